@@ -46,11 +46,26 @@
 #include "amutil.h"
 #include "conffile.h"
 #include "shm-ring.h"
+#ifdef HAVE_SYS_PRCTL_H
+#include <sys/prctl.h>
+#endif
 
 #define	REP_TIMEOUT	(6*60*60)	/* secs for service to reply */
 #define	ACK_TIMEOUT  	10		/* XXX should be configurable */
 #define STDERR_PIPE (DATA_FD_COUNT + 1)
 
+/* the pipe ends a service gets, in service_exec */
+#define SERVICE_FD_STDIN	0
+#define SERVICE_FD_STDOUT	1
+#define SERVICE_FD_STDERR	2
+#define SERVICE_FD_DATA		3	/* read, write for each data stream */
+#define SERVICE_FD_COUNT	(SERVICE_FD_DATA + DATA_FD_COUNT*2)
+
+/* the zygote needs a child subreaper */
+#if defined(PR_SET_CHILD_SUBREAPER) && defined(SOCK_SEQPACKET) && defined(SCM_RIGHTS)
+#define AMANDAD_ZYGOTE 1
+#endif
+
 #define amandad_debug(i, ...) do {	\
 	if ((i) <= debug_amandad) {	\
 		dbprintf(__VA_ARGS__);	\
@@ -157,7 +172,8 @@ struct active_service {
 	shm_ring_t *shm_ring;		/* when reading from shm-ring */
 	struct active_service *as;	/* pointer back to our enclosure */
     } data[DATA_FD_COUNT];
-    char databuf[NETWORK_BLOCK_BYTES];	/* buffer to relay netfd data in */
+    char *databuf;			/* buffer to relay netfd data in */
+    size_t block_size;			/* its size, negotiated with the server */
 };
 
 /*
@@ -170,6 +186,7 @@ static int exit_on_qlength = 0;
 static char *auth = NULL;
 static kencrypt_type amandad_kencrypt = KENCRYPT_NONE;
 static char *global_error = NULL;
+static int zygote_fd = -1;		/* socket to the zygote */
 
 int main(int argc, char **argv);
 
@@ -191,6 +208,16 @@ static void timeout_repfd(void *);
 static void protocol_recv(void *, pkt_t *, security_status_t);
 static void process_readnetfd(void *);
 static void process_writenetfd(void *, void *, ssize_t);
+static void service_exec(const char *, service_t, const char *,
+			 const char *, int *, gboolean);
+static void service_noop(void);
+#ifdef AMANDAD_ZYGOTE
+static void zygote_start(int, int);
+static void zygote_main(int, int, int);
+static pid_t zygote_fork(const char *, service_t, const char *,
+			 const char *, int *);
+static void zygote_reap_orphans(void);
+#endif
 static struct active_service *service_new(security_handle_t *,
     const char *, service_t, const char *);
 static void service_delete(struct active_service *);
@@ -213,6 +240,7 @@ main(
     int in, out;
     const security_driver_t *secdrv;
     int no_exit = 0;
+    int use_zygote = 0;
     char *pgm = "amandad";		/* in case argv[0] is not set */
 #if defined(USE_REUSEADDR)
     const int on = 1;
@@ -292,6 +320,7 @@ main(
      *
      * We accept	-auth=[authentication type]
      *			-no-exit
+     *			-zygote
      *			-tcp=[port]
      *			-udp=[port]
      * We also add a list of services that amandad can launch
@@ -332,6 +361,15 @@ main(
 	    continue;
 	}
 
+	/*
+	 * If -zygote is specified, fork the services from a zygote
+	 * process started now.
+	 */
+	else if (g_str_equal(argv[i], "-zygote")) {
+	    use_zygote = 1;
+	    continue;
+	}
+
 	/*
 	 * Allow us to directly bind to a udp port for debugging.
 	 * This may only apply to some security types.
@@ -515,6 +553,14 @@ main(
 	if(seteuid((uid_t)0) != 0) { error("Can't set euid to 0"); };
     }
 
+    if (use_zygote) {
+#ifdef AMANDAD_ZYGOTE
+	zygote_start(in, out);
+#else
+	g_debug("the zygote is not supported on this system");
+#endif
+    }
+
     /*
      * Schedule to call protocol_accept() when new security handles
      * are created on stdin.
@@ -553,6 +599,11 @@ exit_check(
     assert(cookie != NULL);
     no_exit = *(int *)cookie;
 
+#ifdef AMANDAD_ZYGOTE
+    if (zygote_fd >= 0)
+	zygote_reap_orphans();
+#endif
+
     /*
      * If things are still running, then don't exit.
      */
@@ -1474,7 +1525,7 @@ process_readnetfd(
     nak.body = NULL;
 
     do {
-	n = read(dh->fd_read, as->databuf, sizeof(as->databuf));
+	n = read(dh->fd_read, as->databuf, as->block_size);
     } while ((n < 0) && ((errno == EINTR) || (errno == EAGAIN)));
 
     /*
@@ -1579,7 +1630,13 @@ shm_ring_thread(
     gpointer cookie)
 {
     struct datafd_handle *dh = cookie;
-    shm_ring_consumer_set_size(dh->shm_ring, NETWORK_BLOCK_BYTES*8, NETWORK_BLOCK_BYTES);
+    if (dh->netfd) {
+	shm_ring_consumer_set_futex(dh->shm_ring);
+	if (getconf_boolean(CNF_ZEROCOPY))
+	    shm_ring_consumer_set_zerocopy(dh->shm_ring);
+    }
+    shm_ring_consumer_set_size(dh->shm_ring, dh->as->block_size*8,
+			       dh->as->block_size);
     if (dh->netfd) {
 	shm_ring_to_security_stream(dh->shm_ring, dh->netfd, NULL);
     }
@@ -1698,13 +1755,11 @@ service_new(
     int i;
     int data_read[DATA_FD_COUNT + 2][2];
     int data_write[DATA_FD_COUNT + 2][2];
+    int child_fds[SERVICE_FD_COUNT];
     struct active_service *as;
     pid_t pid;
-    int newfd;
     char *peer_name;
-    char *amanda_remote_host_env[2];
-    char **env;
-    char **service_argv;
+    const char *shm_name = NULL;
 
     assert(security_handle != NULL);
     assert(cmd != NULL);
@@ -1737,6 +1792,7 @@ service_new(
     as->cmd = g_strdup(cmd);
     as->arguments = g_strdup(arguments);
     as->send_partial_reply = 0;
+    as->block_size = NETWORK_BLOCK_BYTES;
 
     if (service == SERVICE_SENDSIZE) {
 	g_option_t *g_options;
@@ -1761,6 +1817,7 @@ service_new(
 	if (p) *p = '\0';
 
 	g_options = parse_g_options(option_str, 1);
+	as->block_size = am_network_block_size(g_options->features);
 	as->data_shm_control_name = g_strdup(g_options->data_shm_control_name);
 	if (!as->data_shm_control_name) {
 	    char *errmsg = NULL;
@@ -1772,8 +1829,35 @@ service_new(
 	free_g_options(g_options);
 	amfree(option_str);
     }
+    as->databuf = g_malloc(as->block_size);
 
-    switch(pid = fork()) {
+    if (as->data_shm_control_name) {
+	shm_name = as->data_shm_control_name;
+    } else if (as->shm_ring && as->shm_ring->shm_control_name) {
+	shm_name = as->shm_ring->shm_control_name;
+    }
+
+    /* the far ends of our pipes */
+    child_fds[SERVICE_FD_STDIN] = data_read[0][0];
+    child_fds[SERVICE_FD_STDOUT] = data_write[0][1];
+    child_fds[SERVICE_FD_STDERR] = data_write[STDERR_PIPE][1];
+    for (i = 0; i < DATA_FD_COUNT; i++) {
+	child_fds[SERVICE_FD_DATA + i*2] = data_read[i + 1][1];
+	child_fds[SERVICE_FD_DATA + i*2 + 1] = data_write[i + 1][0];
+    }
+
+    pid = -1;
+#ifdef AMANDAD_ZYGOTE
+    if (zygote_fd >= 0) {
+	peer_name = security_get_authenticated_peer_name(security_handle);
+	pid = zygote_fork(cmd, service, shm_name, peer_name, child_fds);
+	amfree(peer_name);
+    }
+#endif
+    if (pid < 0)
+	pid = fork();
+
+    switch(pid) {
     case -1:
 	error(_("could not fork service %s: %s\n"), cmd, strerror(errno));
 	/*NOTREACHED*/
@@ -1834,137 +1918,422 @@ service_new(
 	return (as);
     case 0:
 	/*
-	 * The child.  Put our pipes in their advertised locations
-	 * and start up.
+	 * The child.  Close the near ends of our pipes and start up.
 	 */
+	aclose(data_read[0][1]);
+	aclose(data_write[0][0]);
+	for (i = 0; i < DATA_FD_COUNT; i++) {
+	    aclose(data_read[i + 1][0]);
+	    aclose(data_write[i + 1][1]);
+	}
+	aclose(data_write[STDERR_PIPE][0]);
 
-	/* set up the AMANDA_AUTHENTICATED_PEER env var so child services
-	 * can use it to authenticate */
 	peer_name = security_get_authenticated_peer_name(security_handle);
-	amanda_remote_host_env[0] = NULL;
-	amanda_remote_host_env[1] = NULL;
-	if (*peer_name) {
-	    amanda_remote_host_env[0] =
-		g_strdup_printf("AMANDA_AUTHENTICATED_PEER=%s", peer_name);
+	service_exec(cmd, service, shm_name, peer_name, child_fds, FALSE);
+	/*NOTREACHED*/
+    }
+    return NULL;
+}
+
+/*
+ * Run a service in a new child: put its pipes, given by the SERVICE_FD_*
+ * indexes of fds, in their advertised locations and exec it.  A worker
+ * forked by the zygote runs the noop service in-process.
+ */
+static void
+service_exec(
+    const char *cmd,
+    service_t	service,
+    const char *shm_name,
+    const char *peer_name,
+    int	       *fds,
+    gboolean	in_process)
+{
+    int i;
+    int newfd;
+    char *amanda_remote_host_env[2];
+    char **env;
+    char **service_argv;
+
+    /* set up the AMANDA_AUTHENTICATED_PEER env var so child services
+     * can use it to authenticate */
+    amanda_remote_host_env[0] = NULL;
+    amanda_remote_host_env[1] = NULL;
+    if (peer_name && *peer_name) {
+	amanda_remote_host_env[0] =
+	    g_strdup_printf("AMANDA_AUTHENTICATED_PEER=%s", peer_name);
+    }
+
+    /*
+     * The data stream is stdin in the new process
+     */
+    if (dup2(fds[SERVICE_FD_STDIN], 0) < 0) {
+	error(_("dup %d to %d failed: %s\n"), fds[SERVICE_FD_STDIN], 0,
+	    strerror(errno));
+	/*NOTREACHED*/
+    }
+    aclose(fds[SERVICE_FD_STDIN]);
+
+    /*
+     * The reply stream is stdout
+     */
+    if (dup2(fds[SERVICE_FD_STDOUT], 1) < 0) {
+	error(_("dup %d to %d failed: %s\n"), fds[SERVICE_FD_STDOUT], 1,
+	    strerror(errno));
+    }
+    aclose(fds[SERVICE_FD_STDOUT]);
+
+    /*
+     *  Make sure they are not open in the range DATA_FD_OFFSET to
+     *      DATA_FD_OFFSET + DATA_FD_COUNT*2 - 1
+     */
+    for (i = SERVICE_FD_STDERR; i < SERVICE_FD_COUNT; i++) {
+	while(fds[i] >= DATA_FD_OFFSET &&
+	      fds[i] <= DATA_FD_OFFSET + DATA_FD_COUNT*2 - 1) {
+	    newfd = dup(fds[i]);
+	    if(newfd == -1)
+		error(_("Can't dup out off DATA_FD range"));
+	    fds[i] = newfd;
 	}
+    }
 
-	/*
-	 * The data stream is stdin in the new process
-	 */
-        if (dup2(data_read[0][0], 0) < 0) {
-	    error(_("dup %d to %d failed: %s\n"), data_read[0][0], 0,
-		strerror(errno));
-	    /*NOTREACHED*/
+    for (i = 0; i < DATA_FD_COUNT*2; i++)
+	close(DATA_FD_OFFSET + i);
+
+    /*
+     * The rest start at the offset defined in amandad.h, and continue
+     * through the internal defined.
+     */
+    for (i = 0; i < DATA_FD_COUNT*2; i++) {
+	if (dup2(fds[SERVICE_FD_DATA + i], i + DATA_FD_OFFSET) < 0) {
+	    error(_("dup %d to %d failed: %s\n"), fds[SERVICE_FD_DATA + i],
+		i + DATA_FD_OFFSET, strerror(errno));
 	}
-	aclose(data_read[0][0]);
-	aclose(data_read[0][1]);
+	aclose(fds[SERVICE_FD_DATA + i]);
+    }
 
-	/*
-	 * The reply stream is stdout
-	 */
-        if (dup2(data_write[0][1], 1) < 0) {
-	    error(_("dup %d to %d failed: %s\n"), data_write[0][1], 1,
+    service_argv = g_new0(char *, 6);
+    service_argv[0] = g_strdup(cmd);
+    service_argv[1] = g_strdup("amandad");
+    service_argv[2] = g_strdup(auth);
+    if (shm_name) {
+	service_argv[3] = g_strdup("--shm-name");
+	service_argv[4] = g_strdup(shm_name);
+	service_argv[5] = (char *)NULL;
+    } else {
+	service_argv[3] = (char *)NULL;
+    }
+    g_debug("service_argv[0] = %s", service_argv[0]);
+    g_debug("service_argv[1] = %s", service_argv[1]);
+    g_debug("service_argv[2] = %s", service_argv[2]);
+    g_debug("service_argv[3] = %s", service_argv[3]);
+    g_debug("service_argv[4] = %s", service_argv[4]);
+    g_debug("service_argv[5] = %s", service_argv[5]);
+    /* close all unneeded fd */
+    close(STDERR_FILENO);
+    dup2(fds[SERVICE_FD_STDERR], 2);
+    aclose(fds[SERVICE_FD_STDERR]);
+    safe_fd(DATA_FD_OFFSET, DATA_FD_COUNT*2);
+
+    if (in_process && service == SERVICE_NOOP) {
+	service_noop();
+	_exit(0);
+    }
+
+    env = safe_env_full(amanda_remote_host_env);
+    execve(cmd, service_argv, env);
+    error(_("could not exec service %s: %s\n"), cmd, strerror(errno));
+    free_env(env);
+    /*NOTREACHED*/
+}
+
+/*
+ * The noop service, as client-src/noop.c: send back our features.
+ */
+static void
+service_noop(void)
+{
+    char ch;
+    am_feature_t *our_features;
+    char *our_feature_string;
+    char *options;
+    ssize_t n;
+
+    do {
+	/* soak up any stdin */
+	n = read(0, &ch, 1);
+    } while ((n > 0) || ((n < 0) && ((errno == EINTR) || (errno == EAGAIN))));
+    our_features = am_init_feature_set();
+    our_feature_string = am_feature_to_string(our_features);
+    options = g_strjoin(NULL, "OPTIONS features=",
+			our_feature_string,
+			";\n",
+			NULL);
+    amfree(our_feature_string);
+    am_release_feature_set(our_features);
+    if (full_write(1, options, strlen(options)) < strlen(options)) {
+	error(_("error sending noop response: %s"), strerror(errno));
+	/*NOTREACHED*/
+    }
+    amfree(options);
+    close(0);
+    close(1);
+    close(2);
+}
+
+#ifdef AMANDAD_ZYGOTE
+/*
+ * The zygote, started with -zygote, is forked before amandad accepts its
+ * connection; it then forks the service workers on request.  A worker
+ * forked from that small single-threaded process is ready sooner than one
+ * forked from amandad with its security state and shm_ring threads, and
+ * can run the noop service in-process, without an exec.
+ *
+ * amandad sends the SERVICE_FD_* pipes (SCM_RIGHTS) with the service, the
+ * command, the shm_ring name and the peer name; the zygote answers with the
+ * pid of the worker, or -1.  The zygote double-forks, so that the worker is
+ * reparented to amandad, a child subreaper, which waits for it like for a
+ * service it forked itself.
+ */
+#define ZYGOTE_REQUEST_MAX 8192
+
+static void
+zygote_start(
+    int in,
+    int out)
+{
+    int sv[2];
+    pid_t pid;
+
+    if (prctl(PR_SET_CHILD_SUBREAPER, 1) < 0) {
+	g_debug("zygote: prctl(PR_SET_CHILD_SUBREAPER) failed: %s",
 		strerror(errno));
-	}
-        aclose(data_write[0][0]);
-        aclose(data_write[0][1]);
+	return;
+    }
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+	g_debug("zygote: socketpair failed: %s", strerror(errno));
+	return;
+    }
 
-	for (i = 0; i < DATA_FD_COUNT; i++) {
-	    aclose(data_read[i + 1][0]);
-	    aclose(data_write[i + 1][1]);
+    switch (pid = fork()) {
+    case -1:
+	g_debug("zygote: fork failed: %s", strerror(errno));
+	close(sv[0]);
+	close(sv[1]);
+	return;
+
+    case 0:
+	close(sv[0]);
+	zygote_main(sv[1], in, out);
+	/*NOTREACHED*/
+
+    default:
+	close(sv[1]);
+	zygote_fd = sv[0];
+	g_debug("zygote started, pid %d", (int)pid);
+	return;
+    }
+}
+
+static void
+zygote_main(
+    int sock,
+    int in,
+    int out)
+{
+    char buf[ZYGOTE_REQUEST_MAX];
+    char cmsgbuf[CMSG_SPACE(sizeof(int) * SERVICE_FD_COUNT)];
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    int fds[SERVICE_FD_COUNT];
+    int nfds;
+    int devnull;
+    int status_pipe[2];
+    gint32 service;
+    char *cmd, *shm_name, *peer_name;
+    pid_t pid, worker;
+    ssize_t n;
+    int i;
+
+    /* don't keep amandad's connection open */
+    if (in > 2)
+	close(in);
+    if (out > 2 && out != in)
+	close(out);
+    devnull = open("/dev/null", O_RDWR);
+    if (devnull >= 0) {
+	dup2(devnull, 0);
+	dup2(devnull, 1);
+	dup2(devnull, 2);
+	if (devnull > 2)
+	    close(devnull);
+    }
+
+    for (;;) {
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = buf;
+	iov.iov_len = sizeof(buf);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsgbuf;
+	msg.msg_controllen = sizeof(cmsgbuf);
+	n = recvmsg(sock, &msg, 0);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0) {
+	    /* amandad is gone */
+	    _exit(0);
 	}
 
-	/*
-	 *  Make sure they are not open in the range DATA_FD_OFFSET to
-	 *      DATA_FD_OFFSET + DATA_FD_COUNT*2 - 1
-	 */
-	for (i = 0; i < DATA_FD_COUNT; i++) {
-	    while(data_read[i + 1][1] >= DATA_FD_OFFSET &&
-		  data_read[i + 1][1] <= DATA_FD_OFFSET + DATA_FD_COUNT*2 - 1) {
-		newfd = dup(data_read[i + 1][1]);
-		if(newfd == -1)
-		    error(_("Can't dup out off DATA_FD range"));
-		data_read[i + 1][1] = newfd;
+	nfds = 0;
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+	    if (cmsg->cmsg_level == SOL_SOCKET &&
+		cmsg->cmsg_type == SCM_RIGHTS) {
+		nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		if (nfds > SERVICE_FD_COUNT)
+		    nfds = SERVICE_FD_COUNT;
+		memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
 	    }
-	    while(data_write[i + 1][0] >= DATA_FD_OFFSET &&
-		  data_write[i + 1][0] <= DATA_FD_OFFSET + DATA_FD_COUNT*2 - 1) {
-		newfd = dup(data_write[i + 1][0]);
-		if(newfd == -1)
-		    error(_("Can't dup out off DATA_FD range"));
-		data_write[i + 1][0] = newfd;
-	    }
-	}
-	while(data_write[4][0] >= DATA_FD_OFFSET &&
-	      data_write[4][0] <= DATA_FD_OFFSET + DATA_FD_COUNT*2 - 1) {
-	    newfd = dup(data_write[4][0]);
-	    if (newfd == -1)
-		error(_("Can't dup out off DATA_FD range"));
-	    data_write[4][0] = newfd;
 	}
-	while(data_write[4][1] >= DATA_FD_OFFSET &&
-	      data_write[4][1] <= DATA_FD_OFFSET + DATA_FD_COUNT*2 - 1) {
-	    newfd = dup(data_write[4][1]);
-	    if (newfd == -1)
-		error(_("Can't dup out off DATA_FD range"));
-	    data_write[4][1] = newfd;
-	}
-
-	for (i = 0; i < DATA_FD_COUNT*2; i++)
-	    close(DATA_FD_OFFSET + i);
 
-	/*
-	 * The rest start at the offset defined in amandad.h, and continue
-	 * through the internal defined.
-	 */
-	for (i = 0; i < DATA_FD_COUNT; i++) {
-	    if (dup2(data_read[i + 1][1], i*2 + DATA_FD_OFFSET) < 0) {
-		error(_("dup %d to %d failed: %s\n"), data_read[i + 1][1],
-		    i + DATA_FD_OFFSET, strerror(errno));
+	/* service, then the three strings */
+	pid = -1;
+	cmd = shm_name = peer_name = NULL;
+	if (nfds == SERVICE_FD_COUNT && !(msg.msg_flags & (MSG_TRUNC|MSG_CTRUNC)) &&
+	    n > (ssize_t)sizeof(service) && buf[n - 1] == '\0') {
+	    memcpy(&service, buf, sizeof(service));
+	    cmd = buf + sizeof(service);
+	    shm_name = cmd + strlen(cmd) + 1;
+	    if (shm_name < buf + n) {
+		peer_name = shm_name + strlen(shm_name) + 1;
+		if (peer_name >= buf + n)
+		    peer_name = NULL;
 	    }
-	    aclose(data_read[i + 1][1]);
+	}
 
-	    if (dup2(data_write[i + 1][0], i*2 + 1 + DATA_FD_OFFSET) < 0) {
-		error(_("dup %d to %d failed: %s\n"), data_write[i + 1][0],
-		    i + DATA_FD_OFFSET, strerror(errno));
+	if (peer_name && pipe(status_pipe) == 0) {
+	    switch (pid = fork()) {
+	    case -1:
+		break;
+
+	    case 0:
+		close(sock);
+		close(status_pipe[0]);
+		worker = fork();
+		if (worker == 0) {
+		    close(status_pipe[1]);
+		    service_exec(cmd, (service_t)service,
+				 *shm_name ? shm_name : NULL, peer_name, fds,
+				 TRUE);
+		    /*NOTREACHED*/
+		}
+		if (full_write(status_pipe[1], &worker, sizeof(worker)) < sizeof(worker))
+		    _exit(1);
+		_exit(0);
+
+	    default:
+		close(status_pipe[1]);
+		waitpid(pid, NULL, 0);
+		if (full_read(status_pipe[0], &pid, sizeof(pid)) < sizeof(pid))
+		    pid = -1;
+		close(status_pipe[0]);
+		break;
 	    }
-	    aclose(data_write[i + 1][0]);
 	}
 
-	service_argv = g_new0(char *, 6);
-	service_argv[0] = g_strdup(cmd);
-	service_argv[1] = g_strdup("amandad");
-	service_argv[2] = g_strdup(auth);
-	if (as->data_shm_control_name) {
-	    service_argv[3] = g_strdup("--shm-name");
-	    service_argv[4] = g_strdup(as->data_shm_control_name);
-	    service_argv[5] = (char *)NULL;
-	} else if (as->shm_ring && as->shm_ring->shm_control_name) {
-	    service_argv[3] = g_strdup("--shm-name");
-	    service_argv[4] = g_strdup(as->shm_ring->shm_control_name);
-	    service_argv[5] = (char *)NULL;
-	} else {
-	    service_argv[3] = (char *)NULL;
+	for (i = 0; i < nfds; i++)
+	    close(fds[i]);
+	if (send(sock, &pid, sizeof(pid), 0) < 0)
+	    _exit(1);
+    }
+}
+
+/*
+ * Ask the zygote for a worker running cmd.  Returns its pid, or -1 if it
+ * must be forked by amandad.
+ */
+static pid_t
+zygote_fork(
+    const char *cmd,
+    service_t	service,
+    const char *shm_name,
+    const char *peer_name,
+    int	       *fds)
+{
+    GString *req = g_string_new(NULL);
+    char cmsgbuf[CMSG_SPACE(sizeof(int) * SERVICE_FD_COUNT)];
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    gint32 s = service;
+    pid_t pid = -1;
+
+    if (!shm_name)
+	shm_name = "";
+    if (!peer_name)
+	peer_name = "";
+    g_string_append_len(req, (char *)&s, sizeof(s));
+    g_string_append_len(req, cmd, strlen(cmd) + 1);
+    g_string_append_len(req, shm_name, strlen(shm_name) + 1);
+    g_string_append_len(req, peer_name, strlen(peer_name) + 1);
+    if (req->len > ZYGOTE_REQUEST_MAX) {
+	g_string_free(req, TRUE);
+	return -1;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = req->str;
+    iov.iov_len = req->len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsgbuf;
+    msg.msg_controllen = sizeof(cmsgbuf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * SERVICE_FD_COUNT);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * SERVICE_FD_COUNT);
+    msg.msg_controllen = cmsg->cmsg_len;
+
+    if (sendmsg(zygote_fd, &msg, 0) < 0 ||
+	recv(zygote_fd, &pid, sizeof(pid), 0) != sizeof(pid)) {
+	g_debug("zygote: lost the zygote: %s", strerror(errno));
+	aclose(zygote_fd);
+	zygote_fd = -1;
+	pid = -1;
+    }
+    g_string_free(req, TRUE);
+
+    if (pid > 0)
+	g_debug("zygote: service %s is pid %d", cmd, (int)pid);
+    return pid;
+}
+
+/*
+ * As the subreaper, amandad inherits the orphaned processes of its
+ * services; reap them, but leave the services to their own waitpid.
+ */
+static void
+zygote_reap_orphans(void)
+{
+    siginfo_t info;
+    GSList *iter;
+
+    for (;;) {
+	memset(&info, 0, sizeof(info));
+	if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) < 0 ||
+	    info.si_pid == 0)
+	    return;
+	for (iter = serviceq; iter != NULL; iter = g_slist_next(iter)) {
+	    if (((struct active_service *)iter->data)->pid == info.si_pid)
+		return;
 	}
-	g_debug("service_argv[0] = %s", service_argv[0]);
-	g_debug("service_argv[1] = %s", service_argv[1]);
-	g_debug("service_argv[2] = %s", service_argv[2]);
-	g_debug("service_argv[3] = %s", service_argv[3]);
-	g_debug("service_argv[4] = %s", service_argv[4]);
-	g_debug("service_argv[5] = %s", service_argv[5]);
-	/* close all unneeded fd */
-	close(STDERR_FILENO);
-	dup2(data_write[STDERR_PIPE][1], 2);
-        aclose(data_write[STDERR_PIPE][0]);
-        aclose(data_write[STDERR_PIPE][1]);
-	safe_fd(DATA_FD_OFFSET, DATA_FD_COUNT*2);
-	env = safe_env_full(amanda_remote_host_env);
-	execve(cmd, service_argv, env);
-	error(_("could not exec service %s: %s\n"), cmd, strerror(errno));
-	free_env(env);
-	/*NOTREACHED*/
+	waitpid(info.si_pid, NULL, WNOHANG);
     }
-    return NULL;
 }
+#endif
 
 /*
  * Unallocate a service instance
@@ -2078,6 +2447,7 @@ service_delete(
     amfree(as->repbuf);
     as->bufsize = as->repbufsize = 0;
     amfree(as->rep_pkt.body);
+    amfree(as->databuf);
 //    amfree(as);   process_writenetfd can be calledi again, why?
 
     if (exit_on_qlength == 0 && g_slist_length(serviceq) == 0) {
@@ -47,6 +47,8 @@ typedef struct g_option_s {
     char *config;
     char *timestamp;
     char *data_shm_control_name;
+    char *wire_compress;	/* algorithms the server can decompress */
+    off_t resume_offset;	/* bytes of the dump the server already has */
 } g_option_t;
 
 
@@ -48,6 +48,8 @@ init_g_options(
     g_options->config   = NULL;
     g_options->timestamp= NULL;
     g_options->data_shm_control_name   = NULL;
+    g_options->wire_compress   = NULL;
+    g_options->resume_offset   = 0;
 }
 
 
@@ -176,6 +178,19 @@ parse_g_options(
 	    }
 	    g_options->data_shm_control_name = g_strdup(tok+22);
 	}
+	else if(g_str_has_prefix(tok, "wire-compress=")) {
+	    if(g_options->wire_compress != NULL) {
+		dbprintf(_("multiple wire-compress option\n"));
+		if(verbose) {
+		    g_printf(_("ERROR [multiple wire-compress option]\n"));
+		}
+		amfree(g_options->wire_compress);
+	    }
+	    g_options->wire_compress = g_strdup(tok+14);
+	}
+	else if(g_str_has_prefix(tok, "resume-offset=")) {
+	    g_options->resume_offset = (off_t)g_ascii_strtoull(tok+14, NULL, 10);
+	}
 	else {
 	    dbprintf(_("unknown option \"%s\"\n"), tok);
 	    if(verbose) {
@@ -205,6 +220,7 @@ free_g_options(
 	amfree(g_options->config);
 	amfree(g_options->timestamp);
 	amfree(g_options->data_shm_control_name);
+	amfree(g_options->wire_compress);
 	amfree(g_options);
     }
 }
@@ -1089,6 +1089,511 @@ test_header_vers(void)
     return 1;
 }
 
+/****
+ * Test the trailing index
+ */
+
+static void
+write_indexed_archive(
+	char *buf,
+	gsize bufsize,
+	char *bigbuf,
+	gsize bigbuf_size)
+{
+    int fd;
+    amar_t *arch;
+    amar_file_t *af, *af2;
+    amar_attr_t *at, *at2;
+    GError *error = NULL;
+    gboolean ok;
+
+    fd = open_temp(1);
+    arch = amar_new(fd, O_WRONLY, &error);
+    check_gerror(arch, error, "amar_new");
+    amar_enable_index(arch);
+
+    af = amar_new_file(arch, "first", 0, NULL, &error);
+    check_gerror(af, error, "amar_new_file");
+    af2 = amar_new_file(arch, "second", 0, NULL, &error);
+    check_gerror(af2, error, "amar_new_file");
+
+    /* interleave the two files */
+    at = amar_new_attr(af, 20, &error);
+    check_gerror(at, error, "amar_new_attr");
+    at2 = amar_new_attr(af2, 20, &error);
+    check_gerror(at2, error, "amar_new_attr");
+    ok = amar_attr_add_data_buffer(at, buf, bufsize, 0, &error);
+    check_gerror(ok, error, "amar_attr_add_data_buffer");
+    ok = amar_attr_add_data_buffer(at2, buf, 100, 0, &error);
+    check_gerror(ok, error, "amar_attr_add_data_buffer");
+    ok = amar_attr_add_data_buffer(at, buf, 13, 1, &error);
+    check_gerror(ok, error, "amar_attr_add_data_buffer");
+    ok = amar_attr_add_data_buffer(at2, buf+100, 13, 1, &error);
+    check_gerror(ok, error, "amar_attr_add_data_buffer");
+    ok = amar_attr_close(at, &error);
+    check_gerror(ok, error, "amar_attr_close");
+    ok = amar_attr_close(at2, &error);
+    check_gerror(ok, error, "amar_attr_close");
+
+    /* a multi-record attribute, which the index stores as one extent */
+    at2 = amar_new_attr(af2, 21, &error);
+    check_gerror(at2, error, "amar_new_attr");
+    ok = amar_attr_add_data_buffer(at2, bigbuf, bigbuf_size, 1, &error);
+    check_gerror(ok, error, "amar_attr_add_data_buffer");
+    ok = amar_attr_close(at2, &error);
+    check_gerror(ok, error, "amar_attr_close");
+
+    ok = amar_file_close(af, &error);
+    check_gerror(ok, error, "amar_file_close");
+    ok = amar_file_close(af2, &error);
+    check_gerror(ok, error, "amar_file_close");
+
+    ok = amar_close(arch, &error);
+    check_gerror(ok, error, "amar_close");
+    close(fd);
+}
+
+static void
+try_reading_indexed(
+	expected_step_t *steps,
+	amar_attr_handling_t *handling,
+	char *filename)
+{
+    amar_t *ar;
+    expected_state_t state = { steps, 0 };
+    guint16 filenum;
+    GError *error = NULL;
+    gboolean ok;
+    int fd;
+
+    fd = open_temp(0);
+    ar = amar_new(fd, O_RDONLY, &error);
+    check_gerror(ar, error, "amar_new");
+    ok = amar_load_index(ar, &error);
+    check_gerror(ok, error, "amar_load_index");
+
+    if (amar_index_lookup(ar, "no-such-file", 0, &filenum))
+	EXPECT_FAILURE("found nonexistent file %d in the index", (int)filenum);
+    if (!amar_index_lookup(ar, filename, 0, &filenum))
+	EXPECT_FAILURE("file '%s' is not in the index", filename);
+
+    ok = amar_read_file(ar, filenum, &state, handling, file_start_cb,
+			file_finish_cb, &error);
+    check_gerror(ok, error, "amar_read_file");
+    if (steps[state.curstep].kind != EXP_END)
+	EXPECT_FAILURE("Stopped reading early at step %d", state.curstep);
+
+    ok = amar_close(ar, &error);
+    check_gerror(ok, error, "amar_close");
+    close(fd);
+}
+
+static int
+test_index(void)
+{
+    char buf[16300];
+    char *bigbuf;
+    const size_t max_record_data_size = 4*1024*1024;
+    size_t bigbuf_size = max_record_data_size + 1274;
+    simpleprng_state_t prng;
+    gsize i;
+    int fd;
+
+    for (i = 0; i < sizeof(buf); i++)
+	buf[i] = i % 251;
+
+    bigbuf = g_malloc(bigbuf_size);
+    simpleprng_seed(&prng, 0x1de8);
+    simpleprng_fill_buffer(&prng, bigbuf, bigbuf_size);
+
+    write_indexed_archive(buf, sizeof(buf), bigbuf, bigbuf_size);
+
+    /* a sequential reader sees the files, but not the index */
+    {
+	amar_attr_handling_t handling[] = {
+	    { 0, 0, frag_cb, NULL },
+	};
+	expected_step_t steps[] = {
+	    EXPECT_START_FILE_STR(1, "first", 0),
+	    EXPECT_START_FILE_STR(2, "second", 0),
+	    EXPECT_ATTR_DATA_MULTIPART(1, 20, buf, sizeof(buf), 0, 0),
+	    EXPECT_ATTR_DATA_MULTIPART(2, 20, buf, 100, 0, 0),
+	    EXPECT_ATTR_DATA_MULTIPART(1, 20, buf, 13, 1, 0),
+	    EXPECT_ATTR_DATA_MULTIPART(2, 20, buf+100, 13, 1, 0),
+	    EXPECT_ATTR_DATA_MULTIPART(2, 21, bigbuf, max_record_data_size, 0, 0),
+	    EXPECT_ATTR_DATA_MULTIPART(2, 21, bigbuf+max_record_data_size, bigbuf_size-max_record_data_size, 1, 0),
+	    EXPECT_FINISH_FILE(1, 0),
+	    EXPECT_FINISH_FILE(2, 0),
+	    EXPECT_END(),
+	};
+	try_reading(steps, handling);
+    }
+
+    /* reading one file only sees that file, with attributes reassembled */
+    {
+	amar_attr_handling_t handling[] = {
+	    { 20, 256, frag_cb, NULL },
+	    { 0, 0, frag_cb, NULL },
+	};
+	expected_step_t steps[] = {
+	    EXPECT_START_FILE_STR(2, "second", 0),
+	    EXPECT_ATTR_DATA(2, 20, buf, 113, 1, 0),
+	    EXPECT_ATTR_DATA_MULTIPART(2, 21, bigbuf, max_record_data_size, 0, 0),
+	    EXPECT_ATTR_DATA_MULTIPART(2, 21, bigbuf+max_record_data_size, bigbuf_size-max_record_data_size, 1, 0),
+	    EXPECT_FINISH_FILE(2, 0),
+	    EXPECT_END(),
+	};
+	try_reading_indexed(steps, handling, "second");
+    }
+
+    /* the trailer is still found after the archive has been padded */
+    fd = open(temp_filename, O_WRONLY|O_APPEND);
+    g_assert(fd >= 0);
+    bzero(buf, sizeof(buf));
+    g_assert(full_write(fd, buf, 1000) == 1000);
+    close(fd);
+
+    {
+	amar_attr_handling_t handling[] = {
+	    { 20, 0, NULL, NULL }, /* ignore this attribute */
+	    { 0, 0, frag_cb, NULL },
+	};
+	expected_step_t steps[] = {
+	    EXPECT_START_FILE_STR(1, "first", 0),
+	    EXPECT_FINISH_FILE(1, 0),
+	    EXPECT_END(),
+	};
+	try_reading_indexed(steps, handling, "first");
+    }
+
+    g_free(bigbuf);
+    return 1;
+}
+
+static int
+test_no_index(void)
+{
+    int fd;
+    amar_t *ar;
+    GError *error = NULL;
+    gboolean ok;
+
+    fd = open_temp(1);
+    WRITE_HEADER(fd, 1);
+    WRITE_RECORD_STR(fd, 1, AMAR_ATTR_FILENAME, 1, "/first/filename");
+    WRITE_RECORD_STR(fd, 1, 18, 1, "eighteen");
+    WRITE_RECORD_STR(fd, 1, AMAR_ATTR_EOF, 1, "");
+    close(fd);
+
+    fd = open_temp(0);
+    ar = amar_new(fd, O_RDONLY, &error);
+    check_gerror(ar, error, "amar_new");
+    ok = amar_load_index(ar, &error);
+    check_gerror_matches(ok, error, "Archive has no index", "amar_load_index");
+    amar_close(ar, NULL);
+    close(fd);
+
+    return 1;
+}
+
+/* feed several attributes from pipes at once */
+
+#define N_STREAMS 4
+
+typedef struct {
+    GByteArray *data[N_STREAMS];
+    gboolean eoa[N_STREAMS];
+} streams_state_t;
+
+/* stream i is attribute 20+i of file 1 + i%2 */
+static gboolean
+streams_frag_cb(
+	gpointer user_data,
+	uint16_t filenum,
+	gpointer file_data G_GNUC_UNUSED,
+	uint16_t attrid,
+	gpointer attrid_data G_GNUC_UNUSED,
+	gpointer *attr_data G_GNUC_UNUSED,
+	gpointer data,
+	gsize datasize,
+	gboolean eoa,
+	gboolean truncated)
+{
+    streams_state_t *state = user_data;
+    int i = attrid - 20;
+
+    if (i < 0 || i >= N_STREAMS || filenum != 1 + i%2)
+	EXPECT_FAILURE("unexpected data for file %d attribute %d",
+			(int)filenum, (int)attrid);
+    if (truncated || state->eoa[i])
+	EXPECT_FAILURE("bad fragment for attribute %d", (int)attrid);
+
+    g_byte_array_append(state->data[i], data, datasize);
+    state->eoa[i] = eoa;
+
+    return TRUE;
+}
+
+static int
+test_concurrent_fds(void)
+{
+    int fd, i;
+    int p[N_STREAMS][2];
+    size_t sizes[N_STREAMS] = { 5*1024*1024 + 17, 1, 300000, 0 };
+    char *bufs[N_STREAMS];
+    simpleprng_state_t prng;
+    amar_t *arch;
+    amar_file_t *af[2];
+    amar_attr_t *at[N_STREAMS];
+    GError *errors[N_STREAMS];
+    GError *error = NULL;
+    gboolean ok;
+    streams_state_t state;
+    amar_attr_handling_t handling[] = {
+	{ 0, 0, streams_frag_cb, NULL },
+    };
+
+    simpleprng_seed(&prng, 0xc0c0);
+    for (i = 0; i < N_STREAMS; i++) {
+	bufs[i] = g_malloc(sizes[i] + 1);
+	simpleprng_fill_buffer(&prng, bufs[i], sizes[i]);
+    }
+
+    fd = open_temp(1);
+    arch = amar_new(fd, O_WRONLY, &error);
+    check_gerror(arch, error, "amar_new");
+    for (i = 0; i < 2; i++) {
+	char *name = g_strdup_printf("stream-file-%d", i);
+	af[i] = amar_new_file(arch, name, 0, NULL, &error);
+	check_gerror(af[i], error, "amar_new_file");
+	g_free(name);
+    }
+
+    /* a child process writes each stream, while a thread per attribute
+     * adds it to the archive */
+    for (i = 0; i < N_STREAMS; i++) {
+	g_assert(pipe(p[i]) >= 0);
+	switch (fork()) {
+	    case 0: {
+		int j;
+		for (j = 0; j <= i; j++)
+		    close(p[j][0]);
+		g_assert(full_write(p[i][1], bufs[i], sizes[i]) == sizes[i]);
+		exit(0);
+	    }
+
+	    case -1:
+		perror("fork");
+		exit(1);
+
+	    default:
+		close(p[i][1]);
+		break;
+	}
+
+	errors[i] = NULL;
+	at[i] = amar_new_attr(af[i%2], 20 + i, &error);
+	check_gerror(at[i], error, "amar_new_attr");
+	amar_attr_add_data_fd_in_thread(at[i], p[i][0], 1, &errors[i]);
+    }
+
+    for (i = 0; i < N_STREAMS; i++) {
+	int status;
+
+	ok = amar_attr_close(at[i], &error);
+	check_gerror(ok, error, "amar_attr_close");
+	check_gerror(TRUE, errors[i], "amar_attr_add_data_fd_in_thread");
+	(void)wait(&status);
+    }
+    for (i = 0; i < 2; i++) {
+	ok = amar_file_close(af[i], &error);
+	check_gerror(ok, error, "amar_file_close");
+    }
+    ok = amar_close(arch, &error);
+    check_gerror(ok, error, "amar_close");
+    close(fd);
+
+    for (i = 0; i < N_STREAMS; i++) {
+	state.data[i] = g_byte_array_new();
+	state.eoa[i] = FALSE;
+    }
+
+    fd = open_temp(0);
+    arch = amar_new(fd, O_RDONLY, &error);
+    check_gerror(arch, error, "amar_new");
+    ok = amar_read(arch, &state, handling, NULL, NULL, NULL, &error);
+    check_gerror(ok, error, "amar_read");
+    amar_close(arch, NULL);
+    close(fd);
+
+    for (i = 0; i < N_STREAMS; i++) {
+	if (!state.eoa[i])
+	    EXPECT_FAILURE("stream %d did not end", i);
+	if (state.data[i]->len != sizes[i] ||
+	    memcmp(state.data[i]->data, bufs[i], sizes[i]) != 0)
+	    EXPECT_FAILURE("data for stream %d does not match (%u bytes, expected %zu)",
+			    i, state.data[i]->len, sizes[i]);
+	g_byte_array_free(state.data[i], TRUE);
+	g_free(bufs[i]);
+    }
+
+    return 1;
+}
+
+/* amar_read_files calls these from several threads at once */
+
+#define N_INDEX_FILES 40
+
+typedef struct {
+    GMutex *mutex;
+    gsize sizes[N_INDEX_FILES+1];
+    guint32 sums[N_INDEX_FILES+1];
+    int started, finished;
+} threaded_state_t;
+
+static gboolean
+threaded_start_cb(
+	gpointer user_data,
+	uint16_t filenum,
+	gpointer filename G_GNUC_UNUSED,
+	gsize filename_len G_GNUC_UNUSED,
+	gboolean *ignore G_GNUC_UNUSED,
+	gpointer *file_data G_GNUC_UNUSED)
+{
+    threaded_state_t *state = user_data;
+
+    g_assert(filenum >= 1 && filenum <= N_INDEX_FILES);
+    g_mutex_lock(state->mutex);
+    state->started++;
+    g_mutex_unlock(state->mutex);
+
+    return TRUE;
+}
+
+static gboolean
+threaded_finish_cb(
+	gpointer user_data,
+	uint16_t filenum G_GNUC_UNUSED,
+	gpointer *file_data G_GNUC_UNUSED,
+	gboolean truncated)
+{
+    threaded_state_t *state = user_data;
+
+    g_assert(!truncated);
+    g_mutex_lock(state->mutex);
+    state->finished++;
+    g_mutex_unlock(state->mutex);
+
+    return TRUE;
+}
+
+static gboolean
+threaded_frag_cb(
+	gpointer user_data,
+	uint16_t filenum,
+	gpointer file_data G_GNUC_UNUSED,
+	uint16_t attrid G_GNUC_UNUSED,
+	gpointer attrid_data G_GNUC_UNUSED,
+	gpointer *attr_data G_GNUC_UNUSED,
+	gpointer data,
+	gsize datasize,
+	gboolean eoa G_GNUC_UNUSED,
+	gboolean truncated)
+{
+    threaded_state_t *state = user_data;
+    guint32 sum = 0;
+    gsize i;
+
+    g_assert(!truncated);
+    if (!datasize)
+	return TRUE;
+    for (i = 0; i < datasize; i++)
+	sum = sum * 31 + ((guint8 *)data)[i];
+
+    /* each file is only ever read by one thread */
+    state->sizes[filenum] += datasize;
+    state->sums[filenum] = state->sums[filenum] * 7 + sum;
+
+    return TRUE;
+}
+
+static int
+test_index_threads(void)
+{
+    int fd, i;
+    amar_t *arch;
+    amar_file_t *af;
+    amar_attr_t *at;
+    GError *error = NULL;
+    gboolean ok;
+    char buf[4096];
+    simpleprng_state_t prng;
+    threaded_state_t expected, state;
+    amar_attr_handling_t handling[] = {
+	{ 0, 0, threaded_frag_cb, NULL },
+    };
+
+    bzero(&expected, sizeof(expected));
+    bzero(&state, sizeof(state));
+    simpleprng_seed(&prng, 0x7ead);
+
+    fd = open_temp(1);
+    arch = amar_new(fd, O_WRONLY, &error);
+    check_gerror(arch, error, "amar_new");
+    amar_enable_index(arch);
+
+    for (i = 1; i <= N_INDEX_FILES; i++) {
+	char *name = g_strdup_printf("file%d", i);
+	int j;
+
+	af = amar_new_file(arch, name, 0, NULL, &error);
+	check_gerror(af, error, "amar_new_file");
+	g_free(name);
+	at = amar_new_attr(af, AMAR_ATTR_GENERIC_DATA, &error);
+	check_gerror(at, error, "amar_new_attr");
+	for (j = 0; j < i; j++) {
+	    simpleprng_fill_buffer(&prng, buf, sizeof(buf));
+	    ok = amar_attr_add_data_buffer(at, buf, sizeof(buf), 0, &error);
+	    check_gerror(ok, error, "amar_attr_add_data_buffer");
+	    threaded_frag_cb(&expected, i, NULL, 0, NULL, NULL, buf, sizeof(buf), 0, 0);
+	}
+	ok = amar_attr_close(at, &error);
+	check_gerror(ok, error, "amar_attr_close");
+	ok = amar_file_close(af, &error);
+	check_gerror(ok, error, "amar_file_close");
+    }
+
+    ok = amar_close(arch, &error);
+    check_gerror(ok, error, "amar_close");
+    close(fd);
+
+    fd = open_temp(0);
+    arch = amar_new(fd, O_RDONLY, &error);
+    check_gerror(arch, error, "amar_new");
+    ok = amar_load_index(arch, &error);
+    check_gerror(ok, error, "amar_load_index");
+
+    state.mutex = g_mutex_new();
+    ok = amar_read_files(arch, NULL, 0, 4, &state, handling,
+			 threaded_start_cb, threaded_finish_cb, &error);
+    check_gerror(ok, error, "amar_read_files");
+    g_mutex_free(state.mutex);
+
+    if (state.started != N_INDEX_FILES || state.finished != N_INDEX_FILES)
+	EXPECT_FAILURE("started %d and finished %d files; expected %d",
+			state.started, state.finished, N_INDEX_FILES);
+    for (i = 1; i <= N_INDEX_FILES; i++) {
+	if (state.sizes[i] != expected.sizes[i] || state.sums[i] != expected.sums[i])
+	    EXPECT_FAILURE("data for file %d does not match", i);
+    }
+
+    ok = amar_close(arch, &error);
+    check_gerror(ok, error, "amar_close");
+    close(fd);
+
+    return 1;
+}
+
 /****
  * Driver
  */
@@ -1112,6 +1617,10 @@ main(int argc, char **argv)
 	TU_TEST(test_no_header, 90),
 	TU_TEST(test_invalid_eof, 90),
 	TU_TEST(test_header_vers, 90),
+	TU_TEST(test_index, 90),
+	TU_TEST(test_no_index, 90),
+	TU_TEST(test_index_threads, 90),
+	TU_TEST(test_concurrent_fds, 90),
 	TU_END()
     };
 
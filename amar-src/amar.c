@@ -78,6 +78,54 @@ typedef struct record_s {
  * writing straight out of the user's buffers? */
 #define WRITE_BUFFER_SIZE (512*1024)
 
+/* largest record written by splicing; the intermediate pipe is grown to
+ * this size if the kernel allows it */
+#define SPLICE_RECORD_SIZE (1024*1024)
+
+/* The optional trailing index lives in file number 0, which is never
+ * allocated to a user file in an indexed archive.  Readers that do not know
+ * about the index skip these records like any other record for a file with
+ * no filename.  The index data is a sequence of entries:
+ *
+ *   u16 filenum, u16 reserved, u32 filename length, filename,
+ *   u32 extent count, then per extent: u16 attrid, u16 reserved,
+ *   u64 offset, u64 length
+ *
+ * where each extent is a run of consecutive records for one attribute,
+ * measured from the start of the archive and including record headers.  The
+ * index is split across as many records as necessary, and is followed by a
+ * fixed-size trailer record holding the offset of the first index record,
+ * the total size of the archive and INDEX_MAGIC, in that order, so that the
+ * trailer can be found by reading backward from the end of the archive. */
+#define INDEX_FILENUM 0
+#define INDEX_ATTRID 0xfffe
+#define INDEX_TRAILER_ATTRID 0xffff
+#define INDEX_MAGIC "AMARIDX1"
+#define INDEX_MAGIC_SIZE 8
+#define INDEX_TRAILER_DATA_SIZE (16 + INDEX_MAGIC_SIZE)
+#define INDEX_TRAILER_SIZE (RECORD_SIZE + INDEX_TRAILER_DATA_SIZE)
+#define INDEX_FILE_ENTRY_SIZE 12
+#define INDEX_EXTENT_SIZE 20
+
+/* how far back from the end of the file to look for the trailer, allowing for
+ * any NUL padding added by the device the archive was written to */
+#define INDEX_TAIL_SCAN (64*1024)
+
+/* buffer size used by amar_read_file for each file being read */
+#define READ_FILE_BUFFER_SIZE (1024*1024)
+
+typedef struct index_extent_s {
+    guint16  attrid;
+    off_t    offset;
+    off_t    length;
+} index_extent_t;
+
+typedef struct index_file_s {
+    guint16  filenum;
+    GString *filename;
+    GArray  *extents;		/* of index_extent_t */
+} index_file_t;
+
 typedef struct amar_file_attr_handling_s {
     guint16  filenum;
     guint16  attrid;
@@ -123,6 +171,18 @@ struct amar_s {
     size_t buf_len;
     size_t buf_size;
     handling_params_t *hp;
+
+    /* held while writing a record, so that several threads can each feed a
+     * different attribute; protects buf, position and the index */
+    GMutex   *mutex;
+    gboolean  no_splice;	/* splice() to fd failed; copy instead	*/
+
+    /* trailing index; built while writing if amar_enable_index was called,
+     * or filled in by amar_load_index when reading */
+    GPtrArray  *index;		/* index_file_t, in archive order	*/
+    GHashTable *index_by_filenum;
+    GHashTable *index_by_name;
+    off_t       index_base;	/* fd offset of the start of the archive */
 };
 
 struct amar_file_s {
@@ -130,6 +190,7 @@ struct amar_file_s {
     off_t       size;		/* size of the file             */
     gint        filenum;	/* filenum of this file; gint is required by hash table */
     GHashTable  *attributes;	/* all attributes for this file */
+    index_file_t *ixfile;	/* index entry, if the archive is indexed */
 };
 
 struct amar_attr_s {
@@ -149,6 +210,7 @@ struct amar_attr_s {
 
 static gboolean amar_attr_close_no_remove(amar_attr_t *attribute, GError **error);
 static void amar_read_cb(void *cookie);
+static void free_index(amar_t *archive);
 
 GQuark
 amar_error_quark(void)
@@ -181,21 +243,74 @@ write_header(
 	amar_t *archive,
 	GError **error)
 {
+    gboolean rv = TRUE;
+
+    g_mutex_lock(archive->mutex);
+
     /* if it won't fit in the buffer, take the easy way out and flush it */
     if (archive->buf_len + HEADER_SIZE >= WRITE_BUFFER_SIZE - RECORD_SIZE) {
-	if (!flush_buffer(archive, error))
-	    return FALSE;
+	if (!flush_buffer(archive, error)) {
+	    rv = FALSE;
+	    goto out;
+	}
     }
 
     memcpy(archive->buf + archive->buf_len, &archive->hdr, HEADER_SIZE);
     archive->buf_len += HEADER_SIZE;
     archive->position += HEADER_SIZE;
 
-    return TRUE;
+out:
+    g_mutex_unlock(archive->mutex);
+    return rv;
 }
 
+static void
+index_add_record(
+	index_file_t *ixfile,
+	guint16  attrid,
+	off_t    offset,
+	off_t    length)
+{
+    index_extent_t *last = NULL;
+    index_extent_t ext;
+
+    /* extend the previous extent if this record directly follows it */
+    if (ixfile->extents->len) {
+	last = &g_array_index(ixfile->extents, index_extent_t,
+			      ixfile->extents->len - 1);
+	if (last->attrid == attrid && last->offset + last->length == offset) {
+	    last->length += length;
+	    return;
+	}
+    }
+
+    ext.attrid = attrid;
+    ext.offset = offset;
+    ext.length = length;
+    g_array_append_val(ixfile->extents, ext);
+}
+
+/* account for a record of DATA_SIZE bytes about to be written at the current
+ * position; called with archive->mutex held */
+static void
+record_written(
+	amar_t *archive,
+	amar_file_t *file,
+	guint16  attrid,
+	gsize data_size)
+{
+    /* only attribute data is indexed; the reader synthesizes the rest */
+    if (file->ixfile && attrid >= AMAR_ATTR_APP_START)
+	index_add_record(file->ixfile, attrid, archive->position,
+			 RECORD_SIZE + data_size);
+
+    archive->position += data_size + RECORD_SIZE;
+    file->size += data_size + RECORD_SIZE;
+}
+
+/* called with archive->mutex held */
 static gboolean
-write_record(
+write_record_locked(
 	amar_t *archive,
 	amar_file_t *file,
 	guint16  attrid,
@@ -204,6 +319,7 @@ write_record(
 	gsize data_size,
 	GError **error)
 {
+
     /* the buffer always has room for a new record header */
     MKRECORD(archive->buf + archive->buf_len, file->filenum, attrid, data_size, eoa);
     archive->buf_len += RECORD_SIZE;
@@ -231,11 +347,240 @@ write_record(
 	archive->buf_len = 0;
     }
 
-    archive->position += data_size + RECORD_SIZE;
-    file->size += data_size + RECORD_SIZE;
+    record_written(archive, file, attrid, data_size);
     return TRUE;
 }
 
+static gboolean
+write_record(
+	amar_t *archive,
+	amar_file_t *file,
+	guint16  attrid,
+	gboolean eoa,
+	gpointer data,
+	gsize data_size,
+	GError **error)
+{
+    gboolean rv;
+
+    g_mutex_lock(archive->mutex);
+    rv = write_record_locked(archive, file, attrid, eoa, data, data_size, error);
+    g_mutex_unlock(archive->mutex);
+
+    return rv;
+}
+
+#ifdef HAVE_SPLICE
+/* Write a record whose DATA_SIZE bytes of data are waiting in DATA_PIPE,
+ * moving them to the archive with splice().  If the archive fd can't be
+ * spliced to, the data is copied through the write buffer instead, and
+ * archive->no_splice is set. */
+static gboolean
+splice_record(
+	amar_t *archive,
+	amar_file_t *file,
+	guint16  attrid,
+	gboolean eoa,
+	int      data_pipe,
+	gsize    data_size,
+	GError **error)
+{
+    gsize done = 0;
+    gboolean rv = TRUE;
+
+    g_mutex_lock(archive->mutex);
+
+    /* the header goes out with anything already buffered, since the data
+     * must follow it directly */
+    MKRECORD(archive->buf + archive->buf_len, file->filenum, attrid, data_size, eoa);
+    archive->buf_len += RECORD_SIZE;
+    if (!flush_buffer(archive, error)) {
+	rv = FALSE;
+	goto out;
+    }
+
+    while (done < data_size && !archive->no_splice) {
+	ssize_t n = splice(data_pipe, NULL, archive->fd, NULL, data_size - done,
+			   SPLICE_F_MOVE | SPLICE_F_MORE);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+	    g_debug("amar: splice to fd %d not supported: %s", archive->fd,
+		    strerror(errno));
+	    archive->no_splice = TRUE;
+	    break;
+	}
+	if (n <= 0) {
+	    g_set_error(error, amar_error_quark(), errno,
+			"Error writing to amanda archive: %s", strerror(errno));
+	    rv = FALSE;
+	    goto out;
+	}
+	done += n;
+    }
+
+    /* copy whatever could not be spliced */
+    while (done < data_size) {
+	gsize len = MIN(data_size - done, archive->buf_size);
+
+	if (read_fully(data_pipe, archive->buf, len, NULL) < len ||
+	    full_write(archive->fd, archive->buf, len) < len) {
+	    g_set_error(error, amar_error_quark(), errno,
+			"Error writing to amanda archive: %s", strerror(errno));
+	    rv = FALSE;
+	    goto out;
+	}
+	done += len;
+    }
+
+    record_written(archive, file, attrid, data_size);
+
+out:
+    g_mutex_unlock(archive->mutex);
+    return rv;
+}
+#endif
+
+/* big-endian (de)serialization for the index */
+
+static void
+put_u16(guint8 *p, guint16 v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static void
+put_u32(guint8 *p, guint32 v)
+{
+    put_u16(p, v >> 16);
+    put_u16(p + 2, v);
+}
+
+static void
+put_u64(guint8 *p, guint64 v)
+{
+    put_u32(p, v >> 32);
+    put_u32(p + 4, v);
+}
+
+static guint16
+get_u16(const guint8 *p)
+{
+    return ((guint16)p[0] << 8) | p[1];
+}
+
+static guint32
+get_u32(const guint8 *p)
+{
+    return ((guint32)get_u16(p) << 16) | get_u16(p + 2);
+}
+
+static guint64
+get_u64(const guint8 *p)
+{
+    return ((guint64)get_u32(p) << 32) | get_u32(p + 4);
+}
+
+static void
+free_index_file(
+	gpointer data)
+{
+    index_file_t *ixfile = data;
+
+    g_string_free(ixfile->filename, TRUE);
+    g_array_free(ixfile->extents, TRUE);
+    g_free(ixfile);
+}
+
+static void
+free_index(
+	amar_t *archive)
+{
+    guint i;
+
+    if (archive->index_by_filenum)
+	g_hash_table_destroy(archive->index_by_filenum);
+    if (archive->index_by_name)
+	g_hash_table_destroy(archive->index_by_name);
+    if (archive->index) {
+	for (i = 0; i < archive->index->len; i++)
+	    free_index_file(g_ptr_array_index(archive->index, i));
+	g_ptr_array_free(archive->index, TRUE);
+    }
+    archive->index = NULL;
+    archive->index_by_filenum = NULL;
+    archive->index_by_name = NULL;
+}
+
+/* serialize the index and write it, followed by the trailer, at the current
+ * position */
+static gboolean
+write_index(
+	amar_t *archive,
+	GError **error)
+{
+    amar_file_t ixf;
+    GByteArray *data = g_byte_array_new();
+    guint8 entry[INDEX_EXTENT_SIZE];
+    guint8 trailer[INDEX_TRAILER_DATA_SIZE];
+    off_t index_offset = archive->position;
+    gsize done;
+    guint i, j;
+    gboolean success = TRUE;
+
+    for (i = 0; i < archive->index->len; i++) {
+	index_file_t *ixfile = g_ptr_array_index(archive->index, i);
+
+	put_u16(entry, ixfile->filenum);
+	put_u16(entry + 2, 0);
+	put_u32(entry + 4, ixfile->filename->len);
+	g_byte_array_append(data, entry, 8);
+	g_byte_array_append(data, (guint8 *)ixfile->filename->str,
+			    ixfile->filename->len);
+	put_u32(entry, ixfile->extents->len);
+	g_byte_array_append(data, entry, 4);
+
+	for (j = 0; j < ixfile->extents->len; j++) {
+	    index_extent_t *ext = &g_array_index(ixfile->extents, index_extent_t, j);
+
+	    put_u16(entry, ext->attrid);
+	    put_u16(entry + 2, 0);
+	    put_u64(entry + 4, ext->offset);
+	    put_u64(entry + 12, ext->length);
+	    g_byte_array_append(data, entry, INDEX_EXTENT_SIZE);
+	}
+    }
+
+    /* the index records belong to the reserved file number; ixf->ixfile is
+     * NULL, so they are not themselves indexed */
+    bzero(&ixf, sizeof(ixf));
+    ixf.archive = archive;
+    ixf.filenum = INDEX_FILENUM;
+
+    for (done = 0; done < data->len; ) {
+	gsize len = MIN(data->len - done, MAX_RECORD_DATA_SIZE);
+
+	if (!write_record(archive, &ixf, INDEX_ATTRID, done + len == data->len,
+			  data->data + done, len, error)) {
+	    success = FALSE;
+	    goto out;
+	}
+	done += len;
+    }
+
+    put_u64(trailer, index_offset);
+    put_u64(trailer + 8, archive->position + INDEX_TRAILER_SIZE);
+    memcpy(trailer + 16, INDEX_MAGIC, INDEX_MAGIC_SIZE);
+    if (!write_record(archive, &ixf, INDEX_TRAILER_ATTRID, 1,
+		      trailer, INDEX_TRAILER_DATA_SIZE, error))
+	success = FALSE;
+
+out:
+    g_byte_array_free(data, TRUE);
+    return success;
+}
+
 /*
  * Public functions
  */
@@ -260,6 +605,13 @@ amar_new(
     archive->seekable = TRUE; /* assume seekable until lseek() fails */
     archive->files = g_hash_table_new(g_int_hash, g_int_equal);
     archive->buf = NULL;
+    archive->hp = NULL;
+    archive->index = NULL;
+    archive->index_by_filenum = NULL;
+    archive->index_by_name = NULL;
+    archive->index_base = 0;
+    archive->mutex = g_mutex_new();
+    archive->no_splice = FALSE;
 
     if (mode == O_WRONLY) {
 	archive->buf = g_malloc(WRITE_BUFFER_SIZE);
@@ -283,6 +635,17 @@ amar_new(
     return archive;
 }
 
+void
+amar_enable_index(
+    amar_t *archive)
+{
+    g_assert(archive->mode == O_WRONLY);
+    g_assert(archive->maxfilenum == 0);
+
+    if (!archive->index)
+	archive->index = g_ptr_array_new();
+}
+
 gboolean
 amar_close(
     amar_t *archive,
@@ -293,9 +656,14 @@ amar_close(
     /* verify all files are done */
     g_assert(g_hash_table_size(archive->files) == 0);
 
+    if (archive->mode == O_WRONLY && archive->index && !write_index(archive, error))
+	success = FALSE;
+
     if (archive->mode == O_WRONLY && !flush_buffer(archive, error))
 	success = FALSE;
 
+    free_index(archive);
+    g_mutex_free(archive->mutex);
     g_hash_table_destroy(archive->files);
     if (archive->buf) g_free(archive->buf);
     amfree(archive);
@@ -345,6 +713,14 @@ amar_new_file(
 	return NULL;
     }
 
+    /* in an indexed archive, file numbers must stay unique so that the index
+     * is unambiguous */
+    if (archive->index && archive->maxfilenum == G_MAXUINT16) {
+	g_set_error(error, amar_error_quark(), ENOSPC,
+		    "No more file numbers available for an indexed archive");
+	return NULL;
+    }
+
     /* pick a new, unused filenum */
 
     if (g_hash_table_size(archive->files) == 65535) {
@@ -358,8 +734,10 @@ amar_new_file(
 
 	archive->maxfilenum++;
 
-	/* MAGIC_FILENUM can't be used because it matches the header record text */
-	if (archive->maxfilenum == MAGIC_FILENUM) {
+	/* MAGIC_FILENUM can't be used because it matches the header record
+	 * text, and INDEX_FILENUM is reserved for the index */
+	if (archive->maxfilenum == MAGIC_FILENUM ||
+	    archive->maxfilenum == INDEX_FILENUM) {
 	    continue;
 	}
 
@@ -382,6 +760,14 @@ amar_new_file(
     file->attributes = g_hash_table_new_full(g_int_hash, g_int_equal, NULL, g_free);
     g_hash_table_insert(archive->files, &file->filenum, file);
 
+    if (archive->index) {
+	file->ixfile = g_new0(index_file_t, 1);
+	file->ixfile->filenum = file->filenum;
+	file->ixfile->filename = g_string_new_len(filename_buf, filename_len);
+	file->ixfile->extents = g_array_new(FALSE, FALSE, sizeof(index_extent_t));
+	g_ptr_array_add(archive->index, file->ixfile);
+    }
+
     /* record the current position and write a header there, if desired */
     if (header_offset) {
 	*header_offset = archive->position;
@@ -398,6 +784,12 @@ amar_new_file(
 
 error_exit:
     if (file) {
+	if (file->ixfile) {
+	    g_ptr_array_remove(archive->index, file->ixfile);
+	    g_string_free(file->ixfile->filename, TRUE);
+	    g_array_free(file->ixfile->extents, TRUE);
+	    g_free(file->ixfile);
+	}
 	g_hash_table_remove(archive->files, &file->filenum);
 	g_hash_table_destroy(file->attributes);
 	g_free(file);
@@ -602,6 +994,95 @@ amar_attr_add_data_fd_in_thread(
     return 0;
 }
 
+#ifdef HAVE_SPLICE
+/* Like amar_attr_add_data_fd, but the data is moved through a pipe with
+ * splice() rather than read into memory.  Returns -2 if splice can't be used
+ * for this fd, without having consumed any data. */
+static off_t
+add_data_fd_splice(
+    amar_attr_t *attribute,
+    int fd,
+    gboolean eoa,
+    GError **error)
+{
+    amar_file_t *file = attribute->file;
+    amar_t *archive = file->archive;
+    int data_pipe[2];
+    gsize pipe_size = 65536;
+    gboolean first = TRUE;
+    gboolean got_eof = FALSE;
+    int read_error = 0;
+    off_t filesize = 0;
+
+    if (archive->no_splice)
+	return -2;
+
+    if (pipe(data_pipe) < 0)
+	return -2;
+#ifdef F_SETPIPE_SZ
+    {
+	int sz;
+	(void)fcntl(data_pipe[1], F_SETPIPE_SZ, SPLICE_RECORD_SIZE);
+	sz = fcntl(data_pipe[1], F_GETPIPE_SZ);
+	if (sz > 0)
+	    pipe_size = MIN(sz, MAX_RECORD_DATA_SIZE);
+    }
+#endif
+
+    while (!got_eof) {
+	gsize filled = 0;
+
+	/* fill the pipe, so that each record is as large as possible */
+	while (filled < pipe_size) {
+	    ssize_t n = splice(fd, NULL, data_pipe[1], NULL, pipe_size - filled,
+			       SPLICE_F_MOVE | SPLICE_F_MORE);
+	    if (n < 0 && errno == EINTR)
+		continue;
+	    if (n < 0 && first && (errno == EINVAL || errno == ENOSYS)) {
+		close(data_pipe[0]);
+		close(data_pipe[1]);
+		return -2;
+	    }
+	    first = FALSE;
+	    if (n < 0)
+		read_error = errno;
+	    if (n <= 0) {
+		got_eof = TRUE;
+		break;
+	    }
+	    filled += n;
+	}
+
+	/* as in amar_attr_add_data_fd, write everything we read even after
+	 * an error */
+	if (filled || (got_eof && eoa && !read_error)) {
+	    if (!splice_record(archive, file, attribute->attrid,
+			       eoa && got_eof && !read_error,
+			       data_pipe[0], filled, error)) {
+		filesize = -1;
+		break;
+	    }
+	}
+	filesize += filled;
+	attribute->size += filled;
+    }
+
+    close(data_pipe[0]);
+    close(data_pipe[1]);
+
+    if (read_error) {
+	g_set_error(error, amar_error_quark(), read_error,
+	    "Error reading from fd %d: %s", fd, strerror(read_error));
+	filesize = -1;
+    }
+
+    if (filesize != -1)
+	attribute->wrote_eoa = eoa;
+
+    return filesize;
+}
+#endif
+
 static gpointer
 amar_attr_add_data_fd_thread(
     gpointer data)
@@ -630,10 +1111,19 @@ amar_attr_add_data_fd(
     int read_error;
     gboolean short_read;
     off_t filesize = 0;
-    gpointer buf = g_malloc(MAX_RECORD_DATA_SIZE);
+    gpointer buf;
 
     g_assert(!attribute->wrote_eoa);
 
+#ifdef HAVE_SPLICE
+    filesize = add_data_fd_splice(attribute, fd, eoa, error);
+    if (filesize != -2)
+	return filesize;
+    filesize = 0;
+#endif
+
+    buf = g_malloc(MAX_RECORD_DATA_SIZE);
+
     /* read and write until reaching EOF */
     while (1) {
 	/*
@@ -1677,3 +2167,550 @@ void amar_set_error(
     amar_stop_read(archive);
     read_done(archive->hp);
 }
+
+/*
+ * Indexed reading
+ */
+
+typedef struct extent_reader_s {
+    amar_t *archive;
+    gchar  *buf;
+    gsize   buf_size;
+    gsize   buf_len;	/* number of active bytes .. */
+    gsize   buf_offset;	/* ..starting at buf + buf_offset */
+    off_t   next;	/* fd offset of the next byte to read */
+    off_t   remaining;	/* bytes of the extent not yet read */
+} extent_reader_t;
+
+static gboolean
+pread_fully(
+	int fd,
+	gpointer buf,
+	gsize count,
+	off_t offset,
+	GError **error)
+{
+    while (count) {
+	ssize_t n = pread(fd, buf, count, offset);
+
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0) {
+	    if (n == 0)
+		g_set_error(error, amar_error_quark(), EINVAL,
+			    "Unexpected end of archive, position = %lld",
+			    (long long)offset);
+	    else
+		g_set_error(error, amar_error_quark(), errno,
+			    "failed to read archive, position = %lld: %s",
+			    (long long)offset, strerror(errno));
+	    return FALSE;
+	}
+	buf = (gchar *)buf + n;
+	count -= n;
+	offset += n;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+parse_index(
+	amar_t *archive,
+	const guint8 *data,
+	gsize len,
+	off_t index_offset)
+{
+    gsize pos = 0;
+
+    archive->index = g_ptr_array_new();
+    archive->index_by_filenum = g_hash_table_new(g_direct_hash, g_direct_equal);
+    archive->index_by_name = g_hash_table_new((GHashFunc)g_string_hash,
+					      (GEqualFunc)g_string_equal);
+
+    while (pos < len) {
+	index_file_t *ixfile;
+	guint32 name_len, nextents, i;
+
+	if (len - pos < INDEX_FILE_ENTRY_SIZE)
+	    return FALSE;
+	name_len = get_u32(data + pos + 4);
+	if (name_len == 0 || name_len > len - pos - INDEX_FILE_ENTRY_SIZE)
+	    return FALSE;
+	nextents = get_u32(data + pos + 8 + name_len);
+	if (nextents > (len - pos - INDEX_FILE_ENTRY_SIZE - name_len) / INDEX_EXTENT_SIZE)
+	    return FALSE;
+
+	ixfile = g_new0(index_file_t, 1);
+	ixfile->filenum = get_u16(data + pos);
+	ixfile->filename = g_string_new_len((const gchar *)data + pos + 8, name_len);
+	ixfile->extents = g_array_new(FALSE, FALSE, sizeof(index_extent_t));
+	g_ptr_array_add(archive->index, ixfile);
+	pos += INDEX_FILE_ENTRY_SIZE + name_len;
+
+	for (i = 0; i < nextents; i++) {
+	    index_extent_t ext;
+
+	    ext.attrid = get_u16(data + pos);
+	    ext.offset = get_u64(data + pos + 4);
+	    ext.length = get_u64(data + pos + 12);
+	    pos += INDEX_EXTENT_SIZE;
+
+	    /* all indexed data precedes the index itself */
+	    if (ext.offset < 0 || ext.length < (off_t)RECORD_SIZE ||
+		ext.offset > index_offset - ext.length)
+		return FALSE;
+	    g_array_append_val(ixfile->extents, ext);
+	}
+
+	if (ixfile->filenum == INDEX_FILENUM || ixfile->filenum == MAGIC_FILENUM)
+	    return FALSE;
+
+	/* a lookup finds the first file with a given number or name */
+	if (!g_hash_table_lookup(archive->index_by_filenum,
+				 GUINT_TO_POINTER(ixfile->filenum)))
+	    g_hash_table_insert(archive->index_by_filenum,
+				GUINT_TO_POINTER(ixfile->filenum), ixfile);
+	if (!g_hash_table_lookup(archive->index_by_name, ixfile->filename))
+	    g_hash_table_insert(archive->index_by_name, ixfile->filename, ixfile);
+    }
+
+    return TRUE;
+}
+
+gboolean
+amar_load_index(
+	amar_t *archive,
+	GError **error)
+{
+    guint8 *tail = NULL;
+    guint8 *buf = NULL;
+    guint8 *trailer;
+    gsize tail_len, tl, ixlen, pos, out;
+    off_t cur, end, trailer_end;
+    guint64 index_offset, archive_size;
+    guint16 filenum, attrid;
+    guint32 datasize;
+    gboolean eoa;
+    gboolean success = FALSE;
+
+    g_assert(archive->mode == O_RDONLY);
+
+    if (archive->index)
+	return TRUE;
+
+    /* find the end of the archive without disturbing a sequential reader */
+    cur = lseek(archive->fd, 0, SEEK_CUR);
+    end = (cur < 0)? -1 : lseek(archive->fd, 0, SEEK_END);
+    if (end < 0) {
+	g_set_error(error, amar_error_quark(), errno,
+		    "Archive is not seekable: %s", strerror(errno));
+	return FALSE;
+    }
+    lseek(archive->fd, cur, SEEK_SET);
+
+    tail_len = MIN(end, INDEX_TAIL_SCAN);
+    tail = g_malloc(tail_len + 1);
+    if (!pread_fully(archive->fd, tail, tail_len, end - tail_len, error))
+	goto out;
+
+    /* skip any padding, then look for the trailer */
+    for (tl = tail_len; tl > 0 && tail[tl-1] == 0; tl--)
+	;
+    if (tl < INDEX_TRAILER_SIZE)
+	goto no_index;
+    GETRECORD(tail + tl - INDEX_TRAILER_SIZE, filenum, attrid, datasize, eoa);
+    if (filenum != INDEX_FILENUM || attrid != INDEX_TRAILER_ATTRID ||
+	datasize != INDEX_TRAILER_DATA_SIZE ||
+	memcmp(tail + tl - INDEX_MAGIC_SIZE, INDEX_MAGIC, INDEX_MAGIC_SIZE) != 0)
+	goto no_index;
+
+    trailer = tail + tl - INDEX_TRAILER_DATA_SIZE;
+    index_offset = get_u64(trailer);
+    archive_size = get_u64(trailer + 8);
+    trailer_end = end - tail_len + tl;
+    if (archive_size > (guint64)trailer_end ||
+	index_offset > archive_size - INDEX_TRAILER_SIZE)
+	goto corrupt;
+    archive->index_base = trailer_end - archive_size;
+
+    /* read the index records and strip their headers in place */
+    ixlen = archive_size - INDEX_TRAILER_SIZE - index_offset;
+    buf = g_malloc(ixlen + 1);
+    if (!pread_fully(archive->fd, buf, ixlen,
+		     archive->index_base + index_offset, error))
+	goto out;
+
+    for (pos = out = 0; pos < ixlen; ) {
+	if (ixlen - pos < RECORD_SIZE)
+	    goto corrupt;
+	GETRECORD(buf + pos, filenum, attrid, datasize, eoa);
+	if (filenum != INDEX_FILENUM || attrid != INDEX_ATTRID ||
+	    datasize > ixlen - pos - RECORD_SIZE)
+	    goto corrupt;
+	memmove(buf + out, buf + pos + RECORD_SIZE, datasize);
+	out += datasize;
+	pos += RECORD_SIZE + datasize;
+    }
+
+    if (!parse_index(archive, buf, out, index_offset)) {
+	free_index(archive);
+	goto corrupt;
+    }
+
+    success = TRUE;
+    goto out;
+
+no_index:
+    g_set_error(error, amar_error_quark(), ENOENT, "Archive has no index");
+    goto out;
+
+corrupt:
+    g_set_error(error, amar_error_quark(), EINVAL, "Archive index is corrupt");
+
+out:
+    g_free(tail);
+    g_free(buf);
+    return success;
+}
+
+gboolean
+amar_index_lookup(
+	amar_t *archive,
+	gpointer filename_buf,
+	gsize filename_len,
+	guint16 *filenum)
+{
+    GString key;
+    index_file_t *ixfile;
+
+    g_assert(archive->mode == O_RDONLY);
+    g_assert(archive->index != NULL);
+
+    if (!filename_len)
+	filename_len = strlen(filename_buf);
+
+    key.str = filename_buf;
+    key.len = filename_len;
+    key.allocated_len = filename_len;
+    ixfile = g_hash_table_lookup(archive->index_by_name, &key);
+    if (!ixfile)
+	return FALSE;
+
+    *filenum = ixfile->filenum;
+    return TRUE;
+}
+
+/* Ensure that the extent reader's buffer holds at least ATLEAST bytes of the
+ * current extent. */
+static gboolean
+extent_fill(
+	extent_reader_t *er,
+	gsize atleast,
+	GError **error)
+{
+    gsize to_read;
+
+    if (er->buf_len >= atleast)
+	return TRUE;
+
+    if ((off_t)(atleast - er->buf_len) > er->remaining) {
+	g_set_error(error, amar_error_quark(), EINVAL,
+		    "Archive record extends past its index entry, position = %lld",
+		    (long long)(er->next - er->buf_len));
+	return FALSE;
+    }
+
+    if (er->buf_size < atleast) {
+	gchar *newbuf = g_malloc(atleast);
+	memcpy(newbuf, er->buf + er->buf_offset, er->buf_len);
+	g_free(er->buf);
+	er->buf = newbuf;
+	er->buf_size = atleast;
+    } else if (er->buf_offset) {
+	memmove(er->buf, er->buf + er->buf_offset, er->buf_len);
+    }
+    er->buf_offset = 0;
+
+    to_read = MIN((off_t)(er->buf_size - er->buf_len), er->remaining);
+    if (!pread_fully(er->archive->fd, er->buf + er->buf_len, to_read,
+		     er->next, error))
+	return FALSE;
+    er->buf_len += to_read;
+    er->next += to_read;
+    er->remaining -= to_read;
+
+    return TRUE;
+}
+
+/* dispatch one attribute record, as amar_read does */
+static gboolean
+handle_indexed_record(
+	handling_params_t *hp,
+	file_state_t *fs,
+	guint16 attrid,
+	gpointer data,
+	gsize datasize,
+	gboolean eoa)
+{
+    attr_state_t *as = NULL;
+    amar_attr_handling_t *hdl;
+    GSList *iter;
+    gboolean success = TRUE;
+
+    for (iter = fs->attr_states; iter; iter = iter->next) {
+	if (((attr_state_t *)(iter->data))->attrid == attrid) {
+	    as = (attr_state_t *)(iter->data);
+	    break;
+	}
+    }
+
+    if (as) {
+	hdl = as->handling;
+    } else {
+	for (hdl = hp->handling_array; hdl->attrid != 0; hdl++) {
+	    if (hdl->attrid == attrid)
+		break;
+	}
+    }
+
+    /* one-record attributes don't need an attr_state_t */
+    if (eoa && !as) {
+	gpointer tmp = NULL;
+
+	if (!hdl->callback)
+	    return TRUE;
+	return hdl->callback(hp->user_data, fs->filenum, fs->file_data, attrid,
+			     hdl->attrid_data, &tmp, data, datasize, eoa, FALSE);
+    }
+
+    if (!as) {
+	as = g_new0(attr_state_t, 1);
+	as->fd = -1;
+	as->attrid = attrid;
+	as->handling = hdl;
+	fs->attr_states = g_slist_prepend(fs->attr_states, as);
+    }
+
+    if (hdl->callback && !handle_hunk(hp, fs, as, hdl, data, datasize, eoa))
+	return FALSE;
+
+    if (eoa) {
+	success = finish_attr(hp, fs, as, FALSE);
+	fs->attr_states = g_slist_remove(fs->attr_states, as);
+	g_free(as);
+    }
+
+    return success;
+}
+
+static gboolean
+read_indexed_file(
+	index_file_t *ixfile,
+	handling_params_t *hp,
+	extent_reader_t *er,
+	GError **error)
+{
+    file_state_t fs;
+    guint16  filenum;
+    guint16  attrid;
+    guint32  datasize;
+    gboolean eoa;
+    gboolean success = TRUE;
+    guint i;
+
+    bzero(&fs, sizeof(fs));
+    fs.filenum = ixfile->filenum;
+
+    if (hp->file_start_cb &&
+	!hp->file_start_cb(hp->user_data, fs.filenum, ixfile->filename->str,
+			   ixfile->filename->len, &fs.ignore, &fs.file_data))
+	return FALSE;
+    if (fs.ignore)
+	return TRUE;
+
+    for (i = 0; success && i < ixfile->extents->len; i++) {
+	index_extent_t *ext = &g_array_index(ixfile->extents, index_extent_t, i);
+
+	er->next = er->archive->index_base + ext->offset;
+	er->remaining = ext->length;
+	er->buf_len = 0;
+	er->buf_offset = 0;
+
+	while (er->buf_len || er->remaining) {
+	    if (!extent_fill(er, RECORD_SIZE, error)) {
+		success = FALSE;
+		break;
+	    }
+
+	    GETRECORD(er->buf + er->buf_offset, filenum, attrid, datasize, eoa);
+	    if (filenum != fs.filenum || attrid != ext->attrid ||
+		datasize > MAX_RECORD_DATA_SIZE) {
+		g_set_error(error, amar_error_quark(), EINVAL,
+			    "Archive index does not match file %d, position = %lld",
+			    (int)fs.filenum, (long long)(er->next - er->buf_len));
+		success = FALSE;
+		break;
+	    }
+
+	    if (!extent_fill(er, RECORD_SIZE + datasize, error)) {
+		success = FALSE;
+		break;
+	    }
+	    er->buf_offset += RECORD_SIZE;
+	    er->buf_len -= RECORD_SIZE;
+
+	    success = handle_indexed_record(hp, &fs, attrid,
+				er->buf + er->buf_offset, datasize, eoa);
+	    er->buf_offset += datasize;
+	    er->buf_len -= datasize;
+	    if (!success)
+		break;
+	}
+    }
+
+    /* as with amar_read, a file cut short by an error is finished as
+     * truncated */
+    if (success)
+	return finish_file(hp, &fs, FALSE);
+    finish_file(hp, &fs, TRUE);
+    return FALSE;
+}
+
+typedef struct read_files_s {
+    amar_t *archive;
+    GPtrArray *files;		/* index_file_t to read */
+    handling_params_t hp;	/* template for each worker */
+
+    GMutex *mutex;
+    guint next;			/* next entry of files to read */
+    gboolean failed;
+    GError *error;		/* first error seen by any worker */
+} read_files_t;
+
+static gpointer
+read_files_worker(
+	gpointer data)
+{
+    read_files_t *rf = data;
+    handling_params_t hp = rf->hp;
+    extent_reader_t er;
+    GError *error = NULL;
+
+    bzero(&er, sizeof(er));
+    er.archive = rf->archive;
+    er.buf_size = READ_FILE_BUFFER_SIZE;
+    er.buf = g_malloc(er.buf_size);
+    hp.error = &error;
+
+    while (1) {
+	index_file_t *ixfile = NULL;
+
+	g_mutex_lock(rf->mutex);
+	if (!rf->failed && rf->next < rf->files->len)
+	    ixfile = g_ptr_array_index(rf->files, rf->next++);
+	g_mutex_unlock(rf->mutex);
+	if (!ixfile)
+	    break;
+
+	if (!read_indexed_file(ixfile, &hp, &er, &error)) {
+	    g_mutex_lock(rf->mutex);
+	    rf->failed = TRUE;
+	    if (error && !rf->error) {
+		rf->error = error;
+		error = NULL;
+	    }
+	    g_mutex_unlock(rf->mutex);
+	    if (error)
+		g_error_free(error);
+	    break;
+	}
+    }
+
+    g_free(er.buf);
+    return NULL;
+}
+
+gboolean
+amar_read_files(
+	amar_t *archive,
+	guint16 *filenums,
+	gsize nfiles,
+	int nthreads,
+	gpointer user_data,
+	amar_attr_handling_t *handling_array,
+	amar_file_start_callback_t file_start_cb,
+	amar_file_finish_callback_t file_finish_cb,
+	GError **error)
+{
+    read_files_t rf;
+    GThread **threads;
+    gsize i;
+
+    g_assert(archive->mode == O_RDONLY);
+    g_assert(archive->index != NULL);
+
+    bzero(&rf, sizeof(rf));
+    rf.archive = archive;
+    rf.hp.user_data = user_data;
+    rf.hp.handling_array = handling_array;
+    rf.hp.file_start_cb = file_start_cb;
+    rf.hp.file_finish_cb = file_finish_cb;
+
+    /* resolve everything up front, so that a bad file number is reported
+     * before any callbacks are made */
+    if (filenums) {
+	rf.files = g_ptr_array_sized_new(nfiles);
+	for (i = 0; i < nfiles; i++) {
+	    index_file_t *ixfile = g_hash_table_lookup(archive->index_by_filenum,
+					GUINT_TO_POINTER(filenums[i]));
+	    if (!ixfile) {
+		g_set_error(error, amar_error_quark(), ENOENT,
+			    "File %d is not in the archive index", (int)filenums[i]);
+		g_ptr_array_free(rf.files, TRUE);
+		return FALSE;
+	    }
+	    g_ptr_array_add(rf.files, ixfile);
+	}
+    } else {
+	rf.files = g_ptr_array_sized_new(archive->index->len);
+	for (i = 0; i < archive->index->len; i++)
+	    g_ptr_array_add(rf.files, g_ptr_array_index(archive->index, i));
+    }
+
+    nthreads = MAX(1, MIN((gsize)MAX(nthreads, 1), rf.files->len));
+    rf.mutex = g_mutex_new();
+
+    /* the calling thread is one of the workers */
+    threads = g_new0(GThread *, nthreads);
+    for (i = 1; i < (gsize)nthreads; i++)
+	threads[i] = g_thread_create(read_files_worker, &rf, TRUE, NULL);
+    read_files_worker(&rf);
+    for (i = 1; i < (gsize)nthreads; i++) {
+	if (threads[i])
+	    g_thread_join(threads[i]);
+    }
+    g_free(threads);
+
+    g_mutex_free(rf.mutex);
+    g_ptr_array_free(rf.files, TRUE);
+
+    if (rf.error)
+	g_propagate_error(error, rf.error);
+
+    return !rf.failed;
+}
+
+gboolean
+amar_read_file(
+	amar_t *archive,
+	guint16 filenum,
+	gpointer user_data,
+	amar_attr_handling_t *handling_array,
+	amar_file_start_callback_t file_start_cb,
+	amar_file_finish_callback_t file_finish_cb,
+	GError **error)
+{
+    return amar_read_files(archive, &filenum, 1, 1, user_data, handling_array,
+			   file_start_cb, file_finish_cb, error);
+}
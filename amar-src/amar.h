@@ -64,6 +64,13 @@ enum {
  */
 amar_t *amar_new(int fd, mode_t mode, GError **error);
 
+/* Add a trailing index to an archive opened for writing, so that readers can
+ * use amar_read_file and amar_read_files on it.  This must be called before
+ * the first file is added.  The index is written by amar_close, and readers
+ * that do not know about it simply skip it.
+ */
+void amar_enable_index(amar_t *archive);
+
 /* Finish writing to this fd.  All buffers are flushed, but the file descriptor
  * is not closed -- the user must close it. */
 gboolean amar_close(amar_t *archive, GError **error);
@@ -137,7 +144,9 @@ gboolean amar_attr_add_data_buffer(
 
 /* This function reads from the file descriptor 'fd' until EOF and adds
  * the resulting data to the attribute.  The end of the attribute is
- * flagged appropriately if EOA is true.
+ * flagged appropriately if EOA is true.  Where splice() is available, the
+ * data is moved to the archive through a pipe without being copied into
+ * memory.
  *
  * @param attribute: the attribute for the data
  * @param fd: the file descriptor from which to read
@@ -152,7 +161,9 @@ off_t amar_attr_add_data_fd(
 
 /* Same but do it in a new thread
  * Return immediately
- * Caller should not use the archive, next call must be attr->close
+ * Several attributes, of the same or different files, may be fed this way
+ * at once; their records are interleaved in the archive.  The next call on
+ * each such attribute must be attr->close, which waits for the thread.
  */
 off_t amar_attr_add_data_fd_in_thread(
 	    amar_attr_t *attribute,
@@ -311,3 +322,64 @@ void amar_set_error(
     amar_t *archive,
     char *msg);
 
+/* Random access to indexed archives.  These functions need a seekable file
+ * descriptor, read with pread() so that the file offset is not changed, and
+ * do not update amar_size or amar_record.
+ */
+
+/* Load the trailing index of an archive opened for reading.  The archive may
+ * be followed by NUL padding, and may start anywhere in the file.
+ *
+ * @returns: FALSE on error; the error code is ENOENT if the archive has no
+ *	index
+ */
+gboolean amar_load_index(
+	amar_t *archive,
+	GError **error);
+
+/* Find the file number of a file by name in a loaded index.  If filename_len
+ * is zero, its length is calculated with strlen().
+ *
+ * @returns: FALSE if there is no such file
+ */
+gboolean amar_index_lookup(
+	amar_t *archive,
+	gpointer filename_buf,
+	gsize filename_len,
+	guint16 *filenum);
+
+/* Read a single file from an indexed archive, seeking directly to its
+ * records.  The callbacks are called just as amar_read would call them for
+ * this file.
+ *
+ * @returns: FALSE on error or an early exit, otherwise TRUE
+ */
+gboolean amar_read_file(
+	amar_t *archive,
+	guint16 filenum,
+	gpointer user_data,
+	amar_attr_handling_t *handling_array,
+	amar_file_start_callback_t file_start_cb,
+	amar_file_finish_callback_t file_finish_cb,
+	GError **error);
+
+/* Read several files from an indexed archive using up to nthreads threads,
+ * including the calling thread.  If filenums is NULL, every file in the
+ * index is read.  Each file is read entirely by one thread, so the callbacks
+ * for a file are made in order, but callbacks for different files may run
+ * concurrently and must be thread-safe.  After an error or an early exit,
+ * no further files are started.
+ *
+ * @returns: FALSE on error or an early exit, otherwise TRUE
+ */
+gboolean amar_read_files(
+	amar_t *archive,
+	guint16 *filenums,
+	gsize nfiles,
+	int nthreads,
+	gpointer user_data,
+	amar_attr_handling_t *handling_array,
+	amar_file_start_callback_t file_start_cb,
+	amar_file_finish_callback_t file_finish_cb,
+	GError **error);
+
@@ -33,6 +33,8 @@ static struct option long_options[] = {
     {"verbose"         , 0, NULL,  4},
     {"file"            , 1, NULL,  5},
     {"version"         , 0, NULL,  6},
+    {"index"           , 0, NULL,  7},
+    {"threads"         , 1, NULL,  8},
     {NULL, 0, NULL, 0}
 };
 
@@ -40,7 +42,7 @@ static void
 usage(void)
 {
     printf("Usage: amarchiver [--version|--create|--list|--extract] [--verbose]* [--file file]\n");
-    printf("            [filename]*\n");
+    printf("            [--index] [--threads n] [filename]*\n");
     exit(1);
 }
 
@@ -53,7 +55,7 @@ error_exit(const char *action, GError *gerror)
 }
 
 static void
-do_create(char *opt_file, int opt_verbose, int argc, char **argv)
+do_create(char *opt_file, int opt_verbose, int opt_index, int argc, char **argv)
 {
     FILE *output = stdout;
     amar_t *archive;
@@ -75,6 +77,8 @@ do_create(char *opt_file, int opt_verbose, int argc, char **argv)
     archive = amar_new(fd_out, O_WRONLY, &gerror);
     if (!archive)
 	error_exit("amar_new", gerror);
+    if (opt_index)
+	amar_enable_index(archive);
 
     i = 0;
     while (i<argc) {
@@ -249,10 +253,50 @@ extract_frag_cb(
     return TRUE;
 }
 
+/* extract the named files directly, if the archive has an index; returns
+ * FALSE if the archive must be read sequentially instead */
+static gboolean
+extract_indexed(
+	amar_t *archive,
+	struct read_user_data *ud,
+	amar_attr_handling_t *handling,
+	int opt_threads)
+{
+    GError *gerror = NULL;
+    guint16 *filenums;
+    int i, nfiles = 0;
+
+    if (!amar_load_index(archive, &gerror)) {
+	g_clear_error(&gerror);
+	return FALSE;
+    }
+
+    filenums = g_new(guint16, ud->argc);
+    for (i = 0; i < ud->argc; i++) {
+	if (amar_index_lookup(archive, ud->argv[i], 0, &filenums[nfiles]))
+	    nfiles++;
+	else
+	    g_fprintf(stderr, _("'%s' is not in the archive\n"), ud->argv[i]);
+    }
+
+    if (!amar_read_files(archive, filenums, nfiles, opt_threads, ud, handling,
+			 extract_file_start_cb, extract_file_finish_cb, &gerror)) {
+	if (gerror)
+	    error_exit("amar_read_files", gerror);
+	else
+	    /* one of the callbacks already printed an error message */
+	    exit(1);
+    }
+
+    g_free(filenums);
+    return TRUE;
+}
+
 static void
 do_extract(
 	char *opt_file,
 	int opt_verbose,
+	int opt_threads,
 	int argc,
 	char **argv)
 {
@@ -281,6 +325,12 @@ do_extract(
     if (!archive)
 	error_exit("amar_new", gerror);
 
+    /* only a few named files are wanted, so seek to them if possible */
+    if (argc && extract_indexed(archive, &ud, handling, opt_threads)) {
+	amar_close(archive, NULL);
+	return;
+    }
+
 //    if (!amar_read(archive, &ud, handling, extract_file_start_cb,
 //		   extract_file_finish_cb, NULL, &gerror)) {
 //	if (gerror)
@@ -360,6 +410,8 @@ int main(
     int   opt_extract   = 0;
     int   opt_list      = 0;
     int   opt_verbose   = 0;
+    int   opt_index     = 0;
+    int   opt_threads   = 1;
     char *opt_file      = NULL;
 
     glib_init();
@@ -385,6 +437,14 @@ int main(
 	case 6: printf("amarchiver %s\n", VERSION);
 		exit(0);
 		break;
+	case 7: opt_index = 1;
+		break;
+	case 8: opt_threads = atoi(optarg);
+		if (opt_threads < 1) {
+		    g_fprintf(stderr,"--threads must be at least 1\n");
+		    usage();
+		}
+		break;
 	}
     }
     argc -= optind;
@@ -401,9 +461,9 @@ int main(
     }
 
     if (opt_create > 0)
-	do_create(opt_file, opt_verbose, argc, argv);
+	do_create(opt_file, opt_verbose, opt_index, argc, argv);
     else if (opt_extract > 0)
-	do_extract(opt_file, opt_verbose, argc, argv);
+	do_extract(opt_file, opt_verbose, opt_threads, argc, argv);
     else if (opt_list > 0)
 	do_list(opt_file, opt_verbose);
 
@@ -0,0 +1,522 @@
+#!@PERL@
+# Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+# for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+#
+# Contact information: Carbonite Inc., 756 N Pastoria Ave
+# Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
+
+use lib '@amperldir@';
+use strict;
+use warnings;
+use Getopt::Long;
+
+package Amanda::Application::Amblkdiff;
+use base qw(Amanda::Application);
+use IO::Handle;
+use Digest::MD5 qw( md5 );
+use POSIX qw( SEEK_SET SEEK_END );
+use Amanda::Constants;
+use Amanda::Paths;
+use Amanda::Debug qw( :logging );
+use Amanda::Util qw( quote_string );
+
+# The image is a sequence of extents of the device, each one a
+# "<offset> <length>\n" line followed by <length> bytes of data, after a
+# "AMBLKDIFF 1 <blocksize> <size>\n" header and up to an "END\n" line.
+# A level 0 holds all the blocks; a level N the blocks that changed since
+# the lower level, found by comparing the digest of each block with the
+# digests recorded by that level in the state directory.
+
+# the longest extent kept in memory before it is written
+my $MAX_EXTENT = 16 * 1024 * 1024;
+
+sub new {
+    my $class = shift;
+    my ($config, $host, $disk, $device, $level, $index, $message, $collection, $record, $calcsize, $include_list, $exclude_list, $target, $cmd_from_sendbackup, $cmd_to_sendbackup, $server_backup_result, $blocksize, $statedir) = @_;
+    my $self = $class->SUPER::new($config);
+
+    $self->{config}           = $config;
+    $self->{host}             = $host;
+    if (defined $disk) {
+	$self->{disk}         = $disk;
+    } else {
+	$self->{disk}         = $device;
+    }
+    if (defined $device) {
+	$self->{device}       = $device;
+    } else {
+	$self->{device}       = $disk;
+    }
+    $self->{level}            = [ @{$level} ];
+    $self->{index}            = $index;
+    $self->{message}          = $message;
+    $self->{collection}       = $collection;
+    $self->{record}           = $record;
+    $self->{calcsize}         = $calcsize;
+    $self->{exclude_list}     = [ @{$exclude_list} ];
+    $self->{include_list}     = [ @{$include_list} ];
+    $self->{target}           = $target;
+    $self->{cmd_from_sendbackup} = $cmd_from_sendbackup;
+    $self->{cmd_to_sendbackup} = $cmd_to_sendbackup;
+    $self->{server_backup_result} = $server_backup_result;
+    $self->{blocksize}        = $blocksize || 1024 * 1024;
+    $self->{statedir}         = $statedir ||
+				$Amanda::Paths::GNUTAR_LISTED_INCREMENTAL_DIR;
+
+    return $self;
+}
+
+sub command_support {
+    my $self = shift;
+
+    print "CONFIG YES\n";
+    print "HOST YES\n";
+    print "DISK YES\n";
+    print "MAX-LEVEL 99\n";
+    print "INDEX-LINE YES\n";
+    print "INDEX-XML NO\n";
+    print "MESSAGE-LINE YES\n";
+    print "MESSAGE-XML NO\n";
+    print "RECORD YES\n";
+    print "COLLECTION NO\n";
+    print "MULTI-ESTIMATE YES\n";
+    print "CALCSIZE NO\n";
+    print "CLIENT-ESTIMATE YES\n";
+    print "CMD-STREAM YES\n";
+    print "WANT-SERVER-BACKUP-RESULT YES\n";
+}
+
+sub check_options {
+    my $self = shift;
+
+    if ($#{$self->{include_list}} >= 0) {
+	$self->print_to_server("include-list not supported for backup",
+			       $Amanda::Script_App::ERROR);
+    }
+    if ($#{$self->{exclude_list}} >= 0) {
+	$self->print_to_server("exclude-list not supported for backup",
+			       $Amanda::Script_App::ERROR);
+    }
+    if ($self->{target}) {
+	$self->print_to_server("target PROPERTY not supported for backup",
+			       $Amanda::Script_App::ERROR);
+    }
+}
+
+sub command_selfcheck {
+    my $self = shift;
+
+    $self->print_to_server("disk " . quote_string($self->{disk}),
+			   $Amanda::Script_App::GOOD)
+		if defined $self->{disk};
+
+    $self->print_to_server("amblkdiff version " . $Amanda::Constants::VERSION,
+			   $Amanda::Script_App::GOOD);
+
+    $self->print_to_server(quote_string($self->{device}),
+			   $Amanda::Script_App::GOOD)
+		if defined $self->{device};
+
+    if (! -r $self->{device}) {
+	$self->print_to_server("$self->{device} can't be read",
+			       $Amanda::Script_App::ERROR);
+    }
+    if (! -d $self->{statedir} || ! -w $self->{statedir}) {
+	$self->print_to_server("STATEDIR '$self->{statedir}' is not a writable directory",
+			       $Amanda::Script_App::ERROR);
+    }
+    if ($self->{blocksize} !~ /^\d+$/ || $self->{blocksize} < 512) {
+	$self->print_to_server("BLOCKSIZE must be at least 512",
+			       $Amanda::Script_App::ERROR);
+    }
+    $self->check_options();
+}
+
+sub state_filename {
+    my $self = shift;
+    my ($level) = @_;
+
+    return "$self->{statedir}/$self->{host}" .
+	   Amanda::Util::sanitise_filename($self->{disk}) . "_$level.blkdiff";
+}
+
+# The digests of the blocks of the highest level below $level, as one
+# string of 16 bytes per block; undef for a level 0 or when no lower level
+# was recorded with the same block size.
+sub base_digests {
+    my $self = shift;
+    my ($level) = @_;
+
+    for (my $base = $level - 1; $base >= 0; $base--) {
+	my $filename = $self->state_filename($base);
+	open(my $fh, "<", $filename) or next;
+	binmode($fh);
+	my $header = <$fh>;
+	if (!defined $header ||
+	    $header !~ /^AMBLKDIFF 1 (\d+) \d+$/ || $1 != $self->{blocksize}) {
+	    debug("Ignoring '$filename', not made with this BLOCKSIZE");
+	    close($fh);
+	    return undef;
+	}
+	my $digests = do { local $/; <$fh> };
+	close($fh);
+	debug("level $level is relative to '$filename'");
+	return defined $digests ? $digests : '';
+    }
+    return undef;
+}
+
+sub open_device {
+    my $self = shift;
+
+    my $fh;
+    if (!open($fh, "<", $self->{device})) {
+	$self->print_to_server_and_die("Can't open '$self->{device}': $!",
+				       $Amanda::Script_App::ERROR);
+    }
+    binmode($fh);
+    # -s is 0 for a block device
+    my $size = sysseek($fh, 0, SEEK_END);
+    sysseek($fh, 0, SEEK_SET);
+    return ($fh, $size || 0);
+}
+
+# Read the device block by block and call $block_cb->($offset, $data, $digest)
+# for each block, with $digest its digest.
+sub read_blocks {
+    my $self = shift;
+    my ($fh, $block_cb) = @_;
+
+    my $offset = 0;
+    my $buffer;
+    while (1) {
+	my $len = 0;
+	$buffer = '';
+	while ($len < $self->{blocksize}) {
+	    my $s = sysread($fh, $buffer, $self->{blocksize} - $len, $len);
+	    if (!defined $s) {
+		$self->print_to_server_and_die(
+			"Can't read '$self->{device}': $!",
+			$Amanda::Script_App::ERROR);
+	    }
+	    last if $s == 0;
+	    $len += $s;
+	}
+	last if $len == 0;
+	$block_cb->($offset, $buffer, md5($buffer));
+	$offset += $len;
+	last if $len < $self->{blocksize};
+    }
+    return $offset;
+}
+
+sub command_estimate {
+    my $self = shift;
+
+    $self->check_options();
+
+    my ($fh, $devsize) = $self->open_device();
+    my @levels = @{$self->{level}};
+    my %base;
+    my %size;
+    for my $level (@levels) {
+	$base{$level} = $level > 0 ? $self->base_digests($level) : undef;
+	$size{$level} = 0;
+    }
+
+    # one read of the device for all the levels
+    my $block = 0;
+    $self->read_blocks($fh, sub {
+	my ($offset, $data, $digest) = @_;
+	for my $level (@levels) {
+	    my $base = $base{$level};
+	    if (!defined $base || length($base) < ($block + 1) * 16 ||
+		substr($base, $block * 16, 16) ne $digest) {
+		$size{$level} += length($data);
+	    }
+	}
+	$block++;
+    });
+    close($fh);
+
+    for my $level (@levels) {
+	output_size($level, $size{$level});
+    }
+}
+
+sub output_size {
+   my($level) = shift;
+   my($size) = shift;
+   if($size == -1) {
+      print "$level -1 -1\n";
+   }
+   else {
+      my($ksize) = int $size / (1024);
+      $ksize=32 if ($ksize<32);
+      print "$level $ksize 1\n";
+   }
+}
+
+sub command_backup {
+    my $self = shift;
+
+    my $level = $self->{level}[0];
+
+    if (defined($self->{index})) {
+	$self->{'index_out'} = IO::Handle->new_from_fd(4, 'w');
+	$self->{'index_out'} or confess("Could not open index fd");
+    }
+
+    $self->check_options();
+
+    my ($fh, $devsize) = $self->open_device();
+    my $base = $level > 0 ? $self->base_digests($level) : undef;
+
+    my $statefile = $self->state_filename($level);
+    my $state;
+    if ($self->{record}) {
+	if (!open($state, ">", "$statefile.new")) {
+	    $self->print_to_server_and_die("Can't write '$statefile.new': $!",
+					   $Amanda::Script_App::ERROR);
+	}
+	binmode($state);
+	print $state "AMBLKDIFF 1 $self->{blocksize} $devsize\n";
+    }
+
+    my $out = IO::Handle->new_from_fd(fileno(STDOUT), 'w');
+    binmode($out);
+    $out->print("AMBLKDIFF 1 $self->{blocksize} $devsize\n");
+
+    my $size = 0;
+    my $extent_offset;
+    my $extent = '';
+    my $flush = sub {
+	return if !length($extent);
+	$out->print("$extent_offset " . length($extent) . "\n");
+	$out->print($extent);
+	$size += length($extent);
+	$extent = '';
+    };
+
+    my $block = 0;
+    my $changed = 0;
+    $self->read_blocks($fh, sub {
+	my ($offset, $data, $digest) = @_;
+	print $state $digest if $state;
+	if (!defined $base || length($base) < ($block + 1) * 16 ||
+	    substr($base, $block * 16, 16) ne $digest) {
+	    # contiguous changed blocks are written as one extent
+	    $flush->() if length($extent) &&
+			  ($extent_offset + length($extent) != $offset ||
+			   length($extent) >= $MAX_EXTENT);
+	    $extent_offset = $offset if !length($extent);
+	    $extent .= $data;
+	    $changed++;
+	} else {
+	    $flush->();
+	}
+	$block++;
+    });
+    $flush->();
+    $out->print("END\n");
+    close($fh);
+    $out->close();
+    debug("level $level: $changed of $block blocks changed");
+
+    if (defined($self->{index})) {
+	$self->{'index_out'}->print("/\n");
+	$self->{'index_out'}->close;
+    }
+    my $ksize = int($size / 1024);
+    if ($ksize < 32) {
+	$ksize = 32;
+    }
+    print {$self->{mesgout}} "sendbackup: size $ksize\n";
+    $self->{mesgout}->close;
+
+    my $success = 1;
+    if ($self->{'server_backup_result'}) {
+	my $line = $self->{'cmdin'}->getline;
+	chomp $line if defined $line;
+	debug("server_backup_result: " . (defined $line ? $line : "none"));
+	$success = defined $line && $line =~ /^SUCCESS/;
+    }
+
+    if ($state) {
+	if (close($state) && $success) {
+	    rename("$statefile.new", $statefile)
+		or debug("Can't rename '$statefile.new': $!");
+	    # the higher levels are relative to an older state
+	    for (my $l = $level + 1; -e $self->state_filename($l); $l++) {
+		unlink($self->state_filename($l));
+	    }
+	} else {
+	    unlink("$statefile.new");
+	}
+    }
+}
+
+sub command_restore {
+    my $self = shift;
+
+    my $device = $self->{device};
+    if (defined $self->{target}) {
+	$device = $self->{target};
+    } else {
+	chdir(Amanda::Util::get_original_cwd());
+    }
+
+    # include-list and exclude-list are ignored, the complete dle is restored.
+
+    $device = "amblkdiff-restored" if !defined $device;
+    debug("Restoring to $device");
+
+    # the extents of a level N are written over the image restored from
+    # the lower levels
+    my $fd = POSIX::open($device, &POSIX::O_CREAT | &POSIX::O_RDWR, 0600);
+    if (!defined $fd) {
+	$self->print_to_server_and_die("Can't open '$device': $!",
+				       $Amanda::Script_App::ERROR);
+    }
+    my $in = IO::Handle->new_from_fd(fileno(STDIN), 'r');
+    binmode($in);
+
+    my $header = $in->getline;
+    if (!defined $header || $header !~ /^AMBLKDIFF 1 \d+ (\d+)$/) {
+	$self->print_to_server_and_die("Not an amblkdiff image",
+				       $Amanda::Script_App::ERROR);
+    }
+    my $devsize = $1;
+
+    my $ended = 0;
+    while (defined(my $line = $in->getline)) {
+	chomp $line;
+	if ($line eq "END") {
+	    $ended = 1;
+	    last;
+	}
+	my ($offset, $length) = $line =~ /^(\d+) (\d+)$/;
+	if (!defined $length) {
+	    $self->print_to_server_and_die("Bad extent line '$line'",
+					   $Amanda::Script_App::ERROR);
+	}
+	POSIX::lseek($fd, $offset, &POSIX::SEEK_SET);
+	while ($length > 0) {
+	    my $buffer;
+	    my $want = $length > 1048576 ? 1048576 : $length;
+	    my $s = $in->read($buffer, $want);
+	    if (!$s) {
+		$self->print_to_server_and_die("Truncated image",
+					       $Amanda::Script_App::ERROR);
+	    }
+	    Amanda::Util::full_write($fd, $buffer, $s);
+	    $length -= $s;
+	}
+    }
+    if (!$ended) {
+	$self->print_to_server_and_die("Truncated image",
+				       $Amanda::Script_App::ERROR);
+    }
+
+    # a file image takes the size of the device at the time of the dump
+    if (-f $device) {
+	truncate($device, $devsize);
+    }
+    POSIX::close($fd);
+}
+
+sub command_validate {
+    my $self = shift;
+
+    $self->default_validate();
+}
+
+sub command_index {
+    my $self = shift;
+    my $buffer;
+
+    print "/\n";
+
+    do {
+        sysread STDIN, $buffer, 1048576;
+    } while (defined $buffer and length($buffer) > 0);
+}
+
+package main;
+
+sub usage {
+    print <<EOF;
+Usage: amblkdiff <command> --config=<config> --host=<host> --disk=<disk> --device=<device> --level=<level> --index=<yes|no> --message=<text> --collection=<no> --record=<yes|no> --blocksize=<bytes> --statedir=<dir>.
+EOF
+    exit(1);
+}
+
+my $opt_version;
+my $opt_config;
+my $opt_host;
+my $opt_disk;
+my $opt_device;
+my @opt_level;
+my $opt_index;
+my $opt_message;
+my $opt_collection;
+my $opt_record;
+my $opt_calcsize;
+my @opt_include_list;
+my @opt_exclude_list;
+my $opt_target;
+my $opt_cmd_from_sendbackup;
+my $opt_cmd_to_sendbackup;
+my $opt_server_backup_result;
+my $opt_blocksize;
+my $opt_statedir;
+
+my @orig_argv = @ARGV;
+
+Getopt::Long::Configure(qw{bundling});
+GetOptions(
+    'version'            => \$opt_version,
+    'config=s'           => \$opt_config,
+    'host=s'             => \$opt_host,
+    'disk=s'             => \$opt_disk,
+    'device=s'           => \$opt_device,
+    'level=s'            => \@opt_level,
+    'index=s'            => \$opt_index,
+    'message=s'          => \$opt_message,
+    'collection=s'       => \$opt_collection,
+    'record'             => \$opt_record,
+    'calcsize'           => \$opt_calcsize,
+    'include-list=s'     => \@opt_include_list,
+    'exclude-list=s'     => \@opt_exclude_list,
+    'target|directory=s' => \$opt_target,
+    'cmd-from-sendbackup=s'=> \$opt_cmd_from_sendbackup,
+    'cmd-to-sendbackup=s'  => \$opt_cmd_to_sendbackup,
+    'server-backup-result' => \$opt_server_backup_result,
+    'blocksize=s'        => \$opt_blocksize,
+    'statedir=s'         => \$opt_statedir,
+) or usage();
+
+if (defined $opt_version) {
+    print "amblkdiff-" . $Amanda::Constants::VERSION , "\n";
+    exit(0);
+}
+
+my $application = Amanda::Application::Amblkdiff->new($opt_config, $opt_host, $opt_disk, $opt_device, \@opt_level, $opt_index, $opt_message, $opt_collection, $opt_record, $opt_calcsize, \@opt_include_list, \@opt_exclude_list, $opt_target, $opt_cmd_from_sendbackup, $opt_cmd_to_sendbackup, $opt_server_backup_result, $opt_blocksize, $opt_statedir);
+
+Amanda::Debug::debug("Arguments: " . join(' ', @orig_argv));
+
+$application->do($ARGV[0]);
+# NOTREACHED
@@ -59,6 +59,8 @@
  * EXIT-HANDLING   (1=GOOD 2=BAD)
  * TAR-BLOCKSIZE   (default does not add --blocking-factor option,
  *                  using tar's default)
+ * CHANGED-FILE-JOURNAL (no default, the journal of the changed files used
+ *                  instead of walking the tree for the levels > 0)
  * VERBOSE
  */
 
@@ -161,12 +163,15 @@ static void check_no_check_device(void);
 static GPtrArray *amgtar_build_argv(char *gnutar_realpath,
 				application_argument_t *argument,
 				char *incrname, char **file_exclude,
-				char **file_include, int command,
-				messagelist_t *mlist);
+				char **file_include, char *file_journal,
+				int command, messagelist_t *mlist);
+static char *amgtar_journal_list(application_argument_t *argument,
+				 char *incrname, off_t *size);
 static char *command = NULL;
 static char *gnutar_path;
 static char *gnutar_listdir;
 static char *gnutar_target;
+static char *gnutar_changed_journal;
 static int gnutar_onefilesystem;
 static int gnutar_atimepreserve;
 static int gnutar_acls;
@@ -231,6 +236,7 @@ static struct option long_options[] = {
     {"cmd-from-sendbackup=s"  , 1, NULL, 44},
     {"cmd-to-sendbackup=s"    , 1, NULL, 45},
     {"server-backup-result"   , 1, NULL, 46},
+    {"changed-file-journal"   , 1, NULL, 47},
     {NULL, 0, NULL, 0}
 };
 
@@ -369,6 +375,7 @@ main(
 #endif
     gnutar_listdir = NULL;
     gnutar_target = NULL;
+    gnutar_changed_journal = NULL;
     gnutar_onefilesystem = 1;
     gnutar_atimepreserve = 1;
     gnutar_acls = 0;
@@ -592,6 +599,9 @@ main(
 		 break;
 	case 46: argument.server_backup_result = 1;
 		 break;
+	case 47: amfree(gnutar_changed_journal);
+		 gnutar_changed_journal = g_strdup(optarg);
+		 break;
 	case ':':
 	case '?':
 		break;
@@ -770,6 +780,9 @@ main(
     if (gnutar_target) {
 	dbprintf("TARGET %s\n", gnutar_target);
     }
+    if (gnutar_changed_journal) {
+	dbprintf("CHANGED-FILE-JOURNAL %s\n", gnutar_changed_journal);
+    }
     dbprintf("ONE-FILE-SYSTEM %s\n", gnutar_onefilesystem? "yes":"no");
     dbprintf("SPARSE %s\n", gnutar_sparse? "yes":"no");
     dbprintf("NO-UNQUOTE %s\n", gnutar_no_unquote? "yes":"no");
@@ -1119,6 +1132,7 @@ amgtar_estimate(
     GSList    *levels;
     char      *file_exclude = NULL;
     char      *file_include = NULL;
+    char      *file_journal = NULL;
     GString   *strbuf;
     char      *option;
     char      *gnutar_realpath = NULL;
@@ -1203,9 +1217,22 @@ amgtar_estimate(
 	messagelist_t mesglist = NULL;
 	level = GPOINTER_TO_INT(levels->data);
 	incrname = amgtar_get_incrname(argument, level, stdout, CMD_ESTIMATE);
+	if (level > 0 &&
+	    (file_journal = amgtar_journal_list(argument, incrname, &size))) {
+	    /* the size of the changed files, without walking the tree */
+	    dbprintf(_("estimate size for %s level %d: %lld KB (journal)\n"),
+		     qdisk, level, (long long)size);
+	    unlink(incrname);
+	    if (argument->verbose == 0)
+		unlink(file_journal);
+	    amfree(file_journal);
+	    amfree(incrname);
+	    fprintf(stdout, "%d %lld 1\n", level, (long long)size);
+	    continue;
+	}
 	argv_ptr = amgtar_build_argv(gnutar_realpath,
 				     argument, incrname, &file_exclude,
-				     &file_include, CMD_ESTIMATE, &mlist);
+				     &file_include, NULL, CMD_ESTIMATE, &mlist);
 	for (mesglist = mlist; mesglist != NULL; mesglist = mesglist->next){
 	    message_t *message = mesglist->data;
 	    if (message_get_severity(message) > MSG_INFO)
@@ -1378,6 +1405,7 @@ amgtar_backup(
     int        tarpid;
     char      *file_exclude;
     char      *file_include;
+    char      *file_journal = NULL;
     char      *option;
     char      *gnutar_realpath = NULL;
     messagelist_t mlist = NULL;
@@ -1442,9 +1470,12 @@ amgtar_backup(
     incrname = amgtar_get_incrname(argument,
 				   GPOINTER_TO_INT(argument->level->data),
 				   mesgstream, CMD_BACKUP);
+    if (GPOINTER_TO_INT(argument->level->data) > 0)
+	file_journal = amgtar_journal_list(argument, incrname, NULL);
     argv_ptr = amgtar_build_argv(gnutar_realpath,
 				 argument, incrname, &file_exclude,
-				 &file_include, CMD_BACKUP, &mlist);
+				 &file_include, file_journal, CMD_BACKUP,
+				 &mlist);
     for (mesglist = mlist; mesglist != NULL; mesglist = mesglist->next){
 	message_t *message = mesglist->data;
 	if (message_get_severity(message) <= MSG_INFO) {
@@ -1639,10 +1670,13 @@ amgtar_backup(
 	    unlink(file_exclude);
 	if (file_include)
 	    unlink(file_include);
+	if (file_journal)
+	    unlink(file_journal);
     }
 
     amfree(file_exclude);
     amfree(file_include);
+    amfree(file_journal);
     amfree(incrname);
     amfree(qdisk);
     amfree(errmsg);
@@ -2326,6 +2360,234 @@ amgtar_get_incrname(
     return incrname;
 }
 
+/*
+ * The time of the dump that wrote a listed-incremental file, tar dumps
+ * the files changed since then.  0 if the file is empty or unreadable.
+ */
+static time_t
+amgtar_incr_time(
+    char *incrname)
+{
+    char    buf[256];
+    char   *s = buf;
+    int     fd;
+    ssize_t nb;
+
+    if ((fd = open(incrname, O_RDONLY)) == -1)
+	return 0;
+    nb = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (nb <= 0)
+	return 0;
+    buf[nb] = '\0';
+
+    /* formats 1 and 2 start with a "GNU tar-<version>-<format>" line */
+    if (strncmp(s, "GNU tar-", 8) == 0) {
+	if ((s = strchr(s, '\n')) == NULL)
+	    return 0;
+	s++;
+    }
+    return (time_t)strtol(s, NULL, 10);
+}
+
+typedef struct journal_s {
+    FILE       *list;
+    GHashTable *seen;
+    char       *dirname;
+    dev_t       dev;
+    off_t       size;
+} journal_t;
+
+/* Add the entry at REL (relative to the directory dumped, "./..."), and
+ * everything below it if TREE */
+static void
+journal_add(
+    journal_t *journal,
+    char      *rel,
+    gboolean   tree)
+{
+    struct stat st;
+    char *path;
+    char *s;
+
+    if (g_hash_table_lookup(journal->seen, rel))
+	return;
+
+    path = g_strconcat(journal->dirname, rel + 1, NULL);
+    if (lstat(path, &st) == -1 ||
+	(gnutar_onefilesystem && st.st_dev != journal->dev)) {
+	/* removed since, or on another filesystem */
+	g_free(path);
+	return;
+    }
+    if (gnutar_no_unquote && strchr(rel, '\n')) {
+	g_debug("CHANGED-FILE-JOURNAL: can't list '%s' with NO-UNQUOTE", rel);
+	g_free(path);
+	return;
+    }
+    g_hash_table_insert(journal->seen, g_strdup(rel), GINT_TO_POINTER(1));
+
+    /* tar unquotes the names of --files-from */
+    for (s = rel; *s; s++) {
+	if (!gnutar_no_unquote && *s == '\\')
+	    fputs("\\\\", journal->list);
+	else if (!gnutar_no_unquote && *s == '\n')
+	    fputs("\\n", journal->list);
+	else
+	    fputc(*s, journal->list);
+    }
+    fputc('\n', journal->list);
+    journal->size += 512;
+    if (S_ISREG(st.st_mode))
+	journal->size += (st.st_size + 511) / 512 * 512;
+
+    if (tree && S_ISDIR(st.st_mode)) {
+	DIR *dir = opendir(path);
+	struct dirent *entry;
+
+	while (dir && (entry = readdir(dir)) != NULL) {
+	    char *sub;
+
+	    if (is_dot_or_dotdot(entry->d_name))
+		continue;
+	    sub = g_strconcat(rel, "/", entry->d_name, NULL);
+	    journal_add(journal, sub, TRUE);
+	    g_free(sub);
+	}
+	if (dir)
+	    closedir(dir);
+    }
+    g_free(path);
+}
+
+/*
+ * Build, from the CHANGED-FILE-JOURNAL, the list of the entries changed
+ * since the dump that wrote INCRNAME, for a --no-recursion tar.  The
+ * journal is written by a watcher of the filesystem (fanotify, a Lustre
+ * changelog reader, a GPFS policy scan):
+ *
+ *   START <time>	the watcher records all the changes since <time>
+ *   MARK <time>	all the changes until <time> are recorded
+ *   <time> F <path>	the entry at <path> changed
+ *   <time> T <path>	the tree at <path> was created or moved in
+ *
+ * The paths are absolute, or relative to the directory dumped.  Return
+ * NULL, and tar walks the tree, if the journal does not cover the time
+ * since that dump.  The listed-incremental file is left as it is, so that
+ * the next dump that walks the tree holds all the changes since that dump.
+ */
+static char *
+amgtar_journal_list(
+    application_argument_t *argument,
+    char                   *incrname,
+    off_t                  *size)
+{
+    journal_t journal;
+    time_t    since;
+    time_t    start = 0;
+    time_t    mark = 0;
+    FILE     *jfile;
+    char     *listname;
+    char     *line;
+    char      dirname[PATH_MAX];
+    size_t    dirlen;
+    struct stat st;
+
+    if (!gnutar_changed_journal)
+	return NULL;
+    if (argument->dle.include_file || argument->dle.include_list) {
+	g_debug("CHANGED-FILE-JOURNAL is not used with an include");
+	return NULL;
+    }
+    if ((since = amgtar_incr_time(incrname)) == 0) {
+	g_debug("CHANGED-FILE-JOURNAL: no previous dump");
+	return NULL;
+    }
+    if ((jfile = fopen(gnutar_changed_journal, "r")) == NULL) {
+	g_debug("CHANGED-FILE-JOURNAL: can't open '%s': %s",
+		gnutar_changed_journal, strerror(errno));
+	return NULL;
+    }
+
+    canonicalize_pathname(gnutar_target ? gnutar_target : argument->dle.device,
+			  dirname);
+    dirlen = strlen(dirname);
+    while (dirlen > 1 && dirname[dirlen-1] == '/')
+	dirname[--dirlen] = '\0';
+    if (stat(dirname, &st) == -1) {
+	g_debug("CHANGED-FILE-JOURNAL: can't stat '%s': %s", dirname,
+		strerror(errno));
+	fclose(jfile);
+	return NULL;
+    }
+
+    listname = g_strconcat(incrname, ".journal", NULL);
+    journal.list = fopen(listname, "w");
+    if (!journal.list) {
+	g_debug("CHANGED-FILE-JOURNAL: can't write '%s': %s", listname,
+		strerror(errno));
+	g_free(listname);
+	fclose(jfile);
+	return NULL;
+    }
+    journal.seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+					 NULL);
+    journal.dirname = dirname;
+    journal.dev = st.st_dev;
+    journal.size = 0;
+
+    while ((line = pgets(jfile)) != NULL) {
+	long   t;
+	char   kind;
+	int    n = 0;
+	char  *path;
+	char  *rel;
+
+	if (sscanf(line, "START %ld", &t) == 1) {
+	    start = t;
+	} else if (sscanf(line, "MARK %ld", &t) == 1) {
+	    mark = t;
+	} else if (sscanf(line, "%ld %c %n", &t, &kind, &n) == 2 && n > 0 &&
+		   (kind == 'F' || kind == 'T') && t >= since && start &&
+		   start <= since) {
+	    path = line + n;
+	    if (*path == '/' && dirlen == 1) {
+		rel = g_strconcat(".", path, NULL);
+	    } else if (*path == '/') {
+		if (strncmp(path, dirname, dirlen) != 0 ||
+		    (path[dirlen] != '/' && path[dirlen] != '\0')) {
+		    amfree(line);
+		    continue;
+		}
+		rel = g_strconcat(".", path + dirlen, NULL);
+	    } else if (strncmp(path, "./", 2) == 0) {
+		rel = g_strdup(path);
+	    } else {
+		rel = g_strconcat("./", path, NULL);
+	    }
+	    journal_add(&journal, rel, kind == 'T');
+	    g_free(rel);
+	}
+	amfree(line);
+    }
+    fclose(jfile);
+    g_hash_table_destroy(journal.seen);
+
+    if (fclose(journal.list) != 0 || !start || start > since || mark < since) {
+	g_debug("CHANGED-FILE-JOURNAL does not cover the changes since %ld "
+		"(START %ld MARK %ld)", (long)since, (long)start, (long)mark);
+	unlink(listname);
+	g_free(listname);
+	return NULL;
+    }
+
+    g_debug("CHANGED-FILE-JOURNAL: %s lists the changes since %ld",
+	    listname, (long)since);
+    if (size)
+	*size = (journal.size + 1023) / 1024;
+    return listname;
+}
+
 static void
 check_no_check_device(void)
 {
@@ -2367,6 +2629,7 @@ GPtrArray *amgtar_build_argv(
     char  *incrname,
     char **file_exclude,
     char **file_include,
+    char  *file_journal,
     int    command,
     messagelist_t *mlist)
 {
@@ -2420,8 +2683,13 @@ GPtrArray *amgtar_build_argv(
 	g_ptr_array_add(argv_ptr, g_strdup("--selinux"));
     if (gnutar_xattrs)
 	g_ptr_array_add(argv_ptr, g_strdup("--xattrs"));
-    g_ptr_array_add(argv_ptr, g_strdup("--listed-incremental"));
-    g_ptr_array_add(argv_ptr, g_strdup(incrname));
+    if (file_journal) {
+	/* only the entries listed; the listed-incremental file is kept */
+	g_ptr_array_add(argv_ptr, g_strdup("--no-recursion"));
+    } else {
+	g_ptr_array_add(argv_ptr, g_strdup("--listed-incremental"));
+	g_ptr_array_add(argv_ptr, g_strdup(incrname));
+    }
     if (gnutar_sparse) {
 	if (!gnutar_sparse_set) {
 	    char  *gtar_version;
@@ -2476,7 +2744,10 @@ GPtrArray *amgtar_build_argv(
 	g_ptr_array_add(argv_ptr, g_strdup(*file_exclude));
     }
 
-    if (*file_include) {
+    if (file_journal) {
+	g_ptr_array_add(argv_ptr, g_strdup("--files-from"));
+	g_ptr_array_add(argv_ptr, g_strdup(file_journal));
+    } else if (*file_include) {
 	g_ptr_array_add(argv_ptr, g_strdup("--files-from"));
 	g_ptr_array_add(argv_ptr, g_strdup(*file_include));
     }
@@ -0,0 +1,2524 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+/*
+ * amptar writes a GNU tar archive itself, instead of running tar.  The
+ * directory tree is walked in one thread, in the order tar would use, while
+ * a pool of reader threads opens and reads the files ahead of the writer
+ * into a bounded reorder buffer.  On trees of many small files the open and
+ * read latencies overlap instead of adding up.
+ *
+ * The archive uses the GNU format with the --listed-incremental dumpdir
+ * records, and the state kept between levels is a GNU tar snapshot file, so
+ * the dumps are restored with 'tar -xpG', which is what the restore command
+ * runs.
+ *
+ * PROPERTY:
+ *
+ * GNUTAR-PATH     (default GNUTAR), used to restore, validate and index
+ * STATE-DIR       (default $AMDATADIR/amptar)
+ * TARGET (DIRECTORY)  (no default, if set, the backup will be from that
+ *			directory instead of from the --device)
+ * ONE-FILE-SYSTEM (default YES)
+ * READERS         (default 8) number of files read at the same time
+ * READ-AHEAD      (default 64m) bytes of file data read before the writer
+ * INCLUDE-FILE
+ * INCLUDE-LIST
+ * INCLUDE-OPTIONAL
+ * EXCLUDE-FILE
+ * EXCLUDE-LIST
+ * EXCLUDE-OPTIONAL
+ * VERBOSE
+ */
+
+#include "amanda.h"
+#include "match.h"
+#include "pipespawn.h"
+#include "amfeatures.h"
+#include "clock.h"
+#include "amutil.h"
+#include "client_util.h"
+#include "conffile.h"
+#include "getopt.h"
+#include "event.h"
+#include "security-file.h"
+#include "ammessage.h"
+#include "amexec.h"
+#include <pwd.h>
+#include <grp.h>
+
+int debug_application = 1;
+#define application_debug(i, ...) do {	\
+	if ((i) <= debug_application) {	\
+	    g_debug(__VA_ARGS__);	\
+	}				\
+} while (0)
+
+/* tar blocks, and the records the archive is padded to (tar's default
+ * blocking factor of 20) */
+#define TAR_BLOCK_SIZE 512
+#define TAR_RECORD_SIZE (20 * TAR_BLOCK_SIZE)
+
+/* the most a reader prefetches of one file; the writer reads the rest of a
+ * larger file itself */
+#define AMPTAR_PREFETCH_MAX (1024 * 1024)
+
+/* the most entries between the walker and the writer */
+#define AMPTAR_MAX_ENTRIES 8192
+
+#define AMPTAR_WRITE_BUFFER (32 * TAR_RECORD_SIZE)
+
+/* local functions */
+int main(int argc, char **argv);
+
+typedef struct application_argument_s {
+    char      *config;
+    char      *host;
+    int        message;
+    int        collection;
+    GSList    *level;
+    dle_t      dle;
+    int        argc;
+    char     **argv;
+    int        verbose;
+} application_argument_t;
+
+enum { CMD_ESTIMATE, CMD_BACKUP };
+
+static void amptar_support(application_argument_t *argument);
+static void amptar_selfcheck(application_argument_t *argument);
+static void amptar_estimate(application_argument_t *argument);
+static void amptar_backup(application_argument_t *argument);
+static void amptar_restore(application_argument_t *argument);
+static void amptar_validate(application_argument_t *argument);
+static void amptar_index(application_argument_t *argument);
+static void amptar_build_exinclude(dle_t *dle,
+				   int *nb_exclude, char **file_exclude,
+				   int *nb_include, char **file_include,
+				   char *dirname, messagelist_t *mlist);
+static char *command = NULL;
+static char *gnutar_path;
+static char *state_dir;
+static char *amptar_target;
+static int amptar_onefilesystem;
+static guint amptar_readers;
+static gsize amptar_read_ahead;
+static int    amptar_exit_value = 0;
+static FILE  *mesgstream;
+static gboolean restore_ok = TRUE;
+
+static struct option long_options[] = {
+    {"config"          , 1, NULL,  1},
+    {"host"            , 1, NULL,  2},
+    {"disk"            , 1, NULL,  3},
+    {"device"          , 1, NULL,  4},
+    {"level"           , 1, NULL,  5},
+    {"index"           , 1, NULL,  6},
+    {"message"         , 1, NULL,  7},
+    {"collection"      , 0, NULL,  8},
+    {"record"          , 0, NULL,  9},
+    {"gnutar-path"     , 1, NULL, 10},
+    {"state-dir"       , 1, NULL, 11},
+    {"one-file-system" , 1, NULL, 12},
+    {"include-file"    , 1, NULL, 16},
+    {"include-list"    , 1, NULL, 17},
+    {"include-optional", 1, NULL, 18},
+    {"exclude-file"    , 1, NULL, 19},
+    {"exclude-list"    , 1, NULL, 20},
+    {"exclude-optional", 1, NULL, 21},
+    {"directory"       , 1, NULL, 22},
+    {"verbose"         , 1, NULL, 36},
+    {"target"          , 1, NULL, 38},
+    {"readers"         , 1, NULL, 39},
+    {"read-ahead"      , 1, NULL, 40},
+    {NULL, 0, NULL, 0}
+};
+
+static message_t *
+amptar_print_message(
+    message_t *message)
+{
+    if (strcasecmp(command, "selfcheck") == 0) {
+	return print_message(message);
+    }
+    if (message_get_severity(message) <= MSG_INFO) {
+	if (g_str_equal(command, "estimate")) {
+	    fprintf(stdout, "OK %s\n", get_message(message));
+	} else if (g_str_equal(command, "backup")) {
+	    fprintf(mesgstream, "| %s\n", get_message(message));
+	}
+    } else {
+	amptar_exit_value = 1;
+	if (g_str_equal(command, "estimate")) {
+	    fprintf(stdout, "ERROR %s\n", get_message(message));
+	} else if (g_str_equal(command, "backup")) {
+	    fprintf(mesgstream, "sendbackup: error [%s]\n", get_message(message));
+	}
+    }
+    return message;
+}
+
+/* parse a number of bytes with an optional k, m or g suffix; returns
+ * FALSE if STR is not one */
+static gboolean
+parse_size(
+    const char *str,
+    gsize      *size)
+{
+    char *end;
+    guint64 value = g_ascii_strtoull(str, &end, 10);
+
+    if (end == str)
+	return FALSE;
+    switch (g_ascii_tolower(*end)) {
+    case 'g': value *= 1024;
+	      /* fall through */
+    case 'm': value *= 1024;
+	      /* fall through */
+    case 'k': value *= 1024;
+	      end++;
+	      break;
+    case '\0':
+	      break;
+    default:
+	      return FALSE;
+    }
+    if (*end == 'b' || *end == 'B')
+	end++;
+    if (*end != '\0')
+	return FALSE;
+    *size = (gsize)value;
+    return TRUE;
+}
+
+static char *
+escape_tar_glob(
+    char *str,
+    int  *in_argv)
+{
+    char *result = malloc(4*strlen(str)+1);
+    char *r = result;
+    char *s;
+
+    *in_argv = 0;
+    for (s = str; *s != '\0'; s++) {
+	if (*s == '\\') {
+	    char c = *(s+1);
+	    if (c == '\\') {
+		*r++ = '\\';
+		*r++ = '\\';
+		*r++ = '\\';
+		s++;
+	    } else if (c == '?') {
+		*r++ = 127;
+		s++;
+		continue;
+	    } else if (c == 'a') {
+		*r++ = 7;
+		s++;
+		continue;
+	    } else if (c == 'b') {
+		*r++ = 8;
+		s++;
+		continue;
+	    } else if (c == 'f') {
+		*r++ = 12;
+		s++;
+		continue;
+	    } else if (c == 'n') {
+		*r++ = 10;
+		s++;
+		*in_argv = 1;
+		continue;
+	    } else if (c == 'r') {
+		*r++ = 13;
+		s++;
+		*in_argv = 1;
+		continue;
+	    } else if (c == 't') {
+		*r++ = 9;
+		s++;
+		continue;
+	    } else if (c == 'v') {
+		*r++ = 11;
+		s++;
+		continue;
+	    } else if (c >= '0' && c <= '9') {
+		char d = c-'0';
+		s++;
+		c = *(s+1);
+		if (c >= '0' && c <= '9') {
+		    d = (d*8)+(c-'0');
+		    s++;
+		    c = *(s+1);
+		    if (c >= '0' && c <= '9') {
+			d = (d*8)+(c-'0');
+			s++;
+		    }
+		}
+		*r++ = d;
+		continue;
+	    } else {
+		*r++ = '\\';
+	    }
+	} else if (*s == '?') {
+	    *r++ = '\\';
+	    *r++ = '\\';
+	} else if (*s == '*' || *s == '[') {
+	    *r++ = '\\';
+	}
+	*r++ = *s;
+    }
+    *r = '\0';
+
+    return result;
+}
+
+
+int
+main(
+    int		argc,
+    char **	argv)
+{
+    int c;
+    application_argument_t argument;
+    char *amptar_onefilesystem_value = NULL;
+    char *amptar_readers_value = NULL;
+    char *amptar_read_ahead_value = NULL;
+
+#ifdef GNUTAR
+    gnutar_path = g_strdup(GNUTAR);
+#else
+    gnutar_path = NULL;
+#endif
+    state_dir = NULL;
+    amptar_target = NULL;
+    amptar_onefilesystem = 1;
+    amptar_readers = 8;
+    amptar_read_ahead = 64 * 1024 * 1024;
+
+    glib_init();
+
+    /* initialize */
+
+    /*
+     * Configure program for internationalization:
+     *   1) Only set the message locale for now.
+     *   2) Set textdomain for all amanda related programs to "amanda"
+     *      We don't want to be forced to support dozens of message catalogs.
+     */
+    setlocale(LC_MESSAGES, "C");
+    textdomain("amanda");
+
+    if (argc < 2) {
+        printf("ERROR no command given to amptar\n");
+        error(_("No command given to amptar"));
+    }
+
+    /* drop root privileges */
+    if (!set_root_privs(0)) {
+	if (g_str_equal(argv[1], "selfcheck")) {
+	    printf("ERROR amptar must be run setuid root\n");
+	}
+	error(_("amptar must be run setuid root"));
+    }
+
+    safe_fd(3, 2);
+
+    set_pname("amptar");
+    set_pcomponent("application");
+    set_pmodule("amptar");
+
+    /* Don't die when child closes pipe */
+    signal(SIGPIPE, SIG_IGN);
+
+#if defined(USE_DBMALLOC)
+    malloc_size_1 = malloc_inuse(&malloc_hist_1);
+#endif
+
+    add_amanda_log_handler(amanda_log_stderr);
+    add_amanda_log_handler(amanda_log_syslog);
+    dbopen(DBG_SUBDIR_CLIENT);
+    startclock();
+    g_debug(_("version %s"), VERSION);
+
+    config_init(CONFIG_INIT_CLIENT|CONFIG_INIT_GLOBAL, NULL);
+
+    /* parse argument */
+    command = argv[1];
+
+    if (strcasecmp(command,"selfcheck") == 0) {
+	fprintf(stdout, "MESSAGE JSON\n");
+    }
+
+    argument.config     = NULL;
+    argument.host       = NULL;
+    argument.message    = 0;
+    argument.collection = 0;
+    argument.level      = NULL;
+    argument.verbose = 0;
+    init_dle(&argument.dle);
+    argument.dle.record = 0;
+
+    while (1) {
+	int option_index = 0;
+	c = getopt_long (argc, argv, "", long_options, &option_index);
+	if (c == -1) {
+	    break;
+	}
+	switch (c) {
+	case 1: amfree(argument.config);
+		argument.config = g_strdup(optarg);
+		break;
+	case 2: amfree(argument.host);
+		argument.host = g_strdup(optarg);
+		break;
+	case 3: amfree(argument.dle.disk);
+		argument.dle.disk = g_strdup(optarg);
+		break;
+	case 4: amfree(argument.dle.device);
+		argument.dle.device = g_strdup(optarg);
+		break;
+	case 5: argument.level = g_slist_append(argument.level,
+					        GINT_TO_POINTER(atoi(optarg)));
+		break;
+	case 6: argument.dle.create_index = 1;
+		break;
+	case 7: argument.message = 1;
+		break;
+	case 8: argument.collection = 1;
+		break;
+	case 9: argument.dle.record = 1;
+		break;
+	case 10: amfree(gnutar_path);
+		 gnutar_path = g_strdup(optarg);
+		 break;
+	case 11: amfree(state_dir);
+		 state_dir = g_strdup(optarg);
+		 break;
+	case 12: amfree(amptar_onefilesystem_value);
+		 amptar_onefilesystem_value = g_strdup(optarg);
+		 break;
+	case 16: argument.dle.include_file =
+			 append_sl(argument.dle.include_file, optarg);
+		 break;
+	case 17: argument.dle.include_list =
+			 append_sl(argument.dle.include_list, optarg);
+		 break;
+	case 18: argument.dle.include_optional = 1;
+		 break;
+	case 19: argument.dle.exclude_file =
+			 append_sl(argument.dle.exclude_file, optarg);
+		 break;
+	case 20: argument.dle.exclude_list =
+			 append_sl(argument.dle.exclude_list, optarg);
+		 break;
+	case 21: argument.dle.exclude_optional = 1;
+		 break;
+	case 22: amfree(amptar_target);
+		 amptar_target = g_strdup(optarg);
+		 break;
+	case 36: if (strcasecmp(optarg, "YES") == 0)
+		     argument.verbose = 1;
+		 break;
+	case 38: amfree(amptar_target);
+		 amptar_target = g_strdup(optarg);
+		 break;
+	case 39: amfree(amptar_readers_value);
+		 amptar_readers_value = g_strdup(optarg);
+		 break;
+	case 40: amfree(amptar_read_ahead_value);
+		 amptar_read_ahead_value = g_strdup(optarg);
+		 break;
+	case ':':
+	case '?':
+		break;
+	}
+    }
+
+    if (g_str_equal(command, "backup")) {
+	mesgstream = fdopen(3, "w");
+	if (!mesgstream) {
+	    error(_("error mesgstream(%d): %s\n"), 3, strerror(errno));
+	}
+    }
+
+    if (!argument.dle.disk && argument.dle.device)
+	argument.dle.disk = g_strdup(argument.dle.device);
+    if (!argument.dle.device && argument.dle.disk)
+	argument.dle.device = g_strdup(argument.dle.disk);
+
+    if (amptar_onefilesystem_value) {
+	if (strcasecmp(amptar_onefilesystem_value, "NO") == 0) {
+	    amptar_onefilesystem = 0;
+	} else if (strcasecmp(amptar_onefilesystem_value, "YES") == 0) {
+	    amptar_onefilesystem = 1;
+	} else {
+	    delete_message(amptar_print_message(build_message(
+			AMANDA_FILE, __LINE__, 3703007, MSG_ERROR, 4,
+			"value", amptar_onefilesystem_value,
+			"disk", argument.dle.disk,
+			"device", argument.dle.device,
+			"hostname", argument.host)));
+	}
+    }
+
+    if (amptar_readers_value) {
+	char *end;
+	long readers = strtol(amptar_readers_value, &end, 10);
+
+	if (*end == '\0' && readers > 0) {
+	    amptar_readers = readers;
+	} else {
+	    delete_message(amptar_print_message(build_message(
+			AMANDA_FILE, __LINE__, 3703008, MSG_ERROR, 4,
+			"value", amptar_readers_value,
+			"disk", argument.dle.disk,
+			"device", argument.dle.device,
+			"hostname", argument.host)));
+	}
+    }
+
+    if (amptar_read_ahead_value &&
+	!parse_size(amptar_read_ahead_value, &amptar_read_ahead)) {
+	delete_message(amptar_print_message(build_message(
+			AMANDA_FILE, __LINE__, 3703009, MSG_ERROR, 4,
+			"value", amptar_read_ahead_value,
+			"disk", argument.dle.disk,
+			"device", argument.dle.device,
+			"hostname", argument.host)));
+    }
+
+    argument.argc = argc - optind;
+    argument.argv = argv + optind;
+
+    if (argument.config) {
+	config_init(CONFIG_INIT_CLIENT | CONFIG_INIT_EXPLICIT_NAME | CONFIG_INIT_OVERLAY,
+		    argument.config);
+	dbrename(get_config_name(), DBG_SUBDIR_CLIENT);
+    }
+
+    if (config_errors(NULL) >= CFGERR_ERRORS) {
+	g_critical(_("errors processing config file"));
+    }
+
+    if (state_dir && strlen(state_dir) == 0)
+	amfree(state_dir);
+    if (!state_dir) {
+	state_dir = g_strdup_printf("%s/%s", amdatadir, "amptar");
+    }
+
+    if (gnutar_path) {
+	g_debug("GNUTAR-PATH %s", gnutar_path);
+    } else {
+	g_debug("GNUTAR-PATH is not set");
+    }
+    g_debug("STATE-DIR %s", state_dir);
+    if (amptar_target) {
+	g_debug("TARGET %s", amptar_target);
+    }
+    g_debug("ONE-FILE-SYSTEM %s", amptar_onefilesystem? "yes":"no");
+    g_debug("READERS %u", amptar_readers);
+    g_debug("READ-AHEAD %zu", amptar_read_ahead);
+
+    if (g_str_equal(command, "support")) {
+	amptar_support(&argument);
+    } else if (g_str_equal(command, "selfcheck")) {
+	amptar_selfcheck(&argument);
+    } else if (g_str_equal(command, "estimate")) {
+	amptar_estimate(&argument);
+    } else if (g_str_equal(command, "backup")) {
+	amptar_backup(&argument);
+    } else if (g_str_equal(command, "restore")) {
+	amptar_restore(&argument);
+    } else if (g_str_equal(command, "validate")) {
+	amptar_validate(&argument);
+    } else if (g_str_equal(command, "index")) {
+	amptar_index(&argument);
+    } else {
+	g_debug("Unknown command `%s'.", command);
+	fprintf(stderr, "Unknown command `%s'.\n", command);
+	exit (1);
+    }
+
+    g_free(argument.config);
+    g_free(argument.host);
+    g_free(argument.dle.disk);
+    g_free(argument.dle.device);
+    g_slist_free(argument.level);
+    g_free(amptar_onefilesystem_value);
+    g_free(amptar_readers_value);
+    g_free(amptar_read_ahead_value);
+
+    dbclose();
+
+    return amptar_exit_value;
+}
+
+static void
+amptar_support(
+    application_argument_t *argument)
+{
+    (void)argument;
+    fprintf(stdout, "CONFIG YES\n");
+    fprintf(stdout, "HOST YES\n");
+    fprintf(stdout, "DISK YES\n");
+    fprintf(stdout, "MAX-LEVEL 399\n");
+    fprintf(stdout, "INDEX-LINE YES\n");
+    fprintf(stdout, "INDEX-XML NO\n");
+    fprintf(stdout, "MESSAGE-LINE YES\n");
+    fprintf(stdout, "MESSAGE-SELFCHECK-JSON YES\n");
+    fprintf(stdout, "MESSAGE-XML NO\n");
+    fprintf(stdout, "RECORD YES\n");
+    fprintf(stdout, "INCLUDE-FILE YES\n");
+    fprintf(stdout, "INCLUDE-LIST YES\n");
+    fprintf(stdout, "INCLUDE-OPTIONAL YES\n");
+    fprintf(stdout, "EXCLUDE-FILE YES\n");
+    fprintf(stdout, "EXCLUDE-LIST YES\n");
+    fprintf(stdout, "EXCLUDE-OPTIONAL YES\n");
+    fprintf(stdout, "COLLECTION NO\n");
+    fprintf(stdout, "MULTI-ESTIMATE YES\n");
+    fprintf(stdout, "CALCSIZE NO\n");
+    fprintf(stdout, "CLIENT-ESTIMATE YES\n");
+}
+
+static void
+amptar_selfcheck(
+    application_argument_t *argument)
+{
+    messagelist_t mlist = NULL;
+    messagelist_t mesglist = NULL;
+    char *dirname;
+
+    if (argument->dle.disk) {
+	delete_message(amptar_print_message(build_message(
+			AMANDA_FILE, __LINE__, 3703000, MSG_INFO, 3,
+			"disk", argument->dle.disk,
+			"device", argument->dle.device,
+			"hostname", argument->host)));
+    }
+
+    delete_message(amptar_print_message(build_message(
+			AMANDA_FILE, __LINE__, 3703001, MSG_INFO, 4,
+			"version", VERSION,
+			"disk", argument->dle.disk,
+			"device", argument->dle.device,
+			"hostname", argument->host)));
+
+    if (amptar_target) {
+	dirname = amptar_target;
+    } else {
+	dirname = argument->dle.device;
+    }
+
+    amptar_build_exinclude(&argument->dle, NULL, NULL, NULL, NULL,
+			   dirname, &mlist);
+    for (mesglist = mlist; mesglist != NULL; mesglist = mesglist->next){
+	message_t *message = mesglist->data;
+	if (message_get_severity(message) > MSG_INFO)
+	    amptar_print_message(message);
+	delete_message(message);
+    }
+    g_slist_free(mlist);
+
+    delete_message(amptar_print_message(build_message(
+			AMANDA_FILE, __LINE__, 3703004, MSG_INFO, 3,
+			"disk", argument->dle.disk,
+			"device", argument->dle.device,
+			"hostname", argument->host)));
+
+    /* GNU tar is only needed to restore */
+    if (gnutar_path) {
+	char *gnutar_realpath;
+	message_t *message;
+	if ((message = check_exec_for_suid_message("GNUTAR_PATH", gnutar_path, &gnutar_realpath))) {
+	    delete_message(amptar_print_message(message));
+	} else {
+	    message = amptar_print_message(check_file_message(gnutar_path, X_OK));
+	    if (message && message_get_severity(message) <= MSG_INFO) {
+	    } else {
+		char *gtar_version;
+		GPtrArray *argv_ptr = g_ptr_array_new();
+
+		g_ptr_array_add(argv_ptr, gnutar_realpath);
+		g_ptr_array_add(argv_ptr, "--version");
+		g_ptr_array_add(argv_ptr, NULL);
+
+		gtar_version = get_first_line(argv_ptr);
+		if (gtar_version) {
+		    char *gv;
+		    for (gv = gtar_version; *gv && !g_ascii_isdigit(*gv); gv++);
+		    delete_message(amptar_print_message(build_message(
+			AMANDA_FILE, __LINE__, 3703002, MSG_INFO, 4,
+			"gtar-version", gv,
+			"disk", argument->dle.disk,
+			"device", argument->dle.device,
+			"hostname", argument->host)));
+		} else {
+		    delete_message(amptar_print_message(build_message(
+			AMANDA_FILE, __LINE__, 3703003, MSG_ERROR, 4,
+			"gtar-path", gnutar_path,
+			"disk", argument->dle.disk,
+			"device", argument->dle.device,
+			"hostname", argument->host)));
+		}
+
+		g_ptr_array_free(argv_ptr, TRUE);
+		amfree(gtar_version);
+	    }
+	    if (message)
+		delete_message(message);
+	}
+	amfree(gnutar_realpath);
+    } else {
+	delete_message(amptar_print_message(build_message(
+			AMANDA_FILE, __LINE__, 3703005, MSG_WARNING, 3,
+			"disk", argument->dle.disk,
+			"device", argument->dle.device,
+			"hostname", argument->host)));
+    }
+
+    set_root_privs(1);
+    if (state_dir && strlen(state_dir) == 0)
+	state_dir = NULL;
+    if (state_dir) {
+	delete_message(amptar_print_message(check_dir_message(state_dir, R_OK|W_OK)));
+    } else {
+	delete_message(amptar_print_message(build_message(
+                        AMANDA_FILE, __LINE__, 3703020, MSG_ERROR, 3,
+                        "disk", argument->dle.disk,
+                        "device", argument->dle.device,
+                        "hostname", argument->host)));
+    }
+
+    if (amptar_target) {
+	delete_message(amptar_print_message(check_dir_message(amptar_target, R_OK)));
+    } else if (argument->dle.device) {
+	delete_message(amptar_print_message(check_dir_message(argument->dle.device, R_OK)));
+    }
+    set_root_privs(0);
+}
+
+/*
+ * The archive
+ */
+
+typedef enum {
+    ENTRY_MEMBER,	/* a header, and the data of regular files */
+    ENTRY_MESSAGE	/* a line for the message stream, in order */
+} entry_kind_t;
+
+typedef struct entry_s {
+    struct entry_s *next;
+    entry_kind_t kind;
+
+    char *name;		/* "./a/b", with a trailing '/' for directories */
+    char *path;		/* the file to read */
+    char *linkname;	/* of symbolic and hard links */
+    struct stat st;
+    char typeflag;
+    GString *dumpdir;	/* the contents of a 'D' member */
+
+    /* regular files: the first data_len bytes of the file, read by a reader
+     * thread; fd is left open when there is more to read */
+    gboolean read_done;
+    gsize reserved;
+    char *data;
+    gsize data_len;
+    int fd;
+    int read_errno;
+
+    char *message;
+} entry_t;
+
+/* a directory of the previous snapshot */
+typedef struct snapdir_s {
+    gboolean nfs;
+    guint64 dev;
+    guint64 ino;
+} snapdir_t;
+
+typedef struct archive_s {
+    application_argument_t *argument;
+    char *dirname;		/* the top of the tree */
+    char *file_include;	/* the members to archive, or NULL for all */
+    gboolean estimate;
+
+    /* what the previous level saw */
+    gboolean incremental;
+    time_t newer;
+    GHashTable *prev_dirs;	/* name -> snapdir_t */
+
+    /* for this level */
+    time_t start_time;
+    GString *snapshot;
+    dev_t top_dev;
+    tar_matcher_t *exclude;	/* the exclude list, or NULL */
+    GHashTable *hardlinks;	/* "dev:ino" -> archive name */
+    GHashTable *unames;
+    GHashTable *gnames;
+
+    /* between the walker, the readers and the writer; under mutex */
+    GMutex *mutex;
+    GCond *cond;
+    entry_t *head, *tail;
+    guint nentries;
+    gsize reserved;
+    gboolean walk_done;
+    amexec_queue_t *readers;
+
+    /* the writer */
+    char *wbuf;
+    gsize wbuf_len;
+    guint64 written;
+    FILE *indexstream;
+
+    /* estimate */
+    guint64 estimate_size;
+} archive_t;
+
+static void
+free_entry(
+    entry_t *e)
+{
+    if (e->fd >= 0)
+	close(e->fd);
+    g_free(e->name);
+    g_free(e->path);
+    g_free(e->linkname);
+    if (e->dumpdir)
+	g_string_free(e->dumpdir, TRUE);
+    g_free(e->data);
+    g_free(e->message);
+    g_free(e);
+}
+
+static guint64
+round_block(
+    guint64 size)
+{
+    return (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+}
+
+/* the size of the member in the archive, headers included */
+static guint64
+member_size(
+    entry_t *e)
+{
+    guint64 size = TAR_BLOCK_SIZE;
+
+    if (strlen(e->name) >= 100)
+	size += TAR_BLOCK_SIZE + round_block(strlen(e->name) + 1);
+    if (e->linkname && strlen(e->linkname) >= 100)
+	size += TAR_BLOCK_SIZE + round_block(strlen(e->linkname) + 1);
+    if (e->typeflag == '0')
+	size += round_block(e->st.st_size);
+    else if (e->dumpdir)
+	size += round_block(e->dumpdir->len);
+    return size;
+}
+
+/* Read the beginning of a regular file; runs on the reader queue. */
+static void
+read_entry(
+    gpointer data,
+    gpointer user_data)
+{
+    entry_t *e = data;
+    archive_t *ar = user_data;
+    char *buf = NULL;
+    gsize got = 0;
+    int err = 0;
+    int fd;
+
+    fd = open(e->path, O_RDONLY);
+    if (fd < 0) {
+	err = errno;
+    } else {
+	buf = g_malloc(e->reserved);
+	while (got < e->reserved) {
+	    ssize_t n = read(fd, buf + got, e->reserved - got);
+	    if (n < 0) {
+		if (errno == EINTR)
+		    continue;
+		err = errno;
+		break;
+	    }
+	    if (n == 0)
+		break;
+	    got += n;
+	}
+	if (err || got < e->reserved || got >= (gsize)e->st.st_size) {
+	    close(fd);
+	    fd = -1;
+	}
+    }
+
+    g_mutex_lock(ar->mutex);
+    e->data = buf;
+    e->data_len = got;
+    e->fd = fd;
+    e->read_errno = err;
+    e->read_done = TRUE;
+    g_cond_broadcast(ar->cond);
+    g_mutex_unlock(ar->mutex);
+}
+
+/* Hand an entry to the writer, in order.  Blocks while the reorder buffer
+ * is full. */
+static void
+queue_entry(
+    archive_t *ar,
+    entry_t   *e)
+{
+    gboolean need_read;
+
+    if (ar->estimate) {
+	if (e->kind == ENTRY_MEMBER)
+	    ar->estimate_size += member_size(e);
+	free_entry(e);
+	return;
+    }
+
+    if (e->kind == ENTRY_MEMBER && e->typeflag == '0' && e->st.st_size > 0)
+	e->reserved = MIN((guint64)e->st.st_size, AMPTAR_PREFETCH_MAX);
+    else
+	e->read_done = TRUE;
+    need_read = !e->read_done;
+
+    g_mutex_lock(ar->mutex);
+    while (ar->nentries >= AMPTAR_MAX_ENTRIES ||
+	   (ar->reserved > 0 &&
+	    ar->reserved + e->reserved > amptar_read_ahead)) {
+	g_cond_wait(ar->cond, ar->mutex);
+    }
+    if (ar->tail)
+	ar->tail->next = e;
+    else
+	ar->head = e;
+    ar->tail = e;
+    ar->nentries++;
+    ar->reserved += e->reserved;
+    g_cond_broadcast(ar->cond);
+    g_mutex_unlock(ar->mutex);
+
+    /* the writer waits for the read, so E is still there */
+    if (need_read)
+	amexec_queue_push(ar->readers, e);
+}
+
+static void
+queue_message(
+    archive_t  *ar,
+    char        startchr,
+    const char *fmt,
+    ...) G_GNUC_PRINTF(3, 4);
+
+static void
+queue_message(
+    archive_t  *ar,
+    char        startchr,
+    const char *fmt,
+    ...)
+{
+    entry_t *e = g_new0(entry_t, 1);
+    va_list argp;
+    char *msg;
+
+    va_start(argp, fmt);
+    msg = g_strdup_vprintf(fmt, argp);
+    va_end(argp);
+
+    g_debug("%s", msg);
+    if (ar->estimate) {
+	g_free(msg);
+	g_free(e);
+	return;
+    }
+    e->kind = ENTRY_MESSAGE;
+    e->fd = -1;
+    e->message = g_strdup_printf("%c %s", startchr, msg);
+    g_free(msg);
+    queue_entry(ar, e);
+}
+
+/*
+ * The walker
+ */
+
+static gboolean
+is_excluded(
+    archive_t  *ar,
+    const char *name)
+{
+    /* like tar's default, unanchored matching: a tar expression matches
+     * the whole name or any run of its components */
+    return ar->exclude && match_tar_list(ar->exclude, name);
+}
+
+static const char *
+lookup_uname(
+    archive_t *ar,
+    uid_t      uid)
+{
+    char *name = g_hash_table_lookup(ar->unames, GUINT_TO_POINTER(uid));
+
+    if (!name) {
+	struct passwd *pw = getpwuid(uid);
+	name = g_strdup(pw ? pw->pw_name : "");
+	g_hash_table_insert(ar->unames, GUINT_TO_POINTER(uid), name);
+    }
+    return name;
+}
+
+static const char *
+lookup_gname(
+    archive_t *ar,
+    gid_t      gid)
+{
+    char *name = g_hash_table_lookup(ar->gnames, GUINT_TO_POINTER(gid));
+
+    if (!name) {
+	struct group *gr = getgrgid(gid);
+	name = g_strdup(gr ? gr->gr_name : "");
+	g_hash_table_insert(ar->gnames, GUINT_TO_POINTER(gid), name);
+    }
+    return name;
+}
+
+static entry_t *
+new_member(
+    archive_t   *ar,
+    const char  *name,
+    struct stat *st,
+    char         typeflag)
+{
+    entry_t *e = g_new0(entry_t, 1);
+
+    e->kind = ENTRY_MEMBER;
+    e->name = g_strdup(name);
+    e->path = g_strconcat(ar->dirname, name + 1, NULL);
+    e->st = *st;
+    e->typeflag = typeflag;
+    e->fd = -1;
+    return e;
+}
+
+/* Archive a member that is not a directory. */
+static void
+walk_file(
+    archive_t   *ar,
+    const char  *name,
+    struct stat *st)
+{
+    entry_t *e;
+
+    if (S_ISREG(st->st_mode)) {
+	e = new_member(ar, name, st, '0');
+	if (st->st_nlink > 1) {
+	    char *key = g_strdup_printf("%llu:%llu",
+			(unsigned long long)st->st_dev,
+			(unsigned long long)st->st_ino);
+	    char *first = g_hash_table_lookup(ar->hardlinks, key);
+
+	    if (first) {
+		e->typeflag = '1';
+		e->linkname = g_strdup(first);
+		g_free(key);
+	    } else {
+		g_hash_table_insert(ar->hardlinks, key, g_strdup(name));
+	    }
+	}
+    } else if (S_ISLNK(st->st_mode)) {
+	char target[PATH_MAX+1];
+	char *path = g_strconcat(ar->dirname, name + 1, NULL);
+	ssize_t len = readlink(path, target, PATH_MAX);
+
+	g_free(path);
+	if (len < 0) {
+	    queue_message(ar, '?', "%s: Cannot readlink: %s", name,
+			  strerror(errno));
+	    return;
+	}
+	target[len] = '\0';
+	e = new_member(ar, name, st, '2');
+	e->linkname = g_strdup(target);
+    } else if (S_ISCHR(st->st_mode)) {
+	e = new_member(ar, name, st, '3');
+    } else if (S_ISBLK(st->st_mode)) {
+	e = new_member(ar, name, st, '4');
+    } else if (S_ISFIFO(st->st_mode)) {
+	e = new_member(ar, name, st, '6');
+    } else {
+	queue_message(ar, '|', "%s: socket ignored", name);
+	return;
+    }
+    queue_entry(ar, e);
+}
+
+typedef struct child_s {
+    char *base;
+    struct stat st;
+    char flag;		/* 'Y', 'N' or 'D', as in a dumpdir */
+    gboolean skip;	/* excluded, or on another file system */
+} child_t;
+
+static int
+compare_child(
+    gconstpointer a,
+    gconstpointer b)
+{
+    return strcmp(((const child_t *)a)->base, ((const child_t *)b)->base);
+}
+
+/* Archive a directory with its dumpdir, then whatever it holds that this
+ * level includes, in the order of the dumpdir.  NAME is "." or "./a/b". */
+static void
+walk_dir(
+    archive_t   *ar,
+    const char  *name,
+    struct stat *st)
+{
+    char *path = g_strconcat(ar->dirname, name + 1, NULL);
+    char *member = g_strconcat(name, "/", NULL);
+    snapdir_t *prev;
+    gboolean is_new;
+    GArray *children;
+    struct dirent *de;
+    DIR *d;
+    entry_t *e;
+    guint i;
+
+    d = opendir(path);
+    if (!d) {
+	queue_message(ar, '?', "%s: Cannot open: %s", member, strerror(errno));
+	g_free(path);
+	g_free(member);
+	return;
+    }
+
+    prev = ar->prev_dirs ? g_hash_table_lookup(ar->prev_dirs, name) : NULL;
+    is_new = !prev || (!prev->nfs && (prev->dev != (guint64)st->st_dev ||
+				      prev->ino != (guint64)st->st_ino));
+    if (is_new && ar->incremental)
+	queue_message(ar, '|', "%s: Directory is new", member);
+
+    children = g_array_new(FALSE, TRUE, sizeof(child_t));
+    while ((de = readdir(d)) != NULL) {
+	child_t child;
+	char *child_name;
+	char *child_path;
+
+	if (is_dot_or_dotdot(de->d_name))
+	    continue;
+	memset(&child, 0, sizeof(child));
+	child_name = g_strconcat(name, "/", de->d_name, NULL);
+	child_path = g_strconcat(path, "/", de->d_name, NULL);
+	if (lstat(child_path, &child.st) != 0) {
+	    queue_message(ar, '?', "%s: Cannot stat: %s", child_name,
+			  strerror(errno));
+	    g_free(child_name);
+	    g_free(child_path);
+	    continue;
+	}
+	g_free(child_path);
+	if (S_ISSOCK(child.st.st_mode)) {
+	    queue_message(ar, '|', "%s: socket ignored", child_name);
+	    g_free(child_name);
+	    continue;
+	}
+	child.base = g_strdup(de->d_name);
+	if (is_excluded(ar, child_name)) {
+	    child.flag = 'N';
+	    child.skip = TRUE;
+	} else if (S_ISDIR(child.st.st_mode)) {
+	    child.flag = 'D';
+	} else if (is_new || !ar->incremental ||
+		   child.st.st_mtime >= ar->newer ||
+		   child.st.st_ctime >= ar->newer) {
+	    child.flag = 'Y';
+	} else {
+	    child.flag = 'N';
+	}
+	g_free(child_name);
+	g_array_append_val(children, child);
+    }
+    closedir(d);
+    g_array_sort(children, compare_child);
+
+    e = new_member(ar, member, st, 'D');
+    e->dumpdir = g_string_sized_new(children->len * 16 + 1);
+    for (i = 0; i < children->len; i++) {
+	child_t *child = &g_array_index(children, child_t, i);
+	g_string_append_c(e->dumpdir, child->flag);
+	g_string_append_len(e->dumpdir, child->base, strlen(child->base) + 1);
+    }
+    g_string_append_c(e->dumpdir, '\0');
+
+    if (ar->snapshot) {
+	g_string_append_printf(ar->snapshot, "0%c%ld%c0%c%llu%c%llu%c%s%c",
+			       '\0', (long)st->st_mtime, '\0', '\0',
+			       (unsigned long long)st->st_dev, '\0',
+			       (unsigned long long)st->st_ino, '\0',
+			       name, '\0');
+	g_string_append_len(ar->snapshot, e->dumpdir->str, e->dumpdir->len);
+    }
+    queue_entry(ar, e);
+
+    for (i = 0; i < children->len; i++) {
+	child_t *child = &g_array_index(children, child_t, i);
+	char *child_name;
+
+	if (child->skip || child->flag == 'N')
+	    continue;
+	child_name = g_strconcat(name, "/", child->base, NULL);
+	if (child->flag == 'D') {
+	    if (amptar_onefilesystem && child->st.st_dev != ar->top_dev) {
+		/* the mount point, without its contents or a dumpdir, so a
+		 * restore leaves what is below it alone */
+		char *dir_member = g_strconcat(child_name, "/", NULL);
+		queue_entry(ar, new_member(ar, dir_member, &child->st, '5'));
+		g_free(dir_member);
+	    } else {
+		walk_dir(ar, child_name, &child->st);
+	    }
+	} else {
+	    walk_file(ar, child_name, &child->st);
+	}
+	g_free(child_name);
+    }
+
+    for (i = 0; i < children->len; i++)
+	g_free(g_array_index(children, child_t, i).base);
+    g_array_free(children, TRUE);
+    g_free(path);
+    g_free(member);
+}
+
+/* Walk the tree, or the members of the include file. */
+static void
+walk_tree(
+    archive_t *ar,
+    char      *file_include)
+{
+    GPtrArray *roots = g_ptr_array_new();
+    struct stat st;
+    guint i;
+
+    if (file_include) {
+	FILE *include = fopen(file_include, "r");
+	char *line;
+
+	if (include) {
+	    while ((line = pgets(include)) != NULL) {
+		if (g_str_has_prefix(line, "./") && line[2] != '\0') {
+		    g_ptr_array_add(roots, line);
+		} else {
+		    amfree(line);
+		}
+	    }
+	    fclose(include);
+	} else {
+	    queue_message(ar, '?', "Cannot open include file '%s': %s",
+			  file_include, strerror(errno));
+	}
+    } else {
+	g_ptr_array_add(roots, g_strdup("."));
+    }
+
+    for (i = 0; i < roots->len; i++) {
+	char *name = g_ptr_array_index(roots, i);
+	char *path = g_strconcat(ar->dirname, name + 1, NULL);
+	size_t len = strlen(name);
+
+	while (len > 1 && name[len-1] == '/')
+	    name[--len] = '\0';
+	if (lstat(path, &st) != 0) {
+	    queue_message(ar, '?', "%s: Cannot stat: %s", name, strerror(errno));
+	} else if (S_ISDIR(st.st_mode)) {
+	    walk_dir(ar, name, &st);
+	} else if (!ar->incremental || st.st_mtime >= ar->newer ||
+		   st.st_ctime >= ar->newer) {
+	    walk_file(ar, name, &st);
+	}
+	g_free(path);
+	g_free(name);
+    }
+    g_ptr_array_free(roots, TRUE);
+}
+
+static gpointer
+walk_thread(
+    gpointer data)
+{
+    archive_t *ar = data;
+
+    walk_tree(ar, ar->file_include);
+
+    g_mutex_lock(ar->mutex);
+    ar->walk_done = TRUE;
+    g_cond_broadcast(ar->cond);
+    g_mutex_unlock(ar->mutex);
+
+    return NULL;
+}
+
+/*
+ * The writer
+ */
+
+static void
+write_out(
+    archive_t  *ar,
+    const void *buf,
+    gsize       len)
+{
+    const char *p = buf;
+
+    while (len > 0) {
+	gsize n;
+
+	if (ar->wbuf_len == 0 && len >= AMPTAR_WRITE_BUFFER) {
+	    /* large enough to go straight to the output */
+	    n = len - len % AMPTAR_WRITE_BUFFER;
+	    if (full_write(1, p, n) != n) {
+		g_fprintf(mesgstream, "sendbackup: error [Cannot write the archive: %s]\n",
+			  strerror(errno));
+		exit(1);
+	    }
+	} else {
+	    n = MIN(len, AMPTAR_WRITE_BUFFER - ar->wbuf_len);
+	    memcpy(ar->wbuf + ar->wbuf_len, p, n);
+	    ar->wbuf_len += n;
+	    if (ar->wbuf_len == AMPTAR_WRITE_BUFFER) {
+		if (full_write(1, ar->wbuf, ar->wbuf_len) != ar->wbuf_len) {
+		    g_fprintf(mesgstream, "sendbackup: error [Cannot write the archive: %s]\n",
+			      strerror(errno));
+		    exit(1);
+		}
+		ar->wbuf_len = 0;
+	    }
+	}
+	ar->written += n;
+	p += n;
+	len -= n;
+    }
+}
+
+static void
+write_zeros(
+    archive_t *ar,
+    guint64    len)
+{
+    static const char zeros[TAR_BLOCK_SIZE];
+
+    while (len > 0) {
+	gsize n = MIN(len, TAR_BLOCK_SIZE);
+	write_out(ar, zeros, n);
+	len -= n;
+    }
+}
+
+static void
+write_pad(
+    archive_t *ar)
+{
+    if (ar->written % TAR_BLOCK_SIZE)
+	write_zeros(ar, TAR_BLOCK_SIZE - ar->written % TAR_BLOCK_SIZE);
+}
+
+/* Store VALUE in a numeric header field of WIDTH bytes: octal digits and a
+ * NUL, or the GNU base-256 encoding when it doesn't fit. */
+static void
+tar_number(
+    char   *field,
+    int     width,
+    guint64 value)
+{
+    if (value < ((guint64)1 << (3 * (width - 1)))) {
+	g_snprintf(field, width, "%0*llo", width - 1, (unsigned long long)value);
+    } else {
+	int i;
+
+	for (i = width - 1; i > 0; i--) {
+	    field[i] = value & 0xff;
+	    value >>= 8;
+	}
+	field[0] = (char)0x80;
+    }
+}
+
+static void
+write_header(
+    archive_t   *ar,
+    const char  *name,
+    struct stat *st,
+    char         typeflag,
+    const char  *linkname,
+    guint64      size)
+{
+    char h[TAR_BLOCK_SIZE];
+    unsigned int sum = 0;
+    int i;
+
+    memset(h, 0, sizeof(h));
+    strncpy(h, name, 100);
+    tar_number(h + 100, 8, st->st_mode & 07777);
+    tar_number(h + 108, 8, st->st_uid);
+    tar_number(h + 116, 8, st->st_gid);
+    tar_number(h + 124, 12, size);
+    tar_number(h + 136, 12, st->st_mtime > 0 ? st->st_mtime : 0);
+    h[156] = typeflag;
+    if (linkname)
+	strncpy(h + 157, linkname, 100);
+    memcpy(h + 257, "ustar  ", 8);	/* the old GNU magic and version */
+    if (typeflag == 'L' || typeflag == 'K') {
+	strcpy(h + 265, "root");
+	strcpy(h + 297, "root");
+    } else {
+	strncpy(h + 265, lookup_uname(ar, st->st_uid), 31);
+	strncpy(h + 297, lookup_gname(ar, st->st_gid), 31);
+    }
+#ifdef major
+    if (typeflag == '3' || typeflag == '4') {
+	tar_number(h + 329, 8, major(st->st_rdev));
+	tar_number(h + 337, 8, minor(st->st_rdev));
+    }
+#endif
+    if (typeflag != 'L' && typeflag != 'K') {
+	/* as tar --incremental does */
+	tar_number(h + 345, 12, st->st_atime > 0 ? st->st_atime : 0);
+	tar_number(h + 357, 12, st->st_ctime > 0 ? st->st_ctime : 0);
+    }
+
+    memset(h + 148, ' ', 8);
+    for (i = 0; i < TAR_BLOCK_SIZE; i++)
+	sum += (unsigned char)h[i];
+    g_snprintf(h + 148, 7, "%06o", sum);
+    h[155] = ' ';
+
+    write_out(ar, h, sizeof(h));
+}
+
+/* a GNU long name or long link member, holding STR */
+static void
+write_longlink(
+    archive_t   *ar,
+    const char  *str,
+    char         typeflag,
+    struct stat *st)
+{
+    gsize len = strlen(str) + 1;
+
+    write_header(ar, "././@LongLink", st, typeflag, NULL, len);
+    write_out(ar, str, len);
+    write_pad(ar);
+}
+
+static void
+write_member(
+    archive_t *ar,
+    entry_t   *e)
+{
+    guint64 size = 0;
+
+    if (e->typeflag == '0') {
+	if (!e->data && e->read_errno == ENOENT) {
+	    g_fprintf(mesgstream, "| %s: File removed before we read it\n",
+		      e->name);
+	    return;
+	} else if (!e->data && e->read_errno) {
+	    g_fprintf(mesgstream, "? %s: Cannot open: %s\n", e->name,
+		      strerror(e->read_errno));
+	    amptar_exit_value = 1;
+	    return;
+	}
+	size = e->st.st_size;
+    } else if (e->dumpdir) {
+	size = e->dumpdir->len;
+    }
+
+    if (strlen(e->name) >= 100)
+	write_longlink(ar, e->name, 'L', &e->st);
+    if (e->linkname && strlen(e->linkname) >= 100)
+	write_longlink(ar, e->linkname, 'K', &e->st);
+    write_header(ar, e->name, &e->st, e->typeflag, e->linkname, size);
+    if (ar->indexstream)
+	g_fprintf(ar->indexstream, "%s\n", e->name + 1);
+
+    if (e->dumpdir) {
+	write_out(ar, e->dumpdir->str, e->dumpdir->len);
+    } else if (e->typeflag == '0') {
+	guint64 done = 0;
+	int err = e->read_errno;
+
+	if (e->data_len) {
+	    write_out(ar, e->data, MIN(e->data_len, size));
+	    done = MIN(e->data_len, size);
+	}
+
+	/* the rest of a large file */
+	if (e->fd >= 0) {
+	    char *buf = g_malloc(AMPTAR_PREFETCH_MAX);
+
+	    while (done < size) {
+		ssize_t n = read(e->fd, buf, MIN(size - done, AMPTAR_PREFETCH_MAX));
+		if (n < 0) {
+		    if (errno == EINTR)
+			continue;
+		    err = errno;
+		    break;
+		}
+		if (n == 0)
+		    break;
+		write_out(ar, buf, n);
+		done += n;
+	    }
+	    g_free(buf);
+	}
+
+	if (done < size) {
+	    if (err) {
+		g_fprintf(mesgstream, "? %s: Read error at byte %llu: %s\n",
+			  e->name, (unsigned long long)done, strerror(err));
+		amptar_exit_value = 1;
+	    } else {
+		g_fprintf(mesgstream, "| %s: File shrunk by %llu bytes, padding with zeros\n",
+			  e->name, (unsigned long long)(size - done));
+	    }
+	    write_zeros(ar, size - done);
+	}
+    }
+    write_pad(ar);
+}
+
+/* Write the entries as the walker queues them, until it is done. */
+static void
+write_archive(
+    archive_t *ar)
+{
+    while (1) {
+	entry_t *e;
+
+	g_mutex_lock(ar->mutex);
+	while (!ar->head && !ar->walk_done)
+	    g_cond_wait(ar->cond, ar->mutex);
+	e = ar->head;
+	if (!e) {
+	    g_mutex_unlock(ar->mutex);
+	    break;
+	}
+	while (!e->read_done)
+	    g_cond_wait(ar->cond, ar->mutex);
+	ar->head = e->next;
+	if (!ar->head)
+	    ar->tail = NULL;
+	g_mutex_unlock(ar->mutex);
+
+	if (e->kind == ENTRY_MESSAGE) {
+	    g_fprintf(mesgstream, "%s\n", e->message);
+	} else {
+	    write_member(ar, e);
+	}
+
+	g_mutex_lock(ar->mutex);
+	ar->nentries--;
+	ar->reserved -= e->reserved;
+	g_cond_broadcast(ar->cond);
+	g_mutex_unlock(ar->mutex);
+	free_entry(e);
+    }
+
+    /* the end of the archive, padded to a whole record */
+    write_zeros(ar, 2 * TAR_BLOCK_SIZE);
+    if (ar->written % TAR_RECORD_SIZE)
+	write_zeros(ar, TAR_RECORD_SIZE - ar->written % TAR_RECORD_SIZE);
+    if (ar->wbuf_len &&
+	full_write(1, ar->wbuf, ar->wbuf_len) != ar->wbuf_len) {
+	g_fprintf(mesgstream, "sendbackup: error [Cannot write the archive: %s]\n",
+		  strerror(errno));
+	exit(1);
+    }
+    ar->wbuf_len = 0;
+}
+
+/*
+ * The snapshot files
+ */
+
+static char *
+snapshot_basename(
+    application_argument_t *argument)
+{
+    char *sdisk = sanitise_filename(argument->dle.disk);
+    char *basename = g_strjoin(NULL, state_dir, "/", argument->host, sdisk,
+			       NULL);
+
+    g_free(sdisk);
+    return basename;
+}
+
+/* Load the snapshot of the closest lower level into AR; a level 0, or a
+ * level with no lower snapshot, archives everything.  Returns an error
+ * message. */
+static char *
+load_snapshot(
+    archive_t *ar,
+    int        level)
+{
+    char *basename = snapshot_basename(ar->argument);
+    char *contents = NULL;
+    gsize length;
+    int baselevel;
+    char *p, *end;
+
+    for (baselevel = level - 1; baselevel >= 0; baselevel--) {
+	char *filename = g_strdup_printf("%s_%d", basename, baselevel);
+
+	if (g_file_get_contents(filename, &contents, &length, NULL)) {
+	    g_debug("Using snapshot '%s'", filename);
+	    g_free(filename);
+	    break;
+	}
+	g_debug("amptar: error opening %s: %s", filename, strerror(errno));
+	if (baselevel == 0) {
+	    char *errmsg = g_strdup_printf(_("amptar: error opening %s: %s"),
+					   filename, strerror(errno));
+	    g_free(filename);
+	    g_free(basename);
+	    return errmsg;
+	}
+	g_free(filename);
+    }
+    g_free(basename);
+    if (!contents) {
+	g_debug("Using no snapshot");
+	return NULL;
+    }
+
+    /* "GNU tar-VERSION-2\n", the time of that dump, then for each
+     * directory: nfs, mtime (two fields), dev, ino, name and the dumpdir,
+     * with every field ended by a NUL */
+    end = contents + length;
+    p = memchr(contents, '\n', length);
+    if (!p || !g_str_has_prefix(contents, "GNU tar-") || p[-1] != '2' ||
+	p[-2] != '-') {
+	g_free(contents);
+	return g_strdup(_("amptar: the snapshot is not a GNU tar snapshot of format 2"));
+    }
+    p++;
+    if (p >= end || !memchr(p, '\0', end - p)) {
+	g_free(contents);
+	return g_strdup(_("amptar: the snapshot is truncated"));
+    }
+    ar->newer = (time_t)g_ascii_strtoll(p, NULL, 10);
+    p += strlen(p) + 1;
+    if (p < end)
+	p += strnlen(p, end - p) + 1;
+    ar->incremental = TRUE;
+    ar->prev_dirs = g_hash_table_new_full(g_str_hash, g_str_equal,
+					  g_free, g_free);
+
+    while (p < end) {
+	char *field[6];
+	snapdir_t *dir;
+	int i;
+
+	for (i = 0; i < 6 && p < end; i++) {
+	    field[i] = p;
+	    p += strnlen(p, end - p) + 1;
+	}
+	if (i < 6)
+	    break;
+	/* skip the dumpdir */
+	while (p < end && *p) {
+	    p += strnlen(p, end - p) + 1;
+	}
+	p++;
+
+	dir = g_new0(snapdir_t, 1);
+	dir->nfs = (field[0][0] == '1');
+	dir->dev = g_ascii_strtoull(field[3], NULL, 10);
+	dir->ino = g_ascii_strtoull(field[4], NULL, 10);
+	g_hash_table_replace(ar->prev_dirs, g_strdup(field[5]), dir);
+    }
+
+    g_free(contents);
+    return NULL;
+}
+
+static void
+save_snapshot(
+    archive_t *ar,
+    int        level)
+{
+    char *basename = snapshot_basename(ar->argument);
+    char *filename = g_strdup_printf("%s_%d", basename, level);
+    char *tmpname = g_strdup_printf("%s.tmp", filename);
+    GString *out = g_string_new("GNU tar-amptar-2\n");
+    GError *error = NULL;
+
+    g_string_append_printf(out, "%ld%c0%c", (long)ar->start_time, '\0', '\0');
+    g_string_append_len(out, ar->snapshot->str, ar->snapshot->len);
+
+    if (!g_file_set_contents(tmpname, out->str, out->len, &error) ||
+	rename(tmpname, filename) != 0) {
+	char *errmsg = error ? g_strdup(error->message) : g_strdup(strerror(errno));
+	g_debug("Failed to write '%s': %s", filename, errmsg);
+	g_fprintf(mesgstream, "sendbackup: error [Failed to write '%s': %s]\n",
+		  filename, errmsg);
+	amptar_exit_value = 1;
+	g_free(errmsg);
+	if (error)
+	    g_error_free(error);
+	unlink(tmpname);
+    } else {
+	g_debug("Wrote snapshot '%s'", filename);
+    }
+
+    g_string_free(out, TRUE);
+    g_free(tmpname);
+    g_free(filename);
+    g_free(basename);
+}
+
+static archive_t *
+archive_new(
+    application_argument_t *argument,
+    char                   *file_exclude,
+    char                   *file_include)
+{
+    archive_t *ar = g_new0(archive_t, 1);
+    char tmppath[PATH_MAX];
+    struct stat st;
+
+    ar->argument = argument;
+    canonicalize_pathname(amptar_target ? amptar_target : argument->dle.device,
+			  tmppath);
+    ar->dirname = g_strdup(tmppath);
+    ar->file_include = file_include;
+    if (stat(ar->dirname, &st) == 0)
+	ar->top_dev = st.st_dev;
+    ar->start_time = time(NULL);
+    ar->hardlinks = g_hash_table_new_full(g_str_hash, g_str_equal,
+					  g_free, g_free);
+    ar->unames = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+				       NULL, g_free);
+    ar->gnames = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+				       NULL, g_free);
+
+    if (file_exclude) {
+	FILE *exclude = fopen(file_exclude, "r");
+	char *line;
+
+	if (exclude) {
+	    GPtrArray *globs = g_ptr_array_new();
+	    while ((line = pgets(exclude)) != NULL) {
+		if (*line)
+		    g_ptr_array_add(globs, line);
+		else
+		    g_free(line);
+	    }
+	    fclose(exclude);
+	    if (globs->len)
+		ar->exclude = compile_tar_list((char **)globs->pdata,
+					       globs->len);
+	    g_ptr_array_foreach(globs, (GFunc)g_free, NULL);
+	    g_ptr_array_free(globs, TRUE);
+	}
+    }
+
+    return ar;
+}
+
+static void
+archive_free(
+    archive_t *ar)
+{
+    if (ar->prev_dirs)
+	g_hash_table_destroy(ar->prev_dirs);
+    if (ar->snapshot)
+	g_string_free(ar->snapshot, TRUE);
+    g_hash_table_destroy(ar->hardlinks);
+    g_hash_table_destroy(ar->unames);
+    g_hash_table_destroy(ar->gnames);
+    free_tar_matcher(ar->exclude);
+    g_free(ar->dirname);
+    g_free(ar->wbuf);
+    g_free(ar);
+}
+
+static void
+amptar_estimate(
+    application_argument_t *argument)
+{
+    char      *file_exclude = NULL;
+    char      *file_include = NULL;
+    char      *qdisk;
+    GSList    *levels;
+    messagelist_t mlist = NULL;
+    messagelist_t mesglist = NULL;
+    message_t *message;
+
+    if (!argument->level) {
+        fprintf(stderr, "ERROR No level argument\n");
+        error(_("No level argument"));
+    }
+    if (!argument->dle.disk) {
+        fprintf(stderr, "ERROR No disk argument\n");
+        error(_("No disk argument"));
+    }
+    if (!argument->dle.device) {
+        fprintf(stderr, "ERROR No device argument\n");
+        error(_("No device argument"));
+    }
+
+    if (state_dir && strlen(state_dir) == 0)
+	state_dir = NULL;
+    if (state_dir) {
+	message = check_dir_message(state_dir, R_OK|W_OK);
+	if (message) {
+	    if (message_get_severity(message) > MSG_INFO) {
+		amptar_print_message(message);
+		delete_message(message);
+		exit(1);
+	    }
+	    delete_message(message);
+	}
+    } else {
+        fprintf(stdout, "ERROR No STATE-DIR\n");
+        exit(1);
+    }
+
+    amptar_build_exinclude(&argument->dle, NULL, &file_exclude,
+			   NULL, &file_include,
+			   amptar_target ? amptar_target : argument->dle.device,
+			   &mlist);
+    for (mesglist = mlist; mesglist != NULL; mesglist = mesglist->next){
+	message_t *message = mesglist->data;
+	if (message_get_severity(message) > MSG_INFO)
+	    fprintf(stdout, "ERROR %s\n", get_message(message));
+	delete_message(message);
+    }
+    g_slist_free(mlist);
+
+    qdisk = quote_string(argument->dle.disk);
+    for (levels = argument->level; levels != NULL; levels = levels->next) {
+	int level = GPOINTER_TO_INT(levels->data);
+	archive_t *ar = archive_new(argument, file_exclude, file_include);
+	times_t start_time = curclock();
+	char *errmsg;
+	off_t size;
+
+	ar->estimate = TRUE;
+	if ((errmsg = load_snapshot(ar, level))) {
+	    char *qerrmsg = quote_string(errmsg);
+	    g_debug("%s", errmsg);
+	    fprintf(stdout, "ERROR %s\n", qerrmsg);
+	    amptar_exit_value = 1;
+	    g_free(qerrmsg);
+	    g_free(errmsg);
+	    fprintf(stdout, "%d -1 1\n", level);
+	    archive_free(ar);
+	    continue;
+	}
+
+	walk_tree(ar, file_include);
+
+	/* the end blocks, in whole records, in kbytes */
+	ar->estimate_size += 2 * TAR_BLOCK_SIZE;
+	ar->estimate_size = (ar->estimate_size + TAR_RECORD_SIZE - 1) /
+			    TAR_RECORD_SIZE * TAR_RECORD_SIZE;
+	size = ar->estimate_size / 1024;
+
+	g_debug(_("estimate time for %s level %d: %s"), qdisk, level,
+		walltime_str(timessub(curclock(), start_time)));
+	g_debug(_("estimate size for %s level %d: %lld KB"), qdisk, level,
+		(long long)size);
+	fprintf(stdout, "%d %lld 1\n", level, (long long)size);
+	archive_free(ar);
+    }
+
+    if (argument->verbose == 0) {
+	if (file_exclude)
+	    unlink(file_exclude);
+	if (file_include)
+	    unlink(file_include);
+    }
+    amfree(qdisk);
+    amfree(file_exclude);
+    amfree(file_include);
+}
+
+static void
+amptar_backup(
+    application_argument_t *argument)
+{
+    char      *qdisk;
+    char      *file_exclude = NULL;
+    char      *file_include = NULL;
+    char      *errmsg;
+    int        level;
+    archive_t *ar;
+    GThread   *walker;
+    GError    *error = NULL;
+    messagelist_t mlist = NULL;
+    messagelist_t mesglist = NULL;
+    message_t *message;
+
+    if (state_dir && strlen(state_dir) == 0)
+	state_dir = NULL;
+    if (state_dir) {
+	message = check_dir_message(state_dir, R_OK|W_OK);
+	if (message) {
+	    if (message_get_severity(message) > MSG_INFO) {
+		amptar_print_message(message);
+		delete_message(message);
+		exit(1);
+	    }
+	    delete_message(message);
+	}
+    } else {
+        fprintf(mesgstream, "sendbackup: error [STATE-DIR not defined]\n");
+        exit(1);
+    }
+
+    if (!argument->level) {
+        fprintf(mesgstream, "sendbackup: error [No level argument]\n");
+        exit(1);
+    }
+    if (!argument->dle.disk) {
+        fprintf(mesgstream, "sendbackup: error [No disk argument]\n");
+        exit(1);
+    }
+    if (!argument->dle.device) {
+        fprintf(mesgstream, "sendbackup: error [No device argument]\n");
+        exit(1);
+    }
+
+    qdisk = quote_string(argument->dle.disk);
+    level = GPOINTER_TO_INT(argument->level->data);
+
+    amptar_build_exinclude(&argument->dle, NULL, &file_exclude,
+			   NULL, &file_include,
+			   amptar_target ? amptar_target : argument->dle.device,
+			   &mlist);
+    for (mesglist = mlist; mesglist != NULL; mesglist = mesglist->next){
+	message_t *message = mesglist->data;
+	if (message_get_severity(message) <= MSG_INFO) {
+	    fprintf(mesgstream, "| %s\n", get_message(message));
+	} else {
+	    fprintf(mesgstream, "? %s\n", get_message(message));
+	}
+	delete_message(message);
+    }
+    g_slist_free(mlist);
+
+    ar = archive_new(argument, file_exclude, file_include);
+    if ((errmsg = load_snapshot(ar, level))) {
+	g_debug("%s", errmsg);
+	fprintf(mesgstream, "sendbackup: error [%s]\n", errmsg);
+	exit(1);
+    }
+    ar->snapshot = g_string_new(NULL);
+    ar->mutex = g_mutex_new();
+    ar->cond = g_cond_new();
+    ar->wbuf = g_malloc(AMPTAR_WRITE_BUFFER);
+    /* opening files waits on the disks, not on the CPUs */
+    ar->readers = amexec_queue_new("amptar-read", read_entry, ar,
+				   amptar_readers, AMEXEC_PRIORITY_HIGH,
+				   AMEXEC_BLOCKING);
+
+    if (argument->dle.create_index) {
+	ar->indexstream = fdopen(4, "w");
+	if (!ar->indexstream) {
+	    error(_("error indexstream(%d): %s\n"), 4, strerror(errno));
+	}
+    }
+
+    /* reading files may need root */
+    set_root_privs(1);
+    walker = g_thread_create(walk_thread, ar, TRUE, &error);
+    if (!walker) {
+	set_root_privs(0);
+	g_fprintf(mesgstream, "sendbackup: error [Can't create the walker thread: %s]\n",
+		  error->message);
+	exit(1);
+    }
+    write_archive(ar);
+    g_thread_join(walker);
+    amexec_queue_free(ar->readers, FALSE);
+    set_root_privs(0);
+
+    g_debug("amptar: %s: wrote %llu bytes", qdisk,
+	    (unsigned long long)ar->written);
+    if (argument->dle.record) {
+	save_snapshot(ar, level);
+    }
+
+    g_debug("sendbackup: size %lld", (long long)(ar->written / 1024));
+    fprintf(mesgstream, "sendbackup: size %lld\n", (long long)(ar->written / 1024));
+
+    if (ar->indexstream)
+	fclose(ar->indexstream);
+
+    fclose(mesgstream);
+
+    if (argument->verbose == 0) {
+	if (file_exclude)
+	    unlink(file_exclude);
+	if (file_include)
+	    unlink(file_include);
+    }
+
+    g_mutex_free(ar->mutex);
+    g_cond_free(ar->cond);
+    archive_free(ar);
+    amfree(file_exclude);
+    amfree(file_include);
+    amfree(qdisk);
+}
+
+typedef struct filter_s {
+    int    fd;
+    char  *name;
+    char  *buffer;
+    gint64 first;		/* first byte used */
+    gint64 size;		/* number of byte use in the buffer */
+    gint64 allocated_size;	/* allocated size of the buffer     */
+    event_handle_t *event;
+    int    out;
+} filter_t;
+
+static ssize_t
+read_filter_buffer(
+    filter_t *filter)
+{
+    ssize_t nread;
+
+    if (filter->buffer == NULL) {
+	/* allocate initial buffer */
+	filter->buffer = g_malloc(2048);
+	filter->first = 0;
+	filter->size = 0;
+	filter->allocated_size = 2048;
+    } else if (filter->first > 0) {
+	if (filter->allocated_size - filter->size - filter->first < 1024) {
+	    memmove(filter->buffer, filter->buffer + filter->first,
+				    filter->size);
+	    filter->first = 0;
+	}
+    } else if (filter->allocated_size - filter->size < 1024) {
+	/* double the size of the buffer */
+	filter->allocated_size *= 2;
+	filter->buffer = g_realloc(filter->buffer, filter->allocated_size);
+    }
+
+    nread = read(filter->fd, filter->buffer + filter->first + filter->size,
+		 filter->allocated_size - filter->first - filter->size - 2);
+
+    if (nread <= 0) {
+	event_release(filter->event);
+	aclose(filter->fd);
+	if (filter->size > 0 && filter->buffer[filter->first + filter->size - 1] != '\n') {
+	    /* Add a '\n' at end of buffer */
+	    filter->buffer[filter->first + filter->size] = '\n';
+	    filter->size++;
+	}
+    } else {
+	filter->size += nread;
+    }
+
+    return nread;
+}
+
+static void
+handle_restore_stdin(
+    void *cookie)
+{
+    filter_t *filter = cookie;
+    ssize_t   nread;
+
+    if (filter->buffer == NULL) {
+	/* allocate initial buffer */
+	filter->buffer = g_malloc(65536);
+	filter->first = 0;
+	filter->size = 0;
+	filter->allocated_size = 65536;
+    }
+    nread = read(filter->fd, filter->buffer, filter->allocated_size);
+
+    if (nread > 0) {
+	/* process the complete buffer */
+	int nwrite = full_write(filter->out , filter->buffer, nread);
+	if (nwrite < nread) {
+	    amptar_exit_value = 1;
+	    g_debug("wrote only %d bytes", nwrite);
+	    event_release(filter->event);
+	    filter->event = NULL;
+	    aclose(filter->fd);
+	    g_free(filter->buffer);
+	    filter->buffer = NULL;
+	    aclose(filter->out);
+	}
+    } else {
+	event_release(filter->event);
+	filter->event = NULL;
+	aclose(filter->fd);
+	g_free(filter->buffer);
+	filter->buffer = NULL;
+	aclose(filter->out);
+    }
+}
+
+/* the names tar lists go to stdout, and anything else it says to stderr */
+static void
+handle_restore_output(
+    void *cookie)
+{
+    filter_t *filter = cookie;
+    ssize_t   nread;
+    char     *b, *p;
+    gint64    len;
+
+    nread = read_filter_buffer(filter);
+
+    /* process all complete lines */
+    b = filter->buffer + filter->first;
+    b[filter->size] = '\0';
+    while (b < filter->buffer + filter->first + filter->size &&
+	   (p = strchr(b, '\n')) != NULL) {
+	*p = '\0';
+	if (g_str_equal(filter->name, "stdout")) {
+	    g_fprintf(stdout, "%s\n", b);
+	} else {
+	    restore_ok = FALSE;
+	    g_fprintf(stderr, "%s\n", b);
+	}
+	len = p - b + 1;
+	filter->first += len;
+	filter->size -= len;
+	b = p + 1;
+    }
+
+    if (nread <= 0) {
+	g_free(filter->buffer);
+    }
+}
+
+static void
+amptar_restore(
+    application_argument_t *argument)
+{
+    GPtrArray  *argv_ptr = g_ptr_array_new();
+    int         j;
+    char       *include_filename = NULL;
+    char       *exclude_filename = NULL;
+    int         tarpid;
+    filter_t    in_buf;
+    filter_t    out_buf;
+    filter_t    err_buf;
+    int         tarin, tarout, tarerr;
+    char       *errmsg = NULL;
+    amwait_t    wait_status;
+    char       *gnutar_realpath;
+    message_t  *message;
+
+    restore_ok = TRUE;
+    if (!gnutar_path) {
+	error(_("GNUTAR-PATH not defined"));
+    }
+
+    if ((message = check_exec_for_suid_message("GNUTAR_PATH", gnutar_path, &gnutar_realpath))) {
+	fprintf(stderr, "%s\n", get_message(message));
+	delete_message(message);
+	exit(1);
+    }
+
+    if (!security_allow_to_restore()) {
+	error("The user is not allowed to restore files");
+    }
+
+    g_ptr_array_add(argv_ptr, g_strdup(gnutar_realpath));
+    g_ptr_array_add(argv_ptr, g_strdup("--numeric-owner"));
+    /* ignore trailing zero blocks on input (this was the default until tar-1.21) */
+    g_ptr_array_add(argv_ptr, g_strdup("--ignore-zeros"));
+    g_ptr_array_add(argv_ptr, g_strdup("-xpGvf"));
+    g_ptr_array_add(argv_ptr, g_strdup("-"));
+    if (amptar_target) {
+	struct stat stat_buf;
+	if(stat(amptar_target, &stat_buf) != 0) {
+	    fprintf(stderr,"can not stat directory %s: %s\n", amptar_target, strerror(errno));
+	    exit(1);
+	}
+	if (!S_ISDIR(stat_buf.st_mode)) {
+	    fprintf(stderr,"%s is not a directory\n", amptar_target);
+	    exit(1);
+	}
+	if (access(amptar_target, W_OK) != 0) {
+	    fprintf(stderr, "Can't write to %s: %s\n", amptar_target, strerror(errno));
+	    exit(1);
+	}
+	g_ptr_array_add(argv_ptr, g_strdup("--directory"));
+	g_ptr_array_add(argv_ptr, g_strdup(amptar_target));
+    }
+    g_ptr_array_add(argv_ptr, g_strdup("--wildcards"));
+
+    if (argument->dle.exclude_list &&
+	argument->dle.exclude_list->nb_element == 1) {
+	FILE      *exclude;
+	char      *sdisk;
+	int        in_argv;
+	char       line[2*PATH_MAX];
+	FILE      *exclude_list;
+
+	if (argument->dle.disk) {
+	    sdisk = sanitise_filename(argument->dle.disk);
+	} else {
+	    sdisk = g_strdup_printf("no_dle-%d", (int)getpid());
+	}
+	exclude_filename= g_strjoin(NULL, AMANDA_TMPDIR, "/", "exclude-", sdisk,  NULL);
+	amfree(sdisk);
+	exclude_list = fopen(argument->dle.exclude_list->first->name, "r");
+	if (!exclude_list) {
+	    fprintf(stderr, "Cannot open exclude file '%s': %s\n",
+		    argument->dle.exclude_list->first->name, strerror(errno));
+	    error("Cannot open exclude file '%s': %s\n",
+		  argument->dle.exclude_list->first->name, strerror(errno));
+	    /*NOTREACHED*/
+	}
+	exclude = fopen(exclude_filename, "w");
+	if (!exclude) {
+	    fprintf(stderr, "Cannot open exclude file '%s': %s\n",
+		    exclude_filename, strerror(errno));
+	    fclose(exclude_list);
+	    error("Cannot open exclude file '%s': %s\n",
+		  exclude_filename, strerror(errno));
+	    /*NOTREACHED*/
+	}
+	while (fgets(line, 2*PATH_MAX, exclude_list)) {
+	    char *escaped;
+	    line[strlen(line)-1] = '\0'; /* remove '\n' */
+	    escaped = escape_tar_glob(line, &in_argv);
+	    if (in_argv) {
+		g_ptr_array_add(argv_ptr, g_strdup("--exclude"));
+		g_ptr_array_add(argv_ptr, escaped);
+	    } else {
+		fprintf(exclude,"%s\n", escaped);
+		amfree(escaped);
+	    }
+	}
+	fclose(exclude_list);
+	fclose(exclude);
+	g_ptr_array_add(argv_ptr, g_strdup("--exclude-from"));
+	g_ptr_array_add(argv_ptr, g_strdup(exclude_filename));
+    }
+
+    {
+	GPtrArray *argv_include = g_ptr_array_new();
+	FILE      *include;
+	char      *sdisk;
+	int        in_argv;
+	guint      i;
+	int        entry_in_include = 0;
+
+	if (argument->dle.disk) {
+	    sdisk = sanitise_filename(argument->dle.disk);
+	} else {
+	    sdisk = g_strdup_printf("no_dle-%d", (int)getpid());
+	}
+	include_filename = g_strjoin(NULL, AMANDA_TMPDIR, "/", "include-", sdisk,  NULL);
+	amfree(sdisk);
+	include = fopen(include_filename, "w");
+	if (!include) {
+	    fprintf(stderr, "Cannot open include file '%s': %s\n",
+		    include_filename, strerror(errno));
+	    error("Cannot open include file '%s': %s\n",
+		  include_filename, strerror(errno));
+	    /*NOTREACHED*/
+	}
+	if (argument->dle.include_list &&
+	    argument->dle.include_list->nb_element == 1) {
+	    char line[2*PATH_MAX];
+	    FILE *include_list = fopen(argument->dle.include_list->first->name, "r");
+	    if (!include_list) {
+		fclose(include);
+		fprintf(stderr, "Cannot open include file '%s': %s\n",
+			argument->dle.include_list->first->name,
+			strerror(errno));
+		error("Cannot open include file '%s': %s\n",
+		      argument->dle.include_list->first->name,
+		      strerror(errno));
+		/*NOTREACHED*/
+	    }
+	    while (fgets(line, 2*PATH_MAX, include_list)) {
+		char *escaped;
+		line[strlen(line)-1] = '\0'; /* remove '\n' */
+		if (!g_str_equal(line, ".")) {
+		    escaped = escape_tar_glob(line, &in_argv);
+		    if (in_argv) {
+			g_ptr_array_add(argv_include, escaped);
+		    } else {
+			fprintf(include,"%s\n", escaped);
+			entry_in_include++;
+			amfree(escaped);
+		    }
+		}
+	    }
+	    fclose(include_list);
+	}
+
+	for (j=1; j< argument->argc; j++) {
+	    if (!g_str_equal(argument->argv[j], ".")) {
+		char *escaped = escape_tar_glob(argument->argv[j], &in_argv);
+		if (in_argv) {
+		    g_ptr_array_add(argv_include, escaped);
+		} else {
+		    fprintf(include,"%s\n", escaped);
+		    entry_in_include++;
+		    amfree(escaped);
+		}
+	    }
+	}
+	fclose(include);
+
+	if (entry_in_include) {
+	    g_ptr_array_add(argv_ptr, g_strdup("--files-from"));
+	    g_ptr_array_add(argv_ptr, g_strdup(include_filename));
+	}
+
+	for (i = 0; i < argv_include->len; i++) {
+	    g_ptr_array_add(argv_ptr, (char *)g_ptr_array_index(argv_include,i));
+	}
+	g_ptr_array_free(argv_include, TRUE);
+    }
+    g_ptr_array_add(argv_ptr, NULL);
+
+    debug_executing(argv_ptr);
+
+    tarpid = pipespawnv(gnutar_realpath, STDIN_PIPE|STDOUT_PIPE|STDERR_PIPE, 1,
+			&tarin, &tarout, &tarerr, (char **)argv_ptr->pdata);
+
+    memset(&in_buf, 0, sizeof(in_buf));
+    in_buf.fd = 0;
+    in_buf.out = tarin;
+    in_buf.name = "stdin";
+
+    memset(&out_buf, 0, sizeof(out_buf));
+    out_buf.fd = tarout;
+    out_buf.name = "stdout";
+
+    memset(&err_buf, 0, sizeof(err_buf));
+    err_buf.fd = tarerr;
+    err_buf.name = "stderr";
+
+    in_buf.event = event_create((event_id_t)0, EV_READFD,
+			    handle_restore_stdin, &in_buf);
+    out_buf.event = event_create((event_id_t)tarout, EV_READFD,
+			    handle_restore_output, &out_buf);
+    err_buf.event = event_create((event_id_t)tarerr, EV_READFD,
+			    handle_restore_output, &err_buf);
+    event_activate(in_buf.event);
+    event_activate(out_buf.event);
+    event_activate(err_buf.event);
+
+    event_loop(0);
+
+    waitpid(tarpid, &wait_status, 0);
+    if (WIFSIGNALED(wait_status)) {
+	errmsg = g_strdup_printf(_("%s terminated with signal %d: see %s"),
+				 gnutar_path, WTERMSIG(wait_status), dbfn());
+	amptar_exit_value = 1;
+    } else if (WIFEXITED(wait_status) && WEXITSTATUS(wait_status) > 0) {
+	errmsg = g_strdup_printf(_("%s exited with status %d: see %s"),
+				 gnutar_path, WEXITSTATUS(wait_status), dbfn());
+	amptar_exit_value = 1;
+    } else if (!restore_ok) {
+	amptar_exit_value = 1;
+    }
+
+    g_debug(_("amptar: %s: pid %ld"), gnutar_path, (long)tarpid);
+    if (errmsg) {
+	g_debug("%s", errmsg);
+	fprintf(stderr, "error [%s]\n", errmsg);
+    }
+
+    if (argument->verbose == 0) {
+	if (exclude_filename)
+	    unlink(exclude_filename);
+	unlink(include_filename);
+    }
+    g_ptr_array_free_full(argv_ptr);
+    amfree(gnutar_realpath);
+    amfree(include_filename);
+    amfree(exclude_filename);
+
+    g_free(errmsg);
+}
+
+static void
+amptar_validate(
+    application_argument_t *argument G_GNUC_UNUSED)
+{
+    char       *cmd = NULL;
+    GPtrArray  *argv_ptr = g_ptr_array_new();
+    char      **env;
+    char       *e;
+    char        buf[32768];
+
+    if (!gnutar_path) {
+	g_debug("GNUTAR-PATH not set; Piping to /dev/null");
+	fprintf(stderr,"GNUTAR-PATH not set; Piping to /dev/null\n");
+	goto pipe_to_null;
+    }
+
+    cmd = g_strdup(gnutar_path);
+    g_ptr_array_add(argv_ptr, g_strdup(gnutar_path));
+    /* ignore trailing zero blocks on input (this was the default until tar-1.21) */
+    g_ptr_array_add(argv_ptr, g_strdup("--ignore-zeros"));
+    g_ptr_array_add(argv_ptr, g_strdup("-tf"));
+    g_ptr_array_add(argv_ptr, g_strdup("-"));
+    g_ptr_array_add(argv_ptr, NULL);
+
+    debug_executing(argv_ptr);
+    env = safe_env();
+    execve(cmd, (char **)argv_ptr->pdata, env);
+    e = strerror(errno);
+    g_debug("failed to execute %s: %s; Piping to /dev/null", cmd, e);
+    fprintf(stderr,"failed to execute %s: %s; Piping to /dev/null\n", cmd, e);
+    free_env(env);
+pipe_to_null:
+    while (read(0, buf, 32768) > 0) {
+    }
+    amfree(cmd);
+}
+
+static void
+amptar_index(
+    application_argument_t *argument G_GNUC_UNUSED)
+{
+    char       *cmd = NULL;
+    GPtrArray  *argv_ptr = g_ptr_array_new();
+    int         datain = 0;
+    int         indexf;
+    int         errf = 2;
+    pid_t       tarpid;
+    FILE       *indexstream;
+    char        line[32768];
+    amwait_t    wait_status;
+    char       *errmsg = NULL;
+
+    if (!gnutar_path) {
+	g_debug("GNUTAR-PATH not set");
+	fprintf(stderr,"GNUTAR-PATH not set");
+	while (read(0, line, 32768) > 0) {
+	}
+	exit(1);
+    }
+
+    cmd = g_strdup(gnutar_path);
+    g_ptr_array_add(argv_ptr, g_strdup(gnutar_path));
+    /* ignore trailing zero blocks on input (this was the default until tar-1.21) */
+    g_ptr_array_add(argv_ptr, g_strdup("--ignore-zeros"));
+    g_ptr_array_add(argv_ptr, g_strdup("-tf"));
+    g_ptr_array_add(argv_ptr, g_strdup("-"));
+    g_ptr_array_add(argv_ptr, NULL);
+
+    tarpid = pipespawnv(cmd, STDOUT_PIPE, 0,
+			&datain, &indexf, &errf, (char **)argv_ptr->pdata);
+    aclose(datain);
+
+    indexstream = fdopen(indexf, "r");
+    if (!indexstream) {
+	error(_("error indexstream(%d): %s\n"), indexf, strerror(errno));
+    }
+
+    while (fgets(line, sizeof(line), indexstream) != NULL) {
+	if (strlen(line) > 0 && line[strlen(line)-1] == '\n') {
+	    /* remove trailling \n */
+	    line[strlen(line)-1] = '\0';
+	}
+	if (*line == '.' && *(line+1) == '/') { /* filename */
+	    fprintf(stdout, "%s\n", &line[1]); /* remove . */
+	}
+    }
+    fclose(indexstream);
+    waitpid(tarpid, &wait_status, 0);
+    if (WIFSIGNALED(wait_status)) {
+	errmsg = g_strdup_printf(_("%s terminated with signal %d: see %s"),
+				 cmd, WTERMSIG(wait_status), dbfn());
+    } else if (WIFEXITED(wait_status) && WEXITSTATUS(wait_status) > 0) {
+	errmsg = g_strdup_printf(_("%s exited with status %d: see %s"),
+				 cmd, WEXITSTATUS(wait_status), dbfn());
+    }
+    g_debug(_("amptar: %s: pid %ld"), cmd, (long)tarpid);
+    if (errmsg) {
+	g_debug("%s", errmsg);
+	fprintf(stderr, "error [%s]\n", errmsg);
+	amfree(errmsg);
+    }
+
+    g_ptr_array_free_full(argv_ptr);
+    amfree(cmd);
+}
+
+static void
+amptar_build_exinclude(
+    dle_t  *dle,
+    int    *nb_exclude,
+    char  **file_exclude,
+    int    *nb_include,
+    char  **file_include,
+    char   *dirname,
+    messagelist_t *mlist)
+{
+    int n_exclude = 0;
+    int n_include = 0;
+    char *exclude = NULL;
+    char *include = NULL;
+
+    if (dle->exclude_file) n_exclude += dle->exclude_file->nb_element;
+    if (dle->exclude_list) n_exclude += dle->exclude_list->nb_element;
+    if (dle->include_file) n_include += dle->include_file->nb_element;
+    if (dle->include_list) n_include += dle->include_list->nb_element;
+
+    if (n_exclude > 0) exclude = build_exclude(dle, mlist);
+    if (n_include > 0) include = build_include(dle, dirname, mlist);
+
+    if (nb_exclude)
+	*nb_exclude = n_exclude;
+    if (file_exclude)
+	*file_exclude = exclude;
+    else
+	amfree(exclude);
+
+    if (nb_include)
+	*nb_include = n_include;
+    if (file_include)
+	*file_include = include;
+    else
+	amfree(include);
+}
@@ -33,10 +33,11 @@ use IO::Handle;
 use Amanda::Constants;
 use Amanda::Debug qw( :logging );
 use Amanda::Util qw( quote_string );
+use Time::HiRes;
 
 sub new {
     my $class = shift;
-    my ($config, $host, $disk, $device, $level, $index, $message, $collection, $record, $calcsize, $include_list, $exclude_list, $target, $size, $size_level_1, $min_size, $max_size, $block_size, $min_block_size, $max_block_size, $print_to_stderr, $cmd_from_sendbackup, $cmd_to_sendbackup, $server_backup_result) = @_;
+    my ($config, $host, $disk, $device, $level, $index, $message, $collection, $record, $calcsize, $include_list, $exclude_list, $target, $size, $size_level_1, $min_size, $max_size, $block_size, $min_block_size, $max_block_size, $rate, $latency, $data, $print_to_stderr, $cmd_from_sendbackup, $cmd_to_sendbackup, $server_backup_result) = @_;
     my $self = $class->SUPER::new($config);
 
     $self->{config}           = $config;
@@ -67,6 +68,9 @@ sub new {
     $self->{block_size}	      = $block_size;
     $self->{min_block_size}   = $min_block_size || 1;
     $self->{max_block_size}   = $max_block_size || 32768;
+    $self->{rate}	      = $rate;
+    $self->{latency}	      = $latency;
+    $self->{data}	      = $data || 'random';
     $self->{print_to_stderr}  = $print_to_stderr;
     $self->{cmd_from_sendbackup}  = $cmd_from_sendbackup;
     $self->{cmd_to_sendbackup}    = $cmd_to_sendbackup;
@@ -158,6 +162,9 @@ sub command_estimate {
 			       $Amanda::Script_App::ERROR);
     }
 
+    # a slow client is slow to answer the estimate too
+    Time::HiRes::sleep($self->{latency}) if $self->{latency};
+
     if ($level == 0) {
 	output_size($level, $self->{size});
     } else {
@@ -215,10 +222,21 @@ sub command_backup {
     if (defined $self->{blocksize} && $self->{blocksize} < $buf_size) {
 	$buf_size = $self->{blocksize};
     }
-    for (my $i=0; $i<$buf_size; $i++) {
-	$buffer .= chr(int(rand(256)));
+    if ($self->{data} eq 'pattern') {
+	# compressible data, like the xfer-source-pattern element
+	my $pattern = "amrandom pattern data\n";
+	$buffer .= $pattern x (int($buf_size / length($pattern)) + 1);
+    } else {
+	for (my $i=0; $i<$buf_size; $i++) {
+	    $buffer .= chr(int(rand(256)));
+	}
     }
 
+    # LATENCY is the time to the first byte, RATE caps the bytes per second
+    Time::HiRes::sleep($self->{latency}) if $self->{latency};
+    my $start = Time::HiRes::time();
+    my $written = 0;
+
     my $size;
     if ($level == 0) {
 	$size = $self->{size};
@@ -241,7 +259,12 @@ sub command_backup {
 	} elsif ($n ne $block_size) {
 	    debug("Bad write $n != $block_size");
 	}
-	$size -= $block_size
+	$size -= $block_size;
+	$written += $block_size;
+	if ($self->{rate}) {
+	    my $ahead = $written / $self->{rate} - (Time::HiRes::time() - $start);
+	    Time::HiRes::sleep($ahead) if $ahead > 0;
+	}
     }
     POSIX::close($out);
     if (defined($self->{index})) {
@@ -351,6 +374,9 @@ my $opt_max_size;
 my $opt_block_size;
 my $opt_min_block_size;
 my $opt_max_block_size;
+my $opt_rate;
+my $opt_latency;
+my $opt_data;
 my $opt_print_to_stderr;
 my $opt_cmd_from_sendbackup;
 my $opt_cmd_to_sendbackup;
@@ -381,6 +407,9 @@ GetOptions(
     'block-size=s'	 => \$opt_block_size,
     'min-block-size=s'	 => \$opt_min_block_size,
     'max-block-size=s'	 => \$opt_max_block_size,
+    'rate=s'		 => \$opt_rate,
+    'latency=s'		 => \$opt_latency,
+    'data=s'		 => \$opt_data,
     'print-to-stderr=s'  => \$opt_print_to_stderr,
     'cmd-from-sendbackup=s' => \$opt_cmd_from_sendbackup,
     'cmd-to-sendbackup=s' => \$opt_cmd_to_sendbackup,
@@ -392,7 +421,7 @@ if (defined $opt_version) {
     exit(0);
 }
 
-my $application = Amanda::Application::Amrandom->new($opt_config, $opt_host, $opt_disk, $opt_device, \@opt_level, $opt_index, $opt_message, $opt_collection, $opt_record, $opt_calcsize, \@opt_include_list, \@opt_exclude_list, $opt_target, $opt_size, $opt_size_level_1, $opt_min_size, $opt_max_size, $opt_block_size, $opt_min_block_size, $opt_max_block_size, $opt_print_to_stderr, $opt_cmd_from_sendbackup, $opt_cmd_to_sendbackup, $opt_server_backup_result);
+my $application = Amanda::Application::Amrandom->new($opt_config, $opt_host, $opt_disk, $opt_device, \@opt_level, $opt_index, $opt_message, $opt_collection, $opt_record, $opt_calcsize, \@opt_include_list, \@opt_exclude_list, $opt_target, $opt_size, $opt_size_level_1, $opt_min_size, $opt_max_size, $opt_block_size, $opt_min_block_size, $opt_max_block_size, $opt_rate, $opt_latency, $opt_data, $opt_print_to_stderr, $opt_cmd_from_sendbackup, $opt_cmd_to_sendbackup, $opt_server_backup_result);
 
 Amanda::Debug::debug("Arguments: " . join(' ', @orig_argv));
 
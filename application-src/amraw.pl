@@ -36,7 +36,7 @@ use Amanda::Util qw( quote_string );
 
 sub new {
     my $class = shift;
-    my ($config, $host, $disk, $device, $level, $index, $message, $collection, $record, $calcsize, $include_list, $exclude_list, $target, $cmd_from_sendbackup, $cmd_to_sendbackup, $server_backup_result) = @_;
+    my ($config, $host, $disk, $device, $level, $index, $message, $collection, $record, $calcsize, $include_list, $exclude_list, $target, $cmd_from_sendbackup, $cmd_to_sendbackup, $server_backup_result, $resume_offset) = @_;
     my $self = $class->SUPER::new($config);
 
     $self->{config}           = $config;
@@ -63,6 +63,7 @@ sub new {
     $self->{cmd_from_sendbackup} = $cmd_from_sendbackup;
     $self->{cmd_to_sendbackup} = $cmd_to_sendbackup;
     $self->{server_backup_result} = $server_backup_result;
+    $self->{resume_offset}    = $resume_offset;
 
     return $self;
 }
@@ -85,6 +86,7 @@ sub command_support {
     print "CLIENT-ESTIMATE YES\n";
     print "CMD-STREAM YES\n";
     print "WANT-SERVER-BACKUP-RESULT YES\n";
+    print "RESUME YES\n";
 }
 
 sub command_selfcheck {
@@ -208,6 +210,15 @@ sub command_backup {
 				       $Amanda::Script_App::ERROR);
     }
     my $size = 0;
+    # the server already has the first bytes of the dump
+    if ($self->{resume_offset}) {
+	if (!defined POSIX::lseek($fd, $self->{resume_offset}, &POSIX::SEEK_SET)) {
+	    $self->print_to_server_and_die("Can't seek '$self->{device}' to $self->{resume_offset}: $!",
+					   $Amanda::Script_App::ERROR);
+	}
+	$size = $self->{resume_offset};
+	debug("resuming the backup at $size bytes");
+    }
     my $s;
     my $buffer;
     my $out = fileno(STDOUT);
@@ -314,6 +325,7 @@ my $opt_target;
 my $opt_cmd_from_sendbackup;
 my $opt_cmd_to_sendbackup;
 my $opt_server_backup_result;
+my $opt_resume_offset;
 
 my @orig_argv = @ARGV;
 
@@ -336,6 +348,7 @@ GetOptions(
     'cmd-from-sendbackup=s'=> \$opt_cmd_from_sendbackup,
     'cmd-to-sendbackup=s'  => \$opt_cmd_to_sendbackup,
     'server-backup-result' => \$opt_server_backup_result,
+    'resume-offset=s'      => \$opt_resume_offset,
 ) or usage();
 
 if (defined $opt_version) {
@@ -343,7 +356,7 @@ if (defined $opt_version) {
     exit(0);
 }
 
-my $application = Amanda::Application::Amraw->new($opt_config, $opt_host, $opt_disk, $opt_device, \@opt_level, $opt_index, $opt_message, $opt_collection, $opt_record, $opt_calcsize, \@opt_include_list, \@opt_exclude_list, $opt_target, $opt_cmd_from_sendbackup, $opt_cmd_to_sendbackup, $opt_server_backup_result);
+my $application = Amanda::Application::Amraw->new($opt_config, $opt_host, $opt_disk, $opt_device, \@opt_level, $opt_index, $opt_message, $opt_collection, $opt_record, $opt_calcsize, \@opt_include_list, \@opt_exclude_list, $opt_target, $opt_cmd_from_sendbackup, $opt_cmd_to_sendbackup, $opt_server_backup_result, $opt_resume_offset);
 
 Amanda::Debug::debug("Arguments: " . join(' ', @orig_argv));
 
@@ -39,7 +39,7 @@ use Amanda::Util qw( :constants quote_string );
 
 sub new {
     my $class = shift;
-    my ($config, $host, $disk, $device, $level, $index, $message, $collection, $record, $df_path, $zfs_path, $pfexec_path, $pfexec, $keep_snapshot, $exclude_list, $include_list, $target) = @_;
+    my ($config, $host, $disk, $device, $level, $index, $message, $collection, $record, $df_path, $zfs_path, $pfexec_path, $pfexec, $keep_snapshot, $exclude_list, $include_list, $target, $estimate_dryrun) = @_;
     my $self = $class->SUPER::new($config);
 
     $self->{config}     = $config;
@@ -68,6 +68,7 @@ sub new {
     $self->{exclude_list}  = [ @{$exclude_list} ];
     $self->{include_list}  = [ @{$include_list} ];
     $self->{target}        = $target;
+    $self->{estimate_dryrun} = $estimate_dryrun =~ /^YES$/i ? "YES" : "NO";
 
     if ($self->{keep_snapshot} =~ /^YES$/i) {
         $self->{keep_snapshot} = "YES";
@@ -254,6 +255,9 @@ sub estimate_snapshot
     debug "\$snapshot = $self->{snapshot}";
     debug "\$level = $level";
 
+    return $self->estimate_snapshot_dryrun($level)
+	if $self->{estimate_dryrun} eq "YES";
+
     my $cmd;
     if ($level == 0) {
       $cmd = "$self->{pfexec_cmd} $self->{zfs_path} get -Hp -o value referenced $self->{filesystem}\@$self->{snapshot}";
@@ -296,6 +300,44 @@ sub estimate_snapshot
     return $msg;
 }
 
+# The size of the stream, as computed by 'zfs send -nP' from the snapshot
+# metadata, without reading the data.
+sub estimate_snapshot_dryrun
+{
+    my $self = shift;
+    my $level = shift;
+
+    my $cmd = "$self->{pfexec_cmd} $self->{zfs_path} send -nP";
+    if ($level > 0) {
+	my $refsnapshotname = $self->zfs_find_snapshot_level($level-1);
+	debug "Referenced snapshot name: $refsnapshotname|";
+	return "-1" if $refsnapshotname eq "";
+	$cmd .= " -i $refsnapshotname";
+    }
+    $cmd .= " $self->{filesystem}\@$self->{snapshot}";
+    debug "running (estimate): $cmd";
+    my($wtr, $rdr, $err, $pid);
+    $err = Symbol::gensym;
+    $pid = open3($wtr, $rdr, $err, $cmd);
+    close $wtr;
+    # some zfs versions print the dry-run summary on stderr
+    my @lines = (<$rdr>, <$err>);
+    waitpid $pid, 0;
+    close $rdr;
+    close $err;
+    my $size;
+    for my $line (@lines) {
+	$size = $1 if $line =~ /^size\s+(\d+)/;
+    }
+    if ($? != 0 || !defined $size) {
+	chomp @lines;
+	my $msg = @lines ? join(", ", @lines) : "unknown reason";
+	$self->print_to_server_and_die("cannot estimate snapshot '$self->{filesystem}\@$self->{snapshot}': $msg", $Amanda::Script_App::ERROR);
+    }
+
+    return $size;
+}
+
 sub get_compratio
 {
     my $self = shift;
@@ -450,7 +492,7 @@ package main;
 
 sub usage {
     print <<EOF;
-Usage: amzfs-sendrecv <command> --config=<config> --host=<host> --disk=<disk> --device=<device> --level=<level> --index=<yes|no> --message=<text> --collection=<no> --record=<yes|no> --df-path=<path/to/df> --zfs-path=<path/to/zfs> --pfexec-path=<path/to/pfexec> --pfexec=<yes|no> --keep-snapshot=<yes|no>.
+Usage: amzfs-sendrecv <command> --config=<config> --host=<host> --disk=<disk> --device=<device> --level=<level> --index=<yes|no> --message=<text> --collection=<no> --record=<yes|no> --df-path=<path/to/df> --zfs-path=<path/to/zfs> --pfexec-path=<path/to/pfexec> --pfexec=<yes|no> --keep-snapshot=<yes|no> --estimate-dryrun=<yes|no>.
 EOF
     exit(1);
 }
@@ -473,6 +515,7 @@ my $opt_keep_snapshot = "YES";
 my @opt_exclude_list;
 my @opt_include_list;
 my $opt_target;
+my $opt_estimate_dryrun = "NO";
 
 my @orig_argv = @ARGV;
 
@@ -496,6 +539,7 @@ GetOptions(
     'exclude-list=s'  => \@opt_exclude_list,
     'include-list=s'  => \@opt_include_list,
     'target|directory=s' => \$opt_target,
+    'estimate-dryrun=s' => \$opt_estimate_dryrun,
 ) or usage();
 
 if (defined $opt_version) {
@@ -503,7 +547,7 @@ if (defined $opt_version) {
     exit(0);
 }
 
-my $application = Amanda::Application::Amzfs_sendrecv->new($opt_config, $opt_host, $opt_disk, $opt_device, \@opt_level, $opt_index, $opt_message, $opt_collection, $opt_record, $df_path, $zfs_path, $pfexec_path, $pfexec, $opt_keep_snapshot, \@opt_exclude_list, \@opt_include_list, $opt_target);
+my $application = Amanda::Application::Amzfs_sendrecv->new($opt_config, $opt_host, $opt_disk, $opt_device, \@opt_level, $opt_index, $opt_message, $opt_collection, $opt_record, $df_path, $zfs_path, $pfexec_path, $pfexec, $opt_keep_snapshot, \@opt_exclude_list, \@opt_include_list, $opt_target, $opt_estimate_dryrun);
 
 Amanda::Debug::debug("Arguments: " . join(' ', @orig_argv));
 
@@ -36,6 +36,38 @@
 
 #define BUFFER 262144
 
+#ifdef HAVE_SPLICE
+/*
+ * Move the data from stdin to stdout in the kernel, counting it from the
+ * lengths splice() returns; it needs a pipe on one side.  Returns -1 if
+ * splice can not be used and nothing was moved, 1 on error and 0 at EOF.
+ */
+static int
+splice_copy(
+    off_t *total)
+{
+    struct stat st0, st1;
+    ssize_t size;
+
+    if (fstat(0, &st0) < 0 || fstat(1, &st1) < 0 ||
+	(!S_ISFIFO(st0.st_mode) && !S_ISFIFO(st1.st_mode)))
+	return -1;
+
+    while ((size = splice(0, NULL, 1, NULL, BUFFER,
+			  SPLICE_F_MOVE | SPLICE_F_MORE)) != 0) {
+	if (size < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if (*total == 0 && (errno == EINVAL || errno == ENOSYS))
+		return -1;
+	    return 1;
+	}
+	*total += size;
+    }
+    return 0;
+}
+#endif
+
 int main(int argc, char **argv);
 int
 main(
@@ -47,6 +79,17 @@ main(
     off_t size;
     off_t sizew;
 
+#ifdef HAVE_SPLICE
+    switch (splice_copy(&total)) {
+    case 0:
+	fprintf(stderr, "%ju", (uintmax_t)total);
+	return 0;
+    case 1:
+	fprintf(stderr, "%ju", (uintmax_t)total);
+	exit(-1);
+    }
+#endif
+
     while ((size = safe_read(0, buffer, BUFFER)) > 0) {
 	if ((sizew = full_write(1, buffer, size)) < size) {
 	    total += sizew;
@@ -41,6 +41,7 @@
 static amandates_t *amandates_list = NULL;
 static FILE *amdf = NULL;
 static int updated, readonly;
+static int nb_lines;		/* lines in the file, for compaction */
 static char *g_amandates_file = NULL;
 static void import_dumpdates(amandates_t *);
 static void enter_record(char *, int , time_t);
@@ -75,6 +76,7 @@ start_amandates(
     /* initialize state */
 
     updated = 0;
+    nb_lines = 0;
     readonly = !open_readwrite;
     amdf = NULL;
     amandates_list = NULL;
@@ -139,6 +141,7 @@ start_amandates(
 	    continue;
 	}
 
+	nb_lines++;
 	enter_record(name, level, (time_t) ldate);
 	amfree(name);
     }
@@ -168,15 +171,45 @@ finish_amandates(void)
 	    /*NOTREACHED*/
 	}
 
-	rewind(amdf);
+	/*
+	 * A later line of the file overrides an earlier one for the same
+	 * name and level, so the updates are appended; the file is rewritten
+	 * only when the overridden lines are as many as the live ones.
+	 */
+	int nb_records = 0;
+	int nb_changed = 0;
+
 	for(amdp = amandates_list; amdp != NULL; amdp = amdp->next) {
 	    for(level = 0; level < DUMP_LEVELS; level++) {
 		if(amdp->dates[level] == EPOCH) continue;
+		nb_records++;
+		if (amdp->changed & (1 << level))
+		    nb_changed++;
+	    }
+	}
+
+	if (nb_lines + nb_changed <= 2 * nb_records) {
+	    fseek(amdf, 0L, SEEK_END);
+	} else {
+	    rewind(amdf);
+	}
+	for(amdp = amandates_list; amdp != NULL; amdp = amdp->next) {
+	    for(level = 0; level < DUMP_LEVELS; level++) {
+		if(amdp->dates[level] == EPOCH) continue;
+		if (nb_lines + nb_changed <= 2 * nb_records &&
+		    !(amdp->changed & (1 << level)))
+		    continue;
 		qname = quote_string(amdp->name);
 		g_fprintf(amdf, "%s %d %ld\n",
 			qname, level, (long) amdp->dates[level]);
 		amfree(qname);
 	    }
+	    amdp->changed = 0;
+	}
+	if (fflush(amdf) != 0 ||
+	    ftruncate(fileno(amdf), ftell(amdf)) != 0) {
+	    error(_("error [writing %s: %s]"), g_amandates_file, strerror(errno));
+	    /*NOTREACHED*/
 	}
     }
 
@@ -228,6 +261,7 @@ lookup(
 	newp->name = g_strdup(name);
 	for (level = 0; level < DUMP_LEVELS; level++)
 	    newp->dates[level] = EPOCH;
+	newp->changed = 0;
 	newp->next = amdp;
 	if (prevp != NULL) {
 #ifndef __lint	/* Remove complaint about NULL pointer assignment */
@@ -279,6 +313,7 @@ enter_record(
     }
 
     amdp->dates[level] = dumpdate;
+    amdp->changed &= ~(1 << level);	/* the file has it */
 }
 
 
@@ -312,6 +347,7 @@ amandates_updateone(
     }
 
     amdp->dates[level] = dumpdate;
+    amdp->changed |= 1 << level;
     updated = 1;
 }
 
@@ -371,6 +407,7 @@ import_dumpdates(
 	if(dumpdate != -1 && dumpdate > amdp->dates[level]) {
 	    if(!readonly) updated = 1;
 	    amdp->dates[level] = dumpdate;
+	    amdp->changed |= 1 << level;
 	}
     }
     afclose(dumpdf);
@@ -41,6 +41,7 @@ typedef struct amandates_s {
     struct amandates_s *next;
     char *name;				/* filesystem name */
     time_t dates[DUMP_LEVELS];		/* dump dates */
+    int changed;			/* bitmask of the levels updated */
 } amandates_t;
 
 int  start_amandates (char *amandates_file, int open_readwrite);
@@ -0,0 +1,163 @@
+#! @PERL@
+# Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+# for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+#
+# Contact information: Carbonite Inc., 756 N Pastoria Ave
+# Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
+
+use lib '@amperldir@';
+use strict;
+use warnings;
+
+use Getopt::Long;
+use File::Find;
+use Sys::Hostname;
+
+use Amanda::Util qw( :constants );
+use Amanda::Debug qw( debug );
+
+Amanda::Util::setup_application("amsplitdle", "client", $CONTEXT_CMDLINE, "amanda", "amanda");
+
+my $opt_shards = 4;
+my $opt_depth = 1;
+my $opt_dumptype = "comp-user-tar";
+my $opt_host = hostname();
+
+sub usage {
+    print STDERR <<EOF;
+Usage: amsplitdle [--shards N] [--depth N] [--dumptype NAME] [--host HOST]
+                  directory [diskname]
+EOF
+    exit(1);
+}
+
+debug("Arguments: " . join(' ', @ARGV));
+Getopt::Long::Configure(qw{bundling});
+GetOptions(
+    'version' => \&Amanda::Util::version_opt,
+    'shards=i' => \$opt_shards,
+    'depth=i' => \$opt_depth,
+    'dumptype=s' => \$opt_dumptype,
+    'host=s' => \$opt_host,
+) or usage();
+
+usage() if @ARGV < 1 || @ARGV > 2 || $opt_shards < 1 || $opt_depth < 1;
+my $dir = $ARGV[0];
+$dir =~ s{(.)/+$}{$1};
+my $diskname = $ARGV[1] || $dir;
+
+my @dir_stat = lstat($dir);
+if (!@dir_stat || ! -d _) {
+    print STDERR "amsplitdle: '$dir' is not a directory\n";
+    exit(1);
+}
+my $dev = $dir_stat[0];
+
+# The units are the entries $opt_depth levels below $dir, and the entries
+# that are not directories above that level.  Each one is sized with all
+# the files below it, without crossing a filesystem, as gtar
+# --one-file-system does.
+my %unit_size;
+find({
+    no_chdir => 1,
+    wanted => sub {
+	my $path = $File::Find::name;
+	my @st = lstat($path);
+	return if !@st;
+	if ($st[0] != $dev) {
+	    $File::Find::prune = 1;
+	    return;
+	}
+	return if $path eq $dir;
+
+	my $rel = substr($path, length($dir) + 1);
+	my @parts = split(m{/}, $rel);
+	my $unit = join('/', @parts[0 .. ($#parts < $opt_depth-1 ? $#parts : $opt_depth-1)]);
+	if (@parts < $opt_depth && -d _) {
+	    # a directory above the units: its own blocks go to the last shard
+	    $unit_size{''} += $st[12] * 512 if $st[12];
+	    return;
+	}
+	$unit_size{$unit} += defined $st[12] ? $st[12] * 512 : $st[7];
+    },
+}, $dir);
+
+# the space of the upper directories is dumped by the catch-all shard
+my $upper_size = delete $unit_size{''} || 0;
+
+# Largest entries first, each one to the shard with the least to dump
+my @shard_size = (0) x $opt_shards;
+my @shard_units = map { [] } 1 .. $opt_shards;
+$shard_size[$opt_shards-1] = $upper_size;
+for my $unit (sort { $unit_size{$b} <=> $unit_size{$a} || $a cmp $b }
+	      keys %unit_size) {
+    my $min = 0;
+    for my $i (1 .. $opt_shards-1) {
+	$min = $i if $shard_size[$i] < $shard_size[$min];
+    }
+    push @{$shard_units[$min]}, $unit;
+    $shard_size[$min] += $unit_size{$unit};
+}
+debug("shard $_: " . int($shard_size[$_]/1024) . " KB, "
+      . scalar(@{$shard_units[$_]}) . " entries") for 0 .. $opt_shards-1;
+
+# a disklist string: the name is escaped for the glob of gtar, then quoted
+sub quote_pattern {
+    my ($name) = @_;
+
+    $name =~ s/([\\*?\[])/\\$1/g;
+    $name = "./$name";
+    $name =~ s/([\\"])/\\$1/g;
+    return "\"$name\"";
+}
+
+sub quote_string {
+    my ($str) = @_;
+
+    $str =~ s/([\\"])/\\$1/g;
+    return "\"$str\"";
+}
+
+my $total = 0;
+$total += $_ for @shard_size;
+print "# $dir: " . scalar(keys %unit_size) . " entries, "
+    . int($total/1024) . " KB in $opt_shards shards\n";
+
+# The last shard excludes what the others include, so that the entries
+# created after the split are still dumped.
+my @included;
+for my $i (0 .. $opt_shards-1) {
+    my @units = sort @{$shard_units[$i]};
+    my $last = $i == $opt_shards-1;
+
+    next if !$last && !@units;
+    print "# shard " . ($i+1) . ": " . int($shard_size[$i]/1024) . " KB\n";
+    print quote_string($opt_host) . " " . quote_string("$diskname-" . ($i+1))
+	. " " . quote_string($dir) . " {\n";
+    print "    $opt_dumptype\n";
+    if (!$last) {
+	print "    include file " . join(" ", map { quote_pattern($_) } @units)
+	    . "\n";
+	push @included, @units;
+    } elsif (@included) {
+	print "    exclude file " . join(" ", map { quote_pattern($_) }
+					 sort @included) . "\n";
+    }
+    print "}\n";
+}
+
+Amanda::Util::finish_application();
+exit(0);
@@ -64,29 +64,26 @@ round_function(n, x)
 
 #define	FILETYPES	(S_IFREG|S_IFLNK|S_IFDIR)
 
-typedef struct name_s {
-    struct name_s *next;
-    char *str;
-} Name;
-
-Name *name_stack;
-
 #define MAXDUMPS 10
 
-struct {
+typedef struct dumpstats_s {
     int max_inode;
     int total_dirs;
     int total_files;
     off_t total_size;
     off_t total_size_name;
-} dumpstats[MAXDUMPS];
+} dumpstats_t;
+
+/* the totals of all the threads, for final_size */
+dumpstats_t dumpstats[MAXDUMPS];
 
 time_t dumpdate[MAXDUMPS];
 int  dumplevel[MAXDUMPS];
 int ndumps;
 
-void (*add_file_name)(int, char *);
-void (*add_file)(int, struct stat *);
+/* add_file_name and add_file add to the STATS of the calling thread */
+void (*add_file_name)(dumpstats_t *, int, char *);
+void (*add_file)(dumpstats_t *, int, struct stat *);
 off_t (*final_size)(int, char *);
 
 
@@ -94,29 +91,33 @@ int main(int, char **);
 void traverse_dirs(char *, char *);
 
 
-void add_file_name_dump(int, char *);
-void add_file_dump(int, struct stat *);
+void add_file_name_dump(dumpstats_t *, int, char *);
+void add_file_dump(dumpstats_t *, int, struct stat *);
 off_t final_size_dump(int, char *);
 
-void add_file_name_star(int, char *);
-void add_file_star(int, struct stat *);
+void add_file_name_star(dumpstats_t *, int, char *);
+void add_file_star(dumpstats_t *, int, struct stat *);
 off_t final_size_star(int, char *);
 
-void add_file_name_gnutar(int, char *);
-void add_file_gnutar(int, struct stat *);
+void add_file_name_gnutar(dumpstats_t *, int, char *);
+void add_file_gnutar(dumpstats_t *, int, struct stat *);
 off_t final_size_gnutar(int, char *);
 
-void add_file_name_unknown(int, char *);
-void add_file_unknown(int, struct stat *);
+void add_file_name_unknown(dumpstats_t *, int, char *);
+void add_file_unknown(dumpstats_t *, int, struct stat *);
 off_t final_size_unknown(int, char *);
 
 am_sl_t *calc_load_file(char *filename);
+void calc_compile_exclude(void);
 int calc_check_exclude(char *filename);
 
 int use_star_excl = 0;
 int use_gtar_excl = 0;
 am_sl_t *include_sl=NULL, *exclude_sl=NULL;
 
+/* exclude_sl, compiled by calc_compile_exclude */
+tar_matcher_t *exclude_tm = NULL;
+
 int
 main(
     int		argc,
@@ -180,6 +181,8 @@ main(
 	return (0);
     }
 
+    glib_init();
+
     safe_fd(-1, 0);
     safe_cd();
 
@@ -340,6 +343,8 @@ main(
 	/*NOTREACHED*/
     }
 
+    calc_compile_exclude();
+
     if(is_empty_sl(include_sl)) {
 	traverse_dirs(dirname,".");
     }
@@ -393,155 +398,219 @@ basename(
 }
 #endif
 
-void push_name(char *str);
-char *pop_name(void);
+/*
+ * The directories are read by calcsize-threads threads.  The directories
+ * found and not read yet are on a stack shared by the threads; a thread
+ * takes the next one when it is done with a directory, and pushes the
+ * subdirectories it found at once.  Each thread adds up its own dumpstats,
+ * which are added to the global ones when the walk is done.
+ */
+typedef struct walk_s {
+    GMutex *mutex;
+    GCond  *cond;
+    GSList *dirs;	/* the directories to read */
+    int     busy;	/* the threads reading a directory */
+    size_t  parent_len;
+    dev_t   parent_dev;
+    int     has_exclude;
+} walk_t;
+
+static void walk_dir(walk_t *walk, char *dirname, dumpstats_t *stats,
+		     GSList **subdirs);
+static gpointer walk_thread(gpointer data);
 
 void
 traverse_dirs(
     char *	parent_dir,
     char *	include)
 {
-    DIR *d;
-    struct dirent *f;
     struct stat finfo;
-    char *dirname, *newname = NULL;
-    char *newbase = NULL;
-    dev_t parent_dev = (dev_t)0;
+    walk_t walk;
+    GThread **threads;
+    int nb_threads;
     int i;
-    size_t l;
-    size_t parent_len;
-    int has_exclude;
-    char *aparent;
 
     if(parent_dir == NULL || include == NULL)
 	return;
 
-    has_exclude = !is_empty_sl(exclude_sl) && (use_gtar_excl || use_star_excl);
-    aparent = g_strjoin(NULL, parent_dir, "/", include, NULL);
+    walk.has_exclude = !is_empty_sl(exclude_sl) && (use_gtar_excl || use_star_excl);
+    walk.parent_len = strlen(parent_dir);
+    walk.parent_dev = (dev_t)0;
+    walk.busy = 0;
+    walk.mutex = g_mutex_new();
+    walk.cond = g_cond_new();
+    walk.dirs = g_slist_prepend(NULL,
+			g_strjoin(NULL, parent_dir, "/", include, NULL));
 
     /* We (may) need root privs for the *stat() calls here. */
     set_root_privs(1);
     if(stat(parent_dir, &finfo) != -1)
-	parent_dev = finfo.st_dev;
+	walk.parent_dev = finfo.st_dev;
+
+    nb_threads = getconf_int(CNF_CALCSIZE_THREADS);
+    if (nb_threads < 1)
+	nb_threads = 1;
+    threads = g_new0(GThread *, nb_threads);
+    for (i = 1; i < nb_threads; i++) {
+	threads[i] = g_thread_create(walk_thread, &walk, TRUE, NULL);
+	if (!threads[i])
+	    break;
+    }
+    walk_thread(&walk);
+    for (i = 1; i < nb_threads && threads[i]; i++)
+	g_thread_join(threads[i]);
+    g_free(threads);
 
-    parent_len = strlen(parent_dir);
+    /* drop root privs -- we're done with the permission-sensitive calls */
+    set_root_privs(0);
 
-    push_name(aparent);
+    g_cond_free(walk.cond);
+    g_mutex_free(walk.mutex);
+}
 
-    for(; (dirname = pop_name()) != NULL; free(dirname)) {
-	if(has_exclude && calc_check_exclude(dirname+parent_len+1)) {
-	    continue;
-	}
-	if((d = opendir(dirname)) == NULL) {
-	    perror(dirname);
+static gpointer
+walk_thread(
+    gpointer data)
+{
+    walk_t *walk = (walk_t *)data;
+    dumpstats_t stats[MAXDUMPS];
+    GSList *subdirs;
+    char *dirname;
+    int i;
+
+    memset(stats, 0, sizeof(stats));
+
+    g_mutex_lock(walk->mutex);
+    for (;;) {
+	while (!walk->dirs && walk->busy)
+	    g_cond_wait(walk->cond, walk->mutex);
+	if (!walk->dirs)
+	    break;
+	dirname = walk->dirs->data;
+	walk->dirs = g_slist_delete_link(walk->dirs, walk->dirs);
+	walk->busy++;
+	g_mutex_unlock(walk->mutex);
+
+	subdirs = NULL;
+	walk_dir(walk, dirname, stats, &subdirs);
+	g_free(dirname);
+
+	g_mutex_lock(walk->mutex);
+	walk->dirs = g_slist_concat(subdirs, walk->dirs);
+	walk->busy--;
+	if (walk->dirs || walk->busy == 0)
+	    g_cond_broadcast(walk->cond);
+    }
+
+    for (i = 0; i < ndumps; i++) {
+	dumpstats[i].max_inode += stats[i].max_inode;
+	dumpstats[i].total_dirs += stats[i].total_dirs;
+	dumpstats[i].total_files += stats[i].total_files;
+	dumpstats[i].total_size += stats[i].total_size;
+	dumpstats[i].total_size_name += stats[i].total_size_name;
+    }
+    g_mutex_unlock(walk->mutex);
+
+    return NULL;
+}
+
+/* Add the entries of DIRNAME to STATS, and its subdirectories to SUBDIRS */
+static void
+walk_dir(
+    walk_t *		walk,
+    char *		dirname,
+    dumpstats_t *	stats,
+    GSList **		subdirs)
+{
+    DIR *d;
+    struct dirent *f;
+    struct stat finfo;
+    char *newname = NULL;
+    char *newbase = NULL;
+    int i;
+    size_t l;
+
+    if(walk->has_exclude && calc_check_exclude(dirname+walk->parent_len+1)) {
+	return;
+    }
+    if((d = opendir(dirname)) == NULL) {
+	perror(dirname);
+	return;
+    }
+
+    l = strlen(dirname);
+    if(l > 0 && dirname[l - 1] != '/') {
+	newbase = g_strconcat(dirname, "/", NULL);
+    } else {
+	newbase = g_strdup(dirname);
+    }
+
+    while((f = readdir(d)) != NULL) {
+	int is_symlink = 0;
+	int is_dir;
+	int is_file;
+	if(is_dot_or_dotdot(f->d_name)) {
 	    continue;
 	}
 
-	l = strlen(dirname);
-	if(l > 0 && dirname[l - 1] != '/') {
-	    g_free(newbase);
-	    newbase = g_strconcat(dirname, "/", NULL);
-	} else {
-	    g_free(newbase);
-	    newbase = g_strdup(dirname);
+	g_free(newname);
+	newname = g_strconcat(newbase, f->d_name, NULL);
+	if(lstat(newname, &finfo) == -1) {
+	    g_fprintf(stderr, "%s/%s: %s\n",
+		    dirname, f->d_name, strerror(errno));
+	    continue;
 	}
 
-	while((f = readdir(d)) != NULL) {
-	    int is_symlink = 0;
-	    int is_dir;
-	    int is_file;
-	    if(is_dot_or_dotdot(f->d_name)) {
-		continue;
-	    }
-
-	    g_free(newname);
-	    newname = g_strconcat(newbase, f->d_name, NULL);
-	    if(lstat(newname, &finfo) == -1) {
-		g_fprintf(stderr, "%s/%s: %s\n",
-			dirname, f->d_name, strerror(errno));
-		continue;
-	    }
-
-	    if(finfo.st_dev != parent_dev)
-		continue;
+	if(finfo.st_dev != walk->parent_dev)
+	    continue;
 
 #ifdef S_IFLNK
-	    is_symlink = ((finfo.st_mode & S_IFMT) == S_IFLNK);
+	is_symlink = ((finfo.st_mode & S_IFMT) == S_IFLNK);
 #endif
-	    is_dir = ((finfo.st_mode & S_IFMT) == S_IFDIR);
-	    is_file = ((finfo.st_mode & S_IFMT) == S_IFREG);
+	is_dir = ((finfo.st_mode & S_IFMT) == S_IFDIR);
+	is_file = ((finfo.st_mode & S_IFMT) == S_IFREG);
 
-	    if (!(is_file || is_dir || is_symlink)) {
-		continue;
-	    }
+	if (!(is_file || is_dir || is_symlink)) {
+	    continue;
+	}
 
-	    {
-		int is_excluded = -1;
-		for(i = 0; i < ndumps; i++) {
-		    add_file_name(i, newname);
-		    if(is_file && (time_t)finfo.st_ctime >= dumpdate[i]) {
-
-			if(has_exclude) {
-			    if(is_excluded == -1)
-				is_excluded =
-				       calc_check_exclude(newname+parent_len+1);
-			    if(is_excluded == 1) {
-				i = ndumps;
-				continue;
-			    }
+	{
+	    int is_excluded = -1;
+	    for(i = 0; i < ndumps; i++) {
+		add_file_name(stats, i, newname);
+		if(is_file && (time_t)finfo.st_ctime >= dumpdate[i]) {
+
+		    if(walk->has_exclude) {
+			if(is_excluded == -1)
+			    is_excluded =
+			       calc_check_exclude(newname+walk->parent_len+1);
+			if(is_excluded == 1) {
+			    i = ndumps;
+			    continue;
 			}
-			add_file(i, &finfo);
 		    }
+		    add_file(stats, i, &finfo);
 		}
-		if(is_dir) {
-		    if(has_exclude && calc_check_exclude(newname+parent_len+1))
-			continue;
-		    push_name(newname);
-		}
+	    }
+	    if(is_dir) {
+		if(walk->has_exclude &&
+		   calc_check_exclude(newname+walk->parent_len+1))
+		    continue;
+		*subdirs = g_slist_prepend(*subdirs, newname);
+		newname = NULL;
 	    }
 	}
+    }
 
 #ifdef CLOSEDIR_VOID
-	closedir(d);
+    closedir(d);
 #else
-	if(closedir(d) == -1)
-	    perror(dirname);
+    if(closedir(d) == -1)
+	perror(dirname);
 #endif
-    }
-
-    /* drop root privs -- we're done with the permission-sensitive calls */
-    set_root_privs(0);
 
     amfree(newbase);
     amfree(newname);
-    amfree(aparent);
-}
-
-void
-push_name(
-    char *	str)
-{
-    Name *newp;
-
-    newp = g_malloc(sizeof(*newp));
-    newp->str = g_strdup(str);
-
-    newp->next = name_stack;
-    name_stack = newp;
-}
-
-char *
-pop_name(void)
-{
-    Name *newp = name_stack;
-    char *str;
-
-    if(!newp) return NULL;
-
-    name_stack = newp->next;
-    str = newp->str;
-    amfree(newp);
-    return str;
 }
 
 
@@ -563,9 +632,11 @@ pop_name(void)
  */
 void
 add_file_name_dump(
+    dumpstats_t *	stats,
     int		level,
     char *	name)
 {
+    (void)stats;	/* Quiet unused parameter warning */
     (void)level;	/* Quiet unused parameter warning */
     (void)name;		/* Quiet unused parameter warning */
 
@@ -574,12 +645,13 @@ add_file_name_dump(
 
 void
 add_file_dump(
+    dumpstats_t *	stats,
     int			level,
     struct stat *	sp)
 {
     /* keep the size in kbytes, rounded up, plus a 1k header block */
     if((sp->st_mode & S_IFMT) == S_IFREG || (sp->st_mode & S_IFMT) == S_IFDIR)
-    	dumpstats[level].total_size +=
+    	stats[level].total_size +=
 			(ST_BLOCKS(*sp) + (off_t)1) / (off_t)2 + (off_t)1;
 }
 
@@ -629,22 +701,24 @@ final_size_dump(
  */
 void
 add_file_name_gnutar(
+    dumpstats_t *	stats,
     int		level,
     char *	name)
 {
     (void)name;	/* Quiet unused parameter warning */
 
-/*  dumpstats[level].total_size_name += strlen(name) + 64;*/
-    dumpstats[level].total_size += (off_t)1;
+/*  stats[level].total_size_name += strlen(name) + 64;*/
+    stats[level].total_size += (off_t)1;
 }
 
 void
 add_file_gnutar(
+    dumpstats_t *	stats,
     int			level,
     struct stat *	sp)
 {
     /* the header takes one additional block */
-    dumpstats[level].total_size += ST_BLOCKS(*sp);
+    stats[level].total_size += ST_BLOCKS(*sp);
 }
 
 off_t
@@ -669,9 +743,11 @@ final_size_gnutar(
 
 void
 add_file_name_unknown(
+    dumpstats_t *	stats,
     int		level,
     char *	name)
 {
+    (void)stats;	/* Quiet unused parameter warning */
     (void)level;	/* Quiet unused parameter warning */
     (void)name;		/* Quiet unused parameter warning */
 
@@ -680,12 +756,13 @@ add_file_name_unknown(
 
 void
 add_file_unknown(
+    dumpstats_t *	stats,
     int			level,
     struct stat *	sp)
 {
     /* just add up the block counts */
     if((sp->st_mode & S_IFMT) == S_IFREG || (sp->st_mode & S_IFMT) == S_IFDIR)
-    	dumpstats[level].total_size += ST_BLOCKS(*sp);
+    	stats[level].total_size += ST_BLOCKS(*sp);
 }
 
 off_t
@@ -728,19 +805,29 @@ calc_load_file(
     return sl_list;
 }
 
-int
-calc_check_exclude(
-    char *	filename)
+void
+calc_compile_exclude(void)
 {
     sle_t *an_exclude;
-    if(is_empty_sl(exclude_sl)) return 0;
+    char **globs;
+    int nb_globs = 0;
 
-    an_exclude=exclude_sl->first;
-    while(an_exclude != NULL) {
-	if(match_tar(an_exclude->name, filename)) {
-	    return 1;
-	}
-	an_exclude=an_exclude->next;
+    if(is_empty_sl(exclude_sl)) return;
+
+    globs = g_new(char *, exclude_sl->nb_element);
+    for(an_exclude = exclude_sl->first; an_exclude != NULL;
+	an_exclude = an_exclude->next) {
+	globs[nb_globs++] = an_exclude->name;
     }
-    return 0;
+    exclude_tm = compile_tar_list(globs, nb_globs);
+    g_free(globs);
+}
+
+int
+calc_check_exclude(
+    char *	filename)
+{
+    if (!exclude_tm)
+	return 0;
+    return match_tar_list(exclude_tm, filename) ? 1 : 0;
 }
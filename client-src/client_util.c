@@ -514,6 +514,42 @@ parse_options(
 	    }
 	    dle->compress = COMP_SERVER_BEST;
 	}
+	else if (BSTRNCMP(tok, "srvcomp-auto") == 0) {
+	    if (dle->compress != COMP_NONE) {
+		dbprintf(_("multiple compress option\n"));
+		if (verbose) {
+		    g_printf(_("ERROR [multiple compress option]\n"));
+		}
+	    }
+	    dle->compress = COMP_SERVER_AUTO;
+	}
+	else if (BSTRNCMP(tok, "srvcomp-deferred") == 0) {
+	    if (dle->compress != COMP_NONE) {
+		dbprintf(_("multiple compress option\n"));
+		if (verbose) {
+		    g_printf(_("ERROR [multiple compress option]\n"));
+		}
+	    }
+	    dle->compress = COMP_SERVER_DEFERRED;
+	}
+	else if (BSTRNCMP(tok, "srvcomp-zstd") == 0) {
+	    if (dle->compress != COMP_NONE) {
+		dbprintf(_("multiple compress option\n"));
+		if (verbose) {
+		    g_printf(_("ERROR [multiple compress option]\n"));
+		}
+	    }
+	    dle->compress = COMP_SERVER_ZSTD;
+	}
+	else if (BSTRNCMP(tok, "srvcomp-lz4") == 0) {
+	    if (dle->compress != COMP_NONE) {
+		dbprintf(_("multiple compress option\n"));
+		if (verbose) {
+		    g_printf(_("ERROR [multiple compress option]\n"));
+		}
+	    }
+	    dle->compress = COMP_SERVER_LZ4;
+	}
 	else if (BSTRNCMP(tok, "srvcomp-cust=") == 0) {
 	    if (dle->compress != COMP_NONE) {
 		dbprintf(_("multiple compress option\n"));
@@ -52,6 +52,9 @@
 #include "findpass.h"
 #endif
 
+/* number of DLEs of an XML request checked at the same time */
+#define SELFCHECK_WORKERS 8
+
 int need_samba=0;
 int need_rundump=0;
 int need_dump=0;
@@ -74,11 +77,25 @@ static am_feature_t *our_features = NULL;
 static char *our_feature_string = NULL;
 static g_option_t *g_options = NULL;
 
+/* the support of each application, asked once per request */
+static GHashTable *support_options = NULL;
+
+/* a child checking one DLE, and what it printed so far */
+typedef struct check_worker_s {
+    pid_t    pid;
+    int      fd;
+    dle_t   *dle;
+    GString *output;
+} check_worker_t;
+
 /* local functions */
 int main(int argc, char **argv);
 
 static void check_options(dle_t *dle);
 static void check_disk(dle_t *dle);
+static void check_dles(dle_t *dles);
+static backup_support_option_t *selfcheck_support_option(char *program,
+						GPtrArray **errarray);
 static void check_overall(void);
 static int check_file_exist(char *filename);
 static void check_space(char *dir, off_t kbytes);
@@ -385,14 +402,7 @@ main(
 	    run_client_scripts(EXECUTE_ON_PRE_HOST_AMCHECK, g_options, dle,
 			       stdout, R_BOGUS, &selfcheck_fprint_message);
 	}
-	for (dle = dles; dle != NULL; dle = dle->next) {
-	    check_options(dle);
-	    run_client_scripts(EXECUTE_ON_PRE_DLE_AMCHECK, g_options, dle,
-			       stdout, R_BOGUS, &selfcheck_fprint_message);
-	    check_disk(dle);
-	    run_client_scripts(EXECUTE_ON_POST_DLE_AMCHECK, g_options, dle,
-			       stdout, R_BOGUS, &selfcheck_fprint_message);
-	}
+	check_dles(dles);
 	for (dle = dles; dle != NULL; dle = dle->next) {
 	    run_client_scripts(EXECUTE_ON_POST_HOST_AMCHECK, g_options, dle,
 			       stdout, R_BOGUS, &selfcheck_fprint_message);
@@ -624,6 +634,197 @@ check_options(
     }
 }
 
+static backup_support_option_t *
+selfcheck_support_option(
+    char       *program,
+    GPtrArray **errarray)
+{
+    backup_support_option_t *bsu;
+
+    if (!support_options) {
+	support_options = g_hash_table_new_full(g_str_hash, g_str_equal,
+						g_free, g_free);
+    }
+
+    bsu = g_hash_table_lookup(support_options, program);
+    if (bsu) {
+	*errarray = NULL;
+	return bsu;
+    }
+
+    /* a failure is asked again, to report it for each DLE */
+    bsu = backup_support_option(program, errarray);
+    if (bsu)
+	g_hash_table_insert(support_options, g_strdup(program), bsu);
+    return bsu;
+}
+
+/* Check a DLE with its pre-dle and post-dle scripts */
+static void
+check_one_dle(
+    dle_t *dle)
+{
+    run_client_scripts(EXECUTE_ON_PRE_DLE_AMCHECK, g_options, dle,
+		       stdout, R_BOGUS, &selfcheck_fprint_message);
+    check_disk(dle);
+    run_client_scripts(EXECUTE_ON_POST_DLE_AMCHECK, g_options, dle,
+		       stdout, R_BOGUS, &selfcheck_fprint_message);
+}
+
+/* Fork a child to check DLE, its stdout going to a pipe.  Returns NULL if
+ * the child can't be started. */
+static check_worker_t *
+start_check_worker(
+    dle_t *dle)
+{
+    check_worker_t *worker;
+    int             fds[2];
+    pid_t           pid;
+
+    if (pipe(fds) < 0) {
+	g_debug("can't create pipe to check %s: %s", dle->disk, strerror(errno));
+	return NULL;
+    }
+
+    fflush(stdout);fflush(stderr);
+    switch (pid = fork()) {
+    case -1:
+	g_debug("can't fork to check %s: %s", dle->disk, strerror(errno));
+	aclose(fds[0]);
+	aclose(fds[1]);
+	return NULL;
+
+    case 0: /* child */
+	aclose(fds[0]);
+	dup2(fds[1], 1);
+	aclose(fds[1]);
+	check_one_dle(dle);
+	fflush(stdout);
+	exit(0);
+	/*NOTREACHED*/
+
+    default:
+	break;
+    }
+
+    aclose(fds[1]);
+    worker = g_new0(check_worker_t, 1);
+    worker->pid = pid;
+    worker->fd = fds[0];
+    worker->dle = dle;
+    worker->output = g_string_sized_new(1024);
+    return worker;
+}
+
+/* Read what WORKER printed; when it is done, send its output and free it.
+ * Returns FALSE once the worker is freed. */
+static gboolean
+read_check_worker(
+    check_worker_t *worker)
+{
+    char     buf[4096];
+    ssize_t  nread;
+    amwait_t status;
+
+    nread = read(worker->fd, buf, sizeof(buf));
+    if (nread < 0 && (errno == EINTR || errno == EAGAIN))
+	return TRUE;
+    if (nread > 0) {
+	g_string_append_len(worker->output, buf, nread);
+	return TRUE;
+    }
+
+    aclose(worker->fd);
+    fwrite(worker->output->str, 1, worker->output->len, stdout);
+    fflush(stdout);
+    if (waitpid(worker->pid, &status, 0) == worker->pid &&
+	!WIFEXITED(status)) {
+	char *str_signal = g_strdup_printf("%d", WTERMSIG(status));
+	delete_message(selfcheck_print_message(build_message(
+			AMANDA_FILE, __LINE__, 3600099, MSG_ERROR, 4,
+			"signal", str_signal,
+			"hostname", g_options->hostname,
+			"device", worker->dle->device,
+			"disk", worker->dle->disk )));
+	g_free(str_signal);
+    }
+    g_string_free(worker->output, TRUE);
+    g_free(worker);
+    return FALSE;
+}
+
+/*
+ * Check the DLEs of an XML request, up to SELFCHECK_WORKERS at once.  The
+ * options are checked here, since they set the need_* flags for
+ * check_overall(), and the support of each application is asked here, once,
+ * for the children to inherit.  The output of each DLE is sent whole, as
+ * soon as its check is done.
+ */
+static void
+check_dles(
+    dle_t *dles)
+{
+    dle_t  *dle = dles;
+    GSList *workers = NULL;
+    GSList *w, *w_next;
+    guint   nb_workers = 0;
+
+    while (dle || workers) {
+	fd_set readset;
+	int    maxfd = -1;
+
+	while (dle && nb_workers < SELFCHECK_WORKERS) {
+	    check_worker_t *worker;
+
+	    check_options(dle);
+	    if (dle->disk)
+		need_global_check = 1;
+	    if (dle->program_is_application_api) {
+		GPtrArray *errarray;
+
+		if (!selfcheck_support_option(dle->program, &errarray))
+		    g_ptr_array_free_full(errarray);
+	    }
+
+	    worker = start_check_worker(dle);
+	    if (worker) {
+		workers = g_slist_prepend(workers, worker);
+		nb_workers++;
+	    } else {
+		check_one_dle(dle);
+	    }
+	    dle = dle->next;
+	}
+
+	if (!workers)
+	    continue;
+
+	FD_ZERO(&readset);
+	for (w = workers; w != NULL; w = w->next) {
+	    check_worker_t *worker = w->data;
+	    FD_SET(worker->fd, &readset);
+	    if (worker->fd > maxfd)
+		maxfd = worker->fd;
+	}
+	if (select(maxfd + 1, &readset, NULL, NULL, NULL) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    error("select failed: %s", strerror(errno));
+	    /*NOTREACHED*/
+	}
+
+	for (w = workers; w != NULL; w = w_next) {
+	    check_worker_t *worker = w->data;
+
+	    w_next = w->next;
+	    if (FD_ISSET(worker->fd, &readset) && !read_check_worker(worker)) {
+		workers = g_slist_delete_link(workers, w);
+		nb_workers--;
+	    }
+	}
+    }
+}
+
 static void selfcheck_print_array_message(gpointer data, gpointer user_data);
 static void
 selfcheck_print_array_message(
@@ -899,7 +1100,7 @@ check_disk(
 	int                      app_err[2];
 	GPtrArray               *errarray;
 
-	bsu = backup_support_option(dle->program, &errarray);
+	bsu = selfcheck_support_option(dle->program, &errarray);
 
 	if (!bsu) {
 	    char  *line;
@@ -1291,7 +1492,6 @@ check_disk(
 		}
 	    }
 	}
-	amfree(bsu);
 	fflush(stdout);fflush(stderr);
 	amfree(device);
 	amfree(qamdevice);
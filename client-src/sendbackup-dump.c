@@ -520,7 +520,7 @@ char *progname;
 
     if (shm_control_name) {
 	shm_ring = shm_ring_link(shm_control_name);
-	shm_ring_producer_set_size(shm_ring, NETWORK_BLOCK_BYTES*16, NETWORK_BLOCK_BYTES*4);
+	shm_ring_producer_set_dle_size(shm_ring, dle);
 	native_crc.in  = native_pipe[0];
 	if (!have_filter) {
 	    native_crc.out = dumpout;
@@ -42,6 +42,13 @@
 #include "amandates.h"
 #include "stream.h"
 #include "shm-ring.h"
+#include "amcompress.h"
+
+/* compress COMP_FAST/COMP_BEST data in-process when the configured compressor
+ * is gzip, since zlib writes the same format */
+#if defined(HAVE_LIBZ) && defined(HAVE_GZIP)
+#define NATIVE_COMPRESS 1
+#endif
 
 #define sendbackup_debug(i, ...) do {	\
 	if ((i) <= debug_sendbackup) {	\
@@ -91,6 +98,25 @@ typedef struct filter_stderr_pipe {
 static filter_stderr_pipe enc_stderr_pipe;
 static filter_stderr_pipe comp_stderr_pipe;
 
+typedef struct native_compress_s {
+    int in;
+    int out;
+    amcompress_t *comp;
+    gboolean failed;
+    GThread *thread;
+} native_compress_t;
+static gpointer native_compress_thread(gpointer data);
+
+#ifdef NATIVE_COMPRESS
+static native_compress_t native_comp;
+
+static gboolean start_native_compress(dle_t *dle, int *dumpout, int compout);
+#endif
+
+/* transport compression of datafd, negotiated with the server */
+static native_compress_t wire_comp;
+static const char *start_wire_compress(dle_t *dle);
+
 /* local functions */
 int main(int argc, char **argv);
 char *childstr(pid_t pid);
@@ -140,6 +166,7 @@ main(
     char *qamdevice = NULL;
     char *line = NULL;
     char *err_extra = NULL;
+    const char *wire_name;
     char *s;
     int i;
     int ch;
@@ -152,6 +179,7 @@ main(
     int     cmd_to_appli[2] = { 0, 0 };
     GThread *app_strerr_thread = NULL;
     backup_support_option_t *bsu = NULL;
+    gboolean resume = FALSE;
 
     if (argc > 1 && argv[1] && g_str_equal(argv[1], "--version")) {
 	printf("sendbackup-%s\n", VERSION);
@@ -519,10 +547,37 @@ main(
 	cmdwfd = -1;
 	cmdrfd = -1;
     }
+    wire_name = NULL;
+    if (!interactive)
+	wire_name = start_wire_compress(dle);
+
+    /* the server can resume the dump after losing the connection if the
+     * application restarts at an offset of its output, and if that output
+     * is what the server receives */
+    if (!interactive &&
+	am_has_feature(g_options->features, fe_sendbackup_req_options_resume) &&
+	dle->program_is_application_api == 1 && !shm_control_name &&
+	dle->data_path == DATA_PATH_AMANDA &&
+	dle->encrypt != ENCRYPT_CUST && dle->compress != COMP_FAST &&
+	dle->compress != COMP_BEST && dle->compress != COMP_CUST) {
+	GPtrArray *errarray;
+
+	bsu = backup_support_option(dle->program, &errarray);
+	if (errarray)
+	    g_ptr_array_free_full(errarray);
+	resume = bsu && bsu->resume;
+    }
+
     g_printf(_("OPTIONS "));
     if(am_has_feature(g_options->features, fe_rep_options_features)) {
 	g_printf("features=%s;", our_feature_string);
     }
+    if (wire_name) {
+	g_printf("wire-compress=%s;", wire_name);
+    }
+    if (resume) {
+	g_printf("resume;");
+    }
     if(am_has_feature(g_options->features, fe_rep_options_hostname)) {
 	g_printf("hostname=%s;", g_options->hostname);
     }
@@ -648,6 +703,14 @@ main(
 	    }
 
 	    /*  now do the client-side compression */
+#ifdef NATIVE_COMPRESS
+	    native_comp.thread = NULL;
+	    if ((dle->compress == COMP_FAST || dle->compress == COMP_BEST) &&
+		start_native_compress(dle, &dumpout, compout)) {
+		compout = -1;
+		comppid = -1;
+	    } else
+#endif
 	    if(dle->compress == COMP_FAST || dle->compress == COMP_BEST) {
 #if defined(COMPRESS_BEST_OPT) && defined(COMPRESS_FAST_OPT)
 		if(dle->compress == COMP_BEST) {
@@ -699,7 +762,8 @@ main(
 	    }
 
 	    cur_dumptime = time(0);
-	    bsu = backup_support_option(dle->program, &errarray);
+	    if (!bsu)
+		bsu = backup_support_option(dle->program, &errarray);
 	    if (!bsu) {
 		char  *errmsg;
 		char  *qerrmsg;
@@ -726,6 +790,14 @@ main(
 		return 0;
 	    }
 
+	    if (g_options->resume_offset > 0 && !bsu->resume) {
+		fdprintf(mesgfd,
+			 "sendbackup: error [Application '%s' can't resume a backup]\n",
+			 dle->program);
+		g_debug("Application '%s' can't resume a backup", dle->program);
+		return 0;
+	    }
+
 	    if (pipe(errfd) < 0) {
 		char  *errmsg;
 		char  *qerrmsg;
@@ -886,6 +958,11 @@ main(
 			g_ptr_array_add(argv_ptr, g_strdup("--server-backup-result"));
 		    }
 		}
+		if (g_options->resume_offset > 0) {
+		    g_ptr_array_add(argv_ptr, g_strdup("--resume-offset"));
+		    g_ptr_array_add(argv_ptr, g_strdup_printf("%lld",
+				    (long long)g_options->resume_offset));
+		}
 		application_property_add_to_argv(argv_ptr, dle, bsu,
 						 g_options->features);
 
@@ -958,7 +1035,7 @@ main(
 
 	    if (shm_control_name && dle->data_path == DATA_PATH_AMANDA) {
 		shm_ring = shm_ring_link(shm_control_name);
-		shm_ring_producer_set_size(shm_ring, NETWORK_BLOCK_BYTES*16, NETWORK_BLOCK_BYTES*4);
+		shm_ring_producer_set_dle_size(shm_ring, dle);
 		native_crc.in  = native_pipe[0];
 		if (!have_filter) {
 		    native_crc.shm_ring = shm_ring;
@@ -1007,12 +1084,21 @@ main(
 		if (comp_stderr_pipe.thread) {
 		    g_thread_join(comp_stderr_pipe.thread);
 		}
+#ifdef NATIVE_COMPRESS
+		if (native_comp.thread) {
+		    g_thread_join(native_comp.thread);
+		    native_comp.thread = NULL;
+		    if (native_comp.failed)
+			result |= 1;
+		}
+#endif
 		g_thread_join(client_crc.thread);
 	    }
 
 	    if (shm_control_name && dle->data_path == DATA_PATH_DIRECTTCP) {
 		shm_ring = shm_ring_link(shm_control_name);
-		shm_ring_producer_set_size(shm_ring, NETWORK_BLOCK_BYTES*16, NETWORK_BLOCK_BYTES*4);
+		shm_ring_producer_set_size(shm_ring, NETWORK_BLOCK_BYTES*16,
+					   sendbackup_block_size());
 	    }
 
 	    if (!have_filter)
@@ -1126,6 +1212,13 @@ main(
 	statefd = -1;
     }
     aclose(datafd);
+    if (wire_comp.thread) {
+	/* the server sees the end of the data once this is done */
+	g_thread_join(wire_comp.thread);
+	wire_comp.thread = NULL;
+	if (wire_comp.failed)
+	    result = R_FAILED;
+    }
 
     if (am_has_feature(g_options->features, fe_sendbackup_stream_cmd) &&
 	am_has_feature(g_options->features, fe_sendbackup_stream_cmd_get_dumper_result)) {
@@ -1932,6 +2025,166 @@ handle_crc_thread(
     return NULL;
 }
 
+#ifdef NATIVE_COMPRESS
+/* Start compressing with zlib in a thread, in place of running
+ * COMPRESS_PATH, with as many workers as the COMPRESS-THREADS property of
+ * the application, then of the dle, asks for (one by default).  On success,
+ * *DUMPOUT is set to the fd the data is to be written to, and COMPOUT is
+ * owned by the thread.  Returns FALSE, having done nothing, if the caller
+ * should run the compress program instead. */
+static gboolean
+start_native_compress(
+    dle_t *dle,
+    int   *dumpout,
+    int    compout)
+{
+    int   comp_pipe[2];
+    char *errmsg = NULL;
+    int   nthreads;
+
+    nthreads = amcompress_threads_property(dle->application_property);
+    if (!nthreads)
+	nthreads = amcompress_threads_property(dle->property);
+    if (!nthreads)
+	nthreads = 1;
+
+    native_comp.comp = amcompress_new(AMCOMPRESS_GZIP,
+			dle->compress == COMP_BEST ? AMCOMPRESS_LEVEL_BEST
+						   : AMCOMPRESS_LEVEL_FAST,
+			nthreads, &errmsg);
+    if (!native_comp.comp) {
+	g_debug("compress: %s; running %s instead", errmsg, COMPRESS_PATH);
+	g_free(errmsg);
+	return FALSE;
+    }
+
+    if (pipe(comp_pipe) < 0) {
+	g_debug("compress: can't create pipe: %s; running %s instead",
+		strerror(errno), COMPRESS_PATH);
+	amcompress_free(native_comp.comp);
+	native_comp.comp = NULL;
+	return FALSE;
+    }
+
+    native_comp.in = comp_pipe[0];
+    native_comp.out = compout;
+    native_comp.failed = FALSE;
+    *dumpout = comp_pipe[1];
+    native_comp.thread = g_thread_create(native_compress_thread,
+					 (gpointer)&native_comp, TRUE, NULL);
+    g_debug("compress: in-process gzip %s, %d thread(s)",
+	    dle->compress == COMP_BEST ? COMPRESS_BEST_OPT : COMPRESS_FAST_OPT,
+	    nthreads);
+
+    return TRUE;
+}
+#endif
+
+/* If the server offered transport compression with an algorithm
+ * amanda-client.conf asks for, compress everything written to datafd in a
+ * thread.  datafd is then the pipe to the thread, which owns the stream to
+ * the server.  Returns the algorithm to announce to the server, or NULL if
+ * the data is sent as is. */
+static const char *
+start_wire_compress(
+    dle_t *dle)
+{
+    char *want = getconf_str(CNF_WIRE_COMPRESS);
+    amcompress_algo_t algo;
+    gchar **offered, **o;
+    gboolean found = FALSE;
+    int   wire_pipe[2];
+    char *errmsg = NULL;
+
+    wire_comp.thread = NULL;
+    if (!want || !*want || !g_options->wire_compress)
+	return NULL;
+    /* never worth it over shared memory, and directtcp bypasses datafd */
+    if (shm_control_name || dle->data_path != DATA_PATH_AMANDA)
+	return NULL;
+    if (!amcompress_algo_from_name(want, &algo))
+	return NULL;
+
+    offered = g_strsplit(g_options->wire_compress, ",", 0);
+    for (o = offered; *o != NULL; o++) {
+	if (g_ascii_strcasecmp(*o, amcompress_algo_name(algo)) == 0)
+	    found = TRUE;
+    }
+    g_strfreev(offered);
+    if (!found) {
+	g_debug("wire-compress: server does not offer %s", want);
+	return NULL;
+    }
+
+    wire_comp.comp = amcompress_new(algo, AMCOMPRESS_LEVEL_FAST, 1, &errmsg);
+    if (!wire_comp.comp) {
+	g_debug("wire-compress: %s", errmsg);
+	g_free(errmsg);
+	return NULL;
+    }
+    if (pipe(wire_pipe) < 0) {
+	g_debug("wire-compress: can't create pipe: %s", strerror(errno));
+	amcompress_free(wire_comp.comp);
+	wire_comp.comp = NULL;
+	return NULL;
+    }
+
+    /* keep the real stream out of the children, or the server does not see
+     * its end until they all exit */
+    fcntl(datafd, F_SETFD, FD_CLOEXEC);
+    fcntl(wire_pipe[0], F_SETFD, FD_CLOEXEC);
+    wire_comp.in = wire_pipe[0];
+    wire_comp.out = datafd;
+    wire_comp.failed = FALSE;
+    datafd = wire_pipe[1];
+    wire_comp.thread = g_thread_create(native_compress_thread,
+				       (gpointer)&wire_comp, TRUE, NULL);
+    g_debug("wire-compress: %s", amcompress_algo_name(algo));
+
+    return amcompress_algo_name(algo);
+}
+
+static gpointer
+native_compress_thread(
+    gpointer data)
+{
+    native_compress_t *nc = (native_compress_t *)data;
+    char   buf[32768];
+    size_t size;
+    char  *out;
+    gsize  out_len;
+
+    do {
+	size = full_read(nc->in, buf, sizeof(buf));
+	if (nc->failed)
+	    continue; /* keep reading so the application is not blocked */
+
+	if (size > 0)
+	    out = amcompress_update(nc->comp, buf, size, &out_len);
+	else
+	    out = amcompress_finish(nc->comp, &out_len);
+
+	if (!out) {
+	    fdprintf(mesgfd, _("sendbackup: error [compress: %s]\n"),
+		     amcompress_error(nc->comp));
+	    nc->failed = TRUE;
+	} else if (out_len > 0 && full_write(nc->out, out, out_len) != out_len) {
+	    fdprintf(mesgfd, _("sendbackup: error [compress: write failed: %s]\n"),
+		     strerror(errno));
+	    nc->failed = TRUE;
+	}
+    } while (size > 0);
+
+    g_debug("compress: %llu bytes to %llu bytes",
+	    (unsigned long long)amcompress_bytes_in(nc->comp),
+	    (unsigned long long)amcompress_bytes_out(nc->comp));
+    amcompress_free(nc->comp);
+    nc->comp = NULL;
+    close(nc->in);
+    close(nc->out);
+
+    return NULL;
+}
 
 gpointer
 stderr_thread(
@@ -1960,13 +2213,28 @@ stderr_thread(
     return NULL;
 }
 
+static void
+crc_shm_ring_reader(
+    gpointer data,
+    const char *buf,
+    gsize len)
+{
+    crc32_add((uint8_t *)buf, len, (crc_t *)data);
+}
+
 gpointer
 handle_crc_to_shm_ring_thread(
     gpointer data)
 {
     send_crc_t *crc = (send_crc_t *)data;
+    shm_ring_reader_t *reader;
 
-    fd_to_shm_ring(crc->in, crc->shm_ring, &crc->crc);
+    /* the crc is computed by a side reader of the ring, on another core,
+     * while this thread reads the next block */
+    crc32_init(&crc->crc);
+    reader = shm_ring_add_reader(crc->shm_ring, crc_shm_ring_reader, &crc->crc);
+    fd_to_shm_ring(crc->in, crc->shm_ring, NULL);
+    shm_ring_join_reader(crc->shm_ring, reader);
 
     close(crc->in);
     close(crc->out);
@@ -1974,6 +2242,47 @@ handle_crc_to_shm_ring_thread(
     return NULL;
 }
 
+/* The block size of the producer side of the data shm_ring: blocks of the
+ * size amandad sends to the server, as negotiated with fe_net_large_blocks,
+ * and at least NETWORK_BLOCK_BYTES*4 */
+size_t
+sendbackup_block_size(void)
+{
+    size_t block_size = NETWORK_BLOCK_BYTES;
+
+    if (g_options)
+	block_size = am_network_block_size(g_options->features);
+    return MAX(block_size, NETWORK_BLOCK_BYTES*4);
+}
+
+/* Size the producer side of the data shm_ring, honouring the SHM-RING-SIZE
+ * and SHM-RING-MAX-SIZE properties of the application, then of the dle */
+void
+shm_ring_producer_set_dle_size(
+    shm_ring_t *shm_ring,
+    dle_t      *dle)
+{
+    gsize block_size = sendbackup_block_size();
+    gsize ring_size = MAX(NETWORK_BLOCK_BYTES*16, block_size*4);
+    gsize max_size;
+    gsize size;
+
+    size = shm_ring_size_property(dle->application_property, SHM_RING_SIZE_PROPERTY);
+    if (!size)
+	size = shm_ring_size_property(dle->property, SHM_RING_SIZE_PROPERTY);
+    if (size)
+	ring_size = size;
+
+    max_size = shm_ring_size_property(dle->application_property, SHM_RING_MAX_SIZE_PROPERTY);
+    if (!max_size)
+	max_size = shm_ring_size_property(dle->property, SHM_RING_MAX_SIZE_PROPERTY);
+    if (max_size)
+	shm_ring_producer_set_max_size(shm_ring, max_size);
+
+    shm_ring_producer_set_futex(shm_ring);
+    shm_ring_producer_set_size(shm_ring, ring_size, block_size);
+}
+
 
 extern backup_program_t dump_program, gnutar_program;
 
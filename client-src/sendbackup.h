@@ -56,6 +56,8 @@ extern shm_ring_t *shm_ring;
 int fdprintf(int fd, char *format, ...) G_GNUC_PRINTF(2, 3);
 gpointer handle_crc_thread(gpointer data);
 gpointer handle_crc_to_shm_ring_thread(gpointer data);
+size_t sendbackup_block_size(void);
+void shm_ring_producer_set_dle_size(shm_ring_t *shm_ring, dle_t *dle);
 
 void info_tapeheader(dle_t *dle);
 void start_index(int createindex, int input, int mesg, 
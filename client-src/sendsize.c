@@ -41,6 +41,7 @@
 #include "getfsent.h"
 #include "client_util.h"
 #include "conffile.h"
+#include "fsusage.h"
 
 #ifdef SAMBA_CLIENT
 #include "findpass.h"
@@ -108,6 +109,7 @@ static int host_scripts_exit_status = 0;
 int main(int argc, char **argv);
 gboolean dle_add_diskest(dle_t *dle);
 void calc_estimates(disk_estimates_t *est);
+static gboolean check_change_token(disk_estimates_t *est);
 void free_estimates(disk_estimates_t *est);
 void dump_calc_estimates(disk_estimates_t *);
 void star_calc_estimates(disk_estimates_t *);
@@ -458,6 +460,10 @@ main(
 	host_scripts_exit_status += run_client_scripts(EXECUTE_ON_PRE_HOST_ESTIMATE,
 		g_options, est->dle, stdout, R_BOGUS, NULL);
     }
+    for (est = est_list; est != NULL; est = est->next) {
+	if (est->dle->change_token && check_change_token(est))
+	    est->done = 1;		/* unchanged, no estimate */
+    }
     if (host_scripts_exit_status) {
 	dbclose();
 	return 1;
@@ -742,6 +748,56 @@ dle_add_diskest(
 }
 
 
+/*
+ * Report the change token of the DLE, from the stat of its top directory.
+ * Returns TRUE if it is the token the server got with its last estimates,
+ * which it can use again.
+ */
+static gboolean
+check_change_token(
+    disk_estimates_t *	est)
+{
+    struct stat stat_buf;
+    char *dirname;
+    char *token;
+    int level;
+    gboolean unchanged;
+
+    if (est->dirname && *est->dirname)
+	dirname = g_strdup(est->dirname);
+    else
+	dirname = amname_to_dirname(est->dle->disk);
+    if (stat(dirname, &stat_buf) != 0) {
+	dbprintf(_("change token: can't stat %s: %s\n"), dirname,
+		 strerror(errno));
+	g_free(dirname);
+	return FALSE;
+    }
+    g_free(dirname);
+
+    token = g_strdup_printf("%llx.%llx.%lx.%lx",
+			    (unsigned long long)stat_buf.st_dev,
+			    (unsigned long long)stat_buf.st_ino,
+			    (unsigned long)stat_buf.st_mtime,
+			    (unsigned long)stat_buf.st_ctime);
+    unchanged = g_str_equal(token, est->dle->change_token);
+
+    /* the level only keeps the format of the estimate lines */
+    for (level = 0; level < DUMP_LEVELS; level++) {
+	if (est->est[level].needestimate)
+	    break;
+    }
+    if (level == DUMP_LEVELS)
+	level = 0;
+    g_printf("%s %d %s %s\n", est->qamname, level,
+	     unchanged ? "UNCHANGED" : "TOKEN", token);
+    fflush(stdout);
+    dbprintf(_("change token of %s: %s%s\n"), est->qamname, token,
+	     unchanged ? " (unchanged)" : "");
+    g_free(token);
+    return unchanged;
+}
+
 void
 free_estimates(
     disk_estimates_t *	est)
@@ -1298,6 +1354,152 @@ smbtar_calc_estimates(
 #endif
 
 #ifdef GNUTAR
+/*
+ * The level 0 estimate cache
+ *
+ * With estimate-cache-time set, the level 0 size found by gnutar is kept in
+ * gnutar-list-dir, with what the filesystem looked like before the estimate
+ * ran: its free blocks and inodes, and the mtime of the top directory.  The
+ * next estimate within estimate-cache-time returns the size kept if none of
+ * them changed, without walking the DLE.  The incremental levels are always
+ * computed, since a file rewritten in place changes them without changing
+ * the filesystem usage.
+ */
+typedef struct estimate_token_s {
+    time_t    mtime;
+    uintmax_t bfree;
+    uintmax_t ffree;
+    guint     spec;
+} estimate_token_t;
+
+static char *
+estimate_cache_filename(
+    dle_t *dle)
+{
+    char *gnutar_list_dir = getconf_str(CNF_GNUTAR_LIST_DIR);
+    char *sdisk;
+    char *filename;
+
+    if (getconf_int(CNF_ESTIMATE_CACHE_TIME) <= 0 ||
+	!gnutar_list_dir || !*gnutar_list_dir)
+	return NULL;
+
+    sdisk = sanitise_filename(dle->disk);
+    filename = g_strjoin(NULL, gnutar_list_dir, "/", g_options->hostname,
+			 sdisk, ".estimate", NULL);
+    g_free(sdisk);
+    return filename;
+}
+
+static void
+estimate_token_spec(
+    GString  *spec,
+    am_sl_t  *sl)
+{
+    sle_t *sle;
+
+    g_string_append_c(spec, '|');
+    if (!sl)
+	return;
+    for (sle = sl->first; sle != NULL; sle = sle->next) {
+	g_string_append(spec, sle->name);
+	g_string_append_c(spec, '\n');
+    }
+}
+
+static gboolean
+estimate_token(
+    dle_t            *dle,
+    estimate_token_t *token)
+{
+    char *dirname = amname_to_dirname(dle->device);
+    struct fs_usage fsusage;
+    struct stat stat_buf;
+    GString *spec;
+    gboolean result = FALSE;
+
+    if (stat(dirname, &stat_buf) == 0 &&
+	get_fs_usage(dirname, NULL, &fsusage) == 0) {
+	spec = g_string_new(dirname);
+	estimate_token_spec(spec, dle->exclude_file);
+	estimate_token_spec(spec, dle->exclude_list);
+	estimate_token_spec(spec, dle->include_file);
+	estimate_token_spec(spec, dle->include_list);
+	token->mtime = stat_buf.st_mtime;
+	token->bfree = fsusage.fsu_bfree;
+	token->ffree = fsusage.fsu_ffree;
+	token->spec = g_str_hash(spec->str);
+	g_string_free(spec, TRUE);
+	result = TRUE;
+    }
+    g_free(dirname);
+    return result;
+}
+
+/* Return the level 0 size kept for DLE if TOKEN still matches, or -1 */
+static off_t
+estimate_cache_lookup(
+    dle_t            *dle,
+    estimate_token_t *token)
+{
+    char *filename = estimate_cache_filename(dle);
+    FILE *file;
+    long long when, mtime, size;
+    unsigned long long bfree, ffree;
+    unsigned int spec;
+    off_t result = -1;
+
+    if (!filename)
+	return -1;
+    file = fopen(filename, "r");
+    if (file) {
+	if (fscanf(file, "%lld %lld %llu %llu %u %lld", &when, &mtime,
+		   &bfree, &ffree, &spec, &size) == 6 &&
+	    time(NULL) - (time_t)when < getconf_int(CNF_ESTIMATE_CACHE_TIME) &&
+	    (time_t)mtime == token->mtime &&
+	    (uintmax_t)bfree == token->bfree &&
+	    (uintmax_t)ffree == token->ffree &&
+	    (guint)spec == token->spec) {
+	    dbprintf(_("using the level 0 estimate kept in %s\n"), filename);
+	    result = (off_t)size;
+	}
+	fclose(file);
+    }
+    g_free(filename);
+    return result;
+}
+
+static void
+estimate_cache_store(
+    dle_t            *dle,
+    estimate_token_t *token,
+    off_t             size)
+{
+    char *filename = estimate_cache_filename(dle);
+    char *tmp;
+    FILE *file;
+
+    if (!filename)
+	return;
+    tmp = g_strconcat(filename, ".tmp", NULL);
+    file = fopen(tmp, "w");
+    if (file) {
+	g_fprintf(file, "%lld %lld %llu %llu %u %lld\n",
+		  (long long)time(NULL), (long long)token->mtime,
+		  (unsigned long long)token->bfree,
+		  (unsigned long long)token->ffree,
+		  (unsigned int)token->spec, (long long)size);
+	if (fclose(file) != 0 || rename(tmp, filename) != 0) {
+	    dbprintf(_("can't write %s: %s\n"), filename, strerror(errno));
+	    unlink(tmp);
+	}
+    } else {
+	dbprintf(_("can't write %s: %s\n"), tmp, strerror(errno));
+    }
+    g_free(tmp);
+    g_free(filename);
+}
+
 void
 gnutar_calc_estimates(
     disk_estimates_t *	est)
@@ -1305,14 +1507,25 @@ gnutar_calc_estimates(
     int level;
     off_t size;
     char *errmsg = NULL, *qerrmsg;
+    estimate_token_t token;
+    gboolean have_token;
 
     for(level = 0; level < DUMP_LEVELS; level++) {
 	if (est->est[level].needestimate) {
-	    dbprintf(_("getting size via gnutar for %s level %d\n"),
-		      est->qamname, level);
-	    size = getsize_gnutar(est->dle, level,
-				  est->est[level].dumpsince,
-				  &errmsg);
+	    size = -1;
+	    have_token = level == 0 && getconf_int(CNF_ESTIMATE_CACHE_TIME) > 0 &&
+			 estimate_token(est->dle, &token);
+	    if (have_token)
+		size = estimate_cache_lookup(est->dle, &token);
+	    if (size < 0) {
+		dbprintf(_("getting size via gnutar for %s level %d\n"),
+			  est->qamname, level);
+		size = getsize_gnutar(est->dle, level,
+				      est->est[level].dumpsince,
+				      &errmsg);
+		if (have_token && size >= 0 && !errmsg)
+		    estimate_cache_store(est->dle, &token, size);
+	    }
 
 	    amflock(1, "size");
 
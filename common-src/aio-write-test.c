@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2009-2012 Zmanda, Inc.  All Rights Reserved.
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA.
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
+ */
+
+#include "amanda.h"
+#include "testutils.h"
+#include "simpleprng.h"
+#include "aio-write.h"
+
+#define BLOCK_SIZE (32*1024)
+#define NBLOCKS 64
+
+static char *
+make_tempfile(int *fd)
+{
+    char *filename = g_strdup("/tmp/aio-write-test.XXXXXX");
+
+    *fd = g_mkstemp(filename);
+    if (*fd < 0) {
+	g_critical("g_mkstemp: %s", strerror(errno));
+	g_free(filename);
+	return NULL;
+    }
+    return filename;
+}
+
+/* Write NBLOCKS blocks, the last one short, and read the file back */
+static gboolean
+test_write(void)
+{
+    aio_writer_t *writer;
+    simpleprng_state_t prng;
+    char *filename;
+    char *data, *back;
+    gsize total = 0;
+    gboolean ret = TRUE;
+    struct stat st;
+    int fd, i;
+
+    if (!(filename = make_tempfile(&fd)))
+	return FALSE;
+
+    writer = aio_writer_new(fd, 512, 4, BLOCK_SIZE);
+    if (!writer) {
+	tu_dbg("aio_writer_new: %s; nothing to test\n", strerror(errno));
+	close(fd);
+	unlink(filename);
+	g_free(filename);
+	return TRUE;
+    }
+
+    data = g_malloc(BLOCK_SIZE * NBLOCKS);
+    simpleprng_seed(&prng, 0xabcd);
+    simpleprng_fill_buffer(&prng, data, BLOCK_SIZE * NBLOCKS);
+    for (i = 0; i < NBLOCKS; i++) {
+	gsize size = (i == NBLOCKS - 1) ? BLOCK_SIZE / 3 : BLOCK_SIZE;
+	int err = aio_writer_write(writer, data + total, size);
+
+	if (err) {
+	    g_critical("aio_writer_write: %s", strerror(err));
+	    ret = FALSE;
+	    break;
+	}
+	total += size;
+    }
+    if (ret && aio_writer_flush(writer)) {
+	g_critical("aio_writer_flush failed");
+	ret = FALSE;
+    }
+    if (ret && aio_writer_written(writer) != (off_t)(512 + total)) {
+	g_critical("aio_writer_written is %lld, expected %lld",
+		   (long long)aio_writer_written(writer),
+		   (long long)(512 + total));
+	ret = FALSE;
+    }
+    aio_writer_free(writer);
+
+    if (ret) {
+	back = g_malloc(total);
+	if (fstat(fd, &st) != 0 || st.st_size != (off_t)(512 + total)) {
+	    g_critical("the file has the wrong size");
+	    ret = FALSE;
+	} else if (lseek(fd, 512, SEEK_SET) != 512 ||
+		   full_read(fd, back, total) != total ||
+		   memcmp(back, data, total) != 0) {
+	    g_critical("the file does not hold the data written");
+	    ret = FALSE;
+	}
+	g_free(back);
+    }
+
+    g_free(data);
+    close(fd);
+    unlink(filename);
+    g_free(filename);
+    return ret;
+}
+
+/* A write to a descriptor that can't be written is reported by a later
+ * call */
+static gboolean
+test_error(void)
+{
+    aio_writer_t *writer;
+    char *filename;
+    char data[BLOCK_SIZE];
+    gboolean ret = TRUE;
+    int fd, rofd, err = 0, i;
+
+    if (!(filename = make_tempfile(&fd)))
+	return FALSE;
+    rofd = open(filename, O_RDONLY);
+    close(fd);
+
+    writer = aio_writer_new(rofd, 0, 2, BLOCK_SIZE);
+    if (!writer) {
+	tu_dbg("aio_writer_new: %s; nothing to test\n", strerror(errno));
+	goto done;
+    }
+
+    memset(data, 'x', sizeof(data));
+    for (i = 0; i < 8 && !err; i++)
+	err = aio_writer_write(writer, data, sizeof(data));
+    if (!err)
+	err = aio_writer_flush(writer);
+    if (err != EBADF) {
+	g_critical("expected EBADF, got %s", err ? strerror(err) : "success");
+	ret = FALSE;
+    }
+    if (aio_writer_written(writer) != 0) {
+	g_critical("aio_writer_written is %lld, expected 0",
+		   (long long)aio_writer_written(writer));
+	ret = FALSE;
+    }
+    if (aio_writer_write(writer, data, sizeof(data)) != err) {
+	g_critical("the writer accepted data after an error");
+	ret = FALSE;
+    }
+    aio_writer_free(writer);
+
+done:
+    close(rofd);
+    unlink(filename);
+    g_free(filename);
+    return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+    static TestUtilsTest tests[] = {
+	TU_TEST(test_write, 90),
+	TU_TEST(test_error, 90),
+	TU_END()
+    };
+
+    glib_init();
+
+    return testutils_run_tests(argc, argv, tests);
+}
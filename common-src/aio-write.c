@@ -0,0 +1,366 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+
+/*
+ * Asynchronous file writer
+ */
+
+#include "amanda.h"
+#include "aio-write.h"
+
+#ifdef HAVE_LIBURING
+
+#include <liburing.h>
+
+typedef struct {
+    char *buf;
+    gsize len;		/* of the write */
+    gsize done;		/* bytes written so far */
+    off_t offset;
+    gboolean busy;
+} aio_slot_t;
+
+struct aio_writer_s {
+    struct io_uring ring;
+    int fd;
+    guint depth;
+    gsize buffer_size;
+    gboolean fixed;	/* the buffers are registered with the ring */
+    gboolean direct;	/* fd has O_DIRECT */
+    aio_slot_t *slots;
+    guint in_flight;
+    off_t offset;	/* of the next write */
+    int error;		/* errno of the first write to fail */
+    off_t error_offset;	/* where the file stops being written */
+};
+
+/* Record that SLOT stopped early with ERR; the file is good up to the
+ * lowest such offset. */
+static void
+aio_fail(
+    aio_writer_t *writer,
+    aio_slot_t   *slot,
+    int           err)
+{
+    off_t end = slot->offset + slot->done;
+
+    if (!writer->error) {
+	writer->error = err;
+	writer->error_offset = end;
+    } else if (end < writer->error_offset) {
+	writer->error_offset = end;
+    }
+}
+
+/* O_DIRECT can't write a tail that is not aligned: write what is left
+ * through the page cache */
+static void
+aio_drop_direct(
+    aio_writer_t *writer)
+{
+#ifdef O_DIRECT
+    int flags = fcntl(writer->fd, F_GETFL);
+
+    if (flags != -1)
+	(void)fcntl(writer->fd, F_SETFL, flags & ~O_DIRECT);
+#endif
+    writer->direct = FALSE;
+}
+
+static void
+aio_submit(
+    aio_writer_t *writer,
+    aio_slot_t   *slot)
+{
+    struct io_uring_sqe *sqe;
+    int rv;
+
+    /* there are as many entries as buffers, so one is always free */
+    sqe = io_uring_get_sqe(&writer->ring);
+    g_assert(sqe != NULL);
+    if (writer->fixed) {
+	io_uring_prep_write_fixed(sqe, writer->fd, slot->buf + slot->done,
+				  slot->len - slot->done,
+				  slot->offset + slot->done,
+				  slot - writer->slots);
+    } else {
+	io_uring_prep_write(sqe, writer->fd, slot->buf + slot->done,
+			    slot->len - slot->done, slot->offset + slot->done);
+    }
+    io_uring_sqe_set_data(sqe, slot);
+
+    do {
+	rv = io_uring_submit(&writer->ring);
+    } while (rv == -EINTR || rv == -EAGAIN);
+    if (rv < 0) {
+	aio_fail(writer, slot, -rv);
+	slot->busy = FALSE;
+	writer->in_flight--;
+    }
+}
+
+/* Wait for one write to complete */
+static void
+aio_reap(
+    aio_writer_t *writer)
+{
+    struct io_uring_cqe *cqe;
+    aio_slot_t *slot;
+    int rv, res;
+
+    do {
+	rv = io_uring_wait_cqe(&writer->ring, &cqe);
+    } while (rv == -EINTR);
+    if (rv < 0) {
+	/* the ring is unusable; nothing in flight can be trusted */
+	guint i;
+
+	for (i = 0; i < writer->depth; i++) {
+	    if (writer->slots[i].busy) {
+		aio_fail(writer, &writer->slots[i], -rv);
+		writer->slots[i].busy = FALSE;
+	    }
+	}
+	writer->in_flight = 0;
+	return;
+    }
+
+    slot = io_uring_cqe_get_data(cqe);
+    res = cqe->res;
+    io_uring_cqe_seen(&writer->ring, cqe);
+
+    if (res == -EINTR || res == -EAGAIN) {
+	aio_submit(writer, slot);
+	return;
+    } else if (res < 0) {
+	aio_fail(writer, slot, -res);
+    } else if (res == 0) {
+	/* no progress at all: the filesystem is full */
+	aio_fail(writer, slot, ENOSPC);
+    } else {
+	slot->done += res;
+	if (slot->done < slot->len) {
+	    /* a short write, usually at the end of the space; writing the
+	     * rest tells why */
+	    if (writer->direct)
+		aio_drop_direct(writer);
+	    aio_submit(writer, slot);
+	    return;
+	}
+    }
+    slot->busy = FALSE;
+    writer->in_flight--;
+}
+
+aio_writer_t *
+aio_writer_new(
+    int    fd,
+    off_t  offset,
+    guint  depth,
+    gsize  buffer_size)
+{
+    aio_writer_t *writer = g_new0(aio_writer_t, 1);
+    struct iovec *iov;
+    guint i;
+    int rv;
+
+    depth = MAX(depth, 1);
+    buffer_size = (buffer_size + AIO_WRITER_ALIGN - 1) / AIO_WRITER_ALIGN *
+		  AIO_WRITER_ALIGN;
+
+    rv = io_uring_queue_init(depth, &writer->ring, 0);
+    if (rv < 0) {
+	g_free(writer);
+	errno = -rv;
+	return NULL;
+    }
+    writer->fd = fd;
+    writer->depth = depth;
+    writer->buffer_size = buffer_size;
+    writer->offset = offset;
+    writer->slots = g_new0(aio_slot_t, depth);
+
+    iov = g_new(struct iovec, depth);
+    for (i = 0; i < depth; i++) {
+#ifdef HAVE_POSIX_MEMALIGN
+	if (posix_memalign((void **)&writer->slots[i].buf, AIO_WRITER_ALIGN,
+			   buffer_size) != 0)
+	    writer->slots[i].buf = NULL;
+#else
+	writer->slots[i].buf = malloc(buffer_size);
+#endif
+	if (!writer->slots[i].buf) {
+	    g_free(iov);
+	    aio_writer_free(writer);
+	    errno = ENOMEM;
+	    return NULL;
+	}
+	iov[i].iov_base = writer->slots[i].buf;
+	iov[i].iov_len = buffer_size;
+    }
+    /* registered buffers spare the kernel a page mapping per write, but
+     * count against RLIMIT_MEMLOCK; plain writes work as well */
+    rv = io_uring_register_buffers(&writer->ring, iov, depth);
+    writer->fixed = (rv == 0);
+    if (!writer->fixed)
+	g_debug("aio_writer: can't register the buffers: %s", strerror(-rv));
+    g_free(iov);
+
+#ifdef O_DIRECT
+    rv = fcntl(fd, F_GETFL);
+    writer->direct = (rv != -1 && (rv & O_DIRECT));
+    if (writer->direct && offset % AIO_WRITER_ALIGN != 0)
+	aio_drop_direct(writer);
+#endif
+
+    return writer;
+}
+
+int
+aio_writer_write(
+    aio_writer_t  *writer,
+    gconstpointer  data,
+    gsize          size)
+{
+    aio_slot_t *slot = NULL;
+    guint i;
+
+    g_assert(size <= writer->buffer_size);
+
+    if (writer->error)
+	return writer->error;
+
+    if (writer->direct && size % AIO_WRITER_ALIGN != 0) {
+	/* the writes in flight keep O_DIRECT */
+	if (aio_writer_flush(writer))
+	    return writer->error;
+	aio_drop_direct(writer);
+    }
+
+    while (writer->in_flight == writer->depth)
+	aio_reap(writer);
+    if (writer->error)
+	return writer->error;
+
+    for (i = 0; i < writer->depth; i++) {
+	if (!writer->slots[i].busy) {
+	    slot = &writer->slots[i];
+	    break;
+	}
+    }
+    g_assert(slot != NULL);
+
+    memcpy(slot->buf, data, size);
+    slot->len = size;
+    slot->done = 0;
+    slot->offset = writer->offset;
+    slot->busy = TRUE;
+    writer->in_flight++;
+    writer->offset += size;
+    aio_submit(writer, slot);
+
+    return writer->error;
+}
+
+int
+aio_writer_flush(
+    aio_writer_t *writer)
+{
+    while (writer->in_flight > 0)
+	aio_reap(writer);
+    return writer->error;
+}
+
+off_t
+aio_writer_written(
+    aio_writer_t *writer)
+{
+    return writer->error ? writer->error_offset : writer->offset;
+}
+
+void
+aio_writer_free(
+    aio_writer_t *writer)
+{
+    guint i;
+
+    if (!writer)
+	return;
+
+    aio_writer_flush(writer);
+    if (writer->fixed)
+	io_uring_unregister_buffers(&writer->ring);
+    io_uring_queue_exit(&writer->ring);
+    for (i = 0; i < writer->depth; i++)
+	free(writer->slots[i].buf);
+    g_free(writer->slots);
+    g_free(writer);
+}
+
+#else /* HAVE_LIBURING */
+
+aio_writer_t *
+aio_writer_new(
+    int    fd G_GNUC_UNUSED,
+    off_t  offset G_GNUC_UNUSED,
+    guint  depth G_GNUC_UNUSED,
+    gsize  buffer_size G_GNUC_UNUSED)
+{
+    errno = ENOSYS;
+    return NULL;
+}
+
+int
+aio_writer_write(
+    aio_writer_t  *writer G_GNUC_UNUSED,
+    gconstpointer  data G_GNUC_UNUSED,
+    gsize          size G_GNUC_UNUSED)
+{
+    return ENOSYS;
+}
+
+int
+aio_writer_flush(
+    aio_writer_t *writer G_GNUC_UNUSED)
+{
+    return ENOSYS;
+}
+
+off_t
+aio_writer_written(
+    aio_writer_t *writer G_GNUC_UNUSED)
+{
+    return 0;
+}
+
+void
+aio_writer_free(
+    aio_writer_t *writer G_GNUC_UNUSED)
+{
+}
+
+#endif /* HAVE_LIBURING */
@@ -0,0 +1,76 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+
+/*
+ * Asynchronous file writer
+ *
+ * Each block is copied into one of DEPTH aligned buffers and written with
+ * io_uring, so that one thread keeps up to DEPTH writes in flight.  A failed
+ * write is only seen by a later call; aio_writer_written then tells how much
+ * of the file is good.  If the descriptor is opened with O_DIRECT, blocks
+ * that are not a multiple of AIO_WRITER_ALIGN are written through the page
+ * cache instead.
+ *
+ * Without liburing, aio_writer_new fails with ENOSYS and the callers write
+ * synchronously.
+ */
+
+#ifndef AIO_WRITE_H
+#define AIO_WRITE_H
+
+#include <glib.h>
+#include <sys/types.h>
+
+/* alignment of the buffers, of the offsets and of the sizes for O_DIRECT */
+#define AIO_WRITER_ALIGN 4096
+
+typedef struct aio_writer_s aio_writer_t;
+
+/* Create a writer of FD, starting at OFFSET, with DEPTH buffers of
+ * BUFFER_SIZE bytes.  Returns NULL and sets errno if io_uring can't be used.
+ */
+aio_writer_t *aio_writer_new(int fd, off_t offset, guint depth,
+			     gsize buffer_size);
+
+/* Queue SIZE bytes of DATA (at most BUFFER_SIZE) after the previous ones,
+ * waiting for a free buffer if needed.  Returns 0, or the errno of the first
+ * write to fail, this one or an earlier one; the writer then refuses any
+ * further data. */
+int aio_writer_write(aio_writer_t *writer, gconstpointer data, gsize size);
+
+/* Wait for all the writes queued.  Returns 0 or the errno of the first
+ * write to fail. */
+int aio_writer_flush(aio_writer_t *writer);
+
+/* After aio_writer_flush, the offset up to which the file is written without
+ * a hole; that is where the first failed write starts. */
+off_t aio_writer_written(aio_writer_t *writer);
+
+/* Wait for the writes and free the writer; FD is left open. */
+void aio_writer_free(aio_writer_t *writer);
+
+#endif /* AIO_WRITE_H */
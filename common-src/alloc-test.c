@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+#include "amanda.h"
+#include "testutils.h"
+
+/* Tests */
+
+static int
+test_arena_small(void)
+{
+    amarena_t *arena = amarena_new(1024);
+    char *ptrs[1000];
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+	ptrs[i] = amarena_alloc(arena, (i % 37) + 1);
+	if (((gsize)ptrs[i] & 15) != 0) {
+	    g_fprintf(stderr, "allocation %d is not aligned\n", i);
+	    return FALSE;
+	}
+	if (ptrs[i][0] != 0 || ptrs[i][i % 37] != 0) {
+	    g_fprintf(stderr, "allocation %d is not zeroed\n", i);
+	    return FALSE;
+	}
+	memset(ptrs[i], i & 0xff, (i % 37) + 1);
+    }
+
+    /* no allocation overwrote another */
+    for (i = 0; i < 1000; i++) {
+	int j;
+	for (j = 0; j <= i % 37; j++) {
+	    if ((unsigned char)ptrs[i][j] != (i & 0xff)) {
+		g_fprintf(stderr, "allocation %d was overwritten\n", i);
+		return FALSE;
+	    }
+	}
+    }
+
+    amarena_free(arena);
+    return TRUE;
+}
+
+static int
+test_arena_big(void)
+{
+    amarena_t *arena = amarena_new(1024);
+    char *small1, *big, *small2;
+
+    small1 = amarena_alloc(arena, 16);
+    big = amarena_alloc(arena, 100000);
+    small2 = amarena_alloc(arena, 16);
+    memset(big, 'x', 100000);
+
+    /* the big piece does not take the current chunk's place */
+    if (small2 != small1 + 16) {
+	g_fprintf(stderr, "a big allocation abandoned the current chunk\n");
+	return FALSE;
+    }
+    if (amarena_size(arena) != 100032) {
+	g_fprintf(stderr, "arena size is %zu, expected 100032\n",
+		  amarena_size(arena));
+	return FALSE;
+    }
+
+    amarena_reset(arena);
+    if (amarena_size(arena) != 0) {
+	g_fprintf(stderr, "arena size is %zu after a reset\n",
+		  amarena_size(arena));
+	return FALSE;
+    }
+    small1 = amarena_alloc(arena, 16);
+    if (small1[0] != 0) {
+	g_fprintf(stderr, "allocation after a reset is not zeroed\n");
+	return FALSE;
+    }
+
+    amarena_free(arena);
+    return TRUE;
+}
+
+static int
+test_arena_strings(void)
+{
+    amarena_t *arena = amarena_new(0);
+    char *s1, *s2;
+
+    s1 = amarena_strdup(arena, "hello");
+    s2 = amarena_strdup_printf(arena, "%s-%d", s1, 42);
+    if (!g_str_equal(s1, "hello") || !g_str_equal(s2, "hello-42")) {
+	g_fprintf(stderr, "got '%s' and '%s'\n", s1, s2);
+	return FALSE;
+    }
+    if (amarena_strdup(arena, NULL) != NULL) {
+	g_fprintf(stderr, "amarena_strdup(NULL) is not NULL\n");
+	return FALSE;
+    }
+
+    amarena_free(arena);
+    return TRUE;
+}
+
+/*
+ * Main driver
+ */
+
+int
+main(int argc, char **argv)
+{
+    static TestUtilsTest tests[] = {
+	TU_TEST(test_arena_small, 90),
+	TU_TEST(test_arena_big, 90),
+	TU_TEST(test_arena_strings, 90),
+	TU_END()
+    };
+
+    glib_init();
+
+    return testutils_run_tests(argc, argv, tests);
+}
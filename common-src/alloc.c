@@ -150,3 +150,162 @@ free_env(
     }
     g_free(env);
 }
+
+/*
+ * Arenas: memory that is allocated piece by piece and released all at
+ * once.  Each chunk is carved from its start; a request larger than the
+ * chunk size gets a chunk of its own.  An arena is not thread-safe.
+ */
+
+#define AMARENA_ALIGN 16
+#define AMARENA_ROUND(n) (((n) + AMARENA_ALIGN - 1) & ~((size_t)AMARENA_ALIGN - 1))
+
+typedef struct amarena_chunk_s {
+    struct amarena_chunk_s *next;
+    size_t size;			/* usable bytes after the header */
+    size_t used;
+} amarena_chunk_t;
+
+#define AMARENA_HEADER AMARENA_ROUND(sizeof(amarena_chunk_t))
+
+struct amarena_s {
+    amarena_chunk_t *chunks;		/* current chunk first */
+    size_t chunk_size;
+    size_t allocated;			/* bytes handed out */
+};
+
+amarena_t *
+amarena_new(
+    size_t chunk_size)
+{
+    amarena_t *arena = g_new0(amarena_t, 1);
+
+    if (chunk_size == 0)
+	chunk_size = AMARENA_DEFAULT_CHUNK;
+    arena->chunk_size = AMARENA_ROUND(chunk_size);
+    return arena;
+}
+
+static amarena_chunk_t *
+amarena_new_chunk(
+    size_t size)
+{
+    amarena_chunk_t *chunk = g_malloc(AMARENA_HEADER + size);
+
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+gpointer
+amarena_alloc(
+    amarena_t *arena,
+    size_t     size)
+{
+    amarena_chunk_t *chunk = arena->chunks;
+    char *p;
+
+    size = AMARENA_ROUND(size ? size : 1);
+    if (size > arena->chunk_size / 4) {
+	/* a big piece gets its own chunk, behind the current one, so the
+	 * space left in the current chunk is not wasted */
+	amarena_chunk_t *big = amarena_new_chunk(size);
+	big->used = size;
+	if (chunk) {
+	    big->next = chunk->next;
+	    chunk->next = big;
+	} else {
+	    arena->chunks = big;
+	}
+	arena->allocated += size;
+	p = (char *)big + AMARENA_HEADER;
+	memset(p, 0, size);
+	return p;
+    }
+
+    if (!chunk || chunk->size - chunk->used < size) {
+	chunk = amarena_new_chunk(arena->chunk_size);
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+    }
+    p = (char *)chunk + AMARENA_HEADER + chunk->used;
+    chunk->used += size;
+    arena->allocated += size;
+    memset(p, 0, size);
+    return p;
+}
+
+char *
+amarena_strdup(
+    amarena_t  *arena,
+    const char *str)
+{
+    size_t len;
+    char *p;
+
+    if (!str)
+	return NULL;
+    len = strlen(str) + 1;
+    p = amarena_alloc(arena, len);
+    memcpy(p, str, len);
+    return p;
+}
+
+char *
+amarena_strdup_printf(
+    amarena_t  *arena,
+    const char *fmt,
+    ...)
+{
+    va_list argp;
+    char *str;
+    char *p;
+
+    arglist_start(argp, fmt);
+    str = g_strdup_vprintf(fmt, argp);
+    arglist_end(argp);
+    p = amarena_strdup(arena, str);
+    g_free(str);
+    return p;
+}
+
+size_t
+amarena_size(
+    amarena_t *arena)
+{
+    return arena->allocated;
+}
+
+void
+amarena_reset(
+    amarena_t *arena)
+{
+    amarena_chunk_t *chunk, *next;
+    amarena_chunk_t *keep = NULL;
+
+    /* keep one ordinary chunk for the next round of allocations */
+    for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+	next = chunk->next;
+	if (!keep && chunk->size == arena->chunk_size) {
+	    keep = chunk;
+	    keep->next = NULL;
+	    keep->used = 0;
+	} else {
+	    g_free(chunk);
+	}
+    }
+    arena->chunks = keep;
+    arena->allocated = 0;
+}
+
+void
+amarena_free(
+    amarena_t *arena)
+{
+    if (!arena)
+	return;
+    amarena_reset(arena);
+    g_free(arena->chunks);
+    g_free(arena);
+}
@@ -422,6 +422,26 @@ extern int errno;
 char **	safe_env_full(char **add);
 void free_env(char **env);
 
+/*
+ * Arenas hold many small allocations that share one lifetime, such as the
+ * per-run state of the planner or driver; they are released all at once
+ * with amarena_reset or amarena_free, never one by one.  Allocations are
+ * zeroed and 16-byte aligned.  An arena is not thread-safe.
+ */
+typedef struct amarena_s amarena_t;
+
+#define AMARENA_DEFAULT_CHUNK (64*1024)
+
+amarena_t *amarena_new(size_t chunk_size);
+gpointer amarena_alloc(amarena_t *arena, size_t size);
+char *amarena_strdup(amarena_t *arena, const char *str);
+char *amarena_strdup_printf(amarena_t *arena, const char *fmt, ...)
+		G_GNUC_PRINTF(2, 3);
+size_t amarena_size(amarena_t *arena);
+void amarena_reset(amarena_t *arena);
+void amarena_free(amarena_t *arena);
+#define amarena_new0(arena, type) ((type *)amarena_alloc((arena), sizeof(type)))
+
 time_t	unctime(char *timestr);
 
 /*
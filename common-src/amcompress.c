@@ -0,0 +1,1027 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+/*
+ * In-process streaming compression
+ */
+
+#include "amanda.h"
+#include "amcompress.h"
+#include "amexec.h"
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LIBLZ4
+#include <lz4frame.h>
+#endif
+
+/* initial size of the output buffer; it grows as needed */
+#define AMCOMPRESS_OUT_SIZE (256*1024)
+
+/* number of blocks per worker that may be in flight at once in parallel
+ * mode */
+#define AMCOMPRESS_JOBS_PER_THREAD 2
+
+/* upper limit for AMCOMPRESS_THREADS_AUTO */
+#define AMCOMPRESS_MAX_THREADS 16
+
+/* One block to compress on the worker pool */
+typedef struct compress_job_s {
+    char *in;
+    gsize in_len;
+    char *out;
+    gsize out_len;
+    char *errmsg;
+    gboolean done;
+} compress_job_t;
+
+struct amcompress_s {
+    amcompress_algo_t algo;
+    int level;
+
+    /* parallel mode: the input is cut into AMCOMPRESS_BLOCK_SIZE blocks,
+     * each compressed as a complete gzip member, zstd frame or lz4 frame by
+     * the pool, and the results are emitted in order.  Concatenated
+     * members/frames are a valid stream for the command-line tools. */
+    amexec_queue_t *pool;
+    GMutex *mutex;		/* protects jobs, done flags, and idle */
+    GCond *cond;		/* signalled when a job is done */
+    GQueue *jobs;		/* compress_job_t in flight, oldest first */
+    guint max_jobs;
+    GSList *idle;		/* single-stream compressors for the workers */
+    char *block;		/* the block being filled */
+    gsize block_len;
+    guint64 nblocks;
+    GArray *block_offsets;	/* guint64 output offset of each block */
+    guint64 block_out;		/* output of the blocks collected so far */
+
+    char *out;
+    gsize out_size;	/* allocated size of out */
+    gsize out_len;	/* bytes used in out */
+
+    guint64 bytes_in;
+    guint64 bytes_out;
+
+    char *errmsg;
+
+    gboolean decompress;	/* made by amcompress_new_decompress */
+    gboolean at_end;		/* decompress: input ends between streams */
+
+#ifdef HAVE_LIBZ
+    z_stream zstrm;
+#endif
+#ifdef HAVE_LIBZSTD
+    ZSTD_CCtx *zstd;
+    ZSTD_DCtx *zstd_d;
+#endif
+#ifdef HAVE_LIBLZ4
+    LZ4F_cctx *lz4;
+    LZ4F_preferences_t lz4_prefs;
+    gboolean lz4_begun;
+    LZ4F_dctx *lz4_d;
+#endif
+};
+
+static void
+set_error(
+    amcompress_t *comp,
+    char *errmsg)
+{
+    g_free(comp->errmsg);
+    comp->errmsg = errmsg;
+    g_debug("amcompress: %s", errmsg);
+}
+
+static char *
+out_space(
+    amcompress_t *comp,
+    gsize needed)
+{
+    if (comp->out_size - comp->out_len < needed) {
+	while (comp->out_size - comp->out_len < needed)
+	    comp->out_size *= 2;
+	comp->out = g_realloc(comp->out, comp->out_size);
+    }
+    return comp->out + comp->out_len;
+}
+
+gboolean
+amcompress_supported(
+    amcompress_algo_t algo)
+{
+    switch (algo) {
+#ifdef HAVE_LIBZ
+    case AMCOMPRESS_GZIP: return TRUE;
+#endif
+#ifdef HAVE_LIBZSTD
+    case AMCOMPRESS_ZSTD: return TRUE;
+#endif
+#ifdef HAVE_LIBLZ4
+    case AMCOMPRESS_LZ4: return TRUE;
+#endif
+    default: return FALSE;
+    }
+}
+
+gboolean
+amcompress_algo_from_name(
+    const char *name,
+    amcompress_algo_t *algo)
+{
+    if (g_ascii_strcasecmp(name, "gzip") == 0) {
+	*algo = AMCOMPRESS_GZIP;
+    } else if (g_ascii_strcasecmp(name, "zstd") == 0) {
+	*algo = AMCOMPRESS_ZSTD;
+    } else if (g_ascii_strcasecmp(name, "lz4") == 0) {
+	*algo = AMCOMPRESS_LZ4;
+    } else {
+	return FALSE;
+    }
+    return TRUE;
+}
+
+const char *
+amcompress_algo_name(
+    amcompress_algo_t algo)
+{
+    switch (algo) {
+    case AMCOMPRESS_GZIP: return "gzip";
+    case AMCOMPRESS_ZSTD: return "zstd";
+    case AMCOMPRESS_LZ4:  return "lz4";
+    }
+    return "unknown";
+}
+
+struct threads_property_s {
+    property_t *property;
+};
+
+static void
+find_threads_property(
+    gpointer key_p,
+    gpointer value_p,
+    gpointer user_data_p)
+{
+    struct threads_property_s *tp = user_data_p;
+
+    if (!tp->property && g_str_amanda_equal(key_p, AMCOMPRESS_THREADS_PROPERTY))
+	tp->property = value_p;
+}
+
+int
+amcompress_threads_property(
+    proplist_t proplist)
+{
+    struct threads_property_s tp = { NULL };
+    const char *value;
+    guint64 nthreads;
+    char *end;
+
+    if (!proplist)
+	return 0;
+    g_hash_table_foreach(proplist, find_threads_property, &tp);
+    if (!tp.property || !tp.property->values)
+	return 0;
+
+    value = tp.property->values->data;
+    if (g_ascii_strcasecmp(value, "auto") == 0)
+	return AMCOMPRESS_THREADS_AUTO;
+    nthreads = g_ascii_strtoull(value, &end, 10);
+    if (end == value || *end != '\0' || nthreads < 1 ||
+	nthreads > AMCOMPRESS_MAX_THREADS) {
+	g_debug("invalid %s property: %s", AMCOMPRESS_THREADS_PROPERTY, value);
+	return 0;
+    }
+    return (int)nthreads;
+}
+
+static int
+real_level(
+    amcompress_algo_t algo,
+    int level)
+{
+    static const int levels[][3] = {
+	/* default, fast, best */
+	{ 6, 1, 9 },	/* gzip */
+	{ 3, 1, 19 },	/* zstd */
+	{ 0, 0, 12 },	/* lz4 */
+    };
+
+    switch (level) {
+    case AMCOMPRESS_LEVEL_DEFAULT: return levels[algo][0];
+    case AMCOMPRESS_LEVEL_FAST:	   return levels[algo][1];
+    case AMCOMPRESS_LEVEL_BEST:	   return levels[algo][2];
+    default:			   return level;
+    }
+}
+
+/* prepare a single-stream compressor that has finished a stream for the
+ * next one */
+static gboolean
+stream_reset(
+    amcompress_t *comp)
+{
+    comp->bytes_in = comp->bytes_out = 0;
+
+    switch (comp->algo) {
+#ifdef HAVE_LIBZ
+    case AMCOMPRESS_GZIP:
+	return deflateReset(&comp->zstrm) == Z_OK;
+#endif
+#ifdef HAVE_LIBZSTD
+    case AMCOMPRESS_ZSTD:
+	return !ZSTD_isError(ZSTD_CCtx_reset(comp->zstd,
+					     ZSTD_reset_session_only));
+#endif
+#ifdef HAVE_LIBLZ4
+    case AMCOMPRESS_LZ4:
+	/* the context can be reused once LZ4F_compressEnd has run */
+	comp->lz4_begun = FALSE;
+	return TRUE;
+#endif
+    default:
+	return FALSE;
+    }
+}
+
+/* compress one block into a complete stream; runs on the worker pool */
+static void
+compress_job_thread(
+    gpointer data,
+    gpointer user_data)
+{
+    compress_job_t *job = (compress_job_t *)data;
+    amcompress_t *comp = (amcompress_t *)user_data;
+    amcompress_t *stream = NULL;
+    char *out;
+    gsize len1 = 0, len2 = 0;
+
+    g_mutex_lock(comp->mutex);
+    if (comp->idle) {
+	stream = comp->idle->data;
+	comp->idle = g_slist_delete_link(comp->idle, comp->idle);
+    }
+    g_mutex_unlock(comp->mutex);
+
+    if (!stream)
+	stream = amcompress_new(comp->algo, comp->level, 0, &job->errmsg);
+
+    if (stream) {
+	if ((out = amcompress_update(stream, job->in, job->in_len, &len1))) {
+	    job->out = g_malloc(len1 + AMCOMPRESS_OUT_SIZE);
+	    memcpy(job->out, out, len1);
+	    if ((out = amcompress_finish(stream, &len2))) {
+		if (len2 > AMCOMPRESS_OUT_SIZE)
+		    job->out = g_realloc(job->out, len1 + len2);
+		memcpy(job->out + len1, out, len2);
+		job->out_len = len1 + len2;
+	    }
+	}
+	if (!out) {
+	    job->errmsg = g_strdup(amcompress_error(stream));
+	    amcompress_free(stream);
+	    stream = NULL;
+	} else if (!stream_reset(stream)) {
+	    amcompress_free(stream);
+	    stream = NULL;
+	}
+    }
+    g_free(job->in);
+    job->in = NULL;
+
+    g_mutex_lock(comp->mutex);
+    if (stream)
+	comp->idle = g_slist_prepend(comp->idle, stream);
+    job->done = TRUE;
+    g_cond_broadcast(comp->cond);
+    g_mutex_unlock(comp->mutex);
+}
+
+static void
+free_job(
+    compress_job_t *job)
+{
+    g_free(job->in);
+    g_free(job->out);
+    g_free(job->errmsg);
+    g_free(job);
+}
+
+/* append the output of finished jobs to comp->out, in order, waiting for
+ * the oldest job until no more than MAX_PENDING jobs are in flight */
+static gboolean
+collect_jobs(
+    amcompress_t *comp,
+    guint max_pending)
+{
+    compress_job_t *job;
+
+    g_mutex_lock(comp->mutex);
+    while ((job = g_queue_peek_head(comp->jobs))) {
+	if (!job->done) {
+	    if (g_queue_get_length(comp->jobs) <= max_pending)
+		break;
+	    g_cond_wait(comp->cond, comp->mutex);
+	    continue;
+	}
+	g_queue_pop_head(comp->jobs);
+	g_mutex_unlock(comp->mutex);
+
+	if (job->errmsg) {
+	    set_error(comp, job->errmsg);
+	    job->errmsg = NULL;
+	    free_job(job);
+	    return FALSE;
+	}
+	memcpy(out_space(comp, job->out_len), job->out, job->out_len);
+	comp->out_len += job->out_len;
+	g_array_append_val(comp->block_offsets, comp->block_out);
+	comp->block_out += job->out_len;
+	free_job(job);
+
+	g_mutex_lock(comp->mutex);
+    }
+    g_mutex_unlock(comp->mutex);
+
+    return TRUE;
+}
+
+/* hand the current block to the pool, once there is room for it */
+static gboolean
+submit_block(
+    amcompress_t *comp)
+{
+    compress_job_t *job;
+
+    if (!collect_jobs(comp, comp->max_jobs - 1))
+	return FALSE;
+
+    job = g_new0(compress_job_t, 1);
+    job->in = comp->block;
+    job->in_len = comp->block_len;
+    comp->block = g_malloc(AMCOMPRESS_BLOCK_SIZE);
+    comp->block_len = 0;
+    comp->nblocks++;
+
+    g_mutex_lock(comp->mutex);
+    g_queue_push_tail(comp->jobs, job);
+    g_mutex_unlock(comp->mutex);
+    amexec_queue_push(comp->pool, job);
+
+    return TRUE;
+}
+
+static gboolean
+parallel_update(
+    amcompress_t *comp,
+    const char *buf,
+    gsize len)
+{
+    while (len > 0) {
+	gsize n = MIN(len, AMCOMPRESS_BLOCK_SIZE - comp->block_len);
+
+	memcpy(comp->block + comp->block_len, buf, n);
+	comp->block_len += n;
+	buf += n;
+	len -= n;
+	if (comp->block_len == AMCOMPRESS_BLOCK_SIZE && !submit_block(comp))
+	    return FALSE;
+    }
+
+    /* pass along whatever is already done, without waiting */
+    return collect_jobs(comp, G_MAXUINT);
+}
+
+static gboolean
+parallel_finish(
+    amcompress_t *comp)
+{
+    /* an empty input still needs one (empty) member or frame */
+    if ((comp->block_len > 0 || comp->nblocks == 0) && !submit_block(comp))
+	return FALSE;
+
+    if (!collect_jobs(comp, 0))
+	return FALSE;
+
+    /* the end of the last block */
+    g_array_append_val(comp->block_offsets, comp->block_out);
+    return TRUE;
+}
+
+static amcompress_t *
+parallel_new(
+    amcompress_t *comp,
+    int nthreads,
+    char **errmsg)
+{
+    amcompress_t *stream;
+
+    /* make one stream now, so that configuration errors show up here */
+    if (!(stream = amcompress_new(comp->algo, comp->level, 0, errmsg))) {
+	amcompress_free(comp);
+	return NULL;
+    }
+
+    comp->mutex = g_mutex_new();
+    comp->cond = g_cond_new();
+    comp->jobs = g_queue_new();
+    comp->idle = g_slist_prepend(NULL, stream);
+    comp->max_jobs = nthreads * AMCOMPRESS_JOBS_PER_THREAD;
+    comp->block = g_malloc(AMCOMPRESS_BLOCK_SIZE);
+    comp->block_offsets = g_array_new(FALSE, FALSE, sizeof(guint64));
+    comp->pool = amexec_queue_new("compress", compress_job_thread, comp,
+				  nthreads, AMEXEC_PRIORITY_NORMAL, 0);
+
+    return comp;
+}
+
+amcompress_t *
+amcompress_new(
+    amcompress_algo_t algo,
+    int level,
+    int nthreads,
+    char **errmsg)
+{
+    amcompress_t *comp;
+
+    if (!amcompress_supported(algo)) {
+	*errmsg = g_strdup_printf(_("%s compression is not supported by this build"),
+				  amcompress_algo_name(algo));
+	return NULL;
+    }
+
+    comp = g_new0(amcompress_t, 1);
+    comp->algo = algo;
+    comp->level = real_level(algo, level);
+    comp->out_size = AMCOMPRESS_OUT_SIZE;
+    comp->out = g_malloc(comp->out_size);
+
+    if (nthreads == AMCOMPRESS_THREADS_AUTO) {
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = (int)CLAMP(ncpu, 1, AMCOMPRESS_MAX_THREADS);
+    }
+    if (nthreads > 1)
+	return parallel_new(comp, nthreads, errmsg);
+
+    switch (algo) {
+#ifdef HAVE_LIBZ
+    case AMCOMPRESS_GZIP:
+	/* windowBits + 16 selects a gzip header and trailer */
+	if (deflateInit2(&comp->zstrm, comp->level, Z_DEFLATED, 15 + 16, 8,
+			 Z_DEFAULT_STRATEGY) != Z_OK) {
+	    *errmsg = g_strdup_printf(_("deflateInit2 failed: %s"),
+		comp->zstrm.msg ? comp->zstrm.msg : "unknown error");
+	    goto error;
+	}
+	break;
+#endif
+
+#ifdef HAVE_LIBZSTD
+    case AMCOMPRESS_ZSTD: {
+	size_t r;
+
+	comp->zstd = ZSTD_createCCtx();
+	if (!comp->zstd) {
+	    *errmsg = g_strdup(_("ZSTD_createCCtx failed"));
+	    goto error;
+	}
+	r = ZSTD_CCtx_setParameter(comp->zstd, ZSTD_c_compressionLevel,
+				   comp->level);
+	if (ZSTD_isError(r)) {
+	    *errmsg = g_strdup_printf(_("invalid zstd level %d: %s"),
+				      comp->level, ZSTD_getErrorName(r));
+	    goto error;
+	}
+	break;
+    }
+#endif
+
+#ifdef HAVE_LIBLZ4
+    case AMCOMPRESS_LZ4:
+	if (LZ4F_isError(LZ4F_createCompressionContext(&comp->lz4,
+						       LZ4F_VERSION))) {
+	    *errmsg = g_strdup(_("LZ4F_createCompressionContext failed"));
+	    goto error;
+	}
+	memset(&comp->lz4_prefs, 0, sizeof(comp->lz4_prefs));
+	comp->lz4_prefs.compressionLevel = comp->level;
+	comp->lz4_prefs.frameInfo.blockSizeID = LZ4F_max4MB;
+	comp->lz4_prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+	break;
+#endif
+
+    default:
+	*errmsg = g_strdup(_("unknown compression algorithm"));
+	goto error;
+    }
+
+    return comp;
+
+error:
+    amcompress_free(comp);
+    return NULL;
+}
+
+amcompress_t *
+amcompress_new_decompress(
+    amcompress_algo_t algo,
+    char **errmsg)
+{
+    amcompress_t *comp;
+
+    if (!amcompress_supported(algo)) {
+	*errmsg = g_strdup_printf(_("%s compression is not supported by this build"),
+				  amcompress_algo_name(algo));
+	return NULL;
+    }
+
+    comp = g_new0(amcompress_t, 1);
+    comp->algo = algo;
+    comp->decompress = TRUE;
+    comp->at_end = TRUE;
+    comp->out_size = AMCOMPRESS_OUT_SIZE;
+    comp->out = g_malloc(comp->out_size);
+
+    switch (algo) {
+#ifdef HAVE_LIBZ
+    case AMCOMPRESS_GZIP:
+	/* windowBits + 32 accepts either a gzip or a zlib header */
+	if (inflateInit2(&comp->zstrm, 15 + 32) != Z_OK) {
+	    *errmsg = g_strdup_printf(_("inflateInit2 failed: %s"),
+		comp->zstrm.msg ? comp->zstrm.msg : "unknown error");
+	    goto error;
+	}
+	break;
+#endif
+
+#ifdef HAVE_LIBZSTD
+    case AMCOMPRESS_ZSTD:
+	comp->zstd_d = ZSTD_createDCtx();
+	if (!comp->zstd_d) {
+	    *errmsg = g_strdup(_("ZSTD_createDCtx failed"));
+	    goto error;
+	}
+	break;
+#endif
+
+#ifdef HAVE_LIBLZ4
+    case AMCOMPRESS_LZ4:
+	if (LZ4F_isError(LZ4F_createDecompressionContext(&comp->lz4_d,
+							 LZ4F_VERSION))) {
+	    *errmsg = g_strdup(_("LZ4F_createDecompressionContext failed"));
+	    goto error;
+	}
+	break;
+#endif
+
+    default:
+	*errmsg = g_strdup(_("unknown compression algorithm"));
+	goto error;
+    }
+
+    return comp;
+
+error:
+    amcompress_free(comp);
+    return NULL;
+}
+
+/* decompress LEN bytes into comp->out; concatenated gzip members, zstd
+ * frames or lz4 frames are decompressed one after the other */
+static gboolean
+decompress_update(
+    amcompress_t *comp,
+    const char *buf,
+    gsize len)
+{
+    switch (comp->algo) {
+#ifdef HAVE_LIBZ
+    case AMCOMPRESS_GZIP:
+	comp->zstrm.next_in = (Bytef *)buf;
+	comp->zstrm.avail_in = len;
+	do {
+	    uInt avail_in = comp->zstrm.avail_in;
+	    int r;
+
+	    comp->zstrm.next_out = (Bytef *)out_space(comp, AMCOMPRESS_OUT_SIZE);
+	    comp->zstrm.avail_out = comp->out_size - comp->out_len;
+	    r = inflate(&comp->zstrm, Z_NO_FLUSH);
+	    comp->out_len = comp->out_size - comp->zstrm.avail_out;
+	    if (comp->zstrm.avail_in < avail_in)
+		comp->at_end = FALSE;
+	    if (r == Z_STREAM_END) {
+		comp->at_end = TRUE;
+		r = inflateReset(&comp->zstrm);
+	    }
+	    if (r != Z_OK && r != Z_BUF_ERROR) {
+		set_error(comp, g_strdup_printf(_("inflate failed: %s"),
+		    comp->zstrm.msg ? comp->zstrm.msg : "unknown error"));
+		return FALSE;
+	    }
+	} while (comp->zstrm.avail_in > 0 || comp->zstrm.avail_out == 0);
+	return TRUE;
+#endif
+
+#ifdef HAVE_LIBZSTD
+    case AMCOMPRESS_ZSTD: {
+	ZSTD_inBuffer in = { buf, len, 0 };
+	ZSTD_outBuffer out;
+
+	do {
+	    size_t r;
+
+	    out.dst = out_space(comp, ZSTD_DStreamOutSize());
+	    out.size = comp->out_size - comp->out_len;
+	    out.pos = 0;
+	    r = ZSTD_decompressStream(comp->zstd_d, &out, &in);
+	    if (ZSTD_isError(r)) {
+		set_error(comp, g_strdup_printf(_("zstd decompression failed: %s"),
+						ZSTD_getErrorName(r)));
+		return FALSE;
+	    }
+	    comp->out_len += out.pos;
+	    /* 0 means a frame was completely decoded and flushed */
+	    comp->at_end = (r == 0);
+	} while (in.pos < in.size || out.pos == out.size);
+	return TRUE;
+    }
+#endif
+
+#ifdef HAVE_LIBLZ4
+    case AMCOMPRESS_LZ4: {
+	const char *src = buf;
+	gsize left = len;
+	size_t dst_size, avail;
+
+	do {
+	    size_t src_size = left;
+	    size_t r;
+	    char *dst = out_space(comp, AMCOMPRESS_OUT_SIZE);
+
+	    avail = dst_size = comp->out_size - comp->out_len;
+	    r = LZ4F_decompress(comp->lz4_d, dst, &dst_size, src, &src_size, NULL);
+	    if (LZ4F_isError(r)) {
+		set_error(comp, g_strdup_printf(_("lz4 decompression failed: %s"),
+						LZ4F_getErrorName(r)));
+		return FALSE;
+	    }
+	    comp->out_len += dst_size;
+	    src += src_size;
+	    left -= src_size;
+	    /* 0 means a frame was completely decoded */
+	    comp->at_end = (r == 0);
+	} while (left > 0 || dst_size == avail);
+	return TRUE;
+    }
+#endif
+
+    default:
+	(void)buf;
+	(void)len;
+	set_error(comp, g_strdup(_("unknown compression algorithm")));
+	return FALSE;
+    }
+}
+
+char *
+amcompress_update(
+    amcompress_t *comp,
+    const char *buf,
+    gsize len,
+    gsize *out_len)
+{
+    comp->out_len = 0;
+    comp->bytes_in += len;
+
+    if (comp->decompress) {
+	if (!decompress_update(comp, buf, len))
+	    return NULL;
+	comp->bytes_out += comp->out_len;
+	*out_len = comp->out_len;
+	return comp->out;
+    }
+
+    if (comp->pool) {
+	if (!parallel_update(comp, buf, len))
+	    return NULL;
+	comp->bytes_out += comp->out_len;
+	*out_len = comp->out_len;
+	return comp->out;
+    }
+
+    switch (comp->algo) {
+#ifdef HAVE_LIBZ
+    case AMCOMPRESS_GZIP:
+	comp->zstrm.next_in = (Bytef *)buf;
+	comp->zstrm.avail_in = len;
+	do {
+	    int r;
+
+	    comp->zstrm.next_out = (Bytef *)out_space(comp, AMCOMPRESS_OUT_SIZE);
+	    comp->zstrm.avail_out = comp->out_size - comp->out_len;
+	    r = deflate(&comp->zstrm, Z_NO_FLUSH);
+	    if (r != Z_OK && r != Z_BUF_ERROR) {
+		set_error(comp, g_strdup_printf(_("deflate failed: %s"),
+		    comp->zstrm.msg ? comp->zstrm.msg : "unknown error"));
+		return NULL;
+	    }
+	    comp->out_len = comp->out_size - comp->zstrm.avail_out;
+	} while (comp->zstrm.avail_in > 0 || comp->zstrm.avail_out == 0);
+	break;
+#endif
+
+#ifdef HAVE_LIBZSTD
+    case AMCOMPRESS_ZSTD: {
+	ZSTD_inBuffer in = { buf, len, 0 };
+
+	while (in.pos < in.size) {
+	    ZSTD_outBuffer out;
+	    size_t r;
+
+	    out.dst = out_space(comp, ZSTD_CStreamOutSize());
+	    out.size = comp->out_size - comp->out_len;
+	    out.pos = 0;
+	    r = ZSTD_compressStream2(comp->zstd, &out, &in, ZSTD_e_continue);
+	    if (ZSTD_isError(r)) {
+		set_error(comp, g_strdup_printf(_("zstd compression failed: %s"),
+						ZSTD_getErrorName(r)));
+		return NULL;
+	    }
+	    comp->out_len += out.pos;
+	}
+	break;
+    }
+#endif
+
+#ifdef HAVE_LIBLZ4
+    case AMCOMPRESS_LZ4: {
+	size_t r;
+
+	if (!comp->lz4_begun) {
+	    r = LZ4F_compressBegin(comp->lz4, out_space(comp, LZ4F_HEADER_SIZE_MAX),
+				   LZ4F_HEADER_SIZE_MAX, &comp->lz4_prefs);
+	    if (LZ4F_isError(r)) {
+		set_error(comp, g_strdup_printf(_("lz4 compression failed: %s"),
+						LZ4F_getErrorName(r)));
+		return NULL;
+	    }
+	    comp->out_len += r;
+	    comp->lz4_begun = TRUE;
+	}
+	if (len > 0) {
+	    size_t bound = LZ4F_compressBound(len, &comp->lz4_prefs);
+
+	    r = LZ4F_compressUpdate(comp->lz4, out_space(comp, bound), bound,
+				    buf, len, NULL);
+	    if (LZ4F_isError(r)) {
+		set_error(comp, g_strdup_printf(_("lz4 compression failed: %s"),
+						LZ4F_getErrorName(r)));
+		return NULL;
+	    }
+	    comp->out_len += r;
+	}
+	break;
+    }
+#endif
+
+    default:
+	(void)buf;
+	set_error(comp, g_strdup(_("unknown compression algorithm")));
+	return NULL;
+    }
+
+    comp->bytes_out += comp->out_len;
+    *out_len = comp->out_len;
+    return comp->out;
+}
+
+char *
+amcompress_finish(
+    amcompress_t *comp,
+    gsize *out_len)
+{
+    comp->out_len = 0;
+
+    if (comp->decompress) {
+	/* there is nothing left to flush, but the input must not have
+	 * stopped in the middle of a stream */
+	if (!comp->at_end) {
+	    set_error(comp, g_strdup_printf(_("truncated %s stream"),
+					    amcompress_algo_name(comp->algo)));
+	    return NULL;
+	}
+	*out_len = 0;
+	return comp->out;
+    }
+
+    if (comp->pool) {
+	if (!parallel_finish(comp))
+	    return NULL;
+	comp->bytes_out += comp->out_len;
+	*out_len = comp->out_len;
+	return comp->out;
+    }
+
+    switch (comp->algo) {
+#ifdef HAVE_LIBZ
+    case AMCOMPRESS_GZIP: {
+	int r;
+
+	comp->zstrm.next_in = NULL;
+	comp->zstrm.avail_in = 0;
+	do {
+	    comp->zstrm.next_out = (Bytef *)out_space(comp, AMCOMPRESS_OUT_SIZE);
+	    comp->zstrm.avail_out = comp->out_size - comp->out_len;
+	    r = deflate(&comp->zstrm, Z_FINISH);
+	    if (r != Z_OK && r != Z_STREAM_END && r != Z_BUF_ERROR) {
+		set_error(comp, g_strdup_printf(_("deflate failed: %s"),
+		    comp->zstrm.msg ? comp->zstrm.msg : "unknown error"));
+		return NULL;
+	    }
+	    comp->out_len = comp->out_size - comp->zstrm.avail_out;
+	} while (r != Z_STREAM_END);
+	break;
+    }
+#endif
+
+#ifdef HAVE_LIBZSTD
+    case AMCOMPRESS_ZSTD: {
+	ZSTD_inBuffer in = { NULL, 0, 0 };
+	size_t r;
+
+	do {
+	    ZSTD_outBuffer out;
+
+	    out.dst = out_space(comp, ZSTD_CStreamOutSize());
+	    out.size = comp->out_size - comp->out_len;
+	    out.pos = 0;
+	    r = ZSTD_compressStream2(comp->zstd, &out, &in, ZSTD_e_end);
+	    if (ZSTD_isError(r)) {
+		set_error(comp, g_strdup_printf(_("zstd compression failed: %s"),
+						ZSTD_getErrorName(r)));
+		return NULL;
+	    }
+	    comp->out_len += out.pos;
+	} while (r != 0);
+	break;
+    }
+#endif
+
+#ifdef HAVE_LIBLZ4
+    case AMCOMPRESS_LZ4: {
+	size_t bound;
+	size_t r;
+	char *out;
+
+	/* make sure the frame header is written for an empty stream */
+	if (!comp->lz4_begun) {
+	    if (!amcompress_update(comp, NULL, 0, &bound))
+		return NULL;
+	    comp->bytes_out -= comp->out_len;
+	}
+	bound = LZ4F_compressBound(0, &comp->lz4_prefs);
+	out = out_space(comp, bound);
+	r = LZ4F_compressEnd(comp->lz4, out, bound, NULL);
+	if (LZ4F_isError(r)) {
+	    set_error(comp, g_strdup_printf(_("lz4 compression failed: %s"),
+					    LZ4F_getErrorName(r)));
+	    return NULL;
+	}
+	comp->out_len += r;
+	break;
+    }
+#endif
+
+    default:
+	set_error(comp, g_strdup(_("unknown compression algorithm")));
+	return NULL;
+    }
+
+    comp->bytes_out += comp->out_len;
+    *out_len = comp->out_len;
+    return comp->out;
+}
+
+const char *
+amcompress_error(
+    amcompress_t *comp)
+{
+    return comp->errmsg;
+}
+
+guint64
+amcompress_bytes_in(
+    amcompress_t *comp)
+{
+    return comp->bytes_in;
+}
+
+guint64
+amcompress_bytes_out(
+    amcompress_t *comp)
+{
+    return comp->bytes_out;
+}
+
+const guint64 *
+amcompress_block_offsets(
+    amcompress_t *comp,
+    guint64 *nblocks)
+{
+    /* only complete once parallel_finish added the end of the last block */
+    if (!comp->block_offsets || comp->block_offsets->len != comp->nblocks + 1) {
+	*nblocks = 0;
+	return NULL;
+    }
+
+    *nblocks = comp->nblocks;
+    return (const guint64 *)comp->block_offsets->data;
+}
+
+void
+amcompress_free(
+    amcompress_t *comp)
+{
+    if (!comp)
+	return;
+
+    if (comp->mutex) {
+	/* parallel mode; wait for the workers to finish whatever they
+	 * started */
+	if (comp->pool)
+	    amexec_queue_free(comp->pool, FALSE);
+	g_queue_foreach(comp->jobs, (GFunc)free_job, NULL);
+	g_queue_free(comp->jobs);
+	g_slist_foreach(comp->idle, (GFunc)amcompress_free, NULL);
+	g_slist_free(comp->idle);
+	g_mutex_free(comp->mutex);
+	g_cond_free(comp->cond);
+	g_free(comp->block);
+	if (comp->block_offsets)
+	    g_array_free(comp->block_offsets, TRUE);
+	g_free(comp->out);
+	g_free(comp->errmsg);
+	g_free(comp);
+	return;
+    }
+
+    switch (comp->algo) {
+#ifdef HAVE_LIBZ
+    case AMCOMPRESS_GZIP:
+	if (comp->decompress)
+	    inflateEnd(&comp->zstrm);
+	else
+	    deflateEnd(&comp->zstrm);
+	break;
+#endif
+#ifdef HAVE_LIBZSTD
+    case AMCOMPRESS_ZSTD:
+	if (comp->zstd)
+	    ZSTD_freeCCtx(comp->zstd);
+	if (comp->zstd_d)
+	    ZSTD_freeDCtx(comp->zstd_d);
+	break;
+#endif
+#ifdef HAVE_LIBLZ4
+    case AMCOMPRESS_LZ4:
+	if (comp->lz4)
+	    LZ4F_freeCompressionContext(comp->lz4);
+	if (comp->lz4_d)
+	    LZ4F_freeDecompressionContext(comp->lz4_d);
+	break;
+#endif
+    default:
+	break;
+    }
+
+    g_free(comp->out);
+    g_free(comp->errmsg);
+    g_free(comp);
+}
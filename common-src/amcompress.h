@@ -0,0 +1,154 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+/*
+ * In-process streaming compression
+ */
+
+#ifndef AMCOMPRESS_H
+#define AMCOMPRESS_H
+
+#include <glib.h>
+#include "conffile.h"
+
+typedef enum {
+    AMCOMPRESS_GZIP,	/* zlib deflate with a gzip header; 'gzip -dc' compatible */
+    AMCOMPRESS_ZSTD,	/* zstd frame; 'zstd -dc' compatible */
+    AMCOMPRESS_LZ4,	/* lz4 frame; 'lz4 -dc' compatible */
+} amcompress_algo_t;
+
+/* Levels used for "fast" and "best" compression, matching the gzip
+ * --fast and --best flags for AMCOMPRESS_GZIP */
+#define AMCOMPRESS_LEVEL_DEFAULT (-1)
+#define AMCOMPRESS_LEVEL_FAST	 (-2)
+#define AMCOMPRESS_LEVEL_BEST	 (-3)
+
+/* nthreads value asking for one compression thread per online CPU */
+#define AMCOMPRESS_THREADS_AUTO (-1)
+
+/* worker threads set by the COMPRESS-THREADS dumptype or application
+ * property: a count, or "auto" for one per online CPU */
+#define AMCOMPRESS_THREADS_PROPERTY "COMPRESS-THREADS"
+
+/* bytes of input in each independently compressed block, when compressing
+ * with several threads */
+#define AMCOMPRESS_BLOCK_SIZE (1024*1024)
+
+typedef struct amcompress_s amcompress_t;
+
+/* Is the algorithm compiled in?
+ *
+ * @param algo: the algorithm
+ * @returns: TRUE if amcompress_new will accept it
+ */
+gboolean amcompress_supported(amcompress_algo_t algo);
+
+/* Parse an algorithm name ("gzip", "zstd" or "lz4").
+ *
+ * @param name: the name
+ * @param algo (output): the algorithm
+ * @returns: FALSE if the name is unknown
+ */
+gboolean amcompress_algo_from_name(const char *name, amcompress_algo_t *algo);
+const char *amcompress_algo_name(amcompress_algo_t algo);
+
+/* Return the number of worker threads given by the first value of the
+ * COMPRESS-THREADS property, AMCOMPRESS_THREADS_AUTO for "auto", or 0 if it
+ * is not set or invalid.
+ *
+ * @param proplist: dumptype or application properties, may be NULL
+ * @returns: thread count for amcompress_new, or 0
+ */
+int amcompress_threads_property(proplist_t proplist);
+
+/* Create a new compression stream.
+ *
+ * @param algo: the algorithm
+ * @param level: algorithm-specific level, or one of the AMCOMPRESS_LEVEL_*
+ * @param nthreads: worker threads; 0 or 1 to compress in the calling thread,
+ *	or AMCOMPRESS_THREADS_AUTO for one per online CPU.  With more than one
+ *	thread the input is compressed in independent blocks, each written as a
+ *	complete gzip member, zstd frame or lz4 frame; the result decompresses
+ *	with the usual tools but compresses slightly worse.
+ * @param errmsg (output): error message on failure, to be freed by the caller
+ * @returns: new stream, or NULL on error
+ */
+amcompress_t *amcompress_new(amcompress_algo_t algo, int level, int nthreads,
+			     char **errmsg);
+
+/* Create a new decompression stream, for data made by amcompress_new or the
+ * corresponding command-line tool.  amcompress_update and amcompress_finish
+ * then decompress, and amcompress_finish fails if the input stopped in the
+ * middle of a stream.
+ *
+ * @param algo: the algorithm
+ * @param errmsg (output): error message on failure, to be freed by the caller
+ * @returns: new stream, or NULL on error
+ */
+amcompress_t *amcompress_new_decompress(amcompress_algo_t algo, char **errmsg);
+
+/* Compress LEN bytes of data.  The returned buffer holds however much
+ * compressed output is available, possibly none; it belongs to the stream and
+ * is valid until the next call.
+ *
+ * @param comp: the stream
+ * @param buf: input data
+ * @param len: length of input data
+ * @param out_len (output): length of the returned data
+ * @returns: compressed data, or NULL on error
+ */
+char *amcompress_update(amcompress_t *comp, const char *buf, gsize len,
+			gsize *out_len);
+
+/* Flush and terminate the stream; the returned buffer is as for
+ * amcompress_update.
+ */
+char *amcompress_finish(amcompress_t *comp, gsize *out_len);
+
+/* Get the error message for the last failed call
+ */
+const char *amcompress_error(amcompress_t *comp);
+
+/* Total bytes in and out of the stream so far */
+guint64 amcompress_bytes_in(amcompress_t *comp);
+guint64 amcompress_bytes_out(amcompress_t *comp);
+
+/* Get the output offsets of the independent blocks of a stream compressed
+ * with several threads, once amcompress_finish succeeded.  Block N holds the
+ * input from N * AMCOMPRESS_BLOCK_SIZE and starts at offset N of the array;
+ * the last offset is the size of the output.  A block decompresses on its
+ * own, so a reader can start at any of them.
+ *
+ * @param comp: the stream
+ * @param nblocks (output): number of blocks
+ * @returns: NBLOCKS+1 offsets, valid until amcompress_free, or NULL if the
+ *	stream was not compressed in blocks
+ */
+const guint64 *amcompress_block_offsets(amcompress_t *comp, guint64 *nblocks);
+
+void amcompress_free(amcompress_t *comp);
+
+#endif /* AMCOMPRESS_H */
@@ -31,6 +31,31 @@
 
 #ifdef __SSE4_2__
 gboolean compiled_with_sse4_2 = TRUE;
+#else
+gboolean compiled_with_sse4_2 = FALSE;
+#endif
+gboolean have_vpclmul = FALSE;
+gboolean have_armv8_crc = FALSE;
+
+#if defined(__x86_64__) && defined(__SSE4_2__) && defined(HAVE_CRC32C_VPCLMUL)
+#define CRC32C_VPCLMUL 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__linux__) && defined(HAVE_CRC32C_ARMV8)
+#define CRC32C_ARMV8 1
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+/* the interleaved crc instruction kernels combine their lanes with these
+ * shift tables */
+#if defined(__SSE4_2__) || defined(CRC32C_ARMV8)
+#define CRC32C_SHIFT_TABLES 1
+#endif
+
+#ifdef CRC32C_SHIFT_TABLES
 #define POLY 0x82F63B78
 
 /* Multiply a matrix times a vector over the Galois field of two elements,
@@ -157,6 +182,9 @@ typedef struct {
   } b;
 } multi_b;
 
+#endif /* CRC32C_SHIFT_TABLES */
+
+#ifdef __SSE4_2__
 /* Compute CRC-32C using the Intel hardware instruction. */
 void crc32c_add_hw(uint8_t *buf, size_t len, crc_t *crc)
 {
@@ -342,20 +370,298 @@ void crc32c_add_hw(uint8_t *buf, size_t len, crc_t *crc)
 }
 
 #else
-gboolean compiled_with_sse4_2 = FALSE;
 
+void crc32c_add_hw(
+    uint8_t *buf G_GNUC_UNUSED,
+    size_t len G_GNUC_UNUSED,
+    crc_t *crc G_GNUC_UNUSED)
+{
+   g_error("crc32c_add_hw is not defined");
+}
+
+#endif /* __SSE4_2__ */
+
+#ifndef CRC32C_SHIFT_TABLES
 void
 crc32c_init_hw(void)
 {
    g_error("crc32c_init_hw is not defined");
 }
+#endif
 
-void crc32c_add_hw(
+#ifdef CRC32C_VPCLMUL
+#define CRC32C_VPCLMUL_TARGET \
+	__attribute__((target("avx512f,avx512vl,vpclmulqdq,pclmul,sse4.2")))
+
+/* x^n mod P, with P the CRC-32C polynomial in normal bit order */
+static uint64_t
+xpow_mod(
+    unsigned n)
+{
+    uint64_t r = 1;
+
+    while (n--) {
+	r <<= 1;
+	if (r & ((uint64_t)1 << 32))
+	    r ^= ((uint64_t)1 << 32) | 0x1EDC6F41;
+    }
+    return r;
+}
+
+/* a polynomial of degree < 32, as the bit-reflected 64-bit operand of a
+ * carry-less multiply */
+static uint64_t
+reflect64(
+    uint64_t p)
+{
+    uint64_t r = 0;
+    int m;
+
+    for (m = 0; m < 32; m++) {
+	if ((p >> m) & 1)
+	    r |= (uint64_t)1 << (63 - m);
+    }
+    return r;
+}
+
+/* Fold constants moving a 128-bit lane 'bits' further down the stream.  With
+ * reflected operands the carry-less product carries an extra factor of x,
+ * hence the -1 and +63. */
+typedef struct {
+    uint64_t lo;	/* multiplies the first quadword */
+    uint64_t hi;	/* multiplies the second quadword */
+} fold_k_t;
+
+static fold_k_t fold_2048, fold_512, fold_384, fold_256, fold_128;
+
+static void
+fold_constant(
+    fold_k_t *k,
+    unsigned bits)
+{
+    k->lo = reflect64(xpow_mod(bits + 63));
+    k->hi = reflect64(xpow_mod(bits - 1));
+}
+
+static void
+crc32c_init_vpclmul(void)
+{
+    fold_constant(&fold_2048, 2048);
+    fold_constant(&fold_512, 512);
+    fold_constant(&fold_384, 384);
+    fold_constant(&fold_256, 256);
+    fold_constant(&fold_128, 128);
+}
+
+CRC32C_VPCLMUL_TARGET
+static inline __m128i
+fold_k128(
+    fold_k_t *k)
+{
+    return _mm_set_epi64x((long long)k->hi, (long long)k->lo);
+}
+
+/* a = a * k ^ d, on each 128-bit lane */
+#define FOLD512(a, k, d) \
+    (a) = _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128((a), (k), 0x00), \
+				    _mm512_clmulepi64_epi128((a), (k), 0x11), \
+				    (d), 0x96)
+
+/* Compute CRC-32C by folding 256 bytes per iteration with AVX-512
+ * VPCLMULQDQ into four 512-bit accumulators, then hand the single remaining
+ * 128-bit lane and the tail to the crc instruction. */
+CRC32C_VPCLMUL_TARGET
+void
+crc32c_add_vpclmul(
+    uint8_t *buf,
+    size_t len,
+    crc_t *crc)
+{
+    __m512i a0, a1, a2, a3, k, t;
+    __m128i x;
+    uint64_t crc64;
+
+    if (len < 512) {
+	crc32c_add_hw(buf, len, crc);
+	return;
+    }
+    crc->size += len & ~(size_t)63;
+
+    a0 = _mm512_loadu_si512(buf);
+    a1 = _mm512_loadu_si512(buf + 64);
+    a2 = _mm512_loadu_si512(buf + 128);
+    a3 = _mm512_loadu_si512(buf + 192);
+    /* the running crc goes into the first four bytes */
+    a0 = _mm512_xor_si512(a0, _mm512_inserti32x4(_mm512_setzero_si512(),
+				_mm_cvtsi32_si128((int)crc->crc), 0));
+    buf += 256;
+    len -= 256;
+
+    k = _mm512_broadcast_i32x4(fold_k128(&fold_2048));
+    while (len >= 256) {
+	FOLD512(a0, k, _mm512_loadu_si512(buf));
+	FOLD512(a1, k, _mm512_loadu_si512(buf + 64));
+	FOLD512(a2, k, _mm512_loadu_si512(buf + 128));
+	FOLD512(a3, k, _mm512_loadu_si512(buf + 192));
+	buf += 256;
+	len -= 256;
+    }
+
+    k = _mm512_broadcast_i32x4(fold_k128(&fold_512));
+    FOLD512(a0, k, a1);
+    FOLD512(a0, k, a2);
+    FOLD512(a0, k, a3);
+    while (len >= 64) {
+	FOLD512(a0, k, _mm512_loadu_si512(buf));
+	buf += 64;
+	len -= 64;
+    }
+
+    /* fold the four lanes onto the last one */
+    k = _mm512_inserti32x4(_mm512_setzero_si512(), fold_k128(&fold_384), 0);
+    k = _mm512_inserti32x4(k, fold_k128(&fold_256), 1);
+    k = _mm512_inserti32x4(k, fold_k128(&fold_128), 2);
+    t = _mm512_xor_si512(_mm512_clmulepi64_epi128(a0, k, 0x00),
+			 _mm512_clmulepi64_epi128(a0, k, 0x11));
+    x = _mm_xor_si128(_mm_xor_si128(_mm512_extracti32x4_epi32(t, 0),
+				    _mm512_extracti32x4_epi32(t, 1)),
+		      _mm_xor_si128(_mm512_extracti32x4_epi32(t, 2),
+				    _mm512_extracti32x4_epi32(a0, 3)));
+
+    /* the crc of those 16 bytes, from zero, is the crc so far */
+    crc64 = _mm_crc32_u64(0, (uint64_t)_mm_cvtsi128_si64(x));
+    crc64 = _mm_crc32_u64(crc64, (uint64_t)_mm_extract_epi64(x, 1));
+    crc->crc = (uint32_t)crc64;
+
+    crc32c_add_hw(buf, len, crc);
+}
+
+#else
+
+void crc32c_add_vpclmul(
     uint8_t *buf G_GNUC_UNUSED,
     size_t len G_GNUC_UNUSED,
     crc_t *crc G_GNUC_UNUSED)
 {
-   g_error("crc32c_add_hw is not defined");
+   g_error("crc32c_add_vpclmul is not defined");
+}
+
+#endif /* CRC32C_VPCLMUL */
+
+#ifdef CRC32C_ARMV8
+#define CRC32C_ARMV8_TARGET __attribute__((target("+crc")))
+
+/* crc32c over as many blocks of four interleaved lanes as fit in *len */
+CRC32C_ARMV8_TARGET
+static inline uint32_t
+armv8_lanes(
+    uint32_t crc32_0,
+    const uint8_t **next,
+    size_t *len,
+    size_t block,
+    uint32_t zeros[][256])
+{
+    const uint64_t *next64_0, *next64_1, *next64_2, *next64_3, *end64;
+    uint32_t crc32_1, crc32_2, crc32_3;
+
+    while (*len >= block*4) {
+	next64_0 = (const uint64_t *)*next;
+	next64_1 = (const uint64_t *)(*next + block);
+	next64_2 = (const uint64_t *)(*next + block*2);
+	next64_3 = (const uint64_t *)(*next + block*3);
+	end64 = next64_1;
+	crc32_1 = crc32_2 = crc32_3 = 0;
+	do {
+	    crc32_0 = __crc32cd(crc32_0, *next64_0++);
+	    crc32_1 = __crc32cd(crc32_1, *next64_1++);
+	    crc32_2 = __crc32cd(crc32_2, *next64_2++);
+	    crc32_3 = __crc32cd(crc32_3, *next64_3++);
+	} while (next64_0 < end64);
+	crc32_0 = crc32c_shift(zeros, crc32_0) ^ crc32_1;
+	crc32_0 = crc32c_shift(zeros, crc32_0) ^ crc32_2;
+	crc32_0 = crc32c_shift(zeros, crc32_0) ^ crc32_3;
+	*next += block*4;
+	*len -= block*4;
+    }
+    return crc32_0;
+}
+
+/* Compute CRC-32C with the ARMv8 crc32c instructions, four interleaved
+ * lanes combined with the shift tables, as crc32c_add_hw does */
+CRC32C_ARMV8_TARGET
+void
+crc32c_add_armv8(
+    uint8_t *buf,
+    size_t len,
+    crc_t *crc)
+{
+    const uint8_t *next = buf;
+    uint32_t crc32_0;
+
+    crc->size += len;
+    crc32_0 = crc->crc;
+    while (len && ((uintptr_t)next & 7) != 0) {
+	crc32_0 = __crc32cb(crc32_0, *next++);
+	len--;
+    }
+
+    crc32_0 = armv8_lanes(crc32_0, &next, &len, LONG, crc32c_long);
+    crc32_0 = armv8_lanes(crc32_0, &next, &len, SHORT, crc32c_short);
+
+    while (len >= 8) {
+	crc32_0 = __crc32cd(crc32_0, *(const uint64_t *)next);
+	next += 8;
+	len -= 8;
+    }
+    while (len--) {
+	crc32_0 = __crc32cb(crc32_0, *next++);
+    }
+    crc->crc = crc32_0;
+}
+
+#else
+
+void crc32c_add_armv8(
+    uint8_t *buf G_GNUC_UNUSED,
+    size_t len G_GNUC_UNUSED,
+    crc_t *crc G_GNUC_UNUSED)
+{
+   g_error("crc32c_add_armv8 is not defined");
 }
 
+#endif /* CRC32C_ARMV8 */
+
+/* Pick the fastest kernel this cpu supports; have_sse42 must already be
+ * set.  Returns NULL if there is no hardware kernel. */
+crc32_function_t
+crc32c_select_hw(
+    const char **name)
+{
+#ifdef CRC32C_VPCLMUL
+    if (have_sse42 &&
+	__builtin_cpu_supports("avx512f") &&
+	__builtin_cpu_supports("avx512vl") &&
+	__builtin_cpu_supports("pclmul") &&
+	__builtin_cpu_supports("vpclmulqdq")) {
+	have_vpclmul = TRUE;
+	crc32c_init_hw();
+	crc32c_init_vpclmul();
+	*name = "avx512-vpclmulqdq";
+	return &crc32c_add_vpclmul;
+    }
+#endif
+#ifdef CRC32C_ARMV8
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+	have_armv8_crc = TRUE;
+	crc32c_init_hw();
+	*name = "armv8-crc32c";
+	return &crc32c_add_armv8;
+    }
 #endif
+    if (have_sse42) {
+	crc32c_init_hw();
+	*name = "sse4.2";
+	return &crc32c_add_hw;
+    }
+    return NULL;
+}
@@ -34,4 +34,14 @@ extern gboolean compiled_with_sse4_2;
 void crc32c_init_hw(void);
 void crc32c_add_hw(uint8_t *buf, size_t len, crc_t *crc);
 
+/* Kernels for newer cpus; have_vpclmul and have_armv8_crc are set by
+ * crc32c_select_hw when the cpu supports them. */
+extern gboolean have_vpclmul;
+extern gboolean have_armv8_crc;
+void crc32c_add_vpclmul(uint8_t *buf, size_t len, crc_t *crc);
+void crc32c_add_armv8(uint8_t *buf, size_t len, crc_t *crc);
+
+typedef void (*crc32_function_t)(uint8_t *buf, size_t len, crc_t *crc);
+crc32_function_t crc32c_select_hw(const char **name);
+
 #endif /* AMCRCC32HW_H */
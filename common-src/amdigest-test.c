@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+#include "amanda.h"
+#include "amdigest.h"
+#include "testutils.h"
+
+#define SHA256_EMPTY \
+    "sha256:e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"
+#define SHA256_ABC \
+    "sha256:ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"
+
+static int
+check_digest(
+    char *got,
+    const char *expected)
+{
+    if (!got || !g_str_equal(got, expected)) {
+	g_fprintf(stderr, "got '%s', expected '%s'\n",
+		  got ? got : "(null)", expected);
+	g_free(got);
+	return FALSE;
+    }
+    g_free(got);
+    return TRUE;
+}
+
+static int
+test_vectors(void)
+{
+    amdigest_t *digest;
+    int rv;
+
+    if (!amdigest_supported()) {
+	tu_dbg("SHA-256 is not compiled in\n");
+	return TRUE;
+    }
+
+    digest = amdigest_new();
+    rv = check_digest(amdigest_finish(digest), SHA256_EMPTY);
+
+    /* amdigest_finish starts the digest over */
+    amdigest_add(digest, "abc", 3);
+    rv = rv && check_digest(amdigest_finish(digest), SHA256_ABC);
+
+    amdigest_add(digest, "a", 1);
+    amdigest_add(digest, "bc", 2);
+    rv = rv && check_digest(amdigest_finish(digest), SHA256_ABC);
+
+    /* amdigest_value does not */
+    amdigest_add(digest, "ab", 2);
+    g_free(amdigest_value(digest));
+    amdigest_add(digest, "c", 1);
+    rv = rv && check_digest(amdigest_value(digest), SHA256_ABC);
+    rv = rv && check_digest(amdigest_finish(digest), SHA256_ABC);
+
+    amdigest_free(digest);
+    return rv;
+}
+
+static int
+test_copy(void)
+{
+    amdigest_t *digest, *saved;
+    int rv;
+
+    if (!amdigest_supported()) {
+	tu_dbg("SHA-256 is not compiled in\n");
+	return TRUE;
+    }
+
+    /* save the state after "a", add a part that is then abandoned, and
+     * restore the state, as the taper does when it retries a part */
+    digest = amdigest_new();
+    saved = amdigest_new();
+    amdigest_add(digest, "a", 1);
+    amdigest_copy(saved, digest);
+    amdigest_add(digest, "xyz", 3);
+    amdigest_copy(digest, saved);
+    amdigest_add(digest, "bc", 2);
+    rv = check_digest(amdigest_finish(digest), SHA256_ABC);
+
+    amdigest_reset(saved);
+    rv = rv && check_digest(amdigest_finish(saved), SHA256_EMPTY);
+
+    amdigest_free(digest);
+    amdigest_free(saved);
+    return rv;
+}
+
+/*
+ * Main driver
+ */
+
+int
+main(int argc, char **argv)
+{
+    static TestUtilsTest tests[] = {
+	TU_TEST(test_vectors, 90),
+	TU_TEST(test_copy, 90),
+	TU_END()
+    };
+
+    glib_init();
+
+    return testutils_run_tests(argc, argv, tests);
+}
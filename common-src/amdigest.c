@@ -0,0 +1,166 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+
+/*
+ * SHA-256 fixity digests
+ */
+
+#include "amanda.h"
+#include "amdigest.h"
+
+#ifdef HAVE_EVP_SHA256
+#include <openssl/evp.h>
+#endif
+
+struct amdigest_s {
+#ifdef HAVE_EVP_SHA256
+    EVP_MD_CTX *ctx;
+#else
+    int unused;
+#endif
+};
+
+gboolean
+amdigest_supported(void)
+{
+#ifdef HAVE_EVP_SHA256
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+amdigest_t *
+amdigest_new(void)
+{
+#ifdef HAVE_EVP_SHA256
+    amdigest_t *digest = g_new0(amdigest_t, 1);
+
+    /* libcrypto picks the SHA-NI or AVX2 implementation at run time */
+    digest->ctx = EVP_MD_CTX_create();
+    EVP_DigestInit_ex(digest->ctx, EVP_sha256(), NULL);
+    return digest;
+#else
+    return NULL;
+#endif
+}
+
+void
+amdigest_reset(
+    amdigest_t *digest G_GNUC_UNUSED)
+{
+#ifdef HAVE_EVP_SHA256
+    EVP_DigestInit_ex(digest->ctx, EVP_sha256(), NULL);
+#endif
+}
+
+void
+amdigest_copy(
+    amdigest_t *dst G_GNUC_UNUSED,
+    amdigest_t *src G_GNUC_UNUSED)
+{
+#ifdef HAVE_EVP_SHA256
+    EVP_MD_CTX_copy_ex(dst->ctx, src->ctx);
+#endif
+}
+
+void
+amdigest_add(
+    amdigest_t *digest G_GNUC_UNUSED,
+    gconstpointer buf G_GNUC_UNUSED,
+    gsize len G_GNUC_UNUSED)
+{
+#ifdef HAVE_EVP_SHA256
+    EVP_DigestUpdate(digest->ctx, buf, len);
+#endif
+}
+
+#ifdef HAVE_EVP_SHA256
+static char *
+digest_final(
+    EVP_MD_CTX *ctx)
+{
+    static const char hex[] = "0123456789abcdef";
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int md_len = 0;
+    unsigned int i;
+    GString *str;
+
+    EVP_DigestFinal_ex(ctx, md, &md_len);
+
+    str = g_string_sized_new(sizeof(AMDIGEST_ALGORITHM) + md_len * 2);
+    g_string_append(str, AMDIGEST_ALGORITHM ":");
+    for (i = 0; i < md_len; i++) {
+	g_string_append_c(str, hex[md[i] >> 4]);
+	g_string_append_c(str, hex[md[i] & 0xf]);
+    }
+    return g_string_free(str, FALSE);
+}
+#endif
+
+char *
+amdigest_value(
+    amdigest_t *digest G_GNUC_UNUSED)
+{
+#ifdef HAVE_EVP_SHA256
+    EVP_MD_CTX *ctx = EVP_MD_CTX_create();
+    char *value;
+
+    EVP_MD_CTX_copy_ex(ctx, digest->ctx);
+    value = digest_final(ctx);
+    EVP_MD_CTX_destroy(ctx);
+    return value;
+#else
+    return NULL;
+#endif
+}
+
+char *
+amdigest_finish(
+    amdigest_t *digest G_GNUC_UNUSED)
+{
+#ifdef HAVE_EVP_SHA256
+    char *value = digest_final(digest->ctx);
+
+    EVP_DigestInit_ex(digest->ctx, EVP_sha256(), NULL);
+    return value;
+#else
+    return NULL;
+#endif
+}
+
+void
+amdigest_free(
+    amdigest_t *digest)
+{
+    if (!digest)
+	return;
+#ifdef HAVE_EVP_SHA256
+    EVP_MD_CTX_destroy(digest->ctx);
+#endif
+    g_free(digest);
+}
@@ -0,0 +1,87 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+
+/*
+ * SHA-256 fixity digests
+ *
+ * An incremental SHA-256, used by the taper to compute the digest of each
+ * part and of each whole image as it writes them.  Digests are exchanged as
+ * strings "sha256:<64 hex digits>", so that the name of the algorithm is
+ * recorded with the value.
+ */
+
+#ifndef AMDIGEST_H
+#define AMDIGEST_H
+
+#include <glib.h>
+
+#define AMDIGEST_ALGORITHM	"sha256"
+
+typedef struct amdigest_s amdigest_t;
+
+/* Is SHA-256 compiled in?
+ */
+gboolean amdigest_supported(void);
+
+/* Create a digest, ready for amdigest_add.
+ *
+ * @returns: the digest, or NULL if SHA-256 is not compiled in
+ */
+amdigest_t *amdigest_new(void);
+
+/* Start the digest over, discarding the data added so far.
+ */
+void amdigest_reset(amdigest_t *digest);
+
+/* Copy the state of SRC to DST, so that DST can later be restored to it.
+ */
+void amdigest_copy(amdigest_t *dst, amdigest_t *src);
+
+/* Add LEN bytes at BUF to the digest.
+ */
+void amdigest_add(amdigest_t *digest, gconstpointer buf, gsize len);
+
+/* Return the digest of the data added so far, leaving the digest ready to
+ * add more.
+ *
+ * @returns: "sha256:" followed by the digest in hexadecimal, to be freed
+ *	by the caller
+ */
+char *amdigest_value(amdigest_t *digest);
+
+/* Finish the digest and start it over.
+ *
+ * @returns: "sha256:" followed by the digest in hexadecimal, to be freed
+ *	by the caller
+ */
+char *amdigest_finish(amdigest_t *digest);
+
+/* Free the digest.
+ */
+void amdigest_free(amdigest_t *digest);
+
+#endif /* AMDIGEST_H */
@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+#include "amanda.h"
+#include "amexec.h"
+#include "testutils.h"
+
+/* what the jobs of a test saw */
+typedef struct {
+    GMutex *mutex;
+    GCond *cond;
+    int running;
+    int max_running;
+    int done;
+    gboolean gate_open;
+    GString *order;
+} state_t;
+
+static state_t *
+state_new(void)
+{
+    state_t *st = g_new0(state_t, 1);
+
+    st->mutex = g_mutex_new();
+    st->cond = g_cond_new();
+    st->order = g_string_new("");
+    return st;
+}
+
+static void
+state_free(
+    state_t *st)
+{
+    g_mutex_free(st->mutex);
+    g_cond_free(st->cond);
+    g_string_free(st->order, TRUE);
+    g_free(st);
+}
+
+/* count the jobs running at the same time */
+static void
+counting_job(
+    gpointer data G_GNUC_UNUSED,
+    gpointer user_data)
+{
+    state_t *st = user_data;
+
+    g_mutex_lock(st->mutex);
+    st->running++;
+    st->max_running = MAX(st->max_running, st->running);
+    g_mutex_unlock(st->mutex);
+
+    g_usleep(10000);
+
+    g_mutex_lock(st->mutex);
+    st->running--;
+    st->done++;
+    g_mutex_unlock(st->mutex);
+}
+
+/* hold a CPU slot until the gate is opened */
+static void
+gate_job(
+    gpointer data G_GNUC_UNUSED,
+    gpointer user_data)
+{
+    state_t *st = user_data;
+
+    g_mutex_lock(st->mutex);
+    st->running++;
+    g_cond_broadcast(st->cond);
+    while (!st->gate_open)
+	g_cond_wait(st->cond, st->mutex);
+    st->running--;
+    st->done++;
+    g_mutex_unlock(st->mutex);
+}
+
+static void
+open_gate_job(
+    gpointer data G_GNUC_UNUSED,
+    gpointer user_data)
+{
+    state_t *st = user_data;
+
+    g_mutex_lock(st->mutex);
+    st->gate_open = TRUE;
+    g_cond_broadcast(st->cond);
+    g_mutex_unlock(st->mutex);
+}
+
+/* append the job's letter to the order */
+static void
+order_job(
+    gpointer data,
+    gpointer user_data)
+{
+    state_t *st = user_data;
+
+    g_mutex_lock(st->mutex);
+    g_string_append_c(st->order, GPOINTER_TO_INT(data));
+    st->done++;
+    g_mutex_unlock(st->mutex);
+}
+
+static void
+wait_running(
+    state_t *st,
+    int running)
+{
+    g_mutex_lock(st->mutex);
+    while (st->running < running)
+	g_cond_wait(st->cond, st->mutex);
+    g_mutex_unlock(st->mutex);
+}
+
+static int
+test_max_running(void)
+{
+    state_t *st = state_new();
+    amexec_queue_t *queue;
+    int i, rv = TRUE;
+
+    queue = amexec_queue_new("test", counting_job, st, 3,
+			     AMEXEC_PRIORITY_NORMAL, AMEXEC_BLOCKING);
+    for (i = 0; i < 30; i++)
+	amexec_queue_push(queue, NULL);
+    amexec_queue_free(queue, FALSE);
+
+    if (st->done != 30) {
+	tu_dbg("%d jobs done, expected 30\n", st->done);
+	rv = FALSE;
+    }
+    if (st->max_running > 3) {
+	tu_dbg("%d jobs ran at the same time, expected at most 3\n",
+	       st->max_running);
+	rv = FALSE;
+    }
+
+    state_free(st);
+    return rv;
+}
+
+static int
+test_cpu_slots(void)
+{
+    state_t *st = state_new();
+    amexec_queue_t *q1, *q2;
+    int i, rv = TRUE;
+
+    amexec_set_cpu_slots(2);
+    q1 = amexec_queue_new("cpu1", counting_job, st, 4,
+			  AMEXEC_PRIORITY_NORMAL, 0);
+    q2 = amexec_queue_new("cpu2", counting_job, st, 4,
+			  AMEXEC_PRIORITY_HIGH, 0);
+    for (i = 0; i < 20; i++) {
+	amexec_queue_push(q1, NULL);
+	amexec_queue_push(q2, NULL);
+    }
+    amexec_queue_free(q1, FALSE);
+    amexec_queue_free(q2, FALSE);
+
+    if (st->done != 40) {
+	tu_dbg("%d jobs done, expected 40\n", st->done);
+	rv = FALSE;
+    }
+    if (st->max_running > 2) {
+	tu_dbg("%d jobs used a CPU at the same time, expected at most 2\n",
+	       st->max_running);
+	rv = FALSE;
+    }
+
+    state_free(st);
+    return rv;
+}
+
+static int
+test_blocking(void)
+{
+    state_t *st = state_new();
+    amexec_queue_t *cpu, *blocking;
+
+    /* the CPU job holds the only slot until a blocking job lets it go; the
+     * blocking job must not need the slot */
+    amexec_set_cpu_slots(1);
+    cpu = amexec_queue_new("cpu", gate_job, st, 1, AMEXEC_PRIORITY_NORMAL, 0);
+    blocking = amexec_queue_new("blocking", open_gate_job, st, 1,
+				AMEXEC_PRIORITY_LOW, AMEXEC_BLOCKING);
+    amexec_queue_push(cpu, NULL);
+    wait_running(st, 1);
+    amexec_queue_push(blocking, NULL);
+    amexec_queue_free(blocking, FALSE);
+    amexec_queue_free(cpu, FALSE);
+
+    state_free(st);
+    return TRUE;
+}
+
+static int
+test_priority(void)
+{
+    state_t *st = state_new();
+    amexec_queue_t *gate, *low, *high;
+    int rv = TRUE;
+
+    /* once the slot is free, the high-priority jobs go first, whatever the
+     * order they were queued in */
+    amexec_set_cpu_slots(1);
+    gate = amexec_queue_new("gate", gate_job, st, 1, AMEXEC_PRIORITY_NORMAL, 0);
+    low = amexec_queue_new("low", order_job, st, 1, AMEXEC_PRIORITY_LOW, 0);
+    high = amexec_queue_new("high", order_job, st, 1, AMEXEC_PRIORITY_HIGH, 0);
+    amexec_queue_push(gate, NULL);
+    wait_running(st, 1);
+    amexec_queue_push(low, GINT_TO_POINTER('l'));
+    amexec_queue_push(low, GINT_TO_POINTER('l'));
+    amexec_queue_push(high, GINT_TO_POINTER('h'));
+    amexec_queue_push(high, GINT_TO_POINTER('h'));
+
+    g_mutex_lock(st->mutex);
+    st->gate_open = TRUE;
+    g_cond_broadcast(st->cond);
+    g_mutex_unlock(st->mutex);
+
+    amexec_queue_free(gate, FALSE);
+    amexec_queue_free(low, FALSE);
+    amexec_queue_free(high, FALSE);
+
+    if (!g_str_equal(st->order->str, "hhll")) {
+	tu_dbg("jobs ran in the order '%s', expected 'hhll'\n", st->order->str);
+	rv = FALSE;
+    }
+
+    state_free(st);
+    return rv;
+}
+
+static int
+test_immediate(void)
+{
+    state_t *st = state_new();
+    amexec_queue_t *queue;
+    int i, rv = TRUE;
+
+    /* the jobs behind the running one are dropped */
+    queue = amexec_queue_new("test", counting_job, st, 1,
+			     AMEXEC_PRIORITY_NORMAL, AMEXEC_BLOCKING);
+    for (i = 0; i < 10; i++)
+	amexec_queue_push(queue, NULL);
+    amexec_queue_free(queue, TRUE);
+
+    if (st->done >= 10) {
+	tu_dbg("%d jobs done, expected fewer than 10\n", st->done);
+	rv = FALSE;
+    }
+
+    state_free(st);
+    return rv;
+}
+
+/*
+ * Main driver
+ */
+
+int
+main(int argc, char **argv)
+{
+    static TestUtilsTest tests[] = {
+	TU_TEST(test_max_running, 90),
+	TU_TEST(test_cpu_slots, 90),
+	TU_TEST(test_blocking, 90),
+	TU_TEST(test_priority, 90),
+	TU_TEST(test_immediate, 90),
+	TU_END()
+    };
+
+    glib_init();
+
+    return testutils_run_tests(argc, argv, tests);
+}
@@ -0,0 +1,365 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+
+/*
+ * A process-wide executor; see amexec.h
+ */
+
+#include "amanda.h"
+#include "amexec.h"
+
+/* an idle thread exits after this many seconds without a job */
+#define AMEXEC_IDLE_TIMEOUT 60
+
+struct amexec_queue_s {
+    char *name;
+    GFunc func;
+    gpointer user_data;
+    guint max_running;
+    amexec_priority_t priority;
+    gboolean blocking;
+
+    /* the rest is protected by the executor mutex */
+    GQueue *jobs;		/* of job data */
+    guint running;
+    gboolean ready;		/* in exec.ready[priority] */
+    gboolean freeing;
+};
+
+static GStaticMutex init_mutex = G_STATIC_MUTEX_INIT;
+static struct {
+    gboolean initialized;
+    GMutex *mutex;
+    GCond *work_cond;	/* the idle threads wait on it */
+    GCond *done_cond;	/* amexec_queue_free waits on it */
+
+    /* the queues with jobs to start and fewer than max_running running,
+     * by priority */
+    GQueue *ready[AMEXEC_NPRIORITIES];
+
+    guint nthreads;
+    guint nidle;		/* waiting for a job, and not woken */
+    guint nwoken;		/* woken for a new job, and not awake yet */
+    guint cpu_slots;
+    guint cpu_running;	/* the jobs holding a CPU slot */
+    guint blocking_running;
+} exec;
+
+static gpointer exec_thread(gpointer data);
+
+static void
+exec_lock(void)
+{
+    int i;
+
+    g_static_mutex_lock(&init_mutex);
+    if (exec.initialized) {
+	g_static_mutex_unlock(&init_mutex);
+	g_mutex_lock(exec.mutex);
+	return;
+    }
+
+    exec.mutex = g_mutex_new();
+    exec.work_cond = g_cond_new();
+    exec.done_cond = g_cond_new();
+    for (i = 0; i < AMEXEC_NPRIORITIES; i++)
+	exec.ready[i] = g_queue_new();
+    if (!exec.cpu_slots) {
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	exec.cpu_slots = ncpu > 0 ? (guint)ncpu : 1;
+    }
+    exec.initialized = TRUE;
+    g_static_mutex_unlock(&init_mutex);
+    g_mutex_lock(exec.mutex);
+}
+
+/* Put QUEUE in, or take it out of, the ready lists.  Called with the mutex
+ * held. */
+static void
+queue_update_ready(
+    amexec_queue_t *queue)
+{
+    gboolean ready = !g_queue_is_empty(queue->jobs) &&
+		     queue->running < queue->max_running;
+
+    if (ready && !queue->ready) {
+	g_queue_push_tail(exec.ready[queue->priority], queue);
+    } else if (!ready && queue->ready) {
+	g_queue_remove(exec.ready[queue->priority], queue);
+    }
+    queue->ready = ready;
+}
+
+/* Can a job of QUEUE start now?  Called with the mutex held. */
+static gboolean
+queue_can_start(
+    amexec_queue_t *queue)
+{
+    return queue->blocking || exec.cpu_running < exec.cpu_slots;
+}
+
+/* Find the queue of the next job: the one of the highest priority that can
+ * start, PREFER if it is one of them, or else the one that waited the
+ * longest.  PREFER is only compared, as it may have been freed.  Called with
+ * the mutex held. */
+static amexec_queue_t *
+exec_pick(
+    amexec_queue_t *prefer)
+{
+    int i;
+
+    for (i = 0; i < AMEXEC_NPRIORITIES; i++) {
+	amexec_queue_t *found = NULL;
+	GList *iter;
+
+	for (iter = exec.ready[i]->head; iter; iter = iter->next) {
+	    amexec_queue_t *queue = iter->data;
+
+	    if (!queue_can_start(queue))
+		continue;
+	    if (queue == prefer)
+		return queue;
+	    if (!found)
+		found = queue;
+	}
+	if (found) {
+	    /* round-robin among the queues of a priority */
+	    g_queue_remove(exec.ready[i], found);
+	    g_queue_push_tail(exec.ready[i], found);
+	    return found;
+	}
+    }
+
+    return NULL;
+}
+
+/* Run one job of QUEUE; called with the mutex held, which is released while
+ * the job runs. */
+static void
+exec_run_job(
+    amexec_queue_t *queue)
+{
+    gpointer data = g_queue_pop_head(queue->jobs);
+
+    queue->running++;
+    if (queue->blocking)
+	exec.blocking_running++;
+    else
+	exec.cpu_running++;
+    queue_update_ready(queue);
+
+    g_mutex_unlock(exec.mutex);
+    queue->func(data, queue->user_data);
+    g_mutex_lock(exec.mutex);
+
+    queue->running--;
+    if (queue->blocking)
+	exec.blocking_running--;
+    else
+	exec.cpu_running--;
+    queue_update_ready(queue);
+
+    if (queue->freeing && queue->running == 0)
+	g_cond_broadcast(exec.done_cond);
+}
+
+/* Get a thread for a job of QUEUE: wake an idle one, or start one if the job
+ * would not have to wait for a CPU slot anyway.  Called with the mutex
+ * held. */
+static void
+exec_wake(
+    amexec_queue_t *queue)
+{
+    GError *error = NULL;
+
+    if (exec.nidle > 0) {
+	exec.nidle--;
+	exec.nwoken++;
+	g_cond_signal(exec.work_cond);
+	return;
+    }
+
+    /* the threads that are not blocked are enough for the CPU slots */
+    if (!queue->blocking &&
+	exec.nthreads - exec.blocking_running >= exec.cpu_slots)
+	return;
+
+    if (!g_thread_create(exec_thread, NULL, FALSE, &error)) {
+	g_warning("amexec: could not start a thread for '%s': %s",
+		  queue->name, error->message);
+	g_error_free(error);
+
+	/* no thread will ever do it; the caller does */
+	if (exec.nthreads == 0)
+	    exec_run_job(queue);
+	return;
+    }
+    exec.nthreads++;
+}
+
+static gpointer
+exec_thread(
+    gpointer data G_GNUC_UNUSED)
+{
+    amexec_queue_t *last = NULL;
+
+    g_mutex_lock(exec.mutex);
+    while (1) {
+	amexec_queue_t *queue = exec_pick(last);
+
+	if (!queue) {
+	    GTimeVal timeout;
+	    gboolean woken;
+
+	    g_get_current_time(&timeout);
+	    g_time_val_add(&timeout, AMEXEC_IDLE_TIMEOUT * G_USEC_PER_SEC);
+
+	    exec.nidle++;
+	    woken = g_cond_timed_wait(exec.work_cond,
+			exec.mutex, &timeout);
+
+	    /* a woken thread was already counted out of nidle */
+	    if (exec.nwoken > 0) {
+		exec.nwoken--;
+	    } else {
+		exec.nidle--;
+		if (!woken)
+		    break;
+	    }
+	    last = NULL;
+	    continue;
+	}
+
+	exec_run_job(queue);
+	last = queue;
+    }
+    exec.nthreads--;
+    g_mutex_unlock(exec.mutex);
+
+    return NULL;
+}
+
+amexec_queue_t *
+amexec_queue_new(
+    const char *name,
+    GFunc func,
+    gpointer user_data,
+    guint max_running,
+    amexec_priority_t priority,
+    int flags)
+{
+    amexec_queue_t *queue = g_new0(amexec_queue_t, 1);
+
+    g_assert(priority < AMEXEC_NPRIORITIES);
+
+    queue->name = g_strdup(name);
+    queue->func = func;
+    queue->user_data = user_data;
+    queue->max_running = MAX(max_running, 1);
+    queue->priority = priority;
+    queue->blocking = !!(flags & AMEXEC_BLOCKING);
+    queue->jobs = g_queue_new();
+
+    /* make sure the executor exists before the first push */
+    exec_lock();
+    g_mutex_unlock(exec.mutex);
+
+    return queue;
+}
+
+void
+amexec_queue_push(
+    amexec_queue_t *queue,
+    gpointer data)
+{
+    exec_lock();
+    g_assert(!queue->freeing);
+    g_queue_push_tail(queue->jobs, data);
+    queue_update_ready(queue);
+    if (queue->ready)
+	exec_wake(queue);
+    g_mutex_unlock(exec.mutex);
+}
+
+guint
+amexec_queue_unprocessed(
+    amexec_queue_t *queue)
+{
+    guint n;
+
+    exec_lock();
+    n = g_queue_get_length(queue->jobs);
+    g_mutex_unlock(exec.mutex);
+
+    return n;
+}
+
+void
+amexec_queue_free(
+    amexec_queue_t *queue,
+    gboolean immediate)
+{
+    if (!queue)
+	return;
+
+    exec_lock();
+    queue->freeing = TRUE;
+    if (immediate) {
+	while (!g_queue_is_empty(queue->jobs))
+	    g_queue_pop_head(queue->jobs);
+	queue_update_ready(queue);
+    }
+    while (queue->running > 0 || !g_queue_is_empty(queue->jobs))
+	g_cond_wait(exec.done_cond, exec.mutex);
+    g_assert(!queue->ready);
+    g_mutex_unlock(exec.mutex);
+
+    g_queue_free(queue->jobs);
+    g_free(queue->name);
+    g_free(queue);
+}
+
+void
+amexec_set_cpu_slots(
+    guint cpu_slots)
+{
+    exec_lock();
+    exec.cpu_slots = MAX(cpu_slots, 1);
+    g_mutex_unlock(exec.mutex);
+}
+
+guint
+amexec_get_nthreads(void)
+{
+    guint n;
+
+    exec_lock();
+    n = exec.nthreads;
+    g_mutex_unlock(exec.mutex);
+
+    return n;
+}
@@ -0,0 +1,108 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+
+/*
+ * A process-wide executor
+ *
+ * The subsystems that used to have their own thread pools (the S3 and RAIT
+ * devices, the parallel compression and encryption, linesort) queue their
+ * jobs to the queues of one executor instead.  Its threads are shared by all
+ * of the queues and reused from one job to the next.
+ *
+ * The jobs of a queue that computes hold one of the CPU slots, one per
+ * online CPU, while they run; those waiting for a slot run by priority.  The
+ * jobs of an AMEXEC_BLOCKING queue, that mostly wait for a device or the
+ * network, do not hold a slot: another thread is used in their place, so
+ * that they never keep the CPU-bound jobs from running.  Each queue runs up
+ * to max_running of its jobs at a time, in the order they were queued if it
+ * is 1.  A thread that finished a job of a queue takes the next job of the
+ * same queue when it can, for the locality of its data.
+ */
+
+#ifndef AMEXEC_H
+#define AMEXEC_H
+
+#include <glib.h>
+
+typedef enum {
+    AMEXEC_PRIORITY_HIGH,	/* the data path of a transfer */
+    AMEXEC_PRIORITY_NORMAL,
+    AMEXEC_PRIORITY_LOW,	/* background work, like deletions */
+    AMEXEC_NPRIORITIES
+} amexec_priority_t;
+
+/* The jobs of the queue mostly wait rather than compute */
+#define AMEXEC_BLOCKING	(1 << 0)
+
+typedef struct amexec_queue_s amexec_queue_t;
+
+/* Create a queue; FUNC(data, USER_DATA) is called for each job.
+ *
+ * @param name: for debugging
+ * @param func: the job function
+ * @param user_data: its second argument
+ * @param max_running: the number of jobs of this queue that may run at the
+ *        same time, at least 1
+ * @param priority: the priority of its jobs
+ * @param flags: AMEXEC_BLOCKING or 0
+ * @returns: the new queue
+ */
+amexec_queue_t *amexec_queue_new(const char *name, GFunc func,
+				 gpointer user_data, guint max_running,
+				 amexec_priority_t priority, int flags);
+
+/* Queue a job.  It may be called from any thread, including from a job.
+ *
+ * @param queue: the queue
+ * @param data: the first argument of its function
+ */
+void amexec_queue_push(amexec_queue_t *queue, gpointer data);
+
+/* The number of jobs of QUEUE that did not start yet
+ */
+guint amexec_queue_unprocessed(amexec_queue_t *queue);
+
+/* Free a queue, after its jobs are done.  It must not be called from one of
+ * its jobs, and no job may be queued to it meanwhile.
+ *
+ * @param queue: the queue
+ * @param immediate: if TRUE, the jobs that did not start are dropped;
+ *        otherwise they are run first.  The running jobs are always waited
+ *        for.
+ */
+void amexec_queue_free(amexec_queue_t *queue, gboolean immediate);
+
+/* Set the number of CPU slots, instead of the number of online CPUs; for
+ * the tests.
+ */
+void amexec_set_cpu_slots(guint cpu_slots);
+
+/* The number of threads of the executor, running or idle
+ */
+guint amexec_get_nthreads(void);
+
+#endif /* AMEXEC_H */
@@ -34,6 +34,7 @@
 
 #include "amanda.h"
 #include "amfeatures.h"
+#include "stream.h"
 
 /*
  *=====================================================================
@@ -220,6 +221,10 @@ am_init_feature_set(void)
 	am_add_feature(f, fe_sendbackup_stream_cmd);
 	am_add_feature(f, fe_sendbackup_stream_cmd_get_dumper_result);
 	am_add_feature(f, fe_sendbackup_statedone);
+	am_add_feature(f, fe_sendbackup_req_options_wire_compress);
+	am_add_feature(f, fe_sendbackup_req_options_resume);
+	am_add_feature(f, fe_sendsize_change_token);
+	am_add_feature(f, fe_net_large_blocks);
     }
     return f;
 }
@@ -416,6 +421,27 @@ am_has_feature(
     return result;
 }
 
+/*
+ *=====================================================================
+ * Return the block size of the data streams to and from a peer.
+ *
+ * size_t am_network_block_size(am_feature_t *their_features)
+ *
+ * entry:	their_features = features of the peer, or NULL
+ * exit:	NETWORK_BLOCK_BYTES_MAX if both ends have fe_net_large_blocks,
+ *		NETWORK_BLOCK_BYTES otherwise
+ *=====================================================================
+ */
+
+size_t
+am_network_block_size(
+    am_feature_t	*their_features)
+{
+    if (am_has_feature(their_features, fe_net_large_blocks))
+	return NETWORK_BLOCK_BYTES_MAX;
+    return NETWORK_BLOCK_BYTES;
+}
+
 /*
  *=====================================================================
  * Convert a feature set to string.
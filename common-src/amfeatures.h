@@ -251,6 +251,10 @@ typedef enum {
     fe_sendbackup_stream_cmd,
     fe_sendbackup_stream_cmd_get_dumper_result,
     fe_sendbackup_statedone,
+    fe_sendbackup_req_options_wire_compress,
+    fe_sendbackup_req_options_resume,
+    fe_sendsize_change_token,
+    fe_net_large_blocks,
     /*
      * All new features must be inserted immediately *before* this entry.
      */
@@ -280,6 +284,11 @@ extern int am_has_feature(am_feature_t *f, am_feature_e n);
 extern char *am_feature_to_string(am_feature_t *f);
 extern am_feature_t *am_string_to_feature(char *s);
 
+/* The block size of the data streams to and from a peer with THEIR_FEATURES:
+ * NETWORK_BLOCK_BYTES_MAX if it has fe_net_large_blocks, otherwise
+ * NETWORK_BLOCK_BYTES. */
+extern size_t am_network_block_size(am_feature_t *their_features);
+
 #endif
 
 #endif	/* !AMFEATURES_H */
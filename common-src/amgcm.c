@@ -0,0 +1,440 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+/*
+ * AES-256-GCM record encryption
+ */
+
+#include "amanda.h"
+#include "amgcm.h"
+
+#ifdef HAVE_EVP_AES_GCM
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/hmac.h>
+#endif
+
+#define AMGCM_MAGIC	"AMGCM002"
+#define AMGCM_IV_SIZE	12
+#define AMGCM_HKDF_INFO	"amanda-aes-gcm stream key"
+#define FINAL_FLAG	0x80000000U
+
+static void
+put_be32(
+    guint8 *p,
+    guint32 v)
+{
+    p[0] = (guint8)(v >> 24);
+    p[1] = (guint8)(v >> 16);
+    p[2] = (guint8)(v >> 8);
+    p[3] = (guint8)v;
+}
+
+static guint32
+get_be32(
+    const guint8 *p)
+{
+    return ((guint32)p[0] << 24) | ((guint32)p[1] << 16)
+	 | ((guint32)p[2] << 8) | (guint32)p[3];
+}
+
+gboolean
+amgcm_supported(void)
+{
+#ifdef HAVE_EVP_AES_GCM
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+gboolean
+amgcm_load_key(
+    const char *filename,
+    guint8 *key,
+    char **errmsg)
+{
+    gchar *contents = NULL;
+    gsize len;
+    GError *error = NULL;
+    gboolean rval = FALSE;
+
+    if (!g_file_get_contents(filename, &contents, &len, &error)) {
+	*errmsg = g_strdup_printf(_("Can't read key file '%s': %s"),
+				  filename, error->message);
+	g_error_free(error);
+	return FALSE;
+    }
+
+    if (len == AMGCM_KEY_SIZE) {
+	memcpy(key, contents, AMGCM_KEY_SIZE);
+	rval = TRUE;
+    } else {
+	/* hex digits, ignoring whitespace */
+	gsize i, n = 0;
+
+	for (i = 0; i < len; i++) {
+	    int v = g_ascii_xdigit_value(contents[i]);
+	    if (g_ascii_isspace(contents[i]))
+		continue;
+	    if (v < 0 || n >= AMGCM_KEY_SIZE * 2)
+		break;
+	    if (n % 2 == 0)
+		key[n/2] = (guint8)(v << 4);
+	    else
+		key[n/2] |= (guint8)v;
+	    n++;
+	}
+	if (i == len && n == AMGCM_KEY_SIZE * 2)
+	    rval = TRUE;
+	else
+	    *errmsg = g_strdup_printf(
+		_("Key file '%s' must hold %d bytes or %d hex digits"),
+		filename, AMGCM_KEY_SIZE, AMGCM_KEY_SIZE * 2);
+    }
+
+    memset(contents, 0, len);
+    g_free(contents);
+    return rval;
+}
+
+gboolean
+amgcm_make_header(
+    guint8 *hdr,
+    guint32 record_size,
+    char **errmsg)
+{
+#ifdef HAVE_EVP_AES_GCM
+    if (record_size == 0 || record_size > AMGCM_MAX_RECORD_SIZE) {
+	*errmsg = g_strdup_printf(_("invalid AES-GCM record size %u"),
+				  record_size);
+	return FALSE;
+    }
+
+    memcpy(hdr, AMGCM_MAGIC, AMGCM_MAGIC_SIZE);
+    put_be32(hdr + AMGCM_MAGIC_SIZE, record_size);
+    if (RAND_bytes(hdr + AMGCM_MAGIC_SIZE + 4, AMGCM_SALT_SIZE) != 1) {
+	*errmsg = g_strdup(_("Can't generate a random AES-GCM salt"));
+	return FALSE;
+    }
+    return TRUE;
+#else
+    (void)hdr;
+    (void)record_size;
+    *errmsg = g_strdup(_("AES-GCM encryption is not supported"));
+    return FALSE;
+#endif
+}
+
+gboolean
+amgcm_parse_header(
+    const guint8 *hdr,
+    guint32 *record_size,
+    char **errmsg)
+{
+    if (memcmp(hdr, AMGCM_MAGIC, AMGCM_MAGIC_SIZE) != 0) {
+	*errmsg = g_strdup(_("not an AES-GCM encrypted stream"));
+	return FALSE;
+    }
+
+    *record_size = get_be32(hdr + AMGCM_MAGIC_SIZE);
+    if (*record_size == 0 || *record_size > AMGCM_MAX_RECORD_SIZE) {
+	*errmsg = g_strdup_printf(_("invalid AES-GCM record size %u"),
+				  *record_size);
+	return FALSE;
+    }
+    return TRUE;
+}
+
+gboolean
+amgcm_record_length(
+    const guint8 *rec,
+    guint32 record_size,
+    gsize *len,
+    gboolean *final,
+    char **errmsg)
+{
+    guint32 v = get_be32(rec);
+
+    *final = (v & FINAL_FLAG) != 0;
+    *len = v & ~FINAL_FLAG;
+    if (*len > record_size) {
+	*errmsg = g_strdup_printf(_("AES-GCM record of %zu bytes exceeds the "
+				    "record size %u"), *len, record_size);
+	return FALSE;
+    }
+    return TRUE;
+}
+
+gboolean
+amgcm_stream_key(
+    const guint8 *key,
+    const guint8 *hdr,
+    guint8 *stream_key,
+    char **errmsg)
+{
+#ifdef HAVE_EVP_AES_GCM
+    guint8 prk[EVP_MAX_MD_SIZE];
+    guint8 info[sizeof(AMGCM_HKDF_INFO)];
+    unsigned int prk_len = 0, okm_len = 0;
+    guint8 okm[EVP_MAX_MD_SIZE];
+    gboolean ok;
+
+    /* HKDF-SHA256 (RFC 5869); a single expand block covers the key */
+    memcpy(info, AMGCM_HKDF_INFO, sizeof(AMGCM_HKDF_INFO) - 1);
+    info[sizeof(AMGCM_HKDF_INFO) - 1] = 0x01;
+    ok = HMAC(EVP_sha256(), hdr + AMGCM_MAGIC_SIZE + 4, AMGCM_SALT_SIZE,
+	      key, AMGCM_KEY_SIZE, prk, &prk_len) != NULL
+      && HMAC(EVP_sha256(), prk, (int)prk_len, info, sizeof(info),
+	      okm, &okm_len) != NULL
+      && okm_len >= AMGCM_KEY_SIZE;
+    if (ok)
+	memcpy(stream_key, okm, AMGCM_KEY_SIZE);
+    else
+	*errmsg = g_strdup(_("Can't derive the AES-GCM stream key"));
+
+    memset(prk, 0, sizeof(prk));
+    memset(okm, 0, sizeof(okm));
+    return ok;
+#else
+    (void)key; (void)hdr; (void)stream_key;
+    *errmsg = g_strdup(_("AES-GCM encryption is not supported"));
+    return FALSE;
+#endif
+}
+
+#ifdef HAVE_EVP_AES_GCM
+static void
+make_iv(
+    guint8 *iv,
+    guint64 index)
+{
+    /* the key is unique to the stream, so the counter is enough */
+    memset(iv, 0, 4);
+    put_be32(iv + 4, (guint32)(index >> 32));
+    put_be32(iv + 8, (guint32)index);
+}
+#endif
+
+gboolean
+amgcm_seal_record(
+    const guint8 *key,
+    const guint8 *hdr,
+    guint64 index,
+    gboolean final,
+    const guint8 *in,
+    gsize len,
+    guint8 *out,
+    char **errmsg)
+{
+#ifdef HAVE_EVP_AES_GCM
+    EVP_CIPHER_CTX *ctx;
+    guint8 iv[AMGCM_IV_SIZE];
+    int outl = 0, finl = 0;
+    gboolean ok;
+
+    put_be32(out, (guint32)len | (final ? FINAL_FLAG : 0));
+    make_iv(iv, index);
+
+    ctx = EVP_CIPHER_CTX_new();
+    ok = ctx
+      && EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, key, iv) == 1
+      && EVP_EncryptUpdate(ctx, NULL, &outl, hdr, AMGCM_HEADER_SIZE) == 1
+      && EVP_EncryptUpdate(ctx, NULL, &outl, out, 4) == 1
+      && EVP_EncryptUpdate(ctx, out + 4, &outl, in, (int)len) == 1
+      && EVP_EncryptFinal_ex(ctx, out + 4 + outl, &finl) == 1
+      && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, AMGCM_TAG_SIZE,
+			     out + 4 + len) == 1;
+    if (ctx)
+	EVP_CIPHER_CTX_free(ctx);
+
+    if (!ok)
+	*errmsg = g_strdup_printf(_("AES-GCM encryption of record %ju failed"),
+				  (uintmax_t)index);
+    return ok;
+#else
+    (void)key; (void)hdr; (void)index; (void)final;
+    (void)in; (void)len; (void)out;
+    *errmsg = g_strdup(_("AES-GCM encryption is not supported"));
+    return FALSE;
+#endif
+}
+
+gboolean
+amgcm_open_record(
+    const guint8 *key,
+    const guint8 *hdr,
+    guint64 index,
+    const guint8 *rec,
+    gsize len,
+    guint8 *out,
+    char **errmsg)
+{
+#ifdef HAVE_EVP_AES_GCM
+    EVP_CIPHER_CTX *ctx;
+    guint8 iv[AMGCM_IV_SIZE];
+    guint8 tag[AMGCM_TAG_SIZE];
+    int outl = 0, finl = 0;
+    gboolean ok;
+
+    make_iv(iv, index);
+    memcpy(tag, rec + 4 + len, AMGCM_TAG_SIZE);
+
+    ctx = EVP_CIPHER_CTX_new();
+    ok = ctx
+      && EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, key, iv) == 1
+      && EVP_DecryptUpdate(ctx, NULL, &outl, hdr, AMGCM_HEADER_SIZE) == 1
+      && EVP_DecryptUpdate(ctx, NULL, &outl, rec, 4) == 1
+      && EVP_DecryptUpdate(ctx, out, &outl, rec + 4, (int)len) == 1
+      && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, AMGCM_TAG_SIZE,
+			     tag) == 1
+      && EVP_DecryptFinal_ex(ctx, out + outl, &finl) == 1;
+    if (ctx)
+	EVP_CIPHER_CTX_free(ctx);
+
+    if (!ok)
+	*errmsg = g_strdup_printf(_("AES-GCM record %ju failed authentication"),
+				  (uintmax_t)index);
+    return ok;
+#else
+    (void)key; (void)hdr; (void)index; (void)rec; (void)len; (void)out;
+    *errmsg = g_strdup(_("AES-GCM encryption is not supported"));
+    return FALSE;
+#endif
+}
+
+/*
+ * Streams
+ */
+
+struct amgcm_stream_s {
+    guint8 key[AMGCM_KEY_SIZE];	/* the stream key */
+    guint8 hdr[AMGCM_HEADER_SIZE];
+    gboolean hdr_done;		/* header returned */
+    guint64 index;		/* next record number */
+    guint32 record_size;
+    GByteArray *inbuf;		/* plaintext not sealed yet */
+    GByteArray *outbuf;		/* returned by the last call */
+    char *errmsg;
+};
+
+amgcm_stream_t *
+amgcm_stream_new(
+    const guint8 *key,
+    guint32 record_size,
+    char **errmsg)
+{
+    amgcm_stream_t *stream = g_new0(amgcm_stream_t, 1);
+
+    if (!amgcm_make_header(stream->hdr, record_size, errmsg) ||
+	!amgcm_stream_key(key, stream->hdr, stream->key, errmsg)) {
+	g_free(stream);
+	return NULL;
+    }
+    stream->record_size = record_size;
+    stream->inbuf = g_byte_array_new();
+    stream->outbuf = g_byte_array_new();
+    return stream;
+}
+
+/* seal the records of stream->inbuf into stream->outbuf: the complete ones,
+ * or all of them, the last flagged, if FINAL */
+static char *
+stream_seal(
+    amgcm_stream_t *stream,
+    gboolean final,
+    gsize *out_len)
+{
+    gsize pos = 0;
+
+    g_byte_array_set_size(stream->outbuf, 0);
+    if (!stream->hdr_done) {
+	g_byte_array_append(stream->outbuf, stream->hdr, AMGCM_HEADER_SIZE);
+	stream->hdr_done = TRUE;
+    }
+
+    while (stream->inbuf->len - pos >= stream->record_size ||
+	   (final && (pos < stream->inbuf->len || pos == 0))) {
+	gsize len = MIN(stream->record_size, stream->inbuf->len - pos);
+	gsize end = stream->outbuf->len;
+	gboolean last = final && pos + len == stream->inbuf->len;
+
+	g_free(stream->errmsg);
+	stream->errmsg = NULL;
+	g_byte_array_set_size(stream->outbuf,
+			      end + len + AMGCM_RECORD_OVERHEAD);
+	if (!amgcm_seal_record(stream->key, stream->hdr, stream->index++,
+			       last, stream->inbuf->data + pos, len,
+			       stream->outbuf->data + end, &stream->errmsg))
+	    return NULL;
+	pos += len;
+	if (last)
+	    break;
+    }
+    g_byte_array_remove_range(stream->inbuf, 0, pos);
+
+    *out_len = stream->outbuf->len;
+    return (char *)stream->outbuf->data;
+}
+
+char *
+amgcm_stream_update(
+    amgcm_stream_t *stream,
+    const char *buf,
+    gsize len,
+    gsize *out_len)
+{
+    g_byte_array_append(stream->inbuf, (const guint8 *)buf, len);
+    return stream_seal(stream, FALSE, out_len);
+}
+
+char *
+amgcm_stream_finish(
+    amgcm_stream_t *stream,
+    gsize *out_len)
+{
+    return stream_seal(stream, TRUE, out_len);
+}
+
+const char *
+amgcm_stream_error(
+    amgcm_stream_t *stream)
+{
+    return stream->errmsg;
+}
+
+void
+amgcm_stream_free(
+    amgcm_stream_t *stream)
+{
+    if (!stream)
+	return;
+    memset(stream->key, 0, sizeof(stream->key));
+    g_byte_array_free(stream->inbuf, TRUE);
+    g_byte_array_free(stream->outbuf, TRUE);
+    g_free(stream->errmsg);
+    g_free(stream);
+}
@@ -0,0 +1,177 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+/*
+ * AES-256-GCM record encryption
+ *
+ * An encrypted stream is a header followed by a sequence of records, each
+ * sealed independently so that records can be encrypted and decrypted in
+ * parallel:
+ *
+ *   header:  magic "AMGCM002" (8) | record size (4, BE) | salt (32)
+ *   record:  length (4, BE; high bit set on the last record)
+ *	      | ciphertext (length bytes) | GCM tag (16)
+ *
+ * Each stream is sealed with its own key, derived from the long-lived key
+ * and the random salt with HKDF-SHA256, so that nonces never repeat under
+ * one key however many streams are written.  The nonce of record N is four
+ * zero bytes followed by N as a 64-bit big-endian integer.  The header and
+ * the record's length field are authenticated as additional data, so
+ * records cannot be reordered, moved between streams, or dropped from the
+ * end without detection.
+ */
+
+#ifndef AMGCM_H
+#define AMGCM_H
+
+#include <glib.h>
+
+#define AMGCM_KEY_SIZE		32
+#define AMGCM_MAGIC_SIZE	8
+#define AMGCM_SALT_SIZE		32
+#define AMGCM_HEADER_SIZE	(AMGCM_MAGIC_SIZE + 4 + AMGCM_SALT_SIZE)
+#define AMGCM_TAG_SIZE		16
+#define AMGCM_RECORD_OVERHEAD	(4 + AMGCM_TAG_SIZE)
+#define AMGCM_DEFAULT_RECORD_SIZE (1024*1024)
+#define AMGCM_MAX_RECORD_SIZE	(16*1024*1024)
+
+/* Name recorded as srv_encrypt in the dumpfile header of images encrypted
+ * by the native encryption element */
+#define AMGCM_ENCRYPT_NAME	"amanda-aes-gcm"
+
+/* Is AES-GCM compiled in?
+ */
+gboolean amgcm_supported(void);
+
+/* Load a key file, holding either AMGCM_KEY_SIZE raw bytes or their
+ * hexadecimal representation.
+ *
+ * @param filename: the file
+ * @param key (output): AMGCM_KEY_SIZE bytes
+ * @param errmsg (output): error message on failure, to be freed by the caller
+ * @returns: FALSE on error
+ */
+gboolean amgcm_load_key(const char *filename, guint8 *key, char **errmsg);
+
+/* Build a stream header with a fresh random salt.
+ *
+ * @param hdr (output): AMGCM_HEADER_SIZE bytes
+ * @param record_size: maximum plaintext bytes per record
+ * @param errmsg (output): error message on failure
+ * @returns: FALSE on error
+ */
+gboolean amgcm_make_header(guint8 *hdr, guint32 record_size, char **errmsg);
+
+/* Check a stream header and extract its record size.
+ */
+gboolean amgcm_parse_header(const guint8 *hdr, guint32 *record_size,
+			    char **errmsg);
+
+/* Derive the key of the stream with the given header.
+ *
+ * @param key: the long-lived key, AMGCM_KEY_SIZE bytes
+ * @param hdr: the stream header
+ * @param stream_key (output): AMGCM_KEY_SIZE bytes
+ * @param errmsg (output): error message on failure
+ * @returns: FALSE on error
+ */
+gboolean amgcm_stream_key(const guint8 *key, const guint8 *hdr,
+			  guint8 *stream_key, char **errmsg);
+
+/* Seal one record.  OUT must have room for LEN + AMGCM_RECORD_OVERHEAD
+ * bytes.  Safe to call from several threads at once.
+ *
+ * @param key: the stream key, from amgcm_stream_key
+ * @param hdr: the stream header
+ * @param index: record number, starting at zero
+ * @param final: TRUE for the last record of the stream
+ * @param in: plaintext
+ * @param len: plaintext length, at most the header's record size
+ * @param out (output): the record
+ * @param errmsg (output): error message on failure
+ * @returns: FALSE on error
+ */
+gboolean amgcm_seal_record(const guint8 *key, const guint8 *hdr,
+			   guint64 index, gboolean final,
+			   const guint8 *in, gsize len, guint8 *out,
+			   char **errmsg);
+
+/* Decode the length field at the start of a record.
+ *
+ * @param rec: at least 4 bytes of the record
+ * @param record_size: record size from the stream header
+ * @param len (output): plaintext length; the whole record is
+ *	len + AMGCM_RECORD_OVERHEAD bytes
+ * @param final (output): TRUE if this is the last record
+ * @param errmsg (output): error message on failure
+ * @returns: FALSE if the length is invalid
+ */
+gboolean amgcm_record_length(const guint8 *rec, guint32 record_size,
+			     gsize *len, gboolean *final, char **errmsg);
+
+/* Open one record of plaintext length LEN (from amgcm_record_length),
+ * verifying its tag.  OUT must have room for LEN bytes.  Safe to call from
+ * several threads at once.
+ */
+gboolean amgcm_open_record(const guint8 *key, const guint8 *hdr,
+			   guint64 index, const guint8 *rec, gsize len,
+			   guint8 *out, char **errmsg);
+
+/* An encrypting stream, sealing its records one after the other in the
+ * calling thread, for callers that are not xfer elements.
+ */
+typedef struct amgcm_stream_s amgcm_stream_t;
+
+/* Start a stream, with a fresh header.
+ *
+ * @param key: the long-lived key, AMGCM_KEY_SIZE bytes
+ * @param record_size: maximum plaintext bytes per record
+ * @param errmsg (output): error message on failure
+ * @returns: the new stream, or NULL on error
+ */
+amgcm_stream_t *amgcm_stream_new(const guint8 *key, guint32 record_size,
+				 char **errmsg);
+
+/* Encrypt LEN bytes of data.  The returned buffer holds whatever output is
+ * ready, starting with the header, possibly none; it belongs to the stream
+ * and is valid until the next call.
+ *
+ * @returns: encrypted data, or NULL on error
+ */
+char *amgcm_stream_update(amgcm_stream_t *stream, const char *buf, gsize len,
+			  gsize *out_len);
+
+/* Seal the last record; the returned buffer is as for amgcm_stream_update.
+ */
+char *amgcm_stream_finish(amgcm_stream_t *stream, gsize *out_len);
+
+/* Get the error message for the last failed call
+ */
+const char *amgcm_stream_error(amgcm_stream_t *stream);
+
+void amgcm_stream_free(amgcm_stream_t *stream);
+
+#endif /* AMGCM_H */
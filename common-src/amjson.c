@@ -27,8 +27,6 @@
 #include "conffile.h"
 #include "amjson.h"
 
-static char *string_encode_json(char *str);
-
 static void free_json_value_full(gpointer);
 static void
 free_json_value_full(
@@ -60,13 +58,70 @@ delete_json(
     free_json_value_full(json);
 }
 
-static char *json_value_to_string(amjson_t *json, int first, int indent);
+static void json_value_append(GString *r, amjson_t *json, int first, int indent);
 
 char *
 json_to_string(
     amjson_t *json)
 {
-    return json_value_to_string(json, 1, 0);
+    GString *r = g_string_sized_new(512);
+
+    json_value_append(r, json, 1, 0);
+    return g_string_free(r, FALSE);
+}
+
+void
+json_append(
+    GString  *r,
+    amjson_t *json)
+{
+    json_value_append(r, json, 1, 0);
+}
+
+/* For each byte, the character following the '\' of its escape sequence, 'u'
+ * for a \u00XX escape, or 0 if the byte is copied as is. */
+static const char json_escape[256] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'v', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    0,   0,   '"', 0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   '\\', 0,  0,   0,
+};
+
+void
+json_append_escaped(
+    GString    *r,
+    const char *str)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    const unsigned char *s = (const unsigned char *)str;
+    const unsigned char *run;
+
+    if (!str) {
+	g_string_append(r, "null");
+	return;
+    }
+
+    /* copy the runs of bytes that need no escaping in one go */
+    for (run = s; *s != '\0'; s++) {
+	char esc = json_escape[*s];
+
+	if (!esc)
+	    continue;
+	if (s > run)
+	    g_string_append_len(r, (const char *)run, s - run);
+	g_string_append_c(r, '\\');
+	g_string_append_c(r, esc);
+	if (esc == 'u') {
+	    g_string_append(r, "00");
+	    g_string_append_c(r, hex[*s >> 4]);
+	    g_string_append_c(r, hex[*s & 0x0F]);
+	}
+	run = s + 1;
+    }
+    if (s > run)
+	g_string_append_len(r, (const char *)run, s - run);
 }
 
 typedef struct message_hash_s {
@@ -76,7 +131,7 @@ typedef struct message_hash_s {
 } message_hash_t;
 
 static void
-json_hash_to_string(
+json_hash_append(
     gpointer gkey,
     gpointer gvalue,
     gpointer user_data)
@@ -84,88 +139,76 @@ json_hash_to_string(
     char *key = gkey;
     amjson_t *value = gvalue;
     message_hash_t *mh = user_data;
-    char *result_value = json_value_to_string(value, 1, mh->indent);
 
     if (mh->first) {
-	g_string_append_printf(mh->r,"%*c\"%s\": %s", mh->indent, ' ', (char *)key, result_value);
+	g_string_append_printf(mh->r,"%*c\"%s\": ", mh->indent, ' ', (char *)key);
 	mh->first = 0;
     } else {
-	g_string_append_printf(mh->r,",\n%*c\"%s\": %s", mh->indent, ' ', (char *)key, result_value);
+	g_string_append_printf(mh->r,",\n%*c\"%s\": ", mh->indent, ' ', (char *)key);
     }
-    g_free(result_value);
+    json_value_append(mh->r, value, 1, mh->indent);
 }
 
-static char *
-json_value_to_string(
+static void
+json_value_append(
+    GString  *r,
     amjson_t *json,
     int       first,
     int       indent)
 {
-    char *result = NULL;
-
     switch (json->type) {
     case JSON_TRUE:
-	    result = g_strdup_printf("%s", "true");
+	g_string_append(r, "true");
 	break;
     case JSON_FALSE:
-	    result = g_strdup_printf("%s", "false");
+	g_string_append(r, "false");
 	break;
     case JSON_NULL:
-	    result = g_strdup_printf("%s", "null");
+	g_string_append(r, "null");
 	break;
     case JSON_STRING:
-	{
-	    char *encoded = string_encode_json(json->string);
-	    result = g_strdup_printf("\"%s\"", encoded);
-	    g_free(encoded);
-	}
+	g_string_append_c(r, '"');
+	json_append_escaped(r, json->string);
+	g_string_append_c(r, '"');
 	break;
     case JSON_NUMBER:
-	{
-	    result = g_strdup_printf("%lld", (long long)json->number);
-	}
+	g_string_append_printf(r, "%lld", (long long)json->number);
 	break;
     case JSON_ARRAY:
 	if (json->array->len == 0) {
-	    result = g_strdup_printf("[ ]");
+	    g_string_append(r, "[ ]");
         } else {
-	    GString *r = g_string_sized_new(512);
 	    guint i;
 	    int lfirst = 1;
 	    if (indent == 0) {
-		g_string_append_printf(r, "[\n");
+		g_string_append(r, "[\n");
 	    } else {
 		g_string_append_printf(r, "[\n%*c", indent+2, ' ');
 	    }
 	    for (i = 0; i < json->array->len; i++) {
 		amjson_t *value = g_ptr_array_index(json->array, i);
-		char *result_value = json_value_to_string(value, lfirst, indent+2);
-		lfirst = 0;
 		if (i>0) {
 		    g_string_append(r, ",\n");
 		}
-		g_string_append(r, result_value);
-		g_free(result_value);
+		json_value_append(r, value, lfirst, indent+2);
+		lfirst = 0;
 	    }
 	    g_string_append_printf(r, "\n%*c]", indent, ' ');
-	    result = g_string_free(r, FALSE);
 	}
 	break;
 
     case JSON_HASH:
 	if (g_hash_table_size(json->hash) == 0) {
-	    result = g_strdup("{ }");
+	    g_string_append(r, "{ }");
 	} else {
-	    GString *r = g_string_sized_new(512);
-	    message_hash_t mh = {r, 1, indent+2};;
+	    message_hash_t mh = {r, 1, indent+2};
 	    if (first) {
-		g_string_append_printf(r, "{\n");
+		g_string_append(r, "{\n");
 	    } else {
 		g_string_append_printf(r, "%*c{\n", indent, ' ');
 	    }
-	    g_hash_table_foreach(json->hash, json_hash_to_string, &mh);
+	    g_hash_table_foreach(json->hash, json_hash_append, &mh);
 	    g_string_append_printf(r, "\n%*c}", indent, ' ');
-	    result = g_string_free(r, FALSE);
 	}
 	break;
 
@@ -173,9 +216,6 @@ json_value_to_string(
 	g_critical("JSON_BAD");
 	break;
     }
-
-
-    return result;
 }
 
 amjson_type_t
@@ -555,77 +595,6 @@ parse_json(
     return json;
 }
 
-static char *
-string_encode_json(
-    char *str)
-{
-    int i = 0;
-    int len;
-    unsigned char *s;
-    char *encoded;
-    char *e;
-
-    if (!str) {
-        return g_strdup("null");
-    }
-    len = strlen(str)*2;
-    s = (unsigned char *)str;
-    encoded = g_malloc(len+1);
-    e = encoded;
-
-    while(*s != '\0') {
-        if (i++ >= len) {
-            error("string_encode_json: str is too long: %s", str);
-        }
-        if (*s == '\\' || *s == '"') {
-            *e++ = '\\';
-            *e++ = *s++;
-        } else if (*s == '\b') {
-            *e++ = '\\';
-            *e++ = 'b';
-            s++;
-        } else if (*s == '\f') {
-            *e++ = '\\';
-            *e++ = 'f';
-            s++;
-        } else if (*s == '\n') {
-            *e++ = '\\';
-            *e++ = 'n';
-            s++;
-        } else if (*s == '\r') {
-            *e++ = '\\';
-            *e++ = 'r';
-            s++;
-        } else if (*s == '\t') {
-            *e++ = '\\';
-            *e++ = 't';
-            s++;
-        } else if (*s == '\v') {
-            *e++ = '\\';
-            *e++ = 'v';
-            s++;
-        } else if (*s < 32) {
-            *e++ = '\\';
-            *e++ = 'u';
-            *e++ = '0';
-            *e++ = '0';
-            if ((*s>>4) <= 9)
-                *e++ = '0' + (*s>>4);
-            else
-                *e++ = 'A' + (*s>4) - 10;
-            if ((*s & 0x0F) <= 9)
-                *e++ = '0' + (*s & 0x0F);
-            else
-                *e++ = 'A' + (*s & 0x0F) - 10;
-            s++;
-        } else {
-            *e++ = *s++;
-        }
-    }
-    *e = '\0';
-    return encoded;
-}
-
 amjson_type_t
 get_json_type(
     amjson_t *json)
@@ -49,6 +49,12 @@ typedef struct amjson_s amjson_t;
 
 void delete_json(amjson_t *json);
 char *json_to_string(amjson_t *json);
+
+/* Append the serialization of json, or the JSON escaped form of str (without
+ * the quotes), to an existing GString; this lets a caller reuse one buffer
+ * for many values instead of allocating a string per value. */
+void json_append(GString *r, amjson_t *json);
+void json_append_escaped(GString *r, const char *str);
 amjson_t *parse_json(char *s);
 amjson_type_t parse_json_primitive( char *s, int  *i, int   len);
 uint64_t json_parse_number(char *s, int *i, int len);
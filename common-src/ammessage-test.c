@@ -25,6 +25,7 @@
 #include "amanda.h"
 #include "testutils.h"
 #include "ammessage.h"
+#include "amjson.h"
 
 /*
  * Tests
@@ -48,6 +49,45 @@ test_parse_ammessage(void)
     return TRUE;
 }
 
+static gboolean
+test_json_escape(void)
+{
+    static const struct {
+	char *str;
+	char *expected;
+    } tests[] = {
+	{ "", "" },
+	{ "plain text", "plain text" },
+	{ "a \"quoted\" \\path", "a \\\"quoted\\\" \\\\path" },
+	{ "tab\tnl\ncr\r", "tab\\tnl\\ncr\\r" },
+	{ "\001\037x", "\\u0001\\u001Fx" },
+	{ "caf\303\251", "caf\303\251" },
+	{ NULL, NULL }
+    };
+    GString *r = g_string_new(NULL);
+    gboolean success = TRUE;
+    int i;
+
+    for (i = 0; tests[i].str != NULL; i++) {
+	g_string_truncate(r, 0);
+	json_append_escaped(r, tests[i].str);
+	if (!g_str_equal(r->str, tests[i].expected)) {
+	    g_fprintf(stderr, "json_append_escaped('%s') returned '%s', expected '%s'\n",
+		      tests[i].str, r->str, tests[i].expected);
+	    success = FALSE;
+	}
+    }
+
+    g_string_truncate(r, 0);
+    json_append_escaped(r, NULL);
+    if (!g_str_equal(r->str, "null")) {
+	g_fprintf(stderr, "json_append_escaped(NULL) returned '%s'\n", r->str);
+	success = FALSE;
+    }
+
+    g_string_free(r, TRUE);
+    return success;
+}
 
 /*
  * Main driver
@@ -58,6 +98,7 @@ main(int argc, char **argv)
 {
     static TestUtilsTest tests[] = {
 	TU_TEST(test_parse_ammessage, 90),
+	TU_TEST(test_json_escape, 90),
 	TU_END()
     };
 
@@ -479,7 +479,6 @@ struct message_s {
     message_arg_array_t *arg_array;
 };
 
-static char *ammessage_encode_json(char *str);
 static void set_message(message_t *message, int want_quoted);
 static char *severity_name(int severity);
 static GString *fix_message_string(message_t *message, gboolean want_quoted, char *msg);
@@ -504,77 +503,6 @@ severity_name(
 	return "unknown";
 }
 
-static char *
-ammessage_encode_json(
-    char *str)
-{
-    int i = 0;
-    int len;
-    unsigned char *s;
-    char *encoded;
-    char *e;
-
-    if (!str) {
-	return g_strdup("null");
-    }
-    len = strlen(str)*2;
-    s = (unsigned char *)str;
-    encoded = g_malloc(len+1);
-    e = encoded;
-
-    while(*s != '\0') {
-	if (i++ >= len) {
-	    error("ammessage_encode_json: str is too long: %s", str);
-	}
-	if (*s == '\\' || *s == '"') {
-	    *e++ = '\\';
-	    *e++ = *s++;
-	} else if (*s == '\b') {
-	    *e++ = '\\';
-	    *e++ = 'b';
-	    s++;
-	} else if (*s == '\f') {
-	    *e++ = '\\';
-	    *e++ = 'f';
-	    s++;
-	} else if (*s == '\n') {
-	    *e++ = '\\';
-	    *e++ = 'n';
-	    s++;
-	} else if (*s == '\r') {
-	    *e++ = '\\';
-	    *e++ = 'r';
-	    s++;
-	} else if (*s == '\t') {
-	    *e++ = '\\';
-	    *e++ = 't';
-	    s++;
-	} else if (*s == '\v') {
-	    *e++ = '\\';
-	    *e++ = 'v';
-	    s++;
-	} else if (*s < 32) {
-	    *e++ = '\\';
-	    *e++ = 'u';
-	    *e++ = '0';
-	    *e++ = '0';
-	    if ((*s>>4) <= 9)
-		*e++ = '0' + (*s>>4);
-	    else
-		*e++ = 'A' + (*s>4) - 10;
-	    if ((*s & 0x0F) <= 9)
-		*e++ = '0' + (*s & 0x0F);
-	    else
-		*e++ = 'A' + (*s & 0x0F) - 10;
-	    s++;
-	} else {
-	    *e++ = *s++;
-	}
-    }
-    *e = '\0';
-    return encoded;
-}
-
 char *
 message_get_argument(
     message_t *message,
@@ -1208,6 +1136,9 @@ set_message(
 	msg = "%{hostname} %{diskname}: holdingdisk NEVER with tags matching more than one storage, will be dumped to only one storage";
     } else if (message->code == 2800235) {
 	msg  = "program %{program}: wrong permission, must be 'rwsr-x---'";
+    } else if (message->code == 2800236) {
+	msg  = "%{hostname} %{diskname}: %{errmsg}, server encryption will not work";
+	hint = "\"server-decrypt-option\" must name the key file of amanda-aes-gcm";
     } else if (message->code == 2900000) {
 	msg = "The Application '%{application}' failed: %{errmsg}";
     } else if (message->code == 2900001) {
@@ -1450,6 +1381,8 @@ set_message(
 	msg = "Can't get realpath of the security file '%{security_file}': %{errnostr}";
     } else if (message->code == 3600098) {
 	msg = "can not stat '%{filename}' (%{security_orig}): %{errnostr}";
+    } else if (message->code == 3600099) {
+	msg = "%{device}: selfcheck exited with signal %{signal}";
     } else if (message->code == 3700000) {
 	msg = "%{disk}";
     } else if (message->code == 3700001) {
@@ -1527,6 +1460,27 @@ set_message(
     } else if (message->code == 3702020) {
         msg = "No STATE-DIR";
 
+    } else if (message->code == 3703000) {
+	msg = "%{disk}";
+    } else if (message->code == 3703001) {
+	msg = "amptar version %{version}";
+    } else if (message->code == 3703002) {
+	msg = "amptar gtar-version %{gtar-version}";
+    } else if (message->code == 3703003) {
+	msg = "Can't get %{gtar-path} version";
+    } else if (message->code == 3703004) {
+	msg = "amptar";
+    } else if (message->code == 3703005) {
+	msg = "GNUTAR program not available; restore, validate and index will fail";
+    } else if (message->code == 3703007) {
+	msg = "bad ONE-FILE-SYSTEM property value '%{value}'";
+    } else if (message->code == 3703008) {
+	msg = "bad READERS property value '%{value}'";
+    } else if (message->code == 3703009) {
+	msg = "bad READ-AHEAD property value '%{value}'";
+    } else if (message->code == 3703020) {
+        msg = "No STATE-DIR";
+
     } else if (message->code == 4600000) {
 	msg = "%{errmsg}";
     } else if (message->code == 4600001) {
@@ -1846,11 +1800,12 @@ typedef struct message_hash_s {
     int first;
 } message_hash_t;
 
-static void sprint_message_hash(gpointer key, gpointer value, gpointer user_data);
-static char *sprint_message_value(amjson_t *value);
+static void append_message_hash(gpointer key, gpointer value, gpointer user_data);
+static void append_message_value(GString *r, amjson_t *value);
+static void append_message(GString *r, message_t *message);
 
 static void
-sprint_message_hash(
+append_message_hash(
     gpointer gkey,
     gpointer gvalue,
     gpointer user_data)
@@ -1858,180 +1813,159 @@ sprint_message_hash(
     char *key = gkey;
     amjson_t *value = gvalue;
     message_hash_t *mh = user_data;
-    char *result_value = sprint_message_value((amjson_t *)value);
 
     if (!mh->first) {
 	g_string_append(mh->r, ",\n");
     } else {
 	mh->first = 0;
     }
-    g_string_append_printf(mh->r,"%*c\"%s\" : %s", message_indent, ' ', (char *)key, result_value);
-    g_free(result_value);
+    g_string_append_printf(mh->r,"%*c\"%s\" : ", message_indent, ' ', (char *)key);
+    append_message_value(mh->r, value);
 }
 
-static char *
-sprint_message_value(
+static void
+append_message_value(
+    GString  *r,
     amjson_t *value)
 {
-    char *result = NULL;
-
     switch (value->type) {
     case JSON_TRUE :
-	result = g_strdup("true");
+	g_string_append(r, "true");
 	break;
     case JSON_FALSE :
-	result = g_strdup("false");
+	g_string_append(r, "false");
 	break;
     case JSON_NULL :
-	result = g_strdup("null");
+	g_string_append(r, "null");
 	break;
     case JSON_NUMBER :
-	result = g_strdup_printf("%lld", (long long)value->number);
+	g_string_append_printf(r, "%lld", (long long)value->number);
 	break;
     case JSON_STRING :
-	{
-	    char *encoded = ammessage_encode_json(value->string);
-	    result = g_strdup_printf("\"%s\"", encoded);
-	    g_free(encoded);
-	}
+	g_string_append_c(r, '"');
+	json_append_escaped(r, value->string);
+	g_string_append_c(r, '"');
 	break;
     case JSON_HASH :
 	if (g_hash_table_size(value->hash) == 0) {
-	    result = g_strdup("{ }");
+	    g_string_append(r, "{ }");
 	} else {
-	    GString *r = g_string_sized_new(512);
 	    message_hash_t mh = {r, 1};
 	    g_string_append(r, "{\n");
 	    message_indent += 2;
-	    g_hash_table_foreach(value->hash, sprint_message_hash, &mh);
+	    g_hash_table_foreach(value->hash, append_message_hash, &mh);
 	    message_indent -= 2;
 	    g_string_append_printf(r, "\n%*c}", message_indent, ' ');
-	    result = g_string_free(r, FALSE);
 	}
 	break;
     case JSON_ARRAY :
 	if (value->array->len == 0) {
-	    result = g_strdup("[ ]");
+	    g_string_append(r, "[ ]");
 	} else {
-	    GString *r = g_string_sized_new(512);
 	    guint i;
 	    g_string_append(r, "[\n");
 	    message_indent += 2;
 	    for (i = 0; i < value->array->len; i++) {
-		char *result_value = sprint_message_value(g_ptr_array_index(value->array, i));
 		if (i>0) {
 		    g_string_append(r, ",\n");
 		}
 		g_string_append_printf(r, "%*c", message_indent, ' ');
-		g_string_append(r, result_value);
-		g_free(result_value);
+		append_message_value(r, g_ptr_array_index(value->array, i));
 	    }
 	    message_indent -= 2;
 	    g_string_append_printf(r, "\n%*c]", message_indent, ' ');
-	    result = g_string_free(r, FALSE);
 	}
 	break;
     case JSON_BAD:
 	assert(0);
 	break;
     }
+}
 
-    return result;
+/* append '    "key" : "value",\n', with value JSON escaped */
+static void
+append_message_field(
+    GString    *r,
+    const char *key,
+    const char *value)
+{
+    g_string_append_printf(r, "    \"%s\" : \"", key);
+    json_append_escaped(r, value);
+    g_string_append(r, "\",\n");
 }
 
-char *
-sprint_message(
+static void
+append_message(
+    GString   *r,
     message_t *message)
 {
     int i;
     static int first_message = 1;
-    GString *result;
-
-    char *json_file;
-    char *json_process;
-    char *json_running_on;
-    char *json_component;
-    char *json_module;
-    char *json_msg;
-
-    if (message == NULL)
-	return NULL;
 
     message_indent = 4;
-    json_file = ammessage_encode_json(message->file);
-    json_process = ammessage_encode_json(message->process);
-    json_running_on = ammessage_encode_json(message->running_on);
-    json_component = ammessage_encode_json(message->component);
-    json_module = ammessage_encode_json(message->module);
 
-    result = g_string_sized_new(512);
     if (first_message) {
 	first_message = 0;
     } else {
-	g_string_append_printf(result, ",\n");
+	g_string_append(r, ",\n");
     }
-    g_string_append_printf(result,
-        "  {\n" \
-        "    \"source_filename\" : \"%s\",\n" \
-        "    \"source_line\" : \"%d\",\n" \
-        "    \"severity\" : \"%s\",\n" \
-        "    \"process\" : \"%s\",\n" \
-        "    \"running_on\" : \"%s\",\n" \
-        "    \"component\" : \"%s\",\n" \
-        "    \"module\" : \"%s\",\n" \
-        "    \"code\" : \"%d\",\n" \
-        , json_file, message->line, severity_name(message->severity), json_process, json_running_on, json_component, json_module, message->code);
+    g_string_append(r, "  {\n");
+    append_message_field(r, "source_filename", message->file);
+    g_string_append_printf(r, "    \"source_line\" : \"%d\",\n", message->line);
+    g_string_append_printf(r, "    \"severity\" : \"%s\",\n", severity_name(message->severity));
+    append_message_field(r, "process", message->process);
+    append_message_field(r, "running_on", message->running_on);
+    append_message_field(r, "component", message->component);
+    append_message_field(r, "module", message->module);
+    g_string_append_printf(r, "    \"code\" : \"%d\",\n", message->code);
 
     if (message->no_eol) {
-	g_string_append_printf(result,
+	g_string_append_printf(r,
 	"    \"no_eol\" : \"%d\",\n", message->no_eol);
     }
     if (message->merrno) {
-	g_string_append_printf(result,
+	g_string_append_printf(r,
 	"    \"merrno\" : \"%d\",\n", message->merrno);
     }
     if (message->errnocode) {
-	g_string_append_printf(result,
+	g_string_append_printf(r,
 	"    \"errnocode\" : \"%s\",\n", message->errnocode);
     }
     if (message->errnostr) {
-	char *result_value = ammessage_encode_json(message->errnostr);
-	g_string_append_printf(result,
-	"    \"errnostr\" : \"%s\",\n", result_value);
-	g_free(result_value);
+	append_message_field(r, "errnostr", message->errnostr);
     }
     for (i = 0; message->arg_array[i].key != NULL; i++) {
-	char *json_key = ammessage_encode_json(message->arg_array[i].key);
-	char *result_value = sprint_message_value(&message->arg_array[i].value);
-	g_string_append_printf(result,
-	    "    \"%s\" : %s,\n", json_key, result_value);
-	g_free(json_key);
-	g_free(result_value);
+	g_string_append(r, "    \"");
+	json_append_escaped(r, message->arg_array[i].key);
+	g_string_append(r, "\" : ");
+	append_message_value(r, &message->arg_array[i].value);
+	g_string_append(r, ",\n");
     }
     if (!message->msg) {
 	set_message(message, 0);
     }
-    json_msg = ammessage_encode_json(message->msg);
-    g_string_append_printf(result,
-        "    \"message\" : \"%s\"" \
-        , json_msg);
+    g_string_append(r, "    \"message\" : \"");
+    json_append_escaped(r, message->msg);
+    g_string_append_c(r, '"');
     if (message->hint) {
-	char *json_hint = ammessage_encode_json(message->hint);
-	g_string_append_printf(result,
-			",\n    \"hint\" : \"%s\"" \
-		        , message->hint);
-	g_free(json_hint);
+	g_string_append(r, ",\n    \"hint\" : \"");
+	json_append_escaped(r, message->hint);
+	g_string_append_c(r, '"');
     }
-    g_string_append_printf(result,
-	"\n  }");
+    g_string_append(r, "\n  }");
+}
 
-    g_free(json_file);
-    g_free(json_process);
-    g_free(json_running_on);
-    g_free(json_component);
-    g_free(json_module);
-    g_free(json_msg);
+char *
+sprint_message(
+    message_t *message)
+{
+    GString *result;
+
+    if (message == NULL)
+	return NULL;
 
+    result = g_string_sized_new(1024);
+    append_message(result, message);
     return g_string_free(result, FALSE);
 }
 
@@ -2039,14 +1973,15 @@ message_t *
 print_message(
     message_t *message)
 {
-    char *msg;
+    GString *result;
 
     if (message == NULL)
 	return NULL;
 
-    msg = sprint_message(message);
-    g_printf("%s", msg);
-    g_free(msg);
+    result = g_string_sized_new(1024);
+    append_message(result, message);
+    g_printf("%s", result->str);
+    g_string_free(result, TRUE);
     return message;
 }
 
@@ -2055,14 +1990,15 @@ fprint_message(
     FILE      *stream,
     message_t *message)
 {
-    char *msg;
+    GString *result;
 
     if (message == NULL)
 	return NULL;
 
-    msg = sprint_message(message);
-    g_fprintf(stream, "%s", msg);
-    g_free(msg);
+    result = g_string_sized_new(1024);
+    append_message(result, message);
+    fwrite(result->str, 1, result->len, stream);
+    g_string_free(result, TRUE);
     return message;
 }
 
@@ -2071,14 +2007,15 @@ fdprint_message(
     int       fd,
     message_t *message)
 {
-    char *msg;
+    GString *result;
 
     if (message == NULL)
 	return NULL;
 
-    msg = sprint_message(message);
-    full_write(fd, msg, strlen(msg));
-    g_free(msg);
+    result = g_string_sized_new(1024);
+    append_message(result, message);
+    full_write(fd, result->str, result->len);
+    g_string_free(result, TRUE);
     return message;
 }
 
@@ -0,0 +1,198 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+/*
+ * Placement of processes, threads and memory on the NUMA nodes
+ */
+
+#include "amanda.h"
+#include "amnuma.h"
+
+#ifdef HAVE_SCHED_SETAFFINITY
+#include <sched.h>
+#endif
+#include <sys/syscall.h>
+
+#define NODE_SYSFS "/sys/devices/system/node"
+
+/* the nodemask given to mbind(); nodes above it cannot be used */
+#define AMNUMA_MAX_NODES 1024
+#define MPOL_PREFERRED_ 1	/* MPOL_PREFERRED, without <numaif.h> */
+
+int
+amnuma_node_count(void)
+{
+    static int count = -1;
+    DIR *dir;
+    struct dirent *entry;
+    int n = 0;
+
+    if (count >= 0)
+	return count;
+
+    if ((dir = opendir(NODE_SYSFS)) != NULL) {
+	while ((entry = readdir(dir)) != NULL) {
+	    if (g_str_has_prefix(entry->d_name, "node") &&
+		g_ascii_isdigit(entry->d_name[4]))
+		n++;
+	}
+	closedir(dir);
+    }
+    count = n;
+    return count;
+}
+
+int
+amnuma_current_node(void)
+{
+#ifdef SYS_getcpu
+    unsigned cpu, node;
+
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+	return (int)node;
+#endif
+    return -1;
+}
+
+#ifdef HAVE_SCHED_SETAFFINITY
+/* add the CPUs of a sysfs cpulist ("0-7,16-23") to SET */
+static gboolean
+parse_cpulist(
+    const char *list,
+    cpu_set_t  *set)
+{
+    const char *p = list;
+
+    while (*p && *p != '\n') {
+	char *end;
+	long first, last;
+
+	first = last = strtol(p, &end, 10);
+	if (end == p)
+	    return FALSE;
+	if (*end == '-') {
+	    p = end + 1;
+	    last = strtol(p, &end, 10);
+	    if (end == p)
+		return FALSE;
+	}
+	for (; first <= last && first < CPU_SETSIZE; first++)
+	    CPU_SET(first, set);
+	p = end;
+	if (*p == ',')
+	    p++;
+    }
+    return TRUE;
+}
+#endif
+
+gboolean
+amnuma_pin(
+    pid_t  pid,
+    int    node,
+    char **errmsg)
+{
+#ifdef HAVE_SCHED_SETAFFINITY
+    cpu_set_t set;
+    char *filename;
+    char *cpulist = NULL;
+    GError *error = NULL;
+    int cpu;
+
+    CPU_ZERO(&set);
+    if (node < 0) {
+	/* the kernel leaves out the CPUs the process may not use */
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	    CPU_SET(cpu, &set);
+    } else {
+	filename = g_strdup_printf(NODE_SYSFS "/node%d/cpulist", node);
+	if (!g_file_get_contents(filename, &cpulist, NULL, &error)) {
+	    *errmsg = g_strdup_printf(_("NUMA node %d: %s"), node,
+				      error->message);
+	    g_error_free(error);
+	    g_free(filename);
+	    return FALSE;
+	}
+	g_free(filename);
+	if (!parse_cpulist(cpulist, &set) || CPU_COUNT(&set) == 0) {
+	    *errmsg = g_strdup_printf(_("NUMA node %d has no CPU"), node);
+	    g_free(cpulist);
+	    return FALSE;
+	}
+	g_free(cpulist);
+    }
+
+    if (sched_setaffinity(pid, sizeof(set), &set) == -1) {
+	*errmsg = g_strdup_printf(_("sched_setaffinity(%d) failed: %s"),
+				  (int)pid, strerror(errno));
+	return FALSE;
+    }
+    return TRUE;
+#else
+    (void)pid;
+    if (node < 0)
+	return TRUE;
+    *errmsg = g_strdup(_("CPU affinity is not supported on this system"));
+    return FALSE;
+#endif
+}
+
+gboolean
+amnuma_prefer_memory(
+    gpointer addr,
+    size_t   len,
+    int      node,
+    char   **errmsg)
+{
+    if (node < 0)
+	return TRUE;
+#ifdef SYS_mbind
+    {
+	unsigned long mask[AMNUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+
+	if (node >= AMNUMA_MAX_NODES) {
+	    *errmsg = g_strdup_printf(_("NUMA node %d is out of range"), node);
+	    return FALSE;
+	}
+	memset(mask, 0, sizeof(mask));
+	mask[node / (8 * sizeof(unsigned long))] |=
+			1UL << (node % (8 * sizeof(unsigned long)));
+	/* the kernel counts maxnode one past the last bit */
+	if (syscall(SYS_mbind, addr, len, MPOL_PREFERRED_, mask,
+		    (unsigned long)AMNUMA_MAX_NODES + 1, 0) == -1) {
+	    *errmsg = g_strdup_printf(_("mbind to NUMA node %d failed: %s"),
+				      node, strerror(errno));
+	    return FALSE;
+	}
+	return TRUE;
+    }
+#else
+    (void)addr;
+    (void)len;
+    *errmsg = g_strdup(_("NUMA memory placement is not supported on this system"));
+    return FALSE;
+#endif
+}
@@ -0,0 +1,72 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+/*
+ * Placement of processes, threads and memory on the NUMA nodes
+ */
+
+#ifndef AMNUMA_H
+#define AMNUMA_H
+
+#include <glib.h>
+#include <sys/types.h>
+
+/* The number of NUMA nodes of the host.
+ *
+ * @returns: the number of nodes, or 0 if the host has no NUMA information
+ */
+int amnuma_node_count(void);
+
+/* The node of the CPU the calling thread is running on.
+ *
+ * @returns: the node, or -1 if it is unknown
+ */
+int amnuma_current_node(void);
+
+/* Restrict a process, or the calling thread, to the CPUs of a node.  Only
+ * the given thread is moved; the threads it creates later inherit its
+ * placement.
+ *
+ * @param pid: the process (its main thread), or 0 for the calling thread
+ * @param node: the node, or -1 for all of the CPUs
+ * @param errmsg (output): the error message, to be freed by the caller
+ * @returns: FALSE on error
+ */
+gboolean amnuma_pin(pid_t pid, int node, char **errmsg);
+
+/* Allocate the pages of a mapping, when they are first touched, on a node
+ * if it has free memory.
+ *
+ * @param addr: the page-aligned start of the mapping
+ * @param len: its length
+ * @param node: the node; -1 does nothing
+ * @param errmsg (output): the error message, to be freed by the caller
+ * @returns: FALSE on error
+ */
+gboolean amnuma_prefer_memory(gpointer addr, size_t len, int node,
+			      char **errmsg);
+
+#endif /* AMNUMA_H */
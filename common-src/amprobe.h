@@ -0,0 +1,78 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+
+/*
+ * Static probes
+ *
+ * AMPROBEn(name, args...) marks a point that perf, bpftrace or systemtap can
+ * attach to as usdt:<binary>:amanda:<name>; use a double underscore in NAME
+ * where the probe name has a dash.  With <sys/sdt.h>, a probe is a single nop
+ * until a tracer attaches to it, but its arguments are still evaluated, so
+ * they should be values already at hand.  Without <sys/sdt.h> the macros
+ * expand to nothing, so the arguments must not have side effects.
+ *
+ * The probes and their arguments:
+ *   xfer-status (xfer, status)
+ *   xfer-element-start (elt, perl_class)
+ *   xfer-element-cancel (elt, expect_eof)
+ *   xfer-push-buffer, xfer-pull-buffer (elt, bytes, elapsed usec)
+ *   device-write-block-entry (device, size)
+ *   device-write-block-return (device, size, DeviceWriteResult)
+ *   device-read-block-entry (device, max size)
+ *   device-read-block-return (device, size, result)
+ *   s3-request-begin (verb, bucket, key)
+ *   s3-request-end (verb, bytes sent, HTTP status, s3_result_t)
+ *   shm-ring-sem-wait-entry (shm_ring, sem)
+ *   shm-ring-sem-wait-return (shm_ring, sem, result)
+ *   driver-start-dump (host, disk, level, to tape)
+ *   driver-idle (idle reason)
+ */
+
+#ifndef AMPROBE_H
+#define AMPROBE_H
+
+#ifdef HAVE_SYS_SDT_H
+
+#include <sys/sdt.h>
+
+#define AMPROBE0(name)			DTRACE_PROBE(amanda, name)
+#define AMPROBE1(name, a)		DTRACE_PROBE1(amanda, name, a)
+#define AMPROBE2(name, a, b)		DTRACE_PROBE2(amanda, name, a, b)
+#define AMPROBE3(name, a, b, c)		DTRACE_PROBE3(amanda, name, a, b, c)
+#define AMPROBE4(name, a, b, c, d)	DTRACE_PROBE4(amanda, name, a, b, c, d)
+
+#else
+
+#define AMPROBE0(name)			do { } while (0)
+#define AMPROBE1(name, a)		do { } while (0)
+#define AMPROBE2(name, a, b)		do { } while (0)
+#define AMPROBE3(name, a, b, c)		do { } while (0)
+#define AMPROBE4(name, a, b, c, d)	do { } while (0)
+
+#endif
+
+#endif /* AMPROBE_H */
@@ -2210,6 +2210,7 @@ static uint32_t crc_table[16][256];
 static gboolean crc_initialized = FALSE;
 gboolean have_sse42 = FALSE;
 void (* crc32_function)(uint8_t *buf, size_t len, crc_t *crc);
+const char *crc32_function_name = NULL;
 
   #include "amcrc32chw.h"
 
@@ -2225,12 +2226,12 @@ make_crc_table(void)
 	if (compiled_with_sse4_2) {
 	    have_sse42 = get_sse42();
 	}
-	if (have_sse42) {
-	    crc32c_init_hw();
-	    crc32_function = &crc32c_add_hw;
-	} else {
+	crc32_function = crc32c_select_hw(&crc32_function_name);
+	if (!crc32_function) {
             crc32_function = &crc32_add_16bytes;
+	    crc32_function_name = "slice-by-16";
 	}
+	g_debug("crc32: using the %s kernel", crc32_function_name);
 
         for (i = 0; i < 256; i++) {
             uint32_t c = i;
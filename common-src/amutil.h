@@ -433,6 +433,7 @@ typedef struct crc_s {
 } crc_t;
 
 extern int have_sse42;
+extern const char *crc32_function_name;	/* kernel picked by make_crc_table */
 void make_crc_table(void);
 void crc32_init(crc_t *crc);
 void crc32_add_1byte(uint8_t *buf, size_t len, crc_t *crc);
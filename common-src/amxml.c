@@ -93,6 +93,7 @@ free_dle(
     g_slist_free(dle->estimatelist);
     slist_free_full(dle->levellist, g_free);
     amfree(dle->dumpdate);
+    amfree(dle->change_token);
     amfree(dle->compprog);
     amfree(dle->srv_encrypt);
     amfree(dle->clnt_encrypt);
@@ -143,6 +144,7 @@ init_dle(
     dle->kencrypt = 0;
     dle->levellist = NULL;
     dle->dumpdate = NULL;
+    dle->change_token = NULL;
     dle->compprog = NULL;
     dle->srv_encrypt = NULL;
     dle->clnt_encrypt = NULL;
@@ -275,6 +277,7 @@ amstart_element(
 	      g_str_equal(element_name, "auth") ||
 	      g_str_equal(element_name, "index") ||
 	      g_str_equal(element_name, "dumpdate") ||
+	      g_str_equal(element_name, "change-token") ||
 	      g_str_equal(element_name, "level") ||
 	      g_str_equal(element_name, "record") ||
 	      g_str_equal(element_name, "spindle") ||
@@ -299,6 +302,7 @@ amstart_element(
 	    (g_str_equal(element_name, "auth") && dle->auth) ||
 	    (g_str_equal(element_name, "index") && data_user->has_index) ||
 	    (g_str_equal(element_name, "dumpdate") && dle->dumpdate) ||
+	    (g_str_equal(element_name, "change-token") && dle->change_token) ||
 	    (g_str_equal(element_name, "compress") && data_user->has_compress) ||
 	    (g_str_equal(element_name, "encrypt") && data_user->has_encrypt) ||
 	    (g_str_equal(element_name, "kencrypt") && data_user->has_kencrypt) ||
@@ -759,6 +763,14 @@ amtext(
 	    return;
 	}
 	dle->dumpdate = tt;
+    } else if(g_str_equal(last_element_name, "change-token")) {
+	if (dle->change_token != NULL) {
+	    g_set_error(gerror, G_MARKUP_ERROR, G_MARKUP_ERROR_INVALID_CONTENT,
+			"XML: multiple text in %s", last_element_name);
+	    amfree(tt);
+	    return;
+	}
+	dle->change_token = tt;
     } else if(g_str_equal(last_element_name, "record")) {
 	if (strcasecmp(tt, "no") == 0) {
 	    dle->record = 0;
@@ -785,6 +797,14 @@ amtext(
 	    dle->compress = COMP_SERVER_FAST;
 	} else if (g_str_equal(tt, "SERVER-BEST")) {
 	    dle->compress = COMP_SERVER_BEST;
+	} else if (g_str_equal(tt, "SERVER-AUTO")) {
+	    dle->compress = COMP_SERVER_AUTO;
+	} else if (g_str_equal(tt, "SERVER-DEFERRED")) {
+	    dle->compress = COMP_SERVER_DEFERRED;
+	} else if (g_str_equal(tt, "SERVER-ZSTD")) {
+	    dle->compress = COMP_SERVER_ZSTD;
+	} else if (g_str_equal(tt, "SERVER-LZ4")) {
+	    dle->compress = COMP_SERVER_LZ4;
 	} else if (BSTRNCMP(tt, "SERVER-CUSTOM") == 0) {
 	    dle->compress = COMP_SERVER_CUST;
 	} else {
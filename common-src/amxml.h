@@ -67,6 +67,7 @@ typedef struct a_dle_s {
     levellist_t levellist;
     int     nb_level;
     char   *dumpdate;
+    char   *change_token;	/* token of the last estimates, or "NONE" */
     char   *compprog;
     char   *srv_encrypt;
     char   *clnt_encrypt;
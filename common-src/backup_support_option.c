@@ -31,6 +31,253 @@
 #include "pipespawn.h"
 #include "backup_support_option.h"
 
+/* Set the field of BSU for one line of the 'support' output */
+static void
+parse_support_line(
+    backup_support_option_t *bsu,
+    char *line)
+{
+    if (g_str_has_prefix(line, "CONFIG ")) {
+	if (g_str_equal(line + 7, "YES"))
+	    bsu->config = 1;
+    } else if (g_str_has_prefix(line, "HOST ")) {
+	if (g_str_equal(line + 5, "YES"))
+	bsu->host = 1;
+    } else if (g_str_has_prefix(line, "DISK ")) {
+	if (g_str_equal(line + 5, "YES"))
+	    bsu->disk = 1;
+    } else if (g_str_has_prefix(line, "INDEX-LINE ")) {
+	if (g_str_equal(line + 11, "YES"))
+	    bsu->index_line = 1;
+    } else if (g_str_has_prefix(line, "INDEX-XML ")) {
+	if (g_str_equal(line + 10, "YES"))
+	    bsu->index_xml = 1;
+    } else if (g_str_has_prefix(line, "MESSAGE-LINE ")) {
+	if (g_str_equal(line + 13, "YES"))
+	    bsu->message_line = 1;
+    } else if (g_str_has_prefix(line, "MESSAGE-SELFCHECK-JSON ")) {
+	if (g_str_equal(line + 23, "YES"))
+	    bsu->message_selfcheck_json = 1;
+    } else if (g_str_has_prefix(line, "MESSAGE-ESTIMATE-JSON ")) {
+	if (g_str_equal(line + 22, "YES"))
+	    bsu->message_estimate_json = 1;
+    } else if (g_str_has_prefix(line, "MESSAGE-BACKUP-JSON ")) {
+	if (g_str_equal(line + 20, "YES"))
+	    bsu->message_backup_json = 1;
+    } else if (g_str_has_prefix(line, "MESSAGE-RESTORE-JSON ")) {
+	if (g_str_equal(line + 21, "YES"))
+	    bsu->message_restore_json = 1;
+    } else if (g_str_has_prefix(line, "MESSAGE-VALIDATE-JSON ")) {
+	if (g_str_equal(line + 22, "YES"))
+	    bsu->message_validate_json = 1;
+    } else if (g_str_has_prefix(line, "MESSAGE-INDEX-JSON ")) {
+	if (g_str_equal(line + 19, "YES"))
+	    bsu->message_index_json = 1;
+    } else if (g_str_has_prefix(line, "MESSAGE-XML ")) {
+	if (g_str_equal(line + 12, "YES"))
+	    bsu->message_xml = 1;
+    } else if (g_str_has_prefix(line, "RECORD ")) {
+	if (g_str_equal(line + 7, "YES"))
+	    bsu->record = 1;
+    } else if (g_str_has_prefix(line, "INCLUDE-FILE ")) {
+	if (g_str_equal(line + 13, "YES"))
+	    bsu->include_file = 1;
+    } else if (g_str_has_prefix(line, "INCLUDE-LIST ")) {
+	if (g_str_equal(line + 13, "YES"))
+	    bsu->include_list = 1;
+    } else if (g_str_has_prefix(line, "INCLUDE-LIST-GLOB ")) {
+	if (g_str_equal(line + 17, "YES"))
+	    bsu->include_list_glob = 1;
+    } else if (g_str_has_prefix(line, "INCLUDE-OPTIONAL ")) {
+	if (g_str_equal(line + 17, "YES"))
+	    bsu->include_optional = 1;
+    } else if (g_str_has_prefix(line, "EXCLUDE-FILE ")) {
+	if (g_str_equal(line + 13, "YES"))
+	    bsu->exclude_file = 1;
+    } else if (g_str_has_prefix(line, "EXCLUDE-LIST ")) {
+	if (g_str_equal(line + 13, "YES"))
+	    bsu->exclude_list = 1;
+    } else if (g_str_has_prefix(line, "EXCLUDE-LIST-GLOB ")) {
+	if (g_str_equal(line + 17, "YES"))
+	    bsu->exclude_list_glob = 1;
+    } else if (g_str_has_prefix(line, "EXCLUDE-OPTIONAL ")) {
+	if (g_str_equal(line + 17, "YES"))
+	    bsu->exclude_optional = 1;
+    } else if (g_str_has_prefix(line, "COLLECTION ")) {
+	if (g_str_equal(line + 11, "YES"))
+	    bsu->collection = 1;
+    } else if (g_str_has_prefix(line, "CALCSIZE ")) {
+	if (g_str_equal(line + 9, "YES"))
+	    bsu->calcsize = 1;
+    } else if (g_str_has_prefix(line, "CLIENT-ESTIMATE ")) {
+	if (g_str_equal(line + 16, "YES"))
+	    bsu->client_estimate = 1;
+    } else if (g_str_has_prefix(line, "MULTI-ESTIMATE ")) {
+	if (g_str_equal(line + 15, "YES"))
+	    bsu->multi_estimate = 1;
+    } else if (g_str_has_prefix(line, "MAX-LEVEL ")) {
+	bsu->max_level  = atoi(line+10);
+    } else if (g_str_has_prefix(line, "RECOVER-MODE ")) {
+	if (strcasecmp(line+13, "SMB") == 0)
+	    bsu->smb_recover_mode = 1;
+    } else if (g_str_has_prefix(line, "DATA-PATH ")) {
+	if (strcasecmp(line+10, "AMANDA") == 0)
+	    bsu->data_path_set |= DATA_PATH_AMANDA;
+	else if (strcasecmp(line+10, "DIRECTTCP") == 0)
+	    bsu->data_path_set |= DATA_PATH_DIRECTTCP;
+    } else if (g_str_has_prefix(line, "RECOVER-PATH ")) {
+	if (strcasecmp(line+13, "CWD") == 0)
+	    bsu->recover_path = RECOVER_PATH_CWD;
+	else if (strcasecmp(line+13, "REMOTE") == 0)
+	    bsu->recover_path = RECOVER_PATH_REMOTE;
+    } else if (g_str_has_prefix(line, "AMFEATURES ")) {
+	if (g_str_equal(line + 11, "YES"))
+	    bsu->features = 1;
+    } else if (g_str_has_prefix(line, "RECOVER-DUMP-STATE-FILE ")) {
+	if (g_str_equal(line + 24, "YES"))
+	    bsu->recover_dump_state_file = 1;
+    } else if (g_str_has_prefix(line, "DISCOVER ")) {
+	if (g_str_equal(line + 9, "YES"))
+	    bsu->discover = 1;
+    } else if (g_str_has_prefix(line, "DAR ")) {
+	if (g_str_equal(line + 4, "YES"))
+	    bsu->dar = 1;
+    } else if (g_str_has_prefix(line, "STATE-STREAM ")) {
+	if (g_str_equal(line + 13, "YES"))
+	    bsu->state_stream = 1;
+    } else if (g_str_has_prefix(line, "TIMESTAMP ")) {
+	if (g_str_equal(line + 10, "YES"))
+	    bsu->timestamp = 1;
+    } else if (g_str_has_prefix(line, "EXECUTE-WHERE ")) {
+	if (g_str_equal(line + 14, "YES"))
+	    bsu->execute_where = 1;
+    } else if (g_str_has_prefix(line, "CMD-STREAM ")) {
+	if (g_str_equal(line + 11, "YES"))
+	    bsu->cmd_stream = 1;
+    } else if (g_str_has_prefix(line, "WANT-SERVER-BACKUP-RESULT ")) {
+	if (g_str_equal(line + 26, "YES"))
+	    bsu->want_server_backup_result = 1;
+    } else if (g_str_has_prefix(line, "RESUME ")) {
+	if (g_str_equal(line + 7, "YES"))
+	    bsu->resume = 1;
+    } else {
+	dbprintf(_("Invalid support line: %s\n"), line);
+    }
+}
+
+/*
+ * The answers of an application are cached, in the process and in a file,
+ * keyed by the mtime and size of its binary: running 'support' for each DLE
+ * costs more than the estimate of a small DLE.  The file holds a header line
+ * and the lines written by the application.
+ */
+static GHashTable *support_cache = NULL;
+
+static char *
+support_cache_filename(
+    char *program)
+{
+    char *name = g_strdup(program);
+    char *s;
+    char *filename;
+
+    for (s = name; *s != '\0'; s++) {
+	if (*s == '/')
+	    *s = '_';
+    }
+    filename = g_strjoin(NULL, AMANDA_TMPDIR, "/support-", name, NULL);
+    g_free(name);
+    return filename;
+}
+
+static char *
+support_cache_header(
+    char *cmd)
+{
+    struct stat stat_buf;
+
+    if (stat(cmd, &stat_buf) != 0)
+	return NULL;
+    return g_strdup_printf("AMANDA-SUPPORT-CACHE %s %ld %lld", cmd,
+			   (long)stat_buf.st_mtime,
+			   (long long)stat_buf.st_size);
+}
+
+static backup_support_option_t *
+support_cache_read(
+    char *program,
+    char *header)
+{
+    backup_support_option_t *bsu;
+    char *filename;
+    FILE *cachef;
+    char *line;
+
+    bsu = g_hash_table_lookup(support_cache, program);
+    if (bsu)
+	return g_memdup(bsu, sizeof(*bsu));
+
+    filename = support_cache_filename(program);
+    cachef = fopen(filename, "r");
+    g_free(filename);
+    if (!cachef)
+	return NULL;
+    line = pgets(cachef);
+    if (!line || !g_str_equal(line, header)) {
+	amfree(line);
+	fclose(cachef);
+	return NULL;
+    }
+    amfree(line);
+
+    bsu = g_new0(backup_support_option_t, 1);
+    bsu->config = 1;
+    bsu->host = 1;
+    bsu->disk = 1;
+    while ((line = pgets(cachef)) != NULL) {
+	parse_support_line(bsu, line);
+	amfree(line);
+    }
+    fclose(cachef);
+    if (bsu->data_path_set == 0)
+	bsu->data_path_set = DATA_PATH_AMANDA;
+    dbprintf("support of '%s' from the cache\n", program);
+    g_hash_table_insert(support_cache, g_strdup(program),
+			g_memdup(bsu, sizeof(*bsu)));
+    return bsu;
+}
+
+static void
+support_cache_write(
+    char *program,
+    char *header,
+    GPtrArray *lines,
+    backup_support_option_t *bsu)
+{
+    char *filename;
+    char *tmpname;
+    FILE *cachef;
+    guint i;
+    gboolean ok;
+
+    g_hash_table_insert(support_cache, g_strdup(program),
+			g_memdup(bsu, sizeof(*bsu)));
+
+    filename = support_cache_filename(program);
+    tmpname = g_strdup_printf("%s.%ld", filename, (long)getpid());
+    cachef = fopen(tmpname, "w");
+    if (cachef) {
+	ok = g_fprintf(cachef, "%s\n", header) >= 0;
+	for (i = 0; ok && i < lines->len; i++)
+	    ok = g_fprintf(cachef, "%s\n", (char *)g_ptr_array_index(lines, i)) >= 0;
+	ok = (fclose(cachef) == 0) && ok;
+	if (!ok || rename(tmpname, filename) != 0)
+	    unlink(tmpname);
+    }
+    g_free(tmpname);
+    g_free(filename);
+}
+
 backup_support_option_t *
 backup_support_option(
     char       *program,
@@ -45,11 +292,25 @@ backup_support_option(
     char   *line;
     int     status;
     char   *err = NULL;
+    char   *header;
+    GPtrArray *lines;
     backup_support_option_t *bsu;
 
     if (errarray)
 	*errarray = NULL;
     cmd = g_strjoin(NULL, APPLICATION_DIR, "/", program, NULL);
+
+    if (!support_cache)
+	support_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+					      g_free, g_free);
+    header = support_cache_header(cmd);
+    if (header && (bsu = support_cache_read(program, header)) != NULL) {
+	g_free(header);
+	g_ptr_array_free(argv_ptr, TRUE);
+	amfree(cmd);
+	return bsu;
+    }
+    lines = g_ptr_array_new();
     g_ptr_array_add(argv_ptr, g_strdup(program));
     g_ptr_array_add(argv_ptr, g_strdup("support"));
     g_ptr_array_add(argv_ptr, NULL);
@@ -72,130 +333,8 @@ backup_support_option(
     }
     while((line = pgets(streamout)) != NULL) {
 	dbprintf(_("support line: %s\n"), line);
-	if (g_str_has_prefix(line, "CONFIG ")) {
-	    if (g_str_equal(line + 7, "YES"))
-		bsu->config = 1;
-	} else if (g_str_has_prefix(line, "HOST ")) {
-	    if (g_str_equal(line + 5, "YES"))
-	    bsu->host = 1;
-	} else if (g_str_has_prefix(line, "DISK ")) {
-	    if (g_str_equal(line + 5, "YES"))
-		bsu->disk = 1;
-	} else if (g_str_has_prefix(line, "INDEX-LINE ")) {
-	    if (g_str_equal(line + 11, "YES"))
-		bsu->index_line = 1;
-	} else if (g_str_has_prefix(line, "INDEX-XML ")) {
-	    if (g_str_equal(line + 10, "YES"))
-		bsu->index_xml = 1;
-	} else if (g_str_has_prefix(line, "MESSAGE-LINE ")) {
-	    if (g_str_equal(line + 13, "YES"))
-		bsu->message_line = 1;
-	} else if (g_str_has_prefix(line, "MESSAGE-SELFCHECK-JSON ")) {
-	    if (g_str_equal(line + 23, "YES"))
-		bsu->message_selfcheck_json = 1;
-	} else if (g_str_has_prefix(line, "MESSAGE-ESTIMATE-JSON ")) {
-	    if (g_str_equal(line + 22, "YES"))
-		bsu->message_estimate_json = 1;
-	} else if (g_str_has_prefix(line, "MESSAGE-BACKUP-JSON ")) {
-	    if (g_str_equal(line + 20, "YES"))
-		bsu->message_backup_json = 1;
-	} else if (g_str_has_prefix(line, "MESSAGE-RESTORE-JSON ")) {
-	    if (g_str_equal(line + 21, "YES"))
-		bsu->message_restore_json = 1;
-	} else if (g_str_has_prefix(line, "MESSAGE-VALIDATE-JSON ")) {
-	    if (g_str_equal(line + 22, "YES"))
-		bsu->message_validate_json = 1;
-	} else if (g_str_has_prefix(line, "MESSAGE-INDEX-JSON ")) {
-	    if (g_str_equal(line + 19, "YES"))
-		bsu->message_index_json = 1;
-	} else if (g_str_has_prefix(line, "MESSAGE-XML ")) {
-	    if (g_str_equal(line + 12, "YES"))
-		bsu->message_xml = 1;
-	} else if (g_str_has_prefix(line, "RECORD ")) {
-	    if (g_str_equal(line + 7, "YES"))
-		bsu->record = 1;
-	} else if (g_str_has_prefix(line, "INCLUDE-FILE ")) {
-	    if (g_str_equal(line + 13, "YES"))
-		bsu->include_file = 1;
-	} else if (g_str_has_prefix(line, "INCLUDE-LIST ")) {
-	    if (g_str_equal(line + 13, "YES"))
-		bsu->include_list = 1;
-	} else if (g_str_has_prefix(line, "INCLUDE-LIST-GLOB ")) {
-	    if (g_str_equal(line + 17, "YES"))
-		bsu->include_list_glob = 1;
-	} else if (g_str_has_prefix(line, "INCLUDE-OPTIONAL ")) {
-	    if (g_str_equal(line + 17, "YES"))
-		bsu->include_optional = 1;
-	} else if (g_str_has_prefix(line, "EXCLUDE-FILE ")) {
-	    if (g_str_equal(line + 13, "YES"))
-		bsu->exclude_file = 1;
-	} else if (g_str_has_prefix(line, "EXCLUDE-LIST ")) {
-	    if (g_str_equal(line + 13, "YES"))
-		bsu->exclude_list = 1;
-	} else if (g_str_has_prefix(line, "EXCLUDE-LIST-GLOB ")) {
-	    if (g_str_equal(line + 17, "YES"))
-		bsu->exclude_list_glob = 1;
-	} else if (g_str_has_prefix(line, "EXCLUDE-OPTIONAL ")) {
-	    if (g_str_equal(line + 17, "YES"))
-		bsu->exclude_optional = 1;
-	} else if (g_str_has_prefix(line, "COLLECTION ")) {
-	    if (g_str_equal(line + 11, "YES"))
-		bsu->collection = 1;
-	} else if (g_str_has_prefix(line, "CALCSIZE ")) {
-	    if (g_str_equal(line + 9, "YES"))
-		bsu->calcsize = 1;
-	} else if (g_str_has_prefix(line, "CLIENT-ESTIMATE ")) {
-	    if (g_str_equal(line + 16, "YES"))
-		bsu->client_estimate = 1;
-	} else if (g_str_has_prefix(line, "MULTI-ESTIMATE ")) {
-	    if (g_str_equal(line + 15, "YES"))
-		bsu->multi_estimate = 1;
-	} else if (g_str_has_prefix(line, "MAX-LEVEL ")) {
-	    bsu->max_level  = atoi(line+10);
-	} else if (g_str_has_prefix(line, "RECOVER-MODE ")) {
-	    if (strcasecmp(line+13, "SMB") == 0)
-		bsu->smb_recover_mode = 1;
-	} else if (g_str_has_prefix(line, "DATA-PATH ")) {
-	    if (strcasecmp(line+10, "AMANDA") == 0)
-		bsu->data_path_set |= DATA_PATH_AMANDA;
-	    else if (strcasecmp(line+10, "DIRECTTCP") == 0)
-		bsu->data_path_set |= DATA_PATH_DIRECTTCP;
-	} else if (g_str_has_prefix(line, "RECOVER-PATH ")) {
-	    if (strcasecmp(line+13, "CWD") == 0)
-		bsu->recover_path = RECOVER_PATH_CWD;
-	    else if (strcasecmp(line+13, "REMOTE") == 0)
-		bsu->recover_path = RECOVER_PATH_REMOTE;
-	} else if (g_str_has_prefix(line, "AMFEATURES ")) {
-	    if (g_str_equal(line + 11, "YES"))
-		bsu->features = 1;
-	} else if (g_str_has_prefix(line, "RECOVER-DUMP-STATE-FILE ")) {
-	    if (g_str_equal(line + 24, "YES"))
-		bsu->recover_dump_state_file = 1;
-	} else if (g_str_has_prefix(line, "DISCOVER ")) {
-	    if (g_str_equal(line + 9, "YES"))
-		bsu->discover = 1;
-	} else if (g_str_has_prefix(line, "DAR ")) {
-	    if (g_str_equal(line + 4, "YES"))
-		bsu->dar = 1;
-	} else if (g_str_has_prefix(line, "STATE-STREAM ")) {
-	    if (g_str_equal(line + 13, "YES"))
-		bsu->state_stream = 1;
-	} else if (g_str_has_prefix(line, "TIMESTAMP ")) {
-	    if (g_str_equal(line + 10, "YES"))
-		bsu->timestamp = 1;
-	} else if (g_str_has_prefix(line, "EXECUTE-WHERE ")) {
-	    if (g_str_equal(line + 14, "YES"))
-		bsu->execute_where = 1;
-	} else if (g_str_has_prefix(line, "CMD-STREAM ")) {
-	    if (g_str_equal(line + 11, "YES"))
-		bsu->cmd_stream = 1;
-	} else if (g_str_has_prefix(line, "WANT-SERVER-BACKUP-RESULT ")) {
-	    if (g_str_equal(line + 26, "YES"))
-		bsu->want_server_backup_result = 1;
-	} else {
-	    dbprintf(_("Invalid support line: %s\n"), line);
-	}
-	amfree(line);
+	parse_support_line(bsu, line);
+	g_ptr_array_add(lines, line);
     }
     fclose(streamout);
 
@@ -238,6 +377,12 @@ backup_support_option(
 	dbprintf("Application '%s': %s\n", program, err);
 	amfree(bsu);
     }
+
+    /* the answers of a failed support are not cached */
+    if (bsu && header)
+	support_cache_write(program, header, lines, bsu);
+    g_free(header);
+    g_ptr_array_free_full(lines);
     g_ptr_array_free_full(argv_ptr);
     amfree(cmd);
     return bsu;
@@ -74,6 +74,7 @@ typedef struct backup_support_option_s {
     int execute_where;
     int cmd_stream;
     int want_server_backup_result;
+    int resume;
 } backup_support_option_t;
 
 backup_support_option_t *backup_support_option(char       *program,
@@ -125,6 +125,7 @@ static int newhandle = 0;
  */
 static void	stream_read_callback(void *);
 static void	stream_read_sync_callback(void *);
+static char *	bsd_stream_databuf(struct sec_stream *);
 
 /*
  * Setup and return a handle outgoing to a client
@@ -488,7 +489,7 @@ bsd_stream_client(
     struct sec_stream *bs = NULL;
     struct sec_handle *bh = h;
 #ifdef DUMPER_SOCKET_BUFFERING
-    int rcvbuf = sizeof(bs->databuf) * 2;
+    int rcvbuf = NETWORK_BLOCK_BYTES * 2;
 #endif
     char *stream_msg = NULL;
 
@@ -537,6 +538,7 @@ bsd_stream_close(
     if (bs->socket != -1)
 	aclose(bs->socket);
     bsd_stream_read_cancel(bs);
+    amfree(bs->databuf);
     amfree(bs);
 }
 
@@ -559,6 +561,7 @@ bsd_stream_close_async(
 	aclose(bs->socket);
     bsd_stream_read_cancel(bs);
     (*fn)(arg, 0, NULL, 0);
+    amfree(bs->databuf);
     amfree(bs);
 }
 
@@ -644,6 +647,17 @@ bsd_stream_read_sync(
     return (sync_pktlen);
 }
 
+/*
+ * The buffer of a stream, of its block size, allocated on the first read
+ */
+static char *
+bsd_stream_databuf(
+    struct sec_stream *	bs)
+{
+    if (!bs->databuf)
+	bs->databuf = g_malloc(bs->secstr.block_size);
+    return bs->databuf;
+}
 
 /*
  * Callback for bsd_stream_read_sync
@@ -664,7 +678,7 @@ stream_read_sync_callback(
      */
     bsd_stream_read_cancel(bs);
     do {
-	n = read(bs->fd, bs->databuf, sizeof(bs->databuf));
+	n = read(bs->fd, bsd_stream_databuf(bs), bs->secstr.block_size);
     } while ((n < 0) && ((errno == EINTR) || (errno == EAGAIN)));
     if (n < 0)
         security_stream_seterror(&bs->secstr, "%s", strerror(errno));
@@ -695,10 +709,11 @@ bsd_stream_read_to_shm_ring_callback(
     assert(bs != NULL);
 
     if (!bs->ring_init) {
-	shm_ring_producer_set_size(bs->shm_ring, NETWORK_BLOCK_BYTES*8, NETWORK_BLOCK_BYTES);
+	shm_ring_producer_set_size(bs->shm_ring, bs->secstr.block_size*8,
+				   bs->secstr.block_size);
 	bs->ring_init = TRUE;
     }
-    to_read = NETWORK_BLOCK_BYTES;
+    to_read = bs->secstr.block_size;
     write_offset = bs->shm_ring->mc->write_offset;
     written = bs->shm_ring->mc->written;
     shm_ring_size = bs->shm_ring->mc->ring_size;
@@ -888,7 +903,7 @@ stream_read_callback(
     assert(bs != NULL);
 
     do {
-	n = read(bs->fd, bs->databuf, sizeof(bs->databuf));
+	n = read(bs->fd, bsd_stream_databuf(bs), bs->secstr.block_size);
     } while ((n < 0) && ((errno == EINTR) || (errno == EAGAIN)));
 
     if (n <= 0)
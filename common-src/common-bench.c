@@ -0,0 +1,627 @@
+/*
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+/*
+ * common-bench -- time the libamanda functions that show up in profiles
+ *
+ * Each benchmark runs its function in batches, doubling the batch until it
+ * takes at least --time seconds, and reports the time per call and, for the
+ * functions that consume a buffer, the throughput.  Run it with 'make bench',
+ * which writes common-bench.json; it is not part of 'make check'.
+ */
+
+#include "amanda.h"
+#include "amutil.h"
+#include "amcrc32chw.h"
+#include "match.h"
+#include "fileheader.h"
+#include "amxml.h"
+#include "conffile.h"
+#include "simpleprng.h"
+#include "timestamp.h"
+#include "getopt.h"
+
+typedef void (*bench_fn_t)(gpointer data, guint64 iterations);
+
+typedef struct bench_result_s {
+    char *name;
+    gsize bytes;		/* bytes consumed per call, or 0 */
+    guint64 iterations;
+    double seconds;
+} bench_result_t;
+
+static double min_time = 0.5;
+static char *filter = NULL;
+static GPtrArray *results;
+
+/* keeps the compiler from dropping calls whose result is not used */
+static volatile guint64 sink;
+
+static void
+run_bench(
+    const char *name,
+    gsize bytes,
+    bench_fn_t fn,
+    gpointer data)
+{
+    bench_result_t *result;
+    GTimer *timer;
+    guint64 iterations = 1;
+    double seconds;
+
+    if (filter && !strstr(name, filter))
+	return;
+
+    /* one untimed call to warm the caches */
+    fn(data, 1);
+
+    timer = g_timer_new();
+    while (1) {
+	g_timer_start(timer);
+	fn(data, iterations);
+	seconds = g_timer_elapsed(timer, NULL);
+	if (seconds >= min_time)
+	    break;
+	iterations *= 2;
+    }
+    g_timer_destroy(timer);
+
+    result = g_new0(bench_result_t, 1);
+    result->name = g_strdup(name);
+    result->bytes = bytes;
+    result->iterations = iterations;
+    result->seconds = seconds;
+    g_ptr_array_add(results, result);
+}
+
+/*
+ * crc32
+ */
+
+typedef struct crc_data_s {
+    uint8_t *buf;
+    size_t len;
+    crc32_function_t fn;
+} crc_data_t;
+
+static void
+bench_crc32(
+    gpointer data,
+    guint64 iterations)
+{
+    crc_data_t *d = data;
+    crc_t crc;
+
+    crc32_init(&crc);
+    while (iterations--)
+	d->fn(d->buf, d->len, &crc);
+    sink += crc32_finish(&crc);
+}
+
+static void
+crc32_benches(void)
+{
+    static const size_t sizes[] = { 64, 4096, 32768, 1024*1024, 0 };
+    struct {
+	const char *name;
+	crc32_function_t fn;
+	gboolean usable;
+    } kernels[] = {
+	{ "crc32_add_1byte", crc32_add_1byte, TRUE },
+	{ "crc32_add_16bytes", crc32_add_16bytes, TRUE },
+	{ "crc32_add", crc32_add, TRUE },
+#ifdef __SSE4_2__
+	{ "crc32c_add_hw", crc32c_add_hw, FALSE },
+#endif
+	{ NULL, NULL, FALSE }
+    }, *k;
+    simpleprng_state_t prng;
+    crc_data_t d;
+    const size_t *size;
+
+    make_crc_table();
+#ifdef __SSE4_2__
+    kernels[3].usable = have_sse42;
+#endif
+
+    d.buf = g_malloc(1024*1024);
+    simpleprng_seed(&prng, 0xcbc32);
+    simpleprng_fill_buffer(&prng, d.buf, 1024*1024);
+
+    for (k = kernels; k->name; k++) {
+	if (!k->usable)
+	    continue;
+	for (size = sizes; *size; size++) {
+	    char *name = g_strdup_printf("%s/%zu", k->name, *size);
+
+	    d.len = *size;
+	    d.fn = k->fn;
+	    run_bench(name, *size, bench_crc32, &d);
+	    g_free(name);
+	}
+    }
+    g_free(d.buf);
+}
+
+/*
+ * match
+ */
+
+typedef struct match_data_s {
+    int (*fn)(const char *glob, const char *str);
+    const char **pairs;		/* glob, string, ..., NULL */
+} match_data_t;
+
+static const char *disk_pairs[] = {
+    "/usr", "/usr",
+    "/usr/local", "/usr/local",
+    "=/home/users", "/home/users",
+    "usr", "/usr/local/share",
+    "/export/home*", "/export/home04",
+    "[a-z]:\\\\backup", "C:\\backup",
+    NULL
+};
+
+static const char *host_pairs[] = {
+    "localhost", "localhost",
+    "client01.example.com", "client01.example.com",
+    "client0?", "client07.example.com",
+    "*.example.com", "db03.eng.example.com",
+    "=db03.eng.example.com", "db03.eng.example.com",
+    "web", "web12.prod.example.com",
+    NULL
+};
+
+static const char *glob_pairs[] = {
+    "*.c", "conffile.c",
+    "amanda*", "amanda.conf",
+    "[a-m]*.h", "match.h",
+    "^/var/log/.*\\.gz$", "/var/log/messages.1.gz",
+    "a?c", "abc",
+    "*", "anything at all",
+    NULL
+};
+
+static void
+bench_match(
+    gpointer data,
+    guint64 iterations)
+{
+    match_data_t *d = data;
+    const char **p;
+
+    while (iterations--) {
+	for (p = d->pairs; *p; p += 2)
+	    sink += d->fn(p[0], p[1]);
+    }
+}
+
+static void
+match_benches(void)
+{
+    match_data_t d;
+
+    d.fn = match_disk;
+    d.pairs = disk_pairs;
+    run_bench("match_disk", 0, bench_match, &d);
+
+    d.fn = match_host;
+    d.pairs = host_pairs;
+    run_bench("match_host", 0, bench_match, &d);
+
+    d.fn = match_glob;
+    d.pairs = glob_pairs;
+    run_bench("match_glob", 0, bench_match, &d);
+}
+
+/*
+ * fileheader
+ */
+
+typedef struct header_data_s {
+    dumpfile_t hdr;
+    char *buf;
+    size_t size;
+} header_data_t;
+
+static void
+bench_build_header(
+    gpointer data,
+    guint64 iterations)
+{
+    header_data_t *d = data;
+
+    while (iterations--) {
+	size_t size = 0;
+	char *buf = build_header(&d->hdr, &size, DISK_BLOCK_BYTES);
+
+	sink += size;
+	g_free(buf);
+    }
+}
+
+static void
+bench_parse_file_header(
+    gpointer data,
+    guint64 iterations)
+{
+    header_data_t *d = data;
+
+    while (iterations--) {
+	dumpfile_t hdr;
+
+	parse_file_header(d->buf, &hdr, d->size);
+	sink += hdr.type;
+	dumpfile_free_data(&hdr);
+    }
+}
+
+static void
+fileheader_benches(void)
+{
+    header_data_t d;
+
+    fh_init(&d.hdr);
+    d.hdr.type = F_SPLIT_DUMPFILE;
+    strcpy(d.hdr.datestamp, "20161014030405");
+    strcpy(d.hdr.name, "client01.example.com");
+    strcpy(d.hdr.disk, "/export/home");
+    strcpy(d.hdr.program, "APPLICATION");
+    strcpy(d.hdr.application, "amgtar");
+    strcpy(d.hdr.srvcompprog, "/usr/bin/zstd");
+    strcpy(d.hdr.comp_suffix, ".zst");
+    strcpy(d.hdr.recover_cmd, "/usr/bin/zstd -dc |amgtar -f... -");
+    strcpy(d.hdr.uncompress_cmd, " /usr/bin/zstd -dc |");
+    d.hdr.compressed = 1;
+    d.hdr.dumplevel = 1;
+    d.hdr.partnum = 3;
+    d.hdr.totalparts = 12;
+    d.hdr.blocksize = 32768;
+    d.hdr.orig_size = 1024*1024*1024;
+    d.hdr.dle_str = g_strdup("<dle>\n  <program>APPLICATION</program>\n"
+			     "  <disk>/export/home</disk>\n</dle>\n");
+
+    d.size = 0;
+    d.buf = build_header(&d.hdr, &d.size, DISK_BLOCK_BYTES);
+
+    run_bench("build_header", 0, bench_build_header, &d);
+    run_bench("parse_file_header", 0, bench_parse_file_header, &d);
+
+    g_free(d.buf);
+    dumpfile_free_data(&d.hdr);
+}
+
+/*
+ * quoting
+ */
+
+static const char *quote_strs[] = {
+    "plain",
+    "/usr/local/share/doc",
+    "with space",
+    "C:\\Documents and Settings\\user",
+    "tab\there \"and\" quotes\n",
+    "",
+    NULL
+};
+
+static void
+bench_quote_string(
+    gpointer data,
+    guint64 iterations)
+{
+    const char **s;
+
+    (void)data;
+    while (iterations--) {
+	for (s = quote_strs; *s; s++) {
+	    char *q = quote_string(*s);
+
+	    sink += q[0];
+	    g_free(q);
+	}
+    }
+}
+
+static void
+bench_unquote_string(
+    gpointer data,
+    guint64 iterations)
+{
+    char **quoted = data;
+    char **q;
+
+    while (iterations--) {
+	for (q = quoted; *q; q++) {
+	    char *s = unquote_string(*q);
+
+	    sink += s[0];
+	    g_free(s);
+	}
+    }
+}
+
+static void
+quoting_benches(void)
+{
+    char *quoted[G_N_ELEMENTS(quote_strs)];
+    guint i;
+
+    for (i = 0; quote_strs[i]; i++)
+	quoted[i] = quote_string(quote_strs[i]);
+    quoted[i] = NULL;
+
+    run_bench("quote_string", 0, bench_quote_string, NULL);
+    run_bench("unquote_string", 0, bench_unquote_string, quoted);
+
+    for (i = 0; quoted[i]; i++)
+	g_free(quoted[i]);
+}
+
+/*
+ * amxml
+ */
+
+static void
+bench_amxml_parse(
+    gpointer data,
+    guint64 iterations)
+{
+    while (iterations--) {
+	char *errmsg = NULL;
+	dle_t *dle = amxml_parse_node_CHAR((char *)data, &errmsg);
+
+	if (errmsg)
+	    g_critical("amxml_parse_node_CHAR: %s", errmsg);
+	free_dle(dle);
+    }
+}
+
+static void
+amxml_benches(void)
+{
+    GString *xml = g_string_new("<dle>\n");
+    int i;
+
+    /* a DLE the size the planner sends for a big exclude list */
+    g_string_append(xml, "  <program>APPLICATION</program>\n"
+			 "  <disk>/export/home</disk>\n"
+			 "  <diskdevice>/export/home</diskdevice>\n"
+			 "  <level>0</level>\n"
+			 "  <level>1</level>\n"
+			 "  <auth>bsdtcp</auth>\n"
+			 "  <compress>FAST</compress>\n"
+			 "  <record>YES</record>\n"
+			 "  <index>YES</index>\n"
+			 "  <exclude>\n");
+    for (i = 0; i < 2000; i++)
+	g_string_append_printf(xml, "    <file>./user%04d/.cache</file>\n", i);
+    g_string_append(xml, "    <optional>YES</optional>\n"
+			 "  </exclude>\n"
+			 "  <backup-program>\n"
+			 "    <plugin>amgtar</plugin>\n");
+    for (i = 0; i < 200; i++)
+	g_string_append_printf(xml, "    <property>\n"
+				    "      <name>PROP%03d</name>\n"
+				    "      <value>value %d</value>\n"
+				    "    </property>\n", i, i);
+    g_string_append(xml, "  </backup-program>\n</dle>\n");
+
+    run_bench("amxml_parse_node_CHAR", xml->len, bench_amxml_parse, xml->str);
+    g_string_free(xml, TRUE);
+}
+
+/*
+ * conffile
+ */
+
+static void
+bench_config_init(
+    gpointer data,
+    guint64 iterations)
+{
+    (void)data;
+    while (iterations--) {
+	config_init(CONFIG_INIT_USE_CWD, NULL);
+	if (config_errors(NULL) >= CFGERR_ERRORS) {
+	    config_print_errors();
+	    g_critical("errors parsing the benchmark amanda.conf");
+	}
+    }
+}
+
+static void
+conffile_benches(
+    const char *dir)
+{
+    char *filename = g_strconcat(dir, "/amanda.conf", NULL);
+    FILE *conf = fopen(filename, "w");
+    struct stat st;
+    int i;
+
+    if (!conf) {
+	g_critical("Can't create '%s': %s", filename, strerror(errno));
+    }
+
+    /* a config the size of a big site: many dumptypes, each inheriting */
+    g_fprintf(conf, "org \"bench\"\n"
+		    "dumpcycle 7\n"
+		    "tapecycle 30\n"
+		    "runtapes 4\n"
+		    "tpchanger \"chg-disk:/amanda/vtapes\"\n"
+		    "labelstr \"^BENCH-[0-9]+$\"\n"
+		    "define dumptype global {\n"
+		    "    auth \"bsdtcp\"\n"
+		    "    index yes\n"
+		    "}\n");
+    for (i = 0; i < 100; i++)
+	g_fprintf(conf, "define tapetype tape%03d {\n"
+			"    length %d gbytes\n"
+			"    filemark 4 kbytes\n"
+			"    blocksize 256 kbytes\n"
+			"}\n", i, 100 + i);
+    for (i = 0; i < 50; i++)
+	g_fprintf(conf, "define interface if%02d {\n"
+			"    use %d mbps\n"
+			"}\n", i, 10 * (i + 1));
+    for (i = 0; i < 100; i++)
+	g_fprintf(conf, "define application-tool app%03d {\n"
+			"    plugin \"amgtar\"\n"
+			"    property \"ATIME-PRESERVE\" \"NO\"\n"
+			"    property \"EXCLUDE-FILE\" \"./tmp%d\"\n"
+			"}\n", i, i);
+    for (i = 0; i < 1000; i++)
+	g_fprintf(conf, "define dumptype dt%04d {\n"
+			"    global\n"
+			"    comment \"dumptype %d\"\n"
+			"    program \"APPLICATION\"\n"
+			"    application \"app%03d\"\n"
+			"    compress client fast\n"
+			"    priority %s\n"
+			"    exclude list optional \".exclude%d\"\n"
+			"}\n", i, i, i % 100,
+			(i % 3 == 0)? "high" : "medium", i);
+    fclose(conf);
+
+    if (stat(filename, &st) < 0)
+	st.st_size = 0;
+    config_disable_cache();
+    run_bench("config_init", (gsize)st.st_size, bench_config_init, NULL);
+    config_uninit();
+
+    unlink(filename);
+    g_free(filename);
+}
+
+/*
+ * output
+ */
+
+static void
+print_text(void)
+{
+    guint i;
+
+    for (i = 0; i < results->len; i++) {
+	bench_result_t *r = g_ptr_array_index(results, i);
+	double ns = r->seconds * 1e9 / r->iterations;
+
+	g_printf("%-28s %12.1f ns/call", r->name, ns);
+	if (r->bytes)
+	    g_printf(" %10.1f MB/s",
+		     r->bytes * r->iterations / r->seconds / (1024*1024));
+	g_printf("\n");
+    }
+}
+
+static void
+print_json(void)
+{
+    char *timestamp = get_proper_stamp_from_time(time(NULL));
+    guint i;
+
+    g_printf("{\"version\": \"%s\", \"timestamp\": \"%s\", "
+	     "\"crc32_function\": \"%s\",\n \"results\": [\n",
+	     VERSION, timestamp, crc32_function_name);
+    for (i = 0; i < results->len; i++) {
+	bench_result_t *r = g_ptr_array_index(results, i);
+
+	g_printf("%s    {\"name\": \"%s\", \"iterations\": %ju, "
+		 "\"seconds\": %.6f, \"ns_per_call\": %.3f, \"mb_per_sec\": %.3f}",
+		 i? ",\n" : "", r->name, (uintmax_t)r->iterations, r->seconds,
+		 r->seconds * 1e9 / r->iterations,
+		 r->bytes? r->bytes * r->iterations / r->seconds / (1024*1024) : 0);
+    }
+    g_printf("\n ]}\n");
+    g_free(timestamp);
+}
+
+static struct option long_options[] = {
+    {"json"            , 0, NULL,  1},
+    {"time"            , 1, NULL,  2},
+    {"filter"          , 1, NULL,  3},
+    {NULL, 0, NULL, 0}
+};
+
+int
+main(
+    int argc,
+    char **argv)
+{
+    gboolean json = FALSE;
+    char *tmpdir;
+    guint i;
+    int opt;
+
+    glib_init();
+    set_pname("common-bench");
+
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != EOF) {
+	switch (opt) {
+	case 1:	json = TRUE;
+		break;
+	case 2:	min_time = g_ascii_strtod(optarg, NULL);
+		break;
+	case 3:	filter = optarg;
+		break;
+	default:
+		g_fprintf(stderr, "Usage: common-bench [--json] [--time SECONDS] "
+				  "[--filter SUBSTRING]\n");
+		return 1;
+	}
+    }
+    if (min_time <= 0)
+	min_time = 0.5;
+
+    /* config_init reads amanda.conf from the original directory, so move
+     * into a scratch directory before anything asks for it */
+    tmpdir = g_strdup_printf("%s/common-bench.%ld", g_get_tmp_dir(), (long)getpid());
+    if (mkdir(tmpdir, 0700) < 0 || chdir(tmpdir) < 0) {
+	g_fprintf(stderr, "Can't use '%s': %s\n", tmpdir, strerror(errno));
+	return 1;
+    }
+
+    results = g_ptr_array_new();
+
+    crc32_benches();
+    match_benches();
+    fileheader_benches();
+    quoting_benches();
+    amxml_benches();
+    conffile_benches(tmpdir);
+
+    if (json)
+	print_json();
+    else
+	print_text();
+
+    for (i = 0; i < results->len; i++) {
+	bench_result_t *r = g_ptr_array_index(results, i);
+	g_free(r->name);
+	g_free(r);
+    }
+    g_ptr_array_free(results, TRUE);
+
+    if (chdir("/") == 0)
+	rmdir(tmpdir);
+    g_free(tmpdir);
+    return 0;
+}
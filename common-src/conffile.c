@@ -36,6 +36,7 @@
 #include "amutil.h"
 #include "conffile.h"
 #include "clock.h"
+#include "amcompress.h"
 #include <glib.h>
 
 /*
@@ -64,7 +65,10 @@ typedef enum {
     CONF_CHANGERDEV,		CONF_CHANGERFILE,	CONF_LABELSTR,
     CONF_BUMPPERCENT,		CONF_BUMPSIZE,		CONF_BUMPDAYS,
     CONF_BUMPMULT,		CONF_ETIMEOUT,		CONF_DTIMEOUT,
-    CONF_CTIMEOUT,		CONF_TAPELIST,
+    CONF_CTIMEOUT,		CONF_TAPELIST,		CONF_ESTIMATE_PARALLEL,
+    CONF_CHECK_PARALLEL,	CONF_CHECK_CACHE_TIME,
+    CONF_STREAM_SCHEDULE,		CONF_HOLDING_IN_DUMPER,	CONF_AUTOTUNE,
+    CONF_SSH_CONTROL_PERSIST,
     CONF_DEVICE_OUTPUT_BUFFER_SIZE,
     CONF_DISKFILE,		CONF_INFOFILE,		CONF_LOGDIR,
     CONF_LOGFILE,		CONF_DISKDIR,		CONF_DISKSIZE,
@@ -102,7 +106,9 @@ typedef enum {
     /* storage setting */
     CONF_SET_NO_REUSE,	       CONF_ERASE_VOLUME,
     CONF_ERASE_ON_FAILURE,     CONF_COMPRESS_INDEX,	CONF_SORT_INDEX,
-    CONF_ERASE_ON_FULL,
+    CONF_INDEX_CACHE_DIR,      CONF_INDEX_CACHE_SIZE,	CONF_INFOFILE_FORMAT,
+    CONF_METRICS_DIR,          CONF_COMPRESS_CPU_BUDGET,	CONF_RESUME_DUMP,
+    CONF_ERASE_ON_FULL,        CONF_FIXITY_DIGEST,
 
     /* execute on */
     CONF_PRE_AMCHECK,          CONF_POST_AMCHECK,
@@ -139,7 +145,7 @@ typedef enum {
     CONF_CLNTCOMPPROG,		CONF_SRV_ENCRYPT,	CONF_CLNT_ENCRYPT,
     CONF_SRV_DECRYPT_OPT,	CONF_CLNT_DECRYPT_OPT,	CONF_AMANDAD_PATH,
     CONF_CLIENT_USERNAME,	CONF_CLIENT_PORT,	CONF_ALLOW_SPLIT,
-    CONF_MAX_WARNINGS,		CONF_TAG,
+    CONF_MAX_WARNINGS,		CONF_TAG,		CONF_CHANGE_TOKEN,
     CONF_SSL_FINGERPRINT_FILE,	CONF_SSL_CERT_FILE,	CONF_SSL_KEY_FILE,
     CONF_SSL_CA_CERT_FILE,	CONF_SSL_CIPHER_LIST,	CONF_SSL_CHECK_HOST,
     CONF_SSL_CHECK_CERTIFICATE_HOST,			CONF_SSL_DIR,
@@ -153,7 +159,8 @@ typedef enum {
     /* client conf */
     CONF_CONF,			CONF_INDEX_SERVER,	CONF_TAPE_SERVER,
     CONF_SSH_KEYS,		CONF_GNUTAR_LIST_DIR,	CONF_AMANDATES,
-    CONF_AMDUMP_SERVER,		CONF_HOSTNAME,
+    CONF_AMDUMP_SERVER,		CONF_HOSTNAME,		CONF_ESTIMATE_CACHE_TIME,
+    CONF_CALCSIZE_THREADS,	CONF_ZEROCOPY,		CONF_WIRE_COMPRESS,
 
     /* protocol config */
     CONF_REP_TRIES,		CONF_CONNECT_TRIES,	CONF_REQ_TRIES,
@@ -165,11 +172,12 @@ typedef enum {
     CONF_DEBUG_HOLDING,		CONF_DEBUG_PROTOCOL,	CONF_DEBUG_PLANNER,
     CONF_DEBUG_DRIVER,		CONF_DEBUG_DUMPER,	CONF_DEBUG_CHUNKER,
     CONF_DEBUG_TAPER,		CONF_DEBUG_SELFCHECK,	CONF_DEBUG_SENDSIZE,
-    CONF_DEBUG_SENDBACKUP,	CONF_DEBUG_RECOVERY,
+    CONF_DEBUG_SENDBACKUP,	CONF_DEBUG_RECOVERY,	CONF_DEBUG_XFER,
+    CONF_DEBUG_SHM,
 
     /* network interface */
     /* COMMENT, */		/* USE, */
-    CONF_SRC_IP,
+    CONF_SRC_IP,		CONF_NUMA_NODE,		CONF_DUMP_SIZE_LIMIT,
 
     /* dump options (obsolete) */
     CONF_EXCLUDE_FILE,		CONF_EXCLUDE_LIST,
@@ -177,7 +185,8 @@ typedef enum {
     /* compress, estimate, encryption */
     CONF_NONE,			CONF_FAST,		CONF_BEST,
     CONF_SERVER,		CONF_CLIENT,		CONF_CALCSIZE,
-    CONF_CUSTOM,
+    CONF_CUSTOM,		CONF_DEFERRED,		CONF_ZSTD,
+    CONF_LZ4,
 
     /* autolabel */
     CONF_AUTOLABEL,		CONF_ANY_VOLUME,	CONF_OTHER_CONFIG,
@@ -446,6 +455,9 @@ struct catalog_s {
 static conf_var_t *parsetable = NULL;
 static gboolean generate_errors = TRUE;
 
+/* the next value returned by anonymous_value */
+static int anonymous_count = 1;
+
 /* Read and parse a configuration file, recursively reading any included
  * files.  This function sets the keytable and parsetable appropriately
  * according to is_client.
@@ -686,6 +698,7 @@ static void validate_name(tok_t  token, val_t *val);
 static void validate_no_space_dquote(conf_var_t *, val_t *);
 static void validate_nonnegative(conf_var_t *, val_t *);
 static void validate_non_zero(conf_var_t *, val_t *);
+static void validate_numa_node(conf_var_t *, val_t *);
 static void validate_positive(conf_var_t *, val_t *);
 static void validate_runspercycle(conf_var_t *, val_t *);
 static void validate_bumppercent(conf_var_t *, val_t *);
@@ -700,9 +713,11 @@ static void validate_port_range(val_t *, int, int);
 static void validate_reserved_port_range(conf_var_t *, val_t *);
 static void validate_unreserved_port_range(conf_var_t *, val_t *);
 static void validate_program(conf_var_t *, val_t *);
+static void validate_infofile_format(conf_var_t *, val_t *);
 static void validate_dump_limit(conf_var_t *, val_t *);
 static void validate_columnspec(conf_var_t *, val_t *);
 static void validate_tmpdir(conf_var_t *, val_t *);
+static void validate_wire_compress(conf_var_t *, val_t *);
 static void validate_deprecated_changerfile(conf_var_t *, val_t *);
 
 gint compare_pp_script_order(gconstpointer a, gconstpointer b);
@@ -779,6 +794,8 @@ int debug_taper      = 0;
 int debug_selfcheck  = 0;
 int debug_sendsize   = 0;
 int debug_sendbackup = 0;
+int debug_xfer       = 0;
+int debug_shm        = 0;
 
 /* Reset all configuration values to their defaults (which, in many
  * cases, come from --with-foo options at build time) */
@@ -795,6 +812,17 @@ static void update_derived_values(gboolean is_client);
 static cfgerr_level_t apply_config_overrides(config_overrides_t *co,
 					     char *key_ovr);
 
+/* Free the values and subsections, leaving conf_data to be reinitialized */
+static void free_config_data(void);
+
+/* The compiled configuration cache, see below config_uninit */
+static void add_conf_source(char *filename, FILE *file);
+static void free_conf_sources(void);
+static gboolean conf_cache_usable(config_init_flags flags);
+static GString *conf_cache_key(config_init_flags flags);
+static gboolean load_conf_cache(GString *key);
+static void save_conf_cache(GString *key);
+
 /* per-type conf_init functions, used as utilities for init_defaults
  * and for each subsection's init_foo_defaults.
  *
@@ -917,6 +945,7 @@ keytab_t client_keytab[] = {
     { "APPLICATION", CONF_APPLICATION },
     { "APPLICATION_TOOL", CONF_APPLICATION_TOOL },
     { "AUTH", CONF_AUTH },
+    { "CALCSIZE_THREADS", CONF_CALCSIZE_THREADS },
     { "CLIENT", CONF_CLIENT },
     { "CLIENT_NAME", CONF_CLIENT_NAME },
     { "CLIENT_USERNAME", CONF_CLIENT_USERNAME },
@@ -942,8 +971,11 @@ keytab_t client_keytab[] = {
     { "DEBUG_SELFCHECK", CONF_DEBUG_SELFCHECK },
     { "DEBUG_SENDBACKUP", CONF_DEBUG_SENDBACKUP },
     { "DEBUG_SENDSIZE", CONF_DEBUG_SENDSIZE },
+    { "DEBUG_SHM", CONF_DEBUG_SHM },
     { "DEBUG_TAPER", CONF_DEBUG_TAPER },
+    { "DEBUG_XFER", CONF_DEBUG_XFER },
     { "DEFINE", CONF_DEFINE },
+    { "ESTIMATE_CACHE_TIME", CONF_ESTIMATE_CACHE_TIME },
     { "EXECUTE_ON", CONF_EXECUTE_ON },
     { "EXECUTE_WHERE", CONF_EXECUTE_WHERE },
     { "GNUTAR_LIST_DIR", CONF_GNUTAR_LIST_DIR },
@@ -1002,6 +1034,8 @@ keytab_t client_keytab[] = {
     { "TAPEDEV", CONF_TAPEDEV },
     { "UNRESERVED_TCP_PORT", CONF_UNRESERVED_TCP_PORT },
     { "VISIBLE", CONF_VISIBLE },
+    { "WIRE_COMPRESS", CONF_WIRE_COMPRESS },
+    { "ZEROCOPY", CONF_ZEROCOPY },
     { NULL, CONF_IDENT },
     { NULL, CONF_UNKNOWN }
 };
@@ -1022,6 +1056,7 @@ keytab_t server_keytab[] = {
     { "AUTO", CONF_AUTO },
     { "AUTOFLUSH", CONF_AUTOFLUSH },
     { "AUTOLABEL", CONF_AUTOLABEL },
+    { "AUTOTUNE", CONF_AUTOTUNE },
     { "APPLICATION", CONF_APPLICATION },
     { "APPLICATION_TOOL", CONF_APPLICATION_TOOL },
     { "BEST", CONF_BEST },
@@ -1032,9 +1067,12 @@ keytab_t server_keytab[] = {
     { "BUMPSIZE", CONF_BUMPSIZE },
     { "CALCSIZE", CONF_CALCSIZE },
     { "CATALOG", CONF_CATALOG },
+    { "CHANGE_TOKEN", CONF_CHANGE_TOKEN },
     { "CHANGER", CONF_CHANGER },
     { "CHANGERDEV", CONF_CHANGERDEV },
     { "CHANGERFILE", CONF_CHANGERFILE },
+    { "CHECK_CACHE_TIME", CONF_CHECK_CACHE_TIME },
+    { "CHECK_PARALLEL", CONF_CHECK_PARALLEL },
     { "CHUNKSIZE", CONF_CHUNKSIZE },
     { "CLIENT", CONF_CLIENT },
     { "CLIENT_CUSTOM_COMPRESS", CONF_CLNTCOMPPROG },
@@ -1048,6 +1086,7 @@ keytab_t server_keytab[] = {
     { "COMMENT", CONF_COMMENT },
     { "COMPRATE", CONF_COMPRATE },
     { "COMPRESS", CONF_COMPRESS },
+    { "COMPRESS_CPU_BUDGET", CONF_COMPRESS_CPU_BUDGET },
     { "COMPRESS_INDEX", CONF_COMPRESS_INDEX },
     { "CONNECT_TRIES", CONF_CONNECT_TRIES },
     { "CTIMEOUT", CONF_CTIMEOUT },
@@ -1071,6 +1110,9 @@ keytab_t server_keytab[] = {
     { "DEBUG_SELFCHECK"  , CONF_DEBUG_SELFCHECK },
     { "DEBUG_SENDSIZE"   , CONF_DEBUG_SENDSIZE },
     { "DEBUG_SENDBACKUP" , CONF_DEBUG_SENDBACKUP },
+    { "DEBUG_XFER"       , CONF_DEBUG_XFER },
+    { "DEBUG_SHM"        , CONF_DEBUG_SHM },
+    { "DEFERRED", CONF_DEFERRED },
     { "DEFINE", CONF_DEFINE },
     { "DEVICE", CONF_DEVICE },
     { "DEVICE_PROPERTY", CONF_DEVICE_PROPERTY },
@@ -1082,6 +1124,7 @@ keytab_t server_keytab[] = {
     { "DTIMEOUT", CONF_DTIMEOUT },
     { "DUMPCYCLE", CONF_DUMPCYCLE },
     { "DUMPORDER", CONF_DUMPORDER },
+    { "DUMP_SIZE_LIMIT", CONF_DUMP_SIZE_LIMIT },
     { "DUMPTYPE", CONF_DUMPTYPE },
     { "DUMPUSER", CONF_DUMPUSER },
     { "DUMP_LIMIT", CONF_DUMP_LIMIT },
@@ -1094,6 +1137,7 @@ keytab_t server_keytab[] = {
     { "ENCRYPT", CONF_ENCRYPT },
     { "ERROR", CONF_ERROR },
     { "ESTIMATE", CONF_ESTIMATE },
+    { "ESTIMATE_PARALLEL", CONF_ESTIMATE_PARALLEL },
     { "ETIMEOUT", CONF_ETIMEOUT },
     { "EXCLUDE", CONF_EXCLUDE },
     { "EXCLUDE_FILE", CONF_EXCLUDE_FILE },
@@ -1106,11 +1150,13 @@ keytab_t server_keytab[] = {
     { "FILEMARK", CONF_FILEMARK },
     { "FIRST", CONF_FIRST },
     { "FIRSTFIT", CONF_FIRSTFIT },
+    { "FIXITY_DIGEST", CONF_FIXITY_DIGEST },
     { "FULL", CONF_FULL },
     { "HANOI", CONF_HANOI },
     { "HIDDEN", CONF_HIDDEN },
     { "HIGH", CONF_HIGH },
     { "HOLDINGDISK", CONF_HOLDING },
+    { "HOLDING_IN_DUMPER", CONF_HOLDING_IN_DUMPER },
     { "IGNORE", CONF_IGNORE },
     { "INCLUDE", CONF_INCLUDE },
     { "INCLUDEFILE", CONF_INCLUDEFILE },
@@ -1118,7 +1164,10 @@ keytab_t server_keytab[] = {
     { "INCRONLY", CONF_INCRONLY },
     { "INDEX", CONF_INDEX },
     { "INDEXDIR", CONF_INDEXDIR },
+    { "INDEX_CACHE_DIR", CONF_INDEX_CACHE_DIR },
+    { "INDEX_CACHE_SIZE", CONF_INDEX_CACHE_SIZE },
     { "INFOFILE", CONF_INFOFILE },
+    { "INFOFILE_FORMAT", CONF_INFOFILE_FORMAT },
     { "INPARALLEL", CONF_INPARALLEL },
     { "INTERACTIVITY", CONF_INTERACTIVITY },
     { "INTERFACE", CONF_INTERFACE },
@@ -1135,6 +1184,7 @@ keytab_t server_keytab[] = {
     { "LIST", CONF_LIST },
     { "LOGDIR", CONF_LOGDIR },
     { "LOW", CONF_LOW },
+    { "LZ4", CONF_LZ4 },
     { "MAILER", CONF_MAILER },
     { "MAILTO", CONF_MAILTO },
     { "READBLOCKSIZE", CONF_READBLOCKSIZE },
@@ -1147,12 +1197,14 @@ keytab_t server_keytab[] = {
     { "MEMORY", CONF_MEMORY },
     { "MEDIUM", CONF_MEDIUM },
     { "META_AUTOLABEL", CONF_META_AUTOLABEL },
+    { "METRICS_DIR", CONF_METRICS_DIR },
     { "NETUSAGE", CONF_NETUSAGE },
     { "NEVER", CONF_NEVER },
     { "NOFULL", CONF_NOFULL },
     { "NOINC", CONF_NOINC },
     { "NONE", CONF_NONE },
     { "NON_AMANDA", CONF_NON_AMANDA },
+    { "NUMA_NODE", CONF_NUMA_NODE },
     { "OPTIONAL", CONF_OPTIONAL },
     { "ORDER", CONF_ORDER },
     { "ORG", CONF_ORG },
@@ -1203,6 +1255,7 @@ keytab_t server_keytab[] = {
     { "RESERVED_UDP_PORT", CONF_RESERVED_UDP_PORT },
     { "RESERVED_TCP_PORT", CONF_RESERVED_TCP_PORT },
     { "REST_API_PORT", CONF_REST_API_PORT },
+    { "RESUME_DUMP", CONF_RESUME_DUMP },
     { "REST_SSL_CERT", CONF_REST_SSL_CERT },
     { "REST_SSL_KEY", CONF_REST_SSL_KEY },
     { "RETRY_DUMP", CONF_RETRY_DUMP },
@@ -1230,6 +1283,7 @@ keytab_t server_keytab[] = {
     { "SPEED", CONF_SPEED },
     { "SPLIT_DISKBUFFER", CONF_SPLIT_DISKBUFFER },
     { "SRC_IP", CONF_SRC_IP },
+    { "SSH_CONTROL_PERSIST", CONF_SSH_CONTROL_PERSIST },
     { "SSH_KEYS", CONF_SSH_KEYS },
     { "SSL_CA_CERT_FILE", CONF_SSL_CA_CERT_FILE },
     { "SSL_CERT_FILE", CONF_SSL_CERT_FILE },
@@ -1246,6 +1300,7 @@ keytab_t server_keytab[] = {
     { "STORAGE", CONF_STORAGE },
     { "STRANGE", CONF_STRANGE },
     { "STRATEGY", CONF_STRATEGY },
+    { "STREAM_SCHEDULE", CONF_STREAM_SCHEDULE },
     { "DEVICE_OUTPUT_BUFFER_SIZE", CONF_DEVICE_OUTPUT_BUFFER_SIZE },
     { "TAG", CONF_TAG },
     { "TAPECYCLE", CONF_TAPECYCLE },
@@ -1268,6 +1323,7 @@ keytab_t server_keytab[] = {
     { "VAULT", CONF_VAULT },
     { "VISIBLE", CONF_VISIBLE },
     { "VOLUME_ERROR", CONF_VOLUME_ERROR },
+    { "ZSTD", CONF_ZSTD },
     { NULL, CONF_IDENT },
     { NULL, CONF_UNKNOWN }
 };
@@ -1378,6 +1434,10 @@ conf_var_t client_var [] = {
    { CONF_SSL_CHECK_CERTIFICATE_HOST, CONFTYPE_BOOLEAN, read_bool, CNF_SSL_CHECK_CERTIFICATE_HOST     , NULL },
    { CONF_GNUTAR_LIST_DIR    , CONFTYPE_STR     , read_str     , CNF_GNUTAR_LIST_DIR    , NULL },
    { CONF_AMANDATES          , CONFTYPE_STR     , read_str     , CNF_AMANDATES          , NULL },
+   { CONF_ESTIMATE_CACHE_TIME, CONFTYPE_INT     , read_int     , CNF_ESTIMATE_CACHE_TIME, validate_nonnegative },
+   { CONF_CALCSIZE_THREADS   , CONFTYPE_INT     , read_int     , CNF_CALCSIZE_THREADS   , validate_positive },
+   { CONF_ZEROCOPY           , CONFTYPE_BOOLEAN , read_bool    , CNF_ZEROCOPY           , NULL },
+   { CONF_WIRE_COMPRESS      , CONFTYPE_STR     , read_str     , CNF_WIRE_COMPRESS      , validate_wire_compress },
    { CONF_MAILER             , CONFTYPE_STR     , read_str     , CNF_MAILER             , NULL },
    { CONF_KRB5KEYTAB         , CONFTYPE_STR     , read_str     , CNF_KRB5KEYTAB         , NULL },
    { CONF_KRB5PRINCIPAL      , CONFTYPE_STR     , read_str     , CNF_KRB5PRINCIPAL      , NULL },
@@ -1402,6 +1462,8 @@ conf_var_t client_var [] = {
    { CONF_DEBUG_SELFCHECK    , CONFTYPE_INT     , read_int     , CNF_DEBUG_SELFCHECK    , validate_debug },
    { CONF_DEBUG_SENDSIZE     , CONFTYPE_INT     , read_int     , CNF_DEBUG_SENDSIZE     , validate_debug },
    { CONF_DEBUG_SENDBACKUP   , CONFTYPE_INT     , read_int     , CNF_DEBUG_SENDBACKUP   , validate_debug },
+   { CONF_DEBUG_XFER         , CONFTYPE_INT     , read_int     , CNF_DEBUG_XFER         , validate_debug },
+   { CONF_DEBUG_SHM          , CONFTYPE_INT     , read_int     , CNF_DEBUG_SHM          , validate_debug },
    { CONF_RESERVED_UDP_PORT  , CONFTYPE_INTRANGE, read_intrange, CNF_RESERVED_UDP_PORT  , validate_reserved_port_range },
    { CONF_RESERVED_TCP_PORT  , CONFTYPE_INTRANGE, read_intrange, CNF_RESERVED_TCP_PORT  , validate_reserved_port_range },
    { CONF_UNRESERVED_TCP_PORT, CONFTYPE_INTRANGE, read_intrange, CNF_UNRESERVED_TCP_PORT, validate_unreserved_port_range },
@@ -1446,8 +1508,15 @@ conf_var_t server_var [] = {
    { CONF_MAXDUMPS             , CONFTYPE_INT      , read_int         , CNF_MAXDUMPS             , validate_positive },
    { CONF_MAX_DLE_BY_VOLUME    , CONFTYPE_INT      , read_int         , CNF_MAX_DLE_BY_VOLUME    , validate_positive },
    { CONF_ETIMEOUT             , CONFTYPE_INT      , read_int         , CNF_ETIMEOUT             , validate_non_zero },
+   { CONF_ESTIMATE_PARALLEL    , CONFTYPE_INT      , read_int         , CNF_ESTIMATE_PARALLEL    , validate_nonnegative },
+   { CONF_STREAM_SCHEDULE      , CONFTYPE_BOOLEAN  , read_bool        , CNF_STREAM_SCHEDULE      , NULL },
+   { CONF_HOLDING_IN_DUMPER    , CONFTYPE_BOOLEAN  , read_bool        , CNF_HOLDING_IN_DUMPER    , NULL },
+   { CONF_AUTOTUNE             , CONFTYPE_BOOLEAN  , read_bool        , CNF_AUTOTUNE             , NULL },
    { CONF_DTIMEOUT             , CONFTYPE_INT      , read_int         , CNF_DTIMEOUT             , validate_positive },
    { CONF_CTIMEOUT             , CONFTYPE_INT      , read_int         , CNF_CTIMEOUT             , validate_positive },
+   { CONF_CHECK_PARALLEL       , CONFTYPE_INT      , read_int         , CNF_CHECK_PARALLEL       , validate_nonnegative },
+   { CONF_CHECK_CACHE_TIME     , CONFTYPE_INT      , read_int         , CNF_CHECK_CACHE_TIME     , validate_nonnegative },
+   { CONF_SSH_CONTROL_PERSIST  , CONFTYPE_INT      , read_int         , CNF_SSH_CONTROL_PERSIST  , validate_nonnegative },
    { CONF_DEVICE_OUTPUT_BUFFER_SIZE, CONFTYPE_SIZE , read_size        , CNF_DEVICE_OUTPUT_BUFFER_SIZE, NULL },
    { CONF_COLUMNSPEC           , CONFTYPE_STR      , read_str         , CNF_COLUMNSPEC           , validate_columnspec },
    { CONF_TAPERALGO            , CONFTYPE_TAPERALGO, read_taperalgo   , CNF_TAPERALGO            , NULL },
@@ -1492,6 +1561,8 @@ conf_var_t server_var [] = {
    { CONF_DEBUG_SELFCHECK      , CONFTYPE_INT      , read_int         , CNF_DEBUG_SELFCHECK      , validate_debug },
    { CONF_DEBUG_SENDSIZE       , CONFTYPE_INT      , read_int         , CNF_DEBUG_SENDSIZE       , validate_debug },
    { CONF_DEBUG_SENDBACKUP     , CONFTYPE_INT      , read_int         , CNF_DEBUG_SENDBACKUP     , validate_debug },
+   { CONF_DEBUG_XFER           , CONFTYPE_INT      , read_int         , CNF_DEBUG_XFER           , validate_debug },
+   { CONF_DEBUG_SHM            , CONFTYPE_INT      , read_int         , CNF_DEBUG_SHM            , validate_debug },
    { CONF_RESERVED_UDP_PORT    , CONFTYPE_INTRANGE , read_intrange    , CNF_RESERVED_UDP_PORT    , validate_reserved_port_range },
    { CONF_RESERVED_TCP_PORT    , CONFTYPE_INTRANGE , read_intrange    , CNF_RESERVED_TCP_PORT    , validate_reserved_port_range },
    { CONF_UNRESERVED_TCP_PORT  , CONFTYPE_INTRANGE , read_intrange    , CNF_UNRESERVED_TCP_PORT  , validate_unreserved_port_range },
@@ -1512,6 +1583,12 @@ conf_var_t server_var [] = {
    { CONF_SSL_DIR              , CONFTYPE_STR      , read_str         , CNF_SSL_DIR              , NULL },
    { CONF_COMPRESS_INDEX       , CONFTYPE_BOOLEAN  , read_bool        , CNF_COMPRESS_INDEX       , NULL },
    { CONF_SORT_INDEX           , CONFTYPE_BOOLEAN  , read_bool        , CNF_SORT_INDEX           , NULL },
+   { CONF_INDEX_CACHE_DIR      , CONFTYPE_STR      , read_str         , CNF_INDEX_CACHE_DIR      , NULL },
+   { CONF_INDEX_CACHE_SIZE     , CONFTYPE_INT64    , read_int64       , CNF_INDEX_CACHE_SIZE     , validate_nonnegative },
+   { CONF_INFOFILE_FORMAT      , CONFTYPE_STR      , read_str         , CNF_INFOFILE_FORMAT      , validate_infofile_format },
+   { CONF_METRICS_DIR          , CONFTYPE_STR      , read_str         , CNF_METRICS_DIR          , NULL },
+   { CONF_COMPRESS_CPU_BUDGET  , CONFTYPE_INT      , read_int         , CNF_COMPRESS_CPU_BUDGET  , validate_nonnegative },
+   { CONF_RESUME_DUMP          , CONFTYPE_INT      , read_int         , CNF_RESUME_DUMP          , validate_nonnegative },
    { CONF_UNKNOWN              , CONFTYPE_INT      , NULL             , CNF_CNF                  , NULL }
 };
 
@@ -1588,6 +1665,7 @@ conf_var_t dumptype_var [] = {
    { CONF_SSL_CHECK_HOST            , CONFTYPE_BOOLEAN     , read_bool        , DUMPTYPE_SSL_CHECK_HOST            , NULL },
    { CONF_SSL_CHECK_CERTIFICATE_HOST, CONFTYPE_BOOLEAN     , read_bool        , DUMPTYPE_SSL_CHECK_CERTIFICATE_HOST, NULL },
    { CONF_SSL_CHECK_FINGERPRINT     , CONFTYPE_BOOLEAN     , read_bool        , DUMPTYPE_SSL_CHECK_FINGERPRINT     , NULL },
+   { CONF_CHANGE_TOKEN              , CONFTYPE_BOOLEAN     , read_bool        , DUMPTYPE_CHANGE_TOKEN              , NULL },
    { CONF_UNKNOWN                   , CONFTYPE_INT         , NULL             , DUMPTYPE_DUMPTYPE                  , NULL }
 };
 
@@ -1596,6 +1674,9 @@ conf_var_t holding_var [] = {
    { CONF_COMMENT  , CONFTYPE_STR   , read_str   , HOLDING_COMMENT  , NULL },
    { CONF_USE      , CONFTYPE_INT64 , read_int64 , HOLDING_DISKSIZE , validate_use },
    { CONF_CHUNKSIZE, CONFTYPE_INT64 , read_int64 , HOLDING_CHUNKSIZE, validate_chunksize },
+   { CONF_NUMA_NODE, CONFTYPE_INT   , read_int   , HOLDING_NUMA_NODE, validate_numa_node },
+   { CONF_MEMORY   , CONFTYPE_BOOLEAN, read_bool , HOLDING_MEMORY   , NULL },
+   { CONF_DUMP_SIZE_LIMIT, CONFTYPE_INT64, read_int64, HOLDING_DUMP_SIZE_LIMIT, validate_nonnegative },
    { CONF_UNKNOWN  , CONFTYPE_INT   , NULL       , HOLDING_HOLDING  , NULL }
 };
 
@@ -1603,6 +1684,7 @@ conf_var_t interface_var [] = {
    { CONF_COMMENT, CONFTYPE_STR   , read_str   , INTER_COMMENT , NULL },
    { CONF_USE    , CONFTYPE_INT   , read_int   , INTER_MAXUSAGE, validate_positive },
    { CONF_SRC_IP , CONFTYPE_STR   , read_str   , INTER_SRC_IP  , NULL },
+   { CONF_NUMA_NODE, CONFTYPE_INT , read_int   , INTER_NUMA_NODE, validate_numa_node },
    { CONF_UNKNOWN, CONFTYPE_INT   , NULL       , INTER_INTER   , NULL }
 };
 
@@ -1697,6 +1779,7 @@ conf_var_t storage_var [] = {
    { CONF_DUMP_SELECTION           , CONFTYPE_DUMP_SELECTION, read_dump_selection, STORAGE_DUMP_SELECTION           , NULL },
    { CONF_ERASE_ON_FAILURE         , CONFTYPE_BOOLEAN       , read_bool          , STORAGE_ERASE_ON_FAILURE         , NULL },
    { CONF_ERASE_ON_FULL            , CONFTYPE_BOOLEAN       , read_bool          , STORAGE_ERASE_ON_FULL            , NULL },
+   { CONF_FIXITY_DIGEST            , CONFTYPE_BOOLEAN       , read_bool          , STORAGE_FIXITY_DIGEST            , NULL },
    { CONF_VAULT                    , CONFTYPE_VAULT_LIST    , read_vault_list    , STORAGE_VAULT_LIST               , NULL },
    { CONF_UNKNOWN                  , CONFTYPE_INT           , NULL               , STORAGE_STORAGE                  , NULL }
 };
@@ -2131,8 +2214,10 @@ read_conffile(
 	if (!missing_ok || errno != ENOENT)
 	    conf_parserror(_("could not open conf file '%s': %s"),
 		    current_filename, strerror(errno));
+	add_conf_source(current_filename, NULL);
 	goto finish;
     }
+    add_conf_source(current_filename, current_file);
     g_debug("reading config file %s", current_filename);
 
     current_line_num = 0;
@@ -2557,6 +2642,9 @@ init_holdingdisk_defaults(
     conf_init_int64(&hdcur.value[HOLDING_DISKSIZE] , CONF_UNIT_K, (gint64)0);
                     /* 1 Gb = 1M counted in 1Kb blocks */
     conf_init_int64(&hdcur.value[HOLDING_CHUNKSIZE], CONF_UNIT_K, (gint64)1024*1024);
+    conf_init_int(&hdcur.value[HOLDING_NUMA_NODE], CONF_UNIT_NONE, -1);
+    conf_init_bool(&hdcur.value[HOLDING_MEMORY], 0);
+    conf_init_int64(&hdcur.value[HOLDING_DUMP_SIZE_LIMIT], CONF_UNIT_K, (gint64)0);
 }
 
 static void
@@ -2736,6 +2824,7 @@ init_dumptype_defaults(void)
     conf_init_host_limit_server(&dpcur.value[DUMPTYPE_DUMP_LIMIT]);
     conf_init_int      (&dpcur.value[DUMPTYPE_RETRY_DUMP]        , CONF_UNIT_NONE, 2);
     conf_init_str_list (&dpcur.value[DUMPTYPE_TAG]               , NULL);
+    conf_init_bool     (&dpcur.value[DUMPTYPE_CHANGE_TOKEN]      , 0);
 }
 
 static void
@@ -2942,6 +3031,7 @@ init_interface_defaults(void)
     conf_init_str(&ifcur.value[INTER_COMMENT] , "");
     conf_init_int(&ifcur.value[INTER_MAXUSAGE], CONF_UNIT_K, 80000);
     conf_init_str(&ifcur.value[INTER_SRC_IP], "NULL");
+    conf_init_int(&ifcur.value[INTER_NUMA_NODE], CONF_UNIT_NONE, -1);
 }
 
 static void
@@ -3639,6 +3729,7 @@ init_storage_defaults(
     conf_init_dump_selection(&stcur.value[STORAGE_DUMP_SELECTION]);
     conf_init_bool          (&stcur.value[STORAGE_ERASE_ON_FAILURE]         , 0);
     conf_init_bool          (&stcur.value[STORAGE_ERASE_ON_FULL]            , 0);
+    conf_init_bool          (&stcur.value[STORAGE_FIXITY_DIGEST]            , 0);
     conf_init_vault_list    (&stcur.value[STORAGE_VAULT_LIST]);
 }
 
@@ -4448,13 +4539,14 @@ read_compress(
     conf_var_t *np G_GNUC_UNUSED,
     val_t *val)
 {
-    int serv, clie, none, fast, best, custom;
+    int serv, clie, none, fast, best, custom, autom, deferred, zstd, lz4;
     int done;
     comp_t comp;
 
     ckseen(&val->seen);
 
-    serv = clie = none = fast = best = custom  = 0;
+    serv = clie = none = fast = best = custom = autom = deferred = 0;
+    zstd = lz4 = 0;
 
     done = 0;
     do {
@@ -4466,6 +4558,10 @@ read_compress(
 	case CONF_CLIENT: clie = 1; break;
 	case CONF_SERVER: serv = 1; break;
 	case CONF_CUSTOM: custom=1; break;
+	case CONF_AUTO:   autom = 1; break;
+	case CONF_DEFERRED: deferred = 1; break;
+	case CONF_ZSTD:   zstd = 1; break;
+	case CONF_LZ4:    lz4 = 1; break;
 	case CONF_NL:     done = 1; break;
 	case CONF_END:    done = 1; break;
 	default:
@@ -4474,11 +4570,37 @@ read_compress(
 	}
     } while(!done);
 
+    comp = -1;
+
+    /* the server chooses the compression of each dump */
+    if (autom) {
+	if (!clie && none + fast + best + custom == 0)
+	    comp = COMP_SERVER_AUTO;
+	serv = clie = 1; /* skip the choices below */
+    }
+
+    /* the server compresses when the dump is flushed from holding disk */
+    if (deferred) {
+	if (!clie && !autom && none + fast + best + custom == 0)
+	    comp = COMP_SERVER_DEFERRED;
+	else
+	    comp = -1;
+	serv = clie = 1; /* skip the choices below */
+    }
+
+    /* the server compresses with the zstd or lz4 library */
+    if (zstd || lz4) {
+	if (!clie && !autom && !deferred && zstd + lz4 == 1 &&
+	    none + fast + best + custom == 0)
+	    comp = zstd ? COMP_SERVER_ZSTD : COMP_SERVER_LZ4;
+	else
+	    comp = -1;
+	serv = clie = 1; /* skip the choices below */
+    }
+
     if(serv + clie == 0) clie = 1;	/* default to client */
     if(none + fast + best + custom  == 0) fast = 1; /* default to fast */
 
-    comp = -1;
-
     if(!serv && clie) {
 	if(none && !fast && !best && !custom) comp = COMP_NONE;
 	if(!none && fast && !best && !custom) comp = COMP_FAST;
@@ -4494,7 +4616,7 @@ read_compress(
     }
 
     if((int)comp == -1) {
-	conf_parserror(_("NONE, CLIENT FAST, CLIENT BEST, CLIENT CUSTOM, SERVER FAST, SERVER BEST or SERVER CUSTOM expected"));
+	conf_parserror(_("NONE, CLIENT FAST, CLIENT BEST, CLIENT CUSTOM, SERVER FAST, SERVER BEST, SERVER CUSTOM, SERVER AUTO, SERVER DEFERRED, SERVER ZSTD or SERVER LZ4 expected"));
 	comp = COMP_NONE;
     }
 
@@ -5895,6 +6017,17 @@ validate_nonnegative(
     }
 }
 
+/* -1 for no placement, or a node number */
+static void
+validate_numa_node(
+    struct conf_var_s *np,
+    val_t        *val)
+{
+    if (val_t__int(val) < -1)
+	conf_parserror(_("%s must be -1 or a NUMA node number"),
+		       get_token_name(np->token));
+}
+
 static void
 validate_non_zero(
     struct conf_var_s *np,
@@ -6239,6 +6372,16 @@ static void validate_tmpdir(conf_var_t *var G_GNUC_UNUSED, val_t *value)
     }
 }
 
+static void validate_wire_compress(conf_var_t *var G_GNUC_UNUSED, val_t *value)
+{
+    gchar *name = val_t_to_str(value);
+    amcompress_algo_t algo;
+
+    if (*name && !amcompress_algo_from_name(name, &algo)) {
+	conf_parserror(_("wire-compress must be \"\", \"gzip\", \"zstd\" or \"lz4\""));
+    }
+}
+
 /* global changerfile deprecated in 3.4        */
 /* global changerfile must be removed in 3.4.5 */
 static void validate_deprecated_changerfile(conf_var_t *var G_GNUC_UNUSED,
@@ -6375,9 +6518,25 @@ config_init(
 	    config_filename = g_strconcat(config_dir, "/amanda.conf", NULL);
 	}
 
-	read_conffile(config_filename,
-		flags & CONFIG_INIT_CLIENT,
-		flags & (CONFIG_INIT_CLIENT|CONFIG_INIT_GLOBAL));
+	if (conf_cache_usable(flags)) {
+	    GString *key = conf_cache_key(flags);
+
+	    if (!load_conf_cache(key)) {
+		free_conf_sources();
+		read_conffile(config_filename,
+			flags & CONFIG_INIT_CLIENT,
+			flags & (CONFIG_INIT_CLIENT|CONFIG_INIT_GLOBAL));
+		if (cfgerr_level == CFGERR_OK && cfgerr_errors == NULL)
+		    save_conf_cache(key);
+	    }
+	    free_conf_sources();
+	    g_string_free(key, TRUE);
+	} else {
+	    read_conffile(config_filename,
+		    flags & CONFIG_INIT_CLIENT,
+		    flags & (CONFIG_INIT_CLIENT|CONFIG_INIT_GLOBAL));
+	    free_conf_sources();
+	}
     } else {
 	amfree(config_filename);
     }
@@ -6409,8 +6568,9 @@ config_init(
     return cfgerr_level;
 }
 
-void
-config_uninit(void)
+/* free the global parameters and the subsections */
+static void
+free_config_data(void)
 {
     GSList           *hp;
     holdingdisk_t    *hd;
@@ -6428,8 +6588,6 @@ config_uninit(void)
     storage_t        *st, *stnext;
     int               i;
 
-    if (!config_initialized) return;
-
     for(hp=holdinglist; hp != NULL; hp = hp->next) {
 	hd = hp->data;
 	amfree(hd->name);
@@ -6585,6 +6743,14 @@ config_uninit(void)
 
     for(i=0; i<CNF_CNF; i++)
 	free_val_t(&conf_data[i]);
+}
+
+void
+config_uninit(void)
+{
+    if (!config_initialized) return;
+
+    free_config_data();
 
     if (config_overrides) {
 	free_config_overrides(config_overrides);
@@ -6603,6 +6769,890 @@ config_uninit(void)
     config_clear_errors();
     config_initialized = FALSE;
 }
+/*
+ * Compiled configuration cache
+ *
+ * A configuration read without any error or warning is saved as an image of
+ * conf_data and of the subsection lists, in AMANDA_TMPDIR/confcache.XXXXXXXX.
+ * The next config_init of the same file, with the same flags, effective uid
+ * and config overrides, maps it instead of parsing the files again, if none
+ * of the files read changed.  The image is in native byte order and is only
+ * used by the same build of Amanda.
+ */
+
+#define CONF_CACHE_MAGIC "AMCONFC1"
+
+/* a file read by read_conffile during this config_init */
+typedef struct conf_source_s {
+    char     *filename;
+    gboolean  exists;
+    dev_t     dev;
+    ino_t     ino;
+    off_t     size;
+    time_t    mtime;
+    time_t    ctime;
+} conf_source_t;
+
+typedef struct conf_reader_s {
+    const char *p;
+    const char *end;
+    gboolean    error;
+} conf_reader_t;
+
+static GSList *conf_sources = NULL;
+static gboolean conf_cache_disabled = FALSE;
+
+static void
+free_conf_sources(void)
+{
+    GSList *iter;
+
+    for (iter = conf_sources; iter != NULL; iter = iter->next) {
+	conf_source_t *src = iter->data;
+	g_free(src->filename);
+	g_free(src);
+    }
+    g_slist_free(conf_sources);
+    conf_sources = NULL;
+}
+
+/* record the identity of a file opened by read_conffile (file == NULL if it
+ * does not exist) */
+static void
+add_conf_source(
+    char *filename,
+    FILE *file)
+{
+    conf_source_t *src = g_new0(conf_source_t, 1);
+    struct stat sb;
+
+    src->filename = g_strdup(filename);
+    if (file && fstat(fileno(file), &sb) == 0) {
+	src->exists = TRUE;
+	src->dev = sb.st_dev;
+	src->ino = sb.st_ino;
+	src->size = sb.st_size;
+	src->mtime = sb.st_mtime;
+	src->ctime = sb.st_ctime;
+    }
+    conf_sources = g_slist_append(conf_sources, src);
+}
+
+static void
+put_u32(
+    GString *buf,
+    guint32  u)
+{
+    g_string_append_len(buf, (char *)&u, sizeof(u));
+}
+
+static void
+put_i64(
+    GString *buf,
+    gint64   i)
+{
+    g_string_append_len(buf, (char *)&i, sizeof(i));
+}
+
+static void
+put_bytes(
+    GString    *buf,
+    const void *data,
+    gsize       len)
+{
+    g_string_append_len(buf, data, len);
+}
+
+static void
+put_str(
+    GString    *buf,
+    const char *str)
+{
+    if (!str) {
+	put_u32(buf, G_MAXUINT32);
+    } else {
+	put_u32(buf, strlen(str));
+	g_string_append(buf, str);
+    }
+}
+
+static void
+put_str_list(
+    GString *buf,
+    GSList  *list)
+{
+    put_u32(buf, g_slist_length(list));
+    for (; list != NULL; list = list->next)
+	put_str(buf, list->data);
+}
+
+static void
+put_sl(
+    GString *buf,
+    am_sl_t *sl)
+{
+    sle_t *sle;
+
+    if (!sl) {
+	put_u32(buf, G_MAXUINT32);
+	return;
+    }
+    put_u32(buf, sl->nb_element);
+    for (sle = sl->first; sle != NULL; sle = sle->next)
+	put_str(buf, sle->name);
+}
+
+static void
+put_seen(
+    GString *buf,
+    seen_t  *seen)
+{
+    put_str(buf, seen->block);
+    put_str(buf, seen->filename);
+    put_i64(buf, seen->linenum);
+}
+
+static void
+put_property_fn(
+    gpointer key_p,
+    gpointer value_p,
+    gpointer user_data_p)
+{
+    property_t *property = value_p;
+    GString *buf = user_data_p;
+
+    put_str(buf, key_p);
+    put_i64(buf, property->append);
+    put_i64(buf, property->visible);
+    put_i64(buf, property->priority);
+    put_str_list(buf, property->values);
+    put_seen(buf, &property->seen);
+}
+
+static void
+put_val(
+    GString *buf,
+    val_t   *val)
+{
+    GSList *iter;
+
+    put_u32(buf, val->type);
+    put_u32(buf, val->unit);
+    put_seen(buf, &val->seen);
+
+    switch (val->type) {
+	case CONFTYPE_INT:
+	case CONFTYPE_BOOLEAN:
+	case CONFTYPE_NO_YES_ALL:
+	case CONFTYPE_COMPRESS:
+	case CONFTYPE_ENCRYPT:
+	case CONFTYPE_HOLDING:
+	case CONFTYPE_EXECUTE_ON:
+	case CONFTYPE_EXECUTE_WHERE:
+	case CONFTYPE_SEND_AMREPORT_ON:
+	case CONFTYPE_DATA_PATH:
+	case CONFTYPE_STRATEGY:
+	case CONFTYPE_TAPERALGO:
+	case CONFTYPE_PRIORITY:
+	case CONFTYPE_PART_CACHE_TYPE:
+	    put_i64(buf, val->v.i);
+	    break;
+
+	case CONFTYPE_SIZE:
+	    put_i64(buf, val->v.size);
+	    break;
+
+	case CONFTYPE_INT64:
+	    put_i64(buf, val->v.int64);
+	    break;
+
+	case CONFTYPE_TIME:
+	    put_i64(buf, val->v.t);
+	    break;
+
+	case CONFTYPE_REAL:
+	    put_bytes(buf, &val->v.r, sizeof(val->v.r));
+	    break;
+
+	case CONFTYPE_RATE:
+	    put_bytes(buf, val->v.rate, sizeof(val->v.rate));
+	    break;
+
+	case CONFTYPE_INTRANGE:
+	    put_i64(buf, val->v.intrange[0]);
+	    put_i64(buf, val->v.intrange[1]);
+	    break;
+
+	case CONFTYPE_IDENT:
+	case CONFTYPE_STR:
+	case CONFTYPE_APPLICATION:
+	    put_str(buf, val->v.s);
+	    break;
+
+	case CONFTYPE_IDENTLIST:
+	case CONFTYPE_STR_LIST:
+	    put_str_list(buf, val->v.identlist);
+	    break;
+
+	case CONFTYPE_HOST_LIMIT:
+	    put_i64(buf, val->v.host_limit.server);
+	    put_i64(buf, val->v.host_limit.same_host);
+	    put_str_list(buf, val->v.host_limit.match_pats);
+	    break;
+
+	case CONFTYPE_ESTIMATELIST:
+	    put_u32(buf, g_slist_length(val->v.estimatelist));
+	    for (iter = val->v.estimatelist; iter != NULL; iter = iter->next)
+		put_i64(buf, GPOINTER_TO_INT(iter->data));
+	    break;
+
+	case CONFTYPE_EXINCLUDE:
+	    put_i64(buf, val->v.exinclude.optional);
+	    put_sl(buf, val->v.exinclude.sl_list);
+	    put_sl(buf, val->v.exinclude.sl_file);
+	    break;
+
+	case CONFTYPE_PROPLIST:
+	    if (!val->v.proplist) {
+		put_u32(buf, G_MAXUINT32);
+	    } else {
+		put_u32(buf, g_hash_table_size(val->v.proplist));
+		g_hash_table_foreach(val->v.proplist, put_property_fn, buf);
+	    }
+	    break;
+
+	case CONFTYPE_AUTOLABEL:
+	    put_str(buf, val->v.autolabel.template);
+	    put_i64(buf, val->v.autolabel.autolabel);
+	    break;
+
+	case CONFTYPE_LABELSTR:
+	    put_str(buf, val->v.labelstr.template);
+	    put_i64(buf, val->v.labelstr.match_autolabel);
+	    break;
+
+	case CONFTYPE_DUMP_SELECTION:
+	    put_u32(buf, g_slist_length(val->v.dump_selection));
+	    for (iter = val->v.dump_selection; iter != NULL; iter = iter->next) {
+		dump_selection_t *ds = iter->data;
+		put_u32(buf, ds->tag_type);
+		put_str(buf, ds->tag);
+		put_u32(buf, ds->level);
+	    }
+	    break;
+
+	case CONFTYPE_VAULT_LIST:
+	    put_u32(buf, g_slist_length(val->v.vault_list));
+	    for (iter = val->v.vault_list; iter != NULL; iter = iter->next) {
+		vault_el_t *ve = iter->data;
+		put_str(buf, ve->storage);
+		put_i64(buf, ve->days);
+	    }
+	    break;
+    }
+}
+
+static void
+put_conf_object(
+    GString *buf,
+    seen_t  *seen,
+    char    *name,
+    val_t   *value,
+    int      nvalues)
+{
+    int i;
+
+    put_seen(buf, seen);
+    put_str(buf, name);
+    for (i = 0; i < nvalues; i++)
+	put_val(buf, &value[i]);
+}
+
+static void
+get_bytes(
+    conf_reader_t *r,
+    void          *data,
+    gsize          len)
+{
+    if (r->error || (gsize)(r->end - r->p) < len) {
+	r->error = TRUE;
+	memset(data, 0, len);
+	return;
+    }
+    memcpy(data, r->p, len);
+    r->p += len;
+}
+
+static guint32
+get_u32(
+    conf_reader_t *r)
+{
+    guint32 u;
+
+    get_bytes(r, &u, sizeof(u));
+    return u;
+}
+
+static gint64
+get_i64(
+    conf_reader_t *r)
+{
+    gint64 i;
+
+    get_bytes(r, &i, sizeof(i));
+    return i;
+}
+
+/* a count of elements, each taking at least MIN_SIZE bytes */
+static guint32
+get_count(
+    conf_reader_t *r,
+    gsize          min_size)
+{
+    guint32 n = get_u32(r);
+
+    if (!r->error && (gsize)(r->end - r->p) / min_size < n)
+	r->error = TRUE;
+    return r->error ? 0 : n;
+}
+
+static char *
+get_str(
+    conf_reader_t *r)
+{
+    guint32 len = get_u32(r);
+    char *str;
+
+    if (r->error || len == G_MAXUINT32)
+	return NULL;
+    if ((gsize)(r->end - r->p) < len) {
+	r->error = TRUE;
+	return NULL;
+    }
+    str = g_strndup(r->p, len);
+    r->p += len;
+    return str;
+}
+
+static GSList *
+get_str_list(
+    conf_reader_t *r)
+{
+    GSList *list = NULL;
+    guint32 n = get_count(r, sizeof(guint32));
+
+    while (n-- > 0 && !r->error)
+	list = g_slist_prepend(list, get_str(r));
+    return g_slist_reverse(list);
+}
+
+static am_sl_t *
+get_sl(
+    conf_reader_t *r)
+{
+    am_sl_t *sl;
+    guint32 n = get_u32(r);
+
+    if (r->error || n == G_MAXUINT32)
+	return NULL;
+    if ((gsize)(r->end - r->p) / sizeof(guint32) < n) {
+	r->error = TRUE;
+	return NULL;
+    }
+    sl = new_sl();
+    while (n-- > 0 && !r->error) {
+	char *name = get_str(r);
+	sl = append_sl(sl, name);
+	g_free(name);
+    }
+    return sl;
+}
+
+/* the strings of a seen_t are shared, like the filenames of the parser */
+static void
+get_seen(
+    conf_reader_t *r,
+    seen_t        *seen)
+{
+    char *str;
+
+    str = get_str(r);
+    seen->block = str ? get_seen_filename(str) : NULL;
+    g_free(str);
+    str = get_str(r);
+    seen->filename = str ? get_seen_filename(str) : NULL;
+    g_free(str);
+    seen->linenum = get_i64(r);
+}
+
+/* The value is always left in a state free_val_t can handle */
+static void
+get_val(
+    conf_reader_t *r,
+    val_t         *val)
+{
+    guint32 n;
+
+    memset(val, 0, sizeof(*val));
+    val->type = get_u32(r);
+    val->unit = get_u32(r);
+    if (val->type > CONFTYPE_VAULT_LIST) {
+	val->type = CONFTYPE_INT;
+	r->error = TRUE;
+	return;
+    }
+    get_seen(r, &val->seen);
+
+    switch (val->type) {
+	case CONFTYPE_INT:
+	case CONFTYPE_BOOLEAN:
+	case CONFTYPE_NO_YES_ALL:
+	case CONFTYPE_COMPRESS:
+	case CONFTYPE_ENCRYPT:
+	case CONFTYPE_HOLDING:
+	case CONFTYPE_EXECUTE_ON:
+	case CONFTYPE_EXECUTE_WHERE:
+	case CONFTYPE_SEND_AMREPORT_ON:
+	case CONFTYPE_DATA_PATH:
+	case CONFTYPE_STRATEGY:
+	case CONFTYPE_TAPERALGO:
+	case CONFTYPE_PRIORITY:
+	case CONFTYPE_PART_CACHE_TYPE:
+	    val->v.i = get_i64(r);
+	    break;
+
+	case CONFTYPE_SIZE:
+	    val->v.size = get_i64(r);
+	    break;
+
+	case CONFTYPE_INT64:
+	    val->v.int64 = get_i64(r);
+	    break;
+
+	case CONFTYPE_TIME:
+	    val->v.t = get_i64(r);
+	    break;
+
+	case CONFTYPE_REAL:
+	    get_bytes(r, &val->v.r, sizeof(val->v.r));
+	    break;
+
+	case CONFTYPE_RATE:
+	    get_bytes(r, val->v.rate, sizeof(val->v.rate));
+	    break;
+
+	case CONFTYPE_INTRANGE:
+	    val->v.intrange[0] = get_i64(r);
+	    val->v.intrange[1] = get_i64(r);
+	    break;
+
+	case CONFTYPE_IDENT:
+	case CONFTYPE_STR:
+	case CONFTYPE_APPLICATION:
+	    val->v.s = get_str(r);
+	    break;
+
+	case CONFTYPE_IDENTLIST:
+	case CONFTYPE_STR_LIST:
+	    val->v.identlist = get_str_list(r);
+	    break;
+
+	case CONFTYPE_HOST_LIMIT:
+	    val->v.host_limit.server = get_i64(r);
+	    val->v.host_limit.same_host = get_i64(r);
+	    val->v.host_limit.match_pats = get_str_list(r);
+	    break;
+
+	case CONFTYPE_ESTIMATELIST:
+	    n = get_count(r, sizeof(gint64));
+	    while (n-- > 0 && !r->error) {
+		val->v.estimatelist = g_slist_append(val->v.estimatelist,
+					GINT_TO_POINTER((int)get_i64(r)));
+	    }
+	    break;
+
+	case CONFTYPE_EXINCLUDE:
+	    val->v.exinclude.optional = get_i64(r);
+	    val->v.exinclude.sl_list = get_sl(r);
+	    val->v.exinclude.sl_file = get_sl(r);
+	    break;
+
+	case CONFTYPE_PROPLIST:
+	    n = get_u32(r);
+	    if (r->error || n == G_MAXUINT32)
+		break;
+	    conf_init_proplist(val);
+	    while (n-- > 0 && !r->error) {
+		property_t *property = g_new0(property_t, 1);
+		char *key = get_str(r);
+
+		property->append = get_i64(r);
+		property->visible = get_i64(r);
+		property->priority = get_i64(r);
+		property->values = get_str_list(r);
+		get_seen(r, &property->seen);
+		if (!key) {
+		    r->error = TRUE;
+		    free_property_t(property);
+		    break;
+		}
+		g_hash_table_insert(val->v.proplist, key, property);
+	    }
+	    break;
+
+	case CONFTYPE_AUTOLABEL:
+	    val->v.autolabel.template = get_str(r);
+	    val->v.autolabel.autolabel = get_i64(r);
+	    break;
+
+	case CONFTYPE_LABELSTR:
+	    val->v.labelstr.template = get_str(r);
+	    val->v.labelstr.match_autolabel = get_i64(r);
+	    break;
+
+	case CONFTYPE_DUMP_SELECTION:
+	    n = get_count(r, 3 * sizeof(guint32));
+	    while (n-- > 0 && !r->error) {
+		dump_selection_t *ds = g_new0(dump_selection_t, 1);
+		ds->tag_type = get_u32(r);
+		ds->tag = get_str(r);
+		ds->level = get_u32(r);
+		val->v.dump_selection = g_slist_append(val->v.dump_selection,
+						       ds);
+	    }
+	    break;
+
+	case CONFTYPE_VAULT_LIST:
+	    n = get_count(r, sizeof(guint32) + sizeof(gint64));
+	    while (n-- > 0 && !r->error) {
+		vault_el_t *ve = g_new0(vault_el_t, 1);
+		ve->storage = get_str(r);
+		ve->days = get_i64(r);
+		val->v.vault_list = g_slist_append(val->v.vault_list, ve);
+	    }
+	    break;
+    }
+}
+
+static void
+get_conf_object(
+    conf_reader_t *r,
+    seen_t        *seen,
+    char         **name,
+    val_t         *value,
+    int            nvalues)
+{
+    char *str;
+    int i;
+
+    /* the block of a subsection is its own copy, see config_uninit */
+    seen->block = get_str(r);
+    str = get_str(r);
+    seen->filename = str ? get_seen_filename(str) : NULL;
+    g_free(str);
+    seen->linenum = get_i64(r);
+    *name = get_str(r);
+    for (i = 0; i < nvalues; i++)
+	get_val(r, &value[i]);
+    if (!*name)
+	r->error = TRUE;
+}
+
+/* the subsections of a list, in order */
+#define PUT_CONF_LIST(buf, type, list, nvalues) { \
+	type *p_; \
+	guint32 n_ = 0; \
+	for (p_ = (list); p_ != NULL; p_ = p_->next) \
+	    n_++; \
+	put_u32(buf, n_); \
+	for (p_ = (list); p_ != NULL; p_ = p_->next) \
+	    put_conf_object(buf, &p_->seen, p_->name, p_->value, nvalues); \
+    }
+
+/* each subsection is linked before it is read, so that free_config_data
+ * frees it on an error */
+#define GET_CONF_LIST(r, type, list, nvalues) { \
+	type **tail_ = &(list); \
+	guint32 n_ = get_count(r, sizeof(guint32)); \
+	while (n_-- > 0 && !(r)->error) { \
+	    type *p_ = g_new0(type, 1); \
+	    *tail_ = p_; \
+	    tail_ = &p_->next; \
+	    get_conf_object(r, &p_->seen, &p_->name, p_->value, nvalues); \
+	} \
+    }
+
+/* Everything the parse depends on, other than the files */
+static GString *
+conf_cache_key(
+    config_init_flags flags)
+{
+    GString *key = g_string_new(CONF_CACHE_MAGIC);
+    int i;
+
+    put_str(key, VERSION);
+    put_u32(key, sizeof(val_t));
+    put_u32(key, CONFTYPE_VAULT_LIST);
+    put_u32(key, CNF_CNF);
+    put_u32(key, HOLDING_HOLDING);
+    put_u32(key, DUMPTYPE_DUMPTYPE);
+    put_u32(key, TAPETYPE_TAPETYPE);
+    put_u32(key, INTER_INTER);
+    put_u32(key, APPLICATION_APPLICATION);
+    put_u32(key, PP_SCRIPT_PP_SCRIPT);
+    put_u32(key, DEVICE_CONFIG_DEVICE_CONFIG);
+    put_u32(key, CHANGER_CONFIG_CHANGER_CONFIG);
+    put_u32(key, INTERACTIVITY_INTERACTIVITY);
+    put_u32(key, TAPERSCAN_TAPERSCAN);
+    put_u32(key, CATALOG_CATALOG);
+    put_u32(key, POLICY_POLICY);
+    put_u32(key, STORAGE_STORAGE);
+    put_u32(key, flags & (CONFIG_INIT_CLIENT|CONFIG_INIT_GLOBAL));
+    /* validate_tmpdir checks the access of the user */
+    put_u32(key, geteuid());
+    put_str(key, config_filename);
+    if (config_overrides) {
+	put_u32(key, config_overrides->n_used);
+	for (i = 0; i < config_overrides->n_used; i++) {
+	    put_str(key, config_overrides->ovr[i].key);
+	    put_str(key, config_overrides->ovr[i].value);
+	}
+    } else {
+	put_u32(key, 0);
+    }
+    return key;
+}
+
+static char *
+conf_cache_filename(
+    GString *key)
+{
+    crc_t crc;
+
+    crc32_init(&crc);
+    crc32_add((uint8_t *)key->str, key->len, &crc);
+    return g_strdup_printf("%s/confcache.%08x", AMANDA_TMPDIR,
+			   crc32_finish(&crc));
+}
+
+static gboolean
+conf_cache_usable(
+    config_init_flags flags)
+{
+    return !conf_cache_disabled && !(flags & CONFIG_INIT_OVERLAY) &&
+	   getenv("AMANDA_NO_CONFIG_CACHE") == NULL;
+}
+
+void
+config_disable_cache(void)
+{
+    conf_cache_disabled = TRUE;
+}
+
+/* Save the configuration just read; called only if it has no error */
+static void
+save_conf_cache(
+    GString *key)
+{
+    GString *buf;
+    GSList  *iter;
+    char    *filename;
+    char    *tmpname;
+    time_t   now = time(NULL);
+    int      fd;
+    int      i;
+
+    for (iter = conf_sources; iter != NULL; iter = iter->next) {
+	conf_source_t *src = iter->data;
+
+	/* a change later in the same second would not be seen */
+	if (src->exists && (src->mtime >= now - 1 || src->ctime >= now - 1))
+	    return;
+    }
+
+    buf = g_string_sized_new(64*1024);
+    put_u32(buf, key->len);
+    put_bytes(buf, key->str, key->len);
+    put_u32(buf, g_slist_length(conf_sources));
+    for (iter = conf_sources; iter != NULL; iter = iter->next) {
+	conf_source_t *src = iter->data;
+
+	put_str(buf, src->filename);
+	put_u32(buf, src->exists);
+	put_i64(buf, src->dev);
+	put_i64(buf, src->ino);
+	put_i64(buf, src->size);
+	put_i64(buf, src->mtime);
+	put_i64(buf, src->ctime);
+    }
+    put_i64(buf, anonymous_count);
+
+    for (i = 0; i < CNF_CNF; i++)
+	put_val(buf, &conf_data[i]);
+    put_u32(buf, g_slist_length(holdinglist));
+    for (iter = holdinglist; iter != NULL; iter = iter->next) {
+	holdingdisk_t *hd = iter->data;
+	put_conf_object(buf, &hd->seen, hd->name, hd->value, HOLDING_HOLDING);
+    }
+    PUT_CONF_LIST(buf, dumptype_t, dumplist, DUMPTYPE_DUMPTYPE);
+    PUT_CONF_LIST(buf, tapetype_t, tapelist, TAPETYPE_TAPETYPE);
+    PUT_CONF_LIST(buf, interface_t, interface_list, INTER_INTER);
+    PUT_CONF_LIST(buf, application_t, application_list, APPLICATION_APPLICATION);
+    PUT_CONF_LIST(buf, pp_script_t, pp_script_list, PP_SCRIPT_PP_SCRIPT);
+    PUT_CONF_LIST(buf, device_config_t, device_config_list, DEVICE_CONFIG_DEVICE_CONFIG);
+    PUT_CONF_LIST(buf, changer_config_t, changer_config_list, CHANGER_CONFIG_CHANGER_CONFIG);
+    PUT_CONF_LIST(buf, interactivity_t, interactivity_list, INTERACTIVITY_INTERACTIVITY);
+    PUT_CONF_LIST(buf, taperscan_t, taperscan_list, TAPERSCAN_TAPERSCAN);
+    PUT_CONF_LIST(buf, catalog_t, catalog_list, CATALOG_CATALOG);
+    PUT_CONF_LIST(buf, policy_s, policy_list, POLICY_POLICY);
+    PUT_CONF_LIST(buf, storage_t, storage_list, STORAGE_STORAGE);
+
+    filename = conf_cache_filename(key);
+    tmpname = g_strdup_printf("%s.%ld.tmp", filename, (long)getpid());
+    fd = open(tmpname, O_WRONLY|O_CREAT|O_EXCL, 0600);
+    if (fd < 0 ||
+	full_write(fd, buf->str, buf->len) < buf->len ||
+	close(fd) != 0 ||
+	rename(tmpname, filename) != 0) {
+	g_debug("could not write config cache %s: %s", filename,
+		strerror(errno));
+	if (fd >= 0)
+	    unlink(tmpname);
+    }
+    g_free(tmpname);
+    g_free(filename);
+    g_string_free(buf, TRUE);
+}
+
+/* are the files still the ones the cache was made from? */
+static gboolean
+conf_cache_sources_valid(
+    conf_reader_t *r)
+{
+    guint32 n = get_count(r, 6 * sizeof(guint32));
+    gboolean valid = TRUE;
+
+    while (n-- > 0 && !r->error && valid) {
+	char    *filename = get_str(r);
+	gboolean exists = get_u32(r);
+	gint64   dev = get_i64(r);
+	gint64   ino = get_i64(r);
+	gint64   size = get_i64(r);
+	gint64   mtime = get_i64(r);
+	gint64   ctime = get_i64(r);
+	struct stat sb;
+
+	if (!filename || r->error) {
+	    valid = FALSE;
+	} else if (stat(filename, &sb) != 0) {
+	    valid = !exists && errno == ENOENT;
+	} else {
+	    valid = exists && (gint64)sb.st_dev == dev &&
+		    (gint64)sb.st_ino == ino && (gint64)sb.st_size == size &&
+		    (gint64)sb.st_mtime == mtime && (gint64)sb.st_ctime == ctime;
+	}
+	g_free(filename);
+    }
+    return valid && !r->error;
+}
+
+/* Replace the default configuration by the cached one.  On an error, the
+ * defaults are restored as config_init set them, and FALSE is returned */
+static gboolean
+load_conf_cache(
+    GString *key)
+{
+    char          *filename = conf_cache_filename(key);
+    struct stat    sb;
+    conf_reader_t  r;
+    char          *map;
+    int            fd;
+    int            i;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+	g_free(filename);
+	return FALSE;
+    }
+    /* only trust a cache written by this user */
+    if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode) ||
+	sb.st_uid != geteuid() || (sb.st_mode & (S_IWGRP|S_IWOTH)) ||
+	sb.st_size == 0 ||
+	(map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+	close(fd);
+	g_free(filename);
+	return FALSE;
+    }
+    close(fd);
+
+    r.p = map;
+    r.end = map + sb.st_size;
+    r.error = FALSE;
+    if (get_u32(&r) != key->len || r.error ||
+	(gsize)(r.end - r.p) < key->len ||
+	memcmp(r.p, key->str, key->len) != 0) {
+	munmap(map, sb.st_size);
+	g_free(filename);
+	return FALSE;
+    }
+    r.p += key->len;
+    if (!conf_cache_sources_valid(&r)) {
+	munmap(map, sb.st_size);
+	g_free(filename);
+	return FALSE;
+    }
+
+    anonymous_count = get_i64(&r);
+    free_config_data();
+    for (i = 0; i < CNF_CNF; i++)
+	get_val(&r, &conf_data[i]);
+    {
+	guint32 n = get_count(&r, sizeof(guint32));
+	while (n-- > 0 && !r.error) {
+	    holdingdisk_t *hd = g_new0(holdingdisk_t, 1);
+	    holdinglist = g_slist_append(holdinglist, hd);
+	    get_conf_object(&r, &hd->seen, &hd->name, hd->value,
+			    HOLDING_HOLDING);
+	}
+    }
+    GET_CONF_LIST(&r, dumptype_t, dumplist, DUMPTYPE_DUMPTYPE);
+    GET_CONF_LIST(&r, tapetype_t, tapelist, TAPETYPE_TAPETYPE);
+    GET_CONF_LIST(&r, interface_t, interface_list, INTER_INTER);
+    GET_CONF_LIST(&r, application_t, application_list, APPLICATION_APPLICATION);
+    GET_CONF_LIST(&r, pp_script_t, pp_script_list, PP_SCRIPT_PP_SCRIPT);
+    GET_CONF_LIST(&r, device_config_t, device_config_list, DEVICE_CONFIG_DEVICE_CONFIG);
+    GET_CONF_LIST(&r, changer_config_t, changer_config_list, CHANGER_CONFIG_CHANGER_CONFIG);
+    GET_CONF_LIST(&r, interactivity_t, interactivity_list, INTERACTIVITY_INTERACTIVITY);
+    GET_CONF_LIST(&r, taperscan_t, taperscan_list, TAPERSCAN_TAPERSCAN);
+    GET_CONF_LIST(&r, catalog_t, catalog_list, CATALOG_CATALOG);
+    GET_CONF_LIST(&r, policy_s, policy_list, POLICY_POLICY);
+    GET_CONF_LIST(&r, storage_t, storage_list, STORAGE_STORAGE);
+    munmap(map, sb.st_size);
+
+    if (r.error || r.p != r.end) {
+	g_debug("removing corrupt config cache %s", filename);
+	unlink(filename);
+	g_free(filename);
+
+	/* back to the state before read_conffile */
+	free_config_data();
+	config_initialized = FALSE;
+	init_defaults();
+	if (config_overrides) {
+	    for (i = 0; i < config_overrides->n_used; i++) {
+		config_overrides->ovr[i].applied = FALSE;
+	    }
+	}
+	generate_errors = FALSE;
+	apply_config_overrides(config_overrides, NULL);
+	generate_errors = TRUE;
+	return FALSE;
+    }
+
+    g_debug("read config file %s from %s", config_filename, filename);
+    g_free(filename);
+    return TRUE;
+}
 
 static void
 init_defaults(
@@ -6632,6 +7682,10 @@ init_defaults(
     conf_init_bool(&conf_data[CNF_SSL_CHECK_CERTIFICATE_HOST], 1);
     conf_init_str(&conf_data[CNF_GNUTAR_LIST_DIR], GNUTAR_LISTED_INCREMENTAL_DIR);
     conf_init_str(&conf_data[CNF_AMANDATES], DEFAULT_AMANDATES_FILE);
+    conf_init_int(&conf_data[CNF_ESTIMATE_CACHE_TIME], CONF_UNIT_NONE, 0);
+    conf_init_int(&conf_data[CNF_CALCSIZE_THREADS], CONF_UNIT_NONE, 1);
+    conf_init_bool(&conf_data[CNF_ZEROCOPY], 0);
+    conf_init_str(&conf_data[CNF_WIRE_COMPRESS], "");
     conf_init_str(&conf_data[CNF_MAILTO], "");
     conf_init_str(&conf_data[CNF_DUMPUSER], CLIENT_LOGIN);
     conf_init_str(&conf_data[CNF_TAPEDEV], DEFAULT_TAPE_DEVICE);
@@ -6661,8 +7715,15 @@ init_defaults(
     conf_init_int      (&conf_data[CNF_MAXDUMPS]             , CONF_UNIT_NONE, 1);
     conf_init_int      (&conf_data[CNF_MAX_DLE_BY_VOLUME]    , CONF_UNIT_NONE, 1000000000);
     conf_init_int      (&conf_data[CNF_ETIMEOUT]             , CONF_UNIT_NONE, 300);
+    conf_init_int      (&conf_data[CNF_ESTIMATE_PARALLEL]    , CONF_UNIT_NONE, 0);
+    conf_init_bool     (&conf_data[CNF_STREAM_SCHEDULE]      , 0);
+    conf_init_bool     (&conf_data[CNF_HOLDING_IN_DUMPER]    , 0);
+    conf_init_bool     (&conf_data[CNF_AUTOTUNE]             , 0);
     conf_init_int      (&conf_data[CNF_DTIMEOUT]             , CONF_UNIT_NONE, 1800);
     conf_init_int      (&conf_data[CNF_CTIMEOUT]             , CONF_UNIT_NONE, 30);
+    conf_init_int      (&conf_data[CNF_CHECK_PARALLEL]       , CONF_UNIT_NONE, 0);
+    conf_init_int      (&conf_data[CNF_CHECK_CACHE_TIME]     , CONF_UNIT_NONE, 0);
+    conf_init_int      (&conf_data[CNF_SSH_CONTROL_PERSIST]  , CONF_UNIT_NONE, 0);
     conf_init_size     (&conf_data[CNF_DEVICE_OUTPUT_BUFFER_SIZE], CONF_UNIT_NONE, 40*32768);
     conf_init_str   (&conf_data[CNF_PRINTER]              , "");
     conf_init_str   (&conf_data[CNF_MAILER]               , DEFAULT_MAILER);
@@ -6688,6 +7749,12 @@ init_defaults(
     conf_init_str_list (&conf_data[CNF_REPORT_FORMAT]        , NULL);
     conf_init_bool     (&conf_data[CNF_COMPRESS_INDEX]       , TRUE);
     conf_init_bool     (&conf_data[CNF_SORT_INDEX]           , FALSE);
+    conf_init_str      (&conf_data[CNF_INDEX_CACHE_DIR]      , NULL);
+    conf_init_int64    (&conf_data[CNF_INDEX_CACHE_SIZE]     , CONF_UNIT_K   , (gint64)1024*1024);
+    conf_init_str      (&conf_data[CNF_INFOFILE_FORMAT]      , "directory");
+    conf_init_str      (&conf_data[CNF_METRICS_DIR]          , NULL);
+    conf_init_int      (&conf_data[CNF_COMPRESS_CPU_BUDGET]  , CONF_UNIT_NONE, 0);
+    conf_init_int      (&conf_data[CNF_RESUME_DUMP]          , CONF_UNIT_NONE, 2);
     conf_init_str      (&conf_data[CNF_TMPDIR]               , AMANDA_TMPDIR);
     conf_init_identlist(&conf_data[CNF_ACTIVE_STORAGE]       , NULL);
     conf_init_identlist(&conf_data[CNF_STORAGE]              , NULL);
@@ -6718,6 +7785,8 @@ init_defaults(
     conf_init_int      (&conf_data[CNF_DEBUG_SELFCHECK]      , CONF_UNIT_NONE, 0);
     conf_init_int      (&conf_data[CNF_DEBUG_SENDSIZE]       , CONF_UNIT_NONE, 0);
     conf_init_int      (&conf_data[CNF_DEBUG_SENDBACKUP]     , CONF_UNIT_NONE, 0);
+    conf_init_int      (&conf_data[CNF_DEBUG_XFER]           , CONF_UNIT_NONE, 0);
+    conf_init_int      (&conf_data[CNF_DEBUG_SHM]            , CONF_UNIT_NONE, 0);
 #ifdef UDPPORTRANGE
     conf_init_intrange (&conf_data[CNF_RESERVED_UDP_PORT]    , UDPPORTRANGE);
 #else
@@ -7287,6 +8356,8 @@ update_derived_values(
     debug_selfcheck  = getconf_int(CNF_DEBUG_SELFCHECK);
     debug_sendsize   = getconf_int(CNF_DEBUG_SENDSIZE);
     debug_sendbackup = getconf_int(CNF_DEBUG_SENDBACKUP);
+    debug_xfer       = getconf_int(CNF_DEBUG_XFER);
+    debug_shm        = getconf_int(CNF_DEBUG_SHM);
 
     /* And finally, display unit */
     switch (getconf_str(CNF_DISPLAYUNIT)[0]) {
@@ -7928,6 +8999,16 @@ validate_program(
        conf_parserror("program must be \"DUMP\", \"GNUTAR\", \"STAR\" or \"APPLICATION\"");
 }
 
+static void
+validate_infofile_format(
+    conf_var_t *np G_GNUC_UNUSED,
+    val_t        *val)
+{
+    if (!g_str_equal(val->v.s, "directory") &&
+	!g_str_equal(val->v.s, "db"))
+       conf_parserror("infofile-format must be \"directory\" or \"db\"");
+}
+
 static void
 validate_dump_limit(
     conf_var_t *np G_GNUC_UNUSED,
@@ -8696,15 +9777,19 @@ extract_commandline_config_overrides(
 		add_config_override_opt(co, (*argv)[i+1]);
 		moveup = 2;
 	    }
-
-	    /* move up remaining argment array */
-	    for (j = i; j+moveup<*argc; j++) {
-		(*argv)[j] = (*argv)[j+moveup];
-	    }
-	    *argc -= moveup;
+	} else if (g_str_equal((*argv)[i], "--no-cache")) {
+	    config_disable_cache();
+	    moveup = 1;
 	} else {
 	    i++;
+	    continue;
+	}
+
+	/* move up remaining argment array */
+	for (j = i; j+moveup<*argc; j++) {
+	    (*argv)[j] = (*argv)[j+moveup];
 	}
+	*argc -= moveup;
     }
 
     return co;
@@ -10236,6 +11321,22 @@ val_t_display_strs(
 	case COMP_SERVER_CUST:
 	    buf[0] = g_strdup("SERVER CUSTOM");
 	    break;
+
+	case COMP_SERVER_AUTO:
+	    buf[0] = g_strdup("SERVER AUTO");
+	    break;
+
+	case COMP_SERVER_DEFERRED:
+	    buf[0] = g_strdup("SERVER DEFERRED");
+	    break;
+
+	case COMP_SERVER_ZSTD:
+	    buf[0] = g_strdup("SERVER ZSTD");
+	    break;
+
+	case COMP_SERVER_LZ4:
+	    buf[0] = g_strdup("SERVER LZ4");
+	    break;
 	}
 	break;
 
@@ -11117,11 +12218,10 @@ char *
 anonymous_value(void)
 {
     static char number[NUM_STR_SIZE];
-    static int value=1;
 
-    g_snprintf(number, sizeof(number), "%d", value);
+    g_snprintf(number, sizeof(number), "%d", anonymous_count);
 
-    value++;
+    anonymous_count++;
     return number;
 }
 
@@ -135,7 +135,11 @@ typedef enum {
     COMP_CUST,          /* Custom compression on client */
     COMP_SERVER_FAST,   /* Fast compression on server */
     COMP_SERVER_BEST,   /* Best compression on server */
-    COMP_SERVER_CUST    /* Custom compression on server */
+    COMP_SERVER_CUST,   /* Custom compression on server */
+    COMP_SERVER_AUTO,   /* Compression on server chosen for each dump */
+    COMP_SERVER_DEFERRED, /* Compression on server when flushed to tape */
+    COMP_SERVER_ZSTD,   /* zstd compression on server */
+    COMP_SERVER_LZ4     /* lz4 compression on server */
 } comp_t;
 
 /* Encryption types */
@@ -484,6 +488,10 @@ typedef enum {
     CNF_CLIENT_USERNAME,
     CNF_CLIENT_PORT,
     CNF_GNUTAR_LIST_DIR,
+    CNF_ESTIMATE_CACHE_TIME,
+    CNF_CALCSIZE_THREADS,
+    CNF_ZEROCOPY,
+    CNF_WIRE_COMPRESS,
     CNF_AMANDATES,
     CNF_MAILTO,
     CNF_DUMPUSER,
@@ -521,8 +529,15 @@ typedef enum {
     CNF_RUNTAPES,
     CNF_MAXDUMPS,
     CNF_ETIMEOUT,
+    CNF_ESTIMATE_PARALLEL,
+    CNF_STREAM_SCHEDULE,
+    CNF_HOLDING_IN_DUMPER,
+    CNF_AUTOTUNE,
     CNF_DTIMEOUT,
     CNF_CTIMEOUT,
+    CNF_CHECK_PARALLEL,
+    CNF_CHECK_CACHE_TIME,
+    CNF_SSH_CONTROL_PERSIST,
     CNF_DEVICE_OUTPUT_BUFFER_SIZE,
     CNF_PRINTER,
     CNF_MAILER,
@@ -563,6 +578,8 @@ typedef enum {
     CNF_DEBUG_SELFCHECK,
     CNF_DEBUG_SENDSIZE,
     CNF_DEBUG_SENDBACKUP,
+    CNF_DEBUG_XFER,
+    CNF_DEBUG_SHM,
     CNF_RESERVED_UDP_PORT,
     CNF_RESERVED_TCP_PORT,
     CNF_UNRESERVED_TCP_PORT,
@@ -585,6 +602,12 @@ typedef enum {
     CNF_CMDFILE,
     CNF_COMPRESS_INDEX,
     CNF_SORT_INDEX,
+    CNF_INDEX_CACHE_DIR,
+    CNF_INDEX_CACHE_SIZE,
+    CNF_INFOFILE_FORMAT,
+    CNF_METRICS_DIR,
+    CNF_COMPRESS_CPU_BUDGET,
+    CNF_RESUME_DUMP,
     CNF_REST_API_PORT,
     CNF_REST_SSL_CERT,
     CNF_REST_SSL_KEY,
@@ -705,6 +728,8 @@ extern int debug_taper;
 extern int debug_selfcheck;
 extern int debug_sendsize;
 extern int debug_sendbackup;
+extern int debug_xfer;
+extern int debug_shm;
 
 /*
  * Tapetype parameter access
@@ -843,6 +868,7 @@ typedef enum {
     DUMPTYPE_SSL_CHECK_HOST,
     DUMPTYPE_SSL_CHECK_CERTIFICATE_HOST,
     DUMPTYPE_SSL_CHECK_FINGERPRINT,
+    DUMPTYPE_CHANGE_TOKEN,
     DUMPTYPE_DUMPTYPE /* sentinel */
 } dumptype_key;
 
@@ -934,6 +960,7 @@ char *dumptype_key_to_name(int parm);
 #define dumptype_get_client_port(dtyp)         (val_t_to_str(dumptype_getconf((dtyp), DUMPTYPE_CLIENT_PORT)))
 #define dumptype_get_data_path(dtyp)           (val_t_to_data_path(dumptype_getconf((dtyp), DUMPTYPE_DATA_PATH)))
 #define dumptype_get_allow_split(dtyp)         (val_t_to_boolean(dumptype_getconf((dtyp), DUMPTYPE_ALLOW_SPLIT)))
+#define dumptype_get_change_token(dtyp)        (val_t_to_boolean(dumptype_getconf((dtyp), DUMPTYPE_CHANGE_TOKEN)))
 #define dumptype_get_recovery_limit(dtyp)      (val_t_to_host_limit(dumptype_getconf((dtyp), DUMPTYPE_RECOVERY_LIMIT)))
 #define dumptype_get_dump_limit(dtyp)          (val_t_to_host_limit(dumptype_getconf((dtyp), DUMPTYPE_DUMP_LIMIT)))
 #define dumptype_get_max_warnings(dtyp)        (val_t_to_int(dumptype_getconf((dtyp), DUMPTYPE_MAX_WARNINGS)))
@@ -956,6 +983,7 @@ typedef enum {
     INTER_COMMENT,
     INTER_MAXUSAGE,
     INTER_SRC_IP,
+    INTER_NUMA_NODE,
     INTER_INTER /* sentinel */
 } interface_key;
 
@@ -1004,6 +1032,7 @@ char *interface_key_to_name(int parm);
 #define interface_get_comment(iface)    (val_t_to_str(interface_getconf((iface), INTER_COMMENT)))
 #define interface_get_maxusage(iface)   (val_t_to_int(interface_getconf((iface), INTER_MAXUSAGE)))
 #define interface_get_src_ip(iface)     (val_t_to_str(interface_getconf((iface), INTER_SRC_IP)))
+#define interface_get_numa_node(iface)  (val_t_to_int(interface_getconf((iface), INTER_NUMA_NODE)))
 
 /*
  * Holdingdisk parameter access
@@ -1014,6 +1043,9 @@ typedef enum {
     HOLDING_DISKDIR,
     HOLDING_DISKSIZE,
     HOLDING_CHUNKSIZE,
+    HOLDING_NUMA_NODE,
+    HOLDING_MEMORY,
+    HOLDING_DUMP_SIZE_LIMIT,
     HOLDING_HOLDING /* sentinel */
 } holdingdisk_key;
 
@@ -1069,6 +1101,9 @@ char *holdingdisk_key_to_name(int parm);
 #define holdingdisk_get_diskdir(hdisk)   (val_t_to_str(holdingdisk_getconf((hdisk), HOLDING_DISKDIR)))
 #define holdingdisk_get_disksize(hdisk)  (val_t_to_int64(holdingdisk_getconf((hdisk), HOLDING_DISKSIZE)))
 #define holdingdisk_get_chunksize(hdisk) (val_t_to_int64(holdingdisk_getconf((hdisk), HOLDING_CHUNKSIZE)))
+#define holdingdisk_get_numa_node(hdisk) (val_t_to_int(holdingdisk_getconf((hdisk), HOLDING_NUMA_NODE)))
+#define holdingdisk_get_memory(hdisk) (val_t_to_boolean(holdingdisk_getconf((hdisk), HOLDING_MEMORY)))
+#define holdingdisk_get_dump_size_limit(hdisk) (val_t_to_int64(holdingdisk_getconf((hdisk), HOLDING_DUMP_SIZE_LIMIT)))
 
 /* A application-tool interface */
 typedef enum application_e  {
@@ -1524,6 +1559,7 @@ typedef enum storage_e  {
     STORAGE_DUMP_SELECTION,
     STORAGE_ERASE_ON_FAILURE,
     STORAGE_ERASE_ON_FULL,
+    STORAGE_FIXITY_DIGEST,
     STORAGE_VAULT_LIST,
     STORAGE_STORAGE
 } storage_key;
@@ -1605,6 +1641,7 @@ char *storage_key_to_name(int parm);
 #define storage_get_dump_selection(storage)  (val_t_to_dump_selection(storage_getconf((storage), STORAGE_DUMP_SELECTION)))
 #define storage_get_erase_on_failure(storage)  (val_t_to_boolean(storage_getconf((storage), STORAGE_ERASE_ON_FAILURE)))
 #define storage_get_erase_on_full(storage)  (val_t_to_boolean(storage_getconf((storage), STORAGE_ERASE_ON_FULL)))
+#define storage_get_fixity_digest(storage)  (val_t_to_boolean(storage_getconf((storage), STORAGE_FIXITY_DIGEST)))
 #define storage_get_vault_list(storage)  (val_t_to_vault_list(storage_getconf((storage), STORAGE_VAULT_LIST)))
 
 /* A catalog interface */
@@ -1754,7 +1791,8 @@ void add_config_override_opt(config_overrides_t *co,
 			      char *optarg);
 
 /* Given a command line, represented as argc/argv, extract any -o options
- * as config overwrites.  This function modifies argc and argv in place.
+ * as config overwrites, and a --no-cache option (see config_disable_cache).
+ * This function modifies argc and argv in place.
  *
  * This is the deprecated way to extract config overwrites, for applications
  * which do not use getopt.  The preferred method is to use getopt and
@@ -1835,6 +1873,14 @@ cfgerr_level_t config_init_with_global(
  */
 void config_uninit(void);
 
+/* A configuration read without error is saved in a cache file in
+ * AMANDA_TMPDIR, and reused by the next config_init of the same file with
+ * the same overrides, as long as none of the files read has changed.
+ * Disable that cache for this process; setting AMANDA_NO_CONFIG_CACHE in
+ * the environment has the same effect.
+ */
+void config_disable_cache(void);
+
 /* Encode any applied config_overrides into a strv format suitale for
  * executing another Amanda tool.
  *
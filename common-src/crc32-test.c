@@ -29,9 +29,9 @@
 
 /* Utilities */
 
-#define SIZE_BUF 33819
+#define SIZE_BUF 70000
 static uint8_t test_buf[SIZE_BUF];
-static size_t size_of_test[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 15, 16, 17, 63, 64, 65, 255, 256, 257, 258, 767, 768, 769, 1023, 1024, 1027, 32767, 32768, 32769, 33791, 33792, 33793, 33794, 33795, 33796, 33797, 33798, 33799, 33800, 33801, 33802, 33803, 33804, 33805, 33806, 33807, 33808, 33809, 33810, 33811, 33812, 33813, 33814, 33815, 33816, 33817, 33818, 0 };
+static size_t size_of_test[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 15, 16, 17, 63, 64, 65, 255, 256, 257, 258, 767, 768, 769, 1023, 1024, 1027, 32767, 32768, 32769, 33791, 33792, 33793, 33794, 33795, 33796, 33797, 33798, 33799, 33800, 33801, 33802, 33803, 33804, 33805, 33806, 33807, 33808, 33809, 33810, 33811, 33812, 33813, 33814, 33815, 33816, 33817, 33818, 65535, 65536, 65537, 69999, 0 };
 
 static void
 init_test_buf(void)
@@ -78,6 +78,30 @@ test_size(
 	g_fprintf(stderr, " CRC16 %zu %08x:%lld != %08x:%lld\n", size, crc32_finish(&crc1), (long long)crc1.size, crc32_finish(&crc16), (long long)crc16.size);
 	return FALSE;
     }
+#ifdef __SSE4_2__
+    if (have_vpclmul) {
+	crc_t crcv;
+
+	crc32_init(&crcv);
+	crc32c_add_vpclmul(test_buf, size, &crcv);
+	if (crc1.crc != crcv.crc ||
+	    crc1.size != crcv.size) {
+	    g_fprintf(stderr, " CRCvpclmul %zu %08x:%lld != %08x:%lld\n", size, crc32_finish(&crc1), (long long)crc1.size, crc32_finish(&crcv), (long long)crcv.size);
+	    return FALSE;
+	}
+    }
+#endif
+    if (have_armv8_crc) {
+	crc_t crca;
+
+	crc32_init(&crca);
+	crc32c_add_armv8(test_buf, size, &crca);
+	if (crc1.crc != crca.crc ||
+	    crc1.size != crca.size) {
+	    g_fprintf(stderr, " CRCarmv8 %zu %08x:%lld != %08x:%lld\n", size, crc32_finish(&crc1), (long long)crc1.size, crc32_finish(&crca), (long long)crca.size);
+	    return FALSE;
+	}
+    }
 #ifdef __SSE4_2__
     if (have_sse42) {
 	if (crc1.crc != crchw.crc ||
@@ -91,14 +115,55 @@ test_size(
 }
 
 
+/* Time one kernel over the test buffer and print its throughput */
+static void
+bench_kernel(
+    const char *name,
+    void (*fn)(uint8_t *buf, size_t len, crc_t *crc))
+{
+    GTimeVal start, end;
+    crc_t crc;
+    double secs;
+    int i;
+    int rounds = 4096;
+
+    g_get_current_time(&start);
+    crc32_init(&crc);
+    for (i = 0; i < rounds; i++) {
+	fn(test_buf, SIZE_BUF, &crc);
+    }
+    g_get_current_time(&end);
+
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+    if (secs <= 0)
+	secs = 1e-6;
+    g_fprintf(stderr, " %-20s %10.1f MB/s (%08x)\n", name,
+	      (double)rounds * SIZE_BUF / secs / (1024 * 1024), crc32_finish(&crc));
+}
+
+static void
+bench(void)
+{
+    g_fprintf(stderr, " selected kernel: %s\n", crc32_function_name);
+    bench_kernel("slice-by-16", crc32_add_16bytes);
+#ifdef __SSE4_2__
+    if (have_sse42)
+	bench_kernel("sse4.2", crc32c_add_hw);
+    if (have_vpclmul)
+	bench_kernel("avx512-vpclmulqdq", crc32c_add_vpclmul);
+#endif
+    if (have_armv8_crc)
+	bench_kernel("armv8-crc32c", crc32c_add_armv8);
+}
+
 /*
  * Main driver
  */
 
 int
 main(
-    int    argc G_GNUC_UNUSED,
-    char **argv G_GNUC_UNUSED)
+    int    argc,
+    char **argv)
 {
     int i;
     int nb_error = 0;
@@ -106,6 +171,11 @@ main(
     make_crc_table();
     init_test_buf();
 
+    if (argc > 1 && g_str_equal(argv[1], "--bench")) {
+	bench();
+	return 0;
+    }
+
     for (i=0; size_of_test[i] != 0; i++) {
 	if (!test_size(size_of_test[i])) {
 	    nb_error++;
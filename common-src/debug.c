@@ -60,6 +60,19 @@ static char *dbgdir = NULL;
 /* time debug log was opened (timestamp of the file) */
 static time_t open_time;
 
+/* Messages to the debug file are handed to a writer thread, so that a thread
+ * logging on a busy path only pays for formatting them.  These variables
+ * belong to the process that started the writer (debug_writer_pid); a child
+ * of fork() does not have the thread, and writes its messages itself until it
+ * opens a debug file of its own.  debug_pending counts the messages queued
+ * but not yet written, debug_pending_cond is signalled when it decreases. */
+#define DEBUG_QUEUE_MAX 4096
+static GAsyncQueue *debug_queue = NULL;
+static GMutex *debug_pending_mutex = NULL;
+static GCond *debug_pending_cond = NULL;
+static int debug_pending = 0;
+static pid_t debug_writer_pid = 0;
+
 /* storage for global variables */
 int error_exit_status = 1;
 
@@ -69,6 +82,10 @@ static void debug_unlink_old(void);
 static void debug_setup_1(char *config, char *subdir);
 static void debug_setup_2(char *s, int fd, char *annotation);
 static char *msg_timestamp(char timestamp[128]);
+static void debug_start_writer(void);
+static gpointer debug_writer_thread(gpointer data);
+static gboolean debug_async(void);
+static void debug_flush_atexit(void);
 
 static void debug_logging_handler(const gchar *log_domain,
 	GLogLevelFlags log_level,
@@ -191,6 +208,7 @@ debug_logging_handler(const gchar *log_domain G_GNUC_UNUSED,
 	if (!do_suppress_error_traceback && db_fd != -1) {
 	    void *stack[32];
 	    int naddrs;
+	    debug_flush();
 	    naddrs = backtrace(stack, G_N_ELEMENTS(stack));
 	    backtrace_symbols_fd(stack, naddrs, db_fd);
 	}
@@ -469,6 +487,7 @@ debug_setup_2(
 	    close(fd_close[i]);
 	}
 	db_file = fdopen(db_fd, "a");
+	debug_start_writer();
     }
 
     if (annotation) {
@@ -612,6 +631,7 @@ debug_reopen(
 
     /* set 'dbgdir' and clean out old debug files */
     debug_setup_1(NULL, NULL);
+    debug_flush();
 
     /*
      * Reopen the file.
@@ -658,6 +678,7 @@ debug_rename(
     debug_setup_1(config, subdir);
     /* Remove old log from destination directory */
     debug_unlink_old();
+    debug_flush();
 
     g_free(s);
     s = g_strconcat(dbgdir, db_name, NULL);
@@ -803,6 +824,7 @@ debug_close(void)
 
     time(&curtime);
     debug_printf(_("pid %ld finish time %s"), (long)getpid(), ctime(&curtime));
+    debug_flush();
 
     if(db_file && fclose(db_file) == EOF) {
 	int save_errno = errno;
@@ -839,28 +861,114 @@ void debug_printf(const char *format, ...)
 	db_file = stderr;
     }
     if(db_file != NULL) {
-	char *prefix;
+	GString *text_out = g_string_sized_new(256);
 	char *text;
-	char *text_out;
 	char timestamp[128];
 
+	/* the whole line is formatted into one buffer */
 	if (db_file != stderr)
-	    prefix = g_strdup_printf("%s: pid %d: thd-%p: %s:", msg_timestamp(timestamp), (int)getpid(), g_thread_self(), get_pname());
+	    g_string_printf(text_out, "%s: pid %d: thd-%p: %s: ", msg_timestamp(timestamp), (int)getpid(), g_thread_self(), get_pname());
 	else
-	    prefix = g_strdup_printf("%s:", get_pname());
+	    g_string_printf(text_out, "%s: ", get_pname());
 	arglist_start(argp, format);
 	text = g_strdup_vprintf(format, argp);
 	arglist_end(argp);
-	text_out = g_strdup_printf("%s %s", prefix, text);
-	fprintf(db_file, "%s", text_out);
-	fflush(db_file);
-	amfree(prefix);
-	amfree(text);
-	amfree(text_out);
+	g_string_append(text_out, text);
+	g_free(text);
+
+	if (db_file != stderr && debug_async()) {
+	    g_mutex_lock(debug_pending_mutex);
+	    while (debug_pending >= DEBUG_QUEUE_MAX)
+		g_cond_wait(debug_pending_cond, debug_pending_mutex);
+	    debug_pending++;
+	    g_mutex_unlock(debug_pending_mutex);
+	    g_async_queue_push(debug_queue, g_string_free(text_out, FALSE));
+	} else {
+	    fprintf(db_file, "%s", text_out->str);
+	    fflush(db_file);
+	    g_string_free(text_out, TRUE);
+	}
     }
     errno = save_errno;
 }
 
+/*
+ * Wait until the writer thread has written all queued messages.
+ */
+void
+debug_flush(void)
+{
+    if (!debug_async())
+	return;
+
+    g_mutex_lock(debug_pending_mutex);
+    while (debug_pending > 0)
+	g_cond_wait(debug_pending_cond, debug_pending_mutex);
+    g_mutex_unlock(debug_pending_mutex);
+}
+
+static void
+debug_flush_atexit(void)
+{
+    debug_flush();
+}
+
+/* TRUE if messages should be queued for the writer thread */
+static gboolean
+debug_async(void)
+{
+    return debug_queue != NULL && debug_writer_pid == getpid();
+}
+
+static void
+debug_start_writer(void)
+{
+    static gboolean atexit_done = FALSE;
+
+    if (debug_async() || !g_thread_supported())
+	return;
+
+    /* in a child of fork(), the queue and the mutex of the parent may have
+     * been left locked by one of its threads; they are not used again */
+    debug_queue = g_async_queue_new();
+    debug_pending_mutex = g_mutex_new();
+    debug_pending_cond = g_cond_new();
+    debug_pending = 0;
+    debug_writer_pid = getpid();
+    if (!g_thread_create(debug_writer_thread, NULL, FALSE, NULL)) {
+	/* write synchronously */
+	debug_writer_pid = 0;
+	return;
+    }
+
+    if (!atexit_done) {
+	atexit(debug_flush_atexit);
+	atexit_done = TRUE;
+    }
+}
+
+static gpointer
+debug_writer_thread(
+    gpointer data G_GNUC_UNUSED)
+{
+    GAsyncQueue *queue = debug_queue;
+
+    while (1) {
+	char *text = g_async_queue_pop(queue);
+
+	/* db_fd only changes once the queue is flushed */
+	full_write(db_fd, text, strlen(text));
+	g_free(text);
+
+	g_mutex_lock(debug_pending_mutex);
+	debug_pending--;
+	g_cond_broadcast(debug_pending_cond);
+	g_mutex_unlock(debug_pending_mutex);
+    }
+
+    return NULL;
+}
+
 int
 debug_fd(void)
 {
@@ -870,6 +978,8 @@ debug_fd(void)
 FILE *
 debug_fp(void)
 {
+    /* the caller writes to the file itself, after the queued messages */
+    debug_flush();
     return db_file;
 }
 
@@ -183,6 +183,12 @@ void	debug_close(void);
  */
 void	debug_printf(const char *format, ...) G_GNUC_PRINTF(1,2);
 
+/* Once a debug file is open, messages are written to it by a separate thread.
+ * Wait until all messages already logged are in the file.  This is done
+ * before the file is closed or renamed, and at exit.
+ */
+void	debug_flush(void);
+
 /* Get the file descriptor for the debug file
  *
  * @returns: the file descriptor
@@ -151,6 +151,75 @@ out:
 }
 
 
+/* Datagrams read ahead by dgram_recv_next, DGRAM_BATCH per recvmmsg */
+struct dgram_batch_s {
+    int count;			/* datagrams received by the last read */
+    int next;			/* next one to hand out */
+#ifdef HAVE_RECVMMSG
+    struct mmsghdr msgs[DGRAM_BATCH];
+    struct iovec iov[DGRAM_BATCH];
+#endif
+    sockaddr_union addrs[DGRAM_BATCH];
+    size_t lens[DGRAM_BATCH];
+    char bufs[DGRAM_BATCH][MAX_DGRAM+1];
+};
+
+/* A datagram queued by dgram_send_addr while the socket is corked */
+typedef struct dgram_queued_s {
+    sockaddr_union addr;
+    size_t len;
+    char *data;
+} dgram_queued_t;
+
+/*
+ * Send one datagram, retrying for up to five minutes while the peer
+ * refuses it or the socket buffer is full.
+ */
+static int
+dgram_sendto(
+    int			s,
+    const char *	data,
+    size_t		len,
+    sockaddr_union *	addr)
+{
+    int max_wait = 300 / 5;				/* five minutes */
+    int wait_count = 0;
+    int save_errno;
+
+    while(sendto(s,
+		 data,
+		 len,
+		 0, 
+		 (struct sockaddr *)addr,
+		 SS_LEN(addr)) == -1) {
+#ifdef ECONNREFUSED
+	if(errno == ECONNREFUSED && wait_count++ < max_wait) {
+	    dbprintf(_("dgram_send_addr: sendto(%s): retry %d after ECONNREFUSED\n"),
+		  str_sockaddr(addr),
+		  wait_count);
+	    sleep(5);
+	    continue;
+	}
+#endif
+#ifdef EAGAIN
+	if(errno == EAGAIN && wait_count++ < max_wait) {
+	    dbprintf(_("dgram_send_addr: sendto(%s): retry %d after EAGAIN\n"),
+		  str_sockaddr(addr),
+		  wait_count);
+	    sleep(5);
+	    continue;
+	}
+#endif
+	save_errno = errno;
+	dbprintf(_("dgram_send_addr: sendto(%s) failed: %s \n"),
+	      str_sockaddr(addr),
+	      strerror(save_errno));
+	errno = save_errno;
+	return -1;
+    }
+    return 0;
+}
+
 int
 dgram_send_addr(
     sockaddr_union	*addr,
@@ -159,8 +228,6 @@ dgram_send_addr(
     int s, rc;
     int socket_opened;
     int save_errno;
-    int max_wait;
-    int wait_count;
 #if defined(USE_REUSEADDR)
     const int on = 1;
     int r;
@@ -171,6 +238,17 @@ dgram_send_addr(
     dump_sockaddr(addr);
     dbprintf(_("dgram_send_addr: %p->socket = %d\n"),
 	      dgram, dgram->socket);
+    if(dgram->socket != -1 && dgram->corked) {
+	dgram_queued_t *q = g_new(dgram_queued_t, 1);
+
+	copy_sockaddr(&q->addr, addr);
+	q->len = dgram->len;
+	q->data = g_memdup(dgram->data, dgram->len);
+	if (!dgram->queue)
+	    dgram->queue = g_queue_new();
+	g_queue_push_tail(dgram->queue, q);
+	return 0;
+    }
     if(dgram->socket != -1) {
 	s = dgram->socket;
 	socket_opened = 0;
@@ -208,41 +286,7 @@ dgram_send_addr(
 	errno = EMFILE;				/* out of range */
 	rc = -1;
     } else {
-	max_wait = 300 / 5;				/* five minutes */
-	wait_count = 0;
-	rc = 0;
-	while(sendto(s,
-		 dgram->data,
-		 dgram->len,
-		 0, 
-		 (struct sockaddr *)addr,
-		 SS_LEN(addr)) == -1) {
-#ifdef ECONNREFUSED
-	    if(errno == ECONNREFUSED && wait_count++ < max_wait) {
-		dbprintf(_("dgram_send_addr: sendto(%s): retry %d after ECONNREFUSED\n"),
-		      str_sockaddr(addr),
-		      wait_count);
-		sleep(5);
-		continue;
-	    }
-#endif
-#ifdef EAGAIN
-	    if(errno == EAGAIN && wait_count++ < max_wait) {
-		dbprintf(_("dgram_send_addr: sendto(%s): retry %d after EAGAIN\n"),
-		      str_sockaddr(addr),
-		      wait_count);
-		sleep(5);
-		continue;
-	    }
-#endif
-	    save_errno = errno;
-	    dbprintf(_("dgram_send_addr: sendto(%s) failed: %s \n"),
-		  str_sockaddr(addr),
-		  strerror(save_errno));
-	    errno = save_errno;
-	    rc = -1;
-	    break;
-	}
+	rc = dgram_sendto(s, dgram->data, dgram->len, addr);
     }
 
     if(socket_opened) {
@@ -331,6 +375,166 @@ dgram_recv(
 }
 
 
+ssize_t
+dgram_recv_next(
+    dgram_t *		dgram,
+    sockaddr_union *	fromaddr)
+{
+    struct dgram_batch_s *batch;
+    ssize_t size;
+
+    if (!dgram->batch)
+	dgram->batch = g_new0(struct dgram_batch_s, 1);
+    batch = dgram->batch;
+
+    if (batch->next >= batch->count) {
+	batch->next = batch->count = 0;
+#if defined(HAVE_RECVMMSG) && defined(MSG_DONTWAIT)
+	{
+	    int i, n;
+	    int save_errno;
+
+	    for (i = 0; i < DGRAM_BATCH; i++) {
+		batch->iov[i].iov_base = batch->bufs[i];
+		batch->iov[i].iov_len = MAX_DGRAM;
+		memset(&batch->msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+		batch->msgs[i].msg_hdr.msg_name = &batch->addrs[i];
+		batch->msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_union);
+		batch->msgs[i].msg_hdr.msg_iov = &batch->iov[i];
+		batch->msgs[i].msg_hdr.msg_iovlen = 1;
+	    }
+	    do {
+		n = recvmmsg(dgram->socket, batch->msgs, DGRAM_BATCH,
+			     MSG_DONTWAIT, NULL);
+	    } while (n == -1 && errno == EINTR);
+	    if (n == -1) {
+		save_errno = errno;
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+		    dbprintf(_("dgram_recv_next: recvmmsg() failed: %s\n"),
+			     strerror(save_errno));
+		errno = save_errno;
+		return -1;
+	    }
+	    for (i = 0; i < n; i++)
+		batch->lens[i] = batch->msgs[i].msg_len;
+	    batch->count = n;
+	}
+#else
+	/* no recvmmsg: read one datagram, if one is ready */
+	size = dgram_recv(dgram, 0, fromaddr);
+	if (size == 0 && dgram->len == 0) {
+	    errno = EAGAIN;
+	    return -1;
+	}
+	return size;
+#endif
+    }
+
+    size = (ssize_t)batch->lens[batch->next];
+    memcpy(dgram->data, batch->bufs[batch->next], (size_t)size);
+    copy_sockaddr(fromaddr, &batch->addrs[batch->next]);
+    batch->next++;
+    dump_sockaddr(fromaddr);
+    dgram->len = (size_t)size;
+    dgram->data[size] = '\0';
+    dgram->cur = dgram->data;
+    return size;
+}
+
+gboolean
+dgram_pending(
+    dgram_t *	dgram)
+{
+    return dgram->batch && dgram->batch->next < dgram->batch->count;
+}
+
+void
+dgram_cork(
+    dgram_t *	dgram)
+{
+    dgram->corked++;
+}
+
+int
+dgram_uncork(
+    dgram_t *	dgram)
+{
+    dgram_queued_t *q;
+    int rc = 0;
+
+    assert(dgram->corked > 0);
+    if (--dgram->corked > 0 || !dgram->queue)
+	return 0;
+
+    while (!g_queue_is_empty(dgram->queue)) {
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr msgs[DGRAM_BATCH];
+	struct iovec iov[DGRAM_BATCH];
+	int i, n;
+	GList *iter = dgram->queue->head;
+
+	for (i = 0; i < DGRAM_BATCH && iter != NULL; i++, iter = iter->next) {
+	    q = iter->data;
+	    iov[i].iov_base = q->data;
+	    iov[i].iov_len = q->len;
+	    memset(&msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+	    msgs[i].msg_hdr.msg_name = &q->addr;
+	    msgs[i].msg_hdr.msg_namelen = SS_LEN(&q->addr);
+	    msgs[i].msg_hdr.msg_iov = &iov[i];
+	    msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	n = sendmmsg(dgram->socket, msgs, i, 0);
+	if (n > 0) {
+	    while (n-- > 0) {
+		q = g_queue_pop_head(dgram->queue);
+		g_free(q->data);
+		g_free(q);
+	    }
+	    continue;
+	}
+#endif
+	/* sendmmsg failed on the first datagram: send it the slow way, with
+	 * the usual retries, and carry on with the rest */
+	q = g_queue_pop_head(dgram->queue);
+	if (dgram_sendto(dgram->socket, q->data, q->len, &q->addr) != 0)
+	    rc = -1;
+	g_free(q->data);
+	g_free(q);
+    }
+    return rc;
+}
+
+void
+dgram_reserve(
+    dgram_t *	dgram,
+    int		count)
+{
+    int want = count * DGRAM_INFLIGHT_SIZE;
+    int size;
+
+    if (dgram->socket < 0 || (dgram->bufsize && want <= dgram->bufsize))
+	return;
+
+    /* grow by doubling, so a busy planner does not call setsockopt for
+     * every new request */
+    size = dgram->bufsize ? dgram->bufsize : MAX_DGRAM;
+    while (size < want)
+	size *= 2;
+
+    if (setsockopt(dgram->socket, SOL_SOCKET, SO_RCVBUF,
+		   (void *)&size, sizeof(size)) < 0) {
+	dbprintf("dgram_reserve: could not set udp receive buffer to %d: %s (ignored)\n",
+		 size, strerror(errno));
+    }
+    if (setsockopt(dgram->socket, SOL_SOCKET, SO_SNDBUF,
+		   (void *)&size, sizeof(size)) < 0) {
+	dbprintf("dgram_reserve: could not set udp send buffer to %d: %s (ignored)\n",
+		 size, strerror(errno));
+    }
+    dgram->bufsize = size;
+}
+
+
 void
 dgram_zero(
     dgram_t *	dgram)
@@ -43,11 +43,23 @@
  */
 #define MAX_DGRAM      (((1<<16)-1)-24-8)
 
+/* number of datagrams received or sent by a single recvmmsg/sendmmsg */
+#define DGRAM_BATCH	16
+
+/* socket buffer space reserved per in-flight request, see dgram_reserve */
+#define DGRAM_INFLIGHT_SIZE	16384
+
+struct dgram_batch_s;
+
 typedef struct dgram_s {
     char *cur;
     int socket;
     size_t len;
     char data[MAX_DGRAM+1];
+    struct dgram_batch_s *batch; /* datagrams read ahead by dgram_recv_next */
+    int corked;			/* dgram_send_addr queues to 'queue' */
+    GQueue *queue;		/* datagrams waiting for dgram_uncork */
+    int bufsize;		/* socket buffer size set by dgram_reserve */
 } dgram_t;
 
 int	dgram_bind(dgram_t *dgram, sa_family_t family, in_port_t *portp, int priv, char **bind_msg);
@@ -55,6 +67,28 @@ void	dgram_socket(dgram_t *dgram, int sock);
 int	dgram_send_addr(sockaddr_union *addr, dgram_t *dgram);
 ssize_t	dgram_recv(dgram_t *dgram, int timeout,
 		   sockaddr_union *fromaddr);
+
+/* Get the next datagram without waiting.  Datagrams ready on the socket
+ * are read DGRAM_BATCH at a time and handed out one per call.  Returns
+ * the size of the datagram, or -1 with errno set to EAGAIN when nothing
+ * is ready.
+ */
+ssize_t	dgram_recv_next(dgram_t *dgram, sockaddr_union *fromaddr);
+
+/* Are datagrams already read from the socket waiting for dgram_recv_next? */
+gboolean dgram_pending(dgram_t *dgram);
+
+/* Between dgram_cork and dgram_uncork, dgram_send_addr only queues the
+ * datagram; dgram_uncork sends all of them at once.  dgram_uncork returns
+ * -1 if any of the datagrams could not be sent.
+ */
+void	dgram_cork(dgram_t *dgram);
+int	dgram_uncork(dgram_t *dgram);
+
+/* Grow the socket buffers of the datagram socket so that 'count' requests
+ * can be in flight at once. */
+void	dgram_reserve(dgram_t *dgram, int count);
+
 void	dgram_zero(dgram_t *dgram);
 int	dgram_cat(dgram_t *dgram, const char *fmt, ...)
     G_GNUC_PRINTF(2, 3);
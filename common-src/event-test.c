@@ -557,6 +557,112 @@ test_ev_writefd(void)
     return TRUE;
 }
 
+/****
+ * Test many EV_READFD handles at once, and an EV_READFD and an EV_WRITEFD on
+ * the same file descriptor, each of which must fire and be released
+ * independently of the others.
+ */
+
+#define TEST_EV_MANYFD_COUNT 64
+
+static int manyfd_fds[TEST_EV_MANYFD_COUNT];
+static event_handle_t *manyfd_hdl[TEST_EV_MANYFD_COUNT];
+static event_handle_t *samefd_read_hdl, *samefd_write_hdl;
+
+static void
+test_ev_manyfd_cb(void *up)
+{
+    int i = GPOINTER_TO_INT(up);
+    char c;
+
+    if (read(manyfd_fds[i], &c, 1) != 1 || c != (char)i) {
+	tu_dbg("pipe %d: bad read\n", i);
+	return;
+    }
+    tu_dbg("pipe %d: read\n", i);
+    event_release(manyfd_hdl[i]);
+    close(manyfd_fds[i]);
+    global--;
+}
+
+static void
+test_ev_samefd_read_cb(void *up G_GNUC_UNUSED)
+{
+    char c;
+
+    if (read(cb_fd, &c, 1) == 1) {
+	tu_dbg("samefd: read\n");
+	event_release(samefd_read_hdl);
+	global--;
+    }
+}
+
+static void
+test_ev_samefd_write_cb(void *up G_GNUC_UNUSED)
+{
+    if (write(cb_fd, "w", 1) == 1) {
+	tu_dbg("samefd: wrote\n");
+	event_release(samefd_write_hdl);
+	global--;
+    }
+}
+
+static gboolean
+test_ev_manyfd(void)
+{
+    int sv[2];
+    int i;
+
+    global = TEST_EV_MANYFD_COUNT + 2;
+
+    for (i = 0; i < TEST_EV_MANYFD_COUNT; i++) {
+	int p[2];
+	char c = (char)i;
+
+	if (pipe(p) == -1) {
+	    perror("pipe");
+	    return FALSE;
+	}
+	/* the data is there before the event loop starts */
+	if (write(p[1], &c, 1) != 1) {
+	    perror("write");
+	    return FALSE;
+	}
+	close(p[1]);
+	manyfd_fds[i] = p[0];
+	manyfd_hdl[i] = event_create(p[0], EV_READFD, test_ev_manyfd_cb,
+				     GINT_TO_POINTER(i));
+	event_activate(manyfd_hdl[i]);
+    }
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+	perror("socketpair");
+	return FALSE;
+    }
+    cb_fd = sv[0];
+    if (write(sv[1], "r", 1) != 1) {
+	perror("write");
+	return FALSE;
+    }
+    samefd_read_hdl = event_create(sv[0], EV_READFD, test_ev_samefd_read_cb, NULL);
+    event_activate(samefd_read_hdl);
+    samefd_write_hdl = event_create(sv[0], EV_WRITEFD, test_ev_samefd_write_cb, NULL);
+    event_activate(samefd_write_hdl);
+
+    /* let it run; it returns when all of the events are released */
+    event_loop(0);
+
+    close(sv[0]);
+    close(sv[1]);
+
+    if (global != 0) {
+	tu_dbg("%d events did not fire\n", global);
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
 /****
  * Test that a child_watch_source works correctly.
  */
@@ -653,6 +759,7 @@ main(int argc, char **argv)
 	TU_TEST(test_ev_wait_2, 90),
 	TU_TEST(test_ev_readfd, 120), /* runs slowly on old kernels */
 	TU_TEST(test_ev_writefd, 90),
+	TU_TEST(test_ev_manyfd, 90),
 	TU_TEST(test_event_wait, 90),
 	TU_TEST(test_event_wait_2, 90),
 	TU_TEST(test_nonblock, 90),
@@ -36,7 +36,9 @@
  * use Glib's interface directly.
  *
  * Each event_handle is associated with a unique GSource, identified by it
- * event_source_id.
+ * event_source_id.  Where epoll is available, EV_READFD and EV_WRITEFD
+ * handles instead share a single GSource polling an epoll instance, so that
+ * an iteration costs O(ready fds) rather than O(registered fds).
  */
 
 #include "amanda.h"
@@ -44,6 +46,11 @@
 #include "event.h"
 #include "glib-util.h"
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#define EVENT_EPOLL
+#endif
+
 /* TODO: use mem chunks to allocate event_handles */
 /* TODO: lock stuff for threading */
 
@@ -71,11 +78,25 @@ struct event_handle {
 
     gboolean has_fired;		/* for use by event_wait() */
     gboolean is_dead;		/* should this event be deleted? */
+    gboolean is_active;		/* has event_activate been called? */
+    gboolean is_firing;		/* callback is running; don't recurse */
+    guint32 epoll_events;	/* epoll events we wait for, if on epoll */
 };
 
-/* A list of all extant event_handle objects, used for searching for particular
- * events and for deleting dead events */
-GSList *all_events = NULL;
+/* EV_WAIT handles, indexed by id so that event_wakeup doesn't have to search
+ * all extant events.  The values are GSLists of handles. */
+static GHashTable *wait_events = NULL;
+
+/* Released handles, waiting for flush_dead_events to free them */
+static GSList *dead_events = NULL;
+
+/* Number of live handles that GMainLoop dispatches, i.e., not EV_WAIT */
+static int mainloop_events = 0;
+
+/* Nonzero while callbacks are fired from a list of handles; dead handles
+ * are not freed until it drops back to zero, since the list may still
+ * point to them. */
+static int event_firing = 0;
 
 #if (GLIB_MAJOR_VERSION > 2 || (GLIB_MAJOR_VERSION == 2 && GLIB_MINOR_VERSION >= 31))
 # pragma GCC diagnostic push
@@ -122,6 +143,271 @@ event_handle_callback(
     return TRUE;
 }
 
+static guint
+event_id_hash(
+    gconstpointer key)
+{
+    event_id_t id = *(const event_id_t *)key;
+
+    return (guint)(id ^ (id >> 32));
+}
+
+static gboolean
+event_id_equal(
+    gconstpointer a,
+    gconstpointer b)
+{
+    return *(const event_id_t *)a == *(const event_id_t *)b;
+}
+
+#ifdef EVENT_EPOLL
+/*
+ * EpollSource -- a single source for all EV_READFD and EV_WRITEFD handles
+ *
+ * The handles waiting on each fd are kept in event_fds, and the union of
+ * the events they wait for is registered with epoll.  The source polls the
+ * epoll fd, and its dispatch fires the handles of the fds epoll reports.
+ * All of this is protected by event_mutex.
+ */
+
+typedef struct EpollSource {
+    GSource source; /* must be the first element in the struct */
+    GPollFD pollfd; /* the epoll fd */
+} EpollSource;
+
+/* maximum number of ready fds handled by a single dispatch */
+#define EVENT_EPOLL_BATCH 256
+
+static EpollSource *epoll_source = NULL;
+static pid_t epoll_pid;
+static gboolean epoll_broken = FALSE;
+static GSList *event_fds[FD_SETSIZE];
+static guint32 event_fd_mask[FD_SETSIZE];
+
+static gboolean epoll_setup(void);
+
+/* Register with epoll the events wanted by the handles on fd */
+static int
+epoll_update(
+    int fd)
+{
+    struct epoll_event ev;
+    GSList *iter;
+    guint32 mask = 0;
+    int rc;
+
+    for (iter = event_fds[fd]; iter != NULL; iter = g_slist_next(iter))
+	mask |= ((event_handle_t *)iter->data)->epoll_events;
+    if (mask == event_fd_mask[fd])
+	return 0;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = mask;
+    ev.data.fd = fd;
+    if (mask == 0) {
+	/* the fd may already be closed, which removed it from epoll */
+	(void)epoll_ctl(epoll_source->pollfd.fd, EPOLL_CTL_DEL, fd, &ev);
+	rc = 0;
+    } else if (event_fd_mask[fd] == 0) {
+	rc = epoll_ctl(epoll_source->pollfd.fd, EPOLL_CTL_ADD, fd, &ev);
+	if (rc == -1 && errno == EEXIST)
+	    rc = epoll_ctl(epoll_source->pollfd.fd, EPOLL_CTL_MOD, fd, &ev);
+    } else {
+	rc = epoll_ctl(epoll_source->pollfd.fd, EPOLL_CTL_MOD, fd, &ev);
+	if (rc == -1 && errno == ENOENT)
+	    rc = epoll_ctl(epoll_source->pollfd.fd, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    if (rc == 0)
+	event_fd_mask[fd] = mask;
+    return rc;
+}
+
+/* Put an EV_READFD or EV_WRITEFD handle on epoll.  Returns FALSE if the
+ * caller should give it a FDSource instead (e.g., for a regular file,
+ * which epoll refuses). */
+static gboolean
+epoll_add(
+    event_handle_t *handle)
+{
+    int fd = (int)handle->data;
+
+    if (!epoll_setup())
+	return FALSE;
+
+    if (handle->type == EV_READFD) {
+	handle->epoll_events = EPOLLIN | EPOLLHUP | EPOLLERR;
+    } else {
+	handle->epoll_events = EPOLLOUT | EPOLLERR;
+    }
+    event_fds[fd] = g_slist_prepend(event_fds[fd], handle);
+
+    if (epoll_update(fd) < 0) {
+	event_debug(1, _("event: epoll_ctl(%d) failed: %s; using poll\n"),
+		    fd, strerror(errno));
+	event_fds[fd] = g_slist_remove(event_fds[fd], handle);
+	handle->epoll_events = 0;
+	return FALSE;
+    }
+    return TRUE;
+}
+
+static void
+epoll_remove(
+    event_handle_t *handle)
+{
+    int fd = (int)handle->data;
+
+    if (!handle->epoll_events)
+	return;
+
+    event_fds[fd] = g_slist_remove(event_fds[fd], handle);
+    handle->epoll_events = 0;
+    if (epoll_setup())
+	(void)epoll_update(fd);
+}
+
+static gboolean
+epoll_source_prepare(
+    GSource *source G_GNUC_UNUSED,
+    gint *timeout_)
+{
+    *timeout_ = -1; /* block forever, as far as we're concerned */
+    return FALSE;
+}
+
+static gboolean
+epoll_source_check(
+    GSource *source)
+{
+    EpollSource *eps = (EpollSource *)source;
+
+    return (eps->pollfd.revents & G_IO_IN) != 0;
+}
+
+static gboolean
+epoll_source_dispatch(
+    GSource *source G_GNUC_UNUSED,
+    GSourceFunc callback G_GNUC_UNUSED,
+    gpointer user_data G_GNUC_UNUSED)
+{
+    struct epoll_event evs[EVENT_EPOLL_BATCH];
+    GSList *tofire = NULL;
+    GSList *iter;
+    int i, n;
+
+    g_static_mutex_lock(&event_mutex);
+    if (!epoll_setup()) {
+	g_static_mutex_unlock(&event_mutex);
+	return TRUE;
+    }
+
+    /* Find the handles to fire before firing any of them.  A handle whose
+     * callback is still running further up the stack (the callback is
+     * running a nested event loop) is skipped, as GMainLoop would do for a
+     * FDSource. */
+    n = epoll_wait(epoll_source->pollfd.fd, evs, EVENT_EPOLL_BATCH, 0);
+    for (i = 0; i < n; i++) {
+	for (iter = event_fds[evs[i].data.fd]; iter != NULL; iter = g_slist_next(iter)) {
+	    event_handle_t *eh = (event_handle_t *)iter->data;
+	    if (!eh->is_dead && !eh->is_firing && (eh->epoll_events & evs[i].events))
+		tofire = g_slist_prepend(tofire, eh);
+	}
+    }
+
+    event_firing++;
+    for (iter = tofire; iter != NULL; iter = g_slist_next(iter)) {
+	event_handle_t *eh = (event_handle_t *)iter->data;
+
+	/* an earlier callback may have released it */
+	if (eh->is_dead)
+	    continue;
+
+	eh->is_firing = TRUE;
+	g_static_mutex_unlock(&event_mutex);
+	fire(eh);
+	g_static_mutex_lock(&event_mutex);
+	eh->is_firing = FALSE;
+    }
+    event_firing--;
+
+    g_static_mutex_unlock(&event_mutex);
+    g_slist_free(tofire);
+
+    /* never detach */
+    return TRUE;
+}
+
+/* Create the epoll instance and its source, or re-create the instance in a
+ * child process, which otherwise shares the parent's registrations.
+ * Returns FALSE if epoll can't be used. */
+static gboolean
+epoll_setup(void)
+{
+    static GSourceFuncs *epoll_source_funcs = NULL;
+    int epfd;
+    int fd;
+
+    if (epoll_broken)
+	return FALSE;
+    if (epoll_source && epoll_pid == getpid())
+	return TRUE;
+
+#ifdef EPOLL_CLOEXEC
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+#else
+    epfd = epoll_create(FD_SETSIZE);
+    if (epfd != -1)
+	fcntl(epfd, F_SETFD, FD_CLOEXEC);
+#endif
+    if (epfd == -1) {
+	if (epoll_source) {
+	    error(_("event: could not create a new epoll instance: %s"),
+		  strerror(errno));
+	    /*NOTREACHED*/
+	}
+	event_debug(1, _("event: epoll_create failed: %s; using poll\n"),
+		    strerror(errno));
+	epoll_broken = TRUE;
+	return FALSE;
+    }
+    epoll_pid = getpid();
+
+    if (epoll_source) {
+	/* we were forked; re-register everything with our own instance */
+	close(epoll_source->pollfd.fd);
+	epoll_source->pollfd.fd = epfd;
+	for (fd = 0; fd < (int)FD_SETSIZE; fd++) {
+	    if (event_fd_mask[fd]) {
+		event_fd_mask[fd] = 0;
+		(void)epoll_update(fd);
+	    }
+	}
+	return TRUE;
+    }
+
+    /* initialize these here to avoid a compiler warning */
+    if (!epoll_source_funcs) {
+	epoll_source_funcs = g_new0(GSourceFuncs, 1);
+	epoll_source_funcs->prepare = epoll_source_prepare;
+	epoll_source_funcs->check = epoll_source_check;
+	epoll_source_funcs->dispatch = epoll_source_dispatch;
+    }
+
+    epoll_source = (EpollSource *)g_source_new(epoll_source_funcs,
+					       sizeof(EpollSource));
+    epoll_source->pollfd.fd = epfd;
+    epoll_source->pollfd.events = G_IO_IN;
+    g_source_add_poll((GSource *)epoll_source, &epoll_source->pollfd);
+    /* callbacks run nested event loops, which must see the other fds */
+    g_source_set_can_recurse((GSource *)epoll_source, TRUE);
+    g_source_attach((GSource *)epoll_source, NULL);
+    event_debug(1, _("event: using epoll fd %d\n"), epfd);
+
+    return TRUE;
+}
+#endif /* EVENT_EPOLL */
+
 /*
  * Public functions
  *  DEPRECATED because not safe in multi-thread, callback can be called before event_register return
@@ -189,13 +475,18 @@ event_activate(
 
     g_static_mutex_lock(&event_mutex);
 
-    /* add to the list of events */
-    all_events = g_slist_prepend(all_events, (gpointer)handle);
+    handle->is_active = TRUE;
+    if (handle->type != EV_WAIT)
+	mainloop_events++;
 
     /* and set up the GSource for this event */
     switch (handle->type) {
 	case EV_READFD:
 	case EV_WRITEFD:
+#ifdef EVENT_EPOLL
+	    if (epoll_add(handle))
+		break;
+#endif
 	    /* create a new source */
 	    if (handle->type == EV_READFD) {
 		cond = G_IO_IN | G_IO_HUP | G_IO_ERR;
@@ -230,9 +521,24 @@ event_activate(
 	    g_source_set_priority(handle->source, 10);
 	    break;
 
-	case EV_WAIT:
-	    /* nothing to do -- these are handled independently of GMainLoop */
+	case EV_WAIT: {
+	    /* these are handled independently of GMainLoop; just index it */
+	    gpointer key;
+	    gpointer list;
+
+	    if (!wait_events)
+		wait_events = g_hash_table_new_full(event_id_hash, event_id_equal,
+						    g_free, NULL);
+	    if (!g_hash_table_lookup_extended(wait_events, &handle->data,
+					      &key, &list)) {
+		key = g_memdup(&handle->data, sizeof(handle->data));
+		list = NULL;
+	    }
+	    g_hash_table_steal(wait_events, key);
+	    g_hash_table_insert(wait_events, key,
+				g_slist_prepend((GSList *)list, handle));
 	    break;
+	}
 
 	default:
 	    error(_("Unknown event type %s"), event_type2str(handle->type));
@@ -262,6 +568,30 @@ event_release(
 
     /* Mark it as dead and leave it for the event_loop to remove */
     handle->is_dead = TRUE;
+    dead_events = g_slist_prepend(dead_events, handle);
+
+    /* but take it off the indexes right away */
+    if (handle->is_active) {
+	if (handle->type != EV_WAIT)
+	    mainloop_events--;
+#ifdef EVENT_EPOLL
+	epoll_remove(handle);
+#endif
+	if (handle->type == EV_WAIT) {
+	    gpointer key;
+	    gpointer list;
+
+	    if (g_hash_table_lookup_extended(wait_events, &handle->data,
+					     &key, &list)) {
+		list = g_slist_remove((GSList *)list, handle);
+		g_hash_table_steal(wait_events, key);
+		if (list)
+		    g_hash_table_insert(wait_events, key, list);
+		else
+		    g_free(key);
+	    }
+	}
+    }
 
     if (global_return_when_empty && !any_mainloop_events()) {
 	g_main_loop_quit(default_main_loop());
@@ -284,17 +614,13 @@ event_wakeup(
     g_static_mutex_lock(&event_mutex);
     event_debug(1, _("event: wakeup: enter (%jd)\n"), id);
 
-    /* search for any and all matching events, and record them.  This way
-     * we have determined the whole list of events we'll be firing *before*
-     * we fire any of them. */
-    for (iter = all_events; iter != NULL; iter = g_slist_next(iter)) {
-	event_handle_t *eh = (event_handle_t *)iter->data;
-	if (eh->type == EV_WAIT && eh->data == id && !eh->is_dead) {
-	    tofire = g_slist_append(tofire, (gpointer)eh);
-	}
-    }
+    /* record all matching events.  This way we have determined the whole
+     * list of events we'll be firing *before* we fire any of them. */
+    if (wait_events)
+	tofire = g_slist_copy((GSList *)g_hash_table_lookup(wait_events, &id));
 
     /* fire them */
+    event_firing++;
     for (iter = tofire; iter != NULL; iter = g_slist_next(iter)) {
 	event_handle_t *eh = (event_handle_t *)iter->data;
 	if (eh->type == EV_WAIT && eh->data == id && !eh->is_dead) {
@@ -307,6 +633,8 @@ event_wakeup(
 	}
     }
 
+    event_firing--;
+
     /* and free the temporary list */
     g_slist_free(tofire);
 
@@ -350,8 +678,8 @@ event_wait(
     event_loop_wait(eh, 0, TRUE);
 }
 
-/* Flush out any dead events in all_events.  Be careful that this
- * isn't called while someone is iterating over all_events.
+/* Free the dead events.  This is postponed while callbacks are being
+ * fired from a list that may still point to them.
  *
  * @param wait_eh: the event handle we're waiting on, which shouldn't
  *	    be flushed.
@@ -361,14 +689,17 @@ flush_dead_events(event_handle_t *wait_eh)
 {
     GSList *iter, *next;
 
-    for (iter = all_events; iter != NULL; iter = next) {
+    if (event_firing)
+	return;
+
+    for (iter = dead_events; iter != NULL; iter = next) {
 	event_handle_t *hdl = (event_handle_t *)iter->data;
 	next = g_slist_next(iter);
 
 	/* (handle the case when wait_eh is dead by simply not deleting
 	 * it; the next run of event_loop will take care of it) */
-	if (hdl->is_dead && hdl != wait_eh) {
-	    all_events = g_slist_delete_link(all_events, iter);
+	if (hdl != wait_eh) {
+	    dead_events = g_slist_delete_link(dead_events, iter);
 	    if (hdl->source) g_source_destroy(hdl->source);
 
 	    amfree(hdl);
@@ -377,22 +708,12 @@ flush_dead_events(event_handle_t *wait_eh)
 }
 
 /* Return TRUE if we have any events outstanding that can be dispatched
- * by GMainLoop.  Recall EV_WAIT events appear in all_events, but are
- * not dispatched by GMainLoop.  */
+ * by GMainLoop.  Recall EV_WAIT events are not dispatched by GMainLoop.  */
 static gboolean
 any_mainloop_events(void)
 {
-    GSList *iter;
-    gboolean ret = FALSE;
-
-    for (iter = all_events; iter != NULL; iter = g_slist_next(iter)) {
-	event_handle_t *hdl = (event_handle_t *)iter->data;
-	event_debug(2, _("list %p: %s %s/%jd\n"), hdl, hdl->is_dead?"dead":"alive", event_type2str((hdl)->type), (hdl)->data);
-	if (hdl->type != EV_WAIT && !hdl->is_dead)
-	    ret = TRUE;
-    }
-
-    return ret;
+    event_debug(2, _("%d mainloop events\n"), mainloop_events);
+    return mainloop_events > 0;
 }
 
 static void
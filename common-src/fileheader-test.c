@@ -106,6 +106,23 @@ rt_compress(dumpfile_t *hdr)
 #define PREV_RT rt_compress
 }
 
+static int
+rt_compressed_by(dumpfile_t *hdr)
+{
+    if (TAPE_HEADER(hdr)) {
+	strcpy(hdr->compressed_by, "");
+	if (!PREV_RT(hdr)) return 0;
+    } else {
+	strcpy(hdr->compressed_by, "");
+	if (!PREV_RT(hdr)) return 0;
+	strcpy(hdr->compressed_by, "taper");
+	if (!PREV_RT(hdr)) return 0;
+    }
+    return 1;
+#undef PREV_RT
+#define PREV_RT rt_compressed_by
+}
+
 static int
 rt_encrypt(dumpfile_t *hdr)
 {
@@ -33,6 +33,7 @@
 #include "amutil.h"
 #include "fileheader.h"
 #include "match.h"
+#include "amgcm.h"
 #include <glib.h>
 
 static const char *	filetype2str(filetype_t);
@@ -467,6 +468,16 @@ parse_file_header(
 	}
 #undef SC
 
+#define SC "COMPRESSED-BY="
+	if (g_str_has_prefix(line, SC)) {
+	    line += sizeof(SC) - 1;
+	    strncpy(file->compressed_by, line,
+		    sizeof(file->compressed_by) - 1);
+	    file->compressed_by[sizeof(file->compressed_by) - 1] = '\0';
+	    continue;
+	}
+#undef SC
+
 #define SC "ORIGSIZE="
 	if (g_str_has_prefix(line, SC)) {
 	    line += sizeof(SC) - 1;
@@ -600,6 +611,7 @@ dump_dumpfile_t(
 	g_debug(_("    srv_decrypt_opt  = '%s'"), file->srv_decrypt_opt);
 	g_debug(_("    clnt_decrypt_opt = '%s'"), file->clnt_decrypt_opt);
 	g_debug(_("    cont_filename    = '%s'"), file->cont_filename);
+	g_debug(_("    compressed_by    = '%s'"), file->compressed_by);
 	if (file->dle_str)
 	    g_debug(_("    dle_str          = %s"), file->dle_str);
 	else
@@ -810,6 +822,11 @@ build_header(const dumpfile_t * file, size_t *size, size_t max_size)
 	if (file->is_partial != 0) {
             g_string_append_printf(rval, "PARTIAL=YES\n");
 	}
+	if (file->compressed_by[0] != '\0') {
+	    validate_no_space(file->compressed_by, "compressed_by");
+            g_string_append_printf(rval, "COMPRESSED-BY=%s\n",
+                                   file->compressed_by);
+	}
 	if (file->orig_size > 0) {
 	    g_string_append_printf(rval, "ORIGSIZE=%jd\n",
 					 (intmax_t)file->orig_size);
@@ -1005,6 +1022,18 @@ known_compress_type(
     return 0;
 }
 
+/* Was the image encrypted by the native AES-GCM filter?  If so, the data
+ * starts with the stream header described in amgcm.h rather than being
+ * piped through srv_encrypt. */
+int
+native_encrypt_type(
+    const dumpfile_t *	file)
+{
+    if (file->encrypted && g_str_equal(file->srv_encrypt, AMGCM_ENCRYPT_NAME))
+	return 1;
+    return 0;
+}
+
 static const struct {
     filetype_t type;
     const char *str;
@@ -1072,6 +1101,7 @@ gboolean headers_are_equal(dumpfile_t * a, dumpfile_t * b) {
     if (!g_str_equal(a->srv_decrypt_opt, b->srv_decrypt_opt)) return FALSE;
     if (!g_str_equal(a->clnt_decrypt_opt, b->clnt_decrypt_opt)) return FALSE;
     if (!g_str_equal(a->cont_filename, b->cont_filename)) return FALSE;
+    if (!g_str_equal(a->compressed_by, b->compressed_by)) return FALSE;
     if (a->dle_str != b->dle_str && a->dle_str && b->dle_str
 	&& !g_str_equal(a->dle_str, b->dle_str)) return FALSE;
     if (a->is_partial != b->is_partial) return FALSE;
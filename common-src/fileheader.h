@@ -68,6 +68,9 @@ typedef struct file_s {
     string_t srv_decrypt_opt;
     string_t clnt_decrypt_opt;
     string_t cont_filename;
+    string_t compressed_by; /* "dumper" or "taper" with compress server
+			     * deferred; "pending" on the holding disk
+			     * until the taper compresses it */
     char     *dle_str;
     int is_partial;
     int partnum;
@@ -99,6 +102,7 @@ void	parse_file_header(const char *buffer, dumpfile_t *file, size_t buflen);
 void	print_header(FILE *outf, const dumpfile_t *file);
 char   *summarize_header(const dumpfile_t *file);
 int	known_compress_type(const dumpfile_t *file);
+int	native_encrypt_type(const dumpfile_t *file);
 void	dump_dumpfile_t(const dumpfile_t *file);
 
 /* Returns TRUE if the two headers are equal, FALSE otherwise. */
@@ -194,11 +194,84 @@ test_sync(void)
     return (rv) ? TRUE : FALSE;
 }
 
+/*
+ * Test a message written with writev from a borrowed argument, and read in
+ * place.  The payload fits in a pipe, so there is no need for a thread.
+ */
+static gboolean
+test_in_place(void)
+{
+    int p[2];
+    ipc_binary_proto_t *proto;
+    ipc_binary_cmd_t *cmd;
+    ipc_binary_channel_t *wchan, *rchan;
+    ipc_binary_message_t *msg;
+    char payload[16384];
+    gboolean rv = FALSE;
+    gsize i;
+
+    if (pipe(p) == -1) {
+	perror("pipe");
+	return FALSE;
+    }
+
+    for (i = 0; i < sizeof(payload); i++)
+	payload[i] = (char)(i % 251);
+
+    proto = ipc_binary_proto_new(0xE10E);
+    cmd = ipc_binary_proto_add_cmd(proto, MY_PROTO_CMD1);
+    ipc_binary_cmd_add_arg(cmd, MY_PROTO_HOSTNAME, IPC_BINARY_STRING);
+    ipc_binary_cmd_add_arg(cmd, MY_PROTO_DATA, 0);
+
+    wchan = ipc_binary_new_channel(proto);
+    msg = ipc_binary_new_message(wchan, MY_PROTO_CMD1);
+    ipc_binary_add_arg(msg, MY_PROTO_HOSTNAME, 0, "localhost", 0);
+    ipc_binary_add_arg_ref(msg, MY_PROTO_DATA, sizeof(payload), payload);
+    if (ipc_binary_write_message(wchan, p[1], msg) < 0) {
+	tu_dbg("write failed: %s\n", strerror(errno));
+	goto out;
+    }
+    if (wchan->out.length != 0) {
+	tu_dbg("message was copied in the outgoing buffer\n");
+	goto out;
+    }
+
+    rchan = ipc_binary_new_channel(proto);
+    ipc_binary_set_in_place(rchan, TRUE);
+    msg = ipc_binary_read_message(rchan, p[0]);
+    if (!msg) {
+	tu_dbg("read failed\n");
+	ipc_binary_free_channel(rchan);
+	goto out;
+    }
+    if (!g_str_equal((gchar *)msg->args[MY_PROTO_HOSTNAME].data, "localhost")) {
+	tu_dbg("got bad hostname\n");
+    } else if (msg->args[MY_PROTO_DATA].len != sizeof(payload) ||
+	       memcmp(msg->args[MY_PROTO_DATA].data, payload, sizeof(payload))) {
+	tu_dbg("got bad data\n");
+    } else if ((gchar *)msg->args[MY_PROTO_DATA].data < rchan->in.buf ||
+	       (gchar *)msg->args[MY_PROTO_DATA].data >=
+				rchan->in.buf + rchan->in.size) {
+	tu_dbg("data was not received in place\n");
+    } else {
+	rv = TRUE;
+    }
+    ipc_binary_free_message(msg);
+    ipc_binary_free_channel(rchan);
+
+out:
+    ipc_binary_free_channel(wchan);
+    close(p[0]);
+    close(p[1]);
+    return rv;
+}
+
 int
 main(int argc, char **argv)
 {
     static TestUtilsTest tests[] = {
 	TU_TEST(test_sync, 60),
+	TU_TEST(test_in_place, 60),
 	TU_END()
     };
 
@@ -212,6 +212,14 @@ ipc_binary_free_channel(
     g_free(chan);
 }
 
+void
+ipc_binary_set_in_place(
+    ipc_binary_channel_t *chan,
+    gboolean in_place)
+{
+    chan->in_place = in_place;
+}
+
 ipc_binary_message_t *
 ipc_binary_new_message(
     ipc_binary_channel_t *chan,
@@ -262,6 +270,17 @@ ipc_binary_add_arg(
     msg->args[arg_id].data = data;
 }
 
+void
+ipc_binary_add_arg_ref(
+    ipc_binary_message_t *msg,
+    guint16 arg_id,
+    gsize size,
+    gpointer data)
+{
+    ipc_binary_add_arg(msg, arg_id, size, data, TRUE);
+    msg->args[arg_id].borrowed = TRUE;
+}
+
 void
 ipc_binary_free_message(
     ipc_binary_message_t *msg)
@@ -272,7 +291,7 @@ ipc_binary_free_message(
 
     for (i = 0; i < msg->cmd->n_args; i++) {
 	gpointer data = msg->args[i].data;
-	if (data)
+	if (data && !msg->args[i].borrowed)
 	    g_free(data);
     }
 
@@ -318,6 +337,10 @@ ipc_binary_read_message(
     return msg;
 }
 
+static gsize put_message_header(ipc_binary_channel_t *chan,
+			        ipc_binary_message_t *msg, guint8 *hdr,
+			        struct iovec *iov, int *iovcnt);
+
 int
 ipc_binary_write_message(
     ipc_binary_channel_t *chan,
@@ -326,6 +349,27 @@ ipc_binary_write_message(
 {
     gsize written;
 
+    /* with nothing queued, write the headers and the argument data with one
+     * writev, instead of copying everything in the outgoing buffer */
+    if (chan->out.length == 0) {
+	guint8 *hdr;
+	struct iovec *iov;
+	int iovcnt;
+	gsize msg_len;
+	ssize_t rv;
+
+	g_assert(all_args_present(msg));
+	hdr = g_malloc(MSG_HDR_LEN + ARG_HDR_LEN * msg->cmd->n_args);
+	iov = g_new(struct iovec, 1 + 2 * msg->cmd->n_args);
+	msg_len = put_message_header(chan, msg, hdr, iov, &iovcnt);
+	rv = full_writev(fd, iov, iovcnt);
+	g_free(iov);
+	g_free(hdr);
+	ipc_binary_free_message(msg);
+
+	return (rv < 0 || (gsize)rv < msg_len) ? -1 : 0;
+    }
+
     /* add the message to the queue */
     ipc_binary_queue_message(chan, msg);
 
@@ -454,6 +498,12 @@ ipc_binary_poll_message(
 	    data[arglen] = '\0';
 	    msg->args[arg_id].data = (gpointer)data;
 	    msg->args[arg_id].len = arglen;
+	} else if (chan->in_place) {
+	    /* still valid after consume_from_buffer, until more data is
+	     * put in the buffer */
+	    msg->args[arg_id].data = (gpointer)p;
+	    msg->args[arg_id].len = arglen;
+	    msg->args[arg_id].borrowed = TRUE;
 	} else {
 	    msg->args[arg_id].data = g_memdup(p, arglen);
 	    msg->args[arg_id].len = arglen;
@@ -492,10 +542,72 @@ put_guint32(guint8 *p, guint32 v)
     return p;
 }
 
+static gsize
+message_length(
+    ipc_binary_message_t *msg,
+    guint16 *n_args)
+{
+    gsize msg_len = MSG_HDR_LEN;
+    int i;
+
+    *n_args = 0;
+    for (i = 0; i < msg->cmd->n_args; i++) {
+	if (msg->args[i].data) {
+	    (*n_args)++;
+	    msg_len += msg->args[i].len + ARG_HDR_LEN;
+	}
+    }
+
+    return msg_len;
+}
+
+/* Write the message and argument headers of MSG in HDR, and fill IOV with
+ * the headers interleaved with the argument data.  Returns the message
+ * length. */
+static gsize
+put_message_header(
+    ipc_binary_channel_t *chan,
+    ipc_binary_message_t *msg,
+    guint8 *hdr,
+    struct iovec *iov,
+    int *iovcnt)
+{
+    gsize msg_len;
+    guint16 n_args;
+    guint8 *p = hdr;
+    int i;
+
+    msg_len = message_length(msg, &n_args);
+    p = put_guint16(p, chan->proto->magic);
+    p = put_guint16(p, msg->cmd_id);
+    p = put_guint32(p, msg_len);
+    p = put_guint16(p, n_args);
+    iov[0].iov_base = (void *)hdr;
+    iov[0].iov_len = MSG_HDR_LEN;
+    *iovcnt = 1;
+
+    for (i = 0; i < msg->cmd->n_args; i++) {
+	if (!msg->args[i].data)
+	    continue;
+
+	iov[*iovcnt].iov_base = (void *)p;
+	iov[*iovcnt].iov_len = ARG_HDR_LEN;
+	(*iovcnt)++;
+	p = put_guint32(p, msg->args[i].len);
+	p = put_guint16(p, i);
+
+	iov[*iovcnt].iov_base = msg->args[i].data;
+	iov[*iovcnt].iov_len = msg->args[i].len;
+	(*iovcnt)++;
+    }
+
+    return msg_len;
+}
+
 void
 ipc_binary_queue_message(
-    ipc_binary_channel_t *chan G_GNUC_UNUSED,
-    ipc_binary_message_t *msg G_GNUC_UNUSED)
+    ipc_binary_channel_t *chan,
+    ipc_binary_message_t *msg)
 {
     gsize msg_len;
     guint8 *p;
@@ -505,15 +617,10 @@ ipc_binary_queue_message(
     g_assert(all_args_present(msg));
 
     /* calculate the length and make enough room in the buffer */
-    msg_len = MSG_HDR_LEN;
-    for (i = 0; i < msg->cmd->n_args; i++) {
-	if (msg->args[i].data) {
-	    n_args++;
-	    msg_len += msg->args[i].len + ARG_HDR_LEN;
-	}
-    }
+    msg_len = message_length(msg, &n_args);
     expand_buffer(&chan->out, msg_len);
-    p = (guint8 *)(chan->out.buf + chan->out.offset);
+    /* after the data already queued */
+    p = (guint8 *)(chan->out.buf + chan->out.offset + chan->out.length);
 
     /* write the packet */
     p = put_guint16(p, chan->proto->magic);
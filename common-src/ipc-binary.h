@@ -183,6 +183,10 @@ typedef struct ipc_binary_channel_t {
 
     /* buffers for incoming and outgoing data */
     ipc_binary_buf_t in, out;
+
+    /* if TRUE, received messages point into the incoming buffer; see
+     * ipc_binary_set_in_place */
+    gboolean in_place;
 } ipc_binary_channel_t;
 
 /* Create a new channel, ready to send and receive messages.
@@ -200,6 +204,21 @@ ipc_binary_channel_t *ipc_binary_new_channel(
 void ipc_binary_free_channel(
     ipc_binary_channel_t *channel);
 
+/* Set the receive mode of a channel.  In place, the data of the non-string
+ * arguments of a received message is not copied: it points into the incoming
+ * buffer of the channel, and is only valid until the next call to
+ * ipc_binary_feed_data or ipc_binary_read_message on this channel.  Use
+ * it for bulk data that is consumed before the next message is read.  String
+ * arguments are always copied, to terminate them.  The message must still be
+ * freed with ipc_binary_free_message.
+ *
+ * @param chan: the channel
+ * @param in_place: TRUE to receive in place, FALSE to copy (the default)
+ */
+void ipc_binary_set_in_place(
+    ipc_binary_channel_t *chan,
+    gboolean in_place);
+
 /* message format; use the argument id as an index into the args array.  If
  * DATA is NULL, then the argument wasn't present. */
 
@@ -212,6 +231,7 @@ typedef struct ipc_binary_message_t {
     struct {
 	gsize len;
 	gpointer data;
+	gboolean borrowed;	/* DATA is not freed with the message */
     } *args;
 } ipc_binary_message_t;
 
@@ -244,6 +264,22 @@ void ipc_binary_add_arg(
     gpointer data,
     gboolean take_memory);
 
+/* Add an argument to a message without copying it, nor taking ownership of
+ * it.  The data must stay valid until the message is written or queued.
+ * ipc_binary_write_message sends it straight from DATA, so this is the way to
+ * send large payloads.
+ *
+ * @param msg: the message to change
+ * @param arg: the argument ID
+ * @param size: the argument size
+ * @param data: the argument data
+ */
+void ipc_binary_add_arg_ref(
+    ipc_binary_message_t *msg,
+    guint16 arg,
+    gsize size,
+    gpointer data);
+
 /* Free a message structure (including all associated memory)
  *
  * @param msg: message to free
@@ -272,7 +308,9 @@ ipc_binary_message_t *ipc_binary_read_message(
 
 /* Send the given message, blocking until it is completely transmitted.
  * This function automatically frees the message.  Returns -1 on error,
- * with errno set appropriately, or 0 on success.
+ * with errno set appropriately, or 0 on success.  If nothing is queued on the
+ * channel, the arguments are written with writev, without being copied into
+ * the outgoing buffer.
  *
  * @param chan: channel on which to send the message
  * @param fd: file descriptor to write to
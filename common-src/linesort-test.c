@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+#include "amanda.h"
+#include "testutils.h"
+#include "simpleprng.h"
+#include "linesort.h"
+
+#define TEST_PREFIX "./linesort-test.tmp"
+
+/* Utilities */
+
+static int
+cmp_str(
+    const void *a,
+    const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* random index-like lines, not sorted, with bytes above 0x7f */
+static char **
+random_lines(
+    guint32 seed,
+    guint count)
+{
+    static const char *parts[] = {
+	"/", "etc", "usr", "a b", "b-c", "b0", "\303\251t\303\251", "_", "Z"
+    };
+    simpleprng_state_t state;
+    char **lines = g_new0(char *, count + 1);
+    guint i, j, n;
+
+    simpleprng_seed(&state, seed);
+    for (i = 0; i < count; i++) {
+	GString *line = g_string_new(NULL);
+
+	n = 1 + simpleprng_rand_byte(&state) % 6;
+	for (j = 0; j < n; j++) {
+	    g_string_append_c(line, '/');
+	    g_string_append(line,
+		parts[simpleprng_rand_byte(&state) % G_N_ELEMENTS(parts)]);
+	}
+	lines[i] = g_string_free(line, FALSE);
+    }
+    return lines;
+}
+
+/* sort the lines, handed in pieces of SPLIT bytes, and compare the result
+ * with qsort */
+static gboolean
+sort_and_check(
+    char **lines,
+    guint count,
+    gsize chunk_size,
+    int nthreads,
+    gsize split)
+{
+    linesort_t *ls;
+    GString *input = g_string_new(NULL);
+    char *output = NULL;
+    char *expected;
+    char **sorted;
+    gsize len, off;
+    gboolean ret = TRUE;
+    int fd;
+    guint i;
+
+    for (i = 0; i < count; i++) {
+	g_string_append(input, lines[i]);
+	g_string_append_c(input, '\n');
+    }
+
+    ls = linesort_new(TEST_PREFIX, chunk_size, nthreads);
+    for (off = 0; off < input->len; off += split)
+	linesort_add(ls, input->str + off, MIN(split, input->len - off));
+
+    unlink(TEST_PREFIX);
+    fd = open(TEST_PREFIX, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+    if (fd < 0 || !linesort_finish(ls, fd)) {
+	tu_dbg("linesort_finish failed: %s\n",
+	       fd < 0 ? strerror(errno) : linesort_error(ls));
+	ret = FALSE;
+    }
+    if (fd >= 0)
+	close(fd);
+    linesort_free(ls);
+
+    sorted = g_memdup(lines, count * sizeof(char *));
+    qsort(sorted, count, sizeof(char *), cmp_str);
+    g_string_truncate(input, 0);
+    for (i = 0; i < count; i++) {
+	g_string_append(input, sorted[i]);
+	g_string_append_c(input, '\n');
+    }
+    g_free(sorted);
+    expected = g_string_free(input, FALSE);
+
+    if (ret && (!g_file_get_contents(TEST_PREFIX, &output, &len, NULL) ||
+		!g_str_equal(output, expected))) {
+	tu_dbg("chunk %zu threads %d split %zu: wrong output\n",
+	       chunk_size, nthreads, split);
+	ret = FALSE;
+    }
+    unlink(TEST_PREFIX);
+
+    /* the runs are removed by linesort_free */
+    for (i = 0; i < 10; i++) {
+	char *run = g_strdup_printf("%s.run%u", TEST_PREFIX, i);
+	if (access(run, F_OK) == 0) {
+	    tu_dbg("%s was not removed\n", run);
+	    ret = FALSE;
+	}
+	g_free(run);
+    }
+
+    g_free(output);
+    g_free(expected);
+    return ret;
+}
+
+/* Tests */
+
+static gboolean
+test_in_memory(void)
+{
+    char **lines = random_lines(0xabcd, 1000);
+    gboolean ret;
+
+    ret = sort_and_check(lines, 1000, 0, 0, 4096);
+    g_strfreev(lines);
+    return ret;
+}
+
+static gboolean
+test_runs(void)
+{
+    char **lines = random_lines(0x1234, 5000);
+    gboolean ret = TRUE;
+
+    /* a line split between two calls, and one byte at a time */
+    ret = sort_and_check(lines, 5000, 8192, 0, 1000) && ret;
+    ret = sort_and_check(lines, 5000, 64*1024, 0, 1) && ret;
+    g_strfreev(lines);
+    return ret;
+}
+
+static gboolean
+test_runs_threads(void)
+{
+    char **lines = random_lines(0x5678, 20000);
+    gboolean ret = TRUE;
+
+    ret = sort_and_check(lines, 20000, 8192, 4, 65536) && ret;
+    ret = sort_and_check(lines, 20000, 100000, LINESORT_THREADS_AUTO, 777)
+	&& ret;
+    g_strfreev(lines);
+    return ret;
+}
+
+static gboolean
+test_no_newline(void)
+{
+    linesort_t *ls = linesort_new(TEST_PREFIX, 0, 0);
+    char *output = NULL;
+    gboolean ret;
+    int fd;
+
+    linesort_add(ls, "/b\n/a\n/c", 8);
+    fd = open(TEST_PREFIX, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+    ret = fd >= 0 && linesort_finish(ls, fd);
+    if (fd >= 0)
+	close(fd);
+    linesort_free(ls);
+
+    ret = ret && g_file_get_contents(TEST_PREFIX, &output, NULL, NULL) &&
+	  g_str_equal(output, "/a\n/b\n/c\n");
+    if (!ret)
+	tu_dbg("got '%s'\n", output ? output : "(null)");
+    unlink(TEST_PREFIX);
+    g_free(output);
+    return ret;
+}
+
+static gboolean
+append_output(
+    gpointer data,
+    const char *buf,
+    gsize len)
+{
+    g_string_append_len((GString *)data, buf, len);
+    return TRUE;
+}
+
+static gboolean
+test_finish_func(void)
+{
+    char **lines = random_lines(0x9abc, 20000);
+    GString *output = g_string_new(NULL);
+    GString *expected = g_string_new(NULL);
+    linesort_t *ls = linesort_new(TEST_PREFIX, 100000, 0);
+    gboolean ret;
+    guint i;
+
+    for (i = 0; i < 20000; i++) {
+	linesort_add(ls, lines[i], strlen(lines[i]));
+	linesort_add(ls, "\n", 1);
+    }
+    ret = linesort_finish_func(ls, append_output, output);
+    if (!ret)
+	tu_dbg("linesort_finish_func failed: %s\n", linesort_error(ls));
+    linesort_free(ls);
+
+    qsort(lines, 20000, sizeof(char *), cmp_str);
+    for (i = 0; i < 20000; i++) {
+	g_string_append(expected, lines[i]);
+	g_string_append_c(expected, '\n');
+    }
+    if (ret && !g_str_equal(output->str, expected->str)) {
+	tu_dbg("wrong output from linesort_finish_func\n");
+	ret = FALSE;
+    }
+
+    g_string_free(output, TRUE);
+    g_string_free(expected, TRUE);
+    g_strfreev(lines);
+    return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+    static TestUtilsTest tests[] = {
+	TU_TEST(test_in_memory, 90),
+	TU_TEST(test_runs, 90),
+	TU_TEST(test_runs_threads, 90),
+	TU_TEST(test_no_newline, 90),
+	TU_TEST(test_finish_func, 90),
+	TU_END()
+    };
+
+    glib_init();
+
+    return testutils_run_tests(argc, argv, tests);
+}
@@ -0,0 +1,553 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+/*
+ * In-process external sort of text lines, in byte order
+ */
+
+#include "amanda.h"
+#include "linesort.h"
+#include "amexec.h"
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+/* upper limit for LINESORT_THREADS_AUTO */
+#define LINESORT_MAX_THREADS 8
+
+/* The runs are written with a fast zlib level: index lines compress well,
+ * and the runs are read back only once. */
+#ifdef HAVE_LIBZ
+typedef gzFile run_file_t;
+#define run_open_write(name)	gzopen((name), "wb1")
+#define run_open_read(name)	gzopen((name), "rb")
+#define run_puts(f, s)		(gzputs((f), (s)) >= 0 && gzputc((f), '\n') >= 0)
+#define run_gets(f, buf, len)	gzgets((f), (buf), (len))
+#define run_close(f)		(gzclose(f) == Z_OK)
+#else
+typedef FILE *run_file_t;
+#define run_open_write(name)	fopen((name), "w")
+#define run_open_read(name)	fopen((name), "r")
+#define run_puts(f, s)		(fputs((s), (f)) >= 0 && putc('\n', (f)) != EOF)
+#define run_gets(f, buf, len)	fgets((buf), (len), (f))
+#define run_close(f)		(fclose(f) == 0)
+#endif
+
+/* The lines of one chunk, each terminated by a NUL in data */
+typedef struct linesort_chunk_s {
+    GString *data;
+    GArray *offsets;		/* gsize offset of each line in data */
+    char *filename;		/* the run written from the chunk */
+    char *errmsg;
+    gboolean done;
+} linesort_chunk_t;
+
+/* One run being merged */
+typedef struct linesort_run_s {
+    run_file_t file;
+    GString *line;
+} linesort_run_t;
+
+struct linesort_s {
+    char *prefix;
+    gsize chunk_size;
+    linesort_chunk_t *chunk;	/* the chunk being filled */
+    GString *partial;		/* the start of a line not yet complete */
+    GSList *runs;		/* the run filenames, in order */
+    guint nruns;
+    char *errmsg;
+
+    /* with threads, the full chunks are sorted and written by the pool;
+     * at most max_jobs of them are in memory at once */
+    amexec_queue_t *pool;
+    GMutex *mutex;		/* protects the done flags */
+    GCond *cond;		/* signalled when a chunk is done */
+    GQueue *jobs;		/* linesort_chunk_t in flight, oldest first */
+    guint max_jobs;
+};
+
+/* Where linesort_finish writes the lines: a stdio stream, or blocks of lines
+ * given to a function */
+typedef struct linesort_out_s {
+    FILE *file;
+    linesort_write_func func;
+    gpointer data;
+    GString *buf;
+    gboolean failed;
+} linesort_out_t;
+
+#define LINESORT_OUT_BLOCK (64*1024)
+
+static linesort_chunk_t *
+chunk_new(void)
+{
+    linesort_chunk_t *chunk = g_new0(linesort_chunk_t, 1);
+
+    chunk->data = g_string_sized_new(1024*1024);
+    chunk->offsets = g_array_new(FALSE, FALSE, sizeof(gsize));
+    return chunk;
+}
+
+static void
+chunk_free(
+    linesort_chunk_t *chunk)
+{
+    if (chunk->data)
+	g_string_free(chunk->data, TRUE);
+    g_array_free(chunk->offsets, TRUE);
+    g_free(chunk->filename);
+    g_free(chunk->errmsg);
+    g_free(chunk);
+}
+
+static int
+line_cmp(
+    const void *a,
+    const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* the lines of the chunk, sorted */
+static char **
+chunk_sort(
+    linesort_chunk_t *chunk)
+{
+    char **lines = g_new(char *, chunk->offsets->len + 1);
+    guint i;
+
+    for (i = 0; i < chunk->offsets->len; i++)
+	lines[i] = chunk->data->str + g_array_index(chunk->offsets, gsize, i);
+    qsort(lines, chunk->offsets->len, sizeof(char *), line_cmp);
+    return lines;
+}
+
+/* sort the chunk and write it to its run file */
+static void
+chunk_write_run(
+    linesort_chunk_t *chunk)
+{
+    run_file_t run;
+    char **lines = chunk_sort(chunk);
+    guint i;
+
+    if (!(run = run_open_write(chunk->filename))) {
+	chunk->errmsg = g_strdup_printf(_("can't write '%s': %s"),
+					chunk->filename, strerror(errno));
+    } else {
+	for (i = 0; i < chunk->offsets->len; i++) {
+	    if (!run_puts(run, lines[i]))
+		break;
+	}
+	if (!run_close(run) || i < chunk->offsets->len) {
+	    chunk->errmsg = g_strdup_printf(_("can't write '%s': %s"),
+					    chunk->filename, strerror(errno));
+	}
+    }
+    g_free(lines);
+
+    /* the lines are not needed anymore */
+    g_string_free(chunk->data, TRUE);
+    chunk->data = NULL;
+}
+
+/* runs on the pool */
+static void
+chunk_thread(
+    gpointer data,
+    gpointer user_data)
+{
+    linesort_chunk_t *chunk = (linesort_chunk_t *)data;
+    linesort_t *ls = (linesort_t *)user_data;
+
+    chunk_write_run(chunk);
+
+    g_mutex_lock(ls->mutex);
+    chunk->done = TRUE;
+    g_cond_broadcast(ls->cond);
+    g_mutex_unlock(ls->mutex);
+}
+
+static void
+collect_error(
+    linesort_t *ls,
+    linesort_chunk_t *chunk)
+{
+    if (chunk->errmsg && !ls->errmsg) {
+	ls->errmsg = chunk->errmsg;
+	chunk->errmsg = NULL;
+    }
+}
+
+/* free the finished chunks, waiting for the oldest one until no more than
+ * MAX_PENDING chunks are in flight */
+static void
+collect_jobs(
+    linesort_t *ls,
+    guint max_pending)
+{
+    linesort_chunk_t *chunk;
+
+    g_mutex_lock(ls->mutex);
+    while ((chunk = g_queue_peek_head(ls->jobs))) {
+	if (!chunk->done) {
+	    if (g_queue_get_length(ls->jobs) <= max_pending)
+		break;
+	    g_cond_wait(ls->cond, ls->mutex);
+	    continue;
+	}
+	g_queue_pop_head(ls->jobs);
+	collect_error(ls, chunk);
+	chunk_free(chunk);
+    }
+    g_mutex_unlock(ls->mutex);
+}
+
+/* write the current chunk to a new run */
+static void
+flush_chunk(
+    linesort_t *ls)
+{
+    linesort_chunk_t *chunk = ls->chunk;
+
+    chunk->filename = g_strdup_printf("%s.run%u", ls->prefix, ls->nruns++);
+    ls->runs = g_slist_prepend(ls->runs, g_strdup(chunk->filename));
+    ls->chunk = chunk_new();
+
+    if (ls->pool) {
+	collect_jobs(ls, ls->max_jobs - 1);
+	g_mutex_lock(ls->mutex);
+	g_queue_push_tail(ls->jobs, chunk);
+	g_mutex_unlock(ls->mutex);
+	amexec_queue_push(ls->pool, chunk);
+    } else {
+	chunk_write_run(chunk);
+	collect_error(ls, chunk);
+	chunk_free(chunk);
+    }
+}
+
+static void
+add_line(
+    linesort_t *ls,
+    const char *line,
+    gsize len)
+{
+    linesort_chunk_t *chunk = ls->chunk;
+    gsize offset = chunk->data->len;
+
+    g_string_append_len(chunk->data, line, len);
+    g_string_append_c(chunk->data, '\0');
+    g_array_append_val(chunk->offsets, offset);
+    if (chunk->data->len + chunk->offsets->len * sizeof(char *)
+	    >= ls->chunk_size)
+	flush_chunk(ls);
+}
+
+linesort_t *
+linesort_new(
+    const char *prefix,
+    gsize chunk_size,
+    int nthreads)
+{
+    linesort_t *ls = g_new0(linesort_t, 1);
+
+    ls->prefix = g_strdup(prefix);
+    ls->chunk_size = chunk_size ? chunk_size : LINESORT_CHUNK_SIZE;
+    ls->chunk = chunk_new();
+    ls->partial = g_string_new(NULL);
+
+    if (nthreads == LINESORT_THREADS_AUTO) {
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+	nthreads = ncpu > 0 ? (int)MIN(ncpu, LINESORT_MAX_THREADS) : 1;
+    }
+    if (nthreads > 1) {
+	ls->mutex = g_mutex_new();
+	ls->cond = g_cond_new();
+	ls->jobs = g_queue_new();
+	ls->max_jobs = nthreads;
+	ls->pool = amexec_queue_new("linesort", chunk_thread, ls, nthreads,
+				    AMEXEC_PRIORITY_LOW, 0);
+    }
+
+    return ls;
+}
+
+void
+linesort_add(
+    linesort_t *ls,
+    const char *buf,
+    gsize len)
+{
+    const char *end = buf + len;
+    const char *nl;
+
+    while (buf < end && (nl = memchr(buf, '\n', end - buf)) != NULL) {
+	if (ls->partial->len) {
+	    g_string_append_len(ls->partial, buf, nl - buf);
+	    add_line(ls, ls->partial->str, ls->partial->len);
+	    g_string_truncate(ls->partial, 0);
+	} else {
+	    add_line(ls, buf, nl - buf);
+	}
+	buf = nl + 1;
+    }
+    if (buf < end)
+	g_string_append_len(ls->partial, buf, end - buf);
+}
+
+static void
+out_flush(
+    linesort_out_t *out)
+{
+    if (!out->failed && out->buf->len > 0)
+	out->failed = !out->func(out->data, out->buf->str, out->buf->len);
+    g_string_truncate(out->buf, 0);
+}
+
+static void
+out_line(
+    linesort_out_t *out,
+    const char *line)
+{
+    if (out->file) {
+	fputs(line, out->file);
+	putc('\n', out->file);
+	return;
+    }
+    g_string_append(out->buf, line);
+    g_string_append_c(out->buf, '\n');
+    if (out->buf->len >= LINESORT_OUT_BLOCK)
+	out_flush(out);
+}
+
+/* read the next line of a run, without its newline */
+static gboolean
+run_read_line(
+    linesort_run_t *run)
+{
+    char buf[4096];
+    gsize len;
+
+    g_string_truncate(run->line, 0);
+    while (run_gets(run->file, buf, sizeof(buf)) != NULL) {
+	len = strlen(buf);
+	if (len > 0 && buf[len-1] == '\n') {
+	    g_string_append_len(run->line, buf, len - 1);
+	    return TRUE;
+	}
+	g_string_append_len(run->line, buf, len);
+    }
+    return run->line->len > 0;
+}
+
+/* Reorder heap[i] down the min-heap of n runs */
+static void
+heap_down(
+    linesort_run_t **heap,
+    guint n,
+    guint i)
+{
+    for (;;) {
+	guint smallest = i;
+	guint l = 2*i + 1;
+	guint r = 2*i + 2;
+	linesort_run_t *t;
+
+	if (l < n && strcmp(heap[l]->line->str, heap[smallest]->line->str) < 0)
+	    smallest = l;
+	if (r < n && strcmp(heap[r]->line->str, heap[smallest]->line->str) < 0)
+	    smallest = r;
+	if (smallest == i)
+	    return;
+	t = heap[i];
+	heap[i] = heap[smallest];
+	heap[smallest] = t;
+	i = smallest;
+    }
+}
+
+/* k-way merge of all the runs to out */
+static void
+merge_runs(
+    linesort_t *ls,
+    linesort_out_t *out)
+{
+    linesort_run_t **heap = g_new0(linesort_run_t *, ls->nruns);
+    linesort_run_t *run;
+    guint n = 0;
+    guint i;
+    GSList *r;
+
+    ls->runs = g_slist_reverse(ls->runs);
+    for (r = ls->runs; r != NULL; r = r->next) {
+	run = g_new0(linesort_run_t, 1);
+	if (!(run->file = run_open_read((char *)r->data))) {
+	    if (!ls->errmsg)
+		ls->errmsg = g_strdup_printf(_("can't read '%s': %s"),
+					     (char *)r->data, strerror(errno));
+	    g_free(run);
+	    continue;
+	}
+	run->line = g_string_new(NULL);
+	if (!run_read_line(run)) {
+	    run_close(run->file);
+	    g_string_free(run->line, TRUE);
+	    g_free(run);
+	    continue;
+	}
+	heap[n++] = run;
+    }
+    for (i = n / 2; i-- > 0; )
+	heap_down(heap, n, i);
+
+    while (n > 0) {
+	run = heap[0];
+	out_line(out, run->line->str);
+	if (!run_read_line(run)) {
+	    run_close(run->file);
+	    g_string_free(run->line, TRUE);
+	    g_free(run);
+	    heap[0] = heap[--n];
+	}
+	heap_down(heap, n, 0);
+    }
+    g_free(heap);
+}
+
+static void
+finish_to(
+    linesort_t *ls,
+    linesort_out_t *out)
+{
+    if (ls->partial->len) {
+	add_line(ls, ls->partial->str, ls->partial->len);
+	g_string_truncate(ls->partial, 0);
+    }
+
+    if (!ls->runs) {
+	/* everything fit in memory */
+	char **lines = chunk_sort(ls->chunk);
+	guint i;
+
+	for (i = 0; i < ls->chunk->offsets->len; i++) {
+	    out_line(out, lines[i]);
+	}
+	g_free(lines);
+    } else {
+	if (ls->chunk->offsets->len)
+	    flush_chunk(ls);
+	if (ls->pool)
+	    collect_jobs(ls, 0);
+	if (!ls->errmsg)
+	    merge_runs(ls, out);
+    }
+}
+
+gboolean
+linesort_finish(
+    linesort_t *ls,
+    int fd)
+{
+    linesort_out_t out = { NULL, NULL, NULL, NULL, FALSE };
+    int   dupfd;
+
+    if ((dupfd = dup(fd)) == -1 || !(out.file = fdopen(dupfd, "w"))) {
+	if (dupfd != -1)
+	    close(dupfd);
+	g_free(ls->errmsg);
+	ls->errmsg = g_strdup_printf(_("can't write the sorted lines: %s"),
+				     strerror(errno));
+	return FALSE;
+    }
+
+    finish_to(ls, &out);
+
+    if (fclose(out.file) != 0 && !ls->errmsg) {
+	ls->errmsg = g_strdup_printf(_("can't write the sorted lines: %s"),
+				     strerror(errno));
+    }
+    return ls->errmsg == NULL;
+}
+
+gboolean
+linesort_finish_func(
+    linesort_t *ls,
+    linesort_write_func func,
+    gpointer data)
+{
+    linesort_out_t out = { NULL, NULL, NULL, NULL, FALSE };
+
+    out.func = func;
+    out.data = data;
+    out.buf = g_string_sized_new(LINESORT_OUT_BLOCK + 4096);
+
+    finish_to(ls, &out);
+    out_flush(&out);
+    g_string_free(out.buf, TRUE);
+
+    if (out.failed && !ls->errmsg)
+	ls->errmsg = g_strdup(_("can't write the sorted lines"));
+    return ls->errmsg == NULL;
+}
+
+const char *
+linesort_error(
+    linesort_t *ls)
+{
+    return ls->errmsg;
+}
+
+void
+linesort_free(
+    linesort_t *ls)
+{
+    GSList *r;
+
+    if (!ls)
+	return;
+
+    if (ls->pool) {
+	/* wait for the workers to finish whatever they started */
+	amexec_queue_free(ls->pool, FALSE);
+	g_queue_foreach(ls->jobs, (GFunc)chunk_free, NULL);
+    }
+    if (ls->mutex) {
+	g_queue_free(ls->jobs);
+	g_mutex_free(ls->mutex);
+	g_cond_free(ls->cond);
+    }
+    for (r = ls->runs; r != NULL; r = r->next)
+	unlink((char *)r->data);
+    slist_free_full(ls->runs, g_free);
+    chunk_free(ls->chunk);
+    g_string_free(ls->partial, TRUE);
+    g_free(ls->prefix);
+    g_free(ls->errmsg);
+    g_free(ls);
+}
@@ -0,0 +1,98 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+/*
+ * In-process external sort of text lines, in byte order
+ */
+
+#ifndef LINESORT_H
+#define LINESORT_H
+
+#include <glib.h>
+
+/* default number of bytes of lines sorted in memory at once */
+#define LINESORT_CHUNK_SIZE (64*1024*1024)
+
+/* nthreads value asking for one sort thread per online CPU */
+#define LINESORT_THREADS_AUTO (-1)
+
+typedef struct linesort_s linesort_t;
+
+/* Create a new sort.  The lines are kept in memory up to CHUNK_SIZE bytes;
+ * each full chunk is sorted and written to a run file named PREFIX.runN,
+ * compressed when zlib is available, and the runs are merged by
+ * linesort_finish.  The lines are compared as bytes, as by 'LC_ALL=C sort'.
+ *
+ * @param prefix: the start of the run filenames
+ * @param chunk_size: bytes per chunk, or 0 for LINESORT_CHUNK_SIZE
+ * @param nthreads: threads that sort and write the runs while the caller
+ *	keeps adding lines; 0 or 1 to do it in the calling thread, or
+ *	LINESORT_THREADS_AUTO for one per online CPU
+ * @returns: new sort
+ */
+linesort_t *linesort_new(const char *prefix, gsize chunk_size, int nthreads);
+
+/* Add LEN bytes of newline-separated lines.  A line may be split across
+ * calls.
+ *
+ * @param ls: the sort
+ * @param buf: the data
+ * @param len: length of the data
+ */
+void linesort_add(linesort_t *ls, const char *buf, gsize len);
+
+/* Write all the lines, sorted and each terminated by a newline, to FD.
+ *
+ * @param ls: the sort
+ * @param fd: the output; it is not closed
+ * @returns: FALSE on error; see linesort_error
+ */
+gboolean linesort_finish(linesort_t *ls, int fd);
+
+/* A consumer of the sorted lines, for linesort_finish_func; returns FALSE to
+ * stop the output. */
+typedef gboolean (*linesort_write_func)(gpointer data, const char *buf,
+					gsize len);
+
+/* Like linesort_finish, but hand the sorted lines, in blocks of whole lines,
+ * to FUNC instead of writing them to a file descriptor.
+ *
+ * @param ls: the sort
+ * @param func: the consumer
+ * @param data: passed to FUNC
+ * @returns: FALSE on error or if FUNC failed; see linesort_error
+ */
+gboolean linesort_finish_func(linesort_t *ls, linesort_write_func func,
+			      gpointer data);
+
+/* Get the error message of a failed linesort_finish
+ */
+const char *linesort_error(linesort_t *ls);
+
+/* Free the sort and remove its run files */
+void linesort_free(linesort_t *ls);
+
+#endif /* LINESORT_H */
@@ -332,6 +332,8 @@ static gboolean
 test_match_tar(void)
 {
     gboolean ok = TRUE;
+    tar_matcher_t *tm;
+    GPtrArray *globs;
     struct {
 	char *expr, *str;
 	gboolean should_match;
@@ -440,7 +442,39 @@ test_match_tar(void)
 			t->str, t->expr);
 	    }
 	}
+	if (!!match_tar_compiled(compile_tar(t->expr), t->str) != !!matched) {
+	    ok = FALSE;
+	    g_fprintf(stderr, "compiled tar %s does not match %s like match_tar\n",
+		    t->expr, t->str);
+	}
+	tm = compile_tar_list(&t->expr, 1);
+	if (!!match_tar_list(tm, t->str) != !!matched) {
+	    ok = FALSE;
+	    g_fprintf(stderr, "tar list %s does not match %s like match_tar\n",
+		    t->expr, t->str);
+	}
+	free_tar_matcher(tm);
+    }
+
+    /* all the expressions in one list match a string if any of them does */
+    globs = g_ptr_array_new();
+    for (t = tests; t->expr; t++)
+	g_ptr_array_add(globs, t->expr);
+    tm = compile_tar_list((char **)globs->pdata, globs->len);
+    for (t = tests; t->expr; t++) {
+	gboolean any = FALSE;
+	guint i;
+
+	for (i = 0; i < globs->len; i++)
+	    any = any || match_tar(g_ptr_array_index(globs, i), t->str);
+	if (!!match_tar_list(tm, t->str) != !!any) {
+	    ok = FALSE;
+	    g_fprintf(stderr, "tar list does not match %s like match_tar\n",
+		    t->str);
+	}
     }
+    free_tar_matcher(tm);
+    g_ptr_array_free(globs, TRUE);
 
     return ok;
 }
@@ -501,6 +535,7 @@ static gboolean
 test_match_host(void)
 {
     gboolean ok = TRUE;
+    matcher_t *m;
     struct {
 	char *expr, *str;
 	gboolean should_match;
@@ -604,6 +639,13 @@ test_match_host(void)
 			t->str, t->expr);
 	    }
 	}
+	m = compile_host(t->expr);
+	if (!!match_compiled(m, t->str) != !!t->should_match) {
+	    ok = FALSE;
+	    g_fprintf(stderr, "compiled host expr %s does not match %s like match_host\n",
+		    t->expr, t->str);
+	}
+	free_matcher(m);
     }
 
     return ok;
@@ -658,6 +700,7 @@ static gboolean
 test_match_disk(void)
 {
     gboolean ok = TRUE;
+    matcher_t *m;
     struct {
 	char *expr, *str;
 	gboolean should_match;
@@ -798,6 +841,13 @@ test_match_disk(void)
 			t->str, t->expr);
 	    }
 	}
+	m = compile_disk(t->expr);
+	if (!!match_compiled(m, t->str) != !!t->should_match) {
+	    ok = FALSE;
+	    g_fprintf(stderr, "compiled disk expr %s does not match %s like match_disk\n",
+		    t->expr, t->str);
+	}
+	free_matcher(m);
     }
 
     return ok;
@@ -643,11 +643,10 @@ static char *tar_to_regex(const char *glob)
     return amglob_to_regex(glob, "(^|/)", "($|/)", &tar_subst_stable);
 }
 
-int match_tar(const char *glob, const char *str)
+regex_t *compile_tar(const char *glob)
 {
     char *regex;
     regex_t *re;
-    int result;
     regex_errbuf errmsg;
 
     regex = tar_to_regex(glob);
@@ -657,17 +656,275 @@ int match_tar(const char *glob, const char *str)
         error("glob \"%s\" -> regex \"%s\": %s", glob, regex, errmsg);
         /*NOTREACHED*/
 
+    g_free(regex);
+
+    return re;
+}
+
+int match_tar_compiled(regex_t *re, const char *str)
+{
+    int result;
+    regex_errbuf errmsg;
+
     result = try_match(re, str, &errmsg);
 
     if (result == MATCH_ERROR)
-        error("glob \"%s\" -> regex \"%s\": %s", glob, regex, errmsg);
+        error("tar expression: %s", errmsg);
         /*NOTREACHED*/
 
-    g_free(regex);
-
     return result;
 }
 
+int match_tar(const char *glob, const char *str)
+{
+    return match_tar_compiled(compile_tar(glob), str);
+}
+
+/*
+ * A list of tar globs, matched all at once.  A tar glob matches a sequence of
+ * whole path components, and '*' may cross a '/', so:
+ * - a literal glob matches if it starts at the start of a component and ends
+ *   at the end of one;
+ * - "literal*" matches if the literal starts at the start of a component;
+ * - "*literal" matches if the literal ends at the end of a component.
+ * The first two are kept in a trie walked from each component start, the last
+ * one in a trie of the reversed literals walked back from each component end.
+ * All other globs are joined in one regex.
+ */
+
+typedef struct tar_trie_s {
+    char c;
+    gboolean exact;		/* a literal ends here */
+    gboolean prefix;		/* a "literal*" ends here */
+    struct tar_trie_s *child;
+    struct tar_trie_s *sibling;
+} tar_trie_t;
+
+struct tar_matcher_s {
+    tar_trie_t *prefixes;
+    tar_trie_t *suffixes;
+    regex_t *re;		/* the other globs, or NULL */
+    regex_t **each_re;		/* every glob, owned by the regex cache */
+    int nb_globs;
+};
+
+static tar_trie_t *
+tar_trie_add(
+    tar_trie_t **root,
+    const char *literal,
+    gsize len,
+    gboolean reverse)
+{
+    tar_trie_t *node;
+    gsize i;
+
+    if (!*root)
+	*root = g_new0(tar_trie_t, 1);
+    node = *root;
+    for (i = 0; i < len; i++) {
+	char c = reverse ? literal[len - 1 - i] : literal[i];
+	tar_trie_t *child;
+
+	for (child = node->child; child; child = child->sibling) {
+	    if (child->c == c)
+		break;
+	}
+	if (!child) {
+	    child = g_new0(tar_trie_t, 1);
+	    child->c = c;
+	    child->sibling = node->child;
+	    node->child = child;
+	}
+	node = child;
+    }
+    return node;
+}
+
+static void
+tar_trie_free(
+    tar_trie_t *node)
+{
+    while (node) {
+	tar_trie_t *sibling = node->sibling;
+	tar_trie_free(node->child);
+	g_free(node);
+	node = sibling;
+    }
+}
+
+static tar_trie_t *
+tar_trie_step(
+    tar_trie_t *node,
+    char c)
+{
+    for (node = node->child; node; node = node->sibling) {
+	if (node->c == c)
+	    return node;
+    }
+    return NULL;
+}
+
+static gboolean
+tar_glob_is_literal(
+    const char *glob,
+    gsize len)
+{
+    gsize i;
+
+    for (i = 0; i < len; i++) {
+	if (glob[i] == '*' || glob[i] == '?' || glob[i] == '[' ||
+	    glob[i] == '\\')
+	    return FALSE;
+    }
+    return TRUE;
+}
+
+tar_matcher_t *
+compile_tar_list(
+    char **globs,
+    int nb_globs)
+{
+    tar_matcher_t *tm = g_new0(tar_matcher_t, 1);
+    GString *others = NULL;
+    int i;
+
+    tm->nb_globs = nb_globs;
+    tm->each_re = g_new(regex_t *, nb_globs > 0 ? nb_globs : 1);
+    for (i = 0; i < nb_globs; i++) {
+	const char *glob = globs[i];
+	gsize len = strlen(glob);
+	gsize start = 0, end = len;
+
+	/* compile it alone too, it reports a bad glob like match_tar() */
+	tm->each_re[i] = compile_tar(glob);
+
+	while (end > 0 && glob[end - 1] == '*')
+	    end--;
+	if (tar_glob_is_literal(glob, end)) {
+	    tar_trie_t *node = tar_trie_add(&tm->prefixes, glob, end, FALSE);
+	    if (end < len)
+		node->prefix = TRUE;
+	    else
+		node->exact = TRUE;
+	    continue;
+	}
+
+	while (start < len && glob[start] == '*')
+	    start++;
+	if (start > 0 && tar_glob_is_literal(glob + start, len - start)) {
+	    tar_trie_add(&tm->suffixes, glob + start, len - start,
+			 TRUE)->exact = TRUE;
+	    continue;
+	}
+
+	if (!others)
+	    others = g_string_new("(^|/)(");
+	else
+	    g_string_append_c(others, '|');
+	{
+	    char *regex = amglob_to_regex(glob, "(", ")", &tar_subst_stable);
+	    g_string_append(others, regex);
+	    g_free(regex);
+	}
+    }
+
+    if (others) {
+	regex_errbuf errmsg;
+
+	g_string_append(others, ")($|/)");
+	tm->re = g_new(regex_t, 1);
+	if (!do_regex_compile(others->str, tm->re, &errmsg, TRUE))
+	    error("tar globs -> regex \"%s\": %s", others->str, errmsg);
+	    /*NOTREACHED*/
+	g_string_free(others, TRUE);
+    }
+
+    return tm;
+}
+
+int
+match_tar_list(
+    tar_matcher_t *tm,
+    const char *str)
+{
+    const char *s, *p;
+    int i;
+
+    /* with REG_NEWLINE a newline is a boundary for the regexes too; leave
+     * such names to them */
+    if (strchr(str, '\n')) {
+	for (i = 0; i < tm->nb_globs; i++) {
+	    if (match_tar_compiled(tm->each_re[i], str))
+		return MATCH_OK;
+	}
+	return MATCH_NONE;
+    }
+
+    if (tm->prefixes) {
+	/* components start at the beginning and after each '/' */
+	for (s = str; ; s++) {
+	    tar_trie_t *node = tm->prefixes;
+
+	    for (p = s; node; node = tar_trie_step(node, *p++)) {
+		if (node->prefix)
+		    return MATCH_OK;
+		if (node->exact && (*p == '/' || *p == '\0'))
+		    return MATCH_OK;
+		if (*p == '\0')
+		    break;
+	    }
+	    s = strchr(s, '/');
+	    if (!s)
+		break;
+	}
+    }
+
+    if (tm->suffixes) {
+	for (s = str; ; s++) {
+	    if (*s == '/' || *s == '\0') {
+		tar_trie_t *node = tm->suffixes;
+
+		for (p = s; node; node = tar_trie_step(node, *--p)) {
+		    if (node->exact)
+			return MATCH_OK;
+		    if (p == str)
+			break;
+		}
+	    }
+	    if (*s == '\0')
+		break;
+	}
+    }
+
+    if (tm->re) {
+	regex_errbuf errmsg;
+	int result = try_match(tm->re, str, &errmsg);
+
+	if (result == MATCH_ERROR)
+	    error("tar expression: %s", errmsg);
+	    /*NOTREACHED*/
+	return result;
+    }
+
+    return MATCH_NONE;
+}
+
+void
+free_tar_matcher(
+    tar_matcher_t *tm)
+{
+    if (!tm)
+	return;
+    tar_trie_free(tm->prefixes);
+    tar_trie_free(tm->suffixes);
+    if (tm->re) {
+	regfree(tm->re);
+	g_free(tm->re);
+    }
+    g_free(tm->each_re);
+    g_free(tm);
+}
+
 /*
  * DISK/HOST MATCHING
  *
@@ -766,13 +1023,15 @@ out:
     return result;
 }
 
-static int match_word(const char *glob, const char *word, const char separator)
+/*
+ * Build the regex matching the words wrapped by wrap_word() that glob matches
+ */
+
+static char *word_regex(const char *glob, const char separator)
 {
-    char *wrapped_word = wrap_word(word, separator, glob);
     struct mword_regexes *regexes = &mword_slash_regexes;
     struct subst_table *table = &mword_slash_subst_table;
     gboolean not_slash = (separator != '/');
-    int ret;
 
     /*
      * We only expect two separators: '/' or '.'. If it's not '/', it has to be
@@ -784,8 +1043,7 @@ static int match_word(const char *glob, const char *word, const char separator)
     }
 
     if(glob_is_separator_only(glob, separator)) {
-        ret = do_match(regexes->re_double_sep, wrapped_word, TRUE);
-        goto out;
+        return g_strdup(regexes->re_double_sep);
     } else {
         /*
          * Unlike what happens for tar and disk expressions, we need to
@@ -851,13 +1109,20 @@ static int match_word(const char *glob, const char *word, const char separator)
         }
 
         regex = amglob_to_regex(g, begin, end, table);
-        ret = do_match(regex, wrapped_word, TRUE);
-
         g_free(glob_copy);
-        g_free(regex);
+        return regex;
     }
+}
 
-out:
+static int match_word(const char *glob, const char *word, const char separator)
+{
+    char *wrapped_word = wrap_word(word, separator, glob);
+    char *regex = word_regex(glob, separator);
+    int ret;
+
+    ret = do_match(regex, wrapped_word, TRUE);
+
+    g_free(regex);
     g_free(wrapped_word);
     return ret;
 }
@@ -965,9 +1230,156 @@ int match_disk(const char *glob, const char *disk)
 }
 
 /*
- * TIMESTAMPS/LEVEL MATCHING
+ * COMPILED MATCHERS
+ *
+ * A matcher is an expression parsed once, to be matched against many strings.
+ * Host and disk expressions which are plain words, or plain words anchored at
+ * the beginning, are matched with a substring search of the wrapped word
+ * instead of a regex.
  */
 
+typedef enum {
+    MATCHER_HOST,
+    MATCHER_DISK,
+    MATCHER_DATESTAMP,
+    MATCHER_LEVEL
+} matcher_type_t;
+
+typedef enum {
+    MATCH_KIND_ANY,		/* matches everything */
+    MATCH_KIND_STRCMP,		/* "=" expressions: exactly exact */
+    MATCH_KIND_EQUAL,		/* "$"-anchored: exactly exact */
+    MATCH_KIND_PREFIX,		/* starts with exact */
+    MATCH_KIND_RANGE,		/* between first and last, or low and hi */
+    MATCH_KIND_WORD		/* host/disk glob, see word_matcher_t */
+} match_kind_t;
+
+typedef struct word_matcher_s {
+    char *glob;			/* glob given to wrap_word */
+    char *literal;		/* if not NULL, a substring of the wrapped word */
+    gboolean prefix;		/* literal must start the wrapped word */
+    regex_t *re;		/* otherwise; owned by the regex cache */
+} word_matcher_t;
+
+struct matcher_s {
+    matcher_type_t type;
+    match_kind_t kind;
+    char *expr;
+    char *exact;
+    char *first, *last;		/* datestamp range */
+    long int low, hi;		/* level range */
+    word_matcher_t word;
+    word_matcher_t *win_word;	/* disk: the glob for windows shares, if different */
+};
+
+static void compile_word(word_matcher_t *wm, const char *glob, char separator)
+{
+    size_t len = strlen(glob);
+    const char *g = glob;
+    char *regex;
+    regex_errbuf errmsg;
+
+    wm->glob = g_strdup(glob);
+    if (len > 0 && !glob_is_separator_only(glob, separator) &&
+        strpbrk(glob, "\\[]?*") == NULL && glob[len-1] != '$') {
+        if (*g == '^') {
+            wm->prefix = TRUE;
+            g++;
+        }
+        if (*g != '\0') {
+            GString *literal = g_string_new(NULL);
+
+            /* the separators word_regex puts around the glob */
+            if (!wm->prefix && *g != separator)
+                g_string_append_c(literal, separator);
+            g_string_append(literal, g);
+            if (glob[len-1] != separator)
+                g_string_append_c(literal, separator);
+            wm->literal = g_string_free(literal, FALSE);
+            return;
+        }
+        wm->prefix = FALSE;
+    }
+
+    regex = word_regex(glob, separator);
+    wm->re = get_regex_from_cache(regex, &errmsg, TRUE);
+    if (!wm->re)
+        error("glob \"%s\" -> regex \"%s\": %s", glob, regex, errmsg);
+        /*NOTREACHED*/
+    g_free(regex);
+}
+
+static int match_word_compiled(word_matcher_t *wm, const char *word,
+    char separator)
+{
+    char *wrapped_word = wrap_word(word, separator, wm->glob);
+    regex_errbuf errmsg;
+    int ret;
+
+    if (!wm->literal) {
+        ret = try_match(wm->re, wrapped_word, &errmsg);
+        if (ret == MATCH_ERROR)
+            error("glob \"%s\": %s", wm->glob, errmsg);
+            /*NOTREACHED*/
+    } else if (wm->prefix) {
+        ret = g_str_has_prefix(wrapped_word, wm->literal);
+    } else {
+        ret = strstr(wrapped_word, wm->literal) != NULL;
+    }
+
+    g_free(wrapped_word);
+    return ret;
+}
+
+static matcher_t *new_matcher(matcher_type_t type, const char *expr)
+{
+    matcher_t *m = g_new0(matcher_t, 1);
+
+    m->type = type;
+    m->expr = g_strdup(expr);
+    return m;
+}
+
+matcher_t *compile_host(const char *glob)
+{
+    matcher_t *m = new_matcher(MATCHER_HOST, glob);
+    char *lglob;
+
+    if (*glob == '=') {
+        m->kind = MATCH_KIND_STRCMP;
+        m->exact = g_strdup(glob+1);
+        return m;
+    }
+
+    m->kind = MATCH_KIND_WORD;
+    lglob = g_ascii_strdown(glob, -1);
+    compile_word(&m->word, lglob, '.');
+    g_free(lglob);
+    return m;
+}
+
+matcher_t *compile_disk(const char *glob)
+{
+    matcher_t *m = new_matcher(MATCHER_DISK, glob);
+    char *winglob;
+
+    if (*glob == '=') {
+        m->kind = MATCH_KIND_STRCMP;
+        m->exact = g_strdup(glob+1);
+        return m;
+    }
+
+    m->kind = MATCH_KIND_WORD;
+    compile_word(&m->word, glob, '/');
+    winglob = convert_winglob_to_unix(glob);
+    if (!g_str_equal(winglob, glob)) {
+        m->win_word = g_new0(word_matcher_t, 1);
+        compile_word(m->win_word, winglob, '/');
+    }
+    g_free(winglob);
+    return m;
+}
+
 static int
 alldigits(
     const char *str)
@@ -979,11 +1391,11 @@ alldigits(
     return 1;
 }
 
-int
-match_datestamp(
-    const char *	dateexp,
-    const char *	datestamp)
+matcher_t *
+compile_datestamp(
+    const char *	dateexp)
 {
+    matcher_t *m = new_matcher(MATCHER_DATESTAMP, dateexp);
     char *dash;
     size_t len, len_suffix;
     size_t len_prefix;
@@ -1001,11 +1413,14 @@ match_datestamp(
      * then all datestamps match.
      */
     if (strcmp(dateexp, "*") == 0) {
-	return TRUE;
+	m->kind = MATCH_KIND_ANY;
+	return m;
     }
 
     if (*dateexp == '=') {
-	return strcmp(dateexp+1, datestamp) == 0;
+	m->kind = MATCH_KIND_STRCMP;
+	m->exact = g_strdup(dateexp+1);
+	return m;
     }
 
     /* strip and ignore an initial "^" */
@@ -1018,11 +1433,7 @@ match_datestamp(
 	mydateexp[sizeof(mydateexp)-1] = '\0';
     }
 
-    if(strlen(dateexp) < 1) {
-	goto illegal;
-    }
-
-    if(mydateexp[strlen(mydateexp)-1] == '$') {
+    if(strlen(mydateexp) > 0 && mydateexp[strlen(mydateexp)-1] == '$') {
 	match_exact = 1;
 	mydateexp[strlen(mydateexp)-1] = '\0';	/* strip the trailing $ */
     }
@@ -1056,32 +1467,41 @@ match_datestamp(
 	    goto illegal;
 	if (strncmp(firstdate, lastdate, strlen(firstdate)) > 0)
 	    goto illegal;
-	return ((strncmp(datestamp, firstdate, strlen(firstdate)) >= 0) &&
-		(strncmp(datestamp, lastdate , strlen(lastdate))  <= 0));
+	m->kind = MATCH_KIND_RANGE;
+	m->first = g_strdup(firstdate);
+	m->last = g_strdup(lastdate);
+	return m;
     }
     else {
 	if (!alldigits(mydateexp))
 	    goto illegal;
-	if(match_exact == 1) {
-	    return (g_str_equal(datestamp, mydateexp));
-	}
-	else {
-	    return (g_str_has_prefix(datestamp, mydateexp));
-	}
+	m->kind = match_exact ? MATCH_KIND_EQUAL : MATCH_KIND_PREFIX;
+	m->exact = g_strdup(mydateexp);
+	return m;
     }
 illegal:
 	error("Illegal datestamp expression %s", dateexp);
 	/*NOTREACHED*/
 }
 
-
 int
-match_level(
-    const char *	levelexp,
-    const char *	level)
+match_datestamp(
+    const char *	dateexp,
+    const char *	datestamp)
+{
+    matcher_t *m = compile_datestamp(dateexp);
+    int ret = match_compiled(m, datestamp);
+
+    free_matcher(m);
+    return ret;
+}
+
+matcher_t *
+compile_level(
+    const char *	levelexp)
 {
+    matcher_t *m = new_matcher(MATCHER_LEVEL, levelexp);
     char *dash;
-    long int low, hi, level_i;
     char mylevelexp[100];
     int match_exact;
 
@@ -1091,23 +1511,21 @@ match_level(
     }
 
     if (*levelexp == '=') {
-	return strcmp(levelexp+1, level) == 0;
+	m->kind = MATCH_KIND_STRCMP;
+	m->exact = g_strdup(levelexp+1);
+	return m;
     }
 
     if(levelexp[0] == '^') {
 	strncpy(mylevelexp, levelexp+1, strlen(levelexp)-1);
 	mylevelexp[strlen(levelexp)-1] = '\0';
-	if (strlen(levelexp) == 0) {
-	    error("Illegal level expression %s", levelexp);
-	    /*NOTREACHED*/
-	}
     }
     else {
 	strncpy(mylevelexp, levelexp, strlen(levelexp));
 	mylevelexp[strlen(levelexp)] = '\0';
     }
 
-    if(mylevelexp[strlen(mylevelexp)-1] == '$') {
+    if(strlen(mylevelexp) > 0 && mylevelexp[strlen(mylevelexp)-1] == '$') {
 	match_exact = 1;
 	mylevelexp[strlen(mylevelexp)-1] = '\0';
     }
@@ -1123,29 +1541,114 @@ match_level(
         if (!alldigits(mylevelexp) || !alldigits(dash+1)) goto illegal;
 
         errno = 0;
-        low = strtol(mylevelexp, (char **) NULL, 10);
-        if (errno) goto illegal;
-        hi = strtol(dash+1, (char **) NULL, 10);
+        m->low = strtol(mylevelexp, (char **) NULL, 10);
         if (errno) goto illegal;
-        level_i = strtol(level, (char **) NULL, 10);
+        m->hi = strtol(dash+1, (char **) NULL, 10);
         if (errno) goto illegal;
 
-	return ((level_i >= low) && (level_i <= hi));
+	m->kind = MATCH_KIND_RANGE;
+	return m;
     }
     else {
 	if (!alldigits(mylevelexp)) goto illegal;
-	if(match_exact == 1) {
-	    return (g_str_equal(level, mylevelexp));
-	}
-	else {
-	    return (g_str_has_prefix(level, mylevelexp));
-	}
+	m->kind = match_exact ? MATCH_KIND_EQUAL : MATCH_KIND_PREFIX;
+	m->exact = g_strdup(mylevelexp);
+	return m;
     }
 illegal:
     error("Illegal level expression %s", levelexp);
     /*NOTREACHED*/
 }
 
+int
+match_level(
+    const char *	levelexp,
+    const char *	level)
+{
+    matcher_t *m = compile_level(levelexp);
+    int ret = match_compiled(m, level);
+
+    free_matcher(m);
+    return ret;
+}
+
+int match_compiled(matcher_t *m, const char *str)
+{
+    switch (m->kind) {
+    case MATCH_KIND_ANY:
+        return TRUE;
+
+    case MATCH_KIND_STRCMP:
+        return strcmp(m->exact, str) == 0;
+
+    case MATCH_KIND_EQUAL:
+        return g_str_equal(str, m->exact);
+
+    case MATCH_KIND_PREFIX:
+        return g_str_has_prefix(str, m->exact);
+
+    case MATCH_KIND_RANGE:
+        if (m->type == MATCHER_LEVEL) {
+            long int level_i;
+
+            errno = 0;
+            level_i = strtol(str, (char **) NULL, 10);
+            if (errno)
+                error("Illegal level expression %s", m->expr);
+                /*NOTREACHED*/
+            return ((level_i >= m->low) && (level_i <= m->hi));
+        }
+        return ((strncmp(str, m->first, strlen(m->first)) >= 0) &&
+                (strncmp(str, m->last , strlen(m->last))  <= 0));
+
+    case MATCH_KIND_WORD:
+        if (m->type == MATCHER_HOST) {
+            char *lhost = g_ascii_strdown(str, -1);
+            int ret = match_word_compiled(&m->word, lhost, '.');
+
+            g_free(lhost);
+            return ret;
+        }
+
+        /* a Windows share: the first two characters are '\' and there is
+         * no / in the word at all; see match_disk() */
+        if (!(strncmp(str, "\\\\", 2) || strchr(str, '/'))) {
+            char *disk2 = convert_unc_to_unix(str);
+            int ret = match_word_compiled(m->win_word ? m->win_word : &m->word,
+                                          disk2, '/');
+
+            g_free(disk2);
+            return ret;
+        }
+        return match_word_compiled(&m->word, str, '/');
+    }
+
+    return FALSE;
+}
+
+static void free_word_matcher(word_matcher_t *wm)
+{
+    g_free(wm->glob);
+    g_free(wm->literal);
+}
+
+void free_matcher(matcher_t *m)
+{
+    if (!m)
+        return;
+
+    g_free(m->expr);
+    g_free(m->exact);
+    g_free(m->first);
+    g_free(m->last);
+    free_word_matcher(&m->word);
+    if (m->win_word) {
+        free_word_matcher(m->win_word);
+        g_free(m->win_word);
+    }
+    g_free(m);
+}
+
 static char *
 make_template(
     const gboolean add_begin_and_end,
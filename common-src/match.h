@@ -24,6 +24,7 @@
 #define MATCH_H
 
 #include <glib.h>
+#include <regex.h>
 #include <conffile.h>
 
 /*
@@ -100,6 +101,24 @@ int	match_glob(const char *glob, const char *str);
 /* Like match(), but with a tar expression */
 int	match_tar(const char *glob, const char *str);
 
+/* Compile a tar expression once, to match it against many strings with
+ * match_tar_compiled().  The result is owned by the regex cache and must not
+ * be freed. */
+regex_t *compile_tar(const char *glob);
+int	match_tar_compiled(regex_t *re, const char *str);
+
+/* Compile a whole list of tar expressions, such as an exclude list, to know
+ * with one match_tar_list() call whether any of them matches a string.
+ * Literal expressions, and those with a '*' only at the start or at the end,
+ * are matched without a regex; the rest are joined in a single one.  A bad
+ * expression is an error(), as it is for match_tar().  The result can be
+ * shared between threads; free it with free_tar_matcher(). */
+typedef struct tar_matcher_s tar_matcher_t;
+
+tar_matcher_t *compile_tar_list(char **globs, int nb_globs);
+int	match_tar_list(tar_matcher_t *tm, const char *str);
+void	free_tar_matcher(tar_matcher_t *tm);
+
 /*
  * Host expressions
  */
@@ -146,6 +165,23 @@ int	match_datestamp(const char *dateexp, const char *datestamp);
 /* Like match(), but using a level expression */
 int	match_level(const char *levelexp, const char *level);
 
+/*
+ * Compiled expressions
+ */
+
+/* Parse a host, disk, datestamp or level expression once, to match it against
+ * many strings with match_compiled(); the result is the same as the
+ * corresponding match_*() function.  An illegal expression is an error(), as
+ * it is for match_*().  Free the result with free_matcher(). */
+typedef struct matcher_s matcher_t;
+
+matcher_t *compile_host(const char *glob);
+matcher_t *compile_disk(const char *glob);
+matcher_t *compile_datestamp(const char *dateexp);
+matcher_t *compile_level(const char *levelexp);
+int	match_compiled(matcher_t *m, const char *str);
+void	free_matcher(matcher_t *m);
+
 /*
  * labelstr expressions
  */
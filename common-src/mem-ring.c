@@ -51,8 +51,110 @@
 #define DEFAULT_MEM_RING_BLOCK_SIZE (NETWORK_BLOCK_BYTES)
 #define DEFAULT_MEM_RING_SIZE (DEFAULT_MEM_RING_BLOCK_SIZE*8)
 
+/* SPSC mode needs 64-bit loads and stores that are atomic without a lock;
+ * the __atomic builtins follow the C11 memory model */
+#if defined(__GNUC__) && defined(__ATOMIC_ACQUIRE) && \
+    defined(__GCC_ATOMIC_LLONG_LOCK_FREE) && __GCC_ATOMIC_LLONG_LOCK_FREE == 2
+#define MEM_RING_ATOMICS 1
+#define load_acquire(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define load_seq_cst(p)		__atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define store_seq_cst(p, v)	__atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#define add_seq_cst(p, v)	__atomic_add_fetch((p), (v), __ATOMIC_SEQ_CST)
+#if defined(__i386__) || defined(__x86_64__)
+#define cpu_relax()		__builtin_ia32_pause()
+#else
+#define cpu_relax()		do { } while (0)
+#endif
+#endif
+
+/* bounds for the adaptive spin before sleeping, in polls */
+#define MEM_RING_MIN_SPINS 16
+#define MEM_RING_MAX_SPINS 4096
+
+/*
+ * Buffer pool
+ *
+ * The buffers of closed rings are kept in a process-wide pool, up to
+ * MEM_RING_POOL_MAX bytes, so that the rings of the next transfer, which
+ * usually have the same size, reuse them instead of going back to malloc and
+ * faulting the pages in again.
+ */
+
+#define MEM_RING_POOL_MAX (64*1024*1024)
+
+typedef struct ring_buffer_s {
+    char *buffer;
+    uint64_t size;
+} ring_buffer_t;
+
+static GStaticMutex ring_pool_mutex = G_STATIC_MUTEX_INIT;
+static GSList *ring_pool = NULL;	/* of ring_buffer_t, newest first */
+static uint64_t ring_pool_bytes = 0;
+
 static void alloc_mem_ring(mem_ring_t *mem_ring);
 
+/* Take a SIZE-byte buffer from the pool, or allocate one */
+static char *
+ring_pool_get(
+    uint64_t size)
+{
+    GSList *iter;
+    char *buffer = NULL;
+
+    g_static_mutex_lock(&ring_pool_mutex);
+    for (iter = ring_pool; iter; iter = iter->next) {
+	ring_buffer_t *rb = iter->data;
+
+	if (rb->size == size) {
+	    buffer = rb->buffer;
+	    ring_pool_bytes -= rb->size;
+	    ring_pool = g_slist_delete_link(ring_pool, iter);
+	    g_free(rb);
+	    break;
+	}
+    }
+    g_static_mutex_unlock(&ring_pool_mutex);
+
+    if (!buffer)
+	buffer = malloc(size);
+    return buffer;
+}
+
+/* Give the SIZE-byte BUFFER back to the pool; the oldest buffers are freed
+ * if it does not fit */
+static void
+ring_pool_put(
+    char *buffer,
+    uint64_t size)
+{
+    ring_buffer_t *rb;
+
+    if (!buffer)
+	return;
+    if (size > MEM_RING_POOL_MAX) {
+	free(buffer);
+	return;
+    }
+
+    rb = g_new(ring_buffer_t, 1);
+    rb->buffer = buffer;
+    rb->size = size;
+
+    g_static_mutex_lock(&ring_pool_mutex);
+    ring_pool = g_slist_prepend(ring_pool, rb);
+    ring_pool_bytes += size;
+    while (ring_pool_bytes > MEM_RING_POOL_MAX) {
+	GSList *last = g_slist_last(ring_pool);
+
+	rb = last->data;
+	ring_pool_bytes -= rb->size;
+	ring_pool = g_slist_delete_link(ring_pool, last);
+	free(rb->buffer);
+	g_free(rb);
+    }
+    g_static_mutex_unlock(&ring_pool_mutex);
+}
+
 mem_ring_t *
 create_mem_ring(void)
 {
@@ -117,6 +219,19 @@ void init_mem_ring(
     g_mutex_unlock(mem_ring->mutex);
 }
 
+void
+mem_ring_set_eof(
+    mem_ring_t *mem_ring)
+{
+#ifdef MEM_RING_ATOMICS
+    store_seq_cst(&mem_ring->eof_flag, TRUE);
+#else
+    mem_ring->eof_flag = TRUE;
+#endif
+    g_cond_broadcast(mem_ring->add_cond);
+    g_cond_broadcast(mem_ring->free_cond);
+}
+
 static void
 alloc_mem_ring(
     mem_ring_t *mem_ring)
@@ -142,7 +257,12 @@ alloc_mem_ring(
     }
 
     mem_ring->ring_size = best_ring_size;
-    mem_ring->buffer = malloc(mem_ring->ring_size);
+    mem_ring->buffer = ring_pool_get(mem_ring->ring_size);
+
+#ifdef MEM_RING_ATOMICS
+    mem_ring->spsc = mem_ring->producer_spsc && mem_ring->consumer_spsc;
+    mem_ring->producer_spins = mem_ring->consumer_spins = MEM_RING_MIN_SPINS;
+#endif
 }
 
 void
@@ -152,6 +272,217 @@ close_mem_ring(
     g_mutex_free(mem_ring->mutex);
     g_cond_free(mem_ring->add_cond);
     g_cond_free(mem_ring->free_cond);
-    g_free(mem_ring->buffer);
+    ring_pool_put(mem_ring->buffer, mem_ring->ring_size);
     g_free(mem_ring);
 }
+
+void
+mem_ring_producer_set_spsc(
+    mem_ring_t *mem_ring)
+{
+    g_mutex_lock(mem_ring->mutex);
+    mem_ring->producer_spsc = TRUE;
+    g_mutex_unlock(mem_ring->mutex);
+}
+
+void
+mem_ring_consumer_set_spsc(
+    mem_ring_t *mem_ring)
+{
+    g_mutex_lock(mem_ring->mutex);
+    mem_ring->consumer_spsc = TRUE;
+    g_mutex_unlock(mem_ring->mutex);
+}
+
+/* adapt a side's spin count: spin longer if spinning paid off, and less if
+ * it ended up sleeping anyway */
+static void
+adapt_spins(
+    guint *spins,
+    gboolean slept)
+{
+    if (slept)
+	*spins = MAX(*spins / 2, MEM_RING_MIN_SPINS);
+    else
+	*spins = MIN(*spins * 2, MEM_RING_MAX_SPINS);
+}
+
+uint64_t
+mem_ring_wait_for_data(
+    mem_ring_t *mem_ring,
+    uint64_t needed,
+    gboolean *eof_flag)
+{
+    uint64_t usable;
+
+#ifdef MEM_RING_ATOMICS
+    if (mem_ring->spsc) {
+	gboolean slept = FALSE;
+	guint i;
+
+	/* only this thread changes readx */
+	for (i = 0; ; i++) {
+	    usable = load_acquire(&mem_ring->written) - mem_ring->readx;
+	    *eof_flag = load_acquire(&mem_ring->eof_flag);
+	    if (usable >= needed || *eof_flag)
+		break;
+
+	    if (i < mem_ring->consumer_spins) {
+		cpu_relax();
+		continue;
+	    }
+
+	    /* announce that we are going to sleep before checking one last
+	     * time; the producer checks for this after publishing */
+	    g_mutex_lock(mem_ring->mutex);
+	    store_seq_cst(&mem_ring->consumer_sleeping, 1);
+	    while (load_seq_cst(&mem_ring->written) - mem_ring->readx < needed &&
+		   !load_seq_cst(&mem_ring->eof_flag)) {
+		g_cond_wait(mem_ring->add_cond, mem_ring->mutex);
+	    }
+	    store_seq_cst(&mem_ring->consumer_sleeping, 0);
+	    g_mutex_unlock(mem_ring->mutex);
+	    slept = TRUE;
+	}
+	adapt_spins(&mem_ring->consumer_spins, slept);
+
+	return usable;
+    }
+#endif
+
+    g_mutex_lock(mem_ring->mutex);
+    while (1) {
+	usable = mem_ring->written - mem_ring->readx;
+	*eof_flag = mem_ring->eof_flag;
+	if (usable >= needed || *eof_flag)
+	    break;
+	g_cond_wait(mem_ring->add_cond, mem_ring->mutex);
+    }
+    g_mutex_unlock(mem_ring->mutex);
+
+    return usable;
+}
+
+void
+mem_ring_consumed(
+    mem_ring_t *mem_ring,
+    uint64_t len)
+{
+    uint64_t read_offset;
+
+#ifdef MEM_RING_ATOMICS
+    if (mem_ring->spsc) {
+	read_offset = mem_ring->read_offset + len;
+	if (read_offset >= mem_ring->ring_size)
+	    read_offset -= mem_ring->ring_size;
+	mem_ring->read_offset = read_offset;
+
+	/* the sequentially-consistent update orders the check below */
+	add_seq_cst(&mem_ring->readx, len);
+	if (load_seq_cst(&mem_ring->producer_sleeping)) {
+	    g_mutex_lock(mem_ring->mutex);
+	    g_cond_broadcast(mem_ring->free_cond);
+	    g_mutex_unlock(mem_ring->mutex);
+	}
+	return;
+    }
+#endif
+
+    g_mutex_lock(mem_ring->mutex);
+    read_offset = mem_ring->read_offset + len;
+    if (read_offset >= mem_ring->ring_size)
+	read_offset -= mem_ring->ring_size;
+    mem_ring->read_offset = read_offset;
+    mem_ring->readx += len;
+    g_cond_broadcast(mem_ring->free_cond);
+    g_mutex_unlock(mem_ring->mutex);
+}
+
+uint64_t
+mem_ring_wait_for_space(
+    mem_ring_t *mem_ring,
+    uint64_t needed)
+{
+    uint64_t space;
+
+#ifdef MEM_RING_ATOMICS
+    if (mem_ring->spsc) {
+	gboolean slept = FALSE;
+	guint i;
+
+	/* only this thread changes written */
+	for (i = 0; ; i++) {
+	    space = mem_ring->ring_size -
+		    (mem_ring->written - load_acquire(&mem_ring->readx));
+	    if (space >= needed || load_acquire(&mem_ring->eof_flag))
+		break;
+
+	    if (i < mem_ring->producer_spins) {
+		cpu_relax();
+		continue;
+	    }
+
+	    g_mutex_lock(mem_ring->mutex);
+	    store_seq_cst(&mem_ring->producer_sleeping, 1);
+	    while (mem_ring->ring_size -
+		   (mem_ring->written - load_seq_cst(&mem_ring->readx)) < needed &&
+		   !load_seq_cst(&mem_ring->eof_flag)) {
+		g_cond_wait(mem_ring->free_cond, mem_ring->mutex);
+	    }
+	    store_seq_cst(&mem_ring->producer_sleeping, 0);
+	    g_mutex_unlock(mem_ring->mutex);
+	    slept = TRUE;
+	}
+	adapt_spins(&mem_ring->producer_spins, slept);
+
+	return space;
+    }
+#endif
+
+    g_mutex_lock(mem_ring->mutex);
+    while (1) {
+	space = mem_ring->ring_size - (mem_ring->written - mem_ring->readx);
+	if (space >= needed || mem_ring->eof_flag)
+	    break;
+	g_cond_wait(mem_ring->free_cond, mem_ring->mutex);
+    }
+    g_mutex_unlock(mem_ring->mutex);
+
+    return space;
+}
+
+void
+mem_ring_produced(
+    mem_ring_t *mem_ring,
+    uint64_t len)
+{
+    uint64_t write_offset;
+
+    write_offset = mem_ring->write_offset + len;
+    if (write_offset >= mem_ring->ring_size)
+	write_offset -= mem_ring->ring_size;
+
+#ifdef MEM_RING_ATOMICS
+    if (mem_ring->spsc) {
+	mem_ring->write_offset = write_offset;
+	add_seq_cst(&mem_ring->written, len);
+	if (load_seq_cst(&mem_ring->consumer_sleeping)) {
+	    g_mutex_lock(mem_ring->mutex);
+	    g_cond_broadcast(mem_ring->add_cond);
+	    g_mutex_unlock(mem_ring->mutex);
+	}
+	return;
+    }
+#endif
+
+    g_mutex_lock(mem_ring->mutex);
+    mem_ring->write_offset = write_offset;
+    mem_ring->written += len;
+    /* wake the consumer once per consumer block */
+    mem_ring->data_avail += len;
+    if (mem_ring->data_avail >= mem_ring->consumer_block_size) {
+	g_cond_broadcast(mem_ring->add_cond);
+	mem_ring->data_avail = 0;
+    }
+    g_mutex_unlock(mem_ring->mutex);
+}
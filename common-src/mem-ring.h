@@ -39,10 +39,14 @@ typedef struct mem_ring_s {
     uint64_t write_offset;	/* where to write */
     uint64_t written;		/* nb bytes written to the ring */
     gboolean eof_flag;
-    char     padding1[256 - 2*sizeof(off_t) - sizeof(gboolean)];
+    gint     producer_sleeping;	/* SPSC: producer is waiting on free_cond */
+    guint    producer_spins;	/* SPSC: adaptive spin count */
+    char     padding1[256 - 2*sizeof(off_t) - sizeof(gboolean) - sizeof(gint) - sizeof(guint)];
     uint64_t read_offset;	/* where to read */
     uint64_t readx;		/* nb bytes written to the ring */
-    char     padding2[256 - 2*sizeof(off_t)];
+    gint     consumer_sleeping;	/* SPSC: consumer is waiting on add_cond */
+    guint    consumer_spins;	/* SPSC: adaptive spin count */
+    char     padding2[256 - 2*sizeof(off_t) - sizeof(gint) - sizeof(guint)];
     char    *buffer;
     uint64_t ring_size;
     GCond   *add_cond;		/* some data was added to the ring */
@@ -53,6 +57,9 @@ typedef struct mem_ring_s {
     uint64_t consumer_ring_size;
     uint64_t producer_ring_size;
     size_t   data_avail;
+    gboolean producer_spsc;	/* the producer asked for SPSC mode */
+    gboolean consumer_spsc;	/* the consumer asked for SPSC mode */
+    gboolean spsc;		/* lock-free single-producer/single-consumer */
 } mem_ring_t;
 
 mem_ring_t *create_mem_ring(void);
@@ -61,4 +68,38 @@ void mem_ring_consumer_set_size(mem_ring_t *mem_ring, size_t ring_size, size_t b
 void mem_ring_producer_set_size(mem_ring_t *mem_ring, size_t ring_size, size_t block_size);
 void close_mem_ring(mem_ring_t *mem_ring);
 
+/* set eof_flag and wake everyone up.  Called with the mutex held. */
+void mem_ring_set_eof(mem_ring_t *mem_ring);
+
+/* Single-producer/single-consumer mode
+ *
+ * A producer or consumer that moves data only with the functions below can
+ * ask for SPSC mode before its *_set_size call (before init_mem_ring, for a
+ * ring with both ends in one element).  If both sides ask and the platform
+ * has lock-free 64-bit atomics, then
+ * written and readx are published with acquire/release ordering and each
+ * side spins briefly before falling back to the mutex and conditions, which
+ * are then only used to sleep.  Otherwise the functions below take the mutex
+ * themselves, and work with peers that use the ring fields directly.
+ *
+ * None of these functions may be called with the mutex held.
+ */
+void mem_ring_producer_set_spsc(mem_ring_t *mem_ring);
+void mem_ring_consumer_set_spsc(mem_ring_t *mem_ring);
+
+/* Wait until at least NEEDED bytes can be read, or until EOF; returns the
+ * number of readable bytes and sets *EOF_FLAG. */
+uint64_t mem_ring_wait_for_data(mem_ring_t *mem_ring, uint64_t needed,
+				gboolean *eof_flag);
+
+/* Release LEN bytes at read_offset */
+void mem_ring_consumed(mem_ring_t *mem_ring, uint64_t len);
+
+/* Wait until at least NEEDED bytes are free, or until eof_flag is set (which
+ * a consumer does when cancelled); returns the number of free bytes */
+uint64_t mem_ring_wait_for_space(mem_ring_t *mem_ring, uint64_t needed);
+
+/* Publish LEN bytes written at write_offset */
+void mem_ring_produced(mem_ring_t *mem_ring, uint64_t len);
+
 #endif
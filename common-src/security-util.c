@@ -43,6 +43,47 @@
 #include "stream.h"
 #include "sockaddr-util.h"
 
+#ifdef HAVE_LINUX_ERRQUEUE_H
+#include <linux/errqueue.h>
+#include <poll.h>
+#endif
+
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define TCPM_ZEROCOPY 1
+#endif
+
+#ifdef HAVE_NETINET_TCP_H
+#include <netinet/tcp.h>
+#endif
+
+#if defined(TCP_INFO) && defined(__linux__)
+#define TCPM_NET_INFO 1
+/* the struct tcp_info of linux/tcp.h; the libc one stops at
+ * tcpi_total_retrans.  Older kernels fill less of it. */
+struct tcpm_tcp_info {
+    struct tcp_info info;
+    guint64	pacing_rate;
+    guint64	max_pacing_rate;
+    guint64	bytes_acked;
+    guint64	bytes_received;
+    guint32	segs_out;
+    guint32	segs_in;
+    guint32	notsent_bytes;
+    guint32	min_rtt;
+    guint32	data_segs_in;
+    guint32	data_segs_out;
+    guint64	delivery_rate;
+    guint64	busy_time;
+    guint64	rwnd_limited;
+    guint64	sndbuf_limited;
+};
+#endif
+
+/* seconds between two TCP_INFO samples of a connection */
+#define TCPM_NET_SAMPLE_INTERVAL 5
+
+static void tcpm_net_sample(struct tcp_conn *rc, gboolean force);
+
 /*
  * This is a queue of open connections
  */
@@ -61,6 +102,8 @@ static void stream_read_to_shm_ring_callback(void *);
 
 static void sec_tcp_conn_read_cancel(struct tcp_conn *);
 static void sec_tcp_conn_read_callback(void *);
+static void udp_netfd_pending_callback(void *);
+static void udp_netfd_packet(struct udp_handle *);
 
 static void tcpm_send_token_helper(struct tcp_conn *rc, int handle,
 			           const void *buf, size_t len,
@@ -340,10 +383,86 @@ tcpm_stream_write(
 	g_mutex_unlock(stream_write_mutex);
 	return (-1);
     }
+    tcpm_net_sample(rs->rc, FALSE);
     g_mutex_unlock(stream_write_mutex);
     return (0);
 }
 
+/*
+ * Sample TCP_INFO of the connection's socket into rc->net_stats, at most
+ * every TCPM_NET_SAMPLE_INTERVAL seconds unless force is set.  The pipes
+ * of the local and ssh auth fail the first getsockopt and are not tried
+ * again.
+ */
+static void
+tcpm_net_sample(
+    struct tcp_conn *rc,
+    gboolean	force)
+{
+#ifdef TCPM_NET_INFO
+    struct tcpm_tcp_info ti;
+    socklen_t len = sizeof(ti);
+    security_net_stats_t *ns = &rc->net_stats;
+    time_t now;
+    int fd;
+
+    if (rc->net_info < 0)
+	return;
+    now = time(NULL);
+    if (!force && now - rc->net_sampled < TCPM_NET_SAMPLE_INTERVAL)
+	return;
+    rc->net_sampled = now;
+
+    fd = rc->read != -1 ? rc->read : rc->write;
+    memset(&ti, 0, sizeof(ti));
+    if (fd == -1 || getsockopt(fd, IPPROTO_TCP, TCP_INFO, &ti, &len) < 0) {
+	if (fd != -1)
+	    auth_debug(1, "sec: no TCP_INFO for %s: %s\n", rc->hostname,
+		       strerror(errno));
+	rc->net_info = -1;
+	return;
+    }
+    rc->net_info = 1;
+
+    ns->samples++;
+    ns->rtt = ti.info.tcpi_rtt;
+    ns->rtt_sum += ti.info.tcpi_rtt;
+    if (ti.info.tcpi_rtt > ns->rtt_max)
+	ns->rtt_max = ti.info.tcpi_rtt;
+    ns->rcv_rtt = ti.info.tcpi_rcv_rtt;
+    ns->retrans = ti.info.tcpi_total_retrans;
+    /* zero if the kernel didn't fill that far */
+    if (ti.delivery_rate)
+	ns->delivery_rate = ti.delivery_rate;
+    ns->busy_time = ti.busy_time;
+    ns->rwnd_limited = ti.rwnd_limited;
+    ns->sndbuf_limited = ti.sndbuf_limited;
+#else
+    (void)rc;
+    (void)force;
+#endif
+}
+
+gboolean
+tcpm_stream_net_stats(
+    void *s,
+    security_net_stats_t *stats)
+{
+    struct sec_stream *rs = s;
+
+    assert(rs != NULL);
+    assert(rs->rc != NULL);
+
+    if (!stream_write_mutex) {
+	stream_write_mutex = g_mutex_new();
+    }
+    g_mutex_lock(stream_write_mutex);
+    tcpm_net_sample(rs->rc, TRUE);
+    *stats = rs->rc->net_stats;
+    g_mutex_unlock(stream_write_mutex);
+    return stats->samples > 0;
+}
+
 /*
  * Write a chunk of data to a stream.
  */
@@ -370,6 +489,259 @@ tcpm_stream_write_async(
     return (stack_size);
 }
 
+#ifdef TCPM_ZEROCOPY
+/*
+ * Zero-copy writes: with MSG_ZEROCOPY the kernel transmits from the
+ * caller's pages and, once it no longer references them, queues a
+ * completion on the socket error queue.  The kernel numbers the zero-copy
+ * sends of a socket from 0, and the completions come in order on tcp.  A
+ * connection is shared by all the streams to a host, so the ids are
+ * tracked on the tcp_conn, under stream_write_mutex.
+ */
+
+/* stop asking for zero-copy once the kernel copied that many sends anyway,
+ * eg. over the loopback */
+#define TCPM_ZEROCOPY_COPIED_MAX 64
+
+/*
+ * Send all of buf, counting the sends with MSG_ZEROCOPY in rc->zc_next.
+ * A send the kernel can't pin more pages for is copied.
+ */
+static int
+tcpm_zerocopy_send(
+    struct tcp_conn *rc,
+    const void      *buf,
+    size_t           len,
+    int              flags)
+{
+    const char *p = buf;
+    struct pollfd pfd;
+    ssize_t n;
+
+    while (len > 0) {
+	n = send(rc->write, p, len, flags);
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+		/* an async write left the socket non-blocking */
+		pfd.fd = rc->write;
+		pfd.events = POLLOUT;
+		poll(&pfd, 1, -1);
+		continue;
+	    }
+	    if (errno == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+		flags &= ~MSG_ZEROCOPY;
+		continue;
+	    }
+	    return -1;
+	}
+	if (flags & MSG_ZEROCOPY)
+	    rc->zc_next++;
+	p += n;
+	len -= n;
+    }
+    return 0;
+}
+
+/*
+ * Read the completions on the error queue of the socket, without waiting.
+ * Returns the number of completions read, or -1 on error.
+ */
+static int
+tcpm_zerocopy_completions(
+    struct tcp_conn *rc)
+{
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err)) +
+		 CMSG_SPACE(sizeof(struct sockaddr_in6))];
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    struct sock_extended_err *serr;
+    int count = 0;
+
+    for (;;) {
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	if (recvmsg(rc->write, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if (errno == EAGAIN || errno == EWOULDBLOCK)
+		return count;
+	    g_debug("tcpm_zerocopy_completions: recvmsg: %s", strerror(errno));
+	    return -1;
+	}
+
+	for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+	    if (cm->cmsg_len < CMSG_LEN(sizeof(*serr)))
+		continue;
+	    serr = (struct sock_extended_err *)(void *)CMSG_DATA(cm);
+	    if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+		continue;
+
+	    /* sends ee_info to ee_data, inclusive, are completed */
+	    if ((gint32)(serr->ee_data + 1 - rc->zc_done) > 0)
+		rc->zc_done = serr->ee_data + 1;
+	    if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+		rc->zc_copied += serr->ee_data - serr->ee_info + 1;
+		if (rc->zerocopy == 1 &&
+		    rc->zc_copied >= TCPM_ZEROCOPY_COPIED_MAX) {
+		    g_debug("tcpm_zerocopy_completions: the kernel copies the data to %s, not using MSG_ZEROCOPY",
+			    rc->hostname);
+		    rc->zerocopy = -1;
+		}
+	    }
+	    count++;
+	}
+    }
+}
+#endif
+
+/*
+ * Prepare a stream for tcpm_stream_write_zerocopy.  Returns FALSE if the
+ * data can't be sent zero-copy: it is encrypted, written by the driver
+ * (ssl), or the connection is not a socket with SO_ZEROCOPY (pipes of the
+ * local and ssh auth).
+ */
+gboolean
+tcpm_stream_zerocopy_enable(
+    void *s)
+{
+    struct sec_stream *rs = s;
+#ifdef TCPM_ZEROCOPY
+    struct tcp_conn *rc;
+    int one = 1;
+    gboolean rval = TRUE;
+
+    assert(rs != NULL);
+    assert(rs->rc != NULL);
+    rc = rs->rc;
+
+    if (rc->driver->data_encrypt != NULL ||
+	rc->driver->data_write != generic_data_write)
+	return FALSE;
+
+    if (!stream_write_mutex) {
+	stream_write_mutex = g_mutex_new();
+    }
+    g_mutex_lock(stream_write_mutex);
+    if (rc->zerocopy == 0) {
+	if (setsockopt(rc->write, SOL_SOCKET, SO_ZEROCOPY, &one,
+		       sizeof(one)) < 0) {
+	    auth_debug(1, "sec: zerocopy_enable: %s: %s\n", rc->hostname,
+		       strerror(errno));
+	    rval = FALSE;
+	} else {
+	    rc->zerocopy = 1;
+	}
+    }
+    g_mutex_unlock(stream_write_mutex);
+    return rval;
+#else
+    (void)rs;
+    return FALSE;
+#endif
+}
+
+/*
+ * Write a chunk of data to a stream, like tcpm_stream_write, but zero-copy.
+ * Returns 0 if buf must stay unchanged until tcpm_stream_zerocopy_reap
+ * reports the send *id completed, 1 if the data was copied, and -1 on
+ * error.
+ */
+int
+tcpm_stream_write_zerocopy(
+    void       *s,
+    const void *buf,
+    size_t      size,
+    guint32    *id)
+{
+    struct sec_stream *rs = s;
+#ifdef TCPM_ZEROCOPY
+    struct tcp_conn *rc;
+    guint32 netint[2];
+    guint32 first_id;
+    int rval;
+
+    assert(rs != NULL);
+    assert(rs->rc != NULL);
+    rc = rs->rc;
+
+    if (rc->zerocopy != 1 || size == 0)
+	return tcpm_stream_write(s, buf, size) == 0 ? 1 : -1;
+
+    g_mutex_lock(stream_write_mutex);
+    auth_debug(6, _("sec: stream_write_zerocopy: writing %zu bytes to %s:%d %d\n"),
+		   size, rc->hostname, rs->handle, rc->write);
+
+    /* the header is copied, MSG_MORE keeps it with the data */
+    netint[0] = htonl(size);
+    netint[1] = htonl((guint32)rs->handle);
+    first_id = rc->zc_next;
+    if (tcpm_zerocopy_send(rc, netint, sizeof(netint), MSG_MORE) < 0 ||
+	tcpm_zerocopy_send(rc, buf, size, MSG_ZEROCOPY) < 0) {
+	g_free(rc->errmsg);
+	rc->errmsg = g_strdup_printf(_("write error to: %s"), strerror(errno));
+	security_stream_seterror(&rs->secstr, "%s", rc->errmsg);
+	g_mutex_unlock(stream_write_mutex);
+	return -1;
+    }
+    *id = rc->zc_next - 1;
+    rval = rc->zc_next == first_id ? 1 : 0;
+    g_mutex_unlock(stream_write_mutex);
+
+    return rval;
+#else
+    (void)id;
+    return tcpm_stream_write(rs, buf, size) == 0 ? 1 : -1;
+#endif
+}
+
+/*
+ * Collect the completed zero-copy sends of the stream's connection; *done
+ * is set to the id after the last one, all sends before it are completed.
+ * If wait is set and sends are pending, wait up to a second for one to
+ * complete.  Returns -1 on error.
+ */
+int
+tcpm_stream_zerocopy_reap(
+    void     *s,
+    gboolean  wait,
+    guint32  *done)
+{
+    struct sec_stream *rs = s;
+#ifdef TCPM_ZEROCOPY
+    struct tcp_conn *rc;
+    struct pollfd pfd;
+    int count;
+
+    assert(rs != NULL);
+    assert(rs->rc != NULL);
+    rc = rs->rc;
+
+    g_mutex_lock(stream_write_mutex);
+    count = tcpm_zerocopy_completions(rc);
+    if (count == 0 && wait && rc->zc_done != rc->zc_next) {
+	/* a queued completion is reported as POLLERR */
+	g_mutex_unlock(stream_write_mutex);
+	pfd.fd = rc->write;
+	pfd.events = 0;
+	poll(&pfd, 1, 1000);
+	g_mutex_lock(stream_write_mutex);
+	count = tcpm_zerocopy_completions(rc);
+    }
+    *done = rc->zc_done;
+    g_mutex_unlock(stream_write_mutex);
+
+    return count < 0 ? -1 : 0;
+#else
+    (void)rs;
+    (void)wait;
+    *done = 0;
+    return 0;
+#endif
+}
+
 /*
  * Submit a request to read some data.  Calls back with the given
  * function and arg when completed.
@@ -699,6 +1071,7 @@ tcpm_send_token_async(
     awd->written = 0;
     awd->fn = fn;
     awd->arg = arg;
+    awd->rs = rs;
     if (encbuf != buf)
 	amfree(buf);
     rs->rc->async_write_data_list = g_list_append(rs->rc->async_write_data_list, awd);
@@ -713,70 +1086,152 @@ tcpm_send_token_async(
     return (rs->rc->async_write_data_size);
 }
 
+/*
+ * Write as many queued tokens as possible, of any stream of the connection,
+ * with a single data_write_non_blocking.
+ */
+#define TCPM_WRITE_BATCH 16
+
 static void
 tcpm_send_token_callback(
     void *      cookie)
 {
     struct sec_stream *rs = cookie;
-    gboolean done = FALSE;
-    async_write_data *awd = NULL;
+    struct tcp_conn   *rc = rs->rc;
+    struct iovec       iov[TCPM_WRITE_BATCH * 3];
+    async_write_data  *batch[TCPM_WRITE_BATCH];
+    GSList            *done_list = NULL;
+    GSList            *done;
+    GList             *list;
+    async_write_data  *awd;
+    int                nb_awd = 0;
+    int                nb_iov = 0;
+    int                i, j;
+
+    for (list = rc->async_write_data_list;
+	 list != NULL && nb_awd < TCPM_WRITE_BATCH;
+	 list = list->next) {
+	awd = (async_write_data *)list->data;
+	batch[nb_awd++] = awd;
+	memcpy(iov + nb_iov, awd->copy_iov,
+	       awd->copy_nb_iov * sizeof(struct iovec));
+	nb_iov += awd->copy_nb_iov;
+	/* a closing token ends the batch, its stream is released below */
+	if (!awd->buf)
+	    break;
+    }
 
-    if (rs->rc->async_write_data_list) {
+    if (nb_awd > 0) {
 	int rval;
 	int save_errno;
-	awd = (async_write_data *)rs->rc->async_write_data_list->data;
-	rval = rs->rc->driver->data_write_non_blocking(rs->rc, awd->copy_iov, awd->copy_nb_iov);
+	rval = rc->driver->data_write_non_blocking(rc, iov, nb_iov);
 	save_errno = errno;
 	if (rval < 0) {
+	    awd = batch[0];
 	    security_stream_seterror(&rs->secstr, "write error to: %s", strerror(save_errno));
 	    if (awd->fn) {
-		(*awd->fn)(awd->arg, rs->rc->async_write_data_size, NULL, -1);
+		(*awd->fn)(awd->arg, rc->async_write_data_size, NULL, -1);
 	    }
             return;
 	}
 
-	awd->written += rval;
-	rs->rc->async_write_data_size -= rval;
-	/* if completely written */
-	if (awd->copy_iov[0].iov_len == 0 &&
-	    awd->copy_iov[1].iov_len == 0 &&
-	    (awd->nb_iov < 2 || awd->copy_iov[2].iov_len == 0)) {
+	rc->async_write_data_size -= rval;
+	nb_iov = 0;
+	for (i = 0; i < nb_awd; i++) {
+	    gboolean complete = TRUE;
+
+	    awd = batch[i];
+	    for (j = 0; j < awd->copy_nb_iov; j++) {
+		awd->written += awd->copy_iov[j].iov_len - iov[nb_iov + j].iov_len;
+		awd->copy_iov[j] = iov[nb_iov + j];
+		if (awd->copy_iov[j].iov_len != 0)
+		    complete = FALSE;
+	    }
+	    nb_iov += awd->copy_nb_iov;
+	    if (!complete)
+		break;
+
 	    if (awd->fn) {
-		(*awd->fn)(awd->arg, rs->rc->async_write_data_size, awd->buf, awd->written);
+		(*awd->fn)(awd->arg, rc->async_write_data_size, awd->buf, awd->written);
 	    }
 	    g_free(awd->iov[0].iov_base);
 	    g_free(awd->iov[1].iov_base);
-	    rs->rc->async_write_data_list = g_list_remove(rs->rc->async_write_data_list,
+	    rc->async_write_data_list = g_list_remove(rc->async_write_data_list,
 						      awd);
-	    done = TRUE;
+	    done_list = g_slist_append(done_list, awd);
 	}
     }
 
     /* unschedule us */
-    if (!rs->rc->async_write_data_list) {
-	event_release(rs->rc->ev_write);
-	rs->rc->ev_write = NULL;
+    if (!rc->async_write_data_list) {
+	event_release(rc->ev_write);
+	rc->ev_write = NULL;
     }
 
-    if (done && !awd->buf) { /* closing */
+    for (done = done_list; done != NULL; done = done->next) {
+	awd = (async_write_data *)done->data;
+	if (!awd->buf) { /* closing */
+	    struct sec_stream *ars = awd->rs ? awd->rs : rs;
 
-	if (rs->handle < 10000 || rs->closed_by_network == 1) {
-	    security_stream_read_cancel(&rs->secstr);
-	    rs->closed_by_network = 1;
-	    sec_tcp_conn_put(rs->rc);
-	}
-	rs->closed_by_me = 1;
-	if (rs->closed_by_network) {
-	    amfree(((security_stream_t *)rs)->error);
+	    if (ars->handle < 10000 || ars->closed_by_network == 1) {
+		security_stream_read_cancel(&ars->secstr);
+		ars->closed_by_network = 1;
+		sec_tcp_conn_put(ars->rc);
+	    }
+	    ars->closed_by_me = 1;
+	    if (ars->closed_by_network) {
+		amfree(((security_stream_t *)ars)->error);
+	    }
 	}
-
-    }
-    if (done) {
 	g_free(awd);
     }
+    g_slist_free(done_list);
     return;
 }
 
+/*
+ * Receive buffers: the buffer of the packet returned by the previous
+ * tcpm_recv_token is kept, and used to read the next token if it is large
+ * enough, instead of allocating a buffer for every token.
+ */
+static char *
+tcpm_get_buffer(
+    struct tcp_conn *rc,
+    size_t           size)
+{
+    char *buffer;
+
+    if (rc->spare_buffer && rc->spare_alloc >= size) {
+	buffer = rc->spare_buffer;
+	rc->buffer_alloc = rc->spare_alloc;
+	rc->spare_buffer = NULL;
+	rc->spare_alloc = 0;
+	return buffer;
+    }
+    amfree(rc->spare_buffer);
+    rc->spare_alloc = 0;
+    rc->buffer_alloc = size;
+    return g_malloc(size);
+}
+
+/* alloc is the allocated size of buffer, or 0 if it is not known */
+static void
+tcpm_put_buffer(
+    struct tcp_conn *rc,
+    char            *buffer,
+    size_t           alloc)
+{
+    if (!buffer)
+	return;
+    if (alloc == 0 || alloc <= rc->spare_alloc) {
+	g_free(buffer);
+	return;
+    }
+    g_free(rc->spare_buffer);
+    rc->spare_buffer = buffer;
+    rc->spare_alloc = alloc;
+}
+
 /*
  *  return -2 for incomplete packet
  *  return -1 on error
@@ -822,7 +1277,7 @@ tcpm_recv_token(
 	    return(-2);
 	}
 	rc->size_header_read += rval;
-        amfree(rc->buffer);
+	tcpm_put_buffer(rc, rc->buffer, rc->buffer_alloc);
 	*size = (ssize_t)ntohl(rc->netint[0]);
 	*handle = (int)ntohl(rc->netint[1]);
         rc->buffer = NULL;
@@ -914,7 +1369,7 @@ tcpm_recv_token(
     }
     if (!rs || !rs->shm_ring) {
 	if (!rc->buffer)
-	    rc->buffer = g_malloc((size_t)*size);
+	    rc->buffer = tcpm_get_buffer(rc, (size_t)*size);
 	rval = rc->driver->data_read(rc, rc->buffer + rc->size_buffer_read,
 				     (size_t)*size - rc->size_buffer_read, 0);
     } else {
@@ -929,7 +1384,8 @@ tcpm_recv_token(
 	size_t size_read = 0;
 
 	if (!rs->ring_init) {
-	    shm_ring_producer_set_size(rs->shm_ring, NETWORK_BLOCK_BYTES*8, NETWORK_BLOCK_BYTES);
+	    shm_ring_producer_set_size(rs->shm_ring, rs->secstr.block_size*8,
+				       rs->secstr.block_size);
 	    rs->ring_init = TRUE;
 	}
 	write_offset = rs->shm_ring->mc->write_offset;
@@ -940,7 +1396,7 @@ tcpm_recv_token(
 
 	    // read to a buffer
 	    if (!rc->buffer)
-		rc->buffer = g_malloc((size_t)*size);
+		rc->buffer = tcpm_get_buffer(rc, (size_t)*size);
 
 	    rval = rc->driver->data_read(rc, rc->buffer + rc->size_buffer_read,
 				(size_t)*size - rc->size_buffer_read, 0);
@@ -960,7 +1416,7 @@ tcpm_recv_token(
 	    rc->buffer = NULL;
 	    rc->driver->data_decrypt(rc, buf, *size, &decbuf, &decsize);
 	    if (buf != (char *)decbuf) {
-		amfree(buf);
+		tcpm_put_buffer(rc, buf, rc->buffer_alloc);
 		buf = (char *)decbuf;
 	    }
 	    *size = decsize;
@@ -1094,7 +1550,12 @@ tcpm_recv_token(
 	return (-2);
     }
     rc->size_buffer_read += rval;
-    amfree(*buf);
+    if (buf == &rc->pkt) {
+	tcpm_put_buffer(rc, *buf, rc->pkt_alloc);
+	rc->pkt_alloc = rc->buffer_alloc;
+    } else {
+	amfree(*buf);
+    }
     *buf = rc->buffer;
     rc->size_header_read = 0;
     rc->size_buffer_read = 0;
@@ -1107,7 +1568,12 @@ tcpm_recv_token(
 	ssize_t decsize;
 	rc->driver->data_decrypt(rc, *buf, *size, &decbuf, &decsize);
 	if (*buf != (char *)decbuf) {
-	    amfree(*buf);
+	    if (buf == &rc->pkt) {
+		tcpm_put_buffer(rc, *buf, rc->pkt_alloc);
+		rc->pkt_alloc = 0;
+	    } else {
+		amfree(*buf);
+	    }
 	    *buf = (char *)decbuf;
 	}
 	*size = decsize;
@@ -1746,9 +2212,15 @@ udp_recvpkt(
      */
     if (rh->ev_read == NULL) {
 	udp_addref(rh->udp, &udp_netfd_read_callback);
+	dgram_reserve(&rh->udp->dgram, rh->udp->refcnt);
 	rh->ev_read = event_create(rh->event_id, EV_WAIT,
 	    udp_recvpkt_callback, rh);
 	event_activate(rh->ev_read);
+	if (dgram_pending(&rh->udp->dgram) && rh->udp->ev_pending == NULL) {
+	    rh->udp->ev_pending = event_create((event_id_t)0, EV_TIME,
+		udp_netfd_pending_callback, rh->udp);
+	    event_activate(rh->udp->ev_pending);
+	}
     }
     if (rh->ev_timeout != NULL)
 	event_release(rh->ev_timeout);
@@ -1918,24 +2390,59 @@ udp_netfd_read_callback(
     void *	cookie)
 {
     struct udp_handle *udp = cookie;
-    struct sec_handle *rh;
-    int a;
-    char hostname[NI_MAXHOST];
-    in_port_t port;
-    char *errmsg = NULL;
-    int result;
 
     auth_debug(1, _("udp_netfd_read_callback(cookie=%p)\n"), cookie);
     assert(udp != NULL);
     
 #ifndef TEST							/* { */
     /*
-     * Receive the packet.
+     * Handle every packet that is ready, not just one per wakeup.  The
+     * replies and acks sent by the callbacks are queued and go out
+     * together once the socket is drained.  Stop when nobody wants the
+     * packets anymore; the ones already read stay in udp->dgram until
+     * the next udp_recvpkt.
      */
-    dgram_zero(&udp->dgram);
-    if (dgram_recv(&udp->dgram, 0, &udp->peer) < 0)
-	return;
+    dgram_cork(&udp->dgram);
+    while (udp->refcnt > 0 || udp->accept_fn != NULL) {
+	dgram_zero(&udp->dgram);
+	if (dgram_recv_next(&udp->dgram, &udp->peer) < 0)
+	    break;
+	udp_netfd_packet(udp);
+    }
+    dgram_uncork(&udp->dgram);
+#else								/* }{ */
+    udp_netfd_packet(udp);
 #endif /* !TEST */						/* } */
+}
+
+/*
+ * Run the read callback for packets read ahead of an earlier callback.
+ */
+static void
+udp_netfd_pending_callback(
+    void *	cookie)
+{
+    struct udp_handle *udp = cookie;
+
+    event_release(udp->ev_pending);
+    udp->ev_pending = NULL;
+    udp_netfd_read_callback(udp);
+}
+
+/*
+ * Dispatch the packet in udp->dgram to the handle waiting for it, or to
+ * the accept function.
+ */
+static void
+udp_netfd_packet(
+    struct udp_handle *	udp)
+{
+    struct sec_handle *rh;
+    int a;
+    char hostname[NI_MAXHOST];
+    in_port_t port;
+    char *errmsg = NULL;
+    int result;
 
     /*
      * Parse the packet.
@@ -2102,6 +2609,18 @@ sec_tcp_conn_put(
 	return;
     }
     auth_debug(1, _("sec_tcp_conn_put: closing connection to %s\n"), rc->hostname);
+    tcpm_net_sample(rc, TRUE);
+    if (rc->net_stats.samples > 0) {
+	security_net_stats_t *ns = &rc->net_stats;
+	g_debug("network %s: rtt %u us (avg %llu max %u) rcv_rtt %u us retrans %u delivery %llu B/s busy %llu us rwnd_limited %llu us sndbuf_limited %llu us",
+		rc->hostname, ns->rtt,
+		(unsigned long long)(ns->rtt_sum / ns->samples), ns->rtt_max,
+		ns->rcv_rtt, ns->retrans,
+		(unsigned long long)ns->delivery_rate,
+		(unsigned long long)ns->busy_time,
+		(unsigned long long)ns->rwnd_limited,
+		(unsigned long long)ns->sndbuf_limited);
+    }
     if (rc->read != -1)
 	aclose(rc->read);
     if (rc->write != -1)
@@ -2145,6 +2664,9 @@ sec_tcp_conn_put(
     connq = g_slist_remove(connq, rc);
     g_mutex_unlock(security_mutex);
     amfree(rc->pkt);
+    rc->pkt_alloc = 0;
+    amfree(rc->spare_buffer);
+    rc->spare_alloc = 0;
     if(!rc->donotclose) {
 	/* amfree(rc) */
 	/* a memory leak occurs, but freeing it lead to memory
@@ -2465,6 +2987,8 @@ sec_tcp_conn_read_callback(
 	return;
     }
 
+    tcpm_net_sample(rc, FALSE);
+
     if(rval == 0) {
 	rc->pktlen = 0;
 	for (reader_callbacks = rc->reader_callbacks; reader_callbacks != NULL;
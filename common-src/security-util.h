@@ -77,6 +77,7 @@ typedef struct async_write_data {
     ssize_t	  written;
     void          (*fn)(void *, ssize_t, void *, ssize_t);
     void	 *arg;
+    struct sec_stream *rs;		/* stream which queued the token */
 } async_write_data;
 
 struct sec_handle;
@@ -129,7 +130,20 @@ struct tcp_conn {
     char *              buffer;
     ssize_t             size_header_read;
     ssize_t             size_buffer_read;
+    size_t              buffer_alloc;		/* allocated size of buffer */
+    size_t              pkt_alloc;		/* of pkt, 0 if not pooled */
+    char *              spare_buffer;		/* receive buffer to reuse */
+    size_t              spare_alloc;
     GSource            *child_watch;
+    int                 zerocopy;		/* 1 if SO_ZEROCOPY is set on write,
+						 * -1 if given up on it */
+    guint32             zc_next;		/* id of the next zero-copy send */
+    guint32             zc_done;		/* sends before it are completed */
+    guint32             zc_copied;		/* sends the kernel copied anyway */
+    int                 net_info;		/* 1 if TCP_INFO can be sampled,
+						 * -1 if not */
+    time_t              net_sampled;		/* time of the last sample */
+    security_net_stats_t net_stats;
 #ifdef SSL_SECURITY
     SSL_CTX            *ctx;
     SSL                *ssl;
@@ -188,7 +202,7 @@ struct sec_stream {
     void		(*fn)(void *, void *, ssize_t);	/* read event fn */
     void *		arg;		/* arg for previous */
     int			fd;
-    char		databuf[NETWORK_BLOCK_BYTES];
+    char *		databuf;	/* secstr.block_size bytes, or NULL */
     ssize_t		len;
     int			socket;
     in_port_t		port;
@@ -213,6 +227,8 @@ typedef struct udp_handle {
     char *handle;		/* handle from recvd packet */
     int sequence;		/* seq no of packet */
     event_handle_t *ev_read;	/* read event handle from dgram */
+    event_handle_t *ev_pending;	/* runs the read callback for datagrams
+				 * already read from the socket */
     int refcnt;			/* number of handles blocked for reading */
     struct sec_handle *bh_first, *bh_last;
     void (*accept_fn)(security_handle_t *, pkt_t *);
@@ -278,6 +294,10 @@ void	tcpm_stream_read_to_shm_ring(void *, void (*)(void *, void *, ssize_t), str
 void	tcpm_stream_read_cancel(void *);
 void	tcpm_stream_pause(void *);
 void	tcpm_stream_resume(void *);
+gboolean tcpm_stream_zerocopy_enable(void *);
+int	tcpm_stream_write_zerocopy(void *, const void *, size_t, guint32 *);
+int	tcpm_stream_zerocopy_reap(void *, gboolean, guint32 *);
+gboolean tcpm_stream_net_stats(void *, security_net_stats_t *);
 ssize_t	tcpm_send_token(struct tcp_conn *, int, char **, const void *, size_t);
 ssize_t	tcpm_send_token_async(struct sec_stream *, void *, size_t, void (*)(void *, ssize_t, void *, ssize_t), void *);
 ssize_t	tcpm_recv_token(struct tcp_conn *, int *, char **, char **, ssize_t *);
@@ -34,6 +34,7 @@
 #include "amanda.h"
 #include "packet.h"
 #include "security.h"
+#include "security-util.h"
 
 #ifdef BSD_SECURITY
 extern const security_driver_t bsd_security_driver;
@@ -161,6 +162,19 @@ security_streaminit(
 	      stream, driver, driver->name);
     stream->driver = driver;
     stream->error = g_strdup(_("unknown stream error"));
+    stream->block_size = NETWORK_BLOCK_BYTES;
+}
+
+void
+security_stream_set_block_size(
+    security_stream_t *	stream,
+    size_t		block_size)
+{
+    if (block_size < NETWORK_BLOCK_BYTES)
+	block_size = NETWORK_BLOCK_BYTES;
+    if (block_size > NETWORK_BLOCK_BYTES_MAX)
+	block_size = NETWORK_BLOCK_BYTES_MAX;
+    stream->block_size = block_size;
 }
 
 void security_stream_seterror(security_stream_t *stream, const char *fmt, ...)
@@ -185,6 +199,51 @@ security_stream_close(
     (*stream->driver->stream_close)(stream);
 }
 
+/* only the tcpm streams can send zero-copy */
+gboolean
+security_stream_zerocopy_enable(
+    security_stream_t *	stream)
+{
+    if (stream->driver->stream_write != tcpm_stream_write)
+	return FALSE;
+    return tcpm_stream_zerocopy_enable(stream);
+}
+
+int
+security_stream_write_zerocopy(
+    security_stream_t *	stream,
+    const void *	buf,
+    size_t		size,
+    guint32 *		id)
+{
+    if (stream->driver->stream_write != tcpm_stream_write)
+	return security_stream_write(stream, buf, size) == 0 ? 1 : -1;
+    return tcpm_stream_write_zerocopy(stream, buf, size, id);
+}
+
+int
+security_stream_zerocopy_reap(
+    security_stream_t *	stream,
+    gboolean		wait,
+    guint32 *		done)
+{
+    if (stream->driver->stream_write != tcpm_stream_write) {
+	*done = 0;
+	return 0;
+    }
+    return tcpm_stream_zerocopy_reap(stream, wait, done);
+}
+
+gboolean
+security_stream_net_stats(
+    security_stream_t *	stream,
+    security_net_stats_t *stats)
+{
+    if (stream->driver->stream_write != tcpm_stream_write)
+	return FALSE;
+    return tcpm_stream_net_stats(stream, stats);
+}
+
 void
 security_stream_close_async(
     security_stream_t *	stream,
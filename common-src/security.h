@@ -363,6 +363,7 @@ void security_handleinit(security_handle_t *, const security_driver_t *);
 typedef struct security_stream_t {
     const security_driver_t *driver;
     char *error;
+    size_t block_size;		/* see security_stream_set_block_size */
 } security_stream_t;
 
 /* Initializes a security_stream_t. This is meant to be called only by security
@@ -461,6 +462,57 @@ void security_stream_close_async(security_stream_t *, void (*fn)(void *, ssize_t
 #define	security_stream_write_async(stream, buf, size, fn, arg)	\
     (*(stream)->driver->stream_write_async)(stream, buf, size, fn, arg)
 
+/* Zero-copy writes, where the stream's driver and the kernel can send the
+ * data straight from the caller's buffer (MSG_ZEROCOPY on the socket of the
+ * bsdtcp or local auth).
+ *
+ * security_stream_zerocopy_enable returns TRUE if the stream can use
+ * them.  security_stream_write_zerocopy then writes a chunk like
+ * security_stream_write, but returns 0 if buf must stay unchanged until
+ * the send *id completes, 1 if the data was copied, or negative on error.
+ * security_stream_zerocopy_reap sets *done to the id after the last
+ * completed send, waiting up to a second for one if wait is set; it
+ * returns negative on error.
+ */
+/* Set the size of the blocks the stream reads at a time, and of the blocks
+ * of the shm_ring it reads into: the block size negotiated with the peer,
+ * from am_network_block_size.  It is NETWORK_BLOCK_BYTES until set, and must
+ * be set before the first read.  Writes are sent in the blocks they are
+ * given.
+ */
+void security_stream_set_block_size(security_stream_t *stream,
+				    size_t block_size);
+
+gboolean security_stream_zerocopy_enable(security_stream_t *stream);
+int security_stream_write_zerocopy(security_stream_t *stream, const void *buf,
+				   size_t size, guint32 *id);
+int security_stream_zerocopy_reap(security_stream_t *stream, gboolean wait,
+				  guint32 *done);
+
+/* Network telemetry of the connection under a stream, from TCP_INFO
+ * sampled every few seconds while data flows (bsdtcp and ssl auth, on
+ * linux).  Times are in microseconds.  The limited times only grow on the
+ * side sending the data; on the receiving side rcv_rtt is the estimate.
+ */
+typedef struct security_net_stats_s {
+    int		samples;
+    guint32	rtt;			/* smoothed rtt of the last sample */
+    guint32	rtt_max;
+    guint64	rtt_sum;		/* of all samples, for the average */
+    guint32	rcv_rtt;
+    guint32	retrans;		/* segments retransmitted */
+    guint64	delivery_rate;		/* bytes per second, last sample */
+    guint64	busy_time;		/* time with data in flight */
+    guint64	rwnd_limited;		/* by the peer's receive window */
+    guint64	sndbuf_limited;		/* by our send buffer */
+} security_net_stats_t;
+
+/* security_stream_net_stats takes a last sample and fills *stats; it
+ * returns FALSE if the stream's connection can't be sampled.
+ */
+gboolean security_stream_net_stats(security_stream_t *stream,
+				   security_net_stats_t *stats);
+
 /* void security_stream_read(
  *  security_stream_t *stream,
  *  void (*fn)(void *, size_t),
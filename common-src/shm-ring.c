@@ -44,16 +44,63 @@
 #include <glib.h>
 #include <semaphore.h>
 #include <glob.h>
+#include <limits.h>
+#ifdef HAVE_LINUX_FUTEX_H
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
 
 #include "amanda.h"
 #include "glib.h"
 #include "conffile.h"
 #include "security.h"
 #include "shm-ring.h"
+#include "amprobe.h"
+#include "amnuma.h"
+
+/* Write a debugging message if the config variable debug_shm
+ * is greater than or equal to i */
+#define shm_debug(i, ...) do {		\
+	if ((i) <= debug_shm) {		\
+	    g_debug(__VA_ARGS__);	\
+	}				\
+} while (0)
 
 #define DEFAULT_SHM_RING_BLOCK_SIZE (NETWORK_BLOCK_BYTES)
 #define DEFAULT_SHM_RING_SIZE (DEFAULT_SHM_RING_BLOCK_SIZE*8)
 
+/* futex mode needs process-shared futexes and lock-free 64-bit atomics on
+ * the control block */
+#if defined(HAVE_LINUX_FUTEX_H) && defined(SYS_futex) && \
+    defined(__GNUC__) && defined(__ATOMIC_ACQUIRE) && \
+    defined(__GCC_ATOMIC_LLONG_LOCK_FREE) && __GCC_ATOMIC_LLONG_LOCK_FREE == 2
+#define SHM_RING_FUTEX 1
+#define load_acquire(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define load_seq_cst(p)		__atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define store_seq_cst(p, v)	__atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#define add_seq_cst(p, v)	__atomic_add_fetch((p), (v), __ATOMIC_SEQ_CST)
+#define xchg_seq_cst(p, v)	__atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#if defined(__i386__) || defined(__x86_64__)
+#define cpu_relax()		__builtin_ia32_pause()
+#else
+#define cpu_relax()		do { } while (0)
+#endif
+#endif
+
+/* bounds for the adaptive spin before sleeping, in polls */
+#define SHM_RING_MIN_SPINS 16
+#define SHM_RING_MAX_SPINS 4096
+
+/* a sleeping side wakes up this often to check for a cancellation that was
+ * only signalled on the semaphores, and checks the pids every
+ * SHM_RING_PID_CHECK wake-ups, like shm_ring_sem_wait */
+#define SHM_RING_FUTEX_TIMEOUT 1
+#define SHM_RING_PID_CHECK 300
+
+/* the ring doubles when the producer waited for space for more than this
+ * percentage of the time it took to go once around the ring */
+#define SHM_RING_GROW_STALL_PERCENT 10
+
 /* NetBSD only supports 14 character semaphore names */
 #if __NetBSD__
 # define SHM_CONTROL_NAME "/Ac-%04x-%05x"
@@ -83,9 +130,11 @@ GMutex *shm_ring_mutex = NULL;
 static GHashTable *hash_sem = NULL;
 
 static void alloc_shm_ring(shm_ring_t *shm_ring);
+static void shm_ring_advise(shm_ring_t *shm_ring);
 static sem_t *am_sem_create(char *name);
 static sem_t *am_sem_open(char *name);
 static void am_sem_close(sem_t *sem);
+static void shm_ring_wake(shm_ring_t *shm_ring);
 
 
 static int
@@ -217,25 +266,61 @@ cleanup_shm_ring(void)
     g_hash_table_destroy(names);
 }
 
+static gboolean
+shm_ring_peer_died(
+    shm_ring_t *shm_ring)
+{
+    int i;
+
+    for (i=0; i<SHM_RING_MAX_PID; i++) {
+	if (shm_ring->mc->pids[i] != 0) {
+	    if (kill(shm_ring->mc->pids[i], 0) == -1) {
+		if (errno == ESRCH) {
+		    return TRUE;
+		}
+	    }
+	}
+    }
+    return FALSE;
+}
+
+void
+shm_ring_cancel(
+    shm_ring_t *shm_ring)
+{
+    shm_ring->mc->cancelled = 1;
+    sem_post(shm_ring->sem_read);
+    sem_post(shm_ring->sem_write);
+    sem_post(shm_ring->sem_ready);
+    sem_post(shm_ring->sem_start);
+    shm_ring_wake(shm_ring);
+    if (shm_ring->readers_mutex) {
+	g_mutex_lock(shm_ring->readers_mutex);
+	g_cond_broadcast(shm_ring->readers_cond);
+	g_mutex_unlock(shm_ring->readers_mutex);
+    }
+}
+
 int
 shm_ring_sem_wait(
     shm_ring_t *shm_ring,
     sem_t      *sem)
 {
-    int i;
+    AMPROBE2(shm__ring__sem__wait__entry, shm_ring, sem);
     while(1) {
 	struct timespec tv = {time(NULL)+300, 0};
 
 #ifdef HAVE_SEM_TIMEDWAIT
 	if (sem_timedwait(sem, &tv) == 0)
-	    return 0;
+	    break;
 #else
 	if (sem_wait(sem) == 0)
-	    return 0;
+	    break;
 #endif
 
 	if (shm_ring->mc->cancelled) {
 	    g_debug("shm_ring_sem_wait: shm-ring is cancelled");
+	    AMPROBE3(shm__ring__sem__wait__return, shm_ring, sem, -1);
 	    return -1;
 	}
 
@@ -247,27 +332,555 @@ shm_ring_sem_wait(
 	}
 
 	/* Check all pids */
-	for (i=0; i<SHM_RING_MAX_PID; i++) {
-	    if (shm_ring->mc->pids[i] != 0) {
-		if (kill(shm_ring->mc->pids[i], 0) == -1) {
-		    if (errno == ESRCH) {
-			goto failed_sem_wait;
-		    }
-		}
-	    }
+	if (shm_ring_peer_died(shm_ring)) {
+	    goto failed_sem_wait;
 	}
     }
 
+    AMPROBE3(shm__ring__sem__wait__return, shm_ring, sem, 0);
+    return 0;
+
 failed_sem_wait:
     g_debug("shm_ring_sem_wait: failed_sem_wait: %s", strerror(errno));
-    shm_ring->mc->cancelled = 1;
-    sem_post(shm_ring->sem_read);
-    sem_post(shm_ring->sem_write);
-    sem_post(shm_ring->sem_ready);
-    sem_post(shm_ring->sem_start);
+    shm_ring_cancel(shm_ring);
+    AMPROBE3(shm__ring__sem__wait__return, shm_ring, sem, -1);
     return -1;
 }
 
+#ifdef SHM_RING_FUTEX
+static void
+adapt_spins(
+    guint *spins,
+    gboolean slept)
+{
+    if (slept) {
+	if (*spins > SHM_RING_MIN_SPINS)
+	    *spins /= 2;
+    } else if (*spins < SHM_RING_MAX_SPINS) {
+	*spins *= 2;
+    }
+}
+
+/* Sleep until *futex no longer holds val, someone wakes us, or the timeout
+ * expires.  Returns -1 if a peer died while we were waiting. */
+static int
+shm_ring_futex_wait(
+    shm_ring_t *shm_ring,
+    uint32_t   *futex,
+    uint32_t    val)
+{
+    struct timespec tv = { SHM_RING_FUTEX_TIMEOUT, 0 };
+
+    if (syscall(SYS_futex, futex, FUTEX_WAIT, val, &tv, NULL, 0) == 0 ||
+	errno != ETIMEDOUT) {
+	return 0;
+    }
+
+    if (++shm_ring->futex_timeouts >= SHM_RING_PID_CHECK) {
+	shm_ring->futex_timeouts = 0;
+	if (shm_ring_peer_died(shm_ring)) {
+	    g_debug("shm_ring_futex_wait: a peer died");
+	    shm_ring_cancel(shm_ring);
+	    return -1;
+	}
+    }
+    return 0;
+}
+
+static void
+shm_ring_futex_wake(
+    uint32_t *futex)
+{
+    add_seq_cst(futex, 1);
+    syscall(SYS_futex, futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+#endif
+
+/* wake both sides, whatever they are waiting for; used on eof and cancel */
+static void
+shm_ring_wake(
+    shm_ring_t *shm_ring)
+{
+#ifdef SHM_RING_FUTEX
+    if (shm_ring->mc->use_futex) {
+	if (xchg_seq_cst(&shm_ring->mc->consumer_waiting, 0))
+	    shm_ring_futex_wake(&shm_ring->mc->data_futex);
+	if (xchg_seq_cst(&shm_ring->mc->producer_waiting, 0))
+	    shm_ring_futex_wake(&shm_ring->mc->space_futex);
+    }
+#else
+    (void)shm_ring;
+#endif
+}
+
+void
+shm_ring_producer_set_futex(
+    shm_ring_t *shm_ring)
+{
+#ifdef SHM_RING_FUTEX
+    shm_ring->mc->producer_futex = TRUE;
+    shm_ring->spins = SHM_RING_MIN_SPINS;
+#else
+    (void)shm_ring;
+#endif
+}
+
+void
+shm_ring_consumer_set_futex(
+    shm_ring_t *shm_ring)
+{
+#ifdef SHM_RING_FUTEX
+    shm_ring->mc->consumer_futex = TRUE;
+    shm_ring->spins = SHM_RING_MIN_SPINS;
+#else
+    (void)shm_ring;
+#endif
+}
+
+void
+shm_ring_consumer_set_zerocopy(
+    shm_ring_t *shm_ring)
+{
+    shm_ring->zerocopy = TRUE;
+}
+
+void
+shm_ring_producer_set_max_size(
+    shm_ring_t *shm_ring,
+    ssize_t     max_size)
+{
+    shm_ring->mc->producer_max_ring_size = max_size;
+}
+
+struct size_property_s {
+    const char *name;
+    property_t *property;
+};
+
+static void
+find_size_property(
+    gpointer key_p,
+    gpointer value_p,
+    gpointer user_data_p)
+{
+    struct size_property_s *sp = user_data_p;
+
+    if (!sp->property && g_str_amanda_equal(key_p, sp->name))
+	sp->property = value_p;
+}
+
+gsize
+shm_ring_size_property(
+    proplist_t  proplist,
+    const char *name)
+{
+    struct size_property_s sp = { name, NULL };
+    guint64 size;
+    char *end;
+
+    if (!proplist)
+	return 0;
+    g_hash_table_foreach(proplist, find_size_property, &sp);
+    if (!sp.property || !sp.property->values)
+	return 0;
+
+    size = g_ascii_strtoull(sp.property->values->data, &end, 10);
+    switch (g_ascii_tolower(*end)) {
+	case 'g': size *= 1024;
+	/* fall through */
+	case 'm': size *= 1024;
+	/* fall through */
+	case 'k': size *= 1024; end++;
+	/* fall through */
+	case '\0': break;
+	default:
+	    g_debug("invalid %s property: %s", name,
+		    (char *)sp.property->values->data);
+	    return 0;
+    }
+    if (*end != '\0' && g_ascii_tolower(*end) != 'b') {
+	g_debug("invalid %s property: %s", name,
+		(char *)sp.property->values->data);
+	return 0;
+    }
+
+    return size;
+}
+
+/* microseconds on the monotonic clock, so that a stepped wall clock does not
+ * skew the stall measurements */
+static guint64
+shm_ring_clock(void)
+{
+#if GLIB_CHECK_VERSION(2,28,0)
+    return (guint64)g_get_monotonic_time();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (guint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+#endif
+}
+
+/* Called by the producer before writing a block that reaches the end of the
+ * ring.  Growing only there keeps the data contiguous: the consumer is
+ * behind us in this lap, and it sees the new ring_size before any byte
+ * written past the old end. */
+static void
+shm_ring_maybe_grow(
+    shm_ring_t *shm_ring)
+{
+    shm_ring_control_t *mc = shm_ring->mc;
+    guint64 now = shm_ring_clock();
+    guint64 lap = now - shm_ring->lap_start;
+
+    if (mc->ring_size < mc->max_ring_size &&
+	shm_ring->stall_usec * 100 > lap * SHM_RING_GROW_STALL_PERCENT) {
+	g_debug("shm_ring: growing from %lld to %lld bytes (stalled %lld of %lld usec)",
+		(long long)mc->ring_size, (long long)mc->ring_size * 2,
+		(long long)shm_ring->stall_usec, (long long)lap);
+#ifdef SHM_RING_FUTEX
+	store_seq_cst(&mc->ring_size, mc->ring_size * 2);
+#else
+	mc->ring_size *= 2;
+#endif
+    }
+    shm_ring->stall_usec = 0;
+    shm_ring->lap_start = now;
+}
+
+/* Consumer: wait until at least 'needed' bytes are readable, or eof, or
+ * cancellation; returns the number of readable bytes. */
+static uint64_t
+shm_ring_wait_for_data(
+    shm_ring_t *shm_ring,
+    uint64_t    needed,
+    gboolean   *eof_flag)
+{
+    shm_ring_control_t *mc = shm_ring->mc;
+    uint64_t usable = 0;
+
+#ifdef SHM_RING_FUTEX
+    if (mc->use_futex) {
+	gboolean slept = FALSE;
+	guint i;
+
+	/* only this side changes readx */
+	for (i = 0; ; i++) {
+	    uint32_t seq;
+
+	    /* eof_flag first: once set, 'written' is final */
+	    *eof_flag = load_acquire(&mc->eof_flag);
+	    usable = load_acquire(&mc->written) - mc->readx;
+	    if (usable >= needed || *eof_flag || load_acquire(&mc->cancelled))
+		break;
+
+	    if (i < shm_ring->spins) {
+		cpu_relax();
+		continue;
+	    }
+
+	    /* ask for a wake-up, then check one last time; the producer
+	     * checks the flag after publishing */
+	    seq = load_seq_cst(&mc->data_futex);
+	    store_seq_cst(&mc->consumer_wake_at, mc->readx + needed);
+	    store_seq_cst(&mc->consumer_waiting, 1);
+	    if (load_seq_cst(&mc->written) - mc->readx < needed &&
+		!load_seq_cst(&mc->eof_flag) && !load_seq_cst(&mc->cancelled)) {
+		if (shm_ring_futex_wait(shm_ring, &mc->data_futex, seq) != 0)
+		    break;
+	    }
+	    store_seq_cst(&mc->consumer_waiting, 0);
+	    slept = TRUE;
+	}
+	adapt_spins(&shm_ring->spins, slept);
+
+	return usable;
+    }
+#endif
+
+    do {
+	if (shm_ring_sem_wait(shm_ring, shm_ring->sem_read) != 0) {
+	    break;
+	}
+	*eof_flag = mc->eof_flag;
+	usable = mc->written - mc->readx;
+    } while (!mc->cancelled && usable < needed && !*eof_flag);
+
+    return usable;
+}
+
+/* Consumer: release 'len' bytes at read_offset back to the producer */
+static void
+shm_ring_consumed(
+    shm_ring_t *shm_ring,
+    uint64_t    len)
+{
+    shm_ring_control_t *mc = shm_ring->mc;
+    uint64_t read_offset = mc->read_offset + len;
+
+    if (read_offset >= mc->ring_size)
+	read_offset -= mc->ring_size;
+    mc->read_offset = read_offset;
+
+#ifdef SHM_RING_FUTEX
+    if (mc->use_futex) {
+	uint64_t readx = add_seq_cst(&mc->readx, len);
+
+	if (load_seq_cst(&mc->producer_waiting) &&
+	    readx >= load_seq_cst(&mc->producer_wake_at) &&
+	    xchg_seq_cst(&mc->producer_waiting, 0)) {
+	    shm_ring_futex_wake(&mc->space_futex);
+	}
+	return;
+    }
+#endif
+
+    mc->readx += len;
+    sem_post(shm_ring->sem_write);
+}
+
+/* Producer: wait until at least 'needed' bytes are free, or cancellation;
+ * returns the number of free bytes. */
+static uint64_t
+shm_ring_wait_for_space(
+    shm_ring_t *shm_ring,
+    uint64_t    needed)
+{
+    shm_ring_control_t *mc = shm_ring->mc;
+    uint64_t ring_size = mc->ring_size;
+    uint64_t space = 0;
+
+#ifdef SHM_RING_FUTEX
+    if (mc->use_futex) {
+	gboolean slept = FALSE;
+	guint i;
+
+	/* only this side changes written */
+	for (i = 0; ; i++) {
+	    uint32_t seq;
+
+	    space = ring_size - (mc->written - load_acquire(&mc->readx));
+	    if (space >= needed || load_acquire(&mc->cancelled))
+		break;
+
+	    if (i < shm_ring->spins) {
+		cpu_relax();
+		continue;
+	    }
+
+	    seq = load_seq_cst(&mc->space_futex);
+	    store_seq_cst(&mc->producer_wake_at, mc->written + needed - ring_size);
+	    store_seq_cst(&mc->producer_waiting, 1);
+	    if (ring_size - (mc->written - load_seq_cst(&mc->readx)) < needed &&
+		!load_seq_cst(&mc->cancelled)) {
+		guint64 start = shm_ring_clock();
+		int r = shm_ring_futex_wait(shm_ring, &mc->space_futex, seq);
+
+		shm_ring->stall_usec += shm_ring_clock() - start;
+		if (r != 0)
+		    break;
+	    }
+	    store_seq_cst(&mc->producer_waiting, 0);
+	    slept = TRUE;
+	}
+	adapt_spins(&shm_ring->spins, slept);
+
+	return space;
+    }
+#endif
+
+    while (!mc->cancelled) {
+	space = ring_size - (mc->written - mc->readx);
+	if (space >= needed)
+	    break;
+	if (shm_ring_sem_wait(shm_ring, shm_ring->sem_write) != 0) {
+	    break;
+	}
+    }
+
+    return space;
+}
+
+/* Producer: publish 'len' bytes written at write_offset */
+static void
+shm_ring_produced(
+    shm_ring_t *shm_ring,
+    uint64_t    len)
+{
+    shm_ring_control_t *mc = shm_ring->mc;
+
+    mc->write_offset = (mc->write_offset + len) % mc->ring_size;
+
+#ifdef SHM_RING_FUTEX
+    if (mc->use_futex) {
+	uint64_t written = add_seq_cst(&mc->written, len);
+
+	if (load_seq_cst(&mc->consumer_waiting) &&
+	    written >= load_seq_cst(&mc->consumer_wake_at) &&
+	    xchg_seq_cst(&mc->consumer_waiting, 0)) {
+	    shm_ring_futex_wake(&mc->data_futex);
+	}
+	return;
+    }
+#endif
+
+    mc->written += len;
+    shm_ring->data_avail += len;
+    if (shm_ring->data_avail >= mc->consumer_block_size) {
+	sem_post(shm_ring->sem_read);
+	shm_ring->data_avail -= mc->consumer_block_size;
+    }
+}
+
+struct shm_ring_reader_s {
+    shm_ring_t          *shm_ring;
+    shm_ring_reader_func func;
+    gpointer             data;
+    uint64_t             readx;	/* bytes read, like mc->readx */
+    uint64_t             read_offset;
+    gboolean             done;
+    GThread             *thread;
+};
+
+static gpointer
+shm_ring_reader_thread(
+    gpointer data)
+{
+    shm_ring_reader_t *reader = (shm_ring_reader_t *)data;
+    shm_ring_t *shm_ring = reader->shm_ring;
+    uint64_t ring_size = shm_ring->mc->ring_size;
+    uint64_t read_offset = reader->read_offset;
+    uint64_t usable;
+
+    g_mutex_lock(shm_ring->readers_mutex);
+    while (1) {
+	while (shm_ring->readers_written == reader->readx &&
+	       !shm_ring->readers_eof && !shm_ring->mc->cancelled) {
+	    g_cond_wait(shm_ring->readers_cond, shm_ring->readers_mutex);
+	}
+	usable = shm_ring->readers_written - reader->readx;
+	if (usable == 0 || shm_ring->mc->cancelled)
+	    break;
+	g_mutex_unlock(shm_ring->readers_mutex);
+
+	/* the producer does not overwrite this data until readx passes it */
+	if (read_offset + usable <= ring_size) {
+	    reader->func(reader->data, shm_ring->data + read_offset, usable);
+	} else {
+	    reader->func(reader->data, shm_ring->data + read_offset,
+			 ring_size - read_offset);
+	    reader->func(reader->data, shm_ring->data,
+			 usable - (ring_size - read_offset));
+	}
+	read_offset = (read_offset + usable) % ring_size;
+
+	g_mutex_lock(shm_ring->readers_mutex);
+	reader->readx += usable;
+	g_cond_broadcast(shm_ring->readers_cond);
+    }
+    reader->done = TRUE;
+    g_cond_broadcast(shm_ring->readers_cond);
+    g_mutex_unlock(shm_ring->readers_mutex);
+
+    return NULL;
+}
+
+shm_ring_reader_t *
+shm_ring_add_reader(
+    shm_ring_t *shm_ring,
+    shm_ring_reader_func func,
+    gpointer data)
+{
+    shm_ring_reader_t *reader = g_new0(shm_ring_reader_t, 1);
+
+    if (!shm_ring->readers_mutex) {
+	shm_ring->readers_mutex = g_mutex_new();
+	shm_ring->readers_cond = g_cond_new();
+    }
+    reader->shm_ring = shm_ring;
+    reader->func = func;
+    reader->data = data;
+
+    g_mutex_lock(shm_ring->readers_mutex);
+    reader->readx = shm_ring->readers_written;
+    reader->read_offset = shm_ring->mc->write_offset;
+    shm_ring->readers = g_slist_append(shm_ring->readers, reader);
+    g_mutex_unlock(shm_ring->readers_mutex);
+
+    reader->thread = g_thread_create(shm_ring_reader_thread, reader, TRUE, NULL);
+    return reader;
+}
+
+void
+shm_ring_join_reader(
+    shm_ring_t *shm_ring,
+    shm_ring_reader_t *reader)
+{
+    g_thread_join(reader->thread);
+
+    g_mutex_lock(shm_ring->readers_mutex);
+    shm_ring->readers = g_slist_remove(shm_ring->readers, reader);
+    g_mutex_unlock(shm_ring->readers_mutex);
+    g_free(reader);
+}
+
+/* Producer: wait until the side readers leave at least 'needed' bytes free,
+ * or cancellation */
+static void
+shm_ring_readers_wait_for_space(
+    shm_ring_t *shm_ring,
+    uint64_t    needed)
+{
+    uint64_t ring_size = shm_ring->mc->ring_size;
+
+    g_mutex_lock(shm_ring->readers_mutex);
+    while (!shm_ring->mc->cancelled) {
+	uint64_t min_readx = shm_ring->readers_written;
+	GSList *r;
+
+	for (r = shm_ring->readers; r != NULL; r = r->next) {
+	    shm_ring_reader_t *reader = (shm_ring_reader_t *)r->data;
+	    if (!reader->done && reader->readx < min_readx)
+		min_readx = reader->readx;
+	}
+	if (ring_size - (shm_ring->readers_written - min_readx) >= needed)
+	    break;
+	g_cond_wait(shm_ring->readers_cond, shm_ring->readers_mutex);
+    }
+    g_mutex_unlock(shm_ring->readers_mutex);
+}
+
+/* Producer: hand 'len' more bytes, or the eof, to the side readers */
+static void
+shm_ring_readers_produced(
+    shm_ring_t *shm_ring,
+    uint64_t    len,
+    gboolean    eof)
+{
+    g_mutex_lock(shm_ring->readers_mutex);
+    shm_ring->readers_written += len;
+    if (eof)
+	shm_ring->readers_eof = TRUE;
+    g_cond_broadcast(shm_ring->readers_cond);
+    g_mutex_unlock(shm_ring->readers_mutex);
+}
+
+/* Producer: no more data will be written */
+static void
+shm_ring_set_eof(
+    shm_ring_t *shm_ring)
+{
+#ifdef SHM_RING_FUTEX
+    if (shm_ring->mc->use_futex) {
+	store_seq_cst(&shm_ring->mc->eof_flag, TRUE);
+	shm_ring_wake(shm_ring);
+	return;
+    }
+#endif
+    shm_ring->mc->eof_flag = TRUE;
+}
+
 void
 fd_to_shm_ring(
     int fd,
@@ -275,35 +888,34 @@ fd_to_shm_ring(
     crc_t *crc)
 {
     uint64_t write_offset;
-    uint64_t written;
-    uint64_t readx;
     uint64_t shm_ring_size;
     struct iovec iov[2];
     int          iov_count;
     ssize_t      n;
-    size_t      consumer_block_size;
 
-    g_debug("fd_to_shm_ring");
+    g_debug("fd_to_shm_ring%s", shm_ring->mc->use_futex ? " (futex)" : "");
 
     shm_ring_size = shm_ring->mc->ring_size;
-    consumer_block_size = shm_ring->mc->consumer_block_size;
-    crc32_init(crc);
+    shm_ring->lap_start = shm_ring_clock();
+    if (crc)
+	crc32_init(crc);
 
     while (!shm_ring->mc->cancelled) {
-        write_offset = shm_ring->mc->write_offset;
-        written = shm_ring->mc->written;
-	while (!shm_ring->mc->cancelled) {
-            readx = shm_ring->mc->readx;
-	    if (shm_ring_size - (written - readx) >= shm_ring->block_size)
-		break;
-            if (shm_ring_sem_wait(shm_ring, shm_ring->sem_write) != 0) {
-		break;
-	    }
-	}
+	if (shm_ring_wait_for_space(shm_ring, shm_ring->block_size) <
+		shm_ring->block_size)
+	    break;
+	if (shm_ring->readers)
+	    shm_ring_readers_wait_for_space(shm_ring, shm_ring->block_size);
 
 	if (shm_ring->mc->cancelled)
 	    break;
 
+        write_offset = shm_ring->mc->write_offset;
+	if (shm_ring->mc->use_futex && !shm_ring->readers &&
+	    write_offset + shm_ring->block_size >= shm_ring_size) {
+	    shm_ring_maybe_grow(shm_ring);
+	    shm_ring_size = shm_ring->mc->ring_size;
+	}
         iov[0].iov_base = shm_ring->data + write_offset;
         if (write_offset + shm_ring->block_size <= shm_ring_size) {
             iov[0].iov_len = shm_ring->block_size;
@@ -323,38 +935,32 @@ fd_to_shm_ring(
 		    break;
 		}
 	    }
-            write_offset += n;
-            write_offset %= shm_ring_size;
-            shm_ring->mc->write_offset = write_offset;
-            shm_ring->mc->written += n;
-            shm_ring->data_avail += n;
-            if (shm_ring->data_avail >= consumer_block_size) {
-                sem_post(shm_ring->sem_read);
-                shm_ring->data_avail -= consumer_block_size;
-            }
-            if (n <= (ssize_t)iov[0].iov_len) {
+            if (!crc) {
+                /* a side reader computes it */
+            } else if (n <= (ssize_t)iov[0].iov_len) {
                 crc32_add((uint8_t *)iov[0].iov_base, n, crc);
             } else {
                 crc32_add((uint8_t *)iov[0].iov_base, iov[0].iov_len, crc);
                 crc32_add((uint8_t *)iov[1].iov_base, n - iov[0].iov_len, crc);
             }
+	    shm_ring_produced(shm_ring, n);
+	    if (shm_ring->readers)
+		shm_ring_readers_produced(shm_ring, n, FALSE);
         } else {
-            shm_ring->mc->eof_flag = TRUE;
             break;
         }
     }
 
-    sem_post(shm_ring->sem_read);
-    sem_post(shm_ring->sem_read);
+    shm_ring_set_eof(shm_ring);
+    if (shm_ring->readers)
+	shm_ring_readers_produced(shm_ring, 0, TRUE);
+    if (!shm_ring->mc->use_futex) {
+	sem_post(shm_ring->sem_read);
+	sem_post(shm_ring->sem_read);
+    }
 
     // wait for the consumer to read everything
-    while (!shm_ring->mc->cancelled &&
-	   (shm_ring->mc->written != shm_ring->mc->readx ||
-	    !shm_ring->mc->eof_flag)) {
-	if (shm_ring_sem_wait(shm_ring, shm_ring->sem_write) != 0) {
-	    break;
-	}
-    }
+    shm_ring_wait_for_space(shm_ring, shm_ring->mc->ring_size);
 }
 
 void
@@ -368,7 +974,7 @@ close_producer_shm_ring(
     sem_post(shm_ring->sem_start);
     sem_post(shm_ring->sem_write);
     sem_post(shm_ring->sem_read);
-g_debug("close_producer_shm_ring sem_close(sem_write %p", shm_ring->sem_write);
+    shm_debug(1, "close_producer_shm_ring sem_close(sem_write %p", shm_ring->sem_write);
     am_sem_close(shm_ring->sem_write);
     am_sem_close(shm_ring->sem_ready);
     am_sem_close(shm_ring->sem_read);
@@ -385,10 +991,163 @@ g_debug("close_producer_shm_ring sem_close(sem_write %p", shm_ring->sem_write);
     }
     aclose(shm_ring->shm_data);
     aclose(shm_ring->shm_control);
+    if (shm_ring->readers_mutex) {
+	g_mutex_free(shm_ring->readers_mutex);
+	g_cond_free(shm_ring->readers_cond);
+    }
     g_free(shm_ring->shm_control_name);
     g_free(shm_ring);
 }
 
+#ifdef SHM_RING_FUTEX
+/* A block sent zero-copy, released to the producer once the kernel is done
+ * with it */
+typedef struct zc_block_s {
+    guint32  id;	/* last send of the block */
+    gboolean copied;	/* the data was copied, it can be released now */
+    uint64_t len;
+} zc_block_t;
+
+/* Release the blocks at the head of 'inflight' the kernel is done with;
+ * if wait is set, wait a while for a send to complete first. */
+static int
+shm_ring_zerocopy_release(
+    shm_ring_t *shm_ring,
+    struct security_stream_t *netfd,
+    GQueue     *inflight,
+    uint64_t   *sent,
+    gboolean    wait)
+{
+    zc_block_t *zb;
+    guint32 done;
+
+    if (security_stream_zerocopy_reap(netfd, wait, &done) < 0)
+	return -1;
+    while ((zb = g_queue_peek_head(inflight)) != NULL &&
+	   (zb->copied || (gint32)(zb->id - done) < 0)) {
+	g_queue_pop_head(inflight);
+	shm_ring_consumed(shm_ring, zb->len);
+	*sent -= zb->len;
+	g_free(zb);
+    }
+    return 0;
+}
+
+/* Send one piece of a block, queueing it to be released */
+static int
+shm_ring_zerocopy_send(
+    struct security_stream_t *netfd,
+    GQueue     *inflight,
+    char       *buf,
+    uint64_t    len,
+    crc_t      *crc)
+{
+    zc_block_t *zb = g_new0(zc_block_t, 1);
+    int r;
+
+    r = security_stream_write_zerocopy(netfd, buf, len, &zb->id);
+    if (r < 0) {
+	g_free(zb);
+	return -1;
+    }
+    zb->copied = (r == 1);
+    zb->len = len;
+    g_queue_push_tail(inflight, zb);
+    if (crc)
+	crc32_add((uint8_t *)buf, len, crc);
+    return 0;
+}
+
+/*
+ * shm_ring_to_security_stream with MSG_ZEROCOPY: a block stays in the ring
+ * until the kernel reports its send completed, so the consumer keeps 'sent'
+ * bytes past read_offset.  At most half the ring is held that way.  The
+ * producer may be waiting for exactly that space, so the consumer only
+ * sleeps for data once everything sent is released.
+ */
+static void
+shm_ring_to_security_stream_zerocopy(
+    shm_ring_t *shm_ring,
+    struct security_stream_t *netfd,
+    crc_t *crc)
+{
+    shm_ring_control_t *mc = shm_ring->mc;
+    GQueue      *inflight = g_queue_new();
+    zc_block_t  *zb;
+    uint64_t     sent = 0;
+    uint64_t     shm_ring_size;
+    uint64_t     max_sent;
+    uint64_t     offset;
+    uint64_t     to_write;
+    uint64_t     usable;
+    gboolean     eof_flag = FALSE;
+
+    g_debug("shm_ring_to_security_stream (zerocopy)");
+
+    sem_post(shm_ring->sem_write);
+    while (!load_acquire(&mc->cancelled)) {
+	if (sent > 0) {
+	    if (shm_ring_zerocopy_release(shm_ring, netfd, inflight, &sent,
+					  FALSE) < 0)
+		goto failed;
+	}
+	if (sent == 0) {
+	    usable = shm_ring_wait_for_data(shm_ring, shm_ring->block_size,
+					    &eof_flag);
+	} else {
+	    eof_flag = load_acquire(&mc->eof_flag);
+	    usable = load_acquire(&mc->written) - mc->readx - sent;
+	}
+	if (load_acquire(&mc->cancelled))
+	    break;
+	/* the producer may have grown the ring before writing this data */
+	shm_ring_size = mc->ring_size;
+	max_sent = MAX(shm_ring_size / 2, shm_ring->block_size);
+
+	if (usable == 0 && eof_flag && sent == 0) {
+	    /* everything is sent and released */
+	    goto done;
+	}
+	if ((usable < shm_ring->block_size && !eof_flag) || usable == 0 ||
+	    sent + shm_ring->block_size > max_sent) {
+	    if (sent > 0 &&
+		shm_ring_zerocopy_release(shm_ring, netfd, inflight, &sent,
+					  TRUE) < 0)
+		goto failed;
+	    continue;
+	}
+
+	to_write = MIN(usable, shm_ring->block_size);
+	offset = (mc->read_offset + sent) % shm_ring_size;
+	if (offset + to_write <= shm_ring_size) {
+	    if (shm_ring_zerocopy_send(netfd, inflight,
+				       shm_ring->data + offset, to_write,
+				       crc) < 0)
+		goto failed;
+	} else {
+	    if (shm_ring_zerocopy_send(netfd, inflight,
+				       shm_ring->data + offset,
+				       shm_ring_size - offset, crc) < 0 ||
+		shm_ring_zerocopy_send(netfd, inflight, shm_ring->data,
+				       to_write - shm_ring_size + offset,
+				       crc) < 0)
+		goto failed;
+	}
+	sent += to_write;
+    }
+    goto done;
+
+failed:
+    g_debug("shm_ring_to_security_stream: %s",
+	    security_stream_geterror(netfd));
+    shm_ring_cancel(shm_ring);
+done:
+    while ((zb = g_queue_pop_head(inflight)) != NULL)
+	g_free(zb);
+    g_queue_free(inflight);
+}
+#endif
+
 void
 shm_ring_to_security_stream(
     shm_ring_t *shm_ring,
@@ -400,26 +1159,30 @@ shm_ring_to_security_stream(
     gsize        usable = 0;
     gboolean     eof_flag = FALSE;
 
-    g_debug("shm_ring_to_security_stream");
-    shm_ring_size = shm_ring->mc->ring_size;
+#ifdef SHM_RING_FUTEX
+    if (shm_ring->zerocopy && shm_ring->mc->use_futex &&
+	security_stream_zerocopy_enable(netfd)) {
+	shm_ring_to_security_stream_zerocopy(shm_ring, netfd, crc);
+	return;
+    }
+#endif
+
+    g_debug("shm_ring_to_security_stream%s", shm_ring->mc->use_futex ? " (futex)" : "");
 
     sem_post(shm_ring->sem_write);
     while (!shm_ring->mc->cancelled) {
-	do {
-	    if (shm_ring_sem_wait(shm_ring, shm_ring->sem_read) != 0) {
-		break;
-	    }
-	    usable = shm_ring->mc->written - shm_ring->mc->readx;
-	    eof_flag = shm_ring->mc->eof_flag;
-	} while (!shm_ring->mc->cancelled &&
-		 usable < shm_ring->block_size && !eof_flag);
-	read_offset = shm_ring->mc->read_offset;
+	usable = shm_ring_wait_for_data(shm_ring, shm_ring->block_size, &eof_flag);
+	if (shm_ring->mc->cancelled)
+	    break;
+	/* the producer may have grown the ring before writing this data */
+	shm_ring_size = shm_ring->mc->ring_size;
 
 	while (usable >= shm_ring->block_size || eof_flag) {
 	    gsize to_write = usable;
 	    if (to_write > shm_ring->block_size)
 		to_write = shm_ring->block_size;
 
+	    read_offset = shm_ring->mc->read_offset;
 	    if (to_write + read_offset <= shm_ring_size) {
 		security_stream_write(netfd, shm_ring->data + read_offset,
 				      to_write);
@@ -434,22 +1197,17 @@ shm_ring_to_security_stream(
 				      to_write - shm_ring_size + read_offset);
 		if (crc) {
 		    crc32_add((uint8_t *)shm_ring->data + read_offset, shm_ring_size - read_offset, crc);
-		    crc32_add((uint8_t *)shm_ring->data, usable - shm_ring_size + read_offset, crc);
+		    crc32_add((uint8_t *)shm_ring->data, to_write - shm_ring_size + read_offset, crc);
 		}
 	    }
 	    if (to_write) {
-		read_offset += to_write;
-		if (read_offset >= shm_ring_size)
-		    read_offset -= shm_ring_size;
-		shm_ring->mc->read_offset = read_offset;
-		shm_ring->mc->readx += to_write;
-		sem_post(shm_ring->sem_write);
+		shm_ring_consumed(shm_ring, to_write);
 		usable -= to_write;
 	    }
-	    if (shm_ring->mc->write_offset == shm_ring->mc->read_offset &&
-		shm_ring->mc->eof_flag) {
+	    if (usable == 0 && eof_flag) {
 		// notify the producer that everything is read
-		sem_post(shm_ring->sem_write);
+		if (!shm_ring->mc->use_futex)
+		    sem_post(shm_ring->sem_write);
 		return;
 	    }
 	}
@@ -467,31 +1225,26 @@ shm_ring_to_fd(
     gsize        usable = 0;
     gboolean     eof_flag = FALSE;
 
-    g_debug("shm_ring_to_fd");
-    shm_ring_size = shm_ring->mc->ring_size;
+    g_debug("shm_ring_to_fd%s", shm_ring->mc->use_futex ? " (futex)" : "");
 
     sem_post(shm_ring->sem_write);
     while (!shm_ring->mc->cancelled) {
-	do {
-	    if (shm_ring_sem_wait(shm_ring, shm_ring->sem_read) != 0) {
-		break;
-	    }
-	    usable = shm_ring->mc->written - shm_ring->mc->readx;
-	    eof_flag = shm_ring->mc->eof_flag;
-	} while (!shm_ring->mc->cancelled &&
-		 usable < shm_ring->block_size && !eof_flag);
-	read_offset = shm_ring->mc->read_offset;
+	usable = shm_ring_wait_for_data(shm_ring, shm_ring->block_size, &eof_flag);
+	if (shm_ring->mc->cancelled)
+	    break;
+	/* the producer may have grown the ring before writing this data */
+	shm_ring_size = shm_ring->mc->ring_size;
 
 	while (usable >= shm_ring->block_size || eof_flag) {
 	    gsize to_write = usable;
 	    if (to_write > shm_ring->block_size)
 		to_write = shm_ring->block_size;
 
+	    read_offset = shm_ring->mc->read_offset;
 	    if (to_write + read_offset <= shm_ring_size) {
 		if (full_write(fd, shm_ring->data + read_offset, to_write) != to_write) {
 		    g_debug("full_write failed: %s", strerror(errno));
-		    shm_ring->mc->cancelled = TRUE;
-		    sem_post(shm_ring->sem_write);
+		    shm_ring_cancel(shm_ring);
 		    return;
 		}
 		if (crc) {
@@ -502,35 +1255,28 @@ shm_ring_to_fd(
 		if (full_write(fd, shm_ring->data + read_offset,
 			   shm_ring_size - read_offset) != shm_ring_size - read_offset) {
 		    g_debug("full_write failed: %s", strerror(errno));
-		    shm_ring->mc->cancelled = TRUE;
-		    sem_post(shm_ring->sem_write);
+		    shm_ring_cancel(shm_ring);
 		    return;
 		}
 		if (full_write(fd, shm_ring->data,
 			   to_write - shm_ring_size + read_offset) != to_write - shm_ring_size + read_offset) {
 		    g_debug("full_write failed: %s", strerror(errno));
-		    shm_ring->mc->cancelled = TRUE;
-		    sem_post(shm_ring->sem_write);
+		    shm_ring_cancel(shm_ring);
 		    return;
 		}
 		if (crc) {
 		    crc32_add((uint8_t *)shm_ring->data + read_offset, shm_ring_size - read_offset, crc);
-		    crc32_add((uint8_t *)shm_ring->data, usable - shm_ring_size + read_offset, crc);
+		    crc32_add((uint8_t *)shm_ring->data, to_write - shm_ring_size + read_offset, crc);
 		}
 	    }
 	    if (to_write) {
-		read_offset += to_write;
-		if (read_offset >= shm_ring_size)
-		    read_offset -= shm_ring_size;
-		shm_ring->mc->read_offset = read_offset;
-		shm_ring->mc->readx += to_write;
-		sem_post(shm_ring->sem_write);
+		shm_ring_consumed(shm_ring, to_write);
 		usable -= to_write;
 	    }
-	    if (shm_ring->mc->write_offset == shm_ring->mc->read_offset &&
-		shm_ring->mc->eof_flag) {
-		// notify the producer that everythinng is read
-		sem_post(shm_ring->sem_write);
+	    if (usable == 0 && eof_flag) {
+		// notify the producer that everything is read
+		if (!shm_ring->mc->use_futex)
+		    sem_post(shm_ring->sem_write);
 		return;
 	    }
 	}
@@ -556,11 +1302,11 @@ shm_ring_producer_set_size(
 
     alloc_shm_ring(shm_ring);
 
-    if (ftruncate(shm_ring->shm_data, shm_ring->mc->ring_size) == -1) {
+    if (ftruncate(shm_ring->shm_data, shm_ring->mc->max_ring_size) == -1) {
 	g_debug("ftruncate of shm_data failed: %s", strerror(errno));
 	exit(1);
     }
-    shm_ring->shm_data_mmap_size = shm_ring->mc->ring_size;
+    shm_ring->shm_data_mmap_size = shm_ring->mc->max_ring_size;
     shm_ring->data = mmap(NULL, shm_ring->shm_data_mmap_size,
 			   PROT_READ|PROT_WRITE, MAP_SHARED,
 			   shm_ring->shm_data, 0);
@@ -568,6 +1314,17 @@ shm_ring_producer_set_size(
 	g_debug("shm_ring shm_ring->data failed: %s", strerror(errno));
 	exit(1);
     }
+    if (shm_ring->mc->consumer_numa_node >= 0) {
+	char *errmsg = NULL;
+
+	/* before the first write, which allocates the pages */
+	if (!amnuma_prefer_memory(shm_ring->data, shm_ring->shm_data_mmap_size,
+				  shm_ring->mc->consumer_numa_node, &errmsg)) {
+	    g_debug("shm_ring: %s", errmsg);
+	    g_free(errmsg);
+	}
+    }
+    shm_ring_advise(shm_ring);
     sem_post(shm_ring->sem_read);
 }
 
@@ -589,7 +1346,7 @@ alloc_shm_ring(
     }
 
     if (best_ring_size % shm_ring->mc->producer_block_size != 0) {
-	best_ring_size = ((best_ring_size % shm_ring->mc->producer_block_size)+1) * shm_ring->mc->producer_block_size;
+	best_ring_size = ((best_ring_size / shm_ring->mc->producer_block_size)+1) * shm_ring->mc->producer_block_size;
     }
 
     while (best_ring_size % shm_ring->mc->consumer_block_size != 0) {
@@ -598,6 +1355,38 @@ alloc_shm_ring(
 
     shm_ring->ring_size = best_ring_size;
     shm_ring->mc->ring_size = shm_ring->ring_size;
+    shm_ring->mc->use_futex = shm_ring->mc->producer_futex &&
+			      shm_ring->mc->consumer_futex;
+
+    /* doubling keeps the ring a multiple of both block sizes */
+    shm_ring->mc->max_ring_size = shm_ring->ring_size;
+    if (shm_ring->mc->use_futex) {
+	while (shm_ring->mc->max_ring_size * 2 <=
+	       shm_ring->mc->producer_max_ring_size) {
+	    shm_ring->mc->max_ring_size *= 2;
+	}
+    }
+    if (shm_ring->mc->max_ring_size > shm_ring->ring_size) {
+	g_debug("shm_ring: ring_size %lld, may grow to %lld",
+		(long long)shm_ring->ring_size,
+		(long long)shm_ring->mc->max_ring_size);
+    }
+}
+
+/* ask for transparent huge pages on the data segment, to cut TLB misses on
+ * large rings; tmpfs segments cannot use MAP_HUGETLB */
+static void
+shm_ring_advise(
+    shm_ring_t *shm_ring)
+{
+#if defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+    if (madvise(shm_ring->data, shm_ring->shm_data_mmap_size, MADV_HUGEPAGE) == -1 &&
+	errno != EINVAL) {
+	g_debug("madvise(MADV_HUGEPAGE) failed: %s", strerror(errno));
+    }
+#else
+    (void)shm_ring;
+#endif
 }
 
 static sem_t *
@@ -642,7 +1431,7 @@ am_sem_open(
     }
     nb = GPOINTER_TO_INT(g_hash_table_lookup(hash_sem, r));
     nb++;
-g_debug("am_sem_open %p %d", r, nb);
+    shm_debug(1, "am_sem_open %p %d", r, nb);
     g_hash_table_insert(hash_sem, r, GINT_TO_POINTER(nb));
     g_mutex_unlock(shm_ring_mutex);
 
@@ -658,7 +1447,7 @@ am_sem_close(
     g_mutex_lock(shm_ring_mutex);
     nb = GPOINTER_TO_INT(g_hash_table_lookup(hash_sem, sem));
     nb--;
-g_debug("am_sem_close %p %d", sem, nb);
+    shm_debug(1, "am_sem_close %p %d", sem, nb);
     if (nb <= 0) {
 	g_hash_table_remove(hash_sem, sem);
 	if (sem_close(sem) == -1) {
@@ -724,6 +1513,7 @@ shm_ring_create(
     shm_ring->mc->write_offset = 0;
     shm_ring->mc->read_offset = 0;
     shm_ring->mc->eof_flag = FALSE;
+    shm_ring->mc->consumer_numa_node = -1;
     shm_ring->mc->pids[0] = getpid();;
 
     g_snprintf(shm_ring->mc->sem_write_name,
@@ -788,6 +1578,11 @@ shm_ring_consumer_set_size(
     shm_ring->block_size = block_size;
     shm_ring->mc->consumer_ring_size = ring_size;
     shm_ring->mc->consumer_block_size = block_size;
+    /* the consumer reads every byte and the producer may be on another node
+     * (a client application feeding a pinned dumper): ask for the data on
+     * the consumer's node */
+    if (amnuma_node_count() > 1)
+	shm_ring->mc->consumer_numa_node = amnuma_current_node();
     sem_post(shm_ring->sem_write);
     if (shm_ring_sem_wait(shm_ring, shm_ring->sem_read) == -1) {
 	g_debug("shm_ring_consumer_set_size: fail shm_ring_sem_wait");
@@ -809,7 +1604,7 @@ shm_ring_consumer_set_size(
     }
     shm_ring->ring_size = shm_ring->mc->ring_size;
 
-    shm_ring->shm_data_mmap_size = shm_ring->mc->ring_size;
+    shm_ring->shm_data_mmap_size = shm_ring->mc->max_ring_size;
     shm_ring->data = mmap(NULL, shm_ring->shm_data_mmap_size,
 			   PROT_READ|PROT_WRITE, MAP_SHARED,
 			   shm_ring->shm_data, 0);
@@ -824,6 +1619,7 @@ shm_ring_consumer_set_size(
 	g_debug("shm_ring->mc->ring_size %lld", (long long)shm_ring->mc->ring_size);
 	exit(1);
     }
+    shm_ring_advise(shm_ring);
 }
 
 shm_ring_t *
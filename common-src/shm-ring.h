@@ -51,6 +51,19 @@ typedef struct shm_ring_control_t {
     uint64_t read_offset;
     uint64_t readx;
     char     padding2[64 - 2*sizeof(uint64_t)];
+    /* futex mode: a side about to sleep publishes the counter value it
+     * needs and sets its waiting flag; the other side only wakes it once
+     * that value is reached */
+    uint64_t consumer_wake_at;	/* written value the consumer waits for */
+    uint64_t producer_wake_at;	/* readx value the producer waits for */
+    uint32_t data_futex;	/* bumped by the producer to wake the consumer */
+    uint32_t space_futex;	/* bumped by the consumer to wake the producer */
+    uint32_t consumer_waiting;
+    uint32_t producer_waiting;
+    gboolean producer_futex;	/* the producer supports futex mode */
+    gboolean consumer_futex;	/* the consumer supports futex mode */
+    gboolean use_futex;		/* both do; set by shm_ring_producer_set_size */
+    char     padding3[64 - 2*sizeof(uint64_t) - 4*sizeof(uint32_t) - 3*sizeof(gboolean)];
     gboolean cancelled;
     gboolean need_sem_ready;
     uint64_t ring_size;
@@ -64,6 +77,11 @@ typedef struct shm_ring_control_t {
     size_t   producer_block_size;
     uint64_t consumer_ring_size;
     uint64_t producer_ring_size;
+    uint64_t producer_max_ring_size;	/* cap for adaptive growth */
+    uint64_t max_ring_size;	/* size of the shm_data segment; ring_size
+				 * only grows up to this in futex mode */
+    int      consumer_numa_node; /* where the producer places shm_data,
+				  * or -1 */
 } shm_ring_control_t;
 
 typedef struct shm_ring_t {
@@ -81,24 +99,91 @@ typedef struct shm_ring_t {
     size_t         ring_size;	/* shm_ring desired size */
     size_t         block_size;
     size_t         data_avail;
+    guint          spins;	/* adaptive spin count before sleeping */
+    guint          futex_timeouts;
+    guint64        stall_usec;	/* producer time spent waiting for space */
+    guint64        lap_start;	/* when the producer last passed the end */
+    gboolean       zerocopy;	/* consumer sends with MSG_ZEROCOPY */
+
+    /* side readers of the producer, see shm_ring_add_reader; protected by
+     * readers_mutex */
+    GMutex        *readers_mutex;
+    GCond         *readers_cond;
+    GSList        *readers;
+    uint64_t       readers_written; /* bytes the side readers may read */
+    gboolean       readers_eof;
 } shm_ring_t;
 
+/* A side reader gets, in order, each piece of data written into the ring */
+typedef void (*shm_ring_reader_func)(gpointer data, const char *buf, gsize len);
+typedef struct shm_ring_reader_s shm_ring_reader_t;
+
 #include "security.h"
 #include "stream.h"
 
 extern GMutex *shm_ring_mutex;
 
 int shm_ring_sem_wait(shm_ring_t *shm_ring, sem_t *sem);
+
+/* Mark the ring cancelled and wake both sides, whatever they wait on, so that
+ * they see it at once.  Either side may call it, from any thread. */
+void shm_ring_cancel(shm_ring_t *shm_ring);
 shm_ring_t *shm_ring_create(char **errmsg);
 shm_ring_t *shm_ring_link(char *name);
 void shm_ring_to_security_stream(shm_ring_t *shm_ring, struct security_stream_t *netfd, crc_t *crc);
 void shm_ring_consumer_set_size(shm_ring_t *shm_ring, ssize_t ring_size, ssize_t block_size);
 void shm_ring_producer_set_size(shm_ring_t *shm_ring, ssize_t ring_size, ssize_t block_size);
 
+/* Announce that this side moves data with fd_to_shm_ring, shm_ring_to_fd or
+ * shm_ring_to_security_stream, which can wait on shared futexes instead of
+ * posting sem_read/sem_write for every block.  Futex mode is used only if
+ * both sides call this before their shm_ring_*_set_size, and only where
+ * futexes are available; the semaphores are still used for the set_size,
+ * sem_ready and sem_start handshakes and for cancellation.
+ */
+void shm_ring_producer_set_futex(shm_ring_t *shm_ring);
+void shm_ring_consumer_set_futex(shm_ring_t *shm_ring);
+
+/* Let shm_ring_to_security_stream send zero-copy, where the stream supports
+ * it (see security_stream_zerocopy_enable): a block is released to the
+ * producer only once the kernel is done sending it.  Needs futex mode. */
+void shm_ring_consumer_set_zerocopy(shm_ring_t *shm_ring);
+
+/* Let the ring grow, by doubling, up to max_size bytes while the producer
+ * spends much of its time waiting for space.  The whole max_size is mapped
+ * but only touched as the ring grows.  Growth needs futex mode, and must be
+ * called before shm_ring_producer_set_size. */
+void shm_ring_producer_set_max_size(shm_ring_t *shm_ring, ssize_t max_size);
+
+/* ring sizes set by the SHM-RING-SIZE and SHM-RING-MAX-SIZE dumptype or
+ * application properties */
+#define SHM_RING_SIZE_PROPERTY "SHM-RING-SIZE"
+#define SHM_RING_MAX_SIZE_PROPERTY "SHM-RING-MAX-SIZE"
+
+/* Return the size in bytes, with an optional k/m/g suffix, given by the
+ * first value of the property 'name', or 0 if it is not set or invalid. */
+gsize shm_ring_size_property(proplist_t proplist, const char *name);
+
+/* Add a side reader to the producer of the ring: a thread of this process that
+ * calls func with every byte fd_to_shm_ring writes, in place, with its own read
+ * cursor.  The producer reuses space only once the consumer and every side
+ * reader are done with it, so a CRC or an index scanner can run on another core
+ * without a copy of the data.  Call it after shm_ring_producer_set_size and
+ * before fd_to_shm_ring; the ring does not grow while side readers are
+ * attached. */
+shm_ring_reader_t *shm_ring_add_reader(shm_ring_t *shm_ring,
+				       shm_ring_reader_func func,
+				       gpointer data);
+
+/* Wait until the reader has seen all the data (or the ring is cancelled), and
+ * free it.  Call it after fd_to_shm_ring returns. */
+void shm_ring_join_reader(shm_ring_t *shm_ring, shm_ring_reader_t *reader);
+
 void close_producer_shm_ring(shm_ring_t *shm_ring);
 void close_consumer_shm_ring(shm_ring_t *shm_ring);
 void clean_shm_ring(void);
 void cleanup_shm_ring(void);
+/* crc may be NULL, when a side reader computes it */
 void fd_to_shm_ring(int fd, shm_ring_t *shm_ring, crc_t *crc);
 void shm_ring_to_fd(shm_ring_t *shm_ring, int fd, crc_t *crc);
 
@@ -105,7 +105,7 @@ static int newhandle = 1;
  * Local functions
  */
 static int runssh(struct tcp_conn *, const char *, const char *, const char *,
-		  const char *);
+		  const char *, const char *);
 
 /*
  * ssh version of a security handle allocator.  Logically sets
@@ -122,6 +122,7 @@ ssh_connect(
     struct sec_handle *rh;
     char *amandad_path=NULL, *client_username=NULL, *ssh_keys=NULL;
     char *client_port = NULL;
+    char *control_persist = NULL;
 
     assert(fn != NULL);
     assert(hostname != NULL);
@@ -163,10 +164,11 @@ ssh_connect(
 	if (port_str && strlen(port_str) >= 1) {
 	    client_port = port_str;
 	}
+	control_persist = conf_fn("ssh_control_persist", datap);
     }
     if(rh->rc->read == -1) {
 	if (runssh(rh->rs->rc, amandad_path, client_username, ssh_keys,
-		   client_port) < 0) {
+		   client_port, control_persist) < 0) {
 	    security_seterror(&rh->sech, _("can't connect to %s: %s"),
 			      hostname, rh->rs->rc->errmsg);
 	    goto error;
@@ -317,6 +319,11 @@ ssh_child_watch_callback(
 /*
  * Forks a ssh to the host listed in rc->hostname
  * Returns negative on error, with an errmsg in rc->errmsg.
+ *
+ * With a control_persist of more than 0 seconds, the ssh to a (user, host,
+ * port) shares the connection of a master ssh, kept that long after its
+ * last session, through a socket in AMANDA_TMPDIR/ssh-control.  The
+ * estimates, the checks and the dumps of a client then take one handshake.
  */
 static int
 runssh(
@@ -324,7 +331,8 @@ runssh(
     const char *	amandad_path,
     const char *	client_username,
     const char *	ssh_keys,
-    const char *        client_port)
+    const char *        client_port,
+    const char *	control_persist)
 {
     int rpipe[2], wpipe[2];
     char *xamandad_path = (char *)amandad_path;
@@ -335,6 +343,9 @@ runssh(
     gchar *ssh_options[100] = {SSH_OPTIONS, NULL};
     gchar **ssh_option;
     gchar *cmd;
+    char *control_dir = NULL;
+    char *control_persist_opt = NULL;
+    char *control_path_opt = NULL;
 
     memset(rpipe, -1, sizeof(rpipe));
     memset(wpipe, -1, sizeof(wpipe));
@@ -366,6 +377,19 @@ runssh(
 	g_ptr_array_add(myargs, "-i");
 	g_ptr_array_add(myargs, xssh_keys);
     }
+    if (control_persist && atoi(control_persist) > 0) {
+	control_dir = g_strconcat(AMANDA_TMPDIR, "/ssh-control", NULL);
+	control_persist_opt = g_strdup_printf("ControlPersist=%d",
+					      atoi(control_persist));
+	control_path_opt = g_strdup_printf("ControlPath=%s/%%r@%%h:%%p",
+					   control_dir);
+	g_ptr_array_add(myargs, "-o");
+	g_ptr_array_add(myargs, "ControlMaster=auto");
+	g_ptr_array_add(myargs, "-o");
+	g_ptr_array_add(myargs, control_persist_opt);
+	g_ptr_array_add(myargs, "-o");
+	g_ptr_array_add(myargs, control_path_opt);
+    }
     g_ptr_array_add(myargs, rc->hostname);
     g_ptr_array_add(myargs, xamandad_path);
     g_ptr_array_add(myargs, "-auth=ssh");
@@ -383,6 +407,9 @@ runssh(
 	aclose(rpipe[1]);
 	aclose(wpipe[0]);
 	aclose(wpipe[1]);
+	g_free(control_dir);
+	g_free(control_persist_opt);
+	g_free(control_path_opt);
 	return (-1);
     case 0:
 	dup2(wpipe[0], 0);
@@ -398,6 +425,10 @@ runssh(
             (GSourceFunc)ssh_child_watch_callback, rc, NULL);
 	g_source_attach(rc->child_watch, NULL);
 	g_source_unref(rc->child_watch);
+	g_ptr_array_free(myargs, TRUE);
+	g_free(control_dir);
+	g_free(control_persist_opt);
+	g_free(control_path_opt);
 
 	return (0);
     }
@@ -405,6 +436,11 @@ runssh(
     /* drop root privs for good */
     set_root_privs(-1);
 
+    /* only the user of the ssh may use its control sockets */
+    if (control_dir && mkdir(control_dir, 0700) < 0 && errno != EEXIST) {
+	g_debug("Can't create %s: %s", control_dir, strerror(errno));
+    }
+
     safe_fd(-1, 0);
 
     execvp(SSH, (gchar **)myargs->pdata);
@@ -45,12 +45,20 @@
 #include <openssl/crypto.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include <openssl/evp.h>
 
 /*
  * Number of seconds ssl has to start up
  */
 #define	CONNECT_TIMEOUT	20
 
+/*
+ * Session tickets are encrypted with keys derived from the private key and
+ * the period, so that every amandad process can decrypt them; a ticket is
+ * usable for at most this many seconds.
+ */
+#define SSL_TICKET_KEY_PERIOD	(24*60*60)
+
 /*
  * Interface functions
  */
@@ -66,6 +74,11 @@ static ssize_t ssl_data_write(void *c, struct iovec *iov, int iovcnt);
 static ssize_t ssl_data_write_non_blocking(void *c, struct iovec *iov, int iovcnt);
 static ssize_t ssl_data_read(void *c, void *bug, size_t size, int timeout);
 static void init_ssl(void);
+static void ssl_enable_ktls(SSL_CTX *ctx);
+static void ssl_log_ktls(SSL *ssl);
+static void ssl_set_ticket_keys(SSL_CTX *ctx, char *ssl_key_file);
+static void ssl_resume_session(SSL *ssl, char *key);
+static int ssl_new_session(SSL *ssl, SSL_SESSION *session);
 
 /*
  * This is our interface to the outside world.
@@ -104,6 +117,15 @@ const security_driver_t ssl_security_driver = {
 
 static int newhandle = 1;
 
+/*
+ * The last session with each server, by server and configuration (see
+ * runssl), so that the next connection resumes it instead of doing a full
+ * handshake.  The keys are never freed: they are the app data of the SSL
+ * structures.
+ */
+static GHashTable *ssl_sessions = NULL;
+static GMutex *ssl_sessions_mutex = NULL;
+
 /*
  * Local functions
  */
@@ -470,6 +492,7 @@ ssl_accept(
 	return;
     }
     SSL_CTX_set_mode(ctx, SSL_MODE_AUTO_RETRY);
+    ssl_enable_ktls(ctx);
 
     if (ssl_cipher_list) {
 	g_debug("Set ssl_cipher_list to %s", ssl_cipher_list);
@@ -515,6 +538,10 @@ ssl_accept(
 	SSL_CTX_set_verify_depth(ctx,1);
     }
 
+    /* let the client resume its session, from another amandad process */
+    SSL_CTX_set_session_id_context(ctx, (const unsigned char *)"amanda", 6);
+    ssl_set_ticket_keys(ctx, ssl_key_file);
+
     ssl = SSL_new(ctx);
     if (!ssl) {
 	g_debug(_("SSL_new failed: %s"),
@@ -533,6 +560,9 @@ ssl_accept(
 		 ERR_error_string(ERR_get_error(), NULL));
 	return;
     }
+    if (SSL_session_reused(ssl))
+	auth_debug(1, _("ssl: resumed the session of %s\n"), hostname);
+    ssl_log_ktls(ssl);
 
     /* Get the me's certificate (optional) */
     remote_cert = SSL_get_peer_certificate (ssl);
@@ -640,6 +670,7 @@ runssl(
     sockaddr_union   sin;
     socklen_t_equiv  len;
     char            *stream_msg = NULL;
+    char            *session_key;
 
     if (!ssl_key_file) {
 	security_seterror(&rh->sech, _("ssl-key-file must be set"));
@@ -693,6 +724,10 @@ runssl(
 	return -1;
     }
     SSL_CTX_set_mode(rc->ctx, SSL_MODE_AUTO_RETRY);
+    ssl_enable_ktls(rc->ctx);
+    SSL_CTX_set_session_cache_mode(rc->ctx,
+		SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(rc->ctx, ssl_new_session);
 
     if (ssl_cipher_list) {
 	g_debug("Set ssl_cipher_list to %s", ssl_cipher_list);
@@ -766,6 +801,15 @@ runssl(
     /* Assign the socket into the SSL structure (SSL and socket without BIO) */
     SSL_set_fd(rc->ssl, my_socket);
 
+    /* The session depends on the server and on our identity */
+    session_key = g_strdup_printf("%s:%s:%d:%s:%s:%s",
+			get_config_name() ? get_config_name() : "",
+			rc->hostname, (int)port, ssl_cert_file,
+			ssl_ca_cert_file ? ssl_ca_cert_file : "",
+			ssl_cipher_list ? ssl_cipher_list : "");
+    ssl_resume_session(rc->ssl, session_key);
+    g_free(session_key);
+
     /* Perform SSL Handshake on the SSL remote */
     err = SSL_connect(rc->ssl);
     if (err == -1) {
@@ -773,6 +817,9 @@ runssl(
 			  ERR_error_string(ERR_get_error(), NULL));
 	return -1;
     }
+    if (SSL_session_reused(rc->ssl))
+	auth_debug(1, _("ssl: resumed the session with %s\n"), rc->hostname);
+    ssl_log_ktls(rc->ssl);
 
     /* Get the me's certificate (optional) */
     remote_cert = SSL_get_peer_certificate(rc->ssl);
@@ -931,6 +978,138 @@ init_ssl(void)
 	/* Load the error strings for SSL & CRYPTO APIs */
 	SSL_load_error_strings();
 
+	ssl_sessions = g_hash_table_new(g_str_hash, g_str_equal);
+	ssl_sessions_mutex = g_mutex_new();
+
 	init_done = 1;
     }
 }
+
+/*
+ * Let OpenSSL hand the record encryption to the kernel (kTLS) after the
+ * handshake, where it and the kernel support it; it falls back to
+ * userspace encryption otherwise.
+ */
+static void
+ssl_enable_ktls(
+    SSL_CTX *ctx)
+{
+#ifdef SSL_OP_ENABLE_KTLS
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#else
+    (void)ctx;
+#endif
+}
+
+static void
+ssl_log_ktls(
+    SSL *ssl)
+{
+#if defined(SSL_OP_ENABLE_KTLS) && defined(BIO_get_ktls_send)
+    auth_debug(1, _("ssl: kernel TLS send: %s, receive: %s\n"),
+	       BIO_get_ktls_send(SSL_get_wbio(ssl)) ? "yes" : "no",
+	       BIO_get_ktls_recv(SSL_get_rbio(ssl)) ? "yes" : "no");
+#else
+    (void)ssl;
+#endif
+}
+
+/*
+ * Set the session ticket keys of a server context, derived from the
+ * private key and the current period.
+ */
+static void
+ssl_set_ticket_keys(
+    SSL_CTX *ctx,
+    char    *ssl_key_file)
+{
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEYS
+    unsigned char keys[2 * EVP_MAX_MD_SIZE];
+    unsigned int  size;
+    char         *contents;
+    gsize         length;
+    GString      *seed;
+    int           i;
+
+    if (!g_file_get_contents(ssl_key_file, &contents, &length, NULL)) {
+	g_debug("ssl: can't read %s for the session ticket keys", ssl_key_file);
+	return;
+    }
+
+    /* 16 bytes of key name, 16 of HMAC secret and 16 of AES key */
+    for (i = 0; i < 2; i++) {
+	seed = g_string_new(NULL);
+	g_string_printf(seed, "amanda session ticket %d %ld", i,
+			(long)(time(NULL) / SSL_TICKET_KEY_PERIOD));
+	g_string_append_len(seed, contents, length);
+	EVP_Digest(seed->str, seed->len, keys + i * 32, &size,
+		   EVP_sha256(), NULL);
+	memset(seed->str, 0, seed->len);
+	g_string_free(seed, TRUE);
+    }
+    memset(contents, 0, length);
+    g_free(contents);
+
+    if (SSL_CTX_set_tlsext_ticket_keys(ctx, keys, 48) != 1) {
+	g_debug("ssl: can't set the session ticket keys: %s",
+		ERR_error_string(ERR_get_error(), NULL));
+    }
+    memset(keys, 0, sizeof(keys));
+#else
+    (void)ctx;
+    (void)ssl_key_file;
+#endif
+}
+
+/*
+ * Use the last session with the server identified by 'key', if any, and
+ * remember 'key' for ssl_new_session.
+ */
+static void
+ssl_resume_session(
+    SSL  *ssl,
+    char *key)
+{
+    gpointer orig_key;
+    gpointer session;
+
+    g_mutex_lock(ssl_sessions_mutex);
+    if (!g_hash_table_lookup_extended(ssl_sessions, key, &orig_key,
+				      &session)) {
+	orig_key = g_strdup(key);
+	session = NULL;
+	g_hash_table_insert(ssl_sessions, orig_key, NULL);
+    }
+    SSL_set_app_data(ssl, orig_key);
+    if (session && SSL_set_session(ssl, session) != 1) {
+	auth_debug(1, _("ssl: can't resume the session: %s\n"),
+		   ERR_error_string(ERR_get_error(), NULL));
+    }
+    g_mutex_unlock(ssl_sessions_mutex);
+}
+
+/*
+ * OpenSSL callback for a new client session: keep it for the next
+ * connection to the same server.
+ */
+static int
+ssl_new_session(
+    SSL         *ssl,
+    SSL_SESSION *session)
+{
+    char        *key = SSL_get_app_data(ssl);
+    SSL_SESSION *old;
+
+    if (!key)
+	return 0;
+
+    g_mutex_lock(ssl_sessions_mutex);
+    old = g_hash_table_lookup(ssl_sessions, key);
+    if (old)
+	SSL_SESSION_free(old);
+    g_hash_table_insert(ssl_sessions, key, session);
+    g_mutex_unlock(ssl_sessions_mutex);
+
+    /* we keep the reference */
+    return 1;
+}
@@ -37,6 +37,10 @@
 #include "amanda.h"
 
 #define NETWORK_BLOCK_BYTES	DISK_BLOCK_BYTES
+/* the largest block of a data stream, used between peers that both have
+ * fe_net_large_blocks (see am_network_block_size); NETWORK_BLOCK_BYTES is
+ * still used with older peers */
+#define NETWORK_BLOCK_BYTES_MAX	(1024*1024)
 #define STREAM_BUFSIZE		(NETWORK_BLOCK_BYTES * 4)
 
 int stream_server(int family, in_port_t *port, size_t sendsize,
@@ -80,6 +80,9 @@ AMANDA_SETUP_GETFSENT
 AMANDA_SETUP_FILE_LOCKING
 AMANDA_SETUP_SWIG
 AMANDA_CHECK_COMPRESSION
+AMANDA_CHECK_COMPRESSION_LIBS
+AMANDA_CHECK_EVP_AES_GCM
+AMANDA_CHECK_EVP_SHA256
 AMANDA_CHECK_IPV6
 AMANDA_CHECK_READDIR
 AMANDA_CHECK_DEVICE_PREFIXES
@@ -174,6 +177,8 @@ AMANDA_ENABLE_GCC_WARNING([old-style-definition])
 AMANDA_DISABLE_GCC_WARNING([strict-aliasing])
 AMANDA_DISABLE_GCC_WARNING([unknown-pragmas])
 AMANDA_CHECK_SSE42
+AMANDA_CHECK_CRC32C_KERNELS
+AMANDA_CHECK_XOR_KERNELS
 AMANDA_WERROR_FLAGS
 AMANDA_SWIG_ERROR
 
@@ -195,19 +200,27 @@ AC_CHECK_HEADERS(
 	libc.h \
 	libgen.h \
 	limits.h \
+	linux/blkzoned.h \
+	linux/errqueue.h \
+	linux/fs.h \
+	linux/futex.h \
 	math.h \
 	netinet/in.h \
+	netinet/tcp.h \
 	regex.h \
 	stdarg.h \
 	stdlib.h \
 	strings.h \
 	rpc/rpc.h \
+	sys/epoll.h \
 	sys/file.h \
 	sys/ioctl.h \
 	sys/ipc.h \
 	sys/mntent.h \
 	sys/param.h \
+	sys/prctl.h \
 	sys/select.h \
+	sys/sdt.h \
 	sys/stat.h \
 	sys/shm.h \
 	sys/time.h \
@@ -256,6 +269,8 @@ AMANDA_CHECK_GLIB
 AMANDA_CHECK_READLINE
 AC_CHECK_LIB(m,modf)
 AMANDA_CHECK_LIBDL
+AMANDA_CHECK_LIBURING
+AMANDA_CHECK_RDMA
 AMANDA_GLIBC_BACKTRACE
 AC_SEARCH_LIBS([shm_open], [rt], [], [
   AC_MSG_ERROR([unable to find the shm_open() function])
@@ -367,6 +382,11 @@ ICE_CHECK_DECL(eaccess,unistd.h)
 ICE_CHECK_DECL(clock_gettime,time.h)
 AX_FUNC_WHICH_GETSERVBYNAME_R
 AC_CHECK_FUNCS(sem_timedwait)
+AC_CHECK_FUNCS(splice tee)
+AC_CHECK_FUNCS(recvmmsg sendmmsg)
+AC_CHECK_FUNCS(posix_memalign madvise)
+AC_CHECK_FUNCS(fallocate sync_file_range posix_fadvise)
+AC_CHECK_FUNCS(sched_setaffinity)
 
 #
 # Devices
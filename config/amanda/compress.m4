@@ -79,3 +79,69 @@ AC_DEFUN([AMANDA_CHECK_COMPRESSION],
     # Empty GZIP so that make dist works.
     GZIP=
 ])
+
+# SYNOPSIS
+#
+#   AMANDA_CHECK_COMPRESSION_LIBS
+#
+# OVERVIEW
+#
+#   Look for the compression libraries used for in-process compression
+#   (xfer_filter_compress and the dumper).  Each library is optional; define
+#   the following when the library and its header are found:
+#
+#    - HAVE_LIBZ	(zlib, gzip-compatible output)
+#    - HAVE_LIBZSTD	(zstd)
+#    - HAVE_LIBLZ4	(lz4 frame format)
+#
+#   and ZSTD_PATH and LZ4_PATH when the zstd and lz4 programs are found too;
+#   the dumps "compress server auto" compresses with them need them to be
+#   restored.
+#
+AC_DEFUN([AMANDA_CHECK_COMPRESSION_LIBS],
+[
+    AC_REQUIRE([AMANDA_INIT_PROGS])
+
+    AC_CHECK_HEADER([zlib.h], [
+	AC_CHECK_LIB([z], [deflateInit2_], [
+	    AC_DEFINE(HAVE_LIBZ, 1, [Define if zlib is available. ])
+	    AMANDA_ADD_LIBS([-lz])
+	])
+    ])
+
+    AC_ARG_WITH(zstd,
+	AS_HELP_STRING([--without-zstd],
+		       [do not use libzstd for in-process compression]),
+	[ WANT_ZSTD=$withval ], [ WANT_ZSTD=yes ])
+    if test x"$WANT_ZSTD" != x"no"; then
+	AC_CHECK_HEADER([zstd.h], [
+	    AC_CHECK_LIB([zstd], [ZSTD_compressStream2], [
+		AC_DEFINE(HAVE_LIBZSTD, 1, [Define if libzstd is available. ])
+		AMANDA_ADD_LIBS([-lzstd])
+		AC_PATH_PROG(ZSTD,zstd,,$LOCSYSPATH)
+		if test -n "$ZSTD"; then
+		    AC_DEFINE_UNQUOTED(ZSTD_PATH,"$ZSTD",
+			[Define to the exact path to the zstd program. ])
+		fi
+	    ])
+	])
+    fi
+
+    AC_ARG_WITH(lz4,
+	AS_HELP_STRING([--without-lz4],
+		       [do not use liblz4 for in-process compression]),
+	[ WANT_LZ4=$withval ], [ WANT_LZ4=yes ])
+    if test x"$WANT_LZ4" != x"no"; then
+	AC_CHECK_HEADER([lz4frame.h], [
+	    AC_CHECK_LIB([lz4], [LZ4F_compressBegin], [
+		AC_DEFINE(HAVE_LIBLZ4, 1, [Define if liblz4 is available. ])
+		AMANDA_ADD_LIBS([-llz4])
+		AC_PATH_PROG(LZ4,lz4,,$LOCSYSPATH)
+		if test -n "$LZ4"; then
+		    AC_DEFINE_UNQUOTED(LZ4_PATH,"$LZ4",
+			[Define to the exact path to the lz4 program. ])
+		fi
+	    ])
+	])
+    fi
+])
@@ -0,0 +1,38 @@
+# SYNOPSIS
+#
+#   AMANDA_DEDUP_DEVICE
+#
+# OVERVIEW
+#
+#   Perform the necessary checks for the DEDUP Device, which hashes its chunks
+#   with the SHA-256 of -lcrypto.  If the DEDUP device should be built,
+#   WANT_DEDUP_DEVICE is DEFINEd and set up as an AM_CONDITIONAL, and -lcrypto
+#   is added to LIBS.
+#
+AC_DEFUN([AMANDA_DEDUP_DEVICE], [
+	AC_ARG_ENABLE([dedup-device],
+	AS_HELP_STRING([--disable-dedup-device],
+		[disable the deduplicating device]),
+	[ WANT_DEDUP_DEVICE=$enableval ], [ WANT_DEDUP_DEVICE=yes ])
+
+	if test x"$WANT_SERVER" = x"false"; then
+		WANT_DEDUP_DEVICE=no
+	fi
+	if test x"$WANT_DEDUP_DEVICE" = x"yes"; then
+		AC_CHECK_HEADERS([openssl/evp.h], [], [WANT_DEDUP_DEVICE=no])
+	fi
+	if test x"$WANT_DEDUP_DEVICE" = x"yes"; then
+		AC_CHECK_LIB([crypto], [EVP_sha256], [], [WANT_DEDUP_DEVICE=no])
+	fi
+
+	AC_MSG_CHECKING([whether to include the DEDUP device])
+	AC_MSG_RESULT($WANT_DEDUP_DEVICE)
+
+	AM_CONDITIONAL([WANT_DEDUP_DEVICE], [test x"$WANT_DEDUP_DEVICE" = x"yes"])
+
+	# Now handle any setup for DEDUP, if we want it.
+	if test x"$WANT_DEDUP_DEVICE" = x"yes"; then
+	AC_DEFINE(WANT_DEDUP_DEVICE, [], [Compile the DEDUP driver])
+	AMANDA_ADD_LIBS([-lcrypto])
+	fi
+])
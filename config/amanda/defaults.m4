@@ -11,6 +11,8 @@
 #	    define and substitute DEFAULT_TAPE_DEVICE; substitue EXAMPLE_TAPEDEV
 #	--with-amandates
 #	    define and substitute DEFAULT_AMANDATES_FILE
+#	--with-xfer-costs-file
+#	    define DEFAULT_XFER_COSTS_FILE
 #	--with-security-file
 #	    define and substitute DEFAULT_SECURITY_FILE
 #
@@ -123,6 +125,24 @@ AC_DEFUN([AMANDA_SETUP_DEFAULTS],
     AC_DEFINE_DIR([DEFAULT_AMANDATES_FILE], [amandates],
         [Default location for 'amandates'])
 
+    AC_ARG_WITH(xfer-costs-file,
+        AS_HELP_STRING([--with-xfer-costs-file],
+            [location of the measured transfer linkage costs (default: $localstatedir/amanda/xfer-costs)]),
+	    [
+	    case "$withval" in
+	        n | no) xfer_costs_file='' ;;
+	        y |  ye | yes) xfer_costs_file='$localstatedir/amanda/xfer-costs' ;;
+	        *) xfer_costs_file="$withval";;
+	    esac
+	    ],
+	    [xfer_costs_file='$localstatedir/amanda/xfer-costs']
+    )
+
+    if test x"$xfer_costs_file" != x""; then
+	AC_DEFINE_DIR([DEFAULT_XFER_COSTS_FILE], [xfer_costs_file],
+	    [Default location of the measured transfer linkage costs])
+    fi
+
     AC_ARG_WITH(security-file,
         AS_HELP_STRING([--with-security-file],
             [Full path of the security file (default: $sysconfdir/amanda-security.conf)]),
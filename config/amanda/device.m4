@@ -9,6 +9,7 @@ AC_DEFUN([AMANDA_CHECK_DEVICES], [
     AC_REQUIRE([AMANDA_S3_DEVICE])
     AC_REQUIRE([AMANDA_TAPE_DEVICE])
     AC_REQUIRE([AMANDA_DVDRW_DEVICE])
+    AC_REQUIRE([AMANDA_DEDUP_DEVICE])
     AC_REQUIRE([AMANDA_NDMP_DEVICE])
 
     amanda_devices=' file null rait tape'
@@ -19,6 +20,11 @@ AC_DEFUN([AMANDA_CHECK_DEVICES], [
     else
 	missing_devices="$missing_devices (no dvdrw)";
     fi
+    if test x"$WANT_DEDUP_DEVICE" = x"yes"; then
+	amanda_devices="$amanda_devices dedup";
+    else
+	missing_devices="$missing_devices (no dedup)";
+    fi
     if test x"$WANT_NDMP_DEVICE" = x"true"; then
 	amanda_devices="$amanda_devices ndmp";
     else
@@ -336,6 +336,144 @@ AC_DEFUN([AMANDA_CHECK_SSE42],
     AC_SUBST(SSE42_CFLAGS)
 ])
 
+# SYNOPSIS
+#
+#   AMANDA_CHECK_CRC32C_KERNELS
+#
+# OVERVIEW
+#
+#   Check whether the compiler can build the CPU-dispatched CRC32C kernels:
+#   a VPCLMULQDQ folding kernel for AVX-512 x86 and a CRC32 instruction
+#   kernel for ARMv8.  They are compiled with function target attributes, so
+#   no extra CFLAGS are needed; the kernel is chosen at runtime.
+#
+AC_DEFUN([AMANDA_CHECK_CRC32C_KERNELS],
+[
+    AC_CACHE_CHECK(
+       [whether $CC can build the VPCLMULQDQ CRC32C kernel],
+       amanda_cv_crc32c_vpclmul,
+       [
+	    AC_TRY_LINK([
+#include <immintrin.h>
+__attribute__((target("avx512f,avx512vl,vpclmulqdq,pclmul,sse4.2")))
+static __m512i fold(__m512i a, __m512i k)
+{
+    return _mm512_clmulepi64_epi128(a, k, 0x11);
+}
+	    ], [
+	    if (!__builtin_cpu_supports("vpclmulqdq"))
+		return 1;
+	    return fold(_mm512_setzero_si512(), _mm512_setzero_si512())[0];
+	    ], [
+	amanda_cv_crc32c_vpclmul="yes"
+	    ],[
+	amanda_cv_crc32c_vpclmul="no"
+	    ])
+       ])
+    if test "x$amanda_cv_crc32c_vpclmul" = "xyes"; then
+	AC_DEFINE(HAVE_CRC32C_VPCLMUL, 1,
+	    [Define if the VPCLMULQDQ CRC32C kernel can be compiled])
+    fi
+
+    AC_CACHE_CHECK(
+       [whether $CC can build the ARMv8 CRC32C kernel],
+       amanda_cv_crc32c_armv8,
+       [
+	    AC_TRY_LINK([
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+__attribute__((target("+crc")))
+static unsigned int crc(unsigned int c, unsigned long long v)
+{
+    return __crc32cd(c, v);
+}
+	    ], [
+	    if (!(getauxval(AT_HWCAP) & HWCAP_CRC32))
+		return 1;
+	    return crc(0, 0);
+	    ], [
+	amanda_cv_crc32c_armv8="yes"
+	    ],[
+	amanda_cv_crc32c_armv8="no"
+	    ])
+       ])
+    if test "x$amanda_cv_crc32c_armv8" = "xyes"; then
+	AC_DEFINE(HAVE_CRC32C_ARMV8, 1,
+	    [Define if the ARMv8 CRC32C kernel can be compiled])
+    fi
+])
+
+# SYNOPSIS
+#
+#   AMANDA_CHECK_XOR_KERNELS
+#
+# OVERVIEW
+#
+#   Check whether the compiler can build the AVX2 and AVX-512 kernels the
+#   RAIT device uses to compute parity; the SSSE3 Reed-Solomon kernel is
+#   built along with the AVX2 ones.  Like the CRC32C kernels, they are
+#   compiled with function target attributes and chosen at runtime; the
+#   SSE2 and NEON kernels need no check, as they are part of the base
+#   x86_64 and aarch64 architectures.
+#
+AC_DEFUN([AMANDA_CHECK_XOR_KERNELS],
+[
+    AC_CACHE_CHECK(
+       [whether $CC can build the AVX2 XOR kernel],
+       amanda_cv_xor_avx2,
+       [
+	    AC_TRY_LINK([
+#include <immintrin.h>
+__attribute__((target("avx2")))
+static __m256i kernel(__m256i a, __m256i b)
+{
+    return _mm256_shuffle_epi8(_mm256_xor_si256(a, b), b);
+}
+	    ], [
+	    if (!__builtin_cpu_supports("avx2"))
+		return 1;
+	    return _mm256_extract_epi32(kernel(_mm256_setzero_si256(), _mm256_setzero_si256()), 0);
+	    ], [
+	amanda_cv_xor_avx2="yes"
+	    ],[
+	amanda_cv_xor_avx2="no"
+	    ])
+       ])
+    if test "x$amanda_cv_xor_avx2" = "xyes"; then
+	AC_DEFINE(HAVE_XOR_AVX2, 1,
+	    [Define if the AVX2 XOR kernel can be compiled])
+    fi
+
+    AC_CACHE_CHECK(
+       [whether $CC can build the AVX-512 XOR kernel],
+       amanda_cv_xor_avx512,
+       [
+	    AC_TRY_LINK([
+#include <immintrin.h>
+__attribute__((target("avx512f")))
+static int kernel(void *a, void *b)
+{
+    __m512i x = _mm512_xor_si512(_mm512_loadu_si512(a), _mm512_loadu_si512(b));
+    return _mm512_reduce_or_epi32(x);
+}
+	    ], [
+	    char buf[64] = { 0 };
+	    if (!__builtin_cpu_supports("avx512f"))
+		return 1;
+	    return kernel(buf, buf);
+	    ], [
+	amanda_cv_xor_avx512="yes"
+	    ],[
+	amanda_cv_xor_avx512="no"
+	    ])
+       ])
+    if test "x$amanda_cv_xor_avx512" = "xyes"; then
+	AC_DEFINE(HAVE_XOR_AVX512, 1,
+	    [Define if the AVX-512 XOR kernel can be compiled])
+    fi
+])
+
 # SYNOPSIS
 #
 #   AMANDA_TEST_GCC_FLAG(flag, action-if-found, action-if-not-found)
@@ -90,6 +90,101 @@ AC_DEFUN([AMANDA_CHECK_HMAC], [
     fi
 ])
 
+# SYNOPSIS
+#
+#   AMANDA_CHECK_EVP_AES_GCM
+#
+# OVERVIEW
+#
+#   Check for AES-GCM support in the OpenSSL EVP interface of -lcrypto.  If
+#   found, HAVE_EVP_AES_GCM is defined and -lcrypto is added to LIBS.
+#
+AC_DEFUN([AMANDA_CHECK_EVP_AES_GCM], [
+    HAVE_EVP_AES_GCM=no
+    AC_CHECK_HEADERS([openssl/evp.h openssl/rand.h openssl/hmac.h], [], [HAVE_EVP_AES_GCM=missing])
+    if test x"$HAVE_EVP_AES_GCM" = x"no"; then
+	AC_CHECK_LIB([crypto], [EVP_aes_256_gcm], [HAVE_EVP_AES_GCM=yes])
+    fi
+    if test x"$HAVE_EVP_AES_GCM" = x"yes"; then
+	AC_DEFINE(HAVE_EVP_AES_GCM, 1,
+	    [Define if -lcrypto provides AES-GCM through the EVP interface. ])
+	AMANDA_ADD_LIBS([-lcrypto])
+    fi
+])
+
+# SYNOPSIS
+#
+#   AMANDA_CHECK_EVP_SHA256
+#
+# OVERVIEW
+#
+#   Check for SHA-256 in the OpenSSL EVP interface of -lcrypto, used for the
+#   fixity digests of the taper.  If found, HAVE_EVP_SHA256 is defined and
+#   -lcrypto is added to LIBS.
+#
+AC_DEFUN([AMANDA_CHECK_EVP_SHA256], [
+    HAVE_EVP_SHA256=no
+    AC_CHECK_HEADERS([openssl/evp.h], [], [HAVE_EVP_SHA256=missing])
+    if test x"$HAVE_EVP_SHA256" = x"no"; then
+	AC_CHECK_LIB([crypto], [EVP_sha256], [HAVE_EVP_SHA256=yes])
+    fi
+    if test x"$HAVE_EVP_SHA256" = x"yes"; then
+	AC_DEFINE(HAVE_EVP_SHA256, 1,
+	    [Define if -lcrypto provides SHA-256 through the EVP interface. ])
+	AMANDA_ADD_LIBS([-lcrypto])
+    fi
+])
+
+# SYNOPSIS
+#
+#   AMANDA_CHECK_LIBURING
+#
+# OVERVIEW
+#
+#   Check for liburing, used by the asynchronous file writer of the vfs and
+#   diskflat devices.  If found, HAVE_LIBURING is defined and -luring is
+#   added to LIBS.  --without-liburing disables it.
+#
+AC_DEFUN([AMANDA_CHECK_LIBURING], [
+    AC_ARG_WITH(liburing,
+	AS_HELP_STRING([--without-liburing],
+		       [do not use io_uring to write the vfs devices]),
+	[ WANT_LIBURING=$withval ], [ WANT_LIBURING=yes ])
+    if test x"$WANT_LIBURING" != x"no"; then
+	AC_CHECK_HEADER([liburing.h], [
+	    AC_CHECK_LIB([uring], [io_uring_queue_init], [
+		AC_DEFINE(HAVE_LIBURING, 1, [Define if liburing is available. ])
+		AMANDA_ADD_LIBS([-luring])
+	    ])
+	])
+    fi
+])
+
+# SYNOPSIS
+#
+#   AMANDA_CHECK_RDMA
+#
+# OVERVIEW
+#
+#   Check for libibverbs, used to move DirectTCP streams over InfiniBand or
+#   RoCE.  If found, HAVE_RDMA is defined and -libverbs is added to LIBS.
+#   --without-rdma disables it.
+#
+AC_DEFUN([AMANDA_CHECK_RDMA], [
+    AC_ARG_WITH(rdma,
+	AS_HELP_STRING([--without-rdma],
+		       [do not support DirectTCP streams over RDMA]),
+	[ WANT_RDMA=$withval ], [ WANT_RDMA=yes ])
+    if test x"$WANT_RDMA" != x"no"; then
+	AC_CHECK_HEADER([infiniband/verbs.h], [
+	    AC_CHECK_LIB([ibverbs], [ibv_get_device_list], [
+		AC_DEFINE(HAVE_RDMA, 1, [Define if libibverbs is available. ])
+		AMANDA_ADD_LIBS([-libverbs])
+	    ])
+	])
+    fi
+])
+
 # SYNOPSIS
 #
 #   AMANDA_CHECK_NET_LIBS
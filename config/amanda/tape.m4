@@ -29,6 +29,7 @@ AC_DEFUN([AMANDA_TAPE_DEVICE], [
 	linux/zftape.h \
 	sys/tape.h \
 	sys/mtio.h \
+	scsi/sg.h \
 	)
 
     # check for MTIOCTOP, an indicator of POSIX tape support
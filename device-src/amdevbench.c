@@ -0,0 +1,760 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+/*
+ * amdevbench -- drive the Device API and report how fast a device goes
+ *
+ * Each run starts the device, writes LENGTH bytes in files of PART-SIZE bytes
+ * with device_write_block, then reads every file back with device_seek_file
+ * and device_read_block.  Both passes report throughput, CPU time per GB and
+ * the distribution of the time spent in each call.  Runs are repeated for
+ * every combination of the block sizes, thread counts and part sizes given on
+ * the command line.  Unlike amxferbench, no transfer is involved: the numbers
+ * are those of the device alone.
+ */
+
+#include "amanda.h"
+#include "amutil.h"
+#include "conffile.h"
+#include "fileheader.h"
+#include "simpleprng.h"
+#include "timestamp.h"
+#include "amxfer.h"
+#include "device.h"
+#include "getopt.h"
+#include <sys/resource.h>
+
+typedef struct pass_result_s {
+    guint64 bytes;
+    guint files;
+    double seconds;
+    double cpu_seconds;
+    GArray *latencies;		/* microseconds per write or read call */
+    gint64 latency_p50, latency_p99, latency_p999, latency_max;
+    gint64 seek_max;		/* longest device_seek_file, microseconds */
+} pass_result_t;
+
+typedef struct run_result_s {
+    gsize block_size;
+    int threads;		/* NB_THREADS_BACKUP/RECOVERY, or 0 if not set */
+    guint64 part_size;
+    GString *errors;
+    pass_result_t write;
+    pass_result_t read;
+} run_result_t;
+
+static struct option long_options[] = {
+    {"version"         , 0, NULL,  1},
+    {"config"          , 1, NULL,  2},
+    {"property"        , 1, NULL,  3},
+    {"length"          , 1, NULL,  4},
+    {"block-size"      , 1, NULL,  5},
+    {"threads"         , 1, NULL,  6},
+    {"part-size"       , 1, NULL,  7},
+    {"data"            , 1, NULL,  8},
+    {"repeat"          , 1, NULL,  9},
+    {"no-read"         , 0, NULL, 10},
+    {"json"            , 0, NULL, 11},
+    {NULL, 0, NULL, 0}
+};
+
+static char *device_name;
+static GPtrArray *properties;		/* "NAME=VALUE" */
+static guint64 length = 1024*1024*1024;
+static gboolean random_data = TRUE;
+static gboolean do_read = TRUE;
+
+static void
+usage(void)
+{
+    g_fprintf(stderr, _("Usage: amdevbench [--config CONFIG] [--property NAME=VALUE]...\n"
+	"	[--length SIZE] [--block-size SIZE[,SIZE...]] [--threads N[,N...]]\n"
+	"	[--part-size SIZE[,SIZE...]] [--data random|text] [--repeat N]\n"
+	"	[--no-read] [--json] DEVICE\n"));
+    exit(1);
+}
+
+/* parse a size with an optional k, m or g suffix */
+static gboolean
+parse_size(
+    const char *str,
+    guint64 *size)
+{
+    char *end;
+    guint64 val = g_ascii_strtoull(str, &end, 10);
+
+    if (end == str)
+	return FALSE;
+    switch (g_ascii_tolower(*end)) {
+    case 'k': val *= 1024; end++; break;
+    case 'm': val *= 1024*1024; end++; break;
+    case 'g': val *= 1024*1024*1024; end++; break;
+    }
+    if (*end && g_ascii_tolower(*end) != 'b')
+	return FALSE;
+    *size = val;
+    return TRUE;
+}
+
+static GArray *
+parse_size_list(
+    const char *str,
+    gboolean allow_zero)
+{
+    GArray *list = g_array_new(FALSE, FALSE, sizeof(guint64));
+    char **words = g_strsplit(str, ",", 0);
+    char **w;
+
+    for (w = words; *w; w++) {
+	guint64 size;
+
+	if (!parse_size(*w, &size) || (size == 0 && !allow_zero)) {
+	    g_fprintf(stderr, _("Invalid size '%s'\n"), *w);
+	    exit(1);
+	}
+	g_array_append_val(list, size);
+    }
+    g_strfreev(words);
+    return list;
+}
+
+static GArray *
+parse_int_list(
+    const char *str)
+{
+    GArray *list = g_array_new(FALSE, FALSE, sizeof(int));
+    char **words = g_strsplit(str, ",", 0);
+    char **w;
+
+    for (w = words; *w; w++) {
+	char *end;
+	int val = (int)strtol(*w, &end, 10);
+
+	if (end == *w || *end || val < 1) {
+	    g_fprintf(stderr, _("Invalid number '%s'\n"), *w);
+	    exit(1);
+	}
+	g_array_append_val(list, val);
+    }
+    g_strfreev(words);
+    return list;
+}
+
+/* set the property NAME of DEVICE from the string VALUE; returns an error
+ * message, or NULL */
+static char *
+set_property(
+    Device *device,
+    const char *name,
+    const char *value)
+{
+    DevicePropertyBase *base = device_property_get_by_name(name);
+    GValue val;
+    char *err;
+
+    if (!base)
+	return g_strdup_printf(_("unknown device property name '%s'"), name);
+
+    bzero(&val, sizeof(val));
+    g_value_init(&val, base->type);
+    if (!g_value_set_from_string(&val, (char *)value)) {
+	g_value_unset(&val);
+	return g_strdup_printf(_("Could not parse property value '%s' for property '%s'"),
+			       value, name);
+    }
+    err = device_property_set(device, base->ID, &val);
+    g_value_unset(&val);
+    if (err) {
+	char *msg = g_strdup_printf(_("Could not set property '%s' to '%s': %s"),
+				    name, value, err);
+	g_free(err);
+	return msg;
+    }
+    return NULL;
+}
+
+/* open and configure the device for RESULT; returns NULL on error */
+static Device *
+open_device(
+    run_result_t *result)
+{
+    Device *device;
+    char *err = NULL;
+    char *str;
+    unsigned int i;
+
+    device = device_open(device_name);
+    if (device->status != DEVICE_STATUS_SUCCESS ||
+	!device_configure(device, TRUE)) {
+	g_string_append(result->errors, device_error_or_status(device));
+	g_object_unref(device);
+	return NULL;
+    }
+
+    for (i = 0; i < properties->len && !err; i++) {
+	char **nv = g_strsplit(g_ptr_array_index(properties, i), "=", 2);
+	err = set_property(device, nv[0], nv[1]? nv[1] : "");
+	g_strfreev(nv);
+    }
+    if (!err && result->block_size) {
+	str = g_strdup_printf("%zu", result->block_size);
+	err = set_property(device, "BLOCK_SIZE", str);
+	g_free(str);
+    }
+    if (!err && result->threads) {
+	str = g_strdup_printf("%d", result->threads);
+	err = set_property(device, "NB_THREADS_BACKUP", str);
+	if (!err)
+	    err = set_property(device, "NB_THREADS_RECOVERY", str);
+	g_free(str);
+    }
+    if (err) {
+	g_string_append(result->errors, err);
+	g_free(err);
+	g_object_unref(device);
+	return NULL;
+    }
+
+    return device;
+}
+
+static double
+cpu_seconds(void)
+{
+    struct rusage self;
+
+    getrusage(RUSAGE_SELF, &self);
+    return self.ru_utime.tv_sec + self.ru_stime.tv_sec
+	 + (self.ru_utime.tv_usec + self.ru_stime.tv_usec) / 1e6;
+}
+
+static gint
+compare_gint64(
+    gconstpointer a,
+    gconstpointer b)
+{
+    gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void
+summarize_pass(
+    pass_result_t *pass)
+{
+    GArray *lat = pass->latencies;
+
+    if (!lat->len)
+	return;
+    g_array_sort(lat, compare_gint64);
+    pass->latency_p50 = g_array_index(lat, gint64, (lat->len - 1) * 50 / 100);
+    pass->latency_p99 = g_array_index(lat, gint64, (lat->len - 1) * 99 / 100);
+    pass->latency_p999 = g_array_index(lat, gint64, (lat->len - 1) * 999 / 1000);
+    pass->latency_max = g_array_index(lat, gint64, lat->len - 1);
+}
+
+static void
+init_header(
+    dumpfile_t *hdr,
+    char *timestamp,
+    guint filenum)
+{
+    fh_init(hdr);
+    hdr->type = F_DUMPFILE;
+    strncpy(hdr->datestamp, timestamp, sizeof(hdr->datestamp) - 1);
+    strncpy(hdr->name, "amdevbench", sizeof(hdr->name) - 1);
+    g_snprintf(hdr->disk, sizeof(hdr->disk), "/bench/%u", filenum);
+    strncpy(hdr->program, "AMDEVBENCH", sizeof(hdr->program) - 1);
+}
+
+/* write LENGTH bytes in files of PART_SIZE; returns FALSE on error */
+static gboolean
+write_pass(
+    run_result_t *result,
+    char *timestamp)
+{
+    pass_result_t *pass = &result->write;
+    static const char text[] = "The quick brown fox jumps over the lazy dog.\n";
+    Device *device;
+    GTimer *timer;
+    double cpu_start;
+    guint64 left = length;
+    gsize block_size;
+    char *block;
+    gsize i;
+
+    if (!(device = open_device(result)))
+	return FALSE;
+
+    cpu_start = cpu_seconds();
+    timer = g_timer_new();
+
+    if (!device_start(device, ACCESS_WRITE, "AMDEVBENCH", timestamp))
+	goto error;
+
+    /* the device may have rounded the block size */
+    block_size = device->block_size;
+    result->block_size = block_size;
+    block = g_malloc(block_size);
+    if (random_data) {
+	simpleprng_state_t prng;
+
+	simpleprng_seed(&prng, 0xbe7c4);
+	simpleprng_fill_buffer(&prng, block, block_size);
+    } else {
+	for (i = 0; i < block_size; i++)
+	    block[i] = text[i % (sizeof(text) - 1)];
+    }
+
+    while (left > 0) {
+	guint64 part_left = MIN(left, result->part_size);
+	dumpfile_t hdr;
+
+	init_header(&hdr, timestamp, pass->files + 1);
+	if (!device_start_file(device, &hdr)) {
+	    dumpfile_free_data(&hdr);
+	    g_free(block);
+	    goto error;
+	}
+	dumpfile_free_data(&hdr);
+
+	while (part_left > 0) {
+	    guint size = (guint)MIN(part_left, block_size);
+	    gint64 start = xfer_stats_clock();
+	    gint64 latency;
+
+	    if (device_write_block(device, size, block) != WRITE_SUCCEED) {
+		g_free(block);
+		goto error;
+	    }
+	    latency = xfer_stats_clock() - start;
+	    g_array_append_val(pass->latencies, latency);
+	    part_left -= size;
+	    left -= size;
+	    pass->bytes += size;
+	    /* only the last block of a file may be short */
+	    if (size < block_size)
+		break;
+	}
+
+	if (!device_finish_file(device)) {
+	    g_free(block);
+	    goto error;
+	}
+	pass->files++;
+    }
+    g_free(block);
+
+    /* the time to flush the last data is part of the pass */
+    if (!device_finish(device))
+	goto error;
+
+    pass->seconds = g_timer_elapsed(timer, NULL);
+    pass->cpu_seconds = cpu_seconds() - cpu_start;
+    g_timer_destroy(timer);
+    g_object_unref(device);
+    summarize_pass(pass);
+    return TRUE;
+
+error:
+    g_string_append(result->errors, device_error_or_status(device));
+    pass->seconds = g_timer_elapsed(timer, NULL);
+    pass->cpu_seconds = cpu_seconds() - cpu_start;
+    g_timer_destroy(timer);
+    g_object_unref(device);
+    summarize_pass(pass);
+    return FALSE;
+}
+
+/* read back the files written by write_pass; returns FALSE on error */
+static gboolean
+read_pass(
+    run_result_t *result)
+{
+    pass_result_t *pass = &result->read;
+    Device *device;
+    GTimer *timer;
+    double cpu_start;
+    char *buf = NULL;
+    int buf_size = 0;
+    guint file;
+
+    if (!(device = open_device(result)))
+	return FALSE;
+
+    cpu_start = cpu_seconds();
+    timer = g_timer_new();
+
+    if (device_read_label(device) != DEVICE_STATUS_SUCCESS ||
+	!device_start(device, ACCESS_READ, NULL, NULL))
+	goto error;
+
+    for (file = 1; file <= result->write.files; file++) {
+	gint64 start = xfer_stats_clock();
+	gint64 latency;
+	dumpfile_t *hdr;
+
+	hdr = device_seek_file(device, file);
+	if (!hdr || device->status != DEVICE_STATUS_SUCCESS) {
+	    if (hdr)
+		dumpfile_free(hdr);
+	    goto error;
+	}
+	dumpfile_free(hdr);
+	latency = xfer_stats_clock() - start;
+	pass->seek_max = MAX(pass->seek_max, latency);
+
+	while (1) {
+	    int size = buf_size;
+	    int bytes_read;
+
+	    start = xfer_stats_clock();
+	    bytes_read = device_read_block(device, buf, &size, -1);
+	    if (bytes_read == 0 && size > buf_size) {
+		/* the first call tells the size of the buffer */
+		g_free(buf);
+		buf_size = size;
+		buf = g_malloc(buf_size);
+		continue;
+	    }
+	    if (bytes_read == -1) {
+		if (device->is_eof)
+		    break;
+		goto error;
+	    }
+	    latency = xfer_stats_clock() - start;
+	    g_array_append_val(pass->latencies, latency);
+	    pass->bytes += bytes_read;
+	}
+	pass->files++;
+    }
+
+    if (!device_finish(device))
+	goto error;
+
+    pass->seconds = g_timer_elapsed(timer, NULL);
+    pass->cpu_seconds = cpu_seconds() - cpu_start;
+    g_timer_destroy(timer);
+    g_free(buf);
+    g_object_unref(device);
+    summarize_pass(pass);
+    return TRUE;
+
+error:
+    g_string_append(result->errors, device_error_or_status(device));
+    pass->seconds = g_timer_elapsed(timer, NULL);
+    pass->cpu_seconds = cpu_seconds() - cpu_start;
+    g_timer_destroy(timer);
+    g_free(buf);
+    g_object_unref(device);
+    summarize_pass(pass);
+    return FALSE;
+}
+
+static run_result_t *
+run_one(
+    gsize block_size,
+    int threads,
+    guint64 part_size)
+{
+    run_result_t *result = g_new0(run_result_t, 1);
+    char *timestamp = get_proper_stamp_from_time(time(NULL));
+
+    result->block_size = block_size;
+    result->threads = threads;
+    result->part_size = part_size? part_size : length;
+    result->errors = g_string_new("");
+    result->write.latencies = g_array_new(FALSE, FALSE, sizeof(gint64));
+    result->read.latencies = g_array_new(FALSE, FALSE, sizeof(gint64));
+
+    if (write_pass(result, timestamp) && do_read)
+	read_pass(result);
+
+    g_free(timestamp);
+    return result;
+}
+
+static void
+free_result(
+    run_result_t *result)
+{
+    g_array_free(result->write.latencies, TRUE);
+    g_array_free(result->read.latencies, TRUE);
+    g_string_free(result->errors, TRUE);
+    g_free(result);
+}
+
+static double
+mb_per_sec(
+    pass_result_t *p)
+{
+    return p->seconds > 0? p->bytes / p->seconds / (1024*1024) : 0;
+}
+
+static double
+cpu_per_gb(
+    pass_result_t *p)
+{
+    return p->bytes? p->cpu_seconds * (1024.0*1024*1024) / p->bytes : 0;
+}
+
+static void
+print_pass_text(
+    const char *name,
+    pass_result_t *p)
+{
+    g_printf("  %-5s %ju bytes in %u files, %.3f s: %.1f MB/s, %.3f CPU s/GB, "
+	     "latency p50 %jd us p99 %jd us p99.9 %jd us max %jd us",
+	     name, (uintmax_t)p->bytes, p->files, p->seconds, mb_per_sec(p),
+	     cpu_per_gb(p), (intmax_t)p->latency_p50, (intmax_t)p->latency_p99,
+	     (intmax_t)p->latency_p999, (intmax_t)p->latency_max);
+    if (p->seek_max)
+	g_printf(", seek max %jd us", (intmax_t)p->seek_max);
+    g_printf("\n");
+}
+
+static void
+print_text(
+    run_result_t *r)
+{
+    g_printf("block-size %zu threads %d part-size %ju\n", r->block_size,
+	     r->threads, (uintmax_t)r->part_size);
+    if (r->errors->len)
+	g_printf("  error %s\n", r->errors->str);
+    print_pass_text("write", &r->write);
+    if (do_read)
+	print_pass_text("read", &r->read);
+}
+
+static char *
+json_quote(
+    const char *str)
+{
+    GString *q = g_string_new("\"");
+
+    for (; *str; str++) {
+	if (*str == '"' || *str == '\\')
+	    g_string_append_printf(q, "\\%c", *str);
+	else if ((unsigned char)*str < 0x20)
+	    g_string_append_printf(q, "\\u%04x", *str);
+	else
+	    g_string_append_c(q, *str);
+    }
+    g_string_append_c(q, '"');
+
+    return g_string_free(q, FALSE);
+}
+
+static void
+print_pass_json(
+    const char *name,
+    pass_result_t *p)
+{
+    g_printf("     \"%s\": {\"bytes\": %ju, \"files\": %u, \"seconds\": %.6f, "
+	     "\"mb_per_sec\": %.3f, \"cpu_seconds_per_gb\": %.6f,\n",
+	     name, (uintmax_t)p->bytes, p->files, p->seconds, mb_per_sec(p),
+	     cpu_per_gb(p));
+    g_printf("       \"latency_us\": {\"p50\": %jd, \"p99\": %jd, \"p999\": %jd, "
+	     "\"max\": %jd}, \"seek_max_us\": %jd}",
+	     (intmax_t)p->latency_p50, (intmax_t)p->latency_p99,
+	     (intmax_t)p->latency_p999, (intmax_t)p->latency_max,
+	     (intmax_t)p->seek_max);
+}
+
+static void
+print_json(
+    run_result_t *r,
+    gboolean first)
+{
+    char *errors = json_quote(r->errors->str);
+
+    g_printf("%s    {\"block_size\": %zu, \"threads\": %d, \"part_size\": %ju, "
+	     "\"error\": %s,\n",
+	     first? "" : ",\n", r->block_size, r->threads,
+	     (uintmax_t)r->part_size, errors);
+    print_pass_json("write", &r->write);
+    if (do_read) {
+	g_printf(",\n");
+	print_pass_json("read", &r->read);
+    }
+    g_printf("}");
+    g_free(errors);
+}
+
+int
+main(
+    int argc,
+    char **argv)
+{
+    char *config = NULL;
+    GArray *block_sizes = NULL;
+    GArray *threads = NULL;
+    GArray *part_sizes = NULL;
+    guint64 default_size = 0;
+    int default_threads = 0;
+    int repeat = 1;
+    gboolean json = FALSE;
+    gboolean first = TRUE;
+    int failed = 0;
+    guint b, t, p;
+    int n;
+    int opt;
+
+    glib_init();
+
+    /*
+     * Configure program for internationalization:
+     *   1) Only set the message locale for now.
+     *   2) Set textdomain for all amanda related programs to "amanda"
+     *      We don't want to be forced to support dozens of message catalogs.
+     */
+    setlocale(LC_MESSAGES, "C");
+    textdomain("amanda");
+
+    safe_fd(-1, 0);
+    safe_cd();
+
+    set_pname("amdevbench");
+
+    /* Don't die when child closes pipe */
+    signal(SIGPIPE, SIG_IGN);
+
+    dbopen(DBG_SUBDIR_SERVER);
+
+    add_amanda_log_handler(amanda_log_stderr);
+
+    properties = g_ptr_array_new();
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != EOF) {
+	switch (opt) {
+	case 1:	g_printf("amdevbench-%s\n", VERSION);
+		return 0;
+	case 2:	config = optarg;
+		break;
+	case 3:	if (!strchr(optarg, '='))
+		    usage();
+		g_ptr_array_add(properties, optarg);
+		break;
+	case 4:	if (!parse_size(optarg, &length) || length == 0)
+		    usage();
+		break;
+	case 5:	block_sizes = parse_size_list(optarg, FALSE);
+		break;
+	case 6:	threads = parse_int_list(optarg);
+		break;
+	case 7:	part_sizes = parse_size_list(optarg, TRUE);
+		break;
+	case 8:	if (g_str_equal(optarg, "random"))
+		    random_data = TRUE;
+		else if (g_str_equal(optarg, "text"))
+		    random_data = FALSE;
+		else
+		    usage();
+		break;
+	case 9:	repeat = atoi(optarg);
+		if (repeat < 1)
+		    usage();
+		break;
+	case 10: do_read = FALSE;
+		break;
+	case 11: json = TRUE;
+		break;
+	default: usage();
+	}
+    }
+    if (optind != argc - 1)
+	usage();
+    device_name = argv[optind];
+
+    if (config) {
+	config_init_with_global(CONFIG_INIT_EXPLICIT_NAME, config);
+	dbrename(get_config_name(), DBG_SUBDIR_SERVER);
+    } else {
+	config_init(CONFIG_INIT_GLOBAL, NULL);
+    }
+    if (config_errors(NULL) >= CFGERR_WARNINGS) {
+	config_print_errors();
+	if (config_errors(NULL) >= CFGERR_ERRORS) {
+	    g_critical(_("errors processing config file"));
+	}
+    }
+
+    device_api_init();
+
+    /* 0 leaves the device's own block size, thread count and part size */
+    if (!block_sizes) {
+	block_sizes = g_array_new(FALSE, FALSE, sizeof(guint64));
+	g_array_append_val(block_sizes, default_size);
+    }
+    if (!threads) {
+	threads = g_array_new(FALSE, FALSE, sizeof(int));
+	g_array_append_val(threads, default_threads);
+    }
+    if (!part_sizes) {
+	part_sizes = g_array_new(FALSE, FALSE, sizeof(guint64));
+	g_array_append_val(part_sizes, default_size);
+    }
+
+    if (json) {
+	char *timestamp = get_proper_stamp_from_time(time(NULL));
+	char *device_q = json_quote(device_name);
+
+	g_printf("{\"version\": \"%s\", \"timestamp\": \"%s\", \"length\": %ju,\n",
+		 VERSION, timestamp, (uintmax_t)length);
+	g_printf(" \"data\": \"%s\", \"device\": %s,\n \"runs\": [\n",
+		 random_data? "random" : "text", device_q);
+	g_free(timestamp);
+	g_free(device_q);
+    }
+
+    for (b = 0; b < block_sizes->len; b++) {
+	for (t = 0; t < threads->len; t++) {
+	    for (p = 0; p < part_sizes->len; p++) {
+		for (n = 0; n < repeat; n++) {
+		    run_result_t *result = run_one(
+				(gsize)g_array_index(block_sizes, guint64, b),
+				g_array_index(threads, int, t),
+				g_array_index(part_sizes, guint64, p));
+
+		    if (result->errors->len)
+			failed = 1;
+		    if (json)
+			print_json(result, first);
+		    else
+			print_text(result);
+		    first = FALSE;
+		    free_result(result);
+		}
+	    }
+	}
+    }
+
+    if (json)
+	g_printf("\n ]}\n");
+
+    g_array_free(block_sizes, TRUE);
+    g_array_free(threads, TRUE);
+    g_array_free(part_sizes, TRUE);
+    g_ptr_array_free(properties, TRUE);
+
+    dbclose();
+    return failed;
+}
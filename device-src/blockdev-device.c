@@ -0,0 +1,1405 @@
+/*
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+/*
+ * The blockdev device writes a volume straight to a block device, without a
+ * filesystem: a disk, an NVMe namespace, or a zoned (ZNS or host-managed
+ * SMR) drive.  The volume is a log, never rewritten in place:
+ *
+ *   0		the volume label, an Amanda header of 32k
+ *   32k	the superblock, a record of 4k:
+ *		  BLOCKDEV-VOLUME 1 id=<16 hex digits> data=<offset>
+ *   36k	the directory, a record of 4k for each file, in the order they
+ *		are written:
+ *		  BLOCKDEV-FILE 1 id=<volume id> file=<n> offset=<o> size=<s>
+ *   data	the files, one after the other: the 32k header and the data of
+ *		each one, padded to 4k
+ *
+ * The directory ends at the first record without the id of the volume, so
+ * that the records left by an earlier volume on the device are not read; a
+ * file is in the directory once it is finished.  The data is gathered in
+ * buffers of BLOCKDEV_WRITE_SIZE, written with O_DIRECT unless DIRECT_IO is
+ * false, so that the device only sees large aligned sequential writes.
+ *
+ * On a zoned drive, the label and the directory are in the first zone and
+ * the files in the next ones, each zone written at its write pointer; the
+ * offsets are counted in the writable capacity of the zones, so that a file
+ * goes on in the next zone where a ZNS zone ends before its size.  Labeling
+ * or erasing the volume resets all its zones.
+ */
+
+#include "amanda.h"
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#ifdef HAVE_LINUX_FS_H
+# include <linux/fs.h>
+#endif
+#ifdef HAVE_LINUX_BLKZONED_H
+# include <linux/blkzoned.h>
+#endif
+
+#include "device.h"
+
+/*
+ * Type checking and casting macros
+ */
+#define TYPE_BLOCKDEV_DEVICE	(blockdev_device_get_type())
+#define BLOCKDEV_DEVICE(obj)	G_TYPE_CHECK_INSTANCE_CAST((obj), TYPE_BLOCKDEV_DEVICE, BlockdevDevice)
+#define BLOCKDEV_DEVICE_CONST(obj)	G_TYPE_CHECK_INSTANCE_CAST((obj), TYPE_BLOCKDEV_DEVICE, BlockdevDevice const)
+#define BLOCKDEV_DEVICE_CLASS(klass)	G_TYPE_CHECK_CLASS_CAST((klass), TYPE_BLOCKDEV_DEVICE, BlockdevDeviceClass)
+#define IS_BLOCKDEV_DEVICE(obj)	G_TYPE_CHECK_INSTANCE_TYPE((obj), TYPE_BLOCKDEV_DEVICE)
+#define BLOCKDEV_DEVICE_GET_CLASS(obj)	G_TYPE_INSTANCE_GET_CLASS((obj), TYPE_BLOCKDEV_DEVICE, BlockdevDeviceClass)
+
+#define BLOCKDEV_DEVICE_MIN_BLOCK_SIZE (1)
+#define BLOCKDEV_DEVICE_MAX_BLOCK_SIZE (INT_MAX)
+#define BLOCKDEV_DEVICE_DEFAULT_BLOCK_SIZE (DISK_BLOCK_BYTES)
+
+/* alignment of the buffers, offsets and sizes of O_DIRECT */
+#define BLOCKDEV_ALIGN		4096
+#define BLOCKDEV_ALIGN_UP(x)	(((x) + BLOCKDEV_ALIGN - 1) & ~(guint64)(BLOCKDEV_ALIGN - 1))
+#define BLOCKDEV_ALIGN_DOWN(x)	((x) & ~(guint64)(BLOCKDEV_ALIGN - 1))
+
+#define BLOCKDEV_HEADER_SIZE	(32768)	/* of the label and of each file */
+#define BLOCKDEV_RECORD_SIZE	BLOCKDEV_ALIGN
+#define BLOCKDEV_SUPER_OFFSET	BLOCKDEV_HEADER_SIZE
+#define BLOCKDEV_DIR_OFFSET	(BLOCKDEV_SUPER_OFFSET + BLOCKDEV_RECORD_SIZE)
+
+/* the size of the writes and of the reads */
+#define BLOCKDEV_WRITE_SIZE	(4*1024*1024)
+
+/* the directory of a device that is not zoned is a thousandth of it */
+#define BLOCKDEV_MIN_DIR_SIZE	(1024*1024)
+#define BLOCKDEV_MAX_DIR_SIZE	(256*1024*1024)
+
+#define BLOCKDEV_SUPER_FORMAT	"BLOCKDEV-VOLUME 1 id=%016llx data=%llu\n"
+#define BLOCKDEV_RECORD_FORMAT	"BLOCKDEV-FILE 1 id=%016llx file=%u offset=%llu size=%llu\n"
+
+#define EOM_EARLY_WARNING_ZONE_BLOCKS 4
+
+/* Forward declaration */
+static GType blockdev_device_get_type(void);
+
+/* a file in the directory */
+typedef struct {
+    guint file;
+    guint64 offset;	/* of its header */
+    guint64 size;	/* of its header and its data */
+} BlockdevFile;
+
+/*
+ * Main object structure
+ */
+typedef struct _BlockdevDevice BlockdevDevice;
+struct _BlockdevDevice {
+    Device __parent__;
+
+    char *node;
+    int fd;
+    gboolean fd_writable;
+
+    /* the geometry: offsets are in the LENGTH bytes writable on the device;
+     * on a zoned drive, zone_capacity bytes from the start of each zone */
+    guint64 length;
+    guint64 zone_size;		/* 0 if not zoned */
+    guint64 zone_capacity;
+
+    /* the volume */
+    guint64 volume_id;
+    guint64 data_offset;
+    GArray *files;		/* BlockdevFile, in the order of the directory */
+    guint64 dir_next;		/* where the next record goes */
+    guint64 end;		/* where the next file goes */
+
+    /* the file being written: wbuf holds what goes at wbuf_offset */
+    char *wbuf;
+    gsize wbuf_len;
+    guint64 wbuf_offset;
+    guint64 file_offset;
+
+    /* the file being read: rbuf holds what is at rbuf_offset */
+    char *rbuf;
+    gsize rbuf_len;
+    guint64 rbuf_offset;
+    guint64 read_start;		/* of its data */
+    guint64 read_pos;
+    guint64 read_end;
+
+    /* Properties */
+    gboolean direct_io;
+    guint64 volume_limit;
+    gboolean enforce_volume_limit;
+};
+
+/*
+ * Class definition
+ */
+typedef struct _BlockdevDeviceClass BlockdevDeviceClass;
+struct _BlockdevDeviceClass {
+    DeviceClass __parent__;
+};
+
+/* the DIRECT_IO property of the VFS device, which registers it */
+extern DevicePropertyBase device_property_direct_io;
+#define PROPERTY_DIRECT_IO (device_property_direct_io.ID)
+
+/* pointer to the class of our parent */
+static DeviceClass *parent_class = NULL;
+
+void blockdev_device_register(void);
+
+/* here are local prototypes */
+static void blockdev_device_init(BlockdevDevice *self);
+static void blockdev_device_class_init(BlockdevDeviceClass *c);
+static void blockdev_device_base_init(BlockdevDeviceClass *c);
+static void blockdev_device_finalize(GObject *gself);
+static Device *blockdev_device_factory(char *device_name, char *device_type,
+				       char *device_node);
+static void blockdev_device_open_device(Device *dself, char *device_name,
+					char *device_type, char *device_node);
+static DeviceStatusFlags blockdev_device_read_label(Device *dself);
+static gboolean blockdev_device_start(Device *dself, DeviceAccessMode mode,
+				      char *label, char *timestamp);
+static gboolean blockdev_device_start_file(Device *dself, dumpfile_t *ji);
+static DeviceWriteResult blockdev_device_write_block(Device *dself,
+						     guint size, gpointer data);
+static gboolean blockdev_device_finish_file(Device *dself);
+static dumpfile_t *blockdev_device_seek_file(Device *dself,
+					     guint requested_file);
+static gboolean blockdev_device_seek_block(Device *dself, guint64 block);
+static int blockdev_device_read_block(Device *dself, gpointer data,
+				      int *size_req, int max_block);
+static gboolean blockdev_device_erase(Device *dself);
+static gboolean blockdev_device_finish(Device *dself);
+
+static gboolean blockdev_device_set_max_volume_usage_fn(Device *dself,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source);
+static gboolean blockdev_device_set_enforce_max_volume_usage_fn(Device *dself,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source);
+static gboolean property_set_direct_io_fn(Device *dself,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source);
+
+void
+blockdev_device_register(void)
+{
+    static const char *device_prefix_list[] = { "blockdev", NULL };
+
+    register_device(blockdev_device_factory, device_prefix_list);
+}
+
+static GType
+blockdev_device_get_type(void)
+{
+    static GType type = 0;
+
+    if (G_UNLIKELY(type == 0)) {
+        static const GTypeInfo info = {
+            sizeof (BlockdevDeviceClass),
+            (GBaseInitFunc) blockdev_device_base_init,
+            (GBaseFinalizeFunc) NULL,
+            (GClassInitFunc) blockdev_device_class_init,
+            (GClassFinalizeFunc) NULL,
+            NULL /* class_data */,
+            sizeof (BlockdevDevice),
+            0 /* n_preallocs */,
+            (GInstanceInitFunc) blockdev_device_init,
+            NULL
+        };
+
+        type = g_type_register_static(TYPE_DEVICE, "BlockdevDevice",
+                                      &info, (GTypeFlags)0);
+    }
+
+    return type;
+}
+
+static void
+blockdev_device_init(
+    BlockdevDevice *self)
+{
+    Device *dself = DEVICE(self);
+    GValue response;
+
+    self->fd = -1;
+    self->files = g_array_new(FALSE, FALSE, sizeof(BlockdevFile));
+    self->direct_io = TRUE;
+
+    bzero(&response, sizeof(response));
+
+    g_value_init(&response, CONCURRENCY_PARADIGM_TYPE);
+    g_value_set_enum(&response, CONCURRENCY_PARADIGM_RANDOM_ACCESS);
+    device_set_simple_property(dself, PROPERTY_CONCURRENCY,
+	    &response, PROPERTY_SURETY_GOOD, PROPERTY_SOURCE_DETECTED);
+    g_value_unset(&response);
+
+    g_value_init(&response, STREAMING_REQUIREMENT_TYPE);
+    g_value_set_enum(&response, STREAMING_REQUIREMENT_NONE);
+    device_set_simple_property(dself, PROPERTY_STREAMING,
+	    &response, PROPERTY_SURETY_GOOD, PROPERTY_SOURCE_DETECTED);
+    g_value_unset(&response);
+
+    g_value_init(&response, G_TYPE_BOOLEAN);
+    g_value_set_boolean(&response, TRUE);
+    device_set_simple_property(dself, PROPERTY_APPENDABLE,
+	    &response, PROPERTY_SURETY_GOOD, PROPERTY_SOURCE_DETECTED);
+    g_value_unset(&response);
+
+    g_value_init(&response, G_TYPE_BOOLEAN);
+    g_value_set_boolean(&response, FALSE);
+    device_set_simple_property(dself, PROPERTY_PARTIAL_DELETION,
+	    &response, PROPERTY_SURETY_GOOD, PROPERTY_SOURCE_DETECTED);
+    g_value_unset(&response);
+
+    g_value_init(&response, G_TYPE_BOOLEAN);
+    g_value_set_boolean(&response, TRUE);
+    device_set_simple_property(dself, PROPERTY_FULL_DELETION,
+	    &response, PROPERTY_SURETY_GOOD, PROPERTY_SOURCE_DETECTED);
+    g_value_unset(&response);
+
+    g_value_init(&response, G_TYPE_BOOLEAN);
+    g_value_set_boolean(&response, TRUE);
+    device_set_simple_property(dself, PROPERTY_LEOM,
+	    &response, PROPERTY_SURETY_GOOD, PROPERTY_SOURCE_DETECTED);
+    g_value_unset(&response);
+
+    g_value_init(&response, MEDIA_ACCESS_MODE_TYPE);
+    g_value_set_enum(&response, MEDIA_ACCESS_MODE_READ_WRITE);
+    device_set_simple_property(dself, PROPERTY_MEDIUM_ACCESS_TYPE,
+	    &response, PROPERTY_SURETY_GOOD, PROPERTY_SOURCE_DETECTED);
+    g_value_unset(&response);
+
+    g_value_init(&response, G_TYPE_BOOLEAN);
+    g_value_set_boolean(&response, self->direct_io);
+    device_set_simple_property(dself, PROPERTY_DIRECT_IO,
+	    &response, PROPERTY_SURETY_GOOD, PROPERTY_SOURCE_DEFAULT);
+    g_value_unset(&response);
+}
+
+static void
+blockdev_device_class_init(
+    BlockdevDeviceClass *c)
+{
+    GObjectClass *g_object_class = (GObjectClass*) c;
+    DeviceClass *device_class = DEVICE_CLASS(c);
+
+    parent_class = g_type_class_ref(TYPE_DEVICE);
+
+    device_class->open_device = blockdev_device_open_device;
+    device_class->read_label = blockdev_device_read_label;
+    device_class->start = blockdev_device_start;
+    device_class->start_file = blockdev_device_start_file;
+    device_class->write_block = blockdev_device_write_block;
+    device_class->finish_file = blockdev_device_finish_file;
+    device_class->seek_file = blockdev_device_seek_file;
+    device_class->seek_block = blockdev_device_seek_block;
+    device_class->read_block = blockdev_device_read_block;
+    device_class->erase = blockdev_device_erase;
+    device_class->finish = blockdev_device_finish;
+
+    g_object_class->finalize = blockdev_device_finalize;
+}
+
+static void
+blockdev_device_base_init(
+    BlockdevDeviceClass *c)
+{
+    DeviceClass *device_class = (DeviceClass *)c;
+
+    device_class_register_property(device_class, PROPERTY_MAX_VOLUME_USAGE,
+	    (PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_MASK) &
+			(~ PROPERTY_ACCESS_SET_INSIDE_FILE_WRITE),
+	    device_simple_property_get_fn,
+	    blockdev_device_set_max_volume_usage_fn);
+
+    device_class_register_property(device_class, PROPERTY_ENFORCE_MAX_VOLUME_USAGE,
+	    (PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_MASK) &
+			(~ PROPERTY_ACCESS_SET_INSIDE_FILE_WRITE),
+	    device_simple_property_get_fn,
+	    blockdev_device_set_enforce_max_volume_usage_fn);
+
+    device_class_register_property(device_class, PROPERTY_DIRECT_IO,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    property_set_direct_io_fn);
+}
+
+static gboolean
+blockdev_device_set_max_volume_usage_fn(
+    Device *dself,
+    DevicePropertyBase *base,
+    GValue *val,
+    PropertySurety surety,
+    PropertySource source)
+{
+    BlockdevDevice *self = BLOCKDEV_DEVICE(dself);
+
+    self->volume_limit = g_value_get_uint64(val);
+
+    return device_simple_property_set_fn(dself, base, val, surety, source);
+}
+
+static gboolean
+blockdev_device_set_enforce_max_volume_usage_fn(
+    Device *dself,
+    DevicePropertyBase *base,
+    GValue *val,
+    PropertySurety surety,
+    PropertySource source)
+{
+    BlockdevDevice *self = BLOCKDEV_DEVICE(dself);
+
+    self->enforce_volume_limit = g_value_get_boolean(val);
+
+    return device_simple_property_set_fn(dself, base, val, surety, source);
+}
+
+static gboolean
+property_set_direct_io_fn(
+    Device *dself,
+    DevicePropertyBase *base,
+    GValue *val,
+    PropertySurety surety,
+    PropertySource source)
+{
+    BlockdevDevice *self = BLOCKDEV_DEVICE(dself);
+
+    self->direct_io = g_value_get_boolean(val);
+
+    return device_simple_property_set_fn(dself, base, val, surety, source);
+}
+
+static Device *
+blockdev_device_factory(
+    char *device_name,
+    char *device_type,
+    char *device_node)
+{
+    Device *device;
+
+    g_assert(g_str_equal(device_type, "blockdev"));
+
+    device = DEVICE(g_object_new(TYPE_BLOCKDEV_DEVICE, NULL));
+    device_open_device(device, device_name, device_type, device_node);
+
+    return device;
+}
+
+static void
+blockdev_device_open_device(
+    Device *dself,
+    char *device_name,
+    char *device_type,
+    char *device_node)
+{
+    BlockdevDevice *self = BLOCKDEV_DEVICE(dself);
+
+    dself->min_block_size = BLOCKDEV_DEVICE_MIN_BLOCK_SIZE;
+    dself->max_block_size = BLOCKDEV_DEVICE_MAX_BLOCK_SIZE;
+    dself->block_size = BLOCKDEV_DEVICE_DEFAULT_BLOCK_SIZE;
+
+    self->node = g_strdup(device_node);
+
+    if (parent_class->open_device) {
+        parent_class->open_device(dself, device_name, device_type, device_node);
+    }
+}
+
+/*
+ * The device
+ */
+
+/* The offset on the device of OFFSET in the volume */
+static guint64
+blockdev_device_offset(
+    BlockdevDevice *self,
+    guint64 offset)
+{
+    if (!self->zone_size)
+	return offset;
+
+    return (offset / self->zone_capacity) * self->zone_size
+	 + offset % self->zone_capacity;
+}
+
+/* Read or write LEN bytes at OFFSET in the volume, in pieces that do not
+ * cross the end of a zone; FALSE, with errno set, on error */
+static gboolean
+blockdev_io(
+    BlockdevDevice *self,
+    gboolean write,
+    guint64 offset,
+    char *buf,
+    gsize len)
+{
+    while (len > 0) {
+	gsize n = len;
+	ssize_t r;
+
+	if (self->zone_size) {
+	    guint64 left = self->zone_capacity - offset % self->zone_capacity;
+	    if (n > left)
+		n = left;
+	}
+
+	if (write)
+	    r = pwrite(self->fd, buf, n, blockdev_device_offset(self, offset));
+	else
+	    r = pread(self->fd, buf, n, blockdev_device_offset(self, offset));
+	if (r < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return FALSE;
+	}
+	if (r == 0) {
+	    errno = write? ENOSPC : EIO;
+	    return FALSE;
+	}
+	buf += r;
+	len -= r;
+	offset += r;
+    }
+
+    return TRUE;
+}
+
+static char *
+blockdev_alloc(
+    gsize size)
+{
+    void *buf;
+
+    if (posix_memalign(&buf, BLOCKDEV_ALIGN, size) != 0)
+	g_error("blockdev: can't allocate %zu bytes", size);
+    memset(buf, 0, size);
+    return buf;
+}
+
+#ifdef HAVE_LINUX_BLKZONED_H
+/* The zone holding OFFSET in the volume, and its write pointer, also in the
+ * volume, into *WP */
+static gboolean
+blockdev_zone_wp(
+    BlockdevDevice *self,
+    guint64 offset,
+    guint64 *wp)
+{
+    struct blk_zone_report *report;
+    struct blk_zone *zone;
+    guint64 start = (offset / self->zone_capacity) * self->zone_capacity;
+    gboolean rval = FALSE;
+
+    report = g_malloc0(sizeof(*report) + sizeof(*zone));
+    report->sector = blockdev_device_offset(self, start) / 512;
+    report->nr_zones = 1;
+    if (ioctl(self->fd, BLKREPORTZONE, report) == 0 && report->nr_zones == 1) {
+	zone = &report->zones[0];
+	if (zone->type == BLK_ZONE_TYPE_CONVENTIONAL ||
+	    zone->cond == BLK_ZONE_COND_FULL)
+	    *wp = start + self->zone_capacity;
+	else
+	    *wp = start + MIN((zone->wp - zone->start) * 512,
+			      self->zone_capacity);
+	rval = TRUE;
+    }
+    g_free(report);
+
+    return rval;
+}
+#endif
+
+/* Open the device, for writing if WRITABLE, and learn its geometry */
+static gboolean
+blockdev_open(
+    BlockdevDevice *self,
+    gboolean writable)
+{
+    Device *dself = DEVICE(self);
+    int flags = writable? O_RDWR : O_RDONLY;
+    struct stat stat_buf;
+
+    if (self->fd >= 0) {
+	if (self->fd_writable || !writable)
+	    return TRUE;
+	robust_close(self->fd);
+	self->fd = -1;
+    }
+
+#ifdef O_DIRECT
+    if (self->direct_io) {
+	self->fd = robust_open(self->node, flags | O_DIRECT, 0);
+	if (self->fd < 0 && errno == EINVAL)
+	    g_debug("%s: can't use O_DIRECT", self->node);
+    }
+#endif
+    if (self->fd < 0)
+	self->fd = robust_open(self->node, flags, 0);
+    if (self->fd < 0) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Can't open %s: %s"), self->node, strerror(errno)),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+    self->fd_writable = writable;
+
+    if (fstat(self->fd, &stat_buf) == -1) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Can't stat %s: %s"), self->node, strerror(errno)),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+
+    /* a regular file, already as large as the volume, can stand for a
+     * device */
+    self->length = stat_buf.st_size;
+    self->zone_size = 0;
+    if (S_ISBLK(stat_buf.st_mode)) {
+#ifdef BLKGETSIZE64
+	guint64 size;
+
+	if (ioctl(self->fd, BLKGETSIZE64, &size) == -1) {
+	    device_set_error(dself,
+		g_strdup_printf(_("Can't get the size of %s: %s"), self->node,
+				strerror(errno)),
+		DEVICE_STATUS_DEVICE_ERROR);
+	    return FALSE;
+	}
+	self->length = size;
+#endif
+#if defined(HAVE_LINUX_BLKZONED_H) && defined(BLKGETZONESZ)
+	{
+	    __u32 sectors = 0;
+
+	    if (ioctl(self->fd, BLKGETZONESZ, &sectors) == 0 && sectors > 0) {
+		guint64 zones;
+
+		self->zone_size = (guint64)sectors * 512;
+		self->zone_capacity = self->zone_size;
+#ifdef BLK_ZONE_REP_CAPACITY
+		/* the zones of a ZNS drive may hold less than their size */
+		{
+		    struct blk_zone_report *report;
+
+		    report = g_malloc0(sizeof(*report) + sizeof(struct blk_zone));
+		    report->sector = sectors;
+		    report->nr_zones = 1;
+		    if (ioctl(self->fd, BLKREPORTZONE, report) == 0 &&
+			report->nr_zones == 1 &&
+			(report->flags & BLK_ZONE_REP_CAPACITY) &&
+			report->zones[0].capacity > 0)
+			self->zone_capacity = report->zones[0].capacity * 512;
+		    g_free(report);
+		}
+#endif
+		zones = self->length / self->zone_size;
+		self->length = zones * self->zone_capacity;
+	    }
+	}
+#endif
+    } else if (!S_ISREG(stat_buf.st_mode)) {
+	device_set_error(dself,
+	    g_strdup_printf(_("%s is not a block device"), self->node),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+
+    if (self->zone_size)
+	g_debug("%s: zoned, %llu zones of %llu bytes", self->node,
+		(unsigned long long)(self->length / self->zone_capacity),
+		(unsigned long long)self->zone_capacity);
+
+    return TRUE;
+}
+
+static void
+blockdev_close(
+    BlockdevDevice *self)
+{
+    if (self->fd >= 0) {
+	robust_close(self->fd);
+	self->fd = -1;
+    }
+    amfree(self->wbuf);
+    amfree(self->rbuf);
+    self->wbuf_len = 0;
+    self->rbuf_len = 0;
+}
+
+/* Reset the zones of a zoned device */
+static gboolean
+blockdev_reset_zones(
+    BlockdevDevice *self)
+{
+    Device *dself = DEVICE(self);
+
+    if (!self->zone_size)
+	return TRUE;
+
+#ifdef HAVE_LINUX_BLKZONED_H
+    {
+	struct blk_zone_range range;
+
+	range.sector = 0;
+	range.nr_sectors = (self->length / self->zone_capacity)
+			 * self->zone_size / 512;
+	if (ioctl(self->fd, BLKRESETZONE, &range) == 0)
+	    return TRUE;
+    }
+#endif
+    device_set_error(dself,
+	g_strdup_printf(_("Can't reset the zones of %s: %s"), self->node,
+			strerror(errno)),
+	DEVICE_STATUS_DEVICE_ERROR);
+    return FALSE;
+}
+
+/*
+ * The directory
+ */
+
+/* Read the directory of the volume after the label */
+static gboolean
+blockdev_read_directory(
+    BlockdevDevice *self)
+{
+    Device *dself = DEVICE(self);
+    char *buf = blockdev_alloc(BLOCKDEV_WRITE_SIZE);
+    guint64 pos = BLOCKDEV_DIR_OFFSET;
+    gboolean done = FALSE;
+
+    g_array_set_size(self->files, 0);
+    self->end = self->data_offset;
+
+    while (!done && pos + BLOCKDEV_RECORD_SIZE <= self->data_offset) {
+	gsize len = MIN(BLOCKDEV_WRITE_SIZE, self->data_offset - pos);
+	gsize i;
+
+	len -= len % BLOCKDEV_RECORD_SIZE;
+	if (!blockdev_io(self, FALSE, pos, buf, len)) {
+	    device_set_error(dself,
+		g_strdup_printf(_("Can't read the directory of %s: %s"),
+				self->node, strerror(errno)),
+		DEVICE_STATUS_DEVICE_ERROR | DEVICE_STATUS_VOLUME_ERROR);
+	    free(buf);
+	    return FALSE;
+	}
+
+	for (i = 0; i < len; i += BLOCKDEV_RECORD_SIZE) {
+	    unsigned long long id, offset, size;
+	    unsigned int file;
+	    BlockdevFile entry;
+
+	    buf[i + BLOCKDEV_RECORD_SIZE - 1] = '\0';
+	    if (sscanf(buf + i, BLOCKDEV_RECORD_FORMAT, &id, &file, &offset,
+		       &size) != 4 || id != self->volume_id) {
+		done = TRUE;
+		break;
+	    }
+	    entry.file = file;
+	    entry.offset = offset;
+	    entry.size = size;
+	    g_array_append_val(self->files, entry);
+	    self->end = BLOCKDEV_ALIGN_UP(offset + size);
+	    pos += BLOCKDEV_RECORD_SIZE;
+	}
+    }
+    self->dir_next = pos;
+    free(buf);
+
+    return TRUE;
+}
+
+/* Add the file just written to the directory, once its data is on disk */
+static gboolean
+blockdev_add_record(
+    BlockdevDevice *self,
+    BlockdevFile *entry)
+{
+    Device *dself = DEVICE(self);
+    char *record;
+    gboolean rval;
+
+    if (fdatasync(self->fd) == -1) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Error syncing %s: %s"), self->node, strerror(errno)),
+	    DEVICE_STATUS_DEVICE_ERROR | DEVICE_STATUS_VOLUME_ERROR);
+	return FALSE;
+    }
+
+    record = blockdev_alloc(BLOCKDEV_RECORD_SIZE);
+    g_snprintf(record, BLOCKDEV_RECORD_SIZE, BLOCKDEV_RECORD_FORMAT,
+	       (unsigned long long)self->volume_id, entry->file,
+	       (unsigned long long)entry->offset,
+	       (unsigned long long)entry->size);
+    rval = blockdev_io(self, TRUE, self->dir_next, record, BLOCKDEV_RECORD_SIZE)
+	&& fdatasync(self->fd) == 0;
+    free(record);
+    if (!rval) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Error writing the directory of %s: %s"),
+			    self->node, strerror(errno)),
+	    DEVICE_STATUS_DEVICE_ERROR | DEVICE_STATUS_VOLUME_ERROR);
+	return FALSE;
+    }
+
+    g_array_append_val(self->files, *entry);
+    self->dir_next += BLOCKDEV_RECORD_SIZE;
+    return TRUE;
+}
+
+/* Read the header at OFFSET in the volume */
+static dumpfile_t *
+blockdev_read_header(
+    BlockdevDevice *self,
+    guint64 offset)
+{
+    Device *dself = DEVICE(self);
+    char *buf = blockdev_alloc(BLOCKDEV_HEADER_SIZE);
+    dumpfile_t *rval;
+
+    if (!blockdev_io(self, FALSE, offset, buf, BLOCKDEV_HEADER_SIZE)) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Problem reading Amanda header: %s"), strerror(errno)),
+	    DEVICE_STATUS_DEVICE_ERROR | DEVICE_STATUS_VOLUME_ERROR);
+	free(buf);
+	return NULL;
+    }
+
+    rval = g_new(dumpfile_t, 1);
+    parse_file_header(buf, rval, BLOCKDEV_HEADER_SIZE);
+    free(buf);
+    return rval;
+}
+
+/*
+ * Virtual function overrides
+ */
+
+static DeviceStatusFlags
+blockdev_device_read_label(
+    Device *dself)
+{
+    BlockdevDevice *self = BLOCKDEV_DEVICE(dself);
+    dumpfile_t *amanda_header;
+    char *super;
+    unsigned long long id, data;
+
+    g_assert(!dself->in_file);
+
+    amfree(dself->volume_label);
+    amfree(dself->volume_time);
+    dumpfile_free(dself->volume_header);
+    dself->volume_header = NULL;
+
+    if (device_in_error(dself)) return dself->status;
+
+    if (!blockdev_open(self, FALSE))
+	return dself->status;
+
+    amanda_header = dself->volume_header = blockdev_read_header(self, 0);
+    if (!amanda_header)
+	return dself->status;
+
+    if (amanda_header->type != F_TAPESTART) {
+	device_set_error(dself,
+	    g_strdup(_("Volume not labeled")),
+	    DEVICE_STATUS_VOLUME_UNLABELED);
+	return dself->status;
+    }
+
+    super = blockdev_alloc(BLOCKDEV_RECORD_SIZE);
+    if (!blockdev_io(self, FALSE, BLOCKDEV_SUPER_OFFSET, super,
+		     BLOCKDEV_RECORD_SIZE)) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Can't read the superblock of %s: %s"),
+			    self->node, strerror(errno)),
+	    DEVICE_STATUS_DEVICE_ERROR | DEVICE_STATUS_VOLUME_ERROR);
+	free(super);
+	return dself->status;
+    }
+    super[BLOCKDEV_RECORD_SIZE - 1] = '\0';
+    if (sscanf(super, BLOCKDEV_SUPER_FORMAT, &id, &data) != 2 ||
+	data < BLOCKDEV_DIR_OFFSET || data > self->length) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Bad superblock on %s"), self->node),
+	    DEVICE_STATUS_VOLUME_ERROR);
+	free(super);
+	return dself->status;
+    }
+    free(super);
+    self->volume_id = id;
+    self->data_offset = data;
+
+    if (!blockdev_read_directory(self))
+	return dself->status;
+
+    dself->volume_label = g_strdup(amanda_header->name);
+    dself->volume_time = g_strdup(amanda_header->datestamp);
+    dself->header_block_size = BLOCKDEV_HEADER_SIZE;
+    device_set_error(dself, NULL, DEVICE_STATUS_SUCCESS);
+
+    return dself->status;
+}
+
+/* Write a new volume on the device */
+static gboolean
+blockdev_write_label(
+    BlockdevDevice *self,
+    char *label,
+    char *timestamp)
+{
+    Device *dself = DEVICE(self);
+    dumpfile_t *label_header;
+    char *header;
+    size_t size = BLOCKDEV_HEADER_SIZE;
+    char *buf;
+    gboolean ok;
+
+    if (self->length < BLOCKDEV_DIR_OFFSET + BLOCKDEV_MIN_DIR_SIZE) {
+	device_set_error(dself,
+	    g_strdup_printf(_("%s is too small for a volume"), self->node),
+	    DEVICE_STATUS_DEVICE_ERROR | DEVICE_STATUS_VOLUME_ERROR);
+	return FALSE;
+    }
+
+    if (!blockdev_reset_zones(self))
+	return FALSE;
+
+    /* a zoned drive has its first zone for the directory */
+    if (self->zone_size) {
+	self->data_offset = self->zone_capacity;
+    } else {
+	self->data_offset = self->length / 1024;
+	self->data_offset -= self->data_offset % BLOCKDEV_MIN_DIR_SIZE;
+	self->data_offset = CLAMP(self->data_offset, BLOCKDEV_MIN_DIR_SIZE,
+				  BLOCKDEV_MAX_DIR_SIZE);
+    }
+    self->volume_id = ((guint64)g_random_int() << 32) | g_random_int();
+
+    label_header = make_tapestart_header(dself, label, timestamp);
+    header = device_build_amanda_header(dself, label_header, &size);
+    if (!header || size > BLOCKDEV_HEADER_SIZE) {
+	device_set_error(dself,
+	    g_strdup(_("Amanda file header won't fit in a single block!")),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	amfree(header);
+	dumpfile_free(label_header);
+	return FALSE;
+    }
+
+    buf = blockdev_alloc(BLOCKDEV_DIR_OFFSET);
+    memcpy(buf, header, size);
+    g_snprintf(buf + BLOCKDEV_SUPER_OFFSET, BLOCKDEV_RECORD_SIZE,
+	       BLOCKDEV_SUPER_FORMAT, (unsigned long long)self->volume_id,
+	       (unsigned long long)self->data_offset);
+    ok = blockdev_io(self, TRUE, 0, buf, BLOCKDEV_DIR_OFFSET)
+	&& fdatasync(self->fd) == 0;
+    free(buf);
+    amfree(header);
+    if (!ok) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Error writing the label of %s: %s"), self->node,
+			    strerror(errno)),
+	    DEVICE_STATUS_DEVICE_ERROR | DEVICE_STATUS_VOLUME_ERROR);
+	dumpfile_free(label_header);
+	return FALSE;
+    }
+
+    g_array_set_size(self->files, 0);
+    self->dir_next = BLOCKDEV_DIR_OFFSET;
+    self->end = self->data_offset;
+
+    dumpfile_free(dself->volume_header);
+    dself->volume_header = label_header;
+    dself->header_block_size = BLOCKDEV_HEADER_SIZE;
+    return TRUE;
+}
+
+static gboolean
+blockdev_device_start(
+    Device *dself,
+    DeviceAccessMode mode,
+    char *label,
+    char *timestamp)
+{
+    BlockdevDevice *self = BLOCKDEV_DEVICE(dself);
+
+    if (device_in_error(dself)) return FALSE;
+
+    g_mutex_lock(dself->device_mutex);
+    dself->in_file = FALSE;
+    g_mutex_unlock(dself->device_mutex);
+
+    if (!blockdev_open(self, mode != ACCESS_READ))
+	return FALSE;
+
+    if (mode == ACCESS_WRITE) {
+	if (!blockdev_write_label(self, label, timestamp))
+	    return FALSE;
+
+	g_free(dself->volume_label);
+	dself->volume_label = g_strdup(label);
+
+	/* unset the VOLUME_UNLABELED flag, if it was set */
+	device_set_error(dself, NULL, DEVICE_STATUS_SUCCESS);
+    } else if (dself->volume_label == NULL &&
+	       device_read_label(dself) != DEVICE_STATUS_SUCCESS) {
+	/* device_read_label already set our error message */
+	return FALSE;
+    }
+
+#ifdef HAVE_LINUX_BLKZONED_H
+    /* a file not finished may have moved the write pointer of its zone, and
+     * the directory must go on where it ends */
+    if (mode == ACCESS_APPEND && self->zone_size) {
+	guint64 wp;
+
+	if (blockdev_zone_wp(self, self->end, &wp) && wp > self->end)
+	    self->end = BLOCKDEV_ALIGN_UP(wp);
+	if (blockdev_zone_wp(self, 0, &wp) && wp > self->dir_next) {
+	    device_set_error(dself,
+		g_strdup_printf(_("The directory of %s is damaged"), self->node),
+		DEVICE_STATUS_VOLUME_ERROR);
+	    return FALSE;
+	}
+    }
+#endif
+
+    dself->access_mode = mode;
+    return TRUE;
+}
+
+/* The bytes the files use up to POS, and the room for them */
+static guint64
+blockdev_used(
+    BlockdevDevice *self,
+    guint64 pos)
+{
+    return pos - self->data_offset;
+}
+
+static guint64
+blockdev_room(
+    BlockdevDevice *self)
+{
+    guint64 room = self->length - self->data_offset;
+
+    if (self->enforce_volume_limit && self->volume_limit > 0)
+	room = MIN(room, self->volume_limit);
+    return room;
+}
+
+static gboolean
+blockdev_device_start_file(
+    Device *dself,
+    dumpfile_t *ji)
+{
+    BlockdevDevice *self = BLOCKDEV_DEVICE(dself);
+    char *header;
+    size_t size = BLOCKDEV_HEADER_SIZE;
+
+    dself->is_eom = FALSE;
+
+    if (device_in_error(dself)) return FALSE;
+
+    /* the header is always 32k, regardless of the block_size setting */
+    ji->blocksize = BLOCKDEV_HEADER_SIZE;
+
+    if (self->dir_next + BLOCKDEV_RECORD_SIZE > self->data_offset) {
+	dself->is_eom = TRUE;
+	device_set_error(dself,
+	    g_strdup_printf(_("The directory of %s is full"), self->node),
+	    DEVICE_STATUS_VOLUME_ERROR);
+	return FALSE;
+    }
+    if (blockdev_used(self, self->end) + BLOCKDEV_HEADER_SIZE > blockdev_room(self)) {
+	dself->is_eom = TRUE;
+	device_set_error(dself,
+	    g_strdup(_("No space left on device")),
+	    DEVICE_STATUS_VOLUME_ERROR);
+	return FALSE;
+    }
+
+    header = device_build_amanda_header(dself, ji, &size);
+    if (!header || size > BLOCKDEV_HEADER_SIZE) {
+	device_set_error(dself,
+	    g_strdup(_("Amanda file header won't fit in a single block!")),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	amfree(header);
+	return FALSE;
+    }
+
+    if (!self->wbuf)
+	self->wbuf = blockdev_alloc(BLOCKDEV_WRITE_SIZE);
+    memset(self->wbuf, 0, BLOCKDEV_HEADER_SIZE);
+    memcpy(self->wbuf, header, size);
+    amfree(header);
+    self->wbuf_len = BLOCKDEV_HEADER_SIZE;
+    self->wbuf_offset = self->file_offset = self->end;
+
+    dself->block = 0;
+    g_mutex_lock(dself->device_mutex);
+    dself->in_file = TRUE;
+    dself->bytes_written = 0;
+    g_mutex_unlock(dself->device_mutex);
+    if (self->files->len > 0)
+	dself->file = g_array_index(self->files, BlockdevFile,
+				    self->files->len - 1).file + 1;
+    else
+	dself->file = 1;
+
+    return TRUE;
+}
+
+/* Write the write buffer, padded to BLOCKDEV_ALIGN if it's the end of the
+ * file */
+static gboolean
+blockdev_flush(
+    BlockdevDevice *self)
+{
+    Device *dself = DEVICE(self);
+    gsize len = BLOCKDEV_ALIGN_UP(self->wbuf_len);
+
+    if (len == 0)
+	return TRUE;
+
+    memset(self->wbuf + self->wbuf_len, 0, len - self->wbuf_len);
+    if (!blockdev_io(self, TRUE, self->wbuf_offset, self->wbuf, len)) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Error writing to %s: %s"), self->node,
+			    strerror(errno)),
+	    DEVICE_STATUS_DEVICE_ERROR | DEVICE_STATUS_VOLUME_ERROR);
+	return FALSE;
+    }
+    self->wbuf_offset += len;
+    self->wbuf_len = 0;
+
+    return TRUE;
+}
+
+static DeviceWriteResult
+blockdev_device_write_block(
+    Device *dself,
+    guint size,
+    gpointer data)
+{
+    BlockdevDevice *self = BLOCKDEV_DEVICE(dself);
+    guint64 used;
+    char *p = data;
+
+    if (device_in_error(dself)) return WRITE_FAILED;
+
+    g_assert(self->wbuf != NULL);
+
+    used = blockdev_used(self, self->wbuf_offset + self->wbuf_len) + size;
+    if (used + EOM_EARLY_WARNING_ZONE_BLOCKS * dself->block_size
+		> blockdev_room(self))
+	dself->is_eom = TRUE;
+
+    if (BLOCKDEV_ALIGN_UP(used) > blockdev_room(self)) {
+	dself->is_eom = TRUE;
+	device_set_error(dself,
+	    g_strdup(_("No space left on device")),
+	    DEVICE_STATUS_VOLUME_ERROR);
+	return WRITE_FULL;
+    }
+
+    while (size > 0) {
+	gsize n = MIN(size, BLOCKDEV_WRITE_SIZE - self->wbuf_len);
+
+	memcpy(self->wbuf + self->wbuf_len, p, n);
+	self->wbuf_len += n;
+	p += n;
+	size -= n;
+	if (self->wbuf_len == BLOCKDEV_WRITE_SIZE && !blockdev_flush(self))
+	    return WRITE_FAILED;
+    }
+
+    dself->block++;
+    g_mutex_lock(dself->device_mutex);
+    dself->bytes_written += p - (char *)data;
+    g_mutex_unlock(dself->device_mutex);
+
+    return WRITE_SUCCEED;
+}
+
+static gboolean
+blockdev_device_finish_file(
+    Device *dself)
+{
+    BlockdevDevice *self = BLOCKDEV_DEVICE(dself);
+    BlockdevFile entry;
+
+    if (!dself->in_file)
+	return TRUE;
+
+    g_mutex_lock(dself->device_mutex);
+    dself->in_file = FALSE;
+    g_mutex_unlock(dself->device_mutex);
+
+    if (device_in_error(dself)) return FALSE;
+
+    entry.file = dself->file;
+    entry.offset = self->file_offset;
+    entry.size = self->wbuf_offset + self->wbuf_len - self->file_offset;
+    if (!blockdev_flush(self))
+	return FALSE;
+    self->end = self->wbuf_offset;
+
+    return blockdev_add_record(self, &entry);
+}
+
+static dumpfile_t *
+blockdev_device_seek_file(
+    Device *dself,
+    guint requested_file)
+{
+    BlockdevDevice *self = BLOCKDEV_DEVICE(dself);
+    BlockdevFile *entry = NULL;
+    dumpfile_t *rval;
+    guint i;
+
+    if (device_in_error(dself)) return NULL;
+
+    dself->is_eof = FALSE;
+    dself->block = 0;
+    g_mutex_lock(dself->device_mutex);
+    dself->in_file = FALSE;
+    dself->bytes_read = 0;
+    g_mutex_unlock(dself->device_mutex);
+
+    if (requested_file == 0) {
+	dself->file = 0;
+	return blockdev_read_header(self, 0);
+    }
+
+    /* the first file from there */
+    for (i = 0; i < self->files->len; i++) {
+	BlockdevFile *f = &g_array_index(self->files, BlockdevFile, i);
+
+	if (f->file >= requested_file && (!entry || f->file < entry->file))
+	    entry = f;
+    }
+
+    if (!entry) {
+	/* Did they request one past the end? */
+	if (requested_file == 1 || (self->files->len > 0 &&
+	    g_array_index(self->files, BlockdevFile,
+			  self->files->len - 1).file == requested_file - 1)) {
+	    dself->file = requested_file;
+	    return make_tapeend_header();
+	}
+	device_set_error(dself,
+	    g_strdup(_("Attempt to read past tape-end file")),
+	    DEVICE_STATUS_SUCCESS);
+	return NULL;
+    }
+
+    rval = blockdev_read_header(self, entry->offset);
+    if (!rval)
+	return NULL;
+
+    switch (rval->type) {
+	case F_DUMPFILE:
+	case F_CONT_DUMPFILE:
+	case F_SPLIT_DUMPFILE:
+	    break;
+
+	default:
+	    device_set_error(dself,
+		g_strdup(_("Invalid amanda header while reading file header")),
+		DEVICE_STATUS_VOLUME_ERROR);
+	    amfree(rval);
+	    return NULL;
+    }
+
+    self->read_start = self->read_pos = entry->offset + BLOCKDEV_HEADER_SIZE;
+    self->read_end = entry->offset + MAX(entry->size, BLOCKDEV_HEADER_SIZE);
+    self->rbuf_len = 0;
+
+    g_mutex_lock(dself->device_mutex);
+    dself->in_file = TRUE;
+    dself->file = entry->file;
+    g_mutex_unlock(dself->device_mutex);
+
+    return rval;
+}
+
+static gboolean
+blockdev_device_seek_block(
+    Device *dself,
+    guint64 block)
+{
+    BlockdevDevice *self = BLOCKDEV_DEVICE(dself);
+
+    if (device_in_error(dself)) return FALSE;
+
+    self->read_pos = MIN(self->read_start + block * dself->block_size,
+			 self->read_end);
+    dself->block = block;
+
+    return TRUE;
+}
+
+static int
+blockdev_device_read_block(
+    Device *dself,
+    gpointer data,
+    int *size_req,
+    int max_block G_GNUC_UNUSED)
+{
+    BlockdevDevice *self = BLOCKDEV_DEVICE(dself);
+    char *p = data;
+    gsize size;
+
+    if (device_in_error(dself)) return -1;
+
+    if (data == NULL || (gsize)*size_req < dself->block_size) {
+	/* Just a size query. */
+	g_assert(dself->block_size < INT_MAX);
+	*size_req = (int)dself->block_size;
+	return 0;
+    }
+
+    size = MIN(dself->block_size, self->read_end - self->read_pos);
+    if (size == 0) {
+	dself->is_eof = TRUE;
+	g_mutex_lock(dself->device_mutex);
+	dself->in_file = FALSE;
+	g_mutex_unlock(dself->device_mutex);
+	device_set_error(dself,
+	    g_strdup(_("EOF")),
+	    DEVICE_STATUS_SUCCESS);
+	return -1;
+    }
+
+    if (!self->rbuf)
+	self->rbuf = blockdev_alloc(BLOCKDEV_WRITE_SIZE);
+
+    while (p < (char *)data + size) {
+	gsize n;
+
+	/* read the next piece of the file, from an aligned offset */
+	if (self->read_pos < self->rbuf_offset ||
+	    self->read_pos >= self->rbuf_offset + self->rbuf_len) {
+	    self->rbuf_offset = BLOCKDEV_ALIGN_DOWN(self->read_pos);
+	    self->rbuf_len = MIN(BLOCKDEV_WRITE_SIZE,
+			BLOCKDEV_ALIGN_UP(self->read_end) - self->rbuf_offset);
+	    if (!blockdev_io(self, FALSE, self->rbuf_offset, self->rbuf,
+			     self->rbuf_len)) {
+		self->rbuf_len = 0;
+		device_set_error(dself,
+		    g_strdup_printf(_("Error reading from %s: %s"), self->node,
+				    strerror(errno)),
+		    DEVICE_STATUS_DEVICE_ERROR);
+		return -1;
+	    }
+	}
+
+	n = MIN((gsize)((char *)data + size - p),
+		self->rbuf_offset + self->rbuf_len - self->read_pos);
+	memcpy(p, self->rbuf + (self->read_pos - self->rbuf_offset), n);
+	p += n;
+	self->read_pos += n;
+    }
+
+    *size_req = size;
+    g_mutex_lock(dself->device_mutex);
+    dself->bytes_read += size;
+    g_mutex_unlock(dself->device_mutex);
+    dself->block++;
+
+    return size;
+}
+
+static gboolean
+blockdev_device_erase(
+    Device *dself)
+{
+    BlockdevDevice *self = BLOCKDEV_DEVICE(dself);
+    gboolean rval = TRUE;
+
+    if (!blockdev_open(self, TRUE))
+	return FALSE;
+
+    if (self->zone_size) {
+	rval = blockdev_reset_zones(self);
+    } else {
+	/* without its label and superblock, nothing is left of the volume */
+	char *buf = blockdev_alloc(BLOCKDEV_DIR_OFFSET);
+
+	if (!blockdev_io(self, TRUE, 0, buf, BLOCKDEV_DIR_OFFSET) ||
+	    fdatasync(self->fd) == -1) {
+	    device_set_error(dself,
+		g_strdup_printf(_("Can't erase %s: %s"), self->node,
+				strerror(errno)),
+		DEVICE_STATUS_DEVICE_ERROR | DEVICE_STATUS_VOLUME_ERROR);
+	    rval = FALSE;
+	}
+	free(buf);
+    }
+
+    if (dself->access_mode == ACCESS_NULL)
+	blockdev_close(self);
+    if (!rval)
+	return FALSE;
+
+    g_array_set_size(self->files, 0);
+    dumpfile_free(dself->volume_header);
+    dself->volume_header = NULL;
+    device_set_error(dself, g_strdup("Unlabeled volume"),
+		     DEVICE_STATUS_VOLUME_UNLABELED);
+
+    return TRUE;
+}
+
+static gboolean
+blockdev_device_finish(
+    Device *dself)
+{
+    BlockdevDevice *self = BLOCKDEV_DEVICE(dself);
+
+    blockdev_close(self);
+
+    dself->access_mode = ACCESS_NULL;
+    g_mutex_lock(dself->device_mutex);
+    dself->in_file = FALSE;
+    g_mutex_unlock(dself->device_mutex);
+
+    if (device_in_error(dself)) return FALSE;
+
+    return TRUE;
+}
+
+static void
+blockdev_device_finalize(
+    GObject *gself)
+{
+    BlockdevDevice *self = BLOCKDEV_DEVICE(gself);
+
+    blockdev_close(self);
+    g_array_free(self->files, TRUE);
+    amfree(self->node);
+
+    if (G_OBJECT_CLASS(parent_class)->finalize)
+	G_OBJECT_CLASS(parent_class)->finalize(gself);
+}
@@ -0,0 +1,1107 @@
+/*
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+/*
+ * The dedup device is a VFS device whose files hold, after their header, a
+ * recipe instead of the data: the list of the chunks of the data, each one
+ * a record of its SHA-256 hash and its length (4 bytes, BE).
+ *
+ * The data is cut in chunks where its content says so (FastCDC: a gear
+ * fingerprint of the last 64 bytes, with normalized chunking), so that a
+ * chunk seen in an earlier dump is found again even if the data before it
+ * moved.  A chunk is stored once, in the chunk store shared by the volumes,
+ * named after its hash:
+ *
+ *   CHUNK_DIR/ab/abcdef...
+ *
+ * and each volume holds a hard link to the chunks it uses:
+ *
+ *   VOLUME/chunks/ab/abcdef...
+ *
+ * The link count of a chunk in the store is thus the number of volumes using
+ * it, plus one; a volume is read from its own links, and erasing it removes
+ * the chunks no other volume uses.  The store and the volumes must be on the
+ * same filesystem.
+ */
+
+#include "amanda.h"
+#include "amutil.h"
+#include <fcntl.h>
+#include <openssl/evp.h>
+
+#include "vfs-device.h"
+
+/*
+ * Type checking and casting macros
+ */
+#define TYPE_DEDUP_DEVICE	(dedup_device_get_type())
+#define DEDUP_DEVICE(obj)	G_TYPE_CHECK_INSTANCE_CAST((obj), TYPE_DEDUP_DEVICE, DedupDevice)
+#define DEDUP_DEVICE_CONST(obj)	G_TYPE_CHECK_INSTANCE_CAST((obj), TYPE_DEDUP_DEVICE, DedupDevice const)
+#define DEDUP_DEVICE_CLASS(klass)	G_TYPE_CHECK_CLASS_CAST((klass), TYPE_DEDUP_DEVICE, DedupDeviceClass)
+#define IS_DEDUP_DEVICE(obj)	G_TYPE_CHECK_INSTANCE_TYPE((obj), TYPE_DEDUP_DEVICE)
+#define DEDUP_DEVICE_GET_CLASS(obj)	G_TYPE_INSTANCE_GET_CLASS((obj), TYPE_DEDUP_DEVICE, DedupDeviceClass)
+
+#define DEDUP_HASH_SIZE		32	/* SHA-256 */
+#define DEDUP_RECORD_SIZE	(DEDUP_HASH_SIZE + 4)
+
+#define DEDUP_DEFAULT_CHUNK_SIZE (64*1024)
+#define DEDUP_MIN_CHUNK_SIZE	(4*1024)
+#define DEDUP_MAX_CHUNK_SIZE	(4*1024*1024)
+
+/* the directory of the links of a volume, in its VFS directory; its name does
+ * not match the files of the VFS device */
+#define DEDUP_LINKS_NAME	"chunks"
+
+/* Forward declaration */
+static GType dedup_device_get_type(void);
+
+/*
+ * Main object structure
+ */
+typedef struct _DedupDevice DedupDevice;
+struct _DedupDevice {
+    VfsDevice __parent__;
+
+    /* the chunk store */
+    char *chunk_dir;
+
+    /* the average, minimum and maximum size of the chunks, and the masks of
+     * the fingerprint before and after the average size */
+    gsize avg_chunk;
+    gsize min_chunk;
+    gsize max_chunk;
+    guint64 mask_s;
+    guint64 mask_l;
+
+    /* the fan-out directories known to exist, in the store and the volume */
+    gboolean store_fanout[256];
+    gboolean links_fanout[256];
+
+    /* writing: the data not cut yet, and where the search of a cut stopped */
+    guint8 *pending;
+    gsize pending_len;
+    gsize pending_size;
+    gsize scan_pos;
+    guint64 scan_fp;
+
+    /* for the debug log of a file */
+    guint64 nchunks;
+    guint64 new_chunks;
+    guint64 new_bytes;
+
+    /* reading: the chunk being read */
+    guint8 *chunk;
+    gsize chunk_len;
+    gsize chunk_off;
+    gsize chunk_size;
+
+    gboolean (* vfs_clear_and_prepare_label)(Device *dself, char *label, char *timestamp);
+};
+
+/*
+ * Class definition
+ */
+typedef struct _DedupDeviceClass DedupDeviceClass;
+struct _DedupDeviceClass {
+    VfsDeviceClass __parent__;
+};
+
+/* device-specific properties */
+DevicePropertyBase device_property_dedup_chunk_dir;
+#define PROPERTY_DEDUP_CHUNK_DIR (device_property_dedup_chunk_dir.ID)
+
+DevicePropertyBase device_property_dedup_chunk_size;
+#define PROPERTY_DEDUP_CHUNK_SIZE (device_property_dedup_chunk_size.ID)
+
+/* the gear table of the fingerprint */
+static guint64 gear[256];
+
+/* GObject housekeeping */
+void
+dedup_device_register(void);
+
+static Device*
+dedup_device_factory(char *device_name, char *device_type, char *device_node);
+
+static void
+dedup_device_class_init (DedupDeviceClass *c);
+
+static void
+dedup_device_init (DedupDevice *self);
+
+/* Methods */
+static void
+dedup_device_open_device(Device *dself, char *device_name, char *device_type, char *device_node);
+
+static gboolean
+dedup_device_start_file(Device *dself, dumpfile_t *ji);
+
+static DeviceWriteResult
+dedup_device_write_block(Device *dself, guint size, gpointer data);
+
+static gboolean
+dedup_device_finish_file(Device *dself);
+
+static dumpfile_t *
+dedup_device_seek_file(Device *dself, guint requested_file);
+
+static gboolean
+dedup_device_seek_block(Device *dself, guint64 block);
+
+static int
+dedup_device_read_block(Device *dself, gpointer data, int *size_req, int max_block);
+
+static gboolean
+dedup_device_erase(Device *dself);
+
+static void
+dedup_device_finalize(GObject *gself);
+
+static gboolean
+dedup_clear_and_prepare_label(Device *dself, char *label, char *timestamp);
+
+static gboolean
+property_set_chunk_dir_fn(Device *dself, DevicePropertyBase *base,
+    GValue *val, PropertySurety surety, PropertySource source);
+
+static gboolean
+property_set_chunk_size_fn(Device *dself, DevicePropertyBase *base,
+    GValue *val, PropertySurety surety, PropertySource source);
+
+static GType
+dedup_device_get_type (void)
+{
+    static GType type = 0;
+
+    if (G_UNLIKELY(type == 0)) {
+        static const GTypeInfo info = {
+            sizeof (DedupDeviceClass),
+            (GBaseInitFunc) NULL,
+            (GBaseFinalizeFunc) NULL,
+            (GClassInitFunc) dedup_device_class_init,
+            (GClassFinalizeFunc) NULL,
+            NULL /* class_data */,
+            sizeof (DedupDevice),
+            0 /* n_preallocs */,
+            (GInstanceInitFunc) dedup_device_init,
+            NULL
+        };
+
+        type = g_type_register_static (TYPE_VFS_DEVICE, "DedupDevice",
+                                       &info, (GTypeFlags)0);
+    }
+
+    return type;
+}
+
+/* splitmix64 from a fixed seed: the chunk boundaries, and so what is found
+ * again in the store, must not change from a run to the next */
+static void
+gear_init(void)
+{
+    guint64 x = G_GUINT64_CONSTANT(0x616d616e64612121);
+    int i;
+
+    for (i = 0; i < 256; i++) {
+	guint64 z = (x += G_GUINT64_CONSTANT(0x9e3779b97f4a7c15));
+
+	z = (z ^ (z >> 30)) * G_GUINT64_CONSTANT(0xbf58476d1ce4e5b9);
+	z = (z ^ (z >> 27)) * G_GUINT64_CONSTANT(0x94d049bb133111eb);
+	gear[i] = z ^ (z >> 31);
+    }
+}
+
+void
+dedup_device_register(void)
+{
+    const char *device_prefix_list[] = { "dedup", NULL };
+
+    gear_init();
+
+    device_property_fill_and_register(&device_property_dedup_chunk_dir,
+                                      G_TYPE_STRING, "dedup_chunk_dir",
+      "Directory of the chunk store shared by the volumes");
+    device_property_fill_and_register(&device_property_dedup_chunk_size,
+                                      G_TYPE_UINT64, "dedup_chunk_size",
+      "Average size of the chunks the data is cut in");
+
+    register_device(dedup_device_factory, device_prefix_list);
+}
+
+static Device *
+dedup_device_factory(
+    char *device_name,
+    char *device_type,
+    char *device_node)
+{
+    Device *device;
+
+    g_assert(g_str_has_prefix(device_type, "dedup"));
+
+    device = DEVICE(g_object_new(TYPE_DEDUP_DEVICE, NULL));
+    device_open_device(device, device_name, device_type, device_node);
+
+    return device;
+}
+
+static void
+dedup_device_class_init (
+    DedupDeviceClass *c)
+{
+    DeviceClass *device_class = DEVICE_CLASS(c);
+    GObjectClass *g_object_class = G_OBJECT_CLASS(c);
+
+    device_class->open_device = dedup_device_open_device;
+    device_class->start_file = dedup_device_start_file;
+    device_class->write_block = dedup_device_write_block;
+    device_class->finish_file = dedup_device_finish_file;
+    device_class->seek_file = dedup_device_seek_file;
+    device_class->seek_block = dedup_device_seek_block;
+    device_class->read_block = dedup_device_read_block;
+    device_class->erase = dedup_device_erase;
+
+    device_class_register_property(device_class, PROPERTY_DEDUP_CHUNK_DIR,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    property_set_chunk_dir_fn);
+
+    device_class_register_property(device_class, PROPERTY_DEDUP_CHUNK_SIZE,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    property_set_chunk_size_fn);
+
+    g_object_class->finalize = dedup_device_finalize;
+}
+
+static void
+dedup_set_chunk_size(
+    DedupDevice *self,
+    guint64 size)
+{
+    int bits = 0;
+
+    while (((guint64)1 << (bits + 1)) <= size)
+	bits++;
+
+    self->avg_chunk = (gsize)1 << bits;
+    self->min_chunk = self->avg_chunk / 4;
+    self->max_chunk = self->avg_chunk * 4;
+
+    /* one more bit to match before the average size, one less after; the
+     * top bits of the fingerprint are the ones depending on 64 bytes */
+    self->mask_s = (((guint64)1 << (bits + 1)) - 1) << (64 - bits - 1);
+    self->mask_l = (((guint64)1 << (bits - 1)) - 1) << (64 - bits + 1);
+}
+
+static void
+dedup_device_init (
+    DedupDevice *self)
+{
+    Device *dself = DEVICE(self);
+    VfsDevice *vself = VFS_DEVICE(self);
+    GValue val;
+
+    /* vfs_device_init ran first */
+    self->vfs_clear_and_prepare_label = vself->clear_and_prepare_label;
+    vself->clear_and_prepare_label = &dedup_clear_and_prepare_label;
+
+    self->chunk_dir = NULL;
+    dedup_set_chunk_size(self, DEDUP_DEFAULT_CHUNK_SIZE);
+    self->pending = NULL;
+    self->pending_len = self->pending_size = 0;
+    self->scan_pos = 0;
+    self->scan_fp = 0;
+    self->chunk = NULL;
+    self->chunk_len = self->chunk_off = self->chunk_size = 0;
+
+    bzero(&val, sizeof(val));
+
+    g_value_init(&val, G_TYPE_UINT64);
+    g_value_set_uint64(&val, self->avg_chunk);
+    device_set_simple_property(dself, PROPERTY_DEDUP_CHUNK_SIZE,
+	&val, PROPERTY_SURETY_GOOD, PROPERTY_SOURCE_DEFAULT);
+    g_value_unset(&val);
+}
+
+static gboolean
+property_set_chunk_dir_fn(
+    Device *dself,
+    DevicePropertyBase *base,
+    GValue *val,
+    PropertySurety surety,
+    PropertySource source)
+{
+    DedupDevice *self = DEDUP_DEVICE(dself);
+
+    g_free(self->chunk_dir);
+    self->chunk_dir = g_value_dup_string(val);
+    memset(self->store_fanout, 0, sizeof(self->store_fanout));
+
+    return device_simple_property_set_fn(dself, base, val, surety, source);
+}
+
+static gboolean
+property_set_chunk_size_fn(
+    Device *dself,
+    DevicePropertyBase *base,
+    GValue *val,
+    PropertySurety surety,
+    PropertySource source)
+{
+    DedupDevice *self = DEDUP_DEVICE(dself);
+    guint64 size = g_value_get_uint64(val);
+
+    if (size < DEDUP_MIN_CHUNK_SIZE || size > DEDUP_MAX_CHUNK_SIZE) {
+	device_set_error(dself,
+	    g_strdup_printf(_("DEDUP_CHUNK_SIZE must be between %d and %d"),
+			    DEDUP_MIN_CHUNK_SIZE, DEDUP_MAX_CHUNK_SIZE),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+    dedup_set_chunk_size(self, size);
+
+    return device_simple_property_set_fn(dself, base, val, surety, source);
+}
+
+static void
+dedup_device_open_device(
+    Device *dself,
+    char *device_name,
+    char *device_type,
+    char *device_node)
+{
+    DedupDevice *self = DEDUP_DEVICE(dself);
+    DeviceClass *parent_class = DEVICE_CLASS(g_type_class_peek_parent(DEDUP_DEVICE_GET_CLASS(dself)));
+    char *parent_dir;
+
+    parent_class->open_device(dself, device_name, device_type, device_node);
+
+    /* the store is next to the volumes, until DEDUP_CHUNK_DIR says otherwise */
+    parent_dir = g_path_get_dirname(device_node);
+    self->chunk_dir = g_strconcat(parent_dir, "/chunks", NULL);
+    g_free(parent_dir);
+}
+
+static void
+dedup_device_finalize(
+    GObject *gself)
+{
+    DedupDevice *self = DEDUP_DEVICE(gself);
+    GObjectClass *parent_class = G_OBJECT_CLASS(g_type_class_peek_parent(DEDUP_DEVICE_GET_CLASS(gself)));
+
+    if (parent_class->finalize) {
+	parent_class->finalize(gself);
+    }
+    amfree(self->chunk_dir);
+    amfree(self->pending);
+    amfree(self->chunk);
+}
+
+/*
+ * Chunks
+ */
+
+static void
+dedup_hash(
+    const guint8 *buf,
+    gsize len,
+    guint8 *md)
+{
+    unsigned int md_len = DEDUP_HASH_SIZE;
+
+    /* the SHA-256 of libcrypto uses the SHA or AVX2 instructions of the cpu */
+    EVP_Digest(buf, len, md, &md_len, EVP_sha256(), NULL);
+}
+
+static void
+dedup_hex(
+    const guint8 *md,
+    char *hex)
+{
+    static const char digits[] = "0123456789abcdef";
+    int i;
+
+    for (i = 0; i < DEDUP_HASH_SIZE; i++) {
+	hex[2*i] = digits[md[i] >> 4];
+	hex[2*i+1] = digits[md[i] & 0xf];
+    }
+    hex[2*DEDUP_HASH_SIZE] = '\0';
+}
+
+static char *
+dedup_store_name(
+    DedupDevice *self,
+    const char *hex)
+{
+    return g_strdup_printf("%s/%.2s/%s", self->chunk_dir, hex, hex);
+}
+
+static char *
+dedup_links_dir(
+    DedupDevice *self)
+{
+    /* dir_name ends with a '/' */
+    return g_strconcat(VFS_DEVICE(self)->dir_name, DEDUP_LINKS_NAME, NULL);
+}
+
+static char *
+dedup_link_name(
+    DedupDevice *self,
+    const char *hex)
+{
+    return g_strdup_printf("%s%s/%.2s/%s", VFS_DEVICE(self)->dir_name,
+			   DEDUP_LINKS_NAME, hex, hex);
+}
+
+/* create the fan-out directory of NAME, unless it is known to exist */
+static gboolean
+dedup_make_fanout(
+    gboolean *fanout,
+    const char *hex,
+    char *name)
+{
+    int i = g_ascii_xdigit_value(hex[0]) * 16 + g_ascii_xdigit_value(hex[1]);
+
+    if (fanout[i])
+	return TRUE;
+    if (mkpdir(name, 0700, (uid_t)-1, (gid_t)-1) != 0)
+	return FALSE;
+    fanout[i] = TRUE;
+    return TRUE;
+}
+
+static DeviceWriteResult
+dedup_write_error(
+    DedupDevice *self,
+    const char *what,
+    const char *name,
+    int err)
+{
+    Device *dself = DEVICE(self);
+
+    if (err == ENOSPC) {
+	device_set_error(dself,
+	    g_strdup_printf(_("No space left on device: %s %s: %s"), what, name,
+			    strerror(err)),
+	    DEVICE_STATUS_VOLUME_ERROR);
+	return VFS_DEVICE(self)->leom ? WRITE_SPACE : WRITE_FAILED;
+    }
+
+    if (err == EXDEV) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Can't link %s: the chunk directory %s must be on the filesystem of the volume"),
+			    name, self->chunk_dir),
+	    DEVICE_STATUS_DEVICE_ERROR);
+    } else {
+	device_set_error(dself,
+	    g_strdup_printf(_("Can't %s %s: %s"), what, name, strerror(err)),
+	    DEVICE_STATUS_DEVICE_ERROR);
+    }
+    return WRITE_FAILED;
+}
+
+/* Store a chunk, if neither the volume nor the store has it yet, and add it
+ * to the recipe of the file */
+static DeviceWriteResult
+dedup_write_chunk(
+    DedupDevice *self,
+    const guint8 *buf,
+    gsize len)
+{
+    VfsDevice *vself = VFS_DEVICE(self);
+    guint8 record[DEDUP_RECORD_SIZE];
+    char hex[2*DEDUP_HASH_SIZE+1];
+    char *link_name;
+    char *store_name = NULL;
+    char *tmp_name = NULL;
+    struct stat st;
+    DeviceWriteResult result = WRITE_SUCCEED;
+    IoResult io;
+    int fd;
+
+    dedup_hash(buf, len, record);
+    dedup_hex(record, hex);
+    record[DEDUP_HASH_SIZE] = (len >> 24) & 0xff;
+    record[DEDUP_HASH_SIZE+1] = (len >> 16) & 0xff;
+    record[DEDUP_HASH_SIZE+2] = (len >> 8) & 0xff;
+    record[DEDUP_HASH_SIZE+3] = len & 0xff;
+    self->nchunks++;
+
+    link_name = dedup_link_name(self, hex);
+    if (stat(link_name, &st) == 0)
+	goto add_record;
+
+    store_name = dedup_store_name(self, hex);
+    if (!dedup_make_fanout(self->links_fanout, hex, link_name)) {
+	result = dedup_write_error(self, "create the directory of", link_name, errno);
+	goto done;
+    }
+    if (!dedup_make_fanout(self->store_fanout, hex, store_name)) {
+	result = dedup_write_error(self, "create the directory of", store_name, errno);
+	goto done;
+    }
+
+    if (link(store_name, link_name) == 0)
+	goto add_record;
+    if (errno != ENOENT) {
+	result = dedup_write_error(self, "link", store_name, errno);
+	goto done;
+    }
+
+    /* a new chunk; another device may be storing it too */
+    tmp_name = g_strdup_printf("%s.tmp-%ld", store_name, (long)getpid());
+    fd = open(tmp_name, O_CREAT | O_TRUNC | O_WRONLY, VFS_DEVICE_CREAT_MODE);
+    if (fd < 0) {
+	result = dedup_write_error(self, "create", tmp_name, errno);
+	goto done;
+    }
+    if (full_write(fd, buf, len) < len) {
+	int save_errno = errno;
+	close(fd);
+	unlink(tmp_name);
+	result = dedup_write_error(self, "write", tmp_name, save_errno);
+	goto done;
+    }
+    if (close(fd) != 0) {
+	int save_errno = errno;
+	unlink(tmp_name);
+	result = dedup_write_error(self, "write", tmp_name, save_errno);
+	goto done;
+    }
+    if (link(tmp_name, store_name) != 0) {
+	int save_errno = errno;
+	unlink(tmp_name);
+	if (save_errno != EEXIST) {
+	    result = dedup_write_error(self, "link", tmp_name, save_errno);
+	    goto done;
+	}
+	/* the other device stored it first; link its copy, so that the
+	 * store counts this volume */
+	if (link(store_name, link_name) == 0)
+	    goto add_record;
+	result = dedup_write_error(self, "link", store_name, errno);
+	goto done;
+    }
+    if (link(tmp_name, link_name) != 0) {
+	int save_errno = errno;
+	unlink(tmp_name);
+	result = dedup_write_error(self, "link", tmp_name, save_errno);
+	goto done;
+    }
+    unlink(tmp_name);
+    self->new_chunks++;
+    self->new_bytes += len;
+
+add_record:
+    io = vfs_device_robust_write(vself, (char *)record, DEDUP_RECORD_SIZE);
+    if (io == RESULT_NO_SPACE) {
+	result = vself->leom ? WRITE_SPACE : WRITE_FAILED;
+    } else if (io != RESULT_SUCCESS) {
+	result = WRITE_FAILED;
+    }
+
+done:
+    g_free(link_name);
+    g_free(store_name);
+    g_free(tmp_name);
+    return result;
+}
+
+static gsize
+dedup_cut_at(
+    DedupDevice *self,
+    gsize len)
+{
+    self->scan_pos = 0;
+    self->scan_fp = 0;
+    return len;
+}
+
+/* The length of the next chunk of the pending data, or 0 if more data is
+ * needed to find it */
+static gsize
+dedup_next_cut(
+    DedupDevice *self)
+{
+    const guint8 *buf = self->pending;
+    gsize len = self->pending_len;
+    gsize max = MIN(len, self->max_chunk);
+    gsize normal = MIN(self->avg_chunk, max);
+    gsize i = MAX(self->scan_pos, self->min_chunk);
+    guint64 fp = self->scan_fp;
+
+    for (; i < normal; i++) {
+	fp = (fp << 1) + gear[buf[i]];
+	if (!(fp & self->mask_s))
+	    return dedup_cut_at(self, i + 1);
+    }
+    for (; i < max; i++) {
+	fp = (fp << 1) + gear[buf[i]];
+	if (!(fp & self->mask_l))
+	    return dedup_cut_at(self, i + 1);
+    }
+    if (len >= self->max_chunk)
+	return dedup_cut_at(self, self->max_chunk);
+
+    /* go on from there with the next block */
+    self->scan_pos = i;
+    self->scan_fp = fp;
+    return 0;
+}
+
+/* Write the chunks of the pending data; the rest of it too if FINAL */
+static DeviceWriteResult
+dedup_flush(
+    DedupDevice *self,
+    gboolean final)
+{
+    DeviceWriteResult result;
+    gsize len;
+
+    for (;;) {
+	len = dedup_next_cut(self);
+	if (len == 0) {
+	    if (!final || self->pending_len == 0)
+		break;
+	    len = self->pending_len;
+	}
+	result = dedup_write_chunk(self, self->pending, len);
+	if (result != WRITE_SUCCEED) {
+	    self->pending_len = 0;
+	    dedup_cut_at(self, 0);
+	    return result;
+	}
+	/* keep the data at the start of the buffer, for dedup_next_cut */
+	self->pending_len -= len;
+	memmove(self->pending, self->pending + len, self->pending_len);
+    }
+
+    return WRITE_SUCCEED;
+}
+
+/*
+ * Writing
+ */
+
+static gboolean
+dedup_device_start_file(
+    Device *dself,
+    dumpfile_t *ji)
+{
+    DedupDevice *self = DEDUP_DEVICE(dself);
+    VfsDevice *vself = VFS_DEVICE(dself);
+    DeviceClass *parent_class = DEVICE_CLASS(g_type_class_peek_parent(DEDUP_DEVICE_GET_CLASS(dself)));
+
+    /* the recipe is small, it is written synchronously */
+    vself->io_depth = 0;
+
+    if (!parent_class->start_file(dself, ji))
+	return FALSE;
+
+    self->pending_len = 0;
+    dedup_cut_at(self, 0);
+    self->nchunks = self->new_chunks = self->new_bytes = 0;
+
+    return TRUE;
+}
+
+static DeviceWriteResult
+dedup_device_write_block(
+    Device *dself,
+    guint size,
+    gpointer data)
+{
+    DedupDevice *self = DEDUP_DEVICE(dself);
+    VfsDevice *vself = VFS_DEVICE(dself);
+    DeviceWriteResult result;
+
+    if (device_in_error(self)) return WRITE_FAILED;
+
+    g_assert(vself->open_file_fd >= 0);
+
+    /* MAX_VOLUME_USAGE counts the data, as the VFS device does */
+    if (vfs_device_check_at_leom(vself, size))
+	dself->is_eom = TRUE;
+
+    if (vfs_device_check_at_peom(vself, size)) {
+	dself->is_eom = TRUE;
+	device_set_error(dself,
+	    g_strdup(_("No space left on device: more than MAX_VOLUME_USAGE bytes written")),
+	    DEVICE_STATUS_VOLUME_ERROR);
+	return vself->leom ? WRITE_FULL : WRITE_FAILED;
+    }
+
+    if (self->pending_len + size > self->pending_size) {
+	self->pending_size = self->pending_len + size + self->max_chunk;
+	self->pending = g_realloc(self->pending, self->pending_size);
+    }
+    memcpy(self->pending + self->pending_len, data, size);
+    self->pending_len += size;
+
+    result = dedup_flush(self, FALSE);
+    if (result != WRITE_SUCCEED)
+	return result;
+
+    vself->volume_bytes += size;
+    vself->checked_bytes_used += size;
+    dself->block++;
+    g_mutex_lock(dself->device_mutex);
+    dself->bytes_written += size;
+    g_mutex_unlock(dself->device_mutex);
+
+    return WRITE_SUCCEED;
+}
+
+static gboolean
+dedup_device_finish_file(
+    Device *dself)
+{
+    DedupDevice *self = DEDUP_DEVICE(dself);
+    DeviceClass *parent_class = DEVICE_CLASS(g_type_class_peek_parent(DEDUP_DEVICE_GET_CLASS(dself)));
+    gboolean success = TRUE;
+
+    if (!dself->in_file)
+	return TRUE;
+
+    if (dself->access_mode != ACCESS_READ && !device_in_error(dself)) {
+	success = (dedup_flush(self, TRUE) == WRITE_SUCCEED);
+	g_debug("dedup: %ju bytes in %ju chunks, %ju new chunks of %ju bytes",
+		(uintmax_t)dself->bytes_written, (uintmax_t)self->nchunks,
+		(uintmax_t)self->new_chunks, (uintmax_t)self->new_bytes);
+    }
+    self->pending_len = 0;
+
+    return parent_class->finish_file(dself) && success;
+}
+
+/*
+ * Reading
+ */
+
+static void
+dedup_read_reset(
+    DedupDevice *self)
+{
+    self->chunk_len = 0;
+    self->chunk_off = 0;
+}
+
+/* Read the next record of the recipe, and its chunk; 1 if one was read, 0 at
+ * the end of the recipe, -1 on error. */
+static int
+dedup_read_record(
+    DedupDevice *self,
+    guint8 *record,
+    gsize *len)
+{
+    Device *dself = DEVICE(self);
+    int size = DEDUP_RECORD_SIZE;
+    IoResult result;
+
+    result = vfs_device_robust_read(VFS_DEVICE(self), (char *)record, &size);
+    if (result == RESULT_NO_DATA)
+	return 0;
+    if (result != RESULT_SUCCESS) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Error reading from data file: %s"), strerror(errno)),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	return -1;
+    }
+    if (size != DEDUP_RECORD_SIZE) {
+	device_set_error(dself,
+	    g_strdup(_("Truncated chunk list in data file")),
+	    DEVICE_STATUS_VOLUME_ERROR);
+	return -1;
+    }
+
+    *len = ((gsize)record[DEDUP_HASH_SIZE] << 24)
+	 | ((gsize)record[DEDUP_HASH_SIZE+1] << 16)
+	 | ((gsize)record[DEDUP_HASH_SIZE+2] << 8)
+	 | (gsize)record[DEDUP_HASH_SIZE+3];
+    return 1;
+}
+
+static gboolean
+dedup_load_chunk(
+    DedupDevice *self,
+    const guint8 *record,
+    gsize len)
+{
+    Device *dself = DEVICE(self);
+    char hex[2*DEDUP_HASH_SIZE+1];
+    guint8 md[DEDUP_HASH_SIZE];
+    char *name;
+    int fd;
+
+    dedup_hex(record, hex);
+
+    /* the link of the volume, or the store if the volume was copied without
+     * its links */
+    name = dedup_link_name(self, hex);
+    fd = robust_open(name, O_RDONLY, 0);
+    if (fd < 0 && errno == ENOENT) {
+	g_free(name);
+	name = dedup_store_name(self, hex);
+	fd = robust_open(name, O_RDONLY, 0);
+    }
+    if (fd < 0) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Can't open chunk %s: %s"), name, strerror(errno)),
+	    DEVICE_STATUS_VOLUME_ERROR);
+	g_free(name);
+	return FALSE;
+    }
+
+    if (len > self->chunk_size) {
+	self->chunk_size = len;
+	self->chunk = g_realloc(self->chunk, self->chunk_size);
+    }
+    if (full_read(fd, self->chunk, len) < len) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Can't read chunk %s: %s"), name,
+			    errno ? strerror(errno) : _("it is too short")),
+	    DEVICE_STATUS_VOLUME_ERROR);
+	robust_close(fd);
+	g_free(name);
+	return FALSE;
+    }
+    robust_close(fd);
+
+    dedup_hash(self->chunk, len, md);
+    if (memcmp(md, record, DEDUP_HASH_SIZE) != 0) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Chunk %s is corrupted"), name),
+	    DEVICE_STATUS_VOLUME_ERROR);
+	g_free(name);
+	return FALSE;
+    }
+    g_free(name);
+
+    self->chunk_len = len;
+    self->chunk_off = 0;
+    return TRUE;
+}
+
+static dumpfile_t *
+dedup_device_seek_file(
+    Device *dself,
+    guint requested_file)
+{
+    DedupDevice *self = DEDUP_DEVICE(dself);
+    DeviceClass *parent_class = DEVICE_CLASS(g_type_class_peek_parent(DEDUP_DEVICE_GET_CLASS(dself)));
+
+    dedup_read_reset(self);
+    return parent_class->seek_file(dself, requested_file);
+}
+
+static gboolean
+dedup_device_seek_block(
+    Device *dself,
+    guint64 block)
+{
+    DedupDevice *self = DEDUP_DEVICE(dself);
+    VfsDevice *vself = VFS_DEVICE(dself);
+    guint8 record[DEDUP_RECORD_SIZE];
+    guint64 skip = block * dself->block_size;
+    gsize len;
+    int r;
+
+    g_assert(vself->open_file_fd >= 0);
+    if (device_in_error(self)) return FALSE;
+
+    if (lseek(vself->open_file_fd, VFS_DEVICE_LABEL_SIZE, SEEK_SET) == (off_t)-1) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Error seeking within file: %s"), strerror(errno)),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+    dedup_read_reset(self);
+
+    /* skip the chunks before the block, from their length in the recipe */
+    while (skip > 0) {
+	r = dedup_read_record(self, record, &len);
+	if (r < 0)
+	    return FALSE;
+	if (r == 0)
+	    break;
+	if (len <= skip) {
+	    skip -= len;
+	    continue;
+	}
+	if (!dedup_load_chunk(self, record, len))
+	    return FALSE;
+	self->chunk_off = skip;
+	skip = 0;
+    }
+
+    dself->block = block;
+    return TRUE;
+}
+
+static int
+dedup_device_read_block(
+    Device   *dself,
+    gpointer  data,
+    int      *size_req,
+    int       max_block G_GNUC_UNUSED)
+{
+    DedupDevice *self = DEDUP_DEVICE(dself);
+    guint8 record[DEDUP_RECORD_SIZE];
+    gsize size = 0;
+    gsize len;
+    int r;
+
+    if (device_in_error(self)) return -1;
+
+    if (data == NULL || (gsize)*size_req < dself->block_size) {
+        /* Just a size query. */
+	g_assert(dself->block_size < INT_MAX);
+        *size_req = (int)dself->block_size;
+        return 0;
+    }
+
+    while (size < dself->block_size) {
+	gsize n;
+
+	if (self->chunk_off == self->chunk_len) {
+	    r = dedup_read_record(self, record, &len);
+	    if (r < 0)
+		return -1;
+	    if (r == 0)
+		break;
+	    if (!dedup_load_chunk(self, record, len))
+		return -1;
+	}
+	n = MIN(dself->block_size - size, self->chunk_len - self->chunk_off);
+	memcpy((char *)data + size, self->chunk + self->chunk_off, n);
+	self->chunk_off += n;
+	size += n;
+    }
+
+    if (size == 0) {
+        dself->is_eof = TRUE;
+	g_mutex_lock(dself->device_mutex);
+        dself->in_file = FALSE;
+	g_mutex_unlock(dself->device_mutex);
+	device_set_error(dself,
+	    g_strdup(_("EOF")),
+	    DEVICE_STATUS_SUCCESS);
+        return -1;
+    }
+
+    *size_req = size;
+    g_mutex_lock(dself->device_mutex);
+    dself->bytes_read += size;
+    g_mutex_unlock(dself->device_mutex);
+    dself->block++;
+    return size;
+}
+
+/*
+ * Erasing
+ */
+
+/* Drop the links of the volume, and the chunks of the store no other volume
+ * uses.  A device storing a chunk at the same time finds it gone and stores
+ * it again. */
+static void
+dedup_release_chunks(
+    DedupDevice *self)
+{
+    char *links_dir = dedup_links_dir(self);
+    DIR *dir;
+    struct dirent *entry;
+
+    memset(self->links_fanout, 0, sizeof(self->links_fanout));
+
+    dir = opendir(links_dir);
+    if (!dir) {
+	if (errno != ENOENT)
+	    g_warning("Can't open %s: %s", links_dir, strerror(errno));
+	g_free(links_dir);
+	return;
+    }
+
+    while ((entry = readdir(dir)) != NULL) {
+	char *fanout;
+	DIR *fanout_dir;
+	struct dirent *chunk;
+
+	if (entry->d_name[0] == '.')
+	    continue;
+	fanout = g_strconcat(links_dir, "/", entry->d_name, NULL);
+	fanout_dir = opendir(fanout);
+	if (!fanout_dir) {
+	    g_warning("Can't open %s: %s", fanout, strerror(errno));
+	    g_free(fanout);
+	    continue;
+	}
+	while ((chunk = readdir(fanout_dir)) != NULL) {
+	    char *link_name;
+	    char *store_name;
+	    struct stat st;
+
+	    if (chunk->d_name[0] == '.')
+		continue;
+	    link_name = g_strconcat(fanout, "/", chunk->d_name, NULL);
+	    store_name = g_strconcat(self->chunk_dir, "/", entry->d_name, "/",
+				     chunk->d_name, NULL);
+	    if (unlink(link_name) != 0)
+		g_warning("Can't unlink %s: %s", link_name, strerror(errno));
+	    if (stat(store_name, &st) == 0 && st.st_nlink == 1)
+		unlink(store_name);
+	    g_free(link_name);
+	    g_free(store_name);
+	}
+	closedir(fanout_dir);
+	rmdir(fanout);
+	g_free(fanout);
+    }
+    closedir(dir);
+    rmdir(links_dir);
+    g_free(links_dir);
+}
+
+static gboolean
+dedup_clear_and_prepare_label(
+    Device *dself,
+    char *label,
+    char *timestamp)
+{
+    DedupDevice *self = DEDUP_DEVICE(dself);
+
+    dedup_release_chunks(self);
+    return self->vfs_clear_and_prepare_label(dself, label, timestamp);
+}
+
+static gboolean
+dedup_device_erase(
+    Device *dself)
+{
+    DedupDevice *self = DEDUP_DEVICE(dself);
+    DeviceClass *parent_class = DEVICE_CLASS(g_type_class_peek_parent(DEDUP_DEVICE_GET_CLASS(dself)));
+
+    if (!parent_class->erase(dself))
+	return FALSE;
+
+    dedup_release_chunks(self);
+    return TRUE;
+}
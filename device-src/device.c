@@ -35,6 +35,7 @@
 
 #include "timestamp.h"
 #include "amutil.h"
+#include "amprobe.h"
 
 /*
  * Prototypes for subclass registration functions
@@ -50,9 +51,13 @@ void    tape_device_register    (void);
 #endif
 void    vfs_device_register     (void);
 void    diskflat_device_register (void);
+void    blockdev_device_register (void);
 #ifdef WANT_DVDRW_DEVICE
 void    dvdrw_device_register   (void);
 #endif
+#ifdef WANT_DEDUP_DEVICE
+void    dedup_device_register   (void);
+#endif
 #ifdef WANT_NDMP_DEVICE
 void    ndmp_device_register    (void);
 #endif
@@ -75,6 +80,7 @@ void device_api_init(void) {
     null_device_register();
     vfs_device_register();
     diskflat_device_register();
+    blockdev_device_register();	/* after vfs, for its DIRECT_IO property */
 #ifdef WANT_TAPE_DEVICE
     tape_device_register();
 #endif
@@ -85,6 +91,9 @@ void device_api_init(void) {
 #ifdef WANT_DVDRW_DEVICE
     dvdrw_device_register();
 #endif
+#ifdef WANT_DEDUP_DEVICE
+    dedup_device_register();
+#endif
 #ifdef WANT_NDMP_DEVICE
     ndmp_device_register();
 #endif
@@ -203,8 +212,40 @@ struct DevicePrivate_s {
     /* temporary holding place for device_status_error() */
     char * statusmsg;
     DeviceStatusFlags last_status;
+
+    /* QUEUE_DEPTH, and the queue of the default asynchronous adapter while
+     * a file is written or read through it */
+    guint queue_depth;
+    struct DeviceAsync *async;
 };
 
+/* A block in the queue of the default asynchronous adapter */
+typedef struct AsyncBlock {
+    gpointer data;
+    int size;
+    int result;		/* for a read, what read_block returned */
+    DeviceReleaseFunc release;
+    gpointer release_data;
+} AsyncBlock;
+
+/* The default asynchronous adapter, for the devices that have no
+ * write_block_ref of their own: a worker thread calls the synchronous
+ * write_block or read_block, with up to queue_depth blocks in the queue.
+ * Writes are queued by device_write_block_ref and written in order; reads
+ * are done ahead of device_read_block, up to the end of the file. */
+typedef struct DeviceAsync {
+    GThread *thread;
+    GMutex *mutex;
+    GCond *cond;
+    GQueue *queue;
+    gboolean reading;
+    gboolean busy;	/* the worker is writing or reading a block */
+    gboolean stop;
+    gboolean done;	/* reading: read_block returned an error or EOF */
+    gboolean failed;	/* writing: a queued block was not written */
+    int max_block;	/* reading: the blocks left to read, or -1 */
+} DeviceAsync;
+
 /* This holds the default response to a particular property. */
 typedef struct {
     DeviceProperty *prop;
@@ -257,6 +298,12 @@ static gboolean property_get_canonical_name_fn(Device *self,
     DevicePropertyBase *base, GValue *val,
     PropertySurety *surety, PropertySource *source);
 
+static gboolean property_set_queue_depth_fn(Device *self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source);
+
+static void device_async_stop(Device *self);
+
 /* pointer to the class of our parent */
 static GObjectClass *parent_class = NULL;
 
@@ -291,6 +338,8 @@ static void device_finalize(GObject *obj_self) {
     if(G_OBJECT_CLASS(parent_class)->finalize)
         (* G_OBJECT_CLASS(parent_class)->finalize)(obj_self);
 
+    device_async_stop(self);
+
     /* Here we call device_finish() if it hasn't been done
        yet. Subclasses may need to do this same check earlier. */
     if (self->access_mode != ACCESS_NULL) {
@@ -332,6 +381,8 @@ device_init (Device * self)
     selfp->errmsg = NULL;
     selfp->statusmsg = NULL;
     selfp->last_status = 0;
+    selfp->queue_depth = 0;
+    selfp->async = NULL;
     selfp->simple_properties =
         g_hash_table_new_full(g_direct_hash,
                               g_direct_equal,
@@ -423,6 +474,11 @@ device_base_init (DeviceClass * device_class)
 	    PROPERTY_ACCESS_GET_MASK,
 	    device_simple_property_get_fn,
 	    device_simple_property_set_fn);
+
+    device_class_register_property(device_class, PROPERTY_QUEUE_DEPTH,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    property_set_queue_depth_fn);
 }
 
 static void simple_property_free(SimpleProperty * resp) {
@@ -1017,6 +1073,19 @@ property_get_canonical_name_fn(
     return TRUE;
 }
 
+static gboolean
+property_set_queue_depth_fn(
+	Device *self,
+	DevicePropertyBase *base,
+	GValue *val,
+	PropertySurety surety,
+	PropertySource source)
+{
+    selfp->queue_depth = g_value_get_uint(val);
+
+    return device_simple_property_set_fn(self, base, val, surety, source);
+}
+
 /* util function */
 static PropertyPhaseFlags
 state_to_phase(
@@ -1182,6 +1251,8 @@ device_finish (Device * self) {
 
     g_assert(IS_DEVICE (self));
 
+    device_async_stop(self);
+
     klass = DEVICE_GET_CLASS(self);
     g_assert(klass);
     g_assert(klass->finish);
@@ -1300,10 +1371,235 @@ device_start (Device * self, DeviceAccessMode mode,
     return rv;
 }
 
+/* The default asynchronous adapter */
+
+static gpointer
+device_async_thread(
+    gpointer data)
+{
+    Device *self = DEVICE(data);
+    DeviceClass *klass = DEVICE_GET_CLASS(self);
+    DeviceAsync *async = selfp->async;
+    AsyncBlock *ab;
+    gsize buf_size = self->block_size;
+
+    g_mutex_lock(async->mutex);
+    while (1) {
+	if (async->reading) {
+	    while (!async->stop &&
+		   (async->done || g_queue_get_length(async->queue) >= selfp->queue_depth))
+		g_cond_wait(async->cond, async->mutex);
+	    if (async->stop)
+		break;
+
+	    async->busy = TRUE;
+	    g_mutex_unlock(async->mutex);
+	    ab = g_new0(AsyncBlock, 1);
+	    do {
+		ab->data = g_malloc(buf_size);
+		ab->size = (int)buf_size;
+		AMPROBE2(device__read__block__entry, self, ab->size);
+		ab->result = (klass->read_block)(self, ab->data, &ab->size,
+						 async->max_block);
+		AMPROBE3(device__read__block__return, self, ab->size, ab->result);
+		if (ab->result == 0) {
+		    /* the block is larger than the buffer */
+		    g_free(ab->data);
+		    buf_size = ab->size;
+		}
+	    } while (ab->result == 0);
+	    g_mutex_lock(async->mutex);
+
+	    async->busy = FALSE;
+	    if (ab->result < 0) {
+		async->done = TRUE;
+	    } else if (async->max_block > 0 && --async->max_block == 0) {
+		async->done = TRUE;
+	    }
+	    g_queue_push_tail(async->queue, ab);
+	} else {
+	    gboolean failed;
+	    DeviceWriteResult result = WRITE_FAILED;
+
+	    while (!async->stop && g_queue_is_empty(async->queue))
+		g_cond_wait(async->cond, async->mutex);
+	    if (g_queue_is_empty(async->queue))
+		break;
+
+	    ab = g_queue_pop_head(async->queue);
+	    async->busy = TRUE;
+	    failed = async->failed;
+	    g_mutex_unlock(async->mutex);
+
+	    /* once a block is not written, the next ones are not either */
+	    if (!failed) {
+		AMPROBE2(device__write__block__entry, self, ab->size);
+		result = (*klass->write_block)(self, (guint)ab->size, ab->data);
+		AMPROBE3(device__write__block__return, self, ab->size, result);
+	    }
+	    ab->release(ab->release_data);
+	    g_free(ab);
+	    g_mutex_lock(async->mutex);
+
+	    async->busy = FALSE;
+	    if (result != WRITE_SUCCEED)
+		async->failed = TRUE;
+	}
+	g_cond_broadcast(async->cond);
+    }
+    g_mutex_unlock(async->mutex);
+
+    return NULL;
+}
+
+static void
+device_async_start(
+    Device *self,
+    gboolean reading,
+    int max_block)
+{
+    DeviceAsync *async = g_new0(DeviceAsync, 1);
+
+    async->mutex = g_mutex_new();
+    async->cond = g_cond_new();
+    async->queue = g_queue_new();
+    async->reading = reading;
+    async->max_block = max_block;
+    selfp->async = async;
+    async->thread = g_thread_create(device_async_thread, self, TRUE, NULL);
+}
+
+/* Stop the worker; the queued writes are done first, the blocks read ahead
+ * are dropped.  Returns FALSE if a queued write failed. */
+static gboolean
+device_async_stop_and_check(
+    Device *self)
+{
+    DeviceAsync *async = selfp->async;
+    AsyncBlock *ab;
+    gboolean failed;
+
+    if (!async)
+	return TRUE;
+
+    g_mutex_lock(async->mutex);
+    async->stop = TRUE;
+    g_cond_broadcast(async->cond);
+    g_mutex_unlock(async->mutex);
+    g_thread_join(async->thread);
+
+    failed = async->failed;
+    while ((ab = g_queue_pop_head(async->queue))) {
+	g_free(ab->data);
+	g_free(ab);
+    }
+    g_queue_free(async->queue);
+    g_cond_free(async->cond);
+    g_mutex_free(async->mutex);
+    g_free(async);
+    selfp->async = NULL;
+
+    return !failed;
+}
+
+static void
+device_async_stop(
+    Device *self)
+{
+    device_async_stop_and_check(self);
+}
+
+/* Queue a block for the worker.  A failure is the one of an earlier block:
+ * that block, and the ones after it, were not written, so this is always
+ * WRITE_FAILED and not the WRITE_FULL or WRITE_SPACE the device saw.  */
+static DeviceWriteResult
+device_async_write_block(
+    Device *self,
+    guint size,
+    gpointer block,
+    DeviceReleaseFunc release,
+    gpointer release_data)
+{
+    DeviceAsync *async;
+    AsyncBlock *ab;
+
+    if (!selfp->async)
+	device_async_start(self, FALSE, -1);
+    async = selfp->async;
+
+    g_mutex_lock(async->mutex);
+    while (!async->failed &&
+	   g_queue_get_length(async->queue) + (async->busy ? 1 : 0) >= selfp->queue_depth)
+	g_cond_wait(async->cond, async->mutex);
+    if (async->failed) {
+	g_mutex_unlock(async->mutex);
+	return WRITE_FAILED;
+    }
+
+    ab = g_new0(AsyncBlock, 1);
+    ab->data = block;
+    ab->size = (int)size;
+    ab->release = release;
+    ab->release_data = release_data;
+    g_queue_push_tail(async->queue, ab);
+    g_cond_broadcast(async->cond);
+    g_mutex_unlock(async->mutex);
+
+    return WRITE_SUCCEED;
+}
+
+/* Take the next block read ahead by the worker; returns -2 if the worker
+ * stopped reading before the caller did, for the caller to read the block
+ * itself. */
+static int
+device_async_read_block(
+    Device *self,
+    gpointer buffer,
+    int *size,
+    int max_block)
+{
+    DeviceAsync *async;
+    AsyncBlock *ab;
+    int result;
+
+    if (!selfp->async)
+	device_async_start(self, TRUE, max_block);
+    async = selfp->async;
+
+    g_mutex_lock(async->mutex);
+    while (g_queue_is_empty(async->queue) && !async->done)
+	g_cond_wait(async->cond, async->mutex);
+    ab = g_queue_peek_head(async->queue);
+    if (!ab) {
+	g_mutex_unlock(async->mutex);
+	return -2;
+    }
+
+    if (ab->result > 0 && ab->size > *size) {
+	/* the caller must give a larger buffer */
+	*size = ab->size;
+	g_mutex_unlock(async->mutex);
+	return 0;
+    }
+    g_queue_pop_head(async->queue);
+    g_cond_broadcast(async->cond);
+    g_mutex_unlock(async->mutex);
+
+    result = ab->result;
+    if (result > 0)
+	memcpy(buffer, ab->data, ab->size);
+    *size = ab->size;
+    g_free(ab->data);
+    g_free(ab);
+
+    return result;
+}
+
 DeviceWriteResult
 device_write_block (Device * self, guint size, gpointer block)
 {
     DeviceClass *klass;
+    DeviceWriteResult result;
 
     g_assert(IS_DEVICE (self));
     g_assert(size > 0);
@@ -1322,7 +1618,57 @@ device_write_block (Device * self, guint size, gpointer block)
     klass = DEVICE_GET_CLASS(self);
     g_assert(klass);
     g_assert(klass->write_block);
-    return (*klass->write_block)(self,size, block);
+    AMPROBE2(device__write__block__entry, self, size);
+    result = (*klass->write_block)(self,size, block);
+    AMPROBE3(device__write__block__return, self, size, result);
+    return result;
+}
+
+DeviceWriteResult
+device_write_block_ref (Device * self, guint size, gpointer block,
+			DeviceReleaseFunc release, gpointer release_data)
+{
+    DeviceClass *klass;
+    DeviceWriteResult result;
+
+    klass = DEVICE_GET_CLASS(self);
+    g_assert(klass);
+    if (!klass->write_block_ref && selfp->queue_depth > 0) {
+	g_assert(size > 0);
+	g_assert(size <= self->block_size);
+	g_assert(self->in_file);
+	g_assert(!selfp->wrote_short_block);
+	g_assert(block != NULL);
+	g_assert(IS_WRITABLE_ACCESS_MODE(self->access_mode));
+
+	if (size < self->block_size)
+	    selfp->wrote_short_block = TRUE;
+
+	return device_async_write_block(self, size, block, release, release_data);
+    }
+    if (!klass->write_block_ref) {
+	/* the device copies the block */
+	result = device_write_block(self, size, block);
+	if (result == WRITE_SUCCEED)
+	    release(release_data);
+	return result;
+    }
+
+    g_assert(IS_DEVICE (self));
+    g_assert(size > 0);
+    g_assert(size <= self->block_size);
+    g_assert(self->in_file);
+    g_assert(!selfp->wrote_short_block);
+    g_assert(block != NULL);
+    g_assert(IS_WRITABLE_ACCESS_MODE(self->access_mode));
+
+    if (size < self->block_size)
+	selfp->wrote_short_block = TRUE;
+
+    AMPROBE2(device__write__block__entry, self, size);
+    result = (*klass->write_block_ref)(self, size, block, release, release_data);
+    AMPROBE3(device__write__block__return, self, size, result);
+    return result;
 }
 
 gboolean
@@ -1346,14 +1692,19 @@ device_finish_file (Device * self)
 {
     DeviceClass *klass;
 
+    gboolean queued_ok;
+
     g_assert(IS_DEVICE (self));
     g_assert(IS_WRITABLE_ACCESS_MODE(self->access_mode));
     g_assert(self->in_file);
 
+    /* the file is finished even if a queued block was not written */
+    queued_ok = device_async_stop_and_check(self);
+
     klass = DEVICE_GET_CLASS(self);
     g_assert(klass);
     g_assert(klass->finish_file);
-    return (klass->finish_file)(self);
+    return (klass->finish_file)(self) && queued_ok;
 }
 
 gboolean
@@ -1381,12 +1732,46 @@ device_seek_file (Device * self, guint file)
     g_assert(IS_DEVICE (self));
     g_assert(file == 0 || self->access_mode == ACCESS_READ);
 
+    device_async_stop(self);
+
     klass = DEVICE_GET_CLASS(self);
     g_assert(klass);
     g_assert(klass->seek_file);
     return (klass->seek_file)(self,file);
 }
 
+void
+device_prefetch_file (Device * self, guint file)
+{
+    DeviceClass *klass;
+
+    g_assert(IS_DEVICE (self));
+    g_assert(self->access_mode == ACCESS_READ);
+
+    klass = DEVICE_GET_CLASS(self);
+    g_assert(klass);
+    if (klass->prefetch_file) {
+        (klass->prefetch_file)(self,file);
+    }
+}
+
+gboolean
+device_recommended_order (Device * self, DeviceFileExtent *extents,
+			  guint count)
+{
+    DeviceClass *klass;
+
+    g_assert(IS_DEVICE (self));
+    g_assert(self->access_mode == ACCESS_READ);
+    g_assert(!self->in_file);
+
+    klass = DEVICE_GET_CLASS(self);
+    g_assert(klass);
+    if (count < 2 || !klass->recommended_order)
+	return FALSE;
+    return (klass->recommended_order)(self, extents, count);
+}
+
 gboolean
 device_seek_block (Device * self, guint64 block)
 {
@@ -1396,6 +1781,8 @@ device_seek_block (Device * self, guint64 block)
     g_assert(self->access_mode == ACCESS_READ);
     g_assert(self->in_file);
 
+    device_async_stop(self);
+
     klass = DEVICE_GET_CLASS(self);
     g_assert(klass);
     g_assert(klass->seek_block);
@@ -1406,6 +1793,7 @@ int
 device_read_block (Device * self, gpointer buffer, int * size, int max_block)
 {
     DeviceClass *klass;
+    int result;
 
     g_assert(IS_DEVICE (self));
     g_assert(size != NULL);
@@ -1415,10 +1803,23 @@ device_read_block (Device * self, gpointer buffer, int * size, int max_block)
 	g_assert(buffer != NULL);
     }
 
+    /* the device leaves the file when the worker reads its end, before the
+     * caller got all of the blocks */
+    if ((selfp->async && selfp->async->reading) ||
+	(selfp->queue_depth > 0 && self->in_file && *size > 0)) {
+	result = device_async_read_block(self, buffer, size, max_block);
+	if (result != -2)
+	    return result;
+	device_async_stop(self);
+    }
+
     klass = DEVICE_GET_CLASS(self);
     g_assert(klass);
     g_assert(klass->read_block);
-    return (klass->read_block)(self,buffer,size,max_block);
+    AMPROBE2(device__read__block__entry, self, *size);
+    result = (klass->read_block)(self,buffer,size,max_block);
+    AMPROBE3(device__read__block__return, self, *size, result);
+    return result;
 }
 
 gboolean
@@ -1498,6 +1899,20 @@ device_erase (Device * self)
     }
 }
 
+void
+device_cancel (Device * self)
+{
+    DeviceClass *klass;
+
+    g_assert(IS_DEVICE (self));
+
+    klass = DEVICE_GET_CLASS(self);
+    g_assert(klass);
+    if (klass->cancel) {
+	(klass->cancel)(self);
+    }
+}
+
 gboolean
 device_eject (Device * self)
 {
@@ -1671,6 +2086,47 @@ device_check_writable(
     }
 }
 
+gboolean
+device_can_copy_file_from(
+    Device *self,
+    Device *src)
+{
+    DeviceClass *klass;
+
+    klass = DEVICE_GET_CLASS(self);
+    if (klass->can_copy_file_from) {
+	return (klass->can_copy_file_from)(self, src);
+    } else {
+	return FALSE;
+    }
+}
+
+gboolean
+device_copy_file_from(
+    Device *self,
+    Device *src,
+    dumpfile_t *jobInfo,
+    guint64 *size)
+{
+    DeviceClass *klass;
+
+    g_assert(IS_WRITABLE_ACCESS_MODE(self->access_mode));
+    g_assert(!self->in_file);
+    g_assert(src->in_file);
+    g_assert(src->access_mode == ACCESS_READ);
+
+    *size = 0;
+    klass = DEVICE_GET_CLASS(self);
+    if (klass->copy_file_from) {
+	return (klass->copy_file_from)(self, src, jobInfo, size);
+    } else {
+	device_set_error(self,
+	    g_strdup(_("Unimplemented method")),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+}
+
 gboolean
 device_have_set_reuse(
     Device *self)
@@ -57,6 +57,18 @@ typedef enum {
     WRITE_FULL		/* nothing was written, volume is full        */
 } DeviceWriteResult;
 
+/* Called once a device no longer needs a block given to device_write_block_ref */
+typedef void (*DeviceReleaseFunc)(gpointer release_data);
+
+/* A file to read, for device_recommended_order: its number, and the logical
+ * objects (blocks and filemarks, counted from the start of the volume) where
+ * it starts and ends */
+typedef struct {
+    guint file;
+    guint64 first_object;
+    guint64 last_object;
+} DeviceFileExtent;
+
 #define IS_WRITABLE_ACCESS_MODE(mode) ((mode) == ACCESS_WRITE || \
                                        (mode) == ACCESS_APPEND)
 
@@ -197,9 +209,15 @@ struct _DeviceClass {
     gboolean (* start_file) (Device * self, dumpfile_t * info);
     DeviceWriteResult (* write_block) (Device * self, guint size,
 				       gpointer data);
+    DeviceWriteResult (* write_block_ref) (Device * self, guint size,
+				       gpointer data, DeviceReleaseFunc release,
+				       gpointer release_data);
     gboolean (* finish_file) (Device * self);
     gboolean (* init_seek_file) (Device * self, guint file);
     dumpfile_t* (* seek_file) (Device * self, guint file);
+    void (* prefetch_file) (Device * self, guint file);
+    gboolean (* recommended_order) (Device * self, DeviceFileExtent *extents,
+				    guint count);
     gboolean (* seek_block) (Device * self, guint64 block);
     int (* read_block) (Device * self, gpointer buf, int * size, int max_block);
     gboolean (* property_get_ex) (Device * self, DevicePropertyId id,
@@ -215,6 +233,7 @@ struct _DeviceClass {
     gboolean (* erase) (Device * self);
     gboolean (* eject) (Device * self);
     gboolean (* finish) (Device * self);
+    void     (* cancel) (Device * self);
     guint64  (* get_bytes_read) (Device * self);
     guint64  (* clear_bytes_read) (Device * self);
     guint64  (* get_bytes_written) (Device * self);
@@ -249,6 +268,11 @@ struct _DeviceClass {
     gboolean (* create) (Device * self);
     gboolean (* sync_catalog) (Device * self, int request, int wait, char **slot_names);
 
+    /* server-side copy, see device_copy_file_from */
+    gboolean (* can_copy_file_from)(Device *self, Device *src);
+    gboolean (* copy_file_from)(Device *self, Device *src, dumpfile_t *jobInfo,
+				guint64 *size);
+
     /* array of DeviceProperty objects for this class, keyed by ID */
     GArray *class_properties;
 
@@ -350,13 +374,40 @@ gboolean        device_start_file       (Device * self,
 DeviceWriteResult device_write_block	(Device * self,
                                          guint size,
                                          gpointer data);
+/* Like device_write_block, but the device may keep using DATA after returning
+ * instead of copying it.  If the result is WRITE_SUCCEED, RELEASE is called
+ * with RELEASE_DATA, possibly from another thread and possibly before this
+ * returns, once the device no longer needs DATA; the caller must not change
+ * DATA until then.  Otherwise RELEASE is not called.  Every block is released
+ * by the time device_finish_file returns.  For a device without a
+ * write_block_ref method, the QUEUE_DEPTH property has a worker thread write
+ * the blocks; a block that it fails to write makes the next calls and
+ * device_finish_file fail. */
+DeviceWriteResult device_write_block_ref	(Device * self,
+                                         guint size,
+                                         gpointer data,
+                                         DeviceReleaseFunc release,
+                                         gpointer release_data);
 gboolean 	device_finish_file	(Device * self);
 gboolean	device_init_seek_file	(Device * self,
 					guint file);
 dumpfile_t* 	device_seek_file	(Device * self,
 					guint file);
+/* A hint that the next seek_file will be to FILE, while the current file is
+ * still read; the device may start to locate it.  Optional. */
+void		device_prefetch_file	(Device * self,
+					guint file);
+/* Sort the COUNT files of EXTENTS in the order the device recommends to read
+ * them from its current position.  Returns FALSE, leaving them as they are,
+ * if it has no recommendation, as most devices.  Optional. */
+gboolean	device_recommended_order	(Device * self,
+					DeviceFileExtent *extents,
+					guint count);
 gboolean 	device_seek_block	(Device * self,
 					guint64 block);
+/* With the QUEUE_DEPTH property, the blocks are read ahead by a worker thread,
+ * from the first device_read_block up to the end of the file, MAX_BLOCK, or
+ * the next seek; the device's position is then ahead of the caller's. */
 int 	device_read_block	(Device * self, gpointer buffer, int * size, int max_block);
 const GSList *	device_property_get_list	(Device * self);
 gboolean 	device_property_get_ex	(Device * self,
@@ -380,6 +431,13 @@ gboolean 	device_recycle_file	(Device * self,
 gboolean 	device_erase	(Device * self);
 gboolean 	device_eject	(Device * self);
 
+/* Ask the device to give up the operation in progress as soon as it can; that
+ * operation fails.  This may be called from any thread, and is how a cancelled
+ * transfer interrupts a device that waits on the network.  The device stops
+ * cancelling once the operations in progress are done (in device_finish_file
+ * or device_finish, for example) so that the cleanup can proceed.  Optional. */
+void		device_cancel	(Device * self);
+
 #define device_directtcp_supported(self) (DEVICE_GET_CLASS((self))->directtcp_supported)
 gboolean device_listen(Device *self, gboolean for_writing, DirectTCPAddr **addrs);
 int device_accept(Device *self, DirectTCPConnection **conn,
@@ -404,6 +462,16 @@ gboolean device_create(Device *self);
 gboolean device_sync_catalog(Device * self, int request, int wait,
 			     char **slot_names);
 
+/* Copy the file SRC is positioned on (with device_seek_file) to a new file of
+ * SELF, with the header JOBINFO, without the data going through this process:
+ * it is the same as device_start_file, writing every block of the source and
+ * device_finish_file, but done by the storage itself.  SIZE is set to the
+ * number of bytes copied.  device_can_copy_file_from tells whether SELF can do
+ * it from SRC; it is FALSE if the device does not implement the copy. */
+gboolean device_can_copy_file_from(Device *self, Device *src);
+gboolean device_copy_file_from(Device *self, Device *src, dumpfile_t *jobInfo,
+			       guint64 *size);
+
 /* Protected methods. Don't call these except in subclass implementations. */
 
 /* This method provides post-construction initalization once the
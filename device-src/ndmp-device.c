@@ -75,6 +75,10 @@ struct NdmpDevice_ {
     gchar	 *ndmp_auth;
     gboolean	 verbose;
     gsize	 read_block_size;
+    guint	 write_window;	/* NDMP_TAPE_WRITEs kept in flight */
+
+    /* copies of the blocks whose write is in flight, oldest first */
+    GQueue	*write_queue;
 
     GMutex	*abort_mutex;
     GCond	*abort_cond;
@@ -151,10 +155,12 @@ static DevicePropertyBase device_property_ndmp_username;
 static DevicePropertyBase device_property_ndmp_password;
 static DevicePropertyBase device_property_ndmp_auth;
 static DevicePropertyBase device_property_indirect;
+static DevicePropertyBase device_property_ndmp_write_window;
 #define PROPERTY_NDMP_USERNAME (device_property_ndmp_username.ID)
 #define PROPERTY_NDMP_PASSWORD (device_property_ndmp_password.ID)
 #define PROPERTY_NDMP_AUTH (device_property_ndmp_auth.ID)
 #define PROPERTY_INDIRECT (device_property_indirect.ID)
+#define PROPERTY_NDMP_WRITE_WINDOW (device_property_ndmp_write_window.ID)
 
 
 /*
@@ -163,6 +169,7 @@ static DevicePropertyBase device_property_indirect;
 
 void ndmp_device_register(void);
 static void set_error_from_ndmp(NdmpDevice *self);
+static gboolean write_pending_reap(NdmpDevice *self, guint keep);
 
 #define ndmp_device_read_size(self) \
     (((NdmpDevice *)(self))->read_block_size? \
@@ -266,6 +273,11 @@ static gboolean
 close_tape_agent(
 	NdmpDevice *self)
 {
+    gboolean rval = TRUE;
+
+    if (self->ndmp && !g_queue_is_empty(self->write_queue))
+	rval = write_pending_reap(self, 0);
+
     if (self->tape_open) {
 	g_debug("closing tape device '%s' on NDMP server '%s:%d'",
 	    self->ndmp_device_name, self->ndmp_hostname, self->ndmp_port);
@@ -276,7 +288,7 @@ close_tape_agent(
 	}
     }
 
-    return TRUE;
+    return rval;
 }
 
 static gboolean
@@ -356,6 +368,96 @@ robust_write(
     return ROBUST_WRITE_OK;
 }
 
+/*
+ * Pipelined writes: with NDMP_WRITE_WINDOW above 1, write_block sends up to
+ * that many NDMP_TAPE_WRITEs before reading the reply to the oldest, so the
+ * round trips to the tape server overlap.  A copy of each block stays on
+ * write_queue until its reply is in.
+ *
+ * A tape server signals LEOM by failing one write with NDMP9_EOM_ERR and
+ * accepting the next, which may already be in flight.  So after a failed
+ * write all the pending replies are collected: if none of the later writes
+ * landed, the blocks are written again, in order; if one did, the data on
+ * the volume is out of order and the device goes in error.
+ */
+static gboolean
+write_pending_failed(
+    NdmpDevice *self)
+{
+    Device *dself = DEVICE(self);
+    ndmp9_error err = ndmp_connection_err_code(self->ndmp);
+    gboolean landed = FALSE;
+    guint64 actual;
+    gpointer buf;
+
+    if (err != NDMP9_EOM_ERR && err != NDMP9_IO_ERR)
+	set_error_from_ndmp(self);
+
+    while (self->ndmp->tape_writes_pending > 0) {
+	if (ndmp_connection_tape_write_recv(self->ndmp, &actual))
+	    landed = TRUE;
+    }
+
+    if (err == NDMP9_EOM_ERR && !landed) {
+	g_debug("ndmp device hit logical EOM with %u writes in flight",
+		self->write_queue->length);
+	dself->is_eom = TRUE;
+	while ((buf = g_queue_pop_head(self->write_queue)) != NULL) {
+	    robust_write_result result;
+
+	    result = robust_write(self, buf, dself->block_size);
+	    g_free(buf);
+	    if (result == ROBUST_WRITE_NO_SPACE) {
+		err = NDMP9_IO_ERR;
+		break;
+	    } else if (result == ROBUST_WRITE_ERROR) {
+		/* error was set by robust_write */
+		break;
+	    }
+	}
+	if (buf == NULL)
+	    return TRUE;
+    } else if (err == NDMP9_EOM_ERR) {
+	device_set_error(dself,
+	    g_strdup(_("NDMP server wrote blocks after a write failed at logical EOM; set NDMP_WRITE_WINDOW to 1")),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	dself->is_eom = TRUE;
+    }
+
+    if (err == NDMP9_IO_ERR) {
+	/* PEOM; this only happens when the caller ignores LEOM */
+	device_set_error(dself,
+	    g_strdup(_("No space left on device")),
+	    DEVICE_STATUS_VOLUME_ERROR);
+	dself->is_eom = TRUE;
+    }
+
+    while ((buf = g_queue_pop_head(self->write_queue)) != NULL)
+	g_free(buf);
+    return FALSE;
+}
+
+/*
+ * Collect the replies to the oldest pending writes, until at most keep are
+ * left in flight.
+ */
+static gboolean
+write_pending_reap(
+    NdmpDevice *self,
+    guint keep)
+{
+    guint64 actual;
+
+    while (self->write_queue->length > keep) {
+	if (!ndmp_connection_tape_write_recv(self->ndmp, &actual))
+	    return write_pending_failed(self);
+	g_assert(actual == DEVICE(self)->block_size);
+	g_free(g_queue_pop_head(self->write_queue));
+    }
+
+    return TRUE;
+}
+
 static void
 set_error_from_ndmp(
     NdmpDevice *self)
@@ -471,6 +573,7 @@ static void ndmp_device_finalize(GObject * obj_self)
 	g_free(self->ndmp_auth);
     if (self->indirecttcp_sock != -1)
 	close(self->indirecttcp_sock);
+    g_queue_free(self->write_queue);
 }
 
 static DeviceStatusFlags
@@ -837,27 +940,56 @@ ndmp_device_write_block(
         size = dself->block_size;
     }
 
-    switch (robust_write(self, data, size)) {
-	case ROBUST_WRITE_OK_LEOM:
-	    dself->is_eom = TRUE;
-	    /* fall through */
-
-	case ROBUST_WRITE_OK:
-	    break;
+    if (self->write_window > 1) {
+	/* keep a copy until the write is answered; see write_pending_failed */
+	if (!replacement_buffer) {
+	    replacement_buffer = g_try_malloc(size);
+	    if (replacement_buffer == NULL) {
+		device_set_error(dself,
+		    g_strdup(_("Cannot allocate memory")),
+			    DEVICE_STATUS_DEVICE_ERROR);
+		return WRITE_FAILED;
+	    }
+	    memcpy(replacement_buffer, data, size);
+	}
 
-	case ROBUST_WRITE_NO_SPACE:
-	    /* this would be an odd error to see writing the tape label, but
-	     * oh well */
-	    device_set_error(dself,
-		g_strdup(_("No space left on device")),
-		DEVICE_STATUS_VOLUME_ERROR);
-	    dself->is_eom = TRUE;
-	    /* fall through */
+	if (!write_pending_reap(self, self->write_window - 1)) {
+	    /* error was set by write_pending_reap */
+	    g_free(replacement_buffer);
+	    return WRITE_FAILED;
+	}
 
-	case ROBUST_WRITE_ERROR:
-	    /* error was set by robust_write or above */
-	    if (replacement_buffer) g_free(replacement_buffer);
+	if (!ndmp_connection_tape_write_send(self->ndmp,
+					     replacement_buffer, size)) {
+	    set_error_from_ndmp(self);
+	    g_free(replacement_buffer);
 	    return WRITE_FAILED;
+	}
+	g_queue_push_tail(self->write_queue, replacement_buffer);
+	replacement_buffer = NULL;
+    } else {
+	switch (robust_write(self, data, size)) {
+	    case ROBUST_WRITE_OK_LEOM:
+		dself->is_eom = TRUE;
+		/* fall through */
+
+	    case ROBUST_WRITE_OK:
+		break;
+
+	    case ROBUST_WRITE_NO_SPACE:
+		/* this would be an odd error to see writing the tape label, but
+		 * oh well */
+		device_set_error(dself,
+		    g_strdup(_("No space left on device")),
+		    DEVICE_STATUS_VOLUME_ERROR);
+		dself->is_eom = TRUE;
+		/* fall through */
+
+	    case ROBUST_WRITE_ERROR:
+		/* error was set by robust_write or above */
+		if (replacement_buffer) g_free(replacement_buffer);
+		return WRITE_FAILED;
+	}
     }
 
     dself->block++;
@@ -885,6 +1017,12 @@ ndmp_device_finish_file(
 
     if (device_in_error(dself)) return FALSE;
 
+    /* the file mark goes after the writes still in flight */
+    if (!write_pending_reap(self, 0)) {
+	/* error was set by write_pending_reap */
+	return FALSE;
+    }
+
     if (!single_ndmp_mtio(self, NDMP9_MTIO_EOF)) {
 	/* error was set by single_ndmp_mtio */
         dself->is_eom = TRUE;
@@ -1986,6 +2124,26 @@ ndmp_device_set_read_block_size_fn(Device *p_self, DevicePropertyBase *base G_GN
 					val, surety, source);
 }
 
+static gboolean
+ndmp_device_set_write_window_fn(Device *dself,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source)
+{
+    NdmpDevice *self = NDMP_DEVICE(dself);
+    guint write_window = g_value_get_uint(val);
+
+    if (write_window < 1) {
+	device_set_error(dself,
+	    g_strdup_printf("Error setting NDMP-WRITE-WINDOW property to '%u', it must be at least 1", write_window),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+
+    self->write_window = write_window;
+
+    return device_simple_property_set_fn(dself, base, val, surety, source);
+}
+
 static gboolean
 ndmp_device_set_indirect_fn(Device *dself,
     DevicePropertyBase *base, GValue *val,
@@ -2081,6 +2239,11 @@ ndmp_device_class_init(NdmpDeviceClass * c G_GNUC_UNUSED)
 	    device_simple_property_get_fn,
 	    ndmp_device_set_leom_fn);
 
+    device_class_register_property(device_class, PROPERTY_NDMP_WRITE_WINDOW,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    ndmp_device_set_write_window_fn);
+
 }
 
 static void
@@ -2177,6 +2340,14 @@ ndmp_device_init(NdmpDevice *self)
     g_value_unset(&response);
     self->indirect = TRUE;
 
+    self->write_window = 1;
+    g_value_init(&response, G_TYPE_UINT);
+    g_value_set_uint(&response, self->write_window);
+    device_set_simple_property(dself, PROPERTY_NDMP_WRITE_WINDOW,
+	    &response, PROPERTY_SURETY_GOOD, PROPERTY_SOURCE_DEFAULT);
+    g_value_unset(&response);
+    self->write_queue = g_queue_new();
+
     self->indirecttcp_sock = -1;
 }
 
@@ -2241,6 +2412,9 @@ ndmp_device_register(void)
                                       G_TYPE_BOOLEAN, "indirect",
        "Use Indirect TCP mode, even if the NDMP server supports "
        "window length 0");
+    device_property_fill_and_register(&device_property_ndmp_write_window,
+                                      G_TYPE_UINT, "ndmp_write_window",
+       "Number of tape writes kept in flight to the NDMP server");
 }
 
 /*
@@ -272,6 +272,21 @@ void device_property_init(void) {
     device_property_fill_and_register(&device_property_proxy,
                                       G_TYPE_STRING, "proxy",
        "The proxy");
+    device_property_fill_and_register(&device_property_drive_bytes_from_host,
+                                      G_TYPE_UINT64, "drive_bytes_from_host",
+       "Bytes the drive received from the host");
+    device_property_fill_and_register(&device_property_drive_bytes_to_medium,
+                                      G_TYPE_UINT64, "drive_bytes_to_medium",
+       "Bytes the drive wrote to the medium, after compression");
+    device_property_fill_and_register(&device_property_drive_write_rewrites,
+                                      G_TYPE_UINT64, "drive_write_rewrites",
+       "Blocks the drive had to rewrite");
+    device_property_fill_and_register(&device_property_drive_write_errors,
+                                      G_TYPE_UINT64, "drive_write_errors",
+       "Write errors the drive could not correct");
+    device_property_fill_and_register(&device_property_queue_depth,
+                                      G_TYPE_UINT, "queue_depth",
+       "Number of blocks written or read ahead by a worker thread");
 }
 
 DevicePropertyBase device_property_concurrency;
@@ -300,3 +315,8 @@ DevicePropertyBase device_property_nb_threads_recovery;
 DevicePropertyBase device_property_multi_part_upload;
 DevicePropertyBase device_property_ssl_ca_info;
 DevicePropertyBase device_property_proxy;
+DevicePropertyBase device_property_drive_bytes_from_host;
+DevicePropertyBase device_property_drive_bytes_to_medium;
+DevicePropertyBase device_property_drive_write_rewrites;
+DevicePropertyBase device_property_drive_write_errors;
+DevicePropertyBase device_property_queue_depth;
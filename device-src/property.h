@@ -287,4 +287,22 @@ extern DevicePropertyBase device_property_ssl_ca_info;
 /* proxy */
 extern DevicePropertyBase device_property_proxy;
 #define PROPERTY_PROXY (device_property_proxy.ID)
+
+/* Counters kept by the drive itself, as guint64: the bytes written by the
+   host and, after the drive's compression, to the medium; the blocks it
+   had to rewrite, and the write errors it could not correct. */
+extern DevicePropertyBase device_property_drive_bytes_from_host;
+#define PROPERTY_DRIVE_BYTES_FROM_HOST (device_property_drive_bytes_from_host.ID)
+extern DevicePropertyBase device_property_drive_bytes_to_medium;
+#define PROPERTY_DRIVE_BYTES_TO_MEDIUM (device_property_drive_bytes_to_medium.ID)
+extern DevicePropertyBase device_property_drive_write_rewrites;
+#define PROPERTY_DRIVE_WRITE_REWRITES (device_property_drive_write_rewrites.ID)
+extern DevicePropertyBase device_property_drive_write_errors;
+#define PROPERTY_DRIVE_WRITE_ERRORS (device_property_drive_write_errors.ID)
+
+/* The number of blocks, as a guint, that a worker thread may write or read
+   ahead for a device that does it synchronously; zero (the default) for no
+   worker. */
+extern DevicePropertyBase device_property_queue_depth;
+#define PROPERTY_QUEUE_DEPTH (device_property_queue_depth.ID)
 #endif
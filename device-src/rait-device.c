@@ -31,6 +31,13 @@
 #include "device.h"
 #include "fileheader.h"
 #include "amsemaphore.h"
+#include "amexec.h"
+#if defined(__SSE2__) || defined(HAVE_XOR_AVX2) || defined(HAVE_XOR_AVX512)
+#include <immintrin.h>
+#endif
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
 
 /* Just a note about the failure mode of different operations:
    - Recovers from a failure (enters degraded mode)
@@ -83,60 +90,69 @@ struct _RaitDeviceClass {
 
 typedef enum {
     RAIT_STATUS_COMPLETE, /* All subdevices OK. */
-    RAIT_STATUS_DEGRADED, /* One subdevice failed. */
-    RAIT_STATUS_FAILED    /* Two or more subdevices failed. */
+    RAIT_STATUS_DEGRADED, /* No more subdevices failed than there are parity
+                             subdevices. */
+    RAIT_STATUS_FAILED    /* More subdevices failed. */
 } RaitStatus;
 
-/* Older versions of glib have a deadlock in their thread pool implementations,
- * so we include a simple thread-pool implementation here to replace it.
+/* Each RAIT device keeps its own worker threads, rather than building a
+ * GThreadPool for each operation: thread i runs the i-th op of every
+ * operation on the children, which is child i's unless a child failed.
+ * Each thread runs the jobs queued to it in order.  The parity slices are
+ * run by another set of threads, so that they never wait behind a child.
  *
- * This implementation assumes that threads are used for paralellizing a single
- * operation, so all threads run a function to completion before the main thread
- * continues.  This simplifies some of the locking semantics, and in particular
- * there is no need to wait for stray threads to finish an operation when
- * finalizing the RaitDevice object or when beginning a new operation.
+ * Except for writes, all threads run an operation to completion before the
+ * main thread continues.  write_block only queues each child's chunk to its
+ * thread, and returns as soon as the slowest child is less than
+ * RAIT_WRITE_WINDOW blocks behind; any other operation on the children
+ * first waits for the queued writes, and a failed write is reported by
+ * the next write_block or finish_file.
  */
-#if !(GLIB_CHECK_VERSION(2,10,0))
-#define USE_INTERNAL_THREADPOOL
-#endif
+#define RAIT_WRITE_WINDOW 4
+
+typedef struct RaitWorkers_s {
+    /* an amexec_queue_t * for each child, running one job at a time so
+     * the jobs of a child are done in order */
+    GPtrArray *queues;
+    const char *name;
+    int flags;		/* AMEXEC_BLOCKING for operations on the children */
+
+    /* value of this semaphore is the number of threaded operations
+     * in progress */
+    amsemaphore_t *sem;
+} RaitWorkers;
 
 typedef struct RaitDevicePrivate_s {
     GPtrArray * children;
+    /* the number of parity children, from the device name; 1 by default,
+       for XOR parity */
+    guint nparity;
     /* These flags are only relevant for reading. */
     RaitStatus status;
-    /* If status == RAIT_STATUS_DEGRADED, this holds the index of the
-       failed node. It holds a negative number otherwise. */
-    int failed;
+    /* a gboolean for each child, TRUE if it failed, and their count */
+    GArray * failed;
+    guint nfailed;
 
     /* the child block size */
     gsize child_block_size;
 
-#ifdef USE_INTERNAL_THREADPOOL
-    /* array of ThreadInfo for performing parallel operations */
-    GArray *threads;
+    /* for the operations on the children, and for the parity */
+    RaitWorkers child_workers;
+    RaitWorkers parity_workers;
 
-    /* value of this semaphore is the number of threaded operations
-     * in progress */
-    amsemaphore_t *threads_sem;
-#endif
+    /* pipelined writes; protected by write_mutex */
+    GMutex *write_mutex;
+    GCond *write_cond;
+    guint *write_queued;	/* blocks queued to each child */
+    guint nwrite_queued;	/* length of write_queued */
+    gboolean write_failed;	/* a write failed since start_file */
 } RaitDevicePrivate;
 
-#ifdef USE_INTERNAL_THREADPOOL
-typedef struct ThreadInfo {
-    GThread *thread;
-
-    /* struct fields below are protected by this mutex and condition variable */
-    GMutex *mutex;
-    GCond *cond;
-
-    gboolean die;
+typedef struct ThreadJob {
     GFunc func;
     gpointer data;
-
-    /* give threads access to active_threads and its mutex/cond */
-    struct RaitDevicePrivate_s *private;
-} ThreadInfo;
-#endif
+    amsemaphore_t *done;	/* to be decremented when done, or NULL */
+} ThreadJob;
 
 /* This device uses a special sentinel node to indicate that the child devices
  * will be set later (in rait_device_open).  It contains a control character to
@@ -148,11 +164,46 @@ typedef struct ThreadInfo {
 #define rait_device_in_error(dev) \
     (device_in_error((dev)) || PRIVATE(RAIT_DEVICE((dev)))->status == RAIT_STATUS_FAILED)
 
+/* the most children a Reed-Solomon code over GF(2^8) can spread over */
+#define RAIT_MAX_CHILDREN 256
+
+/* Returns TRUE if child I has failed. */
+static gboolean
+child_failed(RaitDevice * self, guint i)
+{
+    GArray *failed = PRIVATE(self)->failed;
+
+    return i < failed->len && g_array_index(failed, gboolean, i);
+}
+
+/* Marks child I as failed, and updates the status: the array is degraded
+ * until more children failed than it has parity children. */
+static void
+set_child_failed(RaitDevice * self, guint i)
+{
+    GArray *failed = PRIVATE(self)->failed;
+
+    if (child_failed(self, i))
+	return;
+    if (failed->len <= i)
+	g_array_set_size(failed, i + 1);
+    g_array_index(failed, gboolean, i) = TRUE;
+    PRIVATE(self)->nfailed++;
+
+    if (PRIVATE(self)->nfailed > PRIVATE(self)->nparity)
+	PRIVATE(self)->status = RAIT_STATUS_FAILED;
+    else
+	PRIVATE(self)->status = RAIT_STATUS_DEGRADED;
+}
+
 void rait_device_register (void);
 
 /* here are local prototypes */
 static void rait_device_init (RaitDevice * o);
 static void rait_device_class_init (RaitDeviceClass * c);
+static void select_parity_functions(void);
+static void free_workers(RaitWorkers *workers);
+static gboolean wait_for_writes(RaitDevice *self);
 static void rait_device_base_init (RaitDeviceClass * c);
 static void rait_device_open_device (Device * self, char * device_name, char * device_type, char * device_node);
 static gboolean rait_device_start (Device * self, DeviceAccessMode mode,
@@ -251,6 +302,10 @@ static void
 rait_device_finalize(GObject *obj_self)
 {
     RaitDevice *self = RAIT_DEVICE (obj_self);
+
+    /* the children are still writing the last blocks */
+    wait_for_writes(self);
+
     if(G_OBJECT_CLASS(parent_class)->finalize) \
            (* G_OBJECT_CLASS(parent_class)->finalize)(obj_self);
     if(self->private->children) {
@@ -259,38 +314,13 @@ rait_device_finalize(GObject *obj_self)
         g_ptr_array_free (self->private->children, TRUE);
         self->private->children = NULL;
     }
-#ifdef USE_INTERNAL_THREADPOOL
-    g_assert(PRIVATE(self)->threads_sem == NULL || PRIVATE(self)->threads_sem->value == 0);
-
-    if (PRIVATE(self)->threads) {
-	guint i;
-
-	for (i = 0; i < PRIVATE(self)->threads->len; i++) {
-	    ThreadInfo *inf = &g_array_index(PRIVATE(self)->threads, ThreadInfo, i);
-	    if (inf->thread) {
-		/* NOTE: the thread is waiting on this condition right now, not
-		 * executing an operation. */
-
-		/* ask the thread to die */
-		g_mutex_lock(inf->mutex);
-		inf->die = TRUE;
-		g_cond_signal(inf->cond);
-		g_mutex_unlock(inf->mutex);
+    g_array_free(self->private->failed, TRUE);
 
-		/* and wait for it to die, which should happen soon */
-		g_thread_join(inf->thread);
-	    }
-
-	    if (inf->mutex)
-		g_mutex_free(inf->mutex);
-	    if (inf->cond)
-		g_cond_free(inf->cond);
-	}
-    }
-
-    if (PRIVATE(self)->threads_sem)
-	amsemaphore_free(PRIVATE(self)->threads_sem);
-#endif
+    free_workers(&PRIVATE(self)->child_workers);
+    free_workers(&PRIVATE(self)->parity_workers);
+    g_mutex_free(PRIVATE(self)->write_mutex);
+    g_cond_free(PRIVATE(self)->write_cond);
+    g_free(PRIVATE(self)->write_queued);
     amfree(self->private);
 }
 
@@ -300,11 +330,22 @@ rait_device_init (RaitDevice * o G_GNUC_UNUSED)
     PRIVATE(o) = g_new(RaitDevicePrivate, 1);
     PRIVATE(o)->children = g_ptr_array_new();
     PRIVATE(o)->status = RAIT_STATUS_COMPLETE;
-    PRIVATE(o)->failed = -1;
-#ifdef USE_INTERNAL_THREADPOOL
-    PRIVATE(o)->threads = NULL;
-    PRIVATE(o)->threads_sem = NULL;
-#endif
+    PRIVATE(o)->nparity = 1;
+    PRIVATE(o)->failed = g_array_new(FALSE, TRUE, sizeof(gboolean));
+    PRIVATE(o)->nfailed = 0;
+    PRIVATE(o)->child_workers.queues = g_ptr_array_new();
+    PRIVATE(o)->child_workers.name = "rait-child";
+    PRIVATE(o)->child_workers.flags = AMEXEC_BLOCKING;
+    PRIVATE(o)->child_workers.sem = NULL;
+    PRIVATE(o)->parity_workers.queues = g_ptr_array_new();
+    PRIVATE(o)->parity_workers.name = "rait-parity";
+    PRIVATE(o)->parity_workers.flags = 0;
+    PRIVATE(o)->parity_workers.sem = NULL;
+    PRIVATE(o)->write_mutex = g_mutex_new();
+    PRIVATE(o)->write_cond = g_cond_new();
+    PRIVATE(o)->write_queued = NULL;
+    PRIVATE(o)->nwrite_queued = 0;
+    PRIVATE(o)->write_failed = FALSE;
 }
 
 static void
@@ -315,6 +356,8 @@ rait_device_class_init (RaitDeviceClass * c)
 
     parent_class = g_type_class_ref (TYPE_DEVICE);
 
+    select_parity_functions();
+
     device_class->open_device = rait_device_open_device;
     device_class->configure = rait_device_configure;
     device_class->start = rait_device_start;
@@ -329,21 +372,6 @@ rait_device_class_init (RaitDeviceClass * c)
     device_class->read_label = rait_device_read_label;
 
     g_object_class->finalize = rait_device_finalize;
-
-#ifndef USE_INTERNAL_THREADPOOL
-#if !GLIB_CHECK_VERSION(2,10,2)
-    /* Versions of glib before 2.10.2 crash if
-     * g_thread_pool_set_max_unused_threads is called before the first
-     * invocation of g_thread_pool_new.  So we make up a thread pool, but don't
-     * start any threads in it, and free it */
-    {
-	GThreadPool *pool = g_thread_pool_new((GFunc)-1, NULL, -1, FALSE, NULL);
-	g_thread_pool_free(pool, TRUE, FALSE);
-    }
-#endif
-
-    g_thread_pool_set_max_unused_threads(-1);
-#endif
 }
 
 static void
@@ -396,101 +424,99 @@ rait_device_base_init (RaitDeviceClass * c)
 	    property_set_max_volume_usage_fn);
 }
 
-/* This function does something a little clever and a little
- * complicated. It takes an array of operations and runs the given
- * function on each element in the array. The trick is that it runs them
- * all in parallel, in different threads. This is more efficient than it
- * sounds because we use a GThreadPool, which means calling this function
- * will probably not start any new threads at all, but rather use
- * existing ones. The func is called with two gpointer arguments: The
- * first from the array, the second is the data argument.
- *
- * When it returns, all the operations have been successfully
- * executed. If you want results from your operations, do it yourself
- * through the array.
- */
-
-#ifdef USE_INTERNAL_THREADPOOL
-static gpointer rait_thread_pool_func(gpointer data) {
-    ThreadInfo *inf = data;
+static void rait_thread_pool_func(gpointer data, gpointer user_data G_GNUC_UNUSED) {
+    ThreadJob *job = data;
 
-    g_mutex_lock(inf->mutex);
-    while (TRUE) {
-	while (!inf->die && !inf->func)
-	    g_cond_wait(inf->cond, inf->mutex);
+    /* invoke the function */
+    job->func(job->data, NULL);
 
-	if (inf->die)
-	    break;
+    /* indicate that we're finished; will not block */
+    if (job->done)
+	amsemaphore_down(job->done);
+    g_free(job);
+}
 
-	if (inf->func) {
-	    /* invoke the function */
-	    inf->func(inf->data, NULL);
-	    inf->func = NULL;
-	    inf->data = NULL;
+/* Queue FUNC(DATA) to queue I of WORKERS, creating it if needed */
+static void queue_thread_job(RaitWorkers *workers, guint i, GFunc func,
+			     gpointer data, amsemaphore_t *done) {
+    ThreadJob *job;
 
-            /* indicate that we're finished; will not block */
-	    amsemaphore_down(inf->private->threads_sem);
-	}
+    while (workers->queues->len <= i) {
+	g_ptr_array_add(workers->queues,
+		amexec_queue_new(workers->name, rait_thread_pool_func, NULL,
+				 1, AMEXEC_PRIORITY_HIGH, workers->flags));
     }
-    g_mutex_unlock(inf->mutex);
-    return NULL;
+
+    job = g_new(ThreadJob, 1);
+    job->func = func;
+    job->data = data;
+    job->done = done;
+
+    amexec_queue_push(g_ptr_array_index(workers->queues, i), job);
 }
 
-static void do_thread_pool_op(RaitDevice *self, GFunc func, GPtrArray * ops) {
+/* Free the queues of WORKERS, which must have no job queued */
+static void free_workers(RaitWorkers *workers) {
     guint i;
 
-    if (PRIVATE(self)->threads_sem == NULL)
-	PRIVATE(self)->threads_sem = amsemaphore_new_with_value(0);
+    g_assert(workers->sem == NULL || workers->sem->value == 0);
+
+    for (i = 0; i < workers->queues->len; i++)
+	amexec_queue_free(g_ptr_array_index(workers->queues, i), FALSE);
+    g_ptr_array_free(workers->queues, TRUE);
+
+    if (workers->sem)
+	amsemaphore_free(workers->sem);
+}
 
-    if (PRIVATE(self)->threads == NULL)
-	PRIVATE(self)->threads = g_array_sized_new(FALSE, TRUE,
-					    sizeof(ThreadInfo), ops->len);
+/* This function does something a little clever and a little
+ * complicated. It takes an array of operations and runs the given
+ * function on each element in the array. The trick is that it runs them
+ * all in parallel, on one executor queue per element (see amexec.h), which
+ * are kept from one call to the next. The func is called with two gpointer arguments: The
+ * first from the array, the second is the data argument.
+ *
+ * When it returns, all the operations have been successfully
+ * executed. If you want results from your operations, do it yourself
+ * through the array.
+ */
+static void do_thread_pool_op(RaitWorkers *workers, GFunc func, GPtrArray * ops) {
+    guint i;
 
-    g_assert(PRIVATE(self)->threads_sem->value == 0);
+    if (workers->sem == NULL)
+	workers->sem = amsemaphore_new_with_value(0);
 
-    if (PRIVATE(self)->threads->len < ops->len)
-	g_array_set_size(PRIVATE(self)->threads, ops->len);
+    g_assert(workers->sem->value == 0);
 
     /* the semaphore will hit zero when each thread has decremented it */
-    amsemaphore_force_set(PRIVATE(self)->threads_sem, ops->len);
-
-    for (i = 0; i < ops->len; i++) {
-	ThreadInfo *inf = &g_array_index(PRIVATE(self)->threads, ThreadInfo, i);
-	if (!inf->thread) {
-	    inf->mutex = g_mutex_new();
-	    inf->cond = g_cond_new();
-	    inf->private = PRIVATE(self);
-	    inf->thread = g_thread_create(rait_thread_pool_func, inf, TRUE, NULL);
-	}
+    amsemaphore_force_set(workers->sem, ops->len);
 
-	/* set up the info the thread needs and trigger it to start */
-	g_mutex_lock(inf->mutex);
-	inf->data = g_ptr_array_index(ops, i);
-	inf->func = func;
-	g_cond_signal(inf->cond);
-	g_mutex_unlock(inf->mutex);
-    }
+    for (i = 0; i < ops->len; i++)
+	queue_thread_job(workers, i, func, g_ptr_array_index(ops, i),
+			 workers->sem);
 
     /* wait until semaphore hits zero */
-    amsemaphore_wait_empty(PRIVATE(self)->threads_sem);
+    amsemaphore_wait_empty(workers->sem);
 }
 
-#else /* USE_INTERNAL_THREADPOOL */
-
-static void do_thread_pool_op(RaitDevice *self G_GNUC_UNUSED, GFunc func, GPtrArray * ops) {
-    GThreadPool * pool;
+/* Wait until the children wrote all the blocks queued to them.  Returns
+ * FALSE if one of these writes failed since start_file. */
+static gboolean wait_for_writes(RaitDevice *self) {
+    RaitDevicePrivate *priv = PRIVATE(self);
+    gboolean failed;
     guint i;
 
-    pool = g_thread_pool_new(func, NULL, -1, FALSE, NULL);
-    for (i = 0; i < ops->len; i ++) {
-        g_thread_pool_push(pool, g_ptr_array_index(ops, i), NULL);
+    g_mutex_lock(priv->write_mutex);
+    for (i = 0; i < priv->nwrite_queued; i++) {
+	while (priv->write_queued[i] > 0)
+	    g_cond_wait(priv->write_cond, priv->write_mutex);
     }
+    failed = priv->write_failed;
+    g_mutex_unlock(priv->write_mutex);
 
-    g_thread_pool_free(pool, FALSE, TRUE);
+    return !failed;
 }
 
-#endif /* USE_INTERNAL_THREADPOOL */
-
 /* This does the above, in a serial fashion (and without using threads) */
 static void do_unthreaded_ops(RaitDevice *self G_GNUC_UNUSED, GFunc func, GPtrArray * ops) {
     guint i;
@@ -504,8 +530,9 @@ static void do_unthreaded_ops(RaitDevice *self G_GNUC_UNUSED, GFunc func, GPtrAr
    automatically between do_thread_pool_op and do_unthreaded_ops,
    depending on g_thread_supported(). */
 static void do_rait_child_ops(RaitDevice *self, GFunc func, GPtrArray * ops) {
+    wait_for_writes(self);
     if (g_thread_supported()) {
-        do_thread_pool_op(self, func, ops);
+        do_thread_pool_op(&PRIVATE(self)->child_workers, func, ops);
     } else {
         do_unthreaded_ops(self, func, ops);
     }
@@ -526,7 +553,7 @@ child_device_names_to_rait_name(RaitDevice * self) {
 
         bzero(&val, sizeof(val));
 
-        if ((signed)i != self->private->failed) {
+        if (!child_failed(self, i)) {
 	    if (device_property_get(child, PROPERTY_CANONICAL_NAME, &val)) {
 		child_name = g_value_get_string(&val);
 		got_prop = TRUE;
@@ -543,7 +570,10 @@ child_device_names_to_rait_name(RaitDevice * self) {
     }
 
     braced = collapse_braced_alternates(kids);
-    result = g_strdup_printf("rait:%s", braced);
+    if (self->private->nparity != 1)
+	result = g_strdup_printf("rait:%u:%s", self->private->nparity, braced);
+    else
+	result = g_strdup_printf("rait:%s", braced);
     g_free(braced);
 
     return result;
@@ -580,7 +610,7 @@ calculate_block_size_from_children(RaitDevice * self, gsize *rait_size)
 
         bzero(&property_result, sizeof(property_result));
 
-	if ((signed)i == self->private->failed)
+	if (child_failed(self, i))
 	    continue;
 
 	child = g_ptr_array_index(self->private->children, i);
@@ -671,7 +701,7 @@ set_block_size_on_children(RaitDevice *self, gsize child_block_size)
 
 	bzero(&property_result, sizeof(property_result));
 
-	if ((signed)i == self->private->failed)
+	if (child_failed(self, i))
 	    continue;
 
 	child = g_ptr_array_index(self->private->children, i);
@@ -799,7 +829,7 @@ static GPtrArray * make_generic_boolean_op_array(RaitDevice* self) {
     for (i = 0; i < self->private->children->len; i ++) {
         GenericOp * op;
 
-        if ((signed)i == self->private->failed) {
+        if (child_failed(self, i)) {
             continue;
         }
 
@@ -819,7 +849,6 @@ static GPtrArray * make_generic_boolean_op_array(RaitDevice* self) {
 static gboolean g_ptr_array_union_robust(RaitDevice * self, GPtrArray * ops,
                                          BooleanExtractor extractor) {
     int nfailed = 0;
-    int lastfailed = 0;
     guint i;
 
     /* We found one or more failed elements.  See which elements failed, and
@@ -827,13 +856,12 @@ static gboolean g_ptr_array_union_robust(RaitDevice * self, GPtrArray * ops,
     for (i = 0; i < ops->len; i ++) {
 	GenericOp * op = g_ptr_array_index(ops, i);
 	if (!extractor(op)) {
-	    self->private->failed = op->child_index;
+	    set_child_failed(self, op->child_index);
 	    g_warning("RAIT array %s isolated device %s: %s",
 		    DEVICE(self)->device_name,
 		    op->child->device_name,
 		    device_error(op->child));
 	    nfailed++;
-            lastfailed = i;
 	}
     }
 
@@ -841,14 +869,12 @@ static gboolean g_ptr_array_union_robust(RaitDevice * self, GPtrArray * ops,
     if (nfailed == 0)
 	return TRUE;
 
-    /* a single failure in COMPLETE just puts us in DEGRADED mode */
-    if (self->private->status == RAIT_STATUS_COMPLETE && nfailed == 1) {
-	self->private->status = RAIT_STATUS_DEGRADED;
-        self->private->failed = lastfailed;
+    /* as many failures as there are parity children just put us in
+     * DEGRADED mode */
+    if (self->private->status == RAIT_STATUS_DEGRADED) {
 	g_warning("RAIT array %s DEGRADED", DEVICE(self)->device_name);
 	return TRUE;
     } else {
-	self->private->status = RAIT_STATUS_FAILED;
 	g_warning("RAIT array %s FAILED", DEVICE(self)->device_name);
 	return FALSE;
     }
@@ -910,6 +936,24 @@ open_child_devices (Device * dself, char * device_name,
 
     self = RAIT_DEVICE(dself);
 
+    /* "rait:M:{...}" spreads the data over all but M children, and M
+     * parity children; with M = 0, the data is only striped, for the speed
+     * of all of the children.  No device type is a number, so no child name
+     * looks like this */
+    if (g_ascii_isdigit(*device_node)) {
+	char *end;
+	guint64 nparity = g_ascii_strtoull(device_node, &end, 10);
+
+	if (*end != ':' || nparity >= RAIT_MAX_CHILDREN) {
+	    device_set_error(dself,
+		g_strdup_printf(_("Invalid RAIT parity count in '%s'"), device_name),
+		DEVICE_STATUS_DEVICE_ERROR);
+	    return FALSE;
+	}
+	self->private->nparity = nparity;
+	device_node = end + 1;
+    }
+
     device_names = expand_braced_alternates(device_node);
 
     if (device_names == NULL) {
@@ -919,6 +963,18 @@ open_child_devices (Device * dself, char * device_name,
         return FALSE;
     }
 
+    if (self->private->nparity != 1 &&
+	(device_names->len <= MAX(self->private->nparity, 1) ||
+	 device_names->len > RAIT_MAX_CHILDREN)) {
+	device_set_error(dself,
+	    g_strdup_printf(_("RAIT device '%s' needs more than %u and at most %u child devices"),
+			    device_name, MAX(self->private->nparity, 1),
+			    RAIT_MAX_CHILDREN),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	g_ptr_array_free_full(device_names);
+        return FALSE;
+    }
+
     /* Open devices in a separate thread, in case they have to rewind etc. */
     device_open_ops = g_ptr_array_new();
 
@@ -958,17 +1014,17 @@ open_child_devices (Device * dself, char * device_name,
             append_message(&failure_errmsgs,
                            strdup(this_failure_errmsg));
 	    failure_flags |= status;
-            if (self->private->status == RAIT_STATUS_COMPLETE) {
-                /* The first failure just puts us in degraded mode. */
+            if (self->private->nfailed < self->private->nparity) {
+                /* The first failures, up to the number of parity children,
+                 * just put us in degraded mode. */
                 g_warning("%s: %s",
                           device_name, this_failure_errmsg);
 		g_warning("%s: %s failed, entering degraded mode.",
                           device_name, op->device_name);
                 g_ptr_array_add(self->private->children, op->result);
-                self->private->status = RAIT_STATUS_DEGRADED;
-                self->private->failed = i;
+                set_child_failed(self, i);
             } else {
-                /* The second and further failures are fatal. */
+                /* Further failures are fatal. */
                 failure = TRUE;
             }
         }
@@ -1025,7 +1081,7 @@ rait_device_open_from_children (GSList *child_devices) {
 	/* a NULL kid is OK -- it opens the device in degraded mode */
 	if (!kid) {
 	    nfailures++;
-	    self->private->failed = i;
+	    set_child_failed(self, i);
 	} else {
 	    g_assert(IS_DEVICE(kid));
 	    g_object_ref((GObject *)kid);
@@ -1180,7 +1236,7 @@ rait_device_configure(Device * dself, gboolean use_global_config)
     for (i = 0; i < self->private->children->len; i ++) {
 	Device *child;
 
-	if ((signed)i == self->private->failed)
+	if (child_failed(self, i))
 	    continue;
 
 	child = g_ptr_array_index(self->private->children, i);
@@ -1240,7 +1296,7 @@ rait_device_start (Device * dself, DeviceAccessMode mode, char * label,
     for (i = 0; i < self->private->children->len; i ++) {
         StartOp * op;
 
-        if ((signed)i == self->private->failed) {
+        if (child_failed(self, i)) {
             continue;
         }
 
@@ -1371,6 +1427,11 @@ rait_device_start_file (Device * dself, dumpfile_t * info) {
 
     do_rait_child_ops(self, start_file_do_op, ops);
 
+    /* the writes of the previous file were reported, or given up */
+    g_mutex_lock(self->private->write_mutex);
+    self->private->write_failed = FALSE;
+    g_mutex_unlock(self->private->write_mutex);
+
     success = g_ptr_array_and(ops, extract_boolean_generic_op);
 
     for (i = 0; i < self->private->children->len && success; i ++) {
@@ -1425,11 +1486,11 @@ rait_device_start_file (Device * dself, dumpfile_t * info) {
 static void find_simple_params(RaitDevice * self,
                                guint * num_children,
                                guint * data_children) {
-    int num, data;
+    guint num, data;
 
     num = self->private->children->len;
-    if (num > 1)
-        data = num - 1;
+    if (num > self->private->nparity)
+        data = num - self->private->nparity;
     else
         data = num;
     if (num_children != NULL)
@@ -1438,75 +1499,702 @@ static void find_simple_params(RaitDevice * self,
         *data_children = data;
 }
 
+/* A copy of a RAIT block, shared by the children writing it */
+typedef struct {
+    gint refs;
+    char * data;
+} BlockCopy;
+
 typedef struct {
     GenericOp base;
+    RaitDevice * self;
     guint size;           /* IN */
     gpointer data;        /* IN */
     gboolean data_needs_free; /* bookkeeping */
+    BlockCopy * copy;     /* holding data, if not data_needs_free */
 } WriteBlockOp;
 
-/* a GFunc. */
+/* a GFunc; this one is queued without waiting for it, so it frees OP. */
 static void write_block_do_op(gpointer data,
                               gpointer user_data G_GNUC_UNUSED) {
     WriteBlockOp * op = data;
+    RaitDevicePrivate * priv = PRIVATE(op->self);
+    DeviceWriteResult result;
 
-    op->base.result =
-        GINT_TO_POINTER(device_write_block(op->base.child, op->size, op->data));
+    result = device_write_block(op->base.child, op->size, op->data);
+
+    g_mutex_lock(priv->write_mutex);
+    /* a child reaching LEOM is not an error */
+    if (result != WRITE_SUCCEED && result != WRITE_SPACE)
+        priv->write_failed = TRUE;
+    priv->write_queued[op->base.child_index]--;
+    g_cond_broadcast(priv->write_cond);
+    g_mutex_unlock(priv->write_mutex);
+
+    if (op->data_needs_free) {
+        g_free(op->data);
+    } else if (g_atomic_int_dec_and_test(&op->copy->refs)) {
+        g_free(op->copy->data);
+        g_free(op->copy);
+    }
+    g_free(op);
+}
+
+/* Parity block generation.
+ *
+ * The first parity chunk is the XOR of the data chunks, and with a single
+ * parity child the reconstruction of a missing chunk is the XOR of the
+ * others with the parity, so both are done by a single kernel which XORs
+ * NSRC source chunks into DST over [OFF, OFF+LEN), a vector at a time,
+ * reading each source once.  Further parity chunks use the Reed-Solomon
+ * kernels below.  The kernels are picked for this cpu when the class is
+ * initialized, and large chunks are split into slices computed by the
+ * child threads. */
+
+typedef void (*xor_function_t)(char *dst, char **src, guint nsrc,
+			       gsize off, gsize len);
+
+static xor_function_t xor_function;
+static const char *xor_function_name;
+
+/* chunks smaller than this are not worth handing to threads */
+#define RAIT_PARITY_SLICE (256*1024)
+
+static void
+xor_generic(
+    char *dst,
+    char **src,
+    guint nsrc,
+    gsize off,
+    gsize len)
+{
+    gsize end = off + len;
+    gsize j;
+    guint i;
+
+    for (j = off; j + sizeof(guint64) <= end; j += sizeof(guint64)) {
+	guint64 acc, v;
+
+	memcpy(&acc, src[0] + j, sizeof(acc));
+	for (i = 1; i < nsrc; i++) {
+	    memcpy(&v, src[i] + j, sizeof(v));
+	    acc ^= v;
+	}
+	memcpy(dst + j, &acc, sizeof(acc));
+    }
+    for (; j < end; j++) {
+	char acc = src[0][j];
+
+	for (i = 1; i < nsrc; i++)
+	    acc ^= src[i][j];
+	dst[j] = acc;
+    }
 }
 
-/* Parity block generation. Performance of this function can be improved
-   considerably by using larger-sized integers or
-   assembly-coded vector instructions. Parameters are:
-   % data       - All data chunks in series (chunk_size * num_chunks bytes)
-   % parity     - Allocated space for parity block (chunk_size bytes)
+#ifdef __SSE2__
+static void
+xor_sse2(
+    char *dst,
+    char **src,
+    guint nsrc,
+    gsize off,
+    gsize len)
+{
+    gsize end = off + len;
+    gsize j;
+    guint i;
+
+    for (j = off; j + sizeof(__m128i) <= end; j += sizeof(__m128i)) {
+	__m128i acc = _mm_loadu_si128((__m128i *)(src[0] + j));
+
+	for (i = 1; i < nsrc; i++)
+	    acc = _mm_xor_si128(acc, _mm_loadu_si128((__m128i *)(src[i] + j)));
+	_mm_storeu_si128((__m128i *)(dst + j), acc);
+    }
+    xor_generic(dst, src, nsrc, j, end - j);
+}
+#endif
+
+#ifdef HAVE_XOR_AVX2
+__attribute__((target("avx2")))
+static void
+xor_avx2(
+    char *dst,
+    char **src,
+    guint nsrc,
+    gsize off,
+    gsize len)
+{
+    gsize end = off + len;
+    gsize j;
+    guint i;
+
+    for (j = off; j + sizeof(__m256i) <= end; j += sizeof(__m256i)) {
+	__m256i acc = _mm256_loadu_si256((__m256i *)(src[0] + j));
+
+	for (i = 1; i < nsrc; i++)
+	    acc = _mm256_xor_si256(acc,
+				   _mm256_loadu_si256((__m256i *)(src[i] + j)));
+	_mm256_storeu_si256((__m256i *)(dst + j), acc);
+    }
+    xor_generic(dst, src, nsrc, j, end - j);
+}
+#endif
+
+#ifdef HAVE_XOR_AVX512
+__attribute__((target("avx512f")))
+static void
+xor_avx512(
+    char *dst,
+    char **src,
+    guint nsrc,
+    gsize off,
+    gsize len)
+{
+    gsize end = off + len;
+    gsize j;
+    guint i;
+
+    for (j = off; j + sizeof(__m512i) <= end; j += sizeof(__m512i)) {
+	__m512i acc = _mm512_loadu_si512(src[0] + j);
+
+	for (i = 1; i < nsrc; i++)
+	    acc = _mm512_xor_si512(acc, _mm512_loadu_si512(src[i] + j));
+	_mm512_storeu_si512(dst + j, acc);
+    }
+    xor_generic(dst, src, nsrc, j, end - j);
+}
+#endif
+
+#ifdef __ARM_NEON
+static void
+xor_neon(
+    char *dst,
+    char **src,
+    guint nsrc,
+    gsize off,
+    gsize len)
+{
+    gsize end = off + len;
+    gsize j;
+    guint i;
+
+    for (j = off; j + sizeof(uint8x16_t) <= end; j += sizeof(uint8x16_t)) {
+	uint8x16_t acc = vld1q_u8((uint8_t *)src[0] + j);
+
+	for (i = 1; i < nsrc; i++)
+	    acc = veorq_u8(acc, vld1q_u8((uint8_t *)src[i] + j));
+	vst1q_u8((uint8_t *)dst + j, acc);
+    }
+    xor_generic(dst, src, nsrc, j, end - j);
+}
+#endif
+
+/*
+ * Reed-Solomon parity
+ *
+ * With NPARITY parity children, parity chunk R is the sum over the data
+ * chunks C of coef(R, C) * chunk[C] in GF(2^8).  The coefficients are a
+ * Cauchy matrix, scaled so that its first row and first column are all
+ * ones: the first parity chunk is the XOR parity, a single data child is
+ * simply mirrored, and the data survives the loss of any NPARITY children.
+ *
+ * A multiplication by a constant is two lookups in 16-entry tables, one for
+ * each nibble, which is what the SIMD byte shuffles do 16 or 32 at a time.
+ * A gf_function_t sets DST to the sum of the NSRC sources multiplied by the
+ * constants whose tables are in TABLES, 32 bytes each.
  */
-static void make_parity_block(char * data, char * parity,
-                              guint chunk_size, guint num_chunks) {
+
+#define GF_POLY 0x11d	/* x^8 + x^4 + x^3 + x^2 + 1 */
+
+typedef void (*gf_function_t)(char *dst, char **src, const guint8 *tables,
+			      guint nsrc, gsize off, gsize len);
+
+static gf_function_t gf_function;
+static const char *gf_function_name;
+
+static guint8 gf_exp[510];
+static guint8 gf_log[256];
+
+static void
+gf_init(void)
+{
+    guint i, x = 1;
+
+    for (i = 0; i < 255; i++) {
+	gf_exp[i] = gf_exp[i + 255] = x;
+	gf_log[x] = i;
+	x <<= 1;
+	if (x & 0x100)
+	    x ^= GF_POLY;
+    }
+}
+
+static guint8
+gf_mul(
+    guint8 a,
+    guint8 b)
+{
+    if (a == 0 || b == 0)
+	return 0;
+    return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+static guint8
+gf_inv(
+    guint8 a)
+{
+    g_assert(a != 0);
+    return gf_exp[255 - gf_log[a]];
+}
+
+/* Fill the 32 bytes at TABLE to multiply by C */
+static void
+gf_mul_table(
+    guint8 c,
+    guint8 *table)
+{
     guint i;
-    bzero(parity, chunk_size);
-    for (i = 0; i < num_chunks - 1; i ++) {
-        guint j;
-        for (j = 0; j < chunk_size; j ++) {
-            parity[j] ^= data[chunk_size*i + j];
-        }
+
+    for (i = 0; i < 16; i++) {
+	table[i] = gf_mul(c, i);
+	table[16 + i] = gf_mul(c, i << 4);
+    }
+}
+
+static void
+gf_generic(
+    char *dst,
+    char **src,
+    const guint8 *tables,
+    guint nsrc,
+    gsize off,
+    gsize len)
+{
+    gsize end = off + len;
+    gsize j;
+    guint i;
+
+    for (j = off; j < end; j++) {
+	guint8 acc = 0;
+
+	for (i = 0; i < nsrc; i++) {
+	    guint8 x = src[i][j];
+	    const guint8 *t = tables + 32 * i;
+
+	    acc ^= t[x & 0x0f] ^ t[16 + (x >> 4)];
+	}
+	dst[j] = acc;
+    }
+}
+
+#ifdef HAVE_XOR_AVX2
+__attribute__((target("ssse3")))
+static void
+gf_ssse3(
+    char *dst,
+    char **src,
+    const guint8 *tables,
+    guint nsrc,
+    gsize off,
+    gsize len)
+{
+    __m128i mask = _mm_set1_epi8(0x0f);
+    gsize end = off + len;
+    gsize j;
+    guint i;
+
+    for (j = off; j + sizeof(__m128i) <= end; j += sizeof(__m128i)) {
+	__m128i acc = _mm_setzero_si128();
+
+	for (i = 0; i < nsrc; i++) {
+	    __m128i lo = _mm_loadu_si128((__m128i *)(tables + 32 * i));
+	    __m128i hi = _mm_loadu_si128((__m128i *)(tables + 32 * i + 16));
+	    __m128i x = _mm_loadu_si128((__m128i *)(src[i] + j));
+
+	    acc = _mm_xor_si128(acc,
+		    _mm_shuffle_epi8(lo, _mm_and_si128(x, mask)));
+	    acc = _mm_xor_si128(acc,
+		    _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(x, 4),
+						       mask)));
+	}
+	_mm_storeu_si128((__m128i *)(dst + j), acc);
     }
+    gf_generic(dst, src, tables, nsrc, j, end - j);
 }
 
-/* Does the same thing as make_parity_block, but instead of using a
-   single memory chunk holding all chunks, it takes a GPtrArray of
-   chunks. */
-static void make_parity_block_extents(GPtrArray * data, char * parity,
-                                      guint chunk_size) {
+__attribute__((target("avx2")))
+static void
+gf_avx2(
+    char *dst,
+    char **src,
+    const guint8 *tables,
+    guint nsrc,
+    gsize off,
+    gsize len)
+{
+    __m256i mask = _mm256_set1_epi8(0x0f);
+    gsize end = off + len;
+    gsize j;
     guint i;
-    bzero(parity, chunk_size);
-    for (i = 0; i < data->len; i ++) {
-        guint j;
-        char * data_chunk;
-        data_chunk = g_ptr_array_index(data, i);
-        for (j = 0; j < chunk_size; j ++) {
-            parity[j] ^= data_chunk[j];
+
+    for (j = off; j + sizeof(__m256i) <= end; j += sizeof(__m256i)) {
+	__m256i acc = _mm256_setzero_si256();
+
+	for (i = 0; i < nsrc; i++) {
+	    /* vpshufb looks up each 128-bit lane in its own copy */
+	    __m256i lo = _mm256_broadcastsi128_si256(
+			    _mm_loadu_si128((__m128i *)(tables + 32 * i)));
+	    __m256i hi = _mm256_broadcastsi128_si256(
+			    _mm_loadu_si128((__m128i *)(tables + 32 * i + 16)));
+	    __m256i x = _mm256_loadu_si256((__m256i *)(src[i] + j));
+
+	    acc = _mm256_xor_si256(acc,
+		    _mm256_shuffle_epi8(lo, _mm256_and_si256(x, mask)));
+	    acc = _mm256_xor_si256(acc,
+		    _mm256_shuffle_epi8(hi,
+			_mm256_and_si256(_mm256_srli_epi64(x, 4), mask)));
+	}
+	_mm256_storeu_si256((__m256i *)(dst + j), acc);
+    }
+    gf_generic(dst, src, tables, nsrc, j, end - j);
+}
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+static void
+gf_neon(
+    char *dst,
+    char **src,
+    const guint8 *tables,
+    guint nsrc,
+    gsize off,
+    gsize len)
+{
+    uint8x16_t mask = vdupq_n_u8(0x0f);
+    gsize end = off + len;
+    gsize j;
+    guint i;
+
+    for (j = off; j + sizeof(uint8x16_t) <= end; j += sizeof(uint8x16_t)) {
+	uint8x16_t acc = vdupq_n_u8(0);
+
+	for (i = 0; i < nsrc; i++) {
+	    uint8x16_t lo = vld1q_u8(tables + 32 * i);
+	    uint8x16_t hi = vld1q_u8(tables + 32 * i + 16);
+	    uint8x16_t x = vld1q_u8((uint8_t *)src[i] + j);
+
+	    acc = veorq_u8(acc, vqtbl1q_u8(lo, vandq_u8(x, mask)));
+	    acc = veorq_u8(acc, vqtbl1q_u8(hi, vshrq_n_u8(x, 4)));
+	}
+	vst1q_u8((uint8_t *)dst + j, acc);
+    }
+    gf_generic(dst, src, tables, nsrc, j, end - j);
+}
+#endif
+
+/* Pick the widest kernels this cpu supports */
+static void
+select_parity_functions(void)
+{
+#if defined(__SSE2__)
+    xor_function = xor_sse2;
+    xor_function_name = "sse2";
+#elif defined(__ARM_NEON)
+    xor_function = xor_neon;
+    xor_function_name = "neon";
+#else
+    xor_function = xor_generic;
+    xor_function_name = "generic";
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+    gf_function = gf_neon;
+    gf_function_name = "neon";
+#else
+    gf_function = gf_generic;
+    gf_function_name = "generic";
+#endif
+#ifdef HAVE_XOR_AVX2
+    if (__builtin_cpu_supports("ssse3")) {
+	gf_function = gf_ssse3;
+	gf_function_name = "ssse3";
+    }
+    if (__builtin_cpu_supports("avx2")) {
+	xor_function = xor_avx2;
+	xor_function_name = "avx2";
+	gf_function = gf_avx2;
+	gf_function_name = "avx2";
+    }
+#endif
+#ifdef HAVE_XOR_AVX512
+    if (__builtin_cpu_supports("avx512f")) {
+	xor_function = xor_avx512;
+	xor_function_name = "avx512";
+    }
+#endif
+    gf_init();
+    g_debug("RAIT parity uses the %s XOR and %s GF(2^8) kernels",
+	    xor_function_name, gf_function_name);
+}
+
+typedef struct {
+    char *dst;
+    char **src;
+    const guint8 *tables;	/* NULL to XOR the sources */
+    guint nsrc;
+    gsize off;
+    gsize len;
+} ParityOp;
+
+/* a GFunc. */
+static void parity_do_op(gpointer data,
+                         gpointer user_data G_GNUC_UNUSED) {
+    ParityOp * op = data;
+
+    if (op->tables)
+        gf_function(op->dst, op->src, op->tables, op->nsrc, op->off, op->len);
+    else
+        xor_function(op->dst, op->src, op->nsrc, op->off, op->len);
+}
+
+/* Compute DST (chunk_size bytes) as the sum of the NSRC chunks in SRC,
+   multiplied by the constants whose tables are in TABLES (or just XORed if
+   it is NULL), in slices of at least RAIT_PARITY_SLICE bytes run in
+   parallel. */
+static void make_parity(RaitDevice * self, char ** src, guint nsrc,
+                        const guint8 * tables, char * dst, gsize chunk_size) {
+    GPtrArray * ops;
+    guint nslices, i;
+    gsize slice, off;
+
+    if (nsrc == 0) {
+        bzero(dst, chunk_size);
+        return;
+    }
+
+    nslices = MIN(chunk_size / RAIT_PARITY_SLICE,
+                  self->private->children->len);
+    if (nslices <= 1) {
+        ParityOp op = { dst, src, tables, nsrc, 0, chunk_size };
+        parity_do_op(&op, NULL);
+        return;
+    }
+
+    /* keep the slices on cache line boundaries */
+    slice = (chunk_size / nslices + 63) & ~(gsize)63;
+    ops = g_ptr_array_sized_new(nslices);
+    for (off = 0; off < chunk_size; off += slice) {
+        ParityOp * op = g_new(ParityOp, 1);
+        op->dst = dst;
+        op->src = src;
+        op->tables = tables;
+        op->nsrc = nsrc;
+        op->off = off;
+        op->len = MIN(slice, chunk_size - off);
+        g_ptr_array_add(ops, op);
+    }
+
+    if (g_thread_supported()) {
+        do_thread_pool_op(&PRIVATE(self)->parity_workers, parity_do_op, ops);
+    } else {
+        do_unthreaded_ops(self, parity_do_op, ops);
+    }
+
+    for (i = 0; i < ops->len; i ++)
+        g_free(g_ptr_array_index(ops, i));
+    g_ptr_array_free(ops, TRUE);
+}
+
+/* The coefficient of data chunk C in parity chunk R, see above */
+static guint8 parity_coef(guint nparity, guint r, guint c) {
+#define CAUCHY(r, c) gf_inv((guint8)((r) ^ (nparity + (c))))
+    return gf_mul(gf_mul(CAUCHY(r, c), CAUCHY(0, 0)),
+                  gf_inv(gf_mul(CAUCHY(0, c), CAUCHY(r, 0))));
+#undef CAUCHY
+}
+
+/* Fill ROW (data_children entries) with the coefficients of each data
+   chunk in the chunk stored on CHILD: the identity for the data children,
+   then the parity coefficients. */
+static void generator_row(guint data_children, guint nparity, guint child,
+                          guint8 * row) {
+    guint c;
+
+    for (c = 0; c < data_children; c ++) {
+        if (child < data_children)
+            row[c] = (c == child);
+        else
+            row[c] = parity_coef(nparity, child - data_children, c);
+    }
+}
+
+/* Compute parity chunk ROW (0-indexed) of the NSRC DATA chunks into
+   PARITY (chunk_size bytes). */
+static void make_parity_chunk(RaitDevice * self, char ** data, guint nsrc,
+                              guint row, char * parity, gsize chunk_size) {
+    guint8 * tables;
+    guint c;
+
+    /* the first parity chunk is the XOR parity */
+    if (row == 0) {
+        make_parity(self, data, nsrc, NULL, parity, chunk_size);
+        return;
+    }
+
+    tables = g_malloc(32 * nsrc);
+    for (c = 0; c < nsrc; c ++)
+        gf_mul_table(parity_coef(self->private->nparity, row, c),
+                     tables + 32 * c);
+    make_parity(self, data, nsrc, tables, parity, chunk_size);
+    g_free(tables);
+}
+
+/* Invert the N x N matrix M in place, by Gauss-Jordan elimination.
+   Returns FALSE if it is singular, which can't happen with the
+   generator rows of any N children. */
+static gboolean gf_invert_matrix(guint8 * m, guint n) {
+    guint8 * inv = g_malloc0(n * n);
+    guint i, j, k;
+    gboolean ok = TRUE;
+
+    for (i = 0; i < n; i ++)
+        inv[i * n + i] = 1;
+
+    for (i = 0; i < n && ok; i ++) {
+        guint8 pivot;
+
+        /* find a row with a non-zero pivot and swap it in */
+        for (j = i; j < n && m[j * n + i] == 0; j ++)
+            ;
+        if (j == n) {
+            ok = FALSE;
+            break;
+        }
+        if (j != i) {
+            for (k = 0; k < n; k ++) {
+                guint8 t;
+                t = m[i * n + k]; m[i * n + k] = m[j * n + k]; m[j * n + k] = t;
+                t = inv[i * n + k]; inv[i * n + k] = inv[j * n + k]; inv[j * n + k] = t;
+            }
+        }
+
+        pivot = gf_inv(m[i * n + i]);
+        for (k = 0; k < n; k ++) {
+            m[i * n + k] = gf_mul(m[i * n + k], pivot);
+            inv[i * n + k] = gf_mul(inv[i * n + k], pivot);
+        }
+
+        for (j = 0; j < n; j ++) {
+            guint8 f = m[j * n + i];
+
+            if (j == i || f == 0)
+                continue;
+            for (k = 0; k < n; k ++) {
+                m[j * n + k] ^= gf_mul(f, m[i * n + k]);
+                inv[j * n + k] ^= gf_mul(f, inv[i * n + k]);
+            }
+        }
+    }
+
+    if (ok)
+        memcpy(m, inv, n * n);
+    g_free(inv);
+    return ok;
+}
+
+/* Rebuild the missing data chunks into BUF, from CHUNKS[i], the chunk
+   read from child i or NULL if that child failed.  Returns FALSE if too
+   few chunks were read. */
+static gboolean rebuild_data_chunks(RaitDevice * self, char ** chunks,
+                                    char * buf, gsize chunk_size) {
+    guint num_children, data_children, nparity;
+    guint * use;
+    guint8 * m;
+    char ** src;
+    guint8 * tables;
+    guint i, n, d;
+    gboolean ok = TRUE;
+
+    find_simple_params(self, &num_children, &data_children);
+    nparity = self->private->nparity;
+
+    /* decode from the first data_children chunks read, data chunks first */
+    use = g_new(guint, data_children);
+    for (i = 0, n = 0; i < num_children && n < data_children; i ++) {
+        if (chunks[i])
+            use[n++] = i;
+    }
+    if (n < data_children) {
+        g_free(use);
+        return FALSE;
+    }
+
+    m = g_malloc(data_children * data_children);
+    for (i = 0; i < data_children; i ++)
+        generator_row(data_children, nparity, use[i], m + i * data_children);
+    if (!gf_invert_matrix(m, data_children)) {
+        g_free(m);
+        g_free(use);
+        return FALSE;
+    }
+
+    src = g_new(char *, data_children);
+    tables = g_malloc(32 * data_children);
+    for (d = 0; d < data_children && ok; d ++) {
+        const guint8 * row = m + d * data_children;
+        gboolean all_ones = TRUE;
+        guint nsrc = 0;
+
+        if (chunks[d])
+            continue;
+
+        for (i = 0; i < data_children; i ++) {
+            if (row[i] == 0)
+                continue;
+            if (row[i] != 1)
+                all_ones = FALSE;
+            gf_mul_table(row[i], tables + 32 * nsrc);
+            src[nsrc++] = chunks[use[i]];
         }
+
+        /* with the XOR parity, the missing chunk is the XOR of the others */
+        make_parity(self, src, nsrc, all_ones? NULL : tables,
+                    buf + chunk_size * d, chunk_size);
     }
+
+    g_free(tables);
+    g_free(src);
+    g_free(m);
+    g_free(use);
+    return ok;
 }
 
 /* Does the parity creation algorithm. Allocates and returns a single
    device block from a larger RAIT block. chunks and chunk are 1-indexed. */
-static char * extract_data_block(char * data, guint size,
+static char * extract_data_block(RaitDevice * self, char * data, guint size,
                                  guint chunks, guint chunk) {
     char * rval;
     guint chunk_size;
+    guint data_chunks = chunks - self->private->nparity;
 
     g_assert(chunks > 0 && chunk > 0 && chunk <= chunks);
     g_assert(data != NULL);
-    g_assert(size > 0 && size % (chunks - 1) == 0);
+    g_assert(size > 0 && size % data_chunks == 0);
 
-    chunk_size = size / (chunks - 1);
+    chunk_size = size / data_chunks;
     rval = g_malloc(chunk_size);
-    if (chunks != chunk) {
+    if (chunk <= data_chunks) {
         /* data block. */
         memcpy(rval, data + chunk_size * (chunk - 1), chunk_size);
     } else {
-        make_parity_block(data, rval, chunk_size, chunks);
+        char ** src = g_new(char *, data_chunks);
+        guint i;
+
+        for (i = 0; i < data_chunks; i ++)
+            src[i] = data + (gsize)chunk_size * i;
+        make_parity_chunk(self, src, data_chunks, chunk - data_chunks - 1,
+                          rval, chunk_size);
+        g_free(src);
     }
 
     return rval;
@@ -1514,79 +2202,107 @@ static char * extract_data_block(char * data, guint size,
 
 static DeviceWriteResult
 rait_device_write_block (Device * dself, guint size, gpointer data) {
-    GPtrArray * ops;
+    RaitDevicePrivate * priv;
     guint i;
-    DeviceWriteResult rait_result;
     guint data_children, num_children;
     gsize blocksize = dself->block_size;
     RaitDevice * self;
-    gboolean last_block = (size < blocksize);
+    BlockCopy * copy;
+    WriteBlockOp ** ops;
+    gboolean failed;
 
     self = RAIT_DEVICE(dself);
+    priv = PRIVATE(self);
 
     if (rait_device_in_error(self)) return WRITE_FAILED;
     if (self->private->status != RAIT_STATUS_COMPLETE) return WRITE_FAILED;
 
     find_simple_params(RAIT_DEVICE(self), &num_children, &data_children);
-    num_children = self->private->children->len;
-    if (num_children != 1)
-        data_children = num_children - 1;
-    else
-        data_children = num_children;
 
-    g_assert(size % data_children == 0 || last_block);
+    g_assert(size % data_children == 0 || size < blocksize);
 
-    /* zero out to the end of a short block -- tape devices only write
+    /* the children write after we return, so they need their own copy;
+     * zero out to the end of a short block -- tape devices only write
      * whole blocks. */
-    if (last_block) {
-        char *new_data;
-
-        new_data = g_malloc(blocksize);
-        memcpy(new_data, data, size);
-        bzero(new_data + size, blocksize - size);
-
-        data = new_data;
+    copy = g_new(BlockCopy, 1);
+    copy->refs = 0;
+    copy->data = g_malloc(blocksize);
+    memcpy(copy->data, data, size);
+    if (size < blocksize) {
+        bzero(copy->data + size, blocksize - size);
         size = blocksize;
     }
 
-    ops = g_ptr_array_sized_new(num_children);
-    for (i = 0; i < self->private->children->len; i ++) {
+    ops = g_new(WriteBlockOp *, num_children);
+    for (i = 0; i < num_children; i ++) {
         WriteBlockOp * op;
-        op = g_malloc(sizeof(*op));
+        op = g_new(WriteBlockOp, 1);
         op->base.child = g_ptr_array_index(self->private->children, i);
+        op->base.child_index = i;
+        op->self = self;
         op->size = size / data_children;
-        if (num_children <= 2) {
-            op->data = data;
+        op->copy = NULL;
+        if (data_children == 1) {
+            /* mirrored */
+            op->data = copy->data;
+            op->data_needs_free = FALSE;
+        } else if (i < data_children) {
+            /* the children only read the data chunks, so share the copy */
+            op->data = copy->data + (gsize)op->size * i;
             op->data_needs_free = FALSE;
         } else {
             op->data_needs_free = TRUE;
-            op->data = extract_data_block(data, size, num_children, i + 1);
+            op->data = extract_data_block(self, copy->data, size,
+                                          num_children, i + 1);
         }
-        g_ptr_array_add(ops, op);
-    }
-
-    do_rait_child_ops(self, write_block_do_op, ops);
-
-    rait_result = WRITE_SUCCEED;
-    for (i = 0; i < self->private->children->len; i ++) {
-        WriteBlockOp * op = g_ptr_array_index(ops, i);
-	DeviceWriteResult result = GPOINTER_TO_INT(op->base.result);
-	if (result == WRITE_SUCCEED && rait_result == WRITE_SUCCEED) {
-	} else if (result == WRITE_SPACE && rait_result == WRITE_SUCCEED) {
-	} else {
-	    rait_result = WRITE_FAILED;
-	}
-        if (op->data_needs_free)
-            free(op->data);
-    }
-
-    if (last_block) {
-        amfree(data);
+        if (!op->data_needs_free) {
+            op->copy = copy;
+            copy->refs++;
+        }
+        ops[i] = op;
+    }
+
+    /* wait for the slowest child to be less than RAIT_WRITE_WINDOW blocks
+     * behind, then queue the block to all of them */
+    g_mutex_lock(priv->write_mutex);
+    if (priv->nwrite_queued < num_children) {
+        priv->write_queued = g_renew(guint, priv->write_queued, num_children);
+        for (i = priv->nwrite_queued; i < num_children; i ++)
+            priv->write_queued[i] = 0;
+        priv->nwrite_queued = num_children;
+    }
+    for (i = 0; i < num_children && !priv->write_failed; i ++) {
+        while (priv->write_queued[i] >= RAIT_WRITE_WINDOW &&
+               !priv->write_failed)
+            g_cond_wait(priv->write_cond, priv->write_mutex);
+    }
+    failed = priv->write_failed;
+    if (!failed) {
+        for (i = 0; i < num_children; i ++)
+            priv->write_queued[i]++;
+    }
+    g_mutex_unlock(priv->write_mutex);
+
+    if (!failed) {
+        for (i = 0; i < num_children; i ++) {
+            if (g_thread_supported())
+                queue_thread_job(&priv->child_workers, i, write_block_do_op,
+                                 ops[i], NULL);
+            else
+                write_block_do_op(ops[i], NULL);
+        }
+    } else {
+        for (i = 0; i < num_children; i ++) {
+            if (ops[i]->data_needs_free)
+                g_free(ops[i]->data);
+            g_free(ops[i]);
+        }
+        g_free(copy->data);
+        g_free(copy);
     }
+    g_free(ops);
 
-    g_ptr_array_free_full(ops);
-
-    if (rait_result != WRITE_SUCCEED) {
+    if (failed) {
 	/* TODO be more specific here */
 	/* TODO: handle EOM here -- if one or more (or two or more??)
 	 * children have is_eom set, then reflect that in our error
@@ -1632,6 +2348,14 @@ rait_device_finish_file (Device * dself) {
     if (rait_device_in_error(dself)) return FALSE;
     if (self->private->status != RAIT_STATUS_COMPLETE) return FALSE;
 
+    if (!wait_for_writes(self)) {
+	device_set_error(dself,
+	    g_strdup("One or more devices failed to write_block"),
+	    DEVICE_STATUS_DEVICE_ERROR);
+        dself->is_eom = TRUE;
+        return FALSE;
+    }
+
     ops = make_generic_boolean_op_array(self);
 
     do_rait_child_ops(self, finish_file_do_op, ops);
@@ -1689,7 +2413,7 @@ rait_device_seek_file (Device * dself, guint file) {
     ops = g_ptr_array_sized_new(self->private->children->len);
     for (i = 0; i < self->private->children->len; i ++) {
         SeekFileOp * op;
-        if ((int)i == self->private->failed)
+        if (child_failed(self, i))
             continue; /* This device is broken. */
         op = g_new(SeekFileOp, 1);
         op->base.child = g_ptr_array_index(self->private->children, i);
@@ -1714,7 +2438,7 @@ rait_device_seek_file (Device * dself, guint file) {
 
         this_op = (SeekFileOp*)g_ptr_array_index(ops, i);
 
-        if ((signed)this_op->base.child_index == self->private->failed)
+        if (child_failed(self, this_op->base.child_index))
             continue;
 
         this_result = this_op->base.result;
@@ -1782,7 +2506,7 @@ rait_device_seek_block (Device * dself, guint64 block) {
     ops = g_ptr_array_sized_new(self->private->children->len);
     for (i = 0; i < self->private->children->len; i ++) {
         SeekBlockOp * op;
-        if ((int)i == self->private->failed)
+        if (child_failed(self, i))
             continue; /* This device is broken. */
         op = g_new(SeekBlockOp, 1);
         op->base.child = g_ptr_array_index(self->private->children, i);
@@ -1861,8 +2585,8 @@ static gboolean raid_block_reconstruction(RaitDevice * self, GPtrArray * ops,
     gsize blocksize;
     gsize child_blocksize;
     guint i;
-    int parity_child;
-    gpointer parity_block = NULL;
+    char ** chunks;
+    gboolean data_missing = FALSE;
     gboolean success;
 
     success = TRUE;
@@ -1870,47 +2594,38 @@ static gboolean raid_block_reconstruction(RaitDevice * self, GPtrArray * ops,
     blocksize = DEVICE(self)->block_size;
     find_simple_params(self, &num_children, &data_children);
 
-    if (num_children > 1)
-        parity_child = num_children - 1;
-    else
-        parity_child = -1;
-
     child_blocksize = blocksize / data_children;
 
+    /* the chunk read from each child, or NULL */
+    chunks = g_new0(char *, num_children);
     for (i = 0; i < ops->len; i ++) {
         ReadBlockOp * op = g_ptr_array_index(ops, i);
         if (!extract_boolean_read_block_op_data(op))
             continue;
-        if ((int)(op->base.child_index) == parity_child) {
-            parity_block = op->buffer;
-        } else {
-	    g_assert(child_blocksize * (op->base.child_index+1) <= bufsize);
-            memcpy((char *)buf + child_blocksize * op->base.child_index, op->buffer,
-                   child_blocksize);
+        chunks[op->base.child_index] = op->buffer;
+    }
+    for (i = 0; i < data_children; i ++) {
+        if (!chunks[i]) {
+            data_missing = TRUE;
+            continue;
         }
+	g_assert(child_blocksize * (i+1) <= bufsize);
+        memcpy((char *)buf + child_blocksize * i, chunks[i], child_blocksize);
     }
-    if (self->private->status == RAIT_STATUS_COMPLETE) {
-	g_assert(parity_block != NULL); /* should have found parity_child */
-
-        if (num_children >= 2) {
-            /* Verify the parity block. This code is inefficient but
-               does the job for the 2-device case, too. */
-            gpointer constructed_parity;
-            GPtrArray * data_extents;
-
-            constructed_parity = g_malloc(child_blocksize);
-            data_extents = g_ptr_array_sized_new(data_children);
-            for (i = 0; i < data_children; i ++) {
-                ReadBlockOp * op = g_ptr_array_index(ops, i);
-                g_assert(extract_boolean_read_block_op_data(op));
-                if ((int)op->base.child_index == parity_child)
-                    continue;
-                g_ptr_array_add(data_extents, op->buffer);
-            }
-            make_parity_block_extents(data_extents, constructed_parity,
-                                      child_blocksize);
 
-            if (0 != memcmp(parity_block, constructed_parity,
+    if (self->private->status == RAIT_STATUS_COMPLETE) {
+        /* Verify the parity blocks. This does nothing in the 1-device
+           case, and compares the mirrors in the 2-device case. */
+        gpointer constructed_parity;
+
+        g_assert(!data_missing);
+        constructed_parity = g_malloc(child_blocksize);
+        for (i = data_children; i < num_children && success; i ++) {
+            g_assert(chunks[i] != NULL);
+            make_parity_chunk(self, chunks, data_children, i - data_children,
+                              constructed_parity, child_blocksize);
+
+            if (0 != memcmp(chunks[i], constructed_parity,
                             child_blocksize)) {
                 device_set_error(DEVICE(self),
 		    g_strdup(_("RAIT is inconsistent: Parity block did not match data blocks.")),
@@ -1918,42 +2633,23 @@ static gboolean raid_block_reconstruction(RaitDevice * self, GPtrArray * ops,
 		/* TODO: can't we just isolate the device in this case? */
                 success = FALSE;
             }
-            g_ptr_array_free(data_extents, TRUE);
-            amfree(constructed_parity);
-        } else { /* do nothing. */ }
+        }
+        amfree(constructed_parity);
     } else if (self->private->status == RAIT_STATUS_DEGRADED) {
-	g_assert(self->private->failed >= 0 && self->private->failed < (int)num_children);
-        /* We are in degraded mode. What's missing? */
-        if (self->private->failed == parity_child) {
-            /* do nothing. */
-        } else if (num_children >= 2) {
-            /* Reconstruct failed block from parity block. */
-            GPtrArray * data_extents = g_ptr_array_new();
-
-            for (i = 0; i < data_children; i ++) {
-                ReadBlockOp * op = g_ptr_array_index(ops, i);
-                if (!extract_boolean_read_block_op_data(op))
-                    continue;
-                g_ptr_array_add(data_extents, op->buffer);
-            }
-
-            /* Conveniently, the reconstruction is the same procedure
-               as the parity generation. This even works if there is
-               only one remaining device! */
-            make_parity_block_extents(data_extents,
-                                      (char *)buf + (child_blocksize *
-                                             self->private->failed),
-                                      child_blocksize);
-
-            /* The array members belong to our ops argument. */
-            g_ptr_array_free(data_extents, TRUE);
-        } else {
-            g_assert_not_reached();
+        /* We are in degraded mode. Reconstruct the missing data blocks, if
+           it isn't only parity blocks that are missing. */
+        if (data_missing &&
+            !rebuild_data_chunks(self, chunks, buf, child_blocksize)) {
+            device_set_error(DEVICE(self),
+                g_strdup(_("Too few blocks read to reconstruct the RAIT block")),
+                DEVICE_STATUS_DEVICE_ERROR);
+            success = FALSE;
         }
     } else {
 	/* device is already in FAILED state -- we shouldn't even be here */
         success = FALSE;
     }
+    g_free(chunks);
     return success;
 }
 
@@ -1985,7 +2681,7 @@ rait_device_read_block (Device * dself, gpointer buf, int * size, int max_block)
     ops = g_ptr_array_sized_new(num_children);
     for (i = 0; i < num_children; i ++) {
         ReadBlockOp * op;
-        if ((int)i == self->private->failed)
+        if (child_failed(self, i))
             continue; /* This device is broken. */
         op = g_new(ReadBlockOp, 1);
         op->base.child = g_ptr_array_index(self->private->children, i);
@@ -2071,7 +2767,7 @@ static GPtrArray * make_property_op_array(RaitDevice * self,
     for (i = 0; i < self->private->children->len; i ++) {
         PropertyOp * op;
 
-        if ((signed)i == self->private->failed) {
+        if (child_failed(self, i)) {
             continue;
         }
 
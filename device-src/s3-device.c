@@ -34,6 +34,7 @@
 #include <dirent.h>
 #include <regex.h>
 #include <time.h>
+#include <utime.h>
 #include "amutil.h"
 #include "conffile.h"
 #include "device.h"
@@ -66,7 +67,20 @@
 /* Note: for compatability, min can only be decreased and max increased */
 #define S3_DEVICE_MIN_BLOCK_SIZE 1024
 #define S3_DEVICE_MAX_BLOCK_SIZE (3*1024*1024*1024ULL)
+
+/* Limits on S3_PART_SIZE; S3 allows parts of 5MiB to 5GiB, and 10000 parts */
+#define S3_DEVICE_MIN_PART_SIZE (5*1024*1024ULL)
+#define S3_DEVICE_MAX_PART_SIZE (1024*1024*1024ULL)
+#define S3_DEVICE_MAX_PARTS 10000
+#define S3_DEVICE_MAX_SWIFT_PARTS 1000
 #define S3_DEVICE_DEFAULT_BLOCK_SIZE (10*1024*1024)
+
+/* A glacier restore is kept 4 days; a key whose restore was requested less
+ * than that ago is not requested again */
+#define S3_DEVICE_RESTORE_VALID (3*86400)
+
+/* Default S3_CACHE_SIZE */
+#define S3_DEVICE_CACHE_SIZE (1024*1024*1024ULL)
 #define EOM_EARLY_WARNING_ZONE_BLOCKS 4
 
 /* This goes in lieu of file number for metadata. */
@@ -154,6 +168,18 @@ static DevicePropertyBase device_property_s3_subdomain;
 static DevicePropertyBase device_property_s3_multi_part_upload;
 #define PROPERTY_S3_MULTI_PART_UPLOAD (device_property_s3_multi_part_upload.ID)
 
+/* Size of the parts of a multi-part upload, if not the block size */
+static DevicePropertyBase device_property_s3_part_size;
+#define PROPERTY_S3_PART_SIZE (device_property_s3_part_size.ID)
+
+/* Largest ranged GET when reading a multi-part object */
+static DevicePropertyBase device_property_s3_read_ahead;
+#define PROPERTY_S3_READ_AHEAD (device_property_s3_read_ahead.ID)
+
+/* Whether to run the requests from one thread with curl_multi */
+static DevicePropertyBase device_property_s3_async;
+#define PROPERTY_S3_ASYNC (device_property_s3_async.ID)
+
 /* If the s3 server have the multi-delete functionality */
 static DevicePropertyBase device_property_s3_multi_delete;
 #define PROPERTY_S3_MULTI_DELETE (device_property_s3_multi_delete.ID)
@@ -187,6 +213,42 @@ static DevicePropertyBase device_property_transition_to_glacier;
 static DevicePropertyBase device_property_timeout;
 #define PROPERTY_TIMEOUT (device_property_timeout.ID)
 
+/* connection reuse and HTTP/2 */
+static DevicePropertyBase device_property_s3_share_connections;
+#define PROPERTY_S3_SHARE_CONNECTIONS (device_property_s3_share_connections.ID)
+static DevicePropertyBase device_property_s3_http2;
+#define PROPERTY_S3_HTTP2 (device_property_s3_http2.ID)
+static DevicePropertyBase device_property_s3_keepalive;
+#define PROPERTY_S3_KEEPALIVE (device_property_s3_keepalive.ID)
+static DevicePropertyBase device_property_s3_connection_idle_timeout;
+#define PROPERTY_S3_CONNECTION_IDLE_TIMEOUT (device_property_s3_connection_idle_timeout.ID)
+
+/* background deletion of recycled files */
+static DevicePropertyBase device_property_s3_delete_threads;
+#define PROPERTY_S3_DELETE_THREADS (device_property_s3_delete_threads.ID)
+
+/* how AWS4 uploads sign their payload */
+static DevicePropertyBase device_property_s3_payload_signing;
+#define PROPERTY_S3_PAYLOAD_SIGNING (device_property_s3_payload_signing.ID)
+
+/* local block cache */
+static DevicePropertyBase device_property_s3_cache_dir;
+#define PROPERTY_S3_CACHE_DIR (device_property_s3_cache_dir.ID)
+static DevicePropertyBase device_property_s3_cache_size;
+#define PROPERTY_S3_CACHE_SIZE (device_property_s3_cache_size.ID)
+static DevicePropertyBase device_property_s3_cache_runs;
+#define PROPERTY_S3_CACHE_RUNS (device_property_s3_cache_runs.ID)
+
+/* bandwidth shared by the devices of a process */
+static DevicePropertyBase device_property_s3_shaper;
+#define PROPERTY_S3_SHAPER (device_property_s3_shaper.ID)
+static DevicePropertyBase device_property_s3_shaper_send_speed;
+#define PROPERTY_S3_SHAPER_SEND_SPEED (device_property_s3_shaper_send_speed.ID)
+static DevicePropertyBase device_property_s3_shaper_recv_speed;
+#define PROPERTY_S3_SHAPER_RECV_SPEED (device_property_s3_shaper_recv_speed.ID)
+static DevicePropertyBase device_property_s3_shaper_weight;
+#define PROPERTY_S3_SHAPER_WEIGHT (device_property_s3_shaper_weight.ID)
+
 /* CAStor replication values for objects and buckets */
 static DevicePropertyBase device_property_s3_reps;
 #define PROPERTY_S3_REPS (device_property_s3_reps.ID)
@@ -305,6 +367,38 @@ setup_handle(S3Device * self);
 static void
 s3_wait_thread_delete(S3Device *self);
 
+static S3Handle *
+s3_device_open_handle(S3Device *self);
+
+static gboolean
+s3_device_configure_handle(S3Device *self, S3Handle *hdl);
+
+/* Queue OBJECTS for deletion by the background workers, after writing them
+ * to the journal.  If REPLACE, the listing includes everything already
+ * queued, which is dropped.
+ *
+ * @param self: the S3Device object
+ * @param objects: the keys to delete; taken by the queue
+ * @param replace: whether OBJECTS supersedes the queue
+ * @returns: FALSE, with the device error set, on error
+ */
+static gboolean
+delete_queue_add(S3Device *self, GSList *objects, gboolean replace);
+
+/* Wait until no key of FILE, or of any file if FILE is -1, is left to delete.
+ *
+ * @param self: the S3Device object
+ * @param file: the file that is written again, or -1
+ * @returns: FALSE, with the device error set, if the deletion failed
+ */
+static gboolean
+delete_queue_wait(S3Device *self, int file);
+
+/* Whether some keys of FILE are still queued for deletion; such files are
+ * not on the volume anymore. */
+static gboolean
+delete_queue_has_file(S3Device *self, int file);
+
 static gboolean
 catalog_open(S3Device *self);
 
@@ -319,6 +413,56 @@ catalog_remove(S3Device *self);
 static gboolean
 catalog_close(S3Device *self);
 
+static gboolean
+write_catalog(S3Device *self);
+
+static void
+catalog_index_reset(S3Device *self);
+
+static void
+catalog_add_file(S3Device *self,
+                 int       file,
+                 guint64   blocks,
+                 guint64   size,
+                 gboolean  multi_part);
+
+static void
+catalog_remove_file(S3Device *self,
+                    int       file);
+
+static gboolean
+catalog_index_valid(S3Device *self);
+
+/* Create the local block cache and bring it under S3_CACHE_SIZE; the cache
+ * is disabled if it can't be created. */
+static void
+cache_open(S3Device *self);
+
+/* Fill BUF with the cached copy of KEY; returns FALSE if there is none. */
+static gboolean
+cache_fetch(S3Device *self,
+            const char *key,
+            CurlBuffer *buf);
+
+/* Keep a copy of the SIZE bytes of KEY in the cache. */
+static void
+cache_store(S3Device *self,
+            const char *key,
+            const char *data,
+            guint64 size);
+
+/* Forget the cached keys starting with KEY_PREFIX. */
+static void
+cache_drop(S3Device *self,
+           const char *key_prefix);
+
+/* Record that this volume is being written, and drop the volumes of the
+ * runs older than the last S3_CACHE_RUNS. */
+static void
+cache_start_run(S3Device *self);
+
+gint gint_cmp(gconstpointer a, gconstpointer b, gpointer data);
+
 /*
  * class mechanics */
 
@@ -472,6 +616,70 @@ static gboolean s3_device_set_s3_multi_part_upload(Device *self,
     DevicePropertyBase *base, GValue *val,
     PropertySurety surety, PropertySource source);
 
+static gboolean s3_device_set_s3_async(Device *self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source);
+
+static gboolean s3_device_set_s3_part_size(Device *self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source);
+
+static gboolean s3_device_set_s3_read_ahead(Device *self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source);
+
+static gboolean s3_device_set_share_connections_fn(Device *self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source);
+
+static gboolean s3_device_set_http2_fn(Device *self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source);
+
+static gboolean s3_device_set_keepalive_fn(Device *self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source);
+
+static gboolean s3_device_set_connection_idle_timeout_fn(Device *self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source);
+
+static gboolean s3_device_set_delete_threads_fn(Device *self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source);
+
+static gboolean s3_device_set_payload_signing_fn(Device *self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source);
+
+static gboolean s3_device_set_cache_dir_fn(Device *self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source);
+
+static gboolean s3_device_set_cache_size_fn(Device *self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source);
+
+static gboolean s3_device_set_cache_runs_fn(Device *self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source);
+
+static gboolean s3_device_set_shaper_fn(Device *self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source);
+
+static gboolean s3_device_set_shaper_send_speed_fn(Device *self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source);
+
+static gboolean s3_device_set_shaper_recv_speed_fn(Device *self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source);
+
+static gboolean s3_device_set_shaper_weight_fn(Device *self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source);
+
 static gboolean s3_device_set_max_volume_usage_fn(Device *p_self,
     DevicePropertyBase *base, GValue *val,
     PropertySurety surety, PropertySource source);
@@ -524,6 +732,17 @@ static void s3_thread_read_block(gpointer thread_data,
 				 gpointer data);
 static void s3_thread_write_block(gpointer thread_data,
 				  gpointer data);
+static void s3_thread_restore_block(gpointer thread_data,
+				    gpointer data);
+static void s3_async_delete_next(S3Device *self, S3_by_thread *s3t);
+static void s3_start_write_block(S3Device *self, S3_by_thread *s3t);
+static guint s3_device_part_size(S3Device *self);
+static DeviceWriteResult s3_device_write_part(S3Device *self);
+static void s3_write_block_done(S3Device *self, S3_by_thread *s3t,
+				gboolean result, char *etag);
+static void s3_start_read_block(S3Device *self, S3_by_thread *s3t);
+static void s3_read_block_done(S3Device *self, S3_by_thread *s3t,
+			       gboolean result);
 static gboolean make_bucket(Device * pself);
 
 
@@ -561,6 +780,20 @@ static gboolean
 s3_device_start_file(Device * self,
                      dumpfile_t * jobInfo);
 
+static DeviceWriteResult
+s3_device_write_block_ref(Device * self,
+                          guint size,
+                          gpointer data,
+                          DeviceReleaseFunc release,
+                          gpointer release_data);
+
+static DeviceWriteResult
+s3_device_write_block_common(Device * self,
+                             guint size,
+                             gpointer data,
+                             DeviceReleaseFunc release,
+                             gpointer release_data);
+
 static DeviceWriteResult
 s3_device_write_block(Device * self,
                       guint size,
@@ -577,6 +810,20 @@ static dumpfile_t*
 s3_device_seek_file(Device *pself,
                     guint file);
 
+static void
+s3_device_prefetch_file(Device *pself,
+                        guint file);
+
+static void
+s3_prefetch_discard(S3Device *self);
+
+static void
+s3_device_cancel(Device *pself);
+
+static void
+s3_device_set_cancelled(S3Device *self,
+                        gboolean cancelled);
+
 static gboolean
 s3_device_seek_block(Device *pself,
                      guint64 block);
@@ -591,6 +838,16 @@ static gboolean
 s3_device_recycle_file(Device *pself,
                        guint file);
 
+static gboolean
+s3_device_can_copy_file_from(Device *pself,
+			     Device *psrc);
+
+static gboolean
+s3_device_copy_file_from(Device *pself,
+			 Device *psrc,
+			 dumpfile_t *jobInfo,
+			 guint64 *size);
+
 static gboolean
 s3_device_erase(Device *pself);
 
@@ -694,6 +951,7 @@ write_amanda_header(S3Device *self,
     }
 
     /* write out the header and flush the uploads. */
+    catalog_index_reset(self);
     catalog_reset(self, amanda_header.buffer, label);
     key = special_file_to_key(self, "tapestart", -1);
     g_assert(header_size < G_MAXUINT); /* for cast to guint */
@@ -713,6 +971,10 @@ write_amanda_header(S3Device *self,
 	dumpfile_free(d_self->volume_header);
 	d_self->volume_header = dumpinfo;
         self->volume_bytes += header_size;
+	if (self->catalog_files) {
+	    self->catalog_bytes = self->volume_bytes;
+	    write_catalog(self);
+	}
     }
     d_self->header_block_size = header_size;
     return result;
@@ -783,7 +1045,8 @@ abort_partial_upload(S3Device *self)
     GSList *objects;
     s3_object *part = NULL;
 
-    if (!self->use_s3_multi_part_upload)
+    /* the segments of a Swift upload are deleted with their file */
+    if (!self->use_s3_multi_part_upload || S3_API_IS_SWIFT(self->s3_api))
 	return TRUE;
 
     result = s3_list_keys(self->s3t[0].s3, self->bucket, "uploads", self->prefix, NULL, &objects, NULL);
@@ -805,6 +1068,31 @@ abort_partial_upload(S3Device *self)
     return TRUE;
 }
 
+static gboolean
+catalog_last_file(
+    gpointer key,
+    gpointer value G_GNUC_UNUSED,
+    gpointer data)
+{
+    *(int *)data = GPOINTER_TO_INT(key);
+    return FALSE;
+}
+
+static gboolean
+catalog_next_file(
+    gpointer key,
+    gpointer value G_GNUC_UNUSED,
+    gpointer data)
+{
+    int file = GPOINTER_TO_INT(key);
+
+    if (file > *(int *)data) {
+	*(int *)data = file;
+	return TRUE;
+    }
+    return FALSE;
+}
+
 /* Find the number of the last file that contains any data (even just a header).
  * Returns -1 in event of an error
  */
@@ -816,6 +1104,11 @@ find_last_file(S3Device *self) {
     int last_file = 0;
     Device *d_self = DEVICE(self);
 
+    if (catalog_index_valid(self)) {
+	g_tree_foreach(self->catalog_files, catalog_last_file, &last_file);
+	return last_file;
+    }
+
     /* list all keys matching C{PREFIX*-*}, stripping the C{-*} */
     result = s3_list_keys(self->s3t[0].s3, self->bucket, NULL, self->prefix, "-", &keys, NULL);
     if (!result) {
@@ -830,7 +1123,7 @@ find_last_file(S3Device *self) {
         int file = key_to_file(prefix_len, object->prefix);
 
         /* and if it's the last, keep it */
-        if (file > last_file)
+        if (file > last_file && !delete_queue_has_file(self, file))
             last_file = file;
     }
 
@@ -848,6 +1141,12 @@ find_next_file(S3Device *self, int last_file) {
     int next_file = 0;
     Device *d_self = DEVICE(self);
 
+    if (catalog_index_valid(self)) {
+	next_file = last_file;
+	g_tree_foreach(self->catalog_files, catalog_next_file, &next_file);
+	return next_file == last_file ? 0 : next_file;
+    }
+
     /* list all keys matching C{PREFIX*-*}, stripping the C{-*} */
     result = s3_list_keys(self->s3t[0].s3, self->bucket, NULL, self->prefix, "-",
 			  &objects, NULL);
@@ -871,7 +1170,8 @@ find_next_file(S3Device *self, int last_file) {
             next_file = -1;
         }
 
-        if (file < next_file && file > last_file) {
+        if (file < next_file && file > last_file &&
+	    !delete_queue_has_file(self, file)) {
             next_file = file;
         }
     }
@@ -896,6 +1196,7 @@ delete_file(S3Device *self,
     } else {
 	my_prefix = g_strdup_printf("%sf%08x-", self->prefix, file);
     }
+    cache_drop(self, my_prefix);
 
     result = s3_list_keys(self->s3t[0].s3, self->bucket, NULL, my_prefix, NULL,
 			  &objects, &total_size);
@@ -917,6 +1218,11 @@ delete_file(S3Device *self,
         return FALSE;
     }
 
+    if (self->delete_threads) {
+	self->volume_bytes = total_size;
+	return delete_queue_add(self, objects, file == -1);
+    }
+
     g_mutex_lock(self->thread_idle_mutex);
     if (!self->objects) {
 	self->objects = objects;
@@ -945,11 +1251,20 @@ delete_file(S3Device *self,
 	    }
 	    self->s3t[thread].idle = 0;
 	    self->s3t[thread].done = 0;
-	    g_thread_pool_push(self->thread_pool_delete, &self->s3t[thread],
-			       NULL);
+	    if (self->s3_multi && !self->use_s3_multi_delete) {
+		s3_async_delete_next(self, &self->s3t[thread]);
+	    } else {
+		amexec_queue_push(self->thread_pool_delete, &self->s3t[thread]);
+	    }
 	}
     }
-    g_cond_wait(self->thread_idle_cond, self->thread_idle_mutex);
+    /* an asynchronous delete chain may already have finished */
+    for (thread = 0; thread < self->nb_threads; thread++)  {
+	if (self->s3t[thread].idle == 0)
+	    break;
+    }
+    if (thread < self->nb_threads)
+	g_cond_wait(self->thread_idle_cond, self->thread_idle_mutex);
     g_mutex_unlock(self->thread_idle_mutex);
 
     self->volume_bytes = total_size;
@@ -1034,6 +1349,59 @@ s3_thread_delete_block(
     g_mutex_unlock(self->thread_idle_mutex);
 }
 
+static void
+s3_async_delete_done(
+    S3Handle *hdl G_GNUC_UNUSED,
+    gboolean success,
+    gpointer data)
+{
+    S3_by_thread *s3t = (S3_by_thread *)data;
+    S3Device *self = S3_DEVICE(s3t->device);
+
+    if (!success) {
+	s3t->errflags = DEVICE_STATUS_DEVICE_ERROR | DEVICE_STATUS_VOLUME_ERROR;
+	s3t->errmsg = g_strdup_printf(_("While deleting key '%s': %s"),
+				      s3t->filename, s3_strerror(s3t->s3));
+    }
+    g_free(s3t->filename);
+    s3t->filename = NULL;
+
+    g_mutex_lock(self->thread_idle_mutex);
+    s3_async_delete_next(self, s3t);
+    g_mutex_unlock(self->thread_idle_mutex);
+}
+
+/* Submit the deletion of the next object on S3T's handle, or mark S3T idle if
+ * there is none left or the last deletion failed.  Called with
+ * thread_idle_mutex held. */
+static void
+s3_async_delete_next(
+    S3Device *self,
+    S3_by_thread *s3t)
+{
+    s3_object *object;
+
+    if (s3t->errflags == DEVICE_STATUS_SUCCESS && self->objects) {
+	object = self->objects->data;
+	self->objects = g_slist_remove(self->objects, object);
+	s3t->filename = object->key;
+	if (s3_delete_async(self->s3_multi, s3t->s3,
+			    (const char *)self->bucket,
+			    (const char *)s3t->filename,
+			    s3_async_delete_done, s3t)) {
+	    return;
+	}
+	s3t->errflags = DEVICE_STATUS_DEVICE_ERROR | DEVICE_STATUS_VOLUME_ERROR;
+	s3t->errmsg = g_strdup_printf(_("While deleting key '%s': %s"),
+				      s3t->filename, s3_strerror(s3t->s3));
+	g_free(s3t->filename);
+	s3t->filename = NULL;
+    }
+    s3t->idle = 1;
+    s3t->done = 1;
+    g_cond_broadcast(self->thread_idle_cond);
+}
+
 static void
 s3_wait_thread_delete(S3Device *self)
 {
@@ -1064,63 +1432,435 @@ s3_wait_thread_delete(S3Device *self)
 }
 
 
+/*
+ * Background deletion
+ *
+ * With S3_DELETE_THREADS, the keys of recycled or relabeled files are written
+ * to a journal next to the catalog and deleted in batches by a pool of workers
+ * with their own handles, instead of before returning.  The journal holds
+ * "KEY: <key>" lines, and a "DONE: <file>" line once a file number is about to
+ * be written again, after which the earlier keys of that file are not deleted
+ * anymore.  It is replayed when the device is set up again, and removed once
+ * the queue is drained.  All of it is protected by delete_mutex.
+ */
+
+/* Count N more (or fewer) keys of the file of KEY to delete */
+static void
+delete_file_count(
+    S3Device *self,
+    const char *key,
+    int n)
+{
+    gpointer file = GINT_TO_POINTER(key_to_file(strlen(self->prefix), key));
+    int count = GPOINTER_TO_INT(g_hash_table_lookup(self->delete_files, file));
+
+    count += n;
+    if (count > 0)
+	g_hash_table_insert(self->delete_files, file, GINT_TO_POINTER(count));
+    else
+	g_hash_table_remove(self->delete_files, file);
+}
+
+/* Write LINES to the journal, replacing it if TRUNCATE, and sync it */
 static gboolean
-delete_all_files(S3Device *self)
+delete_journal_write(
+    S3Device *self,
+    GString *lines,
+    gboolean truncate)
 {
-    return delete_file(self, -1);
+    FILE *file;
+    gboolean ok;
+
+    if (!self->delete_journal)
+	return FALSE;
+    file = fopen(self->delete_journal, truncate ? "w" : "a");
+    if (!file) {
+	g_debug("Can't open S3 delete journal '%s': %s", self->delete_journal,
+		strerror(errno));
+	return FALSE;
+    }
+    ok = fputs(lines->str, file) >= 0 && fflush(file) == 0 &&
+	 fsync(fileno(file)) == 0;
+    if (fclose(file) != 0)
+	ok = FALSE;
+    if (!ok) {
+	g_debug("Can't write S3 delete journal '%s': %s", self->delete_journal,
+		strerror(errno));
+    }
+    return ok;
 }
 
-/*
- * Class mechanics
- */
+static void
+s3_thread_background_delete(
+    gpointer thread_data,
+    gpointer data)
+{
+    S3_by_thread *s3t = (S3_by_thread *)thread_data;
+    S3Device *self = S3_DEVICE(data);
+    GSList *batch, *link;
+    int n, result;
+
+    g_mutex_lock(self->delete_mutex);
+    while (self->delete_objects && !self->delete_stop) {
+	gboolean multi = self->use_s3_multi_delete;
+
+	/* take a batch from the head of the queue */
+	batch = NULL;
+	for (n = 0; self->delete_objects && n < (multi ? 1000 : 1); n++) {
+	    link = self->delete_objects;
+	    self->delete_objects = g_slist_remove_link(self->delete_objects,
+						       link);
+	    batch = g_slist_concat(link, batch);
+	}
+	g_mutex_unlock(self->delete_mutex);
 
-void
-s3_device_register(void)
+	if (multi) {
+	    result = s3_multi_delete(s3t->s3, (const char *)self->bucket,
+				     batch);
+	    if (result == 2) {
+		g_debug("Deleting multiple keys not implemented");
+	    } else if (result == 0) {
+		g_debug("Deleteing multiple keys failed: %s",
+			s3_strerror(s3t->s3));
+	    }
+	} else {
+	    result = s3_delete(s3t->s3, (const char *)self->bucket,
+			       ((s3_object *)batch->data)->key);
+	}
+
+	g_mutex_lock(self->delete_mutex);
+	if (result == 1) {
+	    for (link = batch; link; link = link->next)
+		delete_file_count(self, ((s3_object *)link->data)->key, -1);
+	    slist_free_full(batch, free_s3_object);
+	} else {
+	    /* put the batch back; one key at a time if it was several */
+	    self->delete_objects = g_slist_concat(g_slist_reverse(batch),
+						  self->delete_objects);
+	    if (multi) {
+		self->use_s3_multi_delete = 0;
+	    } else {
+		g_free(self->delete_errmsg);
+		self->delete_errmsg = g_strdup_printf(
+			_("While deleting key '%s': %s"),
+			((s3_object *)self->delete_objects->data)->key,
+			s3_strerror(s3t->s3));
+		self->delete_stop = TRUE;
+	    }
+	}
+	g_cond_broadcast(self->delete_cond);
+    }
+    s3t->idle = 1;
+    self->delete_active--;
+    if (self->delete_active == 0 && !self->delete_objects &&
+	self->delete_journal_active) {
+	/* everything is gone */
+	unlink(self->delete_journal);
+	self->delete_journal_active = FALSE;
+    }
+    g_cond_broadcast(self->delete_cond);
+    g_mutex_unlock(self->delete_mutex);
+}
+
+/* Open the workers' handles and start the pool, the first time */
+static gboolean
+delete_start_workers(
+    S3Device *self)
 {
-    static const char * device_prefix_list[] = { S3_DEVICE_NAME, NULL };
-    g_assert(s3_init());
+    Device *d_self = DEVICE(self);
+    guint thread;
 
-    /* set up our properties */
-    device_property_fill_and_register(&device_property_s3_secret_key,
-                                      G_TYPE_STRING, "s3_secret_key",
-       "Secret access key to authenticate with Amazon S3");
-    device_property_fill_and_register(&device_property_s3_access_key,
-                                      G_TYPE_STRING, "s3_access_key",
-       "Access key ID to authenticate with Amazon S3");
-    device_property_fill_and_register(&device_property_s3_session_token,
-                                      G_TYPE_STRING, "s3_session_token",
-       "Session token to authenticate with Amazon S3");
-    device_property_fill_and_register(&device_property_swift_account_id,
-                                      G_TYPE_STRING, "swift_account_id",
-       "Account ID to authenticate with openstack swift");
-    device_property_fill_and_register(&device_property_swift_access_key,
-                                      G_TYPE_STRING, "swift_access_key",
-       "Access key to authenticate with openstack swift");
-    device_property_fill_and_register(&device_property_username,
-                                      G_TYPE_STRING, "username",
-       "Username to authenticate with");
-    device_property_fill_and_register(&device_property_password,
-                                      G_TYPE_STRING, "password",
-       "password to authenticate with");
-    device_property_fill_and_register(&device_property_tenant_id,
-                                      G_TYPE_STRING, "tenant_id",
-       "tenant_id to authenticate with");
-    device_property_fill_and_register(&device_property_tenant_name,
-                                      G_TYPE_STRING, "tenant_name",
-       "tenant_name to authenticate with");
-    device_property_fill_and_register(&device_property_project_name,
-                                      G_TYPE_STRING, "project_name",
-       "project_name to authenticate with");
-    device_property_fill_and_register(&device_property_domain_name,
-                                      G_TYPE_STRING, "domain_name",
-       "domain_name to authenticate with");
-    device_property_fill_and_register(&device_property_s3_host,
-                                      G_TYPE_STRING, "s3_host",
-       "hostname:port of the server");
-    device_property_fill_and_register(&device_property_s3_service_path,
-                                      G_TYPE_STRING, "s3_service_path",
-       "path to add in the url");
-    device_property_fill_and_register(&device_property_s3_user_token,
+    if (self->thread_pool_background_delete)
+	return TRUE;
+
+    self->s3t_delete = g_new0(S3_by_thread, self->delete_threads);
+    for (thread = 0; thread < self->delete_threads; thread++) {
+	S3_by_thread *s3t = &self->s3t_delete[thread];
+
+	s3t->idle = 1;
+	s3t->done = 1;
+	s3t->errflags = DEVICE_STATUS_SUCCESS;
+	s3t->device = self;
+	s3t->s3 = s3_device_open_handle(self);
+	if (!s3t->s3) {
+	    device_set_error(d_self,
+		g_strdup(_("Internal error creating S3 handle")),
+		DEVICE_STATUS_DEVICE_ERROR);
+	    return FALSE;
+	}
+	if (!s3_device_configure_handle(self, s3t->s3))
+	    return FALSE;
+	if (!s3_open2(s3t->s3)) {
+	    device_set_error(d_self,
+		g_strdup_printf(_("s3_open2 failed: %s"), s3_strerror(s3t->s3)),
+		DEVICE_STATUS_DEVICE_ERROR);
+	    return FALSE;
+	}
+    }
+
+    g_debug("Create %d delete threads", (int)self->delete_threads);
+    self->thread_pool_background_delete = amexec_queue_new("s3-background-delete",
+			s3_thread_background_delete, self,
+			self->delete_threads, AMEXEC_PRIORITY_LOW, AMEXEC_BLOCKING);
+    return TRUE;
+}
+
+/* Put the idle workers to work.  Called with delete_mutex held. */
+static void
+delete_kick_workers(
+    S3Device *self)
+{
+    guint thread;
+
+    for (thread = 0; thread < self->delete_threads; thread++) {
+	if (!self->delete_objects || self->delete_stop)
+	    break;
+	if (self->s3t_delete[thread].idle) {
+	    self->s3t_delete[thread].idle = 0;
+	    self->delete_active++;
+	    amexec_queue_push(self->thread_pool_background_delete,
+			      &self->s3t_delete[thread]);
+	}
+    }
+}
+
+static gboolean
+delete_queue_add(
+    S3Device *self,
+    GSList *objects,
+    gboolean replace)
+{
+    GString *lines = g_string_new("");
+    GSList *link;
+    gboolean journaled;
+
+    if (!delete_start_workers(self)) {
+	slist_free_full(objects, free_s3_object);
+	g_string_free(lines, TRUE);
+	return FALSE;
+    }
+
+    g_mutex_lock(self->delete_mutex);
+    if (replace) {
+	for (link = self->delete_objects; link; link = link->next)
+	    delete_file_count(self, ((s3_object *)link->data)->key, -1);
+	slist_free_full(self->delete_objects, free_s3_object);
+	self->delete_objects = NULL;
+    }
+    for (link = objects; link; link = link->next) {
+	s3_object *object = (s3_object *)link->data;
+
+	g_string_append_printf(lines, "KEY: %s\n", object->key);
+	delete_file_count(self, object->key, 1);
+    }
+    self->delete_objects = g_slist_concat(self->delete_objects, objects);
+
+    journaled = delete_journal_write(self, lines, replace);
+    if (journaled)
+	self->delete_journal_active = TRUE;
+
+    /* a previous failure is retried with the new keys */
+    if (self->delete_active == 0) {
+	self->delete_stop = FALSE;
+	amfree(self->delete_errmsg);
+    }
+    delete_kick_workers(self);
+    g_mutex_unlock(self->delete_mutex);
+    g_string_free(lines, TRUE);
+
+    /* without the journal, the keys must be gone before going on */
+    if (!journaled)
+	return delete_queue_wait(self, -1);
+    return TRUE;
+}
+
+static gboolean
+delete_queue_wait(
+    S3Device *self,
+    int file)
+{
+    Device *d_self = DEVICE(self);
+    gboolean done;
+
+    if (!self->delete_mutex)
+	return TRUE;
+
+    g_mutex_lock(self->delete_mutex);
+    while (1) {
+	if (file == -1)
+	    done = g_hash_table_size(self->delete_files) == 0;
+	else
+	    done = !g_hash_table_lookup(self->delete_files,
+					GINT_TO_POINTER(file));
+	if (done || (self->delete_active == 0 && self->delete_stop))
+	    break;
+	delete_kick_workers(self);
+	g_cond_wait(self->delete_cond, self->delete_mutex);
+    }
+
+    if (!done) {
+	device_set_error(d_self,
+	    g_strdup(self->delete_errmsg ? self->delete_errmsg :
+		     _("Deletion of old S3 keys was interrupted")),
+	    DEVICE_STATUS_DEVICE_ERROR | DEVICE_STATUS_VOLUME_ERROR);
+    } else if (file > 0 && self->delete_journal_active) {
+	/* the older keys of FILE must not be deleted after a replay */
+	GString *line = g_string_new("");
+
+	g_string_printf(line, "DONE: %d\n", file);
+	if (!delete_journal_write(self, line, FALSE)) {
+	    device_set_error(d_self,
+		g_strdup_printf(_("Can't write S3 delete journal '%s'"),
+				self->delete_journal),
+		DEVICE_STATUS_DEVICE_ERROR);
+	    done = FALSE;
+	}
+	g_string_free(line, TRUE);
+    }
+    g_mutex_unlock(self->delete_mutex);
+
+    return done;
+}
+
+static gboolean
+delete_queue_has_file(
+    S3Device *self,
+    int file)
+{
+    gboolean found;
+
+    if (!self->delete_mutex)
+	return FALSE;
+
+    g_mutex_lock(self->delete_mutex);
+    found = g_hash_table_lookup(self->delete_files,
+				GINT_TO_POINTER(file)) != NULL;
+    g_mutex_unlock(self->delete_mutex);
+
+    return found;
+}
+
+/* Queue the keys left in the journal of a previous run */
+static void
+delete_journal_replay(
+    S3Device *self)
+{
+    FILE *file;
+    char line[S3_MAX_KEY_LENGTH + 16];
+    guint prefix_len = strlen(self->prefix);
+    GSList *keys = NULL, *objects = NULL, *link;
+    GHashTable *done;
+    gint lineno = 0;
+
+    file = fopen(self->delete_journal, "r");
+    if (!file)
+	return;
+
+    /* the line of the last DONE of each file */
+    done = g_hash_table_new(g_direct_hash, g_direct_equal);
+    while (fgets(line, sizeof(line), file)) {
+	int filenum;
+
+	lineno++;
+	if (line[0] && line[strlen(line)-1] == '\n')
+	    line[strlen(line)-1] = '\0';
+	if (g_str_has_prefix(line, "KEY: ")) {
+	    s3_object *object = g_new0(s3_object, 1);
+	    object->key = g_strdup(line + 5);
+	    object->size = lineno;	/* until filtered below */
+	    keys = g_slist_prepend(keys, object);
+	} else if (sscanf(line, "DONE: %d", &filenum) == 1) {
+	    g_hash_table_insert(done, GINT_TO_POINTER(filenum),
+				GINT_TO_POINTER(lineno));
+	}
+    }
+    fclose(file);
+
+    for (link = keys; link; link = link->next) {
+	s3_object *object = (s3_object *)link->data;
+	gpointer file_done = g_hash_table_lookup(done,
+			GINT_TO_POINTER(key_to_file(prefix_len, object->key)));
+
+	if (file_done && GPOINTER_TO_INT(file_done) > (gint)object->size) {
+	    free_s3_object(object);
+	} else {
+	    object->size = 0;
+	    objects = g_slist_prepend(objects, object);
+	}
+    }
+    g_slist_free(keys);
+    g_hash_table_destroy(done);
+
+    if (!objects) {
+	unlink(self->delete_journal);
+	return;
+    }
+    g_debug("Resuming the deletion of %d old S3 keys",
+	    g_slist_length(objects));
+    /* the journal is honoured even if S3_DELETE_THREADS is not set anymore */
+    if (self->delete_threads == 0)
+	self->delete_threads = 1;
+    /* rewrites the journal without the keys that are done */
+    delete_queue_add(self, objects, TRUE);
+}
+
+static gboolean
+delete_all_files(S3Device *self)
+{
+    return delete_file(self, -1);
+}
+
+/*
+ * Class mechanics
+ */
+
+void
+s3_device_register(void)
+{
+    static const char * device_prefix_list[] = { S3_DEVICE_NAME, NULL };
+    g_assert(s3_init());
+
+    /* set up our properties */
+    device_property_fill_and_register(&device_property_s3_secret_key,
+                                      G_TYPE_STRING, "s3_secret_key",
+       "Secret access key to authenticate with Amazon S3");
+    device_property_fill_and_register(&device_property_s3_access_key,
+                                      G_TYPE_STRING, "s3_access_key",
+       "Access key ID to authenticate with Amazon S3");
+    device_property_fill_and_register(&device_property_s3_session_token,
+                                      G_TYPE_STRING, "s3_session_token",
+       "Session token to authenticate with Amazon S3");
+    device_property_fill_and_register(&device_property_swift_account_id,
+                                      G_TYPE_STRING, "swift_account_id",
+       "Account ID to authenticate with openstack swift");
+    device_property_fill_and_register(&device_property_swift_access_key,
+                                      G_TYPE_STRING, "swift_access_key",
+       "Access key to authenticate with openstack swift");
+    device_property_fill_and_register(&device_property_username,
+                                      G_TYPE_STRING, "username",
+       "Username to authenticate with");
+    device_property_fill_and_register(&device_property_password,
+                                      G_TYPE_STRING, "password",
+       "password to authenticate with");
+    device_property_fill_and_register(&device_property_tenant_id,
+                                      G_TYPE_STRING, "tenant_id",
+       "tenant_id to authenticate with");
+    device_property_fill_and_register(&device_property_tenant_name,
+                                      G_TYPE_STRING, "tenant_name",
+       "tenant_name to authenticate with");
+    device_property_fill_and_register(&device_property_project_name,
+                                      G_TYPE_STRING, "project_name",
+       "project_name to authenticate with");
+    device_property_fill_and_register(&device_property_domain_name,
+                                      G_TYPE_STRING, "domain_name",
+       "domain_name to authenticate with");
+    device_property_fill_and_register(&device_property_s3_host,
+                                      G_TYPE_STRING, "s3_host",
+       "hostname:port of the server");
+    device_property_fill_and_register(&device_property_s3_service_path,
+                                      G_TYPE_STRING, "s3_service_path",
+       "path to add in the url");
+    device_property_fill_and_register(&device_property_s3_user_token,
                                       G_TYPE_STRING, "s3_user_token",
        "User token for authentication Amazon devpay requests");
     device_property_fill_and_register(&device_property_s3_bucket_location,
@@ -1181,10 +1921,58 @@ s3_device_register(void)
     device_property_fill_and_register(&device_property_s3_multi_part_upload,
                                       G_TYPE_BOOLEAN, "s3_multi_part_upload",
        "If multi part upload must be used");
+    device_property_fill_and_register(&device_property_s3_part_size,
+                                      G_TYPE_UINT64, "s3_part_size",
+       "Size of the parts of a multi part upload (0 for the block size)");
+    device_property_fill_and_register(&device_property_s3_read_ahead,
+                                      G_TYPE_UINT64, "s3_read_ahead",
+       "Largest ranged GET when reading a multi part object (0 for the block size)");
+    device_property_fill_and_register(&device_property_s3_async,
+                                      G_TYPE_BOOLEAN, "s3_async",
+       "Run the requests from one thread with curl_multi");
 
     device_property_fill_and_register(&device_property_timeout,
                                       G_TYPE_UINT64, "timeout",
        "The timeout for one tranfer");
+    device_property_fill_and_register(&device_property_s3_share_connections,
+                                      G_TYPE_BOOLEAN, "s3_share_connections",
+       "Share connections and TLS sessions between the handles of a process");
+    device_property_fill_and_register(&device_property_s3_http2,
+                                      G_TYPE_BOOLEAN, "s3_http2",
+       "Use HTTP/2 over TLS when the server supports it");
+    device_property_fill_and_register(&device_property_s3_keepalive,
+                                      G_TYPE_UINT64, "s3_keepalive",
+       "Idle seconds before sending TCP keepalive probes (0 to disable)");
+    device_property_fill_and_register(&device_property_s3_connection_idle_timeout,
+                                      G_TYPE_UINT64, "s3_connection_idle_timeout",
+       "Idle seconds after which a cached connection is not reused");
+    device_property_fill_and_register(&device_property_s3_delete_threads,
+                                      G_TYPE_UINT64, "s3_delete_threads",
+       "Threads deleting recycled files in the background (0 to wait for the deletion)");
+    device_property_fill_and_register(&device_property_s3_payload_signing,
+                                      G_TYPE_STRING, "s3_payload_signing",
+       "How AWS4 uploads sign their payload: SIGNED, UNSIGNED or STREAMING");
+    device_property_fill_and_register(&device_property_s3_cache_dir,
+                                      G_TYPE_STRING, "s3_cache_dir",
+       "Directory of a local cache of the blocks read and written");
+    device_property_fill_and_register(&device_property_s3_cache_size,
+                                      G_TYPE_UINT64, "s3_cache_size",
+       "Maximum size of the S3_CACHE_DIR cache, in bytes");
+    device_property_fill_and_register(&device_property_s3_cache_runs,
+                                      G_TYPE_UINT64, "s3_cache_runs",
+       "Number of the most recent write runs kept in the S3_CACHE_DIR cache");
+    device_property_fill_and_register(&device_property_s3_shaper,
+                                      G_TYPE_STRING, "s3_shaper",
+       "Name of the bandwidth pool shared with the other devices of the process");
+    device_property_fill_and_register(&device_property_s3_shaper_send_speed,
+                                      G_TYPE_UINT64, "s3_shaper_send_speed",
+       "Maximum speed of all the uploads of the S3_SHAPER pool, in bytes/sec");
+    device_property_fill_and_register(&device_property_s3_shaper_recv_speed,
+                                      G_TYPE_UINT64, "s3_shaper_recv_speed",
+       "Maximum speed of all the downloads of the S3_SHAPER pool, in bytes/sec");
+    device_property_fill_and_register(&device_property_s3_shaper_weight,
+                                      G_TYPE_UINT64, "s3_shaper_weight",
+       "Share of the S3_SHAPER pool this device gets, relative to the others");
 
     /* register the device itself */
     register_device(s3_device_factory, device_prefix_list);
@@ -1232,11 +2020,22 @@ s3_device_init(S3Device * self)
     self->nb_threads_backup = 1;
     self->nb_threads_recovery = 1;
     self->use_s3_multi_part_upload = FALSE;
+    self->set_s3_multi_part_upload = FALSE;
     self->thread_pool_delete = NULL;
+    self->thread_pool_restore = NULL;
     self->thread_pool_write = NULL;
     self->thread_pool_read = NULL;
     self->thread_idle_cond = NULL;
     self->thread_idle_mutex = NULL;
+    self->s3_async = FALSE;
+    self->s3_multi = NULL;
+    self->part_size = 0;
+    self->part_buffer = NULL;
+    self->part_buffer_size = 0;
+    self->part_buffer_len = 0;
+    self->part_number = 0;
+    self->read_ahead = 0;
+    self->read_span = 0;
     self->use_s3_multi_delete = 1;
     self->set_s3_multi_delete = 0;
     self->reps = NULL;
@@ -1323,19 +2122,25 @@ s3_device_class_init(S3DeviceClass * c G_GNUC_UNUSED)
     device_class->read_label = s3_device_read_label;
     device_class->start = s3_device_start;
     device_class->finish = s3_device_finish;
+    device_class->cancel = s3_device_cancel;
     device_class->get_bytes_read = s3_device_get_bytes_read;
     device_class->get_bytes_written = s3_device_get_bytes_written;
 
     device_class->start_file = s3_device_start_file;
     device_class->write_block = s3_device_write_block;
+    device_class->write_block_ref = s3_device_write_block_ref;
     device_class->finish_file = s3_device_finish_file;
 
     device_class->init_seek_file = s3_device_init_seek_file;
     device_class->seek_file = s3_device_seek_file;
+    device_class->prefetch_file = s3_device_prefetch_file;
     device_class->seek_block = s3_device_seek_block;
     device_class->read_block = s3_device_read_block;
     device_class->recycle_file = s3_device_recycle_file;
 
+    device_class->can_copy_file_from = s3_device_can_copy_file_from;
+    device_class->copy_file_from = s3_device_copy_file_from;
+
     device_class->erase = s3_device_erase;
     device_class->set_reuse = s3_device_set_reuse;
     device_class->set_no_reuse = s3_device_set_no_reuse;
@@ -1499,6 +2304,71 @@ s3_device_base_init(
 	    device_simple_property_get_fn,
 	    s3_device_set_timeout_fn);
 
+    device_class_register_property(device_class, PROPERTY_S3_SHARE_CONNECTIONS,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    s3_device_set_share_connections_fn);
+
+    device_class_register_property(device_class, PROPERTY_S3_HTTP2,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    s3_device_set_http2_fn);
+
+    device_class_register_property(device_class, PROPERTY_S3_KEEPALIVE,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    s3_device_set_keepalive_fn);
+
+    device_class_register_property(device_class, PROPERTY_S3_CONNECTION_IDLE_TIMEOUT,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    s3_device_set_connection_idle_timeout_fn);
+
+    device_class_register_property(device_class, PROPERTY_S3_DELETE_THREADS,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    s3_device_set_delete_threads_fn);
+
+    device_class_register_property(device_class, PROPERTY_S3_PAYLOAD_SIGNING,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    s3_device_set_payload_signing_fn);
+
+    device_class_register_property(device_class, PROPERTY_S3_CACHE_DIR,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    s3_device_set_cache_dir_fn);
+
+    device_class_register_property(device_class, PROPERTY_S3_CACHE_SIZE,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    s3_device_set_cache_size_fn);
+
+    device_class_register_property(device_class, PROPERTY_S3_CACHE_RUNS,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    s3_device_set_cache_runs_fn);
+
+    device_class_register_property(device_class, PROPERTY_S3_SHAPER,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    s3_device_set_shaper_fn);
+
+    device_class_register_property(device_class, PROPERTY_S3_SHAPER_SEND_SPEED,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    s3_device_set_shaper_send_speed_fn);
+
+    device_class_register_property(device_class, PROPERTY_S3_SHAPER_RECV_SPEED,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    s3_device_set_shaper_recv_speed_fn);
+
+    device_class_register_property(device_class, PROPERTY_S3_SHAPER_WEIGHT,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    s3_device_set_shaper_weight_fn);
+
     device_class_register_property(device_class, PROPERTY_MAX_SEND_SPEED,
 	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
 	    device_simple_property_get_fn,
@@ -1524,6 +2394,21 @@ s3_device_base_init(
 	    device_simple_property_get_fn,
 	    s3_device_set_s3_multi_part_upload);
 
+    device_class_register_property(device_class, PROPERTY_S3_PART_SIZE,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    s3_device_set_s3_part_size);
+
+    device_class_register_property(device_class, PROPERTY_S3_READ_AHEAD,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    s3_device_set_s3_read_ahead);
+
+    device_class_register_property(device_class, PROPERTY_S3_ASYNC,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    s3_device_set_s3_async);
+
     device_class_register_property(device_class, PROPERTY_COMPRESSION,
 	    PROPERTY_ACCESS_GET_MASK,
 	    device_simple_property_get_fn,
@@ -1935,6 +2820,10 @@ s3_device_set_storage_api(Device *p_self, DevicePropertyBase *base,
 	self->s3_api = S3_API_OAUTH2;
 	if (!self->set_s3_multi_delete)
 	    self->use_s3_multi_delete = 0;
+	/* the XML API of Google Cloud Storage has multi-part uploads, whose
+	 * parts are uploaded in parallel and retried by themselves */
+	if (!self->set_s3_multi_part_upload)
+	    self->use_s3_multi_part_upload = 1;
     } else if (g_str_equal(storage_api, "AWS4")) {
 	self->s3_api = S3_API_AWS4;
 	if (!self->set_s3_multi_delete)
@@ -2065,83 +2954,262 @@ s3_device_set_timeout_fn(Device *p_self, DevicePropertyBase *base,
 }
 
 static gboolean
-s3_device_set_max_send_speed_fn(Device *p_self,
-    DevicePropertyBase *base, GValue *val,
-    PropertySurety surety, PropertySource source)
+s3_device_set_share_connections_fn(Device *p_self, DevicePropertyBase *base,
+    GValue *val, PropertySurety surety, PropertySource source)
 {
     S3Device *self = S3_DEVICE(p_self);
-    guint64 new_val;
-    int     thread;
 
-    new_val = g_value_get_uint64(val);
-    if (new_val && new_val < 5120) {
-	for (thread = 0; thread < self->nb_threads; thread++) {
-	    device_set_error(p_self,
-			g_strdup("MAX-SEND-SPEED property is too low (minimum value is 5120)"),
-			DEVICE_STATUS_DEVICE_ERROR);
-	}
-	return FALSE;
-    }
-    if (self->s3t) {
-	for (thread = 0; thread < self->nb_threads; thread++) {
-	    if (self->s3t[thread].s3 && !s3_set_max_send_speed(self->s3t[thread].s3, new_val)) {
-		device_set_error(p_self,
-			g_strdup("Could not set S3 maximum send speed"),
-			DEVICE_STATUS_DEVICE_ERROR);
-	        return FALSE;
-	    }
-	}
-    }
-    self->max_send_speed = new_val;
+    self->share_connections = g_value_get_boolean(val);
 
     return device_simple_property_set_fn(p_self, base, val, surety, source);
 }
 
 static gboolean
-s3_device_set_max_recv_speed_fn(Device *p_self,
-    DevicePropertyBase *base, GValue *val,
-    PropertySurety surety, PropertySource source)
+s3_device_set_http2_fn(Device *p_self, DevicePropertyBase *base,
+    GValue *val, PropertySurety surety, PropertySource source)
 {
     S3Device *self = S3_DEVICE(p_self);
-    guint64 new_val;
-    int     thread;
 
-    new_val = g_value_get_uint64(val);
-    if (new_val && new_val < 5120) {
-	for (thread = 0; thread < self->nb_threads; thread++) {
-	    device_set_error(p_self,
-			g_strdup("MAX-RECV-SPEED property is too low (minimum value is 5120)"),
-			DEVICE_STATUS_DEVICE_ERROR);
-	}
-	return FALSE;
-    }
-    if (self->s3t) {
-	for (thread = 0; thread < self->nb_threads; thread++) {
-	    if (self->s3t[thread].s3 &&
-		!s3_set_max_recv_speed(self->s3t[thread].s3, new_val)) {
-		device_set_error(p_self,
-			g_strdup("Could not set S3 maximum recv speed"),
-			DEVICE_STATUS_DEVICE_ERROR);
-	        return FALSE;
-	    }
-	}
-    }
-    self->max_recv_speed = new_val;
+    self->http2 = g_value_get_boolean(val);
 
     return device_simple_property_set_fn(p_self, base, val, surety, source);
 }
 
 static gboolean
-s3_device_set_nb_threads_backup(Device *p_self,
-    DevicePropertyBase *base, GValue *val,
-    PropertySurety surety, PropertySource source)
+s3_device_set_keepalive_fn(Device *p_self, DevicePropertyBase *base,
+    GValue *val, PropertySurety surety, PropertySource source)
 {
     S3Device *self = S3_DEVICE(p_self);
-    guint64 new_val;
 
-    new_val = g_value_get_uint64(val);
-    self->nb_threads_backup = new_val;
-    if (self->nb_threads_backup > self->nb_threads) {
+    self->keepalive = g_value_get_uint64(val);
+
+    return device_simple_property_set_fn(p_self, base, val, surety, source);
+}
+
+static gboolean
+s3_device_set_connection_idle_timeout_fn(Device *p_self, DevicePropertyBase *base,
+    GValue *val, PropertySurety surety, PropertySource source)
+{
+    S3Device *self = S3_DEVICE(p_self);
+
+    self->connection_idle_timeout = g_value_get_uint64(val);
+
+    return device_simple_property_set_fn(p_self, base, val, surety, source);
+}
+
+static gboolean
+s3_device_set_delete_threads_fn(Device *p_self, DevicePropertyBase *base,
+    GValue *val, PropertySurety surety, PropertySource source)
+{
+    S3Device *self = S3_DEVICE(p_self);
+
+    if (self->thread_pool_background_delete) {
+	device_set_error(p_self,
+	    g_strdup(_("S3_DELETE_THREADS can't be changed once deletion started")),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+    self->delete_threads = g_value_get_uint64(val);
+
+    return device_simple_property_set_fn(p_self, base, val, surety, source);
+}
+
+static gboolean
+s3_device_set_payload_signing_fn(Device *p_self, DevicePropertyBase *base,
+    GValue *val, PropertySurety surety, PropertySource source)
+{
+    S3Device *self = S3_DEVICE(p_self);
+    const char *payload_signing = g_value_get_string(val);
+
+    if (g_ascii_strcasecmp(payload_signing, "SIGNED") == 0) {
+	self->payload_signing = S3_PAYLOAD_SIGNED;
+    } else if (g_ascii_strcasecmp(payload_signing, "UNSIGNED") == 0) {
+	self->payload_signing = S3_PAYLOAD_UNSIGNED;
+    } else if (g_ascii_strcasecmp(payload_signing, "STREAMING") == 0) {
+	self->payload_signing = S3_PAYLOAD_STREAMING;
+    } else {
+	device_set_error(p_self, g_strdup_printf(
+			_("Invalid S3_PAYLOAD_SIGNING '%s' (must be SIGNED, UNSIGNED or STREAMING)"),
+			payload_signing),
+		    DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+
+    return device_simple_property_set_fn(p_self, base, val, surety, source);
+}
+
+static gboolean
+s3_device_set_cache_dir_fn(Device *p_self, DevicePropertyBase *base,
+    GValue *val, PropertySurety surety, PropertySource source)
+{
+    S3Device *self = S3_DEVICE(p_self);
+    const char *cache_dir = g_value_get_string(val);
+
+    if (self->s3t) {
+	device_set_error(p_self,
+	    g_strdup(_("S3_CACHE_DIR can't be changed once the device is used")),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+    g_free(self->cache_dir);
+    self->cache_dir = (cache_dir && *cache_dir) ? g_strdup(cache_dir) : NULL;
+
+    return device_simple_property_set_fn(p_self, base, val, surety, source);
+}
+
+static gboolean
+s3_device_set_cache_size_fn(Device *p_self, DevicePropertyBase *base,
+    GValue *val, PropertySurety surety, PropertySource source)
+{
+    S3Device *self = S3_DEVICE(p_self);
+
+    self->cache_size = g_value_get_uint64(val);
+
+    return device_simple_property_set_fn(p_self, base, val, surety, source);
+}
+
+static gboolean
+s3_device_set_cache_runs_fn(Device *p_self, DevicePropertyBase *base,
+    GValue *val, PropertySurety surety, PropertySource source)
+{
+    S3Device *self = S3_DEVICE(p_self);
+
+    self->cache_runs = g_value_get_uint64(val);
+
+    return device_simple_property_set_fn(p_self, base, val, surety, source);
+}
+
+static gboolean
+s3_device_set_shaper_fn(Device *p_self, DevicePropertyBase *base,
+    GValue *val, PropertySurety surety, PropertySource source)
+{
+    S3Device *self = S3_DEVICE(p_self);
+    const char *shaper = g_value_get_string(val);
+
+    g_free(self->shaper_pool);
+    self->shaper_pool = (shaper && *shaper) ? g_strdup(shaper) : NULL;
+
+    return device_simple_property_set_fn(p_self, base, val, surety, source);
+}
+
+static gboolean
+s3_device_set_shaper_send_speed_fn(Device *p_self, DevicePropertyBase *base,
+    GValue *val, PropertySurety surety, PropertySource source)
+{
+    S3Device *self = S3_DEVICE(p_self);
+
+    self->shaper_send_speed = g_value_get_uint64(val);
+
+    return device_simple_property_set_fn(p_self, base, val, surety, source);
+}
+
+static gboolean
+s3_device_set_shaper_recv_speed_fn(Device *p_self, DevicePropertyBase *base,
+    GValue *val, PropertySurety surety, PropertySource source)
+{
+    S3Device *self = S3_DEVICE(p_self);
+
+    self->shaper_recv_speed = g_value_get_uint64(val);
+
+    return device_simple_property_set_fn(p_self, base, val, surety, source);
+}
+
+static gboolean
+s3_device_set_shaper_weight_fn(Device *p_self, DevicePropertyBase *base,
+    GValue *val, PropertySurety surety, PropertySource source)
+{
+    S3Device *self = S3_DEVICE(p_self);
+    guint64 weight = g_value_get_uint64(val);
+
+    if (weight == 0 || weight > G_MAXUINT) {
+	device_set_error(p_self,
+	    g_strdup_printf(_("Invalid S3_SHAPER_WEIGHT %ju"), (uintmax_t)weight),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+    self->shaper_weight = weight;
+
+    return device_simple_property_set_fn(p_self, base, val, surety, source);
+}
+
+static gboolean
+s3_device_set_max_send_speed_fn(Device *p_self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source)
+{
+    S3Device *self = S3_DEVICE(p_self);
+    guint64 new_val;
+    int     thread;
+
+    new_val = g_value_get_uint64(val);
+    if (new_val && new_val < 5120) {
+	for (thread = 0; thread < self->nb_threads; thread++) {
+	    device_set_error(p_self,
+			g_strdup("MAX-SEND-SPEED property is too low (minimum value is 5120)"),
+			DEVICE_STATUS_DEVICE_ERROR);
+	}
+	return FALSE;
+    }
+    if (self->s3t) {
+	for (thread = 0; thread < self->nb_threads; thread++) {
+	    if (self->s3t[thread].s3 && !s3_set_max_send_speed(self->s3t[thread].s3, new_val)) {
+		device_set_error(p_self,
+			g_strdup("Could not set S3 maximum send speed"),
+			DEVICE_STATUS_DEVICE_ERROR);
+	        return FALSE;
+	    }
+	}
+    }
+    self->max_send_speed = new_val;
+
+    return device_simple_property_set_fn(p_self, base, val, surety, source);
+}
+
+static gboolean
+s3_device_set_max_recv_speed_fn(Device *p_self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source)
+{
+    S3Device *self = S3_DEVICE(p_self);
+    guint64 new_val;
+    int     thread;
+
+    new_val = g_value_get_uint64(val);
+    if (new_val && new_val < 5120) {
+	for (thread = 0; thread < self->nb_threads; thread++) {
+	    device_set_error(p_self,
+			g_strdup("MAX-RECV-SPEED property is too low (minimum value is 5120)"),
+			DEVICE_STATUS_DEVICE_ERROR);
+	}
+	return FALSE;
+    }
+    if (self->s3t) {
+	for (thread = 0; thread < self->nb_threads; thread++) {
+	    if (self->s3t[thread].s3 &&
+		!s3_set_max_recv_speed(self->s3t[thread].s3, new_val)) {
+		device_set_error(p_self,
+			g_strdup("Could not set S3 maximum recv speed"),
+			DEVICE_STATUS_DEVICE_ERROR);
+	        return FALSE;
+	    }
+	}
+    }
+    self->max_recv_speed = new_val;
+
+    return device_simple_property_set_fn(p_self, base, val, surety, source);
+}
+
+static gboolean
+s3_device_set_nb_threads_backup(Device *p_self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source)
+{
+    S3Device *self = S3_DEVICE(p_self);
+    guint64 new_val;
+
+    new_val = g_value_get_uint64(val);
+    self->nb_threads_backup = new_val;
+    if (self->nb_threads_backup > self->nb_threads) {
 	self->nb_threads = self->nb_threads_backup;
     }
 
@@ -2173,6 +3241,62 @@ s3_device_set_s3_multi_part_upload(Device *p_self,
     S3Device *self = S3_DEVICE(p_self);
 
     self->use_s3_multi_part_upload = g_value_get_boolean(val);
+    self->set_s3_multi_part_upload = TRUE;
+
+    return device_simple_property_set_fn(p_self, base, val, surety, source);
+}
+
+static gboolean
+s3_device_set_s3_part_size(Device *p_self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source)
+{
+    S3Device *self = S3_DEVICE(p_self);
+    guint64 part_size = g_value_get_uint64(val);
+
+    if (part_size != 0 &&
+	(part_size < S3_DEVICE_MIN_PART_SIZE ||
+	 part_size > S3_DEVICE_MAX_PART_SIZE)) {
+	device_set_error(p_self,
+	    g_strdup_printf(_("S3_PART_SIZE must be 0 or between %ju and %ju"),
+			    (uintmax_t)S3_DEVICE_MIN_PART_SIZE,
+			    (uintmax_t)S3_DEVICE_MAX_PART_SIZE),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+    self->part_size = part_size;
+
+    return device_simple_property_set_fn(p_self, base, val, surety, source);
+}
+
+static gboolean
+s3_device_set_s3_read_ahead(Device *p_self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source)
+{
+    S3Device *self = S3_DEVICE(p_self);
+    guint64 read_ahead = g_value_get_uint64(val);
+
+    if (read_ahead > S3_DEVICE_MAX_PART_SIZE) {
+	device_set_error(p_self,
+	    g_strdup_printf(_("S3_READ_AHEAD must be at most %ju"),
+			    (uintmax_t)S3_DEVICE_MAX_PART_SIZE),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+    self->read_ahead = read_ahead;
+
+    return device_simple_property_set_fn(p_self, base, val, surety, source);
+}
+
+static gboolean
+s3_device_set_s3_async(Device *p_self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source)
+{
+    S3Device *self = S3_DEVICE(p_self);
+
+    self->s3_async = g_value_get_boolean(val);
 
     return device_simple_property_set_fn(p_self, base, val, surety, source);
 }
@@ -2410,6 +3534,37 @@ s3_device_open_device(Device *pself, char *device_name,
     device_set_simple_property(pself, device_property_timeout.ID,
 	&tmp_value, PROPERTY_SURETY_GOOD, PROPERTY_SOURCE_DEFAULT);
 
+    /* share connections */
+    self->share_connections = TRUE;
+    bzero(&tmp_value, sizeof(GValue));
+    g_value_init(&tmp_value, G_TYPE_BOOLEAN);
+    g_value_set_boolean(&tmp_value, self->share_connections);
+    device_set_simple_property(pself, device_property_s3_share_connections.ID,
+	&tmp_value, PROPERTY_SURETY_GOOD, PROPERTY_SOURCE_DEFAULT);
+
+    /* cache */
+    self->cache_size = S3_DEVICE_CACHE_SIZE;
+    bzero(&tmp_value, sizeof(GValue));
+    g_value_init(&tmp_value, G_TYPE_UINT64);
+    g_value_set_uint64(&tmp_value, self->cache_size);
+    device_set_simple_property(pself, device_property_s3_cache_size.ID,
+	&tmp_value, PROPERTY_SURETY_GOOD, PROPERTY_SOURCE_DEFAULT);
+
+    self->cache_runs = 1;
+    bzero(&tmp_value, sizeof(GValue));
+    g_value_init(&tmp_value, G_TYPE_UINT64);
+    g_value_set_uint64(&tmp_value, self->cache_runs);
+    device_set_simple_property(pself, device_property_s3_cache_runs.ID,
+	&tmp_value, PROPERTY_SURETY_GOOD, PROPERTY_SOURCE_DEFAULT);
+
+    /* shaper weight */
+    self->shaper_weight = 1;
+    bzero(&tmp_value, sizeof(GValue));
+    g_value_init(&tmp_value, G_TYPE_UINT64);
+    g_value_set_uint64(&tmp_value, self->shaper_weight);
+    device_set_simple_property(pself, device_property_s3_shaper_weight.ID,
+	&tmp_value, PROPERTY_SURETY_GOOD, PROPERTY_SOURCE_DEFAULT);
+
     /* Set default create_bucket */
     self->create_bucket = TRUE;
     bzero(&tmp_value, sizeof(GValue));
@@ -2459,16 +3614,69 @@ static void s3_device_finalize(GObject * obj_self) {
     if(G_OBJECT_CLASS(parent_class)->finalize)
         (* G_OBJECT_CLASS(parent_class)->finalize)(obj_self);
 
+    if (self->s3_multi) {
+	s3_multi_free(self->s3_multi);
+	self->s3_multi = NULL;
+    }
+    s3_prefetch_discard(self);
+    if (self->prefetch_s3) {
+	s3_free(self->prefetch_s3);
+	self->prefetch_s3 = NULL;
+    }
     if (self->thread_pool_delete) {
-	g_thread_pool_free(self->thread_pool_delete, 1, 1);
+	amexec_queue_free(self->thread_pool_delete, TRUE);
 	self->thread_pool_delete = NULL;
     }
+    if (self->thread_pool_restore) {
+	amexec_queue_free(self->thread_pool_restore, TRUE);
+	self->thread_pool_restore = NULL;
+    }
+    slist_free_full(self->restore_objects, free_s3_object);
+    self->restore_objects = NULL;
+    if (self->restore_requested) {
+	g_hash_table_destroy(self->restore_requested);
+	self->restore_requested = NULL;
+    }
+    if (self->thread_pool_background_delete) {
+	/* the journal keeps what is left for the next run */
+	g_mutex_lock(self->delete_mutex);
+	self->delete_stop = TRUE;
+	g_mutex_unlock(self->delete_mutex);
+	amexec_queue_free(self->thread_pool_background_delete, TRUE);
+	self->thread_pool_background_delete = NULL;
+    }
+    if (self->s3t_delete) {
+	guint thread;
+
+	for (thread = 0; thread < self->delete_threads; thread++) {
+	    if (self->s3t_delete[thread].s3)
+		s3_free(self->s3t_delete[thread].s3);
+	}
+	g_free(self->s3t_delete);
+	self->s3t_delete = NULL;
+    }
+    slist_free_full(self->delete_objects, free_s3_object);
+    self->delete_objects = NULL;
+    if (self->delete_files) {
+	g_hash_table_destroy(self->delete_files);
+	self->delete_files = NULL;
+    }
+    if (self->delete_mutex) {
+	g_mutex_free(self->delete_mutex);
+	self->delete_mutex = NULL;
+    }
+    if (self->delete_cond) {
+	g_cond_free(self->delete_cond);
+	self->delete_cond = NULL;
+    }
+    g_free(self->delete_errmsg);
+    g_free(self->delete_journal);
     if (self->thread_pool_write) {
-	g_thread_pool_free(self->thread_pool_write, 1, 1);
+	amexec_queue_free(self->thread_pool_write, TRUE);
 	self->thread_pool_write = NULL;
     }
     if (self->thread_pool_read) {
-	g_thread_pool_free(self->thread_pool_read, 1, 1);
+	amexec_queue_free(self->thread_pool_read, TRUE);
 	self->thread_pool_read = NULL;
     }
     if (self->thread_idle_mutex) {
@@ -2487,6 +3695,15 @@ static void s3_device_finalize(GObject * obj_self) {
 	}
 	g_free(self->s3t);
     }
+    /* after all the handles using it */
+    s3_shaper_free(self->shaper);
+    g_free(self->shaper_pool);
+    g_free(self->cache_dir);
+    if (self->cache_mutex) {
+	g_mutex_free(self->cache_mutex);
+	self->cache_mutex = NULL;
+    }
+    g_free(self->part_buffer);
     if (self->catalog_filename) {
 	catalog_close(self);
     }
@@ -2545,6 +3762,10 @@ catalog_open(
 	g_free(self->catalog_header);
 	self->catalog_label = NULL;
 	self->catalog_header = NULL;
+	if (self->catalog_files) {
+	    g_tree_destroy(self->catalog_files);
+	    self->catalog_files = NULL;
+	}
 	return TRUE;
     }
     if (!fgets(line, 1024, file)) {
@@ -2563,10 +3784,49 @@ catalog_open(
 	line[strlen(line)-1] = '\0';
     g_free(self->catalog_header);
     self->catalog_header = g_strdup(line+8);
+
+    /* the file index, if the catalog has one */
+    if (self->catalog_files) {
+	g_tree_destroy(self->catalog_files);
+	self->catalog_files = NULL;
+    }
+    while (fgets(line, 1024, file)) {
+	unsigned long long bytes, blocks, size;
+	int filenum, multi_part;
+
+	if (sscanf(line, "INDEX: %llu", &bytes) == 1) {
+	    catalog_index_reset(self);
+	    self->catalog_bytes = bytes;
+	} else if (self->catalog_files &&
+		   sscanf(line, "FILE: %d %llu %llu %d", &filenum, &blocks,
+			  &size, &multi_part) == 4) {
+	    S3CatalogFile *cfile = g_new0(S3CatalogFile, 1);
+	    cfile->blocks = blocks;
+	    cfile->size = size;
+	    cfile->multi_part = multi_part;
+	    g_tree_insert(self->catalog_files, GINT_TO_POINTER(filenum), cfile);
+	}
+    }
+    /* checked against the bucket on first use */
+    self->catalog_checked = FALSE;
     fclose(file);
     return TRUE;
 }
 
+static gboolean
+write_catalog_file(
+    gpointer key,
+    gpointer value,
+    gpointer data)
+{
+    S3CatalogFile *cfile = (S3CatalogFile *)value;
+
+    g_fprintf((FILE *)data, "FILE: %d %llu %llu %d\n", GPOINTER_TO_INT(key),
+	      (unsigned long long)cfile->blocks,
+	      (unsigned long long)cfile->size, cfile->multi_part ? 1 : 0);
+    return FALSE;
+}
+
 static gboolean
 write_catalog(
     S3Device *self)
@@ -2582,6 +3842,10 @@ write_catalog(
     }
     g_fprintf(file,"LABEL: %s\n", self->catalog_label);
     g_fprintf(file,"HEADER: %s\n", self->catalog_header);
+    if (self->catalog_files) {
+	g_fprintf(file,"INDEX: %llu\n", (unsigned long long)self->catalog_bytes);
+	g_tree_foreach(self->catalog_files, write_catalog_file, file);
+    }
     fclose(file);
     return TRUE;
 }
@@ -2608,6 +3872,10 @@ catalog_remove(
     amfree(self->catalog_filename);
     amfree(self->catalog_label);
     amfree(self->catalog_header);
+    if (self->catalog_files) {
+	g_tree_destroy(self->catalog_files);
+	self->catalog_files = NULL;
+    }
     return TRUE;
 }
 
@@ -2617,11 +3885,540 @@ catalog_close(
 {
     gboolean result;
 
-    result = write_catalog(self);
-    amfree(self->catalog_filename);
-    amfree(self->catalog_label);
-    amfree(self->catalog_header);
-    return result;
+    result = write_catalog(self);
+    amfree(self->catalog_filename);
+    amfree(self->catalog_label);
+    amfree(self->catalog_header);
+    if (self->catalog_files) {
+	g_tree_destroy(self->catalog_files);
+	self->catalog_files = NULL;
+    }
+    return result;
+}
+
+/* Start an empty file index; the volume is being (re)written */
+static void
+catalog_index_reset(
+    S3Device *self)
+{
+    if (self->catalog_files)
+	g_tree_destroy(self->catalog_files);
+    self->catalog_files = g_tree_new_full(gint_cmp, NULL, NULL, g_free);
+    self->catalog_bytes = 0;
+    self->catalog_checked = TRUE;
+}
+
+static void
+catalog_add_file(
+    S3Device *self,
+    int       file,
+    guint64   blocks,
+    guint64   size,
+    gboolean  multi_part)
+{
+    S3CatalogFile *cfile;
+
+    if (!self->catalog_files)
+	return;
+
+    cfile = g_new0(S3CatalogFile, 1);
+    cfile->blocks = blocks;
+    cfile->size = size;
+    cfile->multi_part = multi_part;
+    g_tree_insert(self->catalog_files, GINT_TO_POINTER(file), cfile);
+    self->catalog_bytes = self->volume_bytes;
+    write_catalog(self);
+}
+
+static void
+catalog_remove_file(
+    S3Device *self,
+    int       file)
+{
+    if (!self->catalog_files)
+	return;
+
+    g_tree_remove(self->catalog_files, GINT_TO_POINTER(file));
+    self->catalog_bytes = self->volume_bytes;
+    write_catalog(self);
+}
+
+/* Whether the file index can be used instead of listing the bucket.  The
+ * first time, check with a HEAD that the last file in the index exists and
+ * that no file was written after it by someone else. */
+static gboolean
+catalog_index_valid(
+    S3Device *self)
+{
+    int last_file = 0;
+    gboolean valid = TRUE;
+    s3_head_t *head;
+    char *key;
+
+    if (!self->catalog_files)
+	return FALSE;
+    if (self->catalog_checked)
+	return TRUE;
+
+    g_tree_foreach(self->catalog_files, catalog_last_file, &last_file);
+    if (last_file > 0) {
+	key = special_file_to_key(self, "filestart", last_file);
+	head = s3_head(self->s3t[0].s3, self->bucket, key);
+	g_free(key);
+	if (head)
+	    free_s3_head(head);
+	else
+	    valid = FALSE;
+    }
+    if (valid) {
+	guint response_code;
+
+	key = special_file_to_key(self, "filestart", last_file + 1);
+	head = s3_head(self->s3t[0].s3, self->bucket, key);
+	g_free(key);
+	s3_error(self->s3t[0].s3, NULL, &response_code, NULL, NULL, NULL, NULL);
+	if (head) {
+	    free_s3_head(head);
+	    /* unless it is an old file being deleted */
+	    if (!delete_queue_has_file(self, last_file + 1))
+		valid = FALSE;
+	} else if (response_code != 404) {
+	    valid = FALSE;
+	}
+    }
+
+    if (!valid) {
+	g_debug("S3 catalog index of '%s' is out of date; listing the bucket",
+		self->prefix);
+	g_tree_destroy(self->catalog_files);
+	self->catalog_files = NULL;
+	return FALSE;
+    }
+    self->catalog_checked = TRUE;
+    return TRUE;
+}
+
+/*
+ * Local block cache
+ *
+ * The cache is a flat directory with one file per block object, named after
+ * the bucket and key with '/' and '%' escaped; the modification time of a
+ * file is its last use.  Several processes can share the directory: each
+ * one only estimates the size of the cache, and rescans it when it thinks
+ * it is full.
+ */
+
+#define CACHE_RUNS_FILE "write-runs"
+
+/* the name in the cache directory of KEY, or of the keys starting with it */
+static char *
+cache_name(
+    S3Device *self,
+    const char *key)
+{
+    GString *name = g_string_new(NULL);
+    char *object = g_strdup_printf("%s/%s", self->bucket, key);
+    const char *p;
+
+    for (p = object; *p; p++) {
+	if (*p == '/' || *p == '%')
+	    g_string_append_printf(name, "%%%02X", (unsigned char)*p);
+	else
+	    g_string_append_c(name, *p);
+    }
+    g_free(object);
+    return g_string_free(name, FALSE);
+}
+
+typedef struct {
+    char *path;
+    time_t mtime;
+    guint64 size;
+} cache_entry_t;
+
+static gint
+cache_entry_cmp(
+    gconstpointer a,
+    gconstpointer b)
+{
+    const cache_entry_t *ea = a, *eb = b;
+
+    if (ea->mtime != eb->mtime)
+	return ea->mtime < eb->mtime ? -1 : 1;
+    return 0;
+}
+
+/* Measure the cache and evict the least recently used files until it is
+ * under 90% of S3_CACHE_SIZE.  Called with cache_mutex held. */
+static void
+cache_trim(
+    S3Device *self)
+{
+    DIR *dir;
+    struct dirent *dirent;
+    struct stat st;
+    GSList *entries = NULL, *link;
+    guint64 used = 0;
+
+    dir = opendir(self->cache_dir);
+    if (!dir)
+	return;
+    while ((dirent = readdir(dir)) != NULL) {
+	cache_entry_t *entry;
+	char *path;
+
+	if (g_str_has_prefix(dirent->d_name, CACHE_RUNS_FILE))
+	    continue;
+	path = g_strconcat(self->cache_dir, "/", dirent->d_name, NULL);
+	if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+	    g_free(path);
+	    continue;
+	}
+	entry = g_new(cache_entry_t, 1);
+	entry->path = path;
+	entry->mtime = st.st_mtime;
+	entry->size = st.st_size;
+	entries = g_slist_prepend(entries, entry);
+	used += st.st_size;
+    }
+    closedir(dir);
+
+    if (used > self->cache_size) {
+	guint64 target = self->cache_size / 10 * 9;
+
+	entries = g_slist_sort(entries, cache_entry_cmp);
+	for (link = entries; link && used > target; link = link->next) {
+	    cache_entry_t *entry = link->data;
+
+	    if (unlink(entry->path) == 0)
+		used -= entry->size;
+	}
+    }
+    for (link = entries; link; link = link->next) {
+	g_free(((cache_entry_t *)link->data)->path);
+	g_free(link->data);
+    }
+    g_slist_free(entries);
+    self->cache_used = used;
+}
+
+static void
+cache_open(
+    S3Device *self)
+{
+    if (!self->cache_dir)
+	return;
+
+    if (mkdir(self->cache_dir, 0700) == -1 && errno != EEXIST) {
+	g_debug("Can't create S3 cache directory '%s': %s; not caching",
+		self->cache_dir, strerror(errno));
+	amfree(self->cache_dir);
+	return;
+    }
+    self->cache_mutex = g_mutex_new();
+    g_mutex_lock(self->cache_mutex);
+    cache_trim(self);
+    g_mutex_unlock(self->cache_mutex);
+}
+
+static gboolean
+cache_fetch(
+    S3Device *self,
+    const char *key,
+    CurlBuffer *buf)
+{
+    char *name, *path;
+    struct stat st;
+    gboolean hit = FALSE;
+    int fd;
+
+    if (!self->cache_dir)
+	return FALSE;
+
+    name = cache_name(self, key);
+    path = g_strconcat(self->cache_dir, "/", name, NULL);
+    g_free(name);
+    fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+	if (fstat(fd, &st) == 0 &&
+	    (guint64)st.st_size <= buf->buffer_len &&
+	    full_read(fd, buf->buffer, st.st_size) == (size_t)st.st_size) {
+	    buf->buffer_pos = st.st_size;
+	    /* it is now the most recently used */
+	    utime(path, NULL);
+	    hit = TRUE;
+	}
+	close(fd);
+    }
+    g_free(path);
+    return hit;
+}
+
+static void
+cache_store(
+    S3Device *self,
+    const char *key,
+    const char *data,
+    guint64 size)
+{
+    char *name, *path, *tmp;
+    int fd;
+
+    if (!self->cache_dir || size > self->cache_size)
+	return;
+
+    name = cache_name(self, key);
+    path = g_strconcat(self->cache_dir, "/", name, NULL);
+    g_free(name);
+    /* readers never see a partial file */
+    tmp = g_strconcat(self->cache_dir, "/tmp.XXXXXX", NULL);
+    fd = g_mkstemp(tmp);
+    if (fd < 0) {
+	g_debug("Can't create a file in S3 cache directory '%s': %s",
+		self->cache_dir, strerror(errno));
+	goto done;
+    }
+    if (full_write(fd, data, size) < size) {
+	g_debug("Can't write S3 cache file '%s': %s", tmp, strerror(errno));
+	close(fd);
+	unlink(tmp);
+	goto done;
+    }
+    if (close(fd) != 0 || rename(tmp, path) != 0) {
+	g_debug("Can't write S3 cache file '%s': %s", path, strerror(errno));
+	unlink(tmp);
+	goto done;
+    }
+
+    g_mutex_lock(self->cache_mutex);
+    self->cache_used += size;
+    if (self->cache_used > self->cache_size)
+	cache_trim(self);
+    g_mutex_unlock(self->cache_mutex);
+
+done:
+    g_free(tmp);
+    g_free(path);
+}
+
+/* Remove the cache files whose name starts with NAME_PREFIX.  Called with
+ * cache_mutex held. */
+static void
+cache_unlink(
+    S3Device *self,
+    const char *name_prefix)
+{
+    DIR *dir;
+    struct dirent *dirent;
+    struct stat st;
+    size_t len = strlen(name_prefix);
+
+    dir = opendir(self->cache_dir);
+    if (!dir)
+	return;
+    while ((dirent = readdir(dir)) != NULL) {
+	char *path;
+
+	if (strncmp(dirent->d_name, name_prefix, len) != 0)
+	    continue;
+	path = g_strconcat(self->cache_dir, "/", dirent->d_name, NULL);
+	if (stat(path, &st) == 0 && unlink(path) == 0)
+	    self->cache_used -= MIN(self->cache_used, (guint64)st.st_size);
+	g_free(path);
+    }
+    closedir(dir);
+}
+
+static void
+cache_drop(
+    S3Device *self,
+    const char *key_prefix)
+{
+    char *name;
+
+    if (!self->cache_dir)
+	return;
+
+    name = cache_name(self, key_prefix);
+    g_mutex_lock(self->cache_mutex);
+    cache_unlink(self, name);
+    g_mutex_unlock(self->cache_mutex);
+    g_free(name);
+}
+
+static void
+cache_start_run(
+    S3Device *self)
+{
+    char *volume_prefix, *volume, *runs_path, *tmp;
+    GSList *runs = NULL, *link;
+    FILE *file;
+    char line[1025];
+    guint nb_runs;
+
+    self->cache_write_through = FALSE;
+    if (!self->cache_dir || self->cache_runs == 0)
+	return;
+
+    volume_prefix = g_strdup_printf("%sf", self->prefix);
+    volume = cache_name(self, volume_prefix);
+    g_free(volume_prefix);
+    runs_path = g_strconcat(self->cache_dir, "/" CACHE_RUNS_FILE, NULL);
+
+    g_mutex_lock(self->cache_mutex);
+
+    /* the volumes written through, oldest first */
+    file = fopen(runs_path, "r");
+    if (file) {
+	while (fgets(line, sizeof(line), file)) {
+	    if (line[0] && line[strlen(line)-1] == '\n')
+		line[strlen(line)-1] = '\0';
+	    if (line[0] && !g_str_equal(line, volume))
+		runs = g_slist_append(runs, g_strdup(line));
+	}
+	fclose(file);
+    }
+    runs = g_slist_append(runs, g_strdup(volume));
+
+    nb_runs = g_slist_length(runs);
+    while (nb_runs > self->cache_runs) {
+	g_debug("Dropping '%s' from the S3 cache", (char *)runs->data);
+	cache_unlink(self, runs->data);
+	g_free(runs->data);
+	runs = g_slist_delete_link(runs, runs);
+	nb_runs--;
+    }
+
+    tmp = g_strconcat(runs_path, ".tmp", NULL);
+    file = fopen(tmp, "w");
+    if (file) {
+	for (link = runs; link; link = link->next)
+	    g_fprintf(file, "%s\n", (char *)link->data);
+	if (fclose(file) == 0 && rename(tmp, runs_path) == 0)
+	    self->cache_write_through = TRUE;
+	else
+	    unlink(tmp);
+    }
+    if (!self->cache_write_through)
+	g_debug("Can't write '%s': %s; not caching the blocks written",
+		runs_path, strerror(errno));
+
+    g_mutex_unlock(self->cache_mutex);
+
+    slist_free_full(runs, g_free);
+    g_free(tmp);
+    g_free(runs_path);
+    g_free(volume);
+}
+
+/* Open a handle with the device's settings */
+static S3Handle *
+s3_device_open_handle(
+    S3Device *self)
+{
+    return s3_open(self->access_key, self->secret_key,
+		   self->session_token,
+		   self->swift_account_id,
+		   self->swift_access_key,
+		   self->host, self->service_path,
+		   self->use_subdomain,
+		   self->user_token, self->bucket_location,
+		   self->storage_class, self->ca_info,
+		   self->server_side_encryption,
+		   self->proxy,
+		   self->s3_api,
+		   self->username,
+		   self->password,
+		   self->tenant_id,
+		   self->tenant_name,
+		   self->project_name,
+		   self->domain_name,
+		   self->client_id,
+		   self->client_secret,
+		   self->refresh_token,
+		   self->reuse_connection,
+		   self->read_from_glacier,
+		   self->timeout,
+		   self->reps, self->reps_bucket);
+}
+
+/* Apply the device's connection settings to HDL, before s3_open2.  Returns
+ * FALSE, with the device error set, if one is not supported. */
+static gboolean
+s3_device_configure_handle(
+    S3Device *self,
+    S3Handle *hdl)
+{
+    Device *d_self = DEVICE(self);
+
+    s3_verbose(hdl, self->verbose);
+
+    if (!s3_use_ssl(hdl, self->use_ssl)) {
+	device_set_error(d_self, g_strdup_printf(_(
+		"Error setting S3 SSL/TLS use "
+		"(tried to enable SSL/TLS for S3, but curl doesn't support it?)")),
+		DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+
+    if (self->max_send_speed && self->max_send_speed < 5120) {
+	device_set_error(d_self,
+		g_strdup("MAX-SEND-SPEED property is too low (minimum value is 5120)"),
+		DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+    if (self->max_send_speed &&
+	!s3_set_max_send_speed(hdl, self->max_send_speed)) {
+	device_set_error(d_self,
+		g_strdup("Could not set S3 maximum send speed"),
+		DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+
+    if (self->max_recv_speed && self->max_recv_speed < 5120) {
+	device_set_error(d_self,
+		g_strdup("MAX-RECV-SPEED property is too low (minimum value is 5120)"),
+		DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+    if (self->max_recv_speed &&
+	!s3_set_max_recv_speed(hdl, self->max_recv_speed)) {
+	device_set_error(d_self,
+		g_strdup("Could not set S3 maximum recv speed"),
+		DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+
+    /* sharing is an optimization; go on without it */
+    if (!s3_set_share_connections(hdl, self->share_connections)) {
+	g_debug("libcurl can't share connections between handles");
+    }
+    if (self->http2 &&
+	!s3_set_http2(hdl, self->http2)) {
+	device_set_error(d_self,
+		g_strdup("Could not enable HTTP/2 (S3_HTTP2); libcurl doesn't support it"),
+		DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+    if (self->keepalive &&
+	!s3_set_keepalive(hdl, self->keepalive)) {
+	device_set_error(d_self,
+		g_strdup("Could not set S3_KEEPALIVE; libcurl doesn't support it"),
+		DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+    if (self->connection_idle_timeout &&
+	!s3_set_connection_idle_timeout(hdl,
+					self->connection_idle_timeout)) {
+	device_set_error(d_self,
+		g_strdup("Could not set S3_CONNECTION_IDLE_TIMEOUT; libcurl doesn't support it"),
+		DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+    s3_set_payload_signing(hdl, self->payload_signing);
+    s3_set_shaper(hdl, self->shaper);
+
+    return TRUE;
 }
 
 static gboolean
@@ -2739,6 +4536,16 @@ setup_handle(S3Device * self) {
 
 	self->thread_idle_cond = g_cond_new();
 	self->thread_idle_mutex = g_mutex_new();
+	self->delete_cond = g_cond_new();
+	self->delete_mutex = g_mutex_new();
+	self->delete_files = g_hash_table_new(g_direct_hash, g_direct_equal);
+	cache_open(self);
+	if (self->shaper_pool) {
+	    self->shaper = s3_shaper_new(self->shaper_pool,
+					 self->shaper_send_speed,
+					 self->shaper_recv_speed,
+					 self->shaper_weight);
+	}
 
 	for (thread = 0; thread < self->nb_threads; thread++) {
 	    self->s3t[thread].idle = 1;
@@ -2751,30 +4558,8 @@ setup_handle(S3Device * self) {
 	    self->s3t[thread].curl_buffer.buffer_len = 0;
 	    self->s3t[thread].timeout = 0;
 	    self->s3t[thread].now_mutex = g_mutex_new();
-            self->s3t[thread].s3 = s3_open(self->access_key, self->secret_key,
-					   self->session_token,
-					   self->swift_account_id,
-					   self->swift_access_key,
-					   self->host, self->service_path,
-					   self->use_subdomain,
-					   self->user_token, self->bucket_location,
-					   self->storage_class, self->ca_info,
-					   self->server_side_encryption,
-					   self->proxy,
-					   self->s3_api,
-					   self->username,
-					   self->password,
-					   self->tenant_id,
-					   self->tenant_name,
-					   self->project_name,
-					   self->domain_name,
-					   self->client_id,
-					   self->client_secret,
-					   self->refresh_token,
-					   self->reuse_connection,
-					   self->read_from_glacier,
-					   self->timeout,
-                                           self->reps, self->reps_bucket);
+	    self->s3t[thread].device = self;
+            self->s3t[thread].s3 = s3_device_open_handle(self);
             if (self->s3t[thread].s3 == NULL) {
 	        device_set_error(d_self,
 		    g_strdup(_("Internal error creating S3 handle")),
@@ -2785,54 +4570,29 @@ setup_handle(S3Device * self) {
         }
 
 	g_debug("Create %d threads", self->nb_threads);
-	self->thread_pool_delete = g_thread_pool_new(s3_thread_delete_block,
-						     self, self->nb_threads, 0,
-						     NULL);
-	self->thread_pool_write = g_thread_pool_new(s3_thread_write_block, self,
-					      self->nb_threads, 0, NULL);
-	self->thread_pool_read = g_thread_pool_new(s3_thread_read_block, self,
-					      self->nb_threads, 0, NULL);
+	/* the transfers wait on the network, so they don't hold CPU slots;
+	 * the data path goes ahead of the deletes and restore requests */
+	self->thread_pool_delete = amexec_queue_new("s3-delete",
+				s3_thread_delete_block, self, self->nb_threads,
+				AMEXEC_PRIORITY_LOW, AMEXEC_BLOCKING);
+	self->thread_pool_restore = amexec_queue_new("s3-restore",
+				s3_thread_restore_block, self, self->nb_threads,
+				AMEXEC_PRIORITY_LOW, AMEXEC_BLOCKING);
+	self->thread_pool_write = amexec_queue_new("s3-write",
+				s3_thread_write_block, self, self->nb_threads,
+				AMEXEC_PRIORITY_HIGH, AMEXEC_BLOCKING);
+	self->thread_pool_read = amexec_queue_new("s3-read",
+				s3_thread_read_block, self, self->nb_threads,
+				AMEXEC_PRIORITY_HIGH, AMEXEC_BLOCKING);
+	if (self->s3_async) {
+	    self->s3_multi = s3_multi_new();
+	    if (!self->s3_multi)
+		g_debug("S3_ASYNC is not supported by this libcurl; using threads");
+	}
 
 	for (thread = 0; thread < self->nb_threads; thread++) {
-	    s3_verbose(self->s3t[thread].s3, self->verbose);
-
-	    if (!s3_use_ssl(self->s3t[thread].s3, self->use_ssl)) {
-		device_set_error(d_self, g_strdup_printf(_(
-	                "Error setting S3 SSL/TLS use "
-	                "(tried to enable SSL/TLS for S3, but curl doesn't support it?)")),
-		        DEVICE_STATUS_DEVICE_ERROR);
-		return FALSE;
-	    }
-
-	    if (self->max_send_speed && self->max_send_speed < 5120) {
-		device_set_error(d_self,
-			g_strdup("MAX-SEND-SPEED property is too low (minimum value is 5120)"),
-			DEVICE_STATUS_DEVICE_ERROR);
-		return FALSE;
-	    }
-	    if (self->max_send_speed &&
-		!s3_set_max_send_speed(self->s3t[thread].s3,
-				       self->max_send_speed)) {
-		device_set_error(d_self,
-			g_strdup("Could not set S3 maximum send speed"),
-			DEVICE_STATUS_DEVICE_ERROR);
-		return FALSE;
-	    }
-
-	    if (self->max_recv_speed && self->max_recv_speed < 5120) {
-		device_set_error(d_self,
-			g_strdup("MAX-RECV-SPEED property is too low (minimum value is 5120)"),
-			DEVICE_STATUS_DEVICE_ERROR);
-		return FALSE;
-	    }
-	    if (self->max_recv_speed &&
-		!s3_set_max_recv_speed(self->s3t[thread].s3,
-				       self->max_recv_speed)) {
-		device_set_error(d_self,
-			g_strdup("Could not set S3 maximum recv speed"),
-			DEVICE_STATUS_DEVICE_ERROR);
+	    if (!s3_device_configure_handle(self, self->s3t[thread].s3))
 		return FALSE;
-	    }
 	}
 
 	for (thread = 0; thread < self->nb_threads; thread++) {
@@ -2856,6 +4616,13 @@ setup_handle(S3Device * self) {
 		}
 	    }
 	}
+
+	/* finish what a previous run left to delete */
+	if (self->catalog_filename) {
+	    self->delete_journal = g_strdup_printf("%s.deleting",
+						   self->catalog_filename);
+	    delete_journal_replay(self);
+	}
     }
 
     return TRUE;
@@ -2960,6 +4727,32 @@ static int progress_func(
     return ret;
 }
 
+/* Cancel, or stop cancelling, the requests of all of our threads */
+static void
+s3_device_set_cancelled(
+    S3Device *self,
+    gboolean cancelled)
+{
+    int thread;
+
+    if (!self->s3t)
+	return;
+    for (thread = 0; thread < self->nb_threads; thread++) {
+	if (self->s3t[thread].s3)
+	    s3_set_cancelled(self->s3t[thread].s3, cancelled);
+    }
+}
+
+static void
+s3_device_cancel(
+    Device *pself)
+{
+    S3Device *self = S3_DEVICE(pself);
+
+    g_debug("s3_device_cancel: aborting the requests in progress");
+    s3_device_set_cancelled(self, TRUE);
+}
+
 static DeviceStatusFlags
 s3_device_read_label(Device *pself) {
     S3Device *self = S3_DEVICE(pself);
@@ -3098,6 +4891,7 @@ s3_device_start (Device * pself, DeviceAccessMode mode,
     }
 
     reset_thread(self);
+    s3_device_set_cancelled(self, FALSE);
     pself->access_mode = mode;
     g_mutex_lock(pself->device_mutex);
     pself->in_file = FALSE;
@@ -3122,6 +4916,7 @@ s3_device_start (Device * pself, DeviceAccessMode mode,
             if (!delete_all_files(self)) {
 		return FALSE;
 	    }
+	    cache_start_run(self);
 
             /* write a new amanda header */
             if (!write_amanda_header(self, label, timestamp)) {
@@ -3141,6 +4936,8 @@ s3_device_start (Device * pself, DeviceAccessMode mode,
 	    if (pself->volume_label == NULL && s3_device_read_label(pself) != DEVICE_STATUS_SUCCESS) {
 		/* s3_device_read_label already set our error message */
 		return FALSE;
+	    } else if (catalog_index_valid(self)) {
+		self->volume_bytes = self->catalog_bytes;
 	    } else {
                 result = s3_list_keys(self->s3t[0].s3, self->bucket, NULL, self->prefix, NULL, &keys, &total_size);
                 if(!result) {
@@ -3152,6 +4949,7 @@ s3_device_start (Device * pself, DeviceAccessMode mode,
                     self->volume_bytes = total_size;
                 }
             }
+	    cache_start_run(self);
             return seek_to_end(self);
             break;
 
@@ -3162,7 +4960,6 @@ s3_device_start (Device * pself, DeviceAccessMode mode,
     return TRUE;
 }
 
-gint gint_cmp(gconstpointer a, gconstpointer b, gpointer data);
 gint
 gint_cmp(
     gconstpointer a,
@@ -3187,6 +4984,8 @@ s3_device_finish (
     S3Device *self = S3_DEVICE(pself);
 
     reset_thread(self);
+    s3_prefetch_discard(self);
+    s3_device_set_cancelled(self, FALSE);
 
     /* we're not in a file anymore */
     pself->access_mode = ACCESS_NULL;
@@ -3247,17 +5046,21 @@ s3_device_get_bytes_written(
 }
 
 
+/* Start a new file with the header JOBINFO: the filestart object is written,
+ * and the volume must have room for it and DATA_SIZE bytes more. */
 static gboolean
-s3_device_start_file (Device *pself, dumpfile_t *jobInfo) {
-    S3Device *self = S3_DEVICE(pself);
+s3_device_write_filestart(
+    S3Device *self,
+    dumpfile_t *jobInfo,
+    guint64 data_size)
+{
+    Device *pself = DEVICE(self);
     CurlBuffer amanda_header = {NULL, 0, 0, 0, TRUE, NULL, NULL};
     gboolean result;
     size_t header_size;
     char  *key;
     int    thread;
 
-    if (device_in_error(self)) return FALSE;
-
     reset_thread(self);
     pself->is_eom = FALSE;
 
@@ -3277,10 +5080,10 @@ s3_device_start_file (Device *pself, dumpfile_t *jobInfo) {
     }
     amanda_header.buffer_len = header_size;
 
-    if(check_at_leom(self, header_size))
+    if(check_at_leom(self, header_size + data_size))
         pself->is_eom = TRUE;
 
-    if(check_at_peom(self, header_size)) {
+    if(check_at_peom(self, header_size + data_size)) {
         pself->is_eom = TRUE;
         device_set_error(pself,
             g_strdup(_("No space left on device")),
@@ -3297,6 +5100,16 @@ s3_device_start_file (Device *pself, dumpfile_t *jobInfo) {
     /* set the file and block numbers correctly */
     pself->file = (pself->file > 0)? pself->file+1 : 1;
     pself->block = 0;
+
+    /* the old keys of this file number must be gone before it is reused */
+    if (!delete_queue_wait(self, pself->file)) {
+	g_free(amanda_header.buffer);
+	return FALSE;
+    }
+    key = g_strdup_printf("%sf%08x-", self->prefix, pself->file);
+    cache_drop(self, key);
+    g_free(key);
+
     g_mutex_lock(pself->device_mutex);
     pself->in_file = TRUE;
     pself->bytes_written = 0;
@@ -3319,6 +5132,20 @@ s3_device_start_file (Device *pself, dumpfile_t *jobInfo) {
     }
 
     self->volume_bytes += header_size;
+    self->file_start_bytes = self->volume_bytes;
+
+    return TRUE;
+}
+
+static gboolean
+s3_device_start_file (Device *pself, dumpfile_t *jobInfo) {
+    S3Device *self = S3_DEVICE(pself);
+
+    if (device_in_error(self)) return FALSE;
+
+    s3_device_set_cancelled(self, FALSE);
+    if (!s3_device_write_filestart(self, jobInfo, 0))
+	return FALSE;
 
     if (self->chunked) {
 	self->filename = file_to_multi_part_key(self, pself->file);
@@ -3327,13 +5154,140 @@ s3_device_start_file (Device *pself, dumpfile_t *jobInfo) {
 	self->uploadId = g_strdup(s3_initiate_multi_part_upload(self->s3t[0].s3,
 						self->bucket, self->filename));
 	self->part_etag = g_tree_new_full(gint_cmp, NULL, NULL, g_free);
+	self->part_buffer_len = 0;
+	self->part_number = 0;
     }
 
     return TRUE;
 }
 
+/* The most parts of a multi-part upload: a Swift Static Large Object only
+ * has 1000 segments by default */
+static guint
+s3_device_max_parts(
+    S3Device *self)
+{
+    return S3_API_IS_SWIFT(self->s3_api) ? S3_DEVICE_MAX_SWIFT_PARTS
+					 : S3_DEVICE_MAX_PARTS;
+}
+
+/* The size at which the part being accumulated is uploaded: S3_PART_SIZE,
+ * raised so that MAX_VOLUME_USAGE fits in the parts the server allows, and
+ * doubled every tenth of them so that a file larger than expected still
+ * fits. */
+static guint
+s3_device_part_size(
+    S3Device *self)
+{
+    guint64 part_size = self->part_size;
+    guint max_parts = s3_device_max_parts(self);
+
+    if (self->volume_limit &&
+	part_size < self->volume_limit / (max_parts - max_parts / 10) + 1) {
+	part_size = self->volume_limit / (max_parts - max_parts / 10) + 1;
+    }
+    part_size <<= self->part_number / (max_parts / 10);
+    if (part_size > S3_DEVICE_MAX_PART_SIZE)
+	part_size = S3_DEVICE_MAX_PART_SIZE;
+
+    return (guint)part_size;
+}
+
+/* Upload the part accumulated in self->part_buffer once a thread is idle.  The
+ * buffer is handed to the thread, and the thread's buffer is kept for the next
+ * part, so the part is not copied again. */
+static DeviceWriteResult
+s3_device_write_part(
+    S3Device *self)
+{
+    Device *pself = DEVICE(self);
+    S3_by_thread *s3t = NULL;
+    char *buffer;
+    guint buffer_size;
+    int thread;
+
+    if (self->part_number >= (int)s3_device_max_parts(self)) {
+	device_set_error(pself,
+	    g_strdup_printf(_("Too many parts for a multi part upload (%d)"),
+			    s3_device_max_parts(self)),
+	    DEVICE_STATUS_DEVICE_ERROR | DEVICE_STATUS_VOLUME_ERROR);
+	return WRITE_FAILED;
+    }
+
+    g_mutex_lock(self->thread_idle_mutex);
+    while (!s3t) {
+	for (thread = 0; thread < self->nb_threads_backup; thread++)  {
+	    if (self->s3t[thread].idle == 1) {
+		/* Check if the thread is in error */
+		if (self->s3t[thread].errflags != DEVICE_STATUS_SUCCESS) {
+		    device_set_error(pself, (char *)self->s3t[thread].errmsg,
+				     self->s3t[thread].errflags);
+		    self->s3t[thread].errflags = DEVICE_STATUS_SUCCESS;
+		    self->s3t[thread].errmsg = NULL;
+		    g_mutex_unlock(self->thread_idle_mutex);
+		    return WRITE_FAILED;
+		}
+		s3t = &self->s3t[thread];
+		break;
+	    }
+	}
+	if (!s3t) {
+	    g_cond_wait(self->thread_idle_cond, self->thread_idle_mutex);
+	}
+    }
+
+    buffer = s3t->curl_buffer.buffer;
+    buffer_size = buffer ? s3t->buffer_len : 0;
+    s3t->curl_buffer.buffer = self->part_buffer;
+    s3t->buffer_len = self->part_buffer_size;
+    s3t->curl_buffer.buffer_len = self->part_buffer_len;
+    s3t->curl_buffer.buffer_pos = 0;
+    s3t->curl_buffer.max_buffer_size = self->part_buffer_size;
+    s3t->curl_buffer.end_of_buffer = TRUE;
+    s3t->curl_buffer.mutex = NULL;
+    s3t->curl_buffer.cond = NULL;
+    self->part_buffer = buffer;
+    self->part_buffer_size = buffer_size;
+    self->part_buffer_len = 0;
+
+    s3t->idle = 0;
+    s3t->done = 0;
+    s3t->filename = g_strdup(self->filename);
+    s3t->uploadId = g_strdup(self->uploadId);
+    s3t->partNumber = ++self->part_number;
+    g_mutex_unlock(self->thread_idle_mutex);
+    s3_start_write_block(self, s3t);
+
+    return WRITE_SUCCEED;
+}
+
 static DeviceWriteResult
 s3_device_write_block (Device * pself, guint size, gpointer data) {
+    return s3_device_write_block_common(pself, size, data, NULL, NULL);
+}
+
+static DeviceWriteResult
+s3_device_write_block_ref (Device * pself, guint size, gpointer data,
+			   DeviceReleaseFunc release, gpointer release_data) {
+    S3Device * self = S3_DEVICE(pself);
+    DeviceWriteResult result;
+
+    /* only a block uploaded by itself can be sent from the caller's buffer */
+    if (self->chunked || (self->part_size && self->uploadId)) {
+	result = s3_device_write_block(pself, size, data);
+	if (result == WRITE_SUCCEED)
+	    release(release_data);
+	return result;
+    }
+    return s3_device_write_block_common(pself, size, data, release,
+					release_data);
+}
+
+/* Write a block, copying it unless RELEASE is given, in which case the upload
+ * is sent from DATA and RELEASE is called once it completes. */
+static DeviceWriteResult
+s3_device_write_block_common (Device * pself, guint size, gpointer data,
+			      DeviceReleaseFunc release, gpointer release_data) {
     char *filename;
     S3Device * self = S3_DEVICE(pself);
     int idle_thread = 0;
@@ -3356,6 +5310,36 @@ s3_device_write_block (Device * pself, guint size, gpointer data) {
         return WRITE_FAILED;
     }
 
+    if (self->part_size && self->uploadId) {
+	/* make sure the part ends at a block boundary without overflowing */
+	if (self->part_buffer_len &&
+	    (guint64)self->part_buffer_len + size > G_MAXUINT &&
+	    s3_device_write_part(self) != WRITE_SUCCEED)
+	    return WRITE_FAILED;
+	if (self->part_buffer_size < self->part_buffer_len + size) {
+	    guint new_size = self->part_buffer_len + size;
+	    char *new_buffer;
+
+	    if (new_size < s3_device_part_size(self) + size)
+		new_size = s3_device_part_size(self) + size;
+	    new_buffer = g_try_realloc(self->part_buffer, new_size);
+	    if (new_buffer == NULL) {
+		device_set_error(pself, g_strdup("Failed to allocate memory"),
+				 DEVICE_STATUS_DEVICE_ERROR);
+		return WRITE_FAILED;
+	    }
+	    self->part_buffer = new_buffer;
+	    self->part_buffer_size = new_size;
+	}
+	memcpy(self->part_buffer + self->part_buffer_len, data, size);
+	self->part_buffer_len += size;
+	pself->block++;
+	self->volume_bytes += size;
+	if (self->part_buffer_len >= s3_device_part_size(self))
+	    return s3_device_write_part(self);
+	return WRITE_SUCCEED;
+    }
+
     if (self->use_s3_multi_part_upload && self->uploadId) {
 	filename = g_strdup(self->filename);
     } else if (self->chunked) {
@@ -3442,27 +5426,35 @@ s3_device_write_block (Device * pself, guint size, gpointer data) {
 	allocate = size;
     }
 
-    if (self->s3t[thread].curl_buffer.buffer &&
-	self->s3t[thread].curl_buffer.buffer_len < allocate) {
-	g_free((char *)self->s3t[thread].curl_buffer.buffer);
-	self->s3t[thread].curl_buffer.buffer = NULL;
-	self->s3t[thread].curl_buffer.buffer_len = 0;
-	self->s3t[thread].buffer_len = 0;
-    }
-    if (self->s3t[thread].curl_buffer.buffer == NULL) {
-	self->s3t[thread].curl_buffer.buffer = g_try_malloc(allocate);
+    if (release) {
+	/* upload straight from the caller's buffer; keep ours for later */
+	self->s3t[thread].own_buffer = self->s3t[thread].curl_buffer.buffer;
+	self->s3t[thread].curl_buffer.buffer = data;
+	self->s3t[thread].release = release;
+	self->s3t[thread].release_data = release_data;
+    } else {
+	if (self->s3t[thread].curl_buffer.buffer &&
+	    self->s3t[thread].curl_buffer.buffer_len < allocate) {
+	    g_free((char *)self->s3t[thread].curl_buffer.buffer);
+	    self->s3t[thread].curl_buffer.buffer = NULL;
+	    self->s3t[thread].curl_buffer.buffer_len = 0;
+	    self->s3t[thread].buffer_len = 0;
+	}
 	if (self->s3t[thread].curl_buffer.buffer == NULL) {
-	    device_set_error(pself, g_strdup("Failed to allocate memory"),
-			     DEVICE_STATUS_DEVICE_ERROR);
-	    g_mutex_unlock(self->thread_idle_mutex);
-	    return WRITE_FAILED;
+	    self->s3t[thread].curl_buffer.buffer = g_try_malloc(allocate);
+	    if (self->s3t[thread].curl_buffer.buffer == NULL) {
+		device_set_error(pself, g_strdup("Failed to allocate memory"),
+				 DEVICE_STATUS_DEVICE_ERROR);
+		g_mutex_unlock(self->thread_idle_mutex);
+		return WRITE_FAILED;
+	    }
+	    self->s3t[thread].curl_buffer.buffer_len = size;
+	    self->s3t[thread].buffer_len = size;
 	}
-	self->s3t[thread].curl_buffer.buffer_len = size;
-	self->s3t[thread].buffer_len = size;
+	memcpy((char *)self->s3t[thread].curl_buffer.buffer, data, size);
     }
     self->s3t[thread].idle = 0;
     self->s3t[thread].done = 0;
-    memcpy((char *)self->s3t[thread].curl_buffer.buffer, data, size);
     self->s3t[thread].curl_buffer.buffer_pos = 0;
     self->s3t[thread].curl_buffer.buffer_len = size;
     self->s3t[thread].curl_buffer.max_buffer_size = allocate;
@@ -3479,7 +5471,7 @@ s3_device_write_block (Device * pself, guint size, gpointer data) {
     self->s3t[thread].uploadId = g_strdup(self->uploadId);
     self->s3t[thread].partNumber = pself->block + 1;
     g_mutex_unlock(self->thread_idle_mutex);
-    g_thread_pool_push(self->thread_pool_write, &self->s3t[thread], NULL);
+    s3_start_write_block(self, &self->s3t[thread]);
 
     pself->block++;
     self->volume_bytes += size;
@@ -3522,6 +5514,33 @@ s3_thread_write_block(
 	s3t->timeout = 0;
 	g_mutex_unlock(s3t->now_mutex);
     }
+    s3_write_block_done(self, s3t, result, etag);
+}
+
+/* Record the result of a block upload and mark S3T idle; takes ownership of
+ * ETAG.  Called without thread_idle_mutex. */
+static void
+s3_write_block_done(
+    S3Device *self,
+    S3_by_thread *s3t,
+    gboolean result,
+    char *etag)
+{
+    if (result && self->cache_write_through && !s3t->uploadId &&
+	!self->chunked)
+	cache_store(self, s3t->filename, s3t->curl_buffer.buffer,
+		    s3t->curl_buffer.buffer_len);
+
+    /* give the caller's buffer back before the thread shows as idle, so that
+     * everything is released by the time finish_file returns */
+    if (s3t->release) {
+	DeviceReleaseFunc release = s3t->release;
+
+	s3t->release = NULL;
+	s3t->curl_buffer.buffer = s3t->own_buffer;
+	s3t->own_buffer = NULL;
+	release(s3t->release_data);
+    }
     g_free((void *)s3t->filename);
     g_free((void *)s3t->uploadId);
     s3t->filename = NULL;
@@ -3546,6 +5565,65 @@ s3_thread_write_block(
 
 }
 
+static void
+s3_async_write_done(
+    S3Handle *hdl,
+    gboolean success,
+    gpointer data)
+{
+    S3_by_thread *s3t = (S3_by_thread *)data;
+    char *etag = NULL;
+
+    g_mutex_lock(s3t->now_mutex);
+    s3t->timeout = 0;
+    g_mutex_unlock(s3t->now_mutex);
+    if (success && s3t->uploadId)
+	etag = s3_steal_etag(hdl);
+    s3_write_block_done(S3_DEVICE(s3t->device), s3t, success, etag);
+}
+
+/* Upload the block in S3T, asynchronously if possible.  Called without
+ * thread_idle_mutex. */
+static void
+s3_start_write_block(
+    S3Device *self,
+    S3_by_thread *s3t)
+{
+    gboolean result;
+
+    /* chunked uploads block in their read function */
+    if (!self->s3_multi || self->chunked) {
+	amexec_queue_push(self->thread_pool_write, s3t);
+	return;
+    }
+
+    g_mutex_lock(s3t->now_mutex);
+    s3t->timeout = time(NULL) + 300;
+    g_mutex_unlock(s3t->now_mutex);
+    if (s3t->uploadId) {
+	result = s3_part_upload_async(self->s3_multi, s3t->s3, self->bucket,
+				      (char *)s3t->filename,
+				      (char *)s3t->uploadId, s3t->partNumber,
+				      S3_BUFFER_READ_FUNCS,
+				      (CurlBuffer *)&s3t->curl_buffer,
+				      progress_func, s3t,
+				      s3_async_write_done, s3t);
+    } else {
+	result = s3_upload_async(self->s3_multi, s3t->s3, self->bucket,
+				 (char *)s3t->filename,
+				 S3_BUFFER_READ_FUNCS,
+				 (CurlBuffer *)&s3t->curl_buffer,
+				 progress_func, s3t,
+				 s3_async_write_done, s3t);
+    }
+    if (!result) {
+	g_mutex_lock(s3t->now_mutex);
+	s3t->timeout = 0;
+	g_mutex_unlock(s3t->now_mutex);
+	s3_write_block_done(self, s3t, FALSE, NULL);
+    }
+}
+
 gboolean add_part_etag(gpointer key, gpointer value, gpointer data);
 gboolean
 add_part_etag(
@@ -3562,6 +5640,33 @@ add_part_etag(
     return FALSE;
  }
 
+/* The segments of a Swift upload, for add_part_segment */
+typedef struct {
+    GString    *buf;
+    const char *bucket;
+    const char *key;
+    const char *uploadId;
+} part_segments_t;
+
+gboolean add_part_segment(gpointer key, gpointer value, gpointer data);
+gboolean
+add_part_segment(
+    gpointer key,
+    gpointer value,
+    gpointer data)
+{
+    int partnum = GPOINTER_TO_INT(key);
+    char *etag = (char *)value;
+    part_segments_t *ps = (part_segments_t *)data;
+    char *segment = s3_swift_segment_key(ps->key, ps->uploadId, partnum);
+
+    g_string_append_printf(ps->buf,
+	       "%s  {\"path\": \"/%s/%s\", \"etag\": \"%s\", \"size_bytes\": null}",
+	       ps->buf->len > 2 ? ",\n" : "", ps->bucket, segment, etag);
+    g_free(segment);
+    return FALSE;
+}
+
 
 static gboolean
 s3_device_finish_file (Device * pself) {
@@ -3570,10 +5675,27 @@ s3_device_finish_file (Device * pself) {
     /* Check all threads are done */
     int idle_thread = 0;
     int thread;
+    gboolean multi_part;
 
     if (!pself->in_file)
 	return TRUE;
 
+    multi_part = self->chunked ||
+		 (self->use_s3_multi_part_upload && self->uploadId);
+
+    /* upload the last part, or the only one of an empty file */
+    if (self->part_size && self->uploadId &&
+	(self->part_buffer_len > 0 || self->part_number == 0)) {
+	/* on failure, still wait for the other parts and abort the upload
+	 * below; the error makes this return FALSE */
+	if (s3_device_write_part(self) != WRITE_SUCCEED &&
+	    pself->status == DEVICE_STATUS_SUCCESS) {
+	    device_set_error(pself,
+		g_strdup(_("failed to upload the last part")),
+		DEVICE_STATUS_DEVICE_ERROR);
+	}
+    }
+
     if (self->chunked) {
 	CurlBuffer *buf = &self->s3t[0].curl_buffer;
 	g_mutex_lock(buf->mutex);
@@ -3602,12 +5724,176 @@ s3_device_finish_file (Device * pself) {
 	    g_cond_wait(self->thread_idle_cond, self->thread_idle_mutex);
 	}
     }
-    self->ultotal = 0;
-    g_mutex_unlock(self->thread_idle_mutex);
-    if (self->use_s3_multi_part_upload && self->uploadId) {
+    self->ultotal = 0;
+    g_mutex_unlock(self->thread_idle_mutex);
+
+    /* the uploads are over, so a cancel no longer stops the cleanup */
+    s3_device_set_cancelled(self, FALSE);
+
+    if (self->use_s3_multi_part_upload && self->uploadId &&
+	pself->status != DEVICE_STATUS_SUCCESS) {
+	/* a part is missing; don't leave a truncated object */
+	s3_abort_multi_part_upload(self->s3t[0].s3, self->bucket,
+				   self->filename, self->uploadId);
+	g_tree_destroy(self->part_etag);
+	self->part_etag = NULL;
+	g_free(self->filename);
+    } else if (self->use_s3_multi_part_upload && self->uploadId) {
+	CurlBuffer data;
+	GString *buf;
+
+	if (S3_API_IS_SWIFT(self->s3_api)) {
+	    /* the manifest of the Static Large Object */
+	    part_segments_t ps;
+
+	    buf = g_string_new("[\n");
+	    ps.buf = buf;
+	    ps.bucket = self->bucket;
+	    ps.key = self->filename;
+	    ps.uploadId = self->uploadId;
+	    g_tree_foreach(self->part_etag, add_part_segment, &ps);
+	    g_string_append(buf, "\n]\n");
+	} else {
+	    buf = g_string_new("<CompleteMultipartUpload>\n");
+	    g_tree_foreach(self->part_etag, add_part_etag, buf);
+	    g_string_append_printf(buf, "</CompleteMultipartUpload>\n");
+	}
+	data.buffer = buf->str;
+	data.buffer_len = strlen(buf->str);
+	data.buffer_pos = 0;
+	data.max_buffer_size = data.buffer_len;
+	data.end_of_buffer = FALSE;
+	data.mutex = NULL;
+	data.cond = NULL;
+	s3_complete_multi_part_upload(self->s3t[0].s3,
+				self->bucket, self->filename, self->uploadId,
+				S3_BUFFER_READ_FUNCS, &data);
+	g_string_free(buf, TRUE);
+
+	g_tree_destroy(self->part_etag);
+	self->part_etag = NULL;
+	g_free(self->filename);
+    }
+
+    amfree(self->uploadId);
+
+    if (self->chunked) {
+	CurlBuffer *buf = &self->s3t[0].curl_buffer;
+	g_cond_free(buf->cond);
+	buf->cond = NULL;
+	g_mutex_free(buf->mutex);
+	buf->mutex = NULL;
+    }
+
+    /* record the file in the index, or stop trusting the index */
+    if (pself->status == DEVICE_STATUS_SUCCESS) {
+	catalog_add_file(self, pself->file, pself->block,
+			 self->volume_bytes - self->file_start_bytes, multi_part);
+    } else if (self->catalog_files) {
+	g_tree_destroy(self->catalog_files);
+	self->catalog_files = NULL;
+	write_catalog(self);
+    }
+
+    /* we're not in a file anymore */
+    g_mutex_lock(pself->device_mutex);
+    pself->in_file = FALSE;
+    pself->bytes_written = 0;;
+    g_mutex_unlock(pself->device_mutex);
+
+    if (pself->status != DEVICE_STATUS_SUCCESS) {
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* The provider can copy between the two devices if they are at the same
+ * endpoint and SELF's credentials can read SRC.  A chunked upload can't be
+ * the target of a copy, and an object in glacier must be restored first. */
+static gboolean
+s3_device_can_copy_file_from(
+    Device *pself,
+    Device *psrc)
+{
+    S3Device *self = S3_DEVICE(pself);
+    S3Device *src;
+
+    if (!IS_S3_DEVICE(psrc))
+	return FALSE;
+    src = S3_DEVICE(psrc);
+
+    if (self->s3_api != src->s3_api)
+	return FALSE;
+    if (self->s3_api != S3_API_S3 && self->s3_api != S3_API_AWS4 &&
+	self->s3_api != S3_API_OAUTH2)
+	return FALSE;
+    if (g_strcmp0(self->host, src->host) != 0 ||
+	g_strcmp0(self->service_path, src->service_path) != 0)
+	return FALSE;
+    if (self->s3_api == S3_API_OAUTH2) {
+	if (g_strcmp0(self->client_id, src->client_id) != 0 ||
+	    g_strcmp0(self->refresh_token, src->refresh_token) != 0)
+	    return FALSE;
+    } else if (g_strcmp0(self->access_key, src->access_key) != 0 ||
+	       g_strcmp0(self->secret_key, src->secret_key) != 0 ||
+	       g_strcmp0(self->session_token, src->session_token) != 0) {
+	return FALSE;
+    }
+    if (self->chunked || src->read_from_glacier)
+	return FALSE;
+
+    return TRUE;
+}
+
+/* Copy the object SRC_KEY of SRC to KEY, in parts if it is larger than one
+ * copy allows.  Returns NULL, or the error message. */
+static char *
+s3_device_copy_object(
+    S3Device *self,
+    S3Device *src,
+    const char *src_key,
+    const char *key,
+    guint64 size)
+{
+    S3Handle *hdl = self->s3t[0].s3;
+    char *uploadId;
+    GTree *part_etag;
+    guint64 offset;
+    int part_number;
+    gboolean result = TRUE;
+    char *errmsg = NULL;
+
+    if (size <= S3_MAX_COPY_SIZE || self->s3_api == S3_API_OAUTH2) {
+	if (!s3_copy(hdl, src->bucket, src_key, self->bucket, key))
+	    return s3_strerror(hdl);
+	return NULL;
+    }
+
+    uploadId = g_strdup(s3_initiate_multi_part_upload(hdl, self->bucket, key));
+    if (!uploadId)
+	return s3_strerror(hdl);
+
+    part_etag = g_tree_new_full(gint_cmp, NULL, NULL, g_free);
+    part_number = 0;
+    for (offset = 0; offset < size; offset += S3_DEVICE_MAX_PART_SIZE) {
+	guint64 end = offset + S3_DEVICE_MAX_PART_SIZE - 1;
+	char *etag = NULL;
+
+	if (end >= size)
+	    end = size - 1;
+	part_number++;
+	result = s3_part_copy(hdl, src->bucket, src_key, self->bucket, key,
+			      uploadId, part_number, offset, end, &etag);
+	if (!result)
+	    break;
+	g_tree_insert(part_etag, GINT_TO_POINTER(part_number), etag);
+    }
+
+    if (result) {
 	CurlBuffer data;
 	GString *buf = g_string_new("<CompleteMultipartUpload>\n");
-	g_tree_foreach(self->part_etag, add_part_etag, buf);
+	g_tree_foreach(part_etag, add_part_etag, buf);
 	g_string_append_printf(buf, "</CompleteMultipartUpload>\n");
 	data.buffer = buf->str;
 	data.buffer_len = strlen(buf->str);
@@ -3616,36 +5902,114 @@ s3_device_finish_file (Device * pself) {
 	data.end_of_buffer = FALSE;
 	data.mutex = NULL;
 	data.cond = NULL;
-	s3_complete_multi_part_upload(self->s3t[0].s3,
-				self->bucket, self->filename, self->uploadId,
-				S3_BUFFER_READ_FUNCS, &data);
+	if (!s3_complete_multi_part_upload(hdl, self->bucket, key,
+				uploadId, S3_BUFFER_READ_FUNCS, &data))
+	    errmsg = s3_strerror(hdl);
+	g_string_free(buf, TRUE);
+    } else {
+	/* keep the error of the failed part, not the one of the abort */
+	errmsg = s3_strerror(hdl);
+	s3_abort_multi_part_upload(hdl, self->bucket, key, uploadId);
+    }
 
-	g_tree_destroy(self->part_etag);
-	self->part_etag = NULL;
-	g_free(self->filename);
+    g_tree_destroy(part_etag);
+    g_free(uploadId);
+    return errmsg;
+}
+
+/* The copy keeps the layout of the source file: a multi-part object is
+ * copied to the multi-part key, and the objects of a file written a block at
+ * a time are copied one by one.  The device reads both layouts. */
+static gboolean
+s3_device_copy_file_from(
+    Device *pself,
+    Device *psrc,
+    dumpfile_t *jobInfo,
+    guint64 *size)
+{
+    S3Device *self = S3_DEVICE(pself);
+    S3Device *src = S3_DEVICE(psrc);
+    GSList *objects = NULL;
+    GSList *iter;
+    guint64 data_size = 0;
+    guint64 blocks = 0;
+    gboolean multi_part;
+    char *errmsg = NULL;
+    char *prefix = NULL;
+    char *key;
+
+    if (device_in_error(self)) return FALSE;
+
+    multi_part = (src->filename != NULL);
+    if (multi_part) {
+	data_size = src->object_size;
+	blocks = (data_size + psrc->block_size - 1) / psrc->block_size;
+    } else {
+	char *file_prefix = file_to_prefix(src, psrc->file);
+	prefix = g_strdup_printf("%s-b", file_prefix);
+	g_free(file_prefix);
+	if (!s3_list_keys(src->s3t[0].s3, src->bucket, NULL, prefix, NULL,
+			  &objects, &data_size)) {
+	    device_set_error(pself,
+		g_strdup_printf(_("While listing the blocks to copy: %s"),
+				s3_strerror(src->s3t[0].s3)),
+		DEVICE_STATUS_DEVICE_ERROR);
+	    g_free(prefix);
+	    return FALSE;
+	}
+	blocks = g_slist_length(objects);
     }
 
-    amfree(self->uploadId);
+    if (!s3_device_write_filestart(self, jobInfo, data_size)) {
+	slist_free_full(objects, free_s3_object);
+	g_free(prefix);
+	return FALSE;
+    }
 
-    if (self->chunked) {
-	CurlBuffer *buf = &self->s3t[0].curl_buffer;
-	g_cond_free(buf->cond);
-	buf->cond = NULL;
-	g_mutex_free(buf->mutex);
-	buf->mutex = NULL;
+    if (multi_part) {
+	key = file_to_multi_part_key(self, pself->file);
+	errmsg = s3_device_copy_object(self, src, src->filename, key,
+				       data_size);
+	g_free(key);
+    } else {
+	for (iter = objects; iter != NULL && !errmsg; iter = iter->next) {
+	    s3_object *object = (s3_object *)iter->data;
+	    guint64 block = g_ascii_strtoull(object->key + strlen(prefix),
+					     NULL, 16);
+
+	    key = file_and_block_to_key(self, pself->file, block);
+	    errmsg = s3_device_copy_object(self, src, object->key, key,
+					   object->size);
+	    g_free(key);
+	}
+    }
+    slist_free_full(objects, free_s3_object);
+    g_free(prefix);
+
+    if (errmsg) {
+	device_set_error(pself,
+	    g_strdup_printf(_("While copying file %d of the source: %s"),
+			    psrc->file, errmsg),
+	    DEVICE_STATUS_DEVICE_ERROR | DEVICE_STATUS_VOLUME_ERROR);
+	g_free(errmsg);
+	if (self->catalog_files) {
+	    g_tree_destroy(self->catalog_files);
+	    self->catalog_files = NULL;
+	    write_catalog(self);
+	}
+    } else {
+	self->volume_bytes += data_size;
+	pself->block = blocks;
+	catalog_add_file(self, pself->file, blocks, data_size, multi_part);
+	*size = data_size;
     }
 
-    /* we're not in a file anymore */
     g_mutex_lock(pself->device_mutex);
     pself->in_file = FALSE;
-    pself->bytes_written = 0;;
+    pself->bytes_written = 0;
     g_mutex_unlock(pself->device_mutex);
 
-    if (pself->status != DEVICE_STATUS_SUCCESS) {
-	return FALSE;
-    }
-
-    return TRUE;
+    return pself->status == DEVICE_STATUS_SUCCESS;
 }
 
 static gboolean
@@ -3656,6 +6020,7 @@ s3_device_recycle_file(Device *pself, guint file) {
     reset_thread(self);
     delete_file(self, file);
     s3_wait_thread_delete(self);
+    catalog_remove_file(self, file);
     return !device_in_error(self);
     /* delete_file already set our error message if necessary */
 }
@@ -3687,7 +6052,7 @@ s3_device_erase(Device *pself) {
     dumpfile_free(pself->volume_header);
     pself->volume_header = NULL;
 
-    if (!delete_all_files(self))
+    if (!delete_all_files(self) || !delete_queue_wait(self, -1))
         return FALSE;
 
     device_set_error(pself, g_strdup("Unlabeled volume"),
@@ -3849,6 +6214,138 @@ s3_device_set_no_reuse(
 
 /* functions for reading */
 
+/*
+ * Glacier restores
+ *
+ * The restores requested are recorded in a state file next to the catalog,
+ * as "RESTORE: <time> <key>" lines, so that a recovery started again does
+ * not request them again while the restored copies are still there.
+ */
+
+static char *
+restore_state_filename(
+    S3Device *self)
+{
+    if (!self->catalog_filename)
+	return NULL;
+    return g_strdup_printf("%s.restoring", self->catalog_filename);
+}
+
+/* Load the restores requested lately into restore_requested */
+static void
+restore_state_read(
+    S3Device *self)
+{
+    char *filename = restore_state_filename(self);
+    FILE *file;
+    char line[S3_MAX_KEY_LENGTH + 64];
+    time_t now = time(NULL);
+
+    self->restore_requested = g_hash_table_new_full(g_str_hash, g_str_equal,
+						    g_free, g_free);
+    if (!filename)
+	return;
+    file = fopen(filename, "r");
+    g_free(filename);
+    if (!file)
+	return;
+
+    while (fgets(line, sizeof(line), file)) {
+	long requested;
+	int n = 0;
+
+	if (line[0] && line[strlen(line)-1] == '\n')
+	    line[strlen(line)-1] = '\0';
+	if (sscanf(line, "RESTORE: %ld %n", &requested, &n) < 1 || n == 0 ||
+	    !line[n])
+	    continue;
+	if (now - requested < S3_DEVICE_RESTORE_VALID) {
+	    time_t *t = g_new(time_t, 1);
+
+	    *t = requested;
+	    g_hash_table_insert(self->restore_requested, g_strdup(line + n), t);
+	}
+    }
+    fclose(file);
+}
+
+static void
+restore_state_line(
+    gpointer key,
+    gpointer value,
+    gpointer data)
+{
+    g_fprintf((FILE *)data, "RESTORE: %ld %s\n", (long)*(time_t *)value,
+	      (char *)key);
+}
+
+/* Write restore_requested back to the state file */
+static void
+restore_state_write(
+    S3Device *self)
+{
+    char *filename = restore_state_filename(self);
+    char *tmp;
+    FILE *file;
+
+    if (!filename)
+	return;
+    tmp = g_strconcat(filename, ".tmp", NULL);
+    file = fopen(tmp, "w");
+    if (file) {
+	g_hash_table_foreach(self->restore_requested, restore_state_line, file);
+	if (fclose(file) != 0 || rename(tmp, filename) != 0) {
+	    g_debug("Can't write S3 restore state '%s': %s", filename,
+		    strerror(errno));
+	    unlink(tmp);
+	}
+    } else {
+	g_debug("Can't write S3 restore state '%s': %s", tmp, strerror(errno));
+    }
+    g_free(tmp);
+    g_free(filename);
+}
+
+static void
+s3_thread_restore_block(
+    gpointer thread_data,
+    gpointer data)
+{
+    S3_by_thread *s3t = (S3_by_thread *)thread_data;
+    S3Device *self = S3_DEVICE(data);
+    s3_object *object;
+    gboolean result;
+
+    g_mutex_lock(self->thread_idle_mutex);
+    while (self->restore_objects && s3t->errflags == DEVICE_STATUS_SUCCESS) {
+	object = self->restore_objects->data;
+	self->restore_objects = g_slist_remove(self->restore_objects, object);
+	g_mutex_unlock(self->thread_idle_mutex);
+
+	result = s3_init_restore(s3t->s3, self->bucket, object->key);
+
+	g_mutex_lock(self->thread_idle_mutex);
+	if (result) {
+	    time_t *t = g_new(time_t, 1);
+
+	    *t = time(NULL);
+	    g_hash_table_insert(self->restore_requested, g_strdup(object->key),
+				t);
+	} else {
+	    s3t->errflags = DEVICE_STATUS_DEVICE_ERROR;
+	    s3t->errmsg = g_strdup_printf(_("While restoring key '%s': %s"),
+					  object->key, s3_strerror(s3t->s3));
+	}
+	free_s3_object(object);
+    }
+    s3t->idle = 1;
+    s3t->done = 1;
+    g_cond_broadcast(self->thread_idle_cond);
+    g_mutex_unlock(self->thread_idle_mutex);
+}
+
+/* Request the restore of the GLACIER objects of FILE with all the threads.
+ * The blocks are then read in order, each one as soon as it is restored. */
 static gboolean
 s3_device_init_seek_file(
     Device *pself,
@@ -3859,6 +6356,9 @@ s3_device_init_seek_file(
     GSList *objects;
     char *prefix;
     const char *errmsg = NULL;
+    char *restore_errmsg = NULL;
+    time_t now;
+    int thread;
 
     if (!self->read_from_glacier) {
 	return TRUE;
@@ -3887,53 +6387,66 @@ s3_device_init_seek_file(
 	return FALSE;
     }
 
-    /* for all GLACIER objects */
+    if (!self->restore_requested)
+	restore_state_read(self);
+
+    /* the GLACIER objects not requested lately, in key (and block) order so
+     * that the first blocks are restored first */
+    now = time(NULL);
+    g_mutex_lock(self->thread_idle_mutex);
     for (; objects; ) {
 	s3_object *object = (s3_object *)objects->data;
-	s3_head_t *head;
+	time_t *requested;
+
 	objects = g_slist_remove(objects, objects->data);
-	if (object->storage_class == S3_SC_GLACIER) {
-	    /* HEAD object */
-	    head = s3_head(self->s3t[0].s3, self->bucket, object->key);
-	    if (!head) {
-	        guint response_code;
-	        s3_error_code_t s3_error_code;
-	        s3_error(self->s3t[0].s3, &errmsg, &response_code,
-			 &s3_error_code, NULL, NULL, NULL);
-
-		device_set_error(pself,
-			g_strdup_printf(
-				_("failed to get head of objects '%s': %s"),
-				object->key, errmsg),
-			DEVICE_STATUS_SUCCESS);
+	requested = g_hash_table_lookup(self->restore_requested, object->key);
+	if (object->storage_class == S3_SC_GLACIER &&
+	    (!requested || now - *requested >= S3_DEVICE_RESTORE_VALID)) {
+	    self->restore_objects = g_slist_prepend(self->restore_objects,
+						    object);
+	} else {
+	    free_s3_object(object);
+	}
+    }
+    if (!self->restore_objects) {
+	g_mutex_unlock(self->thread_idle_mutex);
+	return TRUE;
+    }
+    self->restore_objects = g_slist_reverse(self->restore_objects);
+    g_debug("Requesting the restore of %d keys",
+	    g_slist_length(self->restore_objects));
+
+    for (thread = 0; thread < self->nb_threads; thread++) {
+	self->s3t[thread].idle = 0;
+	self->s3t[thread].done = 0;
+	amexec_queue_push(self->thread_pool_restore, &self->s3t[thread]);
+    }
+    for (thread = 0; thread < self->nb_threads; thread++) {
+	S3_by_thread *s3t = &self->s3t[thread];
 
-		return FALSE;
-	    }
-	    /* if it is not restored */
-	    if (!head->x_amz_restore) {
-	        /* init restore */
-		result = s3_init_restore(self->s3t[0].s3, self->bucket,
-					 object->key);
-		if (!result) {
-		    guint response_code;
-		    s3_error_code_t s3_error_code;
-		    s3_error(self->s3t[0].s3, &errmsg, &response_code,
-			     &s3_error_code, NULL, NULL, NULL);
+	while (!s3t->done)
+	    g_cond_wait(self->thread_idle_cond, self->thread_idle_mutex);
+	if (s3t->errflags != DEVICE_STATUS_SUCCESS) {
+	    if (!restore_errmsg)
+		restore_errmsg = (char *)s3t->errmsg;
+	    else
+		g_free((char *)s3t->errmsg);
+	    s3t->errflags = DEVICE_STATUS_SUCCESS;
+	    s3t->errmsg = NULL;
+	}
+    }
+    /* left by threads that failed */
+    slist_free_full(self->restore_objects, free_s3_object);
+    self->restore_objects = NULL;
+    g_mutex_unlock(self->thread_idle_mutex);
 
-		    device_set_error(pself,
-			g_strdup_printf(_("failed to list objects: %s"),
-					 errmsg),
-			DEVICE_STATUS_SUCCESS);
+    restore_state_write(self);
 
-		    return FALSE;
-		}
-	    }
-	    free_s3_head(head);
-	}
-	free_s3_object(object);
+    if (restore_errmsg) {
+	device_set_error(pself, restore_errmsg, DEVICE_STATUS_SUCCESS);
+	return FALSE;
     }
     return TRUE;
-
 }
 
 static dumpfile_t*
@@ -3946,10 +6459,13 @@ s3_device_seek_file(Device *pself, guint file) {
     const char *errmsg = NULL;
     int thread;
     GSList *objects;
+    S3CatalogFile *cfile;
+    gboolean prefetched;
 
     if (device_in_error(self)) return NULL;
 
     reset_thread(self);
+    s3_device_set_cancelled(self, FALSE);
 
     g_mutex_lock(pself->device_mutex);
     pself->file = file;
@@ -3963,14 +6479,28 @@ s3_device_seek_file(Device *pself, guint file) {
     self->next_block_to_read = 0;
     self->next_byte_to_read = 0;
     self->dltotal = 0;
+    self->read_span = 0;
     g_mutex_unlock(self->thread_idle_mutex);
 
     s3_device_init_seek_file(pself, file);
-    /* read it in */
-    key = special_file_to_key(self, "filestart", pself->file);
-    result = s3_read(self->s3t[0].s3, self->bucket, key, S3_BUFFER_WRITE_FUNCS,
-        &buf, NULL, NULL);
-    g_free(key);
+    /* read it in, unless it was read while the previous file was */
+    prefetched = FALSE;
+    if (self->prefetch_fileno == file && self->prefetch_thread) {
+	g_thread_join(self->prefetch_thread);
+	self->prefetch_thread = NULL;
+	prefetched = self->prefetch_ok;
+    }
+    if (prefetched) {
+	buf = self->prefetch_header;
+	self->prefetch_header.buffer = NULL;
+	result = TRUE;
+    } else {
+	s3_prefetch_discard(self);
+	key = special_file_to_key(self, "filestart", pself->file);
+	result = s3_read(self->s3t[0].s3, self->bucket, key, S3_BUFFER_WRITE_FUNCS,
+	    &buf, NULL, NULL);
+	g_free(key);
+    }
 
     if (!result) {
         guint response_code;
@@ -4036,11 +6566,35 @@ s3_device_seek_file(Device *pself, guint file) {
     }
 
     g_free(self->filename);
+    if (prefetched) {
+	/* named and sized by the prefetch */
+	self->filename = self->prefetch_filename;
+	self->prefetch_filename = NULL;
+	self->object_size = self->prefetch_object_size;
+	s3_prefetch_discard(self);
+	goto located;
+    }
     self->filename = file_to_multi_part_key(self, pself->file);
-    result = s3_list_keys(self->s3t[0].s3, self->bucket, NULL, self->filename,
-			  NULL, &objects, NULL);
+    cfile = NULL;
+    if (catalog_index_valid(self))
+	cfile = g_tree_lookup(self->catalog_files, GINT_TO_POINTER(pself->file));
+    if (cfile) {
+	objects = NULL;
+	if (cfile->multi_part) {
+	    self->object_size = cfile->size;
+	} else {
+	    g_free(self->filename);
+	    self->filename = NULL;
+	    self->object_size = 0;
+	}
+    } else {
+	result = s3_list_keys(self->s3t[0].s3, self->bucket, NULL,
+			      self->filename, NULL, &objects, NULL);
+    }
 
-    if (objects) { /* multi-part */
+    if (cfile) {
+	/* sized from the catalog */
+    } else if (objects) { /* multi-part */
 	s3_object *part = (s3_object *)objects->data;
 	self->object_size = part->size;
 	slist_free_full(objects, free_s3_object);
@@ -4050,6 +6604,7 @@ s3_device_seek_file(Device *pself, guint file) {
 	self->object_size = 0;
     }
 
+located:
     pself->in_file = TRUE;
     for (thread = 0; thread < self->nb_threads; thread++)  {
 	self->s3t[thread].idle = 1;
@@ -4062,6 +6617,112 @@ s3_device_seek_file(Device *pself, guint file) {
     return amanda_header;
 }
 
+/* Read the filestart object of the prefetched file, and list its parts if
+ * the catalog did not size them, on a handle of its own */
+static gpointer
+s3_prefetch_thread(
+    gpointer data)
+{
+    S3Device *self = S3_DEVICE(data);
+    char *key;
+    GSList *objects = NULL;
+
+    key = special_file_to_key(self, "filestart", self->prefetch_fileno);
+    self->prefetch_ok = s3_read(self->prefetch_s3, self->bucket, key,
+				S3_BUFFER_WRITE_FUNCS, &self->prefetch_header,
+				NULL, NULL);
+    g_free(key);
+    if (!self->prefetch_ok || self->prefetch_sized)
+	return NULL;
+
+    self->prefetch_ok = s3_list_keys(self->prefetch_s3, self->bucket, NULL,
+				     self->prefetch_filename, NULL, &objects,
+				     NULL);
+    if (objects) { /* multi-part */
+	s3_object *part = (s3_object *)objects->data;
+	self->prefetch_object_size = part->size;
+	slist_free_full(objects, free_s3_object);
+    } else {
+	g_free(self->prefetch_filename);
+	self->prefetch_filename = NULL;
+	self->prefetch_object_size = 0;
+    }
+    return NULL;
+}
+
+/* Locate FILE while the current file is read, so that seek_file to it does
+ * not wait for its filestart object and the listing of its parts.  Errors
+ * are not reported: seek_file then reads them itself. */
+static void
+s3_device_prefetch_file(
+    Device *pself,
+    guint file)
+{
+    S3Device *self = S3_DEVICE(pself);
+    CurlBuffer buf = {NULL, 0, 0, S3_DEVICE_MAX_BLOCK_SIZE, TRUE, NULL, NULL};
+    S3CatalogFile *cfile = NULL;
+
+    if (device_in_error(self) || self->read_from_glacier || file == 0)
+	return;
+    if (self->prefetch_fileno == file)
+	return;
+    s3_prefetch_discard(self);
+
+    if (!self->prefetch_s3) {
+	self->prefetch_s3 = s3_device_open_handle(self);
+	if (!self->prefetch_s3)
+	    return;
+	if (!s3_device_configure_handle(self, self->prefetch_s3) ||
+	    !s3_open2(self->prefetch_s3)) {
+	    s3_free(self->prefetch_s3);
+	    self->prefetch_s3 = NULL;
+	    return;
+	}
+    }
+
+    self->prefetch_header = buf;
+    self->prefetch_ok = FALSE;
+    self->prefetch_sized = FALSE;
+    self->prefetch_object_size = 0;
+    self->prefetch_filename = file_to_multi_part_key(self, file);
+    if (catalog_index_valid(self))
+	cfile = g_tree_lookup(self->catalog_files, GINT_TO_POINTER(file));
+    if (cfile) {
+	self->prefetch_sized = TRUE;
+	if (cfile->multi_part) {
+	    self->prefetch_object_size = cfile->size;
+	} else {
+	    g_free(self->prefetch_filename);
+	    self->prefetch_filename = NULL;
+	}
+    }
+
+    self->prefetch_fileno = file;
+    self->prefetch_thread = g_thread_create(s3_prefetch_thread, self, TRUE,
+					    NULL);
+    if (!self->prefetch_thread)
+	s3_prefetch_discard(self);
+    else
+	g_debug("S3 prefetch of file %u", file);
+}
+
+/* Wait for the prefetch thread and drop what it read */
+static void
+s3_prefetch_discard(
+    S3Device *self)
+{
+    if (self->prefetch_thread) {
+	g_thread_join(self->prefetch_thread);
+	self->prefetch_thread = NULL;
+    }
+    g_free(self->prefetch_header.buffer);
+    self->prefetch_header.buffer = NULL;
+    g_free(self->prefetch_filename);
+    self->prefetch_filename = NULL;
+    self->prefetch_fileno = 0;
+    self->prefetch_ok = FALSE;
+}
+
 static gboolean
 s3_device_seek_block(Device *pself, guint64 block) {
     S3Device * self = S3_DEVICE(pself);
@@ -4072,9 +6733,54 @@ s3_device_seek_block(Device *pself, guint64 block) {
     self->last_byte_read = (block * pself->block_size) - 1;
     self->next_block_to_read = block;
     self->next_byte_to_read = block * pself->block_size;
+    self->read_span = 0;
     return TRUE;
 }
 
+/* Size the ranged GETs of a multi-part object: start with one block and
+ * double the span, up to S3_READ_AHEAD, each time a full window of GETs
+ * downloads more than 10% faster than the previous window.  Called with
+ * thread_idle_mutex held. */
+static void
+s3_adjust_read_span(
+    S3Device *self,
+    int size_req)
+{
+    GTimeVal now;
+    gdouble elapsed;
+    gdouble rate;
+    guint64 window;
+
+    g_get_current_time(&now);
+    if (self->read_span == 0 || (guint64)self->read_span < (guint64)size_req) {
+	self->read_span = size_req;
+	self->read_rate = 0;
+	self->read_rate_time = now;
+	self->read_rate_bytes = self->dltotal;
+	return;
+    }
+    if (self->read_span * 2 > self->read_ahead)
+	return;
+
+    window = (guint64)self->read_span * self->nb_threads_recovery;
+    if (self->dltotal - self->read_rate_bytes < window)
+	return;
+
+    elapsed = (now.tv_sec - self->read_rate_time.tv_sec) +
+	      (now.tv_usec - self->read_rate_time.tv_usec) / 1000000.0;
+    if (elapsed <= 0)
+	return;
+    rate = (self->dltotal - self->read_rate_bytes) / elapsed;
+    if (rate > self->read_rate * 1.1) {
+	self->read_span *= 2;
+	g_debug("S3 read ahead: %.0f bytes/s, ranged GETs of %u bytes",
+		rate, self->read_span);
+    }
+    self->read_rate = rate;
+    self->read_rate_time = now;
+    self->read_rate_bytes = self->dltotal;
+}
+
 static void
 s3_start_read_ahead(
     Device * pself,
@@ -4088,8 +6794,13 @@ s3_start_read_ahead(
     guint64 range_max = 0;
 
     int allocate = size_req;
+    guint64 span = size_req;
     if (self->chunked) {
 	allocate = size_req*2 + 1;
+    } else if (self->filename && self->read_ahead) {
+	s3_adjust_read_span(self, size_req);
+	span = self->read_span;
+	allocate = span;
     }
 
     /* start a read ahead for each thread */
@@ -4109,7 +6820,11 @@ s3_start_read_ahead(
 		} else if (self->chunked && max_block < 0) {
 		    range_max = self->object_size-1;
 		} else {
-		    range_max = range_min + size_req - 1;
+		    range_max = range_min + span - 1;
+		    /* don't read past what the caller will read */
+		    if (max_block >= 0 &&
+			range_max > (guint64)(self->last_byte_read + max_block * size_req))
+			range_max = self->last_byte_read + max_block * size_req;
 		}
 		if (range_max >= self->object_size) {
 		    range_max = self->object_size-1;
@@ -4131,10 +6846,12 @@ s3_start_read_ahead(
 	    s3t->eof = FALSE;
 	    s3t->dlnow = 0;
 	    s3t->ulnow = 0;
+	    s3t->consumed = 0;
+	    s3t->block_len = size_req;
 	    s3t->errflags = DEVICE_STATUS_SUCCESS;
 	    if (self->chunked ||
 		(self->s3t[thread].curl_buffer.buffer &&
-		 (int)self->s3t[thread].curl_buffer.buffer_len < size_req)) {
+		 (int)self->s3t[thread].curl_buffer.buffer_len < allocate)) {
 		g_free(self->s3t[thread].curl_buffer.buffer);
 		self->s3t[thread].curl_buffer.buffer = NULL;
 		self->s3t[thread].curl_buffer.buffer_len = 0;
@@ -4166,8 +6883,19 @@ s3_start_read_ahead(
 		s3t->curl_buffer.cond = NULL;
 	    }
 	    self->next_block_to_read++;
-	    self->next_byte_to_read += size_req;
-	    g_thread_pool_push(self->thread_pool_read, s3t, NULL);
+	    if (self->filename && !self->chunked) {
+		self->next_byte_to_read = range_max + 1;
+	    } else {
+		self->next_byte_to_read += size_req;
+	    }
+	    if (!self->filename && !self->chunked &&
+		cache_fetch(self, key, &s3t->curl_buffer)) {
+		/* nothing to download */
+		s3t->done = 1;
+		g_cond_broadcast(self->thread_idle_cond);
+	    } else {
+		s3_start_read_block(self, s3t);
+	    }
 	}
     }
 }
@@ -4276,7 +7004,7 @@ s3_device_read_block (Device * pself, gpointer data, int *size_req, int max_bloc
 	s3t = &self->s3t[thread];
 	if (!s3t->idle &&
 	    g_str_equal(key, (char *)s3t->filename) &&
-	    range_min == s3t->range_min) {
+	    range_min == s3t->range_min + s3t->consumed) {
 	    found = 1;
 	    break;
 	}
@@ -4308,11 +7036,11 @@ s3_device_read_block (Device * pself, gpointer data, int *size_req, int max_bloc
 	    g_free(key);
 	    g_mutex_unlock(self->thread_idle_mutex);
 	    return -1;
-       } else if ((guint)*size_req >= s3t->curl_buffer.buffer_pos) {
-	    /* return the buffer */
+       } else if ((guint)*size_req >= s3t->curl_buffer.buffer_pos - s3t->consumed) {
+	    /* return the rest of the buffer */
 	    g_mutex_unlock(self->thread_idle_mutex);
-	    memcpy(data, s3t->curl_buffer.buffer, s3t->curl_buffer.buffer_pos);
-	    *size_req = s3t->curl_buffer.buffer_pos;
+	    *size_req = s3t->curl_buffer.buffer_pos - s3t->consumed;
+	    memcpy(data, s3t->curl_buffer.buffer + s3t->consumed, *size_req);
 	    g_free(key);
 	    s3t->idle = 1;
 	    g_free((char *)s3t->filename);
@@ -4321,8 +7049,25 @@ s3_device_read_block (Device * pself, gpointer data, int *size_req, int max_bloc
 	    done = 1;
 	    g_mutex_lock(self->thread_idle_mutex);
 	    break;
+	} else if (self->filename && self->read_ahead &&
+		   (guint)*size_req >= s3t->block_len) {
+	    /* a ranged GET of several blocks; return the next one */
+	    g_mutex_unlock(self->thread_idle_mutex);
+	    *size_req = s3t->block_len;
+	    memcpy(data, s3t->curl_buffer.buffer + s3t->consumed, *size_req);
+	    s3t->consumed += *size_req;
+	    g_free(key);
+	    pself->block++;
+	    self->last_byte_read += *size_req;
+	    done = 1;
+	    g_mutex_lock(self->thread_idle_mutex);
+	    break;
 	} else { /* buffer not enough large */
-	    *size_req = s3t->curl_buffer.buffer_len;
+	    if (self->filename)
+		*size_req = MIN(s3t->block_len,
+			    s3t->curl_buffer.buffer_pos - s3t->consumed);
+	    else
+		*size_req = s3t->curl_buffer.buffer_len;
 	    g_free(key);
 	    g_mutex_unlock(self->thread_idle_mutex);
 	    return 0;
@@ -4384,6 +7129,18 @@ s3_thread_read_block(
 	g_mutex_unlock(s3t->curl_buffer.mutex);
     }
     g_mutex_lock(self->thread_idle_mutex);
+    s3_read_block_done(self, s3t, result);
+    g_mutex_unlock(self->thread_idle_mutex);
+}
+
+/* Record the result of a block download and mark S3T done.  Called with
+ * thread_idle_mutex held. */
+static void
+s3_read_block_done(
+    S3Device *self,
+    S3_by_thread *s3t,
+    gboolean result)
+{
     if (!result) {
 	guint response_code;
 	s3_error_code_t s3_error_code;
@@ -4408,14 +7165,61 @@ s3_thread_read_block(
 	s3t->eof = TRUE;
     } else {
 	self->dltotal += s3t->curl_buffer.buffer_pos;
+	if (!self->filename && !self->chunked)
+	    cache_store(self, s3t->filename, s3t->curl_buffer.buffer,
+			s3t->curl_buffer.buffer_pos);
     }
     s3t->dlnow = 0;
     s3t->ulnow = 0;
     s3t->done = 1;
     g_cond_broadcast(self->thread_idle_cond);
+}
+
+static void
+s3_async_read_done(
+    S3Handle *hdl G_GNUC_UNUSED,
+    gboolean success,
+    gpointer data)
+{
+    S3_by_thread *s3t = (S3_by_thread *)data;
+    S3Device *self = S3_DEVICE(s3t->device);
+
+    g_mutex_lock(s3t->now_mutex);
+    s3t->timeout = 0;
+    g_mutex_unlock(s3t->now_mutex);
+    g_mutex_lock(self->thread_idle_mutex);
+    s3_read_block_done(self, s3t, success);
     g_mutex_unlock(self->thread_idle_mutex);
+}
+
+/* Download the block for S3T, asynchronously if possible.  Called with
+ * thread_idle_mutex held. */
+static void
+s3_start_read_block(
+    S3Device *self,
+    S3_by_thread *s3t)
+{
+    /* chunked downloads block in their write function */
+    if (!self->s3_multi || self->chunked) {
+	amexec_queue_push(self->thread_pool_read, s3t);
+	return;
+    }
 
-    return;
+    g_mutex_lock(s3t->now_mutex);
+    s3t->timeout = time(NULL) + 300;
+    g_mutex_unlock(s3t->now_mutex);
+    if (!s3_read_range_async(self->s3_multi, s3t->s3, self->bucket,
+			     (char *)s3t->filename,
+			     s3t->range_min, s3t->range_max,
+			     s3_buffer_write_func, s3_buffer_reset_func,
+			     (CurlBuffer *)&s3t->curl_buffer,
+			     progress_func, s3t,
+			     s3_async_read_done, s3t)) {
+	g_mutex_lock(s3t->now_mutex);
+	s3t->timeout = 0;
+	g_mutex_unlock(s3t->now_mutex);
+	s3_read_block_done(self, s3t, FALSE);
+    }
 }
 
 static gboolean
@@ -31,6 +31,7 @@
 
 #include "device.h"
 #include "s3.h"
+#include "amexec.h"
  /* Type checking and casting macros
  */
 #define TYPE_S3_DEVICE	(s3_device_get_type())
@@ -70,6 +71,20 @@ struct _S3_by_thread {
     GMutex		*now_mutex;
     guint64		 dlnow, ulnow;
     time_t		 timeout;
+    gpointer		 device;	/* the S3Device, for async completions */
+    guint		 consumed;	/* bytes of a ranged GET already read */
+    guint		 block_len;	/* size of the blocks a ranged GET holds */
+    DeviceReleaseFunc	 release;	/* set while uploading a caller's block */
+    gpointer		 release_data;
+    char		*own_buffer;	/* curl_buffer.buffer while it is lent */
+};
+
+/* A file of the volume, as recorded in the catalog's file index */
+typedef struct _S3CatalogFile S3CatalogFile;
+struct _S3CatalogFile {
+    guint64              blocks;
+    guint64              size;		/* data bytes, without the header */
+    gboolean             multi_part;	/* one object rather than one per block */
 };
 
 struct _S3Device {
@@ -78,6 +93,10 @@ struct _S3Device {
     char *catalog_filename;
     char *catalog_label;
     char *catalog_header;
+    GTree *catalog_files;	/* S3CatalogFile by file number, or NULL */
+    guint64 catalog_bytes;	/* volume bytes when the index was written */
+    gboolean catalog_checked;	/* the index was checked against the bucket */
+    guint64 file_start_bytes;	/* volume bytes after the current filestart */
 
     /* The "easy" curl handle we use to access Amazon S3 */
     S3_by_thread *s3t;
@@ -149,15 +168,59 @@ struct _S3Device {
     int          nb_threads_backup;
     int          nb_threads_recovery;
     gboolean     use_s3_multi_part_upload;
-    GThreadPool *thread_pool_delete;
-    GThreadPool *thread_pool_write;
-    GThreadPool *thread_pool_read;
+    gboolean     set_s3_multi_part_upload;
+    amexec_queue_t *thread_pool_delete;
+    amexec_queue_t *thread_pool_restore;
+    amexec_queue_t *thread_pool_write;
+    amexec_queue_t *thread_pool_read;
     GCond       *thread_idle_cond;
     GMutex      *thread_idle_mutex;
+    gboolean     s3_async;
+    S3Multi     *s3_multi;
+    guint64      part_size;
+    char        *part_buffer;
+    guint        part_buffer_size;
+    guint        part_buffer_len;
+    int          part_number;
+    guint64      read_ahead;
+    guint        read_span;
+    gdouble      read_rate;
+    GTimeVal     read_rate_time;
+    guint64      read_rate_bytes;
     gint64	 last_byte_read;
     gint64	 next_block_to_read;
     gint64	 next_byte_to_read;
     GSList      *objects;
+
+    /* glacier restores, see s3_device_init_seek_file */
+    GSList	*restore_objects;	/* keys left to request */
+    GHashTable	*restore_requested;	/* key -> time of its request */
+
+    /* the start of the next file, read while the current one is read, see
+     * s3_device_prefetch_file */
+    S3Handle	*prefetch_s3;
+    GThread	*prefetch_thread;
+    guint	 prefetch_fileno;	/* 0 if none */
+    gboolean	 prefetch_ok;		/* the thread read all of it */
+    gboolean	 prefetch_sized;	/* the size came from the catalog */
+    CurlBuffer	 prefetch_header;	/* the filestart object */
+    char	*prefetch_filename;	/* multi-part key, NULL for blocks */
+    guint64	 prefetch_object_size;
+
+    /* background deletion, see S3_DELETE_THREADS */
+    guint64	 delete_threads;
+    S3_by_thread *s3t_delete;
+    amexec_queue_t *thread_pool_background_delete;
+    GMutex	*delete_mutex;
+    GCond	*delete_cond;
+    GSList	*delete_objects;	/* keys left to delete, in key order */
+    GHashTable	*delete_files;		/* file number -> its keys left */
+    int		 delete_active;		/* workers draining delete_objects */
+    gboolean	 delete_stop;		/* workers stop after their batch */
+    char	*delete_errmsg;		/* why the deletion stopped */
+    char	*delete_journal;	/* journal of the keys to delete */
+    gboolean	 delete_journal_active;	/* the journal exists */
+
     guint64	 object_size;
     gboolean	 bucket_made;
 
@@ -171,6 +234,26 @@ struct _S3Device {
     char        *project_id;
 
     gboolean	 reuse_connection;
+    gboolean	 share_connections;
+    gboolean	 http2;
+    guint	 keepalive;
+    guint	 connection_idle_timeout;
+    S3_payload_signing payload_signing;
+
+    /* local block cache, see S3_CACHE_DIR */
+    char	*cache_dir;
+    guint64	 cache_size;		/* the most it may hold */
+    guint64	 cache_runs;		/* write runs kept */
+    guint64	 cache_used;		/* what it holds, as far as we know */
+    gboolean	 cache_write_through;
+    GMutex	*cache_mutex;
+
+    /* see S3_SHAPER */
+    char	*shaper_pool;
+    guint64	 shaper_send_speed;
+    guint64	 shaper_recv_speed;
+    guint	 shaper_weight;
+    S3Shaper	*shaper;
     gboolean	 chunked;
 
     gboolean	 read_from_glacier;
@@ -57,6 +57,7 @@
 #include "amanda.h"
 #endif
 #include "amjson.h"
+#include "amprobe.h"
 #include <curl/curl.h>
 
 /* Constant renamed after version 7.10.7 */
@@ -114,6 +115,10 @@ char *S3_bucket_name[] = {
 
 #define AMAZON_STORAGE_CLASS_HEADER "x-amz-storage-class"
 
+#define AMAZON_COPY_SOURCE_HEADER "x-amz-copy-source"
+#define AMAZON_COPY_SOURCE_RANGE_HEADER "x-amz-copy-source-range"
+#define GOOGLE_COPY_SOURCE_HEADER "x-goog-copy-source"
+
 #define AMAZON_SERVER_SIDE_ENCRYPTION_HEADER "x-amz-server-side-encryption"
 
 #define AMAZON_WILDCARD_LOCATION "*"
@@ -131,6 +136,16 @@ char *S3_bucket_name[] = {
 /* general "reasonable size" parameters */
 #define MAX_ERROR_RESPONSE_LEN (100*1024)
 
+/* payload bytes in each aws-chunked chunk of a streaming-signed upload */
+#define S3_STREAM_CHUNK_SIZE (64*1024)
+/* "<hex size>;chunk-signature=<64 hex>\r\n" is at most this long */
+#define S3_STREAM_CHUNK_HEADER_MAX (16+17+64+2)
+
+#define AWS4_STREAMING_PAYLOAD "STREAMING-AWS4-HMAC-SHA256-PAYLOAD"
+#define AWS4_UNSIGNED_PAYLOAD "UNSIGNED-PAYLOAD"
+#define AWS4_EMPTY_SHA256 \
+    "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"
+
 // CURLE_SSL_CACERT_BADFILE is defined in 7.16.0
 #if LIBCURL_VERSION_NUM >= 0x071000
 #define AMAMDA_CURLE_SSL_CACERT_BADFILE CURLE_SSL_CACERT_BADFILE
@@ -208,11 +223,20 @@ struct S3Handle {
     CURL *curl;
 
     gboolean verbose;
+
+    /* set by s3_set_cancelled; checked by the progress callback, so that a
+     * request in progress is aborted within a second, and not retried */
+    volatile int cancelled;
     gboolean use_ssl;
     gboolean server_side_encryption_header;
 
+    /* the source of a server-side copy, only during s3_copy/s3_part_copy */
+    char *copy_source;
+    char *copy_source_range;
+
     guint64 max_send_speed;
     guint64 max_recv_speed;
+    S3Shaper *shaper;
 
     /* information from the last request */
     char *last_message;
@@ -230,9 +254,14 @@ struct S3Handle {
     char *content_type;
 
     gboolean reuse_connection;
+    gboolean share_connections;
+    gboolean http2;
+    guint    keepalive;
+    guint    connection_idle_timeout;
     gboolean read_from_glacier;
     char *transfer_encoding;
     long     timeout;
+    S3_payload_signing payload_signing;
 
     /* CAStor */
     char *reps;
@@ -252,6 +281,38 @@ typedef struct {
     struct S3Handle *hdl;
 } S3InternalData;
 
+/* State of an upload sent with aws-chunked encoding, each chunk signed with
+ * the signature of the one before it, starting from the request's. */
+typedef struct {
+    /* from authenticate_request, for the current attempt */
+    unsigned char signing_key[32];
+    char *zulu_date;
+    char *scope;
+    char prev_signature[65];
+
+    /* the payload, read through the request's read_func */
+    s3_read_func read_func;
+    gpointer read_data;
+    size_t decoded_size;
+    size_t decoded_sent;
+    gboolean done;	/* the final, empty, chunk is framed */
+
+    /* the framed chunk being sent */
+    char *chunk;
+    size_t chunk_len;
+    size_t chunk_pos;
+} S3StreamSign;
+
+typedef enum {
+    S3_SHAPER_SEND,
+    S3_SHAPER_RECV
+} s3_shaper_direction;
+
+/* Account for BYTES moved in direction DIR, sleeping as long as the pool of
+ * SHAPER needs to get back under its limit. */
+static void
+s3_shaper_consume(S3Shaper *shaper, s3_shaper_direction dir, size_t bytes);
+
 /* Callback function to examine headers one-at-a-time
  *
  * @note this is the same as CURLOPT_HEADERFUNCTION
@@ -300,6 +361,7 @@ s3_error_name_from_code(s3_error_code_t s3_error_code);
 
 
 static void s3_new_curl(S3Handle *hdl);
+static void s3_curl_connection_options(S3Handle *hdl);
 
 /*
  * result handling */
@@ -332,6 +394,13 @@ typedef struct result_handling {
  */
 static gboolean oauth2_get_access_token(S3Handle *hdl);
 
+/*
+ * take the access token the process already has for the OAUTH2 client of
+ * HDL, and start refreshing it in the background when it is about to
+ * expire.  Returns TRUE if HDL has a token it can use.
+ */
+static gboolean oauth2_shared_access_token(S3Handle *hdl);
+
 /* Lookup a result in C{result_handling}.
  *
  * @param result_handling: array of handling specifications
@@ -407,6 +476,8 @@ build_url(
  * @param key: the key being accessed, or NULL for none
  * @param subresource: the sub-resource being accessed (e.g. "acl"), or NULL for none
  * @param md5_hash: the MD5 hash of the request body, or NULL for none
+ * @param stream_sign: for an AWS4 streaming-signed upload, where to store the
+ *     seed signature and signing key, or NULL
  */
 static struct curl_slist *
 authenticate_request(S3Handle *hdl,
@@ -419,7 +490,8 @@ authenticate_request(S3Handle *hdl,
                      const char *data_SHA256Hash,
                      const char *content_type,
                      const size_t content_length,
-                     const char *project_id);
+                     const char *project_id,
+                     S3StreamSign *stream_sign);
 
 
 
@@ -870,7 +942,8 @@ authenticate_request(S3Handle *hdl,
                      const char *data_SHA256Hash,
                      const char *content_type,
                      const size_t content_length,
-                     const char *project_id)
+                     const char *project_id,
+                     S3StreamSign *stream_sign)
 {
     time_t t;
     struct tm tmp;
@@ -1048,6 +1121,12 @@ authenticate_request(S3Handle *hdl,
 	g_string_append(auth_string, "\n");
 
         /* Header must be in alphebetic order */
+	if (stream_sign) {
+	    g_string_append(auth_string, "content-encoding:aws-chunked\n");
+	    g_string_append(strSignedHeaders, "content-encoding;");
+
+	    headers = curl_slist_append(headers, "Content-Encoding: aws-chunked");
+	}
 	if (hdl->use_subdomain) {
 	    g_string_append(auth_string, "host:");
 	    g_string_append(auth_string, bucket);
@@ -1066,11 +1145,46 @@ authenticate_request(S3Handle *hdl,
 	g_string_append(auth_string, "\n");
 	g_string_append(strSignedHeaders, ";x-amz-content-sha256");
 
+	if (hdl->copy_source) {
+	    g_string_append(auth_string, AMAZON_COPY_SOURCE_HEADER ":");
+	    g_string_append(auth_string, hdl->copy_source);
+	    g_string_append(auth_string, "\n");
+	    g_string_append(strSignedHeaders, ";"AMAZON_COPY_SOURCE_HEADER);
+
+	    buf = g_strdup_printf(AMAZON_COPY_SOURCE_HEADER ": %s",
+				  hdl->copy_source);
+	    headers = curl_slist_append(headers, buf);
+	    g_free(buf);
+	}
+	if (hdl->copy_source_range) {
+	    g_string_append(auth_string, AMAZON_COPY_SOURCE_RANGE_HEADER ":");
+	    g_string_append(auth_string, hdl->copy_source_range);
+	    g_string_append(auth_string, "\n");
+	    g_string_append(strSignedHeaders, ";"AMAZON_COPY_SOURCE_RANGE_HEADER);
+
+	    buf = g_strdup_printf(AMAZON_COPY_SOURCE_RANGE_HEADER ": %s",
+				  hdl->copy_source_range);
+	    headers = curl_slist_append(headers, buf);
+	    g_free(buf);
+	}
+
 	g_string_append(auth_string, "x-amz-date:");
 	g_string_append(auth_string, zulu_date);
 	g_string_append(auth_string, "\n");
 	g_string_append(strSignedHeaders, ";x-amz-date");
 
+	if (stream_sign) {
+	    g_string_append_printf(auth_string,
+				   "x-amz-decoded-content-length:%zu\n",
+				   stream_sign->decoded_size);
+	    g_string_append(strSignedHeaders, ";x-amz-decoded-content-length");
+
+	    buf = g_strdup_printf("x-amz-decoded-content-length: %zu",
+				  stream_sign->decoded_size);
+	    headers = curl_slist_append(headers, buf);
+	    g_free(buf);
+	}
+
 	if (hdl->server_side_encryption_header &&
 	    is_non_empty_string(hdl->server_side_encryption)) {
 	    g_string_append(auth_string, AMAZON_SERVER_SIDE_ENCRYPTION_HEADER);
@@ -1138,6 +1252,18 @@ authenticate_request(S3Handle *hdl,
 	signature = EncodeHMACSHA256(signingKey, 32, string_to_sign->str, (int)string_to_sign->len);
 	signatureHex = s3_tohex(signature, 32);
 
+	if (stream_sign) {
+	    /* the chunks chain from the signature of the request */
+	    memcpy(stream_sign->signing_key, signingKey, 32);
+	    g_free(stream_sign->zulu_date);
+	    stream_sign->zulu_date = g_strdup(zulu_date);
+	    g_free(stream_sign->scope);
+	    stream_sign->scope = g_strdup_printf("%s/%s/s3/aws4_request",
+						 szS3Date, hdl->bucket_location);
+	    g_strlcpy(stream_sign->prev_signature, (char *)signatureHex,
+		      sizeof(stream_sign->prev_signature));
+	}
+
         buf = g_strdup_printf("x-amz-content-sha256: %s", data_SHA256Hash);
         headers = curl_slist_append(headers, buf);
         g_free(buf);
@@ -1195,6 +1321,17 @@ authenticate_request(S3Handle *hdl,
 	g_string_append(auth_string, "\n");
 
 	/* CanonicalizedAmzHeaders, sorted lexicographically */
+	if (hdl->copy_source) {
+	    g_string_append(auth_string, AMAZON_COPY_SOURCE_HEADER ":");
+	    g_string_append(auth_string, hdl->copy_source);
+	    g_string_append(auth_string, "\n");
+	}
+	if (hdl->copy_source_range) {
+	    g_string_append(auth_string, AMAZON_COPY_SOURCE_RANGE_HEADER ":");
+	    g_string_append(auth_string, hdl->copy_source_range);
+	    g_string_append(auth_string, "\n");
+	}
+
 	if (is_non_empty_string(hdl->user_token)) {
 	    g_string_append(auth_string, AMAZON_SECURITY_HEADER);
 	    g_string_append(auth_string, ":");
@@ -1279,6 +1416,19 @@ authenticate_request(S3Handle *hdl,
 #endif
 	auth_base64 = s3_base64_encode(md);
 	/* append the new headers */
+	if (hdl->copy_source) {
+	    buf = g_strdup_printf(AMAZON_COPY_SOURCE_HEADER ": %s",
+				  hdl->copy_source);
+	    headers = curl_slist_append(headers, buf);
+	    g_free(buf);
+	}
+	if (hdl->copy_source_range) {
+	    buf = g_strdup_printf(AMAZON_COPY_SOURCE_RANGE_HEADER ": %s",
+				  hdl->copy_source_range);
+	    headers = curl_slist_append(headers, buf);
+	    g_free(buf);
+	}
+
 	if (is_non_empty_string(hdl->user_token)) {
 	    /* Devpay headers are included in hash. */
 	    buf = g_strdup_printf(AMAZON_SECURITY_HEADER ": %s",
@@ -1351,6 +1501,13 @@ authenticate_request(S3Handle *hdl,
         g_free(buf);
     }
 
+    if (hdl->copy_source && hdl->s3_api == S3_API_OAUTH2) {
+        buf = g_strdup_printf(GOOGLE_COPY_SOURCE_HEADER ": %s",
+			      hdl->copy_source);
+        headers = curl_slist_append(headers, buf);
+        g_free(buf);
+    }
+
     if (project_id && hdl->s3_api == S3_API_OAUTH2) {
         buf = g_strdup_printf("x-goog-project-id: %s", project_id);
         headers = curl_slist_append(headers, buf);
@@ -2225,6 +2382,145 @@ s3_buffer_write_func(void *ptr, size_t size, size_t nmemb, void *stream)
     return new_bytes;
 }
 
+/* Bytes sent for an aws-chunked chunk of LEN payload bytes */
+static size_t
+s3_stream_chunk_size(
+    size_t len)
+{
+    char hex[17];
+
+    return g_snprintf(hex, sizeof(hex), "%zx", len) + 17 + 64 + 2 + len + 2;
+}
+
+/* Bytes sent for DECODED_SIZE payload bytes, including the final chunk */
+static size_t
+s3_stream_encoded_size(
+    size_t decoded_size)
+{
+    size_t size;
+
+    size = (decoded_size / S3_STREAM_CHUNK_SIZE) *
+	   s3_stream_chunk_size(S3_STREAM_CHUNK_SIZE);
+    if (decoded_size % S3_STREAM_CHUNK_SIZE)
+	size += s3_stream_chunk_size(decoded_size % S3_STREAM_CHUNK_SIZE);
+    return size + s3_stream_chunk_size(0);
+}
+
+/* Read, sign and frame the next chunk of the payload.  Returns FALSE if the
+ * payload is shorter than announced. */
+static gboolean
+s3_stream_next_chunk(
+    S3StreamSign *sign)
+{
+    size_t len = MIN(S3_STREAM_CHUNK_SIZE,
+		     sign->decoded_size - sign->decoded_sent);
+    char header[S3_STREAM_CHUNK_HEADER_MAX + 1];
+    size_t header_len;
+    size_t got = 0;
+    GString *string_to_sign;
+    char *data_hash = NULL;
+    unsigned char *signature;
+    unsigned char *signature_hex;
+
+    if (!sign->chunk)
+	sign->chunk = g_malloc(S3_STREAM_CHUNK_HEADER_MAX +
+			       S3_STREAM_CHUNK_SIZE + 2);
+
+    /* the length of the header only depends on LEN, so the payload can be
+     * read in place and the header written in front of it once signed */
+    header_len = s3_stream_chunk_size(len) - len - 2;
+    while (got < len) {
+	size_t n = sign->read_func(sign->chunk + header_len + got, 1,
+				   len - got, sign->read_data);
+	if (n == 0 || n > len - got)
+	    return FALSE;
+	got += n;
+    }
+
+    if (len)
+	data_hash = s3_compute_sha256_hash(
+			(unsigned char *)sign->chunk + header_len, len);
+    string_to_sign = g_string_new("AWS4-HMAC-SHA256-PAYLOAD\n");
+    g_string_append_printf(string_to_sign, "%s\n%s\n%s\n%s\n%s",
+			   sign->zulu_date, sign->scope, sign->prev_signature,
+			   AWS4_EMPTY_SHA256,
+			   data_hash ? data_hash : AWS4_EMPTY_SHA256);
+    signature = EncodeHMACSHA256(sign->signing_key, 32, string_to_sign->str,
+				 (int)string_to_sign->len);
+    signature_hex = s3_tohex(signature, 32);
+    g_strlcpy(sign->prev_signature, (char *)signature_hex,
+	      sizeof(sign->prev_signature));
+
+    g_snprintf(header, sizeof(header), "%zx;chunk-signature=%s\r\n",
+	       len, signature_hex);
+    memcpy(sign->chunk, header, header_len);
+    memcpy(sign->chunk + header_len + len, "\r\n", 2);
+    sign->chunk_len = header_len + len + 2;
+    sign->chunk_pos = 0;
+    sign->decoded_sent += len;
+    if (len == 0)
+	sign->done = TRUE;
+
+    g_string_free(string_to_sign, TRUE);
+    g_free(data_hash);
+    g_free(signature);
+    g_free(signature_hex);
+    return TRUE;
+}
+
+/* a CURLOPT_READFUNCTION sending the payload of a streaming-signed upload */
+static size_t
+s3_stream_sign_read_func(void *ptr, size_t size, size_t nmemb, void * stream)
+{
+    S3StreamSign *sign = stream;
+    size_t bytes_desired = size * nmemb;
+    size_t copied = 0;
+
+    while (copied < bytes_desired) {
+	size_t n;
+
+	if (sign->chunk_pos == sign->chunk_len) {
+	    if (sign->done)
+		break;
+	    if (!s3_stream_next_chunk(sign)) {
+		g_debug("streaming upload payload ended early");
+#ifdef CURL_READFUNC_ABORT
+		return CURL_READFUNC_ABORT;
+#else
+		return 0;
+#endif
+	    }
+	}
+	n = MIN(bytes_desired - copied, sign->chunk_len - sign->chunk_pos);
+	memcpy((char *)ptr + copied, sign->chunk + sign->chunk_pos, n);
+	sign->chunk_pos += n;
+	copied += n;
+    }
+
+    return copied;
+}
+
+/* Start the payload over, for a new attempt */
+static void
+s3_stream_sign_reset(
+    S3StreamSign *sign)
+{
+    sign->decoded_sent = 0;
+    sign->done = FALSE;
+    sign->chunk_len = 0;
+    sign->chunk_pos = 0;
+}
+
+static void
+s3_stream_sign_free(
+    S3StreamSign *sign)
+{
+    g_free(sign->zulu_date);
+    g_free(sign->scope);
+    g_free(sign->chunk);
+    g_free(sign);
+}
+
 /* a CURLOPT_READFUNCTION that writes nothing. */
 size_t
 s3_empty_read_func(G_GNUC_UNUSED void *ptr, G_GNUC_UNUSED size_t size, G_GNUC_UNUSED size_t nmemb, G_GNUC_UNUSED void * stream)
@@ -2399,54 +2695,84 @@ curl_debug_message(CURL *curl G_GNUC_UNUSED,
 
     return 0;
 }
-static s3_result_t
-perform_request(S3Handle *hdl,
-                const char *verb,
-                const char *bucket,
-                const char *key,
-                const char *subresource,
-                const char **query,
-                const char *content_type,
-                const char *project_id,
-		struct curl_slist *user_headers,
-                s3_read_func read_func,
-                s3_reset_func read_reset_func,
-                s3_size_func size_func,
-                s3_md5_func md5_func,
-                gpointer read_data,
-                s3_write_func write_func,
-                s3_reset_func write_reset_func,
-                gpointer write_data,
-                s3_progress_func progress_func,
-                gpointer progress_data,
-                const result_handling_t *result_handling,
-		gboolean chunked)
+/* The state of one request, across its retries.  Synchronous requests point
+ * at their caller's arguments; asynchronous ones (see S3Multi) own copies. */
+typedef struct S3Request {
+    S3Handle *hdl;
+
+    /* the request, as passed to perform_request */
+    char *verb;
+    char *bucket;
+    char *key;
+    char *subresource;
+    char **query;
+    char *content_type;
+    char *project_id;
+    struct curl_slist *user_headers;
+    s3_read_func read_func;
+    s3_reset_func read_reset_func;
+    s3_size_func size_func;
+    s3_md5_func md5_func;
+    gpointer read_data;
+    s3_progress_func progress_func;
+    gpointer progress_data;
+    const result_handling_t *result_handling;
+    gboolean chunked;
+    gboolean owns_args;
+
+    /* per-request state */
+    char *url;
+    struct curl_slist *headers;
+    char curl_error_buffer[CURL_ERROR_SIZE];
+    S3InternalData int_writedata;
+    int curlopt_upload, curlopt_nobody, curlopt_httpget, curlopt_post;
+    const char *curlopt_customrequest;
+    gchar *md5_hash_hex, *md5_hash_b64;
+    size_t request_body_size;
+    char *data_SHA256Hash;
+    S3StreamSign *stream_sign;	/* AWS4 streaming signature, or NULL */
+    gint retries;
+    gint retry_after_close;
+    gulong backoff;
+    gulong retry_delay;	/* usec to wait before the next attempt */
+    s3_result_t result;
+
+    /* asynchronous requests only */
+    gboolean server_side_encryption_header;
+    gboolean glacier_retry;	/* retry while a glacier restore is ongoing */
+    gint64 retry_at;		/* time of the next attempt, in usec */
+    s3_done_func done_func;
+    gpointer done_data;
+
+    /* what s3_shaped_read_func reads from */
+    s3_read_func shaped_read_func;
+    gpointer shaped_read_data;
+} S3Request;
+
+/* a CURLOPT_READFUNCTION throttling the read function of a request */
+static size_t
+s3_shaped_read_func(void *ptr, size_t size, size_t nmemb, void * stream)
 {
-    char *url = NULL;
-    s3_result_t result = S3_RESULT_FAIL; /* assume the worst.. */
-    CURLcode curl_code = CURLE_OK;
-    char curl_error_buffer[CURL_ERROR_SIZE] = "";
-    struct curl_slist *headers = NULL;
-    /* Set S3Internal Data */
-    S3InternalData int_writedata = {{NULL, 0, 0, MAX_ERROR_RESPONSE_LEN, TRUE, NULL, NULL}, NULL, NULL, NULL, FALSE, FALSE, NULL, hdl};
-    gboolean should_retry;
-    gint retries = 0;
-    gint retry_after_close = 0;
-    gulong backoff = EXPONENTIAL_BACKOFF_START_USEC;
-    /* corresponds to PUT, HEAD, GET, and POST */
-    int curlopt_upload = 0, curlopt_nobody = 0, curlopt_httpget = 0, curlopt_post = 0;
-    /* do we want to examine the headers */
-    const char *curlopt_customrequest = NULL;
-    /* for MD5 calculation */
-    GByteArray *md5_hash = NULL;
-    gchar *md5_hash_hex = NULL, *md5_hash_b64 = NULL;
-    size_t request_body_size = 0;
-    char *data_SHA256Hash = NULL;
+    S3Request *req = stream;
+    size_t bytes;
+
+    bytes = req->shaped_read_func(ptr, size, nmemb, req->shaped_read_data);
+    /* not CURL_READFUNC_ABORT or CURL_READFUNC_PAUSE */
+    if (bytes <= size * nmemb)
+	s3_shaper_consume(req->hdl->shaper, S3_SHAPER_SEND, bytes);
+    return bytes;
+}
 
-    g_assert(hdl != NULL && hdl->curl != NULL);
+/* Get a fresh authentication token if the API needs one.  Returns
+ * S3_RESULT_OK, or the failure from getting the token. */
+static s3_result_t
+request_refresh_token(
+    S3Handle *hdl)
+{
+    s3_result_t result;
 
     if (hdl->s3_api == S3_API_OAUTH2 && !hdl->getting_oauth2_access_token &&
-	(!hdl->access_token || hdl->expires < time(NULL))) {
+	!oauth2_shared_access_token(hdl)) {
 	result = oauth2_get_access_token(hdl);
 	if (!result) {
 	    g_debug("oauth2_get_access_token returned %d", result);
@@ -2468,335 +2794,544 @@ perform_request(S3Handle *hdl,
 	}
     }
 
+    return S3_RESULT_OK;
+}
+
+/* Set up REQ for its first attempt.  Returns FALSE if it cannot be sent. */
+static gboolean
+request_prepare(
+    S3Request *req,
+    s3_write_func write_func,
+    s3_reset_func write_reset_func,
+    gpointer write_data)
+{
+    S3Handle *hdl = req->hdl;
+    GByteArray *md5_hash = NULL;
+    S3InternalData int_writedata = {{NULL, 0, 0, MAX_ERROR_RESPONSE_LEN, TRUE, NULL, NULL}, NULL, NULL, NULL, FALSE, FALSE, NULL, hdl};
+
+    AMPROBE3(s3__request__begin, req->verb, req->bucket, req->key);
+
+    req->int_writedata = int_writedata;
+    req->result = S3_RESULT_FAIL; /* assume the worst.. */
+    req->backoff = EXPONENTIAL_BACKOFF_START_USEC;
+
     s3_reset(hdl);
 
-    url = build_url(hdl, bucket, key, subresource, query);
-    if (!url) goto cleanup;
+    req->url = build_url(hdl, req->bucket, req->key, req->subresource,
+			 (const char **)req->query);
+    if (!req->url)
+	return FALSE;
 
     /* libcurl may behave strangely if these are not set correctly */
-    if (g_str_has_prefix(verb, "PUT")) {
-        curlopt_upload = 1;
-    } else if (g_str_has_prefix(verb, "GET")) {
-        curlopt_httpget = 1;
-    } else if (g_str_has_prefix(verb, "POST")) {
-        curlopt_post = 1;
-    } else if (g_str_has_prefix(verb, "HEAD")) {
-        curlopt_nobody = 1;
+    if (g_str_has_prefix(req->verb, "PUT")) {
+        req->curlopt_upload = 1;
+    } else if (g_str_has_prefix(req->verb, "GET")) {
+        req->curlopt_httpget = 1;
+    } else if (g_str_has_prefix(req->verb, "POST")) {
+        req->curlopt_post = 1;
+    } else if (g_str_has_prefix(req->verb, "HEAD")) {
+        req->curlopt_nobody = 1;
     } else {
-        curlopt_customrequest = verb;
+        req->curlopt_customrequest = req->verb;
     }
 
-    if (size_func) {
-        request_body_size = size_func(read_data);
+    if (req->size_func) {
+        req->request_body_size = req->size_func(req->read_data);
     }
 
     if (hdl->s3_api == S3_API_AWS4) {
-	if (read_data) {
-	    data_SHA256Hash = s3_compute_sha256_hash_ba(read_data);
+	if (hdl->payload_signing == S3_PAYLOAD_STREAMING &&
+	    req->curlopt_upload && !req->chunked && req->read_func &&
+	    req->request_body_size > 0) {
+	    /* the chunks are hashed as curl sends them */
+	    req->stream_sign = g_new0(S3StreamSign, 1);
+	    req->stream_sign->read_func = req->read_func;
+	    req->stream_sign->read_data = req->read_data;
+	    req->stream_sign->decoded_size = req->request_body_size;
+	    req->request_body_size = s3_stream_encoded_size(
+						req->request_body_size);
+	    req->data_SHA256Hash = g_strdup(AWS4_STREAMING_PAYLOAD);
+	} else if (hdl->payload_signing == S3_PAYLOAD_UNSIGNED &&
+		   hdl->use_ssl && req->read_data) {
+	    req->data_SHA256Hash = g_strdup(AWS4_UNSIGNED_PAYLOAD);
+	} else if (req->read_data) {
+	    req->data_SHA256Hash = s3_compute_sha256_hash_ba(req->read_data);
 	} else {
-	    data_SHA256Hash = s3_compute_sha256_hash((unsigned char *)"", 0);
+	    req->data_SHA256Hash = s3_compute_sha256_hash((unsigned char *)"", 0);
 	}
-    } else if (md5_func) {
-        md5_hash = md5_func(read_data);
+    } else if (req->md5_func) {
+        md5_hash = req->md5_func(req->read_data);
         if (md5_hash) {
-            md5_hash_b64 = s3_base64_encode(md5_hash);
-            md5_hash_hex = s3_hex_encode(md5_hash);
+            req->md5_hash_b64 = s3_base64_encode(md5_hash);
+            req->md5_hash_hex = s3_hex_encode(md5_hash);
             g_byte_array_free(md5_hash, TRUE);
         }
     }
-    if (!read_func) {
+    if (!req->read_func) {
         /* Curl will use fread() otherwise */
-        read_func = s3_empty_read_func;
+        req->read_func = s3_empty_read_func;
     }
 
     if (write_func) {
-        int_writedata.write_func = write_func;
-        int_writedata.reset_func = write_reset_func;
-        int_writedata.write_data = write_data;
+        req->int_writedata.write_func = write_func;
+        req->int_writedata.reset_func = write_reset_func;
+        req->int_writedata.write_data = write_data;
     } else {
         /* Curl will use fwrite() otherwise */
-        int_writedata.write_func = s3_counter_write_func;
-        int_writedata.reset_func = s3_counter_reset_func;
-        int_writedata.write_data = NULL;
+        req->int_writedata.write_func = s3_counter_write_func;
+        req->int_writedata.reset_func = s3_counter_reset_func;
+        req->int_writedata.write_data = NULL;
     }
 
-    while (1) {
-	struct curl_slist *header;
-
-        /* reset things */
-        if (headers) {
-            curl_slist_free_all(headers);
-        }
-        curl_error_buffer[0] = '\0';
-        if (read_reset_func) {
-            read_reset_func(read_data);
-        }
-        /* calls write_reset_func */
-        s3_internal_reset_func(&int_writedata);
+    return TRUE;
+}
 
-        /* set up the request */
-        headers = authenticate_request(hdl, verb, bucket, key, subresource, query,
-            md5_hash_b64, data_SHA256Hash, content_type, request_body_size, project_id);
+/* The curl progress callback of every request: abort it if the handle is
+ * cancelled, or else pass the progress on to the caller's progress_func */
+static int
+s3_internal_progress_func(
+    void *data,
+    double dltotal,
+    double dlnow,
+    double ultotal,
+    double ulnow)
+{
+    S3Request *req = (S3Request *)data;
 
-	/* add user header to headers */
-	for (header = user_headers; header != NULL; header = header->next) {
-	    headers = curl_slist_append(headers, header->data);
-	}
+    if (req->hdl->cancelled)
+	return 1;
+    if (req->progress_func)
+	return req->progress_func(req->progress_data, dltotal, dlnow,
+				  ultotal, ulnow);
+    return 0;
+}
 
-	if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_V4 ))) {
-	    goto curl_error;
+/* Set up hdl->curl for the next attempt of REQ.  Returns the first curl error,
+ * in which case the attempt should not be performed. */
+static CURLcode
+request_setup_attempt(
+    S3Request *req)
+{
+    S3Handle *hdl = req->hdl;
+    CURLcode curl_code = CURLE_OK;
+    struct curl_slist *header;
 
-	}
-	if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_NOSIGNAL, TRUE)))
-	    goto curl_error;
+    /* reset things */
+    if (req->headers) {
+        curl_slist_free_all(req->headers);
+    }
+    req->curl_error_buffer[0] = '\0';
+    if (req->read_reset_func) {
+        req->read_reset_func(req->read_data);
+    }
+    if (req->stream_sign) {
+	s3_stream_sign_reset(req->stream_sign);
+    }
+    /* calls write_reset_func */
+    s3_internal_reset_func(&req->int_writedata);
+
+    /* set up the request */
+    req->headers = authenticate_request(hdl, req->verb, req->bucket, req->key,
+	req->subresource, (const char **)req->query, req->md5_hash_b64,
+	req->data_SHA256Hash, req->content_type, req->request_body_size,
+	req->project_id, req->stream_sign);
+
+    /* add user header to headers */
+    for (header = req->user_headers; header != NULL; header = header->next) {
+	req->headers = curl_slist_append(req->headers, header->data);
+    }
 
-        if (hdl->ca_info) {
-            if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_CAINFO, hdl->ca_info)))
-                goto curl_error;
-        }
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_V4 ))) {
+	return curl_code;
+    }
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_NOSIGNAL, TRUE)))
+	return curl_code;
 
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_VERBOSE, hdl->verbose)))
-            goto curl_error;
-        if (hdl->verbose) {
-            if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_DEBUGFUNCTION,
-                              curl_debug_message)))
-                goto curl_error;
-        }
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_ERRORBUFFER,
-                                          curl_error_buffer)))
-            goto curl_error;
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_NOPROGRESS, 1)))
-            goto curl_error;
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_FOLLOWLOCATION, 1)))
-            goto curl_error;
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_URL, url)))
-            goto curl_error;
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_HTTPHEADER,
-                                          headers)))
-            goto curl_error;
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_WRITEFUNCTION, s3_internal_write_func)))
-            goto curl_error;
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_WRITEDATA, &int_writedata)))
-            goto curl_error;
-        /* Note: we always have to set this apparently, for consistent "end of header" detection */
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_HEADERFUNCTION, s3_internal_header_func)))
-            goto curl_error;
-        /* Note: if set, CURLOPT_HEADERDATA seems to also be used for CURLOPT_WRITEDATA ? */
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_HEADERDATA, &int_writedata)))
-            goto curl_error;
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_PROGRESSFUNCTION, progress_func)))
-            goto curl_error;
-	if (progress_func) {
-	    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_NOPROGRESS,0)))
-		goto curl_error;
-	}
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_PROGRESSDATA, progress_data)))
-            goto curl_error;
+    if (hdl->ca_info) {
+        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_CAINFO, hdl->ca_info)))
+            return curl_code;
+    }
 
-	if (!chunked) {
-	    /* CURLOPT_INFILESIZE_LARGE added in 7.11.0 */
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_VERBOSE, hdl->verbose)))
+        return curl_code;
+    if (hdl->verbose) {
+        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_DEBUGFUNCTION,
+                          curl_debug_message)))
+            return curl_code;
+    }
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_ERRORBUFFER,
+                                      req->curl_error_buffer)))
+        return curl_code;
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_FOLLOWLOCATION, 1)))
+        return curl_code;
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_URL, req->url)))
+        return curl_code;
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_HTTPHEADER,
+                                      req->headers)))
+        return curl_code;
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_WRITEFUNCTION, s3_internal_write_func)))
+        return curl_code;
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_WRITEDATA, &req->int_writedata)))
+        return curl_code;
+    /* Note: we always have to set this apparently, for consistent "end of header" detection */
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_HEADERFUNCTION, s3_internal_header_func)))
+        return curl_code;
+    /* Note: if set, CURLOPT_HEADERDATA seems to also be used for CURLOPT_WRITEDATA ? */
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_HEADERDATA, &req->int_writedata)))
+        return curl_code;
+    /* the progress callback is always installed, as it is how a cancelled
+     * handle aborts the transfer */
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_PROGRESSFUNCTION, s3_internal_progress_func)))
+        return curl_code;
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_NOPROGRESS, 0)))
+        return curl_code;
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_PROGRESSDATA, req)))
+        return curl_code;
+
+    if (!req->chunked) {
+	/* CURLOPT_INFILESIZE_LARGE added in 7.11.0 */
 #if LIBCURL_VERSION_NUM >= 0x070b00
-            if ((curl_code = curl_easy_setopt(hdl->curl,
-					      CURLOPT_INFILESIZE_LARGE,
-					      (curl_off_t)request_body_size)))
-		goto curl_error;
+        if ((curl_code = curl_easy_setopt(hdl->curl,
+					  CURLOPT_INFILESIZE_LARGE,
+					  (curl_off_t)req->request_body_size)))
+	    return curl_code;
 #else
-            if ((curl_code = curl_easy_setopt(hdl->curl,
-					      CURLOPT_INFILESIZE,
-					      (long)request_body_size)))
-		goto curl_error;
+        if ((curl_code = curl_easy_setopt(hdl->curl,
+					  CURLOPT_INFILESIZE,
+					  (long)req->request_body_size)))
+	    return curl_code;
 #endif
 
-	    /* CURLOPT_POSTFIELDSIZE_LARGE added in 7.11.1 */
+	/* CURLOPT_POSTFIELDSIZE_LARGE added in 7.11.1 */
 #if LIBCURL_VERSION_NUM >= 0x070b01
-            if ((curl_code = curl_easy_setopt(hdl->curl,
-					      CURLOPT_POSTFIELDSIZE_LARGE,
-					      (curl_off_t)request_body_size)))
-		goto curl_error;
+        if ((curl_code = curl_easy_setopt(hdl->curl,
+					  CURLOPT_POSTFIELDSIZE_LARGE,
+					  (curl_off_t)req->request_body_size)))
+	    return curl_code;
 #else
-            if ((curl_code = curl_easy_setopt(hdl->curl,
-					      CURLOPT_POSTFIELDSIZE,
-					      (long)request_body_size)))
-		goto curl_error;
+        if ((curl_code = curl_easy_setopt(hdl->curl,
+					  CURLOPT_POSTFIELDSIZE,
+					  (long)req->request_body_size)))
+	    return curl_code;
 #endif
-	}
+    }
 
 /* CURLOPT_MAX_{RECV,SEND}_SPEED_LARGE added in 7.15.5 */
 #if LIBCURL_VERSION_NUM >= 0x070f05
-	if (s3_curl_throttling_compat()) {
-	    if (hdl->max_send_speed)
-		if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_MAX_SEND_SPEED_LARGE, (curl_off_t)hdl->max_send_speed)))
-		    goto curl_error;
-
-	    if (hdl->max_recv_speed)
-		if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_MAX_RECV_SPEED_LARGE, (curl_off_t)hdl->max_recv_speed)))
-		    goto curl_error;
-	}
+    if (s3_curl_throttling_compat()) {
+	if (hdl->max_send_speed)
+	    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_MAX_SEND_SPEED_LARGE, (curl_off_t)hdl->max_send_speed)))
+		return curl_code;
+
+	if (hdl->max_recv_speed)
+	    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_MAX_RECV_SPEED_LARGE, (curl_off_t)hdl->max_recv_speed)))
+		return curl_code;
+    }
 #endif
 
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_HTTPGET, curlopt_httpget)))
-            goto curl_error;
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_UPLOAD, curlopt_upload)))
-            goto curl_error;
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_POST, curlopt_post)))
-            goto curl_error;
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_NOBODY, curlopt_nobody)))
-            goto curl_error;
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_CUSTOMREQUEST,
-                                          curlopt_customrequest)))
-            goto curl_error;
-
-
-        if (curlopt_upload || curlopt_post) {
-            if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_READFUNCTION, read_func)))
-                goto curl_error;
-            if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_READDATA, read_data)))
-                goto curl_error;
-        } else {
-            /* Clear request_body options. */
-            if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_READFUNCTION,
-                                              NULL)))
-                goto curl_error;
-            if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_READDATA,
-                                              NULL)))
-                goto curl_error;
-        }
-	if (hdl->proxy) {
-            if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_PROXY,
-                                              hdl->proxy)))
-                goto curl_error;
-	}
-
-	if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_FRESH_CONNECT,
-		(long)(hdl->reuse_connection && retry_after_close == 0 ? 0 : 1)))) {
-	    goto curl_error;
-	}
-	if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_FORBID_REUSE,
-		(long)(hdl->reuse_connection? 0 : 1)))) {
-	    goto curl_error;
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_HTTPGET, req->curlopt_httpget)))
+        return curl_code;
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_UPLOAD, req->curlopt_upload)))
+        return curl_code;
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_POST, req->curlopt_post)))
+        return curl_code;
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_NOBODY, req->curlopt_nobody)))
+        return curl_code;
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_CUSTOMREQUEST,
+                                      req->curlopt_customrequest)))
+        return curl_code;
+
+
+    if (req->curlopt_upload || req->curlopt_post) {
+	s3_read_func read_func = req->read_func;
+	gpointer read_data = req->read_data;
+
+	if (req->stream_sign) {
+	    read_func = s3_stream_sign_read_func;
+	    read_data = req->stream_sign;
 	}
-	if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_TIMEOUT,
-		(long)hdl->timeout))) {
-	    goto curl_error;
+	if (hdl->shaper) {
+	    req->shaped_read_func = read_func;
+	    req->shaped_read_data = read_data;
+	    read_func = s3_shaped_read_func;
+	    read_data = req;
 	}
+        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_READFUNCTION, read_func)))
+            return curl_code;
+        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_READDATA, read_data)))
+            return curl_code;
+    } else {
+        /* Clear request_body options. */
+        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_READFUNCTION,
+                                          NULL)))
+            return curl_code;
+        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_READDATA,
+                                          NULL)))
+            return curl_code;
+    }
+    if (hdl->proxy) {
+        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_PROXY,
+                                          hdl->proxy)))
+            return curl_code;
+    }
 
-        /* Perform the request */
-        curl_code = curl_easy_perform(hdl->curl);
-
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_FRESH_CONNECT,
+	    (long)(hdl->reuse_connection && req->retry_after_close == 0 ? 0 : 1)))) {
+	return curl_code;
+    }
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_FORBID_REUSE,
+	    (long)(hdl->reuse_connection? 0 : 1)))) {
+	return curl_code;
+    }
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_TIMEOUT,
+	    (long)hdl->timeout))) {
+	return curl_code;
+    }
+    /* lets an S3Multi find the request of a finished transfer */
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_PRIVATE, req)))
+	return curl_code;
 
-        /* interpret the response into hdl->last* */
-    curl_error: /* (label for short-circuiting the curl_easy_perform call) */
-        should_retry = interpret_response(hdl, curl_code, curl_error_buffer,
-            int_writedata.resp_buf.buffer, int_writedata.resp_buf.buffer_pos, int_writedata.etag, md5_hash_hex);
+    return CURLE_OK;
+}
 
-	if (hdl->last_response_code == 503) {
-	    s3_new_curl(hdl);
-	}
+/* Interpret the outcome of an attempt of REQ.  Returns TRUE if REQ is
+ * finished, with its result in req->result, or FALSE if it should be tried
+ * again after req->retry_delay microseconds. */
+static gboolean
+request_attempt_done(
+    S3Request *req,
+    CURLcode curl_code)
+{
+    S3Handle *hdl = req->hdl;
+    gboolean should_retry;
 
-	if (hdl->s3_api == S3_API_OAUTH2 &&
-	    hdl->last_response_code == 401 &&
-	    hdl->last_s3_error_code == S3_ERROR_AuthenticationRequired) {
-	    should_retry = oauth2_get_access_token(hdl);
-	}
-        /* and, unless we know we need to retry, see what we're to do now */
-        if (!should_retry) {
-            result = lookup_result(result_handling, hdl->last_response_code,
-                                   hdl->last_s3_error_code, hdl->last_curl_code);
-
-            /* break out of the while(1) unless we're retrying */
-            if (result != S3_RESULT_RETRY)
-                break;
-        }
+    /* a cancelled request fails at once, without a retry */
+    if (hdl->cancelled) {
+	g_free(hdl->last_message);
+	hdl->last_message = g_strdup("Request cancelled");
+	req->result = S3_RESULT_FAIL;
+	return TRUE;
+    }
 
-        if (retries >= EXPONENTIAL_BACKOFF_MAX_RETRIES &&
-	    retry_after_close < 3 &&
-	    hdl->last_s3_error_code == S3_ERROR_RequestTimeout) {
-	    retries = -1;
-	    retry_after_close++;
-	    g_debug("Retry on a new connection");
-	}
-        if (retries >= EXPONENTIAL_BACKOFF_MAX_RETRIES) {
-            /* we're out of retries, so annotate hdl->last_message appropriately and bail
-             * out. */
-            char *m = g_strdup_printf("Too many retries; last message was '%s'", hdl->last_message);
-            if (hdl->last_message) g_free(hdl->last_message);
-            hdl->last_message = m;
-            result = S3_RESULT_FAIL;
-            break;
-        }
+    /* interpret the response into hdl->last* */
+    should_retry = interpret_response(hdl, curl_code, req->curl_error_buffer,
+        req->int_writedata.resp_buf.buffer, req->int_writedata.resp_buf.buffer_pos,
+	req->int_writedata.etag, req->md5_hash_hex);
 
-        g_usleep(backoff);
-        retries++;
-        backoff *= EXPONENTIAL_BACKOFF_BASE;
+    if (hdl->last_response_code == 503) {
+	s3_new_curl(hdl);
     }
 
-    if (result != S3_RESULT_OK) {
-        g_debug(_("%s %s failed with %d/%s"), verb, url,
-                hdl->last_response_code,
-                s3_error_name_from_code(hdl->last_s3_error_code));
+    if (hdl->s3_api == S3_API_OAUTH2 &&
+	hdl->last_response_code == 401 &&
+	hdl->last_s3_error_code == S3_ERROR_AuthenticationRequired) {
+	should_retry = oauth2_get_access_token(hdl);
+    }
+    /* and, unless we know we need to retry, see what we're to do now */
+    if (!should_retry) {
+        req->result = lookup_result(req->result_handling, hdl->last_response_code,
+                               hdl->last_s3_error_code, hdl->last_curl_code);
+
+        /* we're done unless we're retrying */
+        if (req->result != S3_RESULT_RETRY)
+            return TRUE;
     }
 
-cleanup:
-    g_free(url);
-    if (headers) curl_slist_free_all(headers);
-    g_free(md5_hash_b64);
-    g_free(md5_hash_hex);
-    g_free(data_SHA256Hash);
-
-    /* we don't deallocate the response body -- we keep it for later */
-    g_free(hdl->etag);
-    hdl->etag = int_writedata.etag;
-    hdl->last_response_body = int_writedata.resp_buf.buffer;
-    hdl->last_response_body_size = int_writedata.resp_buf.buffer_pos;
-    hdl->last_num_retries = retries;
+    if (req->retries >= EXPONENTIAL_BACKOFF_MAX_RETRIES &&
+	req->retry_after_close < 3 &&
+	hdl->last_s3_error_code == S3_ERROR_RequestTimeout) {
+	req->retries = -1;
+	req->retry_after_close++;
+	g_debug("Retry on a new connection");
+    }
+    if (req->retries >= EXPONENTIAL_BACKOFF_MAX_RETRIES) {
+        /* we're out of retries, so annotate hdl->last_message appropriately and bail
+         * out. */
+        char *m = g_strdup_printf("Too many retries; last message was '%s'", hdl->last_message);
+        if (hdl->last_message) g_free(hdl->last_message);
+        hdl->last_message = m;
+        req->result = S3_RESULT_FAIL;
+        return TRUE;
+    }
 
-    return result;
+    req->retry_delay = req->backoff;
+    req->retries++;
+    req->backoff *= EXPONENTIAL_BACKOFF_BASE;
+    return FALSE;
 }
 
+/* Free a request that owns its arguments */
+static void
+request_free(
+    S3Request *req)
+{
+    g_free(req->bucket);
+    g_free(req->key);
+    g_free(req->subresource);
+    g_strfreev(req->query);
+    g_free(req->content_type);
+    g_free(req->project_id);
+    if (req->user_headers) curl_slist_free_all(req->user_headers);
+    g_free(req);
+}
 
-static size_t
-s3_internal_write_func(void *ptr, size_t size, size_t nmemb, void * stream)
+/* Release the state of REQ and record the response in its handle; the
+ * response body is kept for later.  Returns the result of REQ. */
+static s3_result_t
+request_finish(
+    S3Request *req)
 {
-    S3InternalData *data = (S3InternalData *) stream;
-    size_t bytes_saved;
+    S3Handle *hdl = req->hdl;
+    s3_result_t result = req->result;
 
-    if (!data->headers_done)
-        return size*nmemb;
+    AMPROBE4(s3__request__end, req->verb, req->request_body_size,
+	     hdl->last_response_code, result);
 
-    /* call write on internal buffer (if not full) */
-    if (data->int_write_done) {
-        bytes_saved = 0;
-    } else {
-        bytes_saved = s3_buffer_write_func(ptr, size, nmemb, &data->resp_buf);
-        if (!bytes_saved) {
-            data->int_write_done = TRUE;
-        }
+    if (result != S3_RESULT_OK && req->url) {
+        g_debug(_("%s %s failed with %d/%s"), req->verb, req->url,
+                hdl->last_response_code,
+                s3_error_name_from_code(hdl->last_s3_error_code));
     }
-    /* call write on user buffer */
-    if (data->write_func) {
-        return data->write_func(ptr, size, nmemb, data->write_data);
-    } else {
-        return bytes_saved;
+
+    g_free(req->url);
+    if (req->headers) curl_slist_free_all(req->headers);
+    g_free(req->md5_hash_b64);
+    g_free(req->md5_hash_hex);
+    g_free(req->data_SHA256Hash);
+    if (req->stream_sign) {
+	s3_stream_sign_free(req->stream_sign);
+	req->stream_sign = NULL;
     }
-}
 
-static void
-s3_internal_reset_func(void * stream)
-{
-    S3InternalData *data = (S3InternalData *) stream;
+    g_free(hdl->etag);
+    hdl->etag = req->int_writedata.etag;
+    hdl->last_response_body = req->int_writedata.resp_buf.buffer;
+    hdl->last_response_body_size = req->int_writedata.resp_buf.buffer_pos;
+    hdl->last_num_retries = req->retries;
 
-    s3_buffer_reset_func(&data->resp_buf);
-    data->headers_done = FALSE;
-    data->int_write_done = FALSE;
-    amfree(data->etag);
-    if (data->reset_func) {
-        data->reset_func(data->write_data);
-    }
+    if (req->owns_args)
+	request_free(req);
+
+    return result;
 }
 
-static size_t
-s3_internal_header_func(void *ptr, size_t size, size_t nmemb, void * stream)
-{
+static s3_result_t
+perform_request(S3Handle *hdl,
+                const char *verb,
+                const char *bucket,
+                const char *key,
+                const char *subresource,
+                const char **query,
+                const char *content_type,
+                const char *project_id,
+		struct curl_slist *user_headers,
+                s3_read_func read_func,
+                s3_reset_func read_reset_func,
+                s3_size_func size_func,
+                s3_md5_func md5_func,
+                gpointer read_data,
+                s3_write_func write_func,
+                s3_reset_func write_reset_func,
+                gpointer write_data,
+                s3_progress_func progress_func,
+                gpointer progress_data,
+                const result_handling_t *result_handling,
+		gboolean chunked)
+{
+    S3Request req;
+    s3_result_t result;
+    CURLcode curl_code;
+
+    g_assert(hdl != NULL && hdl->curl != NULL);
+
+    result = request_refresh_token(hdl);
+    if (result != S3_RESULT_OK)
+	return result;
+
+    memset(&req, 0, sizeof(req));
+    req.hdl = hdl;
+    req.verb = (char *)verb;
+    req.bucket = (char *)bucket;
+    req.key = (char *)key;
+    req.subresource = (char *)subresource;
+    req.query = (char **)query;
+    req.content_type = (char *)content_type;
+    req.project_id = (char *)project_id;
+    req.user_headers = user_headers;
+    req.read_func = read_func;
+    req.read_reset_func = read_reset_func;
+    req.size_func = size_func;
+    req.md5_func = md5_func;
+    req.read_data = read_data;
+    req.progress_func = progress_func;
+    req.progress_data = progress_data;
+    req.result_handling = result_handling;
+    req.chunked = chunked;
+
+    if (request_prepare(&req, write_func, write_reset_func, write_data)) {
+	while (1) {
+	    curl_code = request_setup_attempt(&req);
+
+	    /* Perform the request */
+	    if (curl_code == CURLE_OK)
+		curl_code = curl_easy_perform(hdl->curl);
+
+	    if (request_attempt_done(&req, curl_code))
+		break;
+
+	    g_usleep(req.retry_delay);
+	}
+    }
+
+    return request_finish(&req);
+}
+
+
+static size_t
+s3_internal_write_func(void *ptr, size_t size, size_t nmemb, void * stream)
+{
+    S3InternalData *data = (S3InternalData *) stream;
+    size_t bytes_saved;
+
+    if (!data->headers_done)
+        return size*nmemb;
+
+    s3_shaper_consume(data->hdl->shaper, S3_SHAPER_RECV, size*nmemb);
+
+    /* call write on internal buffer (if not full) */
+    if (data->int_write_done) {
+        bytes_saved = 0;
+    } else {
+        bytes_saved = s3_buffer_write_func(ptr, size, nmemb, &data->resp_buf);
+        if (!bytes_saved) {
+            data->int_write_done = TRUE;
+        }
+    }
+    /* call write on user buffer */
+    if (data->write_func) {
+        return data->write_func(ptr, size, nmemb, data->write_data);
+    } else {
+        return bytes_saved;
+    }
+}
+
+static void
+s3_internal_reset_func(void * stream)
+{
+    S3InternalData *data = (S3InternalData *) stream;
+
+    s3_buffer_reset_func(&data->resp_buf);
+    data->headers_done = FALSE;
+    data->int_write_done = FALSE;
+    amfree(data->etag);
+    if (data->reset_func) {
+        data->reset_func(data->write_data);
+    }
+}
+
+static size_t
+s3_internal_header_func(void *ptr, size_t size, size_t nmemb, void * stream)
+{
     static const char *final_header = "\r\n";
     time_t remote_time_in_sec,local_time;
     char *header;
@@ -2888,7 +3423,7 @@ compile_regexes(void)
   /* using POSIX regular expressions */
   struct {const char * str; int flags; regex_t *regex;} regexes[] = {
         {"<Code>[[:space:]]*([^<]*)[[:space:]]*</Code>", REG_EXTENDED | REG_ICASE, &error_name_regex},
-        {"^ETag:[[:space:]]*\"([^\"]+)\"[[:space:]]*$", REG_EXTENDED | REG_ICASE | REG_NEWLINE, &etag_regex},
+        {"^ETag:[[:space:]]*\"?([^\"[:space:]]+)\"?[[:space:]]*$", REG_EXTENDED | REG_ICASE | REG_NEWLINE, &etag_regex},
         {"^X-Auth-Token:[[:space:]]*([^ ]+)[[:space:]]*$", REG_EXTENDED | REG_ICASE | REG_NEWLINE, &x_auth_token_regex},
         {"^X-Subject-Token:[[:space:]]*([^ ]+)[[:space:]]*$", REG_EXTENDED | REG_ICASE | REG_NEWLINE, &x_subject_token_regex},
         {"^X-Storage-Url:[[:space:]]*([^ ]+)[[:space:]]*$", REG_EXTENDED | REG_ICASE | REG_NEWLINE, &x_storage_url_regex},
@@ -2928,7 +3463,7 @@ compile_regexes(void)
         {"<Code>\\s*([^<]*)\\s*</Code>",
          G_REGEX_OPTIMIZE | G_REGEX_CASELESS,
          &error_name_regex},
-        {"^ETag:\\s*\"([^\"]+)\"\\s*$",
+        {"^ETag:\\s*\"?([^\"\\s]+)\"?\\s*$",
          G_REGEX_OPTIMIZE | G_REGEX_CASELESS,
          &etag_regex},
         {"^X-Auth-Token:\\s*([^ ]+)\\s*$",
@@ -3026,6 +3561,62 @@ gboolean s3_init(void)
 # pragma GCC diagnostic pop
 #endif
 
+#if LIBCURL_VERSION_NUM >= 0x070a03
+/* The share handle of every S3Handle with share_connections set, so that the
+ * handles of a process reuse each other's DNS entries, TLS sessions and (with
+ * curl >= 7.57.0) connections.  It lives until the process exits. */
+static CURLSH *s3_share = NULL;
+static GMutex *s3_share_mutex[CURL_LOCK_DATA_LAST];
+
+static void
+s3_share_lock(
+    CURL *curl G_GNUC_UNUSED,
+    curl_lock_data data,
+    curl_lock_access access G_GNUC_UNUSED,
+    void *userptr G_GNUC_UNUSED)
+{
+    g_mutex_lock(s3_share_mutex[data]);
+}
+
+static void
+s3_share_unlock(
+    CURL *curl G_GNUC_UNUSED,
+    curl_lock_data data,
+    void *userptr G_GNUC_UNUSED)
+{
+    g_mutex_unlock(s3_share_mutex[data]);
+}
+
+static CURLSH *
+s3_get_share(void)
+{
+    static GStaticMutex mutex = G_STATIC_MUTEX_INIT;
+    int i;
+
+    g_static_mutex_lock(&mutex);
+    if (!s3_share) {
+	for (i = 0; i < CURL_LOCK_DATA_LAST; i++)
+	    s3_share_mutex[i] = g_mutex_new();
+	s3_share = curl_share_init();
+	if (s3_share) {
+	    curl_share_setopt(s3_share, CURLSHOPT_LOCKFUNC, s3_share_lock);
+	    curl_share_setopt(s3_share, CURLSHOPT_UNLOCKFUNC, s3_share_unlock);
+	    curl_share_setopt(s3_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+#if LIBCURL_VERSION_NUM >= 0x071700
+	    curl_share_setopt(s3_share, CURLSHOPT_SHARE,
+			      CURL_LOCK_DATA_SSL_SESSION);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x073900
+	    curl_share_setopt(s3_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+	}
+    }
+    g_static_mutex_unlock(&mutex);
+
+    return s3_share;
+}
+#endif
+
 gboolean
 s3_curl_location_compat(void)
 {
@@ -3352,6 +3943,46 @@ s3_new_curl(
 	}
 #endif
     }
+
+    s3_curl_connection_options(hdl);
+}
+
+/* Apply the connection settings of HDL to its curl handle */
+static void
+s3_curl_connection_options(
+    S3Handle *hdl)
+{
+    if (!hdl->curl)
+	return;
+
+#if LIBCURL_VERSION_NUM >= 0x070a03
+    curl_easy_setopt(hdl->curl, CURLOPT_SHARE,
+		     hdl->share_connections ? s3_get_share() : NULL);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x072f00
+    /* CAStor needs HTTP/1.1, set above */
+    if (hdl->s3_api != S3_API_CASTOR) {
+	curl_easy_setopt(hdl->curl, CURLOPT_HTTP_VERSION,
+			 hdl->http2 ? (long)CURL_HTTP_VERSION_2TLS
+				    : (long)CURL_HTTP_VERSION_NONE);
+	/* wait for a connection that can be multiplexed rather than open
+	 * another one */
+	curl_easy_setopt(hdl->curl, CURLOPT_PIPEWAIT, (long)(hdl->http2 ? 1 : 0));
+    }
+#endif
+#if LIBCURL_VERSION_NUM >= 0x071900
+    curl_easy_setopt(hdl->curl, CURLOPT_TCP_KEEPALIVE,
+		     (long)(hdl->keepalive ? 1 : 0));
+    if (hdl->keepalive) {
+	curl_easy_setopt(hdl->curl, CURLOPT_TCP_KEEPIDLE, (long)hdl->keepalive);
+	curl_easy_setopt(hdl->curl, CURLOPT_TCP_KEEPINTVL, (long)hdl->keepalive);
+    }
+#endif
+#if LIBCURL_VERSION_NUM >= 0x074100
+    if (hdl->connection_idle_timeout)
+	curl_easy_setopt(hdl->curl, CURLOPT_MAXAGE_CONN,
+			 (long)hdl->connection_idle_timeout);
+#endif
 }
 
 gboolean
@@ -3473,6 +4104,12 @@ s3_verbose(S3Handle *hdl, gboolean verbose)
     hdl->verbose = verbose;
 }
 
+void
+s3_set_cancelled(S3Handle *hdl, gboolean cancelled)
+{
+    hdl->cancelled = cancelled;
+}
+
 gboolean
 s3_set_max_send_speed(S3Handle *hdl, guint64 max_send_speed)
 {
@@ -3495,6 +4132,75 @@ s3_set_max_recv_speed(S3Handle *hdl, guint64 max_recv_speed)
     return TRUE;
 }
 
+gboolean
+s3_set_share_connections(S3Handle *hdl, gboolean share_connections)
+{
+#if LIBCURL_VERSION_NUM >= 0x070a03
+    if (share_connections && !s3_get_share())
+	return FALSE;
+    hdl->share_connections = share_connections;
+    s3_curl_connection_options(hdl);
+    return TRUE;
+#else
+    return !share_connections;
+#endif
+}
+
+gboolean
+s3_set_http2(S3Handle *hdl, gboolean http2)
+{
+#if LIBCURL_VERSION_NUM >= 0x072f00
+    curl_version_info_data *info;
+
+    /* check the runtime version and features too */
+    info = curl_version_info(CURLVERSION_NOW);
+    if (http2 && (info->version_num < 0x072f00 ||
+		  !(info->features & CURL_VERSION_HTTP2)))
+	return FALSE;
+    hdl->http2 = http2;
+    s3_curl_connection_options(hdl);
+    return TRUE;
+#else
+    return !http2;
+#endif
+}
+
+gboolean
+s3_set_keepalive(S3Handle *hdl, guint keepalive)
+{
+#if LIBCURL_VERSION_NUM >= 0x071900
+    hdl->keepalive = keepalive;
+    s3_curl_connection_options(hdl);
+    return TRUE;
+#else
+    return keepalive == 0;
+#endif
+}
+
+gboolean
+s3_set_connection_idle_timeout(S3Handle *hdl, guint idle_timeout)
+{
+#if LIBCURL_VERSION_NUM >= 0x074100
+    hdl->connection_idle_timeout = idle_timeout;
+    s3_curl_connection_options(hdl);
+    return TRUE;
+#else
+    return idle_timeout == 0;
+#endif
+}
+
+void
+s3_set_shaper(S3Handle *hdl, S3Shaper *shaper)
+{
+    hdl->shaper = shaper;
+}
+
+void
+s3_set_payload_signing(S3Handle *hdl, S3_payload_signing payload_signing)
+{
+    hdl->payload_signing = payload_signing;
+}
+
 gboolean
 s3_use_ssl(S3Handle *hdl, gboolean use_ssl)
 {
@@ -3632,6 +4338,21 @@ s3_part_upload(S3Handle *hdl,
 
     g_assert(hdl != NULL);
 
+    if (uploadId && S3_API_IS_SWIFT(hdl->s3_api)) {
+	char *segment = s3_swift_segment_key(key, uploadId, partNumber);
+	gboolean ok;
+
+	ok = s3_upload(hdl, bucket, segment, FALSE, read_func, reset_func,
+		       size_func, md5_func, read_data,
+		       progress_func, progress_data);
+	g_free(segment);
+	if (etag) {
+	    *etag = hdl->etag;
+	    hdl->etag = NULL;
+	}
+	return ok;
+    }
+
     if (uploadId) {
 	if (hdl->s3_api == S3_API_AWS4) {
 	    query = g_new0(char *, 3);
@@ -3666,76 +4387,310 @@ s3_part_upload(S3Handle *hdl,
 }
 
 
-char *
-s3_initiate_multi_part_upload(
+/* Set the copy source of the next request to KEY in BUCKET, in the form
+ * the API expects. */
+static gboolean
+s3_set_copy_source(
     S3Handle *hdl,
-    const char *bucket,
-    const char *key)
+    const char *src_bucket,
+    const char *src_key)
+{
+    char *esc_key;
+
+    if (hdl->s3_api != S3_API_S3 && hdl->s3_api != S3_API_AWS4 &&
+	hdl->s3_api != S3_API_OAUTH2) {
+	g_free(hdl->last_message);
+	hdl->last_message = g_strdup_printf(
+		"S3 Error: server-side copy is not supported by the %s API",
+		S3_name[hdl->s3_api]);
+	return FALSE;
+    }
+
+    esc_key = curl_escape(src_key, 0);
+    if (hdl->s3_api == S3_API_OAUTH2) {
+	hdl->copy_source = g_strdup_printf("%s/%s", src_bucket, esc_key);
+    } else {
+	hdl->copy_source = g_strdup_printf("/%s/%s", src_bucket, esc_key);
+    }
+    curl_free(esc_key);
+    return TRUE;
+}
+
+/* A copy returns its ETag in the body, not in a header; a 200 response may
+ * also carry an error in its body. */
+static char *
+s3_copy_result_etag(
+    S3Handle *hdl)
+{
+    char *body;
+    char *start, *end;
+    char *etag = NULL;
+
+    if (!hdl->last_response_body || hdl->last_response_body_size == 0)
+	return NULL;
+
+    body = g_strndup(hdl->last_response_body, hdl->last_response_body_size);
+    start = strstr(body, "<ETag>");
+    if (start) {
+	start += strlen("<ETag>");
+	end = strstr(start, "</ETag>");
+	if (end) {
+	    *end = '\0';
+	    if (g_str_has_prefix(start, "&quot;"))
+		start += strlen("&quot;");
+	    else if (*start == '"')
+		start++;
+	    if (g_str_has_suffix(start, "&quot;"))
+		start[strlen(start) - strlen("&quot;")] = '\0';
+	    else if (*start && start[strlen(start) - 1] == '"')
+		start[strlen(start) - 1] = '\0';
+	    etag = g_strdup(start);
+	}
+    }
+    g_free(body);
+    return etag;
+}
+
+/* Copy an object within the provider, without its data going through us
+ * (CopyObject).  The source must be no larger than S3_MAX_COPY_SIZE.
+ *
+ * @param hdl: the S3Handle object
+ * @param src_bucket: the bucket of the object to copy
+ * @param src_key: the key of the object to copy
+ * @param bucket: the bucket to copy to
+ * @param key: the key to copy to
+ * @returns: false if an error ocurred
+ */
+gboolean
+s3_copy(S3Handle *hdl,
+	const char *src_bucket,
+	const char *src_key,
+	const char *bucket,
+	const char *key)
 {
-    char *subresource;
     s3_result_t result = S3_RESULT_FAIL;
     static result_handling_t result_handling[] = {
+        { 200,  S3_ERROR_InternalError, 0, S3_RESULT_RETRY },
         { 200,  0, 0, S3_RESULT_OK },
         RESULT_HANDLING_ALWAYS_RETRY,
         { 0,    0, 0, /* default: */ S3_RESULT_FAIL }
         };
 
-    subresource = g_strdup_printf("uploads");
+    g_assert(hdl != NULL);
+
+    if (!s3_set_copy_source(hdl, src_bucket, src_key))
+	return FALSE;
+
     hdl->server_side_encryption_header = TRUE;
-    result = perform_request(hdl, "POST", bucket, key, subresource, NULL,
-		 NULL, NULL, NULL,
+    result = perform_request(hdl, "PUT", bucket, key, NULL,
+		 NULL, NULL, NULL, NULL,
                  NULL, NULL, NULL, NULL, NULL,
                  NULL, NULL, NULL, NULL, NULL,
                  result_handling, FALSE);
     hdl->server_side_encryption_header = FALSE;
+    amfree(hdl->copy_source);
 
-    g_free(subresource);
+    if (result == S3_RESULT_OK && hdl->last_s3_error_code != S3_ERROR_None)
+	result = S3_RESULT_FAIL;
 
-    if (result == S3_RESULT_OK) {
-	return hdl->uploadId;
-    } else {
-	return NULL;
-    }
+    return result == S3_RESULT_OK;
 }
 
+/* Copy the bytes RANGE_START to RANGE_END, inclusive, of an object as a part
+ * of a multi-part upload (UploadPartCopy).
+ *
+ * @param hdl: the S3Handle object
+ * @param src_bucket: the bucket of the object to copy
+ * @param src_key: the key of the object to copy
+ * @param bucket: the bucket of the multi-part upload
+ * @param key: the key of the multi-part upload
+ * @param uploadId: the multi-part upload
+ * @param partNumber: the number of the part
+ * @param range_start: the first byte copied
+ * @param range_end: the last byte copied
+ * @param etag: (output) the ETag of the part
+ * @returns: false if an error ocurred
+ */
 gboolean
-s3_complete_multi_part_upload(
-    S3Handle *hdl,
-    const char *bucket,
-    const char *key,
-    const char *uploadId,
-    s3_read_func read_func,
-    s3_reset_func reset_func,
-    s3_size_func size_func,
-    s3_md5_func md5_func,
-    gpointer read_data)
+s3_part_copy(S3Handle *hdl,
+	const char *src_bucket,
+	const char *src_key,
+	const char *bucket,
+	const char *key,
+	const char *uploadId,
+	int         partNumber,
+	guint64     range_start,
+	guint64     range_end,
+	char      **etag)
 {
     char *subresource = NULL;
     char **query = NULL;
     s3_result_t result = S3_RESULT_FAIL;
     static result_handling_t result_handling[] = {
+        { 200,  S3_ERROR_InternalError, 0, S3_RESULT_RETRY },
         { 200,  0, 0, S3_RESULT_OK },
         RESULT_HANDLING_ALWAYS_RETRY,
         { 0,    0, 0, /* default: */ S3_RESULT_FAIL }
         };
 
+    g_assert(hdl != NULL);
+
+    if (hdl->s3_api == S3_API_OAUTH2) {
+	g_free(hdl->last_message);
+	hdl->last_message = g_strdup(
+		"S3 Error: a part can't be copied with the OAUTH2 API");
+	return FALSE;
+    }
+    if (!s3_set_copy_source(hdl, src_bucket, src_key))
+	return FALSE;
+    hdl->copy_source_range = g_strdup_printf("bytes=%llu-%llu",
+				(unsigned long long)range_start,
+				(unsigned long long)range_end);
+
     if (hdl->s3_api == S3_API_AWS4) {
-	query = g_new0(char *, 2);
-	query[0] = g_strdup_printf("uploadId=%s", uploadId);
-	query[1] = NULL;
+	query = g_new0(char *, 3);
+	query[0] = g_strdup_printf("partNumber=%d", partNumber);
+	query[1] = g_strdup_printf("uploadId=%s", uploadId);
+	query[2] = NULL;
     } else {
-	subresource = g_strdup_printf("uploadId=%s", uploadId);
+	subresource = g_strdup_printf("partNumber=%d&uploadId=%s",
+			    partNumber, uploadId);
     }
-    result = perform_request(hdl, "POST", bucket, key, subresource,
-		 (const char **)query,
-		 "application/xml", NULL, NULL,
-                 read_func, reset_func, size_func, md5_func, read_data,
+
+    result = perform_request(hdl, "PUT", bucket, key, subresource,
+		 (const char **)query, NULL, NULL, NULL,
+                 NULL, NULL, NULL, NULL, NULL,
                  NULL, NULL, NULL, NULL, NULL,
                  result_handling, FALSE);
+    amfree(hdl->copy_source);
+    amfree(hdl->copy_source_range);
 
     g_free(subresource);
+    if (query) {
+	g_free(query[0]);
+	g_free(query[1]);
+	g_free(query);
+    }
 
-    return (result == S3_RESULT_OK);
+    if (result == S3_RESULT_OK && hdl->last_s3_error_code != S3_ERROR_None)
+	result = S3_RESULT_FAIL;
+    if (result == S3_RESULT_OK && etag) {
+	*etag = s3_copy_result_etag(hdl);
+	if (!*etag) {
+	    g_free(hdl->last_message);
+	    hdl->last_message = g_strdup(
+			"S3 Error: no ETag in the reply to a part copy");
+	    result = S3_RESULT_FAIL;
+	}
+    }
+
+    return result == S3_RESULT_OK;
+}
+
+
+char *
+s3_swift_segment_key(
+    const char *key,
+    const char *uploadId,
+    int         partNumber)
+{
+    return g_strdup_printf("%s/%s/%08d", key, uploadId, partNumber);
+}
+
+char *
+s3_initiate_multi_part_upload(
+    S3Handle *hdl,
+    const char *bucket,
+    const char *key)
+{
+    char *subresource;
+    s3_result_t result = S3_RESULT_FAIL;
+    static result_handling_t result_handling[] = {
+        { 200,  0, 0, S3_RESULT_OK },
+        RESULT_HANDLING_ALWAYS_RETRY,
+        { 0,    0, 0, /* default: */ S3_RESULT_FAIL }
+        };
+
+    if (S3_API_IS_SWIFT(hdl->s3_api)) {
+	/* nothing to ask the server, only name the segments */
+	g_free(hdl->uploadId);
+	hdl->uploadId = g_strdup_printf("%08lx%08x", (unsigned long)time(NULL),
+					g_random_int());
+	return hdl->uploadId;
+    }
+
+    subresource = g_strdup_printf("uploads");
+    hdl->server_side_encryption_header = TRUE;
+    result = perform_request(hdl, "POST", bucket, key, subresource, NULL,
+		 NULL, NULL, NULL,
+                 NULL, NULL, NULL, NULL, NULL,
+                 NULL, NULL, NULL, NULL, NULL,
+                 result_handling, FALSE);
+    hdl->server_side_encryption_header = FALSE;
+
+    g_free(subresource);
+
+    if (result == S3_RESULT_OK) {
+	return hdl->uploadId;
+    } else {
+	return NULL;
+    }
+}
+
+gboolean
+s3_complete_multi_part_upload(
+    S3Handle *hdl,
+    const char *bucket,
+    const char *key,
+    const char *uploadId,
+    s3_read_func read_func,
+    s3_reset_func reset_func,
+    s3_size_func size_func,
+    s3_md5_func md5_func,
+    gpointer read_data)
+{
+    char *subresource = NULL;
+    char **query = NULL;
+    s3_result_t result = S3_RESULT_FAIL;
+    static result_handling_t result_handling[] = {
+        { 200,  0, 0, S3_RESULT_OK },
+        RESULT_HANDLING_ALWAYS_RETRY,
+        { 0,    0, 0, /* default: */ S3_RESULT_FAIL }
+        };
+
+    if (S3_API_IS_SWIFT(hdl->s3_api)) {
+	static result_handling_t swift_result_handling[] = {
+	    { 201,  0, 0, S3_RESULT_OK },
+	    RESULT_HANDLING_ALWAYS_RETRY,
+	    { 0,    0, 0, /* default: */ S3_RESULT_FAIL }
+	    };
+
+	result = perform_request(hdl, "PUT", bucket, key,
+		     "multipart-manifest=put", NULL,
+		     "application/json", NULL, NULL,
+		     read_func, reset_func, size_func, md5_func, read_data,
+		     NULL, NULL, NULL, NULL, NULL,
+		     swift_result_handling, FALSE);
+	return (result == S3_RESULT_OK);
+    }
+
+    if (hdl->s3_api == S3_API_AWS4) {
+	query = g_new0(char *, 2);
+	query[0] = g_strdup_printf("uploadId=%s", uploadId);
+	query[1] = NULL;
+    } else {
+	subresource = g_strdup_printf("uploadId=%s", uploadId);
+    }
+    result = perform_request(hdl, "POST", bucket, key, subresource,
+		 (const char **)query,
+		 "application/xml", NULL, NULL,
+                 read_func, reset_func, size_func, md5_func, read_data,
+                 NULL, NULL, NULL, NULL, NULL,
+                 result_handling, FALSE);
+
+    g_free(subresource);
+
+    return (result == S3_RESULT_OK);
 }
 
 void
@@ -3766,6 +4721,25 @@ s3_abort_multi_part_upload(
         { 0,    0, 0, /* default: */ S3_RESULT_FAIL }
         };
 
+    if (S3_API_IS_SWIFT(hdl->s3_api)) {
+	/* delete the segments uploaded so far */
+	char *prefix = g_strdup_printf("%s/%s/", key, uploadId);
+	GSList *objects = NULL;
+	gboolean ok;
+
+	ok = s3_list_keys(hdl, bucket, NULL, prefix, NULL, &objects, NULL);
+	g_free(prefix);
+	while (objects) {
+	    s3_object *object = objects->data;
+
+	    objects = g_slist_remove(objects, object);
+	    if (!s3_delete(hdl, bucket, object->key))
+		ok = FALSE;
+	    free_s3_object(object);
+	}
+	return ok;
+    }
+
     if (hdl->s3_api == S3_API_AWS4) {
 	query = g_new0(char *, 2);
 	query[0] = g_strdup_printf("uploadId=%s", uploadId);
@@ -4106,6 +5080,8 @@ s3_init_restore(
     static result_handling_t result_handling[] = {
         { 200, 0, 0, S3_RESULT_OK },
         { 202, 0, 0, S3_RESULT_OK },
+        /* requested already, by us or by someone else */
+        { 409, S3_ERROR_RestoreAlreadyInProgress, 0, S3_RESULT_OK },
         RESULT_HANDLING_ALWAYS_RETRY,
         { 0,   0, 0, /* default: */ S3_RESULT_FAIL  }
         };
@@ -4287,6 +5263,693 @@ s3_delete(S3Handle *hdl,
     return result == S3_RESULT_OK;
 }
 
+/*
+ * Asynchronous requests
+ *
+ * An S3Multi drives any number of requests from a single thread with the
+ * curl "multi" interface.  Each request still runs on its own S3Handle, so the
+ * number of requests in flight is the number of handles the caller is using;
+ * retries are rescheduled instead of slept through, so a request that is
+ * backing off does not hold up the others.  Completion functions are called
+ * from the S3Multi thread.
+ */
+
+#if LIBCURL_VERSION_NUM >= 0x071c00	/* curl_multi_wait added in 7.28.0 */
+
+struct S3Multi {
+    CURLM *multi;
+    GThread *thread;
+
+    /* protects the fields below */
+    GMutex *mutex;
+    GQueue *pending;	/* submitted requests waiting to be started */
+    GSList *delayed;	/* requests waiting for their retry_at */
+    gboolean quit;
+
+    /* written by s3_multi_submit to wake the thread */
+    int wake_pipe[2];
+
+    /* only used by the thread */
+    guint in_flight;
+};
+
+/* current time in microseconds, on the monotonic clock so that the retry
+ * and shaping deadlines survive a stepped wall clock */
+static gint64
+s3_multi_now(void)
+{
+#if GLIB_CHECK_VERSION(2,28,0)
+    return g_get_monotonic_time();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (gint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+#endif
+}
+
+/*
+ * Bandwidth shaping
+ */
+
+/* a shaper is busy if it moved data that recently */
+#define S3_SHAPER_BUSY_USEC G_USEC_PER_SEC
+/* the most an idle shaper can save up, in time at its rate */
+#define S3_SHAPER_BURST_USEC (G_USEC_PER_SEC/10)
+
+typedef struct {
+    char *name;
+    guint64 max_speed[2];	/* indexed by s3_shaper_direction */
+    GSList *shapers;
+} S3ShaperPool;
+
+struct S3Shaper {
+    S3ShaperPool *pool;
+    guint weight;
+    gdouble tokens[2];		/* bytes that can go now; negative in debt */
+    gint64 last_refill[2];
+    gint64 last_busy[2];
+};
+
+/* protects all the pools and their shapers */
+static GStaticMutex s3_shaper_mutex = G_STATIC_MUTEX_INIT;
+static GSList *s3_shaper_pools = NULL;
+
+S3Shaper *
+s3_shaper_new(
+    const char *pool_name,
+    guint64 max_send_speed,
+    guint64 max_recv_speed,
+    guint weight)
+{
+    S3Shaper *shaper = g_new0(S3Shaper, 1);
+    S3ShaperPool *pool = NULL;
+    GSList *link;
+    gint64 now = s3_multi_now();
+
+    g_static_mutex_lock(&s3_shaper_mutex);
+    for (link = s3_shaper_pools; link; link = link->next) {
+	if (g_str_equal(((S3ShaperPool *)link->data)->name, pool_name)) {
+	    pool = link->data;
+	    break;
+	}
+    }
+    if (!pool) {
+	pool = g_new0(S3ShaperPool, 1);
+	pool->name = g_strdup(pool_name);
+	s3_shaper_pools = g_slist_prepend(s3_shaper_pools, pool);
+    }
+    if (max_send_speed)
+	pool->max_speed[S3_SHAPER_SEND] = max_send_speed;
+    if (max_recv_speed)
+	pool->max_speed[S3_SHAPER_RECV] = max_recv_speed;
+
+    shaper->pool = pool;
+    shaper->weight = MAX(weight, 1);
+    shaper->last_refill[S3_SHAPER_SEND] = now;
+    shaper->last_refill[S3_SHAPER_RECV] = now;
+    pool->shapers = g_slist_prepend(pool->shapers, shaper);
+    g_static_mutex_unlock(&s3_shaper_mutex);
+
+    return shaper;
+}
+
+void
+s3_shaper_free(
+    S3Shaper *shaper)
+{
+    S3ShaperPool *pool;
+
+    if (!shaper)
+	return;
+
+    g_static_mutex_lock(&s3_shaper_mutex);
+    pool = shaper->pool;
+    pool->shapers = g_slist_remove(pool->shapers, shaper);
+    if (!pool->shapers) {
+	s3_shaper_pools = g_slist_remove(s3_shaper_pools, pool);
+	g_free(pool->name);
+	g_free(pool);
+    }
+    g_static_mutex_unlock(&s3_shaper_mutex);
+    g_free(shaper);
+}
+
+static void
+s3_shaper_consume(
+    S3Shaper *shaper,
+    s3_shaper_direction dir,
+    size_t bytes)
+{
+    S3ShaperPool *pool;
+    GSList *link;
+    gint64 now;
+    guint busy_weight = 0;
+    gdouble rate;
+    gulong wait = 0;
+
+    if (!shaper || bytes == 0)
+	return;
+
+    g_static_mutex_lock(&s3_shaper_mutex);
+    pool = shaper->pool;
+    if (pool->max_speed[dir]) {
+	now = s3_multi_now();
+	shaper->last_busy[dir] = now;
+
+	/* split the pool between the busy shapers */
+	for (link = pool->shapers; link; link = link->next) {
+	    S3Shaper *other = link->data;
+	    if (now - other->last_busy[dir] < S3_SHAPER_BUSY_USEC)
+		busy_weight += other->weight;
+	}
+	rate = (gdouble)pool->max_speed[dir] * shaper->weight / busy_weight;
+
+	if (now > shaper->last_refill[dir]) {
+	    shaper->tokens[dir] += rate * (now - shaper->last_refill[dir]) /
+				   G_USEC_PER_SEC;
+	    shaper->tokens[dir] = MIN(shaper->tokens[dir],
+				      rate * S3_SHAPER_BURST_USEC /
+				      G_USEC_PER_SEC);
+	}
+	shaper->last_refill[dir] = now;
+
+	/* go into debt, and wait until it is paid back */
+	shaper->tokens[dir] -= bytes;
+	if (shaper->tokens[dir] < 0)
+	    wait = (gulong)(-shaper->tokens[dir] * G_USEC_PER_SEC / rate);
+    }
+    g_static_mutex_unlock(&s3_shaper_mutex);
+
+    if (wait)
+	g_usleep(wait);
+}
+
+static void
+s3_multi_wake(
+    S3Multi *mh)
+{
+    char c = 0;
+
+    if (write(mh->wake_pipe[1], &c, 1) < 0 && errno != EAGAIN) {
+	g_debug("s3_multi_wake: %s", strerror(errno));
+    }
+}
+
+/* Called from the thread, without mh->mutex, when REQ is finished */
+static void
+s3_multi_complete(
+    S3Multi *mh G_GNUC_UNUSED,
+    S3Request *req)
+{
+    S3Handle *hdl = req->hdl;
+    s3_done_func done_func = req->done_func;
+    gpointer done_data = req->done_data;
+    s3_result_t result;
+
+    result = request_finish(req);
+    done_func(hdl, result == S3_RESULT_OK, done_data);
+}
+
+/* Start the next attempt of REQ, or complete it if that attempt cannot be set
+ * up.  Called from the thread, without mh->mutex. */
+static void s3_multi_schedule(S3Multi *mh, S3Request *req);
+
+static void
+s3_multi_start(
+    S3Multi *mh,
+    S3Request *req)
+{
+    CURLcode curl_code;
+    CURLMcode curlm_code;
+
+    /* the handle belongs to this request until it completes */
+    req->hdl->server_side_encryption_header = req->server_side_encryption_header;
+    curl_code = request_setup_attempt(req);
+    req->hdl->server_side_encryption_header = FALSE;
+    if (curl_code == CURLE_OK) {
+	curlm_code = curl_multi_add_handle(mh->multi, req->hdl->curl);
+	if (curlm_code == CURLM_OK) {
+	    mh->in_flight++;
+	    return;
+	}
+	g_debug("curl_multi_add_handle failed: %s",
+		curl_multi_strerror(curlm_code));
+	curl_code = CURLE_FAILED_INIT;
+    }
+
+    if (request_attempt_done(req, curl_code))
+	s3_multi_complete(mh, req);
+    else
+	s3_multi_schedule(mh, req);
+}
+
+/* Handle the end of an attempt of REQ, finished with CURL_CODE */
+static void
+s3_multi_attempt_done(
+    S3Multi *mh,
+    S3Request *req,
+    CURLcode curl_code)
+{
+    S3Handle *hdl = req->hdl;
+
+    if (!request_attempt_done(req, curl_code)) {
+	s3_multi_schedule(mh, req);
+	return;
+    }
+
+    /* retry if a restore from glacier is ongoing, as s3_read does */
+    if (req->glacier_retry &&
+	req->result == S3_RESULT_FAIL &&
+	hdl->last_response_code == 403 &&
+	hdl->last_s3_error_code == S3_ERROR_InvalidObjectState) {
+	req->retries = 0;
+	req->retry_after_close = 0;
+	req->backoff = EXPONENTIAL_BACKOFF_START_USEC;
+	req->retry_delay = 300 * G_USEC_PER_SEC; /* 5 minutes */
+	s3_multi_schedule(mh, req);
+	return;
+    }
+
+    s3_multi_complete(mh, req);
+}
+
+static void
+s3_multi_schedule(
+    S3Multi *mh,
+    S3Request *req)
+{
+    req->retry_at = s3_multi_now() + req->retry_delay;
+    g_mutex_lock(mh->mutex);
+    mh->delayed = g_slist_prepend(mh->delayed, req);
+    g_mutex_unlock(mh->mutex);
+}
+
+static gpointer
+s3_multi_thread(
+    gpointer data)
+{
+    S3Multi *mh = (S3Multi *)data;
+    struct curl_waitfd wake;
+    char drain[64];
+
+    wake.fd = mh->wake_pipe[0];
+    wake.events = CURL_WAIT_POLLIN;
+
+    while (1) {
+	GSList *ready = NULL;
+	GSList *iter, *next;
+	gint64 now = s3_multi_now();
+	gint64 wait_usec = G_USEC_PER_SEC;
+	gboolean quit;
+	CURLMsg *msg;
+	int running;
+	int msgs_left;
+
+	/* collect the requests to start */
+	g_mutex_lock(mh->mutex);
+	while (!g_queue_is_empty(mh->pending))
+	    ready = g_slist_prepend(ready, g_queue_pop_head(mh->pending));
+	for (iter = mh->delayed; iter != NULL; iter = next) {
+	    S3Request *req = (S3Request *)iter->data;
+
+	    next = iter->next;
+	    if (req->retry_at <= now) {
+		mh->delayed = g_slist_delete_link(mh->delayed, iter);
+		ready = g_slist_prepend(ready, req);
+	    } else if (req->retry_at - now < wait_usec) {
+		wait_usec = req->retry_at - now;
+	    }
+	}
+	quit = mh->quit && !ready && !mh->delayed && mh->in_flight == 0;
+	g_mutex_unlock(mh->mutex);
+
+	if (quit)
+	    break;
+
+	for (iter = ready; iter != NULL; iter = iter->next)
+	    s3_multi_start(mh, (S3Request *)iter->data);
+	g_slist_free(ready);
+
+	curl_multi_perform(mh->multi, &running);
+
+	while ((msg = curl_multi_info_read(mh->multi, &msgs_left)) != NULL) {
+	    S3Request *req = NULL;
+	    CURL *curl = msg->easy_handle;
+
+	    if (msg->msg != CURLMSG_DONE)
+		continue;
+
+	    curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&req);
+	    curl_multi_remove_handle(mh->multi, curl);
+	    mh->in_flight--;
+	    s3_multi_attempt_done(mh, req, msg->data.result);
+	}
+
+	/* wait for activity, a new request, or the next retry */
+	if (curl_multi_wait(mh->multi, &wake, 1,
+			    (int)((wait_usec + 999) / 1000), NULL) == CURLM_OK &&
+	    (wake.revents & CURL_WAIT_POLLIN)) {
+	    while (read(mh->wake_pipe[0], drain, sizeof(drain)) > 0);
+	}
+	wake.revents = 0;
+    }
+
+    return NULL;
+}
+
+S3Multi *
+s3_multi_new(void)
+{
+    S3Multi *mh = g_new0(S3Multi, 1);
+
+    if (pipe(mh->wake_pipe) < 0) {
+	g_debug("s3_multi_new: pipe failed: %s", strerror(errno));
+	g_free(mh);
+	return NULL;
+    }
+    fcntl(mh->wake_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(mh->wake_pipe[1], F_SETFL, O_NONBLOCK);
+
+    mh->multi = curl_multi_init();
+    if (!mh->multi) {
+	close(mh->wake_pipe[0]);
+	close(mh->wake_pipe[1]);
+	g_free(mh);
+	return NULL;
+    }
+#if LIBCURL_VERSION_NUM >= 0x072b00
+    /* let HTTP/2 requests share a connection */
+    curl_multi_setopt(mh->multi, CURLMOPT_PIPELINING, (long)CURLPIPE_MULTIPLEX);
+#endif
+    mh->mutex = g_mutex_new();
+    mh->pending = g_queue_new();
+    mh->thread = g_thread_create(s3_multi_thread, mh, TRUE, NULL);
+
+    return mh;
+}
+
+void
+s3_multi_free(
+    S3Multi *mh)
+{
+    if (!mh)
+	return;
+
+    g_mutex_lock(mh->mutex);
+    mh->quit = TRUE;
+    g_mutex_unlock(mh->mutex);
+    s3_multi_wake(mh);
+    g_thread_join(mh->thread);
+
+    curl_multi_cleanup(mh->multi);
+    close(mh->wake_pipe[0]);
+    close(mh->wake_pipe[1]);
+    g_queue_free(mh->pending);
+    g_mutex_free(mh->mutex);
+    g_free(mh);
+}
+
+static gboolean
+s3_multi_submit(
+    S3Multi *mh,
+    S3Request *req,
+    s3_write_func write_func,
+    s3_reset_func write_reset_func,
+    gpointer write_data)
+{
+    S3Handle *hdl = req->hdl;
+
+    g_assert(hdl != NULL && hdl->curl != NULL);
+
+    /* the token refresh and request preparation are synchronous; if either
+     * fails, the done function is not called */
+    if (request_refresh_token(hdl) != S3_RESULT_OK) {
+	request_free(req);
+	return FALSE;
+    }
+    if (!request_prepare(req, write_func, write_reset_func, write_data)) {
+	request_finish(req);
+	return FALSE;
+    }
+
+    g_mutex_lock(mh->mutex);
+    g_queue_push_tail(mh->pending, req);
+    g_mutex_unlock(mh->mutex);
+    s3_multi_wake(mh);
+
+    return TRUE;
+}
+
+#else /* LIBCURL_VERSION_NUM < 0x071c00 */
+
+/* s3_multi_new always fails, so nothing can be submitted */
+static gboolean
+s3_multi_submit(
+    S3Multi *mh G_GNUC_UNUSED,
+    S3Request *req,
+    s3_write_func write_func G_GNUC_UNUSED,
+    s3_reset_func write_reset_func G_GNUC_UNUSED,
+    gpointer write_data G_GNUC_UNUSED)
+{
+    request_free(req);
+    return FALSE;
+}
+
+S3Multi *
+s3_multi_new(void)
+{
+    return NULL;
+}
+
+void
+s3_multi_free(
+    S3Multi *mh G_GNUC_UNUSED)
+{
+}
+
+#endif /* LIBCURL_VERSION_NUM >= 0x071c00 */
+
+/* Make a request that owns copies of its arguments */
+static S3Request *
+s3_multi_request_new(
+    S3Handle *hdl,
+    const char *verb,
+    const char *bucket,
+    const char *key,
+    const char *subresource,
+    const char **query,
+    struct curl_slist *user_headers,
+    s3_progress_func progress_func,
+    gpointer progress_data,
+    const result_handling_t *result_handling,
+    s3_done_func done_func,
+    gpointer done_data)
+{
+    S3Request *req = g_new0(S3Request, 1);
+    struct curl_slist *header;
+
+    req->hdl = hdl;
+    req->owns_args = TRUE;
+    req->verb = (char *)verb; /* always a literal */
+    req->bucket = g_strdup(bucket);
+    req->key = g_strdup(key);
+    req->subresource = g_strdup(subresource);
+    req->query = g_strdupv((char **)query);
+    for (header = user_headers; header != NULL; header = header->next) {
+	req->user_headers = curl_slist_append(req->user_headers, header->data);
+    }
+    req->progress_func = progress_func;
+    req->progress_data = progress_data;
+    req->result_handling = result_handling;
+    req->done_func = done_func;
+    req->done_data = done_data;
+
+    return req;
+}
+
+gboolean
+s3_upload_async(S3Multi *mh,
+          S3Handle *hdl,
+          const char *bucket,
+          const char *key,
+          s3_read_func read_func,
+          s3_reset_func reset_func,
+          s3_size_func size_func,
+          s3_md5_func md5_func,
+          gpointer read_data,
+          s3_progress_func progress_func,
+          gpointer progress_data,
+          s3_done_func done_func,
+          gpointer done_data)
+{
+    static result_handling_t result_handling[] = {
+        { 200,  0, 0, S3_RESULT_OK },
+        { 201,  0, 0, S3_RESULT_OK },
+        RESULT_HANDLING_ALWAYS_RETRY,
+        { 0,    0, 0, /* default: */ S3_RESULT_FAIL }
+        };
+    S3Request *req;
+
+    g_assert(hdl != NULL);
+
+    req = s3_multi_request_new(hdl,
+		hdl->s3_api == S3_API_CASTOR ? "POST" : "PUT",
+		bucket, key, NULL, NULL, NULL, progress_func, progress_data,
+		result_handling, done_func, done_data);
+    if (hdl->s3_api == S3_API_CASTOR)
+	req->content_type = g_strdup("application/x-amanda-backup-data");
+    req->read_func = read_func;
+    req->read_reset_func = reset_func;
+    req->size_func = size_func;
+    req->md5_func = md5_func;
+    req->read_data = read_data;
+    req->server_side_encryption_header = TRUE;
+
+    return s3_multi_submit(mh, req, NULL, NULL, NULL);
+}
+
+gboolean
+s3_part_upload_async(S3Multi *mh,
+          S3Handle *hdl,
+          const char *bucket,
+          const char *key,
+	  const char *uploadId,
+	  int         partNumber,
+          s3_read_func read_func,
+          s3_reset_func reset_func,
+          s3_size_func size_func,
+          s3_md5_func md5_func,
+          gpointer read_data,
+          s3_progress_func progress_func,
+          gpointer progress_data,
+          s3_done_func done_func,
+          gpointer done_data)
+{
+    static result_handling_t result_handling[] = {
+        { 200,  0, 0, S3_RESULT_OK },
+        RESULT_HANDLING_ALWAYS_RETRY,
+        { 0,    0, 0, /* default: */ S3_RESULT_FAIL }
+        };
+    S3Request *req;
+
+    g_assert(hdl != NULL);
+
+    if (S3_API_IS_SWIFT(hdl->s3_api)) {
+	char *segment = s3_swift_segment_key(key, uploadId, partNumber);
+	gboolean ok;
+
+	ok = s3_upload_async(mh, hdl, bucket, segment, read_func, reset_func,
+			     size_func, md5_func, read_data,
+			     progress_func, progress_data,
+			     done_func, done_data);
+	g_free(segment);
+	return ok;
+    }
+
+    req = s3_multi_request_new(hdl, "PUT", bucket, key, NULL, NULL, NULL,
+		progress_func, progress_data, result_handling,
+		done_func, done_data);
+    if (hdl->s3_api == S3_API_AWS4) {
+	req->query = g_new0(char *, 3);
+	req->query[0] = g_strdup_printf("partNumber=%d", partNumber);
+	req->query[1] = g_strdup_printf("uploadId=%s", uploadId);
+	req->query[2] = NULL;
+    } else {
+	req->subresource = g_strdup_printf("partNumber=%d&uploadId=%s",
+					   partNumber, uploadId);
+    }
+    req->read_func = read_func;
+    req->read_reset_func = reset_func;
+    req->size_func = size_func;
+    req->md5_func = md5_func;
+    req->read_data = read_data;
+
+    return s3_multi_submit(mh, req, NULL, NULL, NULL);
+}
+
+gboolean
+s3_read_range_async(S3Multi *mh,
+        S3Handle *hdl,
+        const char *bucket,
+        const char *key,
+	const guint64 range_begin,
+	const guint64 range_end,
+        s3_write_func write_func,
+        s3_reset_func reset_func,
+        gpointer write_data,
+        s3_progress_func progress_func,
+        gpointer progress_data,
+        s3_done_func done_func,
+        gpointer done_data)
+{
+    static result_handling_t result_handling[] = {
+        { 200, 0, 0, S3_RESULT_OK },
+        { 206, 0, 0, S3_RESULT_OK },
+        RESULT_HANDLING_ALWAYS_RETRY,
+        { 0,   0, 0, /* default: */ S3_RESULT_FAIL  }
+        };
+    struct curl_slist *headers = NULL;
+    S3Request *req;
+
+    g_assert(hdl != NULL);
+    g_assert(write_func != NULL);
+
+    if (range_end > 0) {
+	char *buf = g_strdup_printf("Range: bytes=%llu-%llu",
+				    (long long unsigned)range_begin,
+				    (long long unsigned)range_end);
+	headers = curl_slist_append(headers, buf);
+	g_free(buf);
+    }
+
+    req = s3_multi_request_new(hdl, "GET", bucket, key, NULL, NULL, headers,
+		progress_func, progress_data, result_handling,
+		done_func, done_data);
+    req->glacier_retry = hdl->read_from_glacier;
+    if (headers)
+	curl_slist_free_all(headers);
+
+    return s3_multi_submit(mh, req, write_func, reset_func, write_data);
+}
+
+gboolean
+s3_delete_async(S3Multi *mh,
+          S3Handle *hdl,
+          const char *bucket,
+          const char *key,
+          s3_done_func done_func,
+          gpointer done_data)
+{
+    static result_handling_t result_handling[] = {
+        { 200,  0,                     0, S3_RESULT_OK },
+        { 204,  0,                     0, S3_RESULT_OK },
+        { 404,  0,                     0, S3_RESULT_OK },
+        { 404,  S3_ERROR_NoSuchBucket, 0, S3_RESULT_OK },
+        RESULT_HANDLING_ALWAYS_RETRY,
+        { 409,  0,                     0, S3_RESULT_OK },
+        { 0,    0,                     0, /* default: */ S3_RESULT_FAIL  }
+        };
+    S3Request *req;
+
+    g_assert(hdl != NULL);
+
+    req = s3_multi_request_new(hdl, "DELETE", bucket, key, NULL, NULL, NULL,
+		NULL, NULL, result_handling, done_func, done_data);
+    req->content_type = g_strdup("application/xml");
+
+    return s3_multi_submit(mh, req, NULL, NULL, NULL);
+}
+
+char *
+s3_steal_etag(S3Handle *hdl)
+{
+    char *etag = hdl->etag;
+
+    hdl->etag = NULL;
+    return etag;
+}
+
 int
 s3_multi_delete(S3Handle *hdl,
 		const char *bucket,
@@ -4530,6 +6193,195 @@ cleanup:
 
 }
 
+/* The OAuth2 access tokens of the process, one for each client and refresh
+ * token, shared by all the handles using them.  A token is refreshed by a
+ * background thread OAUTH2_EARLY_REFRESH seconds before the handles would
+ * see it expire, so that a request only waits for a token when the process
+ * has none.  The tokens live until the process exits. */
+#define OAUTH2_TOKEN_URL "https://accounts.google.com/o/oauth2/token"
+#define OAUTH2_EARLY_REFRESH 300
+
+typedef struct oauth2_token_s {
+    char    *client_id;
+    char    *client_secret;
+    char    *refresh_token;
+    char    *ca_info;
+    char    *proxy;
+    char    *access_token;
+    time_t   expires;		/* the same as S3Handle's expires */
+    gboolean refreshing;
+} oauth2_token_t;
+
+static GHashTable *oauth2_tokens = NULL;
+static GStaticMutex oauth2_tokens_mutex = G_STATIC_MUTEX_INIT;
+
+/* Find the token of HDL's client; the caller holds oauth2_tokens_mutex */
+static oauth2_token_t *
+oauth2_token_lookup(
+    S3Handle *hdl,
+    gboolean  create)
+{
+    oauth2_token_t *tok;
+    char *key = g_strconcat(hdl->client_id ? hdl->client_id : "", " ",
+			    hdl->refresh_token ? hdl->refresh_token : "",
+			    NULL);
+
+    if (!oauth2_tokens)
+	oauth2_tokens = g_hash_table_new_full(g_str_hash, g_str_equal,
+					      g_free, NULL);
+    tok = g_hash_table_lookup(oauth2_tokens, key);
+    if (!tok && create) {
+	tok = g_new0(oauth2_token_t, 1);
+	tok->client_id = g_strdup(hdl->client_id);
+	tok->client_secret = g_strdup(hdl->client_secret);
+	tok->refresh_token = g_strdup(hdl->refresh_token);
+	tok->ca_info = g_strdup(hdl->ca_info);
+	tok->proxy = g_strdup(hdl->proxy);
+	g_hash_table_insert(oauth2_tokens, key, tok);
+	key = NULL;
+    }
+    g_free(key);
+    return tok;
+}
+
+/* Get the token and its expiration time from the BODY of a reply of the
+ * token endpoint */
+static gboolean
+oauth2_parse_token(
+    const char *body,
+    char      **access_token,
+    time_t     *expires)
+{
+    regmatch_t pmatch[2];
+
+    if (s3_regexec_wrap(&access_token_regex, body, 2, pmatch, 0))
+	return FALSE;
+    *access_token = find_regex_substring(body, pmatch[1]);
+    if (!s3_regexec_wrap(&expires_in_regex, body, 2, pmatch, 0)) {
+	char *expires_in = find_regex_substring(body, pmatch[1]);
+	*expires = time(NULL) + atoi(expires_in) - 600;
+	g_free(expires_in);
+    }
+    return TRUE;
+}
+
+/* Use ACCESS_TOKEN in HDL */
+static void
+oauth2_set_access_token(
+    S3Handle   *hdl,
+    const char *access_token,
+    time_t      expires)
+{
+    if (hdl->access_token != access_token) {
+	g_free(hdl->access_token);
+	hdl->access_token = g_strdup(access_token);
+    }
+    g_free(hdl->x_auth_token);
+    hdl->x_auth_token = g_strdup(access_token);
+    hdl->expires = expires;
+}
+
+static size_t
+oauth2_refresh_write_func(
+    void  *ptr,
+    size_t size,
+    size_t nmemb,
+    void  *stream)
+{
+    GString *body = stream;
+
+    /* a token reply is small, ignore a bogus large one */
+    if (body->len + size * nmemb > 65536)
+	return 0;
+    g_string_append_len(body, ptr, size * nmemb);
+    return size * nmemb;
+}
+
+/* Refresh the token DATA, on a curl handle of its own since the S3Handles
+ * are used by their own threads */
+static gpointer
+oauth2_refresh_thread(
+    gpointer data)
+{
+    oauth2_token_t *tok = data;
+    GString *body = g_string_new(NULL);
+    char *post;
+    char *access_token = NULL;
+    time_t expires = 0;
+    long code = 0;
+    CURL *curl;
+
+    post = g_strconcat("client_id=", tok->client_id,
+		       "&client_secret=", tok->client_secret,
+		       "&refresh_token=", tok->refresh_token,
+		       "&grant_type=refresh_token", NULL);
+    curl = curl_easy_init();
+    if (curl) {
+	curl_easy_setopt(curl, CURLOPT_URL, OAUTH2_TOKEN_URL);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post);
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT, 60L);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, oauth2_refresh_write_func);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, body);
+	if (tok->ca_info)
+	    curl_easy_setopt(curl, CURLOPT_CAINFO, tok->ca_info);
+	if (tok->proxy)
+	    curl_easy_setopt(curl, CURLOPT_PROXY, tok->proxy);
+	if (curl_easy_perform(curl) == CURLE_OK)
+	    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+	curl_easy_cleanup(curl);
+    }
+
+    if (code != 200 || !oauth2_parse_token(body->str, &access_token, &expires)) {
+	/* the handles get one themselves when this one expires */
+	g_debug("background refresh of the OAUTH2 access token failed (%ld)",
+		code);
+    }
+
+    g_static_mutex_lock(&oauth2_tokens_mutex);
+    if (access_token && expires > tok->expires) {
+	g_free(tok->access_token);
+	tok->access_token = access_token;
+	tok->expires = expires;
+	access_token = NULL;
+    }
+    tok->refreshing = FALSE;
+    g_static_mutex_unlock(&oauth2_tokens_mutex);
+
+    g_free(access_token);
+    g_free(post);
+    g_string_free(body, TRUE);
+    return NULL;
+}
+
+static gboolean
+oauth2_shared_access_token(
+    S3Handle *hdl)
+{
+    oauth2_token_t *tok;
+    time_t now = time(NULL);
+
+    /* most requests: the token of the handle is good for a while */
+    if (hdl->access_token && hdl->expires - OAUTH2_EARLY_REFRESH >= now)
+	return TRUE;
+
+    g_static_mutex_lock(&oauth2_tokens_mutex);
+    tok = oauth2_token_lookup(hdl, FALSE);
+    if (tok && tok->access_token) {
+	if (tok->expires > hdl->expires || !hdl->access_token)
+	    oauth2_set_access_token(hdl, tok->access_token, tok->expires);
+	if (tok->expires - OAUTH2_EARLY_REFRESH < now && !tok->refreshing &&
+	    tok->expires >= now) {
+	    tok->refreshing = TRUE;
+	    if (!g_thread_create(oauth2_refresh_thread, tok, FALSE, NULL))
+		tok->refreshing = FALSE;
+	}
+    }
+    g_static_mutex_unlock(&oauth2_tokens_mutex);
+
+    return hdl->access_token && hdl->expires >= now;
+}
+
 static s3_result_t
 oauth2_get_access_token(
     S3Handle *hdl)
@@ -4544,7 +6396,9 @@ oauth2_get_access_token(
         { 0, 0,                       0, /* default: */ S3_RESULT_FAIL  }
         };
     char *body;
-    regmatch_t pmatch[2];
+    char *access_token = NULL;
+    time_t expires = hdl->expires;
+    oauth2_token_t *tok;
 
     g_assert(hdl != NULL);
 
@@ -4565,7 +6419,7 @@ oauth2_get_access_token(
     data.mutex = NULL;
     data.cond = NULL;
 
-    hdl->x_storage_url = "https://accounts.google.com/o/oauth2/token";
+    hdl->x_storage_url = OAUTH2_TOKEN_URL;
     hdl->getting_oauth2_access_token = 1;
     result = perform_request(hdl, "POST", NULL, NULL, NULL, NULL,
 			     "application/x-www-form-urlencoded", NULL, NULL,
@@ -4586,14 +6440,19 @@ oauth2_get_access_token(
         goto cleanup;
     }
 
-    if (!s3_regexec_wrap(&access_token_regex, body, 2, pmatch, 0)) {
-        hdl->access_token = find_regex_substring(body, pmatch[1]);
-        hdl->x_auth_token = g_strdup(hdl->access_token);
-    }
-    if (!s3_regexec_wrap(&expires_in_regex, body, 2, pmatch, 0)) {
-        char *expires_in = find_regex_substring(body, pmatch[1]);
-	hdl->expires = time(NULL) + atoi(expires_in) - 600;
-	g_free(expires_in);
+    if (oauth2_parse_token(body, &access_token, &expires)) {
+	oauth2_set_access_token(hdl, access_token, expires);
+
+	/* and give it to the other handles of the process */
+	g_static_mutex_lock(&oauth2_tokens_mutex);
+	tok = oauth2_token_lookup(hdl, TRUE);
+	if (expires > tok->expires || !tok->access_token) {
+	    g_free(tok->access_token);
+	    tok->access_token = g_strdup(access_token);
+	    tok->expires = expires;
+	}
+	g_static_mutex_unlock(&oauth2_tokens_mutex);
+	g_free(access_token);
     }
 
 cleanup:
@@ -40,6 +40,17 @@ typedef enum {
    S3_API_AWS4
 } S3_api;
 
+#define S3_API_IS_SWIFT(api) ((api) == S3_API_SWIFT_1 || \
+			      (api) == S3_API_SWIFT_2 || \
+			      (api) == S3_API_SWIFT_3)
+
+/* How AWS4 uploads sign their payload */
+typedef enum {
+   S3_PAYLOAD_SIGNED,		/* hash the whole body before sending it */
+   S3_PAYLOAD_UNSIGNED,		/* UNSIGNED-PAYLOAD, over https only */
+   S3_PAYLOAD_STREAMING		/* sign each chunk while it is sent */
+} S3_payload_signing;
+
 extern char *S3_name[];
 extern char *S3_bucket_name[];
 
@@ -376,6 +387,18 @@ s3_error(S3Handle *hdl,
          CURLcode *curl_code,
          guint *num_retries);
 
+/* Cancel, or stop cancelling, the requests of a handle.  A request in progress
+ * on a cancelled handle is aborted at its next progress callback (curl calls it
+ * about once a second, even on a stalled connection), and fails without a
+ * retry.  This may be called from any thread.
+ *
+ * @param hdl: the S3Handle object
+ * @param cancelled: TRUE to cancel
+ */
+void
+s3_set_cancelled(S3Handle *hdl,
+                 gboolean cancelled);
+
 /* Control verbose output of HTTP transactions, etc.
  *
  * @param hdl: the S3Handle object
@@ -412,6 +435,94 @@ s3_set_max_send_speed(S3Handle *hdl, guint64 max_send_speed);
 gboolean
 s3_set_max_recv_speed(S3Handle *hdl, guint64 max_recv_speed);
 
+/* A share of a process-wide bandwidth pool.  Every handle given the same
+ * shaper, and every shaper of the same pool, draws from one token bucket per
+ * direction, so the limit holds for the sum of all their transfers.  When
+ * several shapers are busy, each gets a part of the pool proportional to its
+ * weight; an idle shaper's part goes to the others. */
+typedef struct S3Shaper S3Shaper;
+
+/* Join the pool named POOL, creating it if needed.  Non-zero speeds replace
+ * those of the pool; a speed of 0 in every shaper means no limit.
+ *
+ * @param pool: the name of the pool
+ * @param max_send_speed: the pool's upload limit (bytes/sec), or 0 to keep it
+ * @param max_recv_speed: the pool's download limit (bytes/sec), or 0 to keep it
+ * @param weight: the share of this shaper, at least 1
+ * @returns: the new shaper
+ */
+S3Shaper *
+s3_shaper_new(const char *pool, guint64 max_send_speed,
+	      guint64 max_recv_speed, guint weight);
+
+/* Leave the pool; no handle may use SHAPER anymore.
+ *
+ * @param shaper: the shaper to free
+ */
+void
+s3_shaper_free(S3Shaper *shaper);
+
+/* Throttle the transfers of HDL with SHAPER, in addition to the per-handle
+ * limits above.
+ *
+ * @param hdl: the S3Handle object
+ * @param shaper: the shaper, or NULL for none
+ */
+void
+s3_set_shaper(S3Handle *hdl, S3Shaper *shaper);
+
+/* Share DNS entries, TLS sessions and, with curl >= 7.57.0, connections with
+ * the other handles of the process that share them.
+ *
+ * @param hdl: the S3Handle object
+ * @param share_connections: whether to share
+ * @returns: false if sharing is not supported by libcurl
+ */
+gboolean
+s3_set_share_connections(S3Handle *hdl, gboolean share_connections);
+
+/* Negotiate HTTP/2 over TLS, multiplexing requests on one connection where
+ * possible.  Only supported with curl >= 7.47.0 built with HTTP/2.
+ *
+ * @param hdl: the S3Handle object
+ * @param http2: whether to use HTTP/2
+ * @returns: false if HTTP/2 is not supported by libcurl
+ */
+gboolean
+s3_set_http2(S3Handle *hdl, gboolean http2);
+
+/* Send TCP keepalive probes after KEEPALIVE idle seconds, and every KEEPALIVE
+ * seconds after that.  Only supported with curl >= 7.25.0.
+ *
+ * @param hdl: the S3Handle object
+ * @param keepalive: seconds, or 0 to disable keepalive
+ * @returns: false if keepalive is not supported by libcurl
+ */
+gboolean
+s3_set_keepalive(S3Handle *hdl, guint keepalive);
+
+/* Close cached connections that have been idle for more than IDLE_TIMEOUT
+ * seconds instead of reusing them.  Only supported with curl >= 7.65.0.
+ *
+ * @param hdl: the S3Handle object
+ * @param idle_timeout: seconds, or 0 for the libcurl default
+ * @returns: false if the timeout is not supported by libcurl
+ */
+gboolean
+s3_set_connection_idle_timeout(S3Handle *hdl, guint idle_timeout);
+
+/* Choose how AWS4 uploads of a known size sign their payload.  The default,
+ * S3_PAYLOAD_SIGNED, hashes the body before the request starts;
+ * S3_PAYLOAD_STREAMING sends it with aws-chunked encoding, signing each chunk
+ * as it is sent; S3_PAYLOAD_UNSIGNED does not sign it at all, and falls back
+ * to S3_PAYLOAD_SIGNED without https.  Other APIs ignore this.
+ *
+ * @param hdl: the S3Handle object
+ * @param payload_signing: the signing to use
+ */
+void
+s3_set_payload_signing(S3Handle *hdl, S3_payload_signing payload_signing);
+
 /* Get the error information from the last operation on this handle,
  * formatted as a string.
  *
@@ -490,6 +601,72 @@ s3_part_upload(S3Handle *hdl,
           s3_progress_func progress_func,
           gpointer progress_data);
 
+/* The largest object a single server-side copy may copy; a larger object is
+ * copied in parts with s3_part_copy. */
+#define S3_MAX_COPY_SIZE ((guint64)5*1024*1024*1024)
+
+/* Copy an object to another key, possibly in another bucket, without its
+ * data leaving the provider.  The handle's credentials must be allowed to
+ * read the source.  Only the S3, AWS4 and OAUTH2 APIs support it.
+ *
+ * @param hdl: the S3Handle object
+ * @param src_bucket: the bucket of the object to copy
+ * @param src_key: the key of the object to copy
+ * @param bucket: the bucket to copy to
+ * @param key: the key to copy to
+ *
+ * @returns: false if an error ocurred
+ */
+gboolean
+s3_copy(S3Handle *hdl,
+	const char *src_bucket,
+	const char *src_key,
+	const char *bucket,
+	const char *key);
+
+/* Copy a range of an object as a part of a multi-part upload.  Only the S3
+ * and AWS4 APIs support it.
+ *
+ * @param hdl: the S3Handle object
+ * @param src_bucket: the bucket of the object to copy
+ * @param src_key: the key of the object to copy
+ * @param bucket: the bucket of the upload
+ * @param key: the key of the upload
+ * @param uploadId: the UploadId
+ * @param partNumber: the part number
+ * @param range_start: the first byte of the range
+ * @param range_end: the last byte of the range
+ * @param etag: return the resulting etag.
+ *
+ * @returns: false if an error ocurred
+ */
+gboolean
+s3_part_copy(S3Handle *hdl,
+	const char *src_bucket,
+	const char *src_key,
+	const char *bucket,
+	const char *key,
+	const char *uploadId,
+	int         partNumber,
+	guint64     range_start,
+	guint64     range_end,
+	char      **etag);
+
+/* The key of the segment PARTNUMBER of the multi part upload UPLOADID of
+ * KEY, with a Swift API.  Swift has no multi part upload: the parts are
+ * uploaded as the segments of a Static Large Object, and completing the
+ * upload puts its manifest at KEY.  The segments are in the same bucket,
+ * under KEY, so that a listing or a deletion of the prefix of KEY finds
+ * them.
+ *
+ * @returns: a newly allocated string
+ */
+char *
+s3_swift_segment_key(
+    const char *key,
+    const char *uploadId,
+    int         partNumber);
+
 /* Initiate a multi part upload.
  *
  * @param hdl: the S3Handle object
@@ -504,7 +681,8 @@ s3_initiate_multi_part_upload(
     const char *bucket,
     const char *key);
 
-/* Complete a multi part upload.
+/* Complete a multi part upload.  The data is the CompleteMultipartUpload
+ * XML, or with a Swift API the JSON manifest of the segments.
  *
  * @param hdl: the S3Handle object
  * @param bucket: the bucket to which the upload should be made
@@ -588,7 +766,8 @@ s3_list_keys(S3Handle *hdl,
               GSList **list,
               guint64 *total_size);
 
-/* Init a restore from s3 for an object
+/* Init a restore from s3 for an object; a restore already in progress or
+ * done is not an error
  *
  * @param hdl: the S3Handle object
  * @param bucket: the bucket to list
@@ -674,6 +853,111 @@ s3_delete(S3Handle *hdl,
           const char *bucket,
           const char *key);
 
+/* Asynchronous requests
+ *
+ * An S3Multi runs requests from one thread with the curl "multi" interface,
+ * so that many requests can be in flight without a thread for each.  Every
+ * request in flight needs its own S3Handle, which must not be used for
+ * anything else until the request completes.  The done function is called
+ * from the S3Multi thread when the request completes, after the response has
+ * been recorded in the handle (see s3_error and s3_strerror).  If submitting a
+ * request fails, the submit function returns FALSE and the done function is
+ * not called.
+ *
+ * Read and reset functions are called from the S3Multi thread and must not
+ * block, so chunked uploads and downloads cannot be made asynchronously.
+ */
+typedef struct S3Multi S3Multi;
+
+/* Called when an asynchronous request completes
+ *
+ * @param hdl: the handle the request ran on
+ * @param success: FALSE if an error occurred
+ * @param data: the done_data given with the request
+ */
+typedef void (*s3_done_func)(S3Handle *hdl, gboolean success, gpointer data);
+
+/* Create an S3Multi and start its thread.
+ *
+ * @returns: the S3Multi, or NULL if asynchronous requests are not supported
+ */
+S3Multi *
+s3_multi_new(void);
+
+/* Wait for every request submitted to MH to complete, then free it.
+ *
+ * @param mh: the S3Multi, or NULL
+ */
+void
+s3_multi_free(S3Multi *mh);
+
+/* Asynchronous versions of s3_upload (not chunked), s3_part_upload,
+ * s3_read_range and s3_delete.  The ETag of a part upload can be taken with
+ * s3_steal_etag from the done function.  For s3_read_range_async, a range_end
+ * of 0 reads the whole object. */
+gboolean
+s3_upload_async(S3Multi *mh,
+          S3Handle *hdl,
+          const char *bucket,
+          const char *key,
+          s3_read_func read_func,
+          s3_reset_func reset_func,
+          s3_size_func size_func,
+          s3_md5_func md5_func,
+          gpointer read_data,
+          s3_progress_func progress_func,
+          gpointer progress_data,
+          s3_done_func done_func,
+          gpointer done_data);
+
+gboolean
+s3_part_upload_async(S3Multi *mh,
+          S3Handle *hdl,
+          const char *bucket,
+          const char *key,
+	  const char *uploadId,
+	  int         partNumber,
+          s3_read_func read_func,
+          s3_reset_func reset_func,
+          s3_size_func size_func,
+          s3_md5_func md5_func,
+          gpointer read_data,
+          s3_progress_func progress_func,
+          gpointer progress_data,
+          s3_done_func done_func,
+          gpointer done_data);
+
+gboolean
+s3_read_range_async(S3Multi *mh,
+        S3Handle *hdl,
+        const char *bucket,
+        const char *key,
+	const guint64 range_begin,
+	const guint64 range_end,
+        s3_write_func write_func,
+        s3_reset_func reset_func,
+        gpointer write_data,
+        s3_progress_func progress_func,
+        gpointer progress_data,
+        s3_done_func done_func,
+        gpointer done_data);
+
+gboolean
+s3_delete_async(S3Multi *mh,
+          S3Handle *hdl,
+          const char *bucket,
+          const char *key,
+          s3_done_func done_func,
+          gpointer done_data);
+
+/* Take the ETag of the last request made on HDL.
+ *
+ * @param hdl: the S3Handle object
+ * @returns: the ETag, which the caller must free, or NULL
+ */
+char *
+s3_steal_etag(S3Handle *hdl);
+
 /* Delete multiple file.
  *
  * @param hdl: the S3Handle object
@@ -35,6 +35,9 @@
 #ifdef HAVE_LIMITS_H
 # include <limits.h>
 #endif
+#ifdef HAVE_SCSI_SG_H
+# include <scsi/sg.h>
+#endif
 
 /* This is equal to 2*1024*1024*1024 - 16*1024*1024 - 1, but written
    explicitly to avoid overflow issues. */
@@ -78,12 +81,59 @@ typedef struct _TapeDevice {
     TapeDevicePrivate * private;
 } TapeDevice;
 
+/* Possible (abstracted) results from a system I/O operation. */
+typedef enum {
+    RESULT_SUCCESS,
+    RESULT_ERROR,        /* Undefined error (*errmsg set) */
+    RESULT_SMALL_BUFFER, /* Tried to read with a buffer that is too
+                            small. */
+    RESULT_NO_DATA,      /* End of File, while reading */
+    RESULT_NO_SPACE,     /* Out of space. Sometimes we don't know if
+                            it was this or I/O error, but this is the
+                            preferred explanation. */
+    RESULT_MAX
+} IoResult;
+
+/* The drive's counters, see tape_drive_stats_poll */
+typedef struct {
+    gboolean have_compression;	/* the data compression page was read */
+    gdouble compression_rate;	/* written to the medium / from the host */
+    guint64 bytes_from_host;
+    guint64 bytes_to_medium;
+    gboolean have_errors;	/* the write error counters page was read */
+    guint64 write_rewrites;
+    guint64 write_errors;
+} tape_drive_stats_t;
+
 struct TapeDevicePrivate_s {
     /* This holds the total number of bytes written to the device,
        modulus RESETOFS_THRESHOLD. */
     int write_count;
     char * device_filename;
     gsize read_block_size;
+
+    /* the writer thread and its queue of writer_nbufs blocks, of which
+     * writer_count from writer_head are waiting; see WRITE_BUFFER_SIZE */
+    guint64 write_buffer_size;
+    GThread *writer_thread;
+    GMutex *writer_mutex;
+    GCond *writer_cond;
+    char **writer_bufs;
+    guint writer_nbufs;
+    guint writer_head;
+    guint writer_count;
+    gboolean writer_streaming;	/* until the queue runs dry */
+    gboolean writer_flush;	/* write the queue even if it is not full */
+    gboolean writer_quit;
+    IoResult writer_result;	/* of the first write to fail */
+    char *writer_errmsg;
+
+    /* protected by the device_mutex */
+    tape_drive_stats_t drive_stats;
+    time_t drive_stats_time;
+    gboolean drive_stats_unsupported;
+
+    gboolean rao_unsupported;	/* see tape_device_recommended_order */
 };
 
 /*
@@ -121,25 +171,24 @@ gint tape_fileno(int fd);
 #define TAPE_OP_ERROR -1
 #define TAPE_POSITION_UNKNOWN -2
 
-/* Possible (abstracted) results from a system I/O operation. */
-typedef enum {
-    RESULT_SUCCESS,
-    RESULT_ERROR,        /* Undefined error (*errmsg set) */
-    RESULT_SMALL_BUFFER, /* Tried to read with a buffer that is too
-                            small. */
-    RESULT_NO_DATA,      /* End of File, while reading */
-    RESULT_NO_SPACE,     /* Out of space. Sometimes we don't know if
-                            it was this or I/O error, but this is the
-                            preferred explanation. */
-    RESULT_MAX
-} IoResult;
-
 /* returns a fileno like tape_fileno */
 gint tape_eod(int fd);
 
 gboolean tape_weof(int fd, guint8 count);
 gboolean tape_setcompression(int fd, gboolean on);
 
+/* Read log page PAGE (cumulative values) into BUF, setting *GOT to its
+ * length; FALSE, with errno set, if the drive or the system can't */
+gboolean tape_log_sense(int fd, guint8 page, guint8 *buf, gsize len,
+			gsize *got);
+
+/* Give the drive the LEN bytes of user data segments in BUF, with GENERATE
+ * RECOMMENDED ACCESS ORDER, then read them back in the order it recommends
+ * into BUF, setting *GOT to their length; FALSE, with errno set, if the drive
+ * or the system can't */
+gboolean tape_recommended_access_order(int fd, guint8 *buf, gsize len,
+				       gsize *got);
+
 gboolean tape_offl(int fd);
 
 DeviceStatusFlags tape_is_tape_device(int fd);
@@ -164,6 +213,7 @@ DeviceStatusFlags tape_is_ready(int fd, TapeDevice *t_self);
 #define PROPERTY_BSF_AFTER_EOM (device_property_bsf_after_eom.ID)
 #define PROPERTY_NONBLOCKING_OPEN (device_property_nonblocking_open.ID)
 #define PROPERTY_FINAL_FILEMARKS (device_property_final_filemarks.ID)
+#define PROPERTY_WRITE_BUFFER_SIZE (device_property_write_buffer_size.ID)
 
 static DevicePropertyBase device_property_broken_gmt_online;
 static DevicePropertyBase device_property_fsf;
@@ -176,6 +226,7 @@ static DevicePropertyBase device_property_bsf_after_eom;
 static DevicePropertyBase device_property_nonblocking_open;
 static DevicePropertyBase device_property_final_filemarks;
 static DevicePropertyBase device_property_read_buffer_size; /* old name for READ_BLOCK_SIZE */
+static DevicePropertyBase device_property_write_buffer_size;
 
 /* here are local prototypes */
 static void tape_device_init (TapeDevice * o);
@@ -191,6 +242,12 @@ static gboolean tape_device_get_read_block_size_fn(Device *p_self, DevicePropert
 				    GValue *val, PropertySurety *surety, PropertySource *source);
 static gboolean tape_device_set_read_block_size_fn(Device *p_self, DevicePropertyBase *base,
 				    GValue *val, PropertySurety surety, PropertySource source);
+static gboolean tape_device_set_write_buffer_size_fn(Device *p_self, DevicePropertyBase *base,
+				    GValue *val, PropertySurety surety, PropertySource source);
+static gboolean tape_device_recommended_order(Device *d_self,
+    DeviceFileExtent *extents, guint count);
+static gboolean tape_device_get_drive_stats_fn(Device *p_self, DevicePropertyBase *base,
+				    GValue *val, PropertySurety *surety, PropertySource *source);
 static void tape_device_open_device (Device * self, char * device_name, char * device_type, char * device_node);
 static Device * tape_device_factory (char * device_name, char * device_type, char * device_node);
 static DeviceStatusFlags tape_device_read_label(Device * self);
@@ -214,6 +271,12 @@ static gboolean tape_device_fsf (TapeDevice * self, guint count);
 static gboolean tape_device_fsr (TapeDevice * self, guint count);
 static gboolean tape_device_bsr (TapeDevice * self, guint count, guint file, guint block);
 static gboolean tape_device_eod (TapeDevice * self);
+static gboolean tape_writer_start(TapeDevice *self);
+static IoResult tape_writer_flush(TapeDevice *self, char **errmsg);
+static void tape_writer_stop(TapeDevice *self);
+static IoResult tape_writer_queue(TapeDevice *self, guint size, gpointer data,
+				  char **errmsg);
+static void tape_drive_stats_poll(TapeDevice *self, gboolean force);
 
 /* pointer to the class of our parent */
 static DeviceClass *parent_class = NULL;
@@ -319,6 +382,13 @@ tape_device_init (TapeDevice * self) {
     self->private->write_count = 0;
     self->private->device_filename = NULL;
 
+    self->private->write_buffer_size = 0;
+    g_value_init(&response, G_TYPE_UINT64);
+    g_value_set_uint64(&response, self->private->write_buffer_size);
+    device_set_simple_property(d_self, PROPERTY_WRITE_BUFFER_SIZE,
+	    &response, PROPERTY_SURETY_GOOD, PROPERTY_SOURCE_DEFAULT);
+    g_value_unset(&response);
+
     /* Static properites */
     g_value_init(&response, CONCURRENCY_PARADIGM_TYPE);
     g_value_set_enum(&response, CONCURRENCY_PARADIGM_EXCLUSIVE);
@@ -363,6 +433,7 @@ static void tape_device_finalize(GObject * obj_self) {
     if(G_OBJECT_CLASS(parent_class)->finalize) \
            (* G_OBJECT_CLASS(parent_class)->finalize)(obj_self);
 
+    tape_writer_stop(self);
     robust_close(self->fd);
     self->fd = -1;
     amfree(self->private->device_filename);
@@ -386,6 +457,7 @@ tape_device_class_init (TapeDeviceClass * c)
     device_class->finish_file = tape_device_finish_file;
     device_class->seek_file = tape_device_seek_file;
     device_class->seek_block = tape_device_seek_block;
+    device_class->recommended_order = tape_device_recommended_order;
     device_class->eject = tape_device_eject;
     device_class->finish = tape_device_finish;
     device_class->check_writable = tape_device_check_writable;
@@ -470,6 +542,37 @@ tape_device_base_init (TapeDeviceClass * c)
 	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
 	    device_simple_property_get_fn,
 	    tape_device_set_feature_property_fn);
+
+    device_class_register_property(device_class, PROPERTY_WRITE_BUFFER_SIZE,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    tape_device_set_write_buffer_size_fn);
+
+    /* the drive's statistics */
+    device_class_register_property(device_class, PROPERTY_COMPRESSION_RATE,
+	    PROPERTY_ACCESS_GET_MASK,
+	    tape_device_get_drive_stats_fn,
+	    NULL);
+
+    device_class_register_property(device_class, PROPERTY_DRIVE_BYTES_FROM_HOST,
+	    PROPERTY_ACCESS_GET_MASK,
+	    tape_device_get_drive_stats_fn,
+	    NULL);
+
+    device_class_register_property(device_class, PROPERTY_DRIVE_BYTES_TO_MEDIUM,
+	    PROPERTY_ACCESS_GET_MASK,
+	    tape_device_get_drive_stats_fn,
+	    NULL);
+
+    device_class_register_property(device_class, PROPERTY_DRIVE_WRITE_REWRITES,
+	    PROPERTY_ACCESS_GET_MASK,
+	    tape_device_get_drive_stats_fn,
+	    NULL);
+
+    device_class_register_property(device_class, PROPERTY_DRIVE_WRITE_ERRORS,
+	    PROPERTY_ACCESS_GET_MASK,
+	    tape_device_get_drive_stats_fn,
+	    NULL);
 }
 
 static gboolean
@@ -625,6 +728,17 @@ tape_device_set_read_block_size_fn(Device *p_self, DevicePropertyBase *base G_GN
 					val, surety, source);
 }
 
+static gboolean
+tape_device_set_write_buffer_size_fn(Device *p_self, DevicePropertyBase *base,
+    GValue *val, PropertySurety surety, PropertySource source)
+{
+    TapeDevice *self = TAPE_DEVICE(p_self);
+
+    self->private->write_buffer_size = g_value_get_uint64(val);
+
+    return device_simple_property_set_fn(p_self, base, val, surety, source);
+}
+
 void tape_device_register(void) {
     static const char * device_prefix_list[] = { "tape", NULL };
 
@@ -675,6 +789,10 @@ void tape_device_register(void) {
                                       G_TYPE_UINT, "read_buffer_size",
       "(deprecated name for READ_BLOCK_SIZE)");
 
+    device_property_fill_and_register(&device_property_write_buffer_size,
+                                      G_TYPE_UINT64, "write_buffer_size",
+      "Size of the queue a writer thread keeps the drive streaming from, 0 for none");
+
     /* Then the device itself */
     register_device(tape_device_factory, device_prefix_list);
 }
@@ -1009,6 +1127,476 @@ static DeviceStatusFlags tape_device_read_label(Device * dself) {
     return dself->status;
 }
 
+/*
+ * Writer thread
+ *
+ * With WRITE_BUFFER_SIZE set, write_block only copies the block into a queue,
+ * and a thread writes the queue to the drive.  Once the queue runs dry the
+ * thread waits for it to be full again before it restarts the drive, so that
+ * a slow producer makes the drive stop and start a few times, with long
+ * streaming runs, rather than crawl below its minimum speed.  An error is
+ * reported by the next write_block or by finish_file, and the blocks queued
+ * after it are dropped.
+ */
+
+static gpointer
+tape_writer_thread(
+    gpointer data)
+{
+    TapeDevice *self = TAPE_DEVICE(data);
+    Device *d_self = DEVICE(self);
+    TapeDevicePrivate *priv = self->private;
+
+    g_mutex_lock(priv->writer_mutex);
+    for (;;) {
+	char *buf;
+	char *msg = NULL;
+	IoResult result = RESULT_SUCCESS;
+
+	while (!(priv->writer_count > 0 &&
+		 (priv->writer_streaming || priv->writer_flush ||
+		  priv->writer_quit ||
+		  priv->writer_count == priv->writer_nbufs)) &&
+	       !(priv->writer_quit && priv->writer_count == 0)) {
+	    g_cond_wait(priv->writer_cond, priv->writer_mutex);
+	}
+	if (priv->writer_count == 0)
+	    break;
+
+	priv->writer_streaming = TRUE;
+	buf = priv->writer_bufs[priv->writer_head];
+	g_mutex_unlock(priv->writer_mutex);
+
+	/* drop the blocks queued after an error */
+	if (priv->writer_result == RESULT_SUCCESS)
+	    result = tape_device_robust_write(self, buf, d_self->block_size, &msg);
+
+	g_mutex_lock(priv->writer_mutex);
+	if (result != RESULT_SUCCESS && priv->writer_result == RESULT_SUCCESS) {
+	    priv->writer_result = result;
+	    priv->writer_errmsg = msg;
+	} else {
+	    amfree(msg);
+	}
+	priv->writer_head = (priv->writer_head + 1) % priv->writer_nbufs;
+	priv->writer_count--;
+	if (priv->writer_count == 0)
+	    priv->writer_streaming = FALSE;
+	g_cond_broadcast(priv->writer_cond);
+    }
+    g_mutex_unlock(priv->writer_mutex);
+
+    return NULL;
+}
+
+static gboolean
+tape_writer_start(
+    TapeDevice *self)
+{
+    Device *d_self = DEVICE(self);
+    TapeDevicePrivate *priv = self->private;
+    GError *error = NULL;
+    guint i;
+
+    priv->writer_nbufs = MAX(2, priv->write_buffer_size / d_self->block_size);
+    priv->writer_bufs = g_new0(char *, priv->writer_nbufs);
+    for (i = 0; i < priv->writer_nbufs; i++) {
+	priv->writer_bufs[i] = g_try_malloc(d_self->block_size);
+	if (!priv->writer_bufs[i])
+	    goto nomem;
+    }
+    priv->writer_head = 0;
+    priv->writer_count = 0;
+    priv->writer_streaming = FALSE;
+    priv->writer_flush = FALSE;
+    priv->writer_quit = FALSE;
+    priv->writer_result = RESULT_SUCCESS;
+    priv->writer_errmsg = NULL;
+    priv->writer_mutex = g_mutex_new();
+    priv->writer_cond = g_cond_new();
+
+    priv->writer_thread = g_thread_create(tape_writer_thread, (gpointer)self,
+					  TRUE, &error);
+    if (!priv->writer_thread) {
+	g_warning("Can't start the tape writer thread: %s; writing directly",
+		  error->message);
+	g_error_free(error);
+	g_mutex_free(priv->writer_mutex);
+	g_cond_free(priv->writer_cond);
+	goto free_bufs;
+    }
+    g_debug("tape writer thread started with %u blocks of %zu bytes",
+	    priv->writer_nbufs, d_self->block_size);
+    return TRUE;
+
+nomem:
+    g_warning("Can't allocate a %ju-byte tape write buffer; writing directly",
+	      (uintmax_t)priv->write_buffer_size);
+free_bufs:
+    for (i = 0; i < priv->writer_nbufs; i++)
+	g_free(priv->writer_bufs[i]);
+    amfree(priv->writer_bufs);
+    priv->writer_nbufs = 0;
+    /* don't try again for this volume */
+    priv->write_buffer_size = 0;
+    return FALSE;
+}
+
+/* Wait for the queue to be written; returns the first error, if any, and
+ * its message in *ERRMSG */
+static IoResult
+tape_writer_flush(
+    TapeDevice *self,
+    char **errmsg)
+{
+    TapeDevicePrivate *priv = self->private;
+    IoResult result;
+
+    if (!priv->writer_thread)
+	return RESULT_SUCCESS;
+
+    g_mutex_lock(priv->writer_mutex);
+    priv->writer_flush = TRUE;
+    g_cond_broadcast(priv->writer_cond);
+    while (priv->writer_count > 0)
+	g_cond_wait(priv->writer_cond, priv->writer_mutex);
+    priv->writer_flush = FALSE;
+    result = priv->writer_result;
+    *errmsg = priv->writer_errmsg;
+    priv->writer_result = RESULT_SUCCESS;
+    priv->writer_errmsg = NULL;
+    g_mutex_unlock(priv->writer_mutex);
+
+    return result;
+}
+
+/* Write out the queue and stop the thread; errors are up to the caller, who
+ * flushed already */
+static void
+tape_writer_stop(
+    TapeDevice *self)
+{
+    TapeDevicePrivate *priv = self->private;
+    guint i;
+
+    if (!priv->writer_thread)
+	return;
+
+    g_mutex_lock(priv->writer_mutex);
+    priv->writer_quit = TRUE;
+    g_cond_broadcast(priv->writer_cond);
+    g_mutex_unlock(priv->writer_mutex);
+    g_thread_join(priv->writer_thread);
+    priv->writer_thread = NULL;
+
+    amfree(priv->writer_errmsg);
+    g_mutex_free(priv->writer_mutex);
+    g_cond_free(priv->writer_cond);
+    for (i = 0; i < priv->writer_nbufs; i++)
+	g_free(priv->writer_bufs[i]);
+    amfree(priv->writer_bufs);
+    priv->writer_nbufs = 0;
+}
+
+/* Queue the block, zero-padded to block_size; returns an earlier error */
+static IoResult
+tape_writer_queue(
+    TapeDevice *self,
+    guint size,
+    gpointer data,
+    char **errmsg)
+{
+    Device *d_self = DEVICE(self);
+    TapeDevicePrivate *priv = self->private;
+    IoResult result;
+    char *buf;
+
+    g_mutex_lock(priv->writer_mutex);
+    while (priv->writer_count == priv->writer_nbufs &&
+	   priv->writer_result == RESULT_SUCCESS)
+	g_cond_wait(priv->writer_cond, priv->writer_mutex);
+    if (priv->writer_result != RESULT_SUCCESS) {
+	result = priv->writer_result;
+	*errmsg = priv->writer_errmsg;
+	priv->writer_errmsg = NULL;
+	g_mutex_unlock(priv->writer_mutex);
+	return result;
+    }
+    /* the thread does not touch the free buffers */
+    buf = priv->writer_bufs[(priv->writer_head + priv->writer_count) %
+			    priv->writer_nbufs];
+    g_mutex_unlock(priv->writer_mutex);
+
+    memcpy(buf, data, size);
+    if (size < d_self->block_size)
+	bzero(buf + size, d_self->block_size - size);
+
+    g_mutex_lock(priv->writer_mutex);
+    priv->writer_count++;
+    g_cond_broadcast(priv->writer_cond);
+    g_mutex_unlock(priv->writer_mutex);
+
+    return RESULT_SUCCESS;
+}
+
+/*
+ * Drive statistics
+ *
+ * The drive's own counters, from its LOG SENSE pages, are read every
+ * TAPE_DRIVE_STATS_INTERVAL seconds while writing and at the end of each
+ * file, and returned by the DRIVE_* and COMPRESSION_RATE properties.  A
+ * drive that cannot return a page is not asked again.
+ */
+
+#define TAPE_DRIVE_STATS_INTERVAL 60
+
+/* LOG SENSE pages and parameters (SSC-4) */
+#define LOG_PAGE_WRITE_ERRORS		0x02
+#define LOG_PARAM_TOTAL_REWRITES	0x0002
+#define LOG_PARAM_TOTAL_UNCORRECTED	0x0006
+#define LOG_PAGE_DATA_COMPRESSION	0x1b
+#define LOG_PARAM_WRITE_RATIO		0x0001	/* x100 */
+#define LOG_PARAM_MB_FROM_HOST		0x0006
+#define LOG_PARAM_BYTES_FROM_HOST	0x0007
+#define LOG_PARAM_MB_TO_MEDIUM		0x0008
+#define LOG_PARAM_BYTES_TO_MEDIUM	0x0009
+
+/* the value of parameter CODE in log page PAGE of LEN bytes */
+static gboolean
+log_page_param(
+    guint8 *page,
+    gsize len,
+    guint code,
+    guint64 *value)
+{
+    gsize pos, page_len;
+
+    if (len < 4)
+	return FALSE;
+    page_len = MIN(len, 4 + (gsize)((page[2] << 8) | page[3]));
+    for (pos = 4; pos + 4 <= page_len; pos += 4 + page[pos + 3]) {
+	guint param_code = (page[pos] << 8) | page[pos + 1];
+	guint param_len = page[pos + 3];
+	guint i;
+
+	if (pos + 4 + param_len > page_len)
+	    break;
+	if (param_code != code)
+	    continue;
+	if (param_len > 8)
+	    return FALSE;
+	*value = 0;
+	for (i = 0; i < param_len; i++)
+	    *value = (*value << 8) | page[pos + 4 + i];
+	return TRUE;
+    }
+    return FALSE;
+}
+
+static void
+tape_drive_stats_poll(
+    TapeDevice *self,
+    gboolean force)
+{
+    Device *d_self = DEVICE(self);
+    TapeDevicePrivate *priv = self->private;
+    guint8 page[512];
+    gsize len;
+    time_t now = time(NULL);
+    guint64 ratio, mb, bytes;
+    tape_drive_stats_t stats;
+
+    if (priv->drive_stats_unsupported || self->fd < 0)
+	return;
+    if (!force && now - priv->drive_stats_time < TAPE_DRIVE_STATS_INTERVAL)
+	return;
+    priv->drive_stats_time = now;
+
+    g_mutex_lock(d_self->device_mutex);
+    stats = priv->drive_stats;
+    g_mutex_unlock(d_self->device_mutex);
+
+    if (tape_log_sense(self->fd, LOG_PAGE_DATA_COMPRESSION, page,
+		       sizeof(page), &len)) {
+	if (log_page_param(page, len, LOG_PARAM_WRITE_RATIO, &ratio) &&
+	    ratio > 0)
+	    stats.compression_rate = 100.0 / ratio;
+	if (log_page_param(page, len, LOG_PARAM_MB_FROM_HOST, &mb) &&
+	    log_page_param(page, len, LOG_PARAM_BYTES_FROM_HOST, &bytes))
+	    stats.bytes_from_host = mb * 1000000 + bytes;
+	if (log_page_param(page, len, LOG_PARAM_MB_TO_MEDIUM, &mb) &&
+	    log_page_param(page, len, LOG_PARAM_BYTES_TO_MEDIUM, &bytes))
+	    stats.bytes_to_medium = mb * 1000000 + bytes;
+	stats.have_compression = TRUE;
+    }
+    if (tape_log_sense(self->fd, LOG_PAGE_WRITE_ERRORS, page,
+		       sizeof(page), &len)) {
+	log_page_param(page, len, LOG_PARAM_TOTAL_REWRITES,
+		       &stats.write_rewrites);
+	log_page_param(page, len, LOG_PARAM_TOTAL_UNCORRECTED,
+		       &stats.write_errors);
+	stats.have_errors = TRUE;
+    }
+
+    if (!stats.have_compression && !stats.have_errors) {
+	g_debug("%s: no LOG SENSE statistics: %s", d_self->device_name,
+		strerror(errno));
+	priv->drive_stats_unsupported = TRUE;
+	return;
+    }
+
+    g_mutex_lock(d_self->device_mutex);
+    priv->drive_stats = stats;
+    g_mutex_unlock(d_self->device_mutex);
+}
+
+static gboolean
+tape_device_get_drive_stats_fn(Device *p_self, DevicePropertyBase *base,
+    GValue *val, PropertySurety *surety, PropertySource *source)
+{
+    TapeDevice *self = TAPE_DEVICE(p_self);
+    tape_drive_stats_t stats;
+
+    g_mutex_lock(p_self->device_mutex);
+    stats = self->private->drive_stats;
+    g_mutex_unlock(p_self->device_mutex);
+
+    if (base->ID == PROPERTY_COMPRESSION_RATE) {
+	if (!stats.have_compression || stats.compression_rate == 0)
+	    return FALSE;
+	g_value_unset_init(val, G_TYPE_DOUBLE);
+	g_value_set_double(val, stats.compression_rate);
+    } else if (base->ID == PROPERTY_DRIVE_BYTES_FROM_HOST) {
+	if (!stats.have_compression)
+	    return FALSE;
+	g_value_unset_init(val, G_TYPE_UINT64);
+	g_value_set_uint64(val, stats.bytes_from_host);
+    } else if (base->ID == PROPERTY_DRIVE_BYTES_TO_MEDIUM) {
+	if (!stats.have_compression)
+	    return FALSE;
+	g_value_unset_init(val, G_TYPE_UINT64);
+	g_value_set_uint64(val, stats.bytes_to_medium);
+    } else if (base->ID == PROPERTY_DRIVE_WRITE_REWRITES) {
+	if (!stats.have_errors)
+	    return FALSE;
+	g_value_unset_init(val, G_TYPE_UINT64);
+	g_value_set_uint64(val, stats.write_rewrites);
+    } else if (base->ID == PROPERTY_DRIVE_WRITE_ERRORS) {
+	if (!stats.have_errors)
+	    return FALSE;
+	g_value_unset_init(val, G_TYPE_UINT64);
+	g_value_set_uint64(val, stats.write_errors);
+    } else {
+	return FALSE;
+    }
+
+    if (surety)
+	*surety = PROPERTY_SURETY_GOOD;
+    if (source)
+	*source = PROPERTY_SOURCE_DETECTED;
+    return TRUE;
+}
+
+/*
+ * Recommended access order
+ *
+ * A drive supporting RAO (SSC-5) is given the files to read as user data
+ * segments, named after their index, and gives them back in the order that
+ * locates them the fastest from where it is; on serpentine media, that is
+ * not the order of the file numbers.  A drive that can't is not asked again.
+ */
+
+#define TAPE_RAO_MAX_SEGMENTS	2048	/* asked at once */
+#define TAPE_RAO_HEADER_SIZE	8
+#define TAPE_RAO_UDS_SIZE	32	/* a basic user data segment descriptor */
+#define TAPE_RAO_UDS_NAME	3	/* its name, */
+#define TAPE_RAO_UDS_NAME_SIZE	10
+#define TAPE_RAO_UDS_PARTITION	13	/* partition */
+#define TAPE_RAO_UDS_FIRST	14	/* and first */
+#define TAPE_RAO_UDS_LAST	22	/* and last logical objects */
+
+static void
+put_be(
+    guint8 *p,
+    guint64 value,
+    guint size)
+{
+    while (size--) {
+	p[size] = value & 0xff;
+	value >>= 8;
+    }
+}
+
+static gboolean
+tape_device_recommended_order(
+    Device *d_self,
+    DeviceFileExtent *extents,
+    guint count)
+{
+    TapeDevice *self = TAPE_DEVICE(d_self);
+    TapeDevicePrivate *priv = self->private;
+    guint n = MIN(count, TAPE_RAO_MAX_SEGMENTS);
+    gsize len = TAPE_RAO_HEADER_SIZE + n * TAPE_RAO_UDS_SIZE;
+    guint8 *buf = g_malloc0(len);
+    DeviceFileExtent *ordered = g_new(DeviceFileExtent, n);
+    gboolean *placed = g_new0(gboolean, n);
+    gsize got = 0, pos;
+    guint i, nordered = 0;
+
+    if (priv->rao_unsupported || self->fd < 0)
+	goto done;
+
+    put_be(buf + 4, len - TAPE_RAO_HEADER_SIZE, 4);
+    for (i = 0; i < n; i++) {
+	guint8 *uds = buf + TAPE_RAO_HEADER_SIZE + i * TAPE_RAO_UDS_SIZE;
+
+	put_be(uds, TAPE_RAO_UDS_SIZE - 2, 2);
+	g_snprintf((char *)uds + TAPE_RAO_UDS_NAME, TAPE_RAO_UDS_NAME_SIZE,
+		   "%u", i);
+	uds[TAPE_RAO_UDS_PARTITION] = 0;
+	put_be(uds + TAPE_RAO_UDS_FIRST, extents[i].first_object, 8);
+	put_be(uds + TAPE_RAO_UDS_LAST, extents[i].last_object, 8);
+    }
+
+    if (!tape_recommended_access_order(self->fd, buf, len, &got)) {
+	g_debug("%s: no recommended access order: %s", d_self->device_name,
+		strerror(errno));
+	priv->rao_unsupported = TRUE;
+	goto done;
+    }
+
+    for (pos = TAPE_RAO_HEADER_SIZE; pos + TAPE_RAO_UDS_SIZE <= got;
+	 pos += 2 + ((buf[pos] << 8) | buf[pos + 1])) {
+	char name[TAPE_RAO_UDS_NAME_SIZE + 1];
+	guint64 idx;
+
+	memcpy(name, buf + pos + TAPE_RAO_UDS_NAME, TAPE_RAO_UDS_NAME_SIZE);
+	name[TAPE_RAO_UDS_NAME_SIZE] = '\0';
+	idx = g_ascii_strtoull(name, NULL, 10);
+	if (idx < n && !placed[idx]) {
+	    ordered[nordered++] = extents[idx];
+	    placed[idx] = TRUE;
+	}
+	if (((buf[pos] << 8) | buf[pos + 1]) == 0)
+	    break;
+    }
+
+    if (nordered > 0) {
+	/* the ones it did not return, if any, come after */
+	for (i = 0; i < n; i++) {
+	    if (!placed[i])
+		ordered[nordered++] = extents[i];
+	}
+	memcpy(extents, ordered, n * sizeof(*extents));
+    }
+
+done:
+    g_free(buf);
+    g_free(ordered);
+    g_free(placed);
+    return nordered > 0;
+}
+
 static DeviceWriteResult
 tape_device_write_block(Device * pself, guint size, gpointer data) {
     TapeDevice * self;
@@ -1021,25 +1609,34 @@ tape_device_write_block(Device * pself, guint size, gpointer data) {
     g_assert(self->fd >= 0);
     if (device_in_error(self)) return WRITE_FAILED;
 
-    /* zero out to the end of a short block -- tape devices only write
-     * whole blocks. */
-    if (size < pself->block_size) {
-        replacement_buffer = g_try_malloc(pself->block_size);
-	if (replacement_buffer == NULL) {
-	    device_set_error(pself,
-		g_strdup(_("failed to allocate memory")),
-		DEVICE_STATUS_DEVICE_ERROR);
-	    return WRITE_FAILED;
-	}
-        memcpy(replacement_buffer, data, size);
-        bzero(replacement_buffer+size, pself->block_size-size);
+    if (self->private->write_buffer_size > 0 && !self->private->writer_thread)
+	tape_writer_start(self);
 
-        data = replacement_buffer;
-        size = pself->block_size;
-    }
+    if (self->private->writer_thread) {
+	/* padded in the queue */
+	result = tape_writer_queue(self, size, data, &msg);
+	size = pself->block_size;
+    } else {
+        /* zero out to the end of a short block -- tape devices only write
+         * whole blocks. */
+        if (size < pself->block_size) {
+            replacement_buffer = g_try_malloc(pself->block_size);
+	    if (replacement_buffer == NULL) {
+		device_set_error(pself,
+		    g_strdup(_("failed to allocate memory")),
+		    DEVICE_STATUS_DEVICE_ERROR);
+		return WRITE_FAILED;
+	    }
+            memcpy(replacement_buffer, data, size);
+            bzero(replacement_buffer+size, pself->block_size-size);
+
+            data = replacement_buffer;
+            size = pself->block_size;
+        }
 
-    result = tape_device_robust_write(self, data, size, &msg);
-    amfree(replacement_buffer);
+        result = tape_device_robust_write(self, data, size, &msg);
+        amfree(replacement_buffer);
+    }
 
     switch (result) {
 	case RESULT_SUCCESS:
@@ -1372,6 +1969,7 @@ static gboolean tape_device_start_file(Device * d_self,
 static gboolean
 tape_device_finish_file (Device * d_self) {
     TapeDevice * self;
+    char *msg = NULL;
 
     self = TAPE_DEVICE(d_self);
 
@@ -1384,6 +1982,26 @@ tape_device_finish_file (Device * d_self) {
 
     if (device_in_error(d_self)) return FALSE;
 
+    switch (tape_writer_flush(self, &msg)) {
+	case RESULT_SUCCESS:
+	    break;
+
+	case RESULT_NO_SPACE:
+	    device_set_error(d_self,
+		g_strdup(_("No space left on device")),
+		DEVICE_STATUS_VOLUME_ERROR);
+	    d_self->is_eom = TRUE;
+	    return FALSE;
+
+	default:
+	    device_set_error(d_self,
+		g_strdup_printf(_("Error writing block: %s"),
+				msg ? msg : _("unknown error")),
+		DEVICE_STATUS_DEVICE_ERROR);
+	    amfree(msg);
+	    return FALSE;
+    }
+
     if (!tape_weof(self->fd, 1)) {
 	device_set_error(d_self,
 		g_strdup_printf(_("Error writing filemark: %s"), strerror(errno)),
@@ -1393,6 +2011,8 @@ tape_device_finish_file (Device * d_self) {
         return FALSE;
     }
 
+    tape_drive_stats_poll(self, TRUE);
+
     return TRUE;
 }
 
@@ -1682,6 +2302,7 @@ tape_device_finish (Device * d_self) {
     } else {
 	g_mutex_unlock(d_self->device_mutex);
     }
+    tape_writer_stop(self);
 
     /* Straighten out the filemarks.  We already wrote one in finish_file, and
      * the device driver will write another filemark when we rewind.  This means
@@ -1882,8 +2503,10 @@ tape_device_robust_write (TapeDevice * self, void * buf, int count, char **errms
         result = write(self->fd, buf, count);
 
 	/* Success. */
-        if (result == count)
+        if (result == count) {
+	    tape_drive_stats_poll(self, FALSE);
             return RESULT_SUCCESS;
+	}
 
 	if (result > 0) {
             /* write() returned a short count. This should not happen if the block sizes
@@ -2281,6 +2904,111 @@ gboolean tape_setcompression(int fd G_GNUC_UNUSED,
 #endif
 }
 
+gboolean tape_recommended_access_order(int fd G_GNUC_UNUSED,
+	guint8 *buf G_GNUC_UNUSED, gsize len G_GNUC_UNUSED,
+	gsize *got G_GNUC_UNUSED) {
+#if defined(HAVE_SCSI_SG_H) && defined(SG_IO)
+    sg_io_hdr_t io;
+    guint8 cdb[16];
+    guint8 sense[32];
+
+    /* GENERATE RECOMMENDED ACCESS ORDER, of basic descriptors */
+    bzero(cdb, sizeof(cdb));
+    cdb[0] = 0xa4;			/* MAINTENANCE OUT */
+    cdb[1] = 0x1d;
+    put_be(cdb + 10, len, 4);
+
+    bzero(&io, sizeof(io));
+    io.interface_id = 'S';
+    io.cmd_len = sizeof(cdb);
+    io.cmdp = cdb;
+    io.dxfer_direction = SG_DXFER_TO_DEV;
+    io.dxferp = buf;
+    io.dxfer_len = len;
+    io.sbp = sense;
+    io.mx_sb_len = sizeof(sense);
+    io.timeout = 600000;	/* ms; the drive may have a lot to sort */
+    if (ioctl(fd, SG_IO, &io) == -1)
+	return FALSE;
+    if ((io.info & SG_INFO_OK_MASK) != SG_INFO_OK) {
+	errno = EIO;
+	return FALSE;
+    }
+
+    /* RECEIVE RECOMMENDED ACCESS ORDER, from the first one */
+    bzero(cdb, sizeof(cdb));
+    cdb[0] = 0xa3;			/* MAINTENANCE IN */
+    cdb[1] = 0x1d;
+    put_be(cdb + 10, len, 4);
+
+    bzero(&io, sizeof(io));
+    io.interface_id = 'S';
+    io.cmd_len = sizeof(cdb);
+    io.cmdp = cdb;
+    io.dxfer_direction = SG_DXFER_FROM_DEV;
+    io.dxferp = buf;
+    io.dxfer_len = len;
+    io.sbp = sense;
+    io.mx_sb_len = sizeof(sense);
+    io.timeout = 60000;	/* ms */
+    if (ioctl(fd, SG_IO, &io) == -1)
+	return FALSE;
+    if ((io.info & SG_INFO_OK_MASK) != SG_INFO_OK) {
+	errno = EIO;
+	return FALSE;
+    }
+    *got = len - io.resid;
+    return TRUE;
+#else
+    errno = ENOSYS;
+    return FALSE;
+#endif
+}
+
+gboolean tape_log_sense(int fd G_GNUC_UNUSED, guint8 page G_GNUC_UNUSED,
+	guint8 *buf G_GNUC_UNUSED, gsize len G_GNUC_UNUSED,
+	gsize *got G_GNUC_UNUSED) {
+#if defined(HAVE_SCSI_SG_H) && defined(SG_IO)
+    /* the st driver passes SG_IO through to the drive */
+    sg_io_hdr_t io;
+    guint8 cdb[10];
+    guint8 sense[32];
+
+    len = MIN(len, 0xffff);
+    bzero(cdb, sizeof(cdb));
+    cdb[0] = 0x4d;			/* LOG SENSE */
+    cdb[2] = 0x40 | (page & 0x3f);	/* cumulative values */
+    cdb[7] = (len >> 8) & 0xff;
+    cdb[8] = len & 0xff;
+
+    bzero(&io, sizeof(io));
+    io.interface_id = 'S';
+    io.cmd_len = sizeof(cdb);
+    io.cmdp = cdb;
+    io.dxfer_direction = SG_DXFER_FROM_DEV;
+    io.dxferp = buf;
+    io.dxfer_len = len;
+    io.sbp = sense;
+    io.mx_sb_len = sizeof(sense);
+    io.timeout = 10000;	/* ms */
+    if (ioctl(fd, SG_IO, &io) == -1)
+	return FALSE;
+    if ((io.info & SG_INFO_OK_MASK) != SG_INFO_OK) {
+	errno = EIO;
+	return FALSE;
+    }
+    *got = len - io.resid;
+    if (*got < 4 || (buf[0] & 0x3f) != page) {
+	errno = EINVAL;
+	return FALSE;
+    }
+    return TRUE;
+#else
+    errno = ENOSYS;
+    return FALSE;
+#endif
+}
+
 gboolean tape_offl(int fd) {
     struct mtop mt;
     int safe_errno;
@@ -25,18 +25,33 @@
 #include "fsusage.h"
 #include "amutil.h"
 #include <regex.h>
+#include <fcntl.h>
 
 #include "vfs-device.h"
 
 /* This regex will match all VfsDevice files in a directory. We use it
    for cleanup and verification. Note that this regex does NOT match
    the volume label. */
-#define VFS_DEVICE_FILE_REGEX "^[0-9]+[\\.-]"
+#define VFS_DEVICE_FILE_REGEX "^([0-9]+[\\.-]|pack\\.[0-9]+$)"
+
+/* The containers holding the files smaller than PACK_THRESHOLD, named after
+ * the number of their first file, and the start of their directory. */
+#define VFS_DEVICE_PACK_REGEX "^pack\\.[0-9]+$"
+#define VFS_DEVICE_PACK_MAGIC "VFS-PACK 1"
+#define VFS_DEVICE_PACK_FOOTER_SIZE 32
+#define VFS_DEVICE_PACK_FOOTER_FORMAT "PACK-DIR %022llu\n"
+
+/* a container is closed, and another one started, past that size */
+#define VFS_DEVICE_PACK_MAX_SIZE (1024*1024*1024)
 
 /* The name of the volume lockfile. Should be the same as that
    generated by lockfile_name(0). */
 #define VOLUME_LOCKFILE_NAME "00000-lock"
 
+/* The slot manifest; its name does not match VFS_DEVICE_FILE_REGEX. */
+#define VFS_DEVICE_MANIFEST_NAME ".vfs-manifest"
+#define VFS_DEVICE_MANIFEST_MAGIC "VFS-MANIFEST 1"
+
 #define VFS_DEVICE_MIN_BLOCK_SIZE (1)
 #define VFS_DEVICE_MAX_BLOCK_SIZE (INT_MAX)
 #define VFS_DEVICE_DEFAULT_BLOCK_SIZE (DISK_BLOCK_BYTES)
@@ -84,8 +99,10 @@ static gboolean vfs_validate(Device *dself);
 
 static gboolean check_is_dir(VfsDevice * self, const char * name);
 static char * file_number_to_file_name(VfsDevice * self, guint file);
-static gboolean file_number_to_file_name_functor(const char * filename,
-                                                 gpointer datap);
+static gboolean manifest_load(VfsDevice *self);
+static void manifest_invalidate(VfsDevice *self);
+static void manifest_update(VfsDevice *self, guint file, const char *name,
+			    guint64 size);
 static gboolean vfs_device_set_max_volume_usage_fn(Device *dself,
 			    DevicePropertyBase *base, GValue *val,
 			    PropertySurety surety, PropertySource source);
@@ -113,6 +130,24 @@ static gboolean property_set_use_data_fn(Device *dself,
 static gboolean property_set_leom_fn(Device *dself,
 			    DevicePropertyBase *base, GValue *val,
 			    PropertySurety surety, PropertySource source);
+static gboolean property_set_preallocate_fn(Device *dself,
+			    DevicePropertyBase *base, GValue *val,
+			    PropertySurety surety, PropertySource source);
+static gboolean property_set_write_behind_fn(Device *dself,
+			    DevicePropertyBase *base, GValue *val,
+			    PropertySurety surety, PropertySource source);
+static gboolean property_set_drop_cache_fn(Device *dself,
+			    DevicePropertyBase *base, GValue *val,
+			    PropertySurety surety, PropertySource source);
+static gboolean property_set_io_depth_fn(Device *dself,
+			    DevicePropertyBase *base, GValue *val,
+			    PropertySurety surety, PropertySource source);
+static gboolean property_set_direct_io_fn(Device *dself,
+			    DevicePropertyBase *base, GValue *val,
+			    PropertySurety surety, PropertySource source);
+static gboolean property_set_pack_threshold_fn(Device *dself,
+			    DevicePropertyBase *base, GValue *val,
+			    PropertySurety surety, PropertySource source);
 //static char* lockfile_name(VfsDevice * self, guint file);
 static gboolean open_lock(VfsDevice * self, int file, gboolean exclusive);
 static void promote_volume_lock(VfsDevice * self);
@@ -124,11 +159,34 @@ static gboolean check_dir_empty_functor(const char * filename,
 static int search_vfs_directory(VfsDevice *self, const char * regex,
 			SearchDirectoryFunctor functor, gpointer user_data);
 static gint get_last_file_number(VfsDevice * self);
-static gboolean get_last_file_number_functor(const char * filename,
-                                             gpointer datap);
 static char * make_new_file_name(VfsDevice * self, const dumpfile_t * ji);
 static gboolean try_unlink(const char * file);
 
+/* Allocate the open file in PREALLOCATE extents up to END, without changing
+ * its size. */
+static void vfs_preallocate(VfsDevice *self, guint64 end);
+/* Start the writeback of the file up to END, and wait for what was started
+ * the previous time; see WRITE_BEHIND. */
+static void vfs_write_behind(VfsDevice *self, guint64 end);
+/* Write the open file through an aio_writer if IO_DEPTH is set */
+static void vfs_aio_start(VfsDevice *self);
+/* An asynchronous write failed with ERR: set the error, take back the data
+ * that is not on disk and go on synchronously */
+static IoResult vfs_aio_failed(VfsDevice *self, int err);
+/* Wait for the asynchronous writes and stop them */
+static gboolean vfs_aio_finish(VfsDevice *self);
+
+/* Keep the file started with JI in memory, to pack it if it stays small */
+static gboolean vfs_pack_start_file(VfsDevice *self, dumpfile_t *ji);
+/* The file kept in memory is too large to be packed: write it as a file */
+static gboolean vfs_pack_spill(VfsDevice *self);
+/* Append the file kept in memory to the container */
+static gboolean vfs_pack_append(VfsDevice *self);
+/* Write the directory of the container and close it */
+static gboolean vfs_pack_close(VfsDevice *self);
+/* Forget the container, when the volume is erased */
+static void vfs_pack_discard(VfsDevice *self);
+
 /* return TRUE if the device is going to hit ENOSPC "soon" - this is used to
  * detect LEOM as represented by actually running out of space on the
  * underlying filesystem.  Size is the size of the buffer that is about to
@@ -150,6 +208,24 @@ DevicePropertyBase device_property_slow_write;
 DevicePropertyBase device_property_use_data;
 #define PROPERTY_USE_DATA (device_property_use_data.ID)
 
+DevicePropertyBase device_property_preallocate;
+#define PROPERTY_PREALLOCATE (device_property_preallocate.ID)
+
+DevicePropertyBase device_property_write_behind;
+#define PROPERTY_WRITE_BEHIND (device_property_write_behind.ID)
+
+DevicePropertyBase device_property_drop_cache;
+#define PROPERTY_DROP_CACHE (device_property_drop_cache.ID)
+
+DevicePropertyBase device_property_io_depth;
+#define PROPERTY_IO_DEPTH (device_property_io_depth.ID)
+
+DevicePropertyBase device_property_direct_io;
+#define PROPERTY_DIRECT_IO (device_property_direct_io.ID)
+
+DevicePropertyBase device_property_pack_threshold;
+#define PROPERTY_PACK_THRESHOLD (device_property_pack_threshold.ID)
+
 void vfs_device_register(void) {
     static const char * device_prefix_list[] = { "file", NULL };
 
@@ -162,6 +238,24 @@ void vfs_device_register(void) {
     device_property_fill_and_register(&device_property_use_data,
                                       G_TYPE_STRING, "use_data",
       "Should VFS device use the data subdir?");
+    device_property_fill_and_register(&device_property_preallocate,
+                                      G_TYPE_UINT64, "preallocate",
+      "Size of the extents allocated ahead of the writes, 0 to not preallocate");
+    device_property_fill_and_register(&device_property_write_behind,
+                                      G_TYPE_UINT64, "write_behind",
+      "Bytes written between two writebacks of a file, 0 to leave it to the kernel");
+    device_property_fill_and_register(&device_property_drop_cache,
+                                      G_TYPE_BOOLEAN, "drop_cache",
+      "Should VFS device drop the data written back from the page cache?");
+    device_property_fill_and_register(&device_property_io_depth,
+                                      G_TYPE_UINT, "io_depth",
+      "Number of asynchronous writes in flight, 0 to write synchronously");
+    device_property_fill_and_register(&device_property_direct_io,
+                                      G_TYPE_BOOLEAN, "direct_io",
+      "Should VFS device write with O_DIRECT, bypassing the page cache?");
+    device_property_fill_and_register(&device_property_pack_threshold,
+                                      G_TYPE_UINT64, "pack_threshold",
+      "Files up to that size are packed in a container, 0 to not pack");
 
     register_device(vfs_device_factory, device_prefix_list);
 }
@@ -210,6 +304,27 @@ vfs_device_init (
     self->slow_write = FALSE;
     self->slow_count = 0;
     self->use_data = 2;
+    self->preallocate = 0;
+    self->write_behind = 0;
+    self->drop_cache = FALSE;
+    self->allocated_end = 0;
+    self->flushed_end = 0;
+    self->synced_end = 0;
+    self->io_depth = 0;
+    self->direct_io = FALSE;
+    self->aio = NULL;
+    self->manifest = NULL;
+    self->manifest_loaded = FALSE;
+    self->manifest_mtime = 0;
+    self->pack_threshold = 0;
+    self->pack_buffer = NULL;
+    self->pack_fd = -1;
+    self->pack_name = NULL;
+    self->pack_end = 0;
+    self->pack_members = NULL;
+    self->packed_offset = 0;
+    self->packed_size = 0;
+    self->packed_left = -1;
     self->checked_fs_free_bytes = G_MAXUINT64;
     self->checked_fs_free_time = 0;
     self->checked_fs_free_bytes = G_MAXUINT64;
@@ -275,6 +390,42 @@ vfs_device_init (
     device_set_simple_property(dself, PROPERTY_MEDIUM_ACCESS_TYPE,
 	    &response, PROPERTY_SURETY_GOOD, PROPERTY_SOURCE_DETECTED);
     g_value_unset(&response);
+
+    g_value_init(&response, G_TYPE_UINT64);
+    g_value_set_uint64(&response, self->preallocate);
+    device_set_simple_property(dself, PROPERTY_PREALLOCATE,
+	    &response, PROPERTY_SURETY_GOOD, PROPERTY_SOURCE_DEFAULT);
+    g_value_unset(&response);
+
+    g_value_init(&response, G_TYPE_UINT64);
+    g_value_set_uint64(&response, self->write_behind);
+    device_set_simple_property(dself, PROPERTY_WRITE_BEHIND,
+	    &response, PROPERTY_SURETY_GOOD, PROPERTY_SOURCE_DEFAULT);
+    g_value_unset(&response);
+
+    g_value_init(&response, G_TYPE_BOOLEAN);
+    g_value_set_boolean(&response, self->drop_cache);
+    device_set_simple_property(dself, PROPERTY_DROP_CACHE,
+	    &response, PROPERTY_SURETY_GOOD, PROPERTY_SOURCE_DEFAULT);
+    g_value_unset(&response);
+
+    g_value_init(&response, G_TYPE_UINT);
+    g_value_set_uint(&response, self->io_depth);
+    device_set_simple_property(dself, PROPERTY_IO_DEPTH,
+	    &response, PROPERTY_SURETY_GOOD, PROPERTY_SOURCE_DEFAULT);
+    g_value_unset(&response);
+
+    g_value_init(&response, G_TYPE_BOOLEAN);
+    g_value_set_boolean(&response, self->direct_io);
+    device_set_simple_property(dself, PROPERTY_DIRECT_IO,
+	    &response, PROPERTY_SURETY_GOOD, PROPERTY_SOURCE_DEFAULT);
+    g_value_unset(&response);
+
+    g_value_init(&response, G_TYPE_UINT64);
+    g_value_set_uint64(&response, self->pack_threshold);
+    device_set_simple_property(dself, PROPERTY_PACK_THRESHOLD,
+	    &response, PROPERTY_SURETY_GOOD, PROPERTY_SOURCE_DEFAULT);
+    g_value_unset(&response);
 }
 
 static void
@@ -345,6 +496,37 @@ vfs_device_base_init(
 	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
 	    device_simple_property_get_fn,
 	    property_set_leom_fn);
+
+    device_class_register_property(device_class, PROPERTY_PREALLOCATE,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_MASK,
+	    device_simple_property_get_fn,
+	    property_set_preallocate_fn);
+
+    device_class_register_property(device_class, PROPERTY_WRITE_BEHIND,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_MASK,
+	    device_simple_property_get_fn,
+	    property_set_write_behind_fn);
+
+    device_class_register_property(device_class, PROPERTY_DROP_CACHE,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_MASK,
+	    device_simple_property_get_fn,
+	    property_set_drop_cache_fn);
+
+    device_class_register_property(device_class, PROPERTY_IO_DEPTH,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_MASK,
+	    device_simple_property_get_fn,
+	    property_set_io_depth_fn);
+
+    device_class_register_property(device_class, PROPERTY_DIRECT_IO,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_MASK,
+	    device_simple_property_get_fn,
+	    property_set_direct_io_fn);
+
+    device_class_register_property(device_class, PROPERTY_PACK_THRESHOLD,
+	    (PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_MASK) &
+			(~ PROPERTY_ACCESS_SET_INSIDE_FILE_WRITE),
+	    device_simple_property_get_fn,
+	    property_set_pack_threshold_fn);
 }
 
 static gboolean
@@ -521,6 +703,96 @@ property_set_leom_fn(
     return device_simple_property_set_fn(dself, base, val, surety, source);
 }
 
+static gboolean
+property_set_preallocate_fn(
+    Device *dself,
+    DevicePropertyBase *base,
+    GValue *val,
+    PropertySurety surety,
+    PropertySource source)
+{
+    VfsDevice *self = VFS_DEVICE(dself);
+
+    self->preallocate = g_value_get_uint64(val);
+
+    return device_simple_property_set_fn(dself, base, val, surety, source);
+}
+
+static gboolean
+property_set_write_behind_fn(
+    Device *dself,
+    DevicePropertyBase *base,
+    GValue *val,
+    PropertySurety surety,
+    PropertySource source)
+{
+    VfsDevice *self = VFS_DEVICE(dself);
+
+    self->write_behind = g_value_get_uint64(val);
+
+    return device_simple_property_set_fn(dself, base, val, surety, source);
+}
+
+static gboolean
+property_set_drop_cache_fn(
+    Device *dself,
+    DevicePropertyBase *base,
+    GValue *val,
+    PropertySurety surety,
+    PropertySource source)
+{
+    VfsDevice *self = VFS_DEVICE(dself);
+
+    self->drop_cache = g_value_get_boolean(val);
+
+    return device_simple_property_set_fn(dself, base, val, surety, source);
+}
+
+static gboolean
+property_set_io_depth_fn(
+    Device *dself,
+    DevicePropertyBase *base,
+    GValue *val,
+    PropertySurety surety,
+    PropertySource source)
+{
+    VfsDevice *self = VFS_DEVICE(dself);
+
+    self->io_depth = g_value_get_uint(val);
+
+    return device_simple_property_set_fn(dself, base, val, surety, source);
+}
+
+static gboolean
+property_set_direct_io_fn(
+    Device *dself,
+    DevicePropertyBase *base,
+    GValue *val,
+    PropertySurety surety,
+    PropertySource source)
+{
+    VfsDevice *self = VFS_DEVICE(dself);
+
+    self->direct_io = g_value_get_boolean(val);
+
+    return device_simple_property_set_fn(dself, base, val, surety, source);
+}
+
+static gboolean
+property_set_pack_threshold_fn(
+    Device *dself,
+    DevicePropertyBase *base,
+    GValue *val,
+    PropertySurety surety,
+    PropertySource source)
+{
+    VfsDevice *self = VFS_DEVICE(dself);
+
+    self->pack_threshold = g_value_get_uint64(val);
+
+    return device_simple_property_set_fn(dself, base, val, surety, source);
+}
+
 /* Drops everything associated with the volume file: Its name and fd. */
 void
 vfs_release_file(
@@ -530,9 +802,25 @@ vfs_release_file(
 
     /* Doesn't hurt. */
     if (self->open_file_fd != -1) {
+	vfs_aio_finish(self);
+	/* give back what was preallocated past the end */
+	if (self->allocated_end > 0) {
+	    struct stat st;
+
+	    if (fstat(self->open_file_fd, &st) == 0 &&
+		(guint64)st.st_size < self->allocated_end &&
+		ftruncate(self->open_file_fd, st.st_size) == -1)
+		g_debug("ftruncate failed: %s", strerror(errno));
+	    self->allocated_end = 0;
+	}
 	robust_close(self->open_file_fd);
 	self->open_file_fd = -1;
     }
+    if (self->pack_buffer) {
+	g_byte_array_free(self->pack_buffer, TRUE);
+	self->pack_buffer = NULL;
+    }
+    self->packed_left = -1;
     amfree(self->file_name);
 
 }
@@ -551,6 +839,8 @@ static void vfs_device_finalize(
         (* G_OBJECT_CLASS(parent_class)->finalize)(obj_self);
 
     amfree(self->dir_name);
+    manifest_invalidate(self);
+    vfs_pack_discard(self);
 
     self->release_file(dself);
 }
@@ -594,142 +884,622 @@ static gboolean check_is_dir(
     }
 }
 
+/*
+ * Slot manifest
+ *
+ * The manifest lists the files of the directory by file number, with their
+ * names and sizes, so that finding a file does not cost a readdir and a regex
+ * match per entry.  It records the modification time of the directory it was
+ * built from, and is only trusted while the directory has that time; any
+ * file created, renamed or removed by another program makes it stale, and it
+ * is then rebuilt from a scan.
+ *
+ * It is rewritten in place rather than renamed over, since a rename would
+ * change the time of the directory.  A reader that sees it half-written does
+ * not find its END line, and scans the directory instead.
+ *
+ * The files packed in a container (see PACK_THRESHOLD) have an entry giving
+ * the container and their offset in it; a scan finds them in the directory
+ * written at the end of each container.
+ */
+
 typedef struct {
-    VfsDevice * self;
-    int count;
-    char * result;
-} fnfn_data;
+    guint file;
+    guint64 size;	/* 0 if not known, e.g. while the file is written */
+    char *name;		/* in dir_name */
+    char *container;	/* in dir_name, if the file is packed */
+    guint64 offset;	/* of the file in its container */
+} vfs_manifest_entry_t;
 
-/* A SearchDirectoryFunctor. */
-static gboolean
-file_number_to_file_name_functor(const char *filename,
-                                 gpointer datap) {
-    char *result_tmp;
-    struct stat file_status;
-    fnfn_data *data = (fnfn_data*)datap;
+static void
+manifest_entry_free(
+    gpointer data)
+{
+    vfs_manifest_entry_t *entry = data;
 
-    result_tmp = g_strjoin(NULL, data->self->dir_name, "/", filename, NULL);
+    g_free(entry->name);
+    g_free(entry->container);
+    g_free(entry);
+}
 
-    /* Just to be thorough, let's check that it's a real
-       file. */
-    if (0 != stat(result_tmp, &file_status)) {
-	g_warning(_("Cannot stat file %s (%s), ignoring it"), result_tmp, strerror(errno));
-    } else if (!S_ISREG(file_status.st_mode)) {
-	g_warning(_("%s is not a regular file, ignoring it"), result_tmp);
-    } else {
-        data->count ++;
-        if (data->result == NULL) {
-            data->result = result_tmp;
-            result_tmp = NULL;
-        }
-    }
-    amfree(result_tmp);
-    return TRUE;
+static gint
+manifest_entry_cmp(
+    gconstpointer a,
+    gconstpointer b)
+{
+    const vfs_manifest_entry_t *ea = a, *eb = b;
+
+    if (ea->file != eb->file)
+	return ea->file < eb->file ? -1 : 1;
+    return 0;
 }
 
-/* This function finds the filename for a given file number. We search
- * for a filesystem file matching the regex /^0*$device_file\./; if
- * there is more than one such file we make a warning and take an
- * arbitrary one. */
 static char *
-file_number_to_file_name(
-    VfsDevice *self,
-    guint device_file)
+manifest_filename(
+    VfsDevice *self)
 {
-    char *regex;
-    fnfn_data data;
-
-    data.self = self;
-    data.count = 0;
-    data.result = NULL;
+    return g_strconcat(self->dir_name, "/", VFS_DEVICE_MANIFEST_NAME, NULL);
+}
 
-    regex = g_strdup_printf("^0*%u\\.", device_file);
+static void
+manifest_invalidate(
+    VfsDevice *self)
+{
+    slist_free_full(self->manifest, manifest_entry_free);
+    self->manifest = NULL;
+    self->manifest_loaded = FALSE;
+}
 
-    search_vfs_directory(self, regex,
-                         file_number_to_file_name_functor, &data);
+static vfs_manifest_entry_t *
+manifest_lookup(
+    VfsDevice *self,
+    guint file)
+{
+    GSList *iter;
 
-    amfree(regex);
+    for (iter = self->manifest; iter; iter = iter->next) {
+	vfs_manifest_entry_t *entry = iter->data;
 
-    if (data.count == 0) {
-        g_assert(data.result == NULL);
-        return NULL;
-    } else if (data.count > 1) {
-	g_warning("Found multiple names for file number %d, choosing file %s",
-                device_file, data.result);
-        return data.result;
-    } else {
-        g_assert(data.result != NULL);
-        return data.result;
+	if (entry->file == file)
+	    return entry;
     }
-    g_assert_not_reached();
+    return NULL;
 }
 
-/* This function returns the dynamically-allocated lockfile name for a
-   given file number. */
-/*
-static char * lockfile_name(VfsDevice * self, guint number) {
-    return g_strdup_printf("%s/%05d-lock", self->dir_name, number);
+static vfs_manifest_entry_t *
+manifest_add(
+    VfsDevice *self,
+    guint file,
+    const char *name,
+    guint64 size)
+{
+    vfs_manifest_entry_t *entry = g_new0(vfs_manifest_entry_t, 1);
+
+    entry->file = file;
+    entry->size = size;
+    entry->name = g_strdup(name);
+    self->manifest = g_slist_insert_sorted(self->manifest, entry,
+					   manifest_entry_cmp);
+    return entry;
 }
-*/
 
-/* Does what you expect. If the lock already exists, it is released
- * and regained, in case the mode is changing.
- * The file field has several options:
- * - file > 0: Open a lock on a real volume file.
- * - file = 0: Open the volume lock as a volume file (for setup).
- * - file < 0: Open the volume lock as a volume lock (persistantly).
+/* Add a copy of MEMBER, a file packed in a container */
+static void
+manifest_add_member(
+    VfsDevice *self,
+    const vfs_manifest_entry_t *member)
+{
+    vfs_manifest_entry_t *entry;
+
+    entry = manifest_add(self, member->file, member->name, member->size);
+    entry->container = g_strdup(member->container);
+    entry->offset = member->offset;
+}
+
+/*
+ * Containers
+ *
+ * A container holds the small files one after the other, each with its
+ * header, and ends with its directory: a VFS_DEVICE_PACK_MAGIC line, a
+ * "FILE OFFSET SIZE NAME" line per file and an END line with their count,
+ * then a footer of VFS_DEVICE_PACK_FOOTER_SIZE bytes with the offset of the
+ * directory.  The directory is rewritten after each file, which overwrites
+ * the previous one, so that the files survive a crash before the container
+ * is closed.
  */
-static gboolean open_lock(G_GNUC_UNUSED VfsDevice * self,
-			  G_GNUC_UNUSED int file,
-			  G_GNUC_UNUSED gboolean exclusive)
+
+/* Read the directory of CONTAINER into MEMBERS, and where it starts into
+ * DIR_OFFSET.  Returns FALSE if it has no complete directory. */
+static gboolean
+pack_read_directory(
+    VfsDevice *self,
+    const char *container,
+    GSList **members,
+    guint64 *dir_offset)
 {
-    /* At the moment, file locking is horribly broken. */
-    return TRUE;
+    char *path = g_strconcat(self->dir_name, "/", container, NULL);
+    char footer[VFS_DEVICE_PACK_FOOTER_SIZE + 1];
+    struct stat file_status;
+    unsigned long long offset = 0;
+    char *buf = NULL;
+    gchar **lines = NULL, **line;
+    size_t len;
+    GSList *list = NULL;
+    guint count = 0, end_count;
+    gboolean complete = FALSE;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+	goto done;
+
+    if (fstat(fd, &file_status) != 0 ||
+	file_status.st_size < VFS_DEVICE_PACK_FOOTER_SIZE ||
+	lseek(fd, file_status.st_size - VFS_DEVICE_PACK_FOOTER_SIZE,
+	      SEEK_SET) == -1 ||
+	full_read(fd, footer, VFS_DEVICE_PACK_FOOTER_SIZE) <
+						VFS_DEVICE_PACK_FOOTER_SIZE)
+	goto done;
+    footer[VFS_DEVICE_PACK_FOOTER_SIZE] = '\0';
+    if (sscanf(footer, "PACK-DIR %llu", &offset) != 1 ||
+	offset > (guint64)file_status.st_size - VFS_DEVICE_PACK_FOOTER_SIZE)
+	goto done;
+
+    len = file_status.st_size - VFS_DEVICE_PACK_FOOTER_SIZE - offset;
+    buf = g_malloc(len + 1);
+    if (lseek(fd, offset, SEEK_SET) == -1 || full_read(fd, buf, len) < len)
+	goto done;
+    buf[len] = '\0';
+
+    lines = g_strsplit(buf, "\n", 0);
+    if (!lines[0] || !g_str_equal(lines[0], VFS_DEVICE_PACK_MAGIC))
+	goto done;
+    for (line = lines + 1; *line; line++) {
+	vfs_manifest_entry_t *entry;
+	guint fileno;
+	unsigned long long member_offset, size;
+	int n = 0;
+
+	if (sscanf(*line, "END %u", &end_count) == 1) {
+	    complete = (end_count == count);
+	    break;
+	}
+	if (sscanf(*line, "%u %llu %llu %n", &fileno, &member_offset, &size,
+		   &n) < 3 || n == 0 || !(*line)[n])
+	    break;
+	entry = g_new0(vfs_manifest_entry_t, 1);
+	entry->file = fileno;
+	entry->size = size;
+	entry->name = g_strdup(*line + n);
+	entry->container = g_strdup(container);
+	entry->offset = member_offset;
+	list = g_slist_prepend(list, entry);
+	count++;
+    }
+
+done:
+    if (fd >= 0)
+	close(fd);
+    g_strfreev(lines);
+    g_free(buf);
+    g_free(path);
+    if (complete) {
+	*members = list;
+	*dir_offset = offset;
+    } else {
+	slist_free_full(list, manifest_entry_free);
+    }
+    return complete;
 }
 
-/* For now, does it the bad way. */
-static void promote_volume_lock(VfsDevice * self G_GNUC_UNUSED) {
+/* Write the directory of MEMBERS at OFFSET in the container open on FD, and
+ * cut it after.  Returns its size, or 0 if it can't be written. */
+static gsize
+pack_write_directory(
+    int fd,
+    guint64 offset,
+    GSList *members)
+{
+    GString *dir = g_string_new(VFS_DEVICE_PACK_MAGIC "\n");
+    GSList *iter;
+    guint count = 0;
+    gsize len = 0;
+
+    for (iter = members; iter; iter = iter->next) {
+	vfs_manifest_entry_t *member = iter->data;
+
+	g_string_append_printf(dir, "%u %llu %llu %s\n", member->file,
+			       (unsigned long long)member->offset,
+			       (unsigned long long)member->size, member->name);
+	count++;
+    }
+    g_string_append_printf(dir, "END %u\n", count);
+    g_string_append_printf(dir, VFS_DEVICE_PACK_FOOTER_FORMAT,
+			   (unsigned long long)offset);
+
+    if (lseek(fd, offset, SEEK_SET) != -1 &&
+	full_write(fd, dir->str, dir->len) == dir->len &&
+	ftruncate(fd, offset + dir->len) == 0)
+	len = dir->len;
+    g_string_free(dir, TRUE);
+    return len;
 }
 
-static void demote_volume_lock(VfsDevice * self G_GNUC_UNUSED) {
+/* A SearchDirectoryFunctor. */
+static gboolean
+manifest_scan_functor(
+    const char *filename,
+    gpointer datap)
+{
+    VfsDevice *self = VFS_DEVICE(datap);
+    char *path;
+    struct stat file_status;
+    guint64 file;
+
+    file = g_ascii_strtoull(filename, NULL, 10); /* Guaranteed to work. */
+    if (file > G_MAXINT) {
+	g_warning(_("Super-large device file %s found, ignoring"), filename);
+	return TRUE;
+    }
+
+    /* Just to be thorough, let's check that it's a real file. */
+    path = g_strjoin(NULL, self->dir_name, "/", filename, NULL);
+    if (0 != stat(path, &file_status)) {
+	g_warning(_("Cannot stat file %s (%s), ignoring it"), path, strerror(errno));
+    } else if (!S_ISREG(file_status.st_mode)) {
+	g_warning(_("%s is not a regular file, ignoring it"), path);
+    } else if (manifest_lookup(self, file)) {
+	g_warning("Found multiple names for file number %d, ignoring file %s",
+		  (int)file, path);
+    } else {
+	manifest_add(self, file, filename, file_status.st_size);
+    }
+    amfree(path);
+    return TRUE;
 }
 
-/* A SearchDirectoryFunctor */
+/* A SearchDirectoryFunctor, for the containers. */
 static gboolean
-update_volume_size_functor(const char *filename,
-                           gpointer user_data)
+manifest_pack_scan_functor(
+    const char *filename,
+    gpointer datap)
 {
-    char *full_filename;
-    struct stat stat_buf;
-    VfsDevice *self = VFS_DEVICE(user_data);
+    VfsDevice *self = VFS_DEVICE(datap);
+    GSList *members, *iter;
+    guint64 dir_offset;
 
-    full_filename = g_strjoin(NULL, self->dir_name, "/", filename, NULL);
+    /* the files of the one being filled are added by manifest_load */
+    if (self->pack_name && g_str_equal(filename, self->pack_name))
+	return TRUE;
 
-    if (stat(full_filename, &stat_buf) < 0) {
-        /* Log it and keep going. */
-	g_warning(_("Couldn't stat file %s: %s"), full_filename, strerror(errno));
-        amfree(full_filename);
-        return TRUE;
+    if (!pack_read_directory(self, filename, &members, &dir_offset)) {
+	g_warning("Container %s%s has no directory, ignoring it",
+		  self->dir_name, filename);
+	return TRUE;
     }
 
-    amfree(full_filename);
-    self->volume_bytes += stat_buf.st_size;
+    for (iter = members; iter; iter = iter->next) {
+	vfs_manifest_entry_t *entry = iter->data;
 
+	if (manifest_lookup(self, entry->file)) {
+	    g_warning("Found multiple names for file number %d, ignoring "
+		      "the one in container %s", (int)entry->file, filename);
+	    manifest_entry_free(entry);
+	} else {
+	    self->manifest = g_slist_insert_sorted(self->manifest, entry,
+						   manifest_entry_cmp);
+	}
+    }
+    g_slist_free(members);
     return TRUE;
 }
 
-static void
-vfs_update_volume_size(
-    Device *dself)
+/* Read the manifest if it describes the directory as of MTIME */
+static gboolean
+manifest_read(
+    VfsDevice *self,
+    time_t mtime)
 {
-    VfsDevice *self = VFS_DEVICE(dself);
-    self->volume_bytes = 0;
-    search_vfs_directory(self, "^[0-9]+\\.",
-                         update_volume_size_functor, self);
+    char *filename = manifest_filename(self);
+    FILE *file;
+    char line[4096];
+    long manifest_mtime;
+    guint count = 0, end_count;
+    gboolean complete = FALSE;
+
+    file = fopen(filename, "r");
+    g_free(filename);
+    if (!file)
+	return FALSE;
 
-}
+    if (!fgets(line, sizeof(line), file) ||
+	!g_str_equal(line, VFS_DEVICE_MANIFEST_MAGIC "\n") ||
+	!fgets(line, sizeof(line), file) ||
+	sscanf(line, "MTIME %ld", &manifest_mtime) != 1 ||
+	manifest_mtime == 0 || (time_t)manifest_mtime != mtime) {
+	fclose(file);
+	return FALSE;
+    }
 
-static void
+    while (fgets(line, sizeof(line), file)) {
+	guint fileno;
+	unsigned long long size;
+	int n = 0;
+	size_t len = strlen(line);
+
+	if (len == 0 || line[len-1] != '\n')
+	    break;
+	line[len-1] = '\0';
+	if (sscanf(line, "END %u", &end_count) == 1) {
+	    complete = (end_count == count);
+	    break;
+	}
+	if (line[0] == 'P' && line[1] == ' ') {
+	    /* a packed file: its container and its offset there */
+	    vfs_manifest_entry_t *entry;
+	    char container[64];
+	    unsigned long long offset;
+
+	    if (sscanf(line, "P %u %llu %llu %63s %n", &fileno, &size,
+		       &offset, container, &n) < 4 || n == 0 || !line[n])
+		break;
+	    entry = manifest_add(self, fileno, line + n, size);
+	    entry->container = g_strdup(container);
+	    entry->offset = offset;
+	    count++;
+	    continue;
+	}
+	if (sscanf(line, "%u %llu %n", &fileno, &size, &n) < 2 || n == 0 ||
+	    !line[n])
+	    break;
+	manifest_add(self, fileno, line + n, size);
+	count++;
+    }
+    fclose(file);
+
+    if (!complete) {
+	slist_free_full(self->manifest, manifest_entry_free);
+	self->manifest = NULL;
+    }
+    return complete;
+}
+
+static void
+manifest_write(
+    VfsDevice *self)
+{
+    char *filename = manifest_filename(self);
+    GString *contents = g_string_new(VFS_DEVICE_MANIFEST_MAGIC "\n");
+    struct stat dir_status;
+    time_t mtime;
+    GSList *iter;
+    guint count = 0;
+    int fd;
+
+    /* creating it is the only change it makes to the directory */
+    fd = open(filename, O_WRONLY | O_CREAT, VFS_DEVICE_CREAT_MODE);
+    if (stat(self->dir_name, &dir_status) != 0) {
+	self->manifest_loaded = FALSE;
+	if (fd >= 0)
+	    close(fd);
+	goto done;
+    }
+    /* still good for this device if the file can't be written */
+    self->manifest_mtime = dir_status.st_mtime;
+    if (fd < 0) {
+	g_debug("Can't write the manifest %s: %s", filename, strerror(errno));
+	goto done;
+    }
+
+    /* another change later in the same second would go unnoticed, so let the
+     * other programs scan the directory */
+    mtime = dir_status.st_mtime;
+    if (mtime >= time(NULL))
+	mtime = 0;
+    g_string_append_printf(contents, "MTIME %ld\n", (long)mtime);
+    for (iter = self->manifest; iter; iter = iter->next) {
+	vfs_manifest_entry_t *entry = iter->data;
+
+	if (entry->container) {
+	    g_string_append_printf(contents, "P %u %llu %llu %s %s\n",
+				   entry->file,
+				   (unsigned long long)entry->size,
+				   (unsigned long long)entry->offset,
+				   entry->container, entry->name);
+	} else {
+	    g_string_append_printf(contents, "%u %llu %s\n", entry->file,
+				   (unsigned long long)entry->size,
+				   entry->name);
+	}
+	count++;
+    }
+    g_string_append_printf(contents, "END %u\n", count);
+
+    if (ftruncate(fd, 0) != 0 ||
+	full_write(fd, contents->str, contents->len) < contents->len) {
+	g_debug("Can't write the manifest %s: %s", filename, strerror(errno));
+	/* leave it without its END line */
+	if (ftruncate(fd, 0) != 0) {
+	    g_debug("ftruncate failed: %s", strerror(errno));
+	}
+    }
+    close(fd);
+
+done:
+    g_string_free(contents, TRUE);
+    g_free(filename);
+}
+
+/* Make sure the manifest is loaded and describes the directory, rebuilding
+ * it if needed.  Returns FALSE, with the error set, if the directory can't
+ * be read. */
+static gboolean
+manifest_load(
+    VfsDevice *self)
+{
+    struct stat dir_status;
+    GSList *iter;
+
+    if (stat(self->dir_name, &dir_status) == 0) {
+	if (self->manifest_loaded &&
+	    dir_status.st_mtime == self->manifest_mtime)
+	    return TRUE;
+	manifest_invalidate(self);
+	if (manifest_read(self, dir_status.st_mtime)) {
+	    self->manifest_mtime = dir_status.st_mtime;
+	    self->manifest_loaded = TRUE;
+	    return TRUE;
+	}
+    } else {
+	manifest_invalidate(self);
+    }
+
+    if (search_vfs_directory(self, "^[0-9]+\\.",
+			     manifest_scan_functor, self) < 0 ||
+	search_vfs_directory(self, VFS_DEVICE_PACK_REGEX,
+			     manifest_pack_scan_functor, self) < 0) {
+	manifest_invalidate(self);
+	return FALSE;
+    }
+    /* and the files of the container being filled */
+    for (iter = self->pack_members; iter; iter = iter->next) {
+	vfs_manifest_entry_t *member = iter->data;
+
+	if (!manifest_lookup(self, member->file))
+	    manifest_add_member(self, member);
+    }
+    self->manifest_loaded = TRUE;
+    manifest_write(self);
+    return TRUE;
+}
+
+/* File FILE was added (NAME != NULL) or removed by this device; record it if
+ * the manifest is in use */
+static void
+manifest_update(
+    VfsDevice *self,
+    guint file,
+    const char *name,
+    guint64 size)
+{
+    vfs_manifest_entry_t *entry;
+
+    if (!self->manifest_loaded)
+	return;
+
+    entry = manifest_lookup(self, file);
+    if (entry) {
+	self->manifest = g_slist_remove(self->manifest, entry);
+	manifest_entry_free(entry);
+    }
+    if (name)
+	manifest_add(self, file, name, size);
+    manifest_write(self);
+}
+
+/* MEMBER was packed by this device; record it if the manifest is in use */
+static void
+manifest_update_member(
+    VfsDevice *self,
+    const vfs_manifest_entry_t *member)
+{
+    vfs_manifest_entry_t *entry;
+
+    if (!self->manifest_loaded)
+	return;
+
+    entry = manifest_lookup(self, member->file);
+    if (entry) {
+	self->manifest = g_slist_remove(self->manifest, entry);
+	manifest_entry_free(entry);
+    }
+    manifest_add_member(self, member);
+    manifest_write(self);
+}
+
+/* This function finds the filename for a given file number, or NULL if
+ * there is no such file; that of its container if it is packed. */
+static char *
+file_number_to_file_name(
+    VfsDevice *self,
+    guint device_file)
+{
+    vfs_manifest_entry_t *entry;
+
+    if (!manifest_load(self))
+	return NULL;
+
+    entry = manifest_lookup(self, device_file);
+    if (!entry)
+	return NULL;
+    return g_strjoin(NULL, self->dir_name, "/",
+		     entry->container ? entry->container : entry->name, NULL);
+}
+
+/* This function returns the dynamically-allocated lockfile name for a
+   given file number. */
+/*
+static char * lockfile_name(VfsDevice * self, guint number) {
+    return g_strdup_printf("%s/%05d-lock", self->dir_name, number);
+}
+*/
+
+/* Does what you expect. If the lock already exists, it is released
+ * and regained, in case the mode is changing.
+ * The file field has several options:
+ * - file > 0: Open a lock on a real volume file.
+ * - file = 0: Open the volume lock as a volume file (for setup).
+ * - file < 0: Open the volume lock as a volume lock (persistantly).
+ */
+static gboolean open_lock(G_GNUC_UNUSED VfsDevice * self,
+			  G_GNUC_UNUSED int file,
+			  G_GNUC_UNUSED gboolean exclusive)
+{
+    /* At the moment, file locking is horribly broken. */
+    return TRUE;
+}
+
+/* For now, does it the bad way. */
+static void promote_volume_lock(VfsDevice * self G_GNUC_UNUSED) {
+}
+
+static void demote_volume_lock(VfsDevice * self G_GNUC_UNUSED) {
+}
+
+static void
+vfs_update_volume_size(
+    Device *dself)
+{
+    VfsDevice *self = VFS_DEVICE(dself);
+    GSList *iter;
+
+    self->volume_bytes = 0;
+    if (!manifest_load(self))
+	return;
+
+    for (iter = self->manifest; iter; iter = iter->next) {
+	vfs_manifest_entry_t *entry = iter->data;
+	guint64 size = entry->size;
+
+	if (size == 0) {
+	    /* left by a writer that did not finish */
+	    char *full_filename = g_strjoin(NULL, self->dir_name, "/",
+					    entry->name, NULL);
+	    struct stat stat_buf;
+
+	    if (stat(full_filename, &stat_buf) < 0) {
+		/* Log it and keep going. */
+		g_warning(_("Couldn't stat file %s: %s"), full_filename, strerror(errno));
+	    } else {
+		size = stat_buf.st_size;
+	    }
+	    amfree(full_filename);
+	}
+	self->volume_bytes += size;
+    }
+}
+
+static void
 vfs_device_open_device(
     Device *dself,
     char   *device_name,
@@ -799,8 +1569,10 @@ delete_vfs_files(
     g_assert(self != NULL);
 
     /* This function assumes that the volume is locked! */
+    vfs_pack_discard(self);
     search_vfs_directory(self, VFS_DEVICE_FILE_REGEX,
                          delete_vfs_files_functor, self);
+    manifest_invalidate(self);
 }
 
 /* This is a functor suitable for search_directory. It simply prints a
@@ -1008,7 +1780,7 @@ vfs_device_write_block(
 
     if (device_in_error(self)) return WRITE_FAILED;
 
-    g_assert(self->open_file_fd >= 0);
+    g_assert(self->open_file_fd >= 0 || self->pack_buffer);
 
     if (check_at_leom(self, size))
 	dself->is_eom = TRUE;
@@ -1017,10 +1789,12 @@ vfs_device_write_block(
 	/* check_at_peom() only checks against MAX_VOLUME_USAGE limit */
 	DeviceWriteResult dwr = self->leom ? WRITE_FULL : WRITE_FAILED;
 	dself->is_eom = TRUE;
+	if (!vfs_aio_finish(self))
+	    return WRITE_FAILED;
 	device_set_error(dself,
 	    g_strdup(_("No space left on device: more than MAX_VOLUME_USAGE bytes written")),
 	    DEVICE_STATUS_VOLUME_ERROR);
-	if (fsync(self->open_file_fd) == -1) {
+	if (self->open_file_fd >= 0 && fsync(self->open_file_fd) == -1) {
 	    g_debug("fsync failed: %s", strerror(errno));
 	    dwr = WRITE_FAILED;
 	}
@@ -1035,7 +1809,26 @@ vfs_device_write_block(
 	}
     }
 
-    result = vfs_device_robust_write(self, data, size);
+    /* a small file is kept in memory until it is finished or too large */
+    if (self->pack_buffer &&
+	dself->bytes_written + size > self->pack_threshold &&
+	!vfs_pack_spill(self))
+	return WRITE_FAILED;
+
+    if (self->pack_buffer) {
+	g_byte_array_append(self->pack_buffer, data, size);
+	result = RESULT_SUCCESS;
+    } else {
+	vfs_preallocate(self,
+			dself->bytes_written + VFS_DEVICE_LABEL_SIZE + size);
+	if (self->aio) {
+	    int err = aio_writer_write(self->aio, data, size);
+
+	    result = err ? vfs_aio_failed(self, err) : RESULT_SUCCESS;
+	} else {
+	    result = vfs_device_robust_write(self, data, size);
+	}
+    }
 
     if (result == RESULT_NO_SPACE) {
 	DeviceWriteResult dwr = self->leom ? WRITE_SPACE : WRITE_FAILED;
@@ -1067,9 +1860,190 @@ vfs_device_write_block(
     dself->bytes_written += size;
     g_mutex_unlock(dself->device_mutex);
 
+    if (!self->pack_buffer)
+	vfs_write_behind(self, dself->bytes_written + VFS_DEVICE_LABEL_SIZE);
+
     return WRITE_SUCCEED;
 }
 
+static void
+vfs_aio_start(
+    VfsDevice *self)
+{
+    Device *dself = DEVICE(self);
+    int fd = self->open_file_fd;
+
+    if (self->io_depth == 0)
+	return;
+
+#ifdef O_DIRECT
+    if (self->direct_io) {
+	int flags = fcntl(fd, F_GETFL);
+
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_DIRECT) == -1)
+	    g_debug("Can't use O_DIRECT: %s", strerror(errno));
+    }
+#endif
+
+    self->aio = aio_writer_new(fd,
+			       VFS_DEVICE_LABEL_SIZE + dself->bytes_written,
+			       self->io_depth, dself->block_size);
+    if (!self->aio) {
+	g_debug("Writing synchronously: %s", strerror(errno));
+#ifdef O_DIRECT
+	if (self->direct_io) {
+	    int flags = fcntl(fd, F_GETFL);
+
+	    if (flags != -1)
+		(void)fcntl(fd, F_SETFL, flags & ~O_DIRECT);
+	}
+#endif
+    }
+}
+
+static IoResult
+vfs_aio_failed(
+    VfsDevice *self,
+    int err)
+{
+    Device *dself = DEVICE(self);
+    guint64 written, lost;
+
+    aio_writer_flush(self->aio);
+    written = aio_writer_written(self->aio);
+    aio_writer_free(self->aio);
+    self->aio = NULL;
+
+    /* the blocks after the first one to fail were accepted but are not all
+     * on disk: take them back and cut the file after the good data */
+    lost = dself->bytes_written + VFS_DEVICE_LABEL_SIZE - MIN(written,
+		dself->bytes_written + VFS_DEVICE_LABEL_SIZE);
+    self->volume_bytes -= MIN(self->volume_bytes, lost);
+    self->checked_bytes_used -= MIN(self->checked_bytes_used, lost);
+    g_mutex_lock(dself->device_mutex);
+    dself->bytes_written -= lost;
+    g_mutex_unlock(dself->device_mutex);
+    if (lost)
+	g_debug("%llu bytes written asynchronously were lost",
+		(unsigned long long)lost);
+    if (ftruncate(self->open_file_fd,
+		  dself->bytes_written + VFS_DEVICE_LABEL_SIZE) == -1 ||
+	lseek(self->open_file_fd, dself->bytes_written + VFS_DEVICE_LABEL_SIZE,
+	      SEEK_SET) == -1) {
+	g_debug("ftruncate failed: %s", strerror(errno));
+    }
+
+    if (0
+#ifdef EFBIG
+	|| err == EFBIG
+#endif
+#ifdef ENOSPC
+	|| err == ENOSPC
+#endif
+       ) {
+	device_set_error(dself,
+		g_strdup_printf(_("No space left on device: %s"), strerror(err)),
+		DEVICE_STATUS_VOLUME_ERROR);
+	return RESULT_NO_SPACE;
+    }
+    device_set_error(dself,
+	    g_strdup_printf(_("Error writing device fd %d: %s"),
+			    self->open_file_fd, strerror(err)),
+	    DEVICE_STATUS_VOLUME_ERROR);
+    return RESULT_ERROR;
+}
+
+static gboolean
+vfs_aio_finish(
+    VfsDevice *self)
+{
+    int err;
+
+    if (!self->aio)
+	return TRUE;
+
+    err = aio_writer_flush(self->aio);
+    if (err) {
+	vfs_aio_failed(self, err);
+	return FALSE;
+    }
+    aio_writer_free(self->aio);
+    self->aio = NULL;
+    return TRUE;
+}
+
+static void
+vfs_preallocate(
+    VfsDevice *self,
+    guint64 end)
+{
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+    guint64 new_end;
+
+    if (self->preallocate == 0 || end <= self->allocated_end)
+	return;
+
+    /* whole extents, so that the file ends up in a few of them */
+    new_end = (end + self->preallocate - 1) / self->preallocate *
+	      self->preallocate;
+    if (fallocate(self->open_file_fd, FALLOC_FL_KEEP_SIZE,
+		  self->allocated_end, new_end - self->allocated_end) == -1) {
+	/* the write will tell if the filesystem is full */
+	g_debug("fallocate failed: %s; not preallocating %s",
+		strerror(errno), self->file_name);
+	self->allocated_end = G_MAXINT64;
+	return;
+    }
+    self->allocated_end = new_end;
+#else
+    (void)self;
+    (void)end;
+#endif
+}
+
+static void
+vfs_write_behind(
+    VfsDevice *self,
+    guint64 end)
+{
+#ifdef HAVE_SYNC_FILE_RANGE
+    int fd = self->open_file_fd;
+
+    if (self->write_behind == 0 ||
+	end - self->flushed_end < self->write_behind)
+	return;
+
+    /* the previous window must be on disk before it can be dropped; waiting
+     * for it keeps at most two windows of dirty pages */
+    if (self->flushed_end > self->synced_end) {
+	if (sync_file_range(fd, self->synced_end,
+			    self->flushed_end - self->synced_end,
+			    SYNC_FILE_RANGE_WAIT_BEFORE |
+			    SYNC_FILE_RANGE_WRITE |
+			    SYNC_FILE_RANGE_WAIT_AFTER) == -1) {
+	    g_debug("sync_file_range failed: %s", strerror(errno));
+	}
+#ifdef HAVE_POSIX_FADVISE
+	else if (self->drop_cache) {
+	    posix_fadvise(fd, self->synced_end,
+			  self->flushed_end - self->synced_end,
+			  POSIX_FADV_DONTNEED);
+	}
+#endif
+	self->synced_end = self->flushed_end;
+    }
+
+    if (sync_file_range(fd, self->flushed_end, end - self->flushed_end,
+			SYNC_FILE_RANGE_WRITE) == -1) {
+	g_debug("sync_file_range failed: %s", strerror(errno));
+    }
+    self->flushed_end = end;
+#else
+    (void)self;
+    (void)end;
+#endif
+}
+
 static int
 vfs_device_read_block(
     Device   *dself,
@@ -1093,9 +2067,17 @@ vfs_device_read_block(
     }
 
     size = dself->block_size;
-    result = vfs_device_robust_read(self, data, &size);
+    /* a packed file ends before the container */
+    if (self->packed_left >= 0 && self->packed_left < size)
+	size = self->packed_left;
+    if (size == 0)
+	result = RESULT_NO_DATA;
+    else
+	result = vfs_device_robust_read(self, data, &size);
     switch (result) {
     case RESULT_SUCCESS:
+	if (self->packed_left >= 0)
+	    self->packed_left -= size;
         *size_req = size;
 	g_mutex_lock(dself->device_mutex);
 	dself->bytes_read += size;
@@ -1178,6 +2160,7 @@ vfs_device_finish(
     VfsDevice *self = VFS_DEVICE(dself);
 
     self->release_file(dself);
+    vfs_pack_close(self);
 
     dself->access_mode = ACCESS_NULL;
     g_mutex_lock(dself->device_mutex);
@@ -1189,84 +2172,22 @@ vfs_device_finish(
     return TRUE;
 }
 
-typedef struct {
-    VfsDevice *self;
-    int rval;
-} glfn_data;
-
-/* A SearchDirectoryFunctor. */
-static gboolean
-get_last_file_number_functor(
-    const char *filename,
-    gpointer datap)
-{
-    guint64 file;
-    glfn_data *data = (glfn_data *)datap;
-
-    file = g_ascii_strtoull(filename, NULL, 10); /* Guaranteed to work. */
-    if (file > G_MAXINT) {
-	g_warning(_("Super-large device file %s found, ignoring"), filename);
-        return TRUE;
-    }
-    /* This condition is needlessly complex due to sign issues. */
-    if (data->rval < 0 || ((guint)data->rval) < file) {
-        data->rval = file;
-    }
-    return TRUE;
-}
-
 static gint
 get_last_file_number(
     VfsDevice *self)
 {
-    glfn_data data;
-    int count;
     Device *dself = DEVICE(self);
-    data.self = self;
-    data.rval = -1;
-
-    count = search_vfs_directory(self, "^[0-9]+\\.",
-                                 get_last_file_number_functor, &data);
 
-    if (count <= 0) {
+    if (!manifest_load(self) || !self->manifest) {
         /* Somebody deleted something important while we weren't looking. */
 	device_set_error(dself,
 	    g_strdup(_("Error identifying VFS device contents!")),
 	    DEVICE_STATUS_DEVICE_ERROR | DEVICE_STATUS_VOLUME_ERROR);
         return -1;
-    } else {
-        g_assert(data.rval >= 0);
     }
 
-    return data.rval;
-}
-
-typedef struct {
-    VfsDevice * self;
-    guint request;
-    int best_found;
-} gnfn_data;
-
-/* A SearchDirectoryFunctor. */
-static gboolean
-get_next_file_number_functor(
-    const char *filename,
-    gpointer datap)
-{
-    guint      file;
-    gnfn_data *data = (gnfn_data*)datap;
-
-    file = g_ascii_strtoull(filename, NULL, 10); /* Guaranteed to work. */
-    if (file > G_MAXINT) {
-	g_warning(_("Super-large device file %s found, ignoring"), filename);
-        return TRUE;
-    }
-    /* This condition is needlessly complex due to sign issues. */
-    if (file >= data->request &&
-        (data->best_found < 0 || file < (guint)data->best_found)) {
-        data->best_found = file;
-    }
-    return TRUE;
+    /* the manifest is in file number order */
+    return ((vfs_manifest_entry_t *)g_slist_last(self->manifest)->data)->file;
 }
 
 /* Returns the file number equal to or greater than the given requested
@@ -1276,17 +2197,10 @@ get_next_file_number(
     VfsDevice *self,
     guint request)
 {
-    gnfn_data data;
-    int count;
     Device *dself = DEVICE(self);
-    data.self = self;
-    data.request = request;
-    data.best_found = -1;
-
-    count = search_vfs_directory(self, "^[0-9]+\\.",
-                                 get_next_file_number_functor, &data);
+    GSList *iter;
 
-    if (count <= 0) {
+    if (!manifest_load(self) || !self->manifest) {
         /* Somebody deleted something important while we weren't looking. */
 	device_set_error(dself,
 	    g_strdup(_("Error identifying VFS device contents!")),
@@ -1294,8 +2208,13 @@ get_next_file_number(
         return -1;
     }
 
-    /* Could be -1. */
-    return data.best_found;
+    for (iter = self->manifest; iter; iter = iter->next) {
+	vfs_manifest_entry_t *entry = iter->data;
+
+	if (entry->file >= request)
+	    return entry->file;
+    }
+    return -1;
 }
 
 /* Finds the file number, acquires a lock, and returns the new file name. */
@@ -1357,11 +2276,191 @@ vfs_device_start_file_open(
         self->release_file(dself);
         return FALSE;
     }
+    manifest_update(self, dself->file, strrchr(self->file_name, '/') + 1, 0);
 
     return TRUE;
 }
 
 
+static gboolean
+vfs_pack_start_file(
+    VfsDevice *self,
+    dumpfile_t *ji)
+{
+    Device *dself = DEVICE(self);
+    char *label_buffer;
+
+    self->file_name = make_new_file_name(self, ji);
+    if (self->file_name == NULL) {
+	device_set_error(dself,
+		g_strdup(_("Could not create header filename")),
+		DEVICE_STATUS_DEVICE_ERROR);
+        return FALSE;
+    }
+
+    label_buffer = device_build_amanda_header(dself, ji, NULL);
+    if (!label_buffer) {
+	device_set_error(dself,
+	    g_strdup(_("Amanda file header won't fit in a single block!")),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	self->release_file(dself);
+        return FALSE;
+    }
+    self->pack_buffer = g_byte_array_sized_new(VFS_DEVICE_LABEL_SIZE +
+					       dself->block_size);
+    g_byte_array_append(self->pack_buffer, (guint8 *)label_buffer,
+			VFS_DEVICE_LABEL_SIZE);
+    amfree(label_buffer);
+    return TRUE;
+}
+
+static gboolean
+vfs_pack_spill(
+    VfsDevice *self)
+{
+    Device *dself = DEVICE(self);
+    GByteArray *buffer = self->pack_buffer;
+    IoResult result;
+
+    self->open_file_fd = robust_open(self->file_name,
+                                     O_CREAT | O_EXCL | O_RDWR,
+                                     VFS_DEVICE_CREAT_MODE);
+    if (self->open_file_fd < 0) {
+	device_set_error(dself,
+		g_strdup_printf(_("Can't create file %s: %s"), self->file_name, strerror(errno)),
+		DEVICE_STATUS_DEVICE_ERROR);
+        return FALSE;
+    }
+    manifest_update(self, dself->file, strrchr(self->file_name, '/') + 1, 0);
+
+    self->pack_buffer = NULL;
+    self->allocated_end = 0;
+    self->flushed_end = 0;
+    self->synced_end = 0;
+    vfs_preallocate(self, buffer->len);
+    result = vfs_device_robust_write(self, (char *)buffer->data, buffer->len);
+    g_byte_array_free(buffer, TRUE);
+    if (result != RESULT_SUCCESS) {
+	/* vfs_device_robust_write set error status appropriately */
+	return FALSE;
+    }
+
+    vfs_aio_start(self);
+    return TRUE;
+}
+
+static gboolean
+vfs_pack_append(
+    VfsDevice *self)
+{
+    Device *dself = DEVICE(self);
+    GByteArray *buffer = self->pack_buffer;
+    vfs_manifest_entry_t *member;
+
+    if (self->pack_fd < 0) {
+	char *path;
+
+	self->pack_name = g_strdup_printf("pack.%05d", dself->file);
+	path = g_strconcat(self->dir_name, "/", self->pack_name, NULL);
+	self->pack_fd = robust_open(path, O_CREAT | O_EXCL | O_RDWR,
+				    VFS_DEVICE_CREAT_MODE);
+	if (self->pack_fd < 0) {
+	    device_set_error(dself,
+		g_strdup_printf(_("Can't create file %s: %s"), path, strerror(errno)),
+		DEVICE_STATUS_DEVICE_ERROR);
+	    amfree(path);
+	    amfree(self->pack_name);
+	    return FALSE;
+	}
+	amfree(path);
+	self->pack_end = 0;
+    }
+
+    /* over the directory of the previous files */
+    if (lseek(self->pack_fd, self->pack_end, SEEK_SET) == -1 ||
+	full_write(self->pack_fd, buffer->data, buffer->len) < buffer->len) {
+	int save_errno = errno;
+
+	/* take back what was written of it */
+	if (pack_write_directory(self->pack_fd, self->pack_end,
+				 self->pack_members) == 0) {
+	    g_debug("Can't restore the directory of %s: %s", self->pack_name,
+		    strerror(errno));
+	}
+	device_set_error(dself,
+	    g_strdup_printf(_("Error writing container %s: %s"),
+			    self->pack_name, strerror(save_errno)),
+	    DEVICE_STATUS_VOLUME_ERROR);
+	return FALSE;
+    }
+
+    member = g_new0(vfs_manifest_entry_t, 1);
+    member->file = dself->file;
+    member->size = buffer->len;
+    member->name = g_strdup(strrchr(self->file_name, '/') + 1);
+    member->container = g_strdup(self->pack_name);
+    member->offset = self->pack_end;
+    /* in file number order */
+    self->pack_members = g_slist_append(self->pack_members, member);
+    self->pack_end += buffer->len;
+    manifest_update_member(self, member);
+
+    if (pack_write_directory(self->pack_fd, self->pack_end,
+			     self->pack_members) == 0 ||
+	fsync(self->pack_fd) == -1) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Error writing the directory of container %s: %s"),
+			    self->pack_name, strerror(errno)),
+	    DEVICE_STATUS_VOLUME_ERROR);
+	return FALSE;
+    }
+
+    if (self->pack_end >= VFS_DEVICE_PACK_MAX_SIZE)
+	return vfs_pack_close(self);
+    return TRUE;
+}
+
+static gboolean
+vfs_pack_close(
+    VfsDevice *self)
+{
+    Device *dself = DEVICE(self);
+    gsize len;
+    gboolean success = TRUE;
+
+    if (self->pack_fd < 0)
+	return TRUE;
+
+    len = pack_write_directory(self->pack_fd, self->pack_end,
+			       self->pack_members);
+    if (len == 0) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Error writing the directory of container %s: %s"),
+			    self->pack_name, strerror(errno)),
+	    DEVICE_STATUS_VOLUME_ERROR);
+	success = FALSE;
+    }
+    self->volume_bytes += len;
+    self->checked_bytes_used += len;
+
+    vfs_pack_discard(self);
+    return success;
+}
+
+static void
+vfs_pack_discard(
+    VfsDevice *self)
+{
+    if (self->pack_fd >= 0) {
+	robust_close(self->pack_fd);
+	self->pack_fd = -1;
+    }
+    slist_free_full(self->pack_members, manifest_entry_free);
+    self->pack_members = NULL;
+    amfree(self->pack_name);
+    self->pack_end = 0;
+}
+
 static gboolean
 vfs_device_start_file(
     Device *dself,
@@ -1396,14 +2495,26 @@ vfs_device_start_file(
        4) Write the label.
        5) Chain up. */
 
-    if (!self->device_start_file_open(dself, ji)) {
-	return FALSE;
-    }
-
-    if (!vfs_write_amanda_header(self, ji)) {
-	/* vfs_write_amanda_header sets error status if necessary */
-        self->release_file(dself);
-        return FALSE;
+    /* A small file is packed with the others in a container; the subclasses
+     * writing their own blocks lay out their files themselves. */
+    if (self->pack_threshold > 0 &&
+	DEVICE_GET_CLASS(dself)->write_block == vfs_device_write_block) {
+	if (!vfs_pack_start_file(self, ji))
+	    return FALSE;
+    } else {
+	if (!self->device_start_file_open(dself, ji)) {
+	    return FALSE;
+	}
+	self->allocated_end = 0;
+	self->flushed_end = 0;
+	self->synced_end = 0;
+	vfs_preallocate(self, VFS_DEVICE_LABEL_SIZE);
+
+	if (!vfs_write_amanda_header(self, ji)) {
+	    /* vfs_write_amanda_header sets error status if necessary */
+	    self->release_file(dself);
+	    return FALSE;
+	}
     }
 
     /* handle some accounting business */
@@ -1416,6 +2527,9 @@ vfs_device_start_file(
     g_mutex_unlock(dself->device_mutex);
     /* make_new_file_name set dself->file for us */
 
+    if (!self->pack_buffer)
+	vfs_aio_start(self);
+
     return TRUE;
 }
 
@@ -1432,8 +2546,27 @@ vfs_device_finish_file(
     dself->in_file = FALSE;
     g_mutex_unlock(dself->device_mutex);
 
+    if (self->pack_buffer) {
+	gboolean success = vfs_pack_append(self);
+
+	self->release_file(dself);
+	return success;
+    }
+
+    /* a late ENOSPC fails the file */
+    vfs_aio_finish(self);
     self->release_file(dself);
 
+    /* the size of the file is known now */
+    if (self->manifest_loaded && manifest_load(self)) {
+	vfs_manifest_entry_t *entry = manifest_lookup(self, dself->file);
+
+	if (entry) {
+	    entry->size = dself->bytes_written + VFS_DEVICE_LABEL_SIZE;
+	    manifest_write(self);
+	}
+    }
+
     if (device_in_error(self)) return FALSE;
 
     return TRUE;
@@ -1451,6 +2584,7 @@ vfs_device_seek_file(
     VfsDevice *self = VFS_DEVICE(dself);
     int file;
     dumpfile_t * rval;
+    vfs_manifest_entry_t *entry;
     char header_buffer[VFS_DEVICE_LABEL_SIZE];
     int header_buffer_size = sizeof(header_buffer);
     IoResult result;
@@ -1517,6 +2651,17 @@ vfs_device_seek_file(
         return NULL;
     }
 
+    /* a packed file is read from its place in the container */
+    entry = manifest_lookup(self, file);
+    if (entry && entry->container &&
+	lseek(self->open_file_fd, entry->offset, SEEK_SET) == -1) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Couldn't seek in container %s: %s"), self->file_name, strerror(errno)),
+	    DEVICE_STATUS_DEVICE_ERROR);
+        self->release_file(dself);
+        return NULL;
+    }
+
     result = vfs_device_robust_read(self, header_buffer,
                                     &header_buffer_size);
     if (result != RESULT_SUCCESS) {
@@ -1527,6 +2672,13 @@ vfs_device_seek_file(
         return NULL;
     }
 
+    if (entry && entry->container) {
+	self->packed_offset = entry->offset;
+	self->packed_size = entry->size;
+	self->packed_left = entry->size - MIN(entry->size,
+					      (guint64)header_buffer_size);
+    }
+
     rval = g_new(dumpfile_t, 1);
     parse_file_header(header_buffer, rval, header_buffer_size);
     switch (rval->type) {
@@ -1571,6 +2723,7 @@ vfs_device_seek_block(
     guint64 block)
 {
     VfsDevice * self = VFS_DEVICE(dself);
+    guint64 offset;
     off_t result;
 
     g_assert(self->open_file_fd >= 0);
@@ -1578,9 +2731,12 @@ vfs_device_seek_block(
     if (device_in_error(self)) return FALSE;
 
     /* Pretty simple. We figure out the blocksize and use that. */
-    result = lseek(self->open_file_fd,
-                   (block) * dself->block_size + VFS_DEVICE_LABEL_SIZE,
-                   SEEK_SET);
+    offset = (block) * dself->block_size + VFS_DEVICE_LABEL_SIZE;
+    if (self->packed_left >= 0) {
+	self->packed_left = self->packed_size - MIN(self->packed_size, offset);
+	offset += self->packed_offset;
+    }
+    result = lseek(self->open_file_fd, offset, SEEK_SET);
 
     dself->block = block;
 
@@ -1677,12 +2833,103 @@ check_at_peom(
     return FALSE;
 }
 
+gboolean
+vfs_device_check_at_leom(
+    VfsDevice *self,
+    guint64 size)
+{
+    return check_at_leom(self, size);
+}
+
+gboolean
+vfs_device_check_at_peom(
+    VfsDevice *self,
+    guint64 size)
+{
+    return check_at_peom(self, size);
+}
+
+/* Remove the packed file ENTRY from the directory of its container, and the
+ * container with its last file; its space on disk is only given back then. */
+static gboolean
+vfs_pack_recycle_file(
+    VfsDevice *self,
+    vfs_manifest_entry_t *entry)
+{
+    Device *dself = DEVICE(self);
+    guint filenum = entry->file;
+    guint64 size = entry->size;
+    GSList *members, *iter;
+    guint64 dir_offset;
+    gboolean success = TRUE;
+    char *container = g_strdup(entry->container);
+
+    if (self->pack_name && g_str_equal(container, self->pack_name) &&
+	!vfs_pack_close(self)) {
+	self->release_file(dself);
+	g_free(container);
+	return FALSE;
+    }
+
+    if (!pack_read_directory(self, container, &members, &dir_offset)) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Can't read the directory of container %s%s"),
+			    self->dir_name, container),
+	    DEVICE_STATUS_VOLUME_ERROR);
+	self->release_file(dself);
+	g_free(container);
+	return FALSE;
+    }
+
+    for (iter = members; iter; iter = iter->next) {
+	vfs_manifest_entry_t *member = iter->data;
+
+	if (member->file == filenum) {
+	    members = g_slist_delete_link(members, iter);
+	    manifest_entry_free(member);
+	    break;
+	}
+    }
+    members = g_slist_sort(members, manifest_entry_cmp);
+
+    if (!members) {
+	if (!try_unlink(self->file_name)) {
+	    device_set_error(dself,
+		g_strdup_printf(_("Unlink of %s failed: %s"), self->file_name, strerror(errno)),
+		DEVICE_STATUS_VOLUME_ERROR);
+	    success = FALSE;
+	}
+    } else {
+	int fd = robust_open(self->file_name, O_RDWR, 0);
+
+	if (fd < 0 || pack_write_directory(fd, dir_offset, members) == 0) {
+	    device_set_error(dself,
+		g_strdup_printf(_("Error writing the directory of container %s: %s"),
+				self->file_name, strerror(errno)),
+		DEVICE_STATUS_VOLUME_ERROR);
+	    success = FALSE;
+	}
+	if (fd >= 0)
+	    robust_close(fd);
+    }
+    slist_free_full(members, manifest_entry_free);
+    g_free(container);
+
+    if (success) {
+	self->volume_bytes -= MIN(self->volume_bytes, size);
+	manifest_update(self, filenum, NULL, 0);
+    }
+    self->release_file(dself);
+    return success;
+}
+
 static gboolean
 vfs_device_recycle_file(
     Device *dself,
     guint   filenum)
 {
     VfsDevice * self = VFS_DEVICE(dself);
+    vfs_manifest_entry_t *entry;
     struct stat file_status;
     off_t file_size;
 
@@ -1711,6 +2958,10 @@ vfs_device_recycle_file(
         return FALSE;
     }
 
+    entry = manifest_lookup(self, filenum);
+    if (entry && entry->container)
+	return vfs_pack_recycle_file(self, entry);
+
     if (0 != stat(self->file_name, &file_status)) {
 	device_set_error(dself,
 	    g_strdup_printf(_("Cannot stat file %s (%s), so not removing"),
@@ -1729,6 +2980,7 @@ vfs_device_recycle_file(
     }
 
     self->volume_bytes -= file_size;
+    manifest_update(self, filenum, NULL, 0);
     self->release_file(dself);
     return TRUE;
 }
@@ -23,6 +23,7 @@
 #define __VFS_DEVICE_H__
 
 #include "device.h"
+#include "aio-write.h"
 
 /*
  * Type checking and casting macros
@@ -71,6 +72,35 @@ typedef struct {
     /* when was that check performed? */
     time_t checked_fs_free_time;
 
+    /* see the PREALLOCATE, WRITE_BEHIND and DROP_CACHE properties */
+    guint64 preallocate;
+    guint64 write_behind;
+    gboolean drop_cache;
+    guint64 allocated_end;	/* the open file is allocated up to there */
+    guint64 flushed_end;	/* its writeback was started up to there */
+    guint64 synced_end;		/* and is done up to there */
+
+    /* see the IO_DEPTH and DIRECT_IO properties */
+    guint io_depth;
+    gboolean direct_io;
+    aio_writer_t *aio;		/* writes the open file, if IO_DEPTH is set */
+
+    /* the slot manifest, of vfs_manifest_entry_t in file number order */
+    GSList *manifest;
+    gboolean manifest_loaded;
+    time_t manifest_mtime;	/* of dir_name when it was last checked */
+
+    /* see the PACK_THRESHOLD property */
+    guint64 pack_threshold;
+    GByteArray *pack_buffer;	/* the file being written, while it is small */
+    int pack_fd;		/* the container being filled, or -1 */
+    char *pack_name;		/* its name in dir_name */
+    guint64 pack_end;		/* where its next file goes */
+    GSList *pack_members;	/* its directory, of vfs_manifest_entry_t */
+    guint64 packed_offset;	/* the packed file being read starts there, */
+    guint64 packed_size;	/* has that size */
+    gint64 packed_left;		/* and that much data left to read, or -1 */
+
     /* for testing */
     gboolean slow_write;
     int      slow_count;
@@ -108,4 +138,9 @@ void delete_vfs_files(VfsDevice * self);
 IoResult vfs_device_robust_write(VfsDevice *self, char *buf, int count);
 IoResult vfs_device_robust_read(VfsDevice *self, char *buf, int *count);
 gboolean vfs_write_amanda_header(VfsDevice *self, const dumpfile_t *header);
+
+/* Will writing SIZE more bytes reach the logical (LEOM) or the physical (PEOM)
+ * end of the volume?  For the subclasses writing their own blocks. */
+gboolean vfs_device_check_at_leom(VfsDevice *self, guint64 size);
+gboolean vfs_device_check_at_peom(VfsDevice *self, guint64 size);
 #endif
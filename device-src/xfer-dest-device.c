@@ -128,6 +128,7 @@ push_buffer_impl(
 	    xfer_cancel_with_error(elt, "%s: Cannot allocate memory",
 				   self->device->device_name);
 	    wait_until_xfer_cancelled(elt->xfer);
+	    xfer_element_free_buffer(elt, to_free);
 	    return;
 	}
 	self->block_size = self->device->block_size;
@@ -146,7 +147,7 @@ push_buffer_impl(
     /* and if the buffer is now full, write the block */
     if (self->partial_length == self->block_size) {
 	if (!do_block(self, self->block_size, self->partial)) {
-	    g_free(to_free);
+	    xfer_element_free_buffer(elt, to_free);
 	    return;
 	}
 	self->partial_length = 0;
@@ -155,7 +156,7 @@ push_buffer_impl(
     /* write any whole blocks directly from the push buffer */
     while (len >= self->block_size) {
 	if (!do_block(self, self->block_size, buf)) {
-	    g_free(to_free);
+	    xfer_element_free_buffer(elt, to_free);
 	    return;
 	}
 
@@ -169,7 +170,7 @@ push_buffer_impl(
 	self->partial_length = len;
     }
 
-    g_free(to_free);
+    xfer_element_free_buffer(elt, to_free);
 }
 
 static void
@@ -178,6 +179,7 @@ instance_init(
 {
     XferDestDevice *self = XFER_DEST_DEVICE(elt);
     self->partial = NULL;
+    elt->releases_buffers = TRUE;
 }
 
 static void
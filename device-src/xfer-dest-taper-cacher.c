@@ -33,7 +33,6 @@
 
 /* Future Plans:
  * - capture EOF early enough to avoid wasting a tape when the part size is an even multiple of the volume size - maybe reader thread can just go back and tag previous slab with EOF in that case?
- * - use mmap to make the disk-cacher thread unnecessary, if supported, by simply mapping slabs into the disk cache file
  * - can we find a way to fall back to mem_cache when the disk cache gets ENOSPC? Does it even make sense to try, since this would change the part size?
  * - distinguish some permanent device errors and do not retry the part? (this will be a change of behavior)
  */
@@ -64,10 +63,27 @@ typedef struct Slab {
      * transfer is at EOF. */
     gsize size;
 
-    /* base of the slab_size buffer */
+    /* base of the slab buffer, and the size it was allocated with */
     gchar *base;
+    gsize buf_size;
 } Slab;
 
+/*
+ * Slab pool
+ *
+ * Freed slabs are kept in a process-wide pool, up to slab_pool_max bytes of
+ * buffers, so that later parts and later transfers can reuse them instead of
+ * going back to malloc for every slab.  The pool is linked through the slabs'
+ * 'next' pointers.
+ */
+
+#define DEFAULT_SLAB_POOL_MAX (64*1024*1024)
+
+static GStaticMutex slab_pool_mutex = G_STATIC_MUTEX_INIT;
+static Slab *slab_pool = NULL;
+static gsize slab_pool_bytes = 0;
+static gsize slab_pool_max = DEFAULT_SLAB_POOL_MAX;
+
 /*
  * Xfer Dest Taper
  */
@@ -100,12 +116,8 @@ typedef struct XferDestTaperCacher {
      * threads
      */
 
-    /* The thread doing the actual writes to tape; this also handles buffering
-     * for streaming */
-    GThread *device_thread;
-
     /* The thread writing slabs to the disk cache, if any */
-    GThread *disk_cache_thread;
+    XferThread *disk_cache_thread;
 
     /* slab train
      *
@@ -151,6 +163,10 @@ typedef struct XferDestTaperCacher {
     Slab *volatile mem_cache_slab;
     Slab *volatile device_slab;
 
+    /* if true, the device thread is waiting for data to accumulate in the
+     * disk cache, and the reader must not point device_slab to new slabs */
+    volatile gboolean device_spilled;
+
     /* tail and head of the slab train */
     Slab *volatile oldest_slab;
     Slab *volatile newest_slab;
@@ -243,6 +259,11 @@ typedef struct XferDestTaperCacher {
     /* number of slabs in a part */
     guint64 slabs_per_part;
 
+    /* when the device catches up with the reader, the number of slabs left to
+     * accumulate in the disk cache before writing again, or 0 to only
+     * prebuffer in memory */
+    guint64 spill_slabs;
+
     crc_t crc_before_part;
 } XferDestTaperCacher;
 
@@ -280,6 +301,68 @@ _xdt_dbg(const char *fmt, ...)
  * Slab handling
  */
 
+/* Take a slab with a SIZE-byte buffer from the pool, or return NULL if there
+ * is none. */
+static Slab *
+slab_pool_get(
+    gsize size)
+{
+    Slab *slab, **slabp;
+
+    g_static_mutex_lock(&slab_pool_mutex);
+    for (slabp = &slab_pool; *slabp; slabp = &(*slabp)->next) {
+	if ((*slabp)->buf_size == size)
+	    break;
+    }
+    slab = *slabp;
+    if (slab) {
+	*slabp = slab->next;
+	slab_pool_bytes -= slab->buf_size;
+	slab->next = NULL;
+    }
+    g_static_mutex_unlock(&slab_pool_mutex);
+
+    return slab;
+}
+
+/* Called with slab_pool_mutex held, this frees pooled slabs until the pool
+ * fits in slab_pool_max */
+static void
+slab_pool_trim(void)
+{
+    while (slab_pool && slab_pool_bytes > slab_pool_max) {
+	Slab *slab = slab_pool;
+
+	slab_pool = slab->next;
+	slab_pool_bytes -= slab->buf_size;
+	g_free(slab->base);
+	g_free(slab);
+    }
+}
+
+void
+xfer_dest_taper_cacher_set_spill(
+    XferElement *elt,
+    guint64 resume_bytes)
+{
+    XferDestTaperCacher *self = XFER_DEST_TAPER_CACHER(elt);
+
+    if (!self->disk_cache_dirname)
+	return;
+    self->spill_slabs = MIN(self->slabs_per_part,
+	(resume_bytes + self->slab_size - 1) / self->slab_size);
+}
+
+void
+xfer_dest_taper_cacher_set_slab_pool_max(
+    size_t max_bytes)
+{
+    g_static_mutex_lock(&slab_pool_mutex);
+    slab_pool_max = max_bytes;
+    slab_pool_trim();
+    g_static_mutex_unlock(&slab_pool_mutex);
+}
+
 /* called with the slab_mutex held, this gets a new slab to write into, with
  * refcount 1.  It will block if max_memory slabs are already in use, and mem
  * caching is not in use, although allocation may be forced with the 'force'
@@ -325,6 +408,8 @@ alloc_slab(
     if (self->oldest_slab && self->oldest_slab->refcount == 1) {
 	rv = self->oldest_slab;
 	self->oldest_slab = rv->next;
+    } else if ((rv = slab_pool_get(self->slab_size)) != NULL) {
+	rv->refcount = 1;
     } else {
 	rv = g_new0(Slab, 1);
 	rv->refcount = 1;
@@ -335,6 +420,7 @@ alloc_slab(
 	    g_free(rv);
 	    return NULL;
 	}
+	rv->buf_size = self->slab_size;
     }
 
     rv->next = NULL;
@@ -342,8 +428,9 @@ alloc_slab(
     return rv;
 }
 
-/* called with the slab_mutex held, this frees the given slave entirely.  The
- * reference count is not consulted.
+/* called with the slab_mutex held, this returns the given slab to the slab
+ * pool, or frees it entirely if the pool is full.  The reference count is not
+ * consulted.
  *
  * @param slab: slab to free
  */
@@ -351,11 +438,23 @@ static void
 free_slab(
     Slab *slab)
 {
-    if (slab) {
-	if (slab->base)
-	    g_free(slab->base);
-	g_free(slab);
+    if (!slab)
+	return;
+
+    if (slab->base) {
+	g_static_mutex_lock(&slab_pool_mutex);
+	if (slab_pool_bytes + slab->buf_size <= slab_pool_max) {
+	    slab->next = slab_pool;
+	    slab_pool = slab;
+	    slab_pool_bytes += slab->buf_size;
+	    slab = NULL;
+	}
+	g_static_mutex_unlock(&slab_pool_mutex);
+	if (!slab)
+	    return;
+	g_free(slab->base);
     }
+    g_free(slab);
 }
 
 /* called with the slab_mutex held, this decrements the refcount of the
@@ -409,7 +508,13 @@ next_slab(
  * Disk Cache
  *
  * The disk cache thread's job is simply to follow along the slab train at
- * maximum speed, writing slabs to the disk cache file. */
+ * maximum speed, writing slabs to the disk cache file.  It writes all of the
+ * slabs available behind it with a single writev, and starts the writeback of
+ * what it wrote without waiting for it, so that the kernel does not stall it
+ * later on a mass of dirty pages. */
+
+/* maximum number of slabs written by one writev */
+#define DISK_CACHE_WRITE_SLABS 16
 
 static gboolean
 open_disk_cache_fds(
@@ -444,6 +549,10 @@ open_disk_cache_fds(
 	g_free(filename);
 	return FALSE;
     }
+#ifdef HAVE_POSIX_FADVISE
+    /* a retried part is always read from the beginning */
+    posix_fadvise(self->disk_cache_read_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
 
     /* signal anyone waiting for this value */
     g_cond_broadcast(self->state_cond);
@@ -474,6 +583,10 @@ disk_cache_thread(
     while (!elt->cancelled) {
 	gboolean eof, eop;
 	guint64 stop_serial;
+	struct iovec iov[DISK_CACHE_WRITE_SLABS];
+	int niov, nslabs;
+	off_t offset = 0;
+	gsize len;
 	Slab *slab;
 
 	/* rewind to the begining of the disk cache file */
@@ -529,23 +642,43 @@ disk_cache_thread(
             if (elt->cancelled)
                 break;
 
-	    /* drop the lock long enough to write the slab; the refcount
-	     * protects the slab during this time */
-	    slab = self->disk_cacher_slab;
+	    /* gather the slabs already in the train, up to the end of the part;
+	     * the refcount on disk_cacher_slab protects it and the slabs after
+	     * it while the lock is dropped to write them */
+	    niov = nslabs = 0;
+	    len = 0;
+	    for (slab = self->disk_cacher_slab;
+		 slab && nslabs < DISK_CACHE_WRITE_SLABS && !eof && !eop;
+		 slab = slab->next) {
+		if (slab->size) {
+		    iov[niov].iov_base = slab->base;
+		    iov[niov].iov_len = slab->size;
+		    niov++;
+		    len += slab->size;
+		}
+		nslabs++;
+		eof = slab->size < self->slab_size;
+		eop = (slab->serial + 1 == stop_serial);
+	    }
 	    g_mutex_unlock(self->slab_mutex);
 
-	    if (full_write(self->disk_cache_write_fd, slab->base, slab->size) < slab->size) {
+	    if (niov && full_writev(self->disk_cache_write_fd, iov, niov) < 0) {
 		xfer_cancel_with_error(XFER_ELEMENT(self),
 		    _("Error writing to disk cache file in '%s': %s"), self->disk_cache_dirname,
 		    strerror(errno));
 		return NULL;
 	    }
-
-	    eof = slab->size < self->slab_size;
-	    eop = (slab->serial + 1 == stop_serial);
+#ifdef HAVE_SYNC_FILE_RANGE
+	    if (len && sync_file_range(self->disk_cache_write_fd, offset, len,
+				       SYNC_FILE_RANGE_WRITE) == -1) {
+		DBG(1, "sync_file_range failed: %s", strerror(errno));
+	    }
+#endif
+	    offset += len;
 
 	    g_mutex_lock(self->slab_mutex);
-	    next_slab(self, &self->disk_cacher_slab);
+	    while (nslabs--)
+		next_slab(self, &self->disk_cacher_slab);
 	}
 	g_mutex_unlock(self->slab_mutex);
 
@@ -572,15 +705,85 @@ disk_cache_thread(
  * function invocation.
  */
 
-/* This struct tracks the current state of the slab source */
+/* number of slabs read ahead from the disk cache when retrying a part */
+#define DISK_CACHE_READAHEAD 4
+
+/* This struct tracks the current state of the slab source.  When a part is
+ * retried from the disk cache, a readahead thread reads the slabs that are no
+ * longer in memory into free_slabs and queues them on full_slabs, while the
+ * device thread writes the previous ones to the device.  The queues, next_serial,
+ * stop and errmsg are protected by the mutex. */
 typedef struct slab_source_state {
-    /* temporary slab used for reading from disk */
+    XferDestTaperCacher *self;
+
+    XferThread *readahead_thread;
+    GMutex *mutex;
+    GCond *cond;
+    GQueue *full_slabs;
+    GQueue *free_slabs;
+
+    /* slab read from disk, in use by the device thread */
     Slab *tmp_slab;
 
-    /* next serial to read from disk */
+    /* next serial to read from disk, and the first serial in memory */
     guint64 next_serial;
+    guint64 stop_serial;
+
+    /* set to stop the readahead thread */
+    gboolean stop;
+
+    /* error from the readahead thread */
+    char *errmsg;
 } slab_source_state;
 
+static inline void slab_source_free(XferDestTaperCacher *self,
+				    slab_source_state *state);
+
+static gpointer
+disk_readahead_thread(
+    gpointer data)
+{
+    slab_source_state *state = (slab_source_state *)data;
+    XferDestTaperCacher *self = state->self;
+
+    DBG(1, "(this is the disk readahead thread)");
+
+    g_mutex_lock(state->mutex);
+    while (!state->stop && state->next_serial < state->stop_serial) {
+	gsize bytes_read;
+	int err = 0;
+	Slab *slab;
+
+	while (g_queue_is_empty(state->free_slabs) && !state->stop) {
+	    DBG(9, "waiting for a free readahead slab");
+	    g_cond_wait(state->cond, state->mutex);
+	}
+	if (state->stop)
+	    break;
+
+	slab = g_queue_pop_head(state->free_slabs);
+	slab->serial = state->next_serial++;
+	g_mutex_unlock(state->mutex);
+
+	bytes_read = read_fully(self->disk_cache_read_fd, slab->base,
+	    self->slab_size, &err);
+
+	g_mutex_lock(state->mutex);
+	if (bytes_read < self->slab_size) {
+	    state->errmsg = g_strdup(err ? strerror(err) : _("Unexpected EOF"));
+	    g_queue_push_tail(state->free_slabs, slab);
+	    g_cond_broadcast(state->cond);
+	    break;
+	}
+	slab->size = self->slab_size;
+	g_queue_push_tail(state->full_slabs, slab);
+	g_cond_broadcast(state->cond);
+    }
+    g_mutex_unlock(state->mutex);
+
+    return NULL;
+}
+
 /* Called with the slab_mutex held, this function pre-buffers enough data into the slab
  * train to meet the device's streaming needs. */
 static gboolean
@@ -628,6 +831,85 @@ slab_source_prebuffer(
     return TRUE;
 }
 
+/* Called without the slab_mutex held, this starts the readahead thread
+ * reading the slabs from first_serial up to stop_serial from the disk cache,
+ * after stopping any previous readahead. */
+static gboolean
+slab_source_read_disk(
+    XferDestTaperCacher *self,
+    slab_source_state *state,
+    guint64 first_serial,
+    guint64 stop_serial)
+{
+    XferElement *elt = XFER_ELEMENT(self);
+    guint64 nreadahead, i;
+
+    slab_source_free(self, state);
+    state->next_serial = first_serial;
+    state->stop_serial = stop_serial;
+    state->stop = FALSE;
+    state->mutex = g_mutex_new();
+    state->cond = g_cond_new();
+    state->full_slabs = g_queue_new();
+    state->free_slabs = g_queue_new();
+
+    /* get new, temporary slabs for use while reading */
+    g_mutex_lock(self->slab_mutex);
+    nreadahead = MIN(DISK_CACHE_READAHEAD, stop_serial - first_serial);
+    for (i = 0; i < nreadahead; i++) {
+	Slab *slab = alloc_slab(self, TRUE);
+
+	if (!slab) {
+	    /* if we couldn't allocate a slab, then we're cancelled, so
+	     * we're done with this part. */
+	    g_mutex_unlock(self->slab_mutex);
+	    self->last_part_successful = FALSE;
+	    self->no_more_parts = TRUE;
+	    return FALSE;
+	}
+	g_queue_push_tail(state->free_slabs, slab);
+    }
+    g_mutex_unlock(self->slab_mutex);
+
+    /* We're reading from the disk cache, so we need a file descriptor
+     * to read from, so wait for disk_cache_thread to open the
+     * disk_cache_read_fd */
+    g_assert(self->disk_cache_dirname);
+    g_mutex_lock(self->state_mutex);
+    while (self->disk_cache_read_fd == -1 && !elt->cancelled) {
+	DBG(9, "waiting for disk_cache_thread to set disk_cache_read_fd");
+	g_cond_wait(self->state_cond, self->state_mutex);
+    }
+    DBG(9, "slab_source_read_disk done waiting");
+    g_mutex_unlock(self->state_mutex);
+
+    if (elt->cancelled) {
+	self->last_part_successful = FALSE;
+	self->no_more_parts = TRUE;
+	return FALSE;
+    }
+
+    /* seek to the first slab; the disk cache holds the current part */
+    if (lseek(self->disk_cache_read_fd,
+	      (off_t)((first_serial - self->part_first_serial) * self->slab_size),
+	      SEEK_SET) == -1) {
+	xfer_cancel_with_error(XFER_ELEMENT(self),
+	    _("Could not seek disk cache file for reading: %s"),
+	    strerror(errno));
+	self->last_part_successful = FALSE;
+	self->no_more_parts = TRUE;
+	return FALSE;
+    }
+
+    /* and start reading ahead */
+    if (nreadahead) {
+	state->readahead_thread = xfer_thread_create(disk_readahead_thread,
+						     (gpointer)state);
+    }
+
+    return TRUE;
+}
+
 /* Called without the slab_mutex held, this function sets up a new slab_source_state
  * object based on the configuratino of the Xfer Element. */
 static inline gboolean
@@ -635,9 +917,9 @@ slab_source_setup(
     XferDestTaperCacher *self,
     slab_source_state *state)
 {
-    XferElement *elt = XFER_ELEMENT(self);
-    state->tmp_slab = NULL;
-    state->next_serial = G_MAXUINT64;
+    guint64 first_serial, stop_serial;
+
+    state->self = self;
 
     /* if we're to retry the part, rewind to the beginning */
     if (self->retry_part) {
@@ -668,49 +950,13 @@ slab_source_setup(
 		next_slab(self, &self->device_slab);
 	    }
 
-	    /* get a new, temporary slab for use while reading */
-	    state->tmp_slab = alloc_slab(self, TRUE);
-
+	    /* the slabs before device_slab must be read from the disk cache */
+	    first_serial = self->part_first_serial;
+	    stop_serial = self->device_slab->serial;
 	    g_mutex_unlock(self->slab_mutex);
 
-	    if (!state->tmp_slab) {
-                /* if we couldn't allocate a slab, then we're cancelled, so we're done with
-                 * this part. */
-		self->last_part_successful = FALSE;
-		self->no_more_parts = TRUE;
+	    if (!slab_source_read_disk(self, state, first_serial, stop_serial))
 		return FALSE;
-	    }
-
-	    state->tmp_slab->size = self->slab_size;
-	    state->next_serial = self->part_first_serial;
-
-	    /* We're reading from the disk cache, so we need a file descriptor
-	     * to read from, so wait for disk_cache_thread to open the
-	     * disk_cache_read_fd */
-	    g_assert(self->disk_cache_dirname);
-	    g_mutex_lock(self->state_mutex);
-	    while (self->disk_cache_read_fd == -1 && !elt->cancelled) {
-		DBG(9, "waiting for disk_cache_thread to set disk_cache_read_fd");
-		g_cond_wait(self->state_cond, self->state_mutex);
-	    }
-	    DBG(9, "slab_source_setup done waiting");
-	    g_mutex_unlock(self->state_mutex);
-
-	    if (elt->cancelled) {
-		self->last_part_successful = FALSE;
-		self->no_more_parts = TRUE;
-		return FALSE;
-	    }
-
-	    /* rewind to the beginning */
-	    if (lseek(self->disk_cache_read_fd, 0, SEEK_SET) == -1) {
-		xfer_cancel_with_error(XFER_ELEMENT(self),
-		    _("Could not seek disk cache file for reading: %s"),
-		    strerror(errno));
-		self->last_part_successful = FALSE;
-		self->no_more_parts = TRUE;
-		return FALSE;
-	    }
 	}
     }
 
@@ -740,24 +986,39 @@ slab_source_get_from_disk(
     guint64 serial)
 {
     XferDestTaper *xdt = XFER_DEST_TAPER(self);
-    gsize bytes_read;
+    char *errmsg = NULL;
 
-    g_assert(state->next_serial == serial);
+    g_assert(serial < state->stop_serial);
 
     /* NOTE: slab_mutex is held, but we don't need it here, so release it for the moment */
     g_mutex_unlock(self->slab_mutex);
 
-    bytes_read = read_fully(self->disk_cache_read_fd, state->tmp_slab->base,
-        self->slab_size, NULL);
+    /* hand the previous slab back to the readahead thread, and wait for the
+     * next one */
+    g_mutex_lock(state->mutex);
+    if (state->tmp_slab) {
+	g_queue_push_tail(state->free_slabs, state->tmp_slab);
+	state->tmp_slab = NULL;
+	g_cond_broadcast(state->cond);
+    }
+    while (g_queue_is_empty(state->full_slabs) && !state->errmsg) {
+	DBG(9, "waiting for the readahead thread");
+	g_cond_wait(state->cond, state->mutex);
+    }
+    if (!g_queue_is_empty(state->full_slabs))
+	state->tmp_slab = g_queue_pop_head(state->full_slabs);
+    else
+	errmsg = g_strdup(state->errmsg);
+    g_mutex_unlock(state->mutex);
 
-    if (bytes_read < self->slab_size) {
+    if (!state->tmp_slab) {
 	xfer_cancel_with_error(XFER_ELEMENT(xdt),
-	    _("Error reading disk cache: %s"),
-	    errno ? strerror(errno) : _("Unexpected EOF"));
+	    _("Error reading disk cache: %s"), errmsg);
+	g_free(errmsg);
 	goto fatal_error;
     }
 
-    state->tmp_slab->serial = state->next_serial++;
+    g_assert(state->tmp_slab->serial == serial);
     g_mutex_lock(self->slab_mutex);
     return state->tmp_slab;
 
@@ -768,6 +1029,63 @@ fatal_error:
     return NULL;
 }
 
+/* Called with the slab_mutex held when the device thread has caught up with
+ * the reader, this waits until spill_slabs slabs from the given serial on are
+ * in the slab train, or the end of the part or of the data.  Meanwhile the
+ * device thread holds no slab, so the reader only waits for the disk cache,
+ * and the slabs that do not fit in memory stay in the disk cache: the device
+ * is not stopped and started again for each slab a slow client sends.  The
+ * slabs that were dropped from memory are then read back by the readahead
+ * thread.  Note that the slab_mutex may be released during execution,
+ * although it is always held on return. */
+static gboolean
+slab_source_spill(
+    XferDestTaperCacher *self,
+    slab_source_state *state,
+    guint64 serial)
+{
+    XferElement *elt = XFER_ELEMENT(self);
+    Slab *slab;
+    guint64 stop_serial;
+    gboolean ok;
+
+    self->device_spilled = TRUE;
+    while (!elt->cancelled) {
+	slab = self->newest_slab;
+	if (slab && slab->serial >= serial &&
+	    (slab->serial + 1 - serial >= self->spill_slabs ||
+	     slab->size < self->slab_size ||
+	     slab->serial + 1 >= self->part_stop_serial))
+	    break;
+	DBG(9, "waiting for slabs to accumulate in the disk cache");
+	g_cond_wait(self->slab_cond, self->slab_mutex);
+    }
+    self->device_spilled = FALSE;
+    DBG(9, "slab_source_spill done waiting");
+
+    if (elt->cancelled) {
+	self->last_part_successful = FALSE;
+	self->no_more_parts = TRUE;
+	return FALSE;
+    }
+
+    /* follow the train again from the first slab still in memory */
+    for (slab = self->oldest_slab; slab->serial < serial; slab = slab->next)
+	;
+    slab->refcount++;
+    self->device_slab = slab;
+    if (slab->serial == serial)
+	return TRUE;
+
+    stop_serial = slab->serial;
+    DBG(2, "reading slabs %ju to %ju back from the disk cache",
+	(uintmax_t)serial, (uintmax_t)stop_serial);
+    g_mutex_unlock(self->slab_mutex);
+    ok = slab_source_read_disk(self, state, serial, stop_serial);
+    g_mutex_lock(self->slab_mutex);
+    return ok;
+}
+
 /* Called with the slab_mutex held, this function gets the slab with the given
  * serial number, waiting if necessary for that slab to be available.  Note
  * that the slab_mutex may be released during execution, although it is always
@@ -783,8 +1101,14 @@ slab_source_get(
     /* device_slab is only NULL if we're following the slab train, so wait for
      * a new slab */
     if (!self->device_slab) {
+	/* a streaming device waits for data in the disk cache, if any */
+	if (self->spill_slabs &&
+	    (self->streaming == STREAMING_REQUIREMENT_DESIRED ||
+	     self->streaming == STREAMING_REQUIREMENT_REQUIRED)) {
+	    if (!slab_source_spill(self, state, serial))
+		return NULL;
 	/* if the streaming mode requires it, pre-buffer */
-	if (self->streaming == STREAMING_REQUIREMENT_DESIRED) {
+	} else if (self->streaming == STREAMING_REQUIREMENT_DESIRED) {
 	    if (!slab_source_prebuffer(self))
 		return NULL;
 
@@ -820,18 +1144,48 @@ fatal_error:
     return NULL;
 }
 
-/* Called without the slab_mutex held, this frees any resources assigned
- * to the slab source state */
+/* Called without the slab_mutex held, this stops the readahead thread and
+ * frees any resources assigned to the slab source state */
 static inline void
 slab_source_free(
     XferDestTaperCacher *self,
     slab_source_state *state)
 {
-    if (state->tmp_slab) {
-	g_mutex_lock(self->slab_mutex);
-	free_slab(state->tmp_slab);
-	g_mutex_unlock(self->slab_mutex);
+    Slab *slab;
+
+    if (state->readahead_thread) {
+	g_mutex_lock(state->mutex);
+	state->stop = TRUE;
+	g_cond_broadcast(state->cond);
+	g_mutex_unlock(state->mutex);
+	xfer_thread_join(state->readahead_thread);
+	state->readahead_thread = NULL;
+    }
+
+    g_mutex_lock(self->slab_mutex);
+    free_slab(state->tmp_slab);
+    state->tmp_slab = NULL;
+    if (state->full_slabs) {
+	while ((slab = g_queue_pop_head(state->full_slabs)) != NULL)
+	    free_slab(slab);
+	g_queue_free(state->full_slabs);
+	state->full_slabs = NULL;
     }
+    if (state->free_slabs) {
+	while ((slab = g_queue_pop_head(state->free_slabs)) != NULL)
+	    free_slab(slab);
+	g_queue_free(state->free_slabs);
+	state->free_slabs = NULL;
+    }
+    g_mutex_unlock(self->slab_mutex);
+
+    if (state->mutex) {
+	g_mutex_free(state->mutex);
+	g_cond_free(state->cond);
+	state->mutex = NULL;
+    }
+    g_free(state->errmsg);
+    state->errmsg = NULL;
 }
 
 /* Called without the slab_mutex, this writes the given slab to the device */
@@ -859,6 +1213,7 @@ write_slab_to_device(
 	}
 
 	crc32_add((uint8_t *)buf, write_size, &elt->crc);
+	xfer_dest_taper_digest_add(XFER_DEST_TAPER(self), buf, write_size);
 	buf += write_size;
 	self->slab_bytes_written += write_size;
 	remaining -= write_size;
@@ -882,16 +1237,17 @@ device_thread_write_part(
     XferElement *elt = XFER_ELEMENT(self);
     GTimer *timer = g_timer_new();
     XMsg *msg;
-    slab_source_state src_state = {0, 0};
+    slab_source_state src_state;
     guint64 serial, stop_serial;
     gboolean eof = FALSE;
     int fileno = 0;
     int failed = 0;
-    int slab_source_set = 0;
 
+    memset(&src_state, 0, sizeof(src_state));
     self->last_part_successful = FALSE;
     self->bytes_written = 0;
     self->crc_before_part = elt->crc;
+    xfer_dest_taper_digest_start_part(XFER_DEST_TAPER(self));
 
     if (!device_start_file(self->device, self->part_header)) {
 	failed = 1;
@@ -906,7 +1262,6 @@ device_thread_write_part(
 
     if (!slab_source_setup(self, &src_state))
 	goto part_done;
-    slab_source_set = 1;
 
     g_timer_start(timer);
 
@@ -945,9 +1300,7 @@ part_done:
     if (self->device->in_file && !device_finish_file(self->device))
 	failed = 1;
 
-    if (slab_source_set) {
-	slab_source_free(self, &src_state);
-    }
+    slab_source_free(self, &src_state);
 
     if (!failed) {
 	self->last_part_successful = TRUE;
@@ -966,6 +1319,7 @@ part_done:
     msg->successful = self->last_part_successful;
     msg->eom = !self->last_part_successful;
     msg->eof = self->no_more_parts;
+    xfer_dest_taper_digest_part_done(XFER_DEST_TAPER(self), msg);
 
     /* time runs backward on some test boxes, so make sure this is positive */
     if (msg->duration < 0) msg->duration = 0;
@@ -1012,12 +1366,7 @@ device_thread(
     DBG(1, "(this is the device thread)");
 
     if (self->disk_cache_dirname) {
-        GError *error = NULL;
-	self->disk_cache_thread = g_thread_create(disk_cache_thread, (gpointer)self, TRUE, &error);
-        if (!self->disk_cache_thread) {
-            g_critical(_("Error creating new thread: %s (%s)"),
-                error->message, errno? strerror(errno) : _("no error code"));
-        }
+	self->disk_cache_thread = xfer_thread_create(disk_cache_thread, (gpointer)self);
     }
 
     /* This is the outer loop, that loops once for each split part written to
@@ -1060,7 +1409,7 @@ device_thread(
 
     /* make sure the other thread is done before we send XMSG_DONE */
     if (self->disk_cache_thread)
-        g_thread_join(self->disk_cache_thread);
+        xfer_thread_join(self->disk_cache_thread);
 
     g_debug("sending XMSG_CRC message");
     g_debug("xfer-dest-taper-cacher CRC %08x      size %lld",
@@ -1068,6 +1417,7 @@ device_thread(
     msg = xmsg_new(XFER_ELEMENT(self), XMSG_CRC, 0);
     msg->crc = crc32_finish(&elt->crc);
     msg->size = elt->crc.size;
+    xfer_dest_taper_digest_image_done(XFER_DEST_TAPER(self), msg);
     xfer_queue_message(elt->xfer, msg);
 
     /* tell the main thread we're done */
@@ -1111,7 +1461,7 @@ add_reader_slab_to_train(
 	self->mem_cache_slab = slab;
 	slab->refcount++;
     }
-    if (!self->device_slab) {
+    if (!self->device_slab && !self->device_spilled) {
 	self->device_slab = slab;
 	slab->refcount++;
     }
@@ -1213,8 +1563,7 @@ push_buffer_impl(
 {
     push_buffer_static_impl(elt, buf, size);
 
-    if (buf)
-        g_free(buf);
+    xfer_element_free_buffer(elt, buf);
 }
 
 /*
@@ -1226,13 +1575,10 @@ start_impl(
     XferElement *elt)
 {
     XferDestTaperCacher *self = (XferDestTaperCacher *)elt;
-    GError *error = NULL;
 
-    self->device_thread = g_thread_create(device_thread, (gpointer)self, FALSE, &error);
-    if (!self->device_thread) {
-        g_critical(_("Error creating new thread: %s (%s)"),
-            error->message, errno? strerror(errno) : _("no error code"));
-    }
+    /* the thread doing the actual writes to tape; this also handles
+     * buffering for streaming */
+    xfer_thread_run(device_thread, (gpointer)self);
 
     return TRUE;
 }
@@ -1368,6 +1714,7 @@ instance_init(
 {
     XferDestTaperCacher *self = XFER_DEST_TAPER_CACHER(elt);
     elt->can_generate_eof = FALSE;
+    elt->releases_buffers = TRUE;
 
     self->state_mutex = g_mutex_new();
     self->state_cond = g_cond_new();
@@ -1560,6 +1907,11 @@ xfer_dest_taper_cacher(
     if (self->max_slabs < 2)
         self->max_slabs = 2;
 
+    /* with a disk cache, a device that caught up with the reader waits for the
+     * rest of the part there */
+    if (self->disk_cache_dirname)
+	self->spill_slabs = self->slabs_per_part;
+
     DBG(1, "using slab_size %zu and max_slabs %ju", self->slab_size, (uintmax_t)self->max_slabs);
 
     return XFER_ELEMENT(self);
@@ -51,9 +51,6 @@ typedef struct XferDestTaperDirectTCP {
     /* constructor parameters */
     guint64 part_size; /* (bytes) */
 
-    /* thread */
-    GThread *worker_thread;
-
     /* state (governs everything below) */
     GMutex *state_mutex;
 
@@ -314,16 +311,11 @@ start_impl(
     XferElement *elt)
 {
     XferDestTaperDirectTCP *self = (XferDestTaperDirectTCP *)elt;
-    GError *error = NULL;
 
     self->paused = TRUE;
 
     /* start up the thread */
-    self->worker_thread = g_thread_create(worker_thread, (gpointer)self, TRUE, &error);
-    if (!self->worker_thread) {
-	g_critical(_("Error creating new thread: %s (%s)"),
-	    error->message, errno? strerror(errno) : _("no error code"));
-    }
+    xfer_thread_run(worker_thread, (gpointer)self);
 
     return TRUE;
 }
@@ -430,7 +422,6 @@ instance_init(
     XferDestTaperDirectTCP *self = XFER_DEST_TAPER_DIRECTTCP(elt);
     elt->can_generate_eof = FALSE;
 
-    self->worker_thread = NULL;
     self->paused = TRUE;
     self->conn = NULL;
     self->state_mutex = g_mutex_new();
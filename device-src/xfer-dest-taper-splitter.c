@@ -61,6 +61,15 @@ typedef struct FileSlice {
     guint64 length;
 } FileSlice;
 
+struct XferDestTaperSplitter;
+
+/* A ring block written with device_write_block_ref */
+typedef struct LentBlock {
+    struct XferDestTaperSplitter *self;
+    gsize size;
+    gboolean released;
+} LentBlock;
+
 /*
  * Xfer Dest Taper
  */
@@ -89,16 +98,21 @@ typedef struct XferDestTaperSplitter {
     /* TRUE if this element is expecting slices via cache_inform */
     gboolean expect_cache_inform;
 
-    /* The thread doing the actual writes to tape; this also handles buffering
-     * for streaming */
-    GThread *device_thread;
-
     /* Ring Buffer */
     GMutex *ring_mutex;
     GCond *ring_cond;
     mem_ring_t *mem_ring;
     gboolean    ring_ready;
 
+    /* Blocks lent to the device, oldest first.  They stay in the ring until
+     * the device releases them, and are then consumed in order by the device
+     * thread.  lent_bytes is only touched by the device thread; the device
+     * marks a LentBlock released under lent_mutex. */
+    GMutex *lent_mutex;
+    GCond *lent_cond;
+    GQueue *lent_blocks;
+    gsize lent_bytes;
+
     /* Element State
      *
      * "state" includes all of the variables below (including device
@@ -116,6 +130,10 @@ typedef struct XferDestTaperSplitter {
     Device *volatile device;
     dumpfile_t *volatile part_header;
 
+    /* the header given to the last start_part, for the parts the element
+     * starts by itself */
+    dumpfile_t *auto_header;
+
     /* bytes to read from cached slices before reading from the ring buffer */
     guint64 bytes_to_read_from_slices;
     guint64 max_memory;
@@ -351,15 +369,39 @@ iterator_free(
  * Device Thread
  */
 
-/* Wait for at least one block, or EOF, to be available in the ring buffer.
- * Called with the ring mutex held. */
+/* How many bytes may stay lent while waiting for the next block: with more,
+ * the producer could have no room for that block. */
+static gsize
+device_thread_lend_limit(
+    XferDestTaperSplitter *self)
+{
+    XferElement *elt = XFER_ELEMENT(self);
+    gsize ring_size, max_ring_block_size;
+
+    if (self->mem_ring) {
+	ring_size = self->mem_ring->ring_size;
+	max_ring_block_size = MAX(self->mem_ring->producer_block_size,
+				  self->mem_ring->consumer_block_size);
+    } else {
+	ring_size = elt->shm_ring->ring_size;
+	max_ring_block_size = MAX(elt->shm_ring->mc->producer_block_size,
+				  elt->shm_ring->mc->consumer_block_size);
+    }
+
+    if (ring_size < max_ring_block_size + self->device->block_size)
+	return 0;
+    return ring_size - max_ring_block_size - self->device->block_size;
+}
+
+/* Wait for at least one block, or EOF, to be available in the ring buffer
+ * after the lent blocks, and return how many bytes are. */
 static gsize
 device_thread_wait_for_block(
     XferDestTaperSplitter *self,
     gboolean *eof_flag)
 {
     XferElement *elt = XFER_ELEMENT(self);
-    gsize bytes_needed = self->device->block_size;
+    gsize bytes_needed = self->lent_bytes + self->device->block_size;
     gsize usable = 0;
 
     *eof_flag = FALSE;
@@ -373,27 +415,14 @@ device_thread_wait_for_block(
 	if (self->part_bytes_written == 0 && self->streaming != STREAMING_REQUIREMENT_NONE)
 	    bytes_needed = self->mem_ring->ring_size - max_ring_block_size;
 
-	while (1) {
-	    /* are we ready? */
-	    if (elt->cancelled)
-		break;
-
-	    usable = self->mem_ring->written - self->mem_ring->readx;
-	    *eof_flag = self->mem_ring->eof_flag;
-	    if (usable >= bytes_needed) {
-		break;
-	    }
-
-	    if (self->mem_ring->eof_flag)
-		break;
-
-	    /* nope - so wait */
-	    g_cond_wait(self->mem_ring->add_cond, self->mem_ring->mutex);
-
+	/* are we ready? (the ring sets eof_flag when we are cancelled) */
+	usable = mem_ring_wait_for_data(self->mem_ring, 0, eof_flag);
+	if (usable < bytes_needed && !*eof_flag && !elt->cancelled) {
 	    /* in STREAMING_REQUIREMENT_REQUIRED, once we decide to wait for more bytes,
 	     * we need to wait for the entire buffer to fill */
 	    if (self->streaming == STREAMING_REQUIREMENT_REQUIRED)
 		bytes_needed = self->mem_ring->ring_size - max_ring_block_size;
+	    usable = mem_ring_wait_for_data(self->mem_ring, bytes_needed, eof_flag);
 	}
 
     } else { // shm_ring
@@ -427,14 +456,16 @@ device_thread_wait_for_block(
 	    xfer_cancel_with_error(elt, "shm_ring_cancelled");
 	}
     }
+
+    /* the lent blocks are still counted in the ring */
+    usable -= MIN(usable, self->lent_bytes);
     if (self->part_size)
        usable = MIN(usable, self->part_size - self->part_bytes_written);
 
     return usable;
 }
 
-/* Mark readx bytes as free in the ring buffer.  Called with the ring mutex
- * held. */
+/* Mark readx bytes as free in the ring buffer. */
 static void
 device_thread_consume_block(
     XferDestTaperSplitter *self,
@@ -444,12 +475,7 @@ device_thread_consume_block(
     uint64_t read_offset;
 
     if (self->mem_ring) {
-	read_offset = self->mem_ring->read_offset + readx;
-	if (read_offset >= self->mem_ring->ring_size)
-	    read_offset -= self->mem_ring->ring_size;
-	self->mem_ring->readx += readx;
-	self->mem_ring->read_offset = read_offset;
-	g_cond_broadcast(self->mem_ring->free_cond);
+	mem_ring_consumed(self->mem_ring, readx);
     } else { // shm_ring
 	read_offset = elt->shm_ring->mc->read_offset + readx;
 	if (read_offset >= elt->shm_ring->ring_size)
@@ -460,6 +486,88 @@ device_thread_consume_block(
     }
 }
 
+/* Called by the device once it is done with a lent block */
+static void
+device_thread_block_released(
+    gpointer data)
+{
+    LentBlock *lent = data;
+    XferDestTaperSplitter *self = lent->self;
+
+    g_mutex_lock(self->lent_mutex);
+    lent->released = TRUE;
+    g_cond_broadcast(self->lent_cond);
+    g_mutex_unlock(self->lent_mutex);
+}
+
+/* Consume the released blocks at the head of the lent queue, waiting for
+ * more to be released until at most KEEP bytes are still lent. */
+static void
+device_thread_reclaim_blocks(
+    XferDestTaperSplitter *self,
+    gsize keep)
+{
+    LentBlock *lent;
+
+    g_mutex_lock(self->lent_mutex);
+    while (1) {
+	while ((lent = g_queue_peek_head(self->lent_blocks)) && lent->released) {
+	    g_queue_pop_head(self->lent_blocks);
+	    self->lent_bytes -= lent->size;
+	    device_thread_consume_block(self, lent->size);
+	    g_free(lent);
+	}
+	if (!lent || self->lent_bytes <= keep)
+	    break;
+	g_cond_wait(self->lent_cond, self->lent_mutex);
+    }
+    g_mutex_unlock(self->lent_mutex);
+}
+
+/* Write a block from the ring without having the device copy it.  On
+ * success the block is lent and is consumed once the device releases it. */
+static DeviceWriteResult
+device_thread_write_ring_block(
+    XferDestTaperSplitter *self,
+    gsize to_write,
+    gpointer buf)
+{
+    LentBlock *lent = g_new0(LentBlock, 1);
+    DeviceWriteResult ok;
+
+    lent->self = self;
+    lent->size = to_write;
+    g_mutex_lock(self->lent_mutex);
+    g_queue_push_tail(self->lent_blocks, lent);
+    g_mutex_unlock(self->lent_mutex);
+    self->lent_bytes += to_write;
+
+    ok = device_write_block_ref(self->device, (guint)to_write, buf,
+				device_thread_block_released, lent);
+    if (ok != WRITE_SPACE)
+	goto done;
+
+    /* the device did not take the block; retry_write has it copied, so it
+     * can go once the blocks ahead of it do */
+    ok = retry_write(self, to_write, buf);
+    if (ok == WRITE_SUCCEED) {
+	g_mutex_lock(self->lent_mutex);
+	lent->released = TRUE;
+	g_mutex_unlock(self->lent_mutex);
+    }
+
+done:
+    if (ok != WRITE_SUCCEED) {
+	g_mutex_lock(self->lent_mutex);
+	g_queue_pop_tail(self->lent_blocks);
+	g_mutex_unlock(self->lent_mutex);
+	self->lent_bytes -= to_write;
+	g_free(lent);
+    }
+
+    return ok;
+}
+
 /* Write an entire part.  Called with the state_mutex held */
 static XMsg *
 device_thread_write_part(
@@ -475,6 +583,7 @@ device_thread_write_part(
 
     self->part_bytes_written = 0;
     self->crc_before_part = elt->crc;
+    xfer_dest_taper_digest_start_part(XFER_DEST_TAPER(self));
 
     g_timer_start(timer);
 
@@ -538,6 +647,7 @@ device_thread_write_part(
 	    self->part_bytes_written += to_write;
 	    bytes_from_slices -= to_write;
 	    crc32_add((uint8_t *)buf, to_write, &elt->crc);
+	    xfer_dest_taper_digest_add(XFER_DEST_TAPER(self), buf, to_write);
 
 	    if (self->part_size && self->part_bytes_written >= self->part_size) {
 		part_status = PART_EOP;
@@ -558,12 +668,15 @@ device_thread_write_part(
 	    goto part_done;
     }
 
-    if (self->mem_ring)
-	g_mutex_lock(self->mem_ring->mutex);
     while (!elt->cancelled &&
 	   (!elt->shm_ring || !elt->shm_ring->mc->cancelled)) {
 	DeviceWriteResult ok;
 	gboolean eof_flag;
+	gsize offset;
+
+	/* the lent blocks are still in the ring; before waiting on the ring,
+	 * get back enough of them to leave room for the next block */
+	device_thread_reclaim_blocks(self, device_thread_lend_limit(self));
 
 	/* wait for at least one block, and (if necessary) prebuffer */
 	gsize to_writeX = device_thread_wait_for_block(self, &eof_flag);
@@ -574,62 +687,57 @@ device_thread_write_part(
 	    //crc_t block_crc;
 	    gsize to_write = MIN(to_writeX, self->device->block_size);
 	    if (elt->cancelled)
-		goto part_done_unlock;
+		goto part_done;
 
 	    if (to_write == 0) {
 		part_status = PART_EOF;
-		goto part_done_unlock;
+		goto part_done;
 	    }
 
-	    if (self->mem_ring)
-		g_mutex_unlock(self->mem_ring->mutex);
 	    DBG(8, "writing %ju bytes to device", (uintmax_t)to_write);
 
 	    /* note that it's OK to reference these ring_* vars here, as they
 	     * are static at this point */
 	    if (self->mem_ring) {
-		buf = self->mem_ring->buffer + self->mem_ring->read_offset;
+		offset = self->mem_ring->read_offset + self->lent_bytes;
+		if (offset >= self->mem_ring->ring_size)
+		    offset -= self->mem_ring->ring_size;
+		buf = self->mem_ring->buffer + offset;
 	    } else {
-		buf = elt->shm_ring->data + elt->shm_ring->mc->read_offset;
+		offset = elt->shm_ring->mc->read_offset + self->lent_bytes;
+		if (offset >= elt->shm_ring->ring_size)
+		    offset -= elt->shm_ring->ring_size;
+		buf = elt->shm_ring->data + offset;
 	    }
-	    ok = device_write_block(self->device, (guint)to_write, buf);
-
-	    if (ok == WRITE_SPACE)
-	    ok = retry_write(self, to_write, buf);
-
-	    if (self->mem_ring)
-		g_mutex_lock(self->mem_ring->mutex);
+	    ok = device_thread_write_ring_block(self, to_write, buf);
 
 	    if (ok == WRITE_FAILED) {
 		part_status = PART_FAILED;
-		goto part_done_unlock;
+		goto part_done;
 	    } else if (ok == WRITE_FULL) {
 		part_status = PART_EOP;
-		goto part_done_unlock;
+		goto part_done;
 	    } else if (ok == WRITE_SPACE) {
 		part_status = PART_EOP;
-		goto part_done_unlock;
+		goto part_done;
 	    }
 
 	    crc32_add((uint8_t *)(buf),
 			 to_write, &elt->crc);
+	    xfer_dest_taper_digest_add(XFER_DEST_TAPER(self), buf, to_write);
 	    self->part_bytes_written += to_write;
-	    device_thread_consume_block(self, to_write);
+	    device_thread_reclaim_blocks(self, SIZE_MAX);
 
 	    if (self->part_size && self->part_bytes_written >= self->part_size) {
 		part_status = PART_EOP;
-		goto part_done_unlock;
+		goto part_done;
 	    } else if (self->device->is_eom) {
 		part_status = PART_LEOM;
-		goto part_done_unlock;
+		goto part_done;
 	    }
 	    to_writeX -= to_write;
 	}
     }
-part_done_unlock:
-    if (self->mem_ring)
-	g_mutex_unlock(self->mem_ring->mutex);
-
 part_done:
     if (elt->shm_ring) {
 	if (elt->cancelled) {
@@ -657,6 +765,7 @@ part_done:
 	    }
 	}
     }
+    device_thread_reclaim_blocks(self, 0);
 
     g_timer_stop(timer);
     if (part_status == PART_FAILED) {
@@ -671,6 +780,7 @@ part_done:
     msg->successful = self->last_part_successful = part_status != PART_FAILED;
     msg->eom = self->last_part_eom = part_status == PART_LEOM || self->device->is_eom;
     msg->eof = self->last_part_eof = part_status == PART_EOF;
+    xfer_dest_taper_digest_part_done(XFER_DEST_TAPER(self), msg);
 
     /* time runs backward on some test boxes, so make sure this is positive */
     if (msg->duration < 0) msg->duration = 0;
@@ -698,9 +808,12 @@ device_thread(
 
     if (elt->input_mech == XFER_MECH_PUSH_BUFFER) {
 	self->mem_ring = create_mem_ring();
+	mem_ring_producer_set_spsc(self->mem_ring);
+	mem_ring_consumer_set_spsc(self->mem_ring);
 	init_mem_ring(self->mem_ring, self->max_memory, self->device->block_size);
     } else if (elt->input_mech == XFER_MECH_MEM_RING) {
 	self->mem_ring = xfer_element_get_mem_ring(elt->upstream);
+	mem_ring_consumer_set_spsc(self->mem_ring);
 	mem_ring_consumer_set_size(self->mem_ring, self->max_memory, self->device->block_size);
     } else if (elt->input_mech == XFER_MECH_SHM_RING) {
 	shm_ring_consumer_set_size(elt->shm_ring, self->max_memory, self->device->block_size);
@@ -759,12 +872,27 @@ device_thread(
 
 	xfer_queue_message(elt->xfer, msg);
 
-	/* pause ourselves and await instructions from the main thread */
-	self->paused = TRUE;
-
 	/* if this is the last part, we're done with the part loop */
-	if (self->no_more_parts)
+	if (self->no_more_parts) {
+	    self->paused = TRUE;
 	    break;
+	}
+
+	/* with auto_parts, go on with the next part without waiting for the
+	 * main thread, unless it has a decision to make */
+	if (XFER_DEST_TAPER(self)->auto_parts && self->auto_header &&
+	    self->last_part_successful && !self->last_part_eom) {
+	    DBG(2, "device_thread starting part %ju", (uintmax_t)self->partnum);
+	    if (self->part_header)
+		dumpfile_free(self->part_header);
+	    self->part_header = dumpfile_copy(self->auto_header);
+	    self->part_header->partnum = self->partnum;
+	    self->bytes_to_read_from_slices = 0;
+	    continue;
+	}
+
+	/* pause ourselves and await instructions from the main thread */
+	self->paused = TRUE;
     }
     g_mutex_unlock(self->state_mutex);
 
@@ -779,6 +907,7 @@ device_thread(
     msg = xmsg_new(XFER_ELEMENT(self), XMSG_CRC, 0);
     msg->crc = crc32_finish(&elt->crc);
     msg->size = elt->crc.size;
+    xfer_dest_taper_digest_image_done(XFER_DEST_TAPER(self), msg);
     xfer_queue_message(elt->xfer, msg);
 
 device_thread_done:
@@ -813,62 +942,52 @@ push_buffer_impl(
 	while (!self->ring_ready && !elt->cancelled) {
 	    g_cond_wait(self->ring_cond, self->ring_mutex);
 	}
-	if (elt->cancelled)
-	    goto unlock_and_free_and_finish;
 	g_mutex_unlock(self->ring_mutex);
+	if (elt->cancelled)
+	    goto free_and_finish;
     }
 
     /* handle EOF */
     if (G_UNLIKELY(buf == NULL)) {
 	/* indicate EOF to the device thread */
 	g_mutex_lock(self->mem_ring->mutex);
-	self->mem_ring->eof_flag = TRUE;
-	g_cond_broadcast(self->mem_ring->add_cond);
+	mem_ring_set_eof(self->mem_ring);
 	g_mutex_unlock(self->mem_ring->mutex);
 	goto free_and_finish;
     }
 
     /* push the block into the ring buffer, in pieces if necessary */
-    g_mutex_lock(self->mem_ring->mutex);
     while (size > 0) {
 	gsize avail;
+	gint64 start;
 
-	/* wait for some space */
-	while (self->mem_ring->written - self->mem_ring->readx == self->mem_ring->ring_size && !elt->cancelled) {
-	    DBG(9, "push_buffer waiting for any space to buffer pushed data");
-	    g_cond_wait(self->mem_ring->free_cond, self->mem_ring->mutex);
-	}
+	/* wait for some space; this is time spent waiting for the device */
+	DBG(9, "push_buffer waiting for any space to buffer pushed data");
+	start = xfer_stats_clock();
+	avail = mem_ring_wait_for_space(self->mem_ring, 1);
+	xfer_element_add_stats(elt, 0, 0, 0, xfer_stats_clock() - start);
 	DBG(9, "push_buffer done waiting");
 
-	if (elt->cancelled)
-	    goto unlock_and_free_and_finish;
+	if (elt->cancelled || avail == 0)
+	    goto free_and_finish;
 
 	/* only copy to the end of the buffer, if the available space wraps
 	 * around to the beginning */
-	avail = MIN(size, self->mem_ring->ring_size - (self->mem_ring->written - self->mem_ring->readx));
+	avail = MIN(size, avail);
 	avail = MIN(avail, self->mem_ring->ring_size - self->mem_ring->write_offset);
 
 	/* copy AVAIL bytes into the ring buf (knowing it's contiguous) */
 	memmove(self->mem_ring->buffer + self->mem_ring->write_offset, p, avail);
 
-	/* reset the ring variables to represent this state */
-	self->mem_ring->written += avail;
-	self->mem_ring->write_offset += avail; /* will, at most, hit mem_ring->ring_size */
-	if (self->mem_ring->write_offset == self->mem_ring->ring_size)
-	    self->mem_ring->write_offset = 0;
+	/* publish them, and give the device thread a notice that data is
+	 * ready */
+	mem_ring_produced(self->mem_ring, avail);
 	p = (gpointer)((guchar *)p + avail);
 	size -= avail;
-
-	/* and give the device thread a notice that data is ready */
-	g_cond_broadcast(self->mem_ring->add_cond);
     }
 
-unlock_and_free_and_finish:
-    g_mutex_unlock(self->mem_ring->mutex);
-
 free_and_finish:
-    if (buf)
-        g_free(buf);
+    xfer_element_free_buffer(elt, buf);
 }
 
 /*
@@ -880,13 +999,10 @@ start_impl(
     XferElement *elt)
 {
     XferDestTaperSplitter *self = (XferDestTaperSplitter *)elt;
-    GError *error = NULL;
 
-    self->device_thread = g_thread_create(device_thread, (gpointer)self, FALSE, &error);
-    if (!self->device_thread) {
-        g_critical(_("Error creating new thread: %s (%s)"),
-            error->message, errno? strerror(errno) : _("no error code"));
-    }
+    /* the thread doing the actual writes to tape; this also handles
+     * buffering for streaming */
+    xfer_thread_run(device_thread, (gpointer)self);
 
     return TRUE;
 }
@@ -909,23 +1025,19 @@ cancel_impl(
     g_mutex_unlock(self->ring_mutex);
 
     if (elt->shm_ring && !elt->shm_ring->mc->cancelled) {
-	if (!elt->shm_ring->mc->cancelled) {
-	    g_debug("XDTS:cancel_impl: cancelling shm-ring because xfer is cancelled");
-	    elt->shm_ring->mc->cancelled = TRUE;
-	}
-	sem_post(elt->shm_ring->sem_ready);
-	sem_post(elt->shm_ring->sem_start);
-	sem_post(elt->shm_ring->sem_read);
-	sem_post(elt->shm_ring->sem_write);
+	g_debug("XDTS:cancel_impl: cancelling shm-ring because xfer is cancelled");
+	shm_ring_cancel(elt->shm_ring);
     }
     if (self->mem_ring) {
 	g_mutex_lock(self->mem_ring->mutex);
-	self->mem_ring->eof_flag = TRUE;
-	g_cond_broadcast(self->mem_ring->add_cond);
-	g_cond_broadcast(self->mem_ring->free_cond);
+	mem_ring_set_eof(self->mem_ring);
 	g_mutex_unlock(self->mem_ring->mutex);
     }
 
+    /* and interrupt a device write blocked on the network */
+    if (self->device)
+	device_cancel(self->device);
+
     g_mutex_lock(self->state_mutex);
     g_cond_broadcast(self->state_cond);
     g_mutex_unlock(self->state_mutex);
@@ -989,6 +1101,9 @@ start_part_impl(
     if (self->part_header)
 	dumpfile_free(self->part_header);
     self->part_header = dumpfile_copy(header);
+    if (self->auto_header)
+	dumpfile_free(self->auto_header);
+    self->auto_header = dumpfile_copy(header);
 
     DBG(1, "unpausing");
     self->paused = FALSE;
@@ -1103,9 +1218,14 @@ instance_init(
 {
     XferDestTaperSplitter *self = XFER_DEST_TAPER_SPLITTER(elt);
     elt->can_generate_eof = FALSE;
+    elt->releases_buffers = TRUE;
 
     self->ring_mutex = g_mutex_new();
     self->ring_cond = g_cond_new();
+    self->lent_mutex = g_mutex_new();
+    self->lent_cond = g_cond_new();
+    self->lent_blocks = g_queue_new();
+    self->lent_bytes = 0;
     self->state_mutex = g_mutex_new();
     self->state_cond = g_cond_new();
     self->part_slices_mutex = g_mutex_new();
@@ -1140,6 +1260,9 @@ finalize_impl(
 
     g_mutex_free(self->ring_mutex);
     g_cond_free(self->ring_cond);
+    g_mutex_free(self->lent_mutex);
+    g_cond_free(self->lent_cond);
+    g_queue_free(self->lent_blocks);
     g_mutex_free(self->state_mutex);
     g_cond_free(self->state_cond);
 
@@ -1168,6 +1291,8 @@ finalize_impl(
 
     if (self->part_header)
 	dumpfile_free(self->part_header);
+    if (self->auto_header)
+	dumpfile_free(self->auto_header);
 
     if (self->device)
 	g_object_unref(self->device);
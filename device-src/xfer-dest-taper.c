@@ -47,14 +47,30 @@ instance_init(
     elt->can_generate_eof = FALSE;
 }
 
+static void
+finalize_impl(
+    GObject * obj_self)
+{
+    XferDestTaper *self = XFER_DEST_TAPER(obj_self);
+
+    amdigest_free(self->part_digest);
+    amdigest_free(self->image_digest);
+    amdigest_free(self->image_digest_before_part);
+
+    /* chain up */
+    G_OBJECT_CLASS(parent_class)->finalize(obj_self);
+}
+
 static void
 class_init(
     XferDestTaperClass * selfc)
 {
     XferElementClass *klass = XFER_ELEMENT_CLASS(selfc);
+    GObjectClass *goc = G_OBJECT_CLASS(selfc);
     assert(klass);
 
     selfc->cache_inform = cache_inform_impl;
+    goc->finalize = finalize_impl;
 
     klass->perl_class = "Amanda::Xfer::Dest::Taper";
 
@@ -163,3 +179,81 @@ xfer_dest_taper_new_space_available(
     if (klass->new_space_available)
 	klass->new_space_available(XFER_DEST_TAPER(elt), made_space);
 }
+
+void
+xfer_dest_taper_set_auto_parts(
+    XferElement *elt,
+    gboolean auto_parts)
+{
+    XFER_DEST_TAPER(elt)->auto_parts = auto_parts;
+}
+
+/*
+ * Fixity digests
+ */
+
+void
+xfer_dest_taper_set_digest(
+    XferElement *elt,
+    gboolean digest)
+{
+    XferDestTaper *self = XFER_DEST_TAPER(elt);
+
+    if (!digest || !amdigest_supported() || self->image_digest)
+	return;
+
+    self->part_digest = amdigest_new();
+    self->image_digest = amdigest_new();
+    self->image_digest_before_part = amdigest_new();
+}
+
+void
+xfer_dest_taper_digest_start_part(
+    XferDestTaper *self)
+{
+    if (!self->image_digest)
+	return;
+
+    amdigest_reset(self->part_digest);
+    amdigest_copy(self->image_digest_before_part, self->image_digest);
+}
+
+void
+xfer_dest_taper_digest_add(
+    XferDestTaper *self,
+    gconstpointer buf,
+    gsize len)
+{
+    if (!self->image_digest)
+	return;
+
+    amdigest_add(self->part_digest, buf, len);
+    amdigest_add(self->image_digest, buf, len);
+}
+
+void
+xfer_dest_taper_digest_part_done(
+    XferDestTaper *self,
+    XMsg *msg)
+{
+    if (!self->image_digest)
+	return;
+
+    if (msg->successful) {
+	msg->digest = amdigest_finish(self->part_digest);
+    } else {
+	/* the part will be written again, from its start */
+	amdigest_copy(self->image_digest, self->image_digest_before_part);
+    }
+}
+
+void
+xfer_dest_taper_digest_image_done(
+    XferDestTaper *self,
+    XMsg *msg)
+{
+    if (!self->image_digest)
+	return;
+
+    msg->digest = amdigest_finish(self->image_digest);
+}
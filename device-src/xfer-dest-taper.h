@@ -25,6 +25,7 @@
 #define XFER_DEST_TAPER_H
 
 #include "amxfer.h"
+#include "amdigest.h"
 #include "device.h"
 
 /*
@@ -41,6 +42,16 @@ GType xfer_dest_taper_get_type(void);
 
 typedef struct XferDestTaper_ {
     XferElement __parent__;
+
+    /* fixity digests of the current part and of the whole image, and the
+     * image digest as of the start of the part, to go back to if the part
+     * fails; all NULL unless xfer_dest_taper_set_digest was called */
+    amdigest_t *part_digest;
+    amdigest_t *image_digest;
+    amdigest_t *image_digest_before_part;
+
+    /* set by xfer_dest_taper_set_auto_parts */
+    gboolean auto_parts;
 } XferDestTaper;
 
 typedef struct {
@@ -109,4 +120,53 @@ void xfer_dest_taper_new_space_available(
 guint64 xfer_dest_taper_get_part_bytes_written(
     XferElement *self);
 
+/* Have the element compute the fixity digest of each part and of the whole
+ * image, and send them in the XMSG_PART_DONE and XMSG_CRC messages.  This
+ * must be called before the transfer starts; it does nothing if SHA-256 is
+ * not compiled in.
+ *
+ * @param self: the XferDestTaper object
+ * @param digest: TRUE to compute the digests
+ */
+void xfer_dest_taper_set_digest(
+    XferElement *self,
+    gboolean digest);
+
+/* Have the element go on to the next part by itself when a part is done, if
+ * that part was successful, did not reach EOM and was not the last one.  The
+ * next part is written to the same device, with the header given to the last
+ * start_part and the next part number.  XMSG_PART_DONE is still sent for
+ * each part, but start_part must only be called after a part that failed or
+ * reached EOM.  Only the Splitter does this; the other elements always wait
+ * for start_part.
+ *
+ * @param self: the XferDestTaper object
+ * @param auto_parts: TRUE to start the parts in the element
+ */
+void xfer_dest_taper_set_auto_parts(
+    XferElement *self,
+    gboolean auto_parts);
+
+/* Helpers for the subclasses, which call them from the thread writing to the
+ * device: digest_start_part when a part starts, digest_add for each block
+ * written (at the same place the block is added to the CRC), digest_part_done
+ * with the XMSG_PART_DONE message once its successful flag is set, and
+ * digest_image_done with the final XMSG_CRC message.  They do nothing if
+ * digests are not enabled. */
+void xfer_dest_taper_digest_start_part(
+    XferDestTaper *self);
+
+void xfer_dest_taper_digest_add(
+    XferDestTaper *self,
+    gconstpointer buf,
+    gsize len);
+
+void xfer_dest_taper_digest_part_done(
+    XferDestTaper *self,
+    XMsg *msg);
+
+void xfer_dest_taper_digest_image_done(
+    XferDestTaper *self,
+    XMsg *msg);
+
 #endif
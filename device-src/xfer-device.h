@@ -96,6 +96,30 @@ xfer_dest_taper_cacher(
     gboolean use_mem_cache,
     const char *disk_cache_dirname);
 
+/* Set how much of a part an XferDestTaperCacher with a disk cache lets
+ * accumulate in the cache once a streaming device has caught up with a slow
+ * reader, before writing to the device again.  This keeps the device
+ * streaming instead of stopping and starting for each slab.  The default is
+ * the whole part; zero only prebuffers max_memory, as without a disk cache.
+ *
+ * @param elt: the XferDestTaperCacher
+ * @param resume_bytes: bytes to accumulate
+ */
+void
+xfer_dest_taper_cacher_set_spill(
+    XferElement *elt,
+    guint64 resume_bytes);
+
+/* Set the maximum number of bytes of free slabs that XferDestTaperCacher
+ * elements keep for reuse by later parts and transfers.  The default is 64
+ * MiB; zero disables the pool.
+ *
+ * @param max_bytes: maximum size of the slab pool
+ */
+void
+xfer_dest_taper_cacher_set_slab_pool_max(
+    size_t max_bytes);
+
 /* Constructor for XferDestTaperDirectTCP, which uses DirectTCP to transfer data
  * to devices (which must support the feature).
  *
@@ -149,6 +173,20 @@ guint64
 xfer_source_recovery_get_bytes_read(
     XferElement *elt);
 
+/* Have an XferSourceRecovery compute the fixity digest of each part it reads,
+ * and of all of the data read, as XferDestTaper does (see
+ * xfer_dest_taper_set_digest).  The part digest is sent with XMSG_PART_DONE,
+ * the digest of the data read so far with XMSG_CRC.  This must be called
+ * before the transfer starts.
+ *
+ * @param elt: the XferSourceRecovery object
+ * @param digest: TRUE to compute the digests
+ */
+void
+xfer_source_recovery_set_digest(
+    XferElement *elt,
+    gboolean digest);
+
 gboolean
 xfer_source_recovery_cancel(
     XferElement *elt,
@@ -68,6 +68,18 @@ typedef struct {
  * Implementation
  */
 
+static gboolean
+setup_impl(
+    XferElement *elt)
+{
+    XferSourceDevice *self = (XferSourceDevice *)elt;
+
+    if (self->device->block_size > 0)
+	xfer_reserve_buffers(elt->xfer, self->device->block_size, 2, TRUE);
+
+    return TRUE;
+}
+
 static gpointer
 pull_buffer_impl(
     XferElement *elt,
@@ -91,14 +103,7 @@ pull_buffer_impl(
     }
 
     do {
-	buf = g_try_malloc(self->block_size);
-	if (buf == NULL) {
-	    xfer_cancel_with_error(elt,
-		_("%s: cannot allocate memory"),
-		self->device->device_name);
-	    wait_until_xfer_cancelled(elt->xfer);
-	    return NULL;
-	}
+	buf = xfer_element_alloc_buffer(elt, self->block_size);
 	devsize = (int)self->block_size;
 	if (elt->size < 0)
 	    max_block = -1;
@@ -111,12 +116,12 @@ pull_buffer_impl(
 	if (result == 0) {
 	    g_assert(*size > self->block_size);
 	    self->block_size = devsize;
-	    amfree(buf);
+	    xfer_element_free_buffer(elt, buf);
 	}
     } while (result == 0);
 
     if (result < 0) {
-	amfree(buf);
+	xfer_element_free_buffer(elt, buf);
 
 	/* if we're not at EOF, it's an error */
 	if (!self->device->is_eof) {
@@ -151,6 +156,7 @@ class_init(
 	{ XFER_MECH_NONE, XFER_MECH_NONE, XFER_NROPS(0), XFER_NTHREADS(0), XFER_NALLOC(0) }
     };
 
+    klass->setup = setup_impl;
     klass->pull_buffer = pull_buffer_impl;
 
     klass->perl_class = "Amanda::Xfer::Source::Device";
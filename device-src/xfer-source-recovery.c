@@ -52,9 +52,6 @@ static GObjectClass *parent_class = NULL;
 typedef struct XferSourceRecovery {
     XferElement __parent__;
 
-    /* thread for monitoring directtcp transfers */
-    GThread *thread;
-
     /* this mutex in this condition variable governs all variables below */
     GCond  *start_part_cond;
     GMutex *start_part_mutex;
@@ -90,6 +87,11 @@ typedef struct XferSourceRecovery {
     gboolean done;
 
     GCond *abort_cond; /* condition to trigger to abort ndmp command */
+
+    /* fixity digests of the current part and of the data read so far; NULL
+     * unless xfer_source_recovery_set_digest was called */
+    amdigest_t *part_digest;
+    amdigest_t *image_digest;
 } XferSourceRecovery;
 
 /*
@@ -345,6 +347,9 @@ setup_impl(
 	elt->output_listen_addrs = NULL;
     }
 
+    /* pull_buffer_impl computes the crc of the data it returns */
+    elt->output_crc_known = (elt->output_mech == XFER_MECH_PULL_BUFFER);
+
     return TRUE;
 }
 
@@ -356,11 +361,12 @@ start_impl(
 
     if (elt->output_mech == XFER_MECH_DIRECTTCP_CONNECT) {
 	g_assert(elt->output_listen_addrs != NULL);
-	self->thread = g_thread_create(directtcp_connect_thread, (gpointer)self, FALSE, NULL);
+	/* a thread monitors the directtcp transfer */
+	xfer_thread_run(directtcp_connect_thread, (gpointer)self);
 	return TRUE; /* we'll send XMSG_DONE */
     } else if (elt->output_mech == XFER_MECH_DIRECTTCP_LISTEN) {
 	g_assert(elt->output_listen_addrs == NULL);
-	self->thread = g_thread_create(directtcp_listen_thread, (gpointer)self, FALSE, NULL);
+	xfer_thread_run(directtcp_listen_thread, (gpointer)self);
 	return TRUE; /* we'll send XMSG_DONE */
     } else {
 	/* nothing to prepare for - we're ready already! */
@@ -396,6 +402,8 @@ pull_buffer_impl(
 	    msg = xmsg_new(XFER_ELEMENT(self), XMSG_CRC, 0);
 	    msg->crc = crc32_finish(&elt->crc);
 	    msg->size = elt->crc.size;
+	    if (self->image_digest)
+		msg->digest = amdigest_value(self->image_digest);
 	    xfer_queue_message(elt->xfer, msg);
 
 	    /* the device has signalled EOF (really end-of-part), so clean up instance
@@ -436,8 +444,13 @@ pull_buffer_impl(
 		msg->fileno = self->device->file;
 		msg->successful = TRUE;
 		msg->eof = FALSE;
+		if (self->part_digest)
+		    msg->digest = amdigest_finish(self->part_digest);
 
 		xfer_queue_message(elt->xfer, msg);
+	    } else if (self->part_digest) {
+		/* the rest of the part is not read */
+		amdigest_reset(self->part_digest);
 	    }
 	}
     }
@@ -464,20 +477,16 @@ pull_buffer_impl(
 	} else {
 	    /* loop until we read a full block, in case the blocks are larger
 	     * than  expected */
-	    if (self->block_size == 0)
+	    if (self->block_size == 0) {
 		self->block_size = (size_t)self->device->block_size;
+		/* each part's device may have its own block size */
+		if (self->block_size > 0)
+		    xfer_reserve_buffers(elt->xfer, self->block_size, 2, TRUE);
+	    }
 
 	    do {
 		int max_block;
-		buf = g_malloc(self->block_size);
-		if (buf == NULL) {
-		    xfer_cancel_with_error(elt,
-				_("%s: cannot allocate memory"),
-				self->device->device_name);
-		    g_mutex_unlock(self->start_part_mutex);
-		    wait_until_xfer_cancelled(elt->xfer);
-		    goto error_unlocked;
-		}
+		buf = xfer_element_alloc_buffer(elt, self->block_size);
 		devsize = (int)self->block_size;
 		if (elt->size < 0)
 		    max_block = -1;
@@ -489,14 +498,14 @@ pull_buffer_impl(
 		if (result == 0) {
 		    g_assert(*size > self->block_size);
 		    self->block_size = devsize;
-		    amfree(buf);
+		    xfer_element_free_buffer(elt, buf);
 		}
 	    } while (result == 0);
 
 	    if (result > 0 &&
 		(elt->offset ||
 		 (elt->size > 0 && (long long unsigned)elt->size < *size))) {
-		gpointer buf1 = g_malloc(self->block_size);
+		gpointer buf1 = xfer_element_alloc_buffer(elt, self->block_size);
 		if ((long long unsigned)elt->offset > *size) {
 		    g_debug("offset > *size");
 		} else if ((long long unsigned)elt->offset == *size) {
@@ -507,7 +516,7 @@ pull_buffer_impl(
 		    *size = elt->size;
 		memmove(buf1, buf + elt->offset, *size);
 		elt->offset = 0;
-		g_free(buf);
+		xfer_element_free_buffer(elt, buf);
 		buf = buf1;
 	    }
 	    if (result > 0)
@@ -522,7 +531,8 @@ pull_buffer_impl(
 	}
 
 	if (result < 0) {
-	    amfree(buf);
+	    xfer_element_free_buffer(elt, buf);
+	    buf = NULL;
 
 	    /* if we're not at EOF, it's an error */
 	    if (!self->device->is_eof && elt->size != 0) {
@@ -541,6 +551,8 @@ pull_buffer_impl(
 	    msg = xmsg_new(XFER_ELEMENT(self), XMSG_CRC, 0);
 	    msg->crc = crc32_finish(&elt->crc);
 	    msg->size = elt->crc.size;
+	    if (self->image_digest)
+		msg->digest = amdigest_value(self->image_digest);
 	    xfer_queue_message(elt->xfer, msg);
 
 	    /* the device has signalled EOF (really end-of-part), so clean up instance
@@ -553,6 +565,8 @@ pull_buffer_impl(
 	    msg->fileno = self->device->file;
 	    msg->successful = TRUE;
 	    msg->eof = FALSE;
+	    if (self->part_digest)
+		msg->digest = amdigest_finish(self->part_digest);
 
 	    self->paused = TRUE;
 	    self->bytes_read += self->part_size;
@@ -578,6 +592,10 @@ pull_buffer_impl(
 
     if (buf) {
 	crc32_add(buf, *size, &elt->crc);
+	if (self->image_digest) {
+	    amdigest_add(self->part_digest, buf, *size);
+	    amdigest_add(self->image_digest, buf, *size);
+	}
     }
 
     return buf;
@@ -602,6 +620,10 @@ cancel_impl(
     g_cond_broadcast(self->abort_cond);
     g_mutex_unlock(self->start_part_mutex);
 
+    /* and interrupt a device read blocked on the network */
+    if (self->device)
+	device_cancel(self->device);
+
     return TRUE;
 }
 
@@ -734,6 +756,9 @@ finalize_impl(
     g_cond_free(self->start_part_cond);
     g_cond_free(self->abort_cond);
     g_mutex_free(self->start_part_mutex);
+
+    amdigest_free(self->part_digest);
+    amdigest_free(self->image_digest);
 }
 
 static void
@@ -855,6 +880,20 @@ xfer_source_recovery_use_device(
     klass->use_device(XFER_SOURCE_RECOVERY(elt), device);
 }
 
+void
+xfer_source_recovery_set_digest(
+    XferElement *elt,
+    gboolean digest)
+{
+    XferSourceRecovery *self = XFER_SOURCE_RECOVERY(elt);
+
+    if (!digest || !amdigest_supported() || self->image_digest)
+	return;
+
+    self->part_digest = amdigest_new();
+    self->image_digest = amdigest_new();
+}
+
 guint64
 xfer_source_recovery_get_bytes_read(
     XferElement *elt)
@@ -17,7 +17,7 @@
 # Contact information: Carbonite Inc., 756 N Pastoria Ave
 # Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
 
-use Test::More tests => 324;
+use Test::More tests => 326;
 use File::Path;
 use Data::Dumper;
 use strict;
@@ -309,6 +309,7 @@ Amanda::MainLoop::run();
 	property => "\"eject-delay\" \"1s\"",
 	property => "\"unload-delay\" \"2M\"",
 	property => "\"load-poll\" \"2s POLl 3s uNtil 1m\"",
+	property => "\"inventory-cache\" \"5m\"",
     ]);
     $testconf->write( do_catalog => 0 );
 
@@ -376,6 +377,16 @@ Amanda::MainLoop::run();
     is($chg->{'eject_delay'}, 1, "eject-delay parsed");
     is($chg->{'unload_delay'}, 120, "unload-delay parsed");
     is_deeply($chg->{'load_poll'}, [ 2, 3, 60 ], "load-poll parsed");
+    is($chg->{'inventory_cache'}, 300, "inventory-cache parsed");
+
+    $chg->info(
+	    info => ['num_drives'],
+	    info_cb => make_cb(info_cb => sub {
+	my ($err, %info) = @_;
+	is($info{'num_drives'}, 1, "num_drives counts the tape-device drives");
+	Amanda::MainLoop::quit();
+    }));
+    Amanda::MainLoop::run();
 
     # check out the statefile filename generation
     my $dashed_mtx_state_file = $mtx_state_file;
@@ -18,7 +18,7 @@
 # Contact information: Carbonite Inc., 756 N Pastoria Ave
 # Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
 
-use Test::More tests => 381;
+use Test::More tests => 387;
 use strict;
 use warnings;
 use Data::Dumper;
@@ -194,6 +194,7 @@ $testconf->add_dumptype('third_dumptype', [
 $testconf->add_interface('ethernet', [
     'comment' => '"mine"',
     'use' => '100',
+    'numa-node' => '1',
 ]);
 $testconf->add_interface('nic', [
     'comment' => '"empty"',
@@ -203,6 +204,9 @@ $testconf->add_holdingdisk('hd1', [
     'directory' => '"/mnt/hd1"',
     'use' => '100M',
     'chunksize' => '1024k',
+    'numa-node' => '1',
+    'memory' => 'yes',
+    'dump-size-limit' => '10M',
 ]);
 $testconf->add_holdingdisk('hd2', [
     'comment' => '"empty"',
@@ -400,6 +404,8 @@ is(interface_getconf($iface, $INTER_COMMENT), 'mine',
     "interface comment");
 is(interface_getconf($iface, $INTER_MAXUSAGE), 100,
     "interface maxusage");
+is(interface_getconf($iface, $INTER_NUMA_NODE), 1,
+    "interface numa-node");
 
 $iface = lookup_interface("nic");
 ok($iface, "found nic");
@@ -407,12 +413,14 @@ ok(interface_seen($iface, $INTER_COMMENT),
     "seen set for parameters that appeared");
 ok(!interface_seen($iface, $INTER_MAXUSAGE),
     "seen not set for parameters that did not appear");
+is(interface_getconf($iface, $INTER_NUMA_NODE), -1,
+    "interface numa-node defaults to -1");
 
 is_deeply([ sort(+getconf_list("interface")) ],
 	  [ sort('ethernet', 'nic', 'default') ],
     "getconf_list lists all interfaces (in any order)");
 
-skip "error loading config", 13 unless $cfg_result == $CFGERR_OK;
+skip "error loading config", 16 unless $cfg_result == $CFGERR_OK;
 my $hdisk = lookup_holdingdisk("hd1");
 ok($hdisk, "found hd1");
 is(holdingdisk_name($hdisk), "hd1",
@@ -425,6 +433,12 @@ is(holdingdisk_getconf($hdisk, $HOLDING_DISKSIZE), 100*1024,
     "holdingdisk disksize (use)");
 is(holdingdisk_getconf($hdisk, $HOLDING_CHUNKSIZE), 1024,
     "holdingdisk chunksize");
+is(holdingdisk_getconf($hdisk, $HOLDING_NUMA_NODE), 1,
+    "holdingdisk numa-node");
+is(holdingdisk_getconf($hdisk, $HOLDING_MEMORY), 1,
+    "holdingdisk memory");
+is(holdingdisk_getconf($hdisk, $HOLDING_DUMP_SIZE_LIMIT), 10240,
+    "holdingdisk dump-size-limit");
 
 $hdisk = lookup_holdingdisk("hd2");
 ok($hdisk, "found hd2");
@@ -1290,11 +1304,13 @@ $testconf->add_storage('storage1', [
     'dump_selection' => '"full" FULL',
     'dump_selection' => '"incr" INCR',
     'dump_selection' => 'ALL ALL',
+    'fixity_digest' => 'yes',
 ]);
 $testconf->write( do_catalog => 0 );
 config_init($CONFIG_INIT_EXPLICIT_NAME, "TESTCONF");
 my $st = lookup_storage("storage1");
 ok($st, "found storage1");
+ok(storage_getconf($st, $STORAGE_FIXITY_DIGEST), "fixity_digest parsed");
 my $ds = storage_getconf($st, $STORAGE_DUMP_SELECTION);
 is_deeply($ds,
 	[ { 'tag_type' => $Amanda::Config::TAG_NAME, 'level' => $Amanda::Config::LEVEL_FULL, 'tag' => 'full' },
@@ -18,7 +18,7 @@
 # Contact information: Carbonite Inc., 756 N Pastoria Ave
 # Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
 
-use Test::More tests => 18;
+use Test::More tests => 20;
 use strict;
 use warnings;
 
@@ -1286,6 +1286,20 @@ ok(!-f "$infodir/$host_q/$disk_q/info", "infofile successfully deleted");
 
 ok( !defined $ci->put_info($host, $disk, $info), "Amanda::Curinfo->put_info check");
 
+## read it, and a DLE without info, with infofile.c
+
+my @dles = (
+    { 'host' => { 'hostname' => $host }, 'name' => $disk },
+    { 'host' => { 'hostname' => $host }, 'name' => "/no/such/disk" },
+);
+my @infos = $ci->get_all_info(@dles);
+is_deeply(\@infos,
+    [ $ci->get_info($host, $disk), $ci->get_info($host, "/no/such/disk") ],
+    "Amanda::Curinfo->get_all_info reads like get_info");
+@infos = $ci->get_all_info(@dles);
+is_deeply($infos[0], $ci->get_info($host, $disk),
+    "Amanda::Curinfo->get_all_info reads the same from its cache");
+
 ## compare the two files
 
 sub diff_wi
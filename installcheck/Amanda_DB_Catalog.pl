@@ -18,7 +18,7 @@
 # Contact information: Carbonite Inc., 756 N Pastoria Ave
 # Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
 
-use Test::More tests => 85;
+use Test::More tests => 90;
 use File::Path;
 use Data::Dumper;
 use strict;
@@ -697,3 +697,25 @@ got_parts([ sortparts Amanda::DB::Catalog::get_parts() ],
 	[ sortparts parts_named qr/.*/ ],
 	"get_parts returns all parts when given no parameters (2)");
 
+
+# queries read the logfile index once it is written; the logfiles are made
+# older than this second, so that they are indexed
+my $logdir = config_dir_relative(getconf($CNF_LOGDIR));
+utime(time() - 60, time() - 60, glob("$logdir/log.*"));
+rmtree("$logdir/findcache");
+
+got_parts([ sortparts Amanda::DB::Catalog::get_parts(label => 'DIRO-TEST-003') ],
+	[ sortparts parts_matching { defined $_->{'label'} and $_->{'label'} eq 'DIRO-TEST-003' } ],
+	"get_parts parameter label, while building the logfile index");
+ok(-f "$logdir/findcache/catalog",
+	"the logfile index is written");
+got_parts([ sortparts Amanda::DB::Catalog::get_parts(label => 'DIRO-TEST-003') ],
+	[ sortparts parts_matching { defined $_->{'label'} and $_->{'label'} eq 'DIRO-TEST-003' } ],
+	"get_parts parameter label, from the logfile index");
+got_parts([ sortparts Amanda::DB::Catalog::get_parts(label => 'NO-SUCH-LABEL') ],
+	[ ],
+	"get_parts parameter label with an unknown label, from the logfile index",
+	zero_parts_expected => 1);
+got_parts([ sortparts Amanda::DB::Catalog::get_parts() ],
+	[ sortparts parts_named qr/.*/ ],
+	"get_parts returns all parts from the logfile index");
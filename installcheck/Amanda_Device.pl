@@ -18,8 +18,9 @@
 # Contact information: Carbonite Inc., 756 N Pastoria Ave
 # Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
 
-use Test::More tests => 634;
+use Test::More tests => 867;
 use File::Path qw( mkpath rmtree );
+use File::Find;
 use Sys::Hostname;
 use Carp;
 use strict;
@@ -341,6 +342,117 @@ ok($dev->finish(),
     "finish device after read")
     or diag($dev->error_or_status());
 
+# and again, with the blocks read ahead by a worker thread
+$dev = undef;
+$dev = Amanda::Device->new($dev_name);
+is($dev->property_set("queue_depth", 4), undef,
+    "set QUEUE_DEPTH");
+
+ok($dev->start($ACCESS_READ, undef, undef),
+    "start in read mode with a queue depth")
+    or diag($dev->error_or_status());
+
+verify_file(0x2FACE, $dev->block_size()*10+17, 3);
+verify_file(0xD0ED0E, $dev->block_size()*4, 4);
+
+ok($dev->finish(),
+    "finish device after reading ahead")
+    or diag($dev->error_or_status());
+
+# pack the small files in a container
+$dev = undef;
+$dev = Amanda::Device->new($dev_name);
+is($dev->property_set("pack_threshold", $dev->block_size()*8), undef,
+    "set PACK_THRESHOLD");
+
+ok($dev->start($ACCESS_APPEND, undef, undef),
+    "start in append mode with a pack threshold")
+    or diag($dev->error_or_status());
+
+write_file(0xBEEF, $dev->block_size()*2+17, 5);
+write_file(0xBEEF+1, $dev->block_size()*10+17, 6);
+write_file(0xBEEF+2, $dev->block_size()*3, 7);
+write_file(0xBEEF+3, $dev->block_size()*3, 8);
+
+ok($dev->recycle_file(8),
+    "recycle a packed file")
+    or diag($dev->error_or_status());
+
+ok($dev->finish(),
+    "finish device after packing")
+    or diag($dev->error_or_status());
+
+ok(-f "$vtape1/data/pack.00005",
+    "the small files are in a container");
+ok(!-e "$vtape1/data/00005.localhost._home.0",
+    "..and not in files of their own");
+ok(-f "$vtape1/data/00006.localhost._home.0",
+    "..but the larger one is");
+
+for my $scan (0, 1) {
+    # the second time, find the packed files without the manifest
+    unlink("$vtape1/data/.vfs-manifest") if $scan;
+
+    $dev = undef;
+    $dev = Amanda::Device->new($dev_name);
+    ok($dev->start($ACCESS_READ, undef, undef),
+	"start in read mode to read the packed files")
+	or diag($dev->error_or_status());
+
+    verify_file(0xBEEF+2, $dev->block_size()*3, 7);
+    verify_file(0xBEEF, $dev->block_size()*2+17, 5);
+    if (!$scan) {
+	verify_file(0xBEEF+1, $dev->block_size()*10+17, 6);
+	my $hdr = $dev->seek_file(8);
+	is($hdr? $hdr->{'type'} : -1, $Amanda::Header::F_TAPEEND,
+	    "the recycled file is gone");
+    }
+
+    ok($dev->finish(),
+	"finish device after reading the packed files")
+	or diag($dev->error_or_status());
+}
+
+# a container that was never closed, as after a crash, still has its files
+$dev = undef;
+$dev = Amanda::Device->new($dev_name);
+is($dev->property_set("pack_threshold", $dev->block_size()*8), undef,
+    "set PACK_THRESHOLD");
+
+ok($dev->start($ACCESS_APPEND, undef, undef),
+    "start in append mode to leave a container open")
+    or diag($dev->error_or_status());
+
+write_file(0xFEED, $dev->block_size()*2, 8);
+
+{
+    # keep the container as it is before the device closes it
+    my $pack = "$vtape1/data/pack.00008";
+    ok(-f $pack, "the file is in a new container");
+    open(my $fh, "<", $pack) or die("$pack: $!");
+    binmode($fh);
+    my $contents = do { local $/; <$fh> };
+    close($fh);
+
+    $dev = undef;
+    open($fh, ">", $pack) or die("$pack: $!");
+    binmode($fh);
+    print $fh $contents;
+    close($fh);
+    unlink("$vtape1/data/.vfs-manifest");
+}
+
+$dev = Amanda::Device->new($dev_name);
+ok($dev->start($ACCESS_READ, undef, undef),
+    "start in read mode after the container was left open")
+    or diag($dev->error_or_status());
+
+verify_file(0xFEED, $dev->block_size()*2, 8);
+
+ok($dev->finish(),
+    "finish device after reading the unclosed container")
+    or diag($dev->error_or_status());
+
 # test erase
 ok($dev->erase(),
    "erase device")
@@ -757,6 +869,161 @@ ok($dev->finish(),
    "finish device after LEOM test")
     or diag($dev->error_or_status());
 
+## DEDUP device
+
+SKIP: {
+    skip "not built with the dedup device", 29 unless
+	$Amanda::Constants::AMANDA_DEVICES =~ /dedup/;
+
+    # the number and total size of the chunks in the store
+    my $chunk_dir = "$taperoot/chunks";
+    my $store_usage = sub {
+	my ($count, $size) = (0, 0);
+	find(sub { if (-f $_) { $count++; $size += -s $_; } }, $chunk_dir)
+	    if -d $chunk_dir;
+	return "$count chunks, $size bytes";
+    };
+
+    rmtree($chunk_dir);
+    my $dedup1 = mkvtape(14);
+    $dev_name = "dedup:$dedup1";
+
+    $dev = Amanda::Device->new($dev_name);
+    is($dev->status(), $DEVICE_STATUS_SUCCESS,
+	"$dev_name: create successful")
+	or diag($dev->error_or_status());
+
+    properties_include([ $dev->property_list() ],
+	[ @common_properties, 'max_volume_usage', 'dedup_chunk_dir', 'dedup_chunk_size' ],
+	"necessary properties listed on dedup device");
+
+    ok($dev->start($ACCESS_WRITE, "TESTCONF14", undef),
+	"start in write mode")
+	or diag($dev->error_or_status());
+
+    write_file(0xD00D, $dev->block_size()*40+17, 1);
+
+    my $usage = $store_usage->();
+    ok($usage !~ /^0 chunks/,
+	"chunks are stored in the default chunk directory")
+	or diag($usage);
+
+    write_file(0xD00D, $dev->block_size()*40+17, 2);
+
+    is($store_usage->(), $usage,
+	"..and the same data written again stores no new chunk");
+
+    ok($dev->finish(),
+	"finish device")
+	or diag($dev->error_or_status());
+
+    $dev = Amanda::Device->new($dev_name);
+    is($dev->status(), $DEVICE_STATUS_SUCCESS,
+	"$dev_name: re-create successful")
+	or diag($dev->error_or_status());
+
+    ok($dev->start($ACCESS_READ, undef, undef),
+	"start in read mode")
+	or diag($dev->error_or_status());
+
+    verify_file(0xD00D, $dev->block_size()*40+17, 1);
+    verify_file(0xD00D, $dev->block_size()*40+17, 2);
+
+    ok($dev->finish(),
+	"finish device after read")
+	or diag($dev->error_or_status());
+
+    ok($dev->erase(),
+	"erase device")
+	or diag($dev->error_or_status());
+
+    like($store_usage->(), qr/^0 chunks/,
+	"..and its chunks are removed from the store");
+}
+
+## blockdev device, on a sparse file standing for the block device
+
+{
+    my $blockdev_file = "$Installcheck::TMP/Amanda_Device_test_blockdev";
+    open(my $fh, ">", $blockdev_file)
+	or die "Could not create '$blockdev_file': $!";
+    truncate($fh, 64*1024*1024)
+	or die "Could not extend '$blockdev_file': $!";
+    close($fh);
+    $dev_name = "blockdev:$blockdev_file";
+
+    $dev = Amanda::Device->new($dev_name);
+    is($dev->status(), $DEVICE_STATUS_SUCCESS,
+	"$dev_name: create successful")
+	or diag($dev->error_or_status());
+
+    properties_include([ $dev->property_list() ],
+	[ @common_properties, 'max_volume_usage', 'direct_io' ],
+	"necessary properties listed on blockdev device");
+
+    ok($dev->start($ACCESS_WRITE, "TESTCONF15", undef),
+	"start in write mode")
+	or diag($dev->error_or_status());
+
+    write_file(0xB10C, $dev->block_size()*10+17, 1);
+    write_file(0xB10D, 5*1024*1024+3, 2);
+    write_file(0xB10E, $dev->block_size(), 3);
+
+    ok($dev->finish(),
+	"finish device")
+	or diag($dev->error_or_status());
+
+    $dev = Amanda::Device->new($dev_name);
+    is($dev->status(), $DEVICE_STATUS_SUCCESS,
+	"$dev_name: re-create successful")
+	or diag($dev->error_or_status());
+
+    ok($dev->start($ACCESS_APPEND, undef, undef),
+	"start in append mode")
+	or diag($dev->error_or_status());
+
+    write_file(0xB10F, $dev->block_size()*3+1, 4);
+
+    ok($dev->finish(),
+	"finish device after append")
+	or diag($dev->error_or_status());
+
+    $dev = Amanda::Device->new($dev_name);
+    is($dev->read_label(), $DEVICE_STATUS_SUCCESS,
+	"read label")
+	or diag($dev->error_or_status());
+
+    ok($dev->start($ACCESS_READ, undef, undef),
+	"start in read mode")
+	or diag($dev->error_or_status());
+
+    verify_file(0xB10E, $dev->block_size(), 3);
+    verify_file(0xB10C, $dev->block_size()*10+17, 1);
+    verify_file(0xB10F, $dev->block_size()*3+1, 4);
+    verify_file(0xB10D, 5*1024*1024+3, 2);
+
+    my $hdr = $dev->seek_file(5);
+    is($hdr->{'type'}, $Amanda::Header::F_TAPEEND,
+	"seek past the last file gives a tapeend header");
+    ok(!$dev->seek_file(6),
+	"..and seeking further fails");
+
+    ok($dev->finish(),
+	"finish device after read")
+	or diag($dev->error_or_status());
+
+    ok($dev->erase(),
+	"erase device")
+	or diag($dev->error_or_status());
+
+    $dev = Amanda::Device->new($dev_name);
+    is($dev->read_label(), $DEVICE_STATUS_VOLUME_UNLABELED,
+	"..and the volume is unlabeled after that")
+	or diag($dev->error_or_status());
+
+    unlink($blockdev_file);
+}
+
 ## dvdrw device
 
 SKIP: {
@@ -957,6 +1224,137 @@ ok($dev->status() & $DEVICE_STATUS_VOLUME_ERROR,
    "Label mismatch error handled correctly")
     or diag($dev->error_or_status());
 
+####
+## Test a RAIT device with two parity children, which survives the loss of
+## any two of them.
+
+my @vtapes = map { mkvtape($_) } (1 .. 5);
+$dev_name = "rait:2:file:{" . join(",", @vtapes) . "}";
+
+$dev = Amanda::Device->new($dev_name);
+is($dev->status(), $DEVICE_STATUS_SUCCESS,
+   "$dev_name: create successful")
+    or diag($dev->error_or_status());
+
+ok($dev->configure(1), "configure device");
+
+is($dev->property_get("block_size"), 32768*3,
+    "rait device with two parity children stripes over the other three");
+
+like($dev->property_get("canonical_name"), qr/^rait:2:/,
+    "..and keeps the parity count in its canonical name");
+
+ok($dev->start($ACCESS_WRITE, "TESTCONF14", undef),
+   "start in write mode")
+    or diag($dev->error_or_status());
+
+for (my $i = 1; $i <= 2; $i++) {
+    write_file(0xFEED + $i, $dev->block_size()*10+17, $i);
+}
+
+ok($dev->finish(),
+   "finish device after write")
+    or diag($dev->error_or_status());
+
+undef $dev;
+
+# a data child and a parity child missing
+$dev_name = "rait:2:{file:$vtapes[0],MISSING,file:$vtapes[2],MISSING,file:$vtapes[4]}";
+$dev = Amanda::Device->new($dev_name);
+
+ok($dev->start($ACCESS_READ, undef, undef),
+   "start in read mode with two children MISSING")
+    or diag($dev->error_or_status());
+
+verify_file(0xFEED + 2, $dev->block_size()*10+17, 2);
+verify_file(0xFEED + 1, $dev->block_size()*10+17, 1);
+
+ok($dev->finish(),
+   "finish device read with two children MISSING")
+    or diag($dev->error_or_status());
+
+undef $dev;
+
+# two data children lost while reading
+$dev_name = "rait:2:file:{" . join(",", @vtapes) . "}";
+$dev = Amanda::Device->new($dev_name);
+
+ok($dev->start($ACCESS_READ, undef, undef),
+   "start in read mode")
+    or diag($dev->error_or_status());
+
+rmtree($vtapes[0]);
+rmtree($vtapes[2]);
+
+verify_file(0xFEED + 1, $dev->block_size()*10+17, 1);
+verify_file(0xFEED + 2, $dev->block_size()*10+17, 2);
+
+ok($dev->finish(),
+   "finish device read after two missing volumes")
+    or diag($dev->error_or_status());
+
+undef $dev;
+
+$dev = Amanda::Device->new("rait:2:{MISSING,MISSING,MISSING,file:$vtapes[3],file:$vtapes[4]}");
+isnt($dev->status(), $DEVICE_STATUS_SUCCESS,
+   "a RAIT device with more children missing than parity children fails");
+
+$dev = Amanda::Device->new("rait:0:{file:$vtapes[3]}");
+isnt($dev->status(), $DEVICE_STATUS_SUCCESS,
+   "a striped RAIT device with a single child fails");
+
+$dev = Amanda::Device->new("rait:2:{file:$vtapes[3],file:$vtapes[4]}");
+isnt($dev->status(), $DEVICE_STATUS_SUCCESS,
+   "a RAIT device without data children fails");
+
+####
+## Test a RAIT device without parity children, which only stripes the data
+
+@vtapes = map { mkvtape($_) } (1 .. 3);
+$dev_name = "rait:0:file:{" . join(",", @vtapes) . "}";
+
+$dev = Amanda::Device->new($dev_name);
+is($dev->status(), $DEVICE_STATUS_SUCCESS,
+   "$dev_name: create successful")
+    or diag($dev->error_or_status());
+
+ok($dev->configure(1), "configure device");
+
+is($dev->property_get("block_size"), 32768*3,
+    "striped rait device stripes over all of its children");
+
+like($dev->property_get("canonical_name"), qr/^rait:0:/,
+    "..and keeps the parity count in its canonical name");
+
+ok($dev->start($ACCESS_WRITE, "TESTCONF15", undef),
+   "start in write mode")
+    or diag($dev->error_or_status());
+
+write_file(0xD00D, $dev->block_size()*10+17, 1);
+
+ok($dev->finish(),
+   "finish device after write")
+    or diag($dev->error_or_status());
+
+undef $dev;
+
+$dev = Amanda::Device->new($dev_name);
+ok($dev->start($ACCESS_READ, undef, undef),
+   "start in read mode")
+    or diag($dev->error_or_status());
+
+verify_file(0xD00D, $dev->block_size()*10+17, 1);
+
+ok($dev->finish(),
+   "finish device read")
+    or diag($dev->error_or_status());
+
+undef $dev;
+
+$dev = Amanda::Device->new("rait:0:{file:$vtapes[0],MISSING,file:$vtapes[2]}");
+isnt($dev->status(), $DEVICE_STATUS_SUCCESS,
+   "a striped RAIT device with a child MISSING fails");
+
 # Use some config to set a block size on a child device
 ($vtape1, $vtape2) = (mkvtape(1), mkvtape(2));
 $dev_name = "rait:{file:$vtape1,mytape2}";
@@ -1047,10 +1445,10 @@ my $base_name;
 
 SKIP: {
     skip "define \$INSTALLCHECK_S3_{SECRET,ACCESS}_KEY to run S3 tests",
-            104 +
+            117 +
             1 * $verify_file_count +
             7 * $write_file_count +
-            14 * $s3_make_device_count
+            15 * $s3_make_device_count
 	unless $run_s3_tests;
 
     $dev_name = "s3:";
@@ -1212,6 +1610,52 @@ SKIP: {
         or diag($dev->error_or_status());    # (note: we don't use write_max_size here,
 					     # as the maximum for S3 is very large)
 
+    # copy file 3 to another bucket, without reading it
+    my $src_dev = $dev;
+    ok($src_dev->start($ACCESS_READ, undef, undef),
+       "start in read mode for a copy")
+        or diag($src_dev->error_or_status());
+    my $copy_hdr = $src_dev->seek_file(3);
+    ok($copy_hdr, "seek to the file to copy")
+        or diag($src_dev->error_or_status());
+
+    my $copy_dev = s3_make_device("s3:$base_name-s3-copy", "s3");
+    ok($copy_dev->start($ACCESS_WRITE, "TESTCONF14", undef),
+       "start the copy in write mode")
+        or diag($copy_dev->error_or_status());
+    ok($copy_dev->can_copy_file_from($src_dev),
+       "an S3 device can copy from an S3 device with the same credentials");
+    my $copy_size = $copy_dev->copy_file_from($src_dev, $copy_hdr);
+    is($copy_dev->status(), $DEVICE_STATUS_SUCCESS,
+       "copy_file_from succeeds")
+        or diag($copy_dev->error_or_status());
+    is($copy_size, $src_dev->block_size()*10,
+       "..and copies the whole file");
+    ok($copy_dev->finish(),
+       "finish the copy")
+        or diag($copy_dev->error_or_status());
+    ok($src_dev->finish(),
+       "finish the source of the copy")
+        or diag($src_dev->error_or_status());
+
+    ok($copy_dev->start($ACCESS_READ, undef, undef),
+       "start the copy in read mode")
+        or diag($copy_dev->error_or_status());
+    $copy_hdr = $copy_dev->seek_file(1);
+    ok($copy_hdr && $copy_hdr->{'datestamp'} eq "20000101010103",
+       "the copy has the header of the source file")
+        or diag($copy_dev->error_or_status());
+    ok(Amanda::Device::verify_random_from_device(0x2FACE,
+					$copy_dev->block_size()*10, $copy_dev),
+       "the copy has the data of the source file");
+    ok($copy_dev->finish(),
+       "finish the copy after read")
+        or diag($copy_dev->error_or_status());
+    ok($copy_dev->erase(),
+       "erase the copy")
+       or diag($copy_dev->error_or_status());
+    $dev = $src_dev;
+
     ok($dev->erase(),
        "erase device")
        or diag($dev->error_or_status());
@@ -18,7 +18,7 @@
 # Contact information: Carbonite Inc., 756 N Pastoria Ave
 # Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
 
-use Test::More tests => 39;
+use Test::More tests => 48;
 use File::Path;
 use strict;
 use warnings;
@@ -33,7 +33,7 @@ use Amanda::Cmdline;
 use Amanda::Util;
 use Amanda::Debug qw( :logging );
 use Amanda::Logfile qw(:logtype_t :program_t open_logfile get_logline
-		close_logfile log_add $amanda_log_trace_log );
+		get_logline_split close_logfile log_add $amanda_log_trace_log );
 use Amanda::Config qw( :init :getconf config_dir_relative );
 
 Amanda::Debug::dbopen("installcheck");
@@ -156,6 +156,28 @@ is_deeply([ get_logline($logfile) ],
 ok(!get_logline($logfile), "no next line");
 close_logfile($logfile);
 
+##
+# Test lines split in C
+
+$logdata = <<END;
+SUCCESS dumper somebox "/lib dir" 20081002040002 0 [sec 1.0 kb 10]
+  cont "line"
+END
+
+$logfile = open_logfile(write_logfile($logdata));
+ok($logfile, "can open a logfile to split");
+is_deeply([ get_logline_split($logfile) ],
+	  [ $L_SUCCESS, $P_DUMPER,
+	    'somebox "/lib dir" 20081002040002 0 [sec 1.0 kb 10]',
+	    [ "somebox", "/lib dir", "20081002040002", "0", "[sec", "1.0",
+	      "kb", "10]" ] ],
+	  "get_logline_split splits the words of the line");
+is_deeply([ get_logline_split($logfile) ],
+	  [ $L_CONT, $P_DUMPER, 'cont "line"', [] ],
+	  "continuation lines are not split");
+ok(!get_logline_split($logfile), "no third line");
+close_logfile($logfile);
+
 ## HIGHER-LEVEL FUNCTIONS
 
 # a utility function for is_deeply checks, below.  Converts a hash to
@@ -193,6 +215,7 @@ my $logdir = $testconf->{'logdir'};
     my $filename = "$logdir/log";
 
     -f "$filename" and unlink("$filename");
+    unlink("$logdir/binlog");
     Amanda::Logfile::set_logname($filename);
     log_add($L_INFO, "This is my info");
     log_add($L_START, "blah blah blah date 20300405060708 blah blah");
@@ -206,10 +229,26 @@ my $logdir = $testconf->{'logdir'};
     is(Amanda::Logfile::get_current_log_timestamp(), "20300405060708",
 	"get_current_log_timestamp finds a timestamp");
 
+    is(Amanda::Logfile::get_binlog_name($filename), "$logdir/binlog",
+	"get_binlog_name");
+    my $bl = Amanda::Logfile::binlog_open("$logdir/binlog");
+    my @ev = Amanda::Logfile::binlog_next($bl);
+    is_deeply([ @ev[0, 1, 2, 5] ], [ $L_INFO, $P_UNKNOWN, $$, "This is my info" ],
+	"the binary log has the same events");
+    Amanda::Logfile::binlog_seek($bl, 0);
+    Amanda::Logfile::binlog_set_filter($bl, 1 << $L_START);
+    @ev = Amanda::Logfile::binlog_next($bl);
+    is_deeply([ @ev[0, 5] ], [ $L_START, "blah blah blah date 20300405060708 blah blah" ],
+	"..and binlog_set_filter skips the other events");
+    @ev = Amanda::Logfile::binlog_next($bl);
+    is(scalar @ev, 0, "..up to the end of the log");
+    Amanda::Logfile::binlog_close($bl);
+
     Amanda::Logfile::log_rename("20300405060708");
 
     ok(! -f $filename, "after log_rename, /log is gone");
     ok(-f "$filename.20300405060708.0", "..and log.20300405060708.0 exists");
+    ok(-f "$logdir/binlog.20300405060708.0", "..and its binary log");
 }
 
 # set up and read the tapelist (we don't use Amanda::Tapelist to write this,
@@ -17,7 +17,7 @@
 # Contact information: Carbonite Inc., 756 N Pastoria Ave
 # Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
 
-use Test::More tests => 11;
+use Test::More tests => 15;
 use File::Path;
 use Data::Dumper;
 use strict;
@@ -320,4 +320,61 @@ is_plan(make_plan_sync(
     ],
     "plan based on filelist, without a dumpspec");
 
+# split_plan, on a plan of the full and incremental dumps of two DLEs, each
+# dump on its own volume
+{
+    my @dumps = map {
+	my ($disk, $level, $label, $kb) = @$_;
+	{ hostname => 'somebox', diskname => $disk, level => $level, kb => $kb,
+	  parts => [ undef, { label => $label, filenum => 1 } ] }
+    } ( [ '/a', 0, 'Vol-1', 100 ], [ '/b', 0, 'Vol-2', 100 ],
+	[ '/a', 1, 'Vol-3', 10 ],  [ '/b', 1, 'Vol-4', 10 ] );
+    my $plan = Amanda::Recovery::Planner::Plan->new({ dumps => \@dumps });
+    my $summary = sub {
+	[ map { [ map { "$_->{'diskname'}:$_->{'level'}" } @{$_->{'dumps'}} ] } @_ ] };
+
+    is_deeply($summary->($plan->split_plan(4)),
+	[ [ '/a:0' ], [ '/b:0' ], [ '/a:1' ], [ '/b:1' ] ],
+	"split_plan reads the dumps on different volumes at the same time");
+    is_deeply($summary->($plan->split_plan(4, by_dle => 1)),
+	[ [ '/a:0', '/a:1' ], [ '/b:0', '/b:1' ] ],
+	"split_plan with by_dle keeps the dumps of a DLE in order in one plan");
+}
+
+# order_volume, with a device recommending the reverse of the order it's given
+{
+    package main::FakeCatalog;
+    sub get_dumps { return $_[0]->{'dumps'}; }
+
+    package main::FakeDevice;
+    sub block_size { 32768 }
+    sub recommended_order {
+	my $self = shift;
+	my ($extents) = @_;
+	$self->{'extents'} = $extents;
+	return reverse map { $_->[0] } @$extents;
+    }
+
+    package main;
+
+    my @dumps = map {
+	my ($disk, $label, @parts) = @$_;
+	{ hostname => 'somebox', diskname => $disk,
+	  parts => [ undef, map { { label => $label, filenum => $_->[0],
+				    kb => $_->[1] } } @parts ] }
+    } ( [ '/a', 'Vol-1', [ 1, 100 ] ], [ '/x', 'Vol-2', [ 1, 10 ] ],
+	[ '/b', 'Vol-1', [ 2, 64 ], [ 3, 64 ] ], [ '/c', 'Vol-1', [ 4, 10 ] ] );
+    my $plan = Amanda::Recovery::Planner::Plan->new({
+	dumps => [ @dumps ],
+	catalog => bless({ dumps => [ @dumps ] }, 'main::FakeCatalog') });
+    my $dev = bless {}, 'main::FakeDevice';
+
+    $plan->order_volume(label => 'Vol-1', device => $dev);
+    is_deeply($dev->{'extents'}, [ [ 1, 2, 7 ], [ 2, 8, 15 ], [ 4, 16, 18 ] ],
+	"order_volume places the files of the volume from the part sizes");
+    is_deeply([ map { $_->{'diskname'} } @{$plan->{'dumps'}} ],
+	[ '/c', '/x', '/b', '/a' ],
+	"order_volume puts the dumps of the volume in the recommended order");
+}
+
 $catalog->quit();
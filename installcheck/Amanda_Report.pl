@@ -185,6 +185,7 @@ STATS driver hostname localhost
 STATS driver startup time 0.034
 SUCCESS dumper localhost /root 20090728122430 0 [sec 0.02 kb 42 kps 2100 orig-kb 42]
 STATS driver estimate localhost /root 20090728122430 0 [sec 0 nkb 42 ckb 64 kps 1024]
+INFO dumper network localhost /etc 20090728122430 0 [rtt 1.250 rtt-max 3.500 rcv-rtt 0.875 retrans 3 kps 20480.0 rwnd-limited 0.0 sndbuf-limited 0.0]
 SUCCESS dumper localhost /etc 20090728122430 0 [sec 0.87 kb 2048 kps 2354 orig-kb 2048]
 STATS driver estimate localhost /etc 20090728122430 0 [sec 2 nkb 2048 ckb 64 kps 1024]
 SUCCESS dumper localhost /home 20090728122430 0 [sec 1.68421 kb 4096 kps 2354 orig-kb 4096]
@@ -258,6 +259,15 @@ $LogfileData{dumper} = {
                             kb        => "2048",
                             kps       => "2354",
                             orig_kb   => "2048",
+                            network   => {
+                                'rtt'            => "1.250",
+                                'rtt-max'        => "3.500",
+                                'rcv-rtt'        => "0.875",
+                                'retrans'        => "3",
+                                'kps'            => "20480.0",
+                                'rwnd-limited'   => "0.0",
+                                'sndbuf-limited' => "0.0",
+                            },
                         },
                     },
 		  ]
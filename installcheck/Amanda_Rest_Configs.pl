@@ -304,7 +304,12 @@ is_deeply (Installcheck::Config::remove_source_line($reply),
 			'TAPECYCLE' => 3,
 			'DEBUG-RECOVERY' => 1,
 			'ETIMEOUT' => 300,
+			'ESTIMATE-PARALLEL' => 0,
+			'CHECK-PARALLEL' => 0,
+			'CHECK-CACHE-TIME' => 0,
 			'DEBUG-SENDBACKUP' => 0,
+			'DEBUG-XFER' => 0,
+			'DEBUG-SHM' => 0,
 			'REPORT-USE-MEDIA' => 'YES',
 			'DEBUG-AMINDEXD' => 0,
 			'MAILER' => getconf($CNF_MAILER),
@@ -371,6 +376,7 @@ is_deeply (Installcheck::Config::remove_source_line($reply),
 			'DEBUG-SELFCHECK' => 0,
 			'MAXDUMPS' => 1,
 			'AUTOFLUSH' => 'NO',
+			'AUTOTUNE' => 'NO',
 			'CONNECT-TRIES' => 3,
 			'RUNSPERCYCLE' => 0,
 			'KRB5PRINCIPAL' => 'service/amanda',
@@ -379,6 +385,11 @@ is_deeply (Installcheck::Config::remove_source_line($reply),
 			'DISKFILE' => 'disklist',
 			'TAPERFLUSH' => 0,
 			'SORT-INDEX' => 'NO',
+			'INDEX-CACHE-DIR' => undef,
+			'INDEX-CACHE-SIZE' => 1048576,
+			'METRICS-DIR' => undef,
+			'COMPRESS-CPU-BUDGET' => 0,
+			'RESUME-DUMP' => 2,
 			'REST-SSL-KEY' => undef,
 			'REST-SSL-CERT' => undef,
 			'CTIMEOUT' => 30,
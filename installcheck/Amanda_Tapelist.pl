@@ -18,7 +18,7 @@
 # Contact information: Carbonite Inc., 756 N Pastoria Ave
 # Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
 
-use Test::More tests => 54;
+use Test::More tests => 58;
 use strict;
 use warnings;
 
@@ -586,3 +586,44 @@ is(Amanda::Tapelist::volume_is_reusable("TESTCONF2-012"), 0, "volume_is_reusable
 is(Amanda::Tapelist::volume_is_reusable("TESTCONF2-013"), 0, "volume_is_reusable TESTCONF2-013");
 is(Amanda::Tapelist::volume_is_reusable("TESTCONF2-014"), 0, "volume_is_reusable TESTCONF2-014");
 is(Amanda::Tapelist::volume_is_reusable("TESTCONF2-015"), 1, "volume_is_reusable TESTCONF2-015");
+
+# the changes log extends the snapshot it names
+@lines = (
+    "20071111010002 TESTCONF004 reuse POOL:POOL1\n",
+    "20071110010002 TESTCONF003 reuse POOL:POOL1\n",
+    "20071109010002 TESTCONF002 reuse POOL:POOL1\n",
+);
+mktapelist($tapelist, @lines);
+utime(time()-10, time()-10, $tapelist);
+my @st = stat($tapelist);
+open(my $cfh, ">", "$tapelist.changes") or die("Could not write '$tapelist.changes'");
+print $cfh "TAPELIST $st[1] $st[7]\n";
+print $cfh "20071112010002 TESTCONF005 reuse POOL:POOL1\n";
+print $cfh "DELETE TESTCONF003 POOL:POOL1\n";
+close($cfh);
+
+($tl, $message) = Amanda::Tapelist->new($tapelist);
+is_deeply([ map { $_->{'label'} } @{$tl->{'tles'}} ],
+	  [ 'TESTCONF005', 'TESTCONF004', 'TESTCONF002' ],
+	  "the changes log is applied to the snapshot");
+is($tl->lookup_tape_by_pool_label('POOL1', 'TESTCONF003'), undef,
+   "..including the deletions");
+
+open($cfh, ">>", "$tapelist.changes") or die("Could not append to '$tapelist.changes'");
+print $cfh "20071113010002 TESTCONF002 no-reuse POOL:POOL1\n";
+print $cfh "20071114010002 TESTCONF006 reuse POOL:POOL1";
+close($cfh);
+$tl->reload();
+is_deeply([ map { $_->{'label'} . ":" . $_->{'reuse'} } @{$tl->{'tles'}} ],
+	  [ 'TESTCONF002:0', 'TESTCONF005:1', 'TESTCONF004:1' ],
+	  "reload reads the new records, but not a partial one");
+
+open($cfh, ">", "$tapelist.changes") or die("Could not write '$tapelist.changes'");
+print $cfh "TAPELIST 1 1\n";
+print $cfh "DELETE TESTCONF004 POOL:POOL1\n";
+close($cfh);
+($tl, $message) = Amanda::Tapelist->new($tapelist);
+is_deeply([ map { $_->{'label'} } @{$tl->{'tles'}} ],
+	  [ 'TESTCONF004', 'TESTCONF003', 'TESTCONF002' ],
+	  "a changes log for another snapshot is ignored");
+unlink("$tapelist.changes");
@@ -18,7 +18,7 @@
 # Contact information: Carbonite Inc., 756 N Pastoria Ave
 # Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
 
-use Test::More tests => 68;
+use Test::More tests => 70;
 use File::Path;
 use Data::Dumper;
 use strict;
@@ -505,7 +505,7 @@ pass("Two simultaneous transfers run to completion");
 }
 
 SKIP: {
-    skip "not built with server", 45 unless Amanda::Util::built_with_component("server");
+    skip "not built with server", 47 unless Amanda::Util::built_with_component("server");
 
     my $disk_cache_dir = "$Installcheck::TMP";
     my $RANDOM_SEED = 0xFACADE;
@@ -680,6 +680,10 @@ SKIP: {
 		return;
 	    }
 
+	    # with auto_parts, the element went on to the next part by itself
+	    return if $params{'auto_parts'} and $partnum > 0
+		      and $successful and !$eom;
+
 	    if (!$eof) {
 		if ($successful) {
 		    $dest->start_part(0, $hdr);
@@ -971,6 +975,22 @@ SKIP: {
 	  'eda70336:3250585' ],
 	);
 
+    test_taper_dest(
+	Amanda::Xfer::Source::Random->new(1024*1024*3.1, $RANDOM_SEED),
+	sub {
+	    my ($first_dev) = @_;
+	    my $dest = Amanda::Xfer::Dest::Taper::Splitter->new($first_dev,
+						128*1024, 1024*1024, 0);
+	    $dest->set_auto_parts(1);
+	    return $dest;
+	},
+	[ "PART-1-1048576-OK", "PART-2-1048576-OK", "PART-3-294912-OK", "EOM",
+	  "PART-4-858521-OK",
+	  "DONE" ],
+	[ 'eda70336:3250585', 'eda70336:3250585' ],
+	"Amanda::Xfer::Dest::Taper::Splitter - parts started by the element",
+	auto_parts => 1);
+
     test_taper_dest(
 	Amanda::Xfer::Source::Random->new(1024*1024*1.5, $RANDOM_SEED),
 	sub {
@@ -0,0 +1,99 @@
+# Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+# for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+#
+# Contact information: Carbonite Inc., 756 N Pastoria Ave
+# Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
+
+use Test::More tests => 16;
+
+use lib '@amperldir@';
+use strict;
+use warnings;
+use Installcheck;
+use Amanda::Constants;
+use Amanda::Debug;
+use Amanda::Paths;
+use Amanda::Tests;
+use File::Path;
+use Installcheck::Application;
+use IO::File;
+
+Amanda::Debug::dbopen("installcheck");
+Installcheck::log_test_output();
+
+my $app = Installcheck::Application->new('amblkdiff');
+
+my $support = $app->support();
+is($support->{'INDEX-LINE'}, 'YES', "supports indexing");
+is($support->{'MAX-LEVEL'}, '99', "supports incrementals");
+
+my $root_dir = "$Installcheck::TMP/installcheck-amblkdiff";
+my $back_file = "$root_dir/to_backup";
+my $state_dir = "$root_dir/state";
+my $rest_dir = "$root_dir/restore";
+
+rmtree($root_dir);
+File::Path::mkpath($state_dir);
+File::Path::mkpath($rest_dir);
+Amanda::Tests::write_random_file(0xabcde, 1024*1024, $back_file);
+
+$app->add_property('statedir', $state_dir);
+$app->add_property('blocksize', 65536);
+
+my $selfcheck = $app->selfcheck('device' => $back_file, 'level' => 0, 'index' => 'line');
+ok(!@{$selfcheck->{'errors'}}, "no errors during selfcheck");
+
+my $full = $app->backup('device' => $back_file, 'level' => 0, 'index' => 'line',
+			'record' => 1);
+is($full->{'exit_status'}, 0, "level 0 error status ok");
+ok(!@{$full->{'errors'}}, "no errors during level 0 backup")
+    or diag(@{$full->{'errors'}});
+is_deeply($full->{'index'}, ["/"], "index is '/'");
+
+# change two blocks
+my $fh = IO::File->new($back_file, "r+") or die("Can't open '$back_file': $!");
+sysseek($fh, 65536 * 3 + 10, 0);
+syswrite($fh, "x" x 65536);
+$fh->close();
+
+my $estimate = $app->estimate('device' => $back_file, 'level' => 1);
+is($estimate->{'size'}, 131072, "level 1 estimate is the size of the changed blocks");
+
+my $incr = $app->backup('device' => $back_file, 'level' => 1, 'index' => 'line',
+			'record' => 1);
+is($incr->{'exit_status'}, 0, "level 1 error status ok");
+ok(!@{$incr->{'errors'}}, "no errors during level 1 backup")
+    or diag(@{$incr->{'errors'}});
+is($incr->{'size'}, 131072, "level 1 holds only the changed blocks");
+ok(length($incr->{'data'}) < length($full->{'data'}) / 4,
+    "level 1 is smaller than level 0");
+
+my $orig_cur_dir = POSIX::getcwd();
+ok(chdir($rest_dir), "changed working directory (for restore)");
+
+my $restore = $app->restore('objects' => ['.'], 'data' => $full->{'data'});
+is($restore->{'exit_status'}, 0, "level 0 restore error status ok");
+$restore = $app->restore('objects' => ['.'], 'data' => $incr->{'data'},
+			 'level' => 1);
+is($restore->{'exit_status'}, 0, "level 1 restore error status ok");
+
+ok(chdir($orig_cur_dir), "changed working directory (back to original)");
+
+my $restore_file = "$rest_dir/amblkdiff-restored";
+is(`cmp $back_file $restore_file`, "", "restore of level 0 and 1 match");
+
+# cleanup
+rmtree($root_dir);
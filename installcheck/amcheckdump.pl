@@ -18,7 +18,7 @@
 # Contact information: Carbonite Inc., 756 N Pastoria Ave
 # Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
 
-use Test::More tests => 8;
+use Test::More tests => 10;
 use strict;
 use warnings;
 
@@ -84,6 +84,9 @@ like(run_get('amcheckdump', 'TESTCONF', '-oorg=installcheck'), qr(Validating),
 like(run_get('amcheckdump', 'TESTCONF'), qr(Validating),
     "amcheckdump succeeds, claims to validate something (usetimestamps=yes)");
 
+like(run_get('amcheckdump', '--crc-only', 'TESTCONF'), qr(successfully validated),
+    "amcheckdump --crc-only validates the images from their CRCs");
+
 ##
 # now try zeroing out the dumps
 
@@ -102,4 +105,7 @@ for my $dumpfile (@dump1) {
 ok(!run('amcheckdump', 'TESTCONF'),
     "amcheckdump detects a failure from a zeroed-out dumpfile");
 
+ok(!run('amcheckdump', '--crc-only', 'TESTCONF'),
+    "amcheckdump --crc-only detects a failure from a zeroed-out dumpfile");
+
 #Installcheck::Run::cleanup();
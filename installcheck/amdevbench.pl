@@ -0,0 +1,69 @@
+# Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+# for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+#
+# Contact information: Carbonite Inc., 756 N Pastoria Ave
+# Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
+
+use Test::More tests => 9;
+use strict;
+use warnings;
+
+use lib '@amperldir@';
+use Installcheck;
+use Installcheck::Run qw( run run_get );
+use Amanda::Paths;
+use Amanda::Constants;
+use File::Path qw( mkpath rmtree );
+use Amanda::Debug;
+
+Amanda::Debug::dbopen("installcheck");
+Installcheck::log_test_output();
+
+my $vtape = "$Installcheck::TMP/amdevbench-installcheck";
+
+rmtree($vtape);
+mkpath("$vtape/data");
+
+ok(run('amdevbench', '--version'),
+    "amdevbench --version OK");
+like($Installcheck::Run::stdout,
+    qr{^amdevbench-},
+    "..and output is reasonable");
+
+ok(run('amdevbench', '--length', '1m', "file:$vtape"),
+    "simple benchmark succeeds");
+like($Installcheck::Run::stdout,
+    qr{^  write 1048576 bytes in 1 files, .* MB/s}m,
+    "..and reports the write throughput");
+like($Installcheck::Run::stdout,
+    qr{^  read  1048576 bytes in 1 files, .* MB/s}m,
+    "..and the read throughput");
+
+ok(run('amdevbench', '--length', '1m', '--block-size', '32k,64k',
+	'--part-size', '256k,1m', '--json', "file:$vtape"),
+    "sweep with --json succeeds");
+my @runs = ($Installcheck::Run::stdout =~ /"part_size": (\d+)/g);
+is_deeply([ @runs ], [ 262144, 1048576, 262144, 1048576 ],
+    "..and makes a run for each combination");
+like($Installcheck::Run::stdout,
+    qr{"read": \{"bytes": 1048576, "files": 4,}m,
+    "..and reads back every part");
+
+ok(!run('amdevbench', '--length', '1m', '--property', 'NO_SUCH_PROPERTY=1',
+	"file:$vtape"),
+    "an unknown property makes the run fail");
+
+rmtree($vtape);
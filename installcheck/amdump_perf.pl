@@ -0,0 +1,252 @@
+# Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+# for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+#
+# Contact information: Carbonite Inc., 756 N Pastoria Ave
+# Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
+
+# A performance test: a full amdump of synthetic clients, compared with the
+# results of a previous run.  It takes minutes and needs a quiet host, so it
+# only runs when INSTALLCHECK_PERF is set.  The other settings are:
+#
+#   INSTALLCHECK_PERF_CLIENTS    number of DLEs (8)
+#   INSTALLCHECK_PERF_SIZE       bytes dumped by each DLE (64m)
+#   INSTALLCHECK_PERF_RATE       bytes per second of each client, 0 for no cap
+#   INSTALLCHECK_PERF_LATENCY    seconds each client takes to answer (0)
+#   INSTALLCHECK_PERF_DATA       'random' or 'pattern' (random)
+#   INSTALLCHECK_PERF_HOLDING    'yes' to dump to holding disk (yes)
+#   INSTALLCHECK_PERF_BASELINE   file of the baseline results
+#   INSTALLCHECK_PERF_TOLERANCE  fraction the results may be worse by (0.25)
+#   INSTALLCHECK_PERF_UPDATE     write this run's results to the baseline
+#
+# With INSTALLCHECK_S3_ACCESS_KEY, INSTALLCHECK_S3_SECRET_KEY and
+# INSTALLCHECK_PERF_S3_DEVICE (an s3: device name, which may point at a mock
+# S3 server with the S3_HOST property given in INSTALLCHECK_PERF_S3_HOST),
+# the dumps go to that device instead of the vtapes.
+
+use Test::More;
+use File::Path;
+use POSIX qw( times sysconf _SC_CLK_TCK );
+use strict;
+use warnings;
+
+use lib '@amperldir@';
+use Installcheck;
+use Installcheck::Config;
+use Installcheck::Run qw(run run_err $diskname $holdingdir amdump_diag);
+use Amanda::Paths;
+use Amanda::Debug;
+use Amanda::Config qw( :init :getconf config_dir_relative );
+use Amanda::DB::Catalog2;
+
+eval "require Time::HiRes;";
+
+if (!$ENV{'INSTALLCHECK_PERF'}) {
+    plan skip_all => "set INSTALLCHECK_PERF to run the performance tests";
+    exit 0;
+}
+
+Amanda::Debug::dbopen("installcheck");
+Installcheck::log_test_output();
+
+sub parse_size {
+    my ($str) = @_;
+    my %mult = ('' => 1, 'k' => 1024, 'm' => 1024*1024, 'g' => 1024*1024*1024);
+
+    die "invalid size '$str'" if $str !~ /^(\d+)([kmg]?)b?$/i;
+    return $1 * $mult{lc $2};
+}
+
+my $clients = $ENV{'INSTALLCHECK_PERF_CLIENTS'} || 8;
+my $size = parse_size($ENV{'INSTALLCHECK_PERF_SIZE'} || '64m');
+my $rate = parse_size($ENV{'INSTALLCHECK_PERF_RATE'} || '0');
+my $latency = $ENV{'INSTALLCHECK_PERF_LATENCY'} || 0;
+my $data = $ENV{'INSTALLCHECK_PERF_DATA'} || 'random';
+my $holding = ($ENV{'INSTALLCHECK_PERF_HOLDING'} || 'yes') ne 'no';
+my $tolerance = $ENV{'INSTALLCHECK_PERF_TOLERANCE'} || 0.25;
+my $baseline_file = $ENV{'INSTALLCHECK_PERF_BASELINE'}
+		 || "$AMANDA_TMPDIR/installcheck-amdump_perf.baseline";
+my $s3_device = $ENV{'INSTALLCHECK_PERF_S3_DEVICE'};
+$s3_device = undef if !$ENV{'INSTALLCHECK_S3_ACCESS_KEY'} ||
+		      !$ENV{'INSTALLCHECK_S3_SECRET_KEY'};
+
+# the results of a run are compared with the baseline with the same workload
+my $workload = join(' ', "clients=$clients", "size=$size", "rate=$rate",
+			 "latency=$latency", "data=$data",
+			 "holding=" . ($holding ? 'yes' : 'no'),
+			 "dest=" . ($s3_device ? 's3' : 'vtape'));
+
+# results where less is better, and where more is better
+my @lower_better = qw( makespan cpu );
+my @higher_better = qw( dumper_kps chunker_kps taper_kps total_kps );
+
+my $total_kb = int($clients * $size / 1024);
+
+my $testconf = Installcheck::Run::setup();
+$testconf->add_param('autolabel', '"TESTCONF%%" empty volume_error');
+$testconf->add_param('inparallel', $clients);
+$testconf->add_param('netusage', '8 gbytes');
+# room for all of the dumps on one volume
+$testconf->add_tapetype('TEST-TAPE', [
+    'length' => int($total_kb * 2 + 1024*1024) . ' kbytes',
+    'filemark' => '4 kbytes',
+]);
+if ($holding) {
+    $testconf->add_holdingdisk("hd-perf", [
+	'directory' => "\"$holdingdir-perf\"",
+	'use' => int($total_kb * 2) . ' kbytes',
+	'chunksize' => '1 gbyte',
+    ]);
+    rmtree("$holdingdir-perf");
+    mkpath("$holdingdir-perf");
+}
+if ($s3_device) {
+    my @props = (
+	'device_property', "\"S3_ACCESS_KEY\" \"$ENV{'INSTALLCHECK_S3_ACCESS_KEY'}\"",
+	'device_property', "\"S3_SECRET_KEY\" \"$ENV{'INSTALLCHECK_S3_SECRET_KEY'}\"",
+    );
+    push @props, 'device_property', "\"S3_HOST\" \"$ENV{'INSTALLCHECK_PERF_S3_HOST'}\""
+	if $ENV{'INSTALLCHECK_PERF_S3_HOST'};
+    $testconf->add_device('perf-s3', [ 'tapedev', "\"$s3_device\"", @props ]);
+    $testconf->add_param('tpchanger', '"perf-s3"');
+}
+$testconf->add_dumptype('perf-client', [
+    'inherit' => 'installcheck-test',
+    'program' => '"APPLICATION"',
+    'holdingdisk' => $holding ? 'required' : 'never',
+    'maxdumps' => $clients,
+]);
+for my $i (1 .. $clients) {
+    my $props = "property \"SIZE\" \"$size\"\n"
+	      . "\tproperty \"BLOCK-SIZE\" \"32768\"\n"
+	      . "\tproperty \"DATA\" \"$data\"\n";
+    $props .= "\tproperty \"RATE\" \"$rate\"\n" if $rate;
+    $props .= "\tproperty \"LATENCY\" \"$latency\"\n" if $latency;
+    $testconf->add_dle(<<EODLE);
+localhost perf$i $diskname {
+    perf-client
+    application {
+	plugin "amrandom"
+	$props    }
+}
+EODLE
+}
+$testconf->write( do_catalog => 0 );
+
+config_init($CONFIG_INIT_EXPLICIT_NAME, "TESTCONF");
+my $catalog = Amanda::DB::Catalog2->new(undef, create => 1, drop_tables => 1, load => 1);
+$catalog->quit();
+
+plan tests => 3 + @lower_better + @higher_better;
+
+# amdump waits for the driver, the dumpers, the chunkers, the taper and the
+# local amandad, so their CPU time is in the children's times
+my $clk_tck = sysconf(_SC_CLK_TCK);
+my @times_before = times();
+my $start = Time::HiRes::time();
+ok(run('amdump', 'TESTCONF'), "amdump of $clients synthetic clients succeeds")
+    or amdump_diag();
+my %result;
+$result{'makespan'} = Time::HiRes::time() - $start;
+my @times_after = times();
+$result{'cpu'} = ($times_after[2] + $times_after[3]
+		- $times_before[2] - $times_before[3]) / $clk_tck;
+
+# per-stage throughput, from the trace log
+my $logdir = config_dir_relative(getconf($CNF_LOGDIR));
+my ($trace) = sort { -M $a <=> -M $b } glob("$logdir/log.*");
+my %stage = map { $_ => { kb => 0, sec => 0, count => 0 } } qw( dumper chunker taper );
+open(my $fh, "<", $trace) or die("Can't open '$trace': $!");
+while (my $line = <$fh>) {
+    my $prog;
+    if ($line =~ /^SUCCESS (dumper|chunker) /) {
+	$prog = $1;
+    } elsif ($line =~ /^DONE taper /) {
+	$prog = 'taper';
+    } else {
+	next;
+    }
+    next if $line !~ /\[sec ([\d.]+) (?:kb|bytes) (\d+) /;
+    my ($sec, $amount) = ($1, $2);
+    $amount /= 1024 if $line =~ /\[sec [\d.]+ bytes /;
+    $stage{$prog}{'kb'} += $amount;
+    $stage{$prog}{'sec'} += $sec;
+    $stage{$prog}{'count'}++;
+}
+close($fh);
+is($stage{'dumper'}{'count'}, $clients, "..and every client is dumped");
+
+# the average throughput of one stream of each stage, and of the whole run
+for my $prog (keys %stage) {
+    $result{"${prog}_kps"} = $stage{$prog}{'sec'} ?
+		$stage{$prog}{'kb'} / $stage{$prog}{'sec'} : 0;
+}
+$result{'total_kps'} = $result{'makespan'} ?
+		$stage{'dumper'}{'kb'} / $result{'makespan'} : 0;
+
+diag("$workload");
+diag(join(' ', map { sprintf("%s=%.3f", $_, $result{$_}) }
+		   @lower_better, @higher_better));
+
+# the baseline holds one line per workload: "WORKLOAD\tKEY=VALUE ..."
+my %baselines;
+if (open(my $bfh, "<", $baseline_file)) {
+    while (my $line = <$bfh>) {
+	chomp $line;
+	my ($wl, $values) = split /\t/, $line, 2;
+	next if !defined $values;
+	$baselines{$wl} = { map { split /=/, $_, 2 } split(' ', $values) };
+    }
+    close($bfh);
+}
+my $baseline = $baselines{$workload};
+
+SKIP: {
+    skip "no baseline for this workload in $baseline_file",
+	@lower_better + @higher_better
+	if !$baseline;
+
+    for my $key (@lower_better) {
+	my $limit = $baseline->{$key} * (1 + $tolerance);
+	ok($result{$key} <= $limit, "$key is not worse than the baseline")
+	    or diag(sprintf("%s: %.3f, baseline %.3f", $key, $result{$key},
+			    $baseline->{$key}));
+    }
+    for my $key (@higher_better) {
+	my $limit = $baseline->{$key} * (1 - $tolerance);
+	ok($result{$key} >= $limit, "$key is not worse than the baseline")
+	    or diag(sprintf("%s: %.3f, baseline %.3f", $key, $result{$key},
+			    $baseline->{$key}));
+    }
+}
+
+if (!$baseline || $ENV{'INSTALLCHECK_PERF_UPDATE'}) {
+    $baselines{$workload} = { %result };
+    my $ok = open(my $bfh, ">", "$baseline_file.tmp");
+    if ($ok) {
+	for my $wl (sort keys %baselines) {
+	    my $b = $baselines{$wl};
+	    print $bfh "$wl\t", join(' ', map { sprintf("%s=%.3f", $_, $b->{$_}) }
+					 sort keys %$b), "\n";
+	}
+	$ok = close($bfh) && rename("$baseline_file.tmp", $baseline_file);
+    }
+    ok($ok, "baseline written to $baseline_file");
+} else {
+    pass("baseline kept");
+}
+
+Installcheck::Run::cleanup();
+rmtree("$holdingdir-perf");
@@ -0,0 +1,207 @@
+# Copyright (c) 2009-2012 Zmanda, Inc.  All Rights Reserved.
+# Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+# for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+#
+# Contact information: Carbonite Inc., 756 N Pastoria Ave
+# Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
+
+use Test::More tests => 29;
+
+use lib "@amperldir@";
+use strict;
+use warnings;
+use Installcheck;
+use Amanda::Constants;
+use Amanda::Paths;
+use File::Path;
+use Installcheck::Application;
+use IO::File;
+use Data::Dumper;
+use Amanda::Debug;
+
+unless ($Amanda::Constants::GNUTAR and -x $Amanda::Constants::GNUTAR) {
+    SKIP: {
+        skip("GNU tar is not available", Test::More->builder->expected_tests);
+    }
+    exit 0;
+}
+
+Amanda::Debug::dbopen("installcheck");
+Installcheck::log_test_output();
+
+my $app = Installcheck::Application->new('amptar');
+
+my $support = $app->support();
+is($support->{'INDEX-LINE'}, 'YES', "supports indexing");
+is($support->{'MESSAGE-LINE'}, 'YES', "supports messages");
+
+my $root_dir = "$Installcheck::TMP/installcheck-amptar";
+my $back_dir = "$root_dir/to_backup";
+my $rest_dir = "$root_dir/restore";
+my $state_dir = "$root_dir/state";
+
+sub ok_foreach {
+    my $code = shift @_;
+    my $stringify = shift @_;
+    my $name = shift @_;
+    my @list = @_;
+
+    my @errors;
+    foreach my $elm (@list) {
+        my $elm_str = $stringify? $stringify->($elm) : "$elm";
+        push @errors, "on element $elm_str: $@" unless eval {$code->($elm); 1;};
+    }
+    unless (ok(!@errors, $name)) {
+        foreach my $err (@errors) {
+            diag($err);
+        }
+    }
+}
+
+rmtree($root_dir);
+mkpath($back_dir);
+mkpath($rest_dir);
+mkpath($state_dir);
+$app->add_property('STATE-DIR', $state_dir);
+# few readers and a small window, so the writer has to wait on them
+$app->add_property('READERS', '2');
+$app->add_property('READ-AHEAD', '64k');
+
+sub write_file {
+    my ($name, $contents) = @_;
+    my $fh = new IO::File("$back_dir/$name", '>') or die "$name: $!";
+    print $fh $contents;
+    undef $fh;
+}
+
+my @dir_struct = (
+    {'type' => 'f', 'name' => 'foo', 'contents' => "foo\n"},
+    {'type' => 'f', 'name' => 'big', 'contents' => "x" x 300000},
+    {'type' => 'f', 'name' => 'empty', 'contents' => ""},
+    {'type' => 'f', 'name' => ('l' x 150), 'contents' => "long name\n"},
+    {'type' => 'd', 'name' => 'bar/baz/bat/'},
+    {'type' => 'h', 'name' => 'hard', 'to' => 'foo'},
+    {'type' => 's', 'name' => 'sym', 'to' => 'bar'},
+);
+push @dir_struct, map { {'type' => 'f', 'name' => "bar/f$_", 'contents' => "$_\n"} } (1..50);
+
+ok_foreach(
+    sub {
+        my $obj = shift @_;
+
+        if ($obj->{'type'} eq 'f') {
+            write_file($obj->{'name'}, $obj->{'contents'});
+        } elsif ($obj->{'type'} eq 'd') {
+            mkpath("$back_dir/$obj->{'name'}");
+        } elsif ($obj->{'type'} eq 'h') {
+            link("$back_dir/$obj->{'to'}", "$back_dir/$obj->{'name'}") or die "$!";
+        } elsif ($obj->{'type'} eq 's') {
+            symlink("$obj->{'to'}", "$back_dir/$obj->{'name'}") or die "$!";
+        } else {
+            die "unknown object type $obj->{'type'} for $obj->{'name'}";
+        }
+    },
+    sub {shift(@_)->{'name'}},
+    "create directory structure",
+    @dir_struct);
+
+my $selfcheck = $app->selfcheck_message('device' => $back_dir, 'level' => 0, 'index' => 'line');
+is($selfcheck->{'exit_status'}, 0, "error status ok");
+ok(!@{$selfcheck->{'errors'}}, "no errors during selfcheck")
+    or diag(Data::Dumper::Dumper(\@{$selfcheck->{'errors'}}));
+
+my $estimate = $app->estimate('device' => $back_dir, 'level' => 0, 'index' => 'line');
+is($estimate->{'exit_status'}, 0, "estimate error status ok");
+
+my $backup = $app->backup('device' => $back_dir, 'level' => 0, 'index' => 'line',
+			  'record' => 1);
+is($backup->{'exit_status'}, 0, "error status ok");
+ok(!@{$backup->{'errors'}}, "no errors during backup")
+    or diag(@{$backup->{'errors'}});
+
+is(length($backup->{'data'}), $backup->{'size'}, "reported and actual size match");
+is(length($backup->{'data'}) % 10240, 0, "archive is padded to whole records");
+
+ok(@{$backup->{'index'}}, "index is not empty");
+ok_foreach(
+    sub {
+        my $obj = shift @_;
+        my $name = $obj->{'name'};
+        $name =~ s{/$}{};
+        die "missing $name" unless
+            grep {"/$name" eq $_ or "/$name/" eq $_} @{$backup->{'index'}};
+    },
+    sub {shift(@_)->{'name'}},
+    "index contains all names/paths",
+    @dir_struct);
+
+my $orig_cur_dir = POSIX::getcwd();
+ok($orig_cur_dir, "got current directory");
+
+ok(chdir($rest_dir), "changed working directory (for restore)");
+my $restore = $app->restore('objects' => ['.'], 'data' => $backup->{'data'});
+is($restore->{'exit_status'}, 0, "error status ok");
+ok(chdir($orig_cur_dir), "changed working directory (back to original)");
+
+ok_foreach(
+    sub {
+        my $obj = shift @_;
+        my $name = $obj->{'name'};
+        if ($obj->{'type'} eq 'f') {
+            die "$name not restored" unless -f "$rest_dir/$name";
+            die "$name has the wrong size"
+                unless -s "$rest_dir/$name" == length($obj->{'contents'});
+        } elsif ($obj->{'type'} eq 'd') {
+            die "$name not restored" unless -d "$rest_dir/$name";
+        } elsif ($obj->{'type'} eq 'h') {
+            die "$name is not a hard link"
+                unless (stat("$rest_dir/$name"))[1] == (stat("$rest_dir/$obj->{'to'}"))[1];
+        } elsif ($obj->{'type'} eq 's') {
+            die "$name is not a symlink" unless readlink("$rest_dir/$name") eq $obj->{'to'};
+        }
+    },
+    sub {shift(@_)->{'name'}},
+    "level 0 restored",
+    @dir_struct);
+
+# change the tree for a level 1
+sleep(1);
+write_file("bar/f1", "changed\n");
+unlink("$back_dir/bar/f2");
+mkpath("$back_dir/new");
+write_file("new/file", "new\n");
+
+$backup = $app->backup('device' => $back_dir, 'level' => 1, 'index' => 'line',
+		       'record' => 1);
+is($backup->{'exit_status'}, 0, "level 1 error status ok");
+ok(!@{$backup->{'errors'}}, "no errors during level 1 backup")
+    or diag(@{$backup->{'errors'}});
+is(length($backup->{'data'}), $backup->{'size'}, "level 1 reported and actual size match");
+ok((grep { $_ eq "/bar/f1" } @{$backup->{'index'}}), "changed file in the level 1");
+ok((grep { $_ eq "/new/file" } @{$backup->{'index'}}), "new file in the level 1");
+ok(!(grep { $_ eq "/bar/f3" } @{$backup->{'index'}}), "unchanged file not in the level 1");
+
+ok(chdir($rest_dir), "changed working directory (for restore)");
+$restore = $app->restore('objects' => ['.'], 'data' => $backup->{'data'}, 'level' => 1);
+is($restore->{'exit_status'}, 0, "level 1 error status ok");
+ok(chdir($orig_cur_dir), "changed working directory (back to original)");
+
+ok(-f "$rest_dir/new/file", "new file restored");
+ok(!-e "$rest_dir/bar/f2", "removed file removed on restore");
+is(-s "$rest_dir/bar/f1", length("changed\n"), "changed file restored");
+
+# cleanup
+rmtree($root_dir);
@@ -0,0 +1,79 @@
+# Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+# for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+#
+# Contact information: Carbonite Inc., 756 N Pastoria Ave
+# Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
+
+use Test::More tests => 8;
+use strict;
+use warnings;
+
+use lib '@amperldir@';
+use Installcheck;
+use Installcheck::Run qw( run run_get );
+use Amanda::Debug;
+use Amanda::Paths;
+
+Amanda::Debug::dbopen("installcheck");
+Installcheck::log_test_output();
+
+# two hosts dumped in parallel, hostb in 50 seconds and hosta in 100, each
+# written to tape at 500 kps from the holding disk
+my $amdump = "$Installcheck::TMP/amsimulate-amdump";
+open(my $fh, ">", $amdump) or die("Can't write '$amdump': $!");
+print $fh <<'END';
+GENERATING SCHEDULE:
+--------
+DUMP hosta ffff /a 20080618130147 1 0 1970:1:1:0:0:0 19700101000000 1000 1000 100 10
+DUMP hostb ffff /b 20080618130147 1 0 1970:1:1:0:0:0 19700101000000 500 500 50 10
+--------
+driver: start time 0.059 inparallel 2 bandwidth 600 diskspace 868352  dir OBSOLETE datestamp 20080618130147 driver: drain-ends tapeq FIRST big-dumpers TT
+driver: send-cmd time 1.330 to dumper0: PORT-DUMP 00-00001 1487 NULL 4 hosta ffff /a NODEVICE 0 1970:1:1:0:0:0 GNUTAR X amanda X local |""
+driver: send-cmd time 1.330 to dumper1: PORT-DUMP 00-00002 1488 NULL 4 hostb ffff /b NODEVICE 0 1970:1:1:0:0:0 GNUTAR X amanda X local |""
+driver: result time 51.4 from dumper1: DONE 00-00002 500 500 0 "[sec 50.0 kb 500 kps 10.0 orig-kb 500]"
+driver: send-cmd time 51.5 to taper0: FILE-WRITE worker0-0 00-00003 /hold/b hostb /b 0 20080618130147 0
+driver: result time 52.5 from taper0: DONE worker0-0 00-00003 INPUT-GOOD TAPE-GOOD "00000000:0" "[sec 1.0 kb 500 kps 500.0]" "" ""
+driver: result time 101.4 from dumper0: DONE 00-00001 1000 1000 0 "[sec 100.0 kb 1000 kps 10.0 orig-kb 1000]"
+driver: send-cmd time 101.5 to taper0: FILE-WRITE worker0-0 00-00004 /hold/a hosta /a 0 20080618130147 0
+driver: result time 103.5 from taper0: DONE worker0-0 00-00004 INPUT-GOOD TAPE-GOOD "00000000:0" "[sec 2.0 kb 1000 kps 500.0]" "" ""
+END
+close($fh);
+
+ok(run('amsimulate', $amdump),
+    "amsimulate runs with the settings of the amdump file");
+like($Installcheck::Run::stdout,
+    qr{settings: inparallel 2 dumporder TT netusage 600 holding 868352 taper-parallel-write 1},
+    "..and uses the recorded settings");
+like($Installcheck::Run::stdout,
+    qr{predicted run time: 0:01:42 \(dumps done at 0:01:40\)},
+    "..and predicts the run time");
+like($Installcheck::Run::stdout,
+    qr{recorded run time:  0:01:44},
+    "..and reports the recorded run time");
+
+ok(run('amsimulate', '--inparallel', '1', $amdump),
+    "amsimulate runs with one dumper");
+like($Installcheck::Run::stdout,
+    qr{predicted run time: 0:02:31 \(dumps done at 0:02:30\)},
+    "..and the dumps are done one after the other");
+
+ok(run('amsimulate', '--inparallel', '1', '--holding', '600', $amdump),
+    "amsimulate runs with a small holding disk");
+like($Installcheck::Run::stdout,
+    qr{holding disk peak: 500 kb of 600 kb},
+    "..and what does not fit is dumped to tape");
+
+unlink($amdump);
@@ -0,0 +1,71 @@
+# Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+# for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+#
+# Contact information: Carbonite Inc., 756 N Pastoria Ave
+# Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
+
+use Test::More tests => 7;
+use strict;
+use warnings;
+
+use lib '@amperldir@';
+use File::Path;
+use Installcheck;
+use Installcheck::Run qw( run );
+use Amanda::Debug;
+use Amanda::Paths;
+
+Amanda::Debug::dbopen("installcheck");
+Installcheck::log_test_output();
+
+sub write_file {
+    my ($path, $size) = @_;
+
+    open(my $fh, ">", $path) or die("Can't write '$path': $!");
+    print $fh "x" x $size;
+    close($fh);
+}
+
+# three directories of 300, 200 and 100 KB, and a small file
+my $dir = "$Installcheck::TMP/amsplitdle";
+rmtree($dir);
+mkpath(["$dir/a", "$dir/b", "$dir/c d"]);
+write_file("$dir/a/file", 300*1024);
+write_file("$dir/b/file", 200*1024);
+write_file("$dir/c d/file", 100*1024);
+write_file("$dir/small", 1024);
+
+ok(run('amsplitdle', '--shards', '3', '--host', 'localhost',
+       '--dumptype', 'installcheck-test', $dir, '/split'),
+    "amsplitdle runs");
+my $out = $Installcheck::Run::stdout;
+like($out, qr{^"localhost" "/split-1" "\Q$dir\E" \{\n    installcheck-test\n    include file "\./a"\n\}$}m,
+    "..the largest directory is in the first shard");
+like($out, qr{^"localhost" "/split-2" "\Q$dir\E" \{\n    installcheck-test\n    include file "\./b"\n\}$}m,
+    "..the next one in the second shard");
+like($out, qr{^"localhost" "/split-3" "\Q$dir\E" \{\n    installcheck-test\n    exclude file "\./a" "\./b"\n\}$}m,
+    "..and the last shard dumps everything else");
+
+ok(run('amsplitdle', '--shards', '2', '--host', 'localhost', $dir),
+    "amsplitdle runs with two shards");
+like($Installcheck::Run::stdout,
+    qr{^    include file "\./a"\n}m,
+    "..the largest directory is alone in the first shard");
+like($Installcheck::Run::stdout,
+    qr{^    exclude file "\./a"\n}m,
+    "..and is excluded from the second one");
+
+rmtree($dir);
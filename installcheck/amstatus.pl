@@ -18,10 +18,11 @@
 # Contact information: Carbonite Inc., 756 N Pastoria Ave
 # Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
 
-use Test::More tests => 20;
+use Test::More tests => 23;
 use strict;
 use warnings;
 use File::Path;
+use JSON;
 
 use lib '@amperldir@';
 use Installcheck;
@@ -179,3 +180,30 @@ ok(run('amstatus', 'TESTCONF'),
 like($Installcheck::Run::stdout,
     qr{\s*tape 3\s*:\s*1\s*142336k\s*142336k \(  5.82\%\) amstatus_test_3-AA-003 \(1 parts\)},
     "output is correct");
+
+## now test the timeline of a run
+
+$cat = Installcheck::Catalogs::load('dumper-chunker-taper-success');
+$cat->install();
+
+my $trace_file = "$Installcheck::TMP/amstatus-timeline.json";
+unlink $trace_file;
+ok(run('amstatus', 'TESTCONF', '--timeline', $trace_file),
+    "amstatus --timeline runs without error");
+my $trace;
+{
+    local $/;
+    open(my $fh, "<", $trace_file) or die("open $trace_file: $!");
+    $trace = decode_json(<$fh>);
+    close($fh);
+}
+my %spans = map { $_->{'name'} => $_ }
+	    grep { $_->{'ph'} eq 'X' && $_->{'pid'} == 1 }
+	    @{$trace->{'traceEvents'}};
+is_deeply([ sort keys %spans ],
+    [ 'chunking', 'dumping', 'estimate', 'queued', 'taper write' ],
+    "timeline has the phases of the DLE");
+ok(scalar(grep { $_->{'ph'} eq 'C' && $_->{'name'} eq 'holding disk' }
+	       @{$trace->{'traceEvents'}}),
+    "timeline has the holding disk counter");
+unlink $trace_file;
@@ -18,7 +18,7 @@
 # Contact information: Carbonite Inc., 756 N Pastoria Ave
 # Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
 
-use Test::More tests => 11;
+use Test::More tests => 13;
 use strict;
 use warnings;
 
@@ -185,6 +185,34 @@ is_deeply([ get_dry_run("$sbindir/amvault",
     [ "TESTCONF02", "1", "localhost", "$diskname/dir",     "1" ]
     ], "amvault with a disk expression vault only that disk");
 
+# vault the fulls with two streams, each of them with its own source and
+# destination volumes
+my $parallel_root = "$Installcheck::TMP/tertiary-parallel";
+rmtree $parallel_root if -d $parallel_root;
+mkpath "$parallel_root/slot$_" for (1 .. 3);
+open(my $conf_fh, ">>", "$CONFIG_DIR/TESTCONF/amanda.conf");
+print $conf_fh <<EOF;
+define storage "amvault-parallel" {
+    tpchanger "chg-disk:$parallel_root"
+    policy "amvault-policy"
+    autolabel "TESTCONF%%" any
+    taper-parallel-write 2
+}
+EOF
+close($conf_fh);
+
+ok(run("$sbindir/amvault",
+		'--fulls-only',
+		'--dest-storage', 'amvault-parallel',
+		'TESTCONF'),
+    "amvault with taper-parallel-write 2 runs")
+    or diag($Installcheck::Run::stderr);
+
+my @parallel_files = glob("$parallel_root/slot*/0*");
+ok(@parallel_files > 0,
+    "..and files appear on its volumes");
+rmtree $parallel_root;
+
 # Test NDMP-to-NDMP vaulting.  This will test all manner of goodness:
 #  - specifying a named changer on the amvault command line
 #  - exporting
@@ -0,0 +1,76 @@
+# Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+# for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+#
+# Contact information: Carbonite Inc., 756 N Pastoria Ave
+# Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
+
+use Test::More tests => 12;
+use strict;
+use warnings;
+
+use lib '@amperldir@';
+use Installcheck;
+use Installcheck::Run qw( run run_get );
+use Amanda::Paths;
+use Amanda::Constants;
+use File::Path qw( mkpath rmtree );
+use Amanda::Debug;
+
+Amanda::Debug::dbopen("installcheck");
+Installcheck::log_test_output();
+
+my $tmpdir = "$Installcheck::TMP/amxferbench-installcheck";
+
+rmtree($tmpdir);
+mkpath($tmpdir);
+
+ok(run('amxferbench', '--version'),
+    "amxferbench --version OK");
+like($Installcheck::Run::stdout,
+    qr{^amxferbench-},
+    "..and output is reasonable");
+
+ok(run('amxferbench', '--length', '1m', '--filter', 'xor', '--filter', 'crc'),
+    "simple benchmark succeeds");
+like($Installcheck::Run::stdout,
+    qr{^  1048576 bytes in .* MB/s}m,
+    "..and reports the throughput");
+like($Installcheck::Run::stdout,
+    qr{^  XferFilterXor +in 1048576 out 1048576 }m,
+    "..and the element stats");
+
+ok(run('amxferbench', '--length', '1m', '--block-size', '4k,64k',
+	'--mech', 'PULL_BUFFER,PUSH_BUFFER,READFD', '--json'),
+    "sweep with --json succeeds");
+my @runs = ($Installcheck::Run::stdout =~ /"block_size": (\d+)/g);
+is_deeply([ @runs ], [ 4096, 4096, 4096, 65536, 65536, 65536 ],
+    "..and makes a run for each combination");
+like($Installcheck::Run::stdout,
+    qr{"linkage": "XferSourceBench -READFD-> }m,
+    "..with the mechanism forced");
+
+ok(run('amxferbench', '--length', '1m', '--dest', "fd:$tmpdir/out"),
+    "fd destination succeeds");
+is(-s "$tmpdir/out", 1048576,
+    "..and writes all of the data");
+
+ok(run('amxferbench', '--length', '1m', '--mech', 'MEM_RING',
+	'--ring-size', '1m', '--dest', "holding:$tmpdir/holding"),
+    "holding destination fed by a mem ring succeeds");
+is(-s "$tmpdir/holding", 1048576 + 32768,
+    "..and writes the header and all of the data");
+
+rmtree($tmpdir);
@@ -375,7 +375,23 @@ jndex_doit (void)
 	ndmjob_log (1, "Processing input index (-J%s)", J_index_file);
 
 	if (n_file_arg > 0) {
-		rc = ndmfhdb_add_fh_info_to_nlist (fp, nlist, n_file_arg);
+		char		binpath[NDMOS_CONST_PATH_MAX];
+		struct stat	st, bin_st;
+
+		/* use the binary index if it is not older than the text */
+		snprintf (binpath, sizeof binpath, "%s.fhdb", J_index_file);
+		rc = -1;
+		if (fstat (fileno (fp), &st) == 0
+		 && stat (binpath, &bin_st) == 0
+		 && bin_st.st_mtime >= st.st_mtime) {
+			rc = ndmfhdb_bin_add_fh_info_to_nlist (binpath,
+						nlist, n_file_arg);
+			if (rc >= 0)
+				ndmjob_log (2, "Used binary index %s", binpath);
+		}
+		if (rc < 0)
+			rc = ndmfhdb_add_fh_info_to_nlist (fp, nlist,
+						n_file_arg);
 		if (rc < 0) {
 			/* toast one way or another */
 		}
@@ -38,6 +38,107 @@
 #include "amutil.h"
 
 #ifndef NDMOS_OPTION_NO_CONTROL_AGENT
+/*
+ * Index lines are collected into large blocks and written by a
+ * separate thread, so a data server sending millions of file history
+ * entries never waits on the index file.  The session only blocks
+ * when IXLOG_MAX_BLOCKS full blocks are already waiting to be written.
+ */
+#define IXLOG_BLOCK_SIZE	(256*1024)
+#define IXLOG_MAX_BLOCKS	16
+
+typedef struct ixlog_block {
+	size_t		len;
+	char		data[IXLOG_BLOCK_SIZE];
+} ixlog_block_t;
+
+static GThread *	ixlog_thread;
+static GMutex *		ixlog_mutex;
+static GCond *		ixlog_cond;
+static GQueue *		ixlog_queue;
+static ixlog_block_t *	ixlog_cur;
+static gboolean		ixlog_done;
+static gboolean		ixlog_error;
+
+static gpointer
+ixlog_writer_thread (gpointer data G_GNUC_UNUSED)
+{
+	ixlog_block_t *	blk;
+
+	for (;;) {
+		g_mutex_lock (ixlog_mutex);
+		while (ixlog_queue->length == 0 && !ixlog_done)
+			g_cond_wait (ixlog_cond, ixlog_mutex);
+		blk = g_queue_pop_head (ixlog_queue);
+		/* wake up a producer waiting for room */
+		g_cond_broadcast (ixlog_cond);
+		g_mutex_unlock (ixlog_mutex);
+
+		if (!blk)
+			break;
+
+		if (fwrite (blk->data, 1, blk->len, index_fp) != blk->len
+		 || fflush (index_fp) != 0)
+			ixlog_error = TRUE;
+		g_free (blk);
+	}
+
+	return NULL;
+}
+
+static void
+ixlog_submit (void)
+{
+	g_mutex_lock (ixlog_mutex);
+	while (ixlog_queue->length >= IXLOG_MAX_BLOCKS)
+		g_cond_wait (ixlog_cond, ixlog_mutex);
+	g_queue_push_tail (ixlog_queue, ixlog_cur);
+	g_cond_broadcast (ixlog_cond);
+	g_mutex_unlock (ixlog_mutex);
+
+	ixlog_cur = NULL;
+}
+
+static void
+ixlog_start (void)
+{
+	glib_init ();
+
+	ixlog_mutex = g_mutex_new ();
+	ixlog_cond = g_cond_new ();
+	ixlog_queue = g_queue_new ();
+	ixlog_done = FALSE;
+	ixlog_error = FALSE;
+	ixlog_thread = g_thread_create (ixlog_writer_thread, NULL, TRUE, NULL);
+}
+
+/* write out everything queued and stop the writer thread */
+static void
+ixlog_finish (void)
+{
+	if (!ixlog_thread)
+		return;
+
+	if (ixlog_cur)
+		ixlog_submit ();
+
+	g_mutex_lock (ixlog_mutex);
+	ixlog_done = TRUE;
+	g_cond_broadcast (ixlog_cond);
+	g_mutex_unlock (ixlog_mutex);
+
+	g_thread_join (ixlog_thread);
+	ixlog_thread = NULL;
+
+	g_queue_free (ixlog_queue);
+	g_cond_free (ixlog_cond);
+	g_mutex_free (ixlog_mutex);
+
+	if (ixlog_error)
+		ndmjob_log (0, "Warning: error writing index (-I%s)",
+			I_index_file);
+}
+
 int
 start_index_file (void)
 {
@@ -56,6 +157,7 @@ start_index_file (void)
 		}
 		index_fp = ifp;
 		fprintf (ifp, "##ndmjob -I\n");
+		ixlog_start ();
 	} else {
 		index_fp = stderr;
 	}
@@ -63,9 +165,34 @@ start_index_file (void)
 	return 0;
 }
 
+/*
+ * Compile the sorted index to the binary database <index>.fhdb, used
+ * by -J instead of the text when it is up to date.  The text stays
+ * the reference, so a failure here is only logged.
+ */
+static void
+build_index_bin (void)
+{
+	char		binpath[NDMOS_CONST_PATH_MAX];
+	FILE *		ifp;
+
+	snprintf (binpath, sizeof binpath, "%s.fhdb", I_index_file);
+	ifp = fopen (I_index_file, "r");
+	if (!ifp || ndmfhdb_bin_build (ifp, binpath) < 0) {
+		ndmjob_log (1, "Warning: could not build binary index %s",
+			binpath);
+	} else {
+		ndmjob_log (1, "binary index %s done", binpath);
+	}
+	if (ifp)
+		fclose (ifp);
+}
+
 int
 sort_index_file (void)
 {
+	ixlog_finish ();
+
 	if (I_index_file && strcmp (I_index_file, "-") != 0 &&
 	    atoi(I_index_file) == 0) {
 		char		cmd[512];
@@ -80,6 +207,8 @@ sort_index_file (void)
 		if (system (cmd) < 0)
 		    error_byebye ("sort index failed");
 		ndmjob_log (1, "sort index done");
+
+		build_index_bin ();
 	}
 
 	return 0;
@@ -130,8 +259,26 @@ ndmjob_log_deliver (struct ndmlog *log, char *tag, int lev, char *msg)
 void
 ndmjob_ixlog_deliver (struct ndmlog *log, char *tag, int lev, char *msg)
 {
-	fprintf (index_fp, "%s %s\n", tag, msg);
-	fflush (index_fp);	/* this doesn't change the run time */
+	size_t		len;
+
+	if (!ixlog_thread) {
+		fprintf (index_fp, "%s %s\n", tag, msg);
+		fflush (index_fp);
+		return;
+	}
+
+	len = strlen (tag) + 1 + strlen (msg) + 1;
+	if (ixlog_cur && ixlog_cur->len + len >= IXLOG_BLOCK_SIZE)
+		ixlog_submit ();
+	if (!ixlog_cur) {
+		ixlog_cur = g_malloc (sizeof *ixlog_cur);
+		ixlog_cur->len = 0;
+	}
+
+	/* ndmlogf() bounds msg well under a block */
+	g_snprintf (ixlog_cur->data + ixlog_cur->len,
+		IXLOG_BLOCK_SIZE - ixlog_cur->len, "%s %s\n", tag, msg);
+	ixlog_cur->len += len;
 }
 #endif /* !NDMOS_OPTION_NO_CONTROL_AGENT */
 
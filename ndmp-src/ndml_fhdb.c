@@ -113,14 +113,22 @@ int
 ndmfhdb_add_fh_info_to_nlist (FILE *fp, ndmp9_name *nlist, int n_nlist)
 {
 	struct ndmfhdb		_fhcb, *fhcb = &_fhcb;
-	int			i, rc, n_found;
-	ndmp9_file_stat		fstat;
+	int			rc;
 
 	rc = ndmfhdb_open (fp, fhcb);
 	if (rc != 0) {
 		return -31;
 	}
 
+	return ndmfhdb_fh_info_to_nlist (fhcb, nlist, n_nlist);
+}
+
+int
+ndmfhdb_fh_info_to_nlist (struct ndmfhdb *fhcb, ndmp9_name *nlist, int n_nlist)
+{
+	int			i, rc, n_found;
+	ndmp9_file_stat		fstat;
+
 	n_found = 0;
 
 	for (i = 0; i < n_nlist; i++) {
@@ -165,6 +173,9 @@ ndmfhdb_open (FILE *fp, struct ndmfhdb *fhcb)
 int
 ndmfhdb_lookup (struct ndmfhdb *fhcb, char *path, ndmp9_file_stat *fstat)
 {
+	if (fhcb->bin) {
+		return ndmfhdb_bin_lookup (fhcb, path, fstat);
+	}
 	if (fhcb->use_dir_node) {
 		return ndmfhdb_dirnode_lookup (fhcb, path, fstat);
 	} else {
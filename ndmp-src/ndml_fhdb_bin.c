@@ -0,0 +1,835 @@
+/*
+ * Copyright (c) 2001,2002
+ *	Traakan, Inc., Los Altos, CA
+ *	All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice unmodified, this list of conditions, and the following
+ *    disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Project:  NDMJOB
+ * Ident:    $Id: $
+ *
+ * Description:
+ *	Binary File History Database
+ *
+ *	A compact image of the text index, built from it once the
+ *	backup is done and mapped into memory for recovery. Lookups
+ *	are hash probes and a binary search among the children of
+ *	each directory, instead of the seeks and text parsing of
+ *	NDMBSTF. The text index stays the export format.
+ *
+ *	Layout, all in host byte order:
+ *		header
+ *		dirent[n_dirent]	sorted by (parent, name), so the
+ *					children of a dir are contiguous
+ *		node[n_node]		DHn entries and parent dirs
+ *		node_hash[node_hash_size]	index+1, 0 if empty
+ *		file[n_file]		DHf entries
+ *		file_hash[file_hash_size]	index+1, 0 if empty
+ *		names			encoded names, as in the text
+ */
+
+
+#include "ndmlib.h"
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+
+#define NDMFHDB_BIN_MAGIC	"NDMFHDB1"
+
+/* validity bits of struct ndmfhdb_bin_stat */
+#define NDMFHDB_V_MTIME		0x0001
+#define NDMFHDB_V_ATIME		0x0002
+#define NDMFHDB_V_CTIME		0x0004
+#define NDMFHDB_V_UID		0x0008
+#define NDMFHDB_V_GID		0x0010
+#define NDMFHDB_V_MODE		0x0020
+#define NDMFHDB_V_SIZE		0x0040
+#define NDMFHDB_V_LINKS		0x0080
+#define NDMFHDB_V_NODE		0x0100
+#define NDMFHDB_V_FH_INFO	0x0200
+#define NDMFHDB_V_PRESENT	0x8000	/* the entry has a stat */
+
+struct ndmfhdb_bin_header {
+	char			magic[8];
+	unsigned long long	root_node;
+	unsigned int		use_dir_node;
+	unsigned int		n_dirent;
+	unsigned int		n_node;
+	unsigned int		n_file;
+	unsigned int		node_hash_size;
+	unsigned int		file_hash_size;
+	unsigned long long	off_dirent;
+	unsigned long long	off_node;
+	unsigned long long	off_node_hash;
+	unsigned long long	off_file;
+	unsigned long long	off_file_hash;
+	unsigned long long	off_names;
+	unsigned long long	len_names;
+};
+
+struct ndmfhdb_bin_stat {
+	unsigned long long	size;
+	unsigned long long	node;
+	unsigned long long	fh_info;
+	unsigned int		mtime;
+	unsigned int		atime;
+	unsigned int		ctime;
+	unsigned int		uid;
+	unsigned int		gid;
+	unsigned int		mode;
+	unsigned int		links;
+	unsigned short		ftype;
+	unsigned short		valid;
+};
+
+struct ndmfhdb_bin_dirent {
+	unsigned long long	parent;
+	unsigned long long	node;
+	unsigned long long	name_off;
+	unsigned int		name_len;
+	unsigned int		pad;
+};
+
+struct ndmfhdb_bin_node {
+	unsigned long long	node;
+	unsigned int		child_first;
+	unsigned int		n_child;
+	struct ndmfhdb_bin_stat	stat;
+};
+
+struct ndmfhdb_bin_file {
+	unsigned long long	name_off;
+	unsigned int		name_len;
+	unsigned int		pad;
+	struct ndmfhdb_bin_stat	stat;
+};
+
+
+static unsigned
+ndmfhdb_bin_hash_node (unsigned long long node)
+{
+	node *= 0x9E3779B97F4A7C15ULL;
+	return (unsigned) (node >> 32);
+}
+
+static unsigned
+ndmfhdb_bin_hash_name (char *name, unsigned len)
+{
+	unsigned long long	h = 0xCBF29CE484222325ULL;	/* FNV-1a */
+	unsigned		i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char) name[i];
+		h *= 0x100000001B3ULL;
+	}
+	return (unsigned) (h ^ (h >> 32));
+}
+
+static void
+ndmfhdb_bin_stat_from_fstat (struct ndmfhdb_bin_stat *bs,
+  ndmp9_file_stat *fstat)
+{
+	NDMOS_MACRO_ZEROFILL (bs);
+
+	bs->ftype = fstat->ftype;
+	bs->valid = NDMFHDB_V_PRESENT;
+
+#define BIN_STAT_FIELD(F,BIT) \
+	if (fstat->F.valid == NDMP9_VALIDITY_VALID) { \
+		bs->F = fstat->F.value; \
+		bs->valid |= BIT; \
+	}
+	BIN_STAT_FIELD(mtime, NDMFHDB_V_MTIME)
+	BIN_STAT_FIELD(atime, NDMFHDB_V_ATIME)
+	BIN_STAT_FIELD(ctime, NDMFHDB_V_CTIME)
+	BIN_STAT_FIELD(uid, NDMFHDB_V_UID)
+	BIN_STAT_FIELD(gid, NDMFHDB_V_GID)
+	BIN_STAT_FIELD(mode, NDMFHDB_V_MODE)
+	BIN_STAT_FIELD(size, NDMFHDB_V_SIZE)
+	BIN_STAT_FIELD(links, NDMFHDB_V_LINKS)
+	BIN_STAT_FIELD(node, NDMFHDB_V_NODE)
+	BIN_STAT_FIELD(fh_info, NDMFHDB_V_FH_INFO)
+#undef BIN_STAT_FIELD
+}
+
+static void
+ndmfhdb_bin_stat_to_fstat (struct ndmfhdb_bin_stat *bs,
+  ndmp9_file_stat *fstat)
+{
+	NDMOS_MACRO_ZEROFILL (fstat);
+
+	fstat->ftype = bs->ftype;
+
+#define BIN_STAT_FIELD(F,BIT) \
+	if (bs->valid & BIT) { \
+		fstat->F.value = bs->F; \
+		fstat->F.valid = NDMP9_VALIDITY_VALID; \
+	}
+	BIN_STAT_FIELD(mtime, NDMFHDB_V_MTIME)
+	BIN_STAT_FIELD(atime, NDMFHDB_V_ATIME)
+	BIN_STAT_FIELD(ctime, NDMFHDB_V_CTIME)
+	BIN_STAT_FIELD(uid, NDMFHDB_V_UID)
+	BIN_STAT_FIELD(gid, NDMFHDB_V_GID)
+	BIN_STAT_FIELD(mode, NDMFHDB_V_MODE)
+	BIN_STAT_FIELD(size, NDMFHDB_V_SIZE)
+	BIN_STAT_FIELD(links, NDMFHDB_V_LINKS)
+	BIN_STAT_FIELD(node, NDMFHDB_V_NODE)
+	BIN_STAT_FIELD(fh_info, NDMFHDB_V_FH_INFO)
+#undef BIN_STAT_FIELD
+}
+
+
+
+
+/*
+ * Building
+ ****************************************************************
+ */
+
+struct ndmfhdb_bin_builder {
+	struct ndmfhdb_bin_header	hdr;
+
+	struct ndmfhdb_bin_dirent *	dirent;
+	unsigned			dirent_max;
+
+	struct ndmfhdb_bin_node *	node;
+	unsigned			node_max;
+	unsigned *			node_hash;
+
+	struct ndmfhdb_bin_file *	file;
+	unsigned			file_max;
+
+	char *				names;
+	unsigned long long		names_max;
+};
+
+static int
+ndmfhdb_bin_grow (void **vec, unsigned *max, unsigned n, unsigned size)
+{
+	unsigned	new_max;
+	void *		p;
+
+	if (n < *max)
+		return 0;
+
+	new_max = *max ? *max * 2 : 1024;
+	p = realloc (*vec, (size_t) new_max * size);
+	if (!p)
+		return -1;
+	*vec = p;
+	*max = new_max;
+	return 0;
+}
+
+static long long
+ndmfhdb_bin_add_name (struct ndmfhdb_bin_builder *bb, char *name,
+  unsigned len)
+{
+	unsigned long long	off = bb->hdr.len_names;
+
+	if (off + len > bb->names_max) {
+		unsigned long long	new_max;
+		char *			p;
+
+		new_max = bb->names_max ? bb->names_max * 2 : 65536;
+		while (off + len > new_max)
+			new_max *= 2;
+		p = realloc (bb->names, new_max);
+		if (!p)
+			return -1;
+		bb->names = p;
+		bb->names_max = new_max;
+	}
+	NDMOS_API_BCOPY (name, bb->names + off, len);
+	bb->hdr.len_names += len;
+
+	return off;
+}
+
+/*
+ * Find the node record of node, adding an empty one if need be.
+ * The hash is kept below half full.
+ */
+static struct ndmfhdb_bin_node *
+ndmfhdb_bin_get_node (struct ndmfhdb_bin_builder *bb,
+  unsigned long long node)
+{
+	struct ndmfhdb_bin_header *hdr = &bb->hdr;
+	struct ndmfhdb_bin_node *bn;
+	unsigned		mask, i;
+
+	if (hdr->n_node * 2 >= hdr->node_hash_size) {
+		unsigned	new_size;
+		unsigned *	h;
+		unsigned	j;
+
+		new_size = hdr->node_hash_size ? hdr->node_hash_size * 2 : 4096;
+		h = calloc (new_size, sizeof *h);
+		if (!h)
+			return 0;
+		for (j = 0; j < hdr->n_node; j++) {
+			i = ndmfhdb_bin_hash_node (bb->node[j].node);
+			while (h[i & (new_size-1)])
+				i++;
+			h[i & (new_size-1)] = j+1;
+		}
+		free (bb->node_hash);
+		bb->node_hash = h;
+		hdr->node_hash_size = new_size;
+	}
+
+	mask = hdr->node_hash_size - 1;
+	for (i = ndmfhdb_bin_hash_node (node); bb->node_hash[i & mask]; i++) {
+		bn = &bb->node[bb->node_hash[i & mask] - 1];
+		if (bn->node == node)
+			return bn;
+	}
+
+	if (ndmfhdb_bin_grow ((void **) &bb->node, &bb->node_max,
+			hdr->n_node, sizeof *bb->node) < 0)
+		return 0;
+	bn = &bb->node[hdr->n_node++];
+	NDMOS_MACRO_ZEROFILL (bn);
+	bn->node = node;
+	bb->node_hash[i & mask] = hdr->n_node;
+
+	return bn;
+}
+
+/* qsort has no context argument everywhere */
+static char *	ndmfhdb_bin_sort_names;
+
+static int
+ndmfhdb_bin_cmp_dirent (const void *a, const void *b)
+{
+	const struct ndmfhdb_bin_dirent *da = a;
+	const struct ndmfhdb_bin_dirent *db = b;
+	unsigned		len;
+	int			rc;
+
+	if (da->parent != db->parent)
+		return da->parent < db->parent ? -1 : 1;
+
+	len = da->name_len < db->name_len ? da->name_len : db->name_len;
+	rc = memcmp (ndmfhdb_bin_sort_names + da->name_off,
+			ndmfhdb_bin_sort_names + db->name_off, len);
+	if (rc != 0)
+		return rc;
+	return (int) da->name_len - (int) db->name_len;
+}
+
+/*
+ * Parse one text index line into the builder.  Lines of other
+ * agents and other kinds are skipped, as the text lookups do.
+ */
+static int
+ndmfhdb_bin_add_line (struct ndmfhdb_bin_builder *bb, char *line)
+{
+	struct ndmfhdb_bin_node *bn;
+	ndmp9_file_stat		fstat;
+	unsigned long long	a, b;
+	long long		off;
+	char *			p;
+	char *			q;
+	char *			e;
+	int			rc;
+
+	if (strncmp (line, "DHr ", 4) == 0) {
+		bb->hdr.root_node = NDMOS_API_STRTOLL (line+4, &p, 0);
+		if (*p != 0)
+			return -10;
+		bb->hdr.use_dir_node = 1;
+		return 0;
+	}
+
+	if (strncmp (line, "DHd ", 4) == 0) {
+		struct ndmfhdb_bin_dirent *bd;
+
+		/* DHd <dir_node> <name> UNIX <node> */
+		a = NDMOS_API_STRTOLL (line+4, &p, 0);
+		if (*p++ != ' ')
+			return -10;
+		q = strchr (p, ' ');
+		if (!q || strncmp (q, " UNIX ", 6) != 0)
+			return -10;
+		b = NDMOS_API_STRTOLL (q+6, &e, 0);
+		if (*e != 0)
+			return -10;
+
+		off = ndmfhdb_bin_add_name (bb, p, q - p);
+		if (off < 0)
+			return -1;
+		if (ndmfhdb_bin_grow ((void **) &bb->dirent, &bb->dirent_max,
+				bb->hdr.n_dirent, sizeof *bb->dirent) < 0)
+			return -1;
+		bd = &bb->dirent[bb->hdr.n_dirent++];
+		NDMOS_MACRO_ZEROFILL (bd);
+		bd->parent = a;
+		bd->node = b;
+		bd->name_off = off;
+		bd->name_len = q - p;
+		return 0;
+	}
+
+	if (strncmp (line, "DHn ", 4) == 0) {
+		/* DHn <node> UNIX <stat> */
+		a = NDMOS_API_STRTOLL (line+4, &p, 0);
+		if (strncmp (p, " UNIX ", 6) != 0)
+			return -10;
+		rc = ndm_fstat_from_str (&fstat, p+6);
+		if (rc < 0)
+			return rc;
+
+		bn = ndmfhdb_bin_get_node (bb, a);
+		if (!bn)
+			return -1;
+		ndmfhdb_bin_stat_from_fstat (&bn->stat, &fstat);
+		return 0;
+	}
+
+	if (strncmp (line, "DHf ", 4) == 0) {
+		struct ndmfhdb_bin_file *bf;
+
+		/* DHf <path> UNIX <stat> */
+		p = line+4;
+		q = strchr (p, ' ');
+		if (!q || strncmp (q, " UNIX ", 6) != 0)
+			return -10;
+		rc = ndm_fstat_from_str (&fstat, q+6);
+		if (rc < 0)
+			return rc;
+
+		off = ndmfhdb_bin_add_name (bb, p, q - p);
+		if (off < 0)
+			return -1;
+		if (ndmfhdb_bin_grow ((void **) &bb->file, &bb->file_max,
+				bb->hdr.n_file, sizeof *bb->file) < 0)
+			return -1;
+		bf = &bb->file[bb->hdr.n_file++];
+		NDMOS_MACRO_ZEROFILL (bf);
+		bf->name_off = off;
+		bf->name_len = q - p;
+		ndmfhdb_bin_stat_from_fstat (&bf->stat, &fstat);
+		return 0;
+	}
+
+	return 0;
+}
+
+static int
+ndmfhdb_bin_write (struct ndmfhdb_bin_builder *bb, FILE *out)
+{
+	struct ndmfhdb_bin_header *hdr = &bb->hdr;
+	unsigned *		file_hash = 0;
+	unsigned		i, j, mask;
+	unsigned long long	off;
+	int			rc = -1;
+
+	/* group the children of each dir */
+	ndmfhdb_bin_sort_names = bb->names;
+	if (hdr->n_dirent > 0)
+		qsort (bb->dirent, hdr->n_dirent, sizeof *bb->dirent,
+			ndmfhdb_bin_cmp_dirent);
+
+	for (i = 0; i < hdr->n_dirent; i = j) {
+		struct ndmfhdb_bin_node *bn;
+
+		for (j = i+1; j < hdr->n_dirent; j++) {
+			if (bb->dirent[j].parent != bb->dirent[i].parent)
+				break;
+		}
+		bn = ndmfhdb_bin_get_node (bb, bb->dirent[i].parent);
+		if (!bn)
+			goto out;
+		bn->child_first = i;
+		bn->n_child = j - i;
+	}
+	/* lookups need a node hash, even an empty one */
+	if (!bb->node_hash && !ndmfhdb_bin_get_node (bb, hdr->root_node))
+		goto out;
+
+	hdr->file_hash_size = 16;
+	while (hdr->file_hash_size < hdr->n_file * 2)
+		hdr->file_hash_size *= 2;
+	file_hash = calloc (hdr->file_hash_size, sizeof *file_hash);
+	if (!file_hash)
+		goto out;
+	mask = hdr->file_hash_size - 1;
+	for (j = 0; j < hdr->n_file; j++) {
+		i = ndmfhdb_bin_hash_name (bb->names + bb->file[j].name_off,
+					bb->file[j].name_len);
+		while (file_hash[i & mask])
+			i++;
+		file_hash[i & mask] = j+1;
+	}
+
+	NDMOS_API_BCOPY (NDMFHDB_BIN_MAGIC, hdr->magic, sizeof hdr->magic);
+	off = sizeof *hdr;
+	hdr->off_dirent = off;
+	off += (unsigned long long) hdr->n_dirent * sizeof *bb->dirent;
+	hdr->off_node = off;
+	off += (unsigned long long) hdr->n_node * sizeof *bb->node;
+	hdr->off_node_hash = off;
+	off += (unsigned long long) hdr->node_hash_size * sizeof *bb->node_hash;
+	hdr->off_file = off;
+	off += (unsigned long long) hdr->n_file * sizeof *bb->file;
+	hdr->off_file_hash = off;
+	off += (unsigned long long) hdr->file_hash_size * sizeof *file_hash;
+	hdr->off_names = off;
+
+	if (fwrite (hdr, sizeof *hdr, 1, out) != 1
+	 || fwrite (bb->dirent, sizeof *bb->dirent, hdr->n_dirent, out)
+							!= hdr->n_dirent
+	 || fwrite (bb->node, sizeof *bb->node, hdr->n_node, out)
+							!= hdr->n_node
+	 || fwrite (bb->node_hash, sizeof *bb->node_hash,
+			hdr->node_hash_size, out) != hdr->node_hash_size
+	 || fwrite (bb->file, sizeof *bb->file, hdr->n_file, out)
+							!= hdr->n_file
+	 || fwrite (file_hash, sizeof *file_hash,
+			hdr->file_hash_size, out) != hdr->file_hash_size
+	 || fwrite (bb->names, 1, hdr->len_names, out) != hdr->len_names)
+		goto out;
+
+	rc = 0;
+  out:
+	free (file_hash);
+	return rc;
+}
+
+/*
+ * ndmfhdb_bin_build()
+ *
+ * Build the binary database at path from the text index in fp,
+ * sorted or not.
+ *
+ * Returns:
+ *	<0	Error
+ *	 0	Done
+ */
+int
+ndmfhdb_bin_build (FILE *fp, char *path)
+{
+	struct ndmfhdb_bin_builder	_bb, *bb = &_bb;
+	char				linebuf[2048];
+	char				tmppath[NDMOS_CONST_PATH_MAX];
+	FILE *				out;
+	char *				p;
+	int				rc = 0;
+
+	NDMOS_MACRO_ZEROFILL (bb);
+
+	while (fgets (linebuf, sizeof linebuf, fp)) {
+		p = NDMOS_API_STREND (linebuf);
+		if (p == linebuf || p[-1] != '\n') {
+			rc = -2;	/* overflow */
+			break;
+		}
+		p[-1] = 0;
+
+		rc = ndmfhdb_bin_add_line (bb, linebuf);
+		if (rc < 0)
+			break;
+	}
+
+	/* write aside and rename, so a reader never maps a partial file */
+	if (rc == 0) {
+		snprintf (tmppath, sizeof tmppath, "%s.tmp", path);
+		out = fopen (tmppath, "w");
+		if (!out) {
+			rc = -1;
+		} else {
+			rc = ndmfhdb_bin_write (bb, out);
+			if (fclose (out) != 0)
+				rc = -1;
+			if (rc == 0 && rename (tmppath, path) != 0)
+				rc = -1;
+			if (rc < 0)
+				unlink (tmppath);
+		}
+	}
+
+	free (bb->dirent);
+	free (bb->node);
+	free (bb->node_hash);
+	free (bb->file);
+	free (bb->names);
+
+	return rc;
+}
+
+
+
+
+/*
+ * Lookups
+ ****************************************************************
+ */
+
+#define BIN_HDR(FHCB) ((struct ndmfhdb_bin_header *)(FHCB)->bin)
+#define BIN_AT(FHCB,OFF) ((FHCB)->bin + (OFF))
+
+/*
+ * ndmfhdb_bin_open()
+ *
+ * Map the binary database at path for lookups with ndmfhdb_lookup().
+ *
+ * Returns:
+ *	<0	Error, not a binary database
+ *	 0	OK
+ */
+int
+ndmfhdb_bin_open (char *path, struct ndmfhdb *fhcb)
+{
+	struct ndmfhdb_bin_header *hdr;
+	struct stat		st;
+	char *			map;
+	int			fd;
+
+	NDMOS_MACRO_ZEROFILL (fhcb);
+
+	fd = open (path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat (fd, &st) < 0 || (size_t) st.st_size < sizeof *hdr) {
+		close (fd);
+		return -1;
+	}
+
+#ifdef HAVE_SYS_MMAN_H
+	map = mmap (0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		close (fd);
+		return -1;
+	}
+#else
+	map = NDMOS_API_MALLOC (st.st_size);
+	if (!map || full_read (fd, map, st.st_size) != (size_t) st.st_size) {
+		if (map)
+			NDMOS_API_FREE (map);
+		close (fd);
+		return -1;
+	}
+#endif
+	close (fd);
+
+	fhcb->bin = map;
+	fhcb->bin_len = st.st_size;
+
+	hdr = BIN_HDR(fhcb);
+	if (memcmp (hdr->magic, NDMFHDB_BIN_MAGIC, sizeof hdr->magic) != 0
+	 || hdr->off_names + hdr->len_names != fhcb->bin_len) {
+		ndmfhdb_bin_close (fhcb);
+		return -1;
+	}
+
+	fhcb->use_dir_node = hdr->use_dir_node;
+	fhcb->root_node = hdr->root_node;
+
+	return 0;
+}
+
+void
+ndmfhdb_bin_close (struct ndmfhdb *fhcb)
+{
+	if (!fhcb->bin)
+		return;
+#ifdef HAVE_SYS_MMAN_H
+	munmap (fhcb->bin, fhcb->bin_len);
+#else
+	NDMOS_API_FREE (fhcb->bin);
+#endif
+	fhcb->bin = 0;
+	fhcb->bin_len = 0;
+}
+
+static struct ndmfhdb_bin_node *
+ndmfhdb_bin_find_node (struct ndmfhdb *fhcb, unsigned long long node)
+{
+	struct ndmfhdb_bin_header *hdr = BIN_HDR(fhcb);
+	struct ndmfhdb_bin_node *nodes;
+	unsigned *		hash;
+	unsigned		mask, i;
+
+	nodes = (struct ndmfhdb_bin_node *) BIN_AT(fhcb, hdr->off_node);
+	hash = (unsigned *) BIN_AT(fhcb, hdr->off_node_hash);
+	mask = hdr->node_hash_size - 1;
+
+	for (i = ndmfhdb_bin_hash_node (node); hash[i & mask]; i++) {
+		if (nodes[hash[i & mask] - 1].node == node)
+			return &nodes[hash[i & mask] - 1];
+	}
+	return 0;
+}
+
+static int
+ndmfhdb_bin_dir_lookup (struct ndmfhdb *fhcb, unsigned long long dir_node,
+  char *name, unsigned long long *node_p)
+{
+	struct ndmfhdb_bin_header *hdr = BIN_HDR(fhcb);
+	struct ndmfhdb_bin_dirent *dirent;
+	struct ndmfhdb_bin_node *bn;
+	unsigned		lo, hi, mid, len;
+	int			rc;
+
+	bn = ndmfhdb_bin_find_node (fhcb, dir_node);
+	if (!bn || bn->n_child == 0)
+		return 0;
+
+	dirent = (struct ndmfhdb_bin_dirent *) BIN_AT(fhcb, hdr->off_dirent);
+	len = strlen (name);
+	lo = bn->child_first;
+	hi = bn->child_first + bn->n_child;
+	while (lo < hi) {
+		struct ndmfhdb_bin_dirent *bd;
+		unsigned	n;
+
+		mid = lo + (hi - lo) / 2;
+		bd = &dirent[mid];
+		n = bd->name_len < len ? bd->name_len : len;
+		rc = memcmp (BIN_AT(fhcb, hdr->off_names + bd->name_off),
+				name, n);
+		if (rc == 0)
+			rc = (int) bd->name_len - (int) len;
+		if (rc == 0) {
+			*node_p = bd->node;
+			return 1;
+		}
+		if (rc < 0)
+			lo = mid+1;
+		else
+			hi = mid;
+	}
+
+	return 0;
+}
+
+static int
+ndmfhdb_bin_dirnode_lookup (struct ndmfhdb *fhcb, char *path,
+  ndmp9_file_stat *fstat)
+{
+	struct ndmfhdb_bin_node *bn;
+	int			rc;
+	char *			p;
+	char *			q;
+	char			component[256+128];
+	char			key[256+128];
+	unsigned long long	node;
+
+	/* classic path name reduction, as ndmfhdb_dirnode_lookup() */
+	node = fhcb->root_node;
+	p = path;
+	for (;;) {
+		if (*p == '/') {
+			p++;
+			continue;
+		}
+		if (*p == 0) {
+			break;
+		}
+		q = component;
+		while (*p != 0 && *p != '/') {
+			if (q >= component + sizeof component - 1)
+				return -2;
+			*q++ = *p++;
+		}
+		*q = 0;
+
+		if (ndmcstr_from_str (component, key, sizeof key) < 0)
+			return -2;
+		rc = ndmfhdb_bin_dir_lookup (fhcb, node, key, &node);
+		if (rc <= 0)
+			return rc;	/* error or not found */
+	}
+
+	bn = ndmfhdb_bin_find_node (fhcb, node);
+	if (!bn || !(bn->stat.valid & NDMFHDB_V_PRESENT))
+		return 0;
+
+	ndmfhdb_bin_stat_to_fstat (&bn->stat, fstat);
+	return 1;
+}
+
+static int
+ndmfhdb_bin_file_lookup (struct ndmfhdb *fhcb, char *path,
+  ndmp9_file_stat *fstat)
+{
+	struct ndmfhdb_bin_header *hdr = BIN_HDR(fhcb);
+	struct ndmfhdb_bin_file *files;
+	unsigned *		hash;
+	unsigned		mask, i, len;
+	char			key[2048];
+
+	if (ndmcstr_from_str (path, key, sizeof key) < 0)
+		return -2;
+	len = strlen (key);
+
+	files = (struct ndmfhdb_bin_file *) BIN_AT(fhcb, hdr->off_file);
+	hash = (unsigned *) BIN_AT(fhcb, hdr->off_file_hash);
+	mask = hdr->file_hash_size - 1;
+
+	for (i = ndmfhdb_bin_hash_name (key, len); hash[i & mask]; i++) {
+		struct ndmfhdb_bin_file *bf = &files[hash[i & mask] - 1];
+
+		if (bf->name_len == len
+		 && memcmp (BIN_AT(fhcb, hdr->off_names + bf->name_off),
+				key, len) == 0) {
+			ndmfhdb_bin_stat_to_fstat (&bf->stat, fstat);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int
+ndmfhdb_bin_lookup (struct ndmfhdb *fhcb, char *path,
+  ndmp9_file_stat *fstat)
+{
+	if (fhcb->use_dir_node) {
+		return ndmfhdb_bin_dirnode_lookup (fhcb, path, fstat);
+	} else {
+		return ndmfhdb_bin_file_lookup (fhcb, path, fstat);
+	}
+}
+
+int
+ndmfhdb_bin_add_fh_info_to_nlist (char *path, ndmp9_name *nlist, int n_nlist)
+{
+	struct ndmfhdb		_fhcb, *fhcb = &_fhcb;
+	int			n_found;
+
+	if (ndmfhdb_bin_open (path, fhcb) != 0) {
+		return -31;
+	}
+
+	n_found = ndmfhdb_fh_info_to_nlist (fhcb, nlist, n_nlist);
+
+	ndmfhdb_bin_close (fhcb);
+
+	return n_found;
+}
@@ -762,12 +762,18 @@ extern int	ndmcfg_loadfp (FILE *fp, ndmp9_config_info *config_info);
  * using binary search (see NDMBSTF above). The fh_info, a 64-bit
  * cookie used by DATA to identify the region of the backup image
  * containing the corresponding object, is retreived from the index.
+ *
+ * The sorted text index can also be compiled to a binary database
+ * (see ndml_fhdb_bin.c), which is mapped in memory and looked up
+ * through the same ndmfhdb_lookup().
  */
 
 struct ndmfhdb {
 	FILE *			fp;
 	int			use_dir_node;
 	unsigned long long	root_node;
+	char *			bin;		/* mapped binary database */
+	unsigned long long	bin_len;
 };
 
 extern int	ndmfhdb_add_file (struct ndmlog *ixlog, int tagc,
@@ -782,6 +788,8 @@ extern int	ndmfhdb_add_dirnode_root (struct ndmlog *ixlog, int tagc,
 
 extern int	ndmfhdb_add_fh_info_to_nlist (FILE *fp,
 			ndmp9_name *nlist, int n_nlist);
+extern int	ndmfhdb_fh_info_to_nlist (struct ndmfhdb *fhcb,
+			ndmp9_name *nlist, int n_nlist);
 extern int	ndmfhdb_open (FILE *fp, struct ndmfhdb *fhcb);
 extern int	ndmfhdb_lookup (struct ndmfhdb *fhcb, char *path,
 			ndmp9_file_stat *fstat);
@@ -800,5 +808,13 @@ extern int	ndmfhdb_file_lookup (struct ndmfhdb *fhcb, char *path,
 extern char *	ndm_fstat_to_str (ndmp9_file_stat *fstat, char *buf);
 extern int	ndm_fstat_from_str (ndmp9_file_stat *fstat, char *buf);
 
+extern int	ndmfhdb_bin_build (FILE *fp, char *path);
+extern int	ndmfhdb_bin_open (char *path, struct ndmfhdb *fhcb);
+extern void	ndmfhdb_bin_close (struct ndmfhdb *fhcb);
+extern int	ndmfhdb_bin_lookup (struct ndmfhdb *fhcb, char *path,
+			ndmp9_file_stat *fstat);
+extern int	ndmfhdb_bin_add_fh_info_to_nlist (char *path,
+			ndmp9_name *nlist, int n_nlist);
+
 
 #endif /* _NDMLIB_H_ */
@@ -343,6 +343,95 @@ ndmp_connection_tape_write(
     return TRUE;
 }
 
+gboolean
+ndmp_connection_tape_write_send(
+	NDMPConnection *self,
+	gpointer buf,
+	guint64 len)
+{
+    struct ndmp_msg_buf request;
+    ndmp4_tape_write_request *body;
+    int rc;
+
+    g_assert(!self->startup_err);
+
+    NDMOS_MACRO_ZEROFILL(&request);
+    request.protocol_version = NDMP4VER;
+    request.header.message = (ndmp0_message) MT_ndmp4_tape_write;
+    request.header.message_type = NDMP0_MESSAGE_REQUEST;
+    body = &request.body.ndmp4_tape_write_request_body;
+    body->data_out.data_out_val = buf;
+    body->data_out.data_out_len = len;
+
+    g_static_mutex_lock(&ndmlib_mutex);
+    self->conn->last_message = request.header.message;
+    rc = ndmconn_send_nmb(self->conn, &request);
+    g_static_mutex_unlock(&ndmlib_mutex);
+    if (rc) {
+	self->last_rc = NDMCONN_CALL_STATUS_BOTCH;
+	return FALSE;
+    }
+
+    self->last_rc = NDMCONN_CALL_STATUS_OK;
+    self->tape_writes_pending++;
+    return TRUE;
+}
+
+gboolean
+ndmp_connection_tape_write_recv(
+	NDMPConnection *self,
+	guint64 *count)
+{
+    struct ndmp_msg_buf reply;
+    struct ndmconn *conn = self->conn;
+    int rc;
+
+    g_assert(!self->startup_err);
+    g_assert(self->tape_writes_pending > 0);
+
+    *count = 0;
+    self->tape_writes_pending--;
+
+    /* like ndmconn_call, but for the oldest write; notifications arriving
+     * in the meantime go to the unexpected handler */
+    g_static_mutex_lock(&ndmlib_mutex);
+    conn->last_header_error = -1;
+    conn->last_reply_error = -1;
+    for (;;) {
+	if ((rc = ndmconn_recv_nmb(conn, &reply)) != 0)
+	    break;
+	if (reply.header.message_type == NDMP0_MESSAGE_REPLY)
+	    break;
+	(*conn->unexpected)(conn, &reply);
+    }
+
+    if (rc) {
+	ndmconn_set_err_msg(conn, "exchange-failed");
+	self->last_rc = NDMCONN_CALL_STATUS_BOTCH;
+    } else if (reply.header.message != (ndmp0_message) MT_ndmp4_tape_write) {
+	ndmconn_set_err_msg(conn, "msg-mismatch");
+	self->last_rc = NDMCONN_CALL_STATUS_BOTCH;
+    } else if (reply.header.error) {
+	conn->last_header_error = reply.header.error;
+	ndmconn_set_err_msg(conn, "reply-error-hdr");
+	self->last_rc = NDMCONN_CALL_STATUS_HDR_ERROR;
+    } else {
+	conn->last_header_error = reply.header.error;
+	conn->last_reply_error = ndmnmb_get_reply_error(&reply);
+	if (conn->last_reply_error != NDMP9_NO_ERR) {
+	    ndmconn_set_err_msg(conn, "reply-error");
+	    self->last_rc = NDMCONN_CALL_STATUS_REPLY_ERROR;
+	} else {
+	    self->last_rc = NDMCONN_CALL_STATUS_OK;
+	    *count = reply.body.ndmp4_tape_write_reply_body.count;
+	}
+    }
+    ndmconn_free_nmb(NULL, &reply);
+    g_static_mutex_unlock(&ndmlib_mutex);
+
+    return self->last_rc == NDMCONN_CALL_STATUS_OK;
+}
+
 gboolean
 ndmp_connection_tape_read(
 	NDMPConnection *self,
@@ -61,6 +61,9 @@ typedef struct NDMPConnection {
     /* log state, if using verbose logging (private) */
     gpointer log_state;
 
+    /* NDMP_TAPE_WRITE requests sent but not yet answered */
+    guint tape_writes_pending;
+
     /* error info */
     int last_rc;
     gchar *startup_err;
@@ -162,6 +165,20 @@ gboolean ndmp_connection_tape_read(
 	guint64 count, /* buffer size/requested read size */
 	guint64 *out_count); /* bytes read */
 
+/* Pipelined tape writes: tape_write_send sends an NDMP_TAPE_WRITE without
+ * waiting for the reply, and buf can be reused as soon as it returns.  The
+ * tape server answers in order; tape_write_recv waits for the reply to the
+ * oldest write still pending and gives its result as tape_write would.  No
+ * other request may be made on the connection while writes are pending. */
+gboolean ndmp_connection_tape_write_send(
+	NDMPConnection *self,
+	gpointer buf,
+	guint64 len);
+
+gboolean ndmp_connection_tape_write_recv(
+	NDMPConnection *self,
+	guint64 *count); /* output */
+
 gboolean ndmp_connection_tape_get_state(
 	NDMPConnection *self,
 	guint64 *blocksize, /* 0 if not supported */
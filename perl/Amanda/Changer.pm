@@ -704,6 +704,13 @@ information affects some taperscan algorithms and recovery programs, which may
 choose to do their own manual scan instead of invoking many potentially slow
 searches.
 
+=item num_drives
+
+The number of drives the changer can have loaded at once.  If this key is not
+present, assume 1.  With more than one drive, a volume can be reserved while
+another reservation is outstanding; the taper uses this to load the next
+volume while it is still writing to the current one.
+
 =back
 
 =head3 reset
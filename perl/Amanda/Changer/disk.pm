@@ -106,6 +106,7 @@ sub new {
     $self->{'num-slot'} = $config->get_property('num-slot') || 1;
     $self->{'auto-create-slot'} = $config->get_boolean_property(
 					'auto-create-slot', 0);
+    $self->{'device-type'} = $config->get_property('device-type') || 'file';
     $self->{'removable'} = $params{'removable'};
     $self->{'removable'} = $config->get_boolean_property('removable', 0) if !defined $self->{'removable'};
     $self->{'mount'} = $config->get_boolean_property('mount', 0);
@@ -263,13 +264,14 @@ sub inventory {
 
 	my $nb_empty = 0;
 	my @slots = $self->_all_slots();
+	my $labels = $self->_all_slot_labels();
 	my $current = $self->_get_current($state);
 	for my $slot (@slots) {
 	    my $s = { slot => $slot, state => Amanda::Changer::SLOT_FULL };
 	    $s->{'reserved'} = $self->_is_slot_in_use($state, $slot);
-	    my $label = $self->_get_slot_label($slot);
+	    my $label = $labels->{$slot};
 	    if ($label) {
-		$s->{'label'} = $self->_get_slot_label($slot);
+		$s->{'label'} = $label;
 		$s->{'f_type'} = "".$Amanda::Header::F_TAPESTART;
 		$s->{'device_status'} = "".$DEVICE_STATUS_SUCCESS;
 	    } else {
@@ -467,7 +469,7 @@ sub _make_res {
     my $res;
 
     my $slot_path = "$self->{'dir'}/slot$slot";
-    my $device_name = "file:$slot_path";
+    my $device_name = "$self->{'device-type'}:$slot_path";
     my $device = Amanda::Device->new($device_name);
     if ($device->status != $DEVICE_STATUS_SUCCESS) {
 	return $self->make_error("failed", $res_cb,
@@ -584,6 +586,24 @@ sub _get_slot_label {
     return ''; # known, but blank
 }
 
+# Internal function to find the labels of all slots at once; a single glob is
+# much cheaper than one per slot when there are thousands of slots.  Returns a
+# hash from slot number to label; unlabeled slots are missing.
+sub _all_slot_labels {
+    my ($self) = @_;
+    my $dir = _quote_glob($self->{'dir'});
+    my %labels;
+
+    for my $symlink (bsd_glob("$dir/slot*/00000.*")) {
+	my ($slot, $label) = ($symlink =~ qr{/slot([0-9]+)/00000\.([^/]*)$});
+	next unless defined $slot;
+	$slot = "" . ($slot + 0);
+	$labels{$slot} = $label unless exists $labels{$slot};
+    }
+
+    return \%labels;
+}
+
 # Internal function to point a drive to a slot
 sub _load_drive {
     my ($self, $state, $drive, $slot) = @_;
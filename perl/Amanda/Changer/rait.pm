@@ -446,6 +446,8 @@ sub info_key {
 	    errsub => undef,
 	    parent_cb => $all_kids_done_cb,
 	);
+    } else {
+	$params{'info_cb'}->(undef) if $params{'info_cb'};
     }
 }
 
@@ -67,6 +67,11 @@ See the amanda-changers(7) manpage for usage information.
 #   last_operation_time - time the last operation finished
 #   last_operation_delay - required delay for that operation
 #   last_status - last time a 'status' command finished
+#   inventory_seq - incremented each time the slots or drives change, whether
+#                   that was seen by 'status' or recorded from a move result
+#   status_seq - inventory_seq as of the last 'status'
+#   inventory_dirty - set when a move failed, so the physical state of the
+#                     library is uncertain until the next 'status'
 #
 # The 'slots' key is a hash, with slot numbers as keys and hashes
 # as values.  Each slot's hash has keys
@@ -94,7 +99,15 @@ See the amanda-changers(7) manpage for usage information.
 # This package uses Amanda::Changer's with_locked_state to lock a statefile and
 # load its contents.  Every time the state is locked, the package also
 # considers running 'status' to update the state; the status_interval protects
-# against running status too often.
+# against running status too often.  If the inventory-cache property is set,
+# the state is instead trusted for that long after a status, since every move
+# this package makes is recorded in the state; a failed move marks the
+# inventory dirty and forces the next status.
+#
+# With more than one drive, load releases the lock once the robot has moved
+# the tape, and waits for the drive to become ready and reads the label
+# without it, holding a reservation on the drive meanwhile.  Robot motion is
+# still serialized, but other drives can be loaded while one is polling.
 #
 # Each changer method has an "_unlocked" version that does the actual work, and
 # is called with an additional 'state' parameter containing the locked state.
@@ -143,6 +156,7 @@ sub new {
 	fast_search => 1,
 	use_slots => undef,
 	status_interval => 2, # in seconds
+	inventory_cache => 0, # in seconds; 0 to always honor status_interval
 	load_poll => [0, 2, 120], # delay, poll, until
 	eject_delay => 0, # in seconds
 	unload_delay => 0, # in seconds
@@ -337,8 +351,8 @@ sub new {
 	$self->{'load_poll'} = [ $delay, $poll, $until ];
     }
 
-    # status-interval, eject-delay, unload-delay
-    for my $propname (qw(status-interval eject-delay unload-delay)) {
+    # status-interval, eject-delay, unload-delay, inventory-cache
+    for my $propname (qw(status-interval eject-delay unload-delay inventory-cache)) {
 	next unless exists $config->{'properties'}->{$propname};
 	if (@{$config->{'properties'}->{$propname}->{'values'}} > 1) {
 	    return Amanda::Changer->make_error("fatal", undef,
@@ -396,6 +410,15 @@ sub load {
 
     return if $self->check_error($params{'res_cb'});
 
+    # load_unlocked may release the lock early, by calling res_cb with a third
+    # argument: a sub to carry on with, given the caller's res_cb
+    my $res_cb = $params{'res_cb'};
+    $params{'res_cb'} = sub {
+	my ($err, $res, $resume) = @_;
+	return $resume->($res_cb) if $resume;
+	$res_cb->($err, $res);
+    };
+
     $self->_with_updated_state(\%params, 'res_cb', sub { $self->load_unlocked(@_) });
 }
 
@@ -831,6 +854,7 @@ sub load_unlocked {
         my ($err) = @_;
 
         if ($err) {
+	    $state->{'inventory_dirty'} = 1;
             return $self->make_error("failed", $params{'res_cb'},
 			source_filename	=> __FILE__,
 			source_line	=> __LINE__,
@@ -841,27 +865,87 @@ sub load_unlocked {
 			err		=> $err);
         }
 
+	# record the move now, in case the lock is released before the label
+	# has been read
+	$state->{'slots'}->{$slot}->{'loaded_in'} = $drive;
+	$state->{'drives'}->{$drive}->{'orig_slot'} = $slot;
+	$state->{'drives'}->{$drive}->{'state'} = Amanda::Changer::SLOT_FULL;
+	$state->{'drives'}->{$drive}->{'label'} = $state->{'slots'}->{$slot}->{'label'};
+	$state->{'drives'}->{$drive}->{'barcode'} = $state->{'slots'}->{$slot}->{'barcode'};
+	$self->_inventory_changed($state);
+
 	$steps->{'start_polling'}->();
     };
 
-    my ($next_poll, $last_poll);
     step start_polling => sub {
-	my ($delay, $poll, $until) = @{ $self->{'load_poll'} };
-	my $now = time;
-	$next_poll = $now + $delay;
-	$last_poll = $now + $until;
+	if ((keys %{$self->{'drive2device'}}) > 1) {
+	    # hold the drive while polling it without the lock; the drive
+	    # reservation is replaced by the real one in _load_make_res
+	    $state->{'drives'}->{$drive}->{'res_info'} = $self->_res_info_new();
+	    my %resume_params = %params;
+	    delete $resume_params{'state'};
+	    return $params{'res_cb'}->(undef, undef, sub {
+		my ($res_cb) = @_;
+		$self->_load_poll_unlocked($slot, $drive, $res_cb, \%resume_params);
+	    });
+	}
+
+	$self->_load_poll($drive, $steps->{'make_res'});
+    };
 
-	return Amanda::MainLoop::call_after(1000 * ($next_poll - $now), $steps->{'check_device'});
+    step make_res => sub {
+	my ($device, $label) = @_;
+
+	return $params{'res_cb'}->($device) if $device->isa("Amanda::Changer::Error");
+	$self->_load_make_res(\%params, $state, $slot, $drive, $device, $label);
     };
+}
 
-    step check_device => sub {
+# Finish a load in a multi-drive library: wait for the drive to be ready
+# without holding the state lock, then take the lock again to record the label
+# and make the reservation.
+sub _load_poll_unlocked {
+    my $self = shift;
+    my ($slot, $drive, $res_cb, $params) = @_;
+
+    $self->_load_poll($drive, sub {
+	my ($device, $label) = @_;
+
+	$self->with_locked_state($self->{'statefile'}, $res_cb, sub {
+	    my ($state, $locked_res_cb) = @_;
+
+	    # release the drive we held while polling
+	    $state->{'drives'}->{$drive}->{'res_info'} = undef;
+
+	    return $locked_res_cb->($device) if $device->isa("Amanda::Changer::Error");
+	    $self->_load_make_res({ %$params, res_cb => $locked_res_cb },
+				  $state, $slot, $drive, $device, $label);
+	});
+    });
+}
+
+# Poll the device in $drive until it is ready, according to the load-poll
+# property, then call $finished_cb with the device (or an error) and its label.
+sub _load_poll {
+    my $self = shift;
+    my ($drive, $finished_cb) = @_;
+    my ($delay, $poll, $until) = @{ $self->{'load_poll'} };
+    my $now = time;
+    my $next_poll = $now + $delay;
+    my $last_poll = $now + $until;
+    my $check_device;
+
+    $check_device = sub {
 	my $device_name = $self->{'drive2device'}->{$drive};
 	confess "drive $drive not found in drive2device" unless $device_name; # shouldn't happen
 
 	$self->_debug("polling '$device_name' to see if it's ready");
 
 	my $device = $self->get_device($device_name);
-	return $params{'res_cb'}->($device) if $device->isa("Amanda::Changer::Error");
+	if ($device->isa("Amanda::Changer::Error")) {
+	    $check_device = undef;
+	    return $finished_cb->($device);
+	}
 
 	my $label;
 	$device->read_label();
@@ -870,13 +954,12 @@ sub load_unlocked {
 	if ($device->status & $DEVICE_STATUS_VOLUME_MISSING
 	    or $device->status & $DEVICE_STATUS_DEVICE_BUSY) {
 	    # device is not ready -- set up for the next polling step
-	    my ($delay, $poll, $until) = @{ $self->{'load_poll'} };
 	    my $now = time;
 	    $next_poll += $poll;
 	    $next_poll = $now + 1 if ($next_poll < $now);
 	    if ($poll != 0 and $next_poll < $last_poll) {
 		return Amanda::MainLoop::call_after(
-			1000 * ($next_poll - $now), $steps->{'check_device'});
+			1000 * ($next_poll - $now), $check_device);
 	    }
 
 	    # (fall through if we're done polling)
@@ -891,93 +974,26 @@ sub load_unlocked {
 	}
 
 	# success!
-	$steps->{'make_res'}->($device, $label);
+	$check_device = undef;
+	$finished_cb->($device, $label);
     };
 
-    step make_res => sub {
-	my ($device, $label) = @_;
-
-	# check the label against the desired label, in case this isn't the
-	# desired volume
-	if ($label and $params{'label'} and $label ne $params{'label'}) {
-	    $self->_debug("Expected label '$params{label}', but got '$label'");
-
-	    # update metadata with this new information
-	    $state->{'slots'}->{$slot}->{'state'} = Amanda::Changer::SLOT_FULL;
-	    $state->{'slots'}->{$slot}->{'device_status'} = $device->status;
-	    if ($device->status == $DEVICE_STATUS_SUCCESS) {
-	        $state->{'slots'}->{$slot}->{'device_error'} = undef;
-	    } else {
-	        $state->{'slots'}->{$slot}->{'device_error'} = $device->error;
-	    }
-	    if (defined $device->volume_header) {
-		$state->{'slots'}->{$slot}->{'f_type'} = $device->volume_header->{type};
-	    } else {
-		$state->{'slots'}->{$slot}->{'f_type'} = undef;
-	    }
-	    $state->{'slots'}->{$slot}->{'label'} = $label;
-	    if ($state->{'slots'}->{$slot}->{'barcode'}) {
-		my $barcode = $state->{'slots'}->{$slot}->{'barcode'};
-		my $old_label = $state->{'bc2lb'}->{$barcode};
-		if ($label ne $old_label) {
-		    $self->_debug("make_res: slot $slot");
-		    $self->_debug("update label '$label' for barcode '$barcode', old label was '$old_label'");
-		}
-		$state->{'bc2lb'}->{$barcode} = $label;
-	    }
+    Amanda::MainLoop::call_after(1000 * ($next_poll - $now), $check_device);
+}
 
-	    return $self->make_error("failed", $params{'res_cb'},
-			source_filename	=> __FILE__,
-			source_line	=> __LINE__,
-			module		=> ref $self,
-			severity	=> $Amanda::Message::MESSAGE,
-			code		=> 1100106,
-			reason		=> "notfound",
-			slot		=> $slot,
-			label		=> $label,
-			expected_label	=> $params{label});
-	}
+# Check the label read from a freshly loaded volume, update the state with
+# what was found, and call $params->{'res_cb'} with a new reservation.
+sub _load_make_res {
+    my $self = shift;
+    my ($params, $state, $slot, $drive, $device, $label) = @_;
 
-	if (!$label) {
-	    # update metadata with this new information
-	    $state->{'slots'}->{$slot}->{'state'} = Amanda::Changer::SLOT_FULL;
-	    $state->{'slots'}->{$slot}->{'device_status'} = $device->status;
-	    if ($device->status == $DEVICE_STATUS_SUCCESS) {
-		$state->{'slots'}->{$slot}->{'device_error'} = undef;
-	    } else {
-		$state->{'slots'}->{$slot}->{'device_error'} = $device->error;
-	    }
-	    if (defined $device->volume_header) {
-		$state->{'slots'}->{$slot}->{'f_type'} = $device->volume_header->{type};
-	    } else {
-		$state->{'slots'}->{$slot}->{'f_type'} = undef;
-	    }
-	    $state->{'slots'}->{$slot}->{'label'} = undef;
-	    if ($state->{'slots'}->{$slot}->{'barcode'}) {
-		delete $state->{'bc2lb'}->{$state->{'slots'}->{$slot}->{'barcode'}};
-	    }
+    # check the label against the desired label, in case this isn't the
+    # desired volume
+    if ($label and $params->{'label'} and $label ne $params->{'label'}) {
+	$self->_debug("Expected label '$params->{label}', but got '$label'");
 
-	    if (defined $params{'label'}) {
-		$self->_debug("Expected label '$params{label}', but got an unlabeled tape");
-		return $self->make_error("failed", $params{'res_cb'},
-			source_filename	=> __FILE__,
-			source_line	=> __LINE__,
-			module		=> ref $self,
-			severity	=> $Amanda::Message::MESSAGE,
-			code		=> 1100107,
-			reason		=> "notfound",
-			slot		=> $slot,
-			expected_label	=> $params{label});
-	    }
-	}
-
-	# update our state before returning
-	$state->{'slots'}->{$slot}->{'loaded_in'} = $drive;
-	$state->{'drives'}->{$drive}->{'orig_slot'} = $slot;
-	$state->{'slots'}->{$slot}->{'label'} = $label;
-	$state->{'drives'}->{$drive}->{'label'} = $label;
-	$state->{'drives'}->{$drive}->{'state'} = Amanda::Changer::SLOT_FULL;
-	$state->{'drives'}->{$drive}->{'barcode'} = $state->{'slots'}->{$slot}->{'barcode'};
+	# update metadata with this new information
+	$state->{'slots'}->{$slot}->{'state'} = Amanda::Changer::SLOT_FULL;
 	$state->{'slots'}->{$slot}->{'device_status'} = $device->status;
 	if ($device->status == $DEVICE_STATUS_SUCCESS) {
 	    $state->{'slots'}->{$slot}->{'device_error'} = undef;
@@ -989,46 +1005,119 @@ sub load_unlocked {
 	} else {
 	    $state->{'slots'}->{$slot}->{'f_type'} = undef;
 	}
-	my $barcode = $state->{'slots'}->{$slot}->{'barcode'};
-	if ($label and $barcode) {
+	$state->{'slots'}->{$slot}->{'label'} = $label;
+	if ($state->{'slots'}->{$slot}->{'barcode'}) {
+	    my $barcode = $state->{'slots'}->{$slot}->{'barcode'};
 	    my $old_label = $state->{'bc2lb'}->{$barcode};
-	    if (defined $old_label and $old_label ne $label) {
-		$self->_debug("load drive $drive slot $slot");
+	    if ($label ne $old_label) {
+		$self->_debug("make_res: slot $slot");
 		$self->_debug("update label '$label' for barcode '$barcode', old label was '$old_label'");
 	    }
 	    $state->{'bc2lb'}->{$barcode} = $label;
 	}
-	if ($params{'set_current'}) {
-	    $self->_debug("setting current slot to $slot");
-	    $self->_set_current(state => $state, slot => $slot);
+
+	return $self->make_error("failed", $params->{'res_cb'},
+		    source_filename	=> __FILE__,
+		    source_line	=> __LINE__,
+		    module		=> ref $self,
+		    severity	=> $Amanda::Message::MESSAGE,
+		    code		=> 1100106,
+		    reason		=> "notfound",
+		    slot		=> $slot,
+		    label		=> $label,
+		    expected_label	=> $params->{label});
+    }
+
+    if (!$label) {
+	# update metadata with this new information
+	$state->{'slots'}->{$slot}->{'state'} = Amanda::Changer::SLOT_FULL;
+	$state->{'slots'}->{$slot}->{'device_status'} = $device->status;
+	if ($device->status == $DEVICE_STATUS_SUCCESS) {
+	    $state->{'slots'}->{$slot}->{'device_error'} = undef;
+	} else {
+	    $state->{'slots'}->{$slot}->{'device_error'} = $device->error;
+	}
+	if (defined $device->volume_header) {
+	    $state->{'slots'}->{$slot}->{'f_type'} = $device->volume_header->{type};
+	} else {
+	    $state->{'slots'}->{$slot}->{'f_type'} = undef;
 	}
+	$state->{'slots'}->{$slot}->{'label'} = undef;
+	if ($state->{'slots'}->{$slot}->{'barcode'}) {
+	    delete $state->{'bc2lb'}->{$state->{'slots'}->{$slot}->{'barcode'}};
+	}
+
+	if (defined $params->{'label'}) {
+	    $self->_debug("Expected label '$params->{label}', but got an unlabeled tape");
+	    return $self->make_error("failed", $params->{'res_cb'},
+		    source_filename	=> __FILE__,
+		    source_line	=> __LINE__,
+		    module		=> ref $self,
+		    severity	=> $Amanda::Message::MESSAGE,
+		    code		=> 1100107,
+		    reason		=> "notfound",
+		    slot		=> $slot,
+		    expected_label	=> $params->{label});
+	}
+    }
 
-	if (defined $self->{'catalog'} && $label) {
-	    my $volume = $self->{'catalog'}->find_volume($self->{'storage'}->{'tapepool'}, $label);
-	    if (defined $volume and defined $volume->{'barcode'} and
-		defined $state->{'slots'}->{$slot}->{'barcode'} and
-		$state->{'slots'}->{$slot}->{'barcode'} ne $volume->{'barcode'}) {
-		return $self->make_error("failed", $params{'res_cb'},
-			source_filename	=> __FILE__,
-			source_line	=> __LINE__,
-			module		=> ref $self,
-			severity	=> $Amanda::Message::MESSAGE,
-			code		=> 1100108,
-			reason		=> "device",
-			slot		=> $slot,
-			label		=> $label,
-			state_barcode	=> $$state->{'slots'}->{$slot}->{'barcode'},
-			tle_barcode	=> $volume->{'barcode'});
-	    }
+    # update our state before returning
+    $state->{'slots'}->{$slot}->{'loaded_in'} = $drive;
+    $state->{'drives'}->{$drive}->{'orig_slot'} = $slot;
+    $state->{'slots'}->{$slot}->{'label'} = $label;
+    $state->{'drives'}->{$drive}->{'label'} = $label;
+    $state->{'drives'}->{$drive}->{'state'} = Amanda::Changer::SLOT_FULL;
+    $state->{'drives'}->{$drive}->{'barcode'} = $state->{'slots'}->{$slot}->{'barcode'};
+    $state->{'slots'}->{$slot}->{'device_status'} = $device->status;
+    if ($device->status == $DEVICE_STATUS_SUCCESS) {
+	$state->{'slots'}->{$slot}->{'device_error'} = undef;
+    } else {
+	$state->{'slots'}->{$slot}->{'device_error'} = $device->error;
+    }
+    if (defined $device->volume_header) {
+	$state->{'slots'}->{$slot}->{'f_type'} = $device->volume_header->{type};
+    } else {
+	$state->{'slots'}->{$slot}->{'f_type'} = undef;
+    }
+    my $barcode = $state->{'slots'}->{$slot}->{'barcode'};
+    if ($label and $barcode) {
+	my $old_label = $state->{'bc2lb'}->{$barcode};
+	if (defined $old_label and $old_label ne $label) {
+	    $self->_debug("load drive $drive slot $slot");
+	    $self->_debug("update label '$label' for barcode '$barcode', old label was '$old_label'");
+	}
+	$state->{'bc2lb'}->{$barcode} = $label;
+    }
+    if ($params->{'set_current'}) {
+	$self->_debug("setting current slot to $slot");
+	$self->_set_current(state => $state, slot => $slot);
+    }
+
+    if (defined $self->{'catalog'} && $label) {
+	my $volume = $self->{'catalog'}->find_volume($self->{'storage'}->{'tapepool'}, $label);
+	if (defined $volume and defined $volume->{'barcode'} and
+	    defined $state->{'slots'}->{$slot}->{'barcode'} and
+	    $state->{'slots'}->{$slot}->{'barcode'} ne $volume->{'barcode'}) {
+	    return $self->make_error("failed", $params->{'res_cb'},
+		    source_filename	=> __FILE__,
+		    source_line	=> __LINE__,
+		    module		=> ref $self,
+		    severity	=> $Amanda::Message::MESSAGE,
+		    code		=> 1100108,
+		    reason		=> "device",
+		    slot		=> $slot,
+		    label		=> $label,
+		    state_barcode	=> $$state->{'slots'}->{$slot}->{'barcode'},
+		    tle_barcode	=> $volume->{'barcode'});
 	}
-        my $res = Amanda::Changer::robot::Reservation->new($self, $slot, $drive,
-                                $device, $state->{'slots'}->{$slot}->{'barcode'});
+    }
+    my $res = Amanda::Changer::robot::Reservation->new($self, $slot, $drive,
+			    $device, $state->{'slots'}->{$slot}->{'barcode'});
 
-	# mark this as reserved
-	$state->{'drives'}->{$drive}->{'res_info'} = $self->_res_info_new();
+    # mark this as reserved
+    $state->{'drives'}->{$drive}->{'res_info'} = $self->_res_info_new();
 
-        return $params{'res_cb'}->(undef, $res);
-    };
+    return $params->{'res_cb'}->(undef, $res);
 }
 
 sub info_key {
@@ -1043,6 +1132,10 @@ sub info_key {
 	$self->info_key_num_slots(%params);
     } elsif ($key eq 'slots') {
 	$self->info_key_slots(%params);
+    } elsif ($key eq 'num_drives') {
+	$self->info_key_num_drives(%params);
+    } else {
+	$params{'info_cb'}->(undef) if $params{'info_cb'};
     }
 }
 
@@ -1055,6 +1148,15 @@ sub info_key_fast_search {
     );
 }
 
+sub info_key_num_drives {
+    my $self = shift;
+    my %params = @_;
+
+    $params{'info_cb'}->(undef,
+	num_drives => scalar keys %{$self->{'drive2device'}},
+    );
+}
+
 sub info_key_vendor_string {
     my $self = shift;
     my %params = @_;
@@ -1462,6 +1564,7 @@ sub eject_unlocked {
 	my ($err) = @_;
 
         if ($err) {
+	    $state->{'inventory_dirty'} = 1;
             return $self->make_error("failed", $params{'finished_cb'},
 			source_filename	=> __FILE__,
 			source_line	=> __LINE__,
@@ -1482,6 +1585,7 @@ sub eject_unlocked {
 	$state->{'drives'}->{$drive}->{'label'} = undef;
 	$state->{'drives'}->{$drive}->{'barcode'} = undef;
 	$state->{'drives'}->{$drive}->{'orig_slot'} = undef;
+	$self->_inventory_changed($state);
 
 	$self->_set_delay($state, $self->{'unload_delay'});
 	$params{'finished_cb'}->();
@@ -1494,6 +1598,8 @@ sub update {
 
     return if $self->check_error($params{'finished_cb'});
 
+    # the user is asking for fresh information, so never use the cache
+    $params{'force_status'} = 1;
     $self->_with_updated_state(\%params, 'finished_cb',
 	sub { $self->update_unlocked(@_); });
 }
@@ -1903,7 +2009,10 @@ sub move_unlocked {
 
     my $transfer_complete = make_cb(transfer_complete => sub {
 	my ($err) = @_;
-	return $params{'finished_cb'}->($err) if $err;
+	if ($err) {
+	    $state->{'inventory_dirty'} = 1;
+	    return $params{'finished_cb'}->($err);
+	}
 
 	# update metadata
 	if ($from_slot ne $to_slot) {
@@ -1937,6 +2046,7 @@ sub move_unlocked {
 	    $state->{'drives'}->{$in_drive}->{'barcode'} = undef;
 	    $state->{'drives'}->{$in_drive}->{'orig_slot'} = undef;
 	}
+	$self->_inventory_changed($state);
 
 	$params{'finished_cb'}->();
     });
@@ -2253,6 +2363,31 @@ sub verify_unlocked {
 
 # calculate the next highest non-empty slot after $slot (assuming that
 # the changer status has been updated)
+# note that the slots or drives were changed by a move
+sub _inventory_changed {
+    my $self = shift;
+    my ($state) = @_;
+
+    $state->{'inventory_seq'} = ($state->{'inventory_seq'} || 0) + 1;
+}
+
+# compare the occupancy of two 'slots' hashes
+sub _same_slots {
+    my $self = shift;
+    my ($old, $new) = @_;
+
+    return 0 if (keys %$old) != (keys %$new);
+    for my $slot (keys %$new) {
+	my $o = $old->{$slot};
+	my $n = $new->{$slot};
+	return 0 unless $o;
+	return 0 if ($o->{'state'} || 0) != ($n->{'state'} || 0);
+	return 0 if ($o->{'barcode'} || '') ne ($n->{'barcode'} || '');
+    }
+
+    return 1;
+}
+
 sub _get_next_slot {
     my $self = shift;
     my ($state, $slot, $except_slots) = @_;
@@ -2420,6 +2555,14 @@ sub _get_state {
 	    and  defined $self->{'got_status'}) {
 	    $self->_debug("too early for another 'status' invocation");
 	    $steps->{'done'}->();
+	} elsif ($self->{'inventory_cache'}
+	    and !$params{'force_status'}
+	    and !$state->{'inventory_dirty'}
+	    and defined $state->{'last_status'}
+	    and time < $state->{'last_status'} + $self->{'inventory_cache'}) {
+	    $self->_debug("using cached inventory (seq " .
+			  ($state->{'inventory_seq'} || 0) . ")");
+	    $steps->{'done'}->();
 	} else {
 	    $steps->{'wait'}->();
 	}
@@ -2674,6 +2817,20 @@ sub _get_state {
 	    }
 	}
 
+	# if everything since the last status was recorded from our own move
+	# results, the library should look just as we left it; anything else
+	# was changed behind our back
+	if (defined $state->{'status_seq'}
+	    and !$self->_same_slots($old_slots_state, $state->{'slots'})) {
+	    if (!$state->{'inventory_dirty'}) {
+		$self->_debug("library inventory changed outside of Amanda since seq " .
+			      $state->{'inventory_seq'});
+	    }
+	    $self->_inventory_changed($state);
+	}
+	$state->{'inventory_dirty'} = 0;
+	$state->{'status_seq'} = $state->{'inventory_seq'} || 0;
+
 	# sanity check that we don't have tape-device info for nonexistent drives
 	for my $dr (@{$self->{'driveorder'}}) {
 	    if (!exists $state->{'drives'}->{$dr}) {
@@ -125,6 +125,7 @@ sub run {
     $self->{'target'} = $params{'target'};
     $self->{'extract-client'} = $params{'extract-client'};
     $self->{'assume'} = $params{'assume'};
+    $self->{'crc-only'} = $params{'crc-only'};
 
     ($self->{'restore'}, my $result_message) = Amanda::Restore->new(
 			message_pathname => $self->{'message_pathname'});
@@ -204,14 +205,15 @@ sub run {
     $self->{'restore'}->restore(
 		#'application_property'  => $params{'application_property'},
 		'assume'                => $params{'assume'},
-		'decompress'            => 1,
-		'decrypt'               => 1,
+		'decompress'            => !$self->{'crc-only'},
+		'decrypt'               => !$self->{'crc-only'},
 		'device'                => $params{'device'},
 		'target'                => undef,
 		'dumpspecs'             => \@spec,
 		'exact-match'           => $params{'exact-match'},
 		'extract'               => 1,
 		'all_copy'              => 1,
+		'parallel'              => $params{'parallel'},
 		#'init'                  => $params{'init'},
 		#'restore'               => $params{'restore'},
 		'finished_cb'           => $validate_finish_cb,
@@ -219,6 +221,18 @@ sub run {
 		'feedback'              => $self);
 }
 
+# a copy of the feedback for one of the plans checked at the same time, with
+# its own state of the image being validated
+sub new_stream {
+    my $self = shift;
+    my ($stream) = @_;
+
+    $self->{'streams'} ||= { sizes => {}, last_is_size => 0 };
+    my $new = bless { %$self }, ref $self;
+    $new->{'stream'} = $stream;
+    return $new;
+}
+
 sub set_feedback {
     my $self = shift;
     my %params = @_;
@@ -239,6 +253,9 @@ sub set {
     $self->{'dle'} = $dle;
     $self->{'application_property'} = $application_property;
 
+    # the image is only read, the application is not needed
+    return undef if $self->{'crc-only'};
+
     $self->{'extract'} = Amanda::Extract->new(hdr => $hdr, dle => $dle);
     die("$self->{'extract'}") if $self->{'extract'}->isa('Amanda::Message');
     ($self->{'bsu'}, my $err) = $self->{'extract'}->BSU();
@@ -260,6 +277,11 @@ sub get_datapath {
     my $self = shift;
     my $directtcp_supported = shift;
 
+    # the CRCs are computed while reading the image through the server
+    if ($self->{'crc-only'}) {
+	$self->{'use_directtcp'} = 0;
+	return 0;
+    }
     $self->{'use_directtcp'} = $directtcp_supported && !$self->{'bsu'}->{'data-path-directtcp'};
     return $self->{'use_directtcp'};
 }
@@ -267,6 +289,11 @@ sub get_datapath {
 sub get_xfer_dest {
     my $self = shift;
 
+    if ($self->{'crc-only'}) {
+	$self->{'xfer_dest'} = Amanda::Xfer::Dest::Null->new(0);
+	return $self->{'xfer_dest'};
+    }
+
     $self->{'extract'}->set_validate_argv();
 
     if ($self->{'extract'}->{'validate_argv'}) {
@@ -331,6 +358,10 @@ sub user_message {
     my $self = shift;
     my $message = shift;
 
+    if (defined $self->{'stream'}) {
+	return $self->stream_message($message);
+    }
+
     if ($message->{'code'} == 4900000) { #SIZE
 	if ($self->{'is_tty'}) {
 	    print STDOUT "\r$message    ";
@@ -362,4 +393,31 @@ sub user_message {
     }
 }
 
+# the sizes of all streams are on one line on a tty
+sub stream_message {
+    my $self = shift;
+    my $message = shift;
+    my $stream = $self->{'stream'};
+    my $streams = $self->{'streams'};
+    my $sizes = $streams->{'sizes'};
+
+    if ($message->{'code'} == 4900000 || $message->{'code'} == 4900012) { #SIZE
+	if ($self->{'is_tty'}) {
+	    $sizes->{$stream} = "$message";
+	    print STDOUT "\r" . join("  ", map { "[$_] $sizes->{$_}" }
+					  sort { $a <=> $b } keys %$sizes) . "    ";
+	    $streams->{'last_is_size'} = 1;
+	} else {
+	    print STDOUT "READ SIZE: [$stream] $message\n";
+	}
+    } elsif ($message->{'code'} == 4900018 && $message->{'text'} eq 'application stdout') {
+	# do nothing with application stdout
+    } else {
+	delete $sizes->{$stream};
+	print STDOUT "\n" if $self->{'is_tty'} and $streams->{'last_is_size'};
+	print STDOUT "[$stream] $message\n";
+	$streams->{'last_is_size'} = 0;
+    }
+}
+
 1;
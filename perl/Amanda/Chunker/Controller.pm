@@ -203,9 +203,15 @@ sub msg_PORT_WRITE {
 
 	$self->{'xfer'} = Amanda::Xfer->new([$self->{'xfer_source'},
 					     $self->{'xfer_dest'}]);
+	$self->{'xfer'}->set_stats_interval(10);
 	$self->{'xfer'}->start(sub {
             my ($src, $msg, $xfer) = @_;
 
+	    if ($msg->{'type'} == $XMSG_STATS) {
+		$self->report_xfer_stats($msg);
+		return;
+	    }
+
 	    if ($msg->{'type'} == $XMSG_CRC) {
 		if ($msg->{'elt'} == $self->{'xfer_source'}) {
 		    $self->{'source_server_crc'} = $msg->{'crc'}.":".$msg->{'size'};
@@ -291,6 +297,21 @@ sub msg_PORT_WRITE {
     };
 }
 
+# write the XMSG_STATS to the dump log, as the taper workers do
+sub report_xfer_stats {
+    my $self = shift;
+    my $msg = shift;
+
+    my $qdisk = quote_string($self->{'diskname'}."");
+    my $qhost = quote_string($self->{'hostname'}."");
+    my $qelt = quote_string($msg->{'elt'}->repr());
+    printf STDERR "chunker: xfer stats %s %s %s in %s out %s " .
+		  "wait-upstream %.2f wait-downstream %.2f busy %.2f duration %.2f\n",
+		  $qhost, $qdisk, $qelt, $msg->{'bytes_in'}, $msg->{'bytes_out'},
+		  $msg->{'wait_upstream'}, $msg->{'wait_downstream'},
+		  $msg->{'busy'}, $msg->{'duration'};
+}
+
 sub msg_SHM_WRITE {
     my $self = shift;
     $self->{'doing_port_write'} = 0;
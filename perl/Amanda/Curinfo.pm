@@ -114,6 +114,7 @@ use Amanda::Debug qw( :logging );
 use Amanda::Util qw( sanitise_filename );
 
 use Amanda::Curinfo::Info;
+use Amanda::Infofile;
 
 =head1 NAME
 
@@ -161,6 +162,10 @@ This rewrite simplifies the terminology by referring to the storage
 directory as an C<$infodir> and an individual data-storing file as a
 C<$infofile>.
 
+Only the C<directory> format of the C<infofile-format> configuration
+parameter is implemented; the single-file C<db> format is read and
+written by infofile.c only.
+
 =head1 INTERFACE
 
 
@@ -189,6 +194,15 @@ usage is the same as retrieving an info object.
 
   $ci->del_info($host, $disk);
 
+Tools that need the info of many DLEs should read them all at once:
+
+  my @infos = $ci->get_all_info(@dles);
+
+This returns the info of each DLE of C<@dles> (C<Amanda::Disklist::Disk>
+objects), in the same order, like C<get_dle_info> would.  They are read by
+the C code of F<infofile.c> in one call, and cached for the life of the
+process: a DLE is read again only when its info file changes.
+
 To create a new info object, please see the documentation for
 L<Amanda::Curinfo::Info>.
 
@@ -246,6 +260,20 @@ sub get_dle_info
     return $info;
 }
 
+sub get_all_info
+{
+    my ($self, @dles) = @_;
+
+    my @infos = Amanda::Infofile::get_all_info($self->{infodir},
+	map { [ $_->{'host'}->{'hostname'}, $_->{'name'} ] } @dles);
+
+    # a DLE without info, or with a bad one, gets what get_info returns
+    for my $i (0 .. $#dles) {
+	$infos[$i] = $self->get_dle_info($dles[$i]) if !defined $infos[$i];
+    }
+    return @infos;
+}
+
 sub put_info
 {
     my ($self, $host, $disk, $info) = @_;
@@ -406,6 +406,10 @@ sub read_infofile_history
 	    return $hist if $hist->isa("Amanda::Message");
             push @$history, $hist;
 
+        } elsif ( $line =~ m{^change-token:} ) {
+	    # kept as is, for the planner
+	    $self->{change_token_line} = $line;
+
         } else {
 	    return Amanda::Curinfo::Message->new(
 				source_filename => __FILE__,
@@ -456,6 +460,7 @@ sub write_to_file
     foreach my $hist ( @{ $self->{history} } ) {
         print $fh $hist->to_line();
     }
+    print $fh $self->{change_token_line} if $self->{change_token_line};
     print $fh "//\n";
 
     return 1;
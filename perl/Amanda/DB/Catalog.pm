@@ -215,6 +215,13 @@ C<write_timestamp> is required to identify a particular on-storage instance of
 a dump.  Note that the part sizes may differ between instances, so it is not
 valid to concatenate parts from different dump instances.
 
+The results are read from the logfiles.  An index of the logfiles, kept in
+the C<findcache> directory of the log directory, records the taper summary
+lines of each logfile and the labels and DLEs it mentions, so that a query by
+label or by DLE only reads the logfiles that can match.  An entry is rebuilt
+when the size or mtime of its logfile changes, and the index can be removed at
+any time.
+
 =head1 INTERFACES
 
 =head2 SUMMARY DATA
@@ -426,7 +433,10 @@ use Amanda::Logfile qw( :constants );
 use Amanda::Tapelist;
 use Amanda::Config qw( :init :getconf config_dir_relative );
 use Amanda::Util qw( quote_string weaken_ref match_disk match_host match_datestamp match_level match_labelstr_expr);
+use Amanda::Debug qw( :logging );
 use File::Glob qw( :glob );
+use File::Basename;
+use Storable qw( nstore retrieve );
 use warnings;
 use strict;
 
@@ -510,6 +520,285 @@ sub get_run_type {
     return "unknown";
 }
 
+# The logfile index
+#
+# search_logfile keeps its own cache of the parsed logfiles, but the taper
+# lines still have to be read from each of them, and a query for a label or
+# a dle reads every logfile.  The index keeps, for each logfile, its taper
+# summary lines and the labels and dles that it mentions, so that only the
+# logfiles that can match are searched.  It is stored in the find cache
+# directory, next to the logfiles, and an entry is valid while the size and
+# mtime of its logfile do not change: only new logfiles are read.
+
+my $LOGFILE_INDEX_VERSION = 1;
+
+sub _logfile_index_filename {
+    my ($logfile_dir) = @_;
+
+    return "$logfile_dir/findcache/catalog";
+}
+
+sub _load_logfile_index {
+    my ($logfile_dir) = @_;
+    my $filename = _logfile_index_filename($logfile_dir);
+    my $logindex;
+
+    if (-f $filename) {
+	$logindex = eval { retrieve $filename };
+	if (!defined $logindex || ref $logindex ne 'HASH' ||
+	    !defined $logindex->{'version'} ||
+	    $logindex->{'version'} != $LOGFILE_INDEX_VERSION) {
+	    debug("logfile index $filename is unreadable; ignoring it");
+	    $logindex = undef;
+	}
+    }
+    if (!defined $logindex) {
+	$logindex = { version => $LOGFILE_INDEX_VERSION, logfiles => {} };
+    }
+
+    return $logindex;
+}
+
+sub _save_logfile_index {
+    my ($logindex, $logfile_dir) = @_;
+
+    return if !delete $logindex->{'dirty'};
+
+    # forget the logfiles that were removed
+    for my $logfile (keys %{$logindex->{'logfiles'}}) {
+	delete $logindex->{'logfiles'}->{$logfile}
+	    if !-f "$logfile_dir/$logfile";
+    }
+
+    my $filename = _logfile_index_filename($logfile_dir);
+    my $dir = dirname($filename);
+    if (!-d $dir && !mkdir($dir, 0700)) {
+	debug("can't create $dir: $!");
+	return;
+    }
+
+    # write it aside and rename, a concurrent query must never retrieve a
+    # partially written index.
+    my $tmp_file = "$filename.$$";
+    if (eval { nstore $logindex, $tmp_file }) {
+	if (!rename $tmp_file, $filename) {
+	    debug("can't rename $tmp_file to $filename: $!");
+	    unlink $tmp_file;
+	}
+    } else {
+	debug("can't write $tmp_file: $@");
+	unlink $tmp_file;
+    }
+}
+
+# return the index entry of a logfile, reading the logfile if the index has
+# no valid entry for it.
+sub _get_logfile_index {
+    my ($logindex, $logfile_dir, $logfile) = @_;
+    my $path = "$logfile_dir/$logfile";
+
+    my @st = stat($path);
+    my $entry = $logindex->{'logfiles'}->{$logfile};
+    return $entry if (@st and defined $entry
+		      and $entry->{'size'} == $st[7]
+		      and $entry->{'mtime'} == $st[9]);
+
+    $entry = _read_logfile_index($path, $logfile);
+
+    # the logfile may still be written; keep the entry only if the logfile
+    # did not change while it was read, and if a change in the same second
+    # would show in its mtime.
+    my @st_end = stat($path);
+    if (@st and @st_end and $st[7] == $st_end[7] and $st[9] == $st_end[9]
+	and $st[9] < time()) {
+	$entry->{'size'} = $st[7];
+	$entry->{'mtime'} = $st[9];
+	$logindex->{'logfiles'}->{$logfile} = $entry;
+	$logindex->{'dirty'} = 1;
+    }
+
+    return $entry;
+}
+
+# note the labels and the dle in a dump or part result line
+sub _index_result_line {
+    my ($entry, $type, $str) = @_;
+
+    my @words = Amanda::Util::split_quoted_string_friendly($str);
+    shift @words if (@words and $words[0] eq 'VAULT');
+    shift @words if (@words and $words[0] =~ /^ST:/);
+    shift @words if (@words and $words[0] =~ /^POOL/);
+    if ($type == $L_PART or $type == $L_PARTPARTIAL) {
+	my $label = shift @words;
+	$entry->{'labels'}->{$label} = undef if defined $label;
+	shift @words; # filenum
+    }
+    my ($hostname, $diskname) = @words;
+    $entry->{'dles'}->{"$hostname\0$diskname"} = undef if defined $diskname;
+}
+
+sub _read_logfile_index {
+    my ($path, $logfile) = @_;
+    my $entry = { taper => [], labels => {}, dles => {} };
+
+    my $logh = Amanda::Logfile::open_logfile($path);
+    die "logfile '$logfile' not found" unless $logh;
+    while (my ($type, $prog, $str) = Amanda::Logfile::get_logline($logh)) {
+	if ($type == $L_START) {
+	    next unless $prog == $P_TAPER;
+	    my @words = Amanda::Util::split_quoted_string_friendly($str);
+	    while (@words) {
+		my $word = shift @words;
+		if ($word eq 'label' and @words) {
+		    $entry->{'labels'}->{$words[0]} = undef;
+		    last;
+		}
+	    }
+	    next;
+	}
+	next unless ($type == $L_SUCCESS or $type == $L_CHUNKSUCCESS
+		  or $type == $L_DONE or $type == $L_FAIL
+		  or $type == $L_CHUNK or $type == $L_PART
+		  or $type == $L_PARTIAL or $type == $L_PARTPARTIAL);
+	_index_result_line($entry, $type, $str);
+
+	next unless $prog == $P_TAPER;
+	my $status;
+	if ($type == $L_DONE) {
+	    $status = 'OK';
+	} elsif ($type == $L_PARTIAL) {
+	    $status = 'PARTIAL';
+	} elsif ($type == $L_FAIL) {
+	    $status = 'FAIL';
+	} elsif ($type == $L_SUCCESS) {
+	    $status = "OK";
+	} else {
+	    next;
+	}
+
+	# now extract the appropriate info; luckily these log lines have the same
+	# format, more or less
+	my ($storage, $pool, $hostname, $diskname, $dump_timestamp, $nparts, $level, $secs, $kb, $bytes, $message);
+	($storage, $str) = Amanda::Util::skip_quoted_string($str);
+	$storage = Amanda::Util::unquote_string($storage);
+	if ($storage =~ /^ST:/) {
+	    $storage =~ s/^ST://;
+	    ($pool, $str) = Amanda::Util::skip_quoted_string($str);
+	    $pool = Amanda::Util::unquote_string($pool);
+	    if ($pool =~ /^POOL/) {
+		$pool =~ s/^POOL//;
+		($hostname, $str) = Amanda::Util::skip_quoted_string($str);
+	    } else {
+		$hostname = $pool;
+		$pool = Amanda::Config::get_config_name();
+	    }
+	} else {
+	    $hostname = $storage;
+	    $storage = Amanda::Config::get_config_name();
+	    $pool = $storage;
+	}
+	($diskname, $str) = Amanda::Util::skip_quoted_string($str);
+	($dump_timestamp, $str) = Amanda::Util::skip_quoted_string($str);
+	if ($status ne 'FAIL' and $type != $L_SUCCESS) { # nparts is not in SUCCESS lines
+	    ($nparts, my $str1) = Amanda::Util::skip_quoted_string($str);
+	    if (substr($str1, 0,1) ne '[') {
+		$str = $str1;
+	    } else { # nparts is not in all PARTIAL lines
+		$nparts = 0;
+	    }
+
+	} else {
+	    $nparts = 0;
+	}
+	($level, $str) = Amanda::Util::skip_quoted_string($str);
+	if ($status ne 'FAIL') {
+	    if ($str !~ /^\[sec/) {
+		(my $crc1, $str) = Amanda::Util::skip_quoted_string($str);
+	    }
+	    if ($str !~ /^\[sec/) {
+		(my $crc2, $str) = Amanda::Util::skip_quoted_string($str);
+	    }
+	    if ($str !~ /^\[sec/) {
+		(my $crc3, $str) = Amanda::Util::skip_quoted_string($str);
+	    }
+	    my $s = $str;
+	    my $b_unit;
+	    ($secs, $b_unit, $kb, $str) = ($str =~ /^\[sec ([-0-9.]+) (kb|bytes) ([-0-9]+).*\] ?(.*)$/)
+		or die("'$s'");
+	    if ($b_unit eq 'bytes') {
+		$bytes = $kb;
+		$kb /= 1024;
+	    } else {
+		$bytes = 0;
+	    }
+	    $secs = 0.1 if ($secs <= 0);
+	}
+	if ($status ne 'OK') {
+	    $message = $str;
+	} else {
+	    $message = '';
+	}
+
+	$hostname = Amanda::Util::unquote_string($hostname);
+	$diskname = Amanda::Util::unquote_string($diskname);
+	$message = Amanda::Util::unquote_string($message) if $message;
+
+	push @{$entry->{'taper'}}, [ $status, $storage, $hostname, $diskname,
+				     $dump_timestamp, $nparts, $level, $secs,
+				     $kb, $bytes, $message ];
+    }
+    Amanda::Logfile::close_logfile($logh);
+
+    return $entry;
+}
+
+# return false if the logfile of this index entry can't have a result that
+# matches the parameters
+sub _logfile_may_match {
+    my ($entry, $write_timestamp, $params, $hostnames_hash, $disknames_hash,
+	$labels_hash) = @_;
+
+    if (%$labels_hash) {
+	return 0 if !grep { exists $labels_hash->{$_} } keys %{$entry->{'labels'}};
+    }
+    if (defined $params->{'labelstr'}) {
+	return 0 if !grep { match_labelstr_expr($params->{'labelstr'}, $_) }
+			  keys %{$entry->{'labels'}};
+    }
+
+    return 1 if (!%$hostnames_hash and !%$disknames_hash
+		 and !$params->{'hostname_match'}
+		 and !$params->{'diskname_match'}
+		 and !$params->{'dumpspecs'});
+
+    for my $dle (keys %{$entry->{'dles'}}) {
+	my ($hostname, $diskname) = split /\0/, $dle, 2;
+	next if (%$hostnames_hash and !exists($hostnames_hash->{$hostname}));
+	next if (%$disknames_hash and !exists($disknames_hash->{$diskname}));
+	next if ($params->{'hostname_match'}
+		 and !match_host($params->{'hostname_match'}, $hostname));
+	next if ($params->{'diskname_match'}
+		 and !match_disk($params->{'diskname_match'}, $diskname));
+	if ($params->{'dumpspecs'}) {
+	    my $ok = 0;
+	    for my $ds (@{$params->{'dumpspecs'}}) {
+		next if (defined $ds->{'host'}
+			and !match_host("".$ds->{'host'}, $hostname));
+		next if (defined $ds->{'disk'}
+			and !match_disk("".$ds->{'disk'}, $diskname));
+		next if (defined $ds->{'write_timestamp'}
+			 and !match_datestamp("".$ds->{'write_timestamp'}, $write_timestamp));
+		$ok = 1;
+		last;
+	    }
+	    next unless $ok;
+	}
+	return 1;
+    }
+
+    return 0;
+}
+
 
 # this generic function implements the loop of scanning logfiles to find
 # the requested data; get_parts and get_dumps then adjust the results to
@@ -607,20 +896,27 @@ sub get_parts_and_dumps {
 	push @logfiles, 'holding';
     }
 
+    my $logindex = _load_logfile_index($logfile_dir);
+
     # now loop over those logfiles and use search_logfile to load the dumpfiles
     # from them, then process each entry from the logfile
     for my $logfile (@logfiles) {
-	my (@find_results, $write_timestamp);
+	my (@find_results, $write_timestamp, $index);
 
 	# get the raw contents from search_logfile, or use holding if
 	# $logfile is undef
 	if ($logfile ne 'holding') {
-	    @find_results = Amanda::Logfile::search_logfile(undef, undef,
-							"$logfile_dir/$logfile", 1, 1);
-	    # convert to dumpfile hashes, including the write_timestamp from the logfile name
+	    # the write_timestamp comes from the logfile name
 	    my ($timestamp) = $logfile =~ /^log\.([0-9]+)(?:\.[0-9]+|\.amflush)?$/;
 	    $write_timestamp = zeropad($timestamp);
 
+	    # skip the logfiles that can't have a matching result
+	    $index = _get_logfile_index($logindex, $logfile_dir, $logfile);
+	    next if !_logfile_may_match($index, $write_timestamp, \%params,
+			\%hostnames_hash, \%disknames_hash, \%labels_hash);
+
+	    @find_results = Amanda::Logfile::search_logfile(undef, undef,
+							"$logfile_dir/$logfile", 1, 1);
 	} else {
 	    @find_results = Amanda::Logfile::search_holding_disk(1);
 	    $write_timestamp = '00000000000000';
@@ -779,91 +1075,11 @@ sub get_parts_and_dumps {
 	# if these dumps were on the holding disk, then we're done
 	next if $logfile eq 'holding';
 
-	# re-read the logfile to extract dump-level info that's not captured by
-	# search_logfile
-	my $logh = Amanda::Logfile::open_logfile("$logfile_dir/$logfile");
-	die "logfile '$logfile' not found" unless $logh;
-	while (my ($type, $prog, $str) = Amanda::Logfile::get_logline($logh)) {
-	    next unless $prog == $P_TAPER;
-	    my $status;
-	    if ($type == $L_DONE) {
-		$status = 'OK';
-	    } elsif ($type == $L_PARTIAL) {
-		$status = 'PARTIAL';
-	    } elsif ($type == $L_FAIL) {
-		$status = 'FAIL';
-	    } elsif ($type == $L_SUCCESS) {
-		$status = "OK";
-	    } else {
-		next;
-	    }
-
-	    # now extract the appropriate info; luckily these log lines have the same
-	    # format, more or less
-	    my ($storage, $pool, $hostname, $diskname, $dump_timestamp, $nparts, $level, $secs, $kb, $bytes, $message);
-	    ($storage, $str) = Amanda::Util::skip_quoted_string($str);
-	    $storage = Amanda::Util::unquote_string($storage);
-	    if ($storage =~ /^ST:/) {
-		$storage =~ s/^ST://;
-		($pool, $str) = Amanda::Util::skip_quoted_string($str);
-		$pool = Amanda::Util::unquote_string($pool);
-		if ($pool =~ /^POOL/) {
-		    $pool =~ s/^POOL//;
-		    ($hostname, $str) = Amanda::Util::skip_quoted_string($str);
-		} else {
-		    $hostname = $pool;
-		    $pool = Amanda::Config::get_config_name();
-		}
-	    } else {
-		$hostname = $storage;
-		$storage = Amanda::Config::get_config_name();
-		$pool = $storage;
-	    }
-	    ($diskname, $str) = Amanda::Util::skip_quoted_string($str);
-	    ($dump_timestamp, $str) = Amanda::Util::skip_quoted_string($str);
-	    if ($status ne 'FAIL' and $type != $L_SUCCESS) { # nparts is not in SUCCESS lines
-		($nparts, my $str1) = Amanda::Util::skip_quoted_string($str);
-		if (substr($str1, 0,1) ne '[') {
-		    $str = $str1;
-		} else { # nparts is not in all PARTIAL lines
-		    $nparts = 0;
-		}
-
-	    } else {
-		$nparts = 0;
-	    }
-	    ($level, $str) = Amanda::Util::skip_quoted_string($str);
-	    if ($status ne 'FAIL') {
-		if ($str !~ /^\[sec/) {
-		    (my $crc1, $str) = Amanda::Util::skip_quoted_string($str);
-		}
-		if ($str !~ /^\[sec/) {
-		    (my $crc2, $str) = Amanda::Util::skip_quoted_string($str);
-		}
-		if ($str !~ /^\[sec/) {
-		    (my $crc3, $str) = Amanda::Util::skip_quoted_string($str);
-		}
-		my $s = $str;
-		my $b_unit;
-		($secs, $b_unit, $kb, $str) = ($str =~ /^\[sec ([-0-9.]+) (kb|bytes) ([-0-9]+).*\] ?(.*)$/)
-		    or die("'$s'");
-		if ($b_unit eq 'bytes') {
-		    $bytes = $kb;
-		    $kb /= 1024;
-		} else {
-		    $bytes = 0;
-		}
-		$secs = 0.1 if ($secs <= 0);
-	    }
-	    if ($status ne 'OK') {
-		$message = $str;
-	    } else {
-		$message = '';
-	    }
-
-	    $hostname = Amanda::Util::unquote_string($hostname);
-	    $diskname = Amanda::Util::unquote_string($diskname);
-	    $message = Amanda::Util::unquote_string($message) if $message;
+	# the dump-level info that's not captured by search_logfile comes from
+	# the taper lines, kept in the logfile index
+	for my $taper (@{$index->{'taper'}}) {
+	    my ($status, $storage, $hostname, $diskname, $dump_timestamp, $nparts,
+		$level, $secs, $kb, $bytes, $message) = @$taper;
 
 	    # filter against dump criteria
 	    next if ($params{'dump_timestamp_match'}
@@ -947,8 +1163,8 @@ sub get_parts_and_dumps {
 		$dump->{'sec'} = $secs+0.0;
 	    }
 	}
-	Amanda::Logfile::close_logfile($logh);
     }
+    _save_logfile_index($logindex, $logfile_dir);
 
     return [ values %dumps], \@parts;
 }
@@ -40,8 +40,8 @@ Amanda::DB::Catalog2 - access to the Amanda catalog: where is that dump?
   $copy = $catalog->get_copy($copy_id);
   $image->finish_image($orig_kb, $dump_status, nb_files, nb_directories, $native_crc, $client_crc, $server_crc);
   $part = $copy->add_part($volume, $part_offset, $part_size, $filenum,
-			  $part_num, $part_status);
-  $copy->finish_copy($nb_parts, $kb, $byte, $copy_status, $server_crc, $copy_message);
+			  $part_num, $part_status, $part_message, $part_digest);
+  $copy->finish_copy($nb_parts, $kb, $byte, $copy_status, $server_crc, $copy_message, $digest);
   $catalog->remove_volume($pool, $label);
   $catalog->quit();
 
@@ -124,6 +124,11 @@ if not available
 
 (integer) -- time (in seconds) spent writing this part
 
+=item digest
+
+(string) -- fixity digest of the whole image as written, C<sha256:HEX>; undef
+if the storage does not set C<fixity-digest>
+
 =item parts
 
 (arrayref) -- array of parts, indexed by partnum (so C<< $parts->[0] >> is
@@ -178,6 +183,11 @@ on-media dumps)
 
 (integer) -- size (in kb) of this part
 
+=item digest
+
+(string) -- fixity digest of the data of this part, C<sha256:HEX>; undef if
+none was recorded
+
 =back
 
 A part is represented as a hashref with these keys.  The C<label> and
@@ -482,7 +492,7 @@ use strict;
 
 # version of the database
 our @EXPORT = qw($DB_VERSION);
-our $DB_VERSION = 5;
+our $DB_VERSION = 7;
 
 sub new {
     my $class = shift;
@@ -192,7 +192,7 @@ sub run_execute {
 	    $dbh->{'AutoCommit'} = 0;
 #	    $sth = $dbh->prepare($lock_query);
 #	    $sth->execute();
-	    $result = $fn->($obj, @_);
+	    $result = $self->_timed_call($fn, $obj, @_);
 
 	    $dbh->commit;
 
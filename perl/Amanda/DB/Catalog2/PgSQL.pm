@@ -201,7 +201,7 @@ sub run_execute {
 #	    $sth = $dbh->prepare($lock_query);
 #	    $sth->execute();
 
-	    $result = $fn->($obj, @_);
+	    $result = $self->_timed_call($fn, $obj, @_);
 
 	    $dbh->commit;
 	};
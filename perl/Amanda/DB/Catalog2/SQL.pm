@@ -113,7 +113,7 @@ sub run_execute {
     do {
         eval {
             $dbh->{'AutoCommit'} = 0;
-            $result = $fn->($obj, @_);
+            $result = $self->_timed_call($fn, $obj, @_);
 
             $dbh->commit;
         };
@@ -141,6 +141,81 @@ sub run_execute {
 }
 
 
+# The value of a catalog property; the name is given in lowercase and with
+# underscores
+sub catalog_property {
+    my $properties = shift;
+    my $name = shift;
+
+    foreach my $key (keys %{$properties}) {
+	(my $norm = lc($key)) =~ s/-/_/g;
+	return $properties->{$key}->{'values'}[0] if $norm eq $name;
+    }
+    return undef;
+}
+
+# Call $fn, and if the catalog property 'slow_query_time' is set, log the
+# statements that took more than that many milliseconds, with their plan.
+# A statement's time runs until the next statement or the end of the call,
+# so that it includes fetching its rows.
+sub _timed_call {
+    my $self = shift;
+    my $fn = shift;
+    my $obj = shift;
+
+    if (!defined $self->{'slow_query_time'}) {
+	my $properties = Amanda::Config::catalog_getconf($self->{'catalog_conf'},
+						     $CATALOG_PROPERTY);
+	my $slow_query_time = catalog_property($properties, 'slow_query_time');
+	$self->{'slow_query_time'} = 0;
+	$self->{'slow_query_time'} = $slow_query_time + 0
+	    if $have_usleep && defined $slow_query_time;
+    }
+    return $fn->($obj, @_) if !$self->{'slow_query_time'};
+
+    my $dbh = $self->{'dbh'};
+    if (!$dbh->{'Callbacks'}) {
+	# note each execute of the statements prepared from now on
+	my $catalog = $self;
+	weaken_ref($catalog);
+	$dbh->{'Callbacks'} = { ChildCallbacks => { execute => sub {
+	    my ($sth, @bind) = @_;
+	    push @{$catalog->{'executed'}},
+		 [ Time::HiRes::time(), $sth->{'Statement'}, @bind ]
+		if $catalog && $catalog->{'executed'};
+	    return;
+	} } };
+    }
+
+    local $self->{'executed'} = [];
+    my $result = $fn->($obj, @_);
+    my $end = Time::HiRes::time();
+
+    my @executed = @{$self->{'executed'}};
+    $self->{'executed'} = undef;
+    for my $i (0 .. $#executed) {
+	my ($start, $statement, @bind) = @{$executed[$i]};
+	my $next = $i < $#executed ? $executed[$i+1]->[0] : $end;
+	my $ms = int(($next - $start) * 1000);
+	next if $ms < $self->{'slow_query_time'};
+
+	debug("slow query ($ms ms): $statement; bind: " .
+	      join(', ', map { defined $_ ? $_ : 'NULL' } @bind));
+	next if $statement !~ /^\s*(SELECT|UPDATE|DELETE|INSERT)/i;
+	my $explain = $self->{'explain'} || 'EXPLAIN';
+	eval {
+	    my $sth = $dbh->prepare("$explain $statement");
+	    $sth->execute(@bind);
+	    while (my $row = $sth->fetchrow_arrayref) {
+		debug("  plan: " . join(' | ', map { defined $_ ? $_ : '' } @$row));
+	    }
+	};
+	debug("  no plan: $@") if $@;
+    }
+
+    return $result;
+}
+
 sub rm_pool {
     my $self = shift;
     my %params = @_;
@@ -1133,6 +1208,7 @@ $foreign_key (disk_id) REFERENCES disks (disk_id))")
 					      retention_recover INTEGER NOT NULL,
 					      copy_message VARCHAR(150),
 					      copy_pid INTEGER NOT NULL,
+					      digest VARCHAR(80),
 					      $foreign_key (image_id) REFERENCES images (image_id),
 					      $foreign_key (storage_id) REFERENCES storages (storage_id))")
 	or die "Cannot prepare: " . $dbh->errstr();
@@ -1147,6 +1223,7 @@ $foreign_key (disk_id) REFERENCES disks (disk_id))")
 					      part_num INTEGER NOT NULL,
 					      part_status VARCHAR(1024) NOT NULL,
 					      part_message VARCHAR(150),
+					      digest VARCHAR(80),
 					      $foreign_key (copy_id) REFERENCES copys (copy_id),
 					      $foreign_key (volume_id) REFERENCES volumes (volume_id))")
 	or die "Cannot prepare: " . $dbh->errstr();
@@ -1196,6 +1273,8 @@ $foreign_key (disk_id) REFERENCES disks (disk_id))")
     $dbh->do("CREATE INDEX PARTS_volume_id on parts (volume_id)")
 	or die "Cannot do: " . $dbh->errstr();
 
+    $self->_create_query_indexes();
+
     $self->_create_triggers();
 
     if (!$empty) {
@@ -1216,6 +1295,39 @@ $foreign_key (disk_id) REFERENCES disks (disk_id))")
     }
 }
 
+# The indexes for the predicates of the find and retention queries, added
+# in version 6.
+sub _create_query_indexes {
+    my $self = shift;
+    my $dbh = $self->{'dbh'};
+
+    # find by datestamp, for all hosts and disks
+    $dbh->do("CREATE INDEX IMAGES_dump_timestamp on images (dump_timestamp, level)")
+	or die "Cannot do: " . $dbh->errstr();
+
+    # the copies of a storage, by write date
+    $dbh->do("CREATE INDEX COPYS_storage_write on copys (storage_id, write_timestamp)")
+	or die "Cannot do: " . $dbh->errstr();
+    # the copies kept by each retention
+    $dbh->do("CREATE INDEX COPYS_retention_days on copys (retention_days, copy_id)")
+	or die "Cannot do: " . $dbh->errstr();
+    $dbh->do("CREATE INDEX COPYS_retention_full on copys (retention_full, copy_id)")
+	or die "Cannot do: " . $dbh->errstr();
+    $dbh->do("CREATE INDEX COPYS_retention_recover on copys (retention_recover, copy_id)")
+	or die "Cannot do: " . $dbh->errstr();
+
+    # the volumes of the parts of a copy, without reading the parts
+    $dbh->do("CREATE INDEX PARTS_copy_volume on parts (copy_id, volume_id)")
+	or die "Cannot do: " . $dbh->errstr();
+
+    # the reusable volumes of a storage and pool, by write date, and the
+    # volumes by label alone
+    $dbh->do("CREATE INDEX VOLUMES_storage_pool on volumes (storage_id, pool_id, reuse, write_timestamp)")
+	or die "Cannot do: " . $dbh->errstr();
+    $dbh->do("CREATE INDEX VOLUMES_label on volumes (label)")
+	or die "Cannot do: " . $dbh->errstr();
+}
+
 sub _upgrade_table {
     my $self = shift;
     my $current_version = shift;
@@ -1276,6 +1388,36 @@ sub _upgrade_table {
 	print "Upgrading the database to version '4'.\n";
 	debug("Upgrading the database to version '4'.");
     }
+
+    if ($current_version == 5) {
+	$self->_create_query_indexes();
+
+	$sth = $dbh->prepare("UPDATE version SET version=?")
+	    or die "Cannot prepare: " . $dbh->errstr();
+	$sth->execute(6) or die "Cannot execute: " . $sth->errstr();
+
+	$current_version = 6;
+	print "Upgrading the database to version '6'.\n";
+	debug("Upgrading the database to version '6'.");
+    }
+
+    if ($current_version == 6) {
+	$sth = $dbh->prepare("ALTER TABLE copys ADD digest VARCHAR(80)")
+	    or die "Cannot prepare: " . $dbh->errstr();
+	$sth->execute() or die "Cannot execute: " . $sth->errstr();
+
+	$sth = $dbh->prepare("ALTER TABLE parts ADD digest VARCHAR(80)")
+	    or die "Cannot prepare: " . $dbh->errstr();
+	$sth->execute() or die "Cannot execute: " . $sth->errstr();
+
+	$sth = $dbh->prepare("UPDATE version SET version=?")
+	    or die "Cannot prepare: " . $dbh->errstr();
+	$sth->execute(7) or die "Cannot execute: " . $sth->errstr();
+
+	$current_version = 7;
+	print "Upgrading the database to version '7'.\n";
+	debug("Upgrading the database to version '7'.");
+    }
     print "Database is now at version '$Amanda::DB::Catalog2::DB_VERSION'.\n";
     debug("Database is now at version '$Amanda::DB::Catalog2::DB_VERSION'.");
 }
@@ -3077,6 +3219,7 @@ sub _export_to_file {
 	my $server_crc = $row->[9] || "";
 	my $copy_message = $row->[13] || "";
 	my $copy_pid = $row->[14] || 0;
+	my $copy_digest = $row->[15] || "";
 	print $fh "  " . quote_string("$row->[0]") . " "
 		       . quote_string("$row->[1]") . " "
 		       . quote_string("$row->[2]") . " "
@@ -3091,7 +3234,8 @@ sub _export_to_file {
 		       . quote_string("$row->[11]") . " "
 		       . quote_string("$row->[12]") . " "
 		       . quote_string("$copy_message") . " "
-		       . quote_string("$copy_pid") . "\n";
+		       . quote_string("$copy_pid") . " "
+		       . quote_string("$copy_digest") . "\n";
     }
 
     print $fh "\nVOLUME:\n";
@@ -3125,6 +3269,7 @@ sub _export_to_file {
 	or die "Cannot execute: " . $sth->errstr();
     while ($row = $sth->fetchrow_arrayref) {
 	my $part_message = $row->[8] || "";
+	my $part_digest = $row->[9] || "";
 	print $fh "  " . quote_string("$row->[0]") . " "
 		       . quote_string("$row->[1]") . " "
 		       . quote_string("$row->[2]") . " "
@@ -3133,7 +3278,8 @@ sub _export_to_file {
 		       . quote_string("$row->[5]") . " "
 		       . quote_string("$row->[6]") . " "
 		       . quote_string("$row->[7]") . " "
-		       . quote_string("$part_message") . "\n";
+		       . quote_string("$part_message") . " "
+		       . quote_string("$part_digest") . "\n";
     }
 
     print $fh "\nCOMMAND:\n";
@@ -3180,7 +3326,10 @@ sub _import_from_file {
     $line = <$fh>;
     chomp $line;
     my $file_version = int($line);
-    die "Can't import database version $file_version" if $file_version != $Amanda::DB::Catalog2::DB_VERSION;
+    # version 6 only added indexes, version 7 the digests of copys and parts
+    die "Can't import database version $file_version"
+	if $file_version != $Amanda::DB::Catalog2::DB_VERSION &&
+	   $file_version != 6 && $file_version != 5;
     print "importing from a version $file_version database\n";
 
     # these lines was added by create_table
@@ -3314,7 +3463,7 @@ sub _import_from_file {
     $line = <$fh>;
     chomp $line;
     die "not COPY:" if $line ne "COPY:";
-    $sth = $self->make_statement('in cop', 'INSERT INTO copys(image_id,storage_id,write_timestamp,parent_copy_id,nb_parts,kb,bytes,copy_status,server_crc,retention_days,retention_full,retention_recover,copy_message,copy_pid) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)');
+    $sth = $self->make_statement('in cop dig', 'INSERT INTO copys(image_id,storage_id,write_timestamp,parent_copy_id,nb_parts,kb,bytes,copy_status,server_crc,retention_days,retention_full,retention_recover,copy_message,copy_pid,digest) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)');
     while ($line = <$fh>) {
 	chomp $line;
 	last if $line eq "";
@@ -3323,6 +3472,9 @@ sub _import_from_file {
 	my $copy_id = shift @data;
 	$data[0] = $self->{'map_image_id'}->{$data[0]};
 	$data[1] = $self->{'map_storage_id'}->{$data[1]};
+	# no digest before version 7
+	$#data = 14;
+	$data[14] = undef if defined $data[14] && $data[14] eq '';
 	$sth->execute(@data)
 	    or die "Can't import copy $copy_id " . $sth->errstr();
 	$self->{'map_copy_id'}->{$copy_id} = $dbh->last_insert_id(undef, undef, "copys", undef);
@@ -3350,7 +3502,7 @@ sub _import_from_file {
     $line = <$fh>;
     chomp $line;
     die "not PART:" if $line ne "PART:";
-    $sth = $self->make_statement('in par', 'INSERT INTO parts(copy_id,volume_id,part_offset,part_size,filenum,part_num,part_status,part_message) VALUES (?, ?, ?, ?, ?, ?, ?, ?)');
+    $sth = $self->make_statement('in par dig', 'INSERT INTO parts(copy_id,volume_id,part_offset,part_size,filenum,part_num,part_status,part_message,digest) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)');
     while ($line = <$fh>) {
 	chomp $line;
 	last if $line eq "";
@@ -3359,6 +3511,9 @@ sub _import_from_file {
 	my $part_id = shift @data;
 	$data[0] = $self->{'map_copy_id'}->{$data[0]};
 	$data[1] = $self->{'map_volume_id'}->{$data[1]};
+	# no digest before version 7
+	$#data = 8;
+	$data[8] = undef if defined $data[8] && $data[8] eq '';
 	$sth->execute(@data)
 	    or die "Can't import part $part_id " . $sth->errstr();
 	$self->{'map_part_id'}->{$part_id} = $dbh->last_insert_id(undef, undef, "parts", undef);
@@ -3860,7 +4015,7 @@ sub _get_dumps {
 		    $sth_volume->execute($row_copy->[0])
 			or die "Cannot execute: " . $sth_volume->errstr();
 		    my $row_volume = $sth_volume->fetchrow_arrayref;
-		    my $hfile = $row_volume->[0] if $row_copy->[16] eq "HOLDING";
+		    my $hfile = $row_volume->[0] if $row_copy->[17] eq "HOLDING";
 		    #put in result
 		    my %dump =  (
 			status          => $status,
@@ -3879,7 +4034,8 @@ sub _get_dumps {
 			native_crc      => $row_image->[10],
 			client_crc      => $row_image->[11],
 			server_crc      => $row_copy->[9],
-			storage         => $row_copy->[17],
+			digest          => $row_copy->[15],
+			storage         => $row_copy->[18],
 #			holding_file	=> $hfile,
 			pool		=> $row_volume->[1],
 			message         => $row_copy->[13]
@@ -3910,7 +4066,7 @@ sub _get_parts {
     my $dumps = shift;
     my %params = @_;
     my $dbh = $self->{'dbh'};
-    my $sth_part = $dbh->prepare("SELECT part_id, copy_id, volume_id, part_offset, part_size, filenum, part_num, part_status, part_message FROM parts WHERE copy_id = ? ORDER BY part_id")
+    my $sth_part = $dbh->prepare("SELECT part_id, copy_id, volume_id, part_offset, part_size, filenum, part_num, part_status, part_message, digest FROM parts WHERE copy_id = ? ORDER BY part_id")
 	or die "Cannot prepare: " . $dbh->errstr();
 
     my @parts;
@@ -3965,6 +4121,7 @@ sub _get_parts {
 		kb	    => int($row_part->[4]/1024),
 		partnum     => $row_part->[6],
 		status      => $row_part->[7],
+		digest      => $row_part->[9],
 		pool        => $volume{$volume_id}{pool},
 		dump        => $dump
 	    );
@@ -4553,6 +4710,32 @@ sub _write_tapelist {
 	}
     }
 
+    $sth = $self->make_statement('write_tapelist 1', 'SELECT write_timestamp, orig_write_timestamp, label, reuse, barcode, meta_label, block_size, pool_name, storage_name, config_name FROM volumes, metas, storages, pools, configs WHERE storages.config_id=configs.config_id AND volumes.storage_id=storages.storage_id AND volumes.pool_id=pools.pool_id AND volumes.meta_id=metas.meta_id ORDER BY write_timestamp DESC, label DESC');
+    $sth->execute()
+	or die "Cannot execute: " . $sth->errstr();
+    my @lines;
+    while (my $row_volume = $sth->fetchrow_arrayref ) {
+	my $datestamp = $row_volume->[1];
+	my $label = $row_volume->[2];
+	my $reuse = $row_volume->[3] ? 'reuse' : 'no-reuse';
+	my $barcode   = ((defined $row_volume->[4])? (" BARCODE:"   . $row_volume->[4]) : '');
+	my $meta      = ((        $row_volume->[5])? (" META:"      . $row_volume->[5]) : '');
+	my $blocksize = ((defined $row_volume->[6])? (" BLOCKSIZE:" . $row_volume->[6]) : '');
+	my $pool      = ((        $row_volume->[7])? (" POOL:"      . $row_volume->[7]) : '');
+	my $storage   = ((        $row_volume->[8])? (" STORAGE:"   . $row_volume->[8]) : '');
+	my $config    = ((        $row_volume->[9])? (" CONFIG:"    . $row_volume->[9]) : '');
+	my $key = ($row_volume->[7] || '') . "\t" . $label;
+	push @lines, [ $key, "$datestamp $label $reuse$barcode$meta$blocksize$pool$storage$config\n" ];
+    }
+
+    # most writes only append the changed volumes
+    if (!$keep_at_new_name && $self->_append_tapelist_changes(\@lines)) {
+	$fl->unlock();
+	$self->{'need_write_tapelist'} = 0;
+	$self->{'tapelist'}->reload() if $self->{'tapelist'};
+	return;
+    }
+
     my $date = Amanda::Util::generate_timestamp();
     my $new_tapelist_file = $self->{'tapelist_filename'} . "-new-" . $date;
     my $filename;
@@ -4567,20 +4750,8 @@ sub _write_tapelist {
     } while (!defined $r);
     $new_tapelist_file = $filename;
 
-    $sth = $self->make_statement('write_tapelist 1', 'SELECT write_timestamp, orig_write_timestamp, label, reuse, barcode, meta_label, block_size, pool_name, storage_name, config_name FROM volumes, metas, storages, pools, configs WHERE storages.config_id=configs.config_id AND volumes.storage_id=storages.storage_id AND volumes.pool_id=pools.pool_id AND volumes.meta_id=metas.meta_id ORDER BY write_timestamp DESC, label DESC');
-    $sth->execute()
-	or die "Cannot execute: " . $sth->errstr();
-    while (my $row_volume = $sth->fetchrow_arrayref ) {
-	my $datestamp = $row_volume->[1];
-	my $label = $row_volume->[2];
-	my $reuse = $row_volume->[3] ? 'reuse' : 'no-reuse';
-	my $barcode   = ((defined $row_volume->[4])? (" BARCODE:"   . $row_volume->[4]) : '');
-	my $meta      = ((        $row_volume->[5])? (" META:"      . $row_volume->[5]) : '');
-	my $blocksize = ((defined $row_volume->[6])? (" BLOCKSIZE:" . $row_volume->[6]) : '');
-	my $pool      = ((        $row_volume->[7])? (" POOL:"      . $row_volume->[7]) : '');
-	my $storage   = ((        $row_volume->[8])? (" STORAGE:"   . $row_volume->[8]) : '');
-	my $config    = ((        $row_volume->[9])? (" CONFIG:"    . $row_volume->[9]) : '');
-	$result &&= print $fhn "$datestamp $label $reuse$barcode$meta$blocksize$pool$storage$config\n";
+    for my $line (@lines) {
+	$result &&= print $fhn $line->[1];
     }
     my $result_close = close($fhn);
     $result &&= $result_close;
@@ -4592,6 +4763,7 @@ sub _write_tapelist {
             die ("failed to rename '$new_tapelist_file' to '$self->{'tapelist_filename'}': $!");
 	}
 	symlink ("$$", $self->{'tapelist_last_write'});
+	$self->_start_tapelist_changes(\@lines);
     }
     $fl->unlock();
     if (!defined $keep_at_new_name || !$keep_at_new_name) {
@@ -4600,6 +4772,152 @@ sub _write_tapelist {
     }
 }
 
+# The tapelist is a snapshot followed by a log of the volumes changed since,
+# in "$tapelist.changes": one tapelist line or "DELETE label [POOL:pool]"
+# record for each change.  The log starts with the inode and size of the
+# snapshot it extends, so it is ignored if anything else rewrites the
+# tapelist, and it is folded into a new snapshot once it holds more records
+# than a quarter of the volumes.  Both are only written under the tapelist
+# lock; $self->{'tapelist_state'} is what they hold, as of our last write.
+
+sub _tapelist_state_key {
+    my ($line) = @_;
+
+    my ($label) = $line =~ /^\S+ (\S+)/;
+    my ($pool) = $line =~ / POOL:(\S+)/;
+    return undef if !defined $label;
+    return (defined $pool ? $pool : '') . "\t" . $label;
+}
+
+sub _tapelist_ident {
+    my $self = shift;
+
+    my @st = stat($self->{'tapelist_filename'});
+    return undef if !@st;
+    return "$st[1] $st[7]";
+}
+
+# read the snapshot and its changes log into a new tapelist_state, or the
+# records appended by other processes into the current one
+sub _load_tapelist_state {
+    my $self = shift;
+    my $state = $self->{'tapelist_state'};
+
+    my $ident = $self->_tapelist_ident();
+    return undef if !defined $ident;
+    if (!$state || $state->{'ident'} ne $ident) {
+	$state = { ident => $ident, offset => undef, nb_changes => 0,
+		   lines => {} };
+	open(my $fh, "<", $self->{'tapelist_filename'}) or return undef;
+	while (my $line = <$fh>) {
+	    my $key = _tapelist_state_key($line);
+	    $state->{'lines'}{$key} = $line if defined $key;
+	}
+	close($fh);
+    }
+
+    open(my $fh, "<", $self->{'tapelist_filename'} . ".changes") or return undef;
+    my $header = <$fh>;
+    if (!defined $header || $header ne "TAPELIST $ident\n") {
+	close($fh);
+	return undef;
+    }
+    seek($fh, $state->{'offset'}, 0) if defined $state->{'offset'};
+    my $offset = tell($fh);
+    while (my $rec = <$fh>) {
+	last if $rec !~ /\n$/;
+	$offset += length($rec);
+	$state->{'nb_changes'}++;
+	if ($rec =~ /^DELETE (\S+)(?: POOL:(\S+))?$/) {
+	    delete $state->{'lines'}{(defined $2 ? $2 : '') . "\t" . $1};
+	} else {
+	    my $key = _tapelist_state_key($rec);
+	    $state->{'lines'}{$key} = $rec if defined $key;
+	}
+    }
+    close($fh);
+    $state->{'offset'} = $offset;
+    $self->{'tapelist_state'} = $state;
+    return $state;
+}
+
+# append the difference between the tapelist and @$lines to the changes
+# log; return false if the tapelist must be rewritten instead
+sub _append_tapelist_changes {
+    my $self = shift;
+    my $lines = shift;
+
+    my $state = $self->_load_tapelist_state();
+    if (!$state) {
+	$self->{'tapelist_state'} = undef;
+	return 0;
+    }
+
+    my %new_lines;
+    my $records = '';
+    my $nb_records = 0;
+    for my $line (@$lines) {
+	my ($key, $text) = @$line;
+	$new_lines{$key} = $text;
+	my $old = $state->{'lines'}{$key};
+	next if defined $old && $old eq $text;
+	$records .= $text;
+	$nb_records++;
+    }
+    for my $key (keys %{$state->{'lines'}}) {
+	next if exists $new_lines{$key};
+	my ($pool, $label) = split /\t/, $key, 2;
+	$records .= "DELETE $label" . ($pool ne '' ? " POOL:$pool" : '') . "\n";
+	$nb_records++;
+    }
+    return 1 if $nb_records == 0;
+    return 0 if $state->{'nb_changes'} + $nb_records > 256 + @$lines / 4;
+
+    my $changes = $self->{'tapelist_filename'} . ".changes";
+    my $fh;
+    if (!open($fh, ">>", $changes) ||
+	!print($fh $records) ||
+	!close($fh)) {
+	debug("Could not append to '$changes': $!");
+	return 0;
+    }
+    $state->{'lines'} = \%new_lines;
+    $state->{'offset'} += length($records);
+    $state->{'nb_changes'} += $nb_records;
+
+    unlink($self->{'tapelist_last_write'});
+    symlink ("$$", $self->{'tapelist_last_write'});
+    return 1;
+}
+
+# start an empty changes log for the tapelist just written
+sub _start_tapelist_changes {
+    my $self = shift;
+    my $lines = shift;
+
+    $self->{'tapelist_state'} = undef;
+    my $ident = $self->_tapelist_ident();
+    return if !defined $ident;
+
+    my $changes = $self->{'tapelist_filename'} . ".changes";
+    my $header = "TAPELIST $ident\n";
+    my $fh;
+    if (!open($fh, ">", "$changes.new") ||
+	!print($fh $header) ||
+	!close($fh) ||
+	!move("$changes.new", $changes)) {
+	debug("Could not write '$changes': $!");
+	unlink("$changes.new");
+	return;
+    }
+    $self->{'tapelist_state'} = {
+	ident => $ident,
+	offset => length($header),
+	nb_changes => 0,
+	lines => { map { $_->[0] => $_->[1] } @$lines },
+    };
+}
+
 sub write_tapelist {
     my $self = shift;
 
@@ -4936,8 +5254,7 @@ sub new {
 	my $sth;
 
 	# get/add the storage */
-	$sth = $dbh->prepare("SELECT disk_id, dump_timestamp, level, dump_status FROM images WHERE image_id=?")
-	    or die "Cannot prepare: " . $dbh->errstr();
+	$sth = $catalog->make_statement('image:sel ima', 'SELECT disk_id, dump_timestamp, level, dump_status FROM images WHERE image_id=?');
 	$sth->execute($image_id)
 	    or die "Cannot execute: " . $sth->errstr();
 	# get the first row
@@ -5109,6 +5426,7 @@ sub new {
 	copy_id => $copy_id,
 	copy_status => $copy_status,
 	copy_pid => $copy_pid,
+	pending_parts => [],
     }, $class;
 
     return $self;
@@ -5121,8 +5439,7 @@ sub _find_a_part {
     my $dbh = $catalog->{'dbh'};
     my $sth;
 
-    $sth = $dbh->prepare("SELECT part_id FROM parts WHERE copy_id=? LIMIT 1")
-	or die "Cannot prepare: " . $dbh->errstr();
+    $sth = $catalog->make_statement('_find_a_part:sel par', 'SELECT part_id FROM parts WHERE copy_id=? LIMIT 1');
     $sth->execute($copy_id)
 	or die "Cannot execute: " . $sth->errstr();
     return 1 if $sth->fetchrow_arrayref;
@@ -5147,24 +5464,25 @@ sub _add_part {
     my $part_num    = shift;
     my $part_status = shift;
     my $part_message= shift;
+    my $part_digest = shift;
 
     my $catalog = $self->{'catalog'};
     my $copy_id = $self->{'copy_id'};
     my $volume_id = $volume->{'volume_id'};
     my $dbh = $catalog->{'dbh'};
     my $sth;
-    $sth = $catalog->make_statement('in par', 'INSERT INTO parts(copy_id,volume_id,part_offset,part_size,filenum,part_num,part_status,part_message) VALUES (?, ?, ?, ?, ?, ?, ?, ?)');
-    $sth->execute($copy_id, $volume_id, $part_offset, $part_size, $filenum, $part_num, $part_status, $part_message)
+    $sth = $catalog->make_statement('in par dig', 'INSERT INTO parts(copy_id,volume_id,part_offset,part_size,filenum,part_num,part_status,part_message,digest) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)');
+    $sth->execute($copy_id, $volume_id, $part_offset, $part_size, $filenum, $part_num, $part_status, $part_message, $part_digest)
 	or die "Cannot execute: " . $sth->errstr();
 }
 
+# The parts are only queued, and written with the copy by finish_copy, so
+# that the taper does a single transaction per copy.
 sub add_part  {
     my $self = shift;
-    my $catalog = $self->{'catalog'};
 
-    return $catalog->run_execute($self, $self->can('_add_part'),
-			undef,
-			['parts'], @_);
+    push @{$self->{'pending_parts'}}, [ @_ ];
+    return undef;
 }
 
 sub _finish_copy {
@@ -5175,22 +5493,26 @@ sub _finish_copy {
     my $copy_status = shift;
     my $server_crc  = shift;
     my $copy_message= shift;
+    my $digest      = shift;
 
     my $catalog = $self->{'catalog'};
     my $copy_id = $self->{'copy_id'};
     my $dbh = $catalog->{'dbh'};
     my $sth;
 
+    # the parts queued by add_part
+    foreach my $part (@{$self->{'pending_parts'}}) {
+	$self->_add_part(@$part);
+    }
+
     $kb = int($kb);
     $bytes = int($bytes);
-    $sth = $dbh->prepare("UPDATE copys SET nb_parts=?, kb=?, bytes=?, copy_status=?, server_crc=?, copy_message=?, copy_pid=0 WHERE copy_id=?")
-	or die "Cannot prepare: " . $dbh->errstr();
-    $sth->execute($nb_parts, $kb, $bytes, $copy_status, $server_crc, $copy_message, $copy_id)
+    $sth = $catalog->make_statement('_finish_copy:up cop dig', 'UPDATE copys SET nb_parts=?, kb=?, bytes=?, copy_status=?, server_crc=?, copy_message=?, digest=?, copy_pid=0 WHERE copy_id=?');
+    $sth->execute($nb_parts, $kb, $bytes, $copy_status, $server_crc, $copy_message, $digest, $copy_id)
 	or die "Cannot execute: " . $sth->errstr();
 
     if ($copy_status ne "OK") {
-	$sth = $dbh->prepare("UPDATE copys SET retention_days=0, retention_full=0, retention_recover=0 WHERE copy_id=?")
-	    or die "Cannot prepare: " . $dbh->errstr();
+	$sth = $catalog->make_statement('_finish_copy:up cop ret', 'UPDATE copys SET retention_days=0, retention_full=0, retention_recover=0 WHERE copy_id=?');
 	$sth->execute($copy_id)
 	    or die "Cannot execute: " . $sth->errstr();
     }
@@ -5200,9 +5522,11 @@ sub finish_copy  {
     my $self = shift;
     my $catalog = $self->{'catalog'};
 
-    return $catalog->run_execute($self, $self->can('_finish_copy'),
+    my $result = $catalog->run_execute($self, $self->can('_finish_copy'),
 			undef,
-			['copys'], @_);
+			['parts', 'copys'], @_);
+    $self->{'pending_parts'} = [];
+    return $result;
 }
 
 package Amanda::DB::Catalog2::SQL::cmd;
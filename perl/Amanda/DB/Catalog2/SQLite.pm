@@ -41,7 +41,7 @@ use Amanda::Debug qw ( :logging );
 use Amanda::Holding;
 use Amanda::Header;
 
-my $SQLITE_DB_VERSION = 5;
+my $SQLITE_DB_VERSION = 6;
 
 my $have_usleep = eval { require Time::HiRes ; 1 };
 
@@ -92,10 +92,19 @@ sub new {
     $foreign_key = "FOREIGN KEY";
     $foreign_key = $properties->{'autoincrement'}->{'values'}[0] if exists $properties->{'autoincrement'};
     $connect = "DBI:$plugin";
+    my $journal_mode = Amanda::DB::Catalog2::SQL::catalog_property(
+					$properties, 'journal_mode');
+    $journal_mode = defined $journal_mode ? uc($journal_mode) : "TRUNCATE";
+    if ($journal_mode !~ /^(DELETE|TRUNCATE|PERSIST|WAL)$/) {
+	die("Invalid journal_mode '$journal_mode'");
+    }
     while (my ($key, $values) = each %{$properties}) {
+	(my $norm = lc($key)) =~ s/-/_/g;
 	if ($key ne 'username' &&
 	    $key ne 'password' &&
-	    $key ne 'autoincrement') {
+	    $key ne 'autoincrement' &&
+	    $norm ne 'journal_mode' &&
+	    $norm ne 'slow_query_time') {
 	    my $value = $values->{'values'}[0];
 	    $connect .= ":$key=$value";
 	}
@@ -108,7 +117,8 @@ sub new {
 	or die "Cannot prepare: " . $dbh->errstr();
     $sth->execute() or die "Cannot execute: " . $sth->errstr();
 
-    $sth = $dbh->prepare("PRAGMA journal_mode = TRUNCATE")
+    # WAL lets the readers run while the taper or the driver writes
+    $sth = $dbh->prepare("PRAGMA journal_mode = $journal_mode")
 	or die "Cannot prepare: " . $dbh->errstr();
     $sth->execute() or die "Cannot execute: " . $sth->errstr();
 
@@ -134,6 +144,7 @@ sub new {
 	subquery_same_table => 1,
 	temporary      => '',
 	drop_temporary => '',
+	explain        => 'EXPLAIN QUERY PLAN',
     }, $class;
 
     return $self;
@@ -150,11 +161,28 @@ sub run_execute {
     my $stop_loop = 0;
     my $result;
 
+    # Everything but a read is done in one transaction, instead of one per
+    # statement.  A nested run_execute is part of the outer transaction and
+    # the outer one retries.
+    my $transaction = !$self->{'in_transaction'} &&
+		      (!defined $read_lock || defined $write_lock);
+
     do {
 	eval {
-	    $result = $fn->($obj, @_);
+	    if ($transaction) {
+		$dbh->begin_work;
+		$self->{'in_transaction'} = 1;
+	    }
+	    $result = $self->_timed_call($fn, $obj, @_);
+	    $dbh->commit if $transaction;
 	};
 	my $error = $@;
+	if ($transaction) {
+	    $self->{'in_transaction'} = 0;
+	    if ($error) {
+		eval { $dbh->rollback; };
+	    }
+	}
         my $mysql_errno = $dbh->{'mysql_errno'};
         my $mysql_error = $dbh->{'mysql_error'};
         my $errstr = $dbh->errstr;
@@ -165,9 +193,10 @@ sub run_execute {
 	    debug("mysql_error: $mysql_error") if defined $mysql_error;
 	    debug("errstr: $errstr") if defined $errstr;
 
-	    if ($errstr !~ /database is locked/ &&
-		$errstr !~ /database schema has changed/ &&
-		$errstr !~ /UNIQUE constraint failed/) {
+	    if ($self->{'in_transaction'} ||
+		($errstr !~ /database is locked/ &&
+		 $errstr !~ /database schema has changed/ &&
+		 $errstr !~ /UNIQUE constraint failed/)) {
 		die($error);
 	    }
 	    sleep 1;
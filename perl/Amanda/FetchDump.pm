@@ -136,6 +136,7 @@ sub run {
 		'leave'                 => $params{'leave'},
 		'no-reassembly'         => $params{'no-reassembly'},
 		'pipe-fd'               => $params{'pipe-fd'} ? 1 : undef,
+		'parallel'              => $params{'parallel'},
 		'restore'               => $params{'restore'},
 		'server-decompress'     => $params{'server-decompress'},
 		'server-decrypt'        => $params{'server-decrypt'},
@@ -146,16 +147,40 @@ sub run {
 		'feedback'              => $self);
 }
 
+# a copy of the feedback for one of the plans restored at the same time; the
+# state of the dump is set in each copy, and the messages are tagged with the
+# stream number
+sub new_stream {
+    my $self = shift;
+    my ($stream) = @_;
+
+    $self->{'streams'} ||= { sizes => {}, last_is_size => 0 };
+    my $new = bless { %$self }, ref $self;
+    $new->{'stream'} = $stream;
+    return $new;
+}
+
 sub set_feedback {
     my $self = shift;
     my %params = @_;
 
     $self->{'chg'} = $params{'chg'} if exists $params{'chg'};
     $self->{'dev_name'} = $params{'dev_name'} if exists $params{'dev_name'};
+    $self->{'plan'} = $params{'plan'} if exists $params{'plan'};
 
     return $self;
 }
 
+sub recovery_clerk_notif_open_volume {
+    my $self = shift;
+    my %params = @_;
+
+    # the dumps still to read from this volume, in the order its device
+    # recommends
+    $self->{'plan'}->order_volume(%params)
+	if defined $self->{'plan'} and defined $params{'device'};
+}
+
 sub clerk_notif_part {
     my $self = shift;
     my ($label, $filenum, $header) = @_;
@@ -230,6 +255,10 @@ sub user_message {
     my $self = shift;
     my $message = shift;
 
+    if (defined $self->{'stream'}) {
+	return $self->stream_message($message);
+    }
+
     if ($message->{'code'} == 4900000) { #SIZE
 	if ($self->{'is_tty'}) {
 	    print STDERR "\r$message    ";
@@ -254,4 +283,29 @@ sub user_message {
     }
 }
 
+# the sizes of all streams are on one line on a tty
+sub stream_message {
+    my $self = shift;
+    my $message = shift;
+    my $stream = $self->{'stream'};
+    my $streams = $self->{'streams'};
+    my $sizes = $streams->{'sizes'};
+
+    if ($message->{'code'} == 4900000) { #SIZE
+	if ($self->{'is_tty'}) {
+	    $sizes->{$stream} = "$message";
+	    print STDERR "\r" . join("  ", map { "[$_] $sizes->{$_}" }
+					  sort { $a <=> $b } keys %$sizes) . "    ";
+	    $streams->{'last_is_size'} = 1;
+	} else {
+	    print STDERR "READ SIZE: [$stream] $message\n";
+	}
+    } else {
+	delete $sizes->{$stream} if $message->{'code'} == 4900012; #READ SIZE
+	print STDERR "\n" if $self->{'is_tty'} and $streams->{'last_is_size'};
+	print STDERR "[$stream] $message\n";
+	$streams->{'last_is_size'} = 0;
+    }
+}
+
 1;
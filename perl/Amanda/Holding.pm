@@ -262,7 +262,8 @@ sub _walk {
 	    }
 
 	    while (defined(my $dirent = $dirh->read)) {
-		next if $dirent eq '.' or $dirent eq '..' or $dirent eq 'pid';
+		next if $dirent eq '.' or $dirent eq '..' or $dirent eq 'pid'
+		     or $dirent eq 'manifest';
 
 		my $filename = File::Spec->catfile($disk, $datestr, $dirent);
 		if (!-f $filename) {
@@ -503,6 +504,15 @@ sub dir_unlink {
 	    my $dirfn = File::Spec->catfile($disk, $datestr);
 	    next unless _is_datestr($datestr);
 	    next unless -d $dirfn;
+	    # the manifest kept by holding.c does not keep a directory alive
+	    my $manifest = File::Spec->catfile($dirfn, "manifest");
+	    if (-f $manifest) {
+		my $dirh = IO::Dir->new($dirfn);
+		next unless defined $dirh;
+		my @entries = grep { $_ ne '.' and $_ ne '..' } $dirh->read();
+		$dirh->close();
+		unlink($manifest) if @entries == 1;
+	    }
 	    rmdir $dirfn;
 	}
     }
@@ -188,6 +188,11 @@ the holding filename and its header.  Note that C<clerk_notif_holding> is called
 before the C<xfer_src_cb>, since data will begin flowing from a holding disk
 immediately when the transfer is started.
 
+The C<recovery_clerk_notif_open_volume> method is called with the C<label> and
+the C<device> of each volume the Clerk opens, before it seeks to the first
+file, and C<recovery_clerk_notif_close_volume> with the C<label> when it is
+done with it.
+
 A typical Clerk feedback class might look like:
 
     use 'Amanda::Recovery::Clerk';
@@ -312,6 +317,17 @@ sub start_recovery {
     $self->do_recovery(@_);
 }
 
+# the dump located by get_xfer_src was read by other means than the xfer
+# source (Amanda::Vault copies it with the device): forget the transfer, and
+# the position of the device, which was moved
+sub abandon_xfer_src {
+    my $self = shift;
+
+    $self->{'xfer_state'}->{'done'} = 1 if $self->{'xfer_state'};
+    $self->{'on_vol_hdr'} = undef;
+    $self->{'current_part'} = undef;
+}
+
 sub handle_xmsg {
     my $self = shift;
     my ($src, $msg, $xfer) = @_;
@@ -605,7 +621,9 @@ sub _maybe_start_part {
 		$self->{'current_label'} = $dev->volume_label;
 
 		# success!
-		$self->{'feedback'}->recovery_clerk_notif_open_volume(label => $dev->volume_label);
+		$self->{'feedback'}->recovery_clerk_notif_open_volume(
+			label => $dev->volume_label,
+			device => $dev);
 		return $steps->{'seek_and_check'}->();
 	    }
 	}
@@ -688,6 +706,13 @@ sub _maybe_start_part {
 	$self->dbg("reading file $next_filenum on '$next_label'");
 	$xfer_state->{'xfer_src'}->start_part($self->{'current_dev'});
 
+	# let the device locate the following part while this one is read
+	my $following = $xfer_state->{'dump'}{'parts'}[$xfer_state->{'next_part_idx'}+1];
+	if ($following && defined $following->{'label'} &&
+	    $following->{'label'} eq $next_label) {
+	    $self->{'current_dev'}->prefetch_file($following->{'filenum'});
+	}
+
 	$finished_cb->();
     };
 
@@ -168,6 +168,27 @@ Similarly, to get a list of holding files that the plan requires, in order, use
 C<get_holding_file_list>.  Each file is represented as a string giving the
 fully qualified pathname.
 
+A plan can be split into plans that can be performed at the same time, each
+through its own device:
+
+    my @plans = $plan->split_plan($count);
+    my @plans = $plan->split_plan($count, by_dle => 1);
+
+The dumps that use a common volume stay in the same plan, in their order, and
+the dumps are balanced by size between at most C<$count> plans.  The plans are
+returned in the order of their first dump.  With C<by_dle>, all the dumps of a
+DLE also stay in the same plan, so that its incrementals are applied after its
+full dump when the plans are extracted at the same time.
+
+When the dumps need not be recovered in order, the remaining dumps read only
+from a volume can be put in the order the device recommends, once it is open:
+
+    $plan->order_volume(label => $label, device => $dev);
+
+The files are placed on the volume from the sizes of its parts in the catalog,
+so nothing is read; the order is left unchanged if the device has no
+recommendation (see C<recommended_order> in L<Amanda::Device>).
+
 =cut
 
 package Amanda::Recovery::Planner;
@@ -206,6 +227,7 @@ use strict;
 use warnings;
 use Data::Dumper;
 use Carp;
+use POSIX ();
 
 use Amanda::Device qw( :constants );
 use Amanda::Holding;
@@ -696,6 +718,125 @@ sub get_volume_list {
     return @volumes;
 }
 
+sub split_plan {
+    my $self = shift;
+    my ($count, %params) = @_;
+
+    # group the dumps that share a volume, or a DLE with by_dle; a group is
+    # { dumps => [ index, .. ], labels => [ key, .. ], kb => size }
+    my %group_of_label;
+    my @groups;
+    my $dumps = $self->{'dumps'};
+    for my $i (0 .. $#$dumps) {
+	my $dump = $dumps->[$i];
+	my $group = { dumps => [ $i ], labels => [], kb => $dump->{'kb'} || 0 };
+	my @keys;
+	for my $part (@{$dump->{'parts'}}) {
+	    next unless defined $part; # skip parts[0]
+	    next unless defined $part->{'label'}; # skip holding parts
+	    push @keys, "label:$part->{'label'}";
+	}
+	push @keys, "dle:$dump->{'hostname'}:$dump->{'diskname'}"
+	    if $params{'by_dle'};
+	for my $label (@keys) {
+	    my $other = $group_of_label{$label};
+	    if (!defined $other) {
+		push @{$group->{'labels'}}, $label;
+		$group_of_label{$label} = $group;
+	    } elsif ($other != $group) {
+		# merge the older group in this one
+		push @{$group->{'dumps'}}, @{$other->{'dumps'}};
+		push @{$group->{'labels'}}, @{$other->{'labels'}};
+		$group->{'kb'} += $other->{'kb'};
+		$group_of_label{$_} = $group for @{$other->{'labels'}};
+		$other->{'merged'} = 1;
+	    }
+	}
+	push @groups, $group;
+    }
+    @groups = grep { !$_->{'merged'} } @groups;
+
+    # the largest groups first, each one to the plan with the least to read
+    my @bins = map { { dumps => [], kb => 0 } } 1 .. (($count > @groups) ? scalar @groups : $count);
+    for my $group (sort { $b->{'kb'} <=> $a->{'kb'} } @groups) {
+	my ($bin) = sort { $a->{'kb'} <=> $b->{'kb'} } @bins;
+	push @{$bin->{'dumps'}}, @{$group->{'dumps'}};
+	$bin->{'kb'} += $group->{'kb'};
+    }
+
+    my @plans;
+    for my $bin (sort { $a->{'dumps'}[0] <=> $b->{'dumps'}[0] }
+		 map { $_->{'dumps'} = [ sort { $a <=> $b } @{$_->{'dumps'}} ]; $_ }
+		 grep { @{$_->{'dumps'}} } @bins) {
+	my $plan = Amanda::Recovery::Planner::Plan->new({
+	    %$self,
+	    dumps => [ map { $dumps->[$_] } @{$bin->{'dumps'}} ],
+	});
+	$plan->dbg("split plan: " . scalar(@{$plan->{'dumps'}}) . " dumps, " .
+		   $bin->{'kb'} . " KB");
+	push @plans, $plan;
+    }
+
+    return @plans;
+}
+
+sub order_volume {
+    my $self = shift;
+    my %params = @_;
+    my $label = $params{'label'};
+    my $dev = $params{'device'};
+    my $dumps = $self->{'dumps'};
+
+    # the remaining dumps read only from this volume
+    my @slots;
+    for my $i (0 .. $#$dumps) {
+	my @parts = grep { defined } @{$dumps->[$i]{'parts'}};
+	next if !@parts;
+	next if grep { !defined $_->{'label'} or $_->{'label'} ne $label } @parts;
+	push @slots, $i;
+    }
+    return if @slots < 2;
+
+    # place each file on the volume: after the label and its filemark, a
+    # header block, its data blocks and its filemark
+    my %kb;
+    my $volume_dumps = $self->{'catalog'}->get_dumps(labels => [ $label ],
+						     parts => 1);
+    for my $dump (@$volume_dumps) {
+	for my $part (@{$dump->{'parts'}}) {
+	    next unless defined $part and defined $part->{'label'};
+	    next unless $part->{'label'} eq $label;
+	    $kb{$part->{'filenum'}} = $part->{'kb'} || 0;
+	}
+    }
+    my $block_kb = ($dev->block_size || 32768) / 1024;
+    my ($last_filenum) = sort { $b <=> $a } keys %kb;
+    my %extent;
+    my $object = 2;
+    for my $filenum (1 .. ($last_filenum || 0)) {
+	my $objects = 2 + POSIX::ceil(($kb{$filenum} || 0) / $block_kb);
+	$extent{$filenum} = [ $object, $object + $objects - 1 ];
+	$object += $objects;
+    }
+
+    # a dump is asked for by its first file, spanning all of its parts
+    my %dump_of;
+    my @extents;
+    for my $i (@slots) {
+	my @parts = grep { defined } @{$dumps->[$i]{'parts'}};
+	my $first = $parts[0]{'filenum'};
+	my $last = $parts[-1]{'filenum'};
+	return unless $extent{$first} and $extent{$last};
+	$dump_of{$first} = $dumps->[$i];
+	push @extents, [ $first, $extent{$first}[0], $extent{$last}[1] ];
+    }
+
+    my @order = $dev->recommended_order(\@extents);
+    return if @order != @slots;
+    @$dumps[@slots] = map { $dump_of{$_} } @order;
+    $self->dbg("recommended order on $label: files @order");
+}
+
 sub get_holding_file_list {
     my $self = shift;
     my @hfiles;
@@ -81,6 +81,15 @@ logfile, then C<$historical> should be false.  Non-historical reports may draw
 information from the current Amanda environment, e.g., holding disks and info
 files.
 
+  my $report = Amanda::Report->new($logfile, $historical,
+				   summary_parts => 1);
+
+With C<summary_parts>, consecutive taper parts written to the same volume are
+folded into a single entry of the C<parts> list (see L</Parts>), so that the
+memory used for a run with many split dumps does not grow with the number of
+parts.  This is sufficient for every output except those that list each part
+individually, like the xml output.
+
 =head2 Summary Information
 
 Note that most of the data provided by these methods is simply a reference to
@@ -436,6 +445,12 @@ the speed at which the part was written.
 
 =back
 
+When the report was created with C<summary_parts>, an item stands for all the
+consecutive parts written to one volume: C<file>, C<date> and C<partnum> are
+those of the first of them, C<sec> and C<kb> are their sums, C<kps> is
+recomputed from these, and C<nparts> counts them.  The taper hash then also has
+an C<nparts> field, the total number of parts of the dump.
+
 =cut
 
 use constant STATUS_ERROR   => 1;
@@ -447,7 +462,7 @@ use constant STATUS_TAPE    => 16;
 sub new
 {
     my $class = shift @_;
-    my ($logfname, $historical) = @_;
+    my ($logfname, $historical, %params) = @_;
 
     debug("Amanda::Report::new logfname: $logfname");
     my $self = {
@@ -456,6 +471,7 @@ sub new
 	## inputs
 	_logfname => $logfname,
 	_historical => $historical,
+	_summary_parts => $params{'summary_parts'},
 
 	## logfile-parsing state
 
@@ -499,9 +515,12 @@ sub read_file
     $self->{flags}{dump_strange} = 0;
     $self->{flags}{status} = "running";
 
-    while ( my ( $type, $prog, $str ) = Amanda::Logfile::get_logline($logfh) ) {
-        $self->read_line( $type, $prog, $str );
+    while ( my ( $type, $prog, $str, $words ) =
+		Amanda::Logfile::get_logline_split($logfh) ) {
+        $self->read_line( $type, $prog, $str, $words );
     }
+    delete $self->{line_str};
+    delete $self->{line_words};
     if (defined $self->get_program_info("checkdump")) {
 	return Amanda::Report::Message->new(
 		source_filename => __FILE__,
@@ -630,7 +649,10 @@ sub cleanup
 sub read_line
 {
     my $self = shift @_;
-    my ( $type, $prog, $str ) = @_;
+    my ( $type, $prog, $str, $words ) = @_;
+
+    $self->{line_str} = $str;
+    $self->{line_words} = $words;
 
     if ( $type == $L_CONT ) {
 	${$self->{nbline_ref}}++;
@@ -699,6 +721,18 @@ sub read_line
     }
 }
 
+# split a line given to a handler; the line being read was already split in
+# C by get_logline_split
+sub _split_line
+{
+    my $self = shift @_;
+    my ( $str ) = @_;
+
+    my $words = $self->{line_words};
+    return @$words if defined $words && $str eq $self->{line_str};
+    return Amanda::Util::split_quoted_strings($str);
+}
+
 sub get_exit_status
 {
     my $self = shift;
@@ -818,7 +852,7 @@ sub _handle_planner_line
 
     } elsif ( $type == $L_FINISH ) {
 
-        my @info = Amanda::Util::split_quoted_strings($str);
+        my @info = $self->_split_line($str);
         return $planner->{time} = $info[3];
 
     } elsif ( $type == $L_DISK ) {
@@ -862,20 +896,20 @@ sub _handle_driver_line
 
     } elsif ( $type == $L_FINISH ) {
 
-        my @info = Amanda::Util::split_quoted_strings($str);
+        my @info = $self->_split_line($str);
         $self->{flags}{got_finish} = 1;
         return $driver_p->{time} = $info[3];
 
     } elsif ( $type == $L_STATS ) {
 
-        my @info = Amanda::Util::split_quoted_strings($str);
+        my @info = $self->_split_line($str);
         if ( $info[0] eq "hostname" ) {
 
             return $self->{hostname} = $info[1];
 
         } elsif ( $info[0] eq "startup" ) {
 
-            my @info = Amanda::Util::split_quoted_strings($str);
+            my @info = $self->_split_line($str);
             return $driver_p->{start_time} = $info[2];
 
         } elsif ( $info[0] eq "estimate" ) {
@@ -939,11 +973,25 @@ sub _handle_dumper_line
     my $dumper_p = $programs->{dumper} ||= {};
 
     if ( $type == $L_INFO ) {
+	if ( $str =~ m/^network / ) {
+	    # network <host> <disk> <timestamp> <level> [rtt 1.234 retrans 0 ...]
+	    my @info = $self->_split_line($str);
+	    my ( $hostname, $disk, $timestamp, $level ) = @info[ 1 .. 4 ];
+	    my @stats = @info[ 5 .. $#info ];
+	    $stats[0] =~ s{^\[}{};
+	    $stats[-1] =~ s{\]$}{};
+
+	    my $dle    = $self->_get_disklist($hostname, $disk);
+	    my $try    = $self->_get_try( $dle, "dumper", $timestamp );
+	    my $dumper = $try->{dumper} ||= {};
+	    $dumper->{network} = { @stats };
+	    return;
+	}
         return $self->_handle_info_line( "dumper", $str );
 
     } elsif ( $type == $L_STRANGE ) {
 
-        my @info = Amanda::Util::split_quoted_strings($str);
+        my @info = $self->_split_line($str);
         my ( $hostname, $disk, $level ) = @info[ 0 .. 2 ];
 	my $x;
 	if ($info[3] eq '[sec') {
@@ -980,7 +1028,7 @@ sub _handle_dumper_line
 
     } elsif ( $type == $L_SUCCESS ) {
 
-        my @info = Amanda::Util::split_quoted_strings($str);
+        my @info = $self->_split_line($str);
         my ( $hostname, $disk, $timestamp, $level ) = @info[ 0 .. 3 ];
 	my $x;
 	if ($info[4] eq '[sec') {
@@ -1008,7 +1056,7 @@ sub _handle_dumper_line
         return $dumper->{status} = "success";
 
     } elsif ( $type == $L_RETRY ) {
-        my @info = Amanda::Util::split_quoted_strings($str);
+        my @info = $self->_split_line($str);
         my ( $hostname, $disk, $timestamp, $level ) = @info[ 0 .. 3 ];
 
         my $dle    = $self->_get_disklist($hostname, $disk);
@@ -1050,7 +1098,7 @@ sub _handle_chunker_line
 
     } elsif ( $type == $L_SUCCESS || $type == $L_PARTIAL ) {
 
-        my @info = Amanda::Util::split_quoted_strings($str);
+        my @info = $self->_split_line($str);
         my ( $hostname, $disk, $timestamp, $level ) = @info[ 0 .. 3 ];
 	my $x;
 	if ($info[4] eq '[sec') {
@@ -1101,7 +1149,7 @@ sub _handle_taper_line
     if ( $type == $L_START ) {
         # format is:
         # START taper [ST:storage [POOL:pool]] datestamp <start> label <label> tape <tapenum>
-        my @info = Amanda::Util::split_quoted_strings($str);
+        my @info = $self->_split_line($str);
         my ($datestamp, $label, $tapenum, $storage, $pool);
 	$datestamp = $info[1];
 	if ($info[2] =~ /^ST:/) {
@@ -1136,7 +1184,7 @@ sub _handle_taper_line
 # [ST:<storage> [POOL:<pool>]] <label> <tapefile> <hostname> <disk> <timestamp> <currpart>/<predparts> <level> [sec <sec> kb <kb> kps <kps>]
 #
 # format for $L_PARTPARTIAL is the same as $L_PART, plus <err> at the end
-        my @info = Amanda::Util::split_quoted_strings($str);
+        my @info = $self->_split_line($str);
 	my $storage = $info[0];
 	if ($storage =~ /^ST:/) {
 	    $storage =~ s/^ST://g;
@@ -1166,6 +1214,28 @@ sub _handle_taper_line
         my $taper = $try->{taper} ||= {};
         my $parts = $taper->{parts} ||= [];
 
+	$taper->{orig_kb} = $orig_kb;
+
+        my $tape = $self->get_tape($label);
+	# count this as a filesystem if this is the first part
+        $tape->{dle}++ if $currpart == 1;
+        $tape->{kb}   += $kb;
+        $tape->{time} += $sec;
+        $tape->{files}++;
+
+	if ($self->{_summary_parts}) {
+	    $taper->{nparts}++;
+	    my $last = $parts->[-1];
+	    if (defined $last && $last->{label} eq $label &&
+		$last->{storage} eq $storage) {
+		$last->{sec} += $sec;
+		$last->{kb}  += $kb;
+		$last->{kps}  = $last->{sec} ? $last->{kb} / $last->{sec} : $kps;
+		$last->{nparts}++;
+		return;
+	    }
+	}
+
         my $part = {
             storage  => $storage,
             pool     => $pool,
@@ -1177,24 +1247,16 @@ sub _handle_taper_line
             kps      => $kps,
             partnum  => $currpart,
         };
-
-	$taper->{orig_kb} = $orig_kb;
+	$part->{nparts} = 1 if $self->{_summary_parts};
 
         push @$parts, $part;
 
-        my $tape = $self->get_tape($label);
-	# count this as a filesystem if this is the first part
-        $tape->{dle}++ if $currpart == 1;
-        $tape->{kb}   += $kb;
-        $tape->{time} += $sec;
-        $tape->{files}++;
-
     } elsif ( $type == $L_DONE || $type == $L_PARTIAL ) {
 
 # format is:
 # $type = DONE | PARTIAL
 # $type taper [ST:<storage> [POOL:<pool>]] <hostname> <disk> <timestamp> <part> <level> [native-crc client-crc server-crc] [sec <sec> kb <kb> kps <kps>]
-        my @info = Amanda::Util::split_quoted_strings($str);
+        my @info = $self->_split_line($str);
 	my $storage = $info[0];
 	if ($storage =~ /^ST:/) {
 	    $storage =~ s/^ST://g;
@@ -1261,7 +1323,7 @@ sub _handle_taper_line
 
         if ($str =~ m{^no-tape}) {
 
-	    my @info = Amanda::Util::split_quoted_strings($str);
+	    my @info = $self->_split_line($str);
 	    my $failure_from = $info[1];
 	    my $error = join " ", @info[ 2 .. $#info ];
 
@@ -1305,7 +1367,7 @@ sub _handle_amflush_line
         return $self->_handle_info_line( "amflush", $str );
 
     } elsif ( $type == $L_FINISH ) {
-        my @info = Amanda::Util::split_quoted_strings($str);
+        my @info = $self->_split_line($str);
         $self->{flags}{got_finish} = 1;
         return $amflush_p->{time} = $info[3];
 
@@ -1328,7 +1390,7 @@ sub _handle_amvault_line
 
     } elsif ( $type == $L_STATS ) {
 
-        my @info = Amanda::Util::split_quoted_strings($str);
+        my @info = $self->_split_line($str);
         if ( $info[0] eq "hostname" ) {
 
             return $self->{hostname} = $info[1];
@@ -1347,7 +1409,7 @@ sub _handle_amvault_line
         return $self->_handle_disk_line( "amvault", $str );
 
     } elsif ( $type == $L_FINISH ) {
-        my @info = Amanda::Util::split_quoted_strings($str);
+        my @info = $self->_split_line($str);
         $self->{flags}{got_finish} = 1;
         return $amvault_p->{time} = $info[3];
 
@@ -1480,12 +1542,12 @@ sub _handle_ambackupd_line
         $self->_handle_start_line("ambackupd", $str);
 
     } elsif ( $type == $L_FINISH ) {
-        my @info = Amanda::Util::split_quoted_strings($str);
+        my @info = $self->_split_line($str);
         $self->{flags}{got_finish} = 1;
         return $ambackupd->{time} = $info[3];
 
     } elsif ( $type == $L_STATS ) {
-        my @info = Amanda::Util::split_quoted_strings($str);
+        my @info = $self->_split_line($str);
         if ( $info[0] eq "hostname" ) {
             return $self->{hostname} = $info[1];
 	}
@@ -1506,7 +1568,7 @@ sub _handle_fail_line
 {
     my ($self, $program, $str) = @_;
 
-    my @info = Amanda::Util::split_quoted_strings($str);
+    my @info = $self->_split_line($str);
     my $VAULT = $info[0];
     if ($VAULT eq "VAULT") {
 	shift @info;
@@ -1622,7 +1684,7 @@ sub _handle_start_line
 
     my $program_p = $programs->{$program} ||= {};
 
-    my @info = Amanda::Util::split_quoted_strings($str);
+    my @info = $self->_split_line($str);
     my $timestamp = $info[1];
     $program_p->{start} = $info[1];
 
@@ -1665,7 +1727,7 @@ sub _handle_disk_line
     my $self = shift @_;
     my ($program, $str) = @_;
 
-    my @info = Amanda::Util::split_quoted_strings($str);
+    my @info = $self->_split_line($str);
     my ($hostname, $disk) = @info;
 
     $self->{dump_disk}->{$hostname}->{$disk} = 1;
@@ -1683,7 +1745,7 @@ sub _handle_success_line
     my $hosts    = $self->{cache}{hosts} ||= [];
     my $dles     = $self->{cache}{dles}  ||= [];
 
-    my @info = Amanda::Util::split_quoted_strings($str);
+    my @info = $self->_split_line($str);
     my ($hostname, $disk, $timestamp, $level, $stat1, $stat2) = @info;
 
     if ($stat1 =~ /skipped/) {
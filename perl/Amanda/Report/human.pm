@@ -283,15 +283,18 @@ sub calculate_stats
 		    && ( $try->{taper}{status} eq 'done'
 		      || $try->{taper}{status} eq 'partial')) {
 
+		    # with summary_parts, an entry of parts folds several parts
+		    my $nparts = exists $try->{taper}{nparts}
+			? $try->{taper}{nparts}
+			: $try->{taper}{parts} ? scalar @{ $try->{taper}{parts} } : 0;
+
 		    $stats->{tapesize}   += $try->{taper}{kb};
 		    $stats->{taper_time} += $try->{taper}{sec};
-		    $stats->{tapepart_count} += @{ $try->{taper}{parts} }
-			if $try->{taper}{parts};
+		    $stats->{tapepart_count} += $nparts;
 		    $stats->{tapedisk_count}++;
 
 		    $tapedisks->[ $try->{taper}{level} ]++;    #by level count
-		    $tapeparts->[$try->{taper}{level}] += @{ $try->{taper}{parts} }
-			if $try->{taper}{parts};
+		    $tapeparts->[$try->{taper}{level}] += $nparts;
 		}
 
 		# add those values to the stats
@@ -1065,6 +1068,19 @@ sub output_details
 		    }
 		}
 
+		#
+		# note lossy data connections
+		#
+		if (defined $try->{dumper}
+		    && defined $try->{dumper}->{network}
+		    && $try->{dumper}->{network}->{retrans}) {
+		    my $network = $try->{dumper}->{network};
+
+		    push @$notes,
+		      "retransmits: $hostname $qdisk lev $try->{dumper}->{level}",
+		      "                $network->{retrans} segments, rtt $network->{rtt} ms (max $network->{'rtt-max'} ms)";
+		}
+
 		# note: copied & modified from calculate_stats.
 		if (
 		    exists $try->{dumper}
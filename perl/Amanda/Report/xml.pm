@@ -146,13 +146,30 @@ sub make_dumper_xml
                 xml_nl(),
                 make_xml_elt("insize",  $dumper->{orig_kb} * 1024),
                 make_xml_elt("outsize", $dumper->{kb} * 1024),
-                make_xml_elt("time",    $dumper->{sec})
+                make_xml_elt("time",    $dumper->{sec}),
+                ( $dumper->{network} ? make_network_xml( $dumper->{network} ) : () )
             );
         },
         { "result" => $dumper->{status} }
     );
 }
 
+sub make_network_xml
+{
+    my ($network) = @_;
+    return make_xml_elt(
+        "network",
+        sub {
+            return join(
+                xml_nl(),
+                map { make_xml_elt( $_, $network->{$_} ) }
+                  grep { defined $network->{$_} }
+                  qw(rtt rtt-max rcv-rtt retrans kps rwnd-limited sndbuf-limited)
+            );
+        }
+    );
+}
+
 sub make_chunker_xml
 {
     my ($chunker) = @_;
@@ -0,0 +1,155 @@
+# Copyright (c) 2012 Zmanda, Inc.  All Rights Reserved.
+# Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+# for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+#
+# Contact information: Carbonite Inc., 756 N Pastoria Ave
+# Sunnyvale, CA 94085, or: http://www.zmanda.com
+
+package Amanda::Rest::Cache;
+use strict;
+use warnings;
+
+use Amanda::Config qw( :getconf config_dir_relative );
+use Amanda::Debug qw( debug );
+use Digest::MD5;
+use vars qw(@ISA);
+
+my $have_hires_stat = eval { require Time::HiRes; defined &Time::HiRes::stat };
+
+=head1 NAME
+
+Amanda::Rest::Cache -- conditional requests and pagination for the REST server
+
+=head1 SYNOPSIS
+
+    my $etag = Amanda::Rest::Cache::etag(
+			[ Amanda::Rest::Cache::catalog_files() ], %params);
+    return (304, [], $etag)
+	if Amanda::Rest::Cache::not_modified($etag, %params);
+
+    my ($page, $total) = Amanda::Rest::Cache::paginate($dumps, %params);
+
+=head1 DESCRIPTION
+
+The read-only endpoints derive their reply from a few files: the catalog, the
+trace log or the amdump log.  C<etag> computes an entity tag from the identity,
+size and modification time of these files, and from the query parameters, so
+that a client polling with C<If-None-Match> gets a C<304 Not Modified> without
+the server reading the catalog or parsing a log.
+
+=over
+
+=item catalog_files
+
+The files the catalog of the current configuration is kept in.  An empty list
+is returned for a catalog kept in a database server, whose changes cannot be
+seen from the filesystem; no entity tag is computed for these.
+
+=item etag(\@files, %params)
+
+The entity tag, or undef if C<@files> is empty.  The route handler passes the
+C<If-None-Match> header as the C<if_none_match> parameter, it is not part of
+the tag.
+
+=item not_modified($etag, %params)
+
+True if the C<if_none_match> parameter matches C<$etag>.
+
+=item paginate(\@list, %params)
+
+Return the slice of C<@list> selected by the C<offset> and C<limit> query
+parameters, and the length of the whole list.  The list is returned as is if
+neither is given.
+
+=back
+
+=cut
+
+sub catalog_files {
+    my $catalog_name = getconf($CNF_CATALOG);
+
+    if (!$catalog_name) {
+	# the log catalog: the tapelist and the trace logs
+	my $logdir = config_dir_relative(getconf($CNF_LOGDIR));
+	my $tapelist = config_dir_relative(getconf($CNF_TAPELIST));
+	return ($tapelist, $logdir, "$logdir/log");
+    }
+
+    my $catalog_conf = lookup_catalog($catalog_name);
+    return () if !$catalog_conf;
+    my $plugin = Amanda::Config::catalog_getconf($catalog_conf, $CATALOG_PLUGIN);
+    return () if !defined $plugin || $plugin ne 'SQLite';
+
+    my $properties = Amanda::Config::catalog_getconf($catalog_conf,
+						     $CATALOG_PROPERTY);
+    my $dbname = $properties->{'dbname'}->{'values'}[0];
+    return () if !defined $dbname;
+    return ($dbname, "$dbname-wal");
+}
+
+sub etag {
+    my $files = shift;
+    my %params = @_;
+
+    return undef if !@$files;
+
+    my @sig;
+    for my $file (@$files) {
+	my @st = $have_hires_stat ? Time::HiRes::stat($file) : stat($file);
+	push @sig, @st ? join(':', $file, @st[0, 1, 7, 9]) : "$file:-";
+    }
+    # the same files give a different reply for a different query
+    for my $key (sort keys %params) {
+	next if $key eq 'if_none_match';
+	next if !defined $params{$key} || ref $params{$key};
+	push @sig, "$key=$params{$key}";
+    }
+
+    return '"' . Digest::MD5::md5_hex(join("\0", @sig)) . '"';
+}
+
+sub not_modified {
+    my $etag = shift;
+    my %params = @_;
+
+    return 0 if !defined $etag || !defined $params{'if_none_match'};
+    for my $tag (split /\s*,\s*/, $params{'if_none_match'}) {
+	$tag =~ s/^W\///;
+	return 1 if $tag eq $etag || $tag eq '*';
+    }
+    return 0;
+}
+
+sub paginate {
+    my $list = shift;
+    my %params = @_;
+
+    my $total = @$list;
+    return ($list, $total)
+	if !defined $params{'offset'} && !defined $params{'limit'};
+
+    my $offset = $params{'offset'} || 0;
+    my $limit = $params{'limit'};
+    $offset = 0 if $offset !~ /^\d+$/;
+    $limit = undef if defined $limit && $limit !~ /^\d+$/;
+
+    return ([], $total) if $offset >= $total;
+    my $last = $total - 1;
+    $last = $offset + $limit - 1 if defined $limit && $offset + $limit < $total;
+    return ([ @{$list}[$offset .. $last] ], $total);
+}
+
+1;
@@ -522,8 +522,9 @@ sub info {
 	@dles = $host->all_disks();
     }
 
+    my @infos = $ci->get_all_info(@dles);
     for my $dle (@dles) {
-	my $info = $ci->get_dle_info($dle);
+	my $info = shift @infos;
 	return $info if $info->isa("Amanda::Message");
 	$info->{'force-full'}    = 1 if $info->isset($Amanda::Curinfo::Info::FORCE_FULL);
 	$info->{'force-level-1'} = 1 if $info->isset($Amanda::Curinfo::Info::FORCE_LEVEL_1);
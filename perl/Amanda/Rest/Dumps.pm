@@ -21,6 +21,7 @@
 package Amanda::Rest::Dumps;
 use Amanda::Config qw( :init :getconf config_dir_relative );
 use Amanda::Rest::Configs;
+use Amanda::Rest::Cache;
 use Amanda::DB;
 use Amanda::DB::Catalog2;
 use Symbol;
@@ -50,6 +51,13 @@ Amanda::Rest::Dumps -- Rest interface to Amanda::DB::Catalog2
 	status=OK|PARTIAL|FAIL
 	holding=0|1
 	label=LABEL
+	offset=N
+	limit=N
+
+  The reply carries an ETag; a request with a matching If-None-Match header
+  gets a '304 Not Modified' reply without the catalog being read.  With offset
+  or limit, only that slice of the dumps is returned and 'total' gives the
+  number of dumps matching the query.
 
  reply:
   [
@@ -121,8 +129,15 @@ sub list {
 	$params{'diskname'} = uri_unescape($params{'DISK'});
     }
 
+    my $etag = Amanda::Rest::Cache::etag(
+			[ Amanda::Rest::Cache::catalog_files() ], %params);
+    return (304, [], $etag)
+	if Amanda::Rest::Cache::not_modified($etag, %params);
+
     my $catalog = Amanda::DB::Catalog2::new();
     my $dumps = $catalog->get_dumps(%params);
+    my $total;
+    ($dumps, $total) = Amanda::Rest::Cache::paginate($dumps, %params);
 
     # Remove cycle
     # uncomment commented line to remove undef parts.
@@ -142,8 +157,9 @@ sub list {
 				source_line     => __LINE__,
 				code            => 2600000,
 				severity => $Amanda::Message::SUCCESS,
-				dumps           => $dumps);
-    return ($status, \@result_messages);
+				dumps           => $dumps,
+				total           => $total);
+    return ($status, \@result_messages, $etag);
 }
 
 1;
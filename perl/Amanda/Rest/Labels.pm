@@ -21,6 +21,7 @@
 package Amanda::Rest::Labels;
 use Amanda::Config qw( :init :getconf config_dir_relative );
 use Amanda::Rest::Configs;
+use Amanda::Rest::Cache;
 use Amanda::DB::Catalog2;
 use Amanda::Util qw( match_datestamp );
 use Symbol;
@@ -46,6 +47,12 @@ Amanda::Rest::Labels -- Rest interface to get a list of labels
             meta=META
             pool=POOL
             reuse=0|1
+  and select a slice of the list with:
+            offset=N
+            limit=N
+
+  The reply carries an ETag; a request with a matching If-None-Match header
+  gets a '304 Not Modified' reply without the catalog being read.
 
  reply:
   HTTP status: 200 OK
@@ -97,6 +104,11 @@ sub list {
     my ($status, @result_messages) = Amanda::Rest::Configs::config_init(@_);
     return (status, \@result_messages) if @result_messages;
 
+    my $etag = Amanda::Rest::Cache::etag(
+			[ Amanda::Rest::Cache::catalog_files() ], %params);
+    return (304, [], $etag)
+	if Amanda::Rest::Cache::not_modified($etag, %params);
+
     my ($status, $catalog) = Amanda::Rest::Labels::init();
     if ($catalog->isa("Amanda::Message")) {
 	push @result_messages, $catalog;
@@ -112,23 +124,19 @@ sub list {
 			no_bless => 1,
 			retention_name => 1);
     if (defined $params{'datestamp'}) {
-	my @volumes = grep {defined $_->{'write_timestamp'} and match_datestamp($params{'datestamp'}, $_->{'write_timestamp'})} @$volumes;
+	$volumes = [ grep {defined $_->{'write_timestamp'} and match_datestamp($params{'datestamp'}, $_->{'write_timestamp'})} @$volumes ];
+    }
+    my $total;
+    ($volumes, $total) = Amanda::Rest::Cache::paginate($volumes, %params);
 
-	push @result_messages, Amanda::DB::Message->new(
-				source_filename => __FILE__,
-				source_line     => __LINE__,
-				code => 2600001,
-				severity => $Amanda::Message::SUCCESS,
-				volumes => \@volumes);
-    } else {
-	push @result_messages, Amanda::DB::Message->new(
+    push @result_messages, Amanda::DB::Message->new(
 				source_filename => __FILE__,
 				source_line     => __LINE__,
 				code => 2600001,
 				severity => $Amanda::Message::SUCCESS,
-				volumes => $volumes);
-    }
-    return (-1, \@result_messages);
+				volumes => $volumes,
+				total => $total);
+    return (-1, \@result_messages, $etag);
 }
 
 1;
@@ -30,6 +30,7 @@ use Amanda::Report::json;
 use Amanda::MainLoop;
 use Amanda::Label;
 use Amanda::Rest::Configs;
+use Amanda::Rest::Cache;
 use Symbol;
 use Data::Dumper;
 use vars qw(@ISA);
@@ -65,6 +66,11 @@ Amanda::Rest::Report -- Rest interface to Amanda::Report
 
 See perldoc Amanda::Report::json for the report format.
 
+The report of a finished run carries an ETag; a request with a matching
+If-None-Match header gets a '304 Not Modified' reply without the log being
+parsed.  The report of the current log is always recomputed, it changes with
+the state of the processes of the run.
+
 =back
 
 =cut
@@ -83,6 +89,13 @@ sub report {
     my $logdir = config_dir_relative(getconf($CNF_LOGDIR));
     $logfile = "$logdir/$logfile" if $logfile !~ /^\//;
 
+    my $etag;
+    if ($logfile ne "$logdir/log") {
+	$etag = Amanda::Rest::Cache::etag([ $logfile ], %params);
+	return (304, [], $etag)
+	    if Amanda::Rest::Cache::not_modified($etag, %params);
+    }
+
     my $report = Amanda::Report->new($logfile);
     if ($report->isa("Amanda::Message")) {
 	push @result_messages, $report;
@@ -109,7 +122,7 @@ sub report {
 			report => $rep->{'sections'});
     }
 
-    return ($status, \@result_messages);
+    return ($status, \@result_messages, $etag);
 }
 
 1;
@@ -31,6 +31,7 @@ use Amanda::Label;
 use Amanda::Curinfo;
 use Amanda::Status;
 use Amanda::Rest::Configs;
+use Amanda::Rest::Cache;
 use Symbol;
 use Data::Dumper;
 use vars qw(@ISA);
@@ -63,6 +64,10 @@ Amanda::Rest::Status -- Rest interface to Amanda::Status
      }
     ]
 
+  The status of a run that is no longer running carries an ETag; a request
+  with a matching If-None-Match header gets a '304 Not Modified' reply
+  without the log being parsed.
+
 =back
 
 =cut
@@ -77,13 +82,21 @@ sub current {
     $params{'filename'} = $params{'amdump_log'} if defined $params{'amdump_log'};
     $params{'filename'} = $params{'tracefile'} if defined $params{'tracefile'};
     my $Astatus = Amanda::Status->new(%params);
+    my $etag;
     if ($Astatus->isa("Amanda::Message")) {
 	push @result_messages, $Astatus;
     } else {
+	# a live run may die without writing to its log
+	if ($Astatus->{'state'}->{'dead_run'}) {
+	    $etag = Amanda::Rest::Cache::etag([ $Astatus->{'filename'} ],
+					      %params);
+	    return (304, [], $etag)
+		if Amanda::Rest::Cache::not_modified($etag, %params);
+	}
 	push @result_messages, $Astatus->current();
     }
 
-    return ($status, \@result_messages);
+    return ($status, \@result_messages, $etag);
 }
 
 1;
@@ -31,6 +31,7 @@ use Amanda::MainLoop;
 use Amanda::Label;
 use Amanda::Util qw( match_datestamp );
 use Amanda::Rest::Configs;
+use Amanda::Rest::Cache;
 use Symbol;
 use Data::Dumper;
 use Scalar::Util;
@@ -57,6 +58,12 @@ You can use the /amanda/v1.0/configs/:CONF/labels endpoint and filter with the s
             meta=META
             pool=POOL
             reuse=0|1
+  and select a slice of the list with:
+            offset=N
+            limit=N
+
+  The reply carries an ETag; a request with a matching If-None-Match header
+  gets a '304 Not Modified' reply without the catalog being read.
 
  reply:
   HTTP status: 200 OK
@@ -529,6 +536,11 @@ sub list {
     my ($status, @result_messages) = Amanda::Rest::Configs::config_init(@_);
     return ($status, @result_messages) if @result_messages;
 
+    my $etag = Amanda::Rest::Cache::etag(
+			[ Amanda::Rest::Cache::catalog_files() ], %params);
+    return (304, [], $etag)
+	if Amanda::Rest::Cache::not_modified($etag, %params);
+
     ($status, my $catalog) = Amanda::Rest::Labels::init();
     if ($catalog->isa("Amanda::Message")) {
 	push @result_messages, $catalog;
@@ -543,13 +555,16 @@ sub list {
 					 meta    => $params{'meta'},
 					 datestamp => $params{'datestamp'},
 					 retention_name => 1);
+    my $total;
+    ($volumes, $total) = Amanda::Rest::Cache::paginate($volumes, %params);
     push @result_messages, Amanda::DB::Message->new(
 				source_filename => __FILE__,
 				source_line     => __LINE__,
 				code => 2600001,
 				severity => $Amanda::Message::SUCCESS,
-				volumes => $volumes);
-    return ($status, \@result_messages);
+				volumes => $volumes,
+				total => $total);
+    return ($status, \@result_messages, $etag);
 }
 
 1;
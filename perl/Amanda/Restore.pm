@@ -437,6 +437,10 @@ sub local_message {
 	return "Storage $self->{'storage'} have no changer";
     } elsif ($self->{'code'} == 4900068) {
 	return "$self->{'msg'}";
+    } elsif ($self->{'code'} == 4900069) {
+        return "recovery failed: digest in catalog ($self->{'log_digest'}) and digest of the data read ($self->{'source_digest'}) differ";
+    } elsif ($self->{'code'} == 4900070) {
+        return "recovery failed: digest of part $self->{'partnum'} in catalog ($self->{'log_digest'}) and digest of the part read ($self->{'source_digest'}) differ";
     } else {
 	return "No mesage for code '$self->{'code'}'";
     }
@@ -656,6 +660,86 @@ sub user_message {
     }
 }
 
+# The block map written by the dumper for a dump it compressed in independent
+# blocks: the offset in the compressed data of each block of the dump.
+sub _open_block_map {
+    my ($hdr) = @_;
+
+    my $filename = Amanda::Logfile::getblockmapfname(
+		"".$hdr->{'name'}, "".$hdr->{'disk'},
+		$hdr->{'datestamp'}, $hdr->{'dumplevel'});
+    open(my $fh, '<', $filename) or return undef;
+    binmode($fh);
+
+    my $head;
+    if (!defined sysread($fh, $head, 24) || length($head) != 24 ||
+	substr($head, 0, 8) ne "AMBLKMAP") {
+	close($fh);
+	return undef;
+    }
+    my ($bs_hi, $bs_lo, $in_hi, $in_lo) = unpack("NNNN", substr($head, 8));
+    my $map = {
+	fh => $fh,
+	block_size => $bs_hi * 4294967296 + $bs_lo,
+	bytes_in => $in_hi * 4294967296 + $in_lo,
+	base => 0,
+    };
+    if ($map->{'block_size'} == 0 || $map->{'bytes_in'} == 0) {
+	close($fh);
+	return undef;
+    }
+    $map->{'nblocks'} = int(($map->{'bytes_in'} + $map->{'block_size'} - 1) /
+			    $map->{'block_size'});
+    if ((stat($fh))[7] != 24 + 8 * ($map->{'nblocks'} + 1)) {
+	close($fh);
+	return undef;
+    }
+    debug("using block map $filename: $map->{'nblocks'} blocks");
+    return $map;
+}
+
+sub _block_map_offset {
+    my ($map, $block) = @_;
+    my $rec;
+
+    sysseek($map->{'fh'}, 24 + 8 * $block, 0);
+    sysread($map->{'fh'}, $rec, 8);
+    my ($hi, $lo) = unpack("NN", $rec);
+    return $hi * 4294967296 + $lo;
+}
+
+# Translate the range $first:$last (-1 for the end) of the uncompressed dump
+# to the range of the compressed data that holds it.  The blocks are read
+# whole, and the range filter keeps only the requested bytes of their
+# uncompressed data.
+sub _block_map_range {
+    my ($map, $first, $last) = @_;
+    my $bs = $map->{'block_size'};
+
+    my $i = int($first / $bs);
+    $i = $map->{'nblocks'} - 1 if $i >= $map->{'nblocks'};
+    my $start = _block_map_offset($map, $i);
+    my $skip = $first - $i * $bs;
+
+    if ($last < 0) {
+	$map->{'filter'}->add_range($map->{'base'} + $skip, -1);
+	return ($start, -1);
+    }
+
+    my $j = int($last / $bs);
+    $j = $map->{'nblocks'} - 1 if $j >= $map->{'nblocks'};
+    $j = $i if $j < $i;
+    my $end = _block_map_offset($map, $j + 1);
+    $map->{'filter'}->add_range($map->{'base'} + $skip, $last - $first + 1);
+
+    # the uncompressed size of the blocks read
+    my $blocks_end = ($j + 1) * $bs;
+    $blocks_end = $map->{'bytes_in'} if $blocks_end > $map->{'bytes_in'};
+    $map->{'base'} += $blocks_end - $i * $bs;
+
+    return ($start, $end - $start);
+}
+
 sub restore {
     my $self = shift;
     my %params = @_;
@@ -946,6 +1030,8 @@ sub restore {
     my $interactivity;
     my $source_crc;
     my $dest_crc;
+    my $source_digest;
+    my @source_part_digests;
     my $xfer_src;
     my $xfer_dest;
     my $xfer_dest_crc;
@@ -963,6 +1049,7 @@ sub restore {
     my $xfer;
     my $use_dar = 0;
     my $xfer_waiting_dar = 0;
+    my $block_map;
 
     my $steps = define_steps
 	cb_ref => \$params{'finished_cb'},
@@ -1303,10 +1390,60 @@ sub restore {
 			needed_labels   => \@needed_labels,
 			needed_holding	=> \@needed_holding));
 
+	# the dumps written to their own file, or extracted, can be read at
+	# the same time
+	if ($params{'parallel'} and $params{'parallel'} > 1 and
+	    !$params{'pipe-fd'} and !defined $params{'device'} and
+	    @{$plan->{'dumps'}} > 1) {
+	    return $steps->{'start_parallel'}->();
+	}
 	$steps->{'start_dump'}->();
     };
 
+    step start_parallel => sub {
+	# an extracted DLE must get its dumps in order, in one plan
+	my @plans = $plan->split_plan($params{'parallel'},
+		by_dle => ($params{'extract'} || $params{'extract-client'}));
+
+	return $steps->{'start_dump'}->() if @plans < 2;
+
+	# each plan is restored by its own Amanda::Restore, with its own
+	# storages, changers and clerks, and its own feedback for the state of
+	# the dump it extracts
+	$plan->{'dumps'} = [];
+	my $running = @plans;
+	my $stream = 0;
+	for my $subplan (@plans) {
+	    $stream++;
+	    my ($restore, $result_message) = Amanda::Restore->new(
+			message_pathname => $self->{'message_pathname'},
+			delay => $self->{'delay'});
+	    my $feedback = $params{'feedback'};
+	    $feedback = $feedback->new_stream($stream)
+		if $feedback->can('new_stream');
+	    $restore->restore(%params,
+		plan => $subplan,
+		parallel => undef,
+		feedback => $feedback,
+		finished_cb => sub {
+		    my ($exit_status) = @_;
+
+		    $self->{'exit_status'} = $exit_status if $exit_status;
+		    $self->{'image_restored'} += $restore->{'image_restored'};
+		    $self->{'image_failed'} += $restore->{'image_failed'};
+		    $restore = undef;
+		    return $steps->{'finished'}->() if --$running == 0;
+		});
+	}
+    };
+
     step start_dump => sub {
+	# the dumps written each to its own file can be read in the order the
+	# device recommends
+	$params{'feedback'}->set_feedback(plan => $plan)
+	    if !$params{'extract'} and !$params{'extract-client'} and
+	       !$params{'restore'} and !$params{'pipe-fd'};
+
 	$current_dump = shift @{$plan->{'dumps'}};
 
 	if (!$current_dump) {
@@ -1316,6 +1453,8 @@ sub restore {
 	$self->{'image_status'} = 0;
 	$self->{'recovery_done'} = 0;
 	$use_dar = 0;
+	close($block_map->{'fh'}) if defined $block_map;
+	$block_map = undef;
 	%recovery_params = ();
 	$check_crc = !$params{'no-reassembly'};
 	$self->{'feedback'}->notif_start($current_dump) if $self->{'feedback'}->can('notif_start');
@@ -1376,6 +1515,8 @@ sub restore {
 	$self->{'nb_image'} = 1;
 	$self->{'recovery_done'} = 0;
 	$use_dar = 0;
+	close($block_map->{'fh'}) if defined $block_map;
+	$block_map = undef;
 	%recovery_params = ();
 	$check_crc = !$params{'no-reassembly'};
 
@@ -1397,6 +1538,11 @@ sub restore {
 			severity	=> $Amanda::Message::ERROR,
 			errs		=> $errs)) if $errs;
 
+	# verify the fixity digests recorded by the taper
+	if (defined $current_dump->{'digest'} and $xfer_src->can('set_digest')) {
+	    $xfer_src->set_digest(1);
+	}
+
 	delete $self->{'all_filter'};
 	my $dle_str = $hdr->{'dle_str'};
 	my $p1 = XML::Simple->new();
@@ -1486,7 +1632,12 @@ sub restore {
 	    (($hdr->{'srv_encrypt'} and ($decrypt == $ALWAYS || $decrypt == $ONLY_SERVER)) ||
 	     ($hdr->{'clnt_encrypt'} and ($decrypt == $ALWAYS || $decrypt == $ONLY_CLIENT)))) {
 	    $filtered = 1;
-	    if ($hdr->{'srv_encrypt'}) {
+	    if ($hdr->native_encrypt_type()) {
+		# the decrypt option names the key file
+		push @filters,
+		    Amanda::Xfer::Filter::Encrypt->new(
+			$hdr->{'srv_decrypt_opt'}, 1, 4);
+	    } elsif ($hdr->{'srv_encrypt'}) {
 		push @filters,
 		    Amanda::Xfer::Filter::Process->new(
 			[ $hdr->{'srv_encrypt'}, $hdr->{'srv_decrypt_opt'} ], 0, 0, 0, 1);
@@ -1528,6 +1679,10 @@ sub restore {
 	     ($hdr->{'clntcompprog'} and ($decompress == $ALWAYS || $decompress == $ONLY_CLIENT)) ||
 	     ($dle->{'compress'} and $dle->{'compress'} eq "SERVER-FAST" and ($decompress == $ALWAYS || $decompress == $ONLY_SERVER)) ||
 	     ($dle->{'compress'} and $dle->{'compress'} eq "SERVER-BEST" and ($decompress == $ALWAYS || $decompress == $ONLY_SERVER)) ||
+	     ($dle->{'compress'} and $dle->{'compress'} eq "SERVER-AUTO" and ($decompress == $ALWAYS || $decompress == $ONLY_SERVER)) ||
+	     ($dle->{'compress'} and $dle->{'compress'} eq "SERVER-DEFERRED" and ($decompress == $ALWAYS || $decompress == $ONLY_SERVER)) ||
+	     ($dle->{'compress'} and $dle->{'compress'} eq "SERVER-ZSTD" and ($decompress == $ALWAYS || $decompress == $ONLY_SERVER)) ||
+	     ($dle->{'compress'} and $dle->{'compress'} eq "SERVER-LZ4" and ($decompress == $ALWAYS || $decompress == $ONLY_SERVER)) ||
 	     ($dle->{'compress'} and $dle->{'compress'} eq "FAST" and ($decompress == $ALWAYS || $decompress == $ONLY_CLIENT)) ||
 	     ($dle->{'compress'} and $dle->{'compress'} eq "BEST" and ($decompress == $ALWAYS || $decompress == $ONLY_CLIENT)))) {
 	    $filtered = 1;
@@ -1554,10 +1709,17 @@ sub restore {
 			[ $hdr->{'clntcompprog'}, "-d" ], 0, 0, 0, 1);
 		$hdr->{'clntcompprog'} = '';
 	    } else {
+		# a dump the dumper compressed in blocks can be read from any
+		# block, if it is not also encrypted
+		$block_map = _open_block_map($hdr) if defined $clerk && !@filters;
 		push @filters,
 		    Amanda::Xfer::Filter::Process->new(
 			[ $Amanda::Constants::UNCOMPRESS_PATH,
 			  $Amanda::Constants::UNCOMPRESS_OPT ], 0, 0, 0, 1);
+		if (defined $block_map) {
+		    $block_map->{'filter'} = Amanda::Xfer::Filter::Range->new();
+		    push @filters, $block_map->{'filter'};
+		}
 	    }
 	    $dle->{'compress'} = "NONE";
 
@@ -1575,13 +1737,21 @@ sub restore {
 	    # need to compress this file
 
 	    $filtered = 1;
-	    my $compress_opt = $params{'compress-best'} ?
-		$Amanda::Constants::COMPRESS_BEST_OPT :
-		$Amanda::Constants::COMPRESS_FAST_OPT;
-	    push @filters,
-		Amanda::Xfer::Filter::Process->new(
-		    [ $Amanda::Constants::COMPRESS_PATH,
-		      $compress_opt ], 0, 0, 0, 1);
+	    if ($Amanda::Constants::COMPRESS_SUFFIX eq '.gz' &&
+		Amanda::Xfer::Filter::Compress::supported("gzip")) {
+		# in-process, with what UNCOMPRESS_PATH reads
+		push @filters,
+		    Amanda::Xfer::Filter::Compress->new("gzip",
+			$params{'compress-best'} ? -3 : -2, 1);
+	    } else {
+		my $compress_opt = $params{'compress-best'} ?
+		    $Amanda::Constants::COMPRESS_BEST_OPT :
+		    $Amanda::Constants::COMPRESS_FAST_OPT;
+		push @filters,
+		    Amanda::Xfer::Filter::Process->new(
+			[ $Amanda::Constants::COMPRESS_PATH,
+			  $compress_opt ], 0, 0, 0, 1);
+	    }
 
 	    # adjust the header
 	    $hdr->{'compressed'} = 1;
@@ -1591,6 +1761,7 @@ sub restore {
 	    $dest_is_server = 0;
 	}
         $use_dar |= !$filtered && !$hdr->{'compressed'} && !$hdr->{'encrypted'};
+	$use_dar = 1 if defined $block_map;
 
 	my $copy_hdr = Amanda::Header->from_string($hdr->to_string(128,32768));
 	# write the header to the destination if requested
@@ -1820,6 +1991,8 @@ sub restore {
 	    }
 	    $size = -1;
 	    $size = $range1 - $offset + 1 if $range1 >= 0;;
+	    ($offset, $size) = _block_map_range($block_map, $offset, $range1)
+		if defined $block_map;
 	} elsif ($use_dar) {
 	    $xfer_waiting_dar = 1;
 	    return;
@@ -1827,6 +2000,8 @@ sub restore {
 	    $offset = 0;
 	    $size = $current_dump->{'bytes'};
 	    $size = -1 if $size == 0;
+	    $block_map->{'filter'}->add_range($block_map->{'base'}, -1)
+		if defined $block_map;
 	}
 	$xfer_waiting_dar = 0;
 
@@ -1848,6 +2023,7 @@ sub restore {
 	if ($msg->{'type'} == $XMSG_CRC) {
 	    if ($msg->{'elt'} == $xfer_src) {
 		$source_crc = $msg->{'crc'}.":".$msg->{'size'};
+		$source_digest = $msg->{'digest'};
 		debug("source_crc: $source_crc");
 	    } elsif ($msg->{'elt'} == $xfer_dest) {
 		$dest_crc = $msg->{'crc'}.":".$msg->{'size'};
@@ -1881,6 +2057,9 @@ sub restore {
 	    }
 
 	    if ($msg->{'elt'} == $xfer_src) {
+		if ($msg->{'type'} == $XMSG_PART_DONE and defined $msg->{'digest'}) {
+		    push @source_part_digests, [ $msg->{'size'}, $msg->{'digest'} ];
+		}
 		if ($msg->{'type'} == $XMSG_SEGMENT_DONE) {
 		    $xfer_waiting_dar = 1;
 		    $steps->{'xfer_range'}->();
@@ -2113,6 +2292,42 @@ sub restore {
 		$self->{'image_status'} = 1;
 		$self->{'exit_status'} = 1;
 	    }
+
+	    # the fixity digests, when the same bytes were read as written
+	    if (defined $current_dump->{'digest'} and defined $source_digest and
+		defined $source_crc_size and defined $current_dump_server_crc_size and
+		$current_dump_server_crc_size == $source_crc_size and
+		$current_dump->{'digest'} ne $source_digest) {
+		$self->user_message(
+			Amanda::Restore::Message->new(
+				source_filename => __FILE__,
+				source_line     => __LINE__,
+				code            => 4900069,
+				severity	=> $Amanda::Message::ERROR,
+				log_digest	=> $current_dump->{'digest'},
+				source_digest	=> $source_digest));
+		$self->{'image_status'} = 1;
+		$self->{'exit_status'} = 1;
+	    }
+	    my @parts = grep { defined $_ } @{$current_dump->{'parts'} || []};
+	    for my $i (0 .. $#source_part_digests) {
+		my $part = $parts[$i];
+		my ($part_size, $part_digest) = @{$source_part_digests[$i]};
+		next if !defined $part or !defined $part->{'digest'} or
+			$part->{'part_size'} != $part_size;
+		next if $part->{'digest'} eq $part_digest;
+		$self->user_message(
+			Amanda::Restore::Message->new(
+				source_filename => __FILE__,
+				source_line     => __LINE__,
+				code            => 4900070,
+				severity	=> $Amanda::Message::ERROR,
+				partnum		=> $part->{'partnum'},
+				log_digest	=> $part->{'digest'},
+				source_digest	=> $part_digest));
+		$self->{'image_status'} = 1;
+		$self->{'exit_status'} = 1;
+	    }
 	}
 
 	if ($self->{'image_status'}) {
@@ -2128,6 +2343,8 @@ sub restore {
 	$client_filter = undef;
 	$source_crc = undef;
 	$dest_crc = undef;
+	$source_digest = undef;
+	@source_part_digests = ();
 	$restore_native_crc = undef;
 	$restore_client_crc = undef;
 
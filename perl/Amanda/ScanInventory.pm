@@ -177,9 +177,34 @@ sub scan {
     # first scan
     $self->{'scan_num'}++;
 
+    # volumes may have been written or had their retention recomputed since
+    # the last scan
+    $self->{'volume_index'} = undef;
+
     $self->_scan(%params);
 }
 
+# Look up the catalog entry for a label in this storage's pool.  The first
+# lookup in a scan reads the whole pool from the catalog in one query, so that
+# evaluating thousands of slots does not cost one query each.
+sub find_pool_volume {
+    my $self = shift;
+    my ($label) = @_;
+
+    if (!defined $self->{'volume_index'}) {
+	my %index;
+	my $volumes = $self->{'catalog'}->find_volumes(
+				pool => $self->{'storage'}->{'tapepool'});
+	for my $volume (@$volumes) {
+	    $index{$volume->{'label'}} = $volume
+		unless exists $index{$volume->{'label'}};
+	}
+	$self->{'volume_index'} = \%index;
+    }
+
+    return $self->{'volume_index'}->{$label};
+}
+
 sub _user_msg {
     my $self = shift;
     my $message = shift;
@@ -282,6 +307,9 @@ sub _scan {
 	    $remove_undef_state = 0;
 	}
 
+	# a new inventory may reflect volumes labeled since the index was built
+	$self->{'volume_index'} = undef;
+
 	# remove any slots where the state has changed from the list of seen slots
 	for my $i (0..(scalar(@$inventory)-1)) {
 	    my $sl = $inventory->[$i];
@@ -852,9 +880,7 @@ sub volume_is_labelable {
 		return 0;
 	    }
 	} else {
-	    my $volume = $self->{'catalog'}->find_volume(
-				$self->{'storage'}->{'tapepool'},
-				$label);
+	    my $volume = $self->find_pool_volume($label);
 	    if (!$volume) {
 #		$self->_user_msg(slot_result     => 1,
 #				 label           => $label,
@@ -193,6 +193,10 @@ Amanda::Status -- Get the status of a running job.
  taper->{$taper}->{'nb_tape'} => number of tape used
  taper->{$taper}->{'worker'}->{$worker}->{'status'}            => $status
 					 {'taper_status_file'} => filename of status file for the flush
+					 {'xfer_stats'}->{$elt} => latest XMSG_STATS for each element of the transfer:
+					                           {'bytes_in'}, {'bytes_out'},
+					                           {'wait_upstream'}, {'wait_downstream'},
+					                           {'busy'}, {'duration'}
 					 {'message'}           => amstatus message
 					 {'error'}             => error message
 					 {'host'}              => host actualy flushing
@@ -437,7 +441,15 @@ REREAD:
     $state->{'exit_status'} = 0 if !defined $state->{'exit_status'};
     my $line;
     my $fd = $self->{'fd'};
+    my $filepos = tell $fd;
     while ($line = <$fd>) {
+	# the log is still being written; leave a partial last line for
+	# the next call, so the cached filepos is always at a line start.
+	if ($line !~ /\n$/) {
+	    seek $fd, $filepos, 0;
+	    last;
+	}
+	$filepos = tell $fd;
 	$self->{'parsed_line'} = 1;
 	chomp $line;
 	$line =~ s/[:\s]+$//g; #remove separator at end of line
@@ -1277,6 +1289,7 @@ REREAD:
 			$state->{'taper'}->{$taper}->{'stat'}[$ntape]->{'nb_dle'} += 1;
 			delete $dle->{'taper_status_file'};
 			delete $state->{'taper'}->{$taper}->{'worker'}->{$worker}->{'taper_status_file'};
+			delete $state->{'taper'}->{$taper}->{'worker'}->{$worker}->{'xfer_stats'};
 			if ($line[6] eq "DONE") {
 			    delete $state->{'taper'}->{$taper}->{'worker'}->{$worker}->{'host'};
 			    delete $state->{'taper'}->{$taper}->{'worker'}->{$worker}->{'disk'};
@@ -1375,6 +1388,7 @@ REREAD:
 			my $dle = $state->{'serial_to_dle'}->{$serial};
 			delete $dle->{'taper_status_file'};
 			delete $state->{'taper'}->{$taper}->{'worker'}->{$worker}->{'taper_status_file'};
+			delete $state->{'taper'}->{$taper}->{'worker'}->{$worker}->{'xfer_stats'};
 			$state->{'taper'}->{$taper}->{'worker'}->{$worker}->{'status'} = $IDLE;
 			delete $state->{'taper'}->{$taper}->{'worker'}->{$worker}->{'host'};
 			delete $state->{'taper'}->{$taper}->{'worker'}->{$worker}->{'disk'};
@@ -1509,6 +1523,20 @@ REREAD:
 		my $wworker = $state->{'taper'}->{$taper}->{'worker'}->{$worker};
 		my $dle = $state->{'dles'}->{$wworker->{'host'}}->{$wworker->{'disk'}}->{$wworker->{'datestamp'}};
 		$dle->{'taper_status_file'} = $line[7];
+	    } elsif ($line[1] eq "xfer" && $line[2] eq "stats") {
+		#3:taper 4:worker 5:hostname 6:diskname 7:element 8:"in" 9:bytes_in
+		#10:"out" 11:bytes_out 12:"wait-upstream" 13:wait_upstream
+		#14:"wait-downstream" 15:wait_downstream 16:"busy" 17:busy
+		#18:"duration" 19:duration
+		my $taper = $line[3];
+		my $worker = $line[4];
+		$state->{'taper'}->{$taper}->{'worker'}->{$worker}->{'xfer_stats'}->{$line[7]} = {
+			'bytes_in'        => $line[9],
+			'bytes_out'       => $line[11],
+			'wait_upstream'   => $line[13],
+			'wait_downstream' => $line[15],
+			'busy'            => $line[17],
+			'duration'        => $line[19] };
 	    } elsif ($line[2] eq "worker" &&
 	        $line[4] eq "wrote") {
 		#1:taper 2:"worker" 3:worker 4:"wrote" 5:host 6:disk
@@ -1528,7 +1556,7 @@ REREAD:
 	}
     }
 
-    $state->{'filepos'} = tell $self->{'fd'};
+    $state->{'filepos'} = $filepos;
     return undef;
 }
 
@@ -2125,13 +2153,28 @@ sub current {
     my $cache_file = $cache_dir . '/' . $basefile;
     my $cache_read = 0;
 
+    # the cache is only valid for the very file it was built from; the
+    # amdump log is rotated by the next run, and keeps its basename.
+    my ($dev, $ino, undef, undef, undef, undef, undef, $size) = stat $self->{'fd'};
+
     debug("cache_file: $cache_file");
     if (-f $cache_file) {
 	debug("cache_file: $cache_file exists\n");
 	# read the cache file
-	$self->{'state'} = retrieve $cache_file;
-	if ($self->{'state'}->{'version'} eq $Amanda::Constants::VERSION) {
-	    # seek input file
+	my $cached = eval { retrieve $cache_file };
+	if (!defined $cached || ref $cached ne 'HASH') {
+	    debug("cache_file: $cache_file is unreadable; ignoring it");
+	} elsif (!defined $cached->{'version'} ||
+		 $cached->{'version'} ne $Amanda::Constants::VERSION) {
+	    debug("cache_file: $cache_file is from another version; ignoring it");
+	} elsif (!defined $cached->{'file_ino'} ||
+		 $cached->{'file_dev'} != $dev ||
+		 $cached->{'file_ino'} != $ino ||
+		 ($cached->{'filepos'} || 0) > $size) {
+	    debug("cache_file: $cache_file is for another log file; ignoring it");
+	} else {
+	    $self->{'state'} = $cached;
+	    # seek input file, only the new lines are parsed
 	    if ($self->{'state'}->{'filepos'}) {
 		seek $self->{'fd'}, $self->{'state'}->{'filepos'}, 0;
 	    }
@@ -2149,14 +2192,27 @@ sub current {
 	$self->{'state'}->{'chunker_to_serial'} = ();
 	$self->{'state'}->{'running_dumper'} = ();
 	$self->{'state'}->{'worker_to_serial'} = ();
+	$self->{'state'}->{'file_dev'} = $dev;
+	$self->{'state'}->{'file_ino'} = $ino;
     }
 
     my $message = $self->parse();
     return $message if defined $message;
 
     # write the cache file
+    # write it aside and rename, a concurrent amstatus must never
+    # retrieve a partially written cache.
     if ($self->{'parsed_line'}) {
-	store $self->{'state'}, $cache_file;
+	my $tmp_file = "$cache_file.$$";
+	if (eval { store $self->{'state'}, $tmp_file }) {
+	    if (!rename $tmp_file, $cache_file) {
+		debug("can't rename $tmp_file to $cache_file: $!");
+		unlink $tmp_file;
+	    }
+	} else {
+	    debug("can't write $tmp_file: $@");
+	    unlink $tmp_file;
+	}
     }
 
     $self->set_summary();
@@ -208,6 +208,7 @@ sub new {
     $self->{'dump_selection'} = storage_getconf($st, $STORAGE_DUMP_SELECTION);
     $self->{'erase_on_failure'} = storage_getconf($st, $STORAGE_ERASE_ON_FAILURE);
     $self->{'erase_on_full'} = storage_getconf($st, $STORAGE_ERASE_ON_FULL);
+    $self->{'fixity_digest'} = storage_getconf($st, $STORAGE_FIXITY_DIGEST);
     bless $self, $class;
 
     $self->{'tapetype'} = lookup_tapetype($self->{'tapetype_name'});
@@ -61,7 +61,7 @@ use constant FILE_WRITE => message("FILE-WRITE",
     format => [ qw( worker_name handle filename hostname diskname level datestamp
 	    dle_tape_splitsize dle_split_diskbuffer dle_fallback_splitsize dle_allow_split
 	    part_size part_cache_type part_cache_dir part_cache_max_size
-	    orig_kb) ],
+	    orig_kb compress?) ],
 );
 
 use constant VAULT_WRITE => message("VAULT-WRITE",
@@ -377,7 +377,10 @@ sub is_reusable_volume {
     my $self = shift;
     my %params = @_;
     my $volume = $params{'volume'};
-    if (!defined $volume) {
+
+    # a volume => undef argument means the caller already looked, and there
+    # is no such volume
+    if (!exists $params{'volume'}) {
 	$volume = $self->{'catalog'}->find_volume(
 				$self->{'storage'}->{'tapepool'},
 				$params{'label'})
@@ -108,16 +108,14 @@ sub analyze {
 	} elsif ($sl->{'state'} == Amanda::Changer::SLOT_EMPTY) {
 	} elsif (defined $sl->{'label'} &&
 		 $sl->{device_status} == $DEVICE_STATUS_SUCCESS) {
-	    if ($self->is_reusable_volume(label => $sl->{'label'})) {
+	    my $volume = $self->find_pool_volume($sl->{'label'});
+	    if ($self->is_reusable_volume(volume => $volume)) {
 		if ($last_label && $sl->{'label'} gt $last_label) {
 		    push @reusable_after, $sl;
 		} else {
 		    push @reusable_before, $sl;
 		}
 	    } else {
-		my $volume = $self->{'catalog'}->find_volume(
-				$self->{'storage'}->{'tapepool'},
-				$sl->{'label'});
 		if ($volume) {
 		    if ($self->volume_is_new_labelled($volume, $sl)) {
 			if ($last_label && $sl->{'label'} gt $last_label) {
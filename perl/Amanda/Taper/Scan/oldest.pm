@@ -107,9 +107,7 @@ sub analyze {
 	} elsif ($sl->{'state'} == Amanda::Changer::SLOT_EMPTY) {
 	} elsif (defined $sl->{'label'} &&
 		 $sl->{device_status} == $DEVICE_STATUS_SUCCESS) {
-	    my $volume = $self->{'catalog'}->find_volume(
-				$self->{'storage'}->{'tapepool'},
-				$sl->{'label'});
+	    my $volume = $self->find_pool_volume($sl->{'label'});
 	    if ($self->is_reusable_volume(volume => $volume)) {
 		push @reusable, $sl;
 		if ($volume){
@@ -112,6 +112,14 @@ below), the third specify the Amanda::DB::Catalog2 that the scribe will update.
         feedback => $my_feedback,
 	catalog => $my_catalog);
 
+An optional C<lookahead> argument controls when the Scribe starts looking for
+the next volume.  Once the bytes written to the current volume reach this
+fraction of the tapetype's C<length> (the device's C<max_volume_usage>), the
+Scribe scans for the next volume and loads it in another drive.  The volume
+switch then does not have to wait for the changer.  Look-ahead happens only
+when the changer reports more than one drive (its C<num_drives> info key).
+The default is 0.9; 0 disables look-ahead.
+
 Once the object is in place, call its C<start> method.
 
 =head2 START THE SCRIBE
@@ -280,7 +288,8 @@ parameters.
         size => $size,
         duration => $duration,
 	total_duration => $total_duration,
-	nparts => $nparts);
+	nparts => $nparts,
+	digest => $digest);
 
 All parameters will be present on every call, although the order is not
 guaranteed.
@@ -300,7 +309,10 @@ seconds), and C<nparts> describe the total transfer, and are a sum of all of
 the parts written to the device.  Note that C<nparts> does not include any
 empty trailing parts.  Note that C<duration> does not include time spent
 operating the changer, while C<total_duration> reflects the time from the
-C<start_dump> call to the invocation of the C<dump_cb>.
+C<start_dump> call to the invocation of the C<dump_cb>.  The C<digest> is the
+fixity digest of the whole image if the storage sets C<fixity-digest>, and is
+C<undef> otherwise; the digest of each part is recorded with the part in the
+catalog.
 
 =head3 Cancelling a Dump
 
@@ -313,6 +325,24 @@ can be done by calling C<cancel_dump>:
 	xfer => $xfer,
 	dump_cb => $dump_cb);
 
+=head3 Copying a Dump
+
+A dump whose parts are on a device that the Scribe's device can copy from
+(see C<can_copy_file_from> in L<Amanda::Device>) can be copied without a
+transfer, in place of C<get_xfer_dest> and C<start_dump>:
+
+  $scribe->copy_dump(
+      src_device => $src_dev,
+      filenums => [ 3, 4, 5 ],
+      dump_header => $hdr,
+      dump_cb => $dump_cb);
+
+The C<filenums> are the files of the parts on the started C<src_device>, in
+part order.  Each part is copied to one file, and a part which does not fit on
+the volume is copied to the next one; the parts are not split again.  The
+C<dump_cb> is called as for C<start_dump>.  The copy of a part blocks until the
+device is done with it.
+
 =head2 QUIT
 
 When all of the dumpfiles are transferred, call the C<quit> method to
@@ -460,6 +490,8 @@ sub new {
 	debug => $decide_debug,
 	write_timestamp => undef,
 	started => 0,
+	lookahead => exists $params{'lookahead'}? $params{'lookahead'} : 0.9,
+	lookahead_started => 0,
 
 	# device handling, and our current device and reservation
 	devhandling => Amanda::Taper::Scribe::DevHandling->new(
@@ -483,6 +515,7 @@ sub new {
 	xdt => undef,
 	xdt_ready => undef,
 	start_part_on_xdt_ready => 0,
+	auto_parts => 0, # the xdt starts the parts that need no decision
 	size => 0,	# in bytes
 	duration => 0.0,
 	dump_start_time => undef,
@@ -678,6 +711,7 @@ sub get_xfer_dest {
     $self->{'size'} = 0;
     $self->{'crc_size'} = 0;
     $self->{'server_crc'} = '00000000:0';
+    $self->{'digest'} = undef;
     $self->{'duration'} = 0.0;
     $self->{'nparts'} = 0;
     $self->{'dump_start_time'} = undef;
@@ -772,6 +806,7 @@ sub get_xfer_dest {
     }
 
     my $xdt;
+    $self->{'auto_parts'} = 0;
     if ($dest_type eq 'directtcp') {
 	$xdt = Amanda::Xfer::Dest::Taper::DirectTCP->new(
 	    $xdt_first_dev, $part_size);
@@ -780,12 +815,21 @@ sub get_xfer_dest {
 	$xdt = Amanda::Xfer::Dest::Taper::Splitter->new(
 	    $xdt_first_dev, $params{'max_memory'}, $part_size, $can_cache_inform);
 	$self->{'xdt_ready'} = 1; # xdt is ready immediately
+	# the splitter goes on to the next part without waiting for us, so
+	# small parts are not held up by the main loop
+	$xdt->set_auto_parts(1);
+	$self->{'auto_parts'} = 1;
     } else {
 	$xdt = Amanda::Xfer::Dest::Taper::Cacher->new(
 	    $xdt_first_dev, $params{'max_memory'}, $part_size,
 	    $use_mem_cache, $disk_cache_dirname);
 	$self->{'xdt_ready'} = 1; # xdt is ready immediately
     }
+    # the DirectTCP element never sees the data
+    if ($dest_type ne 'directtcp' &&
+	$self->{'taperscan'}->{'storage'}->{'fixity_digest'}) {
+	$xdt->set_digest(1);
+    }
     $self->{'start_part_on_xdt_ready'} = 0;
     $self->{'xdt'} = $xdt;
 
@@ -799,6 +843,57 @@ sub start_dump {
     confess "no xfer dest set up; call get_xfer_dest first"
         unless defined $self->{'xdt'};
 
+    $self->_begin_dump(%params);
+}
+
+# copy the parts of a dump from src_device without an xfer: the device copies
+# each file, see Amanda::Device::copy_file_from.  The parts stay as they are
+# on the source, one file per part.
+sub copy_dump {
+    my $self = shift;
+    my %params = @_;
+
+    for my $rq_param (qw(src_device filenums dump_header dump_cb)) {
+	croak "required parameter '$rq_param' missing"
+	    unless exists $params{$rq_param};
+    }
+    confess "not yet started"
+	unless $self->{'write_timestamp'} and $self->{'started'};
+    confess "xfer already running"
+	if ($self->{'xfer'} or $self->{'xdt'});
+
+    $self->{'oldsize'} = 0;
+    $self->{'size'} = 0;
+    $self->{'crc_size'} = 0;
+    $self->{'server_crc'} = undef;
+    $self->{'digest'} = undef;
+    $self->{'duration'} = 0.0;
+    $self->{'nparts'} = 0;
+    $self->{'last_part_successful'} = 1;
+    $self->{'started_writing'} = 0;
+    $self->{'device_errors'} = [];
+    $self->{'config_denial_message'} = undef;
+    $self->{'image'} = undef;
+    $self->{'image_id'} = undef;
+    $self->{'copy'} = undef;
+    $self->{'retry_part_on_peom'} = 1;
+    $self->{'allow_split'} = 1;
+    $self->{'xdt_ready'} = 1;
+    $self->{'start_part_on_xdt_ready'} = 0;
+    $self->{'auto_parts'} = 0;
+
+    $self->{'copy_src'} = {
+	device => $params{'src_device'},
+	filenums => [ @{$params{'filenums'}} ],
+    };
+
+    $self->_begin_dump(%params, xfer => undef);
+}
+
+sub _begin_dump {
+    my $self = shift;
+    my %params = @_;
+
     # get the header ready for writing (totalparts was set by the caller)
     $self->{'dump_header'} = $params{'dump_header'};
     $self->{'dump_header'}->{'partnum'} = 1;
@@ -882,7 +977,7 @@ sub get_bytes_written {
 	$self->{'oldsize'} = $self->{'size'} + $self->{'xdt'}->get_part_bytes_written();
     } elsif ($self->{'crc_size'}) {
 	$self->{'oldsize'} = $self->{'crc_size'};
-    } elsif (defined $self->{'xfer'} && $self->{'size'}) {
+    } elsif ((defined $self->{'xfer'} || $self->{'copy_src'}) && $self->{'size'}) {
 	$self->{'oldsize'} = $self->{'size'};
     }
     return $self->{'oldsize'};
@@ -929,10 +1024,80 @@ sub _start_part {
     if (!defined ($self->{'nparts'}) or $self->{'nparts'} == 0) {
 	$self->{'feedback'}->scribe_ready();
     }
+    if ($self->{'copy_src'}) {
+	return $self->_copy_part();
+    }
     $self->{'xdt'}->start_part(!$self->{'last_part_successful'},
 			       $self->{'dump_header'});
 }
 
+# copy_dump's counterpart of xdt->start_part and _xmsg_part_done.  The device
+# writes nothing when the file does not fit, so the part is retried whole on
+# the next volume.
+sub _copy_part {
+    my $self = shift;
+    my $src_dev = $self->{'copy_src'}->{'device'};
+    my $partnum = $self->{'dump_header'}->{'partnum'};
+    my $filenum = $self->{'copy_src'}->{'filenums'}[$partnum - 1];
+    my $device = $self->{'device'};
+
+    if (!$src_dev->in_file or $src_dev->file != $filenum) {
+	my $hdr = $src_dev->seek_file($filenum);
+	if (!$hdr) {
+	    $self->{'last_part_successful'} = 0;
+	    return $self->_operation_failed(
+		input_error => $src_dev->error_or_status());
+	}
+    }
+
+    $self->dbg("copying file $filenum of the source as part $partnum");
+    my $start_time = time;
+    my $size = $device->copy_file_from($src_dev, $self->{'dump_header'});
+    my $duration = time - $start_time;
+
+    if ($device->status != $DEVICE_STATUS_SUCCESS) {
+	my $errmsg = $device->error_or_status();
+	# nothing was written; try the part on a new volume, unless this one
+	# was empty
+	if ($device->is_eom and $self->{'device_size'} > 0) {
+	    $self->dbg("no room for part $partnum: $errmsg");
+	    $device->finish();
+	    return $self->_get_new_volume();
+	}
+	$self->{'device_at_eom'} = 1 if $device->is_eom;
+	$self->{'last_part_successful'} = 0;
+	return $self->_operation_failed(device_error => $errmsg);
+    }
+
+    $self->{'started_writing'} = 1;
+    $self->{'feedback'}->scribe_notif_part_done(
+	partnum => $partnum,
+	fileno => $device->file,
+	successful => 1,
+	size => $size,
+	duration => $duration);
+    $self->{'copy'}->add_part($self->{'volume'}, $self->{'size'},
+	     $size, $device->file, $partnum, "OK", '') if $self->{'copy'};
+
+    $self->{'nparts'} = $partnum;
+    $self->{'device_size'} += $size;
+    $self->{'size'} += $size;
+    $self->{'duration'} += $duration;
+    $self->{'tape_good'} = 1;
+
+    if ($partnum == @{$self->{'copy_src'}->{'filenums'}}) {
+	$self->{'copy_src'} = undef;
+	return $self->_dump_done();
+    }
+
+    $self->{'dump_header'}->{'partnum'}++;
+    if ($device->is_eom) {
+	$device->finish();
+	return $self->_get_new_volume();
+    }
+    return $self->_start_part();
+}
+
 sub handle_xmsg {
     my $self = shift;
     my ($src, $msg, $xfer) = @_;
@@ -956,8 +1121,11 @@ sub handle_xmsg {
 	} elsif ($msg->{'type'} == $XMSG_CRC) {
 	    $self->{'crc_size'} = $msg->{'size'};
 	    $self->{'server_crc'} = "$msg->{'crc'}:$msg->{'size'}";
+	    $self->{'digest'} = $msg->{'digest'};
 	} elsif ($msg->{'type'} == $XMSG_NO_SPACE) {
 	    $self->_xmsg_no_space($src, $msg, $xfer);
+	} elsif ($msg->{'type'} == $XMSG_STATS) {
+	    $self->_maybe_start_lookahead();
 	}
     }
 }
@@ -987,7 +1155,7 @@ sub _xmsg_part_done {
 
 	$self->{'copy'}->add_part($self->{'volume'}, $self->{'size'},
 		 $msg->{'size'}, $msg->{'fileno'}, $msg->{'partnum'},
-		 $msg->{'successful'} ? "OK" : "PARTIAL", '');
+		 $msg->{'successful'} ? "OK" : "PARTIAL", '', $msg->{'digest'});
 	# increment nparts here, so empty parts are not counted
 	$self->{'nparts'} = $msg->{'partnum'};
     }
@@ -1002,6 +1170,8 @@ sub _xmsg_part_done {
     }
     $self->{'size'} = $self->{'crc_size'} if $self->{'crc_size'};
 
+    $self->_maybe_start_lookahead() if !$msg->{'eom'};
+
     if (!$msg->{'eof'}) {
 	# update the header for the next dumpfile, if this was a non-empty part
 	if ($msg->{'successful'} and $msg->{'size'} != 0) {
@@ -1054,12 +1224,33 @@ sub _xmsg_part_done {
 		return;
 	    }
 
-	    # no EOM -- go on to the next part
-	    $self->_start_part();
+	    # no EOM -- go on to the next part, unless the xdt already did
+	    $self->_start_part() if !$self->{'auto_parts'};
 	}
     }
 }
 
+# If the current volume is nearly full, have the DevHandling find and load the
+# next one now, while this one is still being written.
+sub _maybe_start_lookahead {
+    my $self = shift;
+
+    return if !$self->{'lookahead'} or $self->{'lookahead_started'};
+    return if !$self->{'device'} or $self->{'device_at_eom'};
+
+    my $capacity = $self->{'device'}->property_get("max_volume_usage");
+    return if !$capacity;
+
+    my $written = $self->{'device_size'};
+    $written += $self->{'xdt'}->get_part_bytes_written() if defined $self->{'xdt'};
+    return if $written < $capacity * $self->{'lookahead'};
+
+    $self->{'lookahead_started'} = 1;
+    $self->dbg("volume is " . int(100 * $written / $capacity) .
+	       "% full; looking ahead for the next volume");
+    $self->{'devhandling'}->start_lookahead();
+}
+
 sub _xmsg_ready {
     my $self = shift;
     my ($src, $msg, $xfer) = @_;
@@ -1215,16 +1406,19 @@ sub _dump_done {
 	duration => $self->{'duration'},
 	total_duration => $total_duration,
 	nparts => $self->{'nparts'},
-	server_crc => $self->{'server_crc'});
+	server_crc => $self->{'server_crc'},
+	digest => $self->{'digest'});
 
     # reset everything and let the original caller know we're done
     $self->{'xfer'} = undef;
     $self->{'xdt'} = undef;
+    $self->{'copy_src'} = undef;
     $self->{'dump_header'} = undef;
     $self->{'dump_cb'} = undef;
     $self->{'size'} = 0;
     $self->{'crc_size'} = 0;
     $self->{'server_crc'} = undef;
+    $self->{'digest'} = undef;
     $self->{'duration'} = 0.0;
     $self->{'nparts'} = undef;
     $self->{'dump_start_time'} = undef;
@@ -1411,11 +1605,13 @@ sub _volume_cb  {
 	$new_scribe->{'split_method'} = $self->{'split_method'};
 	$new_scribe->{'xfer'} = $self->{'xfer'};
 	$new_scribe->{'xdt'} = $self->{'xdt'};
+	$new_scribe->{'copy_src'} = $self->{'copy_src'};
 	$new_scribe->{'xdt_ready'} = $self->{'xdt_ready'};
 	$new_scribe->{'start_part_on_xdt_ready'} = $self->{'start_part_on_xdt_ready'};
 	$new_scribe->{'size'} = $self->{'size'};
 	$new_scribe->{'crc_size'} = $self->{'crc_size'};
 	$new_scribe->{'server_crc'} = $self->{'server_crc'};
+	$new_scribe->{'digest'} = $self->{'digest'};
 	$new_scribe->{'duration'} = $self->{'duration'};
 	$new_scribe->{'dump_start_time'} = $self->{'dump_start_time'};
 	$new_scribe->{'last_part_successful'} = $self->{'last_part_successful'};
@@ -1429,6 +1625,7 @@ sub _volume_cb  {
 	$self->{'dump_cb'} = undef;
 	$self->{'xfer'} = undef;
 	$self->{'xdt'} = undef;
+	$self->{'copy_src'} = undef;
 	$self->{'xdt_ready'} = undef;
 	$self->{'dump_start_time'} = undef;
 	$self->{'started_writing'} = 0;
@@ -1438,7 +1635,7 @@ sub _volume_cb  {
 	$self->{'copy'} = undef;
 
 	my $released_cb = make_cb(released_cb => sub {
-		if (defined $new_scribe->{'device'}) {
+		if (defined $new_scribe->{'device'} and $new_scribe->{'xdt'}) {
 		    $new_scribe->{'xdt'}->use_device($new_scribe->{'device'});
 		}
 		# start it
@@ -1471,6 +1668,7 @@ sub _volume_cb  {
     # for a new volume
     $self->{'reservation'} = $reservation;
     $self->{'device_size'} = 0;
+    $self->{'lookahead_started'} = 0;
     my $device = $self->{'device'} = $reservation->{'device'};
 
     # turn on verbose logging now, if we need it
@@ -1495,7 +1693,7 @@ sub _volume_cb  {
     }
 
     # inform the xdt about this new device before starting it
-    $self->{'xdt'}->use_device($device);
+    $self->{'xdt'}->use_device($device) if $self->{'xdt'};
 
     my $cbX = sub {};
     my $steps = define_steps
@@ -1914,7 +2112,11 @@ use Amanda::Debug qw( :logging );
 #
 # On start, the class starts scanning immediately, even though the scribe has
 # not requested a volume.  Subsequently, a new scan does not begin until the
-# scribe requests a volume.
+# scribe requests a volume, or asks for a look-ahead scan because its current
+# volume is nearly full.  A look-ahead scan runs while the scribe still holds
+# its reservation, so it is only attempted if the changer has more than one
+# drive, and a failed look-ahead is discarded rather than reported: the
+# regular scan will run when the volume is actually needed.
 #
 # This class is "private" to Amanda::Taper::Scribe, so it is documented in
 # comments, rather than POD.
@@ -1938,6 +2140,10 @@ sub new {
 	device => undef,
 	volume_label => undef,
 
+	# look-ahead scanning; multi_drive is undef until the changer is asked
+	lookahead => 0,
+	multi_drive => undef,
+
 	# requests for permissiont to use a new volume
 	request_pending => 0,
 	request_complete => 0,
@@ -2041,6 +2247,40 @@ sub start_scan {
     }
 }
 
+# Start scanning for the next volume before the scribe needs it.  This is a
+# no-op if a scan is already running or its result is waiting, or if the
+# changer cannot load a second volume.
+sub start_lookahead {
+    my $self = shift;
+
+    return if $self->{'scan_running'} or $self->{'scan_finished'}
+	   or $self->{'reservation'};
+
+    if (!defined $self->{'multi_drive'}) {
+	my $chg = $self->{'taperscan'}->{'changer'}
+		  || $self->{'taperscan'}->{'chg'};
+	if (!$chg) {
+	    $self->{'multi_drive'} = 0;
+	    return;
+	}
+	$chg->info(info => [ 'num_drives' ], info_cb => sub {
+	    my ($error, %results) = @_;
+
+	    $self->{'multi_drive'} = (!$error and $results{'num_drives'}
+				      and $results{'num_drives'} > 1)? 1 : 0;
+	    debug("taper: changer has " . ($results{'num_drives'} || 1) .
+		  " drive(s); look-ahead " .
+		  ($self->{'multi_drive'}? "enabled" : "disabled"));
+	    $self->start_lookahead() if $self->{'multi_drive'};
+	});
+	return;
+    }
+    return if !$self->{'multi_drive'};
+
+    $self->{'lookahead'} = 1;
+    $self->_start_scanning();
+}
+
 ## private methods
 
 sub _start_scanning {
@@ -2061,6 +2301,33 @@ sub _start_scanning {
 	my ($error, $reservation, $volume_label, $access_mode, $is_new) = @_;
 
 	$self->{'scan_running'} = 0;
+
+	# a look-ahead that found nothing is not an error yet; forget it and
+	# let the regular scan try again when the volume is needed
+	if ($self->{'lookahead'}) {
+	    $self->{'lookahead'} = 0;
+	    if ($error or !$reservation) {
+		debug("taper: look-ahead scan found no volume: " .
+		      ($error || "no reservation"));
+		if ($reservation) {
+		    $reservation->release(finished_cb => sub {});
+		}
+		# a changer that cannot load two volumes at once will keep failing
+		$self->{'multi_drive'} = 0
+		    if ref $error and $error->{'reason'}
+		       and $error->{'reason'} eq 'driveinuse';
+
+		# if the volume is already wanted, any START_SCAN arrived while
+		# the look-ahead was running, so scan for real now
+		$self->_start_scanning()
+		    if $self->{'volume_cb'} or $self->{'request_pending'}
+		       or $self->{'request_complete'};
+		return;
+	    }
+	    debug("taper: look-ahead loaded volume '" . ($volume_label || '') .
+		  "' in " . $reservation->{'device'}->device_name);
+	}
+
 	$self->{'scan_finished'} = 1;
 
 	$self->{'scan_error'} = $error;
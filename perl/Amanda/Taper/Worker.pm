@@ -42,6 +42,7 @@ use Carp;
 use POSIX qw( :errno_h );
 use Amanda::Changer;
 use Amanda::Config qw( :getconf config_dir_relative );
+use Amanda::Constants;
 use Amanda::Debug qw( :logging );
 use Amanda::Device qw( :constants );
 use Amanda::Header;
@@ -342,6 +343,28 @@ sub CLOSE_SOURCE_VOLUME {
     }) if defined $self->{'src'}->{'clerk'};
 }
 
+# The filter compressing a holding file the dumper left uncompressed for a DLE
+# with compress server deferred, or undef if it is not such a file.  It writes
+# what UNCOMPRESS_PATH reads, as the dumper would have; one thread, as the
+# driver counts one CPU for it.
+sub _deferred_compress_filter {
+    my $self = shift;
+    my ($filename) = @_;
+
+    my $hdr = Amanda::Holding::get_header($filename);
+    return undef if !defined $hdr or $hdr->{'compressed_by'} ne 'pending'
+		 or $hdr->{'compressed'} or $hdr->{'encrypted'};
+
+    Amanda::Debug::debug("compressing $hdr->{'name'}:$hdr->{'disk'} on the flush");
+    if ($Amanda::Constants::COMPRESS_SUFFIX eq '.gz' &&
+	Amanda::Xfer::Filter::Compress::supported("gzip")) {
+	return Amanda::Xfer::Filter::Compress->new("gzip", -2, 1);
+    }
+    return Amanda::Xfer::Filter::Process->new(
+		[ $Amanda::Constants::COMPRESS_PATH,
+		  $Amanda::Constants::COMPRESS_FAST_OPT ], 0, 0, 0, 0);
+}
+
 sub result_cb {
     my $self = shift;
     my %params = %{$self->{'dump_params'}};
@@ -366,7 +389,8 @@ sub result_cb {
 	}
     }
 
-    if ($self->{'source_server_crc'} ne '00000000:0' and
+    if (!$self->{'xfer_compress'} and
+	$self->{'source_server_crc'} ne '00000000:0' and
 	$self->{'dest_server_crc'} ne '00000000:0' and
 	$self->{'source_server_crc'} ne $self->{'dest_server_crc'}) {
 	if ($params{'result'} eq 'DONE') {
@@ -383,6 +407,10 @@ sub result_cb {
 	    push @{$self->{'input_errors'}}, "server crc ($self->{'server_crc'}) and source server crc ($self->{'source_server_crc'}) differ)";
 	}
     }
+    # the volume holds what the taper compressed
+    if ($self->{'xfer_compress'}) {
+	$self->{'server_crc'} = $self->{'dest_server_crc'};
+    }
     if ($self->{'server_crc'} eq '00000000:0') {
 	$self->{'server_crc'} = $self->{'dest_server_crc'};
     }
@@ -431,7 +459,8 @@ sub result_cb {
     my $result_calalog = $params{'result'};
     $result_calalog = "OK" if $result_calalog eq "DONE";
     $self->{'scribe'}->{'copy'}->finish_copy($params{'nparts'}, $kb, $params{'size'},
-                        $result_calalog, $params{'server_crc'}, $umsg) if $self->{'scribe'}->{'copy'};
+                        $result_calalog, $params{'server_crc'}, $umsg,
+			$params{'digest'}) if $self->{'scribe'}->{'copy'};
 
     # write a DONE/PARTIAL/FAIL log line
     if ($logtype == $L_FAIL) {
@@ -697,6 +726,118 @@ sub create_status_file {
     });
 }
 
+# tell amstatus how each element of the transfer is doing, by writing the
+# XMSG_STATS to the dump log
+sub report_xfer_stats {
+    my $self = shift;
+    my $msg = shift;
+
+    my $qdisk = Amanda::Util::quote_string($self->{'diskname'});
+    my $qhost = Amanda::Util::quote_string($self->{'hostname'});
+    my $qelt = Amanda::Util::quote_string($msg->{'elt'}->repr());
+    printf STDERR "taper: xfer stats %s %s %s %s %s in %s out %s " .
+		  "wait-upstream %.2f wait-downstream %.2f busy %.2f duration %.2f\n",
+		  $self->{'taper_name'}, $self->{'worker_name'}, $qhost, $qdisk,
+		  $qelt, $msg->{'bytes_in'}, $msg->{'bytes_out'},
+		  $msg->{'wait_upstream'}, $msg->{'wait_downstream'},
+		  $msg->{'busy'}, $msg->{'duration'};
+    $self->write_xfer_metrics($msg);
+
+    # the drive's own counters, for the devices that read them
+    return if !$self->{'xfer_dest'} || $msg->{'elt'} != $self->{'xfer_dest'};
+    my $dev = $self->{'scribe'}->get_device();
+    return if !$dev;
+    my $from_host = $dev->property_get("drive_bytes_from_host");
+    return if !defined $from_host;
+    my $to_medium = $dev->property_get("drive_bytes_to_medium");
+    my $rate = $dev->property_get("compression_rate");
+    my $rewrites = $dev->property_get("drive_write_rewrites");
+    my $errors = $dev->property_get("drive_write_errors");
+    printf STDERR "taper: drive stats %s %s %s %s from-host %s to-medium %s " .
+		  "compression %s rewrites %s errors %s\n",
+		  $self->{'taper_name'}, $self->{'worker_name'}, $qhost, $qdisk,
+		  $from_host,
+		  defined $to_medium? $to_medium : "-",
+		  defined $rate? sprintf("%.3f", $rate) : "-",
+		  defined $rewrites? $rewrites : "-",
+		  defined $errors? $errors : "-";
+}
+
+# the last XMSG_STATS of each element of each worker, for the metrics-dir
+my %xfer_metrics;
+
+my @xfer_metrics = (
+    [ 'bytes_in', 'amanda_taper_xfer_bytes_in',
+      'Bytes received from upstream by an element of the current transfer.' ],
+    [ 'bytes_out', 'amanda_taper_xfer_bytes_out',
+      'Bytes handed downstream by an element of the current transfer.' ],
+    [ 'wait_upstream', 'amanda_taper_xfer_wait_upstream_seconds',
+      'Time an element of the current transfer waited for upstream.' ],
+    [ 'wait_downstream', 'amanda_taper_xfer_wait_downstream_seconds',
+      'Time an element of the current transfer waited for downstream.' ],
+    [ 'busy', 'amanda_taper_xfer_busy_seconds',
+      'Time an element of the current transfer spent in its own work.' ],
+    [ 'duration', 'amanda_taper_xfer_duration_seconds',
+      'Time since the current transfer started.' ],
+);
+
+sub metric_label {
+    my $value = shift;
+
+    $value =~ s/([\\"])/\\$1/g;
+    $value =~ s/\n/\\n/g;
+    return "\"$value\"";
+}
+
+# write the per-element statistics of the transfers to the metrics-dir, in the
+# Prometheus text format
+sub write_xfer_metrics {
+    my $self = shift;
+    my $msg = shift;
+
+    my $metrics_dir = getconf($CNF_METRICS_DIR);
+    return if !$metrics_dir;
+
+    my $element = ref $msg->{'elt'};
+    $element =~ s/^Amanda::Xfer:://;
+    $xfer_metrics{$self->{'taper_name'}}{$self->{'worker_name'}}{$element} =
+	{ map { $_ => $msg->{$_} } map { $_->[0] } @xfer_metrics };
+
+    my $config = metric_label(Amanda::Config::get_config_name());
+    my $text = '';
+    for my $metric (@xfer_metrics) {
+	my ($key, $name, $help) = @$metric;
+	$text .= "# HELP $name $help\n# TYPE $name gauge\n";
+	for my $taper (sort keys %xfer_metrics) {
+	    for my $worker (sort keys %{$xfer_metrics{$taper}}) {
+		my $elts = $xfer_metrics{$taper}{$worker};
+		for my $elt (sort keys %$elts) {
+		    $text .= sprintf("%s{config=%s,taper=%s,worker=%s,element=%s} %s\n",
+				     $name, $config, metric_label($taper),
+				     metric_label($worker), metric_label($elt),
+				     $elts->{$elt}->{$key});
+		}
+	    }
+	}
+    }
+
+    # replace the file atomically, so that the collector never reads half
+    # of it
+    my $filename = "$metrics_dir/amanda-" . Amanda::Config::get_config_name() .
+		   "-taper.prom";
+    my $tmp_filename = "$filename.$$.tmp";
+    my $fh;
+    if (!open($fh, ">", $tmp_filename)) {
+	debug("Can't create metrics file '$tmp_filename': $!");
+	return;
+    }
+    my $ok = print $fh $text;
+    if (!close($fh) || !$ok || !rename($tmp_filename, $filename)) {
+	debug("Can't write metrics file '$filename': $!");
+	unlink($tmp_filename);
+    }
+}
+
 sub send_port_and_get_header {
     my $self = shift;
     my ($finished_cb) = @_;
@@ -864,6 +1005,7 @@ sub setup_and_start_dump {
 	$self->{'server_crc'} = undef;
 	$self->{'source_server_crc'} = undef;
 	$self->{'dest_server_crc'} = undef;
+	$self->{'xfer_compress'} = undef;
 	$self->{'input_errors'} = [];
 
 	$steps->{'process_args'}->();
@@ -1059,6 +1201,8 @@ sub setup_and_start_dump {
 	    $self->{'xfer_source'} = Amanda::Xfer::Source::ShmRing->new();
 	} elsif ($msgtype eq Amanda::Taper::Protocol::FILE_WRITE) {
 	    $self->{'xfer_source'} = Amanda::Xfer::Source::Holding->new($params{'filename'});
+	    $self->{'xfer_compress'} = $self->_deferred_compress_filter($params{'filename'})
+		if defined $params{'compress'} and $params{'compress'} eq 'fast';
 	} elsif ($msgtype eq Amanda::Taper::Protocol::VAULT_WRITE) {
 	    my $dump = $self->{'src'}->{'plan'}->shift_dump();
 	    return $self->{'src'}->{'clerk'}->get_xfer_src(
@@ -1105,10 +1249,18 @@ sub setup_and_start_dump {
     step make_xfer_2 => sub {
         $self->{'xfer_dest'} = $self->{'scribe'}->get_xfer_dest(%get_xfer_dest_args);
 
-        $self->{'xfer'} = Amanda::Xfer->new([$self->{'xfer_source'}, $self->{'xfer_dest'}]);
+        $self->{'xfer'} = Amanda::Xfer->new([$self->{'xfer_source'},
+		$self->{'xfer_compress'} ? ($self->{'xfer_compress'}) : (),
+		$self->{'xfer_dest'}]);
+	$self->{'xfer'}->set_stats_interval(10);
         $self->{'xfer'}->start(sub {
 	    my ($src, $msg, $xfer) = @_;
 
+	    if ($msg->{'type'} == $XMSG_STATS) {
+		$self->report_xfer_stats($msg);
+		return;
+	    }
+
 	    if ($msg->{'type'} == $XMSG_CRC) {
 		if ($msg->{'elt'} == $self->{'xfer_source'}) {
 		    $self->{'source_server_crc'} = $msg->{'crc'}.":".$msg->{'size'};
@@ -1163,6 +1315,18 @@ sub setup_and_start_dump {
 		$self->{'dumper_status'} = "DONE";
 	    }
 
+	    # a compress server deferred dump is compressed here, or not at all
+	    if ($self->{'xfer_compress'}) {
+		$hdr->{'compressed'} = 1;
+		$hdr->{'comp_suffix'} = $Amanda::Constants::COMPRESS_SUFFIX;
+		$hdr->{'uncompress_cmd'} = " $Amanda::Constants::UNCOMPRESS_PATH $Amanda::Constants::UNCOMPRESS_OPT |";
+		$hdr->{'compressed_by'} = 'taper';
+		# the crc of the holding file is not the crc of what is written
+		$hdr->{'server_crc'} = '00000000:0';
+	    } elsif ($hdr->{'compressed_by'} eq 'pending') {
+		$hdr->{'compressed_by'} = '';
+	    }
+
 	    $self->{'xfer_source'}->start_recovery();
 	    $steps->{'start_dump'}->(undef);
 	} elsif ($msgtype eq Amanda::Taper::Protocol::PORT_WRITE ||
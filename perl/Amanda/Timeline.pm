@@ -0,0 +1,441 @@
+# Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+# for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+#
+# Contact information: Carbonite Inc., 756 N Pastoria Ave
+# Sunnyvale, CA 94085, or: http://www.zmanda.com
+
+package Amanda::Timeline;
+
+=head1 NAME
+
+Amanda::Timeline -- the timeline of an amdump run, in Chrome trace format
+
+=head1 SYNOPSIS
+
+  use Amanda::Timeline;
+
+  my $timeline = Amanda::Timeline->new(filename => $amdump_log);
+  my $err = $timeline->write_chrome_trace($trace_file);
+  die $err if defined $err;
+
+=head1 DESCRIPTION
+
+This package reads an amdump log, the debug output of the planner and the
+driver, and builds the timeline of the run.  It is written in the Chrome
+trace event format, in JSON, that C<chrome://tracing> and the Perfetto UI
+display.
+
+Each DLE has a track, with a span for each of its phases:
+
+  estimate       the planner asks the client for its estimates
+  queued         the schedule is known, the dump is not started
+  dumping        a dumper runs the dump
+  chunking       a chunker writes the dump to the holding disk
+  holding wait   the chunker waits for more holding disk space
+  taper write    a taper worker writes the dump or flushes it
+
+The dumpers, the chunkers and the taper workers also have a track each,
+with a span for each dump they handle, and there are counter tracks for the
+free holding disk space, the free network bandwidth, the number of active
+dumpers and the throughput of each taper worker.
+
+The times are those of the log, in seconds since the start of the planner and
+the driver, which are started together.
+
+=head1 INTERFACE
+
+=over
+
+=item C<new(filename =E<gt> $amdump_log)>
+
+Create the timeline of the given amdump log.
+
+=item C<chrome_trace()>
+
+Parse the log and return the trace, a hash ready to be encoded in JSON.  It
+returns a string if the log can't be read.
+
+=item C<write_chrome_trace($trace_file)>
+
+Write the trace to the file, undef or "-" for the standard output.  It returns
+undef on success, or an error message.
+
+=back
+
+=cut
+
+use strict;
+use warnings;
+use JSON;
+use Amanda::Util;
+
+# track groups, the pid of their events
+my $PID_COUNTERS  = 0;
+my $PID_DLES      = 1;
+my $PID_DUMPERS   = 2;
+my $PID_CHUNKERS  = 3;
+my $PID_TAPERS    = 4;
+
+my %process_names = (
+    $PID_COUNTERS => "counters",
+    $PID_DLES     => "DLEs",
+    $PID_DUMPERS  => "dumpers",
+    $PID_CHUNKERS => "chunkers",
+    $PID_TAPERS   => "taper workers",
+);
+
+sub new {
+    my $class = shift;
+    my %params = @_;
+
+    my $self = bless {
+	filename => $params{'filename'},
+    }, $class;
+
+    return $self;
+}
+
+# seconds to trace microseconds
+sub _us {
+    my ($time) = @_;
+
+    return int($time * 1000000 + 0.5);
+}
+
+# the tid of a track in a group, created on first use
+sub _tid {
+    my $self = shift;
+    my ($pid, $name) = @_;
+
+    my $tracks = $self->{'tracks'}->{$pid} ||= {};
+    if (!defined $tracks->{$name}) {
+	$tracks->{$name} = scalar(keys %$tracks) + 1;
+	push @{$self->{'events'}}, {
+	    name => 'thread_name', ph => 'M', pid => $pid,
+	    tid => $tracks->{$name}, args => { name => $name } };
+    }
+
+    return $tracks->{$name};
+}
+
+sub _begin {
+    my $self = shift;
+    my ($key, $pid, $track, $name, $time, $args) = @_;
+
+    $self->_end($key, $time) if exists $self->{'open'}->{$key};
+    $self->{'open'}->{$key} = {
+	pid => $pid, track => $track, name => $name, time => $time,
+	args => $args || {} };
+}
+
+sub _end {
+    my $self = shift;
+    my ($key, $time, $args) = @_;
+
+    my $span = delete $self->{'open'}->{$key};
+    return if !defined $span;
+
+    my %args = (%{$span->{'args'}}, %{$args || {}});
+    push @{$self->{'events'}}, {
+	name => $span->{'name'}, ph => 'X', pid => $span->{'pid'},
+	tid => $self->_tid($span->{'pid'}, $span->{'track'}),
+	ts => _us($span->{'time'}),
+	dur => _us($time) - _us($span->{'time'}),
+	args => \%args };
+}
+
+sub _counter {
+    my $self = shift;
+    my ($name, $time, $args) = @_;
+
+    push @{$self->{'events'}}, {
+	name => $name, ph => 'C', pid => $PID_COUNTERS,
+	ts => _us($time), args => $args };
+}
+
+# a DLE starts one of its dumps or writes: it leaves the queue
+sub _dle_start {
+    my $self = shift;
+    my ($dle, $time) = @_;
+
+    if (!$self->{'started'}->{$dle}) {
+	$self->{'started'}->{$dle} = 1;
+	$self->_end("queued $dle", $time);
+    }
+}
+
+sub _dumper_count {
+    my $self = shift;
+    my ($delta, $time) = @_;
+
+    $self->{'active_dumpers'} += $delta;
+    $self->_counter('active dumpers', $time,
+		    { active => $self->{'active_dumpers'} });
+}
+
+sub _parse_line {
+    my $self = shift;
+    my ($line) = @_;
+
+    chomp $line;
+    $line =~ s/[:\s]+$//g;
+    my @line = Amanda::Util::split_quoted_strings_for_amstatus($line);
+    return if !defined $line[0];
+
+    if ($line[0] eq 'planner' && defined $line[1] && $line[1] eq 'time') {
+	my $time = $line[2];
+	$self->{'time'} = $time;
+	if ($line[3] eq 'setting' && $line[4] eq 'up' &&
+	    $line[5] eq 'estimates' && $line[6] eq 'for') {
+	    #7:host 8:disk
+	    my $dle = "$line[7]:$line[8]";
+	    $self->_begin("estimate $dle", $PID_DLES, $dle, 'estimate', $time);
+	} elsif ($line[3] eq 'got' && $line[4] eq 'result') {
+	    #7:host 9:disk
+	    my $dle = "$line[7]:$line[9]";
+	    $self->_end("estimate $dle", $time);
+	} elsif ($line[3] eq 'got' && $line[4] eq 'partial') {
+	    #8:host 10:disk
+	    my $dle = "$line[8]:$line[10]";
+	    $self->_end("estimate $dle", $time, { partial => 1 });
+	}
+	return;
+    }
+
+    if ($line[0] eq 'GENERATING' && defined $line[1] &&
+	$line[1] eq 'SCHEDULE') {
+	$self->{'schedule'} = 1;
+	return;
+    } elsif ($line[0] eq '--------') {
+	$self->{'schedule'}++ if $self->{'schedule'};
+	return;
+    } elsif ($line[0] eq 'DUMP' && defined $line[3] &&
+	     $self->{'schedule'} == 2) {
+	#1:host 2:features 3:disk
+	push @{$self->{'scheduled'}}, "$line[1]:$line[3]";
+	return;
+    }
+
+    return if $line[0] ne 'driver' || !defined $line[2] || $line[2] ne 'time';
+    my $time = $line[3];
+    $self->{'time'} = $time;
+
+    if ($line[1] eq 'start') {
+	# the schedule is complete, the estimates are done
+	for my $key (grep { /^estimate / } keys %{$self->{'open'}}) {
+	    $self->_end($key, $time, { unfinished => 1 });
+	}
+	for my $dle (@{$self->{'scheduled'}}) {
+	    $self->_begin("queued $dle", $PID_DLES, $dle, 'queued', $time)
+		if !$self->{'started'}->{$dle};
+	}
+	$self->{'scheduled'} = [];
+	for (my $i = 4; $i < $#line; $i++) {
+	    $self->{'bandwidth'} = $line[$i+1] if $line[$i] eq 'bandwidth';
+	}
+    } elsif ($line[1] eq 'state') {
+	#6:free-kps 8:free-space 12:idle-dumpers
+	$self->_counter('holding disk', $time, { free => $line[8] + 0 });
+	if (defined $self->{'bandwidth'}) {
+	    $self->_counter('network', $time,
+			    { used_kps => $self->{'bandwidth'} - $line[6] });
+	} else {
+	    $self->_counter('network', $time, { free_kps => $line[6] + 0 });
+	}
+    } elsif ($line[1] eq 'send-cmd') {
+	$self->_parse_send_cmd($time, @line);
+    } elsif ($line[1] eq 'result') {
+	$self->_parse_result($time, @line);
+    }
+}
+
+sub _parse_send_cmd {
+    my $self = shift;
+    my ($time, @line) = @_;
+    my $process = $line[5];
+    my $cmd = $line[6];
+
+    if ($process =~ /^dumper\d+$/) {
+	if ($cmd eq 'PORT-DUMP' || $cmd eq 'SHM-DUMP') {
+	    #7:handle 11:host 13:disk 15:level
+	    my $serial = $line[7];
+	    my $dle = "$line[11]:$line[13]";
+	    $self->_dle_start($dle, $time);
+	    $self->{'dumper_serial'}->{$process} = $serial;
+	    $self->_begin("dumping $serial", $PID_DLES, $dle, 'dumping', $time,
+			  { dumper => $process, level => $line[15] });
+	    $self->_begin("dumper $serial", $PID_DUMPERS, $process, $dle, $time,
+			  { level => $line[15] });
+	    $self->_dumper_count(1, $time);
+	}
+    } elsif ($process =~ /^chunker\d+$/) {
+	if ($cmd eq 'PORT-WRITE' || $cmd eq 'SHM-WRITE') {
+	    #7:handle 8:filename 9:host 11:disk 12:level
+	    my $serial = $line[7];
+	    my $dle = "$line[9]:$line[11]";
+	    $self->_dle_start($dle, $time);
+	    $self->{'serial_dle'}->{$serial} = $dle;
+	    $self->{'chunker_serial'}->{$process} = $serial;
+	    $self->_begin("chunking $serial", $PID_DLES, $dle, 'chunking', $time,
+			  { chunker => $process, level => $line[12] });
+	    $self->_begin("chunker $serial", $PID_CHUNKERS, $process, $dle,
+			  $time, { level => $line[12] });
+	} elsif ($cmd eq 'CONTINUE' || $cmd eq 'ABORT') {
+	    #7:handle
+	    $self->_end("holding wait $line[7]", $time);
+	}
+    } elsif ($process =~ /^taper/) {
+	my ($worker, $serial, $dle);
+	if ($cmd eq 'FILE-WRITE') {
+	    #7:worker 8:handle 9:filename 10:host 11:disk 12:level
+	    ($worker, $serial, $dle) = ($line[7], $line[8], "$line[10]:$line[11]");
+	} elsif ($cmd eq 'PORT-WRITE' || $cmd eq 'SHM-WRITE') {
+	    #7:worker 8:handle 9:host 10:disk 11:level
+	    ($worker, $serial, $dle) = ($line[7], $line[8], "$line[9]:$line[10]");
+	} elsif ($cmd eq 'VAULT-WRITE') {
+	    #7:worker 8:handle 9:src_storage 10:src_pool 11:src_label 12:host 13:disk
+	    ($worker, $serial, $dle) = ($line[7], $line[8], "$line[12]:$line[13]");
+	} else {
+	    return;
+	}
+	$self->_dle_start($dle, $time);
+	$self->{'worker_serial'}->{$worker} = $serial;
+	$self->_begin("taper write $serial", $PID_DLES, $dle, 'taper write',
+		      $time, { worker => "$process $worker", command => $cmd });
+	$self->_begin("taper $serial", $PID_TAPERS, "$process $worker", $dle,
+		      $time, { command => $cmd });
+    }
+}
+
+sub _parse_result {
+    my $self = shift;
+    my ($time, @line) = @_;
+    my $process = $line[5];
+    my $result = $line[6];
+
+    if ($process =~ /^dumper\d+$/) {
+	my $serial = $result eq '(eof)' ? $self->{'dumper_serial'}->{$process}
+					 : $line[7];
+	return if !defined $serial;
+	if ($result eq 'DONE' || $result eq 'FAILED' ||
+	    $result eq 'TRY-AGAIN' || $result eq '(eof)') {
+	    #7:handle
+	    if (exists $self->{'open'}->{"dumper $serial"}) {
+		$self->_end("dumping $serial", $time, { result => $result });
+		$self->_end("dumper $serial", $time, { result => $result });
+		$self->_dumper_count(-1, $time);
+	    }
+	    delete $self->{'dumper_serial'}->{$process};
+	}
+    } elsif ($process =~ /^chunker\d+$/) {
+	my $serial = $result eq '(eof)' ? $self->{'chunker_serial'}->{$process}
+					 : $line[7];
+	return if !defined $serial;
+	if ($result eq 'RQ-MORE-DISK') {
+	    #7:handle
+	    my $dle = $self->{'serial_dle'}->{$serial};
+	    $self->_begin("holding wait $serial", $PID_DLES, $dle,
+			  'holding wait', $time) if defined $dle;
+	} elsif ($result eq 'DONE' || $result eq 'PARTIAL' ||
+		 $result eq 'FAILED' || $result eq 'ABORT-FINISHED' ||
+		 $result eq '(eof)') {
+	    #7:handle
+	    $self->_end("holding wait $serial", $time);
+	    $self->_end("chunking $serial", $time, { result => $result });
+	    $self->_end("chunker $serial", $time, { result => $result });
+	    delete $self->{'serial_dle'}->{$serial};
+	    delete $self->{'chunker_serial'}->{$process};
+	}
+    } elsif ($process =~ /^taper/) {
+	#7:worker 8:handle
+	my $worker = $line[7];
+	return if !defined $worker;
+	if ($result eq 'PARTDONE') {
+	    #11:ksize 12:errstr
+	    if (defined $line[12] && $line[12] =~ /kps (\S+)/) {
+		$self->_counter("$process $worker", $time, { kps => $1 + 0 });
+	    }
+	} elsif ($result eq 'DONE' || $result eq 'PARTIAL' ||
+		 $result eq 'FAILED') {
+	    my $serial = $line[8];
+	    $self->_end("taper write $serial", $time, { result => $result });
+	    $self->_end("taper $serial", $time, { result => $result });
+	    $self->_counter("$process $worker", $time, { kps => 0 });
+	    delete $self->{'worker_serial'}->{$worker};
+	}
+    }
+}
+
+sub chrome_trace {
+    my $self = shift;
+
+    my $fd;
+    if (!open($fd, "<", $self->{'filename'})) {
+	return "can't open '$self->{'filename'}': $!";
+    }
+
+    $self->{'events'} = [];
+    $self->{'tracks'} = {};
+    $self->{'open'} = {};
+    $self->{'started'} = {};
+    $self->{'scheduled'} = [];
+    $self->{'schedule'} = 0;
+    $self->{'active_dumpers'} = 0;
+    $self->{'time'} = 0;
+
+    while (my $line = <$fd>) {
+	$self->_parse_line($line);
+    }
+    close($fd);
+
+    # the spans still open at the end of the log end with it
+    for my $key (sort keys %{$self->{'open'}}) {
+	$self->_end($key, $self->{'time'}, { unfinished => 1 });
+    }
+
+    my @metadata = map { {
+	name => 'process_name', ph => 'M', pid => $_ + 0,
+	args => { name => $process_names{$_} } } } sort keys %process_names;
+
+    return {
+	traceEvents => [ @metadata, @{$self->{'events'}} ],
+	displayTimeUnit => 'ms',
+	otherData => { amdump_log => $self->{'filename'} },
+    };
+}
+
+sub write_chrome_trace {
+    my $self = shift;
+    my ($trace_file) = @_;
+
+    my $trace = $self->chrome_trace();
+    return $trace if !ref $trace;
+
+    my $fh;
+    if (!defined $trace_file || $trace_file eq '-') {
+	$fh = \*STDOUT;
+    } elsif (!open($fh, ">", $trace_file)) {
+	return "can't write '$trace_file': $!";
+    }
+    print $fh JSON->new->canonical->encode($trace), "\n";
+    if ($fh != \*STDOUT && !close($fh)) {
+	return "can't write '$trace_file': $!";
+    }
+
+    return undef;
+}
+
+1;
@@ -296,28 +296,33 @@ sub roll_amdump_logs {
 
 sub create_status_file {
     my $self = shift;
+    my ($stream) = @_;
 
     # create temporary file
-    ($self->{status_fh}, $self->{status_filename}) =
+    ($stream->{status_fh}, $stream->{status_filename}) =
 	File::Temp::tempfile("taper_status_file_XXXXXX",
 				DIR => $Amanda::Paths::AMANDA_TMPDIR,
 				UNLINK => 1);
 
     # tell amstatus about it by writing it to the dump log
-    $self->amdump_log("status file $self->{'id'}:" .  "$self->{status_filename}");
-    print {$self->{status_fh}} "0";
+    $self->amdump_log("status file $stream->{'current'}->{'id'}:" .  "$stream->{status_filename}");
+    print {$stream->{status_fh}} "0";
 
     # create timer callback, firing every 'delay' ms (as specified by caller
     # when this Vault was created))
     if (!$self->{'timer'}) {
 	$self->{timer} = Amanda::MainLoop::timeout_source($self->{'delay'});
 	$self->{timer}->set_callback(sub {
-	    if ($self->{'dst'}{scribe}) {
-		my $size = $self->{'dst'}->{scribe}->get_bytes_written();
-		seek $self->{status_fh}, 0, 0;
-		print {$self->{status_fh}} $size, '     ';
-		$self->{status_fh}->flush();
-
+	    my $size = 0;
+	    for my $stream (@{$self->{'streams'}}) {
+		next if !$stream->{'status_fh'};
+		my $written = $stream->{'scribe'}->get_bytes_written();
+		seek $stream->{status_fh}, 0, 0;
+		print {$stream->{status_fh}} $written, '     ';
+		$stream->{status_fh}->flush();
+		$size += $written;
+	    }
+	    if (@{$self->{'streams'}}) {
 		# print progress message if we're running on a tty,
 		# unless --quiet option was given.
 		if ($self->{'is_tty'} && !$self->{'quiet'}) {
@@ -422,18 +427,9 @@ sub setup_src {
 
     $src->{'seen_labels'} = {};
 
+    # the clerks are created with the streams, once the plan is known
     $src->{'interactivity'} = $self->{'interactivity'};
 
-    $src->{'scan'} = Amanda::Recovery::Scan->new(
-	    chg => $src->{'chg'},
-	    interactivity => $src->{'interactivity'});
-
-    $src->{'clerk'} = Amanda::Recovery::Clerk->new(
-	    changer => $src->{'chg'},
-	    feedback => $self,
-	    scan => $src->{'scan'});
-    $self->{'cleanup'}{'quit_clerk'} = 1;
-
     # translate "latest" into the most recent timestamp that wasn't created by amvault
     if (defined $self->{'src_write_timestamp'} && $self->{'src_write_timestamp'} eq "latest") {
 	my $ts = $self->{'src_write_timestamp'} =
@@ -693,7 +689,6 @@ sub setup_dst {
     my $self = shift;
     my $dst = $self->{'dst'} = {};
 
-    $dst->{'label'} = undef;
     $dst->{'tape_num'} = 0;
 
     my $vault_storages = getconf($CNF_VAULT_STORAGE);
@@ -724,36 +719,83 @@ sub setup_dst {
 	interactivity => $interactivity,
 	catalog  => $self->{'catalog'});
 
-    $dst->{'scribe'} = Amanda::Taper::Scribe->new(
-	taperscan => $dst->{'scan'},
-	feedback => $self,
-	catalog  => $self->{'catalog'});
+    $self->start_streams();
+}
 
-    $dst->{'scribe'}->start(
-	write_timestamp => $self->{'dst_write_timestamp'},
-	finished_cb => sub { $self->scribe_started(@_); })
+# The dumps are copied by streams, each with its own clerk and scribe; the
+# scribes share the taperscan of the destination, like the workers of the
+# taper.  There are as many streams as the taper-parallel-write of the
+# destination storage, and the plan is split so that a source volume is only
+# read by one stream.
+sub start_streams {
+    my $self = shift;
+    my $src = $self->{'src'};
+    my $dst = $self->{'dst'};
+
+    my $n_streams = $dst->{'storage'}->{'taper_parallel_write'} || 1;
+    my @plans = ($src->{'plan'});
+    @plans = $src->{'plan'}->split_plan($n_streams) if $n_streams > 1;
+
+    $self->{'streams'} = [];
+    my $starting = @plans;
+    my $start_err;
+    for my $plan (@plans) {
+	my $stream = Amanda::Vault::Stream->new($self, $plan);
+	push @{$self->{'streams'}}, $stream;
+
+	my $scan = Amanda::Recovery::Scan->new(
+		chg => $src->{'chg'},
+		interactivity => $src->{'interactivity'});
+	$stream->{'clerk'} = Amanda::Recovery::Clerk->new(
+		changer => $src->{'chg'},
+		feedback => $stream,
+		scan => $scan);
+	$self->{'cleanup'}{'quit_clerk'} = 1;
+
+	$stream->{'scribe'} = Amanda::Taper::Scribe->new(
+		taperscan => $dst->{'scan'},
+		feedback => $stream,
+		catalog  => $self->{'catalog'});
+	$stream->{'scribe'}->start(
+		write_timestamp => $self->{'dst_write_timestamp'},
+		finished_cb => sub {
+		    my ($err) = @_;
+		    if ($err) {
+			$start_err = $err if !$start_err;
+		    } else {
+			$stream->{'started'} = 1;
+		    }
+		    $self->scribes_started($start_err) if --$starting == 0;
+		});
+    }
 }
 
-sub scribe_started {
+sub scribes_started {
     my $self = shift;
     my ($err) = @_;
 
-    return $self->failure($err) if $err;
-
     $self->{'cleanup'}{'quit_scribe'} = 1;
 
+    return $self->failure($err) if $err;
+
+    my $running = @{$self->{'streams'}};
+    my $xfer_err;
     my $xfers_finished = sub {
 	my ($err) = @_;
-	return $self->failure($err) if $err;
+	$xfer_err = $err if $err and !$xfer_err;
+	return if --$running;
+	return $self->failure($xfer_err) if $xfer_err;
 	$self->quit(0);
     };
 
-    $self->xfer_dumps($xfers_finished);
+    for my $stream (@{$self->{'streams'}}) {
+	$self->xfer_dumps($stream, $xfers_finished);
+    }
 }
 
 sub xfer_dumps {
     my $self = shift;
-    my ($finished_cb) = @_;
+    my ($stream, $finished_cb) = @_;
 
     my $src = $self->{'src'};
     my $dst = $self->{'dst'};
@@ -765,7 +807,8 @@ sub xfer_dumps {
 
     step get_dump => sub {
 	# reset tracking for the current dump
-	$self->{'current'} = $current = {
+	$stream->{'current'} = $current = {
+	    id => undef,
 	    src_result => undef,
 	    src_errors => undef,
 
@@ -780,7 +823,7 @@ sub xfer_dumps {
 	    dump => undef,
 	};
 
-	my $dump = $src->{'plan'}->shift_dump();
+	my $dump = $stream->{'plan'}->shift_dump();
 	if (!$dump) {
 	    return $finished_cb->();
 	}
@@ -791,7 +834,7 @@ sub xfer_dumps {
     };
 
     step get_xfer_src => sub {
-	$src->{'clerk'}->get_xfer_src(
+	$stream->{'clerk'}->get_xfer_src(
 	    dump => $current->{'dump'},
 	    xfer_src_cb => $steps->{'got_xfer_src'})
     };
@@ -818,6 +861,12 @@ sub xfer_dumps {
 
 	$current->{'header'} = $header;
 
+	# the storage can copy the parts itself, without them going through us
+	my $copy_src_dev = $self->_copy_source_device($stream, $current->{'dump'});
+	if ($copy_src_dev) {
+	    return $steps->{'copy_dump'}->($copy_src_dev);
+	}
+
 	# set up splitting args from the tapetype only, since we have no DLEs
 	my $tt = $self->{'dst'}->{'storage'}->{'tapetype'};
 	sub empty2undef { $_[0]? $_[0] : undef }
@@ -827,7 +876,7 @@ sub xfer_dumps {
 	if (defined $dle) {
 	    $dle_allow_split = dumptype_getconf($dle->{'config'}, $DUMPTYPE_ALLOW_SPLIT);
 	}
-	my $xdt_first_dev = $dst->{'scribe'}->get_device();
+	my $xdt_first_dev = $stream->{'scribe'}->get_device();
 	if (!defined $xdt_first_dev) {
 	    return $finished_cb->("no device is available to create an xfer_dest");
 	}
@@ -852,15 +901,15 @@ sub xfer_dumps {
 		dle_allow_split => $dle_allow_split,
 		leom_supported => $leom_supported);
 	}
-	$xfer_dst = $dst->{'scribe'}->get_xfer_dest(
+	$xfer_dst = $stream->{'scribe'}->get_xfer_dest(
 	    max_memory => $self->{'dst'}->{'storage'}->{'device_output_buffer_size'},
 	    can_cache_inform => 0,
 	    %xfer_dest_args,
 	);
 
-	$self->{'id'}++;
-	$self->amdump_log("Vaulting $self->{'id'} $header->{'name'} ".quote_string($header->{'disk'})." $header->{'datestamp'} $header->{'dumplevel'} from storage $src->{'storage'}->{'storage_name'} to storage $dst->{'storage'}->{'storage_name'}");
-	$self->create_status_file();
+	$current->{'id'} = ++$self->{'id'};
+	$self->amdump_log("Vaulting $current->{'id'} $header->{'name'} ".quote_string($header->{'disk'})." $header->{'datestamp'} $header->{'dumplevel'} from storage $src->{'storage'}->{'storage_name'} to storage $dst->{'storage'}->{'storage_name'}");
+	$self->create_status_file($stream);
 
 	# create and start the transfer
 	$xfer = Amanda::Xfer->new([ $xfer_src, $xfer_dst ]);
@@ -873,19 +922,44 @@ sub xfer_dumps {
 	$n_threads = 2;
 
 	# and let both the scribe and the clerk know that data is in motion
-	$src->{'clerk'}->start_recovery(
+	$stream->{'clerk'}->start_recovery(
 	    xfer => $xfer,
 	    recovery_cb => $steps->{'recovery_cb'});
-	$dst->{'scribe'}->start_dump(
+	$stream->{'scribe'}->start_dump(
 	    xfer => $xfer,
 	    dump_header => $header,
 	    dump_cb => $steps->{'dump_cb'});
     };
 
+    step copy_dump => sub {
+	my ($src_dev) = @_;
+	my $header = $current->{'header'};
+	my $dump = $current->{'dump'};
+
+	$current->{'id'} = ++$self->{'id'};
+	$self->amdump_log("Vaulting $current->{'id'} $header->{'name'} ".quote_string($header->{'disk'})." $header->{'datestamp'} $header->{'dumplevel'} from storage $src->{'storage'}->{'storage_name'} to storage $dst->{'storage'}->{'storage_name'} (server-side copy)");
+	$self->create_status_file($stream);
+
+	# there is no recovery to wait for
+	$n_threads = 1;
+	$current->{'src_result'} = 'DONE';
+	$current->{'src_errors'} = [];
+
+	my @filenums = map { $_->{'filenum'} } grep { defined } @{$dump->{'parts'}};
+	$stream->{'scribe'}->copy_dump(
+	    src_device => $src_dev,
+	    filenums => \@filenums,
+	    dump_header => $header,
+	    dump_cb => sub {
+		$stream->{'clerk'}->abandon_xfer_src();
+		$steps->{'dump_cb'}->(@_);
+	    });
+    };
+
     step handle_xmsg => sub {
 	my ($xmsg_src, $msg, $xfer) = @_;
-	$src->{'clerk'}->handle_xmsg(@_);
-	$dst->{'scribe'}->handle_xmsg(@_);
+	$stream->{'clerk'}->handle_xmsg(@_);
+	$stream->{'scribe'}->handle_xmsg(@_);
 
 	if ($msg->{'elt'} == $xfer_src) {
 	    if ($msg->{'type'} == $XMSG_SEGMENT_DONE) {
@@ -943,8 +1017,8 @@ sub xfer_dumps {
 	}
 
 	my $kb = int($current->{'size'}/1024);
-	$self->{'dst'}->{'scribe'}->{'copy'}->finish_copy($current->{'nparts'}, $kb, $current->{'size'},
-	    $result_calalog, $current->{'server_crc'}, undef) if $self->{'dst'}->{'scribe'}->{'copy'};
+	$stream->{'scribe'}->{'copy'}->finish_copy($current->{'nparts'}, $kb, $current->{'size'},
+	    $result_calalog, $current->{'server_crc'}, undef) if $stream->{'scribe'}->{'copy'};
 
 	my $dump = $current->{'dump'};
 	my $stats = make_stats($current->{'size'}, $current->{'total_duration'},
@@ -953,7 +1027,7 @@ sub xfer_dumps {
 
 	# write a DONE/PARTIAL/FAIL log line
 	if ($logtype == $L_FAIL) {
-	    $self->amdump_log("Fail vaulting $self->{'id'} $msg");
+	    $self->amdump_log("Fail vaulting $current->{'id'} $msg");
 	    log_add_full($L_FAIL, "taper", sprintf("%s %s %s %s %s %s",
 		quote_string($dump->{'hostname'}.""), # " is required for SWIG..
 		quote_string($dump->{'diskname'}.""),
@@ -963,9 +1037,9 @@ sub xfer_dumps {
 		$msg));
 	} else {
 	    if ($logtype == $L_PARTIAL) {
-		$self->amdump_log("Partial vaulting $self->{'id'} $stats".(@errors? " $msg" : ""));
+		$self->amdump_log("Partial vaulting $current->{'id'} $stats".(@errors? " $msg" : ""));
 	    } else {
-		$self->amdump_log("Done vaulting $self->{'id'} $stats");
+		$self->amdump_log("Done vaulting $current->{'id'} $stats");
 	    }
 	    log_add_full($logtype, "taper", sprintf("%s %s %s %s %s %s %s%s",
 		quote_string("ST:" . $self->{'dst'}{'chg'}{'storage'}->{'storage_name'}),
@@ -983,6 +1057,27 @@ sub xfer_dumps {
     };
 }
 
+# The device the clerk has loaded for DUMP, if the scribe's device can copy
+# from it and all of the parts of the dump are on that volume.
+sub _copy_source_device {
+    my $self = shift;
+    my ($stream, $dump) = @_;
+    my $clerk = $stream->{'clerk'};
+
+    my $src_dev = $clerk->{'current_dev'};
+    return undef if !$src_dev or !$src_dev->in_file;
+    for my $part (grep { defined } @{$dump->{'parts'}}) {
+	return undef if exists $part->{'holding_file'};
+	return undef if !defined $part->{'label'} or
+			$part->{'label'} ne $clerk->{'current_label'};
+    }
+
+    my $dst_dev = $stream->{'scribe'}->get_device();
+    return undef if !$dst_dev or !$dst_dev->can_copy_file_from($src_dev);
+
+    return $src_dev;
+}
+
 sub quit {
     my $self = shift;
     my ($exit_status) = @_;
@@ -1011,32 +1106,41 @@ sub quit {
     };
 
     # we may have several resources to clean up..
+    my @scribes;
+    my @clerks;
+    if ($self->{'streams'}) {
+	@scribes = map { $_->{'scribe'} } grep { $_->{'started'} } @{$self->{'streams'}};
+	@clerks = map { $_->{'clerk'} } @{$self->{'streams'}};
+    }
+
     step quit_scribe => sub {
-	if ($self->{'cleanup'}{'quit_scribe'}) {
+	my $scribe = shift @scribes;
+	if ($self->{'cleanup'}{'quit_scribe'} and $scribe) {
 	    debug("quitting scribe..");
-	    $self->{'dst'}{'scribe'}->quit(
+	    $scribe->quit(
 		finished_cb => $steps->{'quit_scribe_finished'});
 	} else {
-	    $steps->{'quit_scribe_finished'}->();
+	    $self->{'dst'}{'scan'}->quit() if defined $self->{'dst'}{'scan'};
+	    $steps->{'quit_clerk'}->();
 	}
     };
 
     step quit_scribe_finished => sub {
 	my ($err) = @_;
-	$self->{'dst'}{'scan'}->quit() if defined $self->{'dst'}{'scan'};
 	if ($err) {
 	    $self->user_msg($err);
 	    debug("scribe error: $err");
 	    $exit_status = 1;
 	}
 
-	$steps->{'quit_clerk'}->();
+	$steps->{'quit_scribe'}->();
     };
 
     step quit_clerk => sub {
-	if ($self->{'cleanup'}{'quit_clerk'}) {
+	my $clerk = shift @clerks;
+	if ($self->{'cleanup'}{'quit_clerk'} and $clerk) {
 	    debug("quitting clerk..");
-	    $self->{'src'}{'clerk'}->quit(
+	    $clerk->quit(
 		finished_cb => $steps->{'quit_clerk_finished'});
 	} else {
 	    $steps->{'roll_log'}->();
@@ -1051,7 +1155,7 @@ sub quit {
 	    $exit_status = 1;
 	}
 
-	$steps->{'roll_log'}->();
+	$steps->{'quit_clerk'}->();
     };
 
     step roll_log => sub {
@@ -1111,15 +1215,17 @@ sub failure {
 ## scribe feedback methods
 
 # note that the trace log calls here all add "taper", as we're dry_runing
-# to be the taper in the logfiles.
+# to be the taper in the logfiles.  The Amanda::Vault::Stream the clerk or
+# scribe belongs to is passed as the first argument.
 
 sub request_volume_permission {
     my $self = shift;
+    my $stream = shift;
     my %params = @_;
 
     # sure, use all the volumes you want, no problem!
     # TODO: limit to a vaulting-specific value of runtapes
-    $self->{'dst'}->{'scribe'}->start_scan();
+    $stream->{'scribe'}->start_scan();
     $params{'perm_cb'}->(allow => 1);
 }
 
@@ -1128,19 +1234,20 @@ sub scribe_ready {
 
 sub scribe_notif_new_tape {
     my $self = shift;
+    my $stream = shift;
     my %params = @_;
 
     if ($params{'volume_label'}) {
-	$self->{'dst'}->{'label'} = $params{'volume_label'};
+	$stream->{'label'} = $params{'volume_label'};
 
 	# add to the trace log
 	log_add_full($L_START, "taper", sprintf("datestamp %s %s label %s tape %s",
 		$self->{'dst_write_timestamp'},
 		quote_string("ST:" . $self->{'dst'}{'chg'}{'storage'}->{'storage_name'}),
-		quote_string($self->{'dst'}->{'label'}),
+		quote_string($stream->{'label'}),
 		++$self->{'dst'}->{'tape_num'}));
     } else {
-	$self->{'dst'}->{'label'} = undef;
+	$stream->{'label'} = undef;
 
 	$self->user_msg($params{error});
     }
@@ -1148,17 +1255,18 @@ sub scribe_notif_new_tape {
 
 sub scribe_notif_part_done {
     my $self = shift;
+    my $stream = shift;
     my %params = @_;
 
-    $self->{'last_partnum'} = $params{'partnum'};
+    $stream->{'last_partnum'} = $params{'partnum'};
 
     my $stats = make_stats($params{'size'}, $params{'duration'}, $self->{'orig_kb'});
 
     # log the part, using PART or PARTPARTIAL
-    my $hdr = $self->{'current'}->{'header'};
+    my $hdr = $stream->{'current'}->{'header'};
     my $logbase = sprintf("%s %s %s %s %s %s %s/%s %s %s",
 	quote_string("ST:" . $self->{'dst'}{'chg'}{'storage'}->{'storage_name'}),
-	quote_string($self->{'dst'}->{'label'}),
+	quote_string($stream->{'label'}),
 	$params{'fileno'},
 	quote_string($hdr->{'name'}.""), # " is required for SWIG..
 	quote_string($hdr->{'disk'}.""),
@@ -1179,7 +1287,7 @@ sub scribe_notif_part_done {
 				source_line     => __LINE__,
 				code            => 2500015,
 				severity	=> $Amanda::Message::INFO,
-				label           => $self->{dst}->{label},
+				label           => $stream->{'label'},
 				fileno          => $params{'fileno'},
 				header_summary  => $hdr->summary()));
     }
@@ -1187,6 +1295,7 @@ sub scribe_notif_part_done {
 
 sub scribe_notif_log_info {
     my $self = shift;
+    my $stream = shift;
     my %params = @_;
 
     debug("$params{'message'}");
@@ -1195,6 +1304,7 @@ sub scribe_notif_log_info {
 
 sub scribe_notif_tape_done {
     my $self = shift;
+    my $stream = shift;
     my %params = @_;
 
     # immediately flag that we are busy exporting, to prevent amvault from
@@ -1296,6 +1406,7 @@ sub scribe_notif_tape_done {
 
 sub clerk_notif_part {
     my $self = shift;
+    my $stream = shift;
     my ($label, $fileno, $header) = @_;
 
     # see if this is a new label
@@ -1316,6 +1427,7 @@ sub clerk_notif_part {
 
 sub clerk_notif_holding {
     my $self = shift;
+    my $stream = shift;
     my ($filename, $header) = @_;
 
     # this used to give the fd from which the holding file was being read.. why??
@@ -1328,4 +1440,48 @@ sub clerk_notif_holding {
 				header_summary  => $header->summary()));
 }
 
+package Amanda::Vault::Stream;
+use strict;
+use warnings;
+
+use parent -norequire,  qw(
+    Amanda::Recovery::Clerk::Feedback
+    Amanda::Taper::Scribe::Feedback
+);
+
+# A stream copies the dumps of its plan, one at a time, with its own clerk and
+# scribe.  It is the feedback object of both, and passes their notifications
+# to the vault with itself as first argument.
+
+sub new {
+    my $class = shift;
+    my ($vault, $plan) = @_;
+
+    return bless {
+	vault => $vault,
+	plan => $plan,
+	clerk => undef,
+	scribe => undef,
+	started => 0,
+
+	# the dump being copied, and the volume it is written to
+	current => undef,
+	label => undef,
+
+	status_fh => undef,
+	status_filename => undef,
+    }, $class;
+}
+
+for my $method (qw( request_volume_permission scribe_ready
+		    scribe_notif_new_tape scribe_notif_part_done
+		    scribe_notif_log_info scribe_notif_tape_done
+		    clerk_notif_part clerk_notif_holding )) {
+    no strict 'refs';
+    *$method = sub {
+	my $self = shift;
+	$self->{'vault'}->$method($self, @_);
+    };
+}
+
 1;
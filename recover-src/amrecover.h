@@ -116,6 +116,8 @@ extern DIR_ITEM *get_dir_list(void);
 extern DIR_ITEM *get_next_dir_item(DIR_ITEM *this);
 extern void suck_dir_list_from_server(void);
 extern void clear_dir_list(void);
+extern gboolean is_dir_list_cached(char *path);
+extern void clear_dir_list_cache(void);
 extern char *clean_pathname(char *s);
 extern void display_extract_list(char *file);
 extern void clear_extract_list(void);
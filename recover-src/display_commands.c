@@ -50,9 +50,16 @@ static int add_dir_list_item(char *date,
 void list_disk_history(void);
 void suck_dir_list_from_server(void);
 void list_directory(void);
+gboolean is_dir_list_cached(char *path);
+void clear_dir_list_cache(void);
 
 static DIR_ITEM *dir_list = NULL;
 
+/* The listings fetched during this session, keyed by host, disk, date and
+ * path, so that going back to a directory does not ask the index server
+ * again. */
+static GHashTable *dir_list_cache = NULL;
+
 DIR_ITEM *
 get_dir_list(void)
 {
@@ -93,6 +100,71 @@ free_dir_item(
     }
 }
 
+static DIR_ITEM *
+copy_dir_list(
+    DIR_ITEM *	list)
+{
+    DIR_ITEM *copy = NULL;
+    DIR_ITEM **tail = &copy;
+
+    for (; list != NULL; list = list->next) {
+	DIR_ITEM *item = g_new0(DIR_ITEM, 1);
+
+	item->date = g_strdup(list->date);
+	item->level = list->level;
+	item->tape = g_strdup(list->tape);
+	item->fileno = list->fileno;
+	item->path = g_strdup(list->path);
+	item->tpath = g_strdup(list->tpath);
+	*tail = item;
+	tail = &item->next;
+    }
+    return copy;
+}
+
+static char *
+dir_list_cache_key(
+    char *	path)
+{
+    return g_strjoin("\n", dump_hostname ? dump_hostname : "",
+			   disk_name ? disk_name : "",
+			   dump_date, path, NULL);
+}
+
+static void
+free_cached_dir_list(
+    gpointer	data)
+{
+    free_dir_item((DIR_ITEM *)data);
+}
+
+gboolean
+is_dir_list_cached(
+    char *	path)
+{
+    char *key;
+    gboolean cached;
+
+    if (!dir_list_cache)
+	return FALSE;
+
+    key = dir_list_cache_key(path);
+    cached = g_hash_table_lookup_extended(dir_list_cache, key, NULL, NULL);
+    g_free(key);
+    return cached;
+}
+
+/* forget the cached listings, when they no longer match what the index
+ * server would send */
+void
+clear_dir_list_cache(void)
+{
+    if (dir_list_cache) {
+	g_hash_table_destroy(dir_list_cache);
+	dir_list_cache = NULL;
+    }
+}
+
 /* add item to list if path not already on list */
 static int
 add_dir_list_item(
@@ -160,6 +232,20 @@ suck_dir_list_from_server(void)
 
     clear_dir_list();
 
+    if (dir_list_cache) {
+	gpointer cached;
+	char *key = dir_list_cache_key(disk_path);
+
+	if (g_hash_table_lookup_extended(dir_list_cache, key, NULL, &cached)) {
+	    dbprintf(_("suck_dir_list_from_server: %s is cached\n"), disk_path);
+	    dir_list = copy_dir_list((DIR_ITEM *)cached);
+	    g_free(key);
+	    amfree(disk_path_slash);
+	    return;
+	}
+	g_free(key);
+    }
+
     qdisk_path = quote_string(disk_path);
     cmd = g_strconcat("OLSD ", qdisk_path, NULL);
     amfree(qdisk_path);
@@ -285,6 +371,14 @@ suck_dir_list_from_server(void)
 	if (cmd)
 	    puts(cmd);
 	clear_dir_list();
+    } else {
+	if (!dir_list_cache) {
+	    dir_list_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+						   g_free,
+						   free_cached_dir_list);
+	}
+	g_hash_table_insert(dir_list_cache, dir_list_cache_key(disk_path),
+			    copy_dir_list(dir_list));
     }
     amfree(cmd);
 }
@@ -53,6 +53,7 @@ typedef struct EXTRACT_LIST_ITEM {
     char *path;
     char *tpath;
     struct EXTRACT_LIST_ITEM *next;
+    struct EXTRACT_LIST_ITEM *prev;
 }
 EXTRACT_LIST_ITEM;
 
@@ -62,6 +63,7 @@ typedef struct EXTRACT_LIST {
     char *tape;			/* tape label */
     off_t fileno;		/* fileno on tape */
     EXTRACT_LIST_ITEM *files;	/* files to get off tape */
+    GHashTable *paths;		/* path -> item of files */
 
     struct EXTRACT_LIST *next;
 }
@@ -334,6 +336,8 @@ clear_tape_list(
 	this = next;
     }
     tape_list->files = NULL;
+    g_hash_table_destroy(tape_list->paths);
+    tape_list->paths = NULL;
 }
 
 
@@ -385,14 +389,7 @@ int
 length_of_tape_list(
     EXTRACT_LIST *tape_list)
 {
-    EXTRACT_LIST_ITEM *fn;
-    int n;
-
-    n = 0;
-    for (fn = tape_list->files; fn != NULL; fn = fn->next)
-	n++;
-
-    return n;
+    return g_hash_table_size(tape_list->paths);
 }
 
 
@@ -404,74 +401,80 @@ clear_extract_list(void)
 }
 
 
+/* find a path of the list that includes PATH: an ancestor directory of
+ * PATH, with or without a trailing '/' */
+static EXTRACT_LIST_ITEM *
+find_including_item(
+    EXTRACT_LIST *tape_list,
+    char *path)
+{
+    EXTRACT_LIST_ITEM *fn = NULL;
+    char *prefix = g_strdup(path);
+    char *s;
+    char ch;
+
+    for (s = path; *s != '\0' && fn == NULL; s++) {
+	if (*s != '/')
+	    continue;
+	/* the directory itself, then with its trailing '/' */
+	if (s > path) {
+	    prefix[s - path] = '\0';
+	    fn = g_hash_table_lookup(tape_list->paths, prefix);
+	    prefix[s - path] = '/';
+	}
+	if (fn == NULL && s[1] != '\0') {
+	    ch = prefix[s - path + 1];
+	    prefix[s - path + 1] = '\0';
+	    fn = g_hash_table_lookup(tape_list->paths, prefix);
+	    prefix[s - path + 1] = ch;
+	}
+    }
+
+    g_free(prefix);
+    return fn;
+}
+
+static void
+unlink_extract_item(
+    EXTRACT_LIST *tape_list,
+    EXTRACT_LIST_ITEM *fn)
+{
+    g_hash_table_remove(tape_list->paths, fn->path);
+    if (fn->prev)
+	fn->prev->next = fn->next;
+    else
+	tape_list->files = fn->next;
+    if (fn->next)
+	fn->next->prev = fn->prev;
+    amfree(fn->path);
+    amfree(fn->tpath);
+    amfree(fn);
+}
+
+/* remove the paths that are included in another path of the list; each
+ * path only looks up its ancestors, so this is linear in the number of
+ * paths */
 void
 clean_tape_list(
     EXTRACT_LIST *tape_list)
 {
-    EXTRACT_LIST_ITEM *fn1, *pfn1, *ofn1;
-    EXTRACT_LIST_ITEM *fn2, *pfn2, *ofn2;
-    int remove_fn1;
-    int remove_fn2;
-
-    pfn1 = NULL;
-    fn1 = tape_list->files;
-    while (fn1 != NULL) {
-	remove_fn1 = 0;
-
-	pfn2 = fn1;
-	fn2 = fn1->next;
-	while (fn2 != NULL && remove_fn1 == 0) {
-	    remove_fn2 = 0;
-	    if(g_str_equal(fn1->path, fn2->path)) {
-		remove_fn2 = 1;
-	    } else if (g_str_has_prefix(fn2->path, fn1->path) &&
-		       ((strlen(fn2->path) > strlen(fn1->path) &&
-			 fn2->path[strlen(fn1->path)] == '/') ||
-		       (fn1->path[strlen(fn1->path)-1] == '/'))) {
-		remove_fn2 = 1;
-	    } else if (g_str_has_prefix(fn1->path, fn2->path) &&
-		       ((strlen(fn1->path) > strlen(fn2->path) &&
-			 fn1->path[strlen(fn2->path)] == '/')  ||
-		       (fn2->path[strlen(fn2->path)-1] == '/'))) {
-		remove_fn1 = 1;
-		break;
-	    }
-
-	    if (remove_fn2) {
-		dbprintf(_("removing path %s, it is included in %s\n"),
-			  fn2->path, fn1->path);
-		ofn2 = fn2;
-		fn2 = fn2->next;
-		amfree(ofn2->path);
-		amfree(ofn2->tpath);
-		amfree(ofn2);
-		pfn2->next = fn2;
-	    } else if (remove_fn1 == 0) {
-		pfn2 = fn2;
-		fn2 = fn2->next;
-	    }
-	}
+    EXTRACT_LIST_ITEM *fn, *ifn;
+    GSList *included = NULL, *l;
 
-	if(remove_fn1 != 0) {
-	    /* fn2->path is always valid */
-	    /*@i@*/ dbprintf(_("removing path %s, it is included in %s\n"),
-	    /*@i@*/	      fn1->tpath, fn2->tpath);
-	    ofn1 = fn1;
-	    fn1 = fn1->next;
-	    amfree(ofn1->path);
-	    amfree(ofn1->tpath);
-	    if(pfn1 == NULL) {
-		amfree(tape_list->files);
-		tape_list->files = fn1;
-	    } else {
-		amfree(pfn1->next);
-		pfn1->next = fn1;
-	    }
-	} else {
-	    pfn1 = fn1;
-	    fn1 = fn1->next;
+    for (fn = tape_list->files; fn != NULL; fn = fn->next) {
+	ifn = find_including_item(tape_list, fn->path);
+	if (ifn != NULL) {
+	    dbprintf(_("removing path %s, it is included in %s\n"),
+		      fn->tpath, ifn->tpath);
+	    included = g_slist_prepend(included, fn);
 	}
     }
+
+    /* an item is only removed once all the lookups are done, so that the
+     * paths below a removed path are removed too */
+    for (l = included; l != NULL; l = l->next)
+	unlink_extract_item(tape_list, (EXTRACT_LIST_ITEM *)l->data);
+    g_slist_free(included);
 }
 
 
@@ -642,7 +645,7 @@ add_extract_item(
     DIR_ITEM *ditem)
 {
     EXTRACT_LIST *this, *this1;
-    EXTRACT_LIST_ITEM *that, *curr;
+    EXTRACT_LIST_ITEM *that;
     char *ditem_path;
 
     ditem_path = g_strdup(ditem->path);
@@ -655,20 +658,19 @@ add_extract_item(
                                                        ditem->tape))
 	{
 	    /* yes, so add to list */
-	    curr=this->files;
-	    while(curr!=NULL)
-	    {
-		if (g_str_equal(curr->path, ditem_path)) {
-		    g_free(ditem_path);
-		    return 1;
-		}
-		curr=curr->next;
+	    if (g_hash_table_lookup(this->paths, ditem_path) != NULL) {
+		g_free(ditem_path);
+		return 1;
 	    }
 	    that = (EXTRACT_LIST_ITEM *)g_malloc(sizeof(EXTRACT_LIST_ITEM));
             that->path = ditem_path;
             that->tpath = clean_pathname(g_strdup(ditem->tpath));
+	    that->prev = NULL;
 	    that->next = this->files;
+	    if (this->files)
+		this->files->prev = that;
 	    this->files = that;		/* add at front since easiest */
+	    g_hash_table_insert(this->paths, that->path, that);
 	    return 0;
 	}
     }
@@ -683,7 +685,10 @@ add_extract_item(
     that->path = ditem_path;
     that->tpath = clean_pathname(g_strdup(ditem->tpath));
     that->next = NULL;
+    that->prev = NULL;
     this->files = that;
+    this->paths = g_hash_table_new(g_str_hash, g_str_equal);
+    g_hash_table_insert(this->paths, that->path, that);
 
     /* add this in date increasing order          */
     /* because restore must be done in this order */
@@ -719,7 +724,7 @@ delete_extract_item(
     DIR_ITEM *ditem)
 {
     EXTRACT_LIST *this;
-    EXTRACT_LIST_ITEM *that, *prev;
+    EXTRACT_LIST_ITEM *that;
     char *ditem_path = NULL;
 
     ditem_path = g_strdup(ditem->path);
@@ -732,36 +737,16 @@ delete_extract_item(
                                                        ditem->tape))
 	{
 	    /* yes, so find file on list */
-	    that = this->files;
-	    if (g_str_equal(that->path, ditem_path))
+	    that = g_hash_table_lookup(this->paths, ditem_path);
+	    if (that != NULL)
 	    {
-		/* first on list */
-		this->files = that->next;
-                amfree(that->path);
-                amfree(that->tpath);
-		amfree(that);
+		unlink_extract_item(this, that);
 		/* if list empty delete it */
 		if (this->files == NULL)
 		    delete_tape_list(this);
 		amfree(ditem_path);
 		return 0;
 	    }
-	    prev = that;
-	    that = that->next;
-	    while (that != NULL)
-	    {
-		if (g_str_equal(that->path, ditem_path))
-		{
-		    prev->next = that->next;
-                    amfree(that->path);
-                    amfree(that->tpath);
-		    amfree(that);
-		    amfree(ditem_path);
-		    return 0;
-		}
-		prev = that;
-		that = that->next;
-	    }
 	    amfree(ditem_path);
 	    return 1;
 	}
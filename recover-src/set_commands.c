@@ -52,6 +52,9 @@ set_date(
     cmd = g_strconcat("DATE ", date, NULL);
     if (converse(cmd) == -1)
 	exit(1);
+    /* the cached listings are keyed by the date */
+    if (server_happy())
+	g_strlcpy(dump_date, date, sizeof(dump_date));
 
     /* if a host/disk/directory is set, then check if that directory
        is still valid at the new date, and if not set directory to
@@ -628,6 +631,7 @@ set_directory(
     char *dp, *de;
     char *ldir = NULL;
     int   result;
+    int   valid;
 
     /* do nothing if "." */
     if(g_str_equal(dir, ".")) {
@@ -723,16 +727,22 @@ set_directory(
 	}
     }
 
-    qnew_dir = quote_string(new_dir);
-    cmd = g_strconcat("OISD ", qnew_dir, NULL);
-    amfree(qnew_dir);
-    if (exchange(cmd) == -1) {
-	exit(1);
-	/*NOTREACHED*/
+    /* a directory already listed is known to be valid */
+    if (is_dir_list_cached(new_dir)) {
+	valid = 1;
+    } else {
+	qnew_dir = quote_string(new_dir);
+	cmd = g_strconcat("OISD ", qnew_dir, NULL);
+	amfree(qnew_dir);
+	if (exchange(cmd) == -1) {
+	    exit(1);
+	    /*NOTREACHED*/
+	}
+	amfree(cmd);
+	valid = server_happy();
     }
-    amfree(cmd);
 
-    if (server_happy())
+    if (valid)
     {
 	g_free(disk_path);
 	g_free(disk_tpath);
@@ -915,6 +925,7 @@ set_storage(void)
     g_free(cmd);
     if (!server_happy()) {
     }
+    clear_dir_list_cache();		/* the listings depend on the storage */
     suck_dir_list_from_server();	/* get list of directory contents */
 }
 
@@ -1652,9 +1652,11 @@ import_db(
 		get_pname(), org);
     }
 
+    infofile_begin_batch();
     do {
 	rc = import_one();
     } while (rc);
+    infofile_end_batch();
 
     amfree(line);
     return;
@@ -557,6 +557,8 @@ sub do_backup {
 	my $dle_xml = $xml->XMLin($self->{'dle_str'});
 	$self->{'dle_xml'} = $dle_xml;
 	my @data_compress;
+	my $native_compress_algo = "gzip";
+	my $native_compress_level;
 	my @data_encrypt;
 
 	print {$self->{'mesg_fh'}} "start backup: " . $self->{'qdiskname'} . "\n";
@@ -578,10 +580,32 @@ sub do_backup {
 		$self->{'hdr'}->{'uncompress_cmd'} = " $Amanda::Constants::UNCOMPRESS_PATH $Amanda::Constants::UNCOMPRESS_OPT |";
 		$self->{'hdr'}->{'comp_suffix'} = $Amanda::Constants::COMPRESS_SUFFIX;
 		push @data_compress, $Amanda::Constants::COMPRESS_PATH, $Amanda::Constants::COMPRESS_BEST_OPT;
-	    } elsif ($compress == $COMP_SERVER_FAST) {
+		$native_compress_level = -3;
+	    } elsif (($compress == $COMP_SERVER_ZSTD &&
+		      $Amanda::Constants::ZSTD &&
+		      Amanda::Xfer::Filter::Compress::supported("zstd")) ||
+		     ($compress == $COMP_SERVER_LZ4 &&
+		      $Amanda::Constants::LZ4 &&
+		      Amanda::Xfer::Filter::Compress::supported("lz4"))) {
+		# amrestore runs SRVCOMPPROG -d, as for the dumper
+		my $zstd = $compress == $COMP_SERVER_ZSTD;
+		my $prog = $zstd ? $Amanda::Constants::ZSTD : $Amanda::Constants::LZ4;
+		$self->{'hdr'}->{'srvcompprog'} = $prog;
+		$self->{'hdr'}->{'uncompress_cmd'} = " $prog -dc |";
+		$self->{'hdr'}->{'comp_suffix'} = $zstd ? ".zst" : ".lz4";
+		$native_compress_algo = $zstd ? "zstd" : "lz4";
+		$native_compress_level = $zstd ? 3 : 0;
+	    } elsif ($compress == $COMP_SERVER_FAST ||
+		     $compress == $COMP_SERVER_AUTO ||
+		     $compress == $COMP_SERVER_DEFERRED ||
+		     $compress == $COMP_SERVER_ZSTD ||
+		     $compress == $COMP_SERVER_LZ4) {
+		# without the driver's CPU budget, or without the zstd or lz4
+		# library and program, as SERVER FAST
 		$self->{'hdr'}->{'uncompress_cmd'} = " $Amanda::Constants::UNCOMPRESS_PATH $Amanda::Constants::UNCOMPRESS_OPT |";
 		$self->{'hdr'}->{'comp_suffix'} = $Amanda::Constants::COMPRESS_SUFFIX;
 		push @data_compress, $Amanda::Constants::COMPRESS_PATH, $Amanda::Constants::COMPRESS_FAST_OPT;
+		$native_compress_level = -2;
 	    }
 	} elsif ($self->{'hdr'}->{'comp_suffix'}) {
 	    $self->{'hdr'}->{'compressed'} = 1;
@@ -619,7 +643,29 @@ sub do_backup {
 	my @xfer_link_data;
 	push @xfer_link_data, $xfer_src_data;
 
-	if (@data_compress) {
+	if (defined $native_compress_level &&
+	    ($native_compress_algo ne "gzip" ||
+	     ($Amanda::Constants::COMPRESS_SUFFIX eq '.gz' &&
+	      Amanda::Xfer::Filter::Compress::supported("gzip")))) {
+	    # compress in-process rather than forking gzip; the gzip output
+	    # is still readable by UNCOMPRESS_PATH.  One thread unless the
+	    # COMPRESS-THREADS dumptype property asks for more, or "auto"
+	    my $nthreads = 1;
+	    my $properties = dumptype_getconf($disk->{'config'}, $DUMPTYPE_PROPERTY);
+	    for my $name (keys %$properties) {
+		my $pname = lc($name);
+		$pname =~ tr/_/-/;
+		next if $pname ne 'compress-threads';
+		my $value = $properties->{$name}->{'values'}->[0];
+		if (defined $value && lc($value) eq 'auto') {
+		    $nthreads = -1;
+		} elsif (defined $value && $value =~ /^\d+$/ && $value >= 1) {
+		    $nthreads = $value;
+		}
+	    }
+	    $xfer_compress_data = Amanda::Xfer::Filter::Compress->new($native_compress_algo, $native_compress_level, $nthreads);
+	    push @xfer_link_data, $xfer_compress_data;
+	} elsif (@data_compress) {
 	    $xfer_compress_data = Amanda::Xfer::Filter::Process->new(\@data_compress, 0, 0, 0, 0);
 	    push @xfer_link_data, $xfer_compress_data;
 	}
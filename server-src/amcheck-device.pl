@@ -52,6 +52,8 @@ sub local_message {
 	return "slot $self->{'slot'}: writing to volume: $self->{'dev_error'}";
     } elsif ($self->{'code'} == 5200010) {
 	return "slot $self->{'slot'}: Volume '$self->{'label'}' is writeable";
+    } elsif ($self->{'code'} == 5200011) {
+	return "storage '$self->{'storage_name'}': results of the device check of $self->{'age'} seconds ago";
     } else {
         return "No mesage for code '$self->{'code'}'";
     }
@@ -60,7 +62,7 @@ sub local_message {
 package main;
 
 use Amanda::Util qw( :constants );
-use Amanda::Config qw( :init :getconf );
+use Amanda::Config qw( :init :getconf config_dir_relative );
 use Amanda::Logfile qw( :logtype_t log_add $amanda_log_trace_log );
 use Amanda::Debug;
 use Amanda::Device qw( :constants );
@@ -72,6 +74,7 @@ use Amanda::DB::Catalog2;
 use Amanda::Taper::Scan;
 use Amanda::Interactivity;
 use Amanda::Message;
+use Amanda::Rest::Cache;
 use Getopt::Long;
 use JSON -convert_blessed_universally;
 
@@ -113,13 +116,64 @@ my $storage;
 Amanda::Util::finish_setup($RUNNING_AS_DUMPUSER);
 my $exit_status = 0;
 
+# The results of a successful check are kept for check-cache-time seconds, for
+# as long as the inventory of the storage is the same: the configuration, the
+# catalog and the state file of the changer have not changed.
+my $cache_time = getconf($CNF_CHECK_CACHE_TIME);
+my $cache_file = config_dir_relative(getconf($CNF_LOGDIR)) .
+		 "/amcheck-device.$storage_name.json";
+my @cache_output;
+my $from_cache = 0;
+my $state_file;
+
 sub _user_msg_fn {
     my $message = shift;
 
     my $msg = $message->message();
     delete $message->{'res'};
     my $json = JSON->new->allow_nonref;
-    print STDOUT $json->pretty->allow_blessed->convert_blessed->encode($message);
+    my $output = $json->pretty->allow_blessed->convert_blessed->encode($message);
+    print STDOUT $output;
+    push @cache_output, $output;
+}
+
+sub inventory_version {
+    my @files = (get_config_filename(), Amanda::Rest::Cache::catalog_files());
+    push @files, $state_file if defined $state_file;
+
+    return Amanda::Rest::Cache::etag(\@files, config => get_config_name(),
+						storage => $storage_name);
+}
+
+sub read_cache {
+    return undef if !$cache_time || $overwrite;
+
+    my $fh;
+    open($fh, "<", $cache_file) or return undef;
+    my $cache = eval { decode_json(join('', <$fh>)) };
+    close($fh);
+
+    my $age = defined $cache ? time() - $cache->{'time'} : -1;
+    return undef if $age < 0 || $age >= $cache_time ||
+		    $cache->{'version'} ne inventory_version();
+    $cache->{'age'} = $age;
+    return $cache;
+}
+
+sub write_cache {
+    return if !$cache_time || $overwrite || $exit_status || $from_cache;
+
+    my $tmp = "$cache_file.tmp$$";
+    my $fh;
+    if (!open($fh, ">", $tmp)) {
+	debug("can't write $tmp: $!");
+	return;
+    }
+    print $fh encode_json({ version => inventory_version(),
+			    time    => time(),
+			    output  => \@cache_output });
+    close($fh);
+    rename($tmp, $cache_file) or unlink($tmp);
 }
 
 sub failure {
@@ -143,6 +197,21 @@ sub do_check {
 	$storage->quit();
 	return failure($chg, $finished_cb);
     }
+    $state_file = $chg->{'state_filename'} || $chg->{'statefile'};
+    if (my $cache = read_cache()) {
+	$from_cache = 1;
+	_user_msg_fn(Amanda::Amcheck_Device::Message->new(
+				source_filename	=> __FILE__,
+				source_line	=> __LINE__,
+				code		=> 5200011,
+				severity	=> $Amanda::Message::INFO,
+				age		=> $cache->{'age'},
+				storage_name	=> $storage->{'storage_name'}));
+	print STDOUT @{$cache->{'output'}};
+	$storage->quit();
+	return $finished_cb->();
+    }
+
     my $interactivity = Amanda::Interactivity->new(
 					name => $storage->{'interactivity'},
 					storage_name => $storage->{'storage_name'},
@@ -353,5 +422,6 @@ $| = 1;
 
 Amanda::MainLoop::call_later(\&do_check, \&Amanda::MainLoop::quit);
 Amanda::MainLoop::run();
+write_cache();
 Amanda::Util::finish_application();
 exit($exit_status);
@@ -51,11 +51,13 @@
 #include "ammessage.h"
 #include "event.h"
 #include "physmem.h"
+#include "amgcm.h"
 #include <getopt.h>
 
 #define BUFFER_SIZE	32768
 
 static time_t conf_ctimeout;
+static int conf_check_parallel;
 static int overwrite;
 
 static disklist_t origq;
@@ -448,6 +450,7 @@ main(
     }
 
     conf_ctimeout = (time_t)getconf_int(CNF_CTIMEOUT);
+    conf_check_parallel = getconf_int(CNF_CHECK_PARALLEL);
 
     err_array = match_disklist(&origq, exact_match, argc-1, argv+1);
     if (err_array->len > 0) {
@@ -1957,6 +1960,27 @@ start_server_check(
 					"diskname", dp->name)));
 		    pgmbad = 1;
 		  }
+		  else if (g_str_equal(dp->srv_encrypt, AMGCM_ENCRYPT_NAME)) {
+		    guint8 key[AMGCM_KEY_SIZE];
+		    char *errmsg = NULL;
+
+		    if (!amgcm_supported()) {
+			errmsg = g_strdup(_("AES-GCM encryption is not supported"));
+		    } else if (amgcm_load_key(dp->srv_decrypt_opt ?
+					      dp->srv_decrypt_opt : "",
+					      key, &errmsg)) {
+			memset(key, 0, sizeof(key));
+		    }
+		    if (errmsg) {
+			delete_message(amcheck_fprint_message(outf, build_message(
+					AMANDA_FILE, __LINE__, 2800236, MSG_ERROR, 3,
+					"hostname", hostp->hostname,
+					"diskname", dp->name,
+					"errmsg", errmsg)));
+			g_free(errmsg);
+			pgmbad = 1;
+		    }
+		  }
 		  else if(access(dp->srv_encrypt, X_OK) == -1) {
 		    delete_message(amcheck_fprint_message(outf, build_message(
 					AMANDA_FILE, __LINE__, 2800140, MSG_ERROR, 1,
@@ -2193,6 +2217,17 @@ FILE *client_outf;
 
 static void handle_result(void *, pkt_t *, security_handle_t *);
 void start_host(am_host_t *hostp);
+static void start_checks(void);
+static void check_host_done(void);
+
+/*
+ * The hosts not checked yet, in disklist order, and the number being
+ * checked.  At most conf_check_parallel hosts are checked at once; each has
+ * its own ctimeout, and a host done starts the next one.
+ */
+static GList *check_hosts = NULL;
+static int check_hosts_active = 0;
+static int hostcount;
 
 #define HOST_READY				(0)	/* must be 0 */
 #define HOST_ACTIVE				(1)
@@ -2425,7 +2460,11 @@ start_host(
 		    remote_errors++;
 		  } else if ( dp->compress == COMP_SERVER_FAST ||
 			      dp->compress == COMP_SERVER_BEST ||
-			      dp->compress == COMP_SERVER_CUST ) {
+			      dp->compress == COMP_SERVER_CUST ||
+			      dp->compress == COMP_SERVER_AUTO ||
+			      dp->compress == COMP_SERVER_DEFERRED ||
+			      dp->compress == COMP_SERVER_ZSTD ||
+			      dp->compress == COMP_SERVER_LZ4 ) {
 		    delete_message(amcheck_fprint_message(client_outf, build_message(
 					AMANDA_FILE, __LINE__, 2800195, MSG_ERROR, 1,
 					"hostname", hostp->hostname)));
@@ -2571,24 +2610,62 @@ start_host(
 					AMANDA_FILE, __LINE__, 2800213, MSG_ERROR, 2,
 					"hostname", hostp->hostname,
 					"auth", hostp->disks->auth)));
-    } else {
-	protocol_sendreq(hostp->hostname, secdrv, amhost_get_security_conf,
-			 req, conf_ctimeout, handle_result, hostp);
+	/* no answer will come to free its place in the window */
+	amfree(req);
+	hostp->status = HOST_DONE;
+	return;
     }
+    protocol_sendreq(hostp->hostname, secdrv, amhost_get_security_conf,
+		     req, conf_ctimeout, handle_result, hostp);
 
     amfree(req);
 
     hostp->status = HOST_ACTIVE;
 }
 
+static void
+start_checks(void)
+{
+    while (check_hosts &&
+	   (conf_check_parallel == 0 ||
+	    check_hosts_active < conf_check_parallel)) {
+	am_host_t *hostp = check_hosts->data;
+	disk_t *dp1;
+
+	check_hosts = g_list_delete_link(check_hosts, check_hosts);
+	if (hostp->status != HOST_READY)
+	    continue;
+
+	run_server_host_scripts(EXECUTE_ON_PRE_HOST_AMCHECK,
+				get_config_name(), NULL, hostp);
+	for(dp1 = hostp->disks; dp1 != NULL; dp1 = dp1->hostnext) {
+	    run_server_dle_scripts(EXECUTE_ON_PRE_DLE_AMCHECK,
+			       get_config_name(), NULL, dp1, -1, BOGUS);
+	}
+	start_host(hostp);
+	hostcount++;
+	if (hostp->status == HOST_ACTIVE)
+	    check_hosts_active++;
+	protocol_check();
+    }
+}
+
+/* a host of the window is done; start the next one */
+static void
+check_host_done(void)
+{
+    check_hosts_active--;
+    start_checks();
+}
+
 pid_t
 start_client_checks(
     FILE *outf)
 {
     am_host_t *hostp;
     GList     *dlist;
-    disk_t *dp, *dp1;
-    int hostcount;
+    disk_t *dp;
+    GHashTable *seen;
     pid_t pid;
     int userbad = 0;
 
@@ -2624,22 +2701,20 @@ start_client_checks(
     run_server_global_scripts(EXECUTE_ON_PRE_AMCHECK, get_config_name(), NULL);
     protocol_init();
 
+    seen = g_hash_table_new(g_direct_hash, g_direct_equal);
     for(dlist = origq.head; dlist != NULL; dlist = dlist->next) {
 	dp = dlist->data;
 	hostp = dp->host;
-	if(hostp->status == HOST_READY && dp->todo == 1) {
-	    run_server_host_scripts(EXECUTE_ON_PRE_HOST_AMCHECK,
-				    get_config_name(), NULL, hostp);
-	    for(dp1 = hostp->disks; dp1 != NULL; dp1 = dp1->hostnext) {
-		run_server_dle_scripts(EXECUTE_ON_PRE_DLE_AMCHECK,
-				   get_config_name(), NULL, dp1, -1, BOGUS);
-	    }
-	    start_host(hostp);
-	    hostcount++;
-	    protocol_check();
+	if(hostp->status == HOST_READY && dp->todo == 1 &&
+	   !g_hash_table_lookup(seen, hostp)) {
+	    g_hash_table_insert(seen, hostp, hostp);
+	    check_hosts = g_list_prepend(check_hosts, hostp);
 	}
     }
+    g_hash_table_destroy(seen);
+    check_hosts = g_list_reverse(check_hosts);
 
+    start_checks();
     protocol_run();
     run_server_global_scripts(EXECUTE_ON_POST_AMCHECK, get_config_name(), NULL);
 
@@ -2724,6 +2799,7 @@ handle_result(
 	remote_errors++;
 	hostp->status = HOST_DONE;
 	security_close_connection(sech, hostp->hostname);
+	check_host_done();
 	return;
     }
 
@@ -2850,6 +2926,7 @@ handle_result(
 	}
 	run_server_host_scripts(EXECUTE_ON_POST_HOST_AMCHECK,
 				get_config_name(), NULL, hostp);
+	check_host_done();
     }
     /* try to clean up any defunct processes, since Amanda doesn't wait() for
        them explicitly */
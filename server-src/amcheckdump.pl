@@ -34,7 +34,8 @@ use Amanda::CheckDump;
 
 sub usage {
     print <<EOF;
-USAGE:	amcheckdump [ --timestamp|-t timestamp ] [-o configoption]* <conf>
+USAGE:	amcheckdump [ --timestamp|-t timestamp ] [ --crc-only ] [ --parallel count ]
+		    [-o configoption]* <conf>
     amcheckdump validates Amanda dump images by reading them from storage
 volume(s), and verifying archive integrity if the proper tool is locally
 available. amcheckdump does not actually compare the data located in the image
@@ -45,6 +46,10 @@ to anything; it just validates that the archive stream is valid.
 			the most recent dump; if this parameter is specified,
 			check the most recent dump matching the given
 			date- or timestamp.
+	--crc-only   - Only read the images and compare their CRCs and fixity
+			digests with the ones in the catalog; the images
+			are not decompressed, decrypted or parsed.
+	--parallel count - Check up to count images at the same time.
 	-o configoption	- see the CONFIGURATION OVERRIDE section of amanda(8)
 EOF
     exit(1);
@@ -59,6 +64,8 @@ my $exit_code = 0;
 my $opt_timestamp;
 my $opt_verbose = 0;
 my $opt_assume = 0;
+my $opt_crc_only = 0;
+my $opt_parallel;
 my $config_overrides = new_config_overrides($#ARGV+1);
 
 debug("Arguments: " . join(' ', @ARGV));
@@ -68,6 +75,8 @@ GetOptions(
     'timestamp|t=s' => \$opt_timestamp,
     'verbose|v'     => \$opt_verbose,
     'assume=s'      => \$opt_assume,
+    'crc-only'      => \$opt_crc_only,
+    'parallel=i'    => \$opt_parallel,
     'help|usage|?'  => \&usage,
     'o=s' => sub { add_config_override_opt($config_overrides, $_[1]); },
 ) or usage();
@@ -112,6 +121,8 @@ sub main {
 	assume    => $opt_assume,
 	timestamp => $opt_timestamp,
 	verbose   => $opt_verbose,
+	'crc-only' => $opt_crc_only,
+	parallel  => $opt_parallel,
 	finished_cb => $finished_cb);
 }
 
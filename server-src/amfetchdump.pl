@@ -136,7 +136,7 @@ sub usage {
     print STDERR <<EOF;
 Usage: amfetchdump [-c|-C|-l] [-p|-n] [-a] [-O directory] [-d device]
     [-h|--header-file file|--header-fd fd]
-    [--reserve-tapes] [--release-tapes]
+    [--reserve-tapes] [--release-tapes] [--parallel N]
     [-decrypt|--no-decrypt|--server-decrypt|--client-decrypt]
     [--decompress|--no-decompress|--server-decompress|--client-decompress]
     [(--extract | --extract-client=HOSTNAME) --target target
@@ -177,7 +177,7 @@ my ($opt_config, $opt_no_reassembly, $opt_compress, $opt_compress_best, $opt_pip
     $opt_exclude_file, $opt_exclude_list, $opt_exclude_list_glob,
     $opt_prev_level, $opt_next_level,
     $opt_exact_match, $opt_run_client_scripts,
-    $opt_reserve_tapes, $opt_release_tapes);
+    $opt_reserve_tapes, $opt_release_tapes, $opt_parallel);
 
 my $NEVER = 0;
 my $ALWAYS = 1;
@@ -226,6 +226,7 @@ GetOptions(
     'run-client-scripts' => \$opt_run_client_scripts,
     'reserve-tapes' => \$opt_reserve_tapes,
     'release-tapes' => \$opt_release_tapes,
+    'parallel=i' => \$opt_parallel,
     'init' => \$opt_init,
     'restore!' => \$opt_restore,
     'b=s' => \$opt_blocksize,
@@ -248,6 +249,8 @@ usage("-l is not compatible with -c or -C")
     if ($opt_leave and $opt_compress);
 usage("-p is not compatible with -n")
     if ($opt_pipe and $opt_no_reassembly);
+usage("--parallel must be at least 1")
+    if (defined $opt_parallel and $opt_parallel < 1);
 usage("-h, --header-file, and --header-fd are mutually incompatible")
     if (($opt_header and ($opt_header_file or $opt_header_fd))
 	    or ($opt_header_file and $opt_header_fd));
@@ -471,6 +474,7 @@ sub main {
 		'prev-level'		=> $opt_prev_level,
 		'no-reassembly'		=> $opt_no_reassembly,
 		'pipe-fd'		=> $opt_pipe ? 1 : undef,
+		'parallel'		=> $opt_parallel,
 		'restore'		=> $opt_restore,
 		'server-decompress'	=> $opt_server_decompress,
 		'server-decrypt'	=> $opt_server_decrypt,
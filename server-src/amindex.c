@@ -93,6 +93,26 @@ getstatefname(
   return buf;
 }
 
+/* The block map of a dump compressed in independent blocks: the name of
+ * the state file with a ".blocks" suffix */
+char *
+getblockmapfname(
+    char *	host,
+    char *	disk,
+    char *	date,
+    int		level)
+{
+  char *statefname = getstatefname(host, disk, date, level);
+  char *buf;
+
+  /* remove ".state" */
+  statefname[strlen(statefname) - 6] = '\0';
+  buf = g_strconcat(statefname, ".blocks", NULL);
+  amfree(statefname);
+
+  return buf;
+}
+
 char *
 getindexfname(
     char *	host,
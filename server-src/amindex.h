@@ -38,6 +38,12 @@
 #include "conffile.h"
 
 char *getstatefname(char *host, char *disk, char *date, int level);
+char *getblockmapfname(char *host, char *disk, char *date, int level);
+
+/* A block map is BLOCK_MAP_MAGIC followed by 64-bit big-endian numbers: the
+ * uncompressed size of a block, the uncompressed size of the dump, then the
+ * offset in the compressed dump of each block, and the compressed size. */
+#define BLOCK_MAP_MAGIC "AMBLKMAP"
 char *getindexfname(char *host, char *disk, char *date, int level);
 char *getindex_unsorted_fname(char *host, char *disk, char *date, int level);
 char *getindex_unsorted_gz_fname(char *host, char *disk, char *date, int level);
@@ -58,8 +58,10 @@
 #include "sockaddr-util.h"
 #include "amxml.h"
 #include "server_util.h"
+#include "linesort.h"
 
 #include <grp.h>
+#include <utime.h>
 
 #define DBG(i, ...) do {		\
 	if ((i) <= debug_amindexd) {	\
@@ -100,9 +102,20 @@ static int get_pid_status(int pid, char *program, GPtrArray **emsg);
 static REMOVE_ITEM *remove_files(REMOVE_ITEM *);
 static REMOVE_ITEM *compress_files(REMOVE_ITEM *);
 static char *uncompress_file(char *, char *, char *, int,
+			     char *, GPtrArray **,
+			     gboolean need_uncompress, gboolean need_sort,
+			     char *cache_filename);
+static char *index_cache_get(char *, char *, char *, int,
 			     char *, GPtrArray **,
 			     gboolean need_uncompress, gboolean need_sort);
+static void index_cache_evict(char *cache_dir, char *keep);
 static int process_ls_dump(char *, DUMP_ITEM *, int, GPtrArray **);
+static gboolean index_is_sorted(FILE *fp);
+static void index_seek(FILE *fp, off_t size, char *key);
+
+/* the replies are written in blocks of that size, only reply() and lreply()
+ * flush them */
+#define REPLY_BLOCK_SIZE	(256 * 1024)
 
 static size_t reply_buffer_size = 1;
 static char *reply_buffer = NULL;
@@ -121,12 +134,12 @@ static int build_disk_table(void);
 static int disk_history_list(void);
 static int is_dir_valid_opaque(char *);
 static int opaque_ls(char *, int);
-static void opaque_ls_one (DIR_ITEM *dir_item, am_feature_e marshall_feature,
+static char *opaque_ls_tapelist(DUMP_ITEM *dump, am_feature_e marshall_feature);
+static void opaque_ls_one (DIR_ITEM *dir_item, char *qtapelist_str,
 			     int recursive);
 static int tapedev_is(void);
 static int are_dumps_compressed(void);
 static char *amindexd_nicedate (char *datestamp);
-static int cmp_date (const char *date1, const char *date2);
 static char *get_index_name(char *dump_hostname, char *hostname,
 			    char *diskname, char *timestamps, int level,
 			    GPtrArray **emsg);
@@ -224,6 +237,109 @@ compress_files(
     return compress;
 }
 
+/*
+ * The index returned by get_index_name() is sorted: the lines starting
+ * with a directory name are contiguous, so a directory is found with a
+ * binary search on the file offsets instead of a scan of all the file.
+ * The old dump format, whose lines do not start with the filename, is
+ * still scanned.
+ */
+static gboolean
+index_is_sorted(
+    FILE *fp)
+{
+    int ch = getc(fp);
+
+    rewind(fp);
+    return ch == '/';
+}
+
+/* position fp at the first line not less than key */
+static void
+index_seek(
+    FILE  *fp,
+    off_t  size,
+    char  *key)
+{
+    off_t lo = 0;
+    off_t hi = size;
+    off_t mid;
+    char *line;
+    int   ch;
+
+    while (lo < hi) {
+	mid = lo + (hi - lo) / 2;
+	/* go to the start of the first line at or after mid */
+	if (fseeko(fp, mid > 0 ? mid - 1 : 0, SEEK_SET) != 0)
+	    break;
+	if (mid > 0) {
+	    while ((ch = getc(fp)) != EOF && ch != '\n');
+	}
+	if ((line = agets(fp)) == NULL) {
+	    hi = mid;
+	    continue;
+	}
+	if (strcmp(line, key) < 0) {
+	    lo = ftello(fp);
+	} else {
+	    hi = mid;
+	}
+	g_free(line);
+    }
+
+    fseeko(fp, lo > 0 ? lo - 1 : 0, SEEK_SET);
+    if (lo > 0) {
+	while ((ch = getc(fp)) != EOF && ch != '\n');
+    }
+}
+
+/* find all matching entries in a sorted dump listing */
+static void
+process_ls_dump_sorted(
+    FILE      *fp,
+    char      *dir_slash,
+    DUMP_ITEM *dump_item,
+    int        recursive)
+{
+    struct stat stat_index;
+    size_t len_dir_slash = strlen(dir_slash);
+    char *line;
+    char *s;
+    char *skip;
+
+    if (fstat(fileno(fp), &stat_index) != 0)
+	return;
+    index_seek(fp, stat_index.st_size, dir_slash);
+
+    while ((line = agets(fp)) != NULL) {
+	if (!g_str_has_prefix(line, dir_slash)) {
+	    g_free(line);
+	    break;
+	}
+	if (recursive) {
+	    add_dir_list_item(dump_item, line);
+	    g_free(line);
+	    continue;
+	}
+
+	/* keep the entry of the directory, then skip all its files */
+	s = line + len_dir_slash;
+	while (*s && *s != '/')
+	    s++;
+	if (*s == '/') {
+	    s[1] = '\0';
+	    add_dir_list_item(dump_item, line);
+	    skip = g_strdup(line);
+	    skip[s - line] = '/' + 1;
+	    index_seek(fp, stat_index.st_size, skip);
+	    g_free(skip);
+	} else {
+	    add_dir_list_item(dump_item, line);
+	}
+	g_free(line);
+    }
+}
+
 /* find all matching entries in a dump listing */
 /* return -1 if error */
 static int
@@ -264,6 +380,14 @@ process_ls_dump(
 	return -1;
     }
 
+    if (index_is_sorted(fp)) {
+	process_ls_dump_sorted(fp, dir_slash, dump_item, recursive);
+	afclose(fp);
+	amfree(filename);
+	amfree(dir_slash);
+	return 0;
+    }
+
     len_dir_slash=strlen(dir_slash);
 
     while (fgets(line, STR_SIZE, fp) != NULL) {
@@ -787,10 +911,10 @@ disk_history_list(void)
 	    date[10] = '\0';
 
 	if(am_has_feature(their_features, fe_amindexd_marshall_in_DHST)){
-	    lreply(201, " %s %d %s", date, item->level, tapelist_str);
+	    fast_lreply(201, " %s %d %s", date, item->level, tapelist_str);
 	}
 	else{
-	    lreply(201, " %s %d %s %lld", date, item->level,
+	    fast_lreply(201, " %s %d %s %lld", date, item->level,
 		tapelist_str, (long long)item->file);
 	}
 	amfree(tapelist_str);
@@ -815,7 +939,6 @@ is_dir_valid_opaque(
     DUMP_ITEM *item;
     char line[STR_SIZE];
     FILE *fp;
-    int last_level;
     char *ldir = NULL;
     char *filename = NULL;
     size_t ldir_len;
@@ -838,10 +961,8 @@ is_dir_valid_opaque(
 	reply(502, _("Must set date before asking about directories"));
 	return -1;
     }
-    /* scan through till we find first dump on or before date */
-    for (item=first_dump(); item!=NULL; item=next_dump(item))
-	if (cmp_date(item->date, target_date) <= 0)
-	    break;
+    /* find the first dump on or before date */
+    item = dump_on_or_before(target_date);
 
     if (item == NULL)
     {
@@ -877,36 +998,50 @@ is_dir_valid_opaque(
 	    amfree(ldir);
 	    return -1;
 	}
-	while (fgets(line, STR_SIZE, fp) != NULL) {
-	    if(line[0] == '/') {
-		filename_start = line;
-	    } else {
-		/* tar continually adjusts the output so we must continually 
-		 * search for the filename */
-		filename_start = strstr(line," ./");
-		if (filename_start == NULL)
+	if (index_is_sorted(fp)) {
+	    struct stat stat_index;
+	    char *first = NULL;
+
+	    if (fstat(fileno(fp), &stat_index) == 0) {
+		index_seek(fp, stat_index.st_size, ldir);
+		first = agets(fp);
+	    }
+	    if (first && g_str_has_prefix(first, ldir)) {
+		g_free(first);
+		amfree(filename);
+		amfree(ldir);
+		afclose(fp);
+		return 0;
+	    }
+	    g_free(first);
+	} else {
+	    while (fgets(line, STR_SIZE, fp) != NULL) {
+		if(line[0] == '/') {
+		    filename_start = line;
+		} else {
+		    /* tar continually adjusts the output so we must continually 
+		     * search for the filename */
+		    filename_start = strstr(line," ./");
+		    if (filename_start == NULL)
+			continue;
+		    filename_start += 2;
+		}
+		if (line[0] == '\0')
 		    continue;
-		filename_start += 2;
-            }
-	    if (line[0] == '\0')
-		continue;
-	    if(strlen(line) > 0 && line[strlen(line)-1] == '\n')
-		line[strlen(line)-1] = '\0';
-	    if (strncmp(filename_start, ldir, ldir_len) != 0) {
-		continue;			/* not found yet */
+		if(strlen(line) > 0 && line[strlen(line)-1] == '\n')
+		    line[strlen(line)-1] = '\0';
+		if (strncmp(filename_start, ldir, ldir_len) != 0) {
+		    continue;			/* not found yet */
+		}
+		amfree(filename);
+		amfree(ldir);
+		afclose(fp);
+		return 0;
 	    }
-	    amfree(filename);
-	    amfree(ldir);
-	    afclose(fp);
-	    return 0;
 	}
 	afclose(fp);
 
-	last_level = item->level;
-	do
-	{
-	    item=next_dump(item);
-	} while ((item != NULL) && (item->level >= last_level));
+	item = base_dump(item);
     } while (item != NULL);
 
     amfree(filename);
@@ -922,7 +1057,12 @@ opaque_ls(
 {
     DUMP_ITEM *dump_item;
     DIR_ITEM *dir_item;
-    int level, last_level;
+    DIR_ITEM **entries;
+    guint level_count[DUMP_LEVELS + 1];
+    guint nb_entries, i;
+    DUMP_ITEM *last_dump = NULL;
+    char *qtapelist_str = NULL;
+    int level;
     GPtrArray *emsg = NULL;
     am_feature_e marshall_feature;
 
@@ -951,10 +1091,8 @@ opaque_ls(
 	return -1;
     }
 
-    /* scan through till we find first dump on or before date */
-    for (dump_item=first_dump(); dump_item!=NULL; dump_item=next_dump(dump_item))
-	if (cmp_date(dump_item->date, target_date) <= 0)
-	    break;
+    /* find the first dump on or before date */
+    dump_item = dump_on_or_before(target_date);
 
     if (dump_item == NULL)
     {
@@ -971,63 +1109,83 @@ opaque_ls(
 	return -1;
     }
 
-    /* go back processing higher level dumps till we hit a level 0 dump */
-    last_level = dump_item->level;
-    while ((last_level != 0) && ((dump_item=next_dump(dump_item)) != NULL))
+    /* go back processing lower level dumps till we hit a level 0 dump */
+    while ((dump_item = base_dump(dump_item)) != NULL)
     {
-	if (dump_item->level < last_level)
-	{
-	    last_level = dump_item->level;
-	    if (process_ls_dump(dir, dump_item, recursive, &emsg) == -1) {
-		reply_ptr_array(599, emsg);
-		g_ptr_array_free_full(emsg);
-		return -1;
-	    }
+	if (process_ls_dump(dir, dump_item, recursive, &emsg) == -1) {
+	    reply_ptr_array(599, emsg);
+	    g_ptr_array_free_full(emsg);
+	    return -1;
 	}
     }
     g_ptr_array_free_full(emsg);
 
+    /* order the entries by level, keeping the order of the list in a level;
+     * the entries of a dump are then contiguous */
+    memset(level_count, 0, sizeof(level_count));
+    nb_entries = 0;
+    for (dir_item = get_dir_list(); dir_item != NULL;
+	 dir_item = dir_item->next) {
+	level = dir_item->dump->level;
+	if (level >= 0 && level < DUMP_LEVELS) {
+	    level_count[level + 1]++;
+	    nb_entries++;
+	}
+    }
+    for (level = 0; level < DUMP_LEVELS; level++)
+	level_count[level + 1] += level_count[level];
+    entries = g_new(DIR_ITEM *, nb_entries + 1);
+    for (dir_item = get_dir_list(); dir_item != NULL;
+	 dir_item = dir_item->next) {
+	level = dir_item->dump->level;
+	if (level >= 0 && level < DUMP_LEVELS)
+	    entries[level_count[level]++] = dir_item;
+    }
+
     /* return the information to the caller */
     lreply(200, _(" Opaque list of %s"), dir);
-    for(level=0; level < DUMP_LEVELS; level++) {
-	for (dir_item = get_dir_list(); dir_item != NULL; 
-	     dir_item = dir_item->next) {
-
-	    if(dir_item->dump->level == level) {
-		if (!am_has_feature(their_features, marshall_feature) &&
-	            (num_entries(dir_item->dump->tapes) > 1 ||
-	            dir_item->dump->tapes->numfiles > 1)) {
-	            fast_lreply(501, _(" ERROR: Split dumps not supported"
-				" with old version of amrecover."));
-		    break;
-		}
-		else {
-		    opaque_ls_one(dir_item, marshall_feature, recursive);
-		}
-	    }
+    for (i = 0; i < nb_entries; i++) {
+	dir_item = entries[i];
+	if (!am_has_feature(their_features, marshall_feature) &&
+	    (num_entries(dir_item->dump->tapes) > 1 ||
+	     dir_item->dump->tapes->numfiles > 1)) {
+	    fast_lreply(501, _(" ERROR: Split dumps not supported"
+			" with old version of amrecover."));
+	    /* skip the other entries of that level */
+	    level = dir_item->dump->level;
+	    while (i + 1 < nb_entries && entries[i + 1]->dump->level == level)
+		i++;
+	    continue;
+	}
+	if (dir_item->dump != last_dump) {
+	    g_free(qtapelist_str);
+	    qtapelist_str = opaque_ls_tapelist(dir_item->dump, marshall_feature);
+	    last_dump = dir_item->dump;
 	}
+	opaque_ls_one(dir_item, qtapelist_str, recursive);
     }
+    g_free(qtapelist_str);
+    g_free(entries);
     reply(200, _(" Opaque list of %s"), dir);
 
     clear_dir_list();
     return 0;
 }
 
-void opaque_ls_one(
-    DIR_ITEM *	 dir_item,
-    am_feature_e marshall_feature,
-    int		 recursive)
+/* the tape list of a dump, as it is sent in a listing */
+static char *
+opaque_ls_tapelist(
+    DUMP_ITEM *	 dump,
+    am_feature_e marshall_feature)
 {
-    char date[20];
     char *tapelist_str;
     char *qtapelist_str;
-    char *qpath;
 
     if (am_has_feature(their_features, marshall_feature)) {
-	tapelist_str = marshal_tapelist(dir_item->dump->tapes, 1,
+	tapelist_str = marshal_tapelist(dump->tapes, 1,
 		 am_has_feature(their_features, fe_amrecover_storage_in_marshall));
     } else {
-	tapelist_str = dir_item->dump->tapes->label;
+	tapelist_str = g_strdup(dump->tapes->label);
     }
 
     if (am_has_feature(their_features, fe_amindexd_quote_label)) {
@@ -1035,6 +1193,20 @@ void opaque_ls_one(
     } else {
 	qtapelist_str = g_strdup(tapelist_str);
     }
+    amfree(tapelist_str);
+
+    return qtapelist_str;
+}
+
+static void
+opaque_ls_one(
+    DIR_ITEM *	 dir_item,
+    char *	 qtapelist_str,
+    int		 recursive)
+{
+    char date[20];
+    char *qpath;
+
     strncpy(date, dir_item->dump->date, 20);
     date[19] = '\0';
     if(!am_has_feature(their_features,fe_amrecover_timestamp))
@@ -1059,10 +1231,6 @@ void opaque_ls_one(
 		    qtapelist_str, qpath);
     }
     amfree(qpath);
-    if(am_has_feature(their_features, marshall_feature)) {
-	amfree(tapelist_str);
-    }
-    amfree(qtapelist_str);
 }
 
 /*
@@ -1341,6 +1509,10 @@ main(
 	}
     }
 
+    /* a listing is sent in few large writes instead of a write per entry;
+     * nothing was written to cmdout yet */
+    setvbuf(cmdout, NULL, _IOFBF, REPLY_BLOCK_SIZE);
+
     /* clear these so we can detect when the have not been set by the client */
     amfree(dump_hostname);
     amfree(qdisk_name);
@@ -1801,14 +1973,6 @@ amindexd_nicedate(
     return nice;
 }
 
-static int
-cmp_date(
-    const char *	date1,
-    const char *	date2)
-{
-    return strncmp(date1, date2, strlen(date2));
-}
-
 static int
 get_index_dir(
     char *dump_hostname,
@@ -1983,12 +2147,27 @@ get_index_name(
 
 process_dump:
     amfree(lower_hostname);
+    if (getconf_str(CNF_INDEX_CACHE_DIR) &&
+	*getconf_str(CNF_INDEX_CACHE_DIR)) {
+	return index_cache_get(hostname, diskname, timestamps, level,
+			       fn, emsg, need_uncompress, need_sort);
+    }
     return uncompress_file(hostname, diskname, timestamps, level,
-			   fn, emsg, need_uncompress, need_sort);
+			   fn, emsg, need_uncompress, need_sort, NULL);
 }
 
+/*
+ * With index-cache-dir, the uncompressed and sorted indexes are kept in
+ * the cache directory and shared by all the amindexd processes of the
+ * server, instead of being rebuilt in the index directory for each
+ * session.  The first process that needs an index builds it, with the
+ * lock of the entry held; the others wait for that lock and use the
+ * result.  An entry is touched each time it is used, and the least
+ * recently used entries are removed when the cache is larger than
+ * index-cache-size.
+ */
 static char *
-uncompress_file(
+index_cache_get(
     char       *hostname,
     char       *diskname,
     char       *timestamps,
@@ -1997,13 +2176,182 @@ uncompress_file(
     GPtrArray **emsg,
     gboolean    need_uncompress,
     gboolean    need_sort)
+{
+    char       *cache_dir = getconf_str(CNF_INDEX_CACHE_DIR);
+    char       *key;
+    char       *cache_filename;
+    char       *lock_filename;
+    char       *tmp_filename;
+    char       *new_filename;
+    file_lock  *lock;
+    struct stat stat_cache;
+    guint       nb_emsg;
+    int         result;
+
+    if (mkdir(cache_dir, 0700) != 0 && errno != EEXIST) {
+	g_debug("Can't create index cache directory '%s': %s", cache_dir,
+		strerror(errno));
+	return uncompress_file(hostname, diskname, timestamps, level,
+			       filename, emsg, need_uncompress, need_sort,
+			       NULL);
+    }
+
+    key = old_sanitise_filename(filename);
+    if (g_str_has_suffix(key, COMPRESS_SUFFIX))
+	key[strlen(key) - strlen(COMPRESS_SUFFIX)] = '\0';
+    cache_filename = g_strconcat(cache_dir, "/", key, NULL);
+    lock_filename = g_strconcat(cache_filename, ".lock", NULL);
+    g_free(key);
+
+    lock = file_lock_new(lock_filename);
+    while ((result = file_lock_lock_wr(lock)) == 1) {
+	sleep(1);
+    }
+    if (result != 0) {
+	g_debug("Can't lock '%s': %s", lock_filename, strerror(errno));
+	file_lock_free(lock);
+	g_free(lock_filename);
+	g_free(cache_filename);
+	return uncompress_file(hostname, diskname, timestamps, level,
+			       filename, emsg, need_uncompress, need_sort,
+			       NULL);
+    }
+
+    if (stat(cache_filename, &stat_cache) == 0) {
+	dbprintf("using cached index %s\n", cache_filename);
+	utime(cache_filename, NULL);
+	amfree(filename);
+    } else {
+	tmp_filename = g_strdup_printf("%s.tmp.%ld", cache_filename,
+				       (long)getpid());
+	nb_emsg = (*emsg)->len;
+	new_filename = uncompress_file(hostname, diskname, timestamps, level,
+				       filename, emsg, need_uncompress,
+				       need_sort, tmp_filename);
+	if (!new_filename || (*emsg)->len > nb_emsg ||
+	    rename(tmp_filename, cache_filename) != 0) {
+	    unlink(tmp_filename);
+	    amfree(cache_filename);
+	}
+	g_free(new_filename);
+	g_free(tmp_filename);
+	if (cache_filename)
+	    index_cache_evict(cache_dir, cache_filename);
+    }
+
+    file_lock_unlock(lock);
+    file_lock_free(lock);
+    g_free(lock_filename);
+    return cache_filename;
+}
+
+typedef struct index_cache_entry_s {
+    char   *name;
+    time_t  mtime;
+    off_t   size;
+} index_cache_entry_t;
+
+static gint
+index_cache_entry_cmp(
+    gconstpointer a,
+    gconstpointer b)
+{
+    const index_cache_entry_t *ea = a;
+    const index_cache_entry_t *eb = b;
+
+    if (ea->mtime < eb->mtime)
+	return -1;
+    return ea->mtime > eb->mtime;
+}
+
+/* remove the least recently used entries until the cache fits in
+ * index-cache-size; an entry used in the last minutes is kept, as another
+ * process may be about to open it */
+static void
+index_cache_evict(
+    char *cache_dir,
+    char *keep)
+{
+    gint64          max_size = getconf_int64(CNF_INDEX_CACHE_SIZE) * 1024;
+    gint64          size = 0;
+    time_t          recent = time(NULL) - 300;
+    DIR            *dir;
+    struct dirent  *de;
+    struct stat     stat_entry;
+    GSList         *entries = NULL;
+    GSList         *e;
+    index_cache_entry_t *entry;
+    char           *name;
+    char           *lock_filename;
+    file_lock      *lock;
+
+    if (max_size == 0 || (dir = opendir(cache_dir)) == NULL)
+	return;
+
+    while ((de = readdir(dir)) != NULL) {
+	if (de->d_name[0] == '.' ||
+	    g_str_has_suffix(de->d_name, ".lock") ||
+	    strstr(de->d_name, ".tmp.") != NULL)
+	    continue;
+	name = g_strconcat(cache_dir, "/", de->d_name, NULL);
+	if (stat(name, &stat_entry) != 0 || !S_ISREG(stat_entry.st_mode)) {
+	    g_free(name);
+	    continue;
+	}
+	size += stat_entry.st_size;
+	entry = g_new(index_cache_entry_t, 1);
+	entry->name = name;
+	entry->mtime = stat_entry.st_mtime;
+	entry->size = stat_entry.st_size;
+	entries = g_slist_prepend(entries, entry);
+    }
+    closedir(dir);
+
+    entries = g_slist_sort(entries, index_cache_entry_cmp);
+    for (e = entries; e != NULL && size > max_size; e = e->next) {
+	entry = e->data;
+	if (entry->mtime >= recent || g_str_equal(entry->name, keep))
+	    continue;
+
+	/* an entry being built is locked */
+	lock_filename = g_strconcat(entry->name, ".lock", NULL);
+	lock = file_lock_new(lock_filename);
+	if (file_lock_lock_wr(lock) == 0) {
+	    dbprintf("removing cached index %s\n", entry->name);
+	    unlink(entry->name);
+	    unlink(lock_filename);
+	    size -= entry->size;
+	    file_lock_unlock(lock);
+	}
+	file_lock_free(lock);
+	g_free(lock_filename);
+    }
+
+    for (e = entries; e != NULL; e = e->next) {
+	entry = e->data;
+	g_free(entry->name);
+	g_free(entry);
+    }
+    g_slist_free(entries);
+}
+
+static char *
+uncompress_file(
+    char       *hostname,
+    char       *diskname,
+    char       *timestamps,
+    int         level,
+    char       *filename,
+    GPtrArray **emsg,
+    gboolean    need_uncompress,
+    gboolean    need_sort,
+    char       *cache_filename)
 {
     char *cmd = NULL;
     char *new_filename = NULL;
     struct stat stat_filename;
     int result;
     int pipe_from_gzip;
-    int pipe_to_sort;
     int indexfd;
     int nullfd;
     int uncompress_errfd;
@@ -2012,7 +2360,6 @@ uncompress_file(
     FILE *pipe_stream;
     pid_t pid_gzip = 0;
     pid_t pid_sort = 0;
-    pid_t pid_index = 0;
     int        status;
     char      *msg;
     gpointer  *p;
@@ -2022,7 +2369,12 @@ uncompress_file(
     FILE      *uncompress_err_stream;
     FILE      *sort_err_stream;
 
-    new_filename = getindex_unsorted_fname(hostname, diskname, timestamps, level);
+    /* a cache entry is built from the index, which is kept */
+    if (cache_filename) {
+	new_filename = g_strdup(cache_filename);
+    } else {
+	new_filename = getindex_unsorted_fname(hostname, diskname, timestamps, level);
+    }
 
     /* uncompress the file */
     result = stat(filename, &stat_filename);
@@ -2047,7 +2399,8 @@ uncompress_file(
 	return new_filename;
     }
     if (!need_uncompress && !need_sort) {
-	return new_filename;
+	amfree(new_filename);
+	return filename;
     }
 
 #ifdef UNCOMPRESS_OPT
@@ -2056,7 +2409,7 @@ uncompress_file(
 #  define PARAM_UNCOMPRESS_OPT skip_argument
 #endif
 
-    indexfd = open(new_filename, O_WRONLY|O_CREAT, 0600);
+    indexfd = open(new_filename, O_WRONLY|O_CREAT|O_TRUNC, 0600);
     if (indexfd == -1) {
 	msg = g_strdup_printf(_("Can't open '%s' for writing: %s"),
 			      filename, strerror(errno));
@@ -2119,46 +2472,56 @@ uncompress_file(
     }
 
     if (need_sort) {
-	/* start the sort process */
-	putenv(g_strdup("LC_ALL=C"));
+	int sort_errpipe[2];
 
-	if (getconf_seen(CNF_TMPDIR)) {
-	    gchar *tmpdir = getconf_str(CNF_TMPDIR);
-	    pid_sort = pipespawn(SORT_PATH, STDIN_PIPE|STDERR_PIPE, 0,
-				 &pipe_to_sort, &indexfd, &sort_errfd,
-				 SORT_PATH, "-k", "6", "-T", tmpdir, NULL);
-	} else {
-	    pid_sort = pipespawn(SORT_PATH, STDIN_PIPE|STDERR_PIPE, 0,
-				 &pipe_to_sort, &indexfd, &sort_errfd,
-				 SORT_PATH, "-k", "6", NULL);
+	/* sort in a subprocess, which reports its errors on sort_errfd */
+	if (pipe(sort_errpipe) == -1) {
+	    msg = g_strdup_printf(_("pipe error: %s"), strerror(errno));
+	    dbprintf("%s\n", msg);
+	    g_ptr_array_add(*emsg, msg);
+	    fclose(pipe_stream);
+	    aclose(indexfd);
+	    amfree(filename);
+	    return NULL;
 	}
-	aclose(indexfd);
-
-	/* start a subprocess */
-	/* send all ouput from uncompress process to sort process */
-	pid_index = fork();
-	switch (pid_index) {
+	pid_sort = fork();
+	switch (pid_sort) {
 	case -1:
 	    msg = g_strdup_printf(
 			_("fork error: %s"),
 			strerror(errno));
 	    dbprintf("%s\n", msg);
 	    g_ptr_array_add(*emsg, msg);
-	    unlink(filename);
 	    amfree(filename);
 	    break;
 	default: break;
-	case 0:
-	    while (fgets(line, STR_SIZE, pipe_stream) != NULL) {
-		if (line[0] != '\0') {
-		    full_write(pipe_to_sort,line,strlen(line));
-		}
+	case 0: {
+	    linesort_t *ls;
+	    char *prefix;
+	    size_t len;
+
+	    close(sort_errpipe[0]);
+	    prefix = g_strdup_printf("%s/amindexd-sort.%ld",
+				     getconf_str(CNF_TMPDIR), (long)getpid());
+	    ls = linesort_new(prefix, 0, LINESORT_THREADS_AUTO);
+	    while ((len = fread(line, 1, sizeof(line), pipe_stream)) > 0) {
+		linesort_add(ls, line, len);
+	    }
+	    if (!linesort_finish(ls, indexfd)) {
+		msg = g_strdup_printf("%s\n", linesort_error(ls));
+		full_write(sort_errpipe[1], msg, strlen(msg));
+		linesort_free(ls);
+		exit(1);
 	    }
+	    linesort_free(ls);
 	    exit(0);
 	}
+	}
 
+	sort_errfd = sort_errpipe[0];
+	close(sort_errpipe[1]);
 	fclose(pipe_stream);
-	aclose(pipe_to_sort);
+	aclose(indexfd);
     }
 
     if (need_uncompress) {
@@ -2199,7 +2562,7 @@ uncompress_file(
 
     if (need_uncompress) {
 	status = get_pid_status(pid_gzip, UNCOMPRESS_PATH, emsg);
-	if (status == 0 && filename) {
+	if (status == 0 && filename && !cache_filename) {
 	    unlink(filename);
 	    amfree(filename);
 	}
@@ -2213,14 +2576,8 @@ uncompress_file(
     }
 
     if (need_sort) {
-	status = get_pid_status(pid_index, "index", emsg);
-	if (status == 0 && filename) {
-	    unlink(filename);
-	    amfree(filename);
-	}
-
-	status = get_pid_status(pid_sort, SORT_PATH, emsg);
-	if (status == 0 && filename) {
+	status = get_pid_status(pid_sort, "sort", emsg);
+	if (status == 0 && filename && !cache_filename) {
 	    unlink(filename);
 	    amfree(filename);
 	}
@@ -2233,7 +2590,9 @@ uncompress_file(
 	g_ptr_array_free(sort_err, TRUE);
     }
 
-    if (need_sort && new_filename && getconf_boolean(CNF_COMPRESS_INDEX)) {
+    if (cache_filename) {
+	amfree(filename);
+    } else if (need_sort && new_filename && getconf_boolean(CNF_COMPRESS_INDEX)) {
 	/* add at beginning */
 	REMOVE_ITEM *compress_file;
 	compress_file = (REMOVE_ITEM *)g_malloc(sizeof(REMOVE_ITEM));
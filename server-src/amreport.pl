@@ -616,7 +616,25 @@ debug("using logfile: $logfile" . ($historical? " (historical)" : ""));
 
 ## Parse the report & set output
 
-$report = Amanda::Report->new($logfile, $historical);
+# only the xml and json_raw outputs list every part of a dump; the others
+# are satisfied with one entry per volume, which keeps the memory used for
+# runs with many split dumps bounded.
+sub outputs_need_parts
+{
+    my @formats = map { $_->[FORMAT][FMT_TYP] } @output_queue;
+    push @formats, 'xml' if $opt_xml;
+    if ($mode != MODE_CMDLINE && $from_amdump) {
+	for my $report_format (@{getconf($CNF_REPORT_FORMAT)}) {
+	    my ($module) = split ':', $report_format;
+	    my ($mod) = split ',', $module;
+	    push @formats, $mod;
+	}
+    }
+    return grep { defined $_ && ($_ eq 'xml' || $_ eq 'json_raw') } @formats;
+}
+
+$report = Amanda::Report->new($logfile, $historical,
+			      summary_parts => !outputs_need_parts());
 if ($report->isa("Amanda::Message")) {
     print $report, "\n";
     exit(1);
@@ -310,7 +310,12 @@ sub main {
 	# set up any filters that need to be applied, decryption first
 	my @filters;
 	if ($hdr->{'encrypted'} and not $opt_raw) {
-	    if ($hdr->{'srv_encrypt'}) {
+	    if ($hdr->native_encrypt_type()) {
+		# the decrypt option names the key file
+		push @filters,
+		    Amanda::Xfer::Filter::Encrypt->new(
+			$hdr->{'srv_decrypt_opt'}, 1, 4);
+	    } elsif ($hdr->{'srv_encrypt'}) {
 		push @filters,
 		    Amanda::Xfer::Filter::Process->new(
 			[ $hdr->{'srv_encrypt'}, $hdr->{'srv_decrypt_opt'} ], 0, 0, 0, 1);
@@ -0,0 +1,372 @@
+#!@PERL@
+# Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+# for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+#
+# Contact information: Carbonite Inc., 756 N Pastoria Ave
+# Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
+
+use lib '@amperldir@';
+use strict;
+use warnings;
+
+use Amanda::Util qw( :constants );
+use Amanda::Debug qw( :logging );
+use Amanda::Constants;
+use Getopt::Long;
+
+sub Usage {
+    print STDERR <<END;
+Usage: $0 [--inparallel n] [--dumporder order] [--maxdumps n]
+	  [--netusage kps] [--holding kb] [--taper-parallel-write n]
+	  [--verbose] <amdump-file>
+
+This script replays the schedule of an amdump file with the dump and
+tape throughput it records, and prints how long the run would take with
+the given driver settings.  The settings not given are the ones of the
+recorded run.
+END
+    exit 1;
+}
+
+my $opt_version;
+my $opt_inparallel;
+my $opt_dumporder;
+my $opt_maxdumps;
+my $opt_netusage;
+my $opt_holding;
+my $opt_taper_parallel_write;
+my $opt_verbose = 0;
+
+GetOptions('version'			=> \$opt_version,
+	   'inparallel=i'		=> \$opt_inparallel,
+	   'dumporder=s'		=> \$opt_dumporder,
+	   'maxdumps=i'			=> \$opt_maxdumps,
+	   'netusage=i'			=> \$opt_netusage,
+	   'holding=i'			=> \$opt_holding,
+	   'taper-parallel-write=i'	=> \$opt_taper_parallel_write,
+	   'verbose'			=> \$opt_verbose)
+or Usage();
+
+if (defined $opt_version) {
+    print "amsimulate-" . $Amanda::Constants::VERSION , "\n";
+    exit 0;
+}
+
+Usage() if @ARGV != 1;
+my $amdump_file = $ARGV[0];
+
+Amanda::Util::setup_application("amsimulate", "server", $CONTEXT_CMDLINE, "amanda", "amanda");
+
+##
+# Read the amdump file
+
+my %dles;		# "host disk" => dle
+my @schedule;		# the dles in schedule order
+my %maxdumps;		# host => maxdumps
+my %serial_to_dle;	# handle => dle
+my %taper_workers;
+my ($inparallel, $dumporder, $bandwidth, $diskspace);
+my $recorded_end = 0;
+my ($taper_kb, $taper_sec) = (0, 0);
+
+open(my $fh, "<", $amdump_file)
+    or die("Can't open '$amdump_file': $!");
+my $generating_schedule = 0;
+while (my $line = <$fh>) {
+    chomp $line;
+    $line =~ s/[:\s]+$//g;
+    my @line = Amanda::Util::split_quoted_strings_for_amstatus($line);
+    next if !defined $line[0];
+
+    if ($line[0] eq "GENERATING" && defined $line[1] && $line[1] eq "SCHEDULE") {
+	$generating_schedule = 1;
+    } elsif ($line[0] eq "--------") {
+	$generating_schedule++ if $generating_schedule;
+    } elsif ($line[0] eq "DUMP" && $generating_schedule == 2) {
+	#1:host 3:disk 5:priority 6:level 15:csize 16:time 17:kps
+	my $dle = {
+	    host     => $line[1],
+	    disk     => $line[3],
+	    priority => $line[5],
+	    level    => $line[6],
+	    esize    => $line[15],
+	    etime    => $line[16],
+	    ekps     => $line[17],
+	};
+	$dles{"$line[1] $line[3]"} = $dle;
+	push @schedule, $dle;
+    } elsif ($line[0] eq "driver" && defined $line[1]) {
+	if ($line[1] eq "start" && $line[2] eq "time") {
+	    #3:time 5:inparallel 7:bandwidth 9:diskspace ... last:dumporder
+	    $inparallel = $line[5];
+	    $bandwidth = $line[7];
+	    $diskspace = $line[9];
+	    $dumporder = $line[-1];
+	}
+	next if !defined $line[2] || $line[2] ne "time";
+	$recorded_end = $line[3] if $line[3] > $recorded_end;
+
+	if ($line[1] eq "send-cmd" && $line[5] =~ /^dumper\d*$/ &&
+	    ($line[6] eq "PORT-DUMP" || $line[6] eq "SHM-DUMP")) {
+	    #7:handle 10:maxdumps 11:host 13:disk
+	    my $dle = $dles{"$line[11] $line[13]"};
+	    next if !$dle;
+	    $serial_to_dle{$line[7]} = $dle;
+	    $maxdumps{$line[11]} = $line[10];
+	} elsif ($line[1] eq "send-cmd" && $line[5] =~ /^taper\d*$/ &&
+		 $line[6] =~ /^(FILE|PORT|SHM)-WRITE$/) {
+	    #7:worker 8:handle, then 10:host 11:disk for FILE-WRITE
+	    #			     or 9:host 10:disk otherwise
+	    my ($host, $disk) = $line[6] eq "FILE-WRITE" ?
+				    ($line[10], $line[11]) : ($line[9], $line[10]);
+	    my $dle = $dles{"$host $disk"};
+	    $taper_workers{$line[7]} = 1;
+	    next if !$dle;
+	    $serial_to_dle{$line[8]} = $dle;
+	    $dle->{'direct'} = 1 if $line[6] ne "FILE-WRITE";
+	} elsif ($line[1] eq "result" && $line[5] =~ /^dumper\d*$/ &&
+		 $line[6] eq "DONE") {
+	    my $dle = $serial_to_dle{$line[7]};
+	    next if !$dle;
+	    if ($line =~ /\[sec (\S+) kb (\d+) /) {
+		$dle->{'dtime'} = $1;
+		$dle->{'dsize'} = $2;
+	    }
+	} elsif ($line[1] eq "result" && $line[5] =~ /^taper\d*$/ &&
+		 $line[6] eq "DONE") {
+	    my $dle = $serial_to_dle{$line[8]};
+	    if ($line =~ /\[sec (\S+) (kb|bytes) (\d+) kps/) {
+		my $kb = $2 eq 'kb' ? $3 : $3 / 1024;
+		$taper_kb += $kb;
+		$taper_sec += $1;
+		$dle->{'tkps'} = $kb / $1 if $dle && $1 > 0;
+	    }
+	}
+    }
+}
+close($fh);
+
+die("No schedule in '$amdump_file'\n") if !@schedule;
+
+$inparallel = $opt_inparallel if defined $opt_inparallel;
+$dumporder = $opt_dumporder if defined $opt_dumporder;
+$bandwidth = $opt_netusage if defined $opt_netusage;
+$diskspace = $opt_holding if defined $opt_holding;
+$inparallel = 10 if !$inparallel;
+$dumporder = "tttTTTTTTT" if !defined $dumporder;
+$bandwidth = 0 if !defined $bandwidth;
+$diskspace = 0 if !defined $diskspace;
+my $nb_tapers = $opt_taper_parallel_write || scalar(keys %taper_workers) || 1;
+my $default_tkps = $taper_sec > 0 ? $taper_kb / $taper_sec : 0;
+
+my $no_throughput = 0;
+for my $dle (@schedule) {
+    $maxdumps{$dle->{'host'}} = $opt_maxdumps if defined $opt_maxdumps;
+    $maxdumps{$dle->{'host'}} = 1 if !$maxdumps{$dle->{'host'}};
+
+    # the recorded time of the dump, or what the planner expected
+    $dle->{'size'} = defined $dle->{'dsize'} ? $dle->{'dsize'} : $dle->{'esize'};
+    if (defined $dle->{'dtime'}) {
+	$dle->{'time'} = $dle->{'dtime'};
+    } else {
+	$no_throughput++;
+	$dle->{'time'} = $dle->{'etime'} > 0 ? $dle->{'etime'} :
+			 $dle->{'ekps'} > 0 ? $dle->{'esize'} / $dle->{'ekps'} : 0;
+    }
+    my $tkps = $dle->{'tkps'} || $default_tkps;
+    $dle->{'ttime'} = $tkps > 0 ? $dle->{'size'} / $tkps : 0;
+    $dle->{'direct'} = 1 if $diskspace < $dle->{'esize'};
+}
+
+##
+# Simulate the run
+
+my $clock = 0;
+my @events;		# [ time, sub ], sorted by time
+my @runq = @schedule;
+my @tapeq;
+my @dumper_busy = (0) x $inparallel;
+my @dumper_time = (0) x $inparallel;
+my $tapers_busy = 0;
+my $taper_time = 0;
+my %inprogress;		# host => running dumps
+my %work_left;		# host => seconds of dumps to do
+my $netusage = 0;
+my $holding_used = 0;
+my ($peak_holding, $peak_netusage) = (0, 0);
+my $dumps_end = 0;
+
+$work_left{$_->{'host'}} += $_->{'time'} for @schedule;
+
+sub add_event {
+    my ($time, $cb) = @_;
+    my $i = @events;
+    $i-- while $i > 0 && $events[$i-1]->[0] > $time;
+    splice @events, $i, 0, [ $time, $cb ];
+}
+
+sub host_work_left {
+    my ($host) = @_;
+    return $work_left{$host} / $maxdumps{$host};
+}
+
+# is $dle a better pick than $best for the dumporder letter $type
+sub better {
+    my ($type, $dle, $best) = @_;
+
+    return 1 if !$best;
+    return 0 if $dle->{'priority'} < $best->{'priority'};
+    return $dle->{'esize'} < $best->{'esize'} if $type eq 's';
+    return $dle->{'esize'} > $best->{'esize'} if $type eq 'S';
+    return $dle->{'etime'} < $best->{'etime'} if $type eq 't';
+    return $dle->{'etime'} > $best->{'etime'} if $type eq 'T';
+    return $dle->{'ekps'} < $best->{'ekps'} if $type eq 'b';
+    return $dle->{'ekps'} > $best->{'ekps'} if $type eq 'B';
+    if ($type eq 'C') {
+	my $w = host_work_left($dle->{'host'});
+	my $wbest = host_work_left($best->{'host'});
+	return $w > $wbest || ($w == $wbest && $dle->{'etime'} > $best->{'etime'});
+    }
+    return $dle->{'esize'} < $best->{'esize'};
+}
+
+sub allowed {
+    my ($dle) = @_;
+
+    return 0 if ($inprogress{$dle->{'host'}} || 0) >= $maxdumps{$dle->{'host'}};
+    return 0 if $bandwidth && $netusage > 0 &&
+		$dle->{'ekps'} > $bandwidth - $netusage;
+    if ($dle->{'direct'}) {
+	return $tapers_busy < $nb_tapers;
+    }
+    return $holding_used + $dle->{'esize'} <= $diskspace;
+}
+
+sub finish_dump {
+    my ($dumper, $dle) = @_;
+
+    $dumper_busy[$dumper] = 0;
+    $dumper_time[$dumper] += $clock - $dle->{'start'};
+    $inprogress{$dle->{'host'}}--;
+    $netusage -= $dle->{'ekps'};
+    $dumps_end = $clock;
+    print "$clock: dumped $dle->{'host'} $dle->{'disk'}\n" if $opt_verbose;
+    if ($dle->{'direct'}) {
+	$tapers_busy--;
+	$taper_time += $clock - $dle->{'start'};
+    } else {
+	# the holding space reserved is now what the dump took
+	$holding_used += $dle->{'size'} - $dle->{'esize'};
+	push @tapeq, $dle;
+    }
+}
+
+sub finish_tape {
+    my ($dle) = @_;
+
+    $tapers_busy--;
+    $taper_time += $dle->{'ttime'};
+    $holding_used -= $dle->{'size'};
+    print "$clock: flushed $dle->{'host'} $dle->{'disk'}\n" if $opt_verbose;
+}
+
+sub start_dumps {
+    for my $dumper (0 .. $inparallel-1) {
+	next if $dumper_busy[$dumper];
+	my $type = $dumper < length($dumporder) ? substr($dumporder, $dumper, 1) :
+		   $dumper < 3 ? 't' : 'T';
+	my ($best, $best_i);
+	for my $i (0 .. $#runq) {
+	    my $dle = $runq[$i];
+	    next if !allowed($dle);
+	    if (better($type, $dle, $best)) {
+		$best = $dle;
+		$best_i = $i;
+	    }
+	}
+	last if !$best;
+
+	splice @runq, $best_i, 1;
+	$dumper_busy[$dumper] = 1;
+	$inprogress{$best->{'host'}}++;
+	$netusage += $best->{'ekps'};
+	$work_left{$best->{'host'}} -= $best->{'time'};
+	$best->{'start'} = $clock;
+	my $time = $best->{'time'};
+	if ($best->{'direct'}) {
+	    $tapers_busy++;
+	    $time = $best->{'ttime'} if $best->{'ttime'} > $time;
+	} else {
+	    $holding_used += $best->{'esize'};
+	}
+	$peak_holding = $holding_used if $holding_used > $peak_holding;
+	$peak_netusage = $netusage if $netusage > $peak_netusage;
+	print "$clock: $dumper ($type) dumps $best->{'host'} $best->{'disk'}\n"
+	    if $opt_verbose;
+	my $d = $dumper;
+	add_event($clock + $time, sub { finish_dump($d, $best); });
+    }
+}
+
+sub start_tapes {
+    while (@tapeq && $tapers_busy < $nb_tapers) {
+	my $dle = shift @tapeq;
+	$tapers_busy++;
+	add_event($clock + $dle->{'ttime'}, sub { finish_tape($dle); });
+    }
+}
+
+while (1) {
+    start_dumps();
+    start_tapes();
+    last if !@events;
+    my $event = shift @events;
+    $clock = $event->[0];
+    $event->[1]->();
+}
+
+##
+# Report
+
+sub hms {
+    my ($sec) = @_;
+    $sec = int($sec + 0.5);
+    return sprintf("%d:%02d:%02d", $sec / 3600, ($sec / 60) % 60, $sec % 60);
+}
+
+sub pct {
+    my ($busy, $total) = @_;
+    return $total > 0 ? sprintf("%.1f%%", 100 * $busy / $total) : "-";
+}
+
+my $busy = 0;
+$busy += $_ for @dumper_time;
+print "settings: inparallel $inparallel dumporder $dumporder netusage $bandwidth"
+    . " holding $diskspace taper-parallel-write $nb_tapers\n";
+print "predicted run time: " . hms($clock) . " (dumps done at " . hms($dumps_end) . ")\n";
+print "recorded run time:  " . hms($recorded_end) . "\n";
+print "dumpers busy: " . pct($busy, $inparallel * $clock) . "\n";
+for my $dumper (0 .. $inparallel-1) {
+    print "  dumper$dumper: " . pct($dumper_time[$dumper], $clock) . "\n";
+}
+print "tapers busy: " . pct($taper_time, $nb_tapers * $clock) . "\n";
+print "holding disk peak: $peak_holding kb of $diskspace kb\n";
+print "network peak: $peak_netusage kps of $bandwidth kps\n";
+print "dles not dumped: " . scalar(@runq) . "\n" if @runq;
+print "dles without recorded throughput: $no_throughput\n" if $no_throughput;
+
+Amanda::Util::finish_application();
+exit(@runq ? 1 : 0);
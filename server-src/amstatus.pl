@@ -10,6 +10,7 @@ use Text::ParseWords;
 use Amanda::Util qw( :constants match_labelstr );;
 use Amanda::Process;
 use Amanda::Status;
+use Amanda::Timeline;
 use Amanda::Config qw( :init :getconf config_dir_relative );
 use Amanda::Debug qw( :logging );
 use Getopt::Long;
@@ -39,12 +40,14 @@ my $opt_taped;
 my $opt_stats;
 my $opt_config;
 my $opt_file;
+my $opt_timeline;
 my $opt_locale_independent_date_format = 0;
 
 sub usage() {
 	print "amstatus [--file amdump_file]\n";
 	print "         [--[no]detail] [--[no]summary] [--[no]taped] [--[no]stats]\n";
 	print "         [--[no]locale-independent-date-format]\n";
+	print "         [--timeline trace_file]\n";
 	print "         [--config] <config>\n";
 	exit 0;
 }
@@ -75,6 +78,7 @@ GetOptions(
 #    'gestimate|gettingestimate!'      => \$opt_gestimate,
     'config|c:s'                      => \$opt_config,
     'file:s'                          => \$opt_file,
+    'timeline=s'                      => \$opt_timeline,
     'locale-independent-date-format!' => \$opt_locale_independent_date_format,
     'o=s'  => sub { add_config_override_opt($config_overrides, $_[1]); },
     ) or usage();
@@ -199,8 +203,17 @@ else {
 	}
 }
 
-print "Using: $errfile\n";
 debug("Using: $errfile");
+if (defined $opt_timeline) {
+    my $timeline = Amanda::Timeline->new(filename => $errfile);
+    my $err = $timeline->write_chrome_trace($opt_timeline);
+    if (defined $err) {
+	print STDERR "$err\n";
+	exit 1;
+    }
+    exit 0;
+}
+print "Using: $errfile\n";
 my $status = Amanda::Status->new(filename => $errfile);
 if ($status->isa("Amanda::Message")) {
     print $status, "\n";
@@ -430,6 +443,17 @@ if ($opt_summary) {
 			    print "\n";
 			}
 		    }
+		    if (defined $wworker->{'xfer_stats'}) {
+			for my $elt (sort keys %{$wworker->{'xfer_stats'}}) {
+			    my $st = $wworker->{'xfer_stats'}->{$elt};
+			    my $ename = $elt;
+			    $ename =~ s/^<(\w+).*$/$1/;
+			    printf "%16s  %-24s in %d$unit out %d$unit wait-up %.1fs wait-down %.1fs busy %.1fs\n",
+				   "", $ename, dn($st->{'bytes_in'}), dn($st->{'bytes_out'}),
+				   $st->{'wait_upstream'}, $st->{'wait_downstream'},
+				   $st->{'busy'};
+			}
+		    }
 		}
 	    } else {
 		print "Idle";
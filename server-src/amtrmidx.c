@@ -33,6 +33,7 @@
  * dump.
  */
 
+
 #include "amanda.h"
 #include "conffile.h"
 #include "diskfile.h"
@@ -41,6 +42,14 @@
 #include "amutil.h"
 #include "amindex.h"
 #include "pipespawn.h"
+#include "linesort.h"
+#include "amcompress.h"
+
+/* upper limit of the index directories trimmed at once */
+#define AMTRMIDX_MAX_THREADS 8
+
+/* the manifest of the index directories, in the top index directory */
+#define MANIFEST_NAME "amtrmidx.manifest"
 
 typedef struct inames {
     gboolean header;
@@ -50,10 +59,55 @@ typedef struct inames {
     gboolean index_unsorted;
     gboolean index_unsorted_gz;
     gboolean state_gz;
+    gboolean blocks;
 } inames;
 
+/* One index directory, with all the DLEs that use it */
+typedef struct trim_dir_s {
+    char *host;			/* sanitised */
+    char *disk;			/* sanitised */
+    char *indexdir;		/* with a trailing '/' */
+    GSList *matching_dp;
+
+    /* results, for the manifest */
+    gboolean done;		/* the directory was read */
+    time_t mtime;		/* of the directory, once trimmed */
+    time_t recheck;		/* a kept file becomes removable, or 0 */
+    GPtrArray *kept;		/* the index names of dumps in the catalog */
+} trim_dir_t;
+
+/* An index directory in the manifest of the previous run */
+typedef struct manifest_entry_s {
+    time_t mtime;
+    time_t recheck;
+    int flags;
+    char **names;
+} manifest_entry_t;
+
+#define MANIFEST_SORT		(1 << 0)
+#define MANIFEST_COMPRESS	(1 << 1)
+
+static int amtrmidx_debug = 0;
+static gboolean compress_index;
+static gboolean sort_index;
+static gboolean in_process;	/* uncompress, sort and compress in-process */
+static time_t start_time;
+static time_t tmp_time;		/* files older than this may be removed */
+static GHashTable *dump_hash;
+
 static int sort_by_name_reversed(const void *a, const void *b);
 static gboolean file_exists(char *filename);
+static void trim_indexdir(gpointer data, gpointer user_data);
+static void remove_old_file(trim_dir_t *td, char *filepath);
+static void convert_index(char *src_name, gboolean src_gz, char *dst_name,
+			  gboolean dst_gz, gboolean sort);
+static gboolean rewrite_index(char *src_name, gboolean src_gz,
+			      char *dst_name, gboolean dst_gz, gboolean sort,
+			      char **errmsg);
+static gboolean still_in_catalog(trim_dir_t *td, char *name);
+static GHashTable *read_manifest(char *filename);
+static void write_manifest(char *filename, GPtrArray *dirs);
+static void free_manifest_entry(gpointer data);
 static pid_t run_compress(int fd_in, int *fd_out, int *fd_err,
 			  char *source_filename, char *dest_filename);
 static pid_t run_uncompress(int fd_in, int *fd_out, int *fd_err,
@@ -82,20 +136,22 @@ main(
     char **	argv)
 {
     GList  *dlist;
-    GList  *dlist1;
     disk_t *diskp;
     disklist_t diskl;
-    size_t i;
+    guint i;
     char *conf_diskfile;
     char *conf_indexdir;
-    GHashTable *dump_hash;
-    time_t tmp_time;
-    int amtrmidx_debug = 0;
     config_overrides_t *cfg_ovr = NULL;
-    gboolean   compress_index;
-    gboolean   sort_index;
     char      *lock_file;
     file_lock *lock_index;
+    char      *manifest_file;
+    GHashTable *manifest;
+    GHashTable *dir_hash;
+    GPtrArray  *dirs;
+    GThreadPool *pool = NULL;
+    int         nthreads = 1;
+    int         flags;
+    guint       nb_skipped = 0;
 
     glib_init();
 
@@ -157,6 +213,8 @@ main(
 
     compress_index = getconf_boolean(CNF_COMPRESS_INDEX);
     sort_index = getconf_boolean(CNF_SORT_INDEX);
+    flags = (sort_index ? MANIFEST_SORT : 0) |
+	    (compress_index ? MANIFEST_COMPRESS : 0);
 
     dump_hash = amcatalog_get_dump_list();
 
@@ -165,514 +223,139 @@ main(
     /* take a lock file to prevent concurent trim */
     lock_file = g_strdup_printf("%s/%s", conf_indexdir, "lock");
     lock_index = file_lock_new(lock_file);
+    manifest_file = g_strdup_printf("%s/%s", conf_indexdir, MANIFEST_NAME);
     if (file_lock_lock_wr(lock_index) != 0)
 	goto lock_failed;
 
-    /* now go through the list of disks and find which have indexes */
-    time(&tmp_time);
-    tmp_time -= 7*24*60*60;			/* back one week */
-    for (dlist = diskl.head; dlist != NULL; dlist = dlist->next)
-    {
+    time(&start_time);
+    tmp_time = start_time - 7*24*60*60;		/* back one week */
+
+    /* Without zlib, the pipelines of processes are kept, and they must not
+     * be forked from several threads. */
+    in_process = amcompress_supported(AMCOMPRESS_GZIP);
+    if (in_process) {
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+	nthreads = ncpu > 0 ? (int)MIN(ncpu, AMTRMIDX_MAX_THREADS) : 1;
+    }
+
+    /* find the index directories and the dles that use each of them */
+    dir_hash = g_hash_table_new(g_str_hash, g_str_equal);
+    dirs = g_ptr_array_new();
+    for (dlist = diskl.head; dlist != NULL; dlist = dlist->next) {
+	char *host, *disk, *indexdir;
+	trim_dir_t *td;
+
 	diskp = dlist->data;
-	if (diskp->index)
-	{
-	    char *indexdir, *qindexdir;
-	    DIR *d;
-	    struct dirent *f;
-	    char **names;
-	    size_t name_length;
-	    size_t name_count;
-	    char *host;
-	    char *disk, *qdisk;
-	    disk_t *dp;
-	    GSList *matching_dp = NULL;
-	    GHashTable *hash_inames = g_hash_table_new_full(g_str_hash, g_str_equal, &g_free, &g_free);
-	    inames *iname;
-
-	    /* get listing of indices, newest first */
-	    host = sanitise_filename(diskp->host->hostname);
-	    disk = sanitise_filename(diskp->name);
-	    qdisk = quote_string(diskp->name);
-	    indexdir = g_strjoin(NULL, conf_indexdir, "/",
-				 host, "/",
-				 disk, "/",
-				 NULL);
-	    qindexdir = quote_string(indexdir);
-
-	    /* find all dles that use the same indexdir */
-	    for (dlist1 = diskl.head; dlist1 != NULL; dlist1 = dlist1->next)
-	    {
-		char *dp_host, *dp_disk;
-
-		dp = dlist1->data;
-		dp_host = sanitise_filename(dp->host->hostname);
-		dp_disk = sanitise_filename(dp->name);
-		if (g_str_equal(host, dp_host) &&
-		    g_str_equal(disk, dp_disk)) {
-		    matching_dp = g_slist_append(matching_dp, dp);
-		}
-		amfree(dp_host);
-		amfree(dp_disk);
-	    }
+	host = sanitise_filename(diskp->host->hostname);
+	disk = sanitise_filename(diskp->name);
+	indexdir = g_strjoin(NULL, conf_indexdir, "/",
+			     host, "/",
+			     disk, "/",
+			     NULL);
+	td = g_hash_table_lookup(dir_hash, indexdir);
+	if (!td) {
+	    td = g_new0(trim_dir_t, 1);
+	    td->host = host;
+	    td->disk = disk;
+	    td->indexdir = indexdir;
+	    g_hash_table_insert(dir_hash, td->indexdir, td);
+	    g_ptr_array_add(dirs, td);
+	} else {
+	    amfree(host);
+	    amfree(disk);
+	    amfree(indexdir);
+	}
+	td->matching_dp = g_slist_append(td->matching_dp, diskp);
+    }
 
-	    dbprintf("%s %s -> %s\n", diskp->host->hostname,
-			qdisk, qindexdir);
-	    amfree(qdisk);
-	    if ((d = opendir(indexdir)) == NULL) {
-		dbprintf(_("could not open index directory %s: %s\n"), qindexdir, strerror(errno));
-		amfree(host);
-		amfree(disk);
-		amfree(indexdir);
-	        amfree(qindexdir);
-		g_slist_free(matching_dp);
-		continue;
-	    }
-	    name_length = 100;
-	    names = (char **)g_malloc(name_length * sizeof(char *));
-	    name_count = 0;
-	    while ((f = readdir(d)) != NULL) {
-		size_t  l;
-		char   *n;
-		size_t len_date = 0;
-		char *name;
-		gboolean is_new = FALSE;
-
-		if (is_dot_or_dotdot(f->d_name)) {
-		    continue;
-		}
-		name = g_strdup(f->d_name);
-		n = name;
-		while (((*n >= '0' && *n <= '9') || *n == '_')) {
-		    if (*n == '_')
-			len_date = n -name;
-		    n++;
-		}
+    manifest = read_manifest(manifest_file);
 
-		/* len_date=8  for YYYYMMDD       */
-		/* len_date=14 for YYYYMMDDHHMMSS */
-		if((len_date != 8 && len_date != 14)
-		    || f->d_name[len_date] != '_'
-		    || ! isdigit((int)(f->d_name[len_date+1]))) {
-		    g_free(name);
-		    continue;			/* not an index file */
-		}
-		/*
-		 * Clear out old index temp files.
-		 */
-		l = strlen(f->d_name) - (sizeof(".tmp")-1);
-		if ((l > (len_date + 1))
-			&& (g_str_equal(f->d_name + l, ".tmp"))) {
-		    struct stat sbuf;
-		    char *path, *qpath;
-
-		    path = g_strconcat(indexdir, f->d_name, NULL);
-		    qpath = quote_string(path);
-		    if(lstat(path, &sbuf) != -1
-			&& ((sbuf.st_mode & S_IFMT) == S_IFREG)
-			&& ((time_t)sbuf.st_mtime < tmp_time)) {
-			dbprintf("rm %s\n", qpath);
-		        if(amtrmidx_debug == 0 && unlink(path) == -1) {
-			    dbprintf(_("Error removing %s: %s\n"),
-				      qpath, strerror(errno));
-		        }
-		    }
-		    amfree(qpath);
-		    amfree(path);
-		    g_free(name);
-		    continue;
-		}
-		if(name_count >= name_length) {
-		    char **new_names;
-
-		    new_names = g_malloc((name_length * 2) * sizeof(char *));
-		    memcpy(new_names, names, name_length * sizeof(char *));
-		    amfree(names);
-		    names = new_names;
-		    name_length *= 2;
-		}
+    if (nthreads > 1) {
+	GError *error = NULL;
 
-		*n = '\0';
-		n++;
-		iname = g_hash_table_lookup(hash_inames, name);
-		if (!iname) {
-		    iname = g_new0(struct inames, 1);
-		    is_new = TRUE;
-		}
-		if (strcmp(n, "header") == 0) {
-		    iname->header = TRUE;
-		} else if (strcmp(n, "gz") == 0) {
-		    iname->index_gz = TRUE;
-		} else if (strcmp(n, "sorted") == 0) {
-		    iname->index_sorted = TRUE;
-		} else if (strcmp(n, "sorted.gz") == 0) {
-		    iname->index_sorted_gz = TRUE;
-		} else if (strcmp(n, "unsorted") == 0) {
-		    iname->index_unsorted = TRUE;
-		} else if (strcmp(n, "unsorted.gz") == 0) {
-		    iname->index_unsorted_gz = TRUE;
-		} else if (strcmp(n, "state.gz") == 0) {
-		    iname->state_gz = TRUE;
-		} else {
-		    char *path, *qpath;
-
-		    path = g_strconcat(indexdir, f->d_name, NULL);
-		    qpath = quote_string(path);
-		    dbprintf("rm %s\n", qpath);
-		    if (amtrmidx_debug == 0 && unlink(path) == -1) {
-			dbprintf("Error removing %s: %s\n",
-				 qpath, strerror(errno));
-		    }
-		    g_free(name);
-		    continue;
-		}
-		if (is_new) {
-		    g_hash_table_insert(hash_inames, g_strdup(name), iname);
-		    names[name_count++] = g_strdup(name);
-		}
-		g_free(name);
-	    }
-	    closedir(d);
-	    qsort(names, name_count, sizeof(char *), sort_by_name_reversed);
-
-	    /*
-	     * Search for the first full dump past the minimum number
-	     * of index files to keep.
-	     */
-	    for (i = 0; i < name_count; i++) {
-		char *datestamp;
-		int level;
-		size_t len_date;
-		int matching = 0;
-		GSList *mdp;
-
-		for (len_date = 0; len_date < sizeof("YYYYMMDDHHMMSS")-1; len_date++) {
-                    if (!isdigit((int)(names[i][len_date]))) {
-                        break;
-                    }
-                }
-
-		iname = g_hash_table_lookup(hash_inames, names[i]);
-		datestamp = g_strdup(names[i]);
-		datestamp[len_date] = '\0';
-
-		if (sscanf(&names[i][len_date+1], "%d", &level) != 1)
-		    level = 0;
-		for (mdp = matching_dp; mdp != NULL; mdp = mdp->next) {
-		    dp = mdp->data;
-		    if (cat_dump_hash_exist(dump_hash, dp->host->hostname,
-					    dp->name, datestamp, level)) {
-			matching = 1;
-		    }
-		}
-		if (!matching) {
-		    struct stat sbuf;
-		    char *path;
-
-		    path = g_strconcat(indexdir, names[i], NULL);
-
-		    if (iname && iname->header) {
-			char *filepath = g_strconcat(path, ".header", NULL);
-			if (lstat(filepath, &sbuf) != -1 &&
-			    ((sbuf.st_mode & S_IFMT) == S_IFREG) &&
-			    ((time_t)sbuf.st_mtime < tmp_time)) {
-			    char *qfilepath = quote_string(filepath);
-			    g_debug("rm %s", qfilepath);
-		            if(amtrmidx_debug == 0 && unlink(filepath) == -1) {
-				g_debug("Error removing %s: %s",
-					 qfilepath, strerror(errno));
-			    }
-			    amfree(qfilepath);
-		        }
-			amfree(filepath);
-		    }
-
-		    if (iname && iname->index_gz) {
-			char *filepath = g_strconcat(path, ".gz", NULL);
-			if (lstat(filepath, &sbuf) != -1 &&
-			    ((sbuf.st_mode & S_IFMT) == S_IFREG) &&
-			    ((time_t)sbuf.st_mtime < tmp_time)) {
-			    char *qfilepath = quote_string(filepath);
-			    g_debug("rm %s", qfilepath);
-		            if(amtrmidx_debug == 0 && unlink(filepath) == -1) {
-				g_debug("Error removing %s: %s",
-					 qfilepath, strerror(errno));
-			    }
-			    amfree(qfilepath);
-		        }
-			amfree(filepath);
-		    }
-
-		    if (iname && iname->index_sorted) {
-			char *filepath = g_strconcat(path, "-sorted", NULL);
-			if (lstat(filepath, &sbuf) != -1 &&
-			    ((sbuf.st_mode & S_IFMT) == S_IFREG) &&
-			    ((time_t)sbuf.st_mtime < tmp_time)) {
-			    char *qfilepath = quote_string(filepath);
-			    g_debug("rm %s", qfilepath);
-		            if(amtrmidx_debug == 0 && unlink(filepath) == -1) {
-				g_debug("Error removing %s: %s",
-					 qfilepath, strerror(errno));
-			    }
-			    amfree(qfilepath);
-		        }
-			amfree(filepath);
-		    }
-
-		    if (iname && iname->index_sorted_gz) {
-			char *filepath = g_strconcat(path, "-sorted.gz", NULL);
-			if (lstat(filepath, &sbuf) != -1 &&
-			    ((sbuf.st_mode & S_IFMT) == S_IFREG) &&
-			    ((time_t)sbuf.st_mtime < tmp_time)) {
-			    char *qfilepath = quote_string(filepath);
-			    g_debug("rm %s", qfilepath);
-		            if(amtrmidx_debug == 0 && unlink(filepath) == -1) {
-				g_debug("Error removing %s: %s",
-					 qfilepath, strerror(errno));
-			    }
-			    amfree(qfilepath);
-		        }
-			amfree(filepath);
-		    }
-
-		    if (iname && iname->index_unsorted_gz) {
-			char *filepath = g_strconcat(path, "-unsorted.gz", NULL);
-			if (lstat(filepath, &sbuf) != -1 &&
-			    ((sbuf.st_mode & S_IFMT) == S_IFREG) &&
-			    ((time_t)sbuf.st_mtime < tmp_time)) {
-			    char *qfilepath = quote_string(filepath);
-			    g_debug("rm %s", qfilepath);
-		            if(amtrmidx_debug == 0 && unlink(filepath) == -1) {
-				g_debug("Error removing %s: %s",
-					 qfilepath, strerror(errno));
-			    }
-			    amfree(qfilepath);
-		        }
-			amfree(filepath);
-		    }
-
-		    if (iname && iname->index_unsorted) {
-			char *filepath = g_strconcat(path, "-unsorted", NULL);
-			if (lstat(filepath, &sbuf) != -1 &&
-			    ((sbuf.st_mode & S_IFMT) == S_IFREG) &&
-			    ((time_t)sbuf.st_mtime < tmp_time)) {
-			    char *qfilepath = quote_string(filepath);
-			    g_debug("rm %s", qfilepath);
-		            if(amtrmidx_debug == 0 && unlink(filepath) == -1) {
-				g_debug("Error removing %s: %s",
-					 qfilepath, strerror(errno));
-			    }
-			    amfree(qfilepath);
-		        }
-			amfree(filepath);
-		    }
-
-		    if (iname && iname->state_gz) {
-			char *filepath = g_strconcat(path, ".state.gz", NULL);
-			if (lstat(filepath, &sbuf) != -1 &&
-			    ((sbuf.st_mode & S_IFMT) == S_IFREG) &&
-			    ((time_t)sbuf.st_mtime < tmp_time)) {
-			    char *qfilepath = quote_string(filepath);
-			    g_debug("rm %s", qfilepath);
-		            if(amtrmidx_debug == 0 && unlink(filepath) == -1) {
-				g_debug("Error removing %s: %s",
-					 qfilepath, strerror(errno));
-			    }
-			    amfree(qfilepath);
-		        }
-			amfree(filepath);
-		    }
-
-		    amfree(path);
-		} else {
-
-		/* Did it require un/compression and/or sorting */
-		char *orig_name = getindexfname(host, disk, datestamp, level);
-		char *sorted_name = getindex_sorted_fname(host, disk, datestamp, level);
-		char *sorted_gz_name = getindex_sorted_gz_fname(host, disk, datestamp, level);
-		char *unsorted_name = getindex_unsorted_fname(host, disk, datestamp, level);
-		char *unsorted_gz_name = getindex_unsorted_gz_fname(host, disk, datestamp, level);
-
-		gboolean orig_exist = FALSE;
-		gboolean sorted_exist = FALSE;
-		gboolean sorted_gz_exist = FALSE;
-		gboolean unsorted_exist = FALSE;
-		gboolean unsorted_gz_exist = FALSE;
-
-		int fd;
-		int uncompress_err_fd = -1;
-		int sort_err_fd = -1;
-		int compress_err_fd = -1;
-
-		pid_t uncompress_pid = -1;
-		pid_t sort_pid = -1;
-		pid_t compress_pid = -1;
-
-		iname = g_hash_table_lookup(hash_inames, names[i]);
-		if (iname) {
-		    orig_exist = iname->index_gz;
-		    sorted_exist = iname->index_sorted;
-		    sorted_gz_exist = iname->index_sorted_gz;
-		    unsorted_exist = iname->index_unsorted;
-		    unsorted_gz_exist = iname->index_unsorted_gz;
-		} else {
-		    orig_exist = file_exists(orig_name);
-		    sorted_exist = file_exists(sorted_name);
-		    sorted_gz_exist = file_exists(sorted_gz_name);
-		    unsorted_exist = file_exists(unsorted_name);
-		    unsorted_gz_exist = file_exists(unsorted_gz_name);
-		}
+	pool = g_thread_pool_new(trim_indexdir, NULL, nthreads, FALSE, &error);
+	if (!pool) {
+	    g_debug("can't create the thread pool: %s",
+		    error ? error->message : "unknown error");
+	    if (error)
+		g_error_free(error);
+	}
+    }
+
+    for (i = 0; i < dirs->len; i++) {
+	trim_dir_t *td = g_ptr_array_index(dirs, i);
+	manifest_entry_t *me = g_hash_table_lookup(manifest, td->indexdir);
+	gboolean indexed = FALSE;
+	GSList *mdp;
 
-		if (sort_index && compress_index) {
-		    if (!sorted_gz_exist) {
-			if (sorted_exist) {
-			    // COMPRESS
-			    compress_pid = run_compress(-1, NULL, &compress_err_fd, sorted_name, sorted_gz_name);
-			    unlink(sorted_name);
-			} else if (unsorted_exist) {
-			    // SORT AND COMPRESS
-			    sort_pid = run_sort(-1, &fd, &sort_err_fd, unsorted_name, NULL);
-			    compress_pid = run_compress(fd, NULL, &compress_err_fd, NULL, sorted_gz_name);
-			    unlink(unsorted_name);
-			} else if (unsorted_gz_exist) {
-			    // UNCOMPRESS SORT AND COMPRESS
-			    uncompress_pid = run_uncompress(-1, &fd, &uncompress_err_fd, unsorted_gz_name, NULL);
-			    sort_pid = run_sort(fd, &fd, &sort_err_fd, NULL, NULL);
-			    compress_pid = run_compress(fd, NULL, &compress_err_fd, NULL, sorted_gz_name);
-			    unlink(unsorted_gz_name);
-			} else if (orig_exist) {
-			    // UNCOMPRESS SORT AND COMPRESS
-			    uncompress_pid = run_uncompress(-1, &fd, &uncompress_err_fd, orig_name, NULL);
-			    sort_pid = run_sort(fd, &fd, &sort_err_fd, NULL, NULL);
-			    compress_pid = run_compress(fd, NULL, &compress_err_fd, NULL, sorted_gz_name);
-			    unlink(orig_name);
-			}
-		    } else {
-			if (sorted_exist) {
-			    unlink(sorted_name);
-			}
-			if (unsorted_exist) {
-			    unlink(unsorted_name);
-			}
-			if (unsorted_gz_exist) {
-			    unlink(unsorted_gz_name);
-			}
-		    }
-		} else if (sort_index && !compress_index) {
-		    if (!sorted_exist) {
-			if (sorted_gz_exist) {
-			    // UNCOMPRESS
-			    uncompress_pid = run_uncompress(-1, NULL, &uncompress_err_fd, sorted_gz_name, sorted_name);
-			    unlink(sorted_gz_name);
-			} else if (unsorted_exist) {
-			    // SORT
-			    sort_pid = run_sort(-1, NULL, &sort_err_fd, unsorted_name, sorted_name);
-			    unlink(unsorted_name);
-			} else if (unsorted_gz_exist) {
-			    // UNCOMPRESS AND SORT
-			    uncompress_pid = run_uncompress(-1, &fd, &uncompress_err_fd, unsorted_gz_name, NULL);
-			    sort_pid = run_sort(fd, NULL, &sort_err_fd, NULL, sorted_name);
-			    unlink(unsorted_gz_name);
-			} else if (orig_exist) {
-			    // UNCOMPRESS AND SORT
-			    uncompress_pid = run_uncompress(-1, &fd, &uncompress_err_fd, orig_name, NULL);
-			    sort_pid = run_sort(fd, NULL, &sort_err_fd, NULL, sorted_name);
-			    unlink(orig_name);
-			}
-		    } else {
-			if (sorted_gz_exist) {
-			    unlink(sorted_gz_name);
-			}
-			if (unsorted_exist) {
-			    unlink(unsorted_name);
-			}
-			if (unsorted_gz_exist) {
-			    unlink(unsorted_gz_name);
-			}
-		    }
-		} else if (!sort_index && compress_index) {
-		    if (!sorted_gz_exist && !unsorted_gz_exist) {
-			if (sorted_exist) {
-			    // COMPRESS sorted
-			    compress_pid = run_compress(-1, NULL, &compress_err_fd, sorted_name, sorted_gz_name);
-			    unlink(sorted_name);
-			} else if (unsorted_exist) {
-			    // COMPRESS unsorted
-			    compress_pid = run_compress(-1, NULL, &compress_err_fd, unsorted_name, unsorted_gz_name);
-			    unlink(unsorted_name);
-			} else if (orig_exist) {
-			    // RENAME orig
-			    rename(orig_name, unsorted_gz_name);
-			}
-		    } else {
-			if (sorted_exist) {
-			    unlink(sorted_name);
-			}
-			if (unsorted_exist) {
-			    unlink(unsorted_name);
-			}
-			if (sorted_gz_exist && unsorted_gz_exist) {
-			    unlink(unsorted_gz_name);
-			}
-		    }
-		} else if (!sort_index && !compress_index) {
-		    if (!sorted_exist && !unsorted_exist) {
-			if (sorted_gz_exist) {
-			    // UNCOMPRESS sorted
-			    uncompress_pid = run_uncompress(-1, NULL, &uncompress_err_fd, sorted_gz_name, sorted_name);
-			    unlink(sorted_gz_name);
-			} else if (unsorted_gz_exist) {
-			    // UNCOMPRESS unsorted
-			    uncompress_pid = run_uncompress(-1, NULL, &uncompress_err_fd, unsorted_gz_name, unsorted_name);
-			    unlink(unsorted_gz_name);
-			} else if (orig_exist) {
-			    // UNCOMPRESS orig
-			    uncompress_pid = run_uncompress(-1, NULL, &uncompress_err_fd, orig_name, unsorted_name);
-			    unlink(orig_name);
-			}
-		    } else {
-			if (sorted_gz_exist) {
-			    unlink(sorted_gz_name);
-			}
-			if (unsorted_gz_exist) {
-			    unlink(unsorted_gz_name);
-			}
-			if (sorted_exist && unsorted_exist) {
-			    unlink(unsorted_name);
-			}
-		    }
+	for (mdp = td->matching_dp; mdp != NULL; mdp = mdp->next) {
+	    if (((disk_t *)mdp->data)->index)
+		indexed = TRUE;
+	}
+	if (!indexed)
+	    continue;
+
+	/* The directory is unchanged if its mtime is the one of the previous
+	 * run, no kept file became removable since then, and the dumps of
+	 * all the kept files are still in the catalog. */
+	if (me && me->flags == flags &&
+	    (me->recheck == 0 || me->recheck > start_time)) {
+	    struct stat sbuf;
+	    char **name;
+
+	    if (stat(td->indexdir, &sbuf) == 0 && sbuf.st_mtime == me->mtime) {
+		for (name = me->names; *name != NULL; name++) {
+		    if (!still_in_catalog(td, *name))
+			break;
 		}
-		    if (uncompress_pid != -1)
-			wait_process(uncompress_pid, uncompress_err_fd, "uncompress");
-		    if (sort_pid != -1)
-			wait_process(sort_pid, sort_err_fd, "sort");
-		    if (compress_pid != -1)
-			wait_process(compress_pid, compress_err_fd, "compress");
-
-		    g_free(orig_name);
-		    g_free(sorted_name);
-		    g_free(sorted_gz_name);
-		    g_free(unsorted_name);
-		    g_free(unsorted_gz_name);
+		if (*name == NULL) {
+		    /* keep its manifest entry */
+		    td->done = TRUE;
+		    td->mtime = me->mtime;
+		    td->recheck = me->recheck;
+		    td->kept = g_ptr_array_new();
+		    for (name = me->names; *name != NULL; name++)
+			g_ptr_array_add(td->kept, g_strdup(*name));
+		    nb_skipped++;
+		    continue;
 		}
-
-		amfree(datestamp);
-		amfree(names[i]);
 	    }
-	    g_slist_free(matching_dp);
-	    amfree(names);
-	    amfree(host);
-	    amfree(disk);
-	    amfree(indexdir);
-	    amfree(qindexdir);
-	    g_hash_table_destroy(hash_inames);
 	}
+
+	if (pool)
+	    g_thread_pool_push(pool, td, NULL);
+	else
+	    trim_indexdir(td, NULL);
     }
+    if (pool)
+	g_thread_pool_free(pool, FALSE, TRUE);
+    dbprintf("%u index directories, %u unchanged\n", dirs->len, nb_skipped);
+
+    if (amtrmidx_debug == 0)
+	write_manifest(manifest_file, dirs);
+
+    for (i = 0; i < dirs->len; i++) {
+	trim_dir_t *td = g_ptr_array_index(dirs, i);
+
+	if (td->kept)
+	    g_ptr_array_free(td->kept, TRUE);
+	g_slist_free(td->matching_dp);
+	amfree(td->host);
+	amfree(td->disk);
+	amfree(td->indexdir);
+	g_free(td);
+    }
+    g_ptr_array_free(dirs, TRUE);
+    g_hash_table_destroy(dir_hash);
+    g_hash_table_destroy(manifest);
 
     file_lock_unlock(lock_index);
 lock_failed:
     file_lock_free(lock_index);
     amfree(conf_indexdir);
     amfree(lock_file);
+    amfree(manifest_file);
     g_hash_table_destroy(dump_hash);
     free_disklist(&diskl);
     unload_disklist();
@@ -682,6 +365,409 @@ lock_failed:
     return 0;
 }
 
+/* Is the dump of the index file NAME (DATESTAMP_LEVEL) in the catalog, for
+ * one of the DLEs of the directory? */
+static gboolean
+still_in_catalog(
+    trim_dir_t *td,
+    char *name)
+{
+    char *datestamp;
+    int level;
+    size_t len_date;
+    GSList *mdp;
+    gboolean matching = FALSE;
+
+    for (len_date = 0; len_date < sizeof("YYYYMMDDHHMMSS")-1; len_date++) {
+	if (!isdigit((int)(name[len_date]))) {
+	    break;
+	}
+    }
+
+    datestamp = g_strdup(name);
+    datestamp[len_date] = '\0';
+
+    if (name[len_date] != '_' || sscanf(&name[len_date+1], "%d", &level) != 1)
+	level = 0;
+    for (mdp = td->matching_dp; mdp != NULL; mdp = mdp->next) {
+	disk_t *dp = mdp->data;
+	if (cat_dump_hash_exist(dump_hash, dp->host->hostname,
+				dp->name, datestamp, level)) {
+	    matching = TRUE;
+	}
+    }
+    g_free(datestamp);
+
+    return matching;
+}
+
+/* Remove FILEPATH if it is older than a week; otherwise remember when it
+ * will be. */
+static void
+remove_old_file(
+    trim_dir_t *td,
+    char *filepath)
+{
+    struct stat sbuf;
+
+    if (lstat(filepath, &sbuf) == -1 || (sbuf.st_mode & S_IFMT) != S_IFREG)
+	return;
+
+    if ((time_t)sbuf.st_mtime < tmp_time) {
+	char *qfilepath = quote_string(filepath);
+	g_debug("rm %s", qfilepath);
+	if (amtrmidx_debug == 0 && unlink(filepath) == -1) {
+	    g_debug("Error removing %s: %s",
+		    qfilepath, strerror(errno));
+	}
+	amfree(qfilepath);
+    } else {
+	time_t when = (time_t)sbuf.st_mtime + 7*24*60*60 + 1;
+
+	if (td->recheck == 0 || when < td->recheck)
+	    td->recheck = when;
+    }
+}
+
+/*
+ * Trim one index directory; run by the workers of the pool.
+ */
+static void
+trim_indexdir(
+    gpointer data,
+    gpointer user_data G_GNUC_UNUSED)
+{
+    trim_dir_t *td = data;
+    char *indexdir = td->indexdir;
+    char *qindexdir;
+    char *host = td->host;
+    char *disk = td->disk;
+    DIR *d;
+    struct dirent *f;
+    char **names;
+    size_t name_length;
+    size_t name_count;
+    size_t i;
+    GHashTable *hash_inames = g_hash_table_new_full(g_str_hash, g_str_equal, &g_free, &g_free);
+    inames *iname;
+    struct stat sbuf;
+
+    qindexdir = quote_string(indexdir);
+    dbprintf("%s\n", qindexdir);
+
+    if ((d = opendir(indexdir)) == NULL) {
+	dbprintf(_("could not open index directory %s: %s\n"), qindexdir, strerror(errno));
+	amfree(qindexdir);
+	g_hash_table_destroy(hash_inames);
+	return;
+    }
+    td->kept = g_ptr_array_new();
+
+    /* get listing of indices, newest first */
+    name_length = 100;
+    names = (char **)g_malloc(name_length * sizeof(char *));
+    name_count = 0;
+    while ((f = readdir(d)) != NULL) {
+	size_t  l;
+	char   *n;
+	size_t len_date = 0;
+	char *name;
+	gboolean is_new = FALSE;
+
+	if (is_dot_or_dotdot(f->d_name)) {
+	    continue;
+	}
+	name = g_strdup(f->d_name);
+	n = name;
+	while (((*n >= '0' && *n <= '9') || *n == '_')) {
+	    if (*n == '_')
+		len_date = n -name;
+	    n++;
+	}
+
+	/* len_date=8  for YYYYMMDD       */
+	/* len_date=14 for YYYYMMDDHHMMSS */
+	if((len_date != 8 && len_date != 14)
+	    || f->d_name[len_date] != '_'
+	    || ! isdigit((int)(f->d_name[len_date+1]))) {
+	    g_free(name);
+	    continue;			/* not an index file */
+	}
+	/*
+	 * Clear out old index temp files.
+	 */
+	l = strlen(f->d_name) - (sizeof(".tmp")-1);
+	if ((l > (len_date + 1))
+		&& (g_str_equal(f->d_name + l, ".tmp"))) {
+	    char *path;
+
+	    path = g_strconcat(indexdir, f->d_name, NULL);
+	    remove_old_file(td, path);
+	    amfree(path);
+	    g_free(name);
+	    continue;
+	}
+	if(name_count >= name_length) {
+	    char **new_names;
+
+	    new_names = g_malloc((name_length * 2) * sizeof(char *));
+	    memcpy(new_names, names, name_length * sizeof(char *));
+	    amfree(names);
+	    names = new_names;
+	    name_length *= 2;
+	}
+
+	*n = '\0';
+	n++;
+	iname = g_hash_table_lookup(hash_inames, name);
+	if (!iname) {
+	    iname = g_new0(struct inames, 1);
+	    is_new = TRUE;
+	}
+	if (strcmp(n, "header") == 0) {
+	    iname->header = TRUE;
+	} else if (strcmp(n, "gz") == 0) {
+	    iname->index_gz = TRUE;
+	} else if (strcmp(n, "sorted") == 0) {
+	    iname->index_sorted = TRUE;
+	} else if (strcmp(n, "sorted.gz") == 0) {
+	    iname->index_sorted_gz = TRUE;
+	} else if (strcmp(n, "unsorted") == 0) {
+	    iname->index_unsorted = TRUE;
+	} else if (strcmp(n, "unsorted.gz") == 0) {
+	    iname->index_unsorted_gz = TRUE;
+	} else if (strcmp(n, "state.gz") == 0) {
+	    iname->state_gz = TRUE;
+	} else if (strcmp(n, "blocks") == 0) {
+	    iname->blocks = TRUE;
+	} else {
+	    char *path, *qpath;
+
+	    path = g_strconcat(indexdir, f->d_name, NULL);
+	    qpath = quote_string(path);
+	    dbprintf("rm %s\n", qpath);
+	    if (amtrmidx_debug == 0 && unlink(path) == -1) {
+		dbprintf("Error removing %s: %s\n",
+			 qpath, strerror(errno));
+	    }
+	    amfree(qpath);
+	    amfree(path);
+	    if (is_new)
+		g_free(iname);
+	    g_free(name);
+	    continue;
+	}
+	if (is_new) {
+	    g_hash_table_insert(hash_inames, g_strdup(name), iname);
+	    names[name_count++] = g_strdup(name);
+	}
+	g_free(name);
+    }
+    closedir(d);
+    qsort(names, name_count, sizeof(char *), sort_by_name_reversed);
+
+    /*
+     * Search for the first full dump past the minimum number
+     * of index files to keep.
+     */
+    for (i = 0; i < name_count; i++) {
+	char *datestamp;
+	int level;
+	size_t len_date;
+
+	for (len_date = 0; len_date < sizeof("YYYYMMDDHHMMSS")-1; len_date++) {
+	    if (!isdigit((int)(names[i][len_date]))) {
+		break;
+	    }
+	}
+
+	iname = g_hash_table_lookup(hash_inames, names[i]);
+	datestamp = g_strdup(names[i]);
+	datestamp[len_date] = '\0';
+
+	if (sscanf(&names[i][len_date+1], "%d", &level) != 1)
+	    level = 0;
+	if (!still_in_catalog(td, names[i])) {
+	    char *path;
+	    static char *suffixes[] = {
+		".header", ".gz", "-sorted", "-sorted.gz", "-unsorted.gz",
+		"-unsorted", ".state.gz", ".blocks"
+	    };
+	    gboolean present[G_N_ELEMENTS(suffixes)];
+	    guint s;
+
+	    if (iname) {
+		present[0] = iname->header;
+		present[1] = iname->index_gz;
+		present[2] = iname->index_sorted;
+		present[3] = iname->index_sorted_gz;
+		present[4] = iname->index_unsorted_gz;
+		present[5] = iname->index_unsorted;
+		present[6] = iname->state_gz;
+		present[7] = iname->blocks;
+	    }
+
+	    path = g_strconcat(indexdir, names[i], NULL);
+	    for (s = 0; iname && s < G_N_ELEMENTS(suffixes); s++) {
+		if (present[s]) {
+		    char *filepath = g_strconcat(path, suffixes[s], NULL);
+		    remove_old_file(td, filepath);
+		    amfree(filepath);
+		}
+	    }
+	    amfree(path);
+	} else {
+
+	/* Did it require un/compression and/or sorting */
+	char *orig_name = getindexfname(host, disk, datestamp, level);
+	char *sorted_name = getindex_sorted_fname(host, disk, datestamp, level);
+	char *sorted_gz_name = getindex_sorted_gz_fname(host, disk, datestamp, level);
+	char *unsorted_name = getindex_unsorted_fname(host, disk, datestamp, level);
+	char *unsorted_gz_name = getindex_unsorted_gz_fname(host, disk, datestamp, level);
+
+	gboolean orig_exist = FALSE;
+	gboolean sorted_exist = FALSE;
+	gboolean sorted_gz_exist = FALSE;
+	gboolean unsorted_exist = FALSE;
+	gboolean unsorted_gz_exist = FALSE;
+
+	g_ptr_array_add(td->kept, g_strdup(names[i]));
+
+	if (iname) {
+	    orig_exist = iname->index_gz;
+	    sorted_exist = iname->index_sorted;
+	    sorted_gz_exist = iname->index_sorted_gz;
+	    unsorted_exist = iname->index_unsorted;
+	    unsorted_gz_exist = iname->index_unsorted_gz;
+	} else {
+	    orig_exist = file_exists(orig_name);
+	    sorted_exist = file_exists(sorted_name);
+	    sorted_gz_exist = file_exists(sorted_gz_name);
+	    unsorted_exist = file_exists(unsorted_name);
+	    unsorted_gz_exist = file_exists(unsorted_gz_name);
+	}
+
+	if (sort_index && compress_index) {
+	    if (!sorted_gz_exist) {
+		if (sorted_exist) {
+		    // COMPRESS
+		    convert_index(sorted_name, FALSE, sorted_gz_name, TRUE, FALSE);
+		} else if (unsorted_exist) {
+		    // SORT AND COMPRESS
+		    convert_index(unsorted_name, FALSE, sorted_gz_name, TRUE, TRUE);
+		} else if (unsorted_gz_exist) {
+		    // UNCOMPRESS SORT AND COMPRESS
+		    convert_index(unsorted_gz_name, TRUE, sorted_gz_name, TRUE, TRUE);
+		} else if (orig_exist) {
+		    // UNCOMPRESS SORT AND COMPRESS
+		    convert_index(orig_name, TRUE, sorted_gz_name, TRUE, TRUE);
+		}
+	    } else {
+		if (sorted_exist) {
+		    unlink(sorted_name);
+		}
+		if (unsorted_exist) {
+		    unlink(unsorted_name);
+		}
+		if (unsorted_gz_exist) {
+		    unlink(unsorted_gz_name);
+		}
+	    }
+	} else if (sort_index && !compress_index) {
+	    if (!sorted_exist) {
+		if (sorted_gz_exist) {
+		    // UNCOMPRESS
+		    convert_index(sorted_gz_name, TRUE, sorted_name, FALSE, FALSE);
+		} else if (unsorted_exist) {
+		    // SORT
+		    convert_index(unsorted_name, FALSE, sorted_name, FALSE, TRUE);
+		} else if (unsorted_gz_exist) {
+		    // UNCOMPRESS AND SORT
+		    convert_index(unsorted_gz_name, TRUE, sorted_name, FALSE, TRUE);
+		} else if (orig_exist) {
+		    // UNCOMPRESS AND SORT
+		    convert_index(orig_name, TRUE, sorted_name, FALSE, TRUE);
+		}
+	    } else {
+		if (sorted_gz_exist) {
+		    unlink(sorted_gz_name);
+		}
+		if (unsorted_exist) {
+		    unlink(unsorted_name);
+		}
+		if (unsorted_gz_exist) {
+		    unlink(unsorted_gz_name);
+		}
+	    }
+	} else if (!sort_index && compress_index) {
+	    if (!sorted_gz_exist && !unsorted_gz_exist) {
+		if (sorted_exist) {
+		    // COMPRESS sorted
+		    convert_index(sorted_name, FALSE, sorted_gz_name, TRUE, FALSE);
+		} else if (unsorted_exist) {
+		    // COMPRESS unsorted
+		    convert_index(unsorted_name, FALSE, unsorted_gz_name, TRUE, FALSE);
+		} else if (orig_exist) {
+		    // RENAME orig
+		    rename(orig_name, unsorted_gz_name);
+		}
+	    } else {
+		if (sorted_exist) {
+		    unlink(sorted_name);
+		}
+		if (unsorted_exist) {
+		    unlink(unsorted_name);
+		}
+		if (sorted_gz_exist && unsorted_gz_exist) {
+		    unlink(unsorted_gz_name);
+		}
+	    }
+	} else if (!sort_index && !compress_index) {
+	    if (!sorted_exist && !unsorted_exist) {
+		if (sorted_gz_exist) {
+		    // UNCOMPRESS sorted
+		    convert_index(sorted_gz_name, TRUE, sorted_name, FALSE, FALSE);
+		} else if (unsorted_gz_exist) {
+		    // UNCOMPRESS unsorted
+		    convert_index(unsorted_gz_name, TRUE, unsorted_name, FALSE, FALSE);
+		} else if (orig_exist) {
+		    // UNCOMPRESS orig
+		    convert_index(orig_name, TRUE, unsorted_name, FALSE, FALSE);
+		}
+	    } else {
+		if (sorted_gz_exist) {
+		    unlink(sorted_gz_name);
+		}
+		if (unsorted_gz_exist) {
+		    unlink(unsorted_gz_name);
+		}
+		if (sorted_exist && unsorted_exist) {
+		    unlink(unsorted_name);
+		}
+	    }
+	}
+
+	g_free(orig_name);
+	g_free(sorted_name);
+	g_free(sorted_gz_name);
+	g_free(unsorted_name);
+	g_free(unsorted_gz_name);
+	}
+
+	amfree(datestamp);
+	amfree(names[i]);
+    }
+    amfree(names);
+    amfree(qindexdir);
+    g_hash_table_destroy(hash_inames);
+
+    /* a directory changed during this second may change again unseen */
+    if (stat(indexdir, &sbuf) == 0 && sbuf.st_mtime < start_time) {
+	td->mtime = sbuf.st_mtime;
+	td->done = TRUE;
+    }
+}
+
 static gboolean
 file_exists(
     char *filename)
@@ -696,6 +782,307 @@ file_exists(
     return TRUE;
 }
 
+/*
+ * Rewrite the index SRC_NAME as DST_NAME, uncompressing, sorting and
+ * compressing it on the way, and remove SRC_NAME once it is done.
+ */
+static void
+convert_index(
+    char *src_name,
+    gboolean src_gz,
+    char *dst_name,
+    gboolean dst_gz,
+    gboolean sort)
+{
+    gboolean ok = TRUE;
+
+    if (in_process) {
+	char *errmsg = NULL;
+
+	ok = rewrite_index(src_name, src_gz, dst_name, dst_gz, sort, &errmsg);
+	if (!ok) {
+	    g_debug("can't rewrite %s as %s: %s", src_name, dst_name, errmsg);
+	    g_free(errmsg);
+	}
+    } else {
+	int fd = -1;
+	int uncompress_err_fd = -1;
+	int sort_err_fd = -1;
+	int compress_err_fd = -1;
+	pid_t uncompress_pid = -1;
+	pid_t sort_pid = -1;
+	pid_t compress_pid = -1;
+
+	if (src_gz) {
+	    gboolean last = !sort && !dst_gz;
+	    uncompress_pid = run_uncompress(-1, last ? NULL : &fd,
+				&uncompress_err_fd, src_name,
+				last ? dst_name : NULL);
+	}
+	if (sort) {
+	    sort_pid = run_sort(fd, dst_gz ? &fd : NULL, &sort_err_fd,
+				src_name, dst_gz ? NULL : dst_name);
+	}
+	if (dst_gz) {
+	    compress_pid = run_compress(fd, NULL, &compress_err_fd,
+				src_name, dst_name);
+	}
+
+	if (uncompress_pid != -1)
+	    ok = wait_process(uncompress_pid, uncompress_err_fd, "uncompress") && ok;
+	if (sort_pid != -1)
+	    ok = wait_process(sort_pid, sort_err_fd, "sort") && ok;
+	if (compress_pid != -1)
+	    ok = wait_process(compress_pid, compress_err_fd, "compress") && ok;
+    }
+
+    if (ok)
+	unlink(src_name);
+}
+
+/* Where rewrite_index puts the lines: compressed or not to the output */
+typedef struct index_out_s {
+    amcompress_t *comp;
+    int fd;
+    gboolean failed;
+} index_out_t;
+
+static gboolean
+index_out_write(
+    gpointer data,
+    const char *buf,
+    gsize len)
+{
+    index_out_t *out = data;
+
+    if (out->failed)
+	return FALSE;
+    if (out->comp) {
+	buf = amcompress_update(out->comp, buf, len, &len);
+	if (!buf) {
+	    out->failed = TRUE;
+	    return FALSE;
+	}
+    }
+    if (len > 0 && full_write(out->fd, buf, len) < len)
+	out->failed = TRUE;
+
+    return !out->failed;
+}
+
+/*
+ * The in-process version of the uncompress | sort | compress pipeline.  The
+ * output is written to DST_NAME.tmp, and renamed once it is complete.
+ */
+static gboolean
+rewrite_index(
+    char *src_name,
+    gboolean src_gz,
+    char *dst_name,
+    gboolean dst_gz,
+    gboolean sort,
+    char **errmsg)
+{
+    char *tmp_name = g_strconcat(dst_name, ".tmp", NULL);
+    amcompress_t *decomp = NULL;
+    linesort_t *ls = NULL;
+    index_out_t out = { NULL, -1, FALSE };
+    char buf[65536];
+    char *data;
+    gsize len;
+    ssize_t nread;
+    int in_fd;
+    gboolean ok = FALSE;
+
+    if ((in_fd = open(src_name, O_RDONLY)) < 0) {
+	*errmsg = g_strdup_printf("can't open: %s", strerror(errno));
+	g_free(tmp_name);
+	return FALSE;
+    }
+    unlink(tmp_name);
+    if ((out.fd = open(tmp_name, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR)) < 0) {
+	*errmsg = g_strdup_printf("can't create %s: %s", tmp_name,
+				  strerror(errno));
+	goto out;
+    }
+    if (src_gz &&
+	!(decomp = amcompress_new_decompress(AMCOMPRESS_GZIP, errmsg)))
+	goto out;
+    if (dst_gz &&
+	!(out.comp = amcompress_new(AMCOMPRESS_GZIP, AMCOMPRESS_LEVEL_BEST, 1,
+				    errmsg)))
+	goto out;
+    if (sort) {
+	/* unique among the threads sorting at once */
+	char *prefix = g_strdup_printf("%s/amtrmidx-sort.%ld.%p",
+				       getconf_str(CNF_TMPDIR),
+				       (long)getpid(), (void *)g_thread_self());
+	ls = linesort_new(prefix, 0, 1);
+	g_free(prefix);
+    }
+
+    while ((nread = read(in_fd, buf, sizeof(buf))) > 0) {
+	data = buf;
+	len = nread;
+	if (decomp && !(data = amcompress_update(decomp, buf, len, &len))) {
+	    *errmsg = g_strdup(amcompress_error(decomp));
+	    goto out;
+	}
+	if (ls)
+	    linesort_add(ls, data, len);
+	else if (len > 0 && !index_out_write(&out, data, len))
+	    goto write_failed;
+    }
+    if (nread < 0) {
+	*errmsg = g_strdup_printf("read error: %s", strerror(errno));
+	goto out;
+    }
+    if (decomp) {
+	if (!(data = amcompress_finish(decomp, &len))) {
+	    *errmsg = g_strdup(amcompress_error(decomp));
+	    goto out;
+	}
+	if (ls)
+	    linesort_add(ls, data, len);
+	else if (len > 0 && !index_out_write(&out, data, len))
+	    goto write_failed;
+    }
+    if (ls && !linesort_finish_func(ls, index_out_write, &out)) {
+	if (out.failed)
+	    goto write_failed;
+	*errmsg = g_strdup(linesort_error(ls));
+	goto out;
+    }
+    if (out.comp) {
+	if (!(data = amcompress_finish(out.comp, &len))) {
+	    *errmsg = g_strdup(amcompress_error(out.comp));
+	    goto out;
+	}
+	if (len > 0 && full_write(out.fd, data, len) < len)
+	    goto write_failed;
+    }
+    if (close(out.fd) != 0) {
+	out.fd = -1;
+	goto write_failed;
+    }
+    out.fd = -1;
+    if (rename(tmp_name, dst_name) != 0) {
+	*errmsg = g_strdup_printf("can't rename %s: %s", tmp_name,
+				  strerror(errno));
+	goto out;
+    }
+    ok = TRUE;
+    goto out;
+
+write_failed:
+    *errmsg = g_strdup_printf("can't write %s: %s", tmp_name, strerror(errno));
+
+out:
+    close(in_fd);
+    if (out.fd >= 0)
+	close(out.fd);
+    if (!ok)
+	unlink(tmp_name);
+    if (decomp)
+	amcompress_free(decomp);
+    if (out.comp)
+	amcompress_free(out.comp);
+    linesort_free(ls);
+    g_free(tmp_name);
+    return ok;
+}
+
+static void
+free_manifest_entry(
+    gpointer data)
+{
+    manifest_entry_t *me = data;
+
+    g_strfreev(me->names);
+    g_free(me);
+}
+
+/*
+ * The manifest has one line per trimmed index directory:
+ *   INDEXDIR MTIME RECHECK FLAGS NAME...
+ * where the NAMEs are the DATESTAMP_LEVEL of the kept index files.
+ */
+static GHashTable *
+read_manifest(
+    char *filename)
+{
+    GHashTable *manifest = g_hash_table_new_full(g_str_hash, g_str_equal,
+						 g_free, free_manifest_entry);
+    FILE *mf;
+    char *line;
+
+    if ((mf = fopen(filename, "r")) == NULL)
+	return manifest;
+
+    while ((line = agets(mf)) != NULL) {
+	gchar **fields = split_quoted_strings(line);
+	manifest_entry_t *me;
+	int n, j;
+
+	for (n = 0; fields && fields[n] != NULL; n++);
+	if (n < 4) {
+	    g_strfreev(fields);
+	    amfree(line);
+	    continue;
+	}
+	me = g_new0(manifest_entry_t, 1);
+	me->mtime = (time_t)g_ascii_strtoll(fields[1], NULL, 10);
+	me->recheck = (time_t)g_ascii_strtoll(fields[2], NULL, 10);
+	me->flags = atoi(fields[3]);
+	me->names = g_new0(char *, n - 4 + 1);
+	for (j = 4; j < n; j++)
+	    me->names[j - 4] = g_strdup(fields[j]);
+	g_hash_table_replace(manifest, g_strdup(fields[0]), me);
+	g_strfreev(fields);
+	amfree(line);
+    }
+    fclose(mf);
+
+    return manifest;
+}
+
+static void
+write_manifest(
+    char *filename,
+    GPtrArray *dirs)
+{
+    char *tmp_name = g_strconcat(filename, ".tmp", NULL);
+    FILE *mf;
+    guint i, j;
+    int flags = (sort_index ? MANIFEST_SORT : 0) |
+		(compress_index ? MANIFEST_COMPRESS : 0);
+
+    if ((mf = fopen(tmp_name, "w")) == NULL) {
+	g_debug("can't write %s: %s", tmp_name, strerror(errno));
+	g_free(tmp_name);
+	return;
+    }
+    for (i = 0; i < dirs->len; i++) {
+	trim_dir_t *td = g_ptr_array_index(dirs, i);
+	char *qindexdir;
+
+	if (!td->done)
+	    continue;
+	qindexdir = quote_string_always(td->indexdir);
+	g_fprintf(mf, "%s %lld %lld %d", qindexdir, (long long)td->mtime,
+		  (long long)td->recheck, flags);
+	for (j = 0; j < td->kept->len; j++)
+	    g_fprintf(mf, " %s", (char *)g_ptr_array_index(td->kept, j));
+	g_fprintf(mf, "\n");
+	g_free(qindexdir);
+    }
+    if (fclose(mf) != 0 || rename(tmp_name, filename) != 0) {
+	g_debug("can't write %s: %s", filename, strerror(errno));
+	unlink(tmp_name);
+    }
+    g_free(tmp_name);
+}
+
 static pid_t
 run_compress(
     int   fd_in,
@@ -770,6 +1157,9 @@ run_uncompress(
     return pid;
 }
 
+/* The sort runs in a subprocess that uses linesort, so that it is a stage
+ * of the pipeline like the compress and uncompress processes; the errors
+ * are written to *fd_err. */
 static pid_t
 run_sort(
     int   fd_in,
@@ -780,7 +1170,8 @@ run_sort(
 {
     int   in_fd;
     int   out_fd;
-    int   create_pipe = STDERR_PIPE;
+    int   out_pipe[2];
+    int   err_pipe[2];
     pid_t pid;
     gchar *tmpdir = getconf_str(CNF_TMPDIR);
 
@@ -793,19 +1184,56 @@ run_sort(
     if (dest_filename) {
 	out_fd = open(dest_filename, O_WRONLY|O_CREAT, S_IRUSR);
     } else {
-	create_pipe |= STDOUT_PIPE;
+	if (pipe(out_pipe) == -1)
+	    error(_("error [pipe: %s]"), strerror(errno));
+	out_fd = out_pipe[1];
+	*fd_out = out_pipe[0];
+    }
+    if (pipe(err_pipe) == -1)
+	error(_("error [pipe: %s]"), strerror(errno));
+
+    switch (pid = fork()) {
+    case -1:
+	error(_("error [fork: %s]"), strerror(errno));
+	/*NOTREACHED*/
+
+    case 0: {
+	linesort_t *ls;
+	char *prefix;
+	char  buf[65536];
+	ssize_t len;
+	char *msg = NULL;
+
+	close(err_pipe[0]);
+	if (!dest_filename)
+	    close(out_pipe[0]);
+	prefix = g_strdup_printf("%s/amtrmidx-sort.%ld", tmpdir,
+				 (long)getpid());
+	ls = linesort_new(prefix, 0, LINESORT_THREADS_AUTO);
+	while ((len = read(in_fd, buf, sizeof(buf))) > 0) {
+	    linesort_add(ls, buf, len);
+	}
+	if (len < 0) {
+	    msg = g_strdup_printf("read error: %s\n", strerror(errno));
+	} else if (!linesort_finish(ls, out_fd)) {
+	    msg = g_strdup_printf("%s\n", linesort_error(ls));
+	}
+	linesort_free(ls);
+	if (msg) {
+	    full_write(err_pipe[1], msg, strlen(msg));
+	    exit(1);
+	}
+	exit(0);
     }
 
+    default:
+	break;
+    }
 
-    pid = pipespawn(SORT_PATH, create_pipe, 0,
-		    &in_fd, &out_fd, fd_err,
-		    SORT_PATH, "-T", tmpdir, NULL);
     close(in_fd);
-    if (dest_filename) {
-	close(out_fd);
-    } else {
-	*fd_out = out_fd;
-    }
+    close(out_fd);
+    close(err_pipe[1]);
+    *fd_err = err_pipe[0];
     return pid;
 }
 
@@ -38,6 +38,7 @@
 #include "diskfile.h"
 #include "tapefile.h"
 #include "server_util.h"
+#include "find.h"
 
 int amtrmidx_debug = 0;
 
@@ -204,6 +205,20 @@ main(
 		amfree(newfile);
 		amfree(oldfile);
 
+		oldfile = g_strconcat(conf_logdir, "/", FIND_CACHE_DIR, "/",
+				      adir->d_name, NULL);
+		if (unlink(oldfile) != 0 && errno != ENOENT) {
+		    g_debug("Failed to unlink '%s': %s", oldfile, strerror(errno));
+		}
+		amfree(oldfile);
+
+		/* the binary log is only kept with the current logs */
+		oldfile = g_strconcat(conf_logdir, "/bin", adir->d_name, NULL);
+		if (unlink(oldfile) != 0 && errno != ENOENT) {
+		    g_debug("Failed to unlink '%s': %s", oldfile, strerror(errno));
+		}
+		amfree(oldfile);
+
 		datestamp = g_strdup(adir->d_name);
 		d = strrchr(datestamp+4, '.');
 		if (*d) *d = '\0';
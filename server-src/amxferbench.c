@@ -0,0 +1,1187 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+/*
+ * amxferbench -- run transfer pipelines and report how fast they go
+ *
+ * Each run pushes LENGTH bytes from a benchmark source through the given
+ * filters into the given destination, and reports throughput, CPU time per
+ * GB, the distribution of the time the source spent on each block, and the
+ * XMSG_STATS of every element.  Runs are repeated for every combination of
+ * the block sizes, ring sizes and source mechanisms given on the command
+ * line.
+ */
+
+#include "amanda.h"
+#include "amutil.h"
+#include "conffile.h"
+#include "event.h"
+#include "fileheader.h"
+#include "mem-ring.h"
+#include "simpleprng.h"
+#include "timestamp.h"
+#include "amxfer.h"
+#include "device.h"
+#include "xfer-device.h"
+#include "xfer-server.h"
+#include "getopt.h"
+#include <sys/resource.h>
+
+/*
+ * XferSourceBench
+ *
+ * A source that copies the same block of data downstream LENGTH / BLOCK_SIZE
+ * times, with a configurable block size and output mechanism, and records
+ * the time between consecutive blocks.  Copying a prepared block keeps the
+ * cost of the source itself small and constant.
+ */
+
+GType xfer_source_bench_get_type(void);
+#define XFER_SOURCE_BENCH_TYPE (xfer_source_bench_get_type())
+#define XFER_SOURCE_BENCH(obj) G_TYPE_CHECK_INSTANCE_CAST((obj), xfer_source_bench_get_type(), XferSourceBench)
+#define XFER_SOURCE_BENCH_CONST(obj) G_TYPE_CHECK_INSTANCE_CAST((obj), xfer_source_bench_get_type(), XferSourceBench const)
+#define XFER_SOURCE_BENCH_CLASS(klass) G_TYPE_CHECK_CLASS_CAST((klass), xfer_source_bench_get_type(), XferSourceBenchClass)
+#define IS_XFER_SOURCE_BENCH(obj) G_TYPE_CHECK_INSTANCE_TYPE((obj), xfer_source_bench_get_type ())
+#define XFER_SOURCE_BENCH_GET_CLASS(obj) G_TYPE_INSTANCE_GET_CLASS((obj), xfer_source_bench_get_type(), XferSourceBenchClass)
+
+static GObjectClass *parent_class = NULL;
+
+typedef struct XferSourceBench {
+    XferElement __parent__;
+
+    guint64 length;		/* bytes still to produce */
+    gsize block_size;
+    gsize ring_size;		/* mem_ring size, or 0 for 32 blocks */
+    char *data;			/* the block copied out each time */
+
+    /* the single mech pair offered when the output mechanism is forced */
+    xfer_mech mech;
+    xfer_element_mech_pair_t forced_pairs[2];
+
+    GThread *thread;
+    int pipe_fd;		/* write end of the READFD pipe */
+
+    GMutex *state_mutex;
+    GCond *state_cond;
+    mem_ring_t *mem_ring;
+    gboolean mem_ring_ready;
+
+    /* microseconds between consecutive blocks */
+    GArray *latencies;
+    gint64 last_block;
+} XferSourceBench;
+
+typedef struct {
+    XferElementClass __parent__;
+} XferSourceBenchClass;
+
+/* account for the start of a new block, and return its size, or 0 at EOF */
+static gsize
+next_block(
+    XferSourceBench *self)
+{
+    gint64 now = xfer_stats_clock();
+    gsize size;
+
+    if (XFER_ELEMENT(self)->cancelled || self->length == 0)
+	return 0;
+
+    if (self->last_block) {
+	gint64 latency = now - self->last_block;
+	g_array_append_val(self->latencies, latency);
+    }
+    self->last_block = now;
+
+    size = MIN(self->block_size, self->length);
+    self->length -= size;
+    return size;
+}
+
+static void
+send_done(
+    XferSourceBench *self,
+    GTimer *timer)
+{
+    XferElement *elt = XFER_ELEMENT(self);
+    XMsg *msg;
+
+    msg = xmsg_new(elt, XMSG_DONE, 0);
+    msg->duration = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+    xfer_queue_message(elt->xfer, msg);
+}
+
+static void
+mem_ring_loop(
+    XferSourceBench *self)
+{
+    XferElement *elt = XFER_ELEMENT(self);
+    mem_ring_t *mem_ring;
+    uint64_t write_offset, written, readx;
+    uint64_t mem_ring_size;
+    size_t consumer_block_size;
+    gsize size;
+
+    g_mutex_lock(self->state_mutex);
+    self->mem_ring = mem_ring = create_mem_ring();
+    self->mem_ring_ready = TRUE;
+    g_cond_broadcast(self->state_cond);
+    g_mutex_unlock(self->state_mutex);
+
+    mem_ring_producer_set_size(mem_ring,
+		self->ring_size? self->ring_size : self->block_size * 32,
+		self->block_size);
+    mem_ring_size = mem_ring->ring_size;
+    consumer_block_size = mem_ring->consumer_block_size;
+    write_offset = mem_ring->write_offset;
+
+    while ((size = next_block(self)) > 0) {
+	gsize done = 0;
+
+	while (done < size) {
+	    gsize to_write;
+
+	    g_mutex_lock(mem_ring->mutex);
+	    written = mem_ring->written;
+	    readx = mem_ring->readx;
+	    while (mem_ring_size - (written - readx) < self->block_size &&
+		   !elt->cancelled) {
+		gint64 start = xfer_stats_clock();
+		g_cond_wait(mem_ring->free_cond, mem_ring->mutex);
+		xfer_element_add_stats(elt, 0, 0, 0, xfer_stats_clock() - start);
+		written = mem_ring->written;
+		readx = mem_ring->readx;
+	    }
+	    g_mutex_unlock(mem_ring->mutex);
+	    if (elt->cancelled)
+		return;
+
+	    to_write = MIN(size - done, mem_ring_size - write_offset);
+	    memcpy(mem_ring->buffer + write_offset, self->data + done, to_write);
+	    done += to_write;
+	    write_offset = (write_offset + to_write) % mem_ring_size;
+
+	    g_mutex_lock(mem_ring->mutex);
+	    mem_ring->data_avail += to_write;
+	    mem_ring->written += to_write;
+	    mem_ring->write_offset = write_offset;
+	    if (mem_ring->data_avail >= consumer_block_size) {
+		g_cond_broadcast(mem_ring->add_cond);
+		mem_ring->data_avail -= consumer_block_size;
+	    }
+	    g_mutex_unlock(mem_ring->mutex);
+	}
+	xfer_element_add_stats(elt, 0, size, 0, 0);
+    }
+}
+
+static gpointer
+bench_thread(
+    gpointer data)
+{
+    XferSourceBench *self = XFER_SOURCE_BENCH(data);
+    XferElement *elt = XFER_ELEMENT(self);
+    GTimer *timer = g_timer_new();
+    gsize size;
+
+    switch (elt->output_mech) {
+    case XFER_MECH_PUSH_BUFFER:
+	while ((size = next_block(self)) > 0) {
+	    char *buf = xfer_element_alloc_buffer(elt, self->block_size);
+	    memcpy(buf, self->data, size);
+	    xfer_element_push_buffer(elt->downstream, buf, size);
+	}
+	xfer_element_push_buffer(elt->downstream, NULL, 0);
+	break;
+
+    case XFER_MECH_READFD:
+	while ((size = next_block(self)) > 0) {
+	    gint64 start = xfer_stats_clock();
+	    if (full_write(self->pipe_fd, self->data, size) < size) {
+		if (!elt->cancelled) {
+		    xfer_cancel_with_error(elt,
+			_("Error writing to fd %d: %s"), self->pipe_fd,
+			strerror(errno));
+		    wait_until_xfer_cancelled(elt->xfer);
+		}
+		break;
+	    }
+	    xfer_element_add_stats(elt, 0, size, 0, xfer_stats_clock() - start);
+	}
+	close(self->pipe_fd);
+	self->pipe_fd = -1;
+	break;
+
+    case XFER_MECH_MEM_RING:
+	mem_ring_loop(self);
+	g_mutex_lock(self->mem_ring->mutex);
+	self->mem_ring->eof_flag = TRUE;
+	g_cond_broadcast(self->mem_ring->add_cond);
+	g_mutex_unlock(self->mem_ring->mutex);
+	break;
+
+    default:
+	g_assert_not_reached();
+    }
+
+    send_done(self, timer);
+    return NULL;
+}
+
+static xfer_element_mech_pair_t *
+get_mech_pairs_impl(
+    XferElement *elt)
+{
+    XferSourceBench *self = XFER_SOURCE_BENCH(elt);
+    xfer_element_mech_pair_t *pairs = XFER_ELEMENT_GET_CLASS(elt)->mech_pairs;
+
+    if (self->mech == XFER_MECH_NONE)
+	return pairs;
+
+    /* offer only the forced output mechanism */
+    for (; pairs->output_mech != XFER_MECH_NONE; pairs++) {
+	if (pairs->output_mech == self->mech) {
+	    self->forced_pairs[0] = *pairs;
+	    break;
+	}
+    }
+    return self->forced_pairs;
+}
+
+static gboolean
+setup_impl(
+    XferElement *elt)
+{
+    XferSourceBench *self = XFER_SOURCE_BENCH(elt);
+    int p[2];
+
+    switch (elt->output_mech) {
+    case XFER_MECH_PULL_BUFFER:
+    case XFER_MECH_PUSH_BUFFER:
+	xfer_reserve_buffers(elt->xfer, self->block_size, 4, FALSE);
+	break;
+
+    case XFER_MECH_READFD:
+	if (pipe(p) < 0) {
+	    xfer_cancel_with_error(elt, _("Could not create pipe: %s"),
+				   strerror(errno));
+	    return FALSE;
+	}
+	xfer_element_swap_output_fd(elt, p[0]);
+	self->pipe_fd = p[1];
+	break;
+
+    default:
+	break;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+start_impl(
+    XferElement *elt)
+{
+    XferSourceBench *self = XFER_SOURCE_BENCH(elt);
+    GError *error = NULL;
+
+    if (elt->output_mech == XFER_MECH_PULL_BUFFER)
+	return FALSE;
+
+    self->thread = g_thread_create(bench_thread, (gpointer)self, FALSE, &error);
+    if (!self->thread) {
+	g_critical(_("Error creating new thread: %s (%s)"),
+		   error->message, errno? strerror(errno) : _("no error code"));
+    }
+    return TRUE;
+}
+
+static gboolean
+cancel_impl(
+    XferElement *elt,
+    gboolean expect_eof)
+{
+    XferSourceBench *self = XFER_SOURCE_BENCH(elt);
+    gboolean rv;
+
+    rv = XFER_ELEMENT_CLASS(parent_class)->cancel(elt, expect_eof);
+
+    if (self->mem_ring) {
+	g_mutex_lock(self->mem_ring->mutex);
+	self->mem_ring->eof_flag = TRUE;
+	g_cond_broadcast(self->mem_ring->add_cond);
+	g_cond_broadcast(self->mem_ring->free_cond);
+	g_mutex_unlock(self->mem_ring->mutex);
+    }
+
+    return rv;
+}
+
+static gpointer
+pull_buffer_impl(
+    XferElement *elt,
+    size_t *size)
+{
+    XferSourceBench *self = XFER_SOURCE_BENCH(elt);
+    char *buf;
+
+    if ((*size = next_block(self)) == 0)
+	return NULL;
+
+    buf = xfer_element_alloc_buffer(elt, self->block_size);
+    memcpy(buf, self->data, *size);
+    return buf;
+}
+
+static mem_ring_t *
+get_mem_ring_impl(
+    XferElement *elt)
+{
+    XferSourceBench *self = XFER_SOURCE_BENCH(elt);
+
+    g_mutex_lock(self->state_mutex);
+    while (!self->mem_ring_ready)
+	g_cond_wait(self->state_cond, self->state_mutex);
+    g_mutex_unlock(self->state_mutex);
+
+    return self->mem_ring;
+}
+
+static size_t
+get_block_size_impl(
+    XferElement *elt)
+{
+    return XFER_SOURCE_BENCH(elt)->block_size;
+}
+
+static void
+instance_init(
+    XferElement *elt)
+{
+    XferSourceBench *self = XFER_SOURCE_BENCH(elt);
+
+    elt->can_generate_eof = TRUE;
+    self->pipe_fd = -1;
+    self->state_mutex = g_mutex_new();
+    self->state_cond = g_cond_new();
+    self->latencies = g_array_new(FALSE, FALSE, sizeof(gint64));
+}
+
+static void
+finalize_impl(
+    GObject *obj_self)
+{
+    XferSourceBench *self = XFER_SOURCE_BENCH(obj_self);
+
+    if (self->pipe_fd != -1)
+	close(self->pipe_fd);
+    if (self->mem_ring)
+	close_mem_ring(self->mem_ring);
+    g_mutex_free(self->state_mutex);
+    g_cond_free(self->state_cond);
+    g_array_free(self->latencies, TRUE);
+    g_free(self->data);
+
+    G_OBJECT_CLASS(parent_class)->finalize(obj_self);
+}
+
+static void
+class_init(
+    XferSourceBenchClass *selfc)
+{
+    XferElementClass *klass = XFER_ELEMENT_CLASS(selfc);
+    GObjectClass *goc = G_OBJECT_CLASS(selfc);
+    static xfer_element_mech_pair_t mech_pairs[] = {
+	{ XFER_MECH_NONE, XFER_MECH_PULL_BUFFER, XFER_NROPS(1), XFER_NTHREADS(0), XFER_NALLOC(1) },
+	{ XFER_MECH_NONE, XFER_MECH_PUSH_BUFFER, XFER_NROPS(1), XFER_NTHREADS(1), XFER_NALLOC(1) },
+	{ XFER_MECH_NONE, XFER_MECH_READFD, XFER_NROPS(1), XFER_NTHREADS(1), XFER_NALLOC(0) },
+	{ XFER_MECH_NONE, XFER_MECH_MEM_RING, XFER_NROPS(1), XFER_NTHREADS(1), XFER_NALLOC(0) },
+	{ XFER_MECH_NONE, XFER_MECH_NONE, XFER_NROPS(0), XFER_NTHREADS(0), XFER_NALLOC(0) },
+    };
+
+    klass->setup = setup_impl;
+    klass->start = start_impl;
+    klass->cancel = cancel_impl;
+    klass->pull_buffer = pull_buffer_impl;
+    klass->get_mem_ring = get_mem_ring_impl;
+    klass->get_block_size = get_block_size_impl;
+    klass->get_mech_pairs = get_mech_pairs_impl;
+
+    klass->perl_class = NULL;
+    klass->mech_pairs = mech_pairs;
+
+    goc->finalize = finalize_impl;
+
+    parent_class = g_type_class_peek_parent(selfc);
+}
+
+GType
+xfer_source_bench_get_type (void)
+{
+    static GType type = 0;
+
+    if (G_UNLIKELY(type == 0)) {
+        static const GTypeInfo info = {
+            sizeof (XferSourceBenchClass),
+            (GBaseInitFunc) NULL,
+            (GBaseFinalizeFunc) NULL,
+            (GClassInitFunc) class_init,
+            (GClassFinalizeFunc) NULL,
+            NULL /* class_data */,
+            sizeof (XferSourceBench),
+            0 /* n_preallocs */,
+            (GInstanceInitFunc) instance_init,
+            NULL
+        };
+
+        type = g_type_register_static (XFER_ELEMENT_TYPE, "XferSourceBench", &info, 0);
+    }
+
+    return type;
+}
+
+static XferElement *
+xfer_source_bench(
+    guint64 length,
+    gsize block_size,
+    gsize ring_size,
+    xfer_mech mech,
+    gboolean random_data)
+{
+    XferSourceBench *self = (XferSourceBench *)g_object_new(XFER_SOURCE_BENCH_TYPE, NULL);
+    static const char text[] = "The quick brown fox jumps over the lazy dog.\n";
+
+    self->length = length;
+    self->block_size = block_size;
+    self->ring_size = ring_size;
+    self->mech = mech;
+    self->data = g_malloc(block_size);
+    if (random_data) {
+	simpleprng_state_t prng;
+
+	simpleprng_seed(&prng, 0xbe7c4);
+	simpleprng_fill_buffer(&prng, self->data, block_size);
+    } else {
+	gsize i;
+
+	for (i = 0; i < block_size; i++)
+	    self->data[i] = text[i % (sizeof(text) - 1)];
+    }
+
+    return XFER_ELEMENT(self);
+}
+
+/*
+ * Benchmark driver
+ */
+
+typedef struct run_result_s {
+    gsize block_size;
+    gsize ring_size;
+    xfer_mech mech;
+
+    char *linkage;
+    GString *errors;
+    GPtrArray *stats;		/* XMsg (XMSG_STATS) per element */
+
+    guint64 bytes;
+    double seconds;
+    double cpu_seconds;
+    gint64 latency_p50, latency_p99, latency_max;
+} run_result_t;
+
+static struct option long_options[] = {
+    {"version"         , 0, NULL,  1},
+    {"config"          , 1, NULL,  2},
+    {"filter"          , 1, NULL,  3},
+    {"dest"            , 1, NULL,  4},
+    {"length"          , 1, NULL,  5},
+    {"block-size"      , 1, NULL,  6},
+    {"ring-size"       , 1, NULL,  7},
+    {"mech"            , 1, NULL,  8},
+    {"data"            , 1, NULL,  9},
+    {"repeat"          , 1, NULL, 10},
+    {"json"            , 0, NULL, 11},
+    {"calibrate"       , 0, NULL, 12},
+    {NULL, 0, NULL, 0}
+};
+
+static GPtrArray *filters;
+static char *dest = "null";
+static guint64 length = 1024*1024*1024;
+static gboolean random_data = TRUE;
+static Device *device;
+
+static void
+usage(void)
+{
+    g_fprintf(stderr, _("Usage: amxferbench [--config CONFIG] [--filter FILTER]... [--dest DEST]\n"
+	"	[--length SIZE] [--block-size SIZE[,SIZE...]] [--ring-size SIZE[,SIZE...]]\n"
+	"	[--mech MECH[,MECH...]] [--data random|text] [--repeat N] [--json]\n"
+	"       amxferbench --calibrate\n"
+	"FILTER is xor, crc, compress[:ALGO[:LEVEL]], encrypt:KEYFILE or\n"
+	"	process:COMMAND\n"
+	"DEST is null, fd:FILENAME, holding:FILENAME or device:DEVICE\n"
+	"MECH is any, PULL_BUFFER, PUSH_BUFFER, READFD or MEM_RING\n"));
+    exit(1);
+}
+
+/* parse a size with an optional k, m or g suffix */
+static gboolean
+parse_size(
+    const char *str,
+    guint64 *size)
+{
+    char *end;
+    guint64 val = g_ascii_strtoull(str, &end, 10);
+
+    if (end == str)
+	return FALSE;
+
+    switch (g_ascii_tolower(*end)) {
+    case 'k': val *= 1024; end++; break;
+    case 'm': val *= 1024*1024; end++; break;
+    case 'g': val *= 1024*1024*1024; end++; break;
+    }
+    if (*end && g_ascii_tolower(*end) != 'b')
+	return FALSE;
+
+    *size = val;
+    return TRUE;
+}
+
+static GArray *
+parse_size_list(
+    const char *str,
+    gboolean allow_zero)
+{
+    GArray *list = g_array_new(FALSE, FALSE, sizeof(gsize));
+    char **words = g_strsplit(str, ",", 0);
+    char **w;
+
+    for (w = words; *w; w++) {
+	guint64 size;
+	gsize val;
+
+	if (!parse_size(*w, &size) || (size == 0 && !allow_zero)) {
+	    g_fprintf(stderr, _("Invalid size '%s'\n"), *w);
+	    exit(1);
+	}
+	val = (gsize)size;
+	g_array_append_val(list, val);
+    }
+    g_strfreev(words);
+
+    return list;
+}
+
+static GArray *
+parse_mech_list(
+    const char *str)
+{
+    GArray *list = g_array_new(FALSE, FALSE, sizeof(xfer_mech));
+    char **words = g_strsplit(str, ",", 0);
+    char **w;
+
+    for (w = words; *w; w++) {
+	xfer_mech mech;
+
+	if (g_str_equal(*w, "any")) {
+	    mech = XFER_MECH_NONE;
+	} else {
+	    for (mech = XFER_MECH_NONE + 1; mech < XFER_MECH_MAX; mech++) {
+		if (g_ascii_strcasecmp(*w, xfer_mech_name(mech)) == 0)
+		    break;
+	    }
+	    if (mech != XFER_MECH_PULL_BUFFER &&
+		mech != XFER_MECH_PUSH_BUFFER &&
+		mech != XFER_MECH_READFD &&
+		mech != XFER_MECH_MEM_RING) {
+		g_fprintf(stderr, _("Invalid mechanism '%s'\n"), *w);
+		exit(1);
+	    }
+	}
+	g_array_append_val(list, mech);
+    }
+    g_strfreev(words);
+
+    return list;
+}
+
+static XferElement *
+make_filter(
+    const char *spec)
+{
+    if (g_str_equal(spec, "xor")) {
+	return xfer_filter_xor('b');
+    } else if (g_str_equal(spec, "crc")) {
+	return xfer_filter_crc();
+    } else if (g_str_has_prefix(spec, "compress")) {
+	char **words = g_strsplit(spec, ":", 3);
+	const char *algo = words[1]? words[1] : "gzip";
+	int level = (words[1] && words[2])? atoi(words[2]) : 1;
+	XferElement *elt = NULL;
+
+	if (xfer_filter_compress_supported(algo))
+	    elt = xfer_filter_compress(algo, level, 1);
+	else
+	    g_fprintf(stderr, _("Compression algorithm '%s' is not supported\n"), algo);
+	g_strfreev(words);
+	return elt;
+    } else if (g_str_has_prefix(spec, "encrypt:")) {
+	if (!xfer_filter_encrypt_supported()) {
+	    g_fprintf(stderr, _("AES-GCM encryption is not supported\n"));
+	    return NULL;
+	}
+	return xfer_filter_encrypt(spec + strlen("encrypt:"), FALSE, 1);
+    } else if (g_str_has_prefix(spec, "process:")) {
+	char **argv = g_strsplit(spec + strlen("process:"), " ", 0);
+	XferElement *elt = xfer_filter_process(argv, FALSE, FALSE, FALSE, FALSE);
+	return elt;
+    }
+
+    g_fprintf(stderr, _("Invalid filter '%s'\n"), spec);
+    return NULL;
+}
+
+static void
+init_header(
+    dumpfile_t *hdr,
+    filetype_t type,
+    char *timestamp)
+{
+    fh_init(hdr);
+    hdr->type = type;
+    strncpy(hdr->datestamp, timestamp, sizeof(hdr->datestamp) - 1);
+    strncpy(hdr->name, "amxferbench", sizeof(hdr->name) - 1);
+    strncpy(hdr->disk, "/bench", sizeof(hdr->disk) - 1);
+}
+
+static XferElement *
+make_dest(
+    GString *errors)
+{
+    char *timestamp = get_proper_stamp_from_time(time(NULL));
+    XferElement *elt = NULL;
+    dumpfile_t hdr;
+
+    if (g_str_equal(dest, "null")) {
+	elt = xfer_dest_null(0);
+    } else if (g_str_has_prefix(dest, "fd:")) {
+	int fd = open(dest + 3, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+	    g_string_append_printf(errors, _("Could not open '%s': %s"),
+				   dest + 3, strerror(errno));
+	} else {
+	    elt = xfer_dest_fd(fd);
+	    close(fd);
+	}
+    } else if (g_str_has_prefix(dest, "holding:")) {
+	elt = xfer_dest_holding(0);
+    } else if (g_str_has_prefix(dest, "device:")) {
+	device = device_open(dest + 7);
+	if (device->status != DEVICE_STATUS_SUCCESS ||
+	    !device_configure(device, TRUE) ||
+	    !device_start(device, ACCESS_WRITE, "AMXFERBENCH", timestamp)) {
+	    g_string_append(errors, device_error_or_status(device));
+	} else {
+	    init_header(&hdr, F_DUMPFILE, timestamp);
+	    if (!device_start_file(device, &hdr))
+		g_string_append(errors, device_error_or_status(device));
+	    else
+		elt = xfer_dest_device(device, FALSE);
+	}
+	if (!elt) {
+	    g_object_unref(device);
+	    device = NULL;
+	}
+    }
+    g_free(timestamp);
+
+    return elt;
+}
+
+static void
+bench_callback(
+    gpointer data,
+    XMsg *msg,
+    Xfer *xfer)
+{
+    run_result_t *result = data;
+    unsigned int i;
+
+    switch (msg->type) {
+    case XMSG_ERROR:
+	if (result->errors->len)
+	    g_string_append(result->errors, "; ");
+	g_string_append(result->errors, msg->message);
+	break;
+
+    case XMSG_STATS:
+	/* keep the last message for each element */
+	for (i = 0; i < result->stats->len; i++) {
+	    XMsg *old = g_ptr_array_index(result->stats, i);
+	    if (old->elt == msg->elt) {
+		old->bytes_in = msg->bytes_in;
+		old->bytes_out = msg->bytes_out;
+		old->wait_upstream = msg->wait_upstream;
+		old->wait_downstream = msg->wait_downstream;
+		old->busy = msg->busy;
+		return;
+	    }
+	}
+	g_ptr_array_add(result->stats, g_memdup(msg, sizeof(*msg)));
+	break;
+
+    case XMSG_DONE:
+	if (xfer->status == XFER_DONE)
+	    g_main_loop_quit(default_main_loop());
+	break;
+
+    default:
+	break;
+    }
+}
+
+static gint
+compare_gint64(
+    gconstpointer a,
+    gconstpointer b)
+{
+    gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+
+    return (x > y) - (x < y);
+}
+
+static double
+cpu_seconds(void)
+{
+    struct rusage self, children;
+
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+    return self.ru_utime.tv_sec + self.ru_stime.tv_sec
+	 + children.ru_utime.tv_sec + children.ru_stime.tv_sec
+	 + (self.ru_utime.tv_usec + self.ru_stime.tv_usec
+	    + children.ru_utime.tv_usec + children.ru_stime.tv_usec) / 1e6;
+}
+
+static char *
+linkage_repr(
+    Xfer *xfer)
+{
+    GString *str = g_string_new("");
+    unsigned int i;
+
+    for (i = 0; i < xfer->elements->len; i++) {
+	XferElement *elt = g_ptr_array_index(xfer->elements, i);
+
+	if (i > 0)
+	    g_string_append_printf(str, " -%s-> ",
+				   xfer_mech_name(elt->input_mech));
+	g_string_append(str, G_OBJECT_TYPE_NAME(elt));
+    }
+
+    return g_string_free(str, FALSE);
+}
+
+static run_result_t *
+run_one(
+    gsize block_size,
+    gsize ring_size,
+    xfer_mech mech)
+{
+    run_result_t *result = g_new0(run_result_t, 1);
+    GPtrArray *elements = g_ptr_array_new();
+    XferSourceBench *source;
+    XferElement *dest_elt;
+    Xfer *xfer;
+    GSource *src;
+    GArray *lat;
+    GTimer *timer;
+    double cpu_start;
+    unsigned int i;
+
+    result->block_size = block_size;
+    result->ring_size = ring_size;
+    result->mech = mech;
+    result->errors = g_string_new("");
+    result->stats = g_ptr_array_new();
+
+    source = XFER_SOURCE_BENCH(xfer_source_bench(length, block_size,
+					ring_size, mech, random_data));
+    g_ptr_array_add(elements, source);
+    for (i = 0; i < filters->len; i++) {
+	XferElement *elt = make_filter(g_ptr_array_index(filters, i));
+	if (!elt)
+	    exit(1);
+	g_ptr_array_add(elements, elt);
+    }
+    if (!(dest_elt = make_dest(result->errors))) {
+	g_ptr_array_foreach(elements, (GFunc)g_object_unref, NULL);
+	g_ptr_array_free(elements, TRUE);
+	return result;
+    }
+    g_ptr_array_add(elements, dest_elt);
+
+    xfer = xfer_new((XferElement **)elements->pdata, elements->len);
+    src = xfer_get_source(xfer);
+    g_source_set_callback(src, (GSourceFunc)bench_callback, result, NULL);
+    g_source_attach(src, NULL);
+    xfer_set_stats_interval(xfer, 3600);
+
+    cpu_start = cpu_seconds();
+    timer = g_timer_new();
+    xfer_start(xfer, 0, 0);
+    result->linkage = linkage_repr(xfer);
+
+    if (g_str_has_prefix(dest, "holding:")) {
+	dumpfile_t hdr;
+	char *timestamp = get_proper_stamp_from_time(time(NULL));
+
+	init_header(&hdr, F_DUMPFILE, timestamp);
+	xfer_dest_holding_start_chunk(dest_elt, &hdr, dest + 8, G_MAXINT64);
+	g_free(timestamp);
+    }
+
+    g_main_loop_run(default_main_loop());
+
+    result->seconds = g_timer_elapsed(timer, NULL);
+    result->cpu_seconds = cpu_seconds() - cpu_start;
+    g_timer_destroy(timer);
+    result->bytes = length - source->length;
+    if (mech == XFER_MECH_MEM_RING && source->mem_ring)
+	result->ring_size = source->mem_ring->ring_size;
+
+    if (g_str_has_prefix(dest, "holding:"))
+	g_free(xfer_dest_holding_finish_chunk(dest_elt));
+    if (device) {
+	if (!device_finish(device) && !result->errors->len)
+	    g_string_append(result->errors, device_error_or_status(device));
+	g_object_unref(device);
+	device = NULL;
+    }
+
+    lat = source->latencies;
+    if (lat->len) {
+	g_array_sort(lat, compare_gint64);
+	result->latency_p50 = g_array_index(lat, gint64, (lat->len - 1) * 50 / 100);
+	result->latency_p99 = g_array_index(lat, gint64, (lat->len - 1) * 99 / 100);
+	result->latency_max = g_array_index(lat, gint64, lat->len - 1);
+    }
+
+    xfer_unref(xfer);
+    g_ptr_array_foreach(elements, (GFunc)g_object_unref, NULL);
+    g_ptr_array_free(elements, TRUE);
+
+    return result;
+}
+
+static void
+free_result(
+    run_result_t *result)
+{
+    unsigned int i;
+
+    for (i = 0; i < result->stats->len; i++)
+	g_free(g_ptr_array_index(result->stats, i));
+    g_ptr_array_free(result->stats, TRUE);
+    g_string_free(result->errors, TRUE);
+    g_free(result->linkage);
+    g_free(result);
+}
+
+static double
+mb_per_sec(
+    run_result_t *r)
+{
+    return r->seconds > 0? r->bytes / r->seconds / (1024*1024) : 0;
+}
+
+static double
+cpu_per_gb(
+    run_result_t *r)
+{
+    return r->bytes? r->cpu_seconds * (1024.0*1024*1024) / r->bytes : 0;
+}
+
+static void
+print_text(
+    run_result_t *r)
+{
+    unsigned int i;
+
+    g_printf("block-size %zu ring-size %zu mech %s\n", r->block_size,
+	     r->ring_size,
+	     r->mech == XFER_MECH_NONE? "any" : xfer_mech_name(r->mech));
+    if (r->linkage)
+	g_printf("  linkage %s\n", r->linkage);
+    if (r->errors->len)
+	g_printf("  error %s\n", r->errors->str);
+    g_printf("  %ju bytes in %.3f s: %.1f MB/s, %.3f CPU s/GB, "
+	     "block latency p50 %jd us p99 %jd us max %jd us\n",
+	     (uintmax_t)r->bytes, r->seconds, mb_per_sec(r), cpu_per_gb(r),
+	     (intmax_t)r->latency_p50, (intmax_t)r->latency_p99,
+	     (intmax_t)r->latency_max);
+    for (i = 0; i < r->stats->len; i++) {
+	XMsg *msg = g_ptr_array_index(r->stats, i);
+	g_printf("  %-24s in %ju out %ju wait-upstream %.3f wait-downstream %.3f busy %.3f\n",
+		 G_OBJECT_TYPE_NAME(msg->elt),
+		 (uintmax_t)msg->bytes_in, (uintmax_t)msg->bytes_out,
+		 msg->wait_upstream, msg->wait_downstream, msg->busy);
+    }
+}
+
+static char *
+json_quote(
+    const char *str)
+{
+    GString *q = g_string_new("\"");
+
+    for (; *str; str++) {
+	if (*str == '"' || *str == '\\')
+	    g_string_append_printf(q, "\\%c", *str);
+	else if ((unsigned char)*str < 0x20)
+	    g_string_append_printf(q, "\\u%04x", *str);
+	else
+	    g_string_append_c(q, *str);
+    }
+    g_string_append_c(q, '"');
+
+    return g_string_free(q, FALSE);
+}
+
+static void
+print_json(
+    run_result_t *r,
+    gboolean first)
+{
+    char *linkage = json_quote(r->linkage? r->linkage : "");
+    char *errors = json_quote(r->errors->str);
+    unsigned int i;
+
+    g_printf("%s    {\"block_size\": %zu, \"ring_size\": %zu, \"mech\": \"%s\",\n",
+	     first? "" : ",\n", r->block_size, r->ring_size,
+	     r->mech == XFER_MECH_NONE? "any" : xfer_mech_name(r->mech));
+    g_printf("     \"linkage\": %s, \"error\": %s,\n", linkage, errors);
+    g_printf("     \"bytes\": %ju, \"seconds\": %.6f, \"mb_per_sec\": %.3f, "
+	     "\"cpu_seconds_per_gb\": %.6f,\n",
+	     (uintmax_t)r->bytes, r->seconds, mb_per_sec(r), cpu_per_gb(r));
+    g_printf("     \"block_latency_us\": {\"p50\": %jd, \"p99\": %jd, \"max\": %jd},\n",
+	     (intmax_t)r->latency_p50, (intmax_t)r->latency_p99,
+	     (intmax_t)r->latency_max);
+    g_printf("     \"elements\": [");
+    for (i = 0; i < r->stats->len; i++) {
+	XMsg *msg = g_ptr_array_index(r->stats, i);
+	g_printf("%s\n       {\"element\": \"%s\", \"bytes_in\": %ju, "
+		 "\"bytes_out\": %ju, \"wait_upstream\": %.6f, "
+		 "\"wait_downstream\": %.6f, \"busy\": %.6f}",
+		 i? "," : "", G_OBJECT_TYPE_NAME(msg->elt),
+		 (uintmax_t)msg->bytes_in, (uintmax_t)msg->bytes_out,
+		 msg->wait_upstream, msg->wait_downstream, msg->busy);
+    }
+    g_printf("]}");
+    g_free(linkage);
+    g_free(errors);
+}
+
+int
+main(
+    int argc,
+    char **argv)
+{
+    char *config = NULL;
+    GArray *block_sizes = NULL;
+    GArray *ring_sizes = NULL;
+    GArray *mechs = NULL;
+    gsize default_size = 0;
+    xfer_mech default_mech = XFER_MECH_NONE;
+    int repeat = 1;
+    gboolean json = FALSE;
+    gboolean calibrate = FALSE;
+    gboolean first = TRUE;
+    int failed = 0;
+    guint b, r, m;
+    int n;
+    int opt;
+
+    glib_init();
+
+    /*
+     * Configure program for internationalization:
+     *   1) Only set the message locale for now.
+     *   2) Set textdomain for all amanda related programs to "amanda"
+     *      We don't want to be forced to support dozens of message catalogs.
+     */
+    setlocale(LC_MESSAGES, "C");
+    textdomain("amanda");
+
+    safe_fd(-1, 0);
+    safe_cd();
+
+    set_pname("amxferbench");
+
+    /* Don't die when child closes pipe */
+    signal(SIGPIPE, SIG_IGN);
+
+    dbopen(DBG_SUBDIR_SERVER);
+
+    add_amanda_log_handler(amanda_log_stderr);
+
+    filters = g_ptr_array_new();
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != EOF) {
+	switch (opt) {
+	case 1:	g_printf("amxferbench-%s\n", VERSION);
+		return 0;
+	case 2:	config = optarg;
+		break;
+	case 3:	g_ptr_array_add(filters, optarg);
+		break;
+	case 4:	dest = optarg;
+		if (!g_str_equal(dest, "null") &&
+		    !g_str_has_prefix(dest, "fd:") &&
+		    !g_str_has_prefix(dest, "holding:") &&
+		    !g_str_has_prefix(dest, "device:"))
+		    usage();
+		break;
+	case 5:	if (!parse_size(optarg, &length) || length == 0)
+		    usage();
+		break;
+	case 6:	block_sizes = parse_size_list(optarg, FALSE);
+		break;
+	case 7:	ring_sizes = parse_size_list(optarg, TRUE);
+		break;
+	case 8:	mechs = parse_mech_list(optarg);
+		break;
+	case 9:	if (g_str_equal(optarg, "random"))
+		    random_data = TRUE;
+		else if (g_str_equal(optarg, "text"))
+		    random_data = FALSE;
+		else
+		    usage();
+		break;
+	case 10: repeat = atoi(optarg);
+		if (repeat < 1)
+		    usage();
+		break;
+	case 11: json = TRUE;
+		break;
+	case 12: calibrate = TRUE;
+		break;
+	default: usage();
+	}
+    }
+    if (optind != argc)
+	usage();
+
+    if (config) {
+	config_init_with_global(CONFIG_INIT_EXPLICIT_NAME, config);
+	dbrename(get_config_name(), DBG_SUBDIR_SERVER);
+    } else {
+	config_init(CONFIG_INIT_GLOBAL, NULL);
+    }
+    if (config_errors(NULL) >= CFGERR_WARNINGS) {
+	config_print_errors();
+	if (config_errors(NULL) >= CFGERR_ERRORS) {
+	    g_critical(_("errors processing config file"));
+	}
+    }
+
+    if (calibrate) {
+	char *errmsg = xfer_calibrate_costs(NULL);
+
+	if (errmsg) {
+	    g_fprintf(stderr, "%s\n", errmsg);
+	    return 1;
+	}
+	return 0;
+    }
+
+    if (g_str_has_prefix(dest, "device:"))
+	device_api_init();
+
+    if (!block_sizes) {
+	block_sizes = g_array_new(FALSE, FALSE, sizeof(gsize));
+	default_size = 32768;
+	g_array_append_val(block_sizes, default_size);
+    }
+    if (!ring_sizes) {
+	ring_sizes = g_array_new(FALSE, FALSE, sizeof(gsize));
+	default_size = 0;
+	g_array_append_val(ring_sizes, default_size);
+    }
+    if (!mechs) {
+	mechs = g_array_new(FALSE, FALSE, sizeof(xfer_mech));
+	g_array_append_val(mechs, default_mech);
+    }
+
+    if (json) {
+	char *timestamp = get_proper_stamp_from_time(time(NULL));
+	char *dest_q = json_quote(dest);
+
+	g_printf("{\"version\": \"%s\", \"timestamp\": \"%s\", \"length\": %ju,\n",
+		 VERSION, timestamp, (uintmax_t)length);
+	g_printf(" \"data\": \"%s\", \"dest\": %s, \"filters\": [",
+		 random_data? "random" : "text", dest_q);
+	for (b = 0; b < filters->len; b++) {
+	    char *q = json_quote(g_ptr_array_index(filters, b));
+	    g_printf("%s%s", b? ", " : "", q);
+	    g_free(q);
+	}
+	g_printf("],\n \"runs\": [\n");
+	g_free(timestamp);
+	g_free(dest_q);
+    }
+
+    for (b = 0; b < block_sizes->len; b++) {
+	for (r = 0; r < ring_sizes->len; r++) {
+	    for (m = 0; m < mechs->len; m++) {
+		for (n = 0; n < repeat; n++) {
+		    run_result_t *result = run_one(
+				g_array_index(block_sizes, gsize, b),
+				g_array_index(ring_sizes, gsize, r),
+				g_array_index(mechs, xfer_mech, m));
+
+		    if (result->errors->len)
+			failed = 1;
+		    if (json)
+			print_json(result, first);
+		    else
+			print_text(result);
+		    first = FALSE;
+		    free_result(result);
+		}
+	    }
+	}
+    }
+
+    if (json)
+	g_printf("\n ]}\n");
+
+    g_array_free(block_sizes, TRUE);
+    g_array_free(ring_sizes, TRUE);
+    g_array_free(mechs, TRUE);
+    g_ptr_array_free(filters, TRUE);
+
+    dbclose();
+    return failed;
+}
@@ -23,6 +23,16 @@
 #define EXPIRE_DELAY 24*60*60
 #define EXPIRE_ADJUST 23*60*60
 
+/* The changes made by add_cmd_in_cmdfile, remove_cmd_in_cmdfile,
+ * change_cmd_in_cmdfile and remove_working_in_cmdfile are appended to
+ * <cmdfile>.journal instead of rewriting the cmdfile.  The journal starts with
+ * 'SNAPSHOT <gen>' and is replayed by read_cmdfile only if the cmdfile has the
+ * same 'JOURNAL <gen>' line, so a journal left by a crash during
+ * write_cmdfile is ignored.  write_cmdfile writes a new snapshot with the next
+ * generation and removes the journal; it is called when the journal grows
+ * larger than the cmdfile, and at least CMDFILE_JOURNAL_MIN bytes. */
+#define CMDFILE_JOURNAL_MIN (64*1024)
+
 //static cmddata_t *duplicate_cmddata(cmddata_t *cmddata);
 
 void
@@ -90,8 +100,180 @@ close_cmdfile(
 static int checked_working_pid = 0;
 #define NB_PIDS 10
 
+typedef struct pid_cache_s {
+    pid_t pids[NB_PIDS];
+    pid_t new_pids[NB_PIDS];
+    int   nb_pids;
+} pid_cache_t;
+
 static gboolean need_rewrite;
 
+static char *cmdfile_line(cmddata_t *cmddata);
+static char *cmdfile_status_str(cmddata_t *cmddata);
+static void cmdfile_parse_status(cmddata_t *cmddata, char *fp);
+static void cmdfile_remove_working(gpointer key, gpointer value,
+				   gpointer user_data);
+
+/* validate working_pid */
+static void
+validate_working_pid(
+    pid_cache_t *cache,
+    cmddata_t   *cmddata)
+{
+    int i;
+
+    if (checked_working_pid || cmddata->working_pid == 0)
+	return;
+
+    for (i = 0; i < cache->nb_pids; i++) {
+	if (cache->pids[i] == cmddata->working_pid) {
+	    cmddata->working_pid = cache->new_pids[i];
+	    return;
+	}
+    }
+    if (cache->nb_pids < NB_PIDS) {
+	cache->pids[cache->nb_pids] = cmddata->working_pid;
+	if (kill(cmddata->working_pid, 0) != 0)
+	    cmddata->working_pid =0;
+	cache->new_pids[cache->nb_pids] = cmddata->working_pid;
+	cache->nb_pids++;
+    }
+}
+
+static char *
+journal_filename(
+    cmddatas_t *cmddatas)
+{
+    return g_strconcat(cmddatas->lock->filename, ".journal", NULL);
+}
+
+static gboolean
+cmdfile_remove_done(
+    gpointer key G_GNUC_UNUSED,
+    gpointer value,
+    gpointer user_data G_GNUC_UNUSED)
+{
+    cmddata_t *cmddata = value;
+
+    /* as write_cmdfile would drop it */
+    return cmddata->status == CMD_DONE && cmddata->working_pid == 0;
+}
+
+/* apply the journal of the snapshot just read */
+static void
+replay_journal(
+    cmddatas_t  *cmddatas,
+    pid_cache_t *cache,
+    gboolean    *generic_command_restore,
+    gboolean    *specific_command_restore)
+{
+    char  *filename = journal_filename(cmddatas);
+    char  *data = NULL;
+    gsize  len = 0;
+    char **xlines;
+    int    gen;
+    int    i;
+
+    cmddatas->journal_len = 0;
+    if (!g_file_get_contents(filename, &data, &len, NULL)) {
+	g_free(filename);
+	return;
+    }
+    g_free(filename);
+
+    xlines = g_strsplit(data, "\n", 0);
+    if (!xlines[0] || sscanf(xlines[0], "SNAPSHOT %d", &gen) != 1 ||
+	gen != cmddatas->journal_gen) {
+	/* stale, it is overwritten by the next change */
+	g_strfreev(xlines);
+	g_free(data);
+	return;
+    }
+
+    /* the last element is empty, or a line torn by a crash */
+    for (i = 1; xlines[i] != NULL && xlines[i+1] != NULL; i++) {
+	char *line = xlines[i];
+	cmddata_t *cmddata;
+	int id;
+	int pid;
+
+	if (strncmp(line, "ADD ", 4) == 0) {
+	    cmddata = cmdfile_parse_line(line + 4, generic_command_restore,
+					 specific_command_restore);
+	    if (!cmddata)
+		continue;
+	    validate_working_pid(cache, cmddata);
+	    if (cmddata->id > cmddatas->max_id)
+		cmddatas->max_id = cmddata->id;
+	    g_hash_table_insert(cmddatas->cmdfile,
+				GINT_TO_POINTER(cmddata->id), cmddata);
+	} else if (sscanf(line, "REMOVE %d", &id) == 1) {
+	    g_hash_table_remove(cmddatas->cmdfile, GINT_TO_POINTER(id));
+	} else if (sscanf(line, "STATUS %d", &id) == 1) {
+	    char *fp = strrchr(line, ' ');
+
+	    cmddata = g_hash_table_lookup(cmddatas->cmdfile,
+					  GINT_TO_POINTER(id));
+	    if (cmddata && fp)
+		cmdfile_parse_status(cmddata, fp + 1);
+	} else if (sscanf(line, "WORKING %d", &pid) == 1) {
+	    pid_t xpid = pid;
+	    g_hash_table_foreach(cmddatas->cmdfile, &cmdfile_remove_working,
+				 &xpid);
+	} else {
+	    g_debug("BAD cmdfile journal line: %s", line);
+	}
+    }
+    g_hash_table_foreach_remove(cmddatas->cmdfile, &cmdfile_remove_done,
+				NULL);
+    cmddatas->journal_len = len;
+
+    g_strfreev(xlines);
+    g_free(data);
+}
+
+/* Append ENTRY to the journal, or write a new snapshot if the journal is too
+ * large or can't be written; unlock the cmdfile. */
+static void
+journal_cmdfile(
+    cmddatas_t *cmddatas,
+    char       *entry)
+{
+    char    *filename;
+    char    *buf;
+    int      fd;
+    gboolean ok;
+
+    if (cmddatas->journal_len > MAX(CMDFILE_JOURNAL_MIN, cmddatas->lock->len)) {
+	write_cmdfile(cmddatas);
+	return;
+    }
+
+    filename = journal_filename(cmddatas);
+    if (cmddatas->journal_len == 0) {
+	fd = open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+	buf = g_strdup_printf("SNAPSHOT %d\n%s", cmddatas->journal_gen, entry);
+    } else {
+	fd = open(filename, O_WRONLY|O_APPEND);
+	buf = g_strdup(entry);
+    }
+    ok = fd >= 0 && full_write(fd, buf, strlen(buf)) == strlen(buf);
+    if (fd >= 0 && close(fd) != 0)
+	ok = FALSE;
+    if (!ok) {
+	g_debug("can't write cmdfile journal %s: %s", filename, strerror(errno));
+	g_free(filename);
+	g_free(buf);
+	write_cmdfile(cmddatas);
+	return;
+    }
+    cmddatas->journal_len += strlen(buf);
+    g_free(filename);
+    g_free(buf);
+
+    file_lock_unlock(cmddatas->lock);
+}
+
 static void
 cmdfile_set_expire(
     gpointer key G_GNUC_UNUSED,
@@ -134,9 +316,7 @@ read_cmdfile(
     cmddatas_t *cmddatas = g_new0(cmddatas_t, 1);
     char **xlines;
     int    i;
-    pid_t  pids[NB_PIDS];
-    pid_t  new_pids[NB_PIDS];
-    int    nb_pids = 0;
+    pid_cache_t cache;
     int    result;
     gboolean generic_command_restore = FALSE;
     gboolean specific_command_restore = FALSE;
@@ -145,6 +325,7 @@ read_cmdfile(
     cmddatas->cmdfile = g_hash_table_new_full(g_direct_hash, g_direct_equal,
 					      NULL, &free_cmddata);
     need_rewrite = FALSE;
+    cache.nb_pids = 0;
 
     // open
     while ((result = file_lock_lock(cmddatas->lock)) == 1) {
@@ -157,6 +338,7 @@ read_cmdfile(
     if (!cmddatas->lock->data) {
 	cmddatas->version = 1;
 	cmddatas->max_id = 0;
+	replay_journal(cmddatas, &cache, NULL, NULL);
 	return cmddatas;
     }
     xlines = g_strsplit(cmddatas->lock->data, "\n", 0);
@@ -167,34 +349,23 @@ read_cmdfile(
 
     // read cmd
     for (i=2; xlines[i] != NULL; i++) {
-	cmddata_t *cmddata = cmdfile_parse_line(xlines[i],
+	cmddata_t *cmddata;
+
+	if (sscanf(xlines[i], "JOURNAL %d", &cmddatas->journal_gen) == 1)
+	    continue;
+	cmddata = cmdfile_parse_line(xlines[i],
 				&generic_command_restore,
 				&specific_command_restore);
 
 	if (!cmddata) continue;
-	/* validate working_pid */
-	if (!checked_working_pid && cmddata->working_pid != 0) {
-	    int   i;
-
-	    for (i = 0; i < nb_pids; i++) {
-		if (pids[i] == cmddata->working_pid) {
-		    cmddata->working_pid = new_pids[i];
-		    i += 100;
-		    continue;
-		}
-	    }
-	    if (nb_pids < NB_PIDS) {
-		pids[nb_pids] = cmddata->working_pid;
-		if (kill(cmddata->working_pid, 0) != 0)
-		    cmddata->working_pid =0;
-		new_pids[nb_pids] = cmddata->working_pid;
-		nb_pids++;
-	    }
-	}
+	validate_working_pid(&cache, cmddata);
 
 	g_hash_table_insert(cmddatas->cmdfile, GINT_TO_POINTER(cmddata->id), cmddata);
     }
 
+    replay_journal(cmddatas, &cache, &generic_command_restore,
+		   &specific_command_restore);
+
     if (generic_command_restore) {
 	if (specific_command_restore) {
 	    /* set expire to NOW+24h of all genric command_restore */
@@ -388,33 +559,49 @@ cmdfile_parse_line (
 	fp = s - 1;
 	skip_non_whitespace(s, ch);
 	s[-1] = '\0';
-	if (g_str_equal(fp, "DONE")) {
-	    cmddata->status = CMD_DONE;
-	} else if (g_str_equal(fp, "TODO")) {
-	    cmddata->status = CMD_TODO;
-	} else if (strncmp(fp, "PARTIAL", 7) == 0) {
-	    long long lsize;
-	    cmddata->status = CMD_PARTIAL;
-	    if (sscanf(fp, "PARTIAL:%lld", &lsize) != 1) {
-	    } else {
-		cmddata->size = lsize;
-	    }
-	} else {
-	}
+	cmdfile_parse_status(cmddata, fp);
 
     return cmddata;
 }
 
 static void
-cmdfile_write(
-    gpointer key,
-    gpointer value,
-    gpointer user_data)
+cmdfile_parse_status(
+    cmddata_t *cmddata,
+    char      *fp)
 {
-    int id = GPOINTER_TO_INT(key);
-    cmddata_t *cmddata = value;
-    GPtrArray *lines = user_data;
-    char *line;
+    if (g_str_equal(fp, "DONE")) {
+	cmddata->status = CMD_DONE;
+    } else if (g_str_equal(fp, "TODO")) {
+	cmddata->status = CMD_TODO;
+    } else if (strncmp(fp, "PARTIAL", 7) == 0) {
+	long long lsize;
+	cmddata->status = CMD_PARTIAL;
+	if (sscanf(fp, "PARTIAL:%lld", &lsize) == 1) {
+	    cmddata->size = lsize;
+	}
+    }
+}
+
+static char *
+cmdfile_status_str(
+    cmddata_t *cmddata)
+{
+    switch (cmddata->status) {
+        case CMD_DONE: return g_strdup("DONE");
+        case CMD_TODO: return g_strdup("TODO");
+        case CMD_PARTIAL: return g_strdup_printf(
+				"PARTIAL:%lld", (long long)cmddata->size);
+	default: return NULL;
+    }
+}
+
+/* the line of CMDDATA in the cmdfile, or NULL */
+static char *
+cmdfile_line(
+    cmddata_t *cmddata)
+{
+    int id = cmddata->id;
+    char *line = NULL;
     char *config;
     char *hostname;
     char *diskname;
@@ -422,35 +609,18 @@ cmdfile_write(
     char *dst_storage;
     char *status;
 
-    assert(id == cmddata->id);
-
-    if (cmddata->status == CMD_DONE && cmddata->working_pid == 0)
-	return;
-
     config = quote_string(cmddata->config);
     hostname = quote_string(cmddata->hostname);
     diskname = quote_string(cmddata->diskname);
     dump_timestamp = quote_string(cmddata->dump_timestamp);
     dst_storage = quote_string(cmddata->dst_storage);
-
-    switch (cmddata->status) {
-        case CMD_DONE: status = g_strdup("DONE");
-		       break;
-        case CMD_TODO: status = g_strdup("TODO");
-		       break;
-        case CMD_PARTIAL: status = g_strdup_printf(
-				"PARTIAL:%lld", (long long)cmddata->size);
-		          break;
-	default: status = NULL;
-		 break;
-    }
+    status = cmdfile_status_str(cmddata);
     if (cmddata->operation == CMD_FLUSH) {
 	char *holding_file = quote_string(cmddata->holding_file);
 	line = g_strdup_printf("%d FLUSH %s %s %s %s %s %d %s WORKING:%d %s\n",
 		id, config, holding_file, hostname, diskname,
 		dump_timestamp, cmddata->level, dst_storage, (int)cmddata->working_pid, status);
 	g_free(holding_file);
-	g_ptr_array_add(lines, line);
     } else if (cmddata->operation == CMD_COPY) {
 	char *src_storage = quote_string(cmddata->src_storage);
 	char *src_pool = quote_string(cmddata->src_pool);
@@ -468,7 +638,6 @@ cmdfile_write(
 	g_free(src_pool);
 	g_free(src_label);
 	g_free(src_labels_str);
-	g_ptr_array_add(lines, line);
     } else if (cmddata->operation == CMD_RESTORE) {
 	char *src_storage = quote_string(cmddata->src_storage);
 	char *src_pool = quote_string(cmddata->src_pool);
@@ -494,7 +663,6 @@ cmdfile_write(
 	}
 	g_free(src_storage);
 	g_free(src_pool);
-	g_ptr_array_add(lines, line);
     }
     g_free(config);
     g_free(hostname);
@@ -502,6 +670,28 @@ cmdfile_write(
     g_free(dump_timestamp);
     g_free(dst_storage);
     g_free(status);
+
+    return line;
+}
+
+static void
+cmdfile_write(
+    gpointer key,
+    gpointer value,
+    gpointer user_data)
+{
+    cmddata_t *cmddata = value;
+    GPtrArray *lines = user_data;
+    char *line;
+
+    assert(GPOINTER_TO_INT(key) == cmddata->id);
+
+    if (cmddata->status == CMD_DONE && cmddata->working_pid == 0)
+	return;
+
+    line = cmdfile_line(cmddata);
+    if (line)
+	g_ptr_array_add(lines, line);
 }
 
 // we already have the lock
@@ -512,10 +702,13 @@ write_cmdfile(
 {
     GPtrArray *lines = g_ptr_array_sized_new(100);
     char *buffer;
+    char *journal;
 
     // generate
+    cmddatas->journal_gen++;
     g_ptr_array_add(lines, g_strdup_printf("VERSION %d\n", cmddatas->version));
     g_ptr_array_add(lines, g_strdup_printf("ID %d\n", cmddatas->max_id));
+    g_ptr_array_add(lines, g_strdup_printf("JOURNAL %d\n", cmddatas->journal_gen));
     g_hash_table_foreach(cmddatas->cmdfile, &cmdfile_write, lines);
     g_ptr_array_add(lines, NULL);
     buffer = g_strjoinv(NULL, (gchar **)lines->pdata);
@@ -525,6 +718,14 @@ write_cmdfile(
     file_lock_write(cmddatas->lock, buffer, strlen(buffer));
     g_free(buffer);
 
+    // the journal is now in the snapshot
+    journal = journal_filename(cmddatas);
+    if (unlink(journal) == -1 && errno != ENOENT) {
+	g_debug("can't remove %s: %s", journal, strerror(errno));
+    }
+    g_free(journal);
+    cmddatas->journal_len = 0;
+
     // unlock
     file_lock_unlock(cmddatas->lock);
 }
@@ -550,6 +751,7 @@ add_cmd_in_cmdfile(
     cmddata_t  *cmddata)
 {
     cmddatas_t *new_cmddatas;
+    char *line;
 
     // take the lock and read
     new_cmddatas = read_cmdfile(cmddatas->lock->filename);
@@ -563,7 +765,15 @@ add_cmd_in_cmdfile(
 		        GINT_TO_POINTER(new_cmddatas->max_id), cmddata);
 
     // write
-    write_cmdfile(new_cmddatas);
+    line = cmdfile_line(cmddata);
+    if (line) {
+	char *entry = g_strconcat("ADD ", line, NULL);
+	journal_cmdfile(new_cmddatas, entry);
+	g_free(entry);
+	g_free(line);
+    } else {
+	write_cmdfile(new_cmddatas);
+    }
     close_cmdfile(cmddatas);
     return new_cmddatas;
 }
@@ -574,6 +784,7 @@ remove_cmd_in_cmdfile(
     int         id)
 {
     cmddatas_t *new_cmddatas;
+    char       *entry;
 
     // take the lock and read
     new_cmddatas = read_cmdfile(cmddatas->lock->filename);
@@ -582,7 +793,9 @@ remove_cmd_in_cmdfile(
     g_hash_table_remove(new_cmddatas->cmdfile, GINT_TO_POINTER(id));
 
     // write
-    write_cmdfile(new_cmddatas);
+    entry = g_strdup_printf("REMOVE %d\n", id);
+    journal_cmdfile(new_cmddatas, entry);
+    g_free(entry);
     close_cmdfile(cmddatas);
     return new_cmddatas;
 }
@@ -596,6 +809,8 @@ change_cmd_in_cmdfile(
 {
     cmddatas_t *new_cmddatas;
     cmddata_t  *cmddata;
+    char       *status_str;
+    char       *entry;
 
     // take the lock and read
     new_cmddatas = read_cmdfile(cmddatas->lock->filename);
@@ -606,7 +821,11 @@ change_cmd_in_cmdfile(
     cmddata->size   = size;
 
     // write
-    write_cmdfile(new_cmddatas);
+    status_str = cmdfile_status_str(cmddata);
+    entry = g_strdup_printf("STATUS %d %s\n", id, status_str);
+    journal_cmdfile(new_cmddatas, entry);
+    g_free(entry);
+    g_free(status_str);
     close_cmdfile(cmddatas);
     return new_cmddatas;
 }
@@ -632,6 +851,7 @@ remove_working_in_cmdfile(
     pid_t       pid)
 {
     cmddatas_t *new_cmddatas;
+    char       *entry;
 
     // take the lock and read
     new_cmddatas = read_cmdfile(cmddatas->lock->filename);
@@ -640,7 +860,9 @@ remove_working_in_cmdfile(
     g_hash_table_foreach(new_cmddatas->cmdfile, &cmdfile_remove_working, &pid);
 
     // write
-    write_cmdfile(new_cmddatas);
+    entry = g_strdup_printf("WORKING %d\n", (int)pid);
+    journal_cmdfile(new_cmddatas, entry);
+    g_free(entry);
     close_cmdfile(cmddatas);
     return new_cmddatas;
 }
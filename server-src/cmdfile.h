@@ -72,6 +72,8 @@ typedef struct cmdatas_s {
     int        max_id;
     file_lock *lock;
     cmdfile_t  cmdfile;
+    int        journal_gen;	/* generation of the snapshot */
+    size_t     journal_len;	/* 0 if there is no journal to append to */
 } cmddatas_t;
 
 void free_cmddata(gpointer p);
@@ -33,32 +33,51 @@
 #include "amanda.h"
 #include "disk_history.h"
 
-static DUMP_ITEM *disk_hist = NULL;
+/*
+ * The history is kept in an array sorted by date, newest first, and the
+ * items are also linked in that order.  While it is built, the split dumps
+ * are found by their date, level and storage in disk_hist_split; the array
+ * is sorted once, by clean_dump, when all the parts are added.
+ */
+static GPtrArray *disk_hist = NULL;
+static GHashTable *disk_hist_split = NULL;
+
+static void
+free_dump_item(
+    DUMP_ITEM *item)
+{
+    free_tapelist(item->tapes);
+    amfree(item->hostname);
+    amfree(item);
+}
 
 void
 clear_list(void)
 {
-    DUMP_ITEM *item, *this;
-
-    item = disk_hist;
-    while (item != NULL)
-    {
-	this = item;
-	item = item->next;
-	amfree(this->hostname);
-	while(this->tapes != NULL) {
-	    tapelist_t *tapes = this->tapes;
-	    this->tapes = tapes->next;
-	    amfree(tapes->label);
-	    amfree(tapes->files);
-	    amfree(tapes);
-	}
-	amfree(this);
+    guint i;
+
+    if (disk_hist) {
+	for (i = 0; i < disk_hist->len; i++)
+	    free_dump_item(g_ptr_array_index(disk_hist, i));
+	g_ptr_array_free(disk_hist, TRUE);
+	disk_hist = NULL;
+    }
+    if (disk_hist_split) {
+	g_hash_table_destroy(disk_hist_split);
+	disk_hist_split = NULL;
     }
-    disk_hist = NULL;
 }
 
-/* add item, maintain list ordered by oldest date last */
+static char *
+split_key(
+    char *	date,
+    int		level,
+    char *	storage)
+{
+    return g_strdup_printf("%s\t%d\t%s", date, level, storage);
+}
+
+/* add item; the list is ordered by clean_dump */
 
 void
 add_dump(
@@ -71,30 +90,34 @@ add_dump(
     int		partnum,
     int		maxpart)
 {
-    DUMP_ITEM *new, *item, *before;
+    DUMP_ITEM *new, *item;
     int isafile = 0;
+    char *key;
 
     if(tape[0] == '/')
 	isafile = 1; /* XXX kludgey, like this whole thing */
 
+    if (!disk_hist)
+	disk_hist = g_ptr_array_new();
+    if (!disk_hist_split)
+	disk_hist_split = g_hash_table_new_full(g_str_hash, g_str_equal,
+						g_free, NULL);
+
     /* See if we already have partnum=partnum-1 */
     if (partnum > 1) {
-	for(item = disk_hist, before = NULL; item;
-	    before = item, item = item->next) {
-	    if (g_str_equal(item->date, date) &&
-		item->level == level && item->is_split &&
-		g_str_equal(item->storage, storage)) {
-		item->tapes = append_to_tapelist(item->tapes, storage, tape, file,
-						 partnum, isafile);
-		if (maxpart > item->maxpart)
-		    item->maxpart = maxpart;
-		return;
-	    }
+	key = split_key(date, level, storage);
+	item = g_hash_table_lookup(disk_hist_split, key);
+	g_free(key);
+	if (item) {
+	    item->tapes = append_to_tapelist(item->tapes, storage, tape, file,
+					     partnum, isafile);
+	    if (maxpart > item->maxpart)
+		item->maxpart = maxpart;
 	}
 	return;
     }
 
-    new = (DUMP_ITEM *)g_malloc(sizeof(DUMP_ITEM));
+    new = (DUMP_ITEM *)g_malloc0(sizeof(DUMP_ITEM));
     strncpy(new->date, date, sizeof(new->date)-1);
     new->date[sizeof(new->date)-1] = '\0';
     new->level = level;
@@ -110,49 +133,64 @@ add_dump(
         new->is_split = 1;
     new->tapes = NULL;
     new->hostname = g_strdup(hostname);
+    /* the order of the items of the same date is the order they are added */
+    new->index = disk_hist->len;
 
     new->tapes = append_to_tapelist(new->tapes, storage, tape, file, partnum, isafile);
 
-    if (disk_hist == NULL)
-    {
-	disk_hist = new;
-	new->next = NULL;
-	return;
+    /* the first split dump of that date, level and storage gets the parts */
+    if (new->is_split) {
+	key = split_key(new->date, level, new->storage);
+	if (g_hash_table_lookup(disk_hist_split, key)) {
+	    g_free(key);
+	} else {
+	    g_hash_table_insert(disk_hist_split, key, new);
+	}
     }
 
-    /* prepend this item to the history list, if it's newer */
-    /* XXX this should probably handle them being on the same date with
-       datestamp_uax or something */
-    if (strcmp(disk_hist->date, new->date) < 0)
-    {
-	new->next = disk_hist;
-	disk_hist = new;
-	return;
-    }
+    g_ptr_array_add(disk_hist, new);
+}
 
-    /* append this item to the history list, if it's older */
-    before = disk_hist;
-    item = disk_hist->next;
-    while ((item != NULL) && (strcmp(item->date, new->date) >= 0))
-    {
-	before = item;
-	item = item->next;
-    }
-    new->next = item;
-    before->next = new;
+static int
+cmp_dump_item(
+    gconstpointer a,
+    gconstpointer b)
+{
+    const DUMP_ITEM *item_a = *(DUMP_ITEM * const *)a;
+    const DUMP_ITEM *item_b = *(DUMP_ITEM * const *)b;
+    int r;
+
+    /* newest first */
+    r = strcmp(item_b->date, item_a->date);
+    if (r != 0)
+	return r;
+    if (item_a->index < item_b->index)
+	return -1;
+    return item_a->index > item_b->index;
 }
 
 void
 clean_dump(void)
 {
-    DUMP_ITEM *item, *before;
+    DUMP_ITEM *item;
+    GPtrArray *stack;
+    guint i, n;
+
+    if (!disk_hist)
+	return;
+
+    /* the split dumps are complete */
+    if (disk_hist_split) {
+	g_hash_table_destroy(disk_hist_split);
+	disk_hist_split = NULL;
+    }
 
     /* check if the maxpart part is avaliable */
-    for(item = disk_hist, before = NULL; item;
-					 before = item, item = item->next) {
+    for (i = 0, n = 0; i < disk_hist->len; i++) {
 	int found_maxpart = 0;
 	tapelist_t *cur_tape;
 
+	item = g_ptr_array_index(disk_hist, i);
 	if (item->maxpart > 1) {
 	    for (cur_tape = item->tapes; cur_tape; cur_tape = cur_tape->next) {
 		int files;
@@ -163,26 +201,71 @@ clean_dump(void)
 		}
 	    }
 	    if (found_maxpart == 0) {
-		DUMP_ITEM *myitem = item;
-
-		if (before)
-		    before->next = item->next;
-		else
-		    disk_hist = item->next;
-		item = item->next;
-		/* free myitem */
-		free_tapelist(myitem->tapes);
-		amfree(myitem->hostname);
-		amfree(myitem);
-		if (item == NULL)
-		    break;
+		free_dump_item(item);
+		continue;
 	    }
 	}
+	g_ptr_array_index(disk_hist, n++) = item;
+    }
+    g_ptr_array_set_size(disk_hist, n);
+
+    g_ptr_array_sort(disk_hist, cmp_dump_item);
+
+    /* link the items and find the base of each one: the next older dump
+     * of a lower level, it is popped from the stack of the older dumps */
+    stack = g_ptr_array_new();
+    for (i = disk_hist->len; i > 0; i--) {
+	item = g_ptr_array_index(disk_hist, i - 1);
+	item->index = i - 1;
+	item->next = (i < disk_hist->len) ? g_ptr_array_index(disk_hist, i)
+					  : NULL;
+	while (stack->len > 0 &&
+	       ((DUMP_ITEM *)g_ptr_array_index(stack, stack->len - 1))->level
+							>= item->level) {
+	    g_ptr_array_remove_index(stack, stack->len - 1);
+	}
+	item->base = stack->len > 0 ? g_ptr_array_index(stack, stack->len - 1)
+				    : NULL;
+	g_ptr_array_add(stack, item);
     }
+    g_ptr_array_free(stack, TRUE);
 }
 
 DUMP_ITEM *
 first_dump(void)
 {
-    return disk_hist;
+    if (!disk_hist || disk_hist->len == 0)
+	return NULL;
+    return g_ptr_array_index(disk_hist, 0);
+}
+
+/* the newest dump on or before date; date is compared as a prefix of the
+ * date of the dumps, that may have a time */
+
+DUMP_ITEM *
+dump_on_or_before(
+    const char *date)
+{
+    size_t len = strlen(date);
+    guint lo = 0, hi, mid;
+
+    if (!disk_hist)
+	return NULL;
+
+    /* newest first, the dumps after date are at the start of the array */
+    hi = disk_hist->len;
+    while (lo < hi) {
+	DUMP_ITEM *item;
+
+	mid = lo + (hi - lo) / 2;
+	item = g_ptr_array_index(disk_hist, mid);
+	if (strncmp(item->date, date, len) > 0)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+
+    if (lo == disk_hist->len)
+	return NULL;
+    return g_ptr_array_index(disk_hist, lo);
 }
@@ -45,16 +45,20 @@ typedef struct DUMP_ITEM
     tapelist_t *tapes;
     off_t  file;
     char *hostname;
+    guint index;		/* position in the history, newest first */
 
-    struct DUMP_ITEM *next;
+    struct DUMP_ITEM *next;	/* the next older dump */
+    struct DUMP_ITEM *base;	/* the next older dump of a lower level */
 }
 DUMP_ITEM;
 
 #define next_dump(item)	((item)->next)
+#define base_dump(item)	((item)->base)
 
 extern void clear_list(void);
 extern void add_dump(char *hostname, char *date, int level, char *storage,
 		     char *tape, off_t file, int partnum, int maxpart);
 extern void clean_dump(void);
 extern DUMP_ITEM *first_dump(void);
+extern DUMP_ITEM *dump_on_or_before(const char *date);
 #endif	/* !DISK_HISTORY_H */
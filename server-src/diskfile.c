@@ -37,13 +37,29 @@
 #include "diskfile.h"
 #include "amutil.h"
 #include "amxml.h"
+#include "amcompress.h"
 
 static am_host_t *hostlist = NULL;
 static  disklist_t dlist = { NULL, NULL };
 static netif_t *all_netifs = NULL;
 
+/* Indexes of hostlist, so that a disklist with many hosts and disks is not
+ * read in quadratic time */
+static GHashTable *host_table = NULL;	/* lower-case hostname -> host */
+static GHashTable *shost_table = NULL;	/* sanitised hostname -> host */
+static GHashTable *chost_table = NULL;	/* see canonical_hostname */
+static GSList *glob_hosts = NULL;	/* hosts with glob characters */
+
+/* filenames of the disks, shared by all the disks of a file */
+static GHashTable *disk_strings = NULL;
+
 /* local functions */
 static char *upcase(char *st);
+static char *canonical_hostname(const char *hostname);
+static gboolean is_glob_hostname(const char *hostname);
+static am_host_t *new_host(char *hostname);
+static void index_disk(disk_t *disk);
+static char *intern_disk_string(const char *str);
 static int parse_diskline(disklist_t *, const char *, FILE *, int *, char **);
 static void disk_parserror(const char *, int, const char *, ...)
 			    G_GNUC_PRINTF(3, 4);
@@ -109,12 +125,16 @@ am_host_t *
 lookup_host(
     const char *hostname)
 {
-    am_host_t *p;
+    am_host_t *host;
+    char *key;
 
-    for (p = hostlist; p != NULL; p = p->next) {
-	if(strcasecmp(p->hostname, hostname) == 0) return p;
-    }
-    return (NULL);
+    if (!host_table)
+	return NULL;
+
+    key = g_ascii_strdown(hostname, -1);
+    host = g_hash_table_lookup(host_table, key);
+    g_free(key);
+    return host;
 }
 
 disk_t *
@@ -123,17 +143,119 @@ lookup_disk(
     const char *diskname)
 {
     am_host_t *host;
-    disk_t *disk;
 
     host = lookup_host(hostname);
-    if (host == NULL)
+    if (host == NULL || host->disk_table == NULL)
 	return (NULL);
 
-    for (disk = host->disks; disk != NULL; disk = disk->hostnext) {
-	if (g_str_equal(disk->name, diskname))
-	    return (disk);
+    return g_hash_table_lookup(host->disk_table, diskname);
+}
+
+/* The key under which two plain hostnames match each other with match_host:
+ * lower-case, without leading or trailing dots. */
+static char *
+canonical_hostname(
+    const char *hostname)
+{
+    char *canon = g_ascii_strdown(hostname, -1);
+    char *s = canon;
+    size_t len;
+
+    while (*s == '.')
+	s++;
+    len = strlen(s);
+    while (len > 0 && s[len-1] == '.')
+	len--;
+    memmove(canon, s, len);
+    canon[len] = '\0';
+    return canon;
+}
+
+/* does match_host treat this hostname as more than a plain name? */
+static gboolean
+is_glob_hostname(
+    const char *hostname)
+{
+    return hostname[0] == '=' || strpbrk(hostname, "*?[]{}\\^$") != NULL;
+}
+
+/* create a host and add it to hostlist and its indexes */
+static am_host_t *
+new_host(
+    char *hostname)
+{
+    am_host_t *host;
+
+    if (!host_table) {
+	host_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+					   g_free, NULL);
+	shost_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+					    g_free, NULL);
+	chost_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+					    g_free, NULL);
+    }
+
+    host = g_malloc(sizeof(am_host_t));
+    host->next = hostlist;
+    hostlist = host;
+
+    host->hostname = hostname;
+    host->disks = NULL;
+    host->inprogress = 0;
+    host->maxdumps = 1;
+    host->netif = NULL;
+    host->start_t = 0;
+    host->status = 0;
+    host->features = NULL;
+    host->pre_script = 0;
+    host->post_script = 0;
+    host->disk_table = g_hash_table_new(g_str_hash, g_str_equal);
+    host->sdisk_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+					      g_free, NULL);
+
+    /* the newest host wins, as it did when hostlist was searched */
+    g_hash_table_insert(host_table, g_ascii_strdown(hostname, -1), host);
+    g_hash_table_insert(shost_table, sanitise_filename(hostname), host);
+    if (is_glob_hostname(hostname)) {
+	glob_hosts = g_slist_prepend(glob_hosts, host);
+    } else {
+	g_hash_table_insert(chost_table, canonical_hostname(hostname), host);
     }
-    return (NULL);
+
+    return host;
+}
+
+/* link a disk to its host and to the indexes of the host */
+static void
+index_disk(
+    disk_t *disk)
+{
+    am_host_t *host = disk->host;
+
+    disk->hostnext = host->disks;
+    host->disks = disk;
+    g_hash_table_insert(host->disk_table, disk->name, disk);
+    g_hash_table_insert(host->sdisk_table, sanitise_filename(disk->name),
+			disk);
+}
+
+static char *
+intern_disk_string(
+    const char *str)
+{
+    char *interned;
+
+    if (!str)
+	return NULL;
+    if (!disk_strings)
+	disk_strings = g_hash_table_new_full(g_str_hash, g_str_equal,
+					     g_free, NULL);
+    interned = g_hash_table_lookup(disk_strings, str);
+    if (!interned) {
+	interned = g_strdup(str);
+	g_hash_table_insert(disk_strings, interned, interned);
+    }
+    return interned;
 }
 
 
@@ -212,11 +334,11 @@ add_disk(
     bzero(disk, sizeof(disk_t));
     disk->line = 0;
     disk->allow_split = 0;
+    disk->change_token = 0;
     disk->max_warnings = 20;
     disk->tape_splitsize = (off_t)0;
     disk->split_diskbuffer = NULL;
     disk->fallback_splitsize = (off_t)0;
-    disk->hostname = g_strdup(hostname);
     disk->name = g_strdup(diskname);
     disk->device = g_strdup(diskname);
     disk->spindle = -1;
@@ -235,26 +357,13 @@ add_disk(
 
     host = lookup_host(hostname);
     if(host == NULL) {
-	host = g_malloc(sizeof(am_host_t));
-	host->next = hostlist;
-	hostlist = host;
-
-	host->hostname = g_strdup(hostname);
-	host->disks = NULL;
-	host->inprogress = 0;
-	host->maxdumps = 1;
-	host->netif = NULL;
-	host->start_t = 0;
-	host->status = 0;
-	host->features = NULL;
-	host->pre_script = 0;
-	host->post_script = 0;
+	host = new_host(g_strdup(hostname));
     }
     enqueue_disk(list, disk);
 
     disk->host = host;
-    disk->hostnext = host->disks;
-    host->disks = disk;
+    disk->hostname = host->hostname;
+    index_disk(disk);
 
     return disk;
 }
@@ -364,19 +473,28 @@ unload_disklist(void)
 	hostnext = host->next;
 	for (dp = host->disks; dp != NULL ; dp = dpnext) {
 	    dpnext = dp->hostnext;
-	    amfree(dp->filename);
+	    /* the hostname, filename and exclude/include lists are shared */
 	    amfree(dp->name);
-	    amfree(dp->hostname);
 	    amfree(dp->device);
-	    free_sl(dp->exclude_file);
-	    free_sl(dp->exclude_list);
-	    free_sl(dp->include_file);
-	    free_sl(dp->include_list);
 	    free(dp);
 	}
+	g_hash_table_destroy(host->disk_table);
+	g_hash_table_destroy(host->sdisk_table);
 	amfree(host);
     }
     hostlist=NULL;
+    if (host_table) {
+	g_hash_table_destroy(host_table);
+	g_hash_table_destroy(shost_table);
+	g_hash_table_destroy(chost_table);
+	host_table = shost_table = chost_table = NULL;
+    }
+    g_slist_free(glob_hosts);
+    glob_hosts = NULL;
+    if (disk_strings) {
+	g_hash_table_destroy(disk_strings);
+	disk_strings = NULL;
+    }
     dlist.head = NULL;
     dlist.tail = NULL;
 
@@ -429,6 +547,7 @@ parse_diskline(
     am_host_t *p;
     disk_t *dp;
     identlist_t pp_iter;
+    GSList *iter;
 
     assert(filename != NULL);
     assert(line_num > 0);
@@ -477,26 +596,44 @@ parse_diskline(
     }
 
     shost = sanitise_filename(hostname);
-    for (p = hostlist; p != NULL; p = p->next) {
-	char *shostp = sanitise_filename(p->hostname);
-	if (!g_str_equal(hostname, p->hostname) &&
-	    g_str_equal(shost, shostp)) {
-	    disk_parserror(filename, line_num, _("Two hosts are mapping to the same name: \"%s\" and \"%s\""), p->hostname, hostname);
-	    amfree(shost);
-	    amfree(shostp);
-	    return(-1);
+    p = shost_table ? g_hash_table_lookup(shost_table, shost) : NULL;
+    amfree(shost);
+    if (p && !g_str_equal(hostname, p->hostname)) {
+	disk_parserror(filename, line_num, _("Two hosts are mapping to the same name: \"%s\" and \"%s\""), p->hostname, hostname);
+	amfree(hostname);
+	return(-1);
+    }
+
+    /* Two plain hostnames can only match each other if they have the same
+     * canonical name; a glob must still be tried against every host. */
+    if (is_glob_hostname(hostname)) {
+	for (p = hostlist; p != NULL; p = p->next) {
+	    if (strcasecmp(hostname, p->hostname) &&
+		match_host(hostname, p->hostname) &&
+		match_host(p->hostname, hostname))
+		break;
 	}
-	else if (strcasecmp(hostname, p->hostname) &&
-		 match_host(hostname, p->hostname) &&
-		 match_host(p->hostname, hostname)) {
-	    disk_parserror(filename, line_num, _("Duplicate host name: \"%s\" and \"%s\""), p->hostname, hostname);
-	    amfree(shost);
-	    amfree(shostp);
-	    return(-1);
+    } else {
+	char *chost = canonical_hostname(hostname);
+	p = chost_table ? g_hash_table_lookup(chost_table, chost) : NULL;
+	g_free(chost);
+	if (p && !(strcasecmp(hostname, p->hostname) &&
+		   match_host(hostname, p->hostname) &&
+		   match_host(p->hostname, hostname)))
+	    p = NULL;
+	for (iter = glob_hosts; p == NULL && iter != NULL; iter = iter->next) {
+	    am_host_t *gp = iter->data;
+	    if (strcasecmp(hostname, gp->hostname) &&
+		match_host(hostname, gp->hostname) &&
+		match_host(gp->hostname, hostname))
+		p = gp;
 	}
-	amfree(shostp);
     }
-    amfree(shost);
+    if (p) {
+	disk_parserror(filename, line_num, _("Duplicate host name: \"%s\" and \"%s\""), p->hostname, hostname);
+	amfree(hostname);
+	return(-1);
+    }
 
     skip_whitespace(s, ch);
     if(ch == '\0' || ch == '#') {
@@ -586,7 +723,7 @@ parse_diskline(
     }
     if (!disk) {
 	disk = g_malloc(sizeof(disk_t));
-	disk->filename = g_strdup(filename);
+	disk->filename = intern_disk_string(filename);
 	disk->line = line_num;
 	disk->hostname = hostname;
 	disk->name = diskname;
@@ -602,20 +739,14 @@ parse_diskline(
 
     if (host) {
 	sdisk = sanitise_filename(diskname);
-	for (dp = host->disks; dp != NULL; dp = dp->hostnext) {
-	    char *sdiskp = sanitise_filename(dp->name);
-	    if (!g_str_equal(diskname, dp->name) &&
-		 g_str_equal(sdisk, sdiskp)) {
-		disk_parserror(filename, line_num,
-		 _("Two disks are mapping to the same name: \"%s\" and \"%s\"; you must use different diskname"),
-			       dp->name, diskname);
-		amfree(sdiskp);
-		amfree(sdisk);
-		return(-1);
-	    }
-	    amfree(sdiskp);
-	}
+	dp = g_hash_table_lookup(host->sdisk_table, sdisk);
 	amfree(sdisk);
+	if (dp && !g_str_equal(diskname, dp->name)) {
+	    disk_parserror(filename, line_num,
+	     _("Two disks are mapping to the same name: \"%s\" and \"%s\"; you must use different diskname"),
+			   dp->name, diskname);
+	    return(-1);
+	}
     }
 
     if (fp[0] == '{') {
@@ -701,17 +832,19 @@ parse_diskline(
     disk->dtype_name	     = dumptype_name(dtype);
     disk->config	     = dtype;
     disk->program	     = dumptype_get_program(dtype);
-    disk->exclude_list     = duplicate_sl(dumptype_get_exclude(dtype).sl_list);
-    disk->exclude_file     = duplicate_sl(dumptype_get_exclude(dtype).sl_file);
+    /* the lists are shared with the dumptype, like the strings below */
+    disk->exclude_list     = dumptype_get_exclude(dtype).sl_list;
+    disk->exclude_file     = dumptype_get_exclude(dtype).sl_file;
     disk->exclude_optional   = dumptype_get_exclude(dtype).optional;
-    disk->include_list     = duplicate_sl(dumptype_get_include(dtype).sl_list);
-    disk->include_file     = duplicate_sl(dumptype_get_include(dtype).sl_file);
+    disk->include_list     = dumptype_get_include(dtype).sl_list;
+    disk->include_file     = dumptype_get_include(dtype).sl_file;
     disk->include_optional   = dumptype_get_include(dtype).optional;
     disk->priority	     = dumptype_get_priority(dtype);
     disk->dumpcycle	     = dumptype_get_dumpcycle(dtype);
     disk->auth               = dumptype_get_auth(dtype);
     disk->maxdumps	     = dumptype_get_maxdumps(dtype);
     disk->allow_split        = dumptype_get_allow_split(dtype);
+    disk->change_token       = dumptype_get_change_token(dtype);
     disk->max_warnings       = dumptype_get_max_warnings(dtype);
     disk->tape_splitsize     = dumptype_get_tape_splitsize(dtype);
     disk->split_diskbuffer   = dumptype_get_split_diskbuffer(dtype);
@@ -847,6 +980,8 @@ parse_diskline(
 	all_netifs = netif;
 	netif->config = cfg_if;
 	netif->curusage = 0;
+	netif->measured_kps = 0;
+	netif->kps_ratio = 1.0;
     }
 
     skip_whitespace(s, ch);
@@ -897,30 +1032,19 @@ parse_diskline(
     /* success, add disk to lists */
 
     if(host == NULL) {			/* new host */
-	host = g_malloc(sizeof(am_host_t));
-	host->next = hostlist;
-	hostlist = host;
-
-	host->hostname = g_strdup(hostname);
-	hostname = NULL;
-	host->disks = NULL;
-	host->inprogress = 0;
-	host->maxdumps = 1;		/* will be overwritten */
-	host->netif = NULL;
-	host->start_t = 0;
-	host->status = 0;
-	host->features = NULL;
-	host->pre_script = 0;
-	host->post_script = 0;
+	host = new_host(hostname);	/* maxdumps will be overwritten */
+    } else {
+	amfree(hostname);
     }
+    hostname = NULL;
 
     host->netif = netif;
 
     enqueue_disk(lst, disk);
 
     disk->host = host;
-    disk->hostnext = host->disks;
-    host->disks = disk;
+    disk->hostname = host->hostname;
+    index_disk(disk);
     host->maxdumps = disk->maxdumps;
 
     return (0);
@@ -1038,6 +1162,25 @@ gchar **validate_optionstr(disk_t *dp)
 	break;
     case COMP_SERVER_BEST:
 	break;
+    case COMP_SERVER_AUTO:
+	break;
+    case COMP_SERVER_DEFERRED:
+	break;
+    case COMP_SERVER_ZSTD:
+	/* amrestore runs the zstd program to decompress */
+#ifdef ZSTD_PATH
+	if (!amcompress_supported(AMCOMPRESS_ZSTD))
+#endif
+	    g_ptr_array_add(errarray,
+			    g_strdup("server zstd compression is not supported by this server"));
+	break;
+    case COMP_SERVER_LZ4:
+#ifdef LZ4_PATH
+	if (!amcompress_supported(AMCOMPRESS_LZ4))
+#endif
+	    g_ptr_array_add(errarray,
+			    g_strdup("server lz4 compression is not supported by this server"));
+	break;
     case COMP_SERVER_CUST:
 	if (dp->srvcompprog == NULL || strlen(dp->srvcompprog) == 0) {
 	    g_ptr_array_add(errarray,
@@ -1061,7 +1204,11 @@ gchar **validate_optionstr(disk_t *dp)
 	    }
 	    if (dp->compress == COMP_SERVER_FAST ||
 		dp->compress == COMP_SERVER_BEST ||
-		dp->compress == COMP_SERVER_CUST ) {
+		dp->compress == COMP_SERVER_CUST ||
+		dp->compress == COMP_SERVER_AUTO ||
+		dp->compress == COMP_SERVER_DEFERRED ||
+		dp->compress == COMP_SERVER_ZSTD ||
+		dp->compress == COMP_SERVER_LZ4) {
 		g_ptr_array_add(errarray,
                                 g_strdup("Client encryption with server compression is not supported. See amanda.conf(5) for detail"));
 	    }
@@ -1208,6 +1355,18 @@ char *optionstr(disk_t *dp)
     case COMP_SERVER_BEST:
         g_ptr_array_add(array, g_strdup("srvcomp-best"));
 	break;
+    case COMP_SERVER_AUTO:
+        g_ptr_array_add(array, g_strdup("srvcomp-auto"));
+	break;
+    case COMP_SERVER_DEFERRED:
+        g_ptr_array_add(array, g_strdup("srvcomp-deferred"));
+	break;
+    case COMP_SERVER_ZSTD:
+        g_ptr_array_add(array, g_strdup("srvcomp-zstd"));
+	break;
+    case COMP_SERVER_LZ4:
+        g_ptr_array_add(array, g_strdup("srvcomp-lz4"));
+	break;
     case COMP_SERVER_CUST:
         g_ptr_array_add(array, g_strdup_printf("srvcomp-cust=%s",
             dp->srvcompprog));
@@ -1380,6 +1539,23 @@ char * xml_optionstr(disk_t *dp, int to_server)
     case COMP_SERVER_BEST:
         g_ptr_array_add(array, g_strdup("  <compress>SERVER-BEST</compress>"));
 	break;
+    case COMP_SERVER_AUTO:
+	/* clients before it do not know it, and do not need it */
+	if (to_server)
+	    g_ptr_array_add(array, g_strdup("  <compress>SERVER-AUTO</compress>"));
+	break;
+    case COMP_SERVER_DEFERRED:
+	if (to_server)
+	    g_ptr_array_add(array, g_strdup("  <compress>SERVER-DEFERRED</compress>"));
+	break;
+    case COMP_SERVER_ZSTD:
+	if (to_server)
+	    g_ptr_array_add(array, g_strdup("  <compress>SERVER-ZSTD</compress>"));
+	break;
+    case COMP_SERVER_LZ4:
+	if (to_server)
+	    g_ptr_array_add(array, g_strdup("  <compress>SERVER-LZ4</compress>"));
+	break;
     case COMP_SERVER_CUST:
         g_ptr_array_add(array, g_strdup_printf("  <compress>SERVER-CUSTOM"
             "<custom-compress-program>%s</custom-compress-program>\n"
@@ -1625,6 +1801,44 @@ clean_dle_str_for_client(
 	memmove(hack1, hack2 + SC_LEN, strlen(hack2 + SC_LEN) + 1);
     }
 #undef SC
+#undef SC_LEN
+
+    /* the server compresses, and older clients do not know SERVER-AUTO */
+#define SC "  <compress>SERVER-AUTO</compress>\n"
+#define SC_LEN strlen(SC)
+    hack1 = strstr(rval_dle_str, SC);
+    if (hack1) {
+	memmove(hack1, hack1 + SC_LEN, strlen(hack1 + SC_LEN) + 1);
+    }
+#undef SC
+#undef SC_LEN
+
+    /* nor SERVER-DEFERRED */
+#define SC "  <compress>SERVER-DEFERRED</compress>\n"
+#define SC_LEN strlen(SC)
+    hack1 = strstr(rval_dle_str, SC);
+    if (hack1) {
+	memmove(hack1, hack1 + SC_LEN, strlen(hack1 + SC_LEN) + 1);
+    }
+#undef SC
+#undef SC_LEN
+
+    /* nor SERVER-ZSTD and SERVER-LZ4 */
+#define SC "  <compress>SERVER-ZSTD</compress>\n"
+#define SC_LEN strlen(SC)
+    hack1 = strstr(rval_dle_str, SC);
+    if (hack1) {
+	memmove(hack1, hack1 + SC_LEN, strlen(hack1 + SC_LEN) + 1);
+    }
+#undef SC
+#undef SC_LEN
+#define SC "  <compress>SERVER-LZ4</compress>\n"
+#define SC_LEN strlen(SC)
+    hack1 = strstr(rval_dle_str, SC);
+    if (hack1) {
+	memmove(hack1, hack1 + SC_LEN, strlen(hack1 + SC_LEN) + 1);
+    }
+#undef SC
 #undef SC_LEN
 
     if (!am_has_feature(their_features, fe_dumptype_property)) {
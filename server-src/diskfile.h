@@ -43,6 +43,8 @@ typedef struct netif_s {
     struct netif_s *next;
     interface_t *config;
     unsigned long curusage;
+    unsigned long measured_kps;	/* measured kps of the dumps in progress */
+    double kps_ratio;		/* measured / estimated kps of the dumps */
 } netif_t;
 
 typedef struct amhost_s {
@@ -51,12 +53,15 @@ typedef struct amhost_s {
     struct disk_s *disks;		/* linked list of disk records */
     int inprogress;			/* # dumps in progress */
     int maxdumps;			/* maximum dumps in parallel */
+    unsigned long work_left;		/* est. seconds of dumps to do (driver) */
     netif_t *netif;			/* network interface this host is on */
     time_t start_t;			/* time last dump was started on this host */
     am_feature_t *features;		/* feature set */
     int	 pre_script;
     int  post_script;
     int  status;
+    GHashTable *disk_table;		/* disk name -> disk_t (diskfile.c) */
+    GHashTable *sdisk_table;		/* sanitised disk name -> disk_t */
 } am_host_t;
 
 typedef struct disk_s {
@@ -96,6 +101,7 @@ typedef struct disk_s {
     int		include_optional;	/* include list are optional */
     int		priority;		/* priority of disk */
     int		allow_split;
+    int		change_token;		/* skip the estimates if unchanged */
     int         max_warnings;
     off_t	tape_splitsize;         /* size of dumpfile chunks on tape */
     char	*split_diskbuffer;      /* place where we can buffer PORT-WRITE dumps other than RAM */
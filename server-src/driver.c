@@ -53,6 +53,7 @@
 #include "cmdfile.h"
 #include "tapefile.h"
 #include "shm-ring.h"
+#include "amprobe.h"
 
 #define driver_debug(i, ...) do {	\
 	if ((i) <= debug_driver) {	\
@@ -68,6 +69,12 @@
 
 #define HOST_DELAY 0
 
+/* measured bandwidth: a dump is accounted at its own rate after that many
+ * seconds, and the ratio of an interface is kept in these bounds */
+#define BANDWIDTH_MEASURE_TIME 60
+#define BANDWIDTH_RATIO_MIN 0.25
+#define BANDWIDTH_RATIO_MAX 4.0
+
 static disklist_t  waitq;	// dle waiting estimate result
 static schedlist_t runq;	// dle waiting to be dumped to holding disk
 static schedlist_t directq;	// dle waiting to be dumped directly to tape
@@ -97,6 +104,15 @@ static event_handle_t *flush_ev_read = NULL;
 static event_handle_t *schedule_ev_read = NULL;
 static int   schedule_done;			// 1 if we don't wait for a
 						//   schedule from the planner
+static gboolean conf_stream_schedule;		// the planner sends the
+						//   schedule as it is made
+static gboolean schedule_eof = FALSE;
+static gboolean conf_holding_in_dumper;		// the dumpers write the
+						//   holding files
+static gboolean conf_autotune;			// adjust the dumpers and the
+						//   per-host limits to the rate
+static int dumper_limit;			// dumpers allowed by autotune
+static GString *schedule_buf = NULL;
 static int   force_flush;			// All dump are terminated, we
 						// must now respect taper_flush
 static int nb_sent_new_tape = 0;
@@ -110,15 +126,28 @@ static int no_vault = FALSE;
 static int wait_children(int count);
 static void wait_for_children(void);
 static void allocate_bandwidth(netif_t *ip, unsigned long kps);
+static void measure_holdingdisk(assignedhd_t *hd, sched_t *sp);
+static int holdingdisk_better(holdalloc_t *ha, holdalloc_t *minp, off_t size);
+static gboolean holdingdisk_takes(holdalloc_t *ha, off_t size, gboolean rest);
+static int holdingdisk_busy(holdalloc_t *ha);
+static void holding_readers(sched_t *sp, int delta);
+static int flush_contention(sched_t *sp);
 static int assign_holdingdisk(assignedhd_t **holdp, sched_t *sp);
 static void adjust_diskspace(sched_t *sp, cmd_t cmd);
 static void delete_diskspace(sched_t *sp);
 static assignedhd_t **build_diskspace(char *destname);
 static int client_constrained(disk_t *dp);
 static void deallocate_bandwidth(netif_t *ip, unsigned long kps);
+static unsigned long network_kps(netif_t *ip, sched_t *sp);
+static void measure_bandwidth(sched_t *sp, off_t kb, gboolean done);
+static void forget_bandwidth(sched_t *sp);
+static void autotune_count(sched_t *sp, off_t kb);
+static int autotune_host_limit(am_host_t *host);
+static void autotune_start(void);
 static void dump_schedule(schedlist_t *qp, char *str);
 static assignedhd_t **find_diskspace(off_t size, int *cur_idle,
 					assignedhd_t *preferred);
+static assignedhd_t **find_dump_diskspace(sched_t *sp, int *cur_idle);
 static unsigned long network_free_kps(netif_t *ip);
 static off_t holding_free_space(void);
 static void dumper_chunker_result(job_t *job);
@@ -129,6 +158,10 @@ static void vault_taper_result(job_t *job);
 static void file_taper_result(job_t *job);
 static void handle_dumper_result(void *);
 static void handle_chunker_result(void *);
+static void start_holding_dump(job_t *job, cmd_t cmd);
+static void holding_continue(job_t *job);
+static void holding_no_room(job_t *job, off_t missing);
+static void holding_rq_more_disk(job_t *job);
 static void handle_dumpers_time(void *);
 static void handle_taper_result(void *);
 static gboolean dump_match_selection(char *storage_n, sched_t *sp);
@@ -140,11 +173,16 @@ static void interface_state(char *time_str);
 static int queue_length(schedlist_t *q);
 static void read_flush(void *cookie);
 static void read_schedule(void *cookie);
+static char *read_schedule_line(void);
 static void set_vaultqs(void);
 static void short_dump_state(void);
+static void write_metrics(gboolean force);
 static void start_a_flush_wtaper(wtaper_t    *wtaper,
                                  gboolean    *state_changed);
 static void start_a_flush_taper(taper_t    *taper);
+static void batch_flushes(taper_t *taper);
+static sched_t *pick_batched_flush(wtaper_t *wtaper, gboolean fit,
+				   off_t taper_left, off_t extra_tapes_size);
 static void start_a_vault_wtaper(wtaper_t    *wtaper,
                                  gboolean    *state_changed);
 static void start_a_vault_taper(taper_t    *taper);
@@ -152,6 +190,8 @@ static void start_a_vault(void);
 static void start_a_flush(void);
 static void start_degraded_mode(schedlist_t *queuep);
 static void start_some_dumps(schedlist_t *rq);
+static void compute_work_left(schedlist_t *rq, const time_t now);
+static unsigned long host_work_left(am_host_t *host);
 static void continue_port_dumps(void);
 static void update_failed_dump(sched_t *sp);
 static int no_taper_flushing(void);
@@ -202,6 +242,7 @@ static void insert_before_sched(schedlist_t *list, GList *list_before, sched_t *
 static int find_sched(schedlist_t *list, sched_t *sp);
 static sched_t *dequeue_sched(schedlist_t *list);
 static void remove_sched(schedlist_t *list, sched_t *sp);
+static void clear_sched(schedlist_t *list);
 
 int
 main(
@@ -279,6 +320,7 @@ main(
 	if (g_str_equal(argv[2], "--log-filename")) {
 	    log_filename = g_strdup(argv[3]);
 	    set_logname(log_filename);
+	    log_set_keep_open(TRUE);
 	    argv += 2;
 	    argc -= 2;
 	}
@@ -326,6 +368,14 @@ main(
 
     config_init_with_global(CONFIG_INIT_EXPLICIT_NAME | CONFIG_INIT_USE_CWD, cfg_opt);
 
+    /* the schedule is read from fd 0 as it comes, nothing must stay in the
+     * stdio buffer */
+    conf_stream_schedule = getconf_boolean(CNF_STREAM_SCHEDULE);
+    if (conf_stream_schedule)
+	setvbuf(stdin, (char *)NULL, (int)_IONBF, 0);
+    conf_holding_in_dumper = getconf_boolean(CNF_HOLDING_IN_DUMPER);
+    conf_autotune = getconf_boolean(CNF_AUTOTUNE);
+
     conf_diskfile = config_dir_relative(getconf_str(CNF_DISKFILE));
     read_diskfile(conf_diskfile, &origq);
     disable_skip_disk(&origq);
@@ -415,6 +465,7 @@ main(
     /* set up any configuration-dependent variables */
 
     inparallel	= getconf_int(CNF_INPARALLEL);
+    dumper_limit = inparallel;
 
     conf_reserve = (unsigned long)getconf_int(CNF_RESERVE);
 
@@ -438,7 +489,9 @@ main(
 
 	ha->hdisk = hdp;
 	ha->allocated_dumpers = 0;
+	ha->active_readers = 0;
 	ha->allocated_space = (off_t)0;
+	ha->write_kps = 0;
 	ha->disksize = holdingdisk_get_disksize(hdp);
 
 	/* get disk size */
@@ -531,11 +584,14 @@ main(
 
     runq.head = NULL;
     runq.tail = NULL;
+    runq.index = NULL;
     directq.head = NULL;
     directq.tail = NULL;
+    directq.index = NULL;
     waitq = origq;
     roomq.head = NULL;
     roomq.tail = NULL;
+    roomq.index = NULL;
 
     if (no_taper || conf_runtapes <= 0) {
 	taper_started = 1; /* we'll pretend the taper started and failed immediately */
@@ -572,6 +628,9 @@ main(
     schedule_done = no_dump;
     force_flush = 0;
 
+    if (conf_autotune && !no_dump)
+	autotune_start();
+
     short_dump_state();
     event_loop(0);
     short_dump_state();
@@ -761,6 +820,7 @@ main(
 
     event_loop(0);
     short_dump_state();				/* for amstatus */
+    write_metrics(TRUE);
 
     g_printf(_("driver: QUITTING time %s telling children to quit\n"),
            walltime_str(curclock()));
@@ -802,6 +862,7 @@ main(
     amfree(taper_program);
 
     cleanup_shm_ring();
+    free_all_sched();
 
     dbclose();
 
@@ -845,12 +906,14 @@ wait_children(int count)
 		    if (pid == dumper->pid) {
 			who = g_strdup(dumper->name);
 			dumper->pid = -1;
+			forget_childstr(dumper->fd);
 			break;
 		    }
 		    if (dumper->job && dumper->job->chunker &&
 			pid == dumper->job->chunker->pid) {
 			who = g_strdup(dumper->job->chunker->name);
 			dumper->job->chunker->pid = -1;
+			forget_childstr(dumper->job->chunker->fd);
 			break;
 		    }
 		}
@@ -858,6 +921,7 @@ wait_children(int count)
 		    if (pid == taper->pid) {
 			who = g_strdup(taper->name);
 			taper->pid = -1;
+			forget_childstr(taper->fd);
 			break;
 		    }
 		}
@@ -1054,6 +1118,158 @@ start_a_flush_taper(
     }
 }
 
+static gint
+sort_flush_by_datestamp_size(
+    gconstpointer a,
+    gconstpointer b)
+{
+    const sched_t *sa = a;
+    const sched_t *sb = b;
+    int r = strcmp(sa->datestamp, sb->datestamp);
+
+    if (r != 0)
+	return r;
+    if (sa->act_size != sb->act_size)
+	return sa->act_size > sb->act_size ? -1 : 1;
+    return 0;
+}
+
+static gint
+sort_flush_by_batch(
+    gconstpointer a,
+    gconstpointer b)
+{
+    return ((const sched_t *)a)->flush_batch - ((const sched_t *)b)->flush_batch;
+}
+
+/*
+ * Order the flushes read from the holding disk for one storage, so that
+ * they go to as few volumes as possible: the oldest first, and the largest
+ * first in a datestamp, packed first-fit in the volumes they are expected
+ * on.  Each expected volume is a batch, written by one worker; a batch
+ * starts with its large dumps, and ends with the small ones that fill the
+ * end of the volume.  g_list_sort keeps the links, so the index of the
+ * queue stays valid.
+ */
+static void
+batch_flushes(
+    taper_t *taper)
+{
+    GList  *link;
+    GArray *room;
+    guint   b;
+
+    taper->tapeq.head = g_list_sort(taper->tapeq.head,
+				    sort_flush_by_datestamp_size);
+    taper->tapeq.tail = g_list_last(taper->tapeq.head);
+    if (taper->tape_length <= 0)
+	return;
+
+    room = g_array_new(FALSE, FALSE, sizeof(off_t));
+    for (link = taper->tapeq.head; link != NULL; link = link->next) {
+	sched_t *sp = link->data;
+	off_t left;
+
+	if (sp->action != ACTION_FLUSH)
+	    continue;
+	for (b = 0; b < room->len; b++) {
+	    if (sp->act_size <= g_array_index(room, off_t, b))
+		break;
+	}
+	if (b == room->len) {
+	    /* a new volume; a dump larger than a volume fills it */
+	    left = taper->tape_length - sp->act_size;
+	    if (left < 0)
+		left = 0;
+	    g_array_append_val(room, left);
+	} else {
+	    g_array_index(room, off_t, b) -= sp->act_size;
+	}
+	sp->flush_batch = b + 1;
+    }
+    driver_debug(1, "%s: %d flushes in %u batches\n", taper->storage_name,
+		 queue_length(&taper->tapeq), room->len);
+    g_array_free(room, TRUE);
+
+    taper->tapeq.head = g_list_sort(taper->tapeq.head, sort_flush_by_batch);
+    taper->tapeq.tail = g_list_last(taper->tapeq.head);
+}
+
+/*
+ * Take the next flush of the batch of WTAPER, or of the first batch no
+ * other worker is writing.  With FIT, only a flush that fits in what is
+ * left.  Of those, the first one whose holding disks have the fewest
+ * dumpers and flushes on them, see flush_contention().  Returns NULL if
+ * there is none, for the taperalgo to choose.
+ */
+static sched_t *
+pick_batched_flush(
+    wtaper_t *wtaper,
+    gboolean  fit,
+    off_t     taper_left,
+    off_t     extra_tapes_size)
+{
+    taper_t  *taper = wtaper->taper;
+    wtaper_t *wtaper1;
+    GList    *link;
+    sched_t  *best = NULL;
+    int       best_busy = 0;
+    int       batch = 0;
+    int       i;
+
+    for (i = 0; i < 2 && batch == 0; i++) {
+	for (link = taper->tapeq.head; link != NULL; link = link->next) {
+	    sched_t *sp = link->data;
+	    gboolean claimed = FALSE;
+
+	    if (sp->flush_batch == 0)
+		continue;
+	    if (i == 0) {
+		/* the batch it is writing */
+		if (sp->flush_batch == wtaper->flush_batch)
+		    batch = sp->flush_batch;
+	    } else {
+		for (wtaper1 = taper->wtapetable;
+		     wtaper1 < taper->wtapetable + taper->nb_worker;
+		     wtaper1++) {
+		    if (wtaper1 != wtaper &&
+			wtaper1->flush_batch == sp->flush_batch)
+			claimed = TRUE;
+		}
+		if (!claimed)
+		    batch = sp->flush_batch;
+	    }
+	    if (batch)
+		break;
+	}
+    }
+    if (batch == 0)
+	return NULL;
+
+    for (link = taper->tapeq.head; link != NULL; link = link->next) {
+	sched_t *sp = link->data;
+	disk_t  *dp = sp->disk;
+
+	if (sp->flush_batch != batch)
+	    continue;
+	if (!fit || sp->act_size <=
+		((dp->tape_splitsize || dp->allow_split) ? extra_tapes_size
+							  : taper_left)) {
+	    int busy = flush_contention(sp);
+
+	    if (!best || busy < best_busy) {
+		best = sp;
+		best_busy = busy;
+	    }
+	    if (busy == 0)
+		break;
+	}
+    }
+    if (best)
+	wtaper->flush_batch = batch;
+    return best;
+}
+
 static void
 start_a_flush_wtaper(
     wtaper_t    *wtaper,
@@ -1159,6 +1375,14 @@ start_a_flush_wtaper(
 	}
 	sp = NULL;
 	datestamp = ((sched_t *)(wtaper->taper->tapeq.head->data))->datestamp;
+	if (taperalgo == ALGO_FIRST || taperalgo == ALGO_FIRSTFIT) {
+	    sp = pick_batched_flush(wtaper, taperalgo == ALGO_FIRSTFIT,
+				    taper_left, extra_tapes_size);
+	    if (sp) {
+		remove_sched(&wtaper->taper->tapeq, sp);
+		taperalgo = ALGO_ALGO;	/* already picked, no case below */
+	    }
+	}
 	switch(taperalgo) {
 	case ALGO_FIRST:
 		sp = dequeue_sched(&wtaper->taper->tapeq);
@@ -1310,6 +1534,7 @@ start_a_flush_wtaper(
 		wtaper->nb_dle = 1;
 		wtaper->left = taper->tape_length;
 	    }
+	    holding_readers(sp, 1);
 	    taper_cmd(taper, wtaper, FILE_WRITE, sp, sp->destname,
 		      sp->level,
 		      sp->datestamp);
@@ -1546,7 +1771,7 @@ client_constrained(
 
     /* first, check if host is too busy */
 
-    if (dp->host->inprogress >= dp->host->maxdumps) {
+    if (dp->host->inprogress >= autotune_host_limit(dp->host)) {
 	return 1;
     }
 
@@ -1604,7 +1829,8 @@ allow_dump_dle(
 	    sleep_time = diskp->start_t;
 	}
     } else if (diskp->host->netif->curusage > 0 &&
-	       sp->est_kps > network_free_kps(diskp->host->netif)) {
+	       network_kps(diskp->host->netif, sp) >
+			network_free_kps(diskp->host->netif)) {
 	*cur_idle = max(*cur_idle, IDLE_NO_BANDWIDTH);
     } else if (!wtaper && sp->no_space) {
 	*cur_idle = max(*cur_idle, IDLE_NO_DISKSPACE);
@@ -1614,7 +1840,7 @@ allow_dump_dle(
 	*cur_idle = max(*cur_idle, IDLE_NO_DISKSPACE);
 	/* no tape space */
     } else if (!wtaper && (holdp =
-	find_diskspace(sp->est_size, cur_idle, NULL)) == NULL) {
+	find_dump_diskspace(sp, cur_idle)) == NULL) {
 	*cur_idle = max(*cur_idle, IDLE_NO_DISKSPACE);
 	if (all_tapeq_empty() && dumper_to_holding == 0 && rq != &directq && no_taper_flushing()) {
 	    char *qname = quote_string(diskp->name);
@@ -1655,6 +1881,12 @@ allow_dump_dle(
 			break;
 	      case 'B': accept = (sp->est_kps > (*sp_accept)->est_kps);
 			break;
+	      case 'C': accept = (host_work_left(diskp->host) >
+				  host_work_left((*sp_accept)->disk->host) ||
+				  (host_work_left(diskp->host) ==
+				   host_work_left((*sp_accept)->disk->host) &&
+				   sp->est_time > (*sp_accept)->est_time));
+			break;
 	      default:  log_add(L_WARNING, _("Unknown dumporder character \'%c\', using 's'.\n"),
 				dumptype);
 			accept = (sp->est_size < (*sp_accept)->est_size);
@@ -1678,6 +1910,61 @@ allow_dump_dle(
     }
 }
 
+/* the time a host still needs, spread over the dumps it can run at once */
+static unsigned long
+host_work_left(
+    am_host_t *host)
+{
+    return host->work_left / (host->maxdumps > 1 ? host->maxdumps : 1);
+}
+
+/*
+ * Set the work_left of the hosts with a dump to do or running: the
+ * estimated time of their dumps in rq and directq plus what is left of
+ * their running dumps.
+ */
+static void
+compute_work_left(
+    schedlist_t *rq,
+    const time_t now)
+{
+    dumper_t *dumper;
+    GList    *slist;
+    sched_t  *sp;
+    schedlist_t *queues[2];
+    int q;
+
+    queues[0] = rq;
+    queues[1] = &directq;
+    for (q = 0; q < 2; q++) {
+	for (slist = queues[q]->head; slist != NULL; slist = slist->next) {
+	    get_sched(slist)->disk->host->work_left = 0;
+	}
+    }
+    for (dumper = dmptable; dumper < dmptable+inparallel; dumper++) {
+	if (dumper->busy && dumper->job) {
+	    dumper->job->sched->disk->host->work_left = 0;
+	}
+    }
+
+    for (q = 0; q < 2; q++) {
+	for (slist = queues[q]->head; slist != NULL; slist = slist->next) {
+	    sp = get_sched(slist);
+	    sp->disk->host->work_left += sp->est_time;
+	}
+    }
+    for (dumper = dmptable; dumper < dmptable+inparallel; dumper++) {
+	if (dumper->busy && dumper->job) {
+	    sp = dumper->job->sched;
+	    if (sp->timestamp > 0 &&
+		(unsigned long)(now - sp->timestamp) < sp->est_time) {
+		sp->disk->host->work_left += sp->est_time -
+					     (now - sp->timestamp);
+	    }
+	}
+    }
+}
+
 static void
 start_some_dumps(
     schedlist_t *rq)
@@ -1714,6 +2001,9 @@ start_some_dumps(
 	    dumper_to_holding++;
 	}
     }
+    if (strchr(getconf_str(CNF_DUMPORDER), 'C')) {
+	compute_work_left(rq, now);
+    }
     for (dumper = dmptable; dumper < dmptable+inparallel; dumper++) {
 	gboolean directq_is_empty;
 
@@ -1721,6 +2011,11 @@ start_some_dumps(
 	    continue;
 	}
 
+	/* autotune may run fewer dumpers than inparallel */
+	if (active_dumper() >= dumper_limit) {
+	    break;
+	}
+
 	if (dumper->ev_read != NULL) {
 	    event_release(dumper->ev_read);
 	    dumper->ev_read = NULL;
@@ -1877,6 +2172,8 @@ start_some_dumps(
 	}
 
 	idle_reason = max(idle_reason, cur_idle);
+	if (sp == NULL)
+	    AMPROBE1(driver__idle, cur_idle);
 	if (sp == NULL && idle_reason == IDLE_NO_DISKSPACE) {
 	    /* continue flush waiting for new tape */
 	    start_a_flush();
@@ -1899,7 +2196,10 @@ start_some_dumps(
 	    job_t *job = alloc_job();
 
 	    sp->act_size = (off_t)0;
-	    allocate_bandwidth(sp->disk->host->netif, sp->est_kps);
+	    sp->alloc_kps = network_kps(sp->disk->host->netif, sp);
+	    allocate_bandwidth(sp->disk->host->netif, sp->alloc_kps);
+	    if (sp->compress_deferred)
+		sp->est_size = MAX(sp->est_size, sp->est_nsize);
 	    sp->activehd = assign_holdingdisk(holdp, sp);
 	    amfree(holdp);
 	    g_free(sp->destname);
@@ -1915,6 +2215,8 @@ start_some_dumps(
 
 	    dumper->busy = 1;		/* dumper is now busy */
 	    remove_sched(rq, sp);		/* take it off the run queue */
+	    AMPROBE4(driver__start__dump, sp->disk->host->hostname,
+		     sp->disk->name, sp->level, 0);
 
 	    sp->origsize = (off_t)-1;
 	    sp->dumpsize = (off_t)-1;
@@ -1928,22 +2230,36 @@ start_some_dumps(
 	    dumper->sent_command = FALSE;
 	    dumper->sent_result = 0;
 	    dumper->dump_finish = 0;
-	    startup_chunk_process(chunker,chunker_program);
-	    chunker_cmd(chunker, START, NULL, driver_timestamp);
-	    if (sp->disk->compress == COMP_SERVER_FAST ||
-		sp->disk->compress == COMP_SERVER_BEST ||
-		sp->disk->compress == COMP_SERVER_CUST ||
-		sp->disk->encrypt == ENCRYPT_SERV_CUST) {
-		chunker_cmd(chunker, PORT_WRITE, sp, sp->datestamp);
-		job->do_port_write = TRUE;
+	    job->do_port_write = sp->disk->compress == COMP_SERVER_FAST ||
+				 sp->disk->compress == COMP_SERVER_BEST ||
+				 sp->disk->compress == COMP_SERVER_CUST ||
+				 sp->disk->compress == COMP_SERVER_AUTO ||
+				 sp->disk->compress == COMP_SERVER_ZSTD ||
+				 sp->disk->compress == COMP_SERVER_LZ4 ||
+				 (sp->disk->compress == COMP_SERVER_DEFERRED &&
+				  !sp->compress_deferred) ||
+				 sp->disk->encrypt == ENCRYPT_SERV_CUST;
+	    if (conf_holding_in_dumper && !job->do_port_write &&
+		!getconf_seen(CNF_CATALOG)) {
+		/* the dumper writes the holding file, no chunker */
+		chunker->in_dumper = TRUE;
+		chunker->pid = 0;
+		chunker->fd = -1;
+		chunker->ev_read = NULL;
+		start_holding_dump(job, HOLDING_DUMP);
 	    } else {
-		chunker_cmd(chunker, SHM_WRITE, sp, sp->datestamp);
-		job->do_port_write = FALSE;
+		startup_chunk_process(chunker,chunker_program);
+		chunker_cmd(chunker, START, NULL, driver_timestamp);
+		if (job->do_port_write) {
+		    chunker_cmd(chunker, PORT_WRITE, sp, sp->datestamp);
+		} else {
+		    chunker_cmd(chunker, SHM_WRITE, sp, sp->datestamp);
+		}
+		chunker->ev_read = event_create((event_id_t)chunker->fd,
+						EV_READFD,
+						handle_chunker_result, chunker);
+		event_activate(chunker->ev_read);
 	    }
-	    chunker->ev_read = event_create((event_id_t)chunker->fd,
-					    EV_READFD,
-					    handle_chunker_result, chunker);
-	    event_activate(chunker->ev_read);
 	    sp->disk->host->start_t = now + HOST_DELAY;
 	    if (empty(*rq) && active_dumper() == 0) { force_flush = 1;}
 
@@ -1952,7 +2268,8 @@ start_some_dumps(
 	    job_t *job = alloc_job();
 
 	    sp->act_size = (off_t)0;
-	    allocate_bandwidth(sp->disk->host->netif, sp->est_kps);
+	    sp->alloc_kps = network_kps(sp->disk->host->netif, sp);
+	    allocate_bandwidth(sp->disk->host->netif, sp->alloc_kps);
 	    sp->disk->host->inprogress++;	/* host is now busy */
 	    sp->disk->inprogress = 1;
 	    job->sched = sp;
@@ -1964,9 +2281,12 @@ start_some_dumps(
 	    sp->timestamp = now;
 	    amfree(sp->try_again_message);
 	    amfree(sp->disk->dataport_list);
+	    sp->compress_deferred = FALSE;	/* no holding disk to land on */
 
 	    dumper->busy = 1;		/* dumper is now busy */
 	    remove_sched(&directq, sp);  /* take it off the direct queue */
+	    AMPROBE4(driver__start__dump, sp->disk->host->hostname,
+		     sp->disk->name, sp->level, 1);
 
 	    sp->origsize = (off_t)-1;
 	    sp->dumpsize = (off_t)-1;
@@ -2004,6 +2324,10 @@ start_some_dumps(
 		sp->disk->compress == COMP_SERVER_FAST ||
 		sp->disk->compress == COMP_SERVER_BEST ||
 		sp->disk->compress == COMP_SERVER_CUST ||
+		sp->disk->compress == COMP_SERVER_AUTO ||
+		sp->disk->compress == COMP_SERVER_DEFERRED ||
+		sp->disk->compress == COMP_SERVER_ZSTD ||
+		sp->disk->compress == COMP_SERVER_LZ4 ||
 		sp->disk->encrypt == ENCRYPT_SERV_CUST) {
 		taper_cmd(taper, wtaper, PORT_WRITE, sp, NULL, sp->level,
 			  sp->datestamp);
@@ -2093,6 +2417,7 @@ start_degraded_mode(
     }
 
     newq.head = newq.tail = 0;
+    newq.index = NULL;
 
     dump_schedule(queuep, _("before start degraded mode"));
 
@@ -2142,6 +2467,7 @@ start_degraded_mode(
         amfree(qname);
     }
 
+    clear_sched(queuep);
     /*@i@*/ *queuep = newq;
     all_degraded_mode = (nb_storage == 0);
     for (taper = tapetable; taper < tapetable+nb_storage ; taper++) {
@@ -2182,7 +2508,7 @@ continue_port_dumps(void)
 	    assert(dumper < dmptable + inparallel);
 	    assert(dumper->job);
 	    sp->activehd = assign_holdingdisk(h, sp);
-	    chunker_cmd(dumper->job->chunker, CONTINUE, sp, NULL);
+	    holding_continue(dumper->job);
 	    amfree(h);
 	    remove_sched(&roomq, sp);
 	}
@@ -2222,7 +2548,8 @@ continue_port_dumps(void)
 	 * We abort that dump, hopefully not wasting too much time retrying it.
 	 */
 	remove_sched( &roomq, sp );
-	chunker_cmd(job->chunker, ABORT, NULL, _("Not enough holding disk space"));
+	if (!job->chunker->in_dumper)
+	    chunker_cmd(job->chunker, ABORT, NULL, _("Not enough holding disk space"));
 	dumper_cmd(job->dumper, ABORT, NULL, _("Not enough holding disk space"));
 	job->dumper->sent_result = 1;
 	pending_aborts++;
@@ -2503,8 +2830,11 @@ handle_taper_result(
 	    }
 
 	    wtaper->written += OFF_T_ATOI(result_argv[5]);
+	    wtaper->total_written += OFF_T_ATOI(result_argv[5]);
 	    if (wtaper->written > sp->act_size)
 		sp->act_size = wtaper->written;
+	    if (job->dumper)
+		measure_bandwidth(sp, wtaper->written, FALSE);
 
 	    partsize = 0;
 	    s = strstr(result_argv[6], " kb ");
@@ -2847,7 +3177,8 @@ handle_taper_result(
             }
 	    taper->degraded_mode = TRUE;
 	    start_degraded_mode(&runq);
-            taper->tapeq.head = taper->tapeq.tail = NULL;
+            clear_sched(&taper->tapeq);
+            forget_childstr(taper->fd);
             aaclose(taper->fd);
 
             break;
@@ -3036,6 +3367,7 @@ file_taper_result(
     disk_t   *dp;
     char    *qname = quote_string(sp->disk->name);
 
+    holding_readers(sp, -1);
     if (wtaper->result == DONE) {
 	update_info_taper(sp, wtaper->first_label, wtaper->first_fileno,
 			  sp->level);
@@ -3305,7 +3637,8 @@ dumper_taper_result_finish(
     dumper->busy = 0;
     dp->host->inprogress -= 1;
     dp->inprogress = 0;
-    deallocate_bandwidth(dp->host->netif, sp->est_kps);
+    deallocate_bandwidth(dp->host->netif, sp->alloc_kps);
+    forget_bandwidth(sp);
     free_serial_job(job);
     free_job(job);
     dumper->job = NULL;
@@ -3447,7 +3780,8 @@ dumper_chunker_result_finish(
 
     activehd = sp->activehd;
 
-    deallocate_bandwidth(dp->host->netif, sp->est_kps);
+    deallocate_bandwidth(dp->host->netif, sp->alloc_kps);
+    forget_bandwidth(sp);
 
     is_partial = dumper->result != DONE || chunker->result != DONE;
     rename_tmp_holding(sp->destname, !is_partial);
@@ -3463,6 +3797,8 @@ dumper_chunker_result_finish(
 
     size = holding_file_size(sp->destname, 0);
     h[activehd]->used = size - dummy;
+    if (activehd == 0)
+	measure_holdingdisk(h[activehd], sp);
     h[activehd]->disk->allocated_dumpers--;
     adjust_diskspace(sp, DONE);
 
@@ -3513,7 +3849,7 @@ dumper_chunker_result_finish(
 
 		for (taper = tapetable; taper < tapetable+nb_storage ; taper++) {
 		    if (g_str_equal(storage_name, taper->storage_name)) {
-			sched_t *sp1 = g_new0(sched_t, 1);
+			sched_t *sp1 = alloc_sched();
 			*sp1 = *sp;
 			sp1->action = ACTION_FLUSH;
 	                sp1->destname = g_strdup(sp->destname);
@@ -3543,16 +3879,22 @@ dumper_chunker_result_finish(
     dp->host->inprogress -= 1;
     dp->inprogress = 0;
 
-    if (waitpid(chunker->pid, &retstat, WNOHANG) == chunker->pid) {
-	if (!WIFEXITED(retstat)) {
-	    g_debug("chunker '%s' exited with signal %d", chunker->name, WTERMSIG(retstat));
-	} else if (WEXITSTATUS(retstat) != 0) {
-	    g_debug("chunker '%s' exited with code %d", chunker->name, WEXITSTATUS(retstat));
+    if (chunker->in_dumper) {
+	/* no chunker process was started */
+	chunker->in_dumper = FALSE;
+    } else {
+	if (waitpid(chunker->pid, &retstat, WNOHANG) == chunker->pid) {
+	    if (!WIFEXITED(retstat)) {
+		g_debug("chunker '%s' exited with signal %d", chunker->name, WTERMSIG(retstat));
+	    } else if (WEXITSTATUS(retstat) != 0) {
+		g_debug("chunker '%s' exited with code %d", chunker->name, WEXITSTATUS(retstat));
+	    }
 	}
+	forget_childstr(chunker->fd);
+	aaclose(chunker->fd);
+	chunker->fd = -1;
+	chunker->down = 1;
     }
-    aaclose(chunker->fd);
-    chunker->fd = -1;
-    chunker->down = 1;
 
     free_serial_job(job);
     free_job(job);
@@ -3665,19 +4007,34 @@ handle_dumper_result(
 	switch(cmd) {
 
 	case DONE: /* DONE <handle> <origsize> <dumpsize> <dumptime> <native-crc> <client-crc> <errstr> */
-	    if(result_argc != 8) {
+		   /* DONE <handle> <origsize> <dumpsize> <dumptime> <native-crc> <client-crc> <holding-size> <server-crc> <errstr> */
+	    if (job->chunker && job->chunker->in_dumper) {
+		if (result_argc != 10) {
+		    error(_("error [dumper DONE result_argc != 10: %d]"), result_argc);
+		    /*NOTREACHED*/
+		}
+	    } else if(result_argc != 8) {
 		error(_("error [dumper DONE result_argc != 8: %d]"), result_argc);
 		/*NOTREACHED*/
 	    }
 
 	    sp->origsize = OFF_T_ATOI(result_argv[2]);
 	    sp->dumptime = TIME_T_ATOI(result_argv[4]);
+	    measure_bandwidth(sp, OFF_T_ATOI(result_argv[3]), TRUE);
 	    parse_crc(result_argv[5], &sp->native_crc);
 	    parse_crc(result_argv[6], &sp->client_crc);
 
 	    g_printf(_("driver: finished-cmd time %s %s dumped %s:%s\n"),
 		   walltime_str(curclock()), dumper->name,
 		   dp->host->hostname, qname);
+	    if (job->chunker && job->chunker->in_dumper) {
+		sp->dumpsize = (off_t)atof(result_argv[7]);
+		parse_crc(result_argv[8], &sp->server_crc);
+		job->chunker->result = DONE;
+		g_printf(_("driver: finished-cmd time %s %s chunked %s:%s\n"),
+			 walltime_str(curclock()), dumper->name,
+			 dp->host->hostname, qname);
+	    }
 	    fflush(stdout);
 
 	    dumper->result = cmd;
@@ -3707,6 +4064,8 @@ handle_dumper_result(
 	case FAILED: /* FAILED <handle> <errstr> */
 	    /*free_serial(result_argv[1]);*/
 	    dumper->result = cmd;
+	    if (job->chunker && job->chunker->in_dumper)
+		job->chunker->result = cmd;
 	    break;
 
 	case ABORT_FINISHED: /* ABORT-FINISHED <handle> */
@@ -3719,6 +4078,16 @@ handle_dumper_result(
 	    assert(pending_aborts);
 	    /*free_serial(result_argv[1]);*/
 	    dumper->result = cmd;
+	    if (job->chunker && job->chunker->in_dumper)
+		job->chunker->result = cmd;
+	    break;
+
+	case NO_ROOM: /* NO-ROOM <handle> <missing_size> <message> */
+	    holding_no_room(job, OFF_T_ATOI(result_argv[2]));
+	    break;
+
+	case RQ_MORE_DISK: /* RQ-MORE-DISK <handle> */
+	    holding_rq_more_disk(job);
 	    break;
 
 	case RETRY: /* RETRY <handle> <delay> <level> <errstr> */
@@ -3728,6 +4097,8 @@ handle_dumper_result(
 		int level = atoi(result_argv[3]);
 
 		dumper->result = cmd;
+		if (job->chunker && job->chunker->in_dumper)
+		    job->chunker->result = cmd;
 		if (delay >= 0) {
 		    dp->start_t = now + delay;
 		} else {
@@ -3750,6 +4121,7 @@ handle_dumper_result(
 		event_release(dumper->ev_read);
 		dumper->ev_read = NULL;
 	    }
+	    forget_childstr(dumper->fd);
 	    aaclose(dumper->fd);
 	    dumper->busy = 0;
 	    dumper->down = 1;	/* mark it down so it isn't used again */
@@ -3765,6 +4137,11 @@ handle_dumper_result(
 			sp->level);
             }
 	    dumper->result = cmd;
+	    if (job->chunker && job->chunker->in_dumper) {
+		/* nothing else will finish the holding file */
+		job->chunker->result = cmd;
+		dumper->dump_finish = 1;
+	    }
 	    break;
 
 	default:
@@ -3773,7 +4150,7 @@ handle_dumper_result(
         amfree(qname);
 	g_strfreev(result_argv);
 
-	if (cmd == DUMP_FINISH) {
+	if (cmd == DUMP_FINISH || cmd == NO_ROOM || cmd == RQ_MORE_DISK) {
 	} else if (cmd != BOGUS) {
 	    int last_dump = 1;
 	    dumper_t *dumper;
@@ -3812,7 +4189,11 @@ handle_dumper_result(
 	}
 
 	    /* send the dumper result to the chunker */
-	    if (job->chunker) {
+	    if (job->chunker && job->chunker->in_dumper) {
+		if (dumper->result != LAST_TOK &&
+		    job->chunker->result != LAST_TOK)
+		    dumper_chunker_result(job);
+	    } else if (job->chunker) {
 		if (cmd == TRYAGAIN) {
 		    char *abort_message = g_strdup_printf("dumper TRYAGAIN: %s",
 						sp->try_again_message);
@@ -3880,7 +4261,6 @@ handle_chunker_result(
     cmd_t cmd;
     int result_argc;
     char **result_argv;
-    int dummy;
     int activehd;
     char *qname;
     amwait_t retstat;
@@ -3978,26 +4358,7 @@ handle_chunker_result(
 		sp->disk->shm_name = g_strdup(result_argv[3]);
 	    }
 
-	    if (sp->disk->host->pre_script == 0) {
-		run_server_host_scripts(EXECUTE_ON_PRE_HOST_BACKUP,
-					get_config_name(), driver_timestamp,
-					sp->disk->host);
-		sp->disk->host->pre_script = 1;
-	    }
-	    run_server_dle_scripts(EXECUTE_ON_PRE_DLE_BACKUP,
-				   get_config_name(), driver_timestamp,
-				   sp->disk, sp->level, BOGUS);
-	    if (job->do_port_write) {
-		dumper_cmd(dumper, PORT_DUMP, sp, NULL);
-	    } else {
-		dumper_cmd(dumper, SHM_DUMP, sp, NULL);
-	    }
-	    dumper->sent_command = TRUE;
-	    dumper->ev_read = event_create(
-				(event_id_t)dumper->fd,
-				EV_READFD,
-				handle_dumper_result, dumper);
-	    event_activate(dumper->ev_read);
+	    start_holding_dump(job, job->do_port_write ? PORT_DUMP : SHM_DUMP);
 	    break;
 
 	case DUMPER_STATUS: /* DUMP-STATUS <handle> */
@@ -4013,51 +4374,11 @@ handle_chunker_result(
 	    break;
 
 	case NO_ROOM: /* NO-ROOM <handle> <missing_size> <message> */
-	    if (!h || activehd < 0) { /* should never happen */
-		error(_("!h || activehd < 0"));
-		/*NOTREACHED*/
-	    }
-	    h[activehd]->used -= OFF_T_ATOI(result_argv[2]);
-	    h[activehd]->reserved -= OFF_T_ATOI(result_argv[2]);
-	    h[activehd]->disk->allocated_space -= OFF_T_ATOI(result_argv[2]);
-	    h[activehd]->disk->disksize -= OFF_T_ATOI(result_argv[2]);
+	    holding_no_room(job, OFF_T_ATOI(result_argv[2]));
 	    break;
 
 	case RQ_MORE_DISK: /* RQ-MORE-DISK <handle> */
-	    if (!h || activehd < 0) { /* should never happen */
-		error(_("!h || activehd < 0"));
-		/*NOTREACHED*/
-	    }
-	    h[activehd]->disk->allocated_dumpers--;
-	    h[activehd]->used = h[activehd]->reserved;
-	    if( h[++activehd] ) { /* There's still some allocated space left.
-				   * Tell the dumper about it. */
-		sp->activehd++;
-		chunker_cmd(chunker, CONTINUE, sp, NULL);
-	    } else { /* !h[++activehd] - must allocate more space */
-		sp->act_size = sp->est_size; /* not quite true */
-		sp->est_size = (sp->act_size/(off_t)20) * (off_t)21; /* +5% */
-		sp->est_size = am_round(sp->est_size, (off_t)DISK_BLOCK_KB);
-		if (sp->est_size < sp->act_size + 2*DISK_BLOCK_KB)
-		    sp->est_size += 2 * DISK_BLOCK_KB;
-		h = find_diskspace(sp->est_size - sp->act_size,
-				   &dummy,
-				   h[activehd-1]);
-		if( !h ) {
-		    /* No diskspace available. The reason for this will be
-		     * determined in continue_port_dumps(). */
-		    enqueue_sched(&roomq, sp);
-		    continue_port_dumps();
-		    /* continue flush waiting for new tape */
-		    start_a_flush();
-		    start_a_vault();
-		} else {
-		    /* OK, allocate space for disk and have chunker continue */
-		    sp->activehd = assign_holdingdisk( h, sp );
-		    chunker_cmd(chunker, CONTINUE, sp, NULL);
-		    amfree(h);
-		}
-	    }
+	    holding_rq_more_disk(job);
 	    break;
 
 	case ABORT_FINISHED: /* ABORT-FINISHED <handle> */
@@ -4113,6 +4434,7 @@ handle_chunker_result(
 		} else if (WEXITSTATUS(retstat) != 0) {
 		    g_debug("chunker '%s' exited with code %d", chunker->name, WEXITSTATUS(retstat));
 		}
+		forget_childstr(chunker->fd);
 	    }
 
 	    event_release(chunker->ev_read);
@@ -4159,6 +4481,119 @@ handle_chunker_result(
     } while(areads_dataready(chunker->fd));
 }
 
+/* run the pre-backup scripts and send the dump command CMD of JOB to its
+ * dumper, once the holding side is ready for it */
+static void
+start_holding_dump(
+    job_t *job,
+    cmd_t  cmd)
+{
+    sched_t  *sp = job->sched;
+    dumper_t *dumper = job->dumper;
+
+    if (sp->disk->host->pre_script == 0) {
+	run_server_host_scripts(EXECUTE_ON_PRE_HOST_BACKUP,
+				get_config_name(), driver_timestamp,
+				sp->disk->host);
+	sp->disk->host->pre_script = 1;
+    }
+    run_server_dle_scripts(EXECUTE_ON_PRE_DLE_BACKUP,
+			   get_config_name(), driver_timestamp,
+			   sp->disk, sp->level, BOGUS);
+    dumper_cmd(dumper, cmd, sp, NULL);
+    dumper->sent_command = TRUE;
+    dumper->ev_read = event_create(
+			(event_id_t)dumper->fd,
+			EV_READFD,
+			handle_dumper_result, dumper);
+    event_activate(dumper->ev_read);
+}
+
+/* tell the process writing the holding file of JOB to go on with the
+ * active holding disk */
+static void
+holding_continue(
+    job_t *job)
+{
+    if (job->chunker->in_dumper) {
+	dumper_cmd(job->dumper, CONTINUE, job->sched, NULL);
+    } else {
+	chunker_cmd(job->chunker, CONTINUE, job->sched, NULL);
+    }
+}
+
+/* NO-ROOM: the active holding disk of JOB has MISSING kb less than
+ * expected */
+static void
+holding_no_room(
+    job_t *job,
+    off_t  missing)
+{
+    sched_t *sp = job->sched;
+    assignedhd_t **h = sp->holdp;
+    int activehd = sp->activehd;
+
+    if (!h || activehd < 0) { /* should never happen */
+	error(_("!h || activehd < 0"));
+	/*NOTREACHED*/
+    }
+    h[activehd]->used -= missing;
+    h[activehd]->reserved -= missing;
+    h[activehd]->disk->allocated_space -= missing;
+    h[activehd]->disk->disksize -= missing;
+}
+
+/* RQ-MORE-DISK: the active holding disk of JOB is full */
+static void
+holding_rq_more_disk(
+    job_t *job)
+{
+    sched_t *sp = job->sched;
+    assignedhd_t **h = sp->holdp;
+    int activehd = sp->activehd;
+    int dummy;
+    int i;
+    off_t done;
+
+    if (!h || activehd < 0) { /* should never happen */
+	error(_("!h || activehd < 0"));
+	/*NOTREACHED*/
+    }
+    h[activehd]->disk->allocated_dumpers--;
+    h[activehd]->used = h[activehd]->reserved;
+    for (i = 0, done = 0; i <= activehd; i++)
+	done += h[i]->used;
+    measure_bandwidth(sp, done, FALSE);
+    if( h[++activehd] ) { /* There's still some allocated space left.
+			   * Tell the dumper about it. */
+	sp->activehd++;
+	holding_continue(job);
+    } else { /* !h[++activehd] - must allocate more space */
+	sp->act_size = sp->est_size; /* not quite true */
+	sp->est_size = (sp->act_size/(off_t)20) * (off_t)21; /* +5% */
+	sp->est_size = am_round(sp->est_size, (off_t)DISK_BLOCK_KB);
+	if (sp->est_size < sp->act_size + 2*DISK_BLOCK_KB)
+	    sp->est_size += 2 * DISK_BLOCK_KB;
+	h = find_diskspace(sp->est_size - sp->act_size,
+			   &dummy,
+			   h[activehd-1]);
+	if( !h ) {
+	    /* No diskspace available. The reason for this will be
+	     * determined in continue_port_dumps(). */
+	    enqueue_sched(&roomq, sp);
+	    continue_port_dumps();
+	    /* continue flush waiting for new tape */
+	    start_a_flush();
+	    start_a_vault();
+	} else {
+	    /* OK, allocate space for disk and have chunker continue */
+	    sp->activehd = assign_holdingdisk( h, sp );
+	    holding_continue(job);
+	    amfree(h);
+	}
+    }
+}
+
 
 static void
 read_flush(
@@ -4365,7 +4800,7 @@ read_flush(
 		for (taper = tapetable; taper < tapetable+nb_storage ; taper++) {
 		    if (g_str_equal(taper->storage_name, cmddata->dst_storage)) {
 			sched_t *sp;
-			sp = g_new0(sched_t, 1);
+			sp = alloc_sched();
 			sp->command_id = cmddata->id;
 			sp->action = ACTION_FLUSH;
 			sp->destname = g_strdup(destname);
@@ -4408,6 +4843,11 @@ read_flush(
     amfree(inpline);
     close_infofile();
 
+    for (taper = tapetable; taper < tapetable+nb_storage ; taper++) {
+	if (!empty(taper->tapeq))
+	    batch_flushes(taper);
+    }
+
     start_a_flush();
     if (!no_dump) {
 	schedule_ev_read = event_create((event_id_t)0, EV_READFD,
@@ -4424,7 +4864,10 @@ read_schedule(
 {
     sched_t *sp;
     disk_t *dp;
-    int level, line, priority;
+    int level, priority;
+    static int line = 0;
+    static off_t flush_size = (off_t)0;
+    static gboolean pre_backup_done = FALSE;
     char *dumpdate, *degr_dumpdate, *degr_mesg = NULL;
     char *based_on_timestamp, *degr_based_on_timestamp = NULL;
     int degr_level;
@@ -4437,7 +4880,7 @@ read_schedule(
     char *command;
     char *s;
     int ch;
-    off_t flush_size = (off_t)0;
+    int first_line = line;
     char *qname = NULL;
     long long time_;
     long long nsize_;
@@ -4448,12 +4891,14 @@ read_schedule(
 
     (void)cookie;	/* Quiet unused parameter warning */
 
-    event_release(schedule_ev_read);
-    schedule_ev_read = NULL;
+    if (!conf_stream_schedule) {
+	event_release(schedule_ev_read);
+	schedule_ev_read = NULL;
+    }
 
     /* read schedule from stdin */
 
-    for(line = 0; (inpline = agets(stdin)) != NULL; free(inpline)) {
+    for(; (inpline = read_schedule_line()) != NULL; free(inpline)) {
 	if (inpline[0] == '\0')
 	    continue;
 	line++;
@@ -4661,7 +5106,7 @@ read_schedule(
 	    continue;
 	}
 
-	sp = g_new0(sched_t, 1);
+	sp = alloc_sched();
 	/*@ignore@*/
 	sp->level = level;
 	sp->dumpdate = g_strdup(dumpdate);
@@ -4745,20 +5190,87 @@ read_schedule(
 	}
 	amfree(diskname);
     }
+
+    if (conf_stream_schedule && !schedule_eof) {
+	/* the rest of the schedule comes when all the estimates are in,
+	 * start the dumps already scheduled */
+	if (line > first_line) {
+	    if (!pre_backup_done) {
+		run_server_global_scripts(EXECUTE_ON_PRE_BACKUP,
+					  get_config_name(), driver_timestamp);
+		pre_backup_done = TRUE;
+	    }
+	    start_some_dumps(&runq);
+	}
+	return;
+    }
+    if (schedule_ev_read) {
+	event_release(schedule_ev_read);
+	schedule_ev_read = NULL;
+    }
+
     g_printf(_("driver: flush size %lld\n"), (long long)flush_size);
     amfree(inpline);
     if (line == 0 && !no_dump)
 	log_add(L_WARNING, _("WARNING: got empty schedule from planner"));
     schedule_done = 1;
     start_degraded_mode(&runq);
-    run_server_global_scripts(EXECUTE_ON_PRE_BACKUP, get_config_name(),
-			      driver_timestamp);
+    if (!pre_backup_done) {
+	run_server_global_scripts(EXECUTE_ON_PRE_BACKUP, get_config_name(),
+				  driver_timestamp);
+    }
     if (empty(runq)) force_flush = 1;
     start_some_dumps(&runq);
     start_a_flush();
     start_a_vault();
 }
 
+/* The next line of the schedule, or NULL at its end.  With stream-schedule,
+ * NULL also when no complete line is in yet; schedule_eof tells them apart.
+ * Only one read is done by call, so the event loop is never blocked. */
+static char *
+read_schedule_line(void)
+{
+    char buf[32768];
+    char *nl, *inpline;
+    ssize_t n;
+    gboolean did_read = FALSE;
+
+    if (!conf_stream_schedule)
+	return agets(stdin);
+
+    if (!schedule_buf)
+	schedule_buf = g_string_new(NULL);
+    for (;;) {
+	nl = memchr(schedule_buf->str, '\n', schedule_buf->len);
+	if (nl) {
+	    inpline = g_strndup(schedule_buf->str, nl - schedule_buf->str);
+	    g_string_erase(schedule_buf, 0, nl - schedule_buf->str + 1);
+	    return inpline;
+	}
+	if (schedule_eof) {
+	    if (schedule_buf->len == 0)
+		return NULL;
+	    inpline = g_strndup(schedule_buf->str, schedule_buf->len);
+	    g_string_truncate(schedule_buf, 0);
+	    return inpline;
+	}
+	if (did_read)
+	    return NULL;
+
+	do {
+	    n = read(0, buf, sizeof(buf));
+	} while (n < 0 && errno == EINTR);
+	did_read = TRUE;
+	if (n <= 0) {
+	    if (n < 0)
+		g_debug("error reading the schedule: %s", strerror(errno));
+	    schedule_eof = TRUE;
+	} else {
+	    g_string_append_len(schedule_buf, buf, n);
+	}
+    }
+}
 
 static void
 cmdfile_vault(
@@ -4815,7 +5327,7 @@ cmdfile_vault(
 	return;
     }
 
-    sp = g_new0(sched_t, 1);
+    sp = alloc_sched();
     sp->level = cmddata->level;
     sp->dumpdate = NULL;
     sp->degr_dumpdate = NULL;
@@ -5050,6 +5562,242 @@ deallocate_bandwidth(
     ip->curusage -= kps;
 }
 
+/*
+ * The bandwidth to reserve for sp: its estimated kps, scaled by what the
+ * dumps through the interface actually did compared to their estimate.
+ */
+static unsigned long
+network_kps(
+    netif_t *		ip,
+    sched_t *		sp)
+{
+    double kps = (double)sp->est_kps * ip->kps_ratio;
+
+    if (sp->est_kps == 0)
+	return 0;
+    if (kps < 1)
+	return 1;
+    return (unsigned long)kps;
+}
+
+/*
+ * sp has transferred kb since it started; once it has run long enough for
+ * that to mean something, reserve the rate it is making instead of its
+ * estimate.  When the dump is done, fold its rate in the ratio of its
+ * interface: one sample per dump, so that a long dump weighs no more than a
+ * short one.
+ */
+static void
+measure_bandwidth(
+    sched_t *		sp,
+    off_t		kb,
+    gboolean		done)
+{
+    netif_t *ip = sp->disk->host->netif;
+    time_t elapsed;
+    unsigned long kps;
+
+    if (sp->timestamp == 0 || kb <= 0)
+	return;
+    autotune_count(sp, kb);
+    elapsed = time(NULL) - sp->timestamp;
+    if (elapsed < BANDWIDTH_MEASURE_TIME)
+	return;
+
+    kps = (unsigned long)(kb / elapsed);
+    if (done && sp->est_kps > 0) {
+	double ratio = (double)kps / sp->est_kps;
+
+	ratio = CLAMP(ratio, BANDWIDTH_RATIO_MIN, BANDWIDTH_RATIO_MAX);
+	ip->kps_ratio = (3 * ip->kps_ratio + ratio) / 4;
+    }
+
+    deallocate_bandwidth(ip, sp->alloc_kps);
+    sp->alloc_kps = MAX(kps, 1);
+    allocate_bandwidth(ip, sp->alloc_kps);
+
+    ip->measured_kps -= sp->measured_kps;
+    sp->measured_kps = kps;
+    ip->measured_kps += sp->measured_kps;
+}
+
+/* sp is done with its interface */
+static void
+forget_bandwidth(
+    sched_t *		sp)
+{
+    netif_t *ip = sp->disk->host->netif;
+
+    ip->measured_kps -= sp->measured_kps;
+    sp->measured_kps = 0;
+}
+
+/*
+ * With autotune, the driver adjusts during the run the number of dumpers it
+ * uses, between 1 and inparallel, and the number of dumps in progress on
+ * each host, between 1 and its maxdumps.  Every AUTOTUNE_INTERVAL seconds,
+ * it takes the rate of all the dumps, from the kbytes they reported in the
+ * interval, and hill-climbs: it keeps moving dumper_limit the same way while
+ * the rate does not drop by more than AUTOTUNE_THRESHOLD, and turns back when
+ * it does.  It only adds a dumper when the dumpers are what keeps the driver
+ * from starting dumps; more dumpers do not help when it waits for holding
+ * disk, bandwidth or the clients.
+ *
+ * A host whose rate did not rise with one more dump in progress is limited
+ * to the previous number of dumps, and allowed one more again after
+ * AUTOTUNE_HOST_PROBE intervals.
+ */
+#define AUTOTUNE_INTERVAL	60
+#define AUTOTUNE_THRESHOLD	0.05
+#define AUTOTUNE_HOST_PROBE	10
+
+typedef struct autotune_host_s {
+    int    limit;		/* dumps allowed at once, <= maxdumps */
+    off_t  kb;			/* kbytes dumped in the interval */
+    int    inprogress;		/* dumps in progress when it began */
+    double last_kps;		/* rate in the previous interval */
+    int    last_inprogress;	/* dumps in progress in the previous one */
+    int    probe;		/* intervals before allowing one more */
+} autotune_host_t;
+
+static event_handle_t *autotune_ev = NULL;
+static GHashTable *autotune_hosts = NULL;
+static off_t autotune_kb = 0;
+static double autotune_last_kps = -1;
+static int autotune_direction = -1;
+
+static autotune_host_t *
+autotune_host(
+    am_host_t *host)
+{
+    autotune_host_t *ah = g_hash_table_lookup(autotune_hosts, host);
+
+    if (!ah) {
+	ah = g_new0(autotune_host_t, 1);
+	ah->limit = host->maxdumps;
+	ah->inprogress = host->inprogress;
+	ah->last_kps = -1;
+	g_hash_table_insert(autotune_hosts, host, ah);
+    }
+    return ah;
+}
+
+/* sp has transferred kb since it started */
+static void
+autotune_count(
+    sched_t *	sp,
+    off_t	kb)
+{
+    off_t delta;
+
+    if (!autotune_ev)
+	return;
+
+    /* less than before means the dump was restarted */
+    delta = kb > sp->reported_kb ? kb - sp->reported_kb : 0;
+    sp->reported_kb = kb;
+    autotune_kb += delta;
+    autotune_host(sp->disk->host)->kb += delta;
+}
+
+static int
+autotune_host_limit(
+    am_host_t *	host)
+{
+    autotune_host_t *ah;
+
+    if (!autotune_hosts)
+	return host->maxdumps;
+    ah = g_hash_table_lookup(autotune_hosts, host);
+    return ah ? MIN(ah->limit, host->maxdumps) : host->maxdumps;
+}
+
+static void
+autotune_host_tick(
+    gpointer	key,
+    gpointer	value,
+    gpointer	user_data G_GNUC_UNUSED)
+{
+    am_host_t       *host = key;
+    autotune_host_t *ah = value;
+    double           kps = (double)ah->kb / AUTOTUNE_INTERVAL;
+
+    if (ah->last_kps > 0 && ah->inprogress > ah->last_inprogress &&
+	kps < ah->last_kps * (1.0 + AUTOTUNE_THRESHOLD)) {
+	ah->limit = MAX(ah->last_inprogress, 1);
+	ah->probe = AUTOTUNE_HOST_PROBE;
+	g_printf(_("driver: autotune time %s host %s maxdumps %d kps %.0f\n"),
+		 walltime_str(curclock()), host->hostname, ah->limit, kps);
+    } else if (ah->limit < host->maxdumps && --ah->probe <= 0) {
+	ah->limit++;
+	ah->probe = AUTOTUNE_HOST_PROBE;
+	g_printf(_("driver: autotune time %s host %s maxdumps %d kps %.0f\n"),
+		 walltime_str(curclock()), host->hostname, ah->limit, kps);
+    }
+
+    ah->last_kps = ah->inprogress > 0 ? kps : -1;
+    ah->last_inprogress = ah->inprogress;
+    ah->inprogress = host->inprogress;
+    ah->kb = 0;
+}
+
+static void
+autotune_tick(
+    void *	cookie G_GNUC_UNUSED)
+{
+    double kps = (double)autotune_kb / AUTOTUNE_INTERVAL;
+    int    busy = active_dumper();
+    int    new_limit = dumper_limit;
+
+    event_release(autotune_ev);
+    autotune_ev = NULL;
+    autotune_kb = 0;
+
+    /* the rate only says something while dumps are waiting for a dumper */
+    if (busy > 0 && (queue_length(&runq) > 0 || queue_length(&directq) > 0)) {
+	if (autotune_last_kps > 0 &&
+	    kps < autotune_last_kps * (1.0 - AUTOTUNE_THRESHOLD)) {
+	    autotune_direction = -autotune_direction;
+	}
+	if (autotune_direction > 0) {
+	    if (idle_reason == IDLE_NO_DUMPERS && busy >= dumper_limit)
+		new_limit = MIN(dumper_limit + 1, inparallel);
+	} else {
+	    new_limit = MAX(dumper_limit - 1, 1);
+	}
+	autotune_last_kps = kps;
+
+	if (new_limit != dumper_limit) {
+	    g_printf(_("driver: autotune time %s dumpers %d kps %.0f idle %s\n"),
+		     walltime_str(curclock()), new_limit, kps,
+		     _(idle_strings[idle_reason]));
+	    fflush(stdout);
+	    dumper_limit = new_limit;
+	}
+    } else {
+	autotune_last_kps = -1;
+    }
+    g_hash_table_foreach(autotune_hosts, autotune_host_tick, NULL);
+    fflush(stdout);
+
+    /* nothing is left to tune once the dumps are done */
+    if (!schedule_done || busy > 0)
+	autotune_start();
+    if (new_limit > busy)
+	start_some_dumps(&runq);
+}
+
+static void
+autotune_start(void)
+{
+    if (!autotune_hosts)
+	autotune_hosts = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					       NULL, g_free);
+    autotune_ev = event_create((event_id_t)AUTOTUNE_INTERVAL, EV_TIME,
+			       autotune_tick, NULL);
+    event_activate(autotune_ev);
+}
+
 /* ------------ */
 static off_t
 holding_free_space(void)
@@ -5067,6 +5815,34 @@ holding_free_space(void)
     return total_free;
 }
 
+/*
+ * The holding disk space of a dump to the holding disk.  A dump with
+ * "compress server deferred" lands uncompressed when there is room for its
+ * uncompressed estimate, and the taper compresses it when it is flushed;
+ * otherwise the dumper compresses it and it takes its compressed estimate.
+ */
+static assignedhd_t **
+find_dump_diskspace(
+    sched_t *sp,
+    int *    cur_idle)
+{
+    assignedhd_t **holdp;
+
+    sp->compress_deferred = FALSE;
+    if (sp->disk->compress == COMP_SERVER_DEFERRED &&
+	sp->disk->encrypt != ENCRYPT_SERV_CUST) {
+	holdp = find_diskspace(MAX(sp->est_size, sp->est_nsize), cur_idle,
+			       NULL);
+	if (holdp) {
+	    sp->compress_deferred = TRUE;
+	    return holdp;
+	}
+	hold_debug(1, _("find_dump_diskspace: no room for %s:%s uncompressed, compressing it now\n"),
+		   sp->disk->host->hostname, sp->disk->name);
+    }
+    return find_diskspace(sp->est_size, cur_idle, NULL);
+}
+
 /*
  * We return an array of pointers to assignedhd_t. The array contains at
  * most one entry per holding disk. The list of pointers is terminated by
@@ -5088,6 +5864,7 @@ find_diskspace(
     int j, minj;
     char *used;
     off_t halloc, dalloc, hfree, dfree;
+    gboolean more = (pref != NULL);	/* for a dump that outgrew its disks */
 
     (void)cur_idle;	/* Quiet unused parameter warning */
 
@@ -5109,11 +5886,11 @@ find_diskspace(
     result[0] = NULL;
 
     while( i < num_holdalloc && size > (off_t)0 ) {
-	/* find the holdingdisk with the fewest active dumpers and among
-	 * those the one with the biggest free space
-	 */
+	/* find the least loaded holdingdisk, see holdingdisk_better() */
 	minp = NULL; minj = -1;
 	for(j = 0, ha = holdalloc; ha != NULL; ha = ha->next, j++ ) {
+	    if (!holdingdisk_takes(ha, size, more || i > 0))
+		continue;
 	    if( pref && pref->disk == ha && !used[j] &&
 		ha->allocated_space <= ha->disksize - (off_t)DISK_BLOCK_KB) {
 		minp = ha;
@@ -5122,10 +5899,7 @@ find_diskspace(
 	    }
 	    else if( ha->allocated_space <= ha->disksize - (off_t)(2*DISK_BLOCK_KB) &&
 		!used[j] &&
-		(!minp ||
-		 ha->allocated_dumpers < minp->allocated_dumpers ||
-		 (ha->allocated_dumpers == minp->allocated_dumpers &&
-		  ha->disksize-ha->allocated_space > minp->disksize-minp->allocated_space)) ) {
+		(!minp || holdingdisk_better(ha, minp, size)) ) {
 		minp = ha;
 		minj = j;
 	    }
@@ -5185,6 +5959,151 @@ find_diskspace(
     return result;
 }
 
+/*
+ * Can ha take size K of a dump?  Not a dump whose estimate is above its
+ * dump-size-limit.  A memory holding disk only takes a dump that fits in
+ * it whole, from its start: the rest of a dump that outgrew its estimate
+ * spills to the other holding disks.
+ */
+static gboolean
+holdingdisk_takes(
+    holdalloc_t *	ha,
+    off_t		size,
+    gboolean		rest)
+{
+    off_t limit = holdingdisk_get_dump_size_limit(ha->hdisk);
+    off_t hfree, dfree;
+
+    if (!rest && limit > 0 && size > limit)
+	return FALSE;
+    if (!holdingdisk_get_memory(ha->hdisk))
+	return TRUE;
+    if (rest)
+	return FALSE;
+
+    /* the free space for data, without 1 header for each chunksize */
+    hfree = ha->disksize - ha->allocated_space;
+    dfree = hfree - (((hfree-(off_t)1)/holdingdisk_get_chunksize(ha->hdisk))+(off_t)1) * (off_t)DISK_BLOCK_KB;
+    return dfree >= size;
+}
+
+/*
+ * Is ha a better choice than minp to write size K?  A memory holding disk,
+ * which only takes a dump that fits in it, is better than any other.  A
+ * disk that can take all of it is better than one that can not, since
+ * splitting the dump puts a writer on two disks.  Then the least busy one,
+ * see holdingdisk_busy(), and among those the one with the biggest free
+ * space.  When the write rate of both disks is known, the busy streams
+ * are weighted by it, so that a fast disk takes more writers than a slow
+ * one.
+ */
+static int
+holdingdisk_better(
+    holdalloc_t *	ha,
+    holdalloc_t *	minp,
+    off_t		size)
+{
+    off_t ha_free = ha->disksize - ha->allocated_space;
+    off_t min_free = minp->disksize - minp->allocated_space;
+    gboolean ha_fits = ha_free >= size;
+    gboolean min_fits = min_free >= size;
+    gboolean ha_memory = holdingdisk_get_memory(ha->hdisk);
+
+    if (ha_memory != holdingdisk_get_memory(minp->hdisk))
+	return ha_memory;
+
+    if (ha_fits != min_fits)
+	return ha_fits;
+
+    if (ha->write_kps > 0 && minp->write_kps > 0) {
+	double ha_load = (holdingdisk_busy(ha) + 1) / ha->write_kps;
+	double min_load = (holdingdisk_busy(minp) + 1) / minp->write_kps;
+
+	if (ha_load != min_load)
+	    return ha_load < min_load;
+    } else if (holdingdisk_busy(ha) != holdingdisk_busy(minp)) {
+	return holdingdisk_busy(ha) < holdingdisk_busy(minp);
+    }
+    return ha_free > min_free;
+}
+
+/*
+ * The number of streams on ha: its dumpers, and the flushes reading from
+ * it.  On a disk array a flush read seeks against the dump writes as much
+ * as another writer does, so both count the same.  A memory holding disk
+ * does not seek and only counts its dumpers.
+ */
+static int
+holdingdisk_busy(
+    holdalloc_t *ha)
+{
+    if (holdingdisk_get_memory(ha->hdisk))
+	return ha->allocated_dumpers;
+    return ha->allocated_dumpers + ha->active_readers;
+}
+
+/*
+ * Add delta to the readers of the holding disks of the flush sp, when it
+ * starts and when it is done.
+ */
+static void
+holding_readers(
+    sched_t *sp,
+    int      delta)
+{
+    assignedhd_t **h;
+
+    if (sp->holdp == NULL)
+	return;
+    for (h = sp->holdp; *h != NULL; h++) {
+	(*h)->disk->active_readers += delta;
+    }
+}
+
+/*
+ * How much starting the flush sp would contend with the other streams on
+ * its holding disks.
+ */
+static int
+flush_contention(
+    sched_t *sp)
+{
+    assignedhd_t **h;
+    int busy = 0;
+
+    if (sp->holdp == NULL)
+	return 0;
+    for (h = sp->holdp; *h != NULL; h++) {
+	if (!holdingdisk_get_memory((*h)->disk->hdisk))
+	    busy += holdingdisk_busy((*h)->disk);
+    }
+    return busy;
+}
+
+/*
+ * sp finished writing hd, the only disk it used; what it wrote there,
+ * times the dumpers writing to the disk, is a rate the disk sustained.
+ */
+static void
+measure_holdingdisk(
+    assignedhd_t *	hd,
+    sched_t *		sp)
+{
+    time_t elapsed = time(NULL) - sp->timestamp;
+    double kps;
+
+    if (sp->timestamp == 0 || elapsed < BANDWIDTH_MEASURE_TIME ||
+	hd->used <= 0 || hd->disk->allocated_dumpers <= 0)
+	return;
+
+    kps = (double)hd->used / elapsed * hd->disk->allocated_dumpers;
+    if (kps > hd->disk->write_kps) {
+	hd->disk->write_kps = kps;
+	hold_debug(1, _("measure_holdingdisk: %s write rate %.0f K/s\n"),
+		   holdingdisk_get_diskdir(hd->disk->hdisk), kps);
+    }
+}
+
 static int
 assign_holdingdisk(
     assignedhd_t **	holdp,
@@ -5486,8 +6405,8 @@ static int
 queue_length(
     schedlist_t	*q)
 {
-    if (!q) return 0;
-    return g_list_length(q->head);
+    if (!q || !q->index) return 0;
+    return g_hash_table_size(q->index);
 }
 
 static void
@@ -5557,6 +6476,242 @@ short_dump_state(void)
     interface_state(wall_time);
     holdingdisk_state(wall_time);
     fflush(stdout);
+    write_metrics(FALSE);
+}
+
+/* Append VALUE to METRICS as a label value, escaped as the text format
+ * requires */
+static void
+metric_label(
+    GString    *metrics,
+    const char *value)
+{
+    const char *c;
+
+    g_string_append_c(metrics, '"');
+    for (c = value; *c; c++) {
+	if (*c == '\\' || *c == '"')
+	    g_string_append_c(metrics, '\\');
+	if (*c == '\n')
+	    g_string_append(metrics, "\\n");
+	else
+	    g_string_append_c(metrics, *c);
+    }
+    g_string_append_c(metrics, '"');
+}
+
+/* Append the HELP and TYPE lines of metric NAME */
+static void
+metric_header(
+    GString    *metrics,
+    const char *name,
+    const char *type,
+    const char *help)
+{
+    g_string_append_printf(metrics, "# HELP %s %s\n# TYPE %s %s\n",
+			   name, help, name, type);
+}
+
+/* Append a sample of metric NAME, with the config label and, if LABEL is
+ * not NULL, a second label */
+static void
+metric_sample(
+    GString    *metrics,
+    const char *name,
+    const char *label,
+    const char *label_value,
+    double      value)
+{
+    g_string_append_printf(metrics, "%s{config=", name);
+    metric_label(metrics, get_config_name());
+    if (label) {
+	g_string_append_printf(metrics, ",%s=", label);
+	metric_label(metrics, label_value);
+    }
+    g_string_append_printf(metrics, "} %.15g\n", value);
+}
+
+static const char *
+wtaper_state_name(
+    wtaper_t *wtaper)
+{
+    if (wtaper->state & (TAPER_STATE_DUMP_TO_TAPE |
+			 TAPER_STATE_FILE_TO_TAPE |
+			 TAPER_STATE_VAULT_TO_TAPE))
+	return "writing";
+    if (wtaper->state & (TAPER_STATE_TAPE_REQUESTED |
+			 TAPER_STATE_WAIT_FOR_TAPE |
+			 TAPER_STATE_WAIT_NEW_TAPE))
+	return "waiting-for-volume";
+    if (wtaper->state & (TAPER_STATE_WAIT_CLOSED_VOLUME |
+			 TAPER_STATE_WAIT_CLOSED_SOURCE_VOLUME))
+	return "waiting-closed-volume";
+    if (wtaper->state & TAPER_STATE_DONE)
+	return "done";
+    if (wtaper->state == TAPER_STATE_DEFAULT ||
+	wtaper->state & TAPER_STATE_INIT)
+	return "starting";
+    return "idle";
+}
+
+/*
+ * Write the state of the driver to the metrics-dir, in the Prometheus text
+ * format.  The file is rewritten at most every METRICS_INTERVAL seconds,
+ * unless FORCE.
+ */
+#define METRICS_INTERVAL 5
+static void
+write_metrics(
+    gboolean force)
+{
+    static time_t last_write = 0;
+    char *metrics_dir = getconf_str(CNF_METRICS_DIR);
+    GString *metrics;
+    char *filename;
+    char *tmp_filename;
+    taper_t *taper;
+    netif_t *ip;
+    time_t now;
+    int i, busy;
+    gboolean written;
+    FILE *f;
+
+    if (!metrics_dir || !*metrics_dir)
+	return;
+    now = time(NULL);
+    if (!force && now < last_write + METRICS_INTERVAL)
+	return;
+    last_write = now;
+
+    metrics = g_string_sized_new(4096);
+
+    metric_header(metrics, "amanda_driver_queue_length", "gauge",
+		  "Number of dumps in a queue of the driver.");
+    metric_sample(metrics, "amanda_driver_queue_length", "queue", "runq",
+		  queue_length(&runq));
+    metric_sample(metrics, "amanda_driver_queue_length", "queue", "directq",
+		  queue_length(&directq));
+    metric_sample(metrics, "amanda_driver_queue_length", "queue", "roomq",
+		  queue_length(&roomq));
+
+    metric_header(metrics, "amanda_driver_tapeq_length", "gauge",
+		  "Number of dumps waiting to be written to a storage.");
+    for (taper = tapetable; taper < tapetable+nb_storage ; taper++) {
+	if (taper->storage_name)
+	    metric_sample(metrics, "amanda_driver_tapeq_length", "storage",
+			  taper->storage_name, queue_length(&taper->tapeq));
+    }
+
+    metric_header(metrics, "amanda_driver_dumpers", "gauge",
+		  "Number of dumpers.");
+    metric_sample(metrics, "amanda_driver_dumpers", NULL, NULL, inparallel);
+    busy = 0;
+    for (i = 0; i < inparallel; i++) if (dmptable[i].busy) busy++;
+    metric_header(metrics, "amanda_driver_dumpers_busy", "gauge",
+		  "Number of dumpers running a dump.");
+    metric_sample(metrics, "amanda_driver_dumpers_busy", NULL, NULL, busy);
+    busy = 0;
+    for (i = 0; i < inparallel; i++) if (chktable[i].job) busy++;
+    metric_header(metrics, "amanda_driver_chunkers_busy", "gauge",
+		  "Number of chunkers writing a dump to holding disk.");
+    metric_sample(metrics, "amanda_driver_chunkers_busy", NULL, NULL, busy);
+
+    metric_header(metrics, "amanda_driver_idle", "gauge",
+		  "Why the driver does not start more dumps.");
+    metric_sample(metrics, "amanda_driver_idle", "reason",
+		  idle_strings[idle_reason], 1);
+
+    metric_header(metrics, "amanda_driver_holding_free_kbytes", "gauge",
+		  "Free space on the holding disks, in kbytes.");
+    metric_sample(metrics, "amanda_driver_holding_free_kbytes", NULL, NULL,
+		  (double)holding_free_space());
+
+    metric_header(metrics, "amanda_driver_interface_max_kps", "gauge",
+		  "Bandwidth of a network interface, in kbytes per second.");
+    for (ip = disklist_netifs(); ip != NULL; ip = ip->next)
+	metric_sample(metrics, "amanda_driver_interface_max_kps", "interface",
+		      interface_name(ip->config),
+		      interface_get_maxusage(ip->config));
+    metric_header(metrics, "amanda_driver_interface_allocated_kps", "gauge",
+		  "Bandwidth reserved by the dumps in progress on a network interface, in kbytes per second.");
+    for (ip = disklist_netifs(); ip != NULL; ip = ip->next)
+	metric_sample(metrics, "amanda_driver_interface_allocated_kps",
+		      "interface", interface_name(ip->config), ip->curusage);
+    metric_header(metrics, "amanda_driver_interface_measured_kps", "gauge",
+		  "Measured rate of the dumps in progress on a network interface, in kbytes per second.");
+    for (ip = disklist_netifs(); ip != NULL; ip = ip->next)
+	metric_sample(metrics, "amanda_driver_interface_measured_kps",
+		      "interface", interface_name(ip->config),
+		      ip->measured_kps);
+
+    metric_header(metrics, "amanda_driver_taper_written_kbytes_total", "counter",
+		  "Kbytes written by a taper worker in this run.");
+    for (taper = tapetable; taper < tapetable+nb_storage ; taper++) {
+	wtaper_t *wtaper;
+	if (!taper->storage_name)
+	    continue;
+	for (wtaper = taper->wtapetable;
+	     wtaper < taper->wtapetable + taper->nb_worker;
+	     wtaper++) {
+	    g_string_append(metrics, "amanda_driver_taper_written_kbytes_total{config=");
+	    metric_label(metrics, get_config_name());
+	    g_string_append(metrics, ",storage=");
+	    metric_label(metrics, taper->storage_name);
+	    g_string_append(metrics, ",worker=");
+	    metric_label(metrics, wtaper->name);
+	    g_string_append_printf(metrics, "} %lld\n",
+				   (long long)wtaper->total_written);
+	}
+    }
+    metric_header(metrics, "amanda_driver_taper_state", "gauge",
+		  "What a taper worker is doing.");
+    for (taper = tapetable; taper < tapetable+nb_storage ; taper++) {
+	wtaper_t *wtaper;
+	if (!taper->storage_name)
+	    continue;
+	for (wtaper = taper->wtapetable;
+	     wtaper < taper->wtapetable + taper->nb_worker;
+	     wtaper++) {
+	    g_string_append(metrics, "amanda_driver_taper_state{config=");
+	    metric_label(metrics, get_config_name());
+	    g_string_append(metrics, ",storage=");
+	    metric_label(metrics, taper->storage_name);
+	    g_string_append(metrics, ",worker=");
+	    metric_label(metrics, wtaper->name);
+	    g_string_append(metrics, ",state=");
+	    metric_label(metrics, wtaper_state_name(wtaper));
+	    g_string_append(metrics, "} 1\n");
+	}
+    }
+
+    metric_header(metrics, "amanda_driver_last_update_seconds", "gauge",
+		  "Time this file was written.");
+    metric_sample(metrics, "amanda_driver_last_update_seconds", NULL, NULL,
+		  (double)now);
+    /* replace the file atomically, so that the collector never reads half
+     * of it */
+    filename = g_strdup_printf("%s/amanda-%s-driver.prom", metrics_dir,
+			       get_config_name());
+    tmp_filename = g_strdup_printf("%s.%ld.tmp", filename, (long)getpid());
+    if ((f = fopen(tmp_filename, "w")) == NULL) {
+	g_debug("Can't create metrics file '%s': %s", tmp_filename,
+		strerror(errno));
+	goto done;
+    }
+    written = fputs(metrics->str, f) != EOF;
+    if (fclose(f) == EOF || !written) {
+	g_debug("Can't write metrics file '%s': %s", tmp_filename,
+		strerror(errno));
+	unlink(tmp_filename);
+    } else if (rename(tmp_filename, filename) != 0) {
+	g_debug("Can't rename metrics file '%s': %s", tmp_filename,
+		strerror(errno));
+	unlink(tmp_filename);
+    }
+done:
+    g_free(tmp_filename);
+    g_free(filename);
+    g_string_free(metrics, TRUE);
 }
 
 static TapeAction
@@ -5963,6 +7118,21 @@ fix_index_header(
     close(fd);
 }
 
+/*
+ *  * record the link of sp in the index of the queue
+ *   */
+
+static void
+index_sched(
+    schedlist_t *list,
+    GList       *link)
+{
+    if (!list->index) {
+	list->index = g_hash_table_new(g_direct_hash, g_direct_equal);
+    }
+    g_hash_table_insert(list->index, link->data, link);
+}
+
 /*
  *  * put disk on end of queue
  *   */
@@ -5978,6 +7148,7 @@ enqueue_sched(
     } else {
 	list->tail = list->head;
     }
+    index_sched(list, list->tail);
 }
 
 
@@ -5994,6 +7165,7 @@ headqueue_sched(
     if (!list->tail) {
 	list->tail = list->head;
     }
+    index_sched(list, list->head);
 }
 
 static void
@@ -6002,7 +7174,12 @@ insert_before_sched(
     GList       *list_before,
     sched_t     *sp)
 {
+    if (!list_before) {
+	enqueue_sched(list, sp);
+	return;
+    }
     list->head = g_list_insert_before(list->head, list_before, sp);
+    index_sched(list, list_before->prev);
 }
 
 /*
@@ -6014,12 +7191,7 @@ find_sched(
     schedlist_t *list,
     sched_t     *sp)
 {
-    GList *glist = list->head;
-
-    while (glist && glist->data != sp) {
-	glist = glist->next;
-    }
-    return (glist && glist->data == sp);
+    return list->index && g_hash_table_lookup(list->index, sp) != NULL;
 }
 
 /*
@@ -6035,6 +7207,7 @@ dequeue_sched(
     if (list->head == NULL) return NULL;
 
     sp = list->head->data;
+    g_hash_table_remove(list->index, sp);
     list->head = g_list_delete_link(list->head, list->head);
 
     if (list->head == NULL) list->tail = NULL;
@@ -6047,14 +7220,34 @@ remove_sched(
     schedlist_t *list,
     sched_t *    sp)
 {
-    GList *ltail;
+    GList *link;
 
-    if (list->tail && list->tail->data == sp) {
-	ltail = list->tail;
+    if (!list->index)
+	return;
+    link = g_hash_table_lookup(list->index, sp);
+    if (!link)
+	return;
+    g_hash_table_remove(list->index, sp);
+
+    if (link == list->tail) {
 	list->tail = list->tail->prev;
-	list->head = g_list_delete_link(list->head, ltail);
-    } else {
-	list->head = g_list_remove(list->head, sp);
+    }
+    list->head = g_list_delete_link(list->head, link);
+}
+
+/*
+ *  * empty the queue
+ *   */
+
+static void
+clear_sched(
+    schedlist_t *list)
+{
+    g_list_free(list->head);
+    list->head = list->tail = NULL;
+    if (list->index) {
+	g_hash_table_destroy(list->index);
+	list->index = NULL;
     }
 }
 
@@ -33,6 +33,8 @@
  */
 #include "amanda.h"
 #include "amutil.h"
+#include "amcompress.h"
+#include "amnuma.h"
 #include "clock.h"
 #include "server_util.h"
 #include "conffile.h"
@@ -61,6 +63,8 @@ static taper_t * start_one_tape_process(char *taper_program,
 					char *storage_name,
 					gboolean  no_taper,
 					int nb_taper);
+static int dump_numa_node(sched_t *sp, gboolean for_chunker);
+static char *flush_compress_choice(wtaper_t *wtaper, sched_t *sp);
 
 void
 init_driverio(
@@ -84,28 +88,40 @@ init_driverio(
 }
 
 
+/* the name of the child reading on each fd, noted when it is started */
+static GHashTable *child_names = NULL;
+
+static void
+set_childstr(
+    int fd,
+    char *name)
+{
+    if (!child_names)
+	child_names = g_hash_table_new(g_direct_hash, g_direct_equal);
+    g_hash_table_insert(child_names, GINT_TO_POINTER(fd), name);
+}
+
+/* forget the name of the child reading on FD, once it has exited or its fd
+ * is closed */
+void
+forget_childstr(
+    int fd)
+{
+    if (child_names && fd >= 0)
+	g_hash_table_remove(child_names, GINT_TO_POINTER(fd));
+}
+
 static const char *
 childstr(
     int fd)
 {
     static char buf[NUM_STR_SIZE + 32];
-    dumper_t  *dumper;
-    chunker_t *chunker;
-    taper_t   *taper;
+    char *name = NULL;
 
-    for (taper = tapetable; taper->fd != 0; taper++) {
-	if (taper->fd == fd)
-	    return (taper->name);
-    }
-
-    for (dumper = dmptable; dumper->fd != 0; dumper++) {
-	if (dumper->fd == fd)
-	    return (dumper->name);
-    }
-    for (chunker = chktable; chunker->fd != 0; chunker++) {
-	if (chunker->fd == fd)
-	    return (chunker->name);
-    }
+    if (child_names)
+	name = g_hash_table_lookup(child_names, GINT_TO_POINTER(fd));
+    if (name)
+	return name;
     g_snprintf(buf, sizeof(buf), _("unknown child (fd %d)"), fd);
     return (buf);
 }
@@ -217,6 +233,7 @@ start_one_tape_process(
 	taper->max_dle_by_volume = storage_get_max_dle_by_volume(storage);
 	taper->tapeq.head = NULL;
 	taper->tapeq.tail = NULL;
+	taper->tapeq.index = NULL;
 	taper->vaultqss = NULL;
 	taper->degraded_mode = no_taper;
 	taper->down = FALSE;
@@ -243,6 +260,7 @@ start_one_tape_process(
 	    wtaper->vaultqs.src_labels = NULL;
 	    wtaper->vaultqs.vaultq.head = NULL;
 	    wtaper->vaultqs.vaultq.tail = NULL;
+	    wtaper->vaultqs.vaultq.index = NULL;
 	    wtaper->taper = taper;
 
 	    /* jump right to degraded mode if there's no taper */
@@ -299,6 +317,7 @@ start_one_tape_process(
 	default: /* parent process */
 	    aclose(fd[1]);
 	    taper->fd = fd[0];
+	    set_childstr(taper->fd, taper->name);
 	}
 	g_fprintf(stderr, "driver: taper %s storage %s tape_size %lld\n", taper->name, taper->storage_name, (long long)taper->tape_length);
 
@@ -345,8 +364,10 @@ startup_dump_process(
     default:	/* parent process */
 	aclose(fd[1]);
 	dumper->fd = fd[0];
+	set_childstr(dumper->fd, dumper->name);
 	dumper->ev_read = NULL;
 	dumper->busy = dumper->down = 0;
+	dumper->numa_node = -1;
 	g_fprintf(stderr,_("driver: started %s pid %u\n"),
 		dumper->name, (unsigned)dumper->pid);
 	fflush(stderr);
@@ -402,6 +423,16 @@ startup_chunk_process(
 	    error(_("%s dup2: %s"), chunker->name, strerror(errno));
 	    /*NOTREACHED*/
 	}
+	/* a chunker lives for one dump; the placement survives the exec */
+	if (chunker->job && chunker->job->sched) {
+	    int node = dump_numa_node(chunker->job->sched, TRUE);
+	    char *errmsg = NULL;
+
+	    if (node >= 0 && !amnuma_pin(0, node, &errmsg)) {
+		g_debug("%s: %s", chunker->name, errmsg);
+		g_free(errmsg);
+	    }
+	}
 	config_options = get_config_options(4);
 	config_options[0] = chunker->name ? chunker->name : "chunker",
 	config_options[1] = get_config_name();
@@ -419,6 +450,7 @@ startup_chunk_process(
 	aclose(fd[1]);
 	chunker->down = 0;
 	chunker->fd = fd[0];
+	set_childstr(chunker->fd, chunker->name);
 	chunker->ev_read = NULL;
 	g_fprintf(stderr,_("driver: started %s pid %u\n"),
 		chunker->name, (unsigned)chunker->pid);
@@ -433,7 +465,6 @@ getresult(
     int *result_argc,
     char ***result_argv)
 {
-    cmd_t t;
     char *line;
 
     if ((line = areads(fd)) == NULL) {
@@ -459,10 +490,7 @@ getresult(
 
     if (*result_argc < 1) return BOGUS;
 
-    for (t = (cmd_t)(BOGUS+1); t < LAST_TOK; t++)
-	if (g_str_equal((*result_argv)[0], cmdstr[t])) return t;
-
-    return BOGUS;
+    return str_to_cmd((*result_argv)[0]);
 }
 
 
@@ -617,6 +645,7 @@ taper_cmd(
 	    origsize = 0;
 	g_snprintf(orig_kb, sizeof(orig_kb), "%ju", origsize);
 	splitargs = taper_splitting_args(taper->storage_name, dp);
+	q = flush_compress_choice(wtaper, sp);
 	cmdline = g_strjoin(NULL, cmdstr[cmd],
 			    " ", wtaper->name,
 			    " ", job2serial(wtaper->job),
@@ -627,7 +656,9 @@ taper_cmd(
 			    " ", datestamp,
 			    " ", splitargs,
 			         orig_kb,
+			    " ", q,
 			    "\n", NULL);
+	amfree(q);
 	amfree(splitargs);
 	amfree(qdest);
 	amfree(qname);
@@ -637,6 +668,7 @@ taper_cmd(
     case SHM_WRITE:
 	sp = (sched_t *)ptr;
 	dp = sp->disk;
+	wtaper->compress_cost = 0;
         qname = quote_string(dp->name);
 	g_snprintf(number, sizeof(number), "%d", level);
 	data_path = data_path_to_string(dp->data_path);
@@ -664,6 +696,7 @@ taper_cmd(
     case VAULT_WRITE:
 	sp = (sched_t *) ptr;
 	dp = sp->disk;
+	wtaper->compress_cost = 0;
         qname = quote_string(dp->name);
 	g_snprintf(number, sizeof(number), "%d", level);
 	if (sp->origsize >= 0)
@@ -704,6 +737,10 @@ taper_cmd(
 	if (dp->compress == COMP_SERVER_FAST ||
 	    dp->compress == COMP_SERVER_BEST ||
 	    dp->compress == COMP_SERVER_CUST ||
+	    dp->compress == COMP_SERVER_AUTO ||
+	    dp->compress == COMP_SERVER_DEFERRED ||
+	    dp->compress == COMP_SERVER_ZSTD ||
+	    dp->compress == COMP_SERVER_LZ4 ||
 	    dp->encrypt  == ENCRYPT_SERV_CUST) {
 	    /* The server-crc do not match the client-crc */
 	    g_snprintf(s_crc, sizeof(s_crc), "00000000:0");
@@ -790,6 +827,7 @@ taper_cmd(
     cmdline[strlen(cmdline)-1] = '\0';
     g_debug("driver: send-cmd time %s to %s: %s", walltime_str(curclock()), taper->name, cmdline);
     if (cmd == QUIT) {
+	forget_childstr(taper->fd);
 	aclose(taper->fd);
 	amfree(taper->name);
 	amfree(taper->storage_name);
@@ -798,6 +836,194 @@ taper_cmd(
     return 1;
 }
 
+/* the CPU a compressing dump takes, in quarters of a CPU */
+#define AUTO_COMPRESS_COST_FULL  4	/* zstd, gzip */
+#define AUTO_COMPRESS_COST_LIGHT 1	/* lz4 */
+
+/* above this compressed size over size, compressing is not worth the CPU */
+#define AUTO_COMPRESS_INCOMPRESSIBLE 0.9
+
+/*
+ * What is left of compress-cpu-budget, in quarters of a CPU, without the
+ * dump of DUMPER and the flush of WTAPER: the running dumps and flushes that
+ * compress take theirs.
+ */
+static long
+compress_cpu_left(
+    dumper_t *dumper,
+    wtaper_t *wtaper,
+    long *budgetp)
+{
+    dumper_t *d;
+    taper_t *taper;
+    wtaper_t *w;
+    long budget = getconf_int(CNF_COMPRESS_CPU_BUDGET);
+    long left;
+
+    if (budget == 0)
+	budget = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+    left = budget * 4;
+    for (d = dmptable; d->name != NULL; d++) {
+	if (d != dumper && d->busy)
+	    left -= d->compress_cost;
+    }
+    for (taper = tapetable; taper < tapetable + nb_taper; taper++) {
+	for (w = taper->wtapetable; w < taper->wtapetable + taper->nb_worker;
+	     w++) {
+	    if (w != wtaper && w->job)
+		left -= w->compress_cost;
+	}
+    }
+
+    if (budgetp)
+	*budgetp = budget;
+    return left;
+}
+
+/*
+ * Choose the compression of a flush from the holding disk: "fast" if the
+ * taper may compress a dump with "compress server deferred" the dumper left
+ * uncompressed, or "none".  The taper compresses while the budget has a CPU
+ * for it; a dump flushed without it stays uncompressed.
+ */
+static char *
+flush_compress_choice(
+    wtaper_t *wtaper,
+    sched_t *sp)
+{
+    long left;
+
+    wtaper->compress_cost = 0;
+    if (sp->disk->compress != COMP_SERVER_DEFERRED)
+	return g_strdup("none");
+
+    left = compress_cpu_left(NULL, wtaper, NULL);
+    g_debug("flush compress %s:%s: %s (%ld CPU quarters left)",
+	    sp->disk->host->hostname, sp->disk->name,
+	    left >= AUTO_COMPRESS_COST_FULL ? "fast" : "none", left);
+    if (left < AUTO_COMPRESS_COST_FULL)
+	return g_strdup("none");
+    wtaper->compress_cost = AUTO_COMPRESS_COST_FULL;
+    return g_strdup("fast");
+}
+
+/*
+ * Choose the compression of a dump with "compress server auto": "ALGO:LEVEL",
+ * "none", or "-" for the other dumps.  "compress server zstd" and
+ * "compress server lz4" always get their codec, but count in the budget.  It is the best the part of
+ * compress-cpu-budget the other running dumps leave allows, from the ratio of
+ * the earlier dumps of the DLE in the estimate; the lightest if they did not
+ * compress, so that the dumper can look at the new data.  The dumper does not
+ * compress what it finds incompressible in the first bytes.
+ *
+ * A dump with "compress server deferred" that lands uncompressed on the
+ * holding disk gets "deferred"; one that does not is compressed as with
+ * "compress server auto".
+ */
+static char *
+auto_compress_choice(
+    dumper_t *dumper,
+    sched_t *sp)
+{
+    long budget;
+    long left;
+    double ratio = 0.5;
+    gboolean have_zstd = FALSE;
+    gboolean have_lz4 = FALSE;
+    char *choice = NULL;
+
+    dumper->compress_cost = 0;
+    if (sp->disk->compress == COMP_SERVER_ZSTD) {
+	dumper->compress_cost = AUTO_COMPRESS_COST_FULL;
+	return g_strdup("zstd:3");
+    }
+    if (sp->disk->compress == COMP_SERVER_LZ4) {
+	dumper->compress_cost = AUTO_COMPRESS_COST_LIGHT;
+	return g_strdup("lz4:0");
+    }
+    if (sp->disk->compress == COMP_SERVER_DEFERRED && sp->compress_deferred)
+	return g_strdup("deferred");
+    if (sp->disk->compress != COMP_SERVER_AUTO &&
+	sp->disk->compress != COMP_SERVER_DEFERRED)
+	return g_strdup("-");
+
+    /* only what amrestore can decompress */
+#ifdef ZSTD_PATH
+    have_zstd = amcompress_supported(AMCOMPRESS_ZSTD);
+#endif
+#ifdef LZ4_PATH
+    have_lz4 = amcompress_supported(AMCOMPRESS_LZ4);
+#endif
+
+    left = compress_cpu_left(dumper, NULL, &budget);
+
+    if (sp->est_nsize > 0 && sp->est_csize > 0)
+	ratio = (double)sp->est_csize / (double)sp->est_nsize;
+
+    if (ratio < AUTO_COMPRESS_INCOMPRESSIBLE && have_zstd &&
+	left >= AUTO_COMPRESS_COST_FULL) {
+	/* a faster level when the budget is almost used */
+	choice = g_strdup(left >= 2 * AUTO_COMPRESS_COST_FULL ? "zstd:3" : "zstd:1");
+	dumper->compress_cost = AUTO_COMPRESS_COST_FULL;
+    } else if (have_lz4 && left >= AUTO_COMPRESS_COST_LIGHT) {
+	choice = g_strdup("lz4:0");
+	dumper->compress_cost = AUTO_COMPRESS_COST_LIGHT;
+    } else if (have_zstd && left >= AUTO_COMPRESS_COST_FULL) {
+	choice = g_strdup("zstd:1");
+	dumper->compress_cost = AUTO_COMPRESS_COST_FULL;
+    } else if (!have_zstd && !have_lz4 && left >= AUTO_COMPRESS_COST_FULL) {
+	choice = g_strdup("gzip:1");
+	dumper->compress_cost = AUTO_COMPRESS_COST_FULL;
+    } else {
+	choice = g_strdup("none");
+    }
+
+    g_debug("auto compress %s:%s: %s (ratio %.2f, %ld/%ld CPU quarters left)",
+	    sp->disk->host->hostname, sp->disk->name, choice, ratio, left,
+	    budget * 4);
+    return choice;
+}
+
+/* The NUMA node of a dump: the network interface's for the dumper, the
+ * holding disk's for the chunker.  Each falls back on the other, so that
+ * the dumper and its chunker stay together when only one is configured. */
+static int
+dump_numa_node(
+    sched_t *sp,
+    gboolean for_chunker)
+{
+    int iface_node = interface_get_numa_node(sp->disk->host->netif->config);
+    int hold_node = -1;
+
+    if (sp->holdp && sp->activehd >= 0 && sp->holdp[sp->activehd])
+	hold_node = holdingdisk_get_numa_node(sp->holdp[sp->activehd]->disk->hdisk);
+
+    if (for_chunker)
+	return hold_node >= 0 ? hold_node : iface_node;
+    return iface_node >= 0 ? iface_node : hold_node;
+}
+
+/* Pin a dumper to the node of its next dump.  Only its main thread moves;
+ * the compression threads and filters it starts for the dump follow. */
+static void
+place_dumper(
+    dumper_t *dumper,
+    sched_t  *sp)
+{
+    int node = dump_numa_node(sp, FALSE);
+    char *errmsg = NULL;
+
+    if (node == dumper->numa_node || dumper->pid <= 0)
+	return;
+    if (!amnuma_pin(dumper->pid, node, &errmsg)) {
+	g_debug("%s: %s", dumper->name, errmsg);
+	g_free(errmsg);
+    } else if (node >= 0) {
+	g_debug("%s: pinned to NUMA node %d", dumper->name, node);
+    }
+    dumper->numa_node = node;
+}
+
 int
 dumper_cmd(
     dumper_t *dumper,
@@ -821,7 +1047,8 @@ dumper_cmd(
         if (!sp)
             error("PORT-DUMP without sched pointer\n");
 	// fall through
-    case SHM_DUMP: {
+    case SHM_DUMP:
+    case HOLDING_DUMP: {
         application_t *application = NULL;
         GPtrArray *array;
         GString *strbuf;
@@ -833,6 +1060,7 @@ dumper_cmd(
         if (!sp)
             error("SHM-DUMP without sched pointer\n");
 
+	place_dumper(dumper, sp);
 	dp = sp->disk;
         array = g_ptr_array_new();
         features = dp->host->features;
@@ -919,10 +1147,23 @@ dumper_cmd(
         g_ptr_array_add(array, g_strdup(data_path_to_string(dp->data_path)));
 	if (cmd == PORT_DUMP) {
             g_ptr_array_add(array, g_strdup(dp->dataport_list));
+	} else if (cmd == HOLDING_DUMP) {
+	    /* the dumper writes the holding file itself, in place of the
+	     * chunker SHM-WRITE */
+	    assignedhd_t **h = sp->holdp;
+
+	    g_assert(h != NULL);
+	    h[sp->activehd]->disk->allocated_dumpers++;
+            g_ptr_array_add(array, quote_string(sp->destname));
+            g_ptr_array_add(array, g_strdup_printf("%lld",
+		(long long)holdingdisk_get_chunksize(h[0]->disk->hdisk)));
+            g_ptr_array_add(array, g_strdup_printf("%lld",
+		(long long)h[0]->reserved));
 	} else {
             g_ptr_array_add(array, g_strdup(dp->shm_name));
 	}
         g_ptr_array_add(array, g_strdup_printf("%d", dp->max_warnings));
+        g_ptr_array_add(array, auto_compress_choice(dumper, sp));
         g_ptr_array_add(array, g_string_free(strbuf, FALSE));
         g_ptr_array_add(array, NULL);
 
@@ -937,6 +1178,22 @@ dumper_cmd(
         cmdline = g_strdup_printf("%s %s %s\n", cmdstr[cmd], job2serial(dumper->job), qmesg);
 	amfree(qmesg);
 	break;
+    case CONTINUE: {
+	/* the next holding disk of a HOLDING-DUMP, as for the chunker */
+	assignedhd_t **h = sp->holdp;
+	int activehd = sp->activehd;
+	char *qdest;
+
+	g_assert(h != NULL);
+	qdest = quote_string(h[activehd]->destname);
+	h[activehd]->disk->allocated_dumpers++;
+	cmdline = g_strdup_printf("%s %s %s %lld %lld\n", cmdstr[cmd],
+		job2serial(dumper->job), qdest,
+		(long long)holdingdisk_get_chunksize(h[activehd]->disk->hdisk),
+		(long long)(h[activehd]->reserved - h[activehd]->used));
+	amfree(qdest);
+	break;
+    }
     case QUIT:
 	qmesg = quote_string(mesg);
         cmdline = g_strdup_printf("%s %s\n", cmdstr[cmd], qmesg);
@@ -965,7 +1222,10 @@ dumper_cmd(
 	}
 	cmdline[strlen(cmdline)-1] = '\0';
 	g_debug("driver: send-cmd time %s to %s: %s", walltime_str(curclock()), dumper->name, cmdline);
-	if (cmd == QUIT) aclose(dumper->fd);
+	if (cmd == QUIT) {
+	    forget_childstr(dumper->fd);
+	    aclose(dumper->fd);
+	}
     }
     g_free(cmdline);
     return 1;
@@ -1082,6 +1342,10 @@ chunker_cmd(
 		dp->compress == COMP_SERVER_FAST ||
 		dp->compress == COMP_SERVER_BEST ||
 		dp->compress == COMP_SERVER_CUST ||
+		dp->compress == COMP_SERVER_AUTO ||
+		dp->compress == COMP_SERVER_DEFERRED ||
+		dp->compress == COMP_SERVER_ZSTD ||
+		dp->compress == COMP_SERVER_LZ4 ||
 		dp->encrypt  == ENCRYPT_SERV_CUST) {
 		g_snprintf(c_crc, sizeof(c_crc), "00000000:0");
 	    } else {
@@ -1126,7 +1390,10 @@ chunker_cmd(
     }
     cmdline[strlen(cmdline)-1] = '\0';
     g_debug("driver: send-cmd time %s to %s: %s", walltime_str(curclock()), chunker->name, cmdline);
-    if (cmd == QUIT) aclose(chunker->fd);
+    if (cmd == QUIT) {
+	forget_childstr(chunker->fd);
+	aclose(chunker->fd);
+    }
     amfree(cmdline);
     return 1;
 }
@@ -1156,6 +1423,27 @@ free_job(
     job->wtaper  = NULL;
 }
 
+/* The sched_t of a run come from one arena; a sched_t is rarely freed
+ * before the end of the run, and the arena avoids a malloc for each of a
+ * large disklist.  free_sched releases the strings a sched_t owns, the
+ * struct itself goes with the arena in free_all_sched. */
+static amarena_t *sched_arena = NULL;
+
+sched_t *
+alloc_sched(void)
+{
+    if (!sched_arena)
+	sched_arena = amarena_new(0);
+    return amarena_new0(sched_arena, sched_t);
+}
+
+void
+free_all_sched(void)
+{
+    amarena_free(sched_arena);
+    sched_arena = NULL;
+}
+
 void
 free_sched(
     sched_t *sp)
@@ -1170,7 +1458,6 @@ free_sched(
     g_free(sp->src_storage);
     g_free(sp->src_pool);
     g_free(sp->src_label);
-    g_free(sp);
 }
 
 job_t *
@@ -1378,6 +1665,13 @@ update_info_dumper(
 	info.history[0].secs  = dumptime;
     }
 
+    /* the estimates of the higher levels kept with the change token are
+     * based on an older dump */
+    for (i = 0; i < NB_TOKEN_EST; i++) {
+	if (info.token_est[i].level > level)
+	    info.token_est[i].level = -1;
+    }
+
     if (put_info(dp->host->hostname, dp->name, &info)) {
 	int save_errno = errno;
 	g_fprintf(stderr, _("infofile update failed (%s,'%s'): %s\n"),
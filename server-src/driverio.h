@@ -88,7 +88,9 @@ typedef struct holdalloc_s {
 
     off_t disksize;
     int allocated_dumpers;
+    int active_readers;		/* flushes reading from it */
     off_t allocated_space;
+    double write_kps;		/* best write rate seen (all dumpers), or 0 */
 } holdalloc_t;
 
 typedef struct assignedhd_s {
@@ -99,8 +101,12 @@ typedef struct assignedhd_s {
 } assignedhd_t;
 
 
+/* A queue of sched_t.  The entries are kept in the GList, in queue order;
+ * index maps each sched_t to its link so that an entry can be found or
+ * removed without walking the queue.  It is created on the first insert. */
 typedef struct schedlist_s {
     GList *head, *tail;
+    GHashTable *index;
 } schedlist_t;
 #define get_sched(slist) ((sched_t *)((slist)->data))
 
@@ -114,6 +120,7 @@ typedef struct chunker_s {
     int fd;			/* read/write */
     int result;
     gboolean sendresult;
+    gboolean in_dumper;		/* the dumper writes the holding file */
     event_handle_t *ev_read;	/* read event handle */
     job_t *job;
 } chunker_t;
@@ -130,6 +137,8 @@ typedef struct dumper_s {
     int output_port;		/* output port */
     int sent_result;		/* result to dumper sent */
     int dump_finish;		/* DUMP_FINISH is received */
+    int compress_cost;		/* of its dump, in compress-cpu-budget */
+    int numa_node;		/* node it is pinned to, -1 if none */
     event_handle_t *ev_read;	/* read event handle */
     job_t *job;
 } dumper_t;
@@ -158,10 +167,13 @@ typedef struct wtaper_s {
     TaperState  state;
     off_t       left;
     off_t       written;		// Number of kb already written to tape
+    off_t       total_written;		// Number of kb written in this run
     int         nb_dle;			/* number of dle on the volume */
     gboolean    ready;
     gboolean    allow_take_scribe_from;
     vaultqs_t   vaultqs;		/* to vault from another storage */
+    int         flush_batch;		/* batch of flushes it writes, or 0 */
+    int         compress_cost;		/* of its flush, in compress-cpu-budget */
     struct taper_s *taper;
 } wtaper_t;
 
@@ -214,6 +226,9 @@ typedef struct sched_s {
     char *dumpdate, *degr_dumpdate;
     char *based_on_timestamp, *degr_based_on_timestamp;
     unsigned long est_kps, degr_kps;
+    unsigned long alloc_kps;			/* reserved on the interface */
+    unsigned long measured_kps;			/* last measured, 0 if never */
+    off_t reported_kb;				/* last kb given to autotune */
     char *destname;                             /* file/port name */
     assignedhd_t **holdp;
     time_t timestamp;
@@ -232,6 +247,10 @@ typedef struct sched_s {
     int   src_fileno;
     char *try_again_message;
     taper_t *prefered_taper;
+    int   flush_batch;			/* expected volume of a flush, from 1;
+					 * 0 if not batched */
+    gboolean compress_deferred;		/* compress server deferred: lands
+					 * uncompressed on the holding disk */
 } sched_t;
 
 /* command/result tokens */
@@ -244,12 +263,15 @@ int  startup_vault_tape_process(char *taper_program, gboolean no_taper);
 void startup_dump_process(dumper_t *dumper, char *dumper_program);
 void startup_dump_processes(char *dumper_program, int inparallel, char *timestamp);
 void startup_chunk_process(chunker_t *chunker, char *chunker_program);
+void forget_childstr(int fd);
 
 cmd_t getresult(int fd, int show, int *result_argc, char ***result_argv);
 
 job_t * alloc_job(void);
 void free_job(job_t *job);
+sched_t *alloc_sched(void);
 void free_sched(sched_t *sp);
+void free_all_sched(void);
 
 job_t *serial2job(char *str);
 void free_serial(char *str);
@@ -45,6 +45,10 @@
 #include "amutil.h"
 #include "timestamp.h"
 #include "amxml.h"
+#include "amcompress.h"
+#include "amgcm.h"
+#include "linesort.h"
+#include "xfer-server.h"
 
 #ifdef FAILURE_CODE
 static int dumper_try_again=0;
@@ -68,6 +72,17 @@ static int dumper_try_again=0;
 
 #define STARTUP_TIMEOUT 60
 
+/* compress COMP_FAST/COMP_BEST data in-process when the configured compressor
+ * is gzip, since zlib writes the same format */
+#if defined(HAVE_LIBZ) && defined(HAVE_GZIP)
+#define NATIVE_COMPRESS 1
+#endif
+
+/* "compress server auto" looks at the first bytes of the data, and does not
+ * compress it if their compressed size over their size is above the limit */
+#define AUTO_COMPRESS_SAMPLE_SIZE (1024*1024)
+#define AUTO_COMPRESS_INCOMPRESSIBLE 0.9
+
 struct databuf {
     int fd;			/* file to flush to */
     char *buf;
@@ -79,6 +94,7 @@ struct databuf {
     shm_ring_t *shm_ring_direct;
     uint64_t    shm_readx;
     crc_t      *crc;
+    amcompress_t *compress;	/* in-process compressor, or NULL */
 };
 
 struct databuf *g_databuf = NULL;
@@ -93,6 +109,11 @@ typedef struct filter_s {
     gint64          allocated_size ; /* allocated size of the buffer     */
     event_handle_t *event;
 } filter_t;
+
+/* the index lines being sorted, with sort-index; the runs are sorted by
+ * two threads, so that the dump is not held while a chunk is sorted */
+#define INDEX_SORT_THREADS 2
+static linesort_t *index_sort = NULL;
 static GSList *filters = NULL;
 
 static char *handle = NULL;
@@ -105,6 +126,27 @@ static comp_t srvcompress = COMP_NONE;
 char *srvcompprog = NULL;
 char *clntcompprog = NULL;
 
+/* COMP_SERVER_AUTO: the compression the driver chose, and the first bytes of
+ * the data until they are checked */
+static char *auto_compress = NULL;
+static amcompress_algo_t auto_algo;
+static int auto_level;
+static GString *auto_sample = NULL;
+
+/* worker threads for the in-process COMP_FAST/COMP_BEST compression, from
+ * the COMPRESS-THREADS dumptype property */
+static int compress_threads = 1;
+
+/* COMP_SERVER_DEFERRED: the dump lands uncompressed on the holding disk and
+ * the taper compresses it (compress_pending), or the dumper compresses it as
+ * a COMP_SERVER_AUTO dump */
+static gboolean deferred_dle = FALSE;
+static gboolean compress_pending = FALSE;
+
+/* COMP_SERVER_ZSTD/COMP_SERVER_LZ4: a COMP_SERVER_AUTO dump whose compression
+ * the dumptype fixed, so its first bytes are not checked */
+static gboolean fixed_dle = FALSE;
+
 static encrypt_t srvencrypt = ENCRYPT_NONE;
 char *srv_encrypt = NULL;
 char *clnt_encrypt = NULL;
@@ -117,6 +159,9 @@ static char *src_ip = NULL;
 static char *maxdumps = NULL;
 static char *hostname = NULL;
 am_feature_t *their_features = NULL;
+static amcompress_t *wire_decompress = NULL; /* transport compression of datafd */
+static security_net_stats_t net_stats;	/* of the datafd connection */
+static gboolean have_net_stats = FALSE;
 static char *diskname = NULL;
 static char *qdiskname = NULL, *b64disk;
 static char *device = NULL, *b64device;
@@ -152,9 +197,15 @@ static crc_t crc_data_in;
 static crc_t crc_data_out;
 static crc_t native_crc;
 static crc_t client_crc;
+static crc_t crc_session_in;	/* data-in CRC since the dump was resumed */
+static gboolean resume_offered;	/* the client can resume this dump */
+static int   resume_tries;	/* resumes left for this dump */
+static int   dump_resumes;	/* resumes done for this dump */
+static gboolean dump_suspended;	/* the client streams are lost, not the dump */
 static char *log_filename = NULL;
 static char *state_filename = NULL;
 static char *state_filename_gz = NULL;
+static char *block_map_filename = NULL;
 static int   statefile_in_mesg = -1;
 static gboolean broken_statefile_in_mesg = FALSE;
 static int   statefile_in_stream = -1;
@@ -164,6 +215,10 @@ static char *retry_message = NULL;
 static GThread *shm_thread = NULL;
 static GMutex  *shm_thread_mutex = NULL;
 static GCond   *shm_thread_cond = NULL;
+static GThread *index_compress_thread = NULL;
+static amcompress_t *index_compress = NULL;
+static GThread *data_encrypt_thread = NULL;
+static amgcm_stream_t *data_encrypt = NULL;
 static shm_ring_t *shm_ring_consumer = NULL;
 static shm_ring_t *shm_ring_direct = NULL;
 static char *write_to = NULL;
@@ -174,6 +229,32 @@ static int   nb_directories;
 static char  last_index_char;
 static event_handle_t *stdin_event;
 
+/*
+ * HOLDING-DUMP: the dumper writes the holding file itself, in place of the
+ * chunker, with an xfer-dest-holding reading the shm_ring.  The xfer runs
+ * its own main loop in holding_thread, which also negotiates the holding
+ * space with the driver, as the main thread can block on a full shm_ring
+ * while the xfer waits for more space.
+ */
+static Xfer         *holding_xfer = NULL;
+static XferElement  *holding_dest = NULL;
+static GMainContext *holding_context = NULL;
+static GMainLoop    *holding_loop = NULL;
+static GThread      *holding_thread = NULL;
+static dumpfile_t    holding_header;
+static char         *holding_filename = NULL;
+static char         *holding_old_filename = NULL;
+static gint64        holding_chunk_size;
+static gint64        holding_use_bytes;
+static gint64        holding_chunk_bytes;
+static int           holding_seq;
+static gint64        holding_data_size;
+static crc_t         holding_crc;
+static double        holding_duration;
+static gboolean      holding_done;
+static gboolean      holding_aborted;
+static char         *holding_error = NULL;
+
 static dumpfile_t file;
 static int client_request_result;
 static int result_sent_to_driver;
@@ -227,20 +308,33 @@ int		main(int, char **);
 static int	do_dump(struct databuf *);
 static void	check_options(char *);
 static void     xml_check_options(char *optionstr);
+static const char *auto_compress_prog(amcompress_algo_t algo);
+static void	auto_compress_setup(void);
+static void	auto_compress_check(void);
 static void	finish_tapeheader(dumpfile_t *);
 static ssize_t	write_tapeheader(int, dumpfile_t *);
 static void	databuf_init(struct databuf *, int);
 static int	databuf_write(struct databuf *, const void *, size_t);
 static int	databuf_flush(struct databuf *);
+static size_t	databuf_write_fd(struct databuf *, const void *, size_t);
+static int	databuf_finish_compress(struct databuf *);
+static void	write_block_map(amcompress_t *);
+static int	start_data_compress(struct databuf *);
 static void	process_dumpeof(void);
 static void	process_dumpline(const char *);
 static void	add_msg_data(const char *, size_t);
 static void	parse_info_line(char *);
 static int	log_msgout(logtype_t);
+static void	log_net_stats(void);
 static char *	dumper_get_security_conf (char *, void *);
 
 static int	runcompress(int, comp_t, char *);
+static int	start_index_compress(int);
+static gboolean	finish_index_compress(void);
 static int	runencrypt(int, encrypt_t, char *);
+static gboolean	native_srv_encrypt(void);
+static int	start_data_encrypt(int);
+static gboolean	finish_data_encrypt(void);
 
 static void	sendbackup_response(void *, pkt_t *, security_handle_t *);
 static int	startup_dump(const char *, const char *, const char *, int,
@@ -250,9 +344,13 @@ static int	startup_dump(const char *, const char *, const char *, int,
 			const char *, const char *, const char *,
 			const char *, const char *);
 static void	stop_dump(void);
+static void	client_stream_lost(void);
+static gboolean	resume_dump(struct databuf *);
 
 static void	read_indexfd(void *, void *, ssize_t);
 static void	read_datafd(void *, void *, ssize_t);
+static void	process_datafd(struct databuf *, void *, ssize_t);
+static void	sample_datafd(struct databuf *, void *, ssize_t);
 static void	read_statefd(void *, void *, ssize_t);
 static void	read_mesgfd(void *, void *, ssize_t);
 static void	read_cmdfd(void *, void *, ssize_t);
@@ -268,6 +366,10 @@ static void	send_result_to_driver(void);
 static void wait_filters(void *unused);
 static void stop_dump_callback(void *unused);
 static void handle_stdin(void *cookie G_GNUC_UNUSED);
+static void holding_setup(char *filename, char *chunk_size, char *use_bytes);
+static void holding_start(void);
+static void holding_wait(gboolean cancel);
+static void holding_end(void);
 
 static void
 check_options(
@@ -285,6 +387,14 @@ check_options(
       srvcompress = COMP_BEST;
     else if (strstr(options, "srvcomp-fast;") != NULL)
       srvcompress = COMP_FAST;
+    else if (strstr(options, "srvcomp-auto;") != NULL)
+      srvcompress = COMP_SERVER_AUTO;
+    else if (strstr(options, "srvcomp-deferred;") != NULL)
+      srvcompress = COMP_SERVER_DEFERRED;
+    else if (strstr(options, "srvcomp-zstd;") != NULL)
+      srvcompress = COMP_SERVER_ZSTD;
+    else if (strstr(options, "srvcomp-lz4;") != NULL)
+      srvcompress = COMP_SERVER_LZ4;
     else if ((compmode = strstr(options, "srvcomp-cust=")) != NULL) {
 	compend = strchr(compmode, ';');
 	if (compend ) {
@@ -305,6 +415,7 @@ check_options(
     else {
       srvcompress = COMP_NONE;
     }
+    compress_threads = 1;
     
 
     /* now parse the encryption option */
@@ -371,6 +482,14 @@ xml_check_options(
 	srvcompress = COMP_FAST;
     } else if (dle->compress == COMP_SERVER_BEST) {
 	srvcompress = COMP_BEST;
+    } else if (dle->compress == COMP_SERVER_AUTO) {
+	srvcompress = COMP_SERVER_AUTO;
+    } else if (dle->compress == COMP_SERVER_DEFERRED) {
+	srvcompress = COMP_SERVER_DEFERRED;
+    } else if (dle->compress == COMP_SERVER_ZSTD) {
+	srvcompress = COMP_SERVER_ZSTD;
+    } else if (dle->compress == COMP_SERVER_LZ4) {
+	srvcompress = COMP_SERVER_LZ4;
     } else if (dle->compress == COMP_SERVER_CUST) {
 	srvcompress = COMP_SERVER_CUST;
 	srvcompprog = g_strdup(dle->compprog);
@@ -380,6 +499,9 @@ xml_check_options(
     } else {
 	srvcompress = COMP_NONE;
     }
+    compress_threads = amcompress_threads_property(dle->property);
+    if (compress_threads == 0)
+	compress_threads = 1;
 
     if (dle->encrypt == ENCRYPT_CUST) {
 	srvencrypt = ENCRYPT_CUST;
@@ -415,6 +537,7 @@ main(
     int rc;
     in_port_t header_port;
     char *q = NULL;
+    char **holding_arg;
     int a;
     int res;
     config_overrides_t *cfg_ovr = NULL;
@@ -469,6 +592,7 @@ main(
 	if (g_str_equal(argv[2], "--log-filename")) {
 	    log_filename = g_strdup(argv[3]);
 	    set_logname(log_filename);
+	    log_set_keep_open(TRUE);
 	    argv += 2;
 	    argc -= 2;
 	}
@@ -526,8 +650,9 @@ main(
 
 	case PORT_DUMP:
 	case SHM_DUMP:
+	case HOLDING_DUMP:
 	    /*
-	     * PORT-DUMP or SHM-DUMP
+	     * PORT-DUMP, SHM-DUMP or HOLDING-DUMP
 	     *   handle
 	     *   port
 	     *   src_ip
@@ -552,6 +677,7 @@ main(
 	     *   security_driver
 	     *   data_path
 	     *   dataport_list (PORT-DUMP) or shm_name (SHM-DUMP)
+	     *     or filename chunksize use (HOLDING-DUMP)
 	     *   options
 	     */
 	    a = 1; /* skip "PORT-DUMP" */
@@ -726,7 +852,15 @@ main(
 
 	    amfree(dataport_list);
 	    amfree(shm_name);
-	    if (cmdargs->cmd == PORT_DUMP) {
+	    holding_arg = NULL;
+	    if (cmdargs->cmd == HOLDING_DUMP) {
+		if(a + 2 >= cmdargs->argc) {
+		    error(_("error [dumper HOLDING-DUMP: not enough args: filename chunksize use]"));
+		    /*NOTREACHED*/
+		}
+		holding_arg = &cmdargs->argv[a];
+		a += 3;
+	    } else if (cmdargs->cmd == PORT_DUMP) {
 		if(a >= cmdargs->argc) {
 		    error(_("error [dumper PORT-DUMP: not enough args: dataport_list]"));
 		}
@@ -748,6 +882,12 @@ main(
 	    }
 	    max_warnings = atoi(cmdargs->argv[a++]);
 
+	    if(a >= cmdargs->argc) {
+		error(_("error [dumper PORT-DUMP: not enough args: auto_compress]"));
+	    }
+	    g_free(auto_compress);
+	    auto_compress = g_strdup(cmdargs->argv[a++]);
+
 	    if(a >= cmdargs->argc) {
 		error(_("error [dumper PORT-DUMP: not enough args: options]"));
 	    }
@@ -773,33 +913,40 @@ main(
 		break;
 	    }
 
-	    /* connect outf to chunker/taper port */
+	    if (holding_arg) {
+		/* no chunker, the header and the data go to holding disk */
+		write_to = "holding disk";
+		holding_setup(holding_arg[0], holding_arg[1], holding_arg[2]);
+		outfd = -1;
+	    } else {
+		/* connect outf to chunker/taper port */
 
-	    g_debug(_("Sending header to localhost:%d"), header_port);
-	    outfd = stream_client(NULL, "localhost", header_port,
-				  STREAM_BUFSIZE, 0, NULL, 0, &stream_msg);
-	    if (outfd == -1 || stream_msg) {
+		g_debug(_("Sending header to localhost:%d"), header_port);
+		outfd = stream_client(NULL, "localhost", header_port,
+				      STREAM_BUFSIZE, 0, NULL, 0, &stream_msg);
+		if (outfd == -1 || stream_msg) {
 
-		g_free(errstr);
-		if (stream_msg) {
-		    errstr = g_strdup_printf(_("port open: %s"), stream_msg);
-		    g_free(stream_msg);
-		} else {
-		    errstr = g_strdup_printf(_("port open: %s"), strerror(errno));
+		    g_free(errstr);
+		    if (stream_msg) {
+			errstr = g_strdup_printf(_("port open: %s"), stream_msg);
+			g_free(stream_msg);
+		    } else {
+			errstr = g_strdup_printf(_("port open: %s"), strerror(errno));
+		    }
+		    q = quote_string(errstr);
+		    putresult(FAILED, "%s %s\n", handle, q);
+		    log_add(L_FAIL, "%s %s %s %d [%s]", hostname, qdiskname,
+			    dumper_timestamp, level, errstr);
+		    amfree(amandad_path);
+		    amfree(client_username);
+		    amfree(client_port);
+		    amfree(device);
+		    amfree(b64device);
+		    amfree(qdiskname);
+		    amfree(b64disk);
+		    amfree(q);
+		    break;
 		}
-		q = quote_string(errstr);
-		putresult(FAILED, "%s %s\n", handle, q);
-		log_add(L_FAIL, "%s %s %s %d [%s]", hostname, qdiskname,
-			dumper_timestamp, level, errstr);
-		amfree(amandad_path);
-		amfree(client_username);
-		amfree(client_port);
-		amfree(device);
-		amfree(b64device);
-		amfree(qdiskname);
-		amfree(b64disk);
-		amfree(q);
-		break;
 	    }
 	    shm_ring_consumer = NULL;
 	    shm_ring_direct = NULL;
@@ -810,6 +957,7 @@ main(
 		xml_check_options(options); /* note: modifies globals */
 	    else
 		check_options(options); /* note: modifies globals */
+	    auto_compress_setup();
 
 	    if (msg.buf) msg.buf[0] = '\0';	/* reset msg buffer */
 	    status = 0;
@@ -817,6 +965,9 @@ main(
 	    retry_delay = -1;
 	    retry_level = -1;
 	    dump_stoped = FALSE;
+	    dump_suspended = FALSE;
+	    dump_resumes = 0;
+	    resume_tries = getconf_int(CNF_RESUME_DUMP);
 	    amfree(retry_message);
 	    dumpbytes = dumpsize = headersize = origsize = (off_t)0;
 
@@ -883,6 +1034,7 @@ main(
 		}
 	    }
 
+	    holding_end();
 	    if (db.shm_ring_producer) {
 		close_producer_shm_ring(db.shm_ring_producer);
 		db.shm_ring_producer = NULL;
@@ -982,6 +1134,7 @@ databuf_init(
     db->shm_ring_consumer = NULL;
     db->shm_ring_direct = NULL;
     db->shm_readx = 0;
+    db->compress = NULL;
 }
 
 
@@ -1023,7 +1176,7 @@ databuf_flush(
     /*
      * Write out the buffer
      */
-    written = full_write(db->fd, db->dataout,
+    written = databuf_write_fd(db, db->dataout,
 			(size_t)(db->datain - db->dataout));
     if (written > 0) {
 	crc32_add((uint8_t *)db->dataout, written, &crc_data_out);
@@ -1047,6 +1200,120 @@ databuf_flush(
     return 0;
 }
 
+/*
+ * Write SIZE bytes to db->fd, through the in-process compressor if there
+ * is one.  Returns the number of input bytes consumed, as full_write does.
+ */
+static size_t
+databuf_write_fd(
+    struct databuf *	db,
+    const void *	buf,
+    size_t		size)
+{
+    char *out;
+    gsize out_len;
+
+    if (!db->compress)
+	return full_write(db->fd, buf, size);
+
+    out = amcompress_update(db->compress, buf, size, &out_len);
+    if (!out) {
+	g_debug("data compress: %s", amcompress_error(db->compress));
+	errno = EIO;
+	return 0;
+    }
+    if (out_len > 0 && full_write(db->fd, out, out_len) != out_len)
+	return 0;
+
+    return size;
+}
+
+/*
+ * Flush the in-process compressor, if any, to db->fd and free it.
+ * Returns 0 on success, -1 on error.
+ */
+static int
+databuf_finish_compress(
+    struct databuf *	db)
+{
+    char *out;
+    gsize out_len;
+    int rval = 0;
+
+    if (!db->compress)
+	return 0;
+
+    out = amcompress_finish(db->compress, &out_len);
+    if (!out) {
+	g_free(errstr);
+	errstr = g_strdup_printf(_("data compress: %s"),
+				 amcompress_error(db->compress));
+	rval = -1;
+    } else if (out_len > 0 && full_write(db->fd, out, out_len) != out_len) {
+	g_free(errstr);
+	errstr = g_strdup_printf(_("data write: %s"), strerror(errno));
+	rval = -1;
+    } else {
+	g_debug("data compress: %llu bytes compressed to %llu bytes",
+		(unsigned long long)amcompress_bytes_in(db->compress),
+		(unsigned long long)amcompress_bytes_out(db->compress));
+	write_block_map(db->compress);
+    }
+
+    amcompress_free(db->compress);
+    db->compress = NULL;
+    return rval;
+}
+
+static void
+put_u64(
+    FILE *	f,
+    guint64	n)
+{
+    int i;
+
+    for (i = 56; i >= 0; i -= 8)
+	putc((int)((n >> i) & 0xff), f);
+}
+
+/*
+ * Write the block map of a dump that the in-process compressor cut into
+ * independent blocks, so that a restore can start reading at any block.
+ * A missing map only makes the restores read from the start.
+ */
+static void
+write_block_map(
+    amcompress_t *comp)
+{
+    const guint64 *offsets;
+    guint64 nblocks, i;
+    FILE *mapf;
+
+    offsets = amcompress_block_offsets(comp, &nblocks);
+    /* the offsets are in the encrypted stream if it is encrypted */
+    if (!offsets || srvencrypt != ENCRYPT_NONE || !block_map_filename)
+	return;
+
+    if (mkpdir(block_map_filename, 0755, (uid_t)-1, (gid_t)-1) == -1 ||
+	(mapf = fopen(block_map_filename, "w")) == NULL) {
+	g_debug("Can't create block map '%s': %s", block_map_filename,
+		strerror(errno));
+	return;
+    }
+
+    fputs(BLOCK_MAP_MAGIC, mapf);
+    put_u64(mapf, AMCOMPRESS_BLOCK_SIZE);
+    put_u64(mapf, amcompress_bytes_in(comp));
+    for (i = 0; i <= nblocks; i++)
+	put_u64(mapf, offsets[i]);
+
+    if (ferror(mapf) | (fclose(mapf) != 0)) {
+	g_debug("Can't write block map '%s': %s", block_map_filename,
+		strerror(errno));
+	unlink(block_map_filename);
+    }
+}
+
 static void
 process_dumpeof(void)
 {
@@ -1439,6 +1706,26 @@ log_msgout(
     return to_unlink;
 }
 
+/*
+ * Log the network telemetry of the data connection, times in ms.  We
+ * receive the data, so our window and buffer limited times stay near zero;
+ * the sender's view is logged in the client's amandad debug file.
+ */
+static void
+log_net_stats(void)
+{
+    security_net_stats_t *ns = &net_stats;
+    double busy = (double)ns->busy_time;
+
+    log_add(L_INFO, "network %s %s %s %d [rtt %.3f rtt-max %.3f rcv-rtt %.3f retrans %u kps %.1f rwnd-limited %.1f sndbuf-limited %.1f]",
+	    hostname, qdiskname, dumper_timestamp, level,
+	    (double)ns->rtt_sum / ns->samples / 1000.0,
+	    ns->rtt_max / 1000.0, ns->rcv_rtt / 1000.0, ns->retrans,
+	    ns->delivery_rate / 1024.0,
+	    busy > 0 ? 100.0 * ns->rwnd_limited / busy : 0.0,
+	    busy > 0 ? 100.0 * ns->sndbuf_limited / busy : 0.0);
+}
+
 /* ------------- */
 
 /*
@@ -1507,6 +1794,19 @@ finish_tapeheader(
 	    file->comp_suffix[sizeof(file->comp_suffix) - 1] = '\0';
 	    strncpy(file->srvcompprog, srvcompprog, sizeof(file->srvcompprog) - 1);
 	    file->srvcompprog[sizeof(file->srvcompprog) - 1] = '\0';
+	} else if (srvcompress == COMP_SERVER_AUTO &&
+		   auto_compress_prog(auto_algo)) {
+	    /* amrestore runs SRVCOMPPROG -d */
+	    const char *prog = auto_compress_prog(auto_algo);
+
+	    g_snprintf(file->uncompress_cmd, sizeof(file->uncompress_cmd),
+		     " %s %s |", prog, "-dc");
+	    strncpy(file->comp_suffix,
+		    auto_algo == AMCOMPRESS_ZSTD ? ".zst" : ".lz4",
+		    sizeof(file->comp_suffix) - 1);
+	    file->comp_suffix[sizeof(file->comp_suffix) - 1] = '\0';
+	    strncpy(file->srvcompprog, prog, sizeof(file->srvcompprog) - 1);
+	    file->srvcompprog[sizeof(file->srvcompprog) - 1] = '\0';
 	} else if ( srvcompress == COMP_CUST ) {
 	    g_snprintf(file->uncompress_cmd, sizeof(file->uncompress_cmd),
 		     " %s %s |", clntcompprog, "-d");
@@ -1530,10 +1830,26 @@ finish_tapeheader(
 	    file->compressed = 1;
 	}
     }
+    /* where a compress server deferred dump is compressed */
+    if (compress_pending) {
+	strncpy(file->compressed_by, "pending", sizeof(file->compressed_by) - 1);
+    } else if (deferred_dle && srvcompress != COMP_NONE) {
+	strncpy(file->compressed_by, "dumper", sizeof(file->compressed_by) - 1);
+    }
+    file->compressed_by[sizeof(file->compressed_by) - 1] = '\0';
     /* take care of the encryption header here */
     if (srvencrypt != ENCRYPT_NONE) {
       file->encrypted= 1;
-      if (srvencrypt == ENCRYPT_SERV_CUST) {
+      if (srvencrypt == ENCRYPT_SERV_CUST && native_srv_encrypt()) {
+	/* restored by Amanda::Xfer::Filter::Encrypt, with the key file */
+	file->decrypt_cmd[0] = '\0';
+	strncpy(file->srv_decrypt_opt, srv_decrypt_opt, sizeof(file->srv_decrypt_opt) - 1);
+	file->srv_decrypt_opt[sizeof(file->srv_decrypt_opt) - 1] = '\0';
+	strncpy(file->encrypt_suffix, "enc", sizeof(file->encrypt_suffix) - 1);
+	file->encrypt_suffix[sizeof(file->encrypt_suffix) - 1] = '\0';
+	strncpy(file->srv_encrypt, srv_encrypt, sizeof(file->srv_encrypt) - 1);
+	file->srv_encrypt[sizeof(file->srv_encrypt) - 1] = '\0';
+      } else if (srvencrypt == ENCRYPT_SERV_CUST) {
 	if (srv_decrypt_opt) {
 	  g_snprintf(file->decrypt_cmd, sizeof(file->decrypt_cmd),
 		   " %s %s |", srv_encrypt, srv_decrypt_opt); 
@@ -1640,6 +1956,7 @@ do_dump(
     dump_result = 0;
     client_request_result = 0;
     result_sent_to_driver = 0;
+    have_net_stats = FALSE;
     retry_delay = -1;
     retry_level = -1;
     amfree(retry_message);
@@ -1690,14 +2007,26 @@ do_dump(
     state_filename = getstatefname(hostname, diskname, dumper_timestamp, level);
     state_filename_gz = g_strdup_printf("%s%s", state_filename,
 						COMPRESS_SUFFIX);
+    /* a map left by a previous try would not match this dump */
+    block_map_filename = getblockmapfname(hostname, diskname,
+					  dumper_timestamp, level);
+    unlink(block_map_filename);
 
     if (streams[INDEXFD].fd != NULL) {
-	if (getconf_boolean(CNF_COMPRESS_INDEX)) {
+	if (getconf_boolean(CNF_SORT_INDEX)) {
+	    if (getconf_boolean(CNF_COMPRESS_INDEX)) {
+		indexfile_real = getindex_sorted_gz_fname(hostname, diskname, dumper_timestamp, level);
+	    } else {
+		indexfile_real = getindex_sorted_fname(hostname, diskname, dumper_timestamp, level);
+	    }
+	} else if (getconf_boolean(CNF_COMPRESS_INDEX)) {
 	    indexfile_real = getindex_unsorted_gz_fname(hostname, diskname, dumper_timestamp, level);
 	} else {
 	    indexfile_real = getindex_unsorted_fname(hostname, diskname, dumper_timestamp, level);
 	}
 	indexfile_tmp = g_strconcat(indexfile_real, ".tmp", NULL);
+	if (getconf_boolean(CNF_SORT_INDEX))
+	    index_sort = linesort_new(indexfile_tmp, 0, INDEX_SORT_THREADS);
 
 	if (mkpdir(indexfile_tmp, 0755, (uid_t)-1, (gid_t)-1) == -1) {
             g_free(errstr);
@@ -1714,7 +2043,7 @@ do_dump(
                                      indexfile_tmp, strerror(errno));
 	    goto failed;
 	} else if (getconf_boolean(CNF_COMPRESS_INDEX)) {
-	    if (runcompress(indexout, COMP_BEST, "index compress") < 0) {
+	    if (start_index_compress(indexout) < 0) {
 		aclose(indexout);
 		goto failed;
 	    }
@@ -1733,6 +2062,13 @@ do_dump(
     security_stream_read(streams[MESGFD].fd, read_mesgfd, db);
     set_datafd = 0;
 
+    /*
+     * Without a server filter, the chunker or taper gives us the shm_ring it
+     * reads from, and the data is not copied by the dumper: a local client
+     * writes in the ring itself, and the security driver receives the data
+     * of a remote client in the ring.  Only the dumps with a server filter,
+     * which gets the data on db->fd, go through read_datafd.
+     */
     if (data_path == DATA_PATH_AMANDA) {
 	if (shm_name && !shm_ring_consumer) {
 	    if (g_str_equal(auth, "local") &&
@@ -1741,6 +2077,7 @@ do_dump(
 #endif
 		am_has_feature(their_features, fe_sendbackup_req_options_data_shm_control_name)) {
 		// shm_ring direct
+		g_debug("data path: the client writes in the shm_ring");
 		db->shm_ring_direct = shm_ring_direct;
 		shm_ring_direct = NULL;
 		shm_thread_mutex = g_mutex_new();
@@ -1749,6 +2086,7 @@ do_dump(
 				(gpointer)db, TRUE, NULL);
 	    } else {
 		// stream to shm_ring
+		g_debug("data path: the stream is received in the shm_ring");
 		db->shm_ring_producer = shm_ring_link(shm_name);
 		//db->shm_ring_producer->mc->need_sem_ready++;
 		security_stream_read_to_shm_ring(streams[DATAFD].fd, read_datafd,
@@ -1762,18 +2100,20 @@ do_dump(
 #endif
 		am_has_feature(their_features, fe_sendbackup_req_options_data_shm_control_name)) {
 		// ring to fd (server filter)
+		g_debug("data path: from the client shm_ring to the server filter");
 		db->shm_ring_consumer = shm_ring_consumer;
 		db->crc = &crc_data_in;
 		shm_ring_consumer = NULL;
 		shm_ring_consumer_set_size(db->shm_ring_consumer,
-					   NETWORK_BLOCK_BYTES*4,
-					   NETWORK_BLOCK_BYTES);
+				am_network_block_size(their_features)*4,
+				am_network_block_size(their_features));
 		shm_thread_mutex = g_mutex_new();
 		shm_thread_cond  = g_cond_new();
 		shm_thread = g_thread_create(handle_shm_ring_to_fd_thread,
 				(gpointer)db, TRUE, NULL);
 	    } else {
 		// stream to fd
+		g_debug("data path: from the stream to the server filter");
 	    }
 	}
     } else {
@@ -1802,10 +2142,13 @@ do_dump(
 	g_mutex_unlock(shm_thread_mutex);
     }
 
-    /* set an event to read ABORT command from STDIN */
-    stdin_event = event_create((event_id_t)0, EV_READFD,
-			        handle_stdin, NULL);
-    event_activate(stdin_event);
+    /* set an event to read ABORT command from STDIN, the holding_thread
+     * reads the commands of a HOLDING-DUMP */
+    if (!holding_xfer) {
+	stdin_event = event_create((event_id_t)0, EV_READFD,
+				   handle_stdin, NULL);
+	event_activate(stdin_event);
+    }
     /*
      * Start the event loop.  This will exit when all five events
      * (read the mesgfd, read the datafd, read the indexfd, read the statefd,
@@ -1813,6 +2156,16 @@ do_dump(
      */
     event_loop(0);
 
+    /* a lost client stream suspends the dump if the client can resume it */
+    while (dump_suspended) {
+	if (!resume_dump(db)) {
+	    dump_result = 2;
+	    stop_dump();
+	    break;
+	}
+	event_loop(0);
+    }
+
     if (shm_thread) {
 	g_mutex_lock(shm_thread_mutex);
 	g_cond_broadcast(shm_thread_cond);
@@ -1829,6 +2182,8 @@ do_dump(
 
     if (ISSET(status, GOT_RETRY)) {
 	if (indexfile_tmp) {
+	    aclose(indexout);
+	    finish_index_compress();
 	    unlink(indexfile_tmp);
 	}
 	log_add(L_RETRY, "%s %s %s %d delay %d level %d message %s",
@@ -1842,6 +2197,18 @@ do_dump(
 	return 1;
     }
 
+    if (dump_resumes > 0) {
+	/* the client CRCs only cover the data sent since the last resume */
+	if (client_crc.crc != 0 &&
+	    (client_crc.crc  != crc_session_in.crc ||
+	     client_crc.size != crc_session_in.size)) {
+	    dump_result = max(dump_result, 2);
+	    if (!errstr) errstr = g_strdup_printf(_("client CRC (%08x:%lld) do not match resumed data-in CRC (%08x:%lld)"), client_crc.crc, (long long)client_crc.size, crc_session_in.crc, (long long)crc_session_in.size);
+	}
+	native_crc = crc_data_in;
+	client_crc = crc_data_in;
+    }
+
     if (client_crc.crc == 0) {
 	client_crc = crc_data_in;
     }
@@ -1882,7 +2249,20 @@ do_dump(
     }
 
     if (indexfile_tmp) {
+	if (index_sort) {
+	    if (!linesort_finish(index_sort, indexout) && indexfderror == 0) {
+		g_debug("index sort: %s", linesort_error(index_sort));
+		indexfderror = 1;
+		log_add(L_INFO, _("Index corrupted for %s:%s"), hostname, qdiskname);
+	    }
+	    linesort_free(index_sort);
+	    index_sort = NULL;
+	}
 	/*@i@*/ aclose(indexout);
+	if (!finish_index_compress() && indexfderror == 0) {
+	    indexfderror = 1;
+	    log_add(L_INFO, _("Index corrupted for %s:%s"), hostname, qdiskname);
+	}
 	if (rename(indexfile_tmp, indexfile_real) != 0) {
 	    log_add(L_WARNING, _("could not rename \"%s\" to \"%s\": %s"),
 		    indexfile_tmp, indexfile_real, strerror(errno));
@@ -1906,6 +2286,10 @@ do_dump(
 	g_free(f);
     }
 
+    /* before the result, which ends the try in amreport */
+    if (have_net_stats)
+	log_net_stats();
+
     if (dump_result > 1)
 	goto failed;
 
@@ -1943,6 +2327,7 @@ do_dump(
 
     amfree(state_filename);
     amfree(state_filename_gz);
+    amfree(block_map_filename);
     amfree(errstr);
 
     dumpfile_free_data(&file);
@@ -1979,6 +2364,17 @@ failed:
     }
 
     aclose(db->fd);
+    finish_data_encrypt();
+    if (db->compress) {
+	amcompress_free(db->compress);
+	db->compress = NULL;
+    }
+    amcompress_free(wire_decompress);
+    wire_decompress = NULL;
+    if (auto_sample) {
+	g_string_free(auto_sample, TRUE);
+	auto_sample = NULL;
+    }
 /* JLM kill all filters */
 
     log_start_multiline();
@@ -1997,7 +2393,13 @@ failed:
 	amfree(errfname);
     }
 
+    if (index_sort) {
+	linesort_free(index_sort);
+	index_sort = NULL;
+    }
     if (indexfile_tmp) {
+	aclose(indexout);
+	finish_index_compress();
 	unlink(indexfile_tmp);
 	amfree(indexfile_tmp);
 	amfree(indexfile_real);
@@ -2105,7 +2507,8 @@ handle_shm_ring_to_fd_thread(
 
 	    if (srvencrypt == ENCRYPT_SERV_CUST) {
 		write_to = "encryption program";
-		if (runencrypt(db->fd, srvencrypt, "data encrypt") < 0) {
+		if ((native_srv_encrypt() ? start_data_encrypt(db->fd)
+			: runencrypt(db->fd, srvencrypt, "data encrypt")) < 0) {
 		    dump_result = 2;
 		    aclose(db->fd);
 		    ev_stop_dump = event_create((event_id_t)0, EV_TIME,
@@ -2122,7 +2525,7 @@ handle_shm_ring_to_fd_thread(
 	     */
 	    if ((srvcompress != COMP_NONE) && (srvcompress != COMP_CUST)) {
 		write_to = "compression program";
-		if (runcompress(db->fd, srvcompress, "data compress") < 0) {
+		if (start_data_compress(db) < 0) {
 		    dump_result = 2;
 		    aclose(db->fd);
 		    ev_stop_dump = event_create((event_id_t)0, EV_TIME,
@@ -2143,7 +2546,7 @@ handle_shm_ring_to_fd_thread(
 		to_write = db->shm_ring_consumer->block_size;
 
 	    if (to_write + read_offset <= shm_ring_size) {
-		if (full_write(db->fd, db->shm_ring_consumer->data + read_offset, to_write) != to_write) {
+		if (databuf_write_fd(db, db->shm_ring_consumer->data + read_offset, to_write) != to_write) {
 		    errstr = g_strdup_printf("write to %s failed: %s", write_to, strerror(errno));
 		    g_debug("%s", errstr);
 		    g_mutex_lock(shm_thread_mutex);
@@ -2163,7 +2566,7 @@ handle_shm_ring_to_fd_thread(
 			      db->crc);
 		}
 	    } else {
-		if (full_write(db->fd, db->shm_ring_consumer->data + read_offset,
+		if (databuf_write_fd(db, db->shm_ring_consumer->data + read_offset,
 			   shm_ring_size - read_offset) != shm_ring_size - read_offset) {
 		    errstr = g_strdup_printf("write to %s failed: %s", write_to, strerror(errno));
 		    g_debug("%s", errstr);
@@ -2179,7 +2582,7 @@ handle_shm_ring_to_fd_thread(
 		    g_mutex_unlock(shm_thread_mutex);
 		    return NULL;
 		}
-		if (full_write(db->fd, db->shm_ring_consumer->data,
+		if (databuf_write_fd(db, db->shm_ring_consumer->data,
 			   to_write - shm_ring_size + read_offset) != to_write - shm_ring_size + read_offset) {
 		    errstr = g_strdup_printf("write to %s failed: %s", write_to, strerror(errno));
 		    g_debug("%s", errstr);
@@ -2220,7 +2623,15 @@ handle_shm_ring_to_fd_thread(
 
 shm_done:
     g_mutex_lock(shm_thread_mutex);
+    if (databuf_finish_compress(db) < 0) {
+	g_debug("%s", errstr);
+	dump_result = 2;
+    }
     aclose(db->fd);
+    if (!finish_data_encrypt()) {
+	g_debug("%s", errstr);
+	dump_result = 2;
+    }
     g_cond_broadcast(shm_thread_cond);
     g_mutex_unlock(shm_thread_mutex);
 
@@ -2390,8 +2801,7 @@ read_mesgfd(
 	    errstr = g_strdup_printf("mesg read: %s",
                                      security_stream_geterror(streams[MESGFD].fd));
 	}
-	dump_result = 2;
-	stop_dump();
+	client_stream_lost();
 	if (shm_thread) {
 	    g_cond_broadcast(shm_thread_cond);
 	    g_mutex_unlock(shm_thread_mutex);
@@ -2468,6 +2878,10 @@ header_sent(
     assert(!ISSET(status, HEADER_SENT));
     SET(status, HEADER_SENT);
     finish_tapeheader(&file);
+    if (holding_xfer) {
+	holding_start();
+	return TRUE;
+    }
     if (write_tapeheader(db->fd, &file)) {
 	g_free(errstr);
 	errstr = g_strdup_printf("write_tapeheader: %s", strerror(errno));
@@ -2490,7 +2904,85 @@ read_datafd(
     ssize_t	size)
 {
     struct databuf *db = cookie;
+    char *out;
+    gsize out_len;
+
+    assert(db != NULL);
+    if (!wire_decompress || size < 0) {
+	sample_datafd(db, buf, size);
+	return;
+    }
+
+    /* undo the transport compression negotiated with the client */
+    if (size > 0)
+	out = amcompress_update(wire_decompress, buf, (gsize)size, &out_len);
+    else
+	out = amcompress_finish(wire_decompress, &out_len);
+    if (!out) {
+	g_free(errstr);
+	errstr = g_strdup_printf("data decompress: %s",
+				 amcompress_error(wire_decompress));
+	dump_result = 2;
+	aclose(db->fd);
+	stop_dump();
+	return;
+    }
+
+    if (out_len > 0)
+	sample_datafd(db, out, (ssize_t)out_len);
+
+    if (size == 0) {
+	g_debug("wire-compress: %llu bytes to %llu bytes",
+		(unsigned long long)amcompress_bytes_in(wire_decompress),
+		(unsigned long long)amcompress_bytes_out(wire_decompress));
+	amcompress_free(wire_decompress);
+	wire_decompress = NULL;
+	/* unless writing the last of the data failed and stopped the dump */
+	if (streams[DATAFD].fd != NULL)
+	    sample_datafd(db, NULL, 0);
+    }
+}
+
+/*
+ * Hold the first bytes of the data of a COMP_SERVER_AUTO dump until the
+ * compression is checked on them, then handle them and the rest of the data
+ */
+static void
+sample_datafd(
+    struct databuf *	db,
+    void *		buf,
+    ssize_t		size)
+{
+    if (!auto_sample || size < 0) {
+	process_datafd(db, buf, size);
+	return;
+    }
+
+    if (size > 0) {
+	g_string_append_len(auto_sample, buf, size);
+	if (auto_sample->len < AUTO_COMPRESS_SAMPLE_SIZE)
+	    return;
+    }
+
+    auto_compress_check();
+    if (auto_sample->len > 0)
+	process_datafd(db, auto_sample->str, (ssize_t)auto_sample->len);
+    g_string_free(auto_sample, TRUE);
+    auto_sample = NULL;
+    if (size == 0 && !dump_stoped)
+	process_datafd(db, NULL, 0);
+}
 
+/*
+ * Handle the data read on the datafd stream, after any transport
+ * decompression
+ */
+static void
+process_datafd(
+    struct databuf *	db,
+    void *		buf,
+    ssize_t		size)
+{
     assert(db != NULL);
     if (shm_thread) {
 	g_mutex_lock(shm_thread_mutex);
@@ -2505,9 +2997,7 @@ read_datafd(
 	    errstr = g_strdup_printf("data read: %s",
                                      security_stream_geterror(streams[DATAFD].fd));
 	}
-	dump_result = 2;
-	aclose(db->fd);
-	stop_dump();
+	client_stream_lost();
 	if (shm_thread) {
 	    g_cond_broadcast(shm_thread_cond);
 	    g_mutex_unlock(shm_thread_mutex);
@@ -2640,7 +3130,8 @@ read_datafd(
 
 	if (srvencrypt == ENCRYPT_SERV_CUST) {
 	    write_to = "encryption program";
-	    if (runencrypt(db->fd, srvencrypt, "data encrypt") < 0) {
+	    if ((native_srv_encrypt() ? start_data_encrypt(db->fd)
+			: runencrypt(db->fd, srvencrypt, "data encrypt")) < 0) {
 		dump_result = 2;
 		aclose(db->fd);
 		stop_dump();
@@ -2657,7 +3148,7 @@ read_datafd(
 	 */
 	if ((srvcompress != COMP_NONE) && (srvcompress != COMP_CUST)) {
 	    write_to = "compression program";
-	    if (runcompress(db->fd, srvcompress, "data compress") < 0) {
+	    if (start_data_compress(db) < 0) {
 		dump_result = 2;
 		aclose(db->fd);
 		stop_dump();
@@ -2690,17 +3181,26 @@ read_datafd(
      */
     if (size == 0) {
 	databuf_flush(db);
+	if (databuf_finish_compress(db) < 0) {
+	    dump_result = 2;
+	}
 	if (dumpbytes != (off_t)0) {
 	    dumpsize += (off_t)1;
 	}
 	if (streams[DATAFD].fd) {
+	    have_net_stats = security_stream_net_stats(streams[DATAFD].fd,
+						       &net_stats);
 	    security_stream_close(streams[DATAFD].fd);
 	}
 	streams[DATAFD].fd = NULL;
 	aclose(db->fd);
+	if (!finish_data_encrypt()) {
+	    dump_result = 2;
+	}
 	send_result();
 	crc_data_in.crc  = crc32_finish(&crc_data_in);
 	crc_data_out.crc = crc32_finish(&crc_data_out);
+	crc_session_in.crc = crc32_finish(&crc_session_in);
 	g_debug("data in  CRC: %08x:%lld",
 		crc_data_in.crc, (long long)crc_data_in.size);
 	g_debug("data out CRC: %08x:%lld",
@@ -2721,6 +3221,7 @@ read_datafd(
 
     if (!shm_name) {
 	crc32_add(buf, size, &crc_data_in);
+	crc32_add(buf, size, &crc_session_in);
     }
     if (debug_auth >= 3) {
 	crc_data_in.crc  = crc32_finish(&crc_data_in);
@@ -2855,8 +3356,7 @@ read_indexfd(
 	    errstr = g_strdup_printf("index read: %s",
                                      security_stream_geterror(streams[INDEXFD].fd));
 	}
-	dump_result = 2;
-	stop_dump();
+	client_stream_lost();
 	if (shm_thread) {
 	    g_cond_broadcast(shm_thread_cond);
 	    g_mutex_unlock(shm_thread_mutex);
@@ -2891,7 +3391,9 @@ read_indexfd(
 	     streams[STATEFD].fd == NULL) {
 	    stop_dump();
 	}
-	aclose(indexout);
+	/* a sorted index is written at the end of the dump */
+	if (!index_sort)
+	    aclose(indexout);
 	send_result();
 	if (shm_thread) {
 	    g_cond_broadcast(shm_thread_cond);
@@ -2920,6 +3422,11 @@ read_indexfd(
     }
     last_index_char = sbuf[size-1];
 
+    if (index_sort) {
+	linesort_add(index_sort, buf, (gsize)size);
+	return;
+    }
+
     /*
      * We ignore error while writing to the index file.
      */
@@ -2940,6 +3447,253 @@ handle_stdin(
     stop_dump();
 }
 
+/* the holding sizes of the driver are in kb, floored to 32k */
+static gint64
+holding_kb_to_bytes(
+    char *kb)
+{
+    return (g_ascii_strtoll(kb, NULL, 10) / 32) * 32 * 1024;
+}
+
+static void holding_start_chunk(void);
+
+/* ask the driver for more holding space and wait for its answer, in
+ * holding_thread; the driver ABORTs the dump if it can't get any */
+static void
+holding_rq_more_disk(void)
+{
+    struct cmdargs *cmdargs;
+
+    putresult(RQ_MORE_DISK, "%s\n", handle);
+    cmdargs = getcmd();
+    if (cmdargs->cmd == CONTINUE && cmdargs->argc >= 5) {
+	/* CONTINUE <handle> <filename> <chunksize> <use> */
+	g_free(holding_filename);
+	holding_filename = g_strdup(cmdargs->argv[2]);
+	holding_chunk_size = holding_kb_to_bytes(cmdargs->argv[3]);
+	holding_use_bytes = holding_kb_to_bytes(cmdargs->argv[4]);
+	free_cmdargs(cmdargs);
+	holding_start_chunk();
+	return;
+    }
+
+    if (cmdargs->cmd != ABORT) {
+	g_debug("Expected a CONTINUE or ABORT command, got '%d': %s",
+		cmdargs->cmd, cmdstr[cmdargs->cmd]);
+    }
+    free_cmdargs(cmdargs);
+    holding_aborted = TRUE;
+    xfer_cancel(holding_xfer);
+}
+
+/* start the next chunk, as the chunker does: a new chunk file on a new
+ * holding disk or when the chunk is full */
+static void
+holding_start_chunk(void)
+{
+    char   *chunk_name;
+    gint64  use_bytes;
+
+    if (holding_use_bytes <= 0) {
+	holding_rq_more_disk();
+	return;
+    }
+
+    if ((holding_old_filename &&
+	 !g_str_equal(holding_old_filename, holding_filename)) ||
+	holding_chunk_bytes >= holding_chunk_size) {
+	holding_seq++;
+	holding_chunk_bytes = 0;
+    }
+    g_free(holding_old_filename);
+    holding_old_filename = g_strdup(holding_filename);
+
+    if (holding_seq > 0) {
+	chunk_name = g_strdup_printf("%s.%d", holding_filename, holding_seq);
+    } else {
+	chunk_name = g_strdup(holding_filename);
+    }
+
+    use_bytes = holding_use_bytes;
+    if (use_bytes > holding_chunk_size - holding_chunk_bytes)
+	use_bytes = holding_chunk_size - holding_chunk_bytes;
+
+    dumper_debug(1, "holding: start chunk %s, %lld bytes", chunk_name,
+		 (long long)use_bytes);
+    xfer_dest_holding_start_chunk(holding_dest, &holding_header, chunk_name,
+				  (guint64)use_bytes);
+    g_free(chunk_name);
+}
+
+static gboolean
+holding_first_chunk(
+    gpointer data G_GNUC_UNUSED)
+{
+    holding_start_chunk();
+    return FALSE;
+}
+
+static void
+holding_xmsg_callback(
+    gpointer data G_GNUC_UNUSED,
+    XMsg    *msg,
+    Xfer    *xfer)
+{
+    char *mesg;
+
+    switch (msg->type) {
+    case XMSG_CHUNK_DONE:
+	holding_data_size += msg->data_size;
+	holding_chunk_bytes += msg->header_size + msg->data_size;
+	holding_use_bytes -= msg->header_size + msg->data_size;
+	if (msg->no_room) {
+	    if (holding_use_bytes > 0) {
+		char *q = quote_string(msg->message ? msg->message : "unknown");
+		putresult(NO_ROOM, "%s %lld %s\n", handle,
+			  (long long)(holding_use_bytes / 1024), q);
+		g_free(q);
+	    }
+	    holding_use_bytes = 0;
+	    holding_rq_more_disk();
+	} else {
+	    holding_start_chunk();
+	}
+	break;
+
+    case XMSG_ERROR:
+	if (!holding_error)
+	    holding_error = g_strdup(msg->message);
+	break;
+
+    case XMSG_CRC:
+	if (msg->elt == holding_dest) {
+	    holding_crc.crc = msg->crc;
+	    holding_crc.size = msg->size;
+	}
+	break;
+
+    case XMSG_DONE:
+	if (xfer->status != XFER_DONE)
+	    break;
+	mesg = xfer_dest_holding_finish_chunk(holding_dest);
+	if (mesg && !holding_error) {
+	    holding_error = mesg;
+	} else {
+	    g_free(mesg);
+	}
+	holding_duration = msg->duration;
+	holding_done = TRUE;
+	g_main_loop_quit(holding_loop);
+	break;
+
+    default:
+	break;
+    }
+}
+
+static gpointer
+holding_thread_main(
+    gpointer data G_GNUC_UNUSED)
+{
+    g_main_loop_run(holding_loop);
+    return NULL;
+}
+
+/* set up the xfer of a HOLDING-DUMP, its shm_ring is the one the data is
+ * sent to */
+static void
+holding_setup(
+    char *filename,
+    char *chunk_size,
+    char *use_bytes)
+{
+    XferElement *elements[2];
+    GSource *src;
+
+    g_free(holding_filename);
+    holding_filename = g_strdup(filename);
+    amfree(holding_old_filename);
+    holding_chunk_size = holding_kb_to_bytes(chunk_size);
+    holding_use_bytes = holding_kb_to_bytes(use_bytes);
+    holding_chunk_bytes = 0;
+    holding_seq = 0;
+    holding_data_size = 0;
+    crc32_init(&holding_crc);
+    holding_duration = 0.0;
+    holding_done = FALSE;
+    holding_aborted = FALSE;
+    amfree(holding_error);
+
+    elements[0] = xfer_source_shm_ring();
+    elements[1] = holding_dest = xfer_dest_holding(0);
+    holding_xfer = xfer_new(elements, 2);
+    g_object_unref(elements[0]);
+    g_object_unref(elements[1]);
+
+    holding_context = g_main_context_new();
+    holding_loop = g_main_loop_new(holding_context, FALSE);
+    src = xfer_get_source(holding_xfer);
+    g_source_set_callback(src, (GSourceFunc)holding_xmsg_callback, NULL, NULL);
+    g_source_attach(src, holding_context);
+    xfer_start(holding_xfer, 0, 0);
+
+    g_free(shm_name);
+    shm_name = g_strdup(holding_dest->shm_ring->shm_control_name);
+    holding_thread = g_thread_create(holding_thread_main, NULL, TRUE, NULL);
+}
+
+/* the header is done, start writing the first chunk */
+static void
+holding_start(void)
+{
+    GSource *src;
+
+    dumpfile_free_data(&holding_header);
+    dumpfile_copy_in_place(&holding_header, &file);
+    holding_header.totalparts = -1;
+
+    src = g_idle_source_new();
+    g_source_set_callback(src, holding_first_chunk, NULL, NULL);
+    g_source_attach(src, holding_context);
+    g_source_unref(src);
+}
+
+/* wait for the holding file to be written, or for the xfer to stop if
+ * CANCEL; nothing is written before the header is sent */
+static void
+holding_wait(
+    gboolean cancel)
+{
+    if (!holding_thread)
+	return;
+
+    if (cancel || !ISSET(status, HEADER_SENT))
+	xfer_cancel(holding_xfer);
+    g_thread_join(holding_thread);
+    holding_thread = NULL;
+}
+
+static void
+holding_end(void)
+{
+    if (!holding_xfer)
+	return;
+
+    holding_wait(!holding_done);
+
+    xfer_unref(holding_xfer);
+    holding_xfer = NULL;
+    holding_dest = NULL;
+    g_main_loop_unref(holding_loop);
+    holding_loop = NULL;
+    g_main_context_unref(holding_context);
+    holding_context = NULL;
+    dumpfile_free_data(&holding_header);
+    amfree(holding_filename);
+    amfree(holding_old_filename);
+    amfree(holding_error);
+}
+
 static void
 handle_filter_stderr(
     void *cookie)
@@ -3151,8 +3905,7 @@ timeout_callback(
     assert(unused == NULL);
     g_free(errstr);
     errstr = g_strdup(_("data timeout"));
-    dump_result = 2;
-    stop_dump();
+    client_stream_lost();
     if (shm_thread) {
 	g_mutex_unlock(shm_thread_mutex);
     }
@@ -3195,7 +3948,7 @@ stop_dump(void)
     }
 
     /* Check if I have a pending ABORT command */
-    cmdargs = get_pending_cmd();
+    cmdargs = holding_xfer ? NULL : get_pending_cmd();
     if (cmdargs) {
 	if (cmdargs->cmd != ABORT && cmdargs->cmd != QUIT) {
 	    g_debug("Expected an ABORT command, got '%d': %s", cmdargs->cmd, cmdstr[cmdargs->cmd]);
@@ -3262,6 +4015,117 @@ stop_dump(void)
     dump_stoped = TRUE;
 }
 
+/*
+ * A read on a client stream failed or timed out, errstr says why.  If the
+ * client can resume the dump, only close the client streams: the data
+ * received so far is already on its way to the chunker, and do_dump asks
+ * the client for the rest.  Otherwise stop the dump.
+ * Must be called with shm_thread_mutex locked
+ */
+static void
+client_stream_lost(void)
+{
+    guint i;
+
+    if (dump_suspended)
+	return;
+
+    if (dump_stoped || !resume_offered || resume_tries <= 0 ||
+	!ISSET(status, HEADER_SENT) || ISSET(status, GOT_RETRY) ||
+	data_path != DATA_PATH_AMANDA || shm_name || filters ||
+	g_databuf->fd == -1) {
+	dump_result = 2;
+	stop_dump();
+	return;
+    }
+
+    g_debug("client stream lost after %lld bytes: %s",
+	    (long long)crc_data_in.size, errstr ? errstr : "");
+    for (i = 0; i < NSTREAMS; i++) {
+	if (streams[i].fd != NULL) {
+	    security_stream_read_cancel(streams[i].fd);
+	    security_stream_close(streams[i].fd);
+	    streams[i].fd = NULL;
+	}
+    }
+    if (stdin_event) {
+	event_release(stdin_event);
+	stdin_event = NULL;
+    }
+    aclose(statefile_in_stream);
+    aclose(statefile_in_mesg);
+    timeout(0);
+    dump_suspended = TRUE;
+}
+
+/*
+ * Ask the client for the rest of a suspended dump, from the bytes already
+ * received, and schedule the reads of the new streams.  The header is not
+ * written again, the data goes on on the same chunker stream.
+ */
+static gboolean
+resume_dump(
+    struct databuf *db)
+{
+    int rc;
+
+    dump_suspended = FALSE;
+    resume_tries--;
+    dump_resumes++;
+    log_add(L_INFO, _("%s %s resuming the dump at %lld bytes after: %s"),
+	    hostname, qdiskname, (long long)crc_data_in.size,
+	    errstr ? errstr : _("lost connection"));
+    amfree(errstr);
+    CLR(status, GOT_INFO_ENDLINE | GOT_SIZELINE | GOT_ENDLINE | HEADER_DONE);
+    if (msg.buf) msg.buf[0] = '\0';	/* drop a partial line */
+
+    rc = startup_dump(hostname,
+		      diskname,
+		      device,
+		      level,
+		      dumpdate,
+		      progname,
+		      amandad_path,
+		      client_username,
+		      ssl_fingerprint_file,
+		      ssl_cert_file,
+		      ssl_key_file,
+		      ssl_ca_cert_file,
+		      ssl_cipher_list,
+		      ssl_check_certificate_host,
+		      client_port,
+		      ssh_keys,
+		      auth,
+		      options);
+    if (rc == 0 && !resume_offered) {
+	g_free(errstr);
+	errstr = g_strdup(_("the client can't resume the dump"));
+	return FALSE;
+    }
+    if (rc != 0) {
+	/* a RETRY restarts the dump from the beginning, not from here */
+	CLR(status, GOT_RETRY);
+	if (!errstr)
+	    errstr = g_strdup(_("can't resume the dump"));
+	return FALSE;
+    }
+
+    set_datafd = 0;
+    if (streams[INDEXFD].fd != NULL)
+	security_stream_read(streams[INDEXFD].fd, read_indexfd, &indexout);
+    security_stream_read(streams[MESGFD].fd, read_mesgfd, db);
+    if (streams[CMDFD].fd != NULL)
+	security_stream_read(streams[CMDFD].fd, read_cmdfd, NULL);
+    if (streams[STATEFD].fd != NULL)
+	security_stream_read(streams[STATEFD].fd, read_statefd, NULL);
+    timeout(conf_dtimeout);
+    stdin_event = event_create((event_id_t)0, EV_READFD,
+			       handle_stdin, NULL);
+    event_activate(stdin_event);
+
+    return TRUE;
+}
+
 static void
 wait_filters(
     void *unused G_GNUC_UNUSED)
@@ -3328,6 +4192,452 @@ wait_filters(
     }
 }
 
+static const char *
+auto_compress_prog(
+    amcompress_algo_t algo)
+{
+    switch (algo) {
+#ifdef ZSTD_PATH
+    case AMCOMPRESS_ZSTD:
+	return ZSTD_PATH;
+#endif
+#ifdef LZ4_PATH
+    case AMCOMPRESS_LZ4:
+	return LZ4_PATH;
+#endif
+    default:
+	return NULL;
+    }
+}
+
+/*
+ * Set up a COMP_SERVER_AUTO dump with the compression the driver chose,
+ * "ALGO:LEVEL" or "none".  Its first bytes are kept to check it, unless they
+ * do not go through the dumper.  A COMP_SERVER_DEFERRED dump is not
+ * compressed if the driver chose "deferred", and is a COMP_SERVER_AUTO dump
+ * otherwise.  A COMP_SERVER_ZSTD or COMP_SERVER_LZ4 dump is a COMP_SERVER_AUTO
+ * dump whose first bytes are not checked.
+ */
+static void
+auto_compress_setup(void)
+{
+    char *colon;
+
+    if (auto_sample) {
+	g_string_free(auto_sample, TRUE);
+	auto_sample = NULL;
+    }
+    deferred_dle = (srvcompress == COMP_SERVER_DEFERRED);
+    fixed_dle = (srvcompress == COMP_SERVER_ZSTD ||
+		 srvcompress == COMP_SERVER_LZ4);
+    compress_pending = FALSE;
+    if (fixed_dle)
+	srvcompress = COMP_SERVER_AUTO;
+    if (deferred_dle) {
+	if (g_str_equal(auto_compress, "deferred")) {
+	    g_debug("deferred compress: compressed when flushed");
+	    srvcompress = COMP_NONE;
+	    compress_pending = TRUE;
+	    return;
+	}
+	g_debug("deferred compress: no room on the holding disk, compressing now");
+	srvcompress = COMP_SERVER_AUTO;
+    }
+    if (srvcompress != COMP_SERVER_AUTO)
+	return;
+
+    colon = strchr(auto_compress, ':');
+    if (colon) {
+	*colon = '\0';
+	if (!amcompress_algo_from_name(auto_compress, &auto_algo) ||
+	    !amcompress_supported(auto_algo) ||
+	    (auto_algo != AMCOMPRESS_GZIP && !auto_compress_prog(auto_algo))) {
+	    g_debug("auto compress: can't compress with %s", auto_compress);
+	    colon = NULL;
+	}
+	auto_level = colon ? atoi(colon + 1) : 0;
+    }
+    if (!colon) {
+	g_debug("auto compress: none");
+	srvcompress = COMP_NONE;
+	return;
+    }
+
+    if (!shm_name && !fixed_dle)
+	auto_sample = g_string_sized_new(AUTO_COMPRESS_SAMPLE_SIZE);
+}
+
+/*
+ * Check the compression of a COMP_SERVER_AUTO dump on its first bytes: do not
+ * compress them if even the fastest compression gives little
+ */
+static void
+auto_compress_check(void)
+{
+    amcompress_algo_t algo;
+    amcompress_t *comp;
+    char *errmsg = NULL;
+    gsize out_len;
+    double ratio;
+
+    if (auto_sample->len == 0) {
+	srvcompress = COMP_NONE;
+	return;
+    }
+
+    algo = amcompress_supported(AMCOMPRESS_LZ4) ? AMCOMPRESS_LZ4 : auto_algo;
+    comp = amcompress_new(algo, AMCOMPRESS_LEVEL_FAST, 1, &errmsg);
+    if (!comp) {
+	g_debug("auto compress: %s; keeping %s", errmsg,
+		amcompress_algo_name(auto_algo));
+	g_free(errmsg);
+	return;
+    }
+    if (!amcompress_update(comp, auto_sample->str, auto_sample->len, &out_len) ||
+	!amcompress_finish(comp, &out_len)) {
+	g_debug("auto compress: %s; keeping %s", amcompress_error(comp),
+		amcompress_algo_name(auto_algo));
+	amcompress_free(comp);
+	return;
+    }
+    ratio = (double)amcompress_bytes_out(comp) / (double)auto_sample->len;
+    amcompress_free(comp);
+
+    if (ratio > AUTO_COMPRESS_INCOMPRESSIBLE) {
+	g_debug("auto compress: first %zu bytes compress to %.2f with %s, not compressing",
+		auto_sample->len, ratio, amcompress_algo_name(algo));
+	srvcompress = COMP_NONE;
+    } else {
+	g_debug("auto compress: first %zu bytes compress to %.2f with %s, compressing with %s level %d",
+		auto_sample->len, ratio, amcompress_algo_name(algo),
+		amcompress_algo_name(auto_algo), auto_level);
+    }
+}
+
+/*
+ * Sets up compression of the data stream to db->fd: in-process when the
+ * configured compressor is gzip and zlib is available, otherwise by running
+ * the compress program.  Returns 0 on success, negative on error.
+ */
+static int
+start_data_compress(
+    struct databuf *db)
+{
+    if (srvcompress == COMP_SERVER_AUTO) {
+	char *errmsg = NULL;
+
+	/* a single thread: the driver counts a dump as one CPU */
+	db->compress = amcompress_new(auto_algo, auto_level, 1, &errmsg);
+	if (db->compress) {
+	    g_debug("data compress: in-process %s level %d",
+		    amcompress_algo_name(auto_algo), auto_level);
+	    return 0;
+	}
+	if (auto_algo != AMCOMPRESS_GZIP) {
+	    g_free(errstr);
+	    errstr = g_strdup_printf("data compress: %s", errmsg);
+	    g_free(errmsg);
+	    return -1;
+	}
+	g_debug("data compress: %s; running %s instead", errmsg, COMPRESS_PATH);
+	g_free(errmsg);
+    }
+
+#ifdef NATIVE_COMPRESS
+    if (srvcompress == COMP_FAST || srvcompress == COMP_BEST) {
+	char *errmsg = NULL;
+
+	db->compress = amcompress_new(AMCOMPRESS_GZIP,
+			srvcompress == COMP_BEST ? AMCOMPRESS_LEVEL_BEST
+						 : AMCOMPRESS_LEVEL_FAST,
+			compress_threads, &errmsg);
+	if (db->compress) {
+	    g_debug("data compress: in-process gzip %s, %d thread(s)",
+		    srvcompress == COMP_BEST ? COMPRESS_BEST_OPT : COMPRESS_FAST_OPT,
+		    compress_threads);
+	    return 0;
+	}
+	g_debug("data compress: %s; running %s instead", errmsg, COMPRESS_PATH);
+	g_free(errmsg);
+    }
+#endif
+
+    return runcompress(db->fd, srvcompress, "data compress");
+}
+
+/*
+ * Compress the index in a thread of our own: the pipe replaces OUTFD, as
+ * with runcompress, and the thread writes the gzip stream to the file.
+ * Falls back to runcompress if zlib is not available.
+ */
+static gpointer
+index_compress_thread_func(
+    gpointer	data)
+{
+    int *fds = data;
+    int in = fds[0];
+    int out = fds[1];
+    char *buf = g_malloc(DISK_BLOCK_BYTES * 16);
+    char *cbuf;
+    gsize clen;
+    ssize_t nread;
+    gboolean ok = TRUE;
+
+    g_free(fds);
+    for (;;) {
+	nread = read(in, buf, DISK_BLOCK_BYTES * 16);
+	if (nread < 0 && errno == EINTR)
+	    continue;
+	if (nread < 0) {
+	    g_debug("index compress: read: %s", strerror(errno));
+	    ok = FALSE;
+	    break;
+	}
+	if (nread == 0)
+	    break;
+	if (!ok)
+	    continue;	/* drain the pipe so the dumper is not blocked */
+	cbuf = amcompress_update(index_compress, buf, (gsize)nread, &clen);
+	if (!cbuf) {
+	    g_debug("index compress: %s", amcompress_error(index_compress));
+	    ok = FALSE;
+	} else if (clen > 0 && full_write(out, cbuf, clen) != clen) {
+	    g_debug("index compress: write: %s", strerror(errno));
+	    ok = FALSE;
+	}
+    }
+    if (ok) {
+	cbuf = amcompress_finish(index_compress, &clen);
+	if (!cbuf) {
+	    g_debug("index compress: %s", amcompress_error(index_compress));
+	    ok = FALSE;
+	} else if (clen > 0 && full_write(out, cbuf, clen) != clen) {
+	    g_debug("index compress: write: %s", strerror(errno));
+	    ok = FALSE;
+	}
+    }
+    if (close(out) != 0)
+	ok = FALSE;
+    close(in);
+    g_free(buf);
+    return GINT_TO_POINTER(ok);
+}
+
+static int
+start_index_compress(
+    int		outfd)
+{
+    int  outpipe[2];
+    int *fds;
+    char *errmsg = NULL;
+
+    index_compress = amcompress_new(AMCOMPRESS_GZIP, AMCOMPRESS_LEVEL_BEST, 1,
+				    &errmsg);
+    if (!index_compress) {
+	g_debug("index compress: %s; running %s instead", errmsg, COMPRESS_PATH);
+	g_free(errmsg);
+	return runcompress(outfd, COMP_BEST, "index compress");
+    }
+
+    if (pipe(outpipe) < 0) {
+	g_free(errstr);
+	errstr = g_strdup_printf(_("pipe: %s"), strerror(errno));
+	amcompress_free(index_compress);
+	index_compress = NULL;
+	return -1;
+    }
+    fds = g_new(int, 2);
+    fds[0] = outpipe[0];
+    fds[1] = dup(outfd);
+    if (fds[1] < 0 || dup2(outpipe[1], outfd) < 0) {
+	g_free(errstr);
+	errstr = g_strdup_printf(_("couldn't dup2: %s"), strerror(errno));
+	if (fds[1] >= 0)
+	    close(fds[1]);
+	aclose(outpipe[0]);
+	aclose(outpipe[1]);
+	g_free(fds);
+	amcompress_free(index_compress);
+	index_compress = NULL;
+	return -1;
+    }
+    aclose(outpipe[1]);
+    g_debug("index compress: in-process gzip %s", COMPRESS_BEST_OPT);
+    index_compress_thread = g_thread_create(index_compress_thread_func,
+					    fds, TRUE, NULL);
+    return 0;
+}
+
+/*
+ * Wait for the index compress thread, once the index fd is closed.
+ * Returns FALSE if the compressed index is incomplete.
+ */
+static gboolean
+finish_index_compress(void)
+{
+    gboolean ok;
+
+    if (!index_compress_thread)
+	return TRUE;
+
+    ok = GPOINTER_TO_INT(g_thread_join(index_compress_thread));
+    index_compress_thread = NULL;
+    if (ok) {
+	g_debug("index compress: %llu bytes compressed to %llu bytes",
+		(unsigned long long)amcompress_bytes_in(index_compress),
+		(unsigned long long)amcompress_bytes_out(index_compress));
+    }
+    amcompress_free(index_compress);
+    index_compress = NULL;
+    return ok;
+}
+
+/*
+ * Is the server encryption the native AES-GCM one?  Its decrypt option
+ * names the key file.
+ */
+static gboolean
+native_srv_encrypt(void)
+{
+    return srv_encrypt && g_str_equal(srv_encrypt, AMGCM_ENCRYPT_NAME);
+}
+
+/*
+ * Encrypt the data in a thread of our own: the pipe replaces OUTFD, as
+ * with runencrypt, and the thread writes the AES-GCM stream to OUTFD.
+ * Returns the error message, or NULL, from the thread.
+ */
+static gpointer
+data_encrypt_thread_func(
+    gpointer	data)
+{
+    int *fds = data;
+    int in = fds[0];
+    int out = fds[1];
+    char *buf = g_malloc(DISK_BLOCK_BYTES * 16);
+    char *cbuf;
+    gsize clen;
+    ssize_t nread;
+    char *errmsg = NULL;
+
+    g_free(fds);
+    for (;;) {
+	nread = read(in, buf, DISK_BLOCK_BYTES * 16);
+	if (nread < 0 && errno == EINTR)
+	    continue;
+	if (nread < 0) {
+	    errmsg = g_strdup_printf(_("data encrypt: read: %s"),
+				     strerror(errno));
+	    break;
+	}
+	if (nread == 0)
+	    break;
+	if (errmsg)
+	    continue;	/* drain the pipe so the dumper is not blocked */
+	cbuf = amgcm_stream_update(data_encrypt, buf, (gsize)nread, &clen);
+	if (!cbuf) {
+	    errmsg = g_strdup_printf(_("data encrypt: %s"),
+				     amgcm_stream_error(data_encrypt));
+	} else if (clen > 0 && full_write(out, cbuf, clen) != clen) {
+	    errmsg = g_strdup_printf(_("data encrypt: write: %s"),
+				     strerror(errno));
+	}
+    }
+    if (!errmsg) {
+	cbuf = amgcm_stream_finish(data_encrypt, &clen);
+	if (!cbuf) {
+	    errmsg = g_strdup_printf(_("data encrypt: %s"),
+				     amgcm_stream_error(data_encrypt));
+	} else if (clen > 0 && full_write(out, cbuf, clen) != clen) {
+	    errmsg = g_strdup_printf(_("data encrypt: write: %s"),
+				     strerror(errno));
+	}
+    }
+    if (close(out) != 0 && !errmsg)
+	errmsg = g_strdup_printf(_("data encrypt: close: %s"), strerror(errno));
+    close(in);
+    g_free(buf);
+    return errmsg;
+}
+
+static int
+start_data_encrypt(
+    int		outfd)
+{
+    int  outpipe[2];
+    int *fds;
+    guint8 key[AMGCM_KEY_SIZE];
+    char *errmsg = NULL;
+
+    if (!srv_decrypt_opt ||
+	!amgcm_load_key(srv_decrypt_opt, key, &errmsg) ||
+	!(data_encrypt = amgcm_stream_new(key, AMGCM_DEFAULT_RECORD_SIZE,
+					  &errmsg))) {
+	g_free(errstr);
+	errstr = g_strdup_printf(_("data encrypt: %s"), errmsg ? errmsg :
+			_("no key file given by server-decrypt-option"));
+	g_free(errmsg);
+	memset(key, 0, sizeof(key));
+	return -1;
+    }
+    memset(key, 0, sizeof(key));
+
+    if (pipe(outpipe) < 0) {
+	g_free(errstr);
+	errstr = g_strdup_printf(_("pipe: %s"), strerror(errno));
+	amgcm_stream_free(data_encrypt);
+	data_encrypt = NULL;
+	return -1;
+    }
+    fds = g_new(int, 2);
+    fds[0] = outpipe[0];
+    fds[1] = dup(outfd);
+    if (fds[1] < 0 || dup2(outpipe[1], outfd) < 0) {
+	g_free(errstr);
+	errstr = g_strdup_printf(_("couldn't dup2: %s"), strerror(errno));
+	if (fds[1] >= 0)
+	    close(fds[1]);
+	aclose(outpipe[0]);
+	aclose(outpipe[1]);
+	g_free(fds);
+	amgcm_stream_free(data_encrypt);
+	data_encrypt = NULL;
+	return -1;
+    }
+    aclose(outpipe[1]);
+    g_debug("data encrypt: in-process %s", AMGCM_ENCRYPT_NAME);
+    data_encrypt_thread = g_thread_create(data_encrypt_thread_func,
+					  fds, TRUE, NULL);
+    return 0;
+}
+
+/*
+ * Wait for the data encrypt thread, once the data fd is closed.  Returns
+ * FALSE, with errstr set, if the encrypted data is incomplete.
+ */
+static gboolean
+finish_data_encrypt(void)
+{
+    char *errmsg;
+
+    if (!data_encrypt_thread)
+	return TRUE;
+
+    errmsg = g_thread_join(data_encrypt_thread);
+    data_encrypt_thread = NULL;
+    amgcm_stream_free(data_encrypt);
+    data_encrypt = NULL;
+    if (errmsg) {
+	g_debug("%s", errmsg);
+	if (!errstr)
+	    errstr = errmsg;
+	else
+	    g_free(errmsg);
+	return FALSE;
+    }
+    return TRUE;
+}
+
 /*
  * Runs compress with the first arg as its stdout.  Returns
  * 0 on success or negative if error, and it's pid via the second
@@ -3721,6 +5031,22 @@ bad_nak:
 		    }
 		    if (u)
 		       *u = ';';
+		} else if (strncmp_const_skip_no_var(tok, "wire-compress=", tok) == 0) {
+		    amcompress_algo_t algo;
+		    char *errmsg = NULL;
+
+		    amcompress_free(wire_decompress);
+		    wire_decompress = NULL;
+		    if (!amcompress_algo_from_name(tok, &algo) ||
+			!(wire_decompress = amcompress_new_decompress(algo, &errmsg))) {
+			extra = g_strdup_printf(_("OPTIONS: can't decompress wire-compress=%s: %s"),
+						tok, errmsg ? errmsg : _("unknown algorithm"));
+			g_free(errmsg);
+			goto parse_error;
+		    }
+		    g_debug("wire-compress: client sends %s compressed data", tok);
+		} else if (g_str_equal(tok, "resume")) {
+		    resume_offered = TRUE;
 		}
 		tok = p;
 	    }
@@ -3753,6 +5079,10 @@ bad_nak:
 	    goto connect_error;
 	}
     }
+    if (streams[DATAFD].fd) {
+	security_stream_set_block_size(streams[DATAFD].fd,
+				       am_network_block_size(their_features));
+    }
 
     /*
      * Authenticate the streams
@@ -3820,6 +5150,8 @@ dumper_get_security_conf(
 		    result = src_ip;
         } else if(g_str_equal(string, "ssh_keys")) {
                 result = ssh_keys;
+        } else if(g_str_equal(string, "ssh_control_persist")) {
+                result = server_ssh_control_persist();
         } else if(g_str_equal(string, "kencrypt")) {
 		if (dumper_kencrypt == KENCRYPT_YES)
                     result = "yes";
@@ -3897,8 +5229,12 @@ startup_dump(
     has_timestamp = am_has_feature(their_features, fe_req_options_timestamp);
     has_device    = am_has_feature(their_features, fe_sendbackup_req_device);
     has_data_shm_control_name = am_has_feature(their_features, fe_sendbackup_req_options_data_shm_control_name);
-    crc32_init(&crc_data_in);
-    crc32_init(&crc_data_out);
+    /* a resumed dump goes on with the CRCs of the data already received */
+    if (dump_resumes == 0) {
+	crc32_init(&crc_data_in);
+	crc32_init(&crc_data_out);
+    }
+    crc32_init(&crc_session_in);
     crc32_init(&native_crc);
     crc32_init(&client_crc);
     native_crc.crc = 0;
@@ -3948,6 +5284,33 @@ startup_dump(
         g_string_append_printf(reqbuf, "data-shm-control-name=%s;", shm_name);
     }
 
+    /* offer the client to compress the data on the wire with whatever we
+     * can decompress */
+    amcompress_free(wire_decompress);
+    wire_decompress = NULL;
+    if (am_has_feature(their_features, fe_sendbackup_req_options_wire_compress) &&
+	!shm_name && data_path == DATA_PATH_AMANDA) {
+	static const amcompress_algo_t wire_algos[] = {
+	    AMCOMPRESS_ZSTD, AMCOMPRESS_LZ4, AMCOMPRESS_GZIP
+	};
+	GString *offer = g_string_new(NULL);
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(wire_algos); i++) {
+	    if (amcompress_supported(wire_algos[i]))
+		g_string_append_printf(offer, "%s%s", offer->len ? "," : "",
+				       amcompress_algo_name(wire_algos[i]));
+	}
+	if (offer->len)
+	    g_string_append_printf(reqbuf, "wire-compress=%s;", offer->str);
+	g_string_free(offer, TRUE);
+    }
+
+    resume_offered = FALSE;
+    if (dump_resumes > 0)
+	g_string_append_printf(reqbuf, "resume-offset=%lld;",
+			       (long long)crc_data_in.size);
+
     g_string_append_c(reqbuf, '\n');
 
     amfree(dle_str);
@@ -4017,6 +5380,10 @@ send_result(void)
 	streams[STATEFD].fd == NULL &&
 	filters == NULL
        ) {
+	// the holding file must be written before the shm_ring is consumed
+	if (holding_xfer)
+	    holding_wait(FALSE);
+
 	// shm_ring_* might not be done, wait for them
 	// they are run in separate thread
 	if (g_databuf->shm_ring_consumer) {
@@ -4084,6 +5451,23 @@ send_result_to_driver(void)
 	if (!errstr) errstr = g_strdup(_("got no header information"));
     }
 
+    if (holding_xfer) {
+	holding_wait(dump_result > 1);
+	if (holding_aborted) {
+	    amfree(errstr);
+	    errstr = g_strdup("Aborted by driver");
+	    putresult(ABORT_FINISHED, "%s\n", handle);
+	    dump_result = max(dump_result, 2);
+	    result_sent_to_driver = 1;
+	    chunker_taper_result = FAILED;
+	    return;
+	}
+	if (holding_error) {
+	    dump_result = max(dump_result, 2);
+	    if (!errstr) errstr = g_strdup(holding_error);
+	}
+    }
+
     dumpsize -= headersize;		/* don't count the header */
     if (shm_name) {
         if (g_databuf->shm_ring_producer) {
@@ -4147,13 +5531,35 @@ send_result_to_driver(void)
     m = g_strdup_printf("[%s]", errstr);
     q = quote_string(m);
     amfree(m);
-    putresult(DONE, _("%s %lld %lld %lu %08x:%lld %08x:%lld %s\n"), handle,
+    if (holding_xfer) {
+	/* the result of the holding file, as the chunker gives it */
+	long long holding_kb = (long long)(holding_data_size / 1024);
+	char *qhost = quote_string(hostname);
+
+	log_add_full(L_SUCCESS, "chunker", "%s %s %s %d %08x:%lld [sec %f kb %lld kps %f]",
+		     qhost, qdiskname, dumper_timestamp, level,
+		     holding_crc.crc, (long long)holding_crc.size,
+		     holding_duration, holding_kb,
+		     holding_duration > 0 ? holding_kb / holding_duration : 0.0);
+	g_free(qhost);
+	putresult(DONE, _("%s %lld %lld %lu %08x:%lld %08x:%lld %lld %08x:%lld %s\n"), handle,
 		(long long)origsize,
 		(long long)dumpsize,
 	        (unsigned long)((double)dumptime+0.5),
 		native_crc.crc, (long long)native_crc.size,
 		client_crc.crc, (long long)client_crc.size,
+		holding_kb,
+		holding_crc.crc, (long long)holding_crc.size,
 		q);
+    } else {
+	putresult(DONE, _("%s %lld %lld %lu %08x:%lld %08x:%lld %s\n"), handle,
+		(long long)origsize,
+		(long long)dumpsize,
+	        (unsigned long)((double)dumptime+0.5),
+		native_crc.crc, (long long)native_crc.size,
+		client_crc.crc, (long long)client_crc.size,
+		q);
+    }
     amfree(q);
 
     cmdargs = getcmd();
@@ -49,21 +49,81 @@ static int parse_taper_datestamp_log(char *logline, char **datestamp,
 				     char **level, char **storage, char **pool);
 static gboolean logfile_has_tape(char * label, char * datestamp,
                                  char * logfile);
+static GPtrArray *load_log_records(const char *logfile);
+static void free_log_records(GPtrArray *records);
+static gboolean search_log_records(find_result_t **output_find,
+				   const char *label,
+				   const char *passed_datestamp,
+				   const char *logfile, GPtrArray *records,
+				   disklist_t *dynamic_disklist,
+				   int added_todo);
 
 static char *find_sort_order = NULL;
 static GStringChunk *string_chunk = NULL;
 
+/* most threads find_dump uses to load the log files */
+#define FIND_MAX_THREADS 8
+
+typedef struct find_log_s {
+    char *logfile;
+    char *datestamp;
+    GPtrArray *records;
+} find_log_t;
+
+static void
+find_log_thread(
+    gpointer data,
+    gpointer user_data G_GNUC_UNUSED)
+{
+    find_log_t *fl = data;
+
+    fl->records = load_log_records(fl->logfile);
+}
+
+static void
+add_find_log(
+    GPtrArray *logs,
+    char *logfile,
+    char *datestamp)
+{
+    find_log_t *fl = g_new0(find_log_t, 1);
+
+    fl->logfile = logfile;
+    fl->datestamp = datestamp;
+    g_ptr_array_add(logs, fl);
+}
+
 find_result_t *
 find_dump(
     disklist_t *diskqp,
     int added_todo)
+{
+    GHashTable *tape_seen = g_hash_table_new_full(g_str_hash, g_str_equal,
+						  g_free, NULL);
+    find_result_t *output_find;
+
+    output_find = find_dump_new_datestamps(diskqp, tape_seen, added_todo);
+    g_hash_table_destroy(tape_seen);
+
+    search_holding_disk(&output_find, diskqp, added_todo);
+
+    return(output_find);
+}
+
+find_result_t *
+find_dump_new_datestamps(
+    disklist_t *diskqp,
+    GHashTable *tape_seen,
+    int added_todo)
 {
     char *conf_logdir, *logfile = NULL;
-    int tape, maxtape, logs;
+    int tape, maxtape;
     unsigned seq;
     tape_t *tp;
     find_result_t *output_find = NULL;
-    GHashTable *tape_seen = g_hash_table_new(g_str_hash, g_str_equal);
+    GPtrArray *logs = g_ptr_array_new();
+    guint i;
+    long nthreads;
 
     if (string_chunk == NULL) {
 	string_chunk = g_string_chunk_new(32768);
@@ -80,56 +140,75 @@ find_dump(
 	if (g_hash_table_lookup(tape_seen, tp->datestamp)) {
 	    continue;
 	}
-	g_hash_table_insert(tape_seen, tp->datestamp, GINT_TO_POINTER(1));
+	g_hash_table_insert(tape_seen, g_strdup(tp->datestamp),
+			    GINT_TO_POINTER(1));
 
 	/* search log files */
 
-	logs = 0;
-
 	/* new-style log.<date>.<seq> */
 
 	for(seq = 0; 1; seq++) {
 	    char seq_str[NUM_STR_SIZE];
 
 	    g_snprintf(seq_str, sizeof(seq_str), "%u", seq);
-	    g_free(logfile);
 	    logfile = g_strconcat(conf_logdir, "/log.", tp->datestamp, ".",
 	        seq_str, NULL);
-	    if(access(logfile, R_OK) != 0) break;
-	    if (search_logfile(&output_find, NULL, tp->datestamp,
-                               logfile, diskqp, added_todo)) {
-                logs ++;
-            }
+	    if(access(logfile, R_OK) != 0) {
+		g_free(logfile);
+		break;
+	    }
+	    add_find_log(logs, logfile, tp->datestamp);
 	}
 
 	/* search old-style amflush log, if any */
 
-	g_free(logfile);
 	logfile = g_strconcat(conf_logdir, "/log.", tp->datestamp, ".amflush",
 	    NULL);
 	if(access(logfile,R_OK) == 0) {
-	    if (search_logfile(&output_find, NULL, tp->datestamp,
-                               logfile, diskqp, added_todo)) {
-                logs ++;
-            }
-        }
+	    add_find_log(logs, logfile, tp->datestamp);
+	} else {
+	    g_free(logfile);
+	}
 
 	/* search old-style main log, if any */
 
-	g_free(logfile);
 	logfile = g_strconcat(conf_logdir, "/log.", tp->datestamp, NULL);
 	if(access(logfile,R_OK) == 0) {
-	    if (search_logfile(&output_find, NULL, tp->datestamp,
-                               logfile, diskqp, added_todo)) {
-                logs ++;
-            }
+	    add_find_log(logs, logfile, tp->datestamp);
+	} else {
+	    g_free(logfile);
 	}
     }
-    g_hash_table_destroy(tape_seen);
-    amfree(logfile);
-    amfree(conf_logdir);
 
-    search_holding_disk(&output_find, diskqp, added_todo);
+    /* Parsing the logs is the slow part, and each log is parsed on its own,
+     * so they are loaded in parallel.  The searches, that update the disklist,
+     * are then done in order, as before. */
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads > FIND_MAX_THREADS)
+	nthreads = FIND_MAX_THREADS;
+    if (nthreads > (long)logs->len)
+	nthreads = logs->len;
+    if (nthreads > 1) {
+	GThreadPool *pool = g_thread_pool_new(find_log_thread, NULL, nthreads,
+					      FALSE, NULL);
+	for (i = 0; i < logs->len; i++)
+	    g_thread_pool_push(pool, g_ptr_array_index(logs, i), NULL);
+	g_thread_pool_free(pool, FALSE, TRUE);
+    }
+
+    for (i = 0; i < logs->len; i++) {
+	find_log_t *fl = g_ptr_array_index(logs, i);
+
+	if (!fl->records)
+	    fl->records = load_log_records(fl->logfile);
+	search_log_records(&output_find, NULL, fl->datestamp, fl->logfile,
+			   fl->records, diskqp, added_todo);
+	free_log_records(fl->records);
+	g_free(fl->logfile);
+	g_free(fl);
+    }
+    g_ptr_array_free(logs, TRUE);
+    amfree(conf_logdir);
 
     return(output_find);
 }
@@ -769,38 +848,797 @@ parse_taper_datestamp_log(
     return 1;
 }
 
-/* Returns TRUE if the given logfile mentions the given tape. */
-static gboolean logfile_has_tape(char * label, char * datestamp,
-                                 char * logfile) {
-    FILE * logf;
-    char * ck_datestamp, *ck_label = NULL, *ck_storage = NULL, *ck_pool = NULL;
+/*
+ * Parsed log files
+ *
+ * Parsing the log files is the expensive part of a search, and the same logs
+ * are searched over and over.  Each log is parsed once into a list of
+ * log_rec_t, the lines that matter to the searches, and the list is saved in
+ * FIND_CACHE_DIR next to the log, keyed by the size and mtime of the log.
+ * The results of a search also depend on the tapelist and the disklist, so
+ * the records are kept as they are parsed and search_logfile replays them.
+ */
+
+typedef enum {
+    REC_START,		/* a "START taper" line */
+    REC_BAD_START,	/* a "START taper" line that could not be parsed */
+    REC_RESULT,		/* a dump or part result line */
+} rec_type_t;
+
+/* where the parse of a strange result line stopped */
+typedef enum {
+    STOP_NONE,		/* the line was parsed completely */
+    STOP_EMPTY,		/* nothing after the program */
+    STOP_PART_LABEL,	/* a part line ends after its label */
+    STOP_PART_FILENUM,	/* a part line ends after its file number */
+    STOP_HOST,		/* the line ends after the host name, or later */
+} rec_stop_t;
+
+typedef struct log_rec_s {
+    rec_type_t type;
+    logtype_t curlog;
+    program_t curprog;
+
+    /* REC_START */
+    char *datestamp;
+    char *label;
+    char *storage;
+    char *pool;
+
+    /* REC_BAD_START: the line; REC_RESULT: the message for a strange line */
+    char *line;
+
+    /* REC_RESULT */
+    rec_stop_t stop;
+    char *part_storage;	/* part lines only */
+    char *part_pool;
+    char *part_label;
+    int fileno;
+    char *host;
+    char *disk;
+    char *date;		/* NULL for old logs, that use the log datestamp */
+    int level;
+    int partnum;
+    int totalparts;
+    gboolean nparts;	/* partnum and totalparts were in the line */
+    crc_t native_crc;
+    crc_t client_crc;
+    crc_t server_crc;
+    double sec;
+    off_t kb;
+    off_t bytes;
+    off_t orig_kb;
+    char *rest;
+} log_rec_t;
+
+#define FIND_CACHE_MAGIC "AMFINDC1"
+#define FIND_CACHE_ORDER 0x01020304
+
+static void
+free_log_rec(
+    gpointer data)
+{
+    log_rec_t *rec = data;
+
+    g_free(rec->datestamp);
+    g_free(rec->label);
+    g_free(rec->storage);
+    g_free(rec->pool);
+    g_free(rec->line);
+    g_free(rec->part_storage);
+    g_free(rec->part_pool);
+    g_free(rec->part_label);
+    g_free(rec->host);
+    g_free(rec->disk);
+    g_free(rec->date);
+    g_free(rec->rest);
+    g_free(rec);
+}
+
+static void
+free_log_records(
+    GPtrArray *records)
+{
+    guint i;
+
+    for (i = 0; i < records->len; i++)
+	free_log_rec(g_ptr_array_index(records, i));
+    g_ptr_array_free(records, TRUE);
+}
+
+/* Parse a line read by get_logline_r.  Returns NULL for the lines the
+ * searches do not use.  This runs in the find_dump threads, so it does not
+ * use the get_logline globals. */
+static log_rec_t *
+parse_log_line(
+    const char *logfile,
+    logline_t *ll)
+{
+    logtype_t curlog = ll->curlog;
+    program_t curprog = ll->curprog;
+    char *curstr = ll->curstr;
+    log_rec_t *rec;
+    char *s, *qdisk, *date, *number, *rest, *rest_undo;
+    int ch;
+    crc_t crc1, crc2, crc3;
+
+    if (curlog == L_START && curprog == P_TAPER) {
+	char *ck_datestamp = NULL;
+	char *ck_label = NULL;
+	char *ck_storage = NULL;
+	char *ck_pool = NULL;
+
+	rec = g_new0(log_rec_t, 1);
+	rec->curlog = curlog;
+	rec->curprog = curprog;
+	if (parse_taper_datestamp_log(curstr, &ck_datestamp,
+				      &ck_label, &ck_storage, &ck_pool) == 0) {
+	    rec->type = REC_BAD_START;
+	    rec->line = g_strdup(curstr);
+	    amfree(ck_storage);
+	    amfree(ck_pool);
+	} else {
+	    rec->type = REC_START;
+	    rec->datestamp = g_strdup(ck_datestamp);
+	    rec->label = ck_label;
+	    rec->storage = ck_storage;
+	    rec->pool = ck_pool;
+	}
+	return rec;
+    }
+
+    if (curlog != L_SUCCESS && curlog != L_CHUNKSUCCESS &&
+	curlog != L_DONE    && curlog != L_FAIL &&
+	curlog != L_CHUNK   && curlog != L_PART && curlog != L_PARTIAL &&
+	curlog != L_PARTPARTIAL)
+	return NULL;
+
+    rec = g_new0(log_rec_t, 1);
+    rec->type = REC_RESULT;
+    rec->curlog = curlog;
+    rec->curprog = curprog;
+    rec->partnum = -1;
+    rec->totalparts = -1;
+
+    s = curstr;
+    ch = *s++;
+
+    skip_whitespace(s, ch);
+    if(ch == '\0') {
+	rec->stop = STOP_EMPTY;
+	rec->line = g_strdup_printf(_("strange log line in %s \"%s\"\n"),
+				    logfile, curstr);
+	return rec;
+    }
+
+    if (curlog == L_PART || curlog == L_PARTPARTIAL ||
+	curlog == L_DONE || curlog == L_FAIL || curlog == L_PARTIAL) {
+	char *part_storage;
+	char *qpart_storage;
+	char *part_pool;
+	char *qnext_string;
+	char *next_string;
+
+	qpart_storage = s - 1;
+	skip_quoted_string(s, ch);
+	s[-1] = '\0';
+	part_storage = unquote_string(qpart_storage);
+	if (strcmp(part_storage, "VAULT") == 0) {
+	    g_free(part_storage);
+	    skip_whitespace(s, ch);
+	    qpart_storage = s - 1;
+	    skip_quoted_string(s, ch);
+	    s[-1] = '\0';
+	    part_storage = unquote_string(qpart_storage);
+	}
+	if (strncmp(part_storage, "ST:", 3) == 0) {
+	    char *ps = part_storage;
+	    part_storage = g_strdup(ps+3);
+	    g_free(ps);
+	    skip_whitespace(s, ch);
+	    qnext_string = s - 1;
+	    skip_quoted_string(s, ch);
+	    s[-1] = '\0';
+	    next_string = unquote_string(qnext_string);
+	} else {
+	    next_string = part_storage;
+	    part_storage = g_strdup(get_config_name());
+	}
+
+	if (strncmp(next_string, "POOL:", 5) == 0) {
+	    char *pp = next_string;
+	    part_pool = g_strdup(next_string+5);
+	    g_free(pp);
+	    skip_whitespace(s, ch);
+	    qnext_string = s - 1;
+	    skip_quoted_string(s, ch);
+	    s[-1] = '\0';
+	    next_string = unquote_string(qnext_string);
+	} else {
+	    part_pool = g_strdup(part_storage);
+	}
+
+	if (curlog == L_PART || curlog == L_PARTPARTIAL) {
+	    rec->part_label = next_string;
+	    rec->part_storage = part_storage;
+	    rec->part_pool = part_pool;
+
+	    skip_whitespace(s, ch);
+	    if (ch == '\0') {
+		rec->stop = STOP_PART_LABEL;
+		rec->line = g_strdup_printf("strange log line in %s \"%s\"\n",
+					    logfile, curstr);
+		return rec;
+	    }
+
+	    number = s - 1;
+	    skip_non_whitespace(s, ch);
+	    s[-1] = '\0';
+	    rec->fileno = atoi(number);
+	    if (rec->fileno == 0)
+		return rec;
+
+	    skip_whitespace(s, ch);
+	    if(ch == '\0') {
+		rec->stop = STOP_PART_FILENUM;
+		rec->line = g_strdup_printf("strange log line in %s \"%s\"\n",
+					    logfile, curstr);
+		return rec;
+	    }
+	    rec->host = s - 1;
+	    skip_non_whitespace(s, ch);
+	    s[-1] = '\0';
+	    rec->host = g_strdup(rec->host);
+	} else {
+	    amfree(part_storage);
+	    amfree(part_pool);
+	    rec->host = next_string;
+	}
+    } else {
+	rec->host = s - 1;
+	skip_non_whitespace(s, ch);
+	s[-1] = '\0';
+	rec->host = g_strdup(rec->host);
+    }
+
+    rec->stop = STOP_HOST;
+    skip_whitespace(s, ch);
+    if(ch == '\0') {
+	rec->line = g_strdup_printf(_("strange log line in %s \"%s\"\n"),
+				    logfile, curstr);
+	return rec;
+    }
+    qdisk = s - 1;
+    skip_quoted_string(s, ch);
+    s[-1] = '\0';
+    rec->disk = unquote_string(qdisk);
+
+    skip_whitespace(s, ch);
+    if(ch == '\0') {
+	rec->line = g_strdup_printf(_("strange log line in %s \"%s\"\n"),
+				    logfile, curstr);
+	return rec;
+    }
+    date = s - 1;
+    skip_non_whitespace(s, ch);
+    s[-1] = '\0';
+
+    if(strlen(date) < 3) { /* old log didn't have datestamp */
+	rec->level = atoi(date);
+	rec->partnum = 1;
+	rec->totalparts = 1;
+    } else {
+	if (curprog == P_TAPER &&
+		(curlog == L_CHUNK || curlog == L_PART ||
+		 curlog == L_PARTPARTIAL || curlog == L_PARTIAL ||
+		 curlog == L_DONE)) {
+	    char *s1, ch1;
+	    skip_whitespace(s, ch);
+	    number = s - 1;
+	    skip_non_whitespace(s, ch);
+	    s1 = &s[-1];
+	    ch1 = *s1;
+	    skip_whitespace(s, ch);
+	    if (*(s-1) != '[') {
+		*s1 = ch1;
+		sscanf(number, "%d/%d", &rec->partnum, &rec->totalparts);
+		rec->nparts = TRUE;
+	    } else { /* nparts is not in all PARTIAL lines */
+		rec->partnum = 1;
+		rec->totalparts = 1;
+		s = number + 1;
+	    }
+	} else {
+	    skip_whitespace(s, ch);
+	}
+	if(ch == '\0' || sscanf(s - 1, "%d", &rec->level) != 1) {
+	    rec->line = g_strdup_printf(_("Fstrange log line in %s \"%s\"\n"),
+					logfile, s-1);
+	    return rec;
+	}
+	skip_integer(s, ch);
+	rec->date = g_strdup(date);
+    }
+
+    skip_whitespace(s, ch);
+    if(ch == '\0') {
+	rec->line = g_strdup_printf(_("strange log line in %s \"%s\"\n"),
+				    logfile, curstr);
+	return rec;
+    }
+    rest = s - 1;
+    skip_non_whitespace(s, ch);
+    rest_undo = s - 1;
+    *rest_undo = '\0';
+    crc1.crc = 0;
+    crc1.size = 0;
+    crc2.crc = 0;
+    crc2.size = 0;
+    crc3.crc = 0;
+    crc3.size = 0;
+    if (curlog == L_DONE) {
+	if (!g_str_equal(rest, "[sec")) {
+	    // CRC
+	    parse_crc(rest, &crc1);
+	    skip_whitespace(s, ch);
+	    rest = s - 1;
+	    skip_non_whitespace(s, ch);
+	    rest_undo = s - 1;
+	    *rest_undo = '\0';
+	}
+	if (!g_str_equal(rest, "[sec")) {
+	    // CRC
+	    parse_crc(rest, &crc2);
+	    skip_whitespace(s, ch);
+	    rest = s - 1;
+	    skip_non_whitespace(s, ch);
+	    rest_undo = s - 1;
+	    *rest_undo = '\0';
+	}
+	if (!g_str_equal(rest, "[sec")) {
+	    // CRC
+	    parse_crc(rest, &crc3);
+	    skip_whitespace(s, ch);
+	    rest = s - 1;
+	    skip_non_whitespace(s, ch);
+	    rest_undo = s - 1;
+	    *rest_undo = '\0';
+	}
+    }
+    if (curprog == P_DUMPER) {
+	rec->native_crc = crc1;
+	rec->client_crc = crc2;
+    } else if (curprog == P_CHUNKER) {
+	rec->server_crc = crc1;
+    } else if (curprog == P_TAPER) {
+	rec->native_crc = crc1;
+	rec->client_crc = crc2;
+	rec->server_crc = crc3;
+    }
+    if (g_str_equal(rest, "[sec")) {
+	skip_whitespace(s, ch);
+	if(ch == '\0') {
+	    rec->line = g_strdup_printf(_("strange log line in %s \"%s\"\n"),
+					logfile, curstr);
+	    return rec;
+	}
+	rec->sec = atof(s - 1);
+	skip_non_whitespace(s, ch);
+	skip_whitespace(s, ch);
+	rest = s - 1;
+	skip_non_whitespace(s, ch);
+	rest_undo = s - 1;
+	*rest_undo = '\0';
+	if (!g_str_equal(rest, "kb") &&
+	    !g_str_equal(rest, "bytes")) {
+	    rec->line = g_strdup_printf(_("Bstrange log line in %s \"%s\"\n"),
+					logfile, curstr);
+	    return rec;
+	}
+
+	skip_whitespace(s, ch);
+	if (ch == '\0') {
+	    rec->line = g_strdup_printf(_("strange log line in %s \"%s\"\n"),
+					logfile, curstr);
+	    return rec;
+	}
+	if (g_str_equal(rest, "kb")) {
+	    rec->kb = atof(s - 1);
+	    rec->bytes = 0;
+	} else {
+	    rec->bytes = atof(s - 1);
+	    rec->kb = rec->bytes / 1024;
+	}
+	skip_non_whitespace(s, ch);
+	skip_whitespace(s, ch);
+	rest = s - 1;
+	skip_non_whitespace(s, ch);
+	rest_undo = s - 1;
+	*rest_undo = '\0';
+	if (!g_str_equal(rest, "kps")) {
+	    rec->line = g_strdup_printf(_("Cstrange log line in %s \"%s\"\n"),
+					logfile, curstr);
+	    return rec;
+	}
+
+	skip_whitespace(s, ch);
+	if (ch == '\0') {
+	    rec->line = g_strdup_printf(_("strange log line in %s \"%s\"\n"),
+					logfile, curstr);
+	    return rec;
+	}
+	/* kps = atof(s - 1); */
+	skip_non_whitespace(s, ch);
+	skip_whitespace(s, ch);
+	rest = s - 1;
+	skip_non_whitespace(s, ch);
+	rest_undo = s - 1;
+	*rest_undo = '\0';
+	if (!g_str_equal(rest, "orig-kb")) {
+	    rec->orig_kb = 0;
+	} else {
+
+	    skip_whitespace(s, ch);
+	    if(ch == '\0') {
+		rec->line = g_strdup_printf(_("strange log line in %s \"%s\"\n"),
+					    logfile, curstr);
+		return rec;
+	    }
+	    rec->orig_kb = atof(s - 1);
+	    if (rec->orig_kb < 0)
+		rec->orig_kb = 0;
+	}
+    } else {
+	rec->sec = 0;
+	rec->kb = 0;
+	rec->bytes = 0;
+	rec->orig_kb = 0;
+	*rest_undo = ' ';
+    }
+
+    if (g_str_has_prefix(rest, "error")) rest += 6;
+    if (g_str_has_prefix(rest, "config")) rest += 7;
+    rec->rest = g_strdup(rest);
+    rec->stop = STOP_NONE;
+
+    return rec;
+}
+
+/* The cache file: FIND_CACHE_MAGIC, FIND_CACHE_ORDER, the size and mtime of
+ * the log and the number of records, then the records.  The numbers are in
+ * host byte order, and a string is its 32-bit length (G_MAXUINT32 for NULL)
+ * then its bytes. */
+
+static char *
+cache_filename(
+    const char *logfile)
+{
+    char *dir = g_path_get_dirname(logfile);
+    char *base = g_path_get_basename(logfile);
+    char *filename = g_strjoin("/", dir, FIND_CACHE_DIR, base, NULL);
+
+    g_free(dir);
+    g_free(base);
+    return filename;
+}
+
+static void
+cache_put(
+    GString *buf,
+    const void *data,
+    size_t len)
+{
+    g_string_append_len(buf, data, len);
+}
+
+static void
+cache_put_str(
+    GString *buf,
+    const char *str)
+{
+    guint32 len = str ? strlen(str) : G_MAXUINT32;
+
+    cache_put(buf, &len, sizeof(len));
+    if (str)
+	cache_put(buf, str, len);
+}
+
+static gboolean
+cache_get(
+    const char **p,
+    const char *end,
+    void *data,
+    size_t len)
+{
+    if ((size_t)(end - *p) < len)
+	return FALSE;
+    memcpy(data, *p, len);
+    *p += len;
+    return TRUE;
+}
+
+static gboolean
+cache_get_str(
+    const char **p,
+    const char *end,
+    char **str)
+{
+    guint32 len;
+
+    if (!cache_get(p, end, &len, sizeof(len)))
+	return FALSE;
+    if (len == G_MAXUINT32) {
+	*str = NULL;
+	return TRUE;
+    }
+    if ((size_t)(end - *p) < len)
+	return FALSE;
+    *str = g_strndup(*p, len);
+    *p += len;
+    return TRUE;
+}
+
+#define CACHE_PUT(buf, v) cache_put((buf), &(v), sizeof(v))
+#define CACHE_GET(p, end, v) cache_get((p), (end), &(v), sizeof(v))
+
+static void
+write_log_cache(
+    const char *logfile,
+    struct stat *st,
+    GPtrArray *records)
+{
+    char *filename = cache_filename(logfile);
+    char *dir = g_path_get_dirname(filename);
+    char *tmpname = g_strdup_printf("%s.tmp%ld", filename, (long)getpid());
+    GString *buf = g_string_sized_new(records->len * 128 + 64);
+    guint32 order = FIND_CACHE_ORDER;
+    guint64 size = st->st_size;
+    gint64 mtime = st->st_mtime;
+    guint32 nrecs = records->len;
+    guint i;
+    int fd;
+
+    cache_put(buf, FIND_CACHE_MAGIC, strlen(FIND_CACHE_MAGIC));
+    CACHE_PUT(buf, order);
+    CACHE_PUT(buf, size);
+    CACHE_PUT(buf, mtime);
+    CACHE_PUT(buf, nrecs);
+    for (i = 0; i < records->len; i++) {
+	log_rec_t *rec = g_ptr_array_index(records, i);
+	gint32 n;
+	gint64 o;
+
+	n = rec->type;		CACHE_PUT(buf, n);
+	n = rec->curlog;	CACHE_PUT(buf, n);
+	n = rec->curprog;	CACHE_PUT(buf, n);
+	n = rec->stop;		CACHE_PUT(buf, n);
+	cache_put_str(buf, rec->datestamp);
+	cache_put_str(buf, rec->label);
+	cache_put_str(buf, rec->storage);
+	cache_put_str(buf, rec->pool);
+	cache_put_str(buf, rec->line);
+	cache_put_str(buf, rec->part_storage);
+	cache_put_str(buf, rec->part_pool);
+	cache_put_str(buf, rec->part_label);
+	cache_put_str(buf, rec->host);
+	cache_put_str(buf, rec->disk);
+	cache_put_str(buf, rec->date);
+	cache_put_str(buf, rec->rest);
+	n = rec->fileno;	CACHE_PUT(buf, n);
+	n = rec->level;		CACHE_PUT(buf, n);
+	n = rec->partnum;	CACHE_PUT(buf, n);
+	n = rec->totalparts;	CACHE_PUT(buf, n);
+	n = rec->nparts;	CACHE_PUT(buf, n);
+	CACHE_PUT(buf, rec->native_crc.crc);
+	o = rec->native_crc.size;	CACHE_PUT(buf, o);
+	CACHE_PUT(buf, rec->client_crc.crc);
+	o = rec->client_crc.size;	CACHE_PUT(buf, o);
+	CACHE_PUT(buf, rec->server_crc.crc);
+	o = rec->server_crc.size;	CACHE_PUT(buf, o);
+	CACHE_PUT(buf, rec->sec);
+	o = rec->kb;		CACHE_PUT(buf, o);
+	o = rec->bytes;		CACHE_PUT(buf, o);
+	o = rec->orig_kb;	CACHE_PUT(buf, o);
+    }
+
+    /* the cache is only an optimization; failing to write it is harmless */
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+	g_debug("could not create %s: %s", dir, strerror(errno));
+    } else if ((fd = open(tmpname, O_WRONLY|O_CREAT|O_TRUNC, 0600)) < 0) {
+	g_debug("could not create %s: %s", tmpname, strerror(errno));
+    } else if (full_write(fd, buf->str, buf->len) != buf->len) {
+	g_debug("could not write %s: %s", tmpname, strerror(errno));
+	close(fd);
+	unlink(tmpname);
+    } else if (close(fd) != 0 || rename(tmpname, filename) != 0) {
+	g_debug("could not rename %s to %s: %s", tmpname, filename,
+		strerror(errno));
+	unlink(tmpname);
+    }
+
+    g_string_free(buf, TRUE);
+    g_free(tmpname);
+    g_free(dir);
+    g_free(filename);
+}
+
+/* Read the cached records of LOGFILE, or return NULL if there is no cache
+ * or it is not for the current content of the log. */
+static GPtrArray *
+read_log_cache(
+    const char *logfile,
+    struct stat *st)
+{
+    char *filename = cache_filename(logfile);
+    char *data = NULL;
+    gsize len;
+    const char *p, *end;
+    char magic[sizeof(FIND_CACHE_MAGIC) - 1];
+    guint32 order, nrecs, i;
+    guint64 size;
+    gint64 mtime;
+    GPtrArray *records = NULL;
+    gboolean ok;
+
+    if (!g_file_get_contents(filename, &data, &len, NULL)) {
+	g_free(filename);
+	return NULL;
+    }
+
+    p = data;
+    end = data + len;
+    if (!CACHE_GET(&p, end, magic) ||
+	memcmp(magic, FIND_CACHE_MAGIC, sizeof(magic)) != 0 ||
+	!CACHE_GET(&p, end, order) || order != FIND_CACHE_ORDER ||
+	!CACHE_GET(&p, end, size) || size != (guint64)st->st_size ||
+	!CACHE_GET(&p, end, mtime) || mtime != (gint64)st->st_mtime ||
+	!CACHE_GET(&p, end, nrecs))
+	goto out;
+
+    records = g_ptr_array_sized_new(nrecs);
+    for (i = 0, ok = TRUE; ok && i < nrecs; i++) {
+	log_rec_t *rec = g_new0(log_rec_t, 1);
+	gint32 type, clog, cprog, stop, fileno, level, partnum, totalparts;
+	gint32 nparts;
+	gint64 ncsize, ccsize, scsize, kb, bytes, orig_kb;
+
+	g_ptr_array_add(records, rec);
+	ok = CACHE_GET(&p, end, type) &&
+	     CACHE_GET(&p, end, clog) &&
+	     CACHE_GET(&p, end, cprog) &&
+	     CACHE_GET(&p, end, stop) &&
+	     cache_get_str(&p, end, &rec->datestamp) &&
+	     cache_get_str(&p, end, &rec->label) &&
+	     cache_get_str(&p, end, &rec->storage) &&
+	     cache_get_str(&p, end, &rec->pool) &&
+	     cache_get_str(&p, end, &rec->line) &&
+	     cache_get_str(&p, end, &rec->part_storage) &&
+	     cache_get_str(&p, end, &rec->part_pool) &&
+	     cache_get_str(&p, end, &rec->part_label) &&
+	     cache_get_str(&p, end, &rec->host) &&
+	     cache_get_str(&p, end, &rec->disk) &&
+	     cache_get_str(&p, end, &rec->date) &&
+	     cache_get_str(&p, end, &rec->rest) &&
+	     CACHE_GET(&p, end, fileno) &&
+	     CACHE_GET(&p, end, level) &&
+	     CACHE_GET(&p, end, partnum) &&
+	     CACHE_GET(&p, end, totalparts) &&
+	     CACHE_GET(&p, end, nparts) &&
+	     CACHE_GET(&p, end, rec->native_crc.crc) &&
+	     CACHE_GET(&p, end, ncsize) &&
+	     CACHE_GET(&p, end, rec->client_crc.crc) &&
+	     CACHE_GET(&p, end, ccsize) &&
+	     CACHE_GET(&p, end, rec->server_crc.crc) &&
+	     CACHE_GET(&p, end, scsize) &&
+	     CACHE_GET(&p, end, rec->sec) &&
+	     CACHE_GET(&p, end, kb) &&
+	     CACHE_GET(&p, end, bytes) &&
+	     CACHE_GET(&p, end, orig_kb) &&
+	     type >= REC_START && type <= REC_RESULT &&
+	     stop >= STOP_NONE && stop <= STOP_HOST &&
+	     clog >= 0 && clog < L_MARKER &&
+	     cprog >= 0 && cprog <= P_LAST;
+	if (!ok)
+	    break;
+	rec->type = type;
+	rec->curlog = clog;
+	rec->curprog = cprog;
+	rec->stop = stop;
+	rec->fileno = fileno;
+	rec->level = level;
+	rec->partnum = partnum;
+	rec->totalparts = totalparts;
+	rec->nparts = nparts;
+	rec->native_crc.size = ncsize;
+	rec->client_crc.size = ccsize;
+	rec->server_crc.size = scsize;
+	rec->kb = kb;
+	rec->bytes = bytes;
+	rec->orig_kb = orig_kb;
+    }
+    if (!ok || p != end) {
+	g_debug("ignoring corrupted %s", filename);
+	free_log_records(records);
+	records = NULL;
+    }
+
+out:
+    g_free(data);
+    g_free(filename);
+    return records;
+}
+
+/* Return the records of LOGFILE, from its cache if it is current; the
+ * caller frees them with free_log_records. */
+static GPtrArray *
+load_log_records(
+    const char *logfile)
+{
+    FILE *logf;
+    struct stat st;
+    GPtrArray *records;
+    log_rec_t *rec;
+    logline_t ll;
+
     if((logf = fopen(logfile, "r")) == NULL) {
+	if (errno != ENOENT) {
+	    g_debug("could not open logfile %s: %s", logfile, strerror(errno));
+	}
 	error(_("could not open logfile %s: %s"), logfile, strerror(errno));
 	/*NOTREACHED*/
     }
 
-    while(get_logline(logf)) {
-	if(curlog == L_START && curprog == P_TAPER) {
-	    if(parse_taper_datestamp_log(curstr,
-					 &ck_datestamp, &ck_label, &ck_storage, &ck_pool) == 0) {
-		g_printf(_("strange log line \"start taper %s\" curstr='%s'\n"),
-                         logfile, curstr);
-	    } else if(g_str_equal(ck_datestamp, datestamp)
-		      && g_str_equal(ck_label, label)) {
-		amfree(ck_label);
-		amfree(ck_storage);
-		amfree(ck_pool);
-                afclose(logf);
-                return TRUE;
-	    }
-	    amfree(ck_label);
-	    amfree(ck_storage);
-	    amfree(ck_pool);
-	}
+    if (fstat(fileno(logf), &st) != 0) {
+	st.st_size = -1;
+    } else if ((records = read_log_cache(logfile, &st)) != NULL) {
+	afclose(logf);
+	return records;
     }
 
+    records = g_ptr_array_new();
+    memset(&ll, 0, sizeof(ll));
+    while(get_logline_r(logf, &ll)) {
+	if ((rec = parse_log_line(logfile, &ll)) != NULL)
+	    g_ptr_array_add(records, rec);
+    }
+    free_logline(&ll);
+
+    /* the log may still be written; cache it only if it did not change
+     * while it was read */
+    if (!ferror(logf) && st.st_size >= 0) {
+	struct stat st_end;
+	if (fstat(fileno(logf), &st_end) == 0 &&
+	    st.st_size == st_end.st_size && st.st_mtime == st_end.st_mtime) {
+	    write_log_cache(logfile, &st, records);
+	}
+    }
     afclose(logf);
-    return FALSE;
+
+    return records;
+}
+
+/* Returns TRUE if the given logfile mentions the given tape. */
+static gboolean logfile_has_tape(char * label, char * datestamp,
+                                 char * logfile) {
+    GPtrArray *records = load_log_records(logfile);
+    gboolean found = FALSE;
+    guint i;
+
+    for (i = 0; i < records->len && !found; i++) {
+	log_rec_t *rec = g_ptr_array_index(records, i);
+
+	if (rec->type == REC_BAD_START) {
+	    g_printf(_("strange log line \"start taper %s\" curstr='%s'\n"),
+                     logfile, rec->line);
+	} else if (rec->type == REC_START &&
+		   g_str_equal(rec->datestamp, datestamp) &&
+		   g_str_equal(rec->label, label)) {
+	    found = TRUE;
+	}
+    }
+
+    free_log_records(records);
+    return found;
 }
 
 static gboolean
@@ -827,39 +1665,33 @@ volume_matches(
     return TRUE;
 }
 
-/* WARNING: Function accesses globals find_diskqp, curlog, curlog, curstr,
- * dynamic_disklist */
-gboolean
-search_logfile(
+/* The search_logfile of the already loaded RECORDS of LOGFILE.
+ * WARNING: Function accesses globals find_diskqp, dynamic_disklist */
+static gboolean
+search_log_records(
     find_result_t **output_find,
     const char *label,
     const char *passed_datestamp,
     const char *logfile,
+    GPtrArray *records,
     disklist_t * dynamic_disklist,
     int added_todo)
 {
-    FILE *logf;
-    char *host = NULL;
-    char *disk = NULL, *qdisk, *disk_undo;
-    char *date = NULL, *date_undo;
+    log_rec_t *rec;
+    guint i;
+    char *host;
+    char *disk;
+    char *date;
     int  partnum;
     int  totalparts;
     int  maxparts = -1;
-    char *number;
-    int fileno;
     char *current_label;
     char *current_storage;
     char *current_pool;
-    char *rest, *rest_undo;
-    char *ck_label=NULL;
-    char *ck_storage=NULL;
-    char *ck_pool=NULL;
+    char *rest;
     int level = 0;
     off_t filenum;
-    char *ck_datestamp=NULL;
     char *datestamp;
-    char *s;
-    int ch;
     disk_t *dp;
     GHashTable* valid_label;
     GHashTable* part_by_dle;
@@ -872,13 +1704,11 @@ search_logfile(
     off_t bytes;
     off_t orig_kb;
     int   taper_part = 0;
-    crc_t crc1, crc2, crc3;
     crc_t native_crc;
     crc_t client_crc;
     crc_t server_crc;
-
-    g_return_val_if_fail(output_find != NULL, 0);
-    g_return_val_if_fail(logfile != NULL, 0);
+    logtype_t curlog;
+    program_t curprog;
 
     current_label = g_strdup("");
     current_storage = g_strdup("");
@@ -890,57 +1720,45 @@ search_logfile(
     part_by_dle = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
     datestamp = g_strdup(passed_datestamp);
 
-    if((logf = fopen(logfile, "r")) == NULL) {
-	if (errno != ENOENT) {
-	    g_debug("could not open logfile %s: %s", logfile, strerror(errno));
-	}
-	error(_("could not open logfile %s: %s"), logfile, strerror(errno));
-	/*NOTREACHED*/
-    }
-
     filenum = (off_t)0;
-    while(get_logline(logf)) {
-	if (curlog == L_START && curprog == P_TAPER) {
-	    amfree(ck_label);
-	    amfree(ck_storage);
-	    amfree(ck_pool);
-	    ck_datestamp = NULL;
-	    if(parse_taper_datestamp_log(curstr, &ck_datestamp,
-                                         &ck_label, &ck_storage, &ck_pool) == 0) {
-		g_printf(_("strange log line in %s \"start taper %s\"\n"),
-                         logfile, curstr);
-                continue;
-	    }
+    for (i = 0; i < records->len; i++) {
+	rec = g_ptr_array_index(records, i);
+	curlog = rec->curlog;
+	curprog = rec->curprog;
+
+	if (rec->type == REC_BAD_START) {
+	    g_printf(_("strange log line in %s \"start taper %s\"\n"),
+                     logfile, rec->line);
+	    continue;
+	}
+	if (rec->type == REC_START) {
             if (datestamp != NULL) {
-                if (!g_str_equal(datestamp, ck_datestamp)) {
+                if (!g_str_equal(datestamp, rec->datestamp)) {
                     g_printf(_("Log file %s stamped %s, expecting %s!\n"),
-                             logfile, ck_datestamp, datestamp);
-		    amfree(ck_label);
+                             logfile, rec->datestamp, datestamp);
                     break;
                 }
             }
 
-            right_label = volume_matches(label, ck_label, ck_datestamp);
-	    if (right_label && ck_label) {
-		g_hash_table_insert(valid_label, g_strdup(ck_label),
+            right_label = volume_matches(label, rec->label, rec->datestamp);
+	    if (right_label && rec->label) {
+		g_hash_table_insert(valid_label, g_strdup(rec->label),
 				    GINT_TO_POINTER(1));
 	    }
 	    if (label && datestamp && right_label) {
 		found_something = TRUE;
 	    }
             amfree(current_label);
-            current_label = ck_label;
-	    ck_label = NULL;
+            current_label = g_strdup(rec->label);
             amfree(current_storage);
-            current_storage = ck_storage;
-	    ck_storage = NULL;
+            current_storage = g_strdup(rec->storage);
             amfree(current_pool);
-            current_pool = ck_pool;
-	    ck_pool = NULL;
+            current_pool = g_strdup(rec->pool);
             if (datestamp == NULL) {
-                datestamp = g_strdup(ck_datestamp);
+                datestamp = g_strdup(rec->datestamp);
             }
 	    filenum = (off_t)0;
+	    continue;
 	}
 	if (!datestamp)
 	    continue;
@@ -953,556 +1771,297 @@ search_logfile(
 		   taper_part == 0) {
 	    filenum++;
 	}
-	partnum = -1;
-	totalparts = -1;
-	if (curlog == L_SUCCESS || curlog == L_CHUNKSUCCESS ||
-	    curlog == L_DONE    || curlog == L_FAIL ||
-	    curlog == L_CHUNK   || curlog == L_PART || curlog == L_PARTIAL ||
-	    curlog == L_PARTPARTIAL ) {
-	    s = curstr;
-	    ch = *s++;
-
-	    skip_whitespace(s, ch);
-	    if(ch == '\0') {
-		g_printf(_("strange log line in %s \"%s\"\n"),
-		    logfile, curstr);
-		continue;
-	    }
-
-	    if (curlog == L_PART || curlog == L_PARTPARTIAL ||
-		curlog == L_DONE || curlog == L_FAIL || curlog == L_PARTIAL) {
-		char *part_storage;
-		char *qpart_storage;
-		char *part_pool;
-		char *part_label;
-		char *qnext_string;
-		char *next_string;
-		taper_part++;
-
-		qpart_storage = s - 1;
-		skip_quoted_string(s, ch);
-		s[-1] = '\0';
-		part_storage = unquote_string(qpart_storage);
-		if (strcmp(part_storage, "VAULT") == 0) {
-		    g_free(part_storage);
-		    skip_whitespace(s, ch);
-		    qpart_storage = s - 1;
-		    skip_quoted_string(s, ch);
-		    s[-1] = '\0';
-		    part_storage = unquote_string(qpart_storage);
-		}
-		if (strncmp(part_storage, "ST:", 3) == 0) {
-		    char *ps = part_storage;
-		    part_storage = g_strdup(ps+3);
-		    g_free(ps);
-		    skip_whitespace(s, ch);
-		    qnext_string = s - 1;
-		    skip_quoted_string(s, ch);
-		    s[-1] = '\0';
-		    next_string = unquote_string(qnext_string);
-		} else {
-		    next_string = part_storage;
-		    part_storage = g_strdup(get_config_name());
-		}
 
-		if (strncmp(next_string, "POOL:", 5) == 0) {
-		    char *pp = next_string;
-		    part_pool = g_strdup(next_string+5);
-		    g_free(pp);
-		    skip_whitespace(s, ch);
-		    qnext_string = s - 1;
-		    skip_quoted_string(s, ch);
-		    s[-1] = '\0';
-		    next_string = unquote_string(qnext_string);
-		} else {
-		    part_pool = g_strdup(part_storage);
-		}
-
-		if (curlog == L_PART || curlog == L_PARTPARTIAL) {
-		    part_label = next_string;
-		    if (!g_hash_table_lookup(valid_label, part_label)) {
-			amfree(part_label);
-			amfree(part_storage);
-			amfree(part_pool);
-			continue;
-		    }
-		    amfree(current_label);
-		    current_label = part_label;
-		    amfree(current_storage);
-		    current_storage = part_storage;
-		    amfree(current_pool);
-		    current_pool = part_pool;
-
-		    skip_whitespace(s, ch);
-		    if (ch == '\0') {
-			g_printf("strange log line in %s \"%s\"\n",
-			   logfile, curstr);
-			continue;
-		    }
-
-		    number = s - 1;
-		    skip_non_whitespace(s, ch);
-		    s[-1] = '\0';
-		    fileno = atoi(number);
-		    filenum = fileno;
-		    if (filenum == 0)
-			continue;
-
-		    skip_whitespace(s, ch);
-		    if(ch == '\0') {
-			g_printf("strange log line in %s \"%s\"\n",
-			   logfile, curstr);
-			continue;
-		    }
-		    amfree(host);
-		    host = s - 1;
-		    skip_non_whitespace(s, ch);
-		    s[-1] = '\0';
-		    host = g_strdup(host);
-		} else {
-		    amfree(part_storage);
-		    amfree(part_pool);
-		    amfree(host);
-		    host = next_string;
-		}
-	    } else {
-		taper_part = 0;
-		    amfree(host);
-		host = s - 1;
-		skip_non_whitespace(s, ch);
-		s[-1] = '\0';
-		host = g_strdup(host);
-	    }
-
-	    skip_whitespace(s, ch);
-	    if(ch == '\0') {
-		g_printf(_("strange log line in %s \"%s\"\n"),
-		    logfile, curstr);
-		continue;
-	    }
-	    qdisk = s - 1;
-	    skip_quoted_string(s, ch);
-	    disk_undo = s - 1;
-	    *disk_undo = '\0';
-	    amfree(disk);
-	    disk = unquote_string(qdisk);
+	if (rec->stop == STOP_EMPTY) {
+	    g_printf("%s", rec->line);
+	    continue;
+	}
 
-	    skip_whitespace(s, ch);
-	    if(ch == '\0') {
-		g_printf(_("strange log line in %s \"%s\"\n"),
-                         logfile, curstr);
-		amfree(disk);
-		continue;
-	    }
-	    amfree(date);
-	    date = s - 1;
-	    skip_non_whitespace(s, ch);
-	    date_undo = s - 1;
-	    *date_undo = '\0';
-	    date = g_strdup(date);
-
-	    if(strlen(date) < 3) { /* old log didn't have datestamp */
-		level = atoi(date);
-		date = g_strdup(datestamp);
-		partnum = 1;
-		totalparts = 1;
-	    } else {
-		if (curprog == P_TAPER &&
-			(curlog == L_CHUNK || curlog == L_PART ||
-			 curlog == L_PARTPARTIAL || curlog == L_PARTIAL ||
-			 curlog == L_DONE)) {
-		    char *s1, ch1;
-		    skip_whitespace(s, ch);
-		    number = s - 1;
-		    skip_non_whitespace(s, ch);
-		    s1 = &s[-1];
-		    ch1 = *s1;
-		    skip_whitespace(s, ch);
-		    if (*(s-1) != '[') {
-			*s1 = ch1;
-			sscanf(number, "%d/%d", &partnum, &totalparts);
-			if (partnum > maxparts)
-			    maxparts = partnum;
-			if (totalparts > maxparts)
-			    maxparts = totalparts;
-		    } else { /* nparts is not in all PARTIAL lines */
-			partnum = 1;
-			totalparts = 1;
-			s = number + 1;
-		    }
-		} else {
-		    skip_whitespace(s, ch);
-		}
-		if(ch == '\0' || sscanf(s - 1, "%d", &level) != 1) {
-		    g_printf(_("Fstrange log line in %s \"%s\"\n"),
-		    logfile, s-1);
-		    amfree(disk);
-		    continue;
-		}
-		skip_integer(s, ch);
-	    }
+	if (curlog == L_PART || curlog == L_PARTPARTIAL ||
+	    curlog == L_DONE || curlog == L_FAIL || curlog == L_PARTIAL) {
+	    taper_part++;
 
-	    skip_whitespace(s, ch);
-	    if(ch == '\0') {
-		g_printf(_("strange log line in %s \"%s\"\n"),
-		    logfile, curstr);
-		amfree(disk);
-		continue;
-	    }
-	    rest = s - 1;
-	    skip_non_whitespace(s, ch);
-	    rest_undo = s - 1;
-	    *rest_undo = '\0';
-	    crc1.crc = 0;
-	    crc1.size = 0;
-	    crc2.crc = 0;
-	    crc2.size = 0;
-	    crc3.crc = 0;
-	    crc3.size = 0;
-	    if (curlog == L_DONE) {
-		if (!g_str_equal(rest, "[sec")) {
-		    // CRC
-		    parse_crc(rest, &crc1);
-		    skip_whitespace(s, ch);
-		    rest = s - 1;
-		    skip_non_whitespace(s, ch);
-		    rest_undo = s - 1;
-		    *rest_undo = '\0';
-		}
-		if (!g_str_equal(rest, "[sec")) {
-		    // CRC
-		    parse_crc(rest, &crc2);
-		    skip_whitespace(s, ch);
-		    rest = s - 1;
-		    skip_non_whitespace(s, ch);
-		    rest_undo = s - 1;
-		    *rest_undo = '\0';
-		}
-		if (!g_str_equal(rest, "[sec")) {
-		    // CRC
-		    parse_crc(rest, &crc3);
-		    skip_whitespace(s, ch);
-		    rest = s - 1;
-		    skip_non_whitespace(s, ch);
-		    rest_undo = s - 1;
-		    *rest_undo = '\0';
-		}
-	    }
-	    native_crc.crc = 0;
-	    native_crc.size = 0;
-	    client_crc.crc = 0;
-	    client_crc.size = 0;
-	    server_crc.crc = 0;
-	    server_crc.size = 0;
-	    if (curprog == P_DUMPER) {
-		native_crc = crc1;
-		client_crc = crc2;
-	    } else if (curprog == P_CHUNKER) {
-		server_crc = crc1;
-	    } else if (curprog == P_TAPER) {
-		native_crc = crc1;
-		client_crc = crc2;
-		server_crc = crc3;
-	    }
-	    if (g_str_equal(rest, "[sec")) {
-		skip_whitespace(s, ch);
-		if(ch == '\0') {
-		    g_printf(_("strange log line in %s \"%s\"\n"),
-			     logfile, curstr);
-		    amfree(disk);
+	    if (curlog == L_PART || curlog == L_PARTPARTIAL) {
+		if (!g_hash_table_lookup(valid_label, rec->part_label)) {
 		    continue;
 		}
-		sec = atof(s - 1);
-		skip_non_whitespace(s, ch);
-		skip_whitespace(s, ch);
-		rest = s - 1;
-		skip_non_whitespace(s, ch);
-		rest_undo = s - 1;
-		*rest_undo = '\0';
-		if (!g_str_equal(rest, "kb") &&
-		    !g_str_equal(rest, "bytes")) {
-		    g_printf(_("Bstrange log line in %s \"%s\"\n"),
-			     logfile, curstr);
-		    amfree(disk);
+		amfree(current_label);
+		current_label = g_strdup(rec->part_label);
+		amfree(current_storage);
+		current_storage = g_strdup(rec->part_storage);
+		amfree(current_pool);
+		current_pool = g_strdup(rec->part_pool);
+
+		if (rec->stop == STOP_PART_LABEL) {
+		    g_printf("%s", rec->line);
 		    continue;
 		}
 
-		skip_whitespace(s, ch);
-		if (ch == '\0') {
-		     g_printf(_("strange log line in %s \"%s\"\n"),
-			      logfile, curstr);
-		     amfree(disk);
-		     continue;
-		}
-		if (g_str_equal(rest, "kb")) {
-		    kb = atof(s - 1);
-		    bytes = 0;
-		} else {
-		    bytes = atof(s - 1);
-		    kb = bytes / 1024;
-		}
-		skip_non_whitespace(s, ch);
-		skip_whitespace(s, ch);
-		rest = s - 1;
-		skip_non_whitespace(s, ch);
-		rest_undo = s - 1;
-		*rest_undo = '\0';
-		if (!g_str_equal(rest, "kps")) {
-		    g_printf(_("Cstrange log line in %s \"%s\"\n"),
-			     logfile, curstr);
-		    amfree(disk);
+		filenum = rec->fileno;
+		if (filenum == 0)
 		    continue;
-		}
 
-		skip_whitespace(s, ch);
-		if (ch == '\0') {
-		    g_printf(_("strange log line in %s \"%s\"\n"),
-			     logfile, curstr);
-		    amfree(disk);
+		if (rec->stop == STOP_PART_FILENUM) {
+		    g_printf("%s", rec->line);
 		    continue;
 		}
-		/* kps = atof(s - 1); */
-		skip_non_whitespace(s, ch);
-		skip_whitespace(s, ch);
-		rest = s - 1;
-		skip_non_whitespace(s, ch);
-		rest_undo = s - 1;
-		*rest_undo = '\0';
-		if (!g_str_equal(rest, "orig-kb")) {
-		    orig_kb = 0;
-		} else {
-
-		    skip_whitespace(s, ch);
-		    if(ch == '\0') {
-			g_printf(_("strange log line in %s \"%s\"\n"),
-				 logfile, curstr);
-			amfree(disk);
-			continue;
-		    }
-		    orig_kb = atof(s - 1);
-		    if (orig_kb < 0)
-			orig_kb = 0;
-		}
-	    } else {
-		sec = 0;
-		kb = 0;
-		bytes = 0;
-		orig_kb = 0;
-		*rest_undo = ' ';
 	    }
+	} else {
+	    taper_part = 0;
+	}
 
-	    if (g_str_has_prefix(rest, "error")) rest += 6;
-	    if (g_str_has_prefix(rest, "config")) rest += 7;
+	if (rec->nparts) {
+	    if (rec->partnum > maxparts)
+		maxparts = rec->partnum;
+	    if (rec->totalparts > maxparts)
+		maxparts = rec->totalparts;
+	}
+	if (rec->stop != STOP_NONE) {
+	    g_printf("%s", rec->line);
+	    continue;
+	}
 
-	    dp = lookup_disk(host,disk);
-	    if ( dp == NULL ) {
-		if (dynamic_disklist == NULL) {
-		    amfree(disk);
-		    continue;
-		}
-		dp = add_disk(dynamic_disklist, host, disk);
-		dp->todo = added_todo;
+	host = rec->host;
+	disk = rec->disk;
+	date = rec->date ? rec->date : datestamp;
+	level = rec->level;
+	partnum = rec->partnum;
+	totalparts = rec->totalparts;
+	native_crc = rec->native_crc;
+	client_crc = rec->client_crc;
+	server_crc = rec->server_crc;
+	sec = rec->sec;
+	kb = rec->kb;
+	bytes = rec->bytes;
+	orig_kb = rec->orig_kb;
+	rest = rec->rest;
+
+	dp = lookup_disk(host,disk);
+	if ( dp == NULL ) {
+	    if (dynamic_disklist == NULL) {
+		continue;
 	    }
-            if (find_match(host, disk)) {
-		if(curprog == P_TAPER) {
-		    char *key = g_strdup_printf(
-					"HOST:%s DISK:%s: DATE:%s LEVEL:%d",
-					host, disk, date, level);
-		    find_result_t *new_output_find = g_new0(find_result_t, 1);
-		    part_find = g_hash_table_lookup(part_by_dle, key);
-		    maxparts = partnum;
-		    if (maxparts < totalparts)
-			maxparts = totalparts;
-		    for (a_part_find = part_find;
-			 a_part_find;
-			 a_part_find = a_part_find->next) {
-			if (maxparts < a_part_find->partnum)
-			    maxparts = a_part_find->partnum;
-			if (maxparts < a_part_find->totalparts)
-			    maxparts = a_part_find->totalparts;
-		    }
-		    new_output_find->timestamp = g_string_chunk_insert_const(string_chunk, date);
-		    new_output_find->write_timestamp = g_string_chunk_insert_const(string_chunk, datestamp);
-		    new_output_find->hostname=g_string_chunk_insert_const(string_chunk, host);
-		    new_output_find->diskname=g_string_chunk_insert_const(string_chunk, disk);
-		    new_output_find->level=level;
-		    new_output_find->partnum = partnum;
-		    new_output_find->totalparts = totalparts;
-		    new_output_find->label=g_string_chunk_insert_const(string_chunk, current_label);
-		    if (current_storage) {
-			new_output_find->storage=g_string_chunk_insert_const(string_chunk, current_storage);
-		    }
-		    if (current_pool) {
-			new_output_find->pool=g_string_chunk_insert_const(string_chunk, current_pool);
-		    }
-		    new_output_find->status=NULL;
-		    new_output_find->dump_status=NULL;
-		    new_output_find->message="";
-		    new_output_find->filenum=filenum;
-		    new_output_find->sec=sec;
-		    new_output_find->kb=kb;
-		    new_output_find->bytes=bytes;
-		    new_output_find->orig_kb=orig_kb;
-		    new_output_find->next=NULL;
-		    new_output_find->native_crc = native_crc;
-		    new_output_find->client_crc = client_crc;
-		    new_output_find->server_crc = server_crc;
-		    if (curlog == L_SUCCESS) {
-			new_output_find->status = "OK";
-			new_output_find->dump_status = "OK";
-			new_output_find->next = *output_find;
-			new_output_find->partnum = 1; /* L_SUCCESS is pre-splitting */
-			*output_find = new_output_find;
-                        found_something = TRUE;
-		    } else if (curlog == L_CHUNKSUCCESS || curlog == L_DONE ||
-			       curlog == L_PARTIAL      || curlog == L_FAIL) {
-			/* result line */
-			if (curlog == L_PARTIAL || curlog == L_FAIL) {
-			    /* set dump_status of each part */
+	    dp = add_disk(dynamic_disklist, host, disk);
+	    dp->todo = added_todo;
+	}
+	if (find_match(host, disk)) {
+	    if(curprog == P_TAPER) {
+		char *key = g_strdup_printf(
+				    "HOST:%s DISK:%s: DATE:%s LEVEL:%d",
+				    host, disk, date, level);
+		find_result_t *new_output_find = g_new0(find_result_t, 1);
+		part_find = g_hash_table_lookup(part_by_dle, key);
+		maxparts = partnum;
+		if (maxparts < totalparts)
+		    maxparts = totalparts;
+		for (a_part_find = part_find;
+		     a_part_find;
+		     a_part_find = a_part_find->next) {
+		    if (maxparts < a_part_find->partnum)
+			maxparts = a_part_find->partnum;
+		    if (maxparts < a_part_find->totalparts)
+			maxparts = a_part_find->totalparts;
+		}
+		new_output_find->timestamp = g_string_chunk_insert_const(string_chunk, date);
+		new_output_find->write_timestamp = g_string_chunk_insert_const(string_chunk, datestamp);
+		new_output_find->hostname=g_string_chunk_insert_const(string_chunk, host);
+		new_output_find->diskname=g_string_chunk_insert_const(string_chunk, disk);
+		new_output_find->level=level;
+		new_output_find->partnum = partnum;
+		new_output_find->totalparts = totalparts;
+		new_output_find->label=g_string_chunk_insert_const(string_chunk, current_label);
+		if (current_storage) {
+		    new_output_find->storage=g_string_chunk_insert_const(string_chunk, current_storage);
+		}
+		if (current_pool) {
+		    new_output_find->pool=g_string_chunk_insert_const(string_chunk, current_pool);
+		}
+		new_output_find->status=NULL;
+		new_output_find->dump_status=NULL;
+		new_output_find->message="";
+		new_output_find->filenum=filenum;
+		new_output_find->sec=sec;
+		new_output_find->kb=kb;
+		new_output_find->bytes=bytes;
+		new_output_find->orig_kb=orig_kb;
+		new_output_find->next=NULL;
+		new_output_find->native_crc = native_crc;
+		new_output_find->client_crc = client_crc;
+		new_output_find->server_crc = server_crc;
+		if (curlog == L_SUCCESS) {
+		    new_output_find->status = "OK";
+		    new_output_find->dump_status = "OK";
+		    new_output_find->next = *output_find;
+		    new_output_find->partnum = 1; /* L_SUCCESS is pre-splitting */
+		    *output_find = new_output_find;
+		    found_something = TRUE;
+		} else if (curlog == L_CHUNKSUCCESS || curlog == L_DONE ||
+			   curlog == L_PARTIAL      || curlog == L_FAIL) {
+		    /* result line */
+		    if (curlog == L_PARTIAL || curlog == L_FAIL) {
+			/* set dump_status of each part */
+			for (a_part_find = part_find;
+			     a_part_find;
+			     a_part_find = a_part_find->next) {
+			    char *urest = unquote_string(rest);
+			    if (curlog == L_PARTIAL)
+				a_part_find->dump_status = "PARTIAL";
+			    else {
+				a_part_find->dump_status = "FAIL";
+			    }
+			    a_part_find->message = g_string_chunk_insert_const(string_chunk, urest);
+			    amfree(urest);
+			}
+		    } else {
+			if (maxparts > -1) { /* format with part */
+			    /* must check if all part are there */
+			    int num_part = maxparts;
 			    for (a_part_find = part_find;
 				 a_part_find;
 				 a_part_find = a_part_find->next) {
-				char *urest = unquote_string(rest);
-				if (curlog == L_PARTIAL)
-				    a_part_find->dump_status = "PARTIAL";
-				else {
-				    a_part_find->dump_status = "FAIL";
-				}
-				a_part_find->message = g_string_chunk_insert_const(string_chunk, urest);
-				amfree(urest);
+				if (a_part_find->partnum == num_part &&
+				    g_str_equal(a_part_find->status, "OK"))
+				    num_part--;
 			    }
-			} else {
-			    if (maxparts > -1) { /* format with part */
-				/* must check if all part are there */
-				int num_part = maxparts;
-				for (a_part_find = part_find;
-				     a_part_find;
-				     a_part_find = a_part_find->next) {
-				    if (a_part_find->partnum == num_part &&
-					g_str_equal(a_part_find->status, "OK"))
-					num_part--;
-			        }
-				/* set dump_status of each part */
-				for (a_part_find = part_find;
-				     a_part_find;
-				     a_part_find = a_part_find->next) {
-				    if (num_part == 0) {
-					a_part_find->dump_status = "OK";
-				    } else {
-					a_part_find->dump_status = "FAIL";
-					a_part_find->message =
-						g_string_chunk_insert_const(string_chunk, "Missing part");
-				    }
-				}
-			    }
-			}
-			if (curlog == L_DONE) {
+			    /* set dump_status of each part */
 			    for (a_part_find = part_find;
 				 a_part_find;
-			         a_part_find = a_part_find->next) {
-				if (a_part_find->totalparts == -1) {
-				    a_part_find->totalparts = maxparts;
-				}
-				if (a_part_find->orig_kb == 0) {
-				    a_part_find->orig_kb = orig_kb;
+				 a_part_find = a_part_find->next) {
+				if (num_part == 0) {
+				    a_part_find->dump_status = "OK";
+				} else {
+				    a_part_find->dump_status = "FAIL";
+				    a_part_find->message =
+					    g_string_chunk_insert_const(string_chunk, "Missing part");
 				}
-				a_part_find->native_crc = native_crc;
-				a_part_find->client_crc = client_crc;
-				a_part_find->server_crc = server_crc;
 			    }
 			}
-			if (part_find) { /* find last element */
-			    for (a_part_find = part_find;
-				 a_part_find->next != NULL;
-				 a_part_find=a_part_find->next) {
+		    }
+		    if (curlog == L_DONE) {
+			for (a_part_find = part_find;
+			     a_part_find;
+			     a_part_find = a_part_find->next) {
+			    if (a_part_find->totalparts == -1) {
+				a_part_find->totalparts = maxparts;
 			    }
-			    /* merge part_find to *output_find */
-			    a_part_find->next = *output_find;
-			    *output_find = part_find;
-			    part_find = NULL;
-			    maxparts = -1;
-                            found_something = TRUE;
-			    g_hash_table_remove(part_by_dle, key);
-			}
-			free_find_result(&new_output_find);
-		    } else { /* part line */
-			if (curlog == L_PART || curlog == L_CHUNK) {
-			    new_output_find->status = "OK";
-			    new_output_find->dump_status = "OK";
-			} else { /* PARTPARTIAL */
-			    new_output_find->status = "PARTIAL";
-			    new_output_find->dump_status = "PARTIAL";
+			    if (a_part_find->orig_kb == 0) {
+				a_part_find->orig_kb = orig_kb;
+			    }
+			    a_part_find->native_crc = native_crc;
+			    a_part_find->client_crc = client_crc;
+			    a_part_find->server_crc = server_crc;
 			}
-			/* Add to part_find list */
-			if (part_find) {
-			    new_output_find->next = part_find;
-			    part_find = new_output_find;
-			} else {
-			    new_output_find->next = NULL;
-			    part_find = new_output_find;
+		    }
+		    if (part_find) { /* find last element */
+			for (a_part_find = part_find;
+			     a_part_find->next != NULL;
+			     a_part_find=a_part_find->next) {
 			}
-			g_hash_table_insert(part_by_dle, g_strdup(key),
-					    part_find);
+			/* merge part_find to *output_find */
+			a_part_find->next = *output_find;
+			*output_find = part_find;
+			part_find = NULL;
+			maxparts = -1;
 			found_something = TRUE;
+			g_hash_table_remove(part_by_dle, key);
 		    }
-		    amfree(key);
-		}
-		else if(curlog == L_FAIL) {
-		    char *status_failed;
-		    /* print other failures too -- this is a hack to ensure that failures which
-		     * did not make it to tape are also listed in the output of 'amadmin x find';
-		     * users that do not want this information (e.g., Amanda::DB::Catalog) should
-		     * filter dumps with a NULL label. */
-		    find_result_t *new_output_find = g_new0(find_result_t, 1);
-		    new_output_find->next = *output_find;
-		    new_output_find->timestamp = g_string_chunk_insert_const(string_chunk, date);
-		    new_output_find->write_timestamp = g_string_chunk_insert_const(string_chunk, "00000000000000"); /* dump was not written.. */
-		    new_output_find->hostname=g_string_chunk_insert_const(string_chunk, host);
-		    new_output_find->diskname=g_string_chunk_insert_const(string_chunk, disk);
-		    if (current_storage != NULL) {
-			new_output_find->storage=g_string_chunk_insert_const(string_chunk, current_storage);
+		    free_find_result(&new_output_find);
+		} else { /* part line */
+		    if (curlog == L_PART || curlog == L_CHUNK) {
+			new_output_find->status = "OK";
+			new_output_find->dump_status = "OK";
+		    } else { /* PARTPARTIAL */
+			new_output_find->status = "PARTIAL";
+			new_output_find->dump_status = "PARTIAL";
 		    }
-		    if (current_pool != NULL) {
-			new_output_find->pool=g_string_chunk_insert_const(string_chunk, current_pool);
+		    /* Add to part_find list */
+		    if (part_find) {
+			new_output_find->next = part_find;
+			part_find = new_output_find;
+		    } else {
+			new_output_find->next = NULL;
+			part_find = new_output_find;
 		    }
-		    new_output_find->level=level;
-		    new_output_find->label=NULL;
-		    new_output_find->partnum=partnum;
-		    new_output_find->totalparts=totalparts;
-		    new_output_find->filenum=0;
-		    new_output_find->sec=sec;
-		    new_output_find->kb=kb;
-		    new_output_find->bytes=bytes;
-		    new_output_find->orig_kb=orig_kb;
-		    status_failed = g_strjoin(NULL,
-			 "FAILED (",
-			 program_str[(int)curprog],
-			 ") ",
-			 rest,
-			 NULL);
-		    new_output_find->status = g_string_chunk_insert_const(string_chunk, status_failed);
-		    amfree(status_failed);
-		    new_output_find->dump_status="";
-		    new_output_find->message="";
-		    *output_find=new_output_find;
-                    found_something = TRUE;
-		    maxparts = -1;
+		    g_hash_table_insert(part_by_dle, g_strdup(key),
+					part_find);
+		    found_something = TRUE;
+		}
+		amfree(key);
+	    }
+	    else if(curlog == L_FAIL) {
+		char *status_failed;
+		/* print other failures too -- this is a hack to ensure that failures which
+		 * did not make it to tape are also listed in the output of 'amadmin x find';
+		 * users that do not want this information (e.g., Amanda::DB::Catalog) should
+		 * filter dumps with a NULL label. */
+		find_result_t *new_output_find = g_new0(find_result_t, 1);
+		new_output_find->next = *output_find;
+		new_output_find->timestamp = g_string_chunk_insert_const(string_chunk, date);
+		new_output_find->write_timestamp = g_string_chunk_insert_const(string_chunk, "00000000000000"); /* dump was not written.. */
+		new_output_find->hostname=g_string_chunk_insert_const(string_chunk, host);
+		new_output_find->diskname=g_string_chunk_insert_const(string_chunk, disk);
+		if (current_storage != NULL) {
+		    new_output_find->storage=g_string_chunk_insert_const(string_chunk, current_storage);
+		}
+		if (current_pool != NULL) {
+		    new_output_find->pool=g_string_chunk_insert_const(string_chunk, current_pool);
 		}
+		new_output_find->level=level;
+		new_output_find->label=NULL;
+		new_output_find->partnum=partnum;
+		new_output_find->totalparts=totalparts;
+		new_output_find->filenum=0;
+		new_output_find->sec=sec;
+		new_output_find->kb=kb;
+		new_output_find->bytes=bytes;
+		new_output_find->orig_kb=orig_kb;
+		status_failed = g_strjoin(NULL,
+		     "FAILED (",
+		     program_str[(int)curprog],
+		     ") ",
+		     rest,
+		     NULL);
+		new_output_find->status = g_string_chunk_insert_const(string_chunk, status_failed);
+		amfree(status_failed);
+		new_output_find->dump_status="";
+		new_output_find->message="";
+		*output_find=new_output_find;
+		found_something = TRUE;
+		maxparts = -1;
 	    }
 	}
     }
-    amfree(host);
-    amfree(date);
-    amfree(disk);
 
     g_hash_table_destroy(valid_label);
     g_hash_table_destroy(part_by_dle);
-    afclose(logf);
     amfree(datestamp);
     amfree(current_label);
     amfree(current_storage);
     amfree(current_pool);
-    amfree(disk);
+
+    return found_something;
+}
+
+gboolean
+search_logfile(
+    find_result_t **output_find,
+    const char *label,
+    const char *passed_datestamp,
+    const char *logfile,
+    disklist_t * dynamic_disklist,
+    int added_todo)
+{
+    GPtrArray *records;
+    gboolean found_something;
+
+    g_return_val_if_fail(output_find != NULL, 0);
+    g_return_val_if_fail(logfile != NULL, 0);
+
+    records = load_log_records(logfile);
+    found_something = search_log_records(output_find, label,
+					 passed_datestamp, logfile, records,
+					 dynamic_disklist, added_todo);
+    free_log_records(records);
 
     return found_something;
 }
@@ -1527,16 +2086,23 @@ dumps_match(
 {
     find_result_t *cur_result;
     find_result_t *matches = NULL;
+    matcher_t *host_m, *disk_m, *datestamp_m, *level_m;
+
+    /* parse the expressions once for all the results */
+    host_m = (hostname && *hostname) ? compile_host(hostname) : NULL;
+    disk_m = (diskname && *diskname) ? compile_disk(diskname) : NULL;
+    datestamp_m = (datestamp && *datestamp) ? compile_datestamp(datestamp) : NULL;
+    level_m = (level && *level) ? compile_level(level) : NULL;
 
     for(cur_result=output_find;
 	cur_result;
 	cur_result=cur_result->next) {
 	char level_str[NUM_STR_SIZE];
 	g_snprintf(level_str, sizeof(level_str), "%d", cur_result->level);
-	if((!hostname || *hostname == '\0' || match_host(hostname, cur_result->hostname)) &&
-	   (!diskname || *diskname == '\0' || match_disk(diskname, cur_result->diskname)) &&
-	   (!datestamp || *datestamp== '\0' || match_datestamp(datestamp, cur_result->timestamp)) &&
-	   (!level || *level== '\0' || match_level(level, level_str)) &&
+	if((!host_m || match_compiled(host_m, cur_result->hostname)) &&
+	   (!disk_m || match_compiled(disk_m, cur_result->diskname)) &&
+	   (!datestamp_m || match_compiled(datestamp_m, cur_result->timestamp)) &&
+	   (!level_m || match_compiled(level_m, level_str)) &&
 	   (!ok || g_str_equal(cur_result->status, "OK")) &&
 	   (!ok || g_str_equal(cur_result->dump_status, "OK"))){
 
@@ -1564,9 +2130,30 @@ dumps_match(
 	}
     }
 
+    free_matcher(host_m);
+    free_matcher(disk_m);
+    free_matcher(datestamp_m);
+    free_matcher(level_m);
     return(matches);
 }
 
+/* the expressions of a dumpspec, parsed once; NULL matches everything */
+typedef struct dumpspec_matcher_s {
+    matcher_t *host;
+    matcher_t *disk;
+    matcher_t *datestamp;
+    matcher_t *write_timestamp;
+    matcher_t *level;
+} dumpspec_matcher_t;
+
+static matcher_t *
+compile_dumpspec_field(
+    matcher_t *(*compile)(const char *),
+    const char *expr)
+{
+    return (expr && *expr) ? compile(expr) : NULL;
+}
+
 /*
  * Return the set of dumps that match one or more of the given dumpspecs,
  * If 'ok' is true, only dumps with a SUCCESS status will be matched.
@@ -1584,6 +2171,21 @@ dumps_match_dumpspecs(
     find_result_t *matches = NULL;
     GSList        *dumpspec;
     dumpspec_t    *ds;
+    dumpspec_matcher_t *dsm_array, *dsm;
+    guint          n_dumpspecs = g_slist_length(dumpspecs);
+    guint          i;
+
+    dsm_array = g_new0(dumpspec_matcher_t, n_dumpspecs + 1);
+    for (dumpspec = dumpspecs, dsm = dsm_array; dumpspec;
+	 dumpspec = dumpspec->next, dsm++) {
+	ds = (dumpspec_t *)dumpspec->data;
+	dsm->host = compile_dumpspec_field(compile_host, ds->host);
+	dsm->disk = compile_dumpspec_field(compile_disk, ds->disk);
+	dsm->datestamp = compile_dumpspec_field(compile_datestamp, ds->datestamp);
+	dsm->write_timestamp = compile_dumpspec_field(compile_datestamp,
+						      ds->write_timestamp);
+	dsm->level = compile_dumpspec_field(compile_level, ds->level);
+    }
 
     for(cur_result=output_find;
 	cur_result;
@@ -1605,17 +2207,16 @@ dumps_match_dumpspecs(
 	    memcpy(zeropad_w_ts, cur_result->write_timestamp, strlen(cur_result->write_timestamp));
 	}
 
-	for (dumpspec = dumpspecs; dumpspec; dumpspec = dumpspec->next) {
-	    ds = (dumpspec_t *)dumpspec->data;
-	    if((!ds->host || *ds->host == '\0' || match_host(ds->host, cur_result->hostname)) &&
-	       (!ds->disk || *ds->disk == '\0' || match_disk(ds->disk, cur_result->diskname)) &&
-	       (!ds->datestamp || *ds->datestamp== '\0'
-			|| match_datestamp(ds->datestamp, cur_result->timestamp)
-			|| (zeropad_ts && match_datestamp(ds->datestamp, zeropad_ts))) &&
-	       (!ds->write_timestamp || *ds->write_timestamp== '\0'
-			|| match_datestamp(ds->write_timestamp, cur_result->write_timestamp)
-			|| (zeropad_w_ts && match_datestamp(ds->write_timestamp, zeropad_w_ts))) &&
-	       (!ds->level || *ds->level== '\0' || match_level(ds->level, level_str)) &&
+	for (dsm = dsm_array; dsm < dsm_array + n_dumpspecs; dsm++) {
+	    if((!dsm->host || match_compiled(dsm->host, cur_result->hostname)) &&
+	       (!dsm->disk || match_compiled(dsm->disk, cur_result->diskname)) &&
+	       (!dsm->datestamp
+			|| match_compiled(dsm->datestamp, cur_result->timestamp)
+			|| (zeropad_ts && match_compiled(dsm->datestamp, zeropad_ts))) &&
+	       (!dsm->write_timestamp
+			|| match_compiled(dsm->write_timestamp, cur_result->write_timestamp)
+			|| (zeropad_w_ts && match_compiled(dsm->write_timestamp, zeropad_w_ts))) &&
+	       (!dsm->level || match_compiled(dsm->level, level_str)) &&
 	       (!ok || g_str_equal(cur_result->status, "OK")) &&
 	       (!ok || g_str_equal(cur_result->dump_status, "OK"))) {
 
@@ -1646,6 +2247,15 @@ dumps_match_dumpspecs(
 	amfree(zeropad_ts);
     }
 
+    for (i = 0; i < n_dumpspecs; i++) {
+	free_matcher(dsm_array[i].host);
+	free_matcher(dsm_array[i].disk);
+	free_matcher(dsm_array[i].datestamp);
+	free_matcher(dsm_array[i].write_timestamp);
+	free_matcher(dsm_array[i].level);
+    }
+    g_free(dsm_array);
+
     return(matches);
 }
 
@@ -5,6 +5,10 @@
 
 #define DEFAULT_SORT_ORDER      "hkdlspbfw"
 
+/* subdirectory of the log directory where search_logfile caches the parsed
+ * log files, by log file name */
+#define FIND_CACHE_DIR          "findcache"
+
 typedef struct find_result_s {
     struct find_result_s *next;
     char *timestamp;		/* dump timestamp */
@@ -39,6 +43,12 @@ typedef struct find_result_s {
  * the dirty work for find_dump. */
 find_result_t *find_dump(disklist_t* diskqp, int added_todo);
 
+/* Like find_dump, but only for the volumes whose datestamp is not in
+ * TAPE_SEEN, and without the holding disk.  The datestamps searched are added
+ * to TAPE_SEEN, a set of strings whose keys are freed with g_free. */
+find_result_t *find_dump_new_datestamps(disklist_t *diskqp,
+					GHashTable *tape_seen, int added_todo);
+
 /* Return a list of unqualified filenames of logfiles for active
  * tapes.  Filenames are relative to the logdir.
  *
@@ -48,13 +48,6 @@
  */
 static int is_dir(char *fname);
 
-/* Is fname an empty file?
- *
- * @param fname: filename (fully qualified)
- * @returns: boolean
- */
-static int is_emptyfile(char *fname);
-
 /* sanity check that datestamp is of the form YYYYMMDD or 
  * YYYYMMDDhhmmss
  *
@@ -79,18 +72,6 @@ is_dir(
     return (statbuf.st_mode & S_IFDIR) == S_IFDIR;
 }
 
-static int
-is_emptyfile(
-    char *fname)
-{
-    struct stat statbuf;
-
-    if(stat(fname, &statbuf) == -1) return 0;
-
-    return ((statbuf.st_mode & S_IFDIR) != S_IFDIR) &&
-		(statbuf.st_size == (off_t)0);
-}
-
 static int
 is_datestr(
     char *fname)
@@ -138,6 +119,630 @@ is_datestr(
     return 1;
 }
 
+/*
+ * Manifest
+ *
+ * Each holding directory keeps a MANIFEST_NAME file with its entries and the
+ * header fields that the walks need.  This way amflush, amadmin or the driver
+ * do not have to open every chunk to read its header.  The file is a journal
+ * that is replayed in order:
+ *
+ *   AMANDA HOLDING MANIFEST 1
+ *   F name size mtime checked type level datestamp host disk cont_filename
+ *   + name
+ *   - name
+ *   R oldname newname
+ *   D dir_mtime written
+ *
+ * An 'F' line records the header of an entry as read at time 'checked'.  It is
+ * trusted only while the size and mtime of the file still match and mtime is
+ * before 'checked'; otherwise the header is read again.  holding_chunk_open,
+ * rename_tmp_holding and holding_file_unlink append '+', 'R' and '-' lines,
+ * followed by a 'D' line if the journal was complete before their change.
+ * The list of entries is used in place of readdir only when the journal ends
+ * with a 'D' line that was written after the directory mtime it records and
+ * that mtime is still current.  Any other change to the directory makes the
+ * next walk read it again and rewrite the manifest.
+ */
+
+#define MANIFEST_NAME "manifest"
+#define MANIFEST_MAGIC "AMANDA HOLDING MANIFEST 1"
+
+typedef struct {
+    off_t size;
+    time_t mtime;
+    time_t checked;		/* 0 if the header is not known */
+    filetype_t type;
+    int dumplevel;
+    char *datestamp;
+    char *hostname;
+    char *diskname;
+    char *cont_filename;
+    gboolean dirty;		/* header read since the manifest was loaded */
+} manifest_entry_t;
+
+typedef struct {
+    char *hdir;
+    char *filename;
+    GHashTable *entries;	/* name -> manifest_entry_t */
+    gboolean exists;		/* the manifest file was found */
+    struct stat file_st;	/* ... with this stat when loaded */
+    int nlines;
+    gboolean listed;		/* the journal ends with a trusted 'D' line */
+    time_t dir_mtime;		/* ... for this directory mtime */
+    gboolean rebuilt;		/* entries were read from the directory */
+    time_t rebuilt_mtime;	/* ... at this mtime, -1 if unknown */
+    time_t rebuilt_time;	/* ... and this time */
+    gboolean dirty;
+} manifest_t;
+
+static GHashTable *manifests = NULL;	/* hdir -> manifest_t */
+
+static void
+manifest_entry_free(
+    gpointer data)
+{
+    manifest_entry_t *entry = data;
+
+    g_free(entry->datestamp);
+    g_free(entry->hostname);
+    g_free(entry->diskname);
+    g_free(entry->cont_filename);
+    g_free(entry);
+}
+
+static void
+manifest_free(
+    gpointer data)
+{
+    manifest_t *m = data;
+
+    g_hash_table_destroy(m->entries);
+    g_free(m->hdir);
+    g_free(m->filename);
+    g_free(m);
+}
+
+static gboolean
+same_file_stat(
+    struct stat *a,
+    struct stat *b)
+{
+    return a->st_ino == b->st_ino && a->st_size == b->st_size &&
+	   a->st_mtime == b->st_mtime;
+}
+
+static void
+manifest_replay_line(
+    manifest_t *m,
+    char *line)
+{
+    gchar **words = split_quoted_strings(line);
+    guint n = g_strv_length(words);
+    manifest_entry_t *entry;
+
+    if (n == 11 && g_str_equal(words[0], "F")) {
+	entry = g_new0(manifest_entry_t, 1);
+	entry->size = (off_t)g_ascii_strtoll(words[2], NULL, 10);
+	entry->mtime = (time_t)atol(words[3]);
+	entry->checked = (time_t)atol(words[4]);
+	entry->type = (filetype_t)atoi(words[5]);
+	entry->dumplevel = atoi(words[6]);
+	entry->datestamp = g_strdup(words[7]);
+	entry->hostname = g_strdup(words[8]);
+	entry->diskname = g_strdup(words[9]);
+	entry->cont_filename = g_strdup(words[10]);
+	g_hash_table_replace(m->entries, g_strdup(words[1]), entry);
+    } else if (n == 2 && g_str_equal(words[0], "+")) {
+	g_hash_table_replace(m->entries, g_strdup(words[1]),
+			     g_new0(manifest_entry_t, 1));
+	m->listed = FALSE;
+    } else if (n == 2 && g_str_equal(words[0], "-")) {
+	g_hash_table_remove(m->entries, words[1]);
+	m->listed = FALSE;
+    } else if (n == 3 && g_str_equal(words[0], "R")) {
+	gpointer key, value;
+
+	if (g_hash_table_lookup_extended(m->entries, words[1], &key, &value)) {
+	    g_hash_table_steal(m->entries, words[1]);
+	    g_free(key);
+	} else {
+	    value = g_new0(manifest_entry_t, 1);
+	}
+	g_hash_table_replace(m->entries, g_strdup(words[2]), value);
+	m->listed = FALSE;
+    } else if (n == 3 && g_str_equal(words[0], "D")) {
+	time_t dir_mtime = (time_t)atol(words[1]);
+	time_t written = (time_t)atol(words[2]);
+
+	m->listed = dir_mtime < written;
+	m->dir_mtime = dir_mtime;
+    }
+    g_strfreev(words);
+}
+
+/* Load the manifest of HDIR, or return the copy already loaded if the file
+ * did not change since. */
+static manifest_t *
+manifest_get(
+    char *hdir)
+{
+    manifest_t *m;
+    struct stat st;
+    gboolean exists;
+    int fd;
+
+    if (!manifests)
+	manifests = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+					  manifest_free);
+
+    m = g_hash_table_lookup(manifests, hdir);
+    if (m) {
+	exists = stat(m->filename, &st) == 0;
+	if (exists == m->exists && (!exists || same_file_stat(&st, &m->file_st)))
+	    return m;
+	g_hash_table_remove(manifests, hdir);
+    }
+
+    m = g_new0(manifest_t, 1);
+    m->hdir = g_strdup(hdir);
+    m->filename = g_strconcat(hdir, "/", MANIFEST_NAME, NULL);
+    m->entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+				       manifest_entry_free);
+    m->rebuilt_mtime = -1;
+    g_hash_table_insert(manifests, m->hdir, m);
+
+    if ((fd = open(m->filename, O_RDONLY)) == -1)
+	return m;
+    if (amroflock(fd, m->filename) == 0) {
+	if (fstat(fd, &m->file_st) == 0) {
+	    size_t size = (size_t)m->file_st.st_size;
+	    char *buf = g_malloc(size + 1);
+	    char *line, *eol;
+
+	    m->exists = TRUE;
+	    size = read_fully(fd, buf, size, NULL);
+	    buf[size] = '\0';
+	    /* only whole lines of a manifest we know */
+	    if (g_str_has_prefix(buf, MANIFEST_MAGIC "\n")) {
+		line = buf + strlen(MANIFEST_MAGIC "\n");
+		while ((eol = strchr(line, '\n')) != NULL) {
+		    *eol = '\0';
+		    manifest_replay_line(m, line);
+		    m->nlines++;
+		    line = eol + 1;
+		}
+	    }
+	    g_free(buf);
+	}
+	amfunlock(fd, m->filename);
+    }
+    close(fd);
+    return m;
+}
+
+static void
+manifest_entry_line(
+    GString *buf,
+    char *name,
+    manifest_entry_t *entry)
+{
+    char *qname = quote_string_always(name);
+
+    if (entry->checked) {
+	char *qdatestamp = quote_string_always(entry->datestamp);
+	char *qhostname = quote_string_always(entry->hostname);
+	char *qdiskname = quote_string_always(entry->diskname);
+	char *qcont = quote_string_always(entry->cont_filename);
+
+	g_string_append_printf(buf, "F %s %lld %ld %ld %d %d %s %s %s %s\n",
+		qname, (long long)entry->size, (long)entry->mtime,
+		(long)entry->checked, (int)entry->type, entry->dumplevel,
+		qdatestamp, qhostname, qdiskname, qcont);
+	g_free(qdatestamp);
+	g_free(qhostname);
+	g_free(qdiskname);
+	g_free(qcont);
+    } else {
+	g_string_append_printf(buf, "+ %s\n", qname);
+    }
+    g_free(qname);
+}
+
+typedef struct {
+    GString *buf;
+    gboolean all;
+    int nlines;
+} manifest_write_t;
+
+static void
+manifest_write_entry(
+    gpointer key,
+    gpointer value,
+    gpointer data)
+{
+    manifest_entry_t *entry = value;
+    manifest_write_t *w = data;
+
+    if (w->all || entry->dirty) {
+	manifest_entry_line(w->buf, key, entry);
+	w->nlines++;
+    }
+    entry->dirty = FALSE;
+}
+
+/* Write what was learned of M since it was loaded: append the headers read,
+ * or rewrite the whole manifest after a readdir or when the journal has grown
+ * much longer than the list of entries.  If another process changed the
+ * manifest in the meantime, only the headers are appended: an 'F' line is
+ * checked against the file anyway. */
+static void
+manifest_flush(
+    manifest_t *m)
+{
+    manifest_write_t w;
+    struct stat st;
+    gboolean changed;
+    int fd;
+
+    if (!m->dirty)
+	return;
+    m->dirty = FALSE;
+
+    if ((fd = open(m->filename, O_RDWR)) == -1)
+	return;
+    if (amflock(fd, m->filename) != 0) {
+	close(fd);
+	return;
+    }
+    changed = fstat(fd, &st) != 0 || !m->exists ||
+	      !same_file_stat(&st, &m->file_st);
+
+    w.buf = g_string_new(NULL);
+    w.nlines = 0;
+    w.all = !changed && (m->rebuilt ||
+	    m->nlines > 2 * (int)g_hash_table_size(m->entries) + 1000);
+    if (w.all)
+	g_string_append(w.buf, MANIFEST_MAGIC "\n");
+    g_hash_table_foreach(m->entries, manifest_write_entry, &w);
+
+    if (w.all && m->rebuilt) {
+	struct stat dir_st;
+
+	/* the directory did not change since it was read */
+	m->listed = m->rebuilt_mtime != -1 && stat(m->hdir, &dir_st) == 0 &&
+		    dir_st.st_mtime == m->rebuilt_mtime;
+	m->dir_mtime = m->rebuilt_mtime;
+	if (m->listed) {
+	    g_string_append_printf(w.buf, "D %ld %ld\n", (long)m->dir_mtime,
+				   (long)m->rebuilt_time);
+	    w.nlines++;
+	}
+    } else if (w.all && m->listed) {
+	g_string_append_printf(w.buf, "D %ld %ld\n", (long)m->dir_mtime,
+			       (long)time(NULL));
+	w.nlines++;
+    }
+    m->rebuilt = FALSE;
+
+    if (w.all) {
+	if (ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0 ||
+	    full_write(fd, w.buf->str, w.buf->len) != w.buf->len)
+	    changed = TRUE;
+	m->nlines = w.nlines;
+    } else if (w.buf->len) {
+	if (lseek(fd, 0, SEEK_END) == -1 ||
+	    full_write(fd, w.buf->str, w.buf->len) != w.buf->len)
+	    changed = TRUE;
+	m->nlines += w.nlines;
+    }
+    if (w.buf->len && fstat(fd, &m->file_st) != 0)
+	changed = TRUE;
+    g_string_free(w.buf, TRUE);
+    amfunlock(fd, m->filename);
+    close(fd);
+
+    /* reload the manifest next time */
+    if (changed)
+	g_hash_table_remove(manifests, m->hdir);
+}
+
+static void
+manifest_flush_one(
+    gpointer key G_GNUC_UNUSED,
+    gpointer value,
+    gpointer data)
+{
+    GSList **list = data;
+
+    *list = g_slist_prepend(*list, value);
+}
+
+/* Write back all the manifests loaded */
+static void
+manifest_flush_all(void)
+{
+    GSList *list = NULL, *m;
+
+    if (!manifests)
+	return;
+    /* manifest_flush can drop a manifest from the table */
+    g_hash_table_foreach(manifests, manifest_flush_one, &list);
+    for (m = list; m != NULL; m = m->next)
+	manifest_flush((manifest_t *)m->data);
+    g_slist_free(list);
+}
+
+static void
+manifest_add_name(
+    gpointer key,
+    gpointer value G_GNUC_UNUSED,
+    gpointer data)
+{
+    GSList **names = data;
+
+    *names = g_slist_prepend(*names, g_strdup(key));
+}
+
+/* Get the names in HDIR from its manifest if it can be trusted, else from
+ * readdir.  Returns FALSE if the directory cannot be read. */
+static gboolean
+manifest_list_dir(
+    char *hdir,
+    GSList **names)
+{
+    manifest_t *m = manifest_get(hdir);
+    struct stat st;
+    time_t now;
+    DIR *dir;
+    struct dirent *workdir;
+    GHashTable *entries;
+    int fd;
+
+    *names = NULL;
+    if (m->listed && stat(hdir, &st) == 0 && st.st_mtime == m->dir_mtime) {
+	g_hash_table_foreach(m->entries, manifest_add_name, names);
+	return TRUE;
+    }
+
+    /* create the manifest first, so that doing so does not change the
+     * mtime of the directory once it is read */
+    if (!m->exists &&
+	(fd = open(m->filename, O_WRONLY|O_CREAT|O_EXCL, 0600)) != -1) {
+	if (full_write(fd, MANIFEST_MAGIC "\n",
+		       strlen(MANIFEST_MAGIC "\n")) == strlen(MANIFEST_MAGIC "\n")) {
+	    m->exists = fstat(fd, &m->file_st) == 0;
+	}
+	close(fd);
+    }
+
+    now = time(NULL);
+    if (stat(hdir, &st) != 0 || (dir = opendir(hdir)) == NULL)
+	return FALSE;
+    /* a change in the second of the stat would not show in the mtime */
+    m->rebuilt_mtime = st.st_mtime < now ? st.st_mtime : -1;
+    m->rebuilt_time = now;
+    m->rebuilt = TRUE;
+    m->dirty = TRUE;
+    m->listed = FALSE;
+
+    /* keep only the entries still there */
+    entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+				    manifest_entry_free);
+    while ((workdir = readdir(dir)) != NULL) {
+	gpointer key, value;
+
+	if (is_dot_or_dotdot(workdir->d_name) ||
+	    g_str_equal(workdir->d_name, MANIFEST_NAME))
+	    continue;
+	if (g_hash_table_lookup_extended(m->entries, workdir->d_name,
+					 &key, &value)) {
+	    g_hash_table_steal(m->entries, workdir->d_name);
+	    g_free(key);
+	} else {
+	    value = g_new0(manifest_entry_t, 1);
+	}
+	g_hash_table_replace(entries, g_strdup(workdir->d_name), value);
+	*names = g_slist_prepend(*names, g_strdup(workdir->d_name));
+    }
+    closedir(dir);
+    g_hash_table_destroy(m->entries);
+    m->entries = entries;
+    return TRUE;
+}
+
+/* Fill the header fields the walks need (type, dumplevel, datestamp, name,
+ * disk and cont_filename) of the holding file FNAME from the manifest of its
+ * directory, reading the header only if the manifest does not know it.
+ *
+ * @param fname: full pathname of the holding file
+ * @param file: (result) header fields
+ * @param finfo: (result) stat of the file, or NULL
+ * @returns: 1 if the file was a regular, non-empty file with a header;
+ * otherwise errno is ENOENT if the file does not exist
+ */
+static int
+holding_file_get_summary(
+    char *fname,
+    dumpfile_t *file,
+    struct stat *finfo)
+{
+    char *hdir = g_path_get_dirname(fname);
+    char *name = g_path_get_basename(fname);
+    manifest_t *m = manifest_get(hdir);
+    manifest_entry_t *entry;
+    struct stat st;
+    time_t now;
+    int result = 0;
+
+    fh_init(file);
+    file->type = F_UNKNOWN;
+
+    now = time(NULL);
+    if (stat(fname, &st) != 0)
+	goto done;
+    errno = 0;
+    if (!S_ISREG(st.st_mode) || st.st_size == 0)
+	goto done;
+    if (finfo)
+	*finfo = st;
+
+    entry = g_hash_table_lookup(m->entries, name);
+    if (entry && entry->checked && entry->size == st.st_size &&
+	entry->mtime == st.st_mtime && entry->mtime < entry->checked) {
+	file->type = entry->type;
+	file->dumplevel = entry->dumplevel;
+	g_strlcpy(file->datestamp, entry->datestamp, sizeof(file->datestamp));
+	g_strlcpy(file->name, entry->hostname, sizeof(file->name));
+	g_strlcpy(file->disk, entry->diskname, sizeof(file->disk));
+	g_strlcpy(file->cont_filename, entry->cont_filename,
+		  sizeof(file->cont_filename));
+	result = 1;
+	goto done;
+    }
+
+    if (!holding_file_get_dumpfile(fname, file)) {
+	if (errno != ENOENT)
+	    errno = 0;
+	goto done;
+    }
+    result = 1;
+
+    /* a change after the stat will show in the mtime */
+    entry = g_new0(manifest_entry_t, 1);
+    entry->size = st.st_size;
+    entry->mtime = st.st_mtime;
+    entry->checked = now;
+    entry->type = file->type;
+    entry->dumplevel = file->dumplevel;
+    entry->datestamp = g_strdup(file->datestamp);
+    entry->hostname = g_strdup(file->name);
+    entry->diskname = g_strdup(file->disk);
+    entry->cont_filename = g_strdup(file->cont_filename);
+    entry->dirty = TRUE;
+    g_hash_table_replace(m->entries, name, entry);
+    name = NULL;
+    m->dirty = TRUE;
+
+done:
+    g_free(hdir);
+    g_free(name);
+    return result;
+}
+
+/* A change to the entries of a holding directory, journaled in its manifest.
+ * The lock on the manifest is held from manifest_update_start to
+ * manifest_update_finish, around the change itself. */
+typedef struct {
+    int fd;
+    char *hdir;
+    char *filename;
+    gboolean listed;	/* the journal was complete before the change */
+    GString *lines;
+} manifest_update_t;
+
+/* The last line of the manifest open on FD is a trusted 'D' line for
+ * DIR_MTIME */
+static gboolean
+manifest_ends_listed(
+    int fd,
+    time_t dir_mtime)
+{
+    char buf[128];
+    struct stat st;
+    off_t offset;
+    size_t len;
+    char *line;
+    long mtime, written;
+
+    if (fstat(fd, &st) != 0)
+	return FALSE;
+    offset = st.st_size > (off_t)sizeof(buf) - 1 ?
+	     st.st_size - (off_t)sizeof(buf) + 1 : 0;
+    if (lseek(fd, offset, SEEK_SET) != offset)
+	return FALSE;
+    len = read_fully(fd, buf, (size_t)(st.st_size - offset), NULL);
+    if (len == 0 || buf[len - 1] != '\n')
+	return FALSE;
+    buf[len - 1] = '\0';
+    line = strrchr(buf, '\n');
+    line = line ? line + 1 : buf;
+    return sscanf(line, "D %ld %ld", &mtime, &written) == 2 &&
+	   (time_t)mtime == dir_mtime && mtime < written;
+}
+
+static manifest_update_t *
+manifest_update_start(
+    char *hfile)
+{
+    manifest_update_t *u = g_new0(manifest_update_t, 1);
+    struct stat st;
+
+    u->hdir = g_path_get_dirname(hfile);
+    u->filename = g_strconcat(u->hdir, "/", MANIFEST_NAME, NULL);
+    u->lines = g_string_new(NULL);
+    u->fd = open(u->filename, O_RDWR);
+    if (u->fd == -1)
+	return u;
+    if (amflock(u->fd, u->filename) != 0) {
+	aclose(u->fd);
+	return u;
+    }
+    u->listed = stat(u->hdir, &st) == 0 && manifest_ends_listed(u->fd, st.st_mtime);
+    return u;
+}
+
+static void
+manifest_update_note(
+    manifest_update_t *u,
+    char op,
+    char *hfile,
+    char *new_hfile)
+{
+    char *name, *qname;
+
+    if (u->fd == -1)
+	return;
+    name = g_path_get_basename(hfile);
+    qname = quote_string_always(name);
+    g_string_append_printf(u->lines, "%c %s", op, qname);
+    g_free(qname);
+    g_free(name);
+    if (new_hfile) {
+	name = g_path_get_basename(new_hfile);
+	qname = quote_string_always(name);
+	g_string_append_printf(u->lines, " %s", qname);
+	g_free(qname);
+	g_free(name);
+    }
+    g_string_append_c(u->lines, '\n');
+}
+
+static void
+manifest_update_finish(
+    manifest_update_t *u)
+{
+    struct stat st;
+    time_t now;
+
+    if (u->fd != -1) {
+	now = time(NULL);
+	if (u->listed && stat(u->hdir, &st) == 0)
+	    g_string_append_printf(u->lines, "D %ld %ld\n", (long)st.st_mtime,
+				   (long)now);
+	if (u->lines->len && lseek(u->fd, 0, SEEK_END) != -1 &&
+	    full_write(u->fd, u->lines->str, u->lines->len) != u->lines->len)
+	    dbprintf(_("could not update holding manifest %s: %s\n"),
+		     u->filename, strerror(errno));
+	amfunlock(u->fd, u->filename);
+	close(u->fd);
+    }
+    g_string_free(u->lines, TRUE);
+    g_free(u->filename);
+    g_free(u->hdir);
+    g_free(u);
+}
+
 /*
  * Recursion functions
  *
@@ -198,7 +803,7 @@ static void holding_walk_file(
 	int is_cruft = 0;
 
         /* get the header to look for cont_filename */
-        if (!holding_file_get_dumpfile(filename, &file)) {
+        if (!holding_file_get_summary(filename, &file, NULL)) {
 	    is_cruft = 1;
         }
 
@@ -239,39 +844,34 @@ static void holding_walk_dir(
     holding_walk_fn per_file_fn,
     holding_walk_fn per_chunk_fn)
 {
-    DIR *dir;
-    struct dirent *workdir;
+    GSList *names, *name;
     char *hfile = NULL;
     dumpfile_t dumpf;
     int dumpf_ok;
     int proceed = 1;
 
-    if ((dir = opendir(hdir)) == NULL) {
+    if (!manifest_list_dir(hdir, &names)) {
         if (errno != ENOENT)
            dbprintf(_("Warning: could not open holding dir %s: %s\n"),
                   hdir, strerror(errno));
         return;
     }
 
-    while ((workdir = readdir(dir)) != NULL) {
+    for (name = names; name != NULL; name = name->next) {
+	char *element = (char *)name->data;
 	int is_cruft = 0;
 
-        if (is_dot_or_dotdot(workdir->d_name))
-            continue; /* expected cruft */
-
         g_free(hfile);
-        hfile = g_strconcat(hdir, "/", workdir->d_name, NULL);
-
-        /* filter out various undesirables */
-        if (is_emptyfile(hfile))
-            is_cruft = 1;
-
-        if (is_dir(hfile)) {
-            is_cruft= 1;
-        }
-
-        if (!(dumpf_ok=holding_file_get_dumpfile(hfile, &dumpf)) ||
-            dumpf.type != F_DUMPFILE) {
+        hfile = g_strconcat(hdir, "/", element, NULL);
+
+        /* filter out various undesirables: directories, empty files and
+	 * files without a header */
+        if (!(dumpf_ok=holding_file_get_summary(hfile, &dumpf, NULL)) &&
+	    errno == ENOENT) {
+	    dumpfile_free_data(&dumpf);
+	    continue; /* removed since listed */
+	}
+        if (!dumpf_ok || dumpf.type != F_DUMPFILE) {
             if (dumpf_ok && dumpf.type == F_CONT_DUMPFILE) {
 		dumpfile_free_data(&dumpf);
                 continue; /* silently skip expected file */
@@ -287,7 +887,7 @@ static void holding_walk_dir(
 	if (per_file_fn) 
 	    proceed = per_file_fn(datap, 
 			hdir, 
-			workdir->d_name, 
+			element, 
 			hfile, 
 			is_cruft);
 	if (!is_cruft && proceed && stop_at != STOP_AT_FILE)
@@ -297,8 +897,9 @@ static void holding_walk_dir(
 	dumpfile_free_data(&dumpf);
     }
 
-    closedir(dir);
+    slist_free_full(names, g_free);
     amfree(hfile);
+    manifest_flush_all();
 }
 
 /* Recurse over all holding directories in a holding disk.
@@ -546,6 +1147,7 @@ holding_get_file_chunks(char *hfile)
 
     holding_walk_file(hfile, (gpointer)&data,
 	holding_get_walk_fn);
+    manifest_flush_all();
 
     return data.result;
 }
@@ -565,7 +1167,7 @@ holding_get_files_for_flush(
     file_list = holding_get_files(NULL, 1, 1);
     for (file_elt = file_list; file_elt != NULL; file_elt = file_elt->next) {
         /* get info on that file */
-	if (!holding_file_get_dumpfile((char *)file_elt->data, &file))
+	if (!holding_file_get_summary((char *)file_elt->data, &file, NULL))
 	    continue;
 
         if (file.type != F_DUMPFILE) {
@@ -599,6 +1201,7 @@ holding_get_files_for_flush(
     }
 
     if (file_list) slist_free_full(file_list, g_free);
+    manifest_flush_all();
 
     return result_list;
 }
@@ -613,7 +1216,7 @@ holding_get_all_datestamps(void)
     all_files = holding_get_files(NULL, 1, 0);
     for (file = all_files; file != NULL; file = file->next) {
 	dumpfile_t dfile;
-	if (!holding_file_get_dumpfile((char *)file->data, &dfile))
+	if (!holding_file_get_summary((char *)file->data, &dfile, NULL))
 	    continue;
 	if (!g_slist_find_custom(datestamps, dfile.datestamp,
 				 g_compare_strings)) {
@@ -625,6 +1228,7 @@ holding_get_all_datestamps(void)
     }
 
     slist_free_full(all_files, g_free);
+    manifest_flush_all();
 
     return datestamps;
 }
@@ -645,9 +1249,11 @@ holding_file_size(
     /* Loop through all cont_filenames (subsequent chunks) */
     filename = g_strdup(hfile);
     while (filename != NULL && filename[0] != '\0') {
-        /* stat the file for its size */
-        if (stat(filename, &finfo) == -1) {
-	    dbprintf(_("stat %s: %s\n"), filename, strerror(errno));
+        /* stat the file for its size, and get the header to look for
+	 * cont_filename */
+        if (!holding_file_get_summary(filename, &file, &finfo)) {
+	    dbprintf(_("holding_file_size: open of %s failed.\n"), filename);
+	    dumpfile_free_data(&file);
             size = -1;
 	    break;
         }
@@ -655,19 +1261,13 @@ holding_file_size(
         if (strip_headers)
             size -= (off_t)(DISK_BLOCK_BYTES / 1024);
 
-        /* get the header to look for cont_filename */
-        if (!holding_file_get_dumpfile(filename, &file)) {
-	    dbprintf(_("holding_file_size: open of %s failed.\n"), filename);
-            size = -1;
-	    break;
-        }
-
         /* on to the next chunk */
         g_free(filename);
         filename = g_strdup(file.cont_filename);
 	dumpfile_free_data(&file);
     }
     amfree(filename);
+    manifest_flush_all();
     return size;
 }
 
@@ -688,9 +1288,11 @@ holding_file_size_bytes(
     /* Loop through all cont_filenames (subsequent chunks) */
     filename = g_strdup(hfile);
     while (filename != NULL && filename[0] != '\0') {
-        /* stat the file for its size */
-        if (stat(filename, &finfo) == -1) {
-	    dbprintf(_("stat %s: %s\n"), filename, strerror(errno));
+        /* stat the file for its size, and get the header to look for
+	 * cont_filename */
+        if (!holding_file_get_summary(filename, &file, &finfo)) {
+	    dbprintf(_("holding_file_size: open of %s failed.\n"), filename);
+	    dumpfile_free_data(&file);
             size = -1;
 	    break;
         }
@@ -698,19 +1300,13 @@ holding_file_size_bytes(
         if (strip_headers)
             size -= (off_t)DISK_BLOCK_BYTES;
 
-        /* get the header to look for cont_filename */
-        if (!holding_file_get_dumpfile(filename, &file)) {
-	    dbprintf(_("holding_file_size: open of %s failed.\n"), filename);
-            size = -1;
-	    break;
-        }
-
         /* on to the next chunk */
         g_free(filename);
         filename = g_strdup(file.cont_filename);
 	dumpfile_free_data(&file);
     }
     amfree(filename);
+    manifest_flush_all();
     return size;
 }
 
@@ -727,12 +1323,17 @@ holding_file_unlink(
         return 0;
 
     for (chunk = chunklist; chunk != NULL; chunk = chunk->next) {
+	manifest_update_t *mu = manifest_update_start((char *)chunk->data);
+
         if (unlink((char *)chunk->data)<0) {
 	    dbprintf(_("holding_file_unlink: could not unlink %s: %s\n"),
                     (char *)chunk->data, strerror(errno));
+	    manifest_update_finish(mu);
 	    slist_free_full(chunklist, g_free);
             return 0;
         }
+	manifest_update_note(mu, '-', (char *)chunk->data, NULL);
+	manifest_update_finish(mu);
     }
     slist_free_full(chunklist, g_free);
     return 1;
@@ -804,6 +1405,7 @@ holding_cleanup_dir(
 {
     holding_cleanup_datap_t *data = (holding_cleanup_datap_t *)datap;
     char *pid_file;
+    char *manifest_file;
 
     if (is_cruft) {
 	if (data->verbose_output)
@@ -820,7 +1422,11 @@ holding_cleanup_dir(
     }
     g_free(pid_file);
 
-    /* try removing it */
+    /* try removing it, with its manifest; the next walk rebuilds the
+     * manifest if the directory is not empty */
+    manifest_file = g_strconcat(fqpath, "/", MANIFEST_NAME, NULL);
+    unlink(manifest_file);
+    g_free(manifest_file);
     if (rmdir(fqpath) == 0) {
 	/* success, so don't try to walk into it */
 	if (data->verbose_output)
@@ -996,6 +1602,7 @@ rename_tmp_holding(
     dumpfile_t file;
     char *filename;
     char *filename_tmp = NULL;
+    manifest_update_t *mu;
 
     memset(buffer, 0, sizeof(buffer));
     filename = g_strdup(holding_file);
@@ -1011,10 +1618,14 @@ rename_tmp_holding(
 	buflen = read_fully(fd, buffer, sizeof(buffer), NULL);
 	close(fd);
 
+	mu = manifest_update_start(filename);
 	if(rename(filename_tmp, filename) != 0) {
 	    dbprintf(_("rename_tmp_holding: could not rename \"%s\" to \"%s\": %s"),
 		    filename_tmp, filename, strerror(errno));
+	} else {
+	    manifest_update_note(mu, 'R', filename_tmp, filename);
 	}
+	manifest_update_finish(mu);
 
 	if (buflen <= 0) {
 	    dbprintf(_("rename_tmp_holding: %s: empty file?\n"), filename);
@@ -1063,6 +1674,24 @@ rename_tmp_holding(
 }
 
 
+int
+holding_chunk_open(
+    char *	filename)
+{
+    manifest_update_t *mu = manifest_update_start(filename);
+    int fd;
+    int save_errno;
+
+    fd = open(filename, O_RDWR|O_CREAT|O_TRUNC, 0600);
+    save_errno = errno;
+    if (fd >= 0)
+	manifest_update_note(mu, '+', filename, NULL);
+    manifest_update_finish(mu);
+    errno = save_errno;
+    return fd;
+}
+
+
 int
 mkholdingdir(
     char *	diskdir)
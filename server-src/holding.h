@@ -190,6 +190,15 @@ int
 rename_tmp_holding(char *holding_file,
                    int complete);
 
+/* Create (or truncate) a holding chunk for writing, and note it in the
+ * manifest of its holding directory.
+ *
+ * @param filename: full pathname of the chunk
+ * @returns: file descriptor, or -1 with errno set
+ */
+int
+holding_chunk_open(char *filename);
+
 /* Set up a holding directory and do basic permission
  * checks on it
  *
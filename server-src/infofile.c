@@ -342,13 +342,47 @@ read_txinfofile(
 	    return 0;				/* normal end of record */
 	}
 
+	s = line;
+	ch = *s++;
+
+	if(strncmp_const_skip(line, "change-token:", s, ch) == 0) {
+	    /* change-token: TOKEN [LEVEL SIZE]... */
+	    char *token;
+	    int nb_est = 0;
+
+	    skip_whitespace(s, ch);
+	    if (ch == '\0') {
+		amfree(line);
+		break;
+	    }
+	    token = s - 1;
+	    skip_non_whitespace(s, ch);
+	    s[-1] = '\0';
+	    strncpy(info->change_token, token, sizeof(info->change_token)-1);
+	    info->change_token[sizeof(info->change_token)-1] = '\0';
+	    s[-1] = (char)ch;
+	    while (nb_est < NB_TOKEN_EST) {
+		int level;
+
+		skip_whitespace(s, ch);
+		if (ch == '\0' ||
+		    sscanf(s - 1, "%d %lld", &level, &off_t_tmp) != 2)
+		    break;
+		info->token_est[nb_est].level = level;
+		info->token_est[nb_est].size = (off_t)off_t_tmp;
+		nb_est++;
+		skip_integer(s, ch);
+		skip_whitespace(s, ch);
+		skip_integer(s, ch);
+	    }
+	    amfree(line);
+	    continue;
+	}
+
 	if (nb_history >= NB_HISTORY) break;
 
 	memset(&onehistory, 0, sizeof(onehistory));
 
-	s = line;
-	ch = *s++;
-
 	if(strncmp_const_skip(line, "history:", s, ch) != 0) {
 	    amfree(line);
 	    break;
@@ -475,6 +509,14 @@ write_txinfofile(
 		(intmax_t)info->history[i].date,
 		(intmax_t)info->history[i].secs);
     }
+    if (info->change_token[0] != '\0') {
+	g_fprintf(infof, "change-token: %s", info->change_token);
+	for (i = 0; i < NB_TOKEN_EST && info->token_est[i].level >= 0; i++) {
+	    g_fprintf(infof, " %d %lld", info->token_est[i].level,
+		      (long long)info->token_est[i].size);
+	}
+	g_fprintf(infof, "\n");
+    }
     g_fprintf(infof, "//\n");
 
     return 0;
@@ -511,6 +553,664 @@ delete_txinfofile(
     return rc;
 }
 
+/*
+ * The curinfo database (infofile-format "db")
+ *
+ * All the records are in one file, INFODB_NAME in the infofile directory.
+ * The file is a header then records, appended by the writers under a lock:
+ * a put or a delete appends a new record for the DLE, that replaces the
+ * previous one.  Each record has a checksum; a record cut by a crash is
+ * ignored by the readers and truncated by the next writer.  When most of
+ * the file is replaced records, it is rewritten to a new file that is
+ * renamed over it.
+ *
+ * The file is memory-mapped and indexed once by open_infofile, and the
+ * index is kept across close_infofile/open_infofile, so the planner reads
+ * all its DLEs from a single mapping and the driver does not reread the
+ * file for each dump; get_info only checks with fstat that the file was not
+ * changed by another process.
+ */
+
+#define INFODB_NAME	"curinfo.db"
+#define INFODB_MAGIC	"AMINFODB"
+#define INFODB_ORDER	0x01020304
+#define INFODB_VERSION	1
+#define INFODB_HDR_SIZE	16
+#define INFODB_REC_MAGIC 0x494e4652	/* "INFR" */
+#define INFODB_COMPACT_SIZE (1024*1024)
+
+typedef struct infodb_rec_s {
+    guint32 magic;
+    guint32 keylen;
+    guint32 datalen;	/* 0 for a deleted DLE */
+    guint32 crc;	/* of the key and the data */
+} infodb_rec_t;
+
+static struct {
+    char *dir;
+    char *filename;
+    int fd;
+    dev_t dev;
+    ino_t ino;
+    char *map;
+    size_t map_size;
+    size_t valid_end;	/* end of the last good record */
+    size_t live;	/* bytes of the records in the index */
+    GHashTable *index;	/* "host\001disk" -> guint64 * offset */
+    int lock_fd;	/* the lock file, while writing */
+    int batch;		/* nesting of infofile_begin_batch */
+} infodb = { NULL, NULL, -1, 0, 0, NULL, 0, 0, 0, NULL, -1, 0 };
+
+static gboolean use_infodb;
+
+static char *
+infodb_key(
+    char *host,
+    char *disk)
+{
+    return g_strconcat(host, "\001", disk, NULL);
+}
+
+static guint32
+infodb_crc(
+    const char *key,
+    guint32 keylen,
+    const char *data,
+    guint32 datalen)
+{
+    crc_t crc;
+
+    crc32_init(&crc);
+    crc32_add((uint8_t *)key, keylen, &crc);
+    if (datalen)
+	crc32_add((uint8_t *)data, datalen, &crc);
+    return crc32_finish(&crc);
+}
+
+static void
+infodb_unmap(void)
+{
+    if (infodb.map) {
+	munmap(infodb.map, infodb.map_size);
+	infodb.map = NULL;
+    }
+    infodb.map_size = 0;
+}
+
+static void
+infodb_reset_index(void)
+{
+    if (infodb.index)
+	g_hash_table_destroy(infodb.index);
+    infodb.index = g_hash_table_new_full(g_str_hash, g_str_equal,
+					 g_free, g_free);
+    infodb.live = 0;
+}
+
+static void
+infodb_forget(void)
+{
+    infodb_unmap();
+    if (infodb.fd >= 0) {
+	close(infodb.fd);
+	infodb.fd = -1;
+    }
+    infodb.valid_end = 0;
+    infodb_reset_index();
+}
+
+/* index the records after infodb.valid_end */
+static void
+infodb_scan(void)
+{
+    guint64 *offset;
+    guint64 *old;
+
+    if (infodb.valid_end == 0) {
+	guint32 order, version;
+
+	if (infodb.map_size < INFODB_HDR_SIZE)
+	    return;
+	memcpy(&order, infodb.map + 8, 4);
+	memcpy(&version, infodb.map + 12, 4);
+	if (memcmp(infodb.map, INFODB_MAGIC, 8) != 0 ||
+	    order != INFODB_ORDER || version != INFODB_VERSION) {
+	    g_debug("%s: not a curinfo database", infodb.filename);
+	    return;
+	}
+	infodb.valid_end = INFODB_HDR_SIZE;
+    }
+
+    while (infodb.map_size - infodb.valid_end >= sizeof(infodb_rec_t)) {
+	infodb_rec_t rec;
+	const char *key;
+	char *k;
+
+	memcpy(&rec, infodb.map + infodb.valid_end, sizeof(rec));
+	if (rec.magic != INFODB_REC_MAGIC ||
+	    (guint64)rec.keylen + rec.datalen >
+		infodb.map_size - infodb.valid_end - sizeof(rec))
+	    break;
+	key = infodb.map + infodb.valid_end + sizeof(rec);
+	if (infodb_crc(key, rec.keylen, key + rec.keylen, rec.datalen)
+		!= rec.crc)
+	    break;
+
+	k = g_strndup(key, rec.keylen);
+	if ((old = g_hash_table_lookup(infodb.index, k)) != NULL) {
+	    infodb_rec_t orec;
+	    memcpy(&orec, infodb.map + *old, sizeof(orec));
+	    infodb.live -= sizeof(orec) + orec.keylen + orec.datalen;
+	}
+	if (rec.datalen) {
+	    offset = g_new(guint64, 1);
+	    *offset = infodb.valid_end;
+	    g_hash_table_insert(infodb.index, k, offset);
+	    infodb.live += sizeof(rec) + rec.keylen + rec.datalen;
+	} else {
+	    g_hash_table_remove(infodb.index, k);
+	    g_free(k);
+	}
+	infodb.valid_end += sizeof(rec) + rec.keylen + rec.datalen;
+    }
+}
+
+/* map and index the current content of the database */
+static int
+infodb_refresh(void)
+{
+    struct stat st;
+
+    if (stat(infodb.filename, &st) != 0) {
+	infodb_forget();
+	return errno == ENOENT ? 0 : -1;
+    }
+
+    if (infodb.fd >= 0 && (st.st_dev != infodb.dev || st.st_ino != infodb.ino))
+	infodb_forget();	/* compacted by another process */
+    if (infodb.fd < 0) {
+	if ((infodb.fd = open(infodb.filename, O_RDONLY)) < 0)
+	    return -1;
+	if (fstat(infodb.fd, &st) != 0) {
+	    infodb_forget();
+	    return -1;
+	}
+	infodb.dev = st.st_dev;
+	infodb.ino = st.st_ino;
+    }
+
+    if ((size_t)st.st_size == infodb.map_size)
+	return 0;
+
+    if ((size_t)st.st_size < infodb.valid_end) {
+	/* a writer truncated a partial record we had not indexed */
+	infodb.valid_end = 0;
+	infodb_reset_index();
+    }
+    infodb_unmap();
+    if (st.st_size > 0) {
+	infodb.map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED,
+			  infodb.fd, 0);
+	if (infodb.map == MAP_FAILED) {
+	    infodb.map = NULL;
+	    infodb_forget();
+	    return -1;
+	}
+	infodb.map_size = st.st_size;
+    }
+    infodb_scan();
+
+    return 0;
+}
+
+static void
+infodb_put_value(
+    GString *buf,
+    const void *data,
+    size_t len)
+{
+    g_string_append_len(buf, data, len);
+}
+
+#define INFODB_PUT(buf, v) infodb_put_value((buf), &(v), sizeof(v))
+#define INFODB_GET(p, end, v) \
+    ((size_t)((end) - (p)) >= sizeof(v) ? \
+	(memcpy(&(v), (p), sizeof(v)), (p) += sizeof(v), TRUE) : FALSE)
+
+/* the same information as write_txinfofile: the stats of the levels without
+ * a dump and the unused history are not stored */
+static void
+encode_info(
+    GString *buf,
+    info_t *info)
+{
+    guint32 n32;
+    gint64 n64;
+    gint32 level, i, nb_history;
+
+    n32 = info->command;
+    INFODB_PUT(buf, n32);
+    for (i = 0; i < AVG_COUNT; i++) {
+	INFODB_PUT(buf, info->full.rate[i]);
+	INFODB_PUT(buf, info->full.comp[i]);
+	INFODB_PUT(buf, info->incr.rate[i]);
+	INFODB_PUT(buf, info->incr.comp[i]);
+    }
+
+    for (level = 0; level < DUMP_LEVELS; level++) {
+	stats_t *sp = &info->inf[level];
+
+	if (sp->date < (time_t)0 && sp->label[0] == '\0')
+	    continue;
+	INFODB_PUT(buf, level);
+	n64 = sp->size;		INFODB_PUT(buf, n64);
+	n64 = sp->csize;	INFODB_PUT(buf, n64);
+	n64 = sp->secs;		INFODB_PUT(buf, n64);
+	n64 = sp->date;		INFODB_PUT(buf, n64);
+	n64 = sp->filenum;	INFODB_PUT(buf, n64);
+	n32 = strlen(sp->label);
+	INFODB_PUT(buf, n32);
+	infodb_put_value(buf, sp->label, n32);
+    }
+    level = -1;
+    INFODB_PUT(buf, level);
+
+    level = info->last_level;		INFODB_PUT(buf, level);
+    level = info->consecutive_runs;	INFODB_PUT(buf, level);
+
+    for (nb_history = 0;
+	 nb_history < NB_HISTORY && info->history[nb_history].level > -1;
+	 nb_history++) {
+    }
+    INFODB_PUT(buf, nb_history);
+    for (i = 0; i < nb_history; i++) {
+	history_t *hp = &info->history[i];
+
+	level = hp->level;	INFODB_PUT(buf, level);
+	n64 = hp->size;		INFODB_PUT(buf, n64);
+	n64 = hp->csize;	INFODB_PUT(buf, n64);
+	n64 = hp->date;		INFODB_PUT(buf, n64);
+	n64 = hp->secs;		INFODB_PUT(buf, n64);
+    }
+
+    /* the change token is optional, at the end of the record */
+    if (info->change_token[0] != '\0') {
+	n32 = strlen(info->change_token);
+	INFODB_PUT(buf, n32);
+	infodb_put_value(buf, info->change_token, n32);
+	for (nb_history = 0; nb_history < NB_TOKEN_EST &&
+			     info->token_est[nb_history].level >= 0;
+	     nb_history++) {
+	}
+	INFODB_PUT(buf, nb_history);
+	for (i = 0; i < nb_history; i++) {
+	    level = info->token_est[i].level;	INFODB_PUT(buf, level);
+	    n64 = info->token_est[i].size;	INFODB_PUT(buf, n64);
+	}
+    }
+}
+
+/* INFO must have been zeroed by zero_info */
+static int
+decode_info(
+    const char *p,
+    const char *end,
+    info_t *info)
+{
+    guint32 n32;
+    gint64 n64;
+    gint32 level, i, nb_history;
+
+    if (!INFODB_GET(p, end, n32))
+	return -2;
+    info->command = n32;
+    for (i = 0; i < AVG_COUNT; i++) {
+	if (!INFODB_GET(p, end, info->full.rate[i]) ||
+	    !INFODB_GET(p, end, info->full.comp[i]) ||
+	    !INFODB_GET(p, end, info->incr.rate[i]) ||
+	    !INFODB_GET(p, end, info->incr.comp[i]))
+	    return -2;
+    }
+
+    while (1) {
+	stats_t *sp;
+
+	if (!INFODB_GET(p, end, level))
+	    return -2;
+	if (level < 0)
+	    break;
+	if (level >= DUMP_LEVELS)
+	    return -2;
+	sp = &info->inf[level];
+	if (!INFODB_GET(p, end, n64)) return -2;
+	sp->size = n64;
+	if (!INFODB_GET(p, end, n64)) return -2;
+	sp->csize = n64;
+	if (!INFODB_GET(p, end, n64)) return -2;
+	sp->secs = n64;
+	if (!INFODB_GET(p, end, n64)) return -2;
+	sp->date = n64;
+	if (!INFODB_GET(p, end, n64)) return -2;
+	sp->filenum = n64;
+	if (!INFODB_GET(p, end, n32) || n32 >= sizeof(sp->label) ||
+	    (size_t)(end - p) < n32)
+	    return -2;
+	memcpy(sp->label, p, n32);
+	sp->label[n32] = '\0';
+	p += n32;
+    }
+
+    if (!INFODB_GET(p, end, level)) return -2;
+    info->last_level = level;
+    if (!INFODB_GET(p, end, level)) return -2;
+    info->consecutive_runs = level;
+
+    if (!INFODB_GET(p, end, nb_history) || nb_history < 0 ||
+	nb_history > NB_HISTORY)
+	return -2;
+    for (i = 0; i < nb_history; i++) {
+	history_t *hp = &info->history[i];
+
+	if (!INFODB_GET(p, end, level)) return -2;
+	hp->level = level;
+	if (!INFODB_GET(p, end, n64)) return -2;
+	hp->size = n64;
+	if (!INFODB_GET(p, end, n64)) return -2;
+	hp->csize = n64;
+	if (!INFODB_GET(p, end, n64)) return -2;
+	hp->date = n64;
+	if (!INFODB_GET(p, end, n64)) return -2;
+	hp->secs = n64;
+    }
+
+    if (p < end) {
+	if (!INFODB_GET(p, end, n32) || n32 >= sizeof(info->change_token) ||
+	    (size_t)(end - p) < n32)
+	    return -2;
+	memcpy(info->change_token, p, n32);
+	info->change_token[n32] = '\0';
+	p += n32;
+	if (!INFODB_GET(p, end, nb_history) || nb_history < 0 ||
+	    nb_history > NB_TOKEN_EST)
+	    return -2;
+	for (i = 0; i < nb_history; i++) {
+	    if (!INFODB_GET(p, end, level)) return -2;
+	    info->token_est[i].level = level;
+	    if (!INFODB_GET(p, end, n64)) return -2;
+	    info->token_est[i].size = n64;
+	}
+    }
+
+    return p == end ? 0 : -2;
+}
+
+static int
+infodb_get(
+    char *host,
+    char *disk,
+    info_t *info)
+{
+    char *key;
+    guint64 *offset;
+    infodb_rec_t rec;
+    const char *data;
+
+    if (infodb_refresh() != 0)
+	return -1;
+
+    key = infodb_key(host, disk);
+    offset = g_hash_table_lookup(infodb.index, key);
+    g_free(key);
+    if (!offset)
+	return -1; /* record not found */
+
+    memcpy(&rec, infodb.map + *offset, sizeof(rec));
+    data = infodb.map + *offset + sizeof(rec) + rec.keylen;
+    return decode_info(data, data + rec.datalen, info);
+}
+
+static int
+infodb_lock(void)
+{
+    char *lockname;
+
+    if (infodb.lock_fd >= 0)
+	return 0;
+
+    lockname = g_strconcat(infodb.filename, ".lock", NULL);
+    if (mkpdir(lockname, 0755, (uid_t)-1, (gid_t)-1) == -1 ||
+	(infodb.lock_fd = open(lockname, O_RDWR|O_CREAT, 0644)) < 0) {
+	g_free(lockname);
+	return -1;
+    }
+    g_free(lockname);
+    if (amflock(infodb.lock_fd, "info") != 0) {
+	close(infodb.lock_fd);
+	infodb.lock_fd = -1;
+	return -1;
+    }
+    return 0;
+}
+
+static void
+infodb_unlock(void)
+{
+    if (infodb.lock_fd < 0 || infodb.batch)
+	return;
+    amfunlock(infodb.lock_fd, "info");
+    close(infodb.lock_fd);
+    infodb.lock_fd = -1;
+}
+
+static void
+infodb_append_rec(
+    GString *buf,
+    const char *key,
+    const char *data,
+    guint32 datalen)
+{
+    infodb_rec_t rec;
+
+    rec.magic = INFODB_REC_MAGIC;
+    rec.keylen = strlen(key);
+    rec.datalen = datalen;
+    rec.crc = infodb_crc(key, rec.keylen, data, datalen);
+    infodb_put_value(buf, &rec, sizeof(rec));
+    infodb_put_value(buf, key, rec.keylen);
+    infodb_put_value(buf, data, datalen);
+}
+
+static void
+infodb_put_header(
+    GString *buf)
+{
+    guint32 order = INFODB_ORDER;
+    guint32 version = INFODB_VERSION;
+
+    infodb_put_value(buf, INFODB_MAGIC, 8);
+    INFODB_PUT(buf, order);
+    INFODB_PUT(buf, version);
+}
+
+static void
+infodb_copy_rec(
+    gpointer key G_GNUC_UNUSED,
+    gpointer value,
+    gpointer user_data)
+{
+    GString *buf = user_data;
+    guint64 offset = *(guint64 *)value;
+    infodb_rec_t rec;
+
+    memcpy(&rec, infodb.map + offset, sizeof(rec));
+    infodb_put_value(buf, infodb.map + offset,
+		     sizeof(rec) + rec.keylen + rec.datalen);
+}
+
+/* rewrite the file with only the current records; called with the lock */
+static void
+infodb_compact(void)
+{
+    GString *buf = g_string_sized_new(infodb.live + INFODB_HDR_SIZE);
+    char *newname;
+    int fd;
+    gboolean ok;
+
+    infodb_put_header(buf);
+    g_hash_table_foreach(infodb.index, infodb_copy_rec, buf);
+
+    newname = g_strconcat(infodb.filename, ".new", NULL);
+    fd = open(newname, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    ok = fd >= 0 &&
+	 full_write(fd, buf->str, buf->len) == buf->len &&
+	 fsync(fd) == 0;
+    if (fd >= 0 && close(fd) != 0)
+	ok = FALSE;
+    if (ok && rename(newname, infodb.filename) != 0)
+	ok = FALSE;
+    if (!ok) {
+	g_debug("could not compact %s: %s", infodb.filename, strerror(errno));
+	unlink(newname);
+    } else {
+	infodb_forget();
+	infodb_refresh();
+    }
+    g_free(newname);
+    g_string_free(buf, TRUE);
+}
+
+/* append a record for the DLE; a NULL INFO deletes it */
+static int
+infodb_write(
+    char *host,
+    char *disk,
+    info_t *info)
+{
+    char *key = infodb_key(host, disk);
+    GString *buf = g_string_sized_new(1024);
+    int fd = -1;
+    int rc = -1;
+    int save_errno;
+    struct stat st;
+
+    if (infodb_lock() != 0 || infodb_refresh() != 0)
+	goto out;
+
+    if (!info && !g_hash_table_lookup(infodb.index, key)) {
+	rc = 0;		/* nothing to delete */
+	goto out;
+    }
+
+    if ((fd = open(infodb.filename, O_RDWR|O_CREAT, 0644)) < 0 ||
+	fstat(fd, &st) != 0)
+	goto out;
+
+    if (infodb.valid_end == 0) {
+	/* a new or unreadable file */
+	if (st.st_size > 0) {
+	    char *oldname = g_strconcat(infodb.filename, ".bad", NULL);
+	    g_debug("%s is not a curinfo database, moved to %s",
+		    infodb.filename, oldname);
+	    close(fd);
+	    rename(infodb.filename, oldname);
+	    g_free(oldname);
+	    infodb_forget();
+	    if ((fd = open(infodb.filename, O_RDWR|O_CREAT|O_TRUNC, 0644)) < 0)
+		goto out;
+	}
+	infodb_put_header(buf);
+    } else if ((size_t)st.st_size > infodb.valid_end) {
+	/* drop a record cut by a crash */
+	if (ftruncate(fd, infodb.valid_end) != 0)
+	    goto out;
+    }
+
+    if (info) {
+	GString *data = g_string_sized_new(512);
+	encode_info(data, info);
+	infodb_append_rec(buf, key, data->str, data->len);
+	g_string_free(data, TRUE);
+    } else {
+	infodb_append_rec(buf, key, NULL, 0);
+    }
+
+    if (lseek(fd, infodb.valid_end ? (off_t)infodb.valid_end : 0,
+	      SEEK_SET) < 0 ||
+	full_write(fd, buf->str, buf->len) != buf->len ||
+	(!infodb.batch && fsync(fd) != 0))
+	goto out;
+    rc = 0;
+    close(fd);
+    fd = -1;
+
+    infodb_refresh();
+    if (infodb.valid_end > INFODB_COMPACT_SIZE &&
+	infodb.live < infodb.valid_end / 4) {
+	infodb_compact();
+    }
+
+out:
+    save_errno = errno;
+    if (fd >= 0)
+	close(fd);
+    infodb_unlock();
+    g_string_free(buf, TRUE);
+    g_free(key);
+    errno = save_errno;
+    return rc;
+}
+
+static int
+infodb_open(
+    char *dir)
+{
+    if (infodb.dir && !g_str_equal(infodb.dir, dir)) {
+	infodb_forget();
+	amfree(infodb.dir);
+	amfree(infodb.filename);
+    }
+    if (!infodb.dir) {
+	infodb.dir = g_strdup(dir);
+	infodb.filename = g_strjoin("/", dir, INFODB_NAME, NULL);
+    }
+    if (!infodb.index) {
+	infodb_reset_index();
+    }
+
+    return infodb_refresh();
+}
+
+/* Hold the write lock of the database, and delay the fsync, across several
+ * put_info or del_info, until infofile_end_batch. */
+int
+infofile_begin_batch(void)
+{
+    if (!use_infodb)
+	return 0;
+    if (infodb_lock() != 0)
+	return -1;
+    infodb.batch++;
+    return 0;
+}
+
+int
+infofile_end_batch(void)
+{
+    int rc = 0;
+
+    if (!use_infodb || infodb.batch == 0)
+	return 0;
+    if (--infodb.batch == 0) {
+	int fd = open(infodb.filename, O_RDONLY);
+	if (fd >= 0) {
+	    rc = fsync(fd);
+	    close(fd);
+	}
+	infodb_unlock();
+    }
+    return rc;
+}
+
 int
 open_infofile(
     char *	filename)
@@ -519,6 +1219,14 @@ open_infofile(
 
     infodir = g_strdup(filename);
 
+    use_infodb = config_is_initialized() &&
+		 g_str_equal(getconf_str(CNF_INFOFILE_FORMAT), "db");
+    if (use_infodb && infodb_open(infodir) != 0) {
+	g_debug("could not open %s: %s", infodb.filename, strerror(errno));
+	amfree(infodir);
+	return -1;
+    }
+
     return 0; /* success! */
 }
 
@@ -527,6 +1235,9 @@ close_infofile(void)
 {
     assert(infodir != NULL);
 
+    /* the database stays mapped for the next open_infofile */
+    while (infodb.batch)
+	infofile_end_batch();
     amfree(infodir);
 }
 
@@ -635,6 +1346,10 @@ zero_info(
 	info->history[i].csize = (off_t)0;
 	info->history[i].date = 0UL;
     }
+
+    for(i = 0; i < NB_TOKEN_EST; i++) {
+	info->token_est[i].level = -1;
+    }
     return;
 }
 
@@ -648,6 +1363,15 @@ get_info(
 
     (void) zero_info(info);
 
+    if (use_infodb) {
+	rc = infodb_get(hostname, diskname, info);
+	if (rc != -1)
+	    return rc;
+	/* not in the database yet: read the record of the directory format,
+	 * that is moved to the database by the next put_info */
+	zero_info(info);
+    }
+
     {
 	FILE *infof;
 
@@ -666,6 +1390,84 @@ get_info(
     return rc;
 }
 
+/*
+ * A cache of the info files of the directory format, for the processes that
+ * read the info of every DLE again and again, like the perl tools through
+ * Amanda::Infofile.  An entry is reused while its file has the same device,
+ * inode, size and mtime, and was not changed in the second it was read: a
+ * second change in that second would not show in the mtime.  The database
+ * format needs no cache, it is mapped and indexed by infodb_refresh.
+ */
+typedef struct info_cache_s {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    time_t read_time;
+    info_t info;
+} info_cache_t;
+
+static GHashTable *info_cache = NULL;	/* info file name -> info_cache_t */
+
+int
+get_info_cached(
+    char *	hostname,
+    char *	diskname,
+    info_t *	info)
+{
+    char *myhost, *mydisk, *fn;
+    info_cache_t *ic;
+    struct stat st;
+    time_t now;
+    int rc;
+
+    if (use_infodb)
+	return get_info(hostname, diskname, info);
+
+    myhost = sanitise_filename(hostname);
+    mydisk = sanitise_filename(diskname);
+    fn = g_strjoin(NULL, infodir, "/", myhost, "/", mydisk, "/info", NULL);
+    amfree(myhost);
+    amfree(mydisk);
+
+    if (!info_cache)
+	info_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+					   g_free, g_free);
+
+    if (stat(fn, &st) != 0) {
+	g_hash_table_remove(info_cache, fn);
+	g_free(fn);
+	return get_info(hostname, diskname, info);
+    }
+
+    ic = g_hash_table_lookup(info_cache, fn);
+    if (ic && ic->dev == st.st_dev && ic->ino == st.st_ino &&
+	ic->size == st.st_size && ic->mtime == st.st_mtime &&
+	ic->read_time > st.st_mtime) {
+	memcpy(info, &ic->info, sizeof(info_t));
+	g_free(fn);
+	return 0;
+    }
+
+    now = time(NULL);
+    rc = get_info(hostname, diskname, info);
+    if (rc == 0) {
+	ic = g_new(info_cache_t, 1);
+	ic->dev = st.st_dev;
+	ic->ino = st.st_ino;
+	ic->size = st.st_size;
+	ic->mtime = st.st_mtime;
+	ic->read_time = now;
+	memcpy(&ic->info, info, sizeof(info_t));
+	g_hash_table_insert(info_cache, fn, ic);
+    } else {
+	g_hash_table_remove(info_cache, fn);
+	g_free(fn);
+    }
+
+    return rc;
+}
+
 
 int
 put_info(
@@ -676,6 +1478,9 @@ put_info(
     FILE *infof;
     int rc;
 
+    if (use_infodb)
+	return infodb_write(hostname, diskname, info);
+
     infof = open_txinfofile(hostname, diskname, "w");
 
     if(infof == NULL) return -1;
@@ -693,6 +1498,11 @@ del_info(
     char *	hostname,
     char *	diskname)
 {
+    if (use_infodb) {
+	int rc = infodb_write(hostname, diskname, NULL);
+	delete_txinfofile(hostname, diskname);
+	return rc;
+    }
     return delete_txinfofile(hostname, diskname);
 }
 
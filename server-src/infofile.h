@@ -41,6 +41,7 @@
 
 #define AVG_COUNT	3
 #define NB_HISTORY	100
+#define NB_TOKEN_EST	3	/* estimates kept with the change token */
 #define newperf(ary,f)	( ary[2]=ary[1], ary[1]=ary[0], ary[0]=(f) )
 
 typedef struct stats_s {
@@ -62,6 +63,12 @@ typedef struct history_s {
     time_t secs;		/* time of dump in secs */
 } history_t;
 
+/* an estimate of the last run, reused while the change token is the same */
+typedef struct token_est_s {
+    int level;			/* level of the estimate, -1 if unused */
+    off_t size;			/* estimated size in kbytes */
+} token_est_t;
+
 typedef struct perf_s {
     double rate[AVG_COUNT];
     double comp[AVG_COUNT];
@@ -82,6 +89,8 @@ typedef struct info_s {
     stats_t inf[DUMP_LEVELS];
     int last_level, consecutive_runs;
     history_t history[NB_HISTORY+1];
+    char change_token[MAX_LABEL];	/* client change token of the estimates */
+    token_est_t token_est[NB_TOKEN_EST];
 } info_t;
 
 
@@ -92,7 +101,16 @@ char *get_dumpdate(info_t *info, int level);
 char *get_based_on_timestamp(info_t *info, int lev);
 double perf_average(double *array, double def);
 int get_info(char *hostname, char *diskname, info_t *info);
+/* Like get_info, but keep what is read from the directory format in a
+ * per-process cache, reread only when the info file changes. */
+int get_info_cached(char *hostname, char *diskname, info_t *info);
 int put_info(char *hostname, char *diskname, info_t *info);
 int del_info(char *hostname, char *diskname);
 
+/* With infofile-format "db", hold the database lock and delay the sync to
+ * disk across several put_info and del_info, up to infofile_end_batch.  They
+ * do nothing with the directory format. */
+int infofile_begin_batch(void);
+int infofile_end_batch(void);
+
 #endif /* ! INFOFILE_H */
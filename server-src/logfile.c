@@ -67,6 +67,18 @@ int multiline = -1;
 static char *logfile;
 static int logfd = -1;
 
+/* keep-open mode, see log_set_keep_open */
+static gboolean log_keep_open = FALSE;
+static dev_t logfd_dev;
+static ino_t logfd_ino;
+static time_t log_last_sync = 0;
+static gboolean log_need_sync = FALSE;
+static GString *log_multibuf = NULL;	/* the record being built */
+static GString *log_bin_multibuf = NULL; /* and its binary log records */
+
+/* the binary log, opened and closed with the text log */
+static int binfd = -1;
+
  /*
   * Note that technically we could use two locks, a read lock
   * from 0-EOF and a write-lock from EOF-EOF, thus leaving the
@@ -79,6 +91,14 @@ static int logfd = -1;
 /* local functions */
 static void open_log(void);
 static void close_log(void);
+static void write_log_record(const char *buf, size_t len);
+static void sync_log(gboolean force);
+static void release_kept_log(void);
+static void open_binlog(void);
+static void close_binlog(void);
+static void write_binlog_record(const char *buf, size_t len);
+static void add_binlog_record(GString *buf, logtype_t typ, char *pname,
+			      const char *msg, size_t len);
 
 void
 amanda_log_trace_log(
@@ -104,6 +124,8 @@ static void log_add_full_v(logtype_t typ, char *pname, char *format, va_list arg
     char *leader = NULL;
     char *xlated_fmt = gettext(format);
     char linebuf[STR_SIZE];
+    char *record;
+    GString *bin;
     size_t n;
     static gboolean in_log_add = 0;
 
@@ -129,29 +151,33 @@ static void log_add_full_v(logtype_t typ, char *pname, char *format, va_list arg
 
     in_log_add = 1;
 
-    /* append message to the log file */
-
-    if(multiline == -1) open_log();
-
-    if (full_write(logfd, leader, strlen(leader)) < strlen(leader)) {
-	error(_("log file write error: %s"), strerror(errno));
-	/*NOTREACHED*/
-    }
-
-    amfree(leader);
-
     /* add a newline if necessary */
     n = strlen(linebuf);
     if(n == 0 || linebuf[n-1] != '\n') linebuf[n++] = '\n';
     linebuf[n] = '\0';
 
-    if (full_write(logfd, linebuf, n) < n) {
-	error(_("log file write error: %s"), strerror(errno));
-	/*NOTREACHED*/
+    /* append message to the log file, as a single write so that it is not
+     * interleaved with the lines of the other processes */
+
+    record = g_strconcat(leader, linebuf, NULL);
+    amfree(leader);
+    bin = g_string_sized_new(BINLOG_HEADER_SIZE + n);
+    add_binlog_record(bin, multiline > 0 ? L_CONT : typ, pname, linebuf, n-1);
+
+    if (log_keep_open && multiline != -1) {
+	/* the whole multiline record is written by log_end_multiline */
+	g_string_append(log_multibuf, record);
+	g_string_append_len(log_bin_multibuf, bin->str, bin->len);
+    } else {
+	if(multiline == -1) open_log();
+	write_log_record(record, strlen(record));
+	write_binlog_record(bin->str, bin->len);
+	if(multiline == -1) close_log();
     }
+    g_free(record);
+    g_string_free(bin, TRUE);
 
     if(multiline != -1) multiline++;
-    else close_log();
 
     in_log_add = 0;
 }
@@ -180,7 +206,16 @@ log_start_multiline(void)
     assert(multiline == -1);
 
     multiline = 0;
-    open_log();
+    if (log_keep_open) {
+	if (!log_multibuf) {
+	    log_multibuf = g_string_new(NULL);
+	    log_bin_multibuf = g_string_new(NULL);
+	}
+	g_string_truncate(log_multibuf, 0);
+	g_string_truncate(log_bin_multibuf, 0);
+    } else {
+	open_log();
+    }
 }
 
 
@@ -189,7 +224,39 @@ log_end_multiline(void)
 {
     assert(multiline != -1);
     multiline = -1;
-    close_log();
+    if (log_keep_open) {
+	open_log();
+	write_log_record(log_multibuf->str, log_multibuf->len);
+	write_binlog_record(log_bin_multibuf->str, log_bin_multibuf->len);
+	close_log();
+	g_string_truncate(log_multibuf, 0);
+	g_string_truncate(log_bin_multibuf, 0);
+    } else {
+	close_log();
+    }
+}
+
+void
+log_set_keep_open(
+    gboolean keep_open)
+{
+    static gboolean atexit_done = FALSE;
+
+    assert(multiline == -1);
+    if (!keep_open)
+	release_kept_log();
+    log_keep_open = keep_open;
+    if (keep_open && !atexit_done) {
+	atexit(release_kept_log);
+	atexit_done = TRUE;
+    }
+}
+
+void
+log_sync(void)
+{
+    if (logfd != -1 && log_keep_open)
+	sync_log(TRUE);
 }
 
 char *
@@ -290,6 +357,8 @@ void
 set_logname(
     char *filename)
 {
+    release_kept_log();
+    g_free(logfile);
     logfile = g_strdup(filename);
 }
 
@@ -306,6 +375,7 @@ log_rename(
 
     if(datestamp == NULL) datestamp = "error";
 
+    release_kept_log();
     conf_logdir = config_dir_relative(getconf_str(CNF_LOGDIR));
     logfile = g_strjoin(NULL, conf_logdir, "/log", NULL);
 
@@ -325,6 +395,16 @@ log_rename(
     if(rename(logfile, fname) == -1) {
 	g_debug(_("could not rename \"%s\" to \"%s\": %s"),
 	      logfile, fname, strerror(errno));
+    } else {
+	char *binlog = get_binlog_name(logfile);
+	char *binfname = get_binlog_name(fname);
+
+	if (rename(binlog, binfname) == -1 && errno != ENOENT) {
+	    g_debug(_("could not rename \"%s\" to \"%s\": %s"),
+		  binlog, binfname, strerror(errno));
+	}
+	g_free(binlog);
+	g_free(binfname);
     }
 
     amfree(fname);
@@ -336,12 +416,35 @@ log_rename(
 static void
 open_log(void)
 {
+    if (log_keep_open && logfd != -1) {
+	struct stat sb;
+
+	/* reopen if the log was renamed or removed under us */
+	if (stat(logfile, &sb) == 0 &&
+	    sb.st_dev == logfd_dev && sb.st_ino == logfd_ino)
+	    return;
+	release_kept_log();
+    }
+
     logfd = open(logfile, O_WRONLY|O_CREAT|O_APPEND, 0600);
 
     if(logfd == -1) {
 	error(_("could not open log file %s: %s"), logfile, strerror(errno));
 	/*NOTREACHED*/
     }
+    open_binlog();
+
+    if (log_keep_open) {
+	struct stat sb;
+
+	/* every record is a single O_APPEND write, so it needs no lock */
+	if (fstat(logfd, &sb) == 0) {
+	    logfd_dev = sb.st_dev;
+	    logfd_ino = sb.st_ino;
+	}
+	log_last_sync = time(NULL);
+	return;
+    }
 
     if(amflock(logfd, "log") == -1) {
 	error(_("could not lock log file %s: %s"), logfile, strerror(errno));
@@ -353,6 +456,11 @@ open_log(void)
 static void
 close_log(void)
 {
+    if (log_keep_open) {
+	sync_log(FALSE);
+	return;
+    }
+
     if(amfunlock(logfd, "log") == -1) {
 	error(_("could not unlock log file %s: %s"), logfile, strerror(errno));
 	/*NOTREACHED*/
@@ -364,6 +472,156 @@ close_log(void)
     }
 
     logfd = -1;
+    close_binlog();
+}
+
+static void
+write_log_record(
+    const char *buf,
+    size_t len)
+{
+    if (full_write(logfd, buf, len) < len) {
+	error(_("log file write error: %s"), strerror(errno));
+	/*NOTREACHED*/
+    }
+    log_need_sync = TRUE;
+}
+
+/* In keep-open mode the records written since the last sync are flushed to
+ * disk together, at most LOG_SYNC_INTERVAL seconds after the first of them,
+ * and when the log is released. */
+static void
+sync_log(
+    gboolean force)
+{
+    time_t now;
+
+    if (!log_need_sync)
+	return;
+    now = time(NULL);
+    if (!force && now - log_last_sync < LOG_SYNC_INTERVAL)
+	return;
+    if (fsync(logfd) == -1 && errno != EINVAL) {
+	g_debug("could not fsync log file %s: %s", logfile, strerror(errno));
+    }
+    log_last_sync = now;
+    log_need_sync = FALSE;
+}
+
+/* close the descriptor kept open in keep-open mode */
+static void
+release_kept_log(void)
+{
+    if (!log_keep_open || logfd == -1)
+	return;
+
+    sync_log(TRUE);
+    if(close(logfd) == -1) {
+	g_debug("close log file: %s", strerror(errno));
+    }
+    logfd = -1;
+    close_binlog();
+}
+
+char *
+get_binlog_name(
+    const char *logname)
+{
+    const char *slash = strrchr(logname, '/');
+
+    if (!slash)
+	return g_strconcat("bin", logname, NULL);
+    return g_strdup_printf("%.*s/bin%s", (int)(slash - logname), logname,
+			   slash + 1);
+}
+
+/* The binary log is not needed to run, so its errors are only logged to
+ * the debug file; the records are written under the lock of the text log,
+ * or in a single O_APPEND write in keep-open mode. */
+static void
+open_binlog(void)
+{
+    char *binlog;
+
+    if (binfd != -1)
+	return;
+    binlog = get_binlog_name(logfile);
+    binfd = open(binlog, O_WRONLY|O_CREAT|O_APPEND, 0600);
+    if (binfd == -1) {
+	g_debug("could not open binary log %s: %s", binlog, strerror(errno));
+    }
+    g_free(binlog);
+}
+
+static void
+close_binlog(void)
+{
+    if (binfd == -1)
+	return;
+    if (close(binfd) == -1) {
+	g_debug("close binary log: %s", strerror(errno));
+    }
+    binfd = -1;
+}
+
+static void
+write_binlog_record(
+    const char *buf,
+    size_t len)
+{
+    if (binfd == -1 || len == 0)
+	return;
+    if (full_write(binfd, buf, len) < len) {
+	g_debug("binary log write error: %s", strerror(errno));
+    }
+}
+
+static void
+binlog_put32(
+    GString *buf,
+    guint32 v)
+{
+    v = htonl(v);
+    g_string_append_len(buf, (char *)&v, 4);
+}
+
+static void
+binlog_put16(
+    GString *buf,
+    guint16 v)
+{
+    v = htons(v);
+    g_string_append_len(buf, (char *)&v, 2);
+}
+
+static void
+add_binlog_record(
+    GString    *buf,
+    logtype_t   typ,
+    char       *pname,
+    const char *msg,
+    size_t      len)
+{
+    program_t prog;
+    GTimeVal now;
+
+    for (prog = P_UNKNOWN + 1; prog <= P_LAST; prog++) {
+	if (pname && g_str_equal(program_str[prog], pname))
+	    break;
+    }
+    if (prog > P_LAST)
+	prog = P_UNKNOWN;
+    g_get_current_time(&now);
+
+    binlog_put32(buf, BINLOG_MAGIC);
+    binlog_put32(buf, BINLOG_HEADER_SIZE + len + 1);
+    binlog_put16(buf, typ);
+    binlog_put16(buf, prog);
+    binlog_put32(buf, getpid());
+    binlog_put32(buf, now.tv_sec);
+    binlog_put32(buf, now.tv_usec);
+    g_string_append_len(buf, msg, len);
+    g_string_append_c(buf, '\0');
 }
 
 /* WARNING: Function accesses globals curstr, curlog, and curprog
@@ -372,8 +630,26 @@ int
 get_logline(
     FILE *	logf)
 {
-    static char *logline = NULL;
-    static size_t line_size = 0;
+    static logline_t ll;
+
+    if (!get_logline_r(logf, &ll))
+	return 0;
+
+    curlinenum++;
+    curlog = ll.curlog;
+    if (curlog != L_CONT)
+	curprog = ll.curprog;
+    curstr = ll.curstr;
+    return 1;
+}
+
+/* Like get_logline, but the line is returned in LL instead of the globals,
+ * so several files can be read at once, in several threads. */
+int
+get_logline_r(
+    FILE *	logf,
+    logline_t *	ll)
+{
     char *lline;
     size_t loffset = 0;
     char *logstr, *progstr;
@@ -381,47 +657,47 @@ get_logline(
     int ch;
     int n;
 
-    if (!logline) {
-	line_size = 256;
-	logline = g_malloc(line_size);
+    if (!ll->line) {
+	ll->line_size = 256;
+	ll->line = g_malloc(ll->line_size);
     }
 
-    logline[0] = '\0';
+    ll->line[0] = '\0';
     while(1) {
-	lline = untaint_fgets(logline + loffset, line_size - loffset, logf);
+	lline = untaint_fgets(ll->line + loffset, ll->line_size - loffset, logf);
 	if (lline == NULL) {
 	    break; /* EOF */
 	}
-	if (strlen(logline) == line_size -1 &&
-		   logline[strlen(logline)-1] != '\n') {
-	    line_size *= 2;
-	    logline = g_realloc(logline, line_size);
-	    loffset = strlen(logline);
-	} else if (strlen(logline) == 0 ||
-		   (strlen(logline) == 1 && logline[0] == '\n')) {
+	if (strlen(ll->line) == ll->line_size -1 &&
+		   ll->line[strlen(ll->line)-1] != '\n') {
+	    ll->line_size *= 2;
+	    ll->line = g_realloc(ll->line, ll->line_size);
+	    loffset = strlen(ll->line);
+	} else if (strlen(ll->line) == 0 ||
+		   (strlen(ll->line) == 1 && ll->line[0] == '\n')) {
 	} else {
 	    break; /* good line */
 	}
-	logline[loffset] = '\0';
+	ll->line[loffset] = '\0';
     }
-    if (logline[0] == '\0')
+    if (ll->line[0] == '\0')
 	return 0;
 
     /* remove \n */
-    n = strlen(logline);
-    if (logline[n-1] == '\n') logline[n-1] = '\0';
+    n = strlen(ll->line);
+    if (ll->line[n-1] == '\n') ll->line[n-1] = '\0';
 
-    curlinenum++;
-    s = logline;
+    ll->linenum++;
+    s = ll->line;
     ch = *s++;
 
     /* continuation lines are special */
 
-    if(logline[0] == ' ' && logline[1] == ' ') {
-	curlog = L_CONT;
+    if(ll->line[0] == ' ' && ll->line[1] == ' ') {
+	ll->curlog = L_CONT;
 	/* curprog stays the same */
 	skip_whitespace(s, ch);
-	curstr = s-1;
+	ll->curstr = s-1;
 	return 1;
     }
 
@@ -447,19 +723,28 @@ get_logline(
     /* rest of line is logtype dependent string */
 
     skip_whitespace(s, ch);
-    curstr = s - 1;
+    ll->curstr = s - 1;
 
     /* lookup strings */
 
-    for(curlog = L_MARKER; curlog != L_BOGUS; curlog--)
-	if(g_str_equal(logtype_str[curlog], logstr)) break;
+    for(ll->curlog = L_MARKER; ll->curlog != L_BOGUS; ll->curlog--)
+	if(g_str_equal(logtype_str[ll->curlog], logstr)) break;
 
-    for(curprog = P_LAST; curprog != P_UNKNOWN; curprog--)
-	if(g_str_equal(program_str[curprog], progstr)) break;
+    for(ll->curprog = P_LAST; ll->curprog != P_UNKNOWN; ll->curprog--)
+	if(g_str_equal(program_str[ll->curprog], progstr)) break;
 
     return 1;
 }
 
+void
+free_logline(
+    logline_t *	ll)
+{
+    amfree(ll->line);
+    ll->line_size = 0;
+    ll->curstr = NULL;
+}
+
 char *
 get_logtype_str(
     logtype_t logtype)
@@ -474,3 +759,179 @@ get_program_str(
     return program_str[program];
 }
 
+/*
+ * Binary log reader
+ */
+
+struct binlog_s {
+    int fd;
+    char *map;
+    gsize map_size;
+    gsize pos;			/* of the next record */
+    guint32 filter;
+};
+
+/* map the log again if it grew; FALSE if it did not */
+static gboolean
+binlog_remap(
+    binlog_t *bl)
+{
+    struct stat st;
+
+    if (fstat(bl->fd, &st) == -1 || (gsize)st.st_size <= bl->map_size)
+	return FALSE;
+    if (bl->map)
+	munmap(bl->map, bl->map_size);
+    bl->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, bl->fd, 0);
+    if (bl->map == MAP_FAILED) {
+	g_debug("could not map binary log: %s", strerror(errno));
+	bl->map = NULL;
+	bl->map_size = 0;
+	return FALSE;
+    }
+    bl->map_size = st.st_size;
+    return TRUE;
+}
+
+binlog_t *
+binlog_open(
+    const char *filename)
+{
+    binlog_t *bl;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd == -1)
+	return NULL;
+    bl = g_new0(binlog_t, 1);
+    bl->fd = fd;
+    binlog_remap(bl);
+    return bl;
+}
+
+static guint32
+binlog_get32(
+    const char *p)
+{
+    guint32 v;
+
+    memcpy(&v, p, 4);
+    return ntohl(v);
+}
+
+static guint16
+binlog_get16(
+    const char *p)
+{
+    guint16 v;
+
+    memcpy(&v, p, 2);
+    return ntohs(v);
+}
+
+/* read the record at bl->pos, whatever its type */
+static gboolean
+binlog_read(
+    binlog_t *bl,
+    binlog_event_t *ev)
+{
+    const char *rec;
+    guint32 len;
+
+    for (;;) {
+	rec = bl->map + bl->pos;
+	if (bl->map_size - bl->pos >= BINLOG_HEADER_SIZE) {
+	    len = binlog_get32(rec + 4);
+	    if (binlog_get32(rec) != BINLOG_MAGIC ||
+		len <= BINLOG_HEADER_SIZE) {
+		g_debug("bad record in binary log at offset %zu", bl->pos);
+		return FALSE;
+	    }
+	    if (bl->map_size - bl->pos >= len)
+		break;
+	}
+	/* the record is not all there yet */
+	if (!binlog_remap(bl))
+	    return FALSE;
+    }
+    if (rec[len - 1] != '\0') {
+	g_debug("bad record in binary log at offset %zu", bl->pos);
+	return FALSE;
+    }
+
+    ev->type = binlog_get16(rec + 8);
+    ev->program = binlog_get16(rec + 10);
+    if ((int)ev->type > (int)L_MARKER)
+	ev->type = L_BOGUS;
+    if ((int)ev->program > (int)P_LAST)
+	ev->program = P_UNKNOWN;
+    ev->pid = binlog_get32(rec + 12);
+    ev->sec = binlog_get32(rec + 16);
+    ev->usec = binlog_get32(rec + 20);
+    ev->message = rec + BINLOG_HEADER_SIZE;
+    ev->offset = bl->pos;
+    bl->pos += len;
+    return TRUE;
+}
+
+gboolean
+binlog_next(
+    binlog_t *bl,
+    binlog_event_t *ev)
+{
+    while (binlog_read(bl, ev)) {
+	if (!bl->filter || (bl->filter & BINLOG_TYPE(ev->type)))
+	    return TRUE;
+    }
+    return FALSE;
+}
+
+void
+binlog_set_filter(
+    binlog_t *bl,
+    guint32 type_mask)
+{
+    bl->filter = type_mask;
+}
+
+void
+binlog_seek(
+    binlog_t *bl,
+    gsize offset)
+{
+    bl->pos = offset;
+    if (bl->pos > bl->map_size)
+	binlog_remap(bl);
+    if (bl->pos > bl->map_size)
+	bl->pos = bl->map_size;
+}
+
+/* the records of the processes of a run are in the order they were written,
+ * so the time only goes forward */
+void
+binlog_seek_time(
+    binlog_t *bl,
+    time_t when)
+{
+    binlog_event_t ev;
+
+    bl->pos = 0;
+    while (binlog_read(bl, &ev)) {
+	if (ev.sec >= when) {
+	    bl->pos = ev.offset;
+	    return;
+	}
+    }
+}
+
+void
+binlog_close(
+    binlog_t *bl)
+{
+    if (!bl)
+	return;
+    if (bl->map)
+	munmap(bl->map, bl->map_size);
+    close(bl->fd);
+    g_free(bl);
+}
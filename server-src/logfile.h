@@ -66,6 +66,17 @@ typedef enum program_e {
 
 extern char *logtype_str[];
 
+/* A line read by get_logline_r.  Zero it before the first call, and free it
+ * with free_logline. */
+typedef struct logline_s {
+    logtype_t curlog;
+    program_t curprog;	/* kept from the previous line for L_CONT */
+    char *curstr;	/* points into line */
+    int linenum;
+    char *line;
+    size_t line_size;
+} logline_t;
+
 extern int curlinenum;
 extern logtype_t curlog;
 extern program_t curprog;
@@ -80,10 +91,80 @@ void log_add(logtype_t typ, char * format, ...) G_GNUC_PRINTF(2, 3);
 void log_add_full(logtype_t typ, char *pname, char *format, ...) G_GNUC_PRINTF(3, 4);
 void log_start_multiline(void);
 void log_end_multiline(void);
+
+/* seconds between the syncs of the log in keep-open mode */
+#define LOG_SYNC_INTERVAL 1
+
+/* In keep-open mode, the log file descriptor stays open between log_add
+ * calls, each record, including a whole multiline record, is written to it
+ * with a single O_APPEND write and no lock, and the log is synced to disk at
+ * most every LOG_SYNC_INTERVAL seconds and when the log is closed or the
+ * process exits.  It is used by the processes of a run, that add many lines.
+ *
+ * @param keep_open: TRUE to enter keep-open mode, FALSE to leave it
+ */
+void log_set_keep_open(gboolean keep_open);
+
+/* Sync the records written in keep-open mode to disk now */
+void log_sync(void);
 char *make_logname(char *process, char *datestamp);
 char *get_logname(void);
 void set_logname(char *filename);
 void log_rename(char *datestamp);
 int get_logline(FILE *);
+int get_logline_r(FILE *logf, logline_t *ll);
+void free_logline(logline_t *ll);
+
+/*
+ * The binary event log.  Each record written to the log by log_add is also
+ * appended, as a typed and length-prefixed record, to a binary log named
+ * like the text log with a "bin" prefix (log.20240101000000.0 has
+ * binlog.20240101000000.0), so that tools can find the events of a run
+ * without parsing the text.  A record is, in network byte order:
+ *
+ *   guint32 magic	 BINLOG_MAGIC
+ *   guint32 length	 of the whole record
+ *   guint16 type	 a logtype_t, L_CONT for a continuation line
+ *   guint16 program	 a program_t
+ *   guint32 pid
+ *   guint32 sec, usec	 when the record was written
+ *   the message, without its newline, and a NUL byte
+ */
+#define BINLOG_MAGIC	   0x414d4c47	/* "AMLG" */
+#define BINLOG_HEADER_SIZE 24
+
+/* The binary log of the text log LOGNAME */
+char *get_binlog_name(const char *logname);
+
+typedef struct binlog_event_s {
+    logtype_t type;
+    program_t program;
+    long pid;
+    time_t sec;
+    long usec;
+    const char *message;	/* points into the log, valid until binlog_close */
+    gsize offset;		/* of the record in the log */
+} binlog_event_t;
+
+typedef struct binlog_s binlog_t;
+
+/* Map the binary log FILENAME for reading; NULL if it can't be opened */
+binlog_t *binlog_open(const char *filename);
+
+/* Read the next record whose type is in the filter into EV; FALSE at the
+ * end of the log, which is mapped again if it grew meanwhile */
+gboolean binlog_next(binlog_t *bl, binlog_event_t *ev);
+
+/* Only return the records whose type is in the mask of BINLOG_TYPE bits,
+ * or all records for a mask of 0 */
+#define BINLOG_TYPE(t) (1U << (t))
+void binlog_set_filter(binlog_t *bl, guint32 type_mask);
+
+/* Continue at the record at OFFSET, or at the first record written at
+ * WHEN or later */
+void binlog_seek(binlog_t *bl, gsize offset);
+void binlog_seek_time(binlog_t *bl, time_t when);
+
+void binlog_close(binlog_t *bl);
 
 #endif  /* ! LOGFILE_H */
@@ -59,6 +59,7 @@
 #define RUNS_REDZONE		    5	/* should be in conf file? */
 
 #define PROMOTE_THRESHOLD	 0.05	/* if <5% unbalanced, don't promote */
+#define STREAM_SCHEDULE_SHARE	 0.5	/* of the tape, for the streamed dumps */
 #define DEFAULT_DUMPRATE	 1024.0	/* K/s */
 
 /* configuration file stuff */
@@ -70,6 +71,8 @@ int	conf_dumpcycle;
 int	conf_runspercycle;
 int	conf_tapecycle;
 time_t	conf_etimeout;
+int	conf_estimate_parallel;
+gboolean conf_stream_schedule;
 int	conf_reserve;
 int	conf_usetimestamps;
 
@@ -111,6 +114,8 @@ typedef struct est_s {
     double fullcomp, incrcomp;
     char *errstr;
     char *degr_mesg;
+    char *change_token;		/* change token reported by the client */
+    gboolean unchanged;		/* the client did no estimate, kept ones used */
     info_t *info;
 } est_t;
 
@@ -128,8 +133,17 @@ estlist_t failq;	// REP received, failed
 estlist_t schedq;	// REP received and valid, analyze done.
 estlist_t activeq;	//
 
+/* the est_t of each disk_t, for find_est_for_dp */
+static GHashTable *est_by_disk = NULL;
+
+/* the est_t, info_t and dump dates of every disk live until the planner
+ * exits, so they come from one arena instead of a malloc each */
+static amarena_t *planner_arena = NULL;
+
 gint64 total_size;
 double total_lev0, balanced_size, balance_threshold;
+gint64 streamed_size = 0;	/* size of the dumps sent before the estimates end */
+int nb_streamed = 0;
 gint64 tape_length;
 size_t tape_mark;
 
@@ -180,11 +194,13 @@ typedef struct cmdfile_data_s {
 static void setup_estimate(disk_t *dp);
 static void get_estimates(void);
 static void analyze_estimate(est_t *est);
+static gint schedule_order_data(gconstpointer a, gconstpointer b);
 static void handle_failed(est_t *est);
 static void delay_dumps(void);
 static int promote_highest_priority_incremental(void);
 static int promote_hills(void);
 static void output_scheduleline(est_t *est);
+static void stream_schedule(void);
 static void server_estimate(est_t *est, int i, info_t *info, int level,
 			    tapetype_t *tapetype);
 
@@ -313,6 +329,7 @@ main(
                                                  "--log-filename")) {
 	log_filename = g_strdup(argv[diskarg_offset+1]);
 	set_logname(log_filename);
+	log_set_keep_open(TRUE);
 	diskarg_offset += 2;
     }
     if (argc - diskarg_offset > 0 && g_str_equal(argv[diskarg_offset],
@@ -404,6 +421,8 @@ main(
     conf_dumpcycle = getconf_int(CNF_DUMPCYCLE);
     conf_runspercycle = getconf_int(CNF_RUNSPERCYCLE);
     conf_etimeout = (time_t)getconf_int(CNF_ETIMEOUT);
+    conf_estimate_parallel = getconf_int(CNF_ESTIMATE_PARALLEL);
+    conf_stream_schedule = getconf_boolean(CNF_STREAM_SCHEDULE);
     conf_reserve  = getconf_int(CNF_RESERVE);
     conf_usetimestamps = getconf_boolean(CNF_USETIMESTAMPS);
 
@@ -677,6 +696,7 @@ main(
     section_start = curclock();
 
     startq.head = startq.tail = NULL;
+    planner_arena = amarena_new(0);
     while(!empty(origq)) {
 	disk_t *dp = dequeue_disk(&origq);
 	if(dp->todo == 1) {
@@ -707,6 +727,14 @@ main(
     waitq.head = waitq.tail = NULL;
     failq.head = failq.tail = NULL;
 
+			/* an empty tape still has a label and an endmark */
+    total_size = ((gint64)tt_blocksize_kb + (gint64)tape_mark) * (gint64)2;
+    total_lev0 = 0.0;
+    balanced_size = 0.0;
+
+    /* with stream-schedule, estimates are analyzed as they come in */
+    schedq.head = schedq.tail = NULL;
+
     get_estimates();
 
     g_fprintf(stderr, _("%s: time %s: getting estimates took %s secs\n"),
@@ -739,13 +767,10 @@ main(
     g_fprintf(stderr,_("\nANALYZING ESTIMATES...\n"));
     section_start = curclock();
 
-			/* an empty tape still has a label and an endmark */
-    total_size = ((gint64)tt_blocksize_kb + (gint64)tape_mark) * (gint64)2;
-    total_lev0 = 0.0;
-    balanced_size = 0.0;
-
-    schedq.head = schedq.tail = NULL;
     while(!empty(estq)) analyze_estimate(dequeue_est(&estq));
+    /* g_list_sort is stable, so this is the order insert_est gives */
+    schedq.head = g_list_sort(schedq.head, schedule_order_data);
+    schedq.tail = g_list_last(schedq.head);
     while(!empty(failq)) handle_failed(dequeue_est(&failq));
 
     run_server_global_scripts(EXECUTE_ON_POST_ESTIMATE, get_config_name(),
@@ -846,7 +871,7 @@ main(
      */
 
     g_fprintf(stderr,_("\nGENERATING SCHEDULE:\n--------\n"));
-    if (empty(schedq)) {
+    if (empty(schedq) && nb_streamed == 0) {
         exit_status = EXIT_FAILURE;
         g_fprintf(stderr, _("--> Generated empty schedule! <--\n"));
     } else {
@@ -861,6 +886,11 @@ main(
 
     clear_tapelist();
     quit_amcatalog();
+    if (est_by_disk)
+	g_hash_table_destroy(est_by_disk);
+    est_by_disk = NULL;
+    amarena_free(planner_arena);
+    planner_arena = NULL;
     amfree(planner_timestamp);
     amfree(our_feature_string);
     am_release_feature_set(our_features);
@@ -918,7 +948,8 @@ static void askfor(
 
     ep->estimate[seq].level = lev;
 
-    ep->estimate[seq].dumpdate = g_strdup(get_dumpdate(info,lev));
+    ep->estimate[seq].dumpdate = amarena_strdup(planner_arena,
+						get_dumpdate(info,lev));
     ep->estimate[seq].based_on_timestamp = get_based_on_timestamp(info,lev);
 
     ep->estimate[seq].nsize = (gint64)-3;
@@ -946,7 +977,7 @@ setup_estimate(
 
     /* get current information about disk */
 
-    info = g_new0(info_t, 1);
+    info = amarena_new0(planner_arena, info_t);
     if(get_info(dp->host->hostname, dp->name, info)) {
 	/* no record for this disk, make a note of it */
 	log_add(L_INFO, _("Adding new disk %s:%s."), dp->host->hostname, qname);
@@ -988,7 +1019,10 @@ setup_estimate(
 
     /* setup working data struct for disk */
 
-    ep = g_malloc(sizeof(est_t));
+    ep = amarena_new0(planner_arena, est_t);
+    if (!est_by_disk)
+	est_by_disk = g_hash_table_new(g_direct_hash, g_direct_equal);
+    g_hash_table_insert(est_by_disk, dp, ep);
     ep->disk = dp;
     ep->info = info;
     ep->state = DISK_READY;
@@ -1576,46 +1610,41 @@ static gint64 bump_thresh(
 static void getsize(am_host_t *hostp);
 static disk_t *lookup_hostdisk(am_host_t *hp, char *str);
 static void handle_result(void *datap, pkt_t *pkt, security_handle_t *sech);
+static token_est_t *find_token_est(info_t *info, int level);
+static void save_change_token(est_t *ep);
+static void estimate_result(void *datap, pkt_t *pkt, security_handle_t *sech);
+static void start_estimates(void);
 
+/*
+ * The hosts not asked yet, in disklist order, and the hosts asked whose
+ * estimates are not all in.  At most conf_estimate_parallel hosts are asked
+ * at once; a host done starts the next one.
+ */
+static GList *estimate_hosts = NULL;
+static GHashTable *estimate_hosts_active = NULL;
 
 static void get_estimates(void)
 {
-    int something_started;
+    GHashTable *seen = g_hash_table_new(g_direct_hash, g_direct_equal);
     GList *elist;
 
-    something_started = 1;
-    while (something_started) {
-	something_started = 0;
-	for (elist = startq.head; elist != NULL; elist = elist->next) {
-	    est_t  *ep = get_est(elist);
-	    disk_t *dp = ep->disk;
-	    disk_t *dp1;
-	    am_host_t *hostp = dp->host;
-	    if (hostp->status == HOST_READY) {
-		something_started = 1;
-		run_server_host_scripts(EXECUTE_ON_PRE_HOST_ESTIMATE,
-					get_config_name(), planner_timestamp,
-					hostp);
-		for(dp1 = hostp->disks; dp1 != NULL; dp1 = dp1->hostnext) {
-		    if (dp1->todo) {
-			est_t *ep1;
-			ep1 = find_est_for_dp(dp1);
-			run_server_dle_scripts(EXECUTE_ON_PRE_DLE_ESTIMATE,
-					   get_config_name(), planner_timestamp,
-					   dp1, ep1->estimate[0].level, BOGUS);
-		    }
-		}
-		getsize(hostp);
-		protocol_check();
-		/*
-		 * dp is no longer on startq, so elist is not valid
-		 * and we have to start all over.
-		 */
-		break;
-	    }
+    for (elist = startq.head; elist != NULL; elist = elist->next) {
+	am_host_t *hostp = get_est(elist)->disk->host;
+
+	if (hostp->status == HOST_READY &&
+	    !g_hash_table_lookup(seen, hostp)) {
+	    g_hash_table_insert(seen, hostp, hostp);
+	    estimate_hosts = g_list_prepend(estimate_hosts, hostp);
 	}
     }
+    g_hash_table_destroy(seen);
+    estimate_hosts = g_list_reverse(estimate_hosts);
+    estimate_hosts_active = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+    start_estimates();
     protocol_run();
+    g_hash_table_destroy(estimate_hosts_active);
+    estimate_hosts_active = NULL;
 
     while(!empty(waitq)) {
 	est_t *ep = dequeue_est(&waitq);
@@ -1751,6 +1780,23 @@ static char *client_estimate_as_xml(est_t *ep, am_feature_t *features,
 
     g_string_append_printf(strbuf, "    <spindle>%d</spindle>\n", dp->spindle);
 
+    /*
+     * The previous token is only worth sending if the estimates of every
+     * level we ask for were kept with it.
+     */
+    if (dp->change_token && am_has_feature(features, fe_sendsize_change_token)) {
+        gboolean all_kept = (info.change_token[0] != '\0');
+
+        for (i = 0; i < nr_estimates && all_kept; i++) {
+            if (!find_token_est(&info, ep->estimate[i].level))
+                all_kept = FALSE;
+        }
+        tmp = amxml_format_tag("change-token",
+                               all_kept ? info.change_token : "NONE");
+        g_string_append_printf(strbuf, "  %s\n", tmp);
+        g_free(tmp);
+    }
+
     tmp = xml_optionstr(dp, 0);
     g_string_append_printf(strbuf, "%s</dle>", tmp);
     g_free(tmp);
@@ -2103,11 +2149,126 @@ send:
     }
 
     protocol_sendreq(hostp->hostname, secdrv, amhost_get_security_conf,
-	req, timeout, handle_result, hostp);
+	req, timeout, estimate_result, hostp);
 
     g_free(req);
 }
 
+static void
+start_estimates(void)
+{
+    while (estimate_hosts &&
+	   (conf_estimate_parallel == 0 ||
+	    (int)g_hash_table_size(estimate_hosts_active) <
+						conf_estimate_parallel)) {
+	am_host_t *hostp = estimate_hosts->data;
+	disk_t *dp1;
+
+	estimate_hosts = g_list_delete_link(estimate_hosts, estimate_hosts);
+	if (hostp->status != HOST_READY)
+	    continue;
+
+	run_server_host_scripts(EXECUTE_ON_PRE_HOST_ESTIMATE,
+				get_config_name(), planner_timestamp,
+				hostp);
+	for(dp1 = hostp->disks; dp1 != NULL; dp1 = dp1->hostnext) {
+	    if (dp1->todo) {
+		est_t *ep1;
+		ep1 = find_est_for_dp(dp1);
+		run_server_dle_scripts(EXECUTE_ON_PRE_DLE_ESTIMATE,
+				   get_config_name(), planner_timestamp,
+				   dp1, ep1->estimate[0].level, BOGUS);
+	    }
+	}
+	getsize(hostp);
+	if (hostp->status == HOST_ACTIVE)
+	    g_hash_table_insert(estimate_hosts_active, hostp, hostp);
+	protocol_check();
+    }
+    stream_schedule();
+}
+
+/* handle_result, then start the next host once this one is done with */
+static void
+estimate_result(
+    void *datap,
+    pkt_t *pkt,
+    security_handle_t *sech)
+{
+    am_host_t *hostp = (am_host_t *)datap;
+
+    handle_result(datap, pkt, sech);
+    if (hostp->status != HOST_ACTIVE &&
+	g_hash_table_remove(estimate_hosts_active, hostp)) {
+	start_estimates();
+    }
+    stream_schedule();
+}
+
+/* Whether EP can go to the driver before all the estimates are in: a dump
+ * that delay_dumps and the promotes would not change, and that leaves most
+ * of the tape to the dumps still waiting for their estimates. */
+static gboolean
+stream_releasable(
+    est_t *ep,
+    gint64 size)
+{
+    disk_t *dp = ep->disk;
+    int level = ep->dump_est->level;
+
+    if (level < 0 || ep->dump_est->csize == (gint64)-1)
+	return FALSE;
+    if (size > tapetype_get_length(tape) ||
+	(double)(streamed_size + size) >
+			(double)tape_length * STREAM_SCHEDULE_SHARE)
+	return FALSE;
+
+    if (level == 0 && ISSET(ep->info->command, FORCE_FULL))
+	return TRUE;
+    if (level > 0 && dp->priority >= PRIORITY_HIGH)
+	return TRUE;
+    return ep->unchanged;
+}
+
+/*
+ * With stream-schedule, analyze the disks whose estimates are in and send
+ * the ones stream_releasable accepts to the driver now, so it can start
+ * dumping them while the other clients are still estimating.  They are
+ * counted in total_size, so the rest of the schedule is still made to fit.
+ */
+static void
+stream_schedule(void)
+{
+    GSList *analyzed = NULL, *l;
+
+    if (!conf_stream_schedule)
+	return;
+
+    while (!empty(estq)) {
+	est_t *ep = dequeue_est(&estq);
+
+	analyze_estimate(ep);
+	analyzed = g_slist_prepend(analyzed, ep);
+    }
+
+    analyzed = g_slist_reverse(analyzed);
+    for (l = analyzed; l != NULL; l = l->next) {
+	est_t *ep = l->data;
+	gint64 size = (gint64)tt_blocksize_kb + ep->dump_est->csize +
+		      (gint64)tape_mark;
+
+	if (!stream_releasable(ep, size))
+	    continue;
+	if (nb_streamed++ == 0)
+	    g_fprintf(stderr, _("\nSTREAMING SCHEDULE:\n--------\n"));
+	remove_est(&schedq, ep);
+	streamed_size += size;
+	output_scheduleline(ep);
+	fflush(stdout);
+    }
+    g_slist_free(analyzed);
+}
+
 static disk_t *lookup_hostdisk(
     /*@keep@*/ am_host_t *hp,
     char *str)
@@ -2121,6 +2282,48 @@ static disk_t *lookup_hostdisk(
 }
 
 
+/* the estimate kept with the change token for LEVEL, or NULL */
+static token_est_t *
+find_token_est(
+    info_t *info,
+    int level)
+{
+    int i;
+
+    for (i = 0; i < NB_TOKEN_EST; i++) {
+	if (info->token_est[i].level == level && info->token_est[i].size >= 0)
+	    return &info->token_est[i];
+    }
+    return NULL;
+}
+
+/* keep the change token and the estimates of the client, for the next run */
+static void
+save_change_token(
+    est_t *ep)
+{
+    disk_t *dp = ep->disk;
+    info_t info;
+    int i, n = 0;
+
+    get_info(dp->host->hostname, dp->name, &info);
+    strncpy(info.change_token, ep->change_token, sizeof(info.change_token)-1);
+    info.change_token[sizeof(info.change_token)-1] = '\0';
+    for (i = 0; i < MAX_LEVELS && n < NB_TOKEN_EST; i++) {
+	if (ep->estimate[i].level == -1 || ep->estimate[i].nsize < 0)
+	    continue;
+	info.token_est[n].level = ep->estimate[i].level;
+	info.token_est[n].size = ep->estimate[i].nsize;
+	n++;
+    }
+    for (; n < NB_TOKEN_EST; n++)
+	info.token_est[n].level = -1;
+    if (put_info(dp->host->hostname, dp->name, &info)) {
+	g_fprintf(stderr, _("could not save the change token of %s:%s\n"),
+		  dp->host->hostname, dp->name);
+    }
+}
+
 static void handle_result(
     void *datap,
     pkt_t *pkt,
@@ -2263,7 +2466,38 @@ static void handle_result(
 
 	ep = find_est_for_dp(dp);
 	size = (gint64)-1;
-	if (strncmp_const(t-1,"SIZE ") == 0) {
+	if (strncmp_const(t-1,"TOKEN ") == 0 ||
+	    strncmp_const(t-1,"UNCHANGED ") == 0) {
+	    gboolean unchanged = (*(t-1) == 'U');
+
+	    skip_non_whitespace(t, tch);
+	    skip_whitespace(t, tch);
+	    msg = t-1;
+	    skip_non_whitespace(t, tch);
+	    msg_undo = t[-1];
+	    t[-1] = '\0';
+	    ep->change_token = amarena_strdup(planner_arena, msg);
+	    t[-1] = msg_undo;
+	    if (unchanged) {
+		/* the client did no estimate, take the kept ones */
+		for (i = 0; i < MAX_LEVELS; i++) {
+		    token_est_t *te;
+
+		    if (ep->estimate[i].level == -1)
+			continue;
+		    te = find_token_est(ep->info, ep->estimate[i].level);
+		    if (te) {
+			ep->estimate[i].nsize = te->size;
+			ep->estimate[i].guessed = 0;
+		    }
+		}
+		ep->got_estimate++;
+		ep->unchanged = TRUE;
+		dbprintf(_("%s:%s unchanged, using the estimates of token %s\n"),
+			 hostp->hostname, dp->name, ep->change_token);
+	    }
+	    goto next_line;
+	} else if (strncmp_const(t-1,"SIZE ") == 0) {
 	    if (sscanf(t - 1, "SIZE %lld", &size_) != 1) {
 		amfree(disk);
 		goto bad_msg;
@@ -2384,6 +2618,8 @@ next_line:
 			    ep->estimate[i].level = -1;
 		        }
 		    }
+		    if (ep->change_token)
+			save_change_token(ep);
 		    enqueue_est(&estq, ep);
 	    }
 	    else {
@@ -2638,7 +2874,8 @@ static void analyze_estimate(
               ep->dump_est->level, (long long)ep->dump_est->nsize,
               (long long)ep->dump_est->csize);
 
-    insert_est(&schedq, ep, schedule_order);
+    /* sorted by schedule_order once all the estimates are analyzed */
+    enqueue_est(&schedq, ep);
 
     total_size += (gint64)tt_blocksize_kb + ep->dump_est->csize + tape_mark;
 
@@ -2729,6 +2966,14 @@ static int schedule_order(
     return 0;
 }
 
+static gint
+schedule_order_data(
+    gconstpointer a,
+    gconstpointer b)
+{
+    return schedule_order((est_t *)a, (est_t *)b);
+}
+
 
 static one_est_t *pick_inclevel(
     est_t *ep)
@@ -2830,6 +3075,27 @@ static void delay_one_dump(est_t *ep, int delete, ...);
 static int promote_highest_priority_incremental(void);
 static int promote_hills(void);
 
+/* Whether the info file of EP asks for a full dump; FORCED keeps the answer
+ * of each est, since the info file does not change while delaying dumps. */
+static gboolean
+est_forced_full(
+    GHashTable *forced,
+    est_t      *ep)
+{
+    gpointer value;
+    info_t info;
+
+    value = g_hash_table_lookup(forced, ep);
+    if (!value) {
+	disk_t *dp = ep->disk;
+
+	get_info(dp->host->hostname, dp->name, &info);
+	value = GINT_TO_POINTER(ISSET(info.command, FORCE_FULL) ? 2 : 1);
+	g_hash_table_insert(forced, ep, value);
+    }
+    return value == GINT_TO_POINTER(2);
+}
+
 /* delay any dumps that will not fit */
 static void delay_dumps(void)
 {
@@ -2845,7 +3111,7 @@ static void delay_dumps(void)
     char	est_kb[20];		/* Text formatted dump size */
     char	tape_kb[20];		/* Text formatted tape size */
     int		nb_forced_level_0;
-    info_t	info;
+    GHashTable *forced;
     int		delete;
     char *	message;
     gint64	full_size;
@@ -2966,6 +3232,7 @@ static void delay_dumps(void)
     }
 
     /* 2.a. Do not delay forced full */
+    forced = g_hash_table_new(g_direct_hash, g_direct_equal);
     delayed_ep = NULL;
     delayed_dp = NULL;
     do {
@@ -2981,8 +3248,7 @@ static void delay_dumps(void)
 
 	    if(ep->dump_est->level != 0) continue;
 
-	    get_info(dp->host->hostname, dp->name, &info);
-	    if(ISSET(info.command, FORCE_FULL)) {
+	    if (est_forced_full(forced, ep)) {
 		nb_forced_level_0 += 1;
 		preserve_ep = ep;
 		continue;
@@ -3020,6 +3286,7 @@ static void delay_dumps(void)
 			   message, NULL);
 	}
     } while (delayed_ep);
+    g_hash_table_destroy(forced);
 
     /* 2.b. Delay forced full if needed */
     if(nb_forced_level_0 > 0 && total_size > tape_length) {
@@ -3244,6 +3511,23 @@ static void delay_one_dump(est_t *ep, int delete, ...)
 }
 
 
+/* The counts of dumps by day or by host, kept in a GHashTable */
+static int
+count_of(
+    GHashTable   *counts,
+    gconstpointer key)
+{
+    return GPOINTER_TO_INT(g_hash_table_lookup(counts, key));
+}
+
+static void
+count_inc(
+    GHashTable *counts,
+    gpointer    key)
+{
+    g_hash_table_insert(counts, key, GINT_TO_POINTER(count_of(counts, key) + 1));
+}
+
 static int promote_highest_priority_incremental(void)
 {
     GList  *elist, *elist1;
@@ -3253,6 +3537,10 @@ static int promote_highest_priority_incremental(void)
     int check_days;
     int nb_today, nb_same_day, nb_today2;
     int nb_disk_today, nb_disk_same_day;
+    GHashTable *disk_same_day;	/* next_level0 -> incrementals */
+    GHashTable *host_today;	/* hostname -> full dumps */
+    GHashTable *host_same_day;	/* "next_level0 hostname" -> incrementals */
+    char *key;
     char *qname;
 
     /*
@@ -3260,6 +3548,25 @@ static int promote_highest_priority_incremental(void)
      * cause total_size to exceed tape_length
      */
 
+    /* what each disk is compared with, counted once for all the disks */
+    nb_disk_today = 0;
+    disk_same_day = g_hash_table_new(g_direct_hash, g_direct_equal);
+    host_today = g_hash_table_new(g_str_hash, g_str_equal);
+    host_same_day = g_hash_table_new_full(g_str_hash, g_str_equal,
+					  g_free, NULL);
+    for (elist1 = schedq.head; elist1 != NULL; elist1 = elist1->next) {
+	ep1 = get_est(elist1);
+	dp1 = ep1->disk;
+	if(ep1->dump_est->level == 0) {
+	    nb_disk_today++;
+	    count_inc(host_today, dp1->host->hostname);
+	} else {
+	    count_inc(disk_same_day, GINT_TO_POINTER(ep1->next_level0));
+	    count_inc(host_same_day, g_strdup_printf("%d %s",
+				ep1->next_level0, dp1->host->hostname));
+	}
+    }
+
     dp_promote = NULL;
     ep_promote = NULL;
     for (elist = schedq.head; elist != NULL; elist = elist->next) {
@@ -3287,24 +3594,12 @@ static int promote_highest_priority_incremental(void)
 	if(new_total > tape_length)
 	    continue;
 
-	nb_today = 0;
-	nb_same_day = 0;
-	nb_disk_today = 0;
-	nb_disk_same_day = 0;
-	for (elist1 = schedq.head; elist1 != NULL; elist1 = elist1->next) {
-	    ep1 = get_est(elist1);
-	    dp1 = ep1->disk;
-	    if(ep1->dump_est->level == 0)
-		nb_disk_today++;
-	    else if(ep1->next_level0 == ep->next_level0)
-		nb_disk_same_day++;
-	    if(g_str_equal(dp->host->hostname, dp1->host->hostname)) {
-		if(ep1->dump_est->level == 0)
-		    nb_today++;
-		else if(ep1->next_level0 == ep->next_level0)
-		    nb_same_day++;
-	    }
-	}
+	nb_disk_same_day = count_of(disk_same_day,
+				    GINT_TO_POINTER(ep->next_level0));
+	nb_today = count_of(host_today, dp->host->hostname);
+	key = g_strdup_printf("%d %s", ep->next_level0, dp->host->hostname);
+	nb_same_day = count_of(host_same_day, key);
+	g_free(key);
 
 	/* do not promote if overflow balanced size and something today */
 	/* promote if nothing today */
@@ -3342,6 +3637,9 @@ static int promote_highest_priority_incremental(void)
 	}
 	amfree(qname);
     }
+    g_hash_table_destroy(disk_same_day);
+    g_hash_table_destroy(host_today);
+    g_hash_table_destroy(host_same_day);
 
     if (ep_promote) {
 	one_est_t *level0_est;
@@ -3377,15 +3675,30 @@ static int promote_highest_priority_incremental(void)
 }
 
 
+struct balance_stats {
+    int disks;
+    gint64 size;
+    GList *eps;		/* the schedq entries due that day */
+};
+
+static void
+promote_hills_free(
+    struct balance_stats *sp,
+    int			  my_dumpcycle)
+{
+    int days;
+
+    for(days = 0; days < my_dumpcycle; days++)
+	g_list_free(sp[days].eps);
+    g_free(sp);
+}
+
 static int promote_hills(void)
 {
     GList  *elist;
     est_t  *ep;
     disk_t *dp;
-    struct balance_stats {
-	int disks;
-	gint64 size;
-    } *sp = NULL;
+    struct balance_stats *sp = NULL;
     int days;
     int hill_days = 0;
     gint64 hill_size;
@@ -3407,12 +3720,15 @@ static int promote_hills(void)
     for(days = 0; days < my_dumpcycle; days++) {
 	sp[days].disks = 0;
 	sp[days].size = (gint64)0;
+	sp[days].eps = NULL;
     }
 
     for (elist = schedq.head; elist != NULL; elist = elist->next) {
 	ep = get_est(elist);
 	dp = ep->disk;
 	days = ep->next_level0;
+	if (days >= 0 && days < my_dumpcycle)
+	    sp[days].eps = g_list_prepend(sp[days].eps, ep);
 	if (days < 0) days = 0;
 	if(days<my_dumpcycle && !dp->skip_full && dp->strategy != DS_NOFULL &&
 	   dp->strategy != DS_INCRONLY) {
@@ -3420,6 +3736,8 @@ static int promote_hills(void)
 	    sp[days].size += ep->last_lev0size;
 	}
     }
+    for(days = 0; days < my_dumpcycle; days++)
+	sp[days].eps = g_list_reverse(sp[days].eps);
 
     /* Search for a suitable big hill and cut it down */
     while(1) {
@@ -3435,13 +3753,12 @@ static int promote_hills(void)
 	if(hill_size <= (gint64)0) break;	/* no suitable hills */
 
 	/* Find all the dumps in that hill and try and remove one */
-	for (elist = schedq.head; elist != NULL; elist = elist->next) {
+	for (elist = sp[hill_days].eps; elist != NULL; elist = elist->next) {
 	    one_est_t *level0_est;
 
 	    ep = get_est(elist);
 	    dp = ep->disk;
-	    if(ep->next_level0 != hill_days ||
-	       ep->next_level0 > dp->maxpromoteday ||
+	    if(ep->next_level0 > dp->maxpromoteday ||
 	       dp->skip_full ||
 	       dp->strategy == DS_NOFULL ||
 	       dp->strategy == DS_INCRONLY)
@@ -3472,14 +3789,14 @@ static int promote_hills(void)
 		    dp->host->hostname, qname, hill_days);
 
 	    amfree(qname);
-	    amfree(sp);
+	    promote_hills_free(sp, my_dumpcycle);
 	    return 1;
 	}
 	/* All the disks in that hill were unsuitable. */
 	sp[hill_days].disks = 0;	/* Don't get tricked again */
     }
 
-    amfree(sp);
+    promote_hills_free(sp, my_dumpcycle);
     return 0;
 }
 
@@ -3725,51 +4042,12 @@ static est_t *
 find_est_for_dp(
     disk_t *dp)
 {
-    GList *elist;
-    est_t *ep;
+    est_t *ep = NULL;
 
-    for (elist = waitq.head; elist != NULL; elist = elist->next) {
-	ep = get_est(elist);
-	if (ep->disk == dp) {
-	    return ep;
-	}
-    }
-    for (elist = pestq.head; elist != NULL; elist = elist->next) {
-	ep = get_est(elist);
-	if (ep->disk == dp) {
-	    return ep;
-	}
-    }
-    for (elist = estq.head; elist != NULL; elist = elist->next) {
-	ep = get_est(elist);
-	if (ep->disk == dp) {
-	    return ep;
-	}
-    }
-    for (elist = startq.head; elist != NULL; elist = elist->next) {
-	ep = get_est(elist);
-	if (ep->disk == dp) {
-	    return ep;
-	}
-    }
-    for (elist = failq.head; elist != NULL; elist = elist->next) {
-	ep = get_est(elist);
-	if (ep->disk == dp) {
-	    return ep;
-	}
-    }
-    for (elist = schedq.head; elist != NULL; elist = elist->next) {
-	ep = get_est(elist);
-	if (ep->disk == dp) {
-	    return ep;
-	}
-    }
-    for (elist = activeq.head; elist != NULL; elist = elist->next) {
-	ep = get_est(elist);
-	if (ep->disk == dp) {
-	    return ep;
-	}
-    }
+    if (est_by_disk)
+	ep = g_hash_table_lookup(est_by_disk, dp);
+    if (ep)
+	return ep;
 
     g_critical("find_est_for_dp return NULL");
     return NULL;
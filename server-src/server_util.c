@@ -49,7 +49,7 @@ const char *cmdstr[] = {
     "SUCCESS", "FAILED", "TRY-AGAIN", "NO-ROOM", "RQ-MORE-DISK",	/* dumper results */
     "ABORT-FINISHED", "BAD-COMMAND",			/* dumper results */
     "START-TAPER", "FILE-WRITE", "NEW-TAPE", "NO-NEW-TAPE",
-    "SHM-WRITE", "SHM-DUMP", "SHM-NAME",
+    "SHM-WRITE", "SHM-DUMP", "SHM-NAME", "HOLDING-DUMP",
     "PARTDONE", "PORT-WRITE", "VAULT-WRITE", "DUMPER-STATUS", /* taper cmds */
     "PORT", "TAPE-ERROR", "TAPER-OK",			 /* taper results */
     "REQUEST-NEW-TAPE", "DIRECTTCP-PORT", "TAKE-SCRIBE-FROM",
@@ -63,11 +63,32 @@ const char *cmdstr[] = {
 static void start_amcatalog(void);
 static GPtrArray *run_amcatalog_multi(char *command, int n_args, ...);
 
+cmd_t
+str_to_cmd(
+    const char *str)
+{
+    static GHashTable *cmds = NULL;
+    gpointer value;
+    cmd_t cmd_i;
+
+    if (!cmds) {
+	cmds = g_hash_table_new(g_str_hash, g_str_equal);
+	/* values are offset by one so that BOGUS is not NULL */
+	for (cmd_i = BOGUS; cmdstr[cmd_i] != NULL; cmd_i++)
+	    g_hash_table_insert(cmds, (gpointer)cmdstr[cmd_i],
+				GINT_TO_POINTER(cmd_i + 1));
+    }
+
+    value = g_hash_table_lookup(cmds, str);
+    if (!value)
+	return BOGUS;
+    return (cmd_t)(GPOINTER_TO_INT(value) - 1);
+}
+
 struct cmdargs *
 getcmd(void)
 {
     char *line;
-    cmd_t cmd_i;
     struct cmdargs *cmdargs = g_new0(struct cmdargs, 1);
 
     if (isatty(0)) {
@@ -93,11 +114,7 @@ getcmd(void)
 	return cmdargs;
     }
 
-    for(cmd_i=BOGUS; cmdstr[cmd_i] != NULL; cmd_i++)
-	if(g_str_equal(cmdargs->argv[0], cmdstr[cmd_i])) {
-	    cmdargs->cmd = cmd_i;
-	    return cmdargs;
-	}
+    cmdargs->cmd = str_to_cmd(cmdargs->argv[0]);
     return cmdargs;
 }
 
@@ -134,6 +151,16 @@ void putresult(cmd_t result, const char *format, ...)
     g_free(msg);
 }
 
+char *
+server_ssh_control_persist(void)
+{
+    static char persist[NUM_STR_SIZE];
+
+    g_snprintf(persist, sizeof(persist), "%d",
+	       getconf_int(CNF_SSH_CONTROL_PERSIST));
+    return persist;
+}
+
 char *
 amhost_get_security_conf(
     char *string,
@@ -149,6 +176,8 @@ amhost_get_security_conf(
 	result = getconf_str(CNF_KRB5PRINCIPAL);
     else if (g_str_equal(string, "krb5keytab"))
 	result = getconf_str(CNF_KRB5KEYTAB);
+    else if (g_str_equal(string, "ssh_control_persist"))
+	result = server_ssh_control_persist();
     if (result) {
 	if (strlen(result) == 0)
 	    result = NULL;
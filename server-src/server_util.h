@@ -50,7 +50,7 @@ enum {
     SUCCESS, FAILED, TRYAGAIN, NO_ROOM, RQ_MORE_DISK,	/* dumper results */
     ABORT_FINISHED, BAD_COMMAND,			/* dumper results */
     START_TAPER, FILE_WRITE, NEW_TAPE, NO_NEW_TAPE,     /* taper... */
-    SHM_WRITE, SHM_DUMP, SHM_NAME,
+    SHM_WRITE, SHM_DUMP, SHM_NAME, HOLDING_DUMP,
     PARTDONE, PORT_WRITE, VAULT_WRITE, DUMPER_STATUS,   /* ... cmds */
     PORT, TAPE_ERROR, TAPER_OK,				/* taper results */
     REQUEST_NEW_TAPE, DIRECTTCP_PORT, TAKE_SCRIBE_FROM,
@@ -61,6 +61,9 @@ enum {
 };
 extern const char *cmdstr[];
 
+/* the cmd_t of the token STR, or BOGUS */
+cmd_t str_to_cmd(const char *str);
+
 struct cmdargs {
     cmd_t cmd;
     int argc;
@@ -106,6 +109,10 @@ int dumper_cmd(struct dumper_s *dumper, cmd_t cmd, struct sched_s *sp,
 	       char *mesg);
 
 char *amhost_get_security_conf(char *string, void *arg);
+
+/* The ssh-control-persist of the configuration, as the string the
+ * "ssh_control_persist" security conf key returns. */
+char *server_ssh_control_persist(void);
 int check_infofile(char *infodir, disklist_t *dl, char **errmsg);
 
 void run_server_script(pp_script_t  *pp_script,
@@ -48,15 +48,16 @@ static gboolean retention_computed = FALSE;
 static char *tape_hash_key(const char *pool, const char *label);
 static tape_t *parse_tapeline(int *status, char *line);
 static tape_t *insert(tape_t *list, tape_t *tp);
+static void unlink_tape(tape_t *tp);
+static void apply_tapelist_change(char *line);
+static void read_tapelist_changes(char *tapefile, struct stat *snapshot);
 static time_t stamp2time(char *datestamp);
-static void compute_storage_retention_nb(const char *storage,
-					 const char *tapepool,
-					 const char *l_template,
+static void compute_storage_retention_nb(GHashTable *volumes,
 					 int retention_tapes);
 static void compute_storage_retention(find_result_t *output_find,
+				      GHashTable *volumes,
 				      const char *storage,
 				      const char *tapepool,
-				      const char *l_template,
 				      int   retention_tapes,
 				      int   retention_days,
 				      int   retention_recover,
@@ -85,6 +86,7 @@ read_tapelist(
     int pos;
     char *line = NULL;
     int status = 0;
+    struct stat snapshot;
 
     reset_tapelist();
     if((tapef = fopen(tapefile,"r")) == NULL) {
@@ -115,6 +117,9 @@ read_tapelist(
 	    g_hash_table_insert(tape_table_label, tp->label, tp);
 	}
     }
+    if (fstat(fileno(tapef), &snapshot) == 0) {
+	read_tapelist_changes(tapefile, &snapshot);
+    }
     afclose(tapef);
 
     for(pos=1,tp=tape_list; tp != NULL; pos++,tp=tp->next) {
@@ -125,6 +130,80 @@ read_tapelist(
     return 0;
 }
 
+/*
+ * The volumes changed since the tapelist was last rewritten are appended to
+ * TAPEFILE.changes (see _write_tapelist in Amanda::DB::Catalog2::SQL), one
+ * tapelist line or "DELETE label [POOL:pool]" record each.  The log starts
+ * with the inode and size of the snapshot it extends, and is ignored for
+ * any other; a last record without its newline is still being written.
+ */
+static void
+read_tapelist_changes(
+    char        *tapefile,
+    struct stat *snapshot)
+{
+    char *changes_name = g_strconcat(tapefile, ".changes", NULL);
+    char *header;
+    gchar *buf = NULL;
+    gsize len;
+    char *line, *eol;
+
+    if (!g_file_get_contents(changes_name, &buf, &len, NULL)) {
+	g_free(changes_name);
+	return;
+    }
+    header = g_strdup_printf("TAPELIST %llu %llu\n",
+			     (unsigned long long)snapshot->st_ino,
+			     (unsigned long long)snapshot->st_size);
+    if (g_str_has_prefix(buf, header)) {
+	line = buf + strlen(header);
+	while ((eol = strchr(line, '\n')) != NULL) {
+	    *eol = '\0';
+	    apply_tapelist_change(line);
+	    line = eol + 1;
+	}
+    } else {
+	g_debug("ignoring '%s', it is not for the current tapelist",
+		changes_name);
+    }
+    g_free(header);
+    g_free(buf);
+    g_free(changes_name);
+}
+
+static void
+apply_tapelist_change(
+    char *line)
+{
+    tape_t *tp, *old;
+    int status;
+
+    if (strncmp_const(line, "DELETE ") == 0) {
+	char *label = line + 7;
+	char *pool = strstr(label, " POOL:");
+
+	if (pool) {
+	    *pool = '\0';
+	    pool += 6;
+	}
+	tp = lookup_tapepoollabel(pool, label);
+	if (tp)
+	    unlink_tape(tp);
+	return;
+    }
+
+    tp = parse_tapeline(&status, line);
+    if (!tp)
+	return;
+    old = lookup_tapepoollabel(tp->pool, tp->label);
+    if (old)
+	unlink_tape(old);
+    tape_list = insert(tape_list, tp);
+    g_hash_table_insert(tape_table_storage_label,
+			tape_hash_key(tp->pool, tp->label), tp);
+    g_hash_table_insert(tape_table_label, tp->label, tp);
+}
+
 void
 clear_tapelist(void)
 {
@@ -326,42 +405,52 @@ void
 remove_tapelabel(
     const char *label)
 {
-    tape_t *tp, *prev, *next;
+    tape_t *tp;
 
     tp = lookup_tapelabel(label);
     if (tp) {
-	char *tape_key = tape_hash_key(tp->pool, tp->label);
-	g_hash_table_remove(tape_table_storage_label, tape_key);
-	g_hash_table_remove(tape_table_label, tp->label);
-	g_free(tape_key);
-	prev = tp->prev;
-	next = tp->next;
-	/*@ignore@*/
-	if(prev != NULL)
-	    prev->next = next;
-	else /* begin of list */
-	    tape_list = next;
-	if(next != NULL)
-	    next->prev = prev;
-	else /* end of list */
-	    tape_list_end = prev;
-	/*@end@*/
-	while (next != NULL) {
-	    next->position--;
-	    next = next->next;
-	}
-	amfree(tp->datestamp);
-	amfree(tp->label);
-	amfree(tp->meta);
-	amfree(tp->comment);
-	amfree(tp->pool);
-	amfree(tp->storage);
-	amfree(tp->config);
-	amfree(tp->barcode);
-	amfree(tp);
+	unlink_tape(tp);
     }
 }
 
+/* remove a tape from the list and the hash tables, and free it */
+static void
+unlink_tape(
+    tape_t *tp)
+{
+    char *tape_key = tape_hash_key(tp->pool, tp->label);
+    tape_t *prev, *next;
+
+    g_hash_table_remove(tape_table_storage_label, tape_key);
+    g_hash_table_remove(tape_table_label, tp->label);
+    g_free(tape_key);
+    prev = tp->prev;
+    next = tp->next;
+    /*@ignore@*/
+    if(prev != NULL)
+	prev->next = next;
+    else /* begin of list */
+	tape_list = next;
+    if(next != NULL)
+	next->prev = prev;
+    else /* end of list */
+	tape_list_end = prev;
+    /*@end@*/
+    while (next != NULL) {
+	next->position--;
+	next = next->next;
+    }
+    amfree(tp->datestamp);
+    amfree(tp->label);
+    amfree(tp->meta);
+    amfree(tp->comment);
+    amfree(tp->pool);
+    amfree(tp->storage);
+    amfree(tp->config);
+    amfree(tp->barcode);
+    amfree(tp);
+}
+
 tape_t *
 add_tapelabel(
     const char *datestamp,
@@ -726,13 +815,114 @@ gchar **list_new_tapes(
 
 }
 
+/* The dumps on the volumes, for the recover and full retentions.  It is
+ * updated by update_output_find as the tapelist changes, instead of being
+ * searched again from all the logs. */
 static find_result_t *output_find = NULL;
+/* the datestamps whose logs were searched for output_find */
+static GHashTable *output_find_seen = NULL;
+/* the datestamp of each volume when output_find was updated */
+static GHashTable *output_find_labels = NULL;
+
+/* Bring output_find up to date with the tapelist: search the logs of the
+ * volumes written since the last update, and drop the dumps of the volumes
+ * that were overwritten. */
+static void
+update_output_find(void)
+{
+    find_result_t *ofr, *next, **prev;
+    find_result_t *new_find;
+    GHashTable *changed;
+    disklist_t *diskp;
+    tape_t *tp;
+    gboolean first = (output_find_seen == NULL);
+
+    if (first) {
+	output_find_seen = g_hash_table_new_full(g_str_hash, g_str_equal,
+						 g_free, NULL);
+	output_find_labels = g_hash_table_new_full(g_str_hash, g_str_equal,
+						   g_free, g_free);
+    }
+
+    /* a volume written since the last update may add dumps to a datestamp
+     * already searched, so search its datestamp again */
+    changed = g_hash_table_new(g_str_hash, g_str_equal);
+    for (tp = tape_list; tp != NULL; tp = tp->next) {
+	char *datestamp = g_hash_table_lookup(output_find_labels, tp->label);
+	if (!datestamp || !g_str_equal(datestamp, tp->datestamp)) {
+	    g_hash_table_remove(output_find_seen, tp->datestamp);
+	    g_hash_table_insert(changed, tp->datestamp, GINT_TO_POINTER(1));
+	    g_hash_table_insert(output_find_labels, g_strdup(tp->label),
+				g_strdup(tp->datestamp));
+	}
+    }
+
+    prev = &output_find;
+    for (ofr = output_find; ofr != NULL; ofr = next) {
+	next = ofr->next;
+	if (ofr->label && ofr->label[0] != '/' &&
+	    (g_hash_table_lookup(changed, ofr->write_timestamp) ||
+	     !(tp = lookup_tapelabel(ofr->label)) ||
+	     !g_str_equal(tp->datestamp, ofr->write_timestamp))) {
+	    *prev = next;
+	    g_free(ofr);
+	} else {
+	    prev = &ofr->next;
+	}
+    }
+    g_hash_table_destroy(changed);
+
+    diskp = get_disklist();
+    if (!diskp) {
+	char *conf_diskfile = config_dir_relative(getconf_str(CNF_DISKFILE));
+	diskp = g_new0(disklist_t, 1);
+	read_diskfile(conf_diskfile, diskp);
+	g_free(conf_diskfile);
+    }
+    new_find = find_dump_new_datestamps(diskp, output_find_seen, 1);
+    if (first) {
+	search_holding_disk(&new_find, diskp, 1);
+    }
+    if (new_find) {
+	for (ofr = new_find; ofr->next != NULL; ofr = ofr->next) {
+	}
+	ofr->next = output_find;
+	output_find = new_find;
+    }
+    sort_find_result("hkDLpbfw", &output_find);
+}
+
+/* Return the set of the volumes of the storage */
+static GHashTable *
+storage_volumes(
+    const char *storage,
+    const char *tapepool,
+    const char *l_template)
+{
+    GHashTable *volumes = g_hash_table_new(g_direct_hash, g_direct_equal);
+    tape_t *tp;
+
+    for (tp = tape_list; tp != NULL; tp = tp->next) {
+	if ((!tp->config || g_str_equal(tp->config, get_config_name())) &&
+	    (!tp->storage || g_str_equal(tp->storage, storage)) &&
+	    ((tp->pool && g_str_equal(tp->pool, tapepool)) ||
+	     (!tp->pool && match_labelstr_template(l_template, tp->label,
+						   tp->barcode, tp->meta,
+						   tp->storage)))) {
+	    g_hash_table_insert(volumes, tp, tp);
+	}
+    }
+    return volumes;
+}
+
 void
 compute_retention(void)
 {
     tape_t     *tp;
     storage_t  *storage;
-    disklist_t  *diskp;
+    GHashTable **volumes;
+    int         nstorages = 0;
+    int         i;
 
     for (tp = tape_list; tp != NULL; tp = tp->next) {
 	tp->retention_nb = FALSE;
@@ -753,57 +943,72 @@ compute_retention(void)
 	}
     }
 
+    /* the volumes of each storage, matched against its template once */
     for (storage = get_first_storage(); storage != NULL;
 	 storage = get_next_storage(storage)) {
-	char       *policy_name = storage_get_policy(storage);
-	policy_s   *policy = lookup_policy(policy_name);
+	nstorages++;
+    }
+    volumes = g_new0(GHashTable *, nstorages + 1);
+    for (i = 0, storage = get_first_storage(); storage != NULL;
+	 i++, storage = get_next_storage(storage)) {
 	labelstr_s *labelstr = storage_get_labelstr(storage);
-	compute_storage_retention_nb(storage_name(storage),
+	volumes[i] = storage_volumes(storage_name(storage),
 				     storage_get_tapepool(storage),
-				     labelstr->template,
-				     policy_get_retention_tapes(policy));
+				     labelstr->template);
     }
 
-    if (retention_computed)
-	return;
-
-    for (storage = get_first_storage(); storage != NULL;
-	 storage = get_next_storage(storage)) {
+    for (i = 0, storage = get_first_storage(); storage != NULL;
+	 i++, storage = get_next_storage(storage)) {
 	char       *policy_name = storage_get_policy(storage);
 	policy_s   *policy = lookup_policy(policy_name);
-	labelstr_s *labelstr = storage_get_labelstr(storage);
+	compute_storage_retention_nb(volumes[i],
+				     policy_get_retention_tapes(policy));
+    }
+
+    if (!retention_computed) {
+	gboolean need_find = FALSE;
+
+	for (storage = get_first_storage(); storage != NULL;
+	     storage = get_next_storage(storage)) {
+	    char       *policy_name = storage_get_policy(storage);
+	    policy_s   *policy = lookup_policy(policy_name);
 
-	if (!output_find && (policy_get_retention_recover(policy) ||
-			     policy_get_retention_full(policy))) {
-	    char *conf_diskfile = config_dir_relative(getconf_str(CNF_DISKFILE));
-	    diskp = get_disklist();
-	    if (!diskp) {
-		diskp = g_new0(disklist_t, 1);
-		read_diskfile(conf_diskfile, diskp);
+	    if (policy_get_retention_recover(policy) ||
+		policy_get_retention_full(policy)) {
+		need_find = TRUE;
 	    }
-	    output_find = find_dump(diskp, 1);
-	    sort_find_result("hkDLpbfw", &output_find);
-	    g_free(conf_diskfile);
+	}
+	if (need_find) {
+	    update_output_find();
 	}
 
-	compute_storage_retention(output_find, storage_name(storage),
-				  storage_get_tapepool(storage),
-				  labelstr->template,
-				  policy_get_retention_tapes(policy),
-				  policy_get_retention_days(policy),
-				  policy_get_retention_recover(policy),
-				  policy_get_retention_full(policy));
+	for (i = 0, storage = get_first_storage(); storage != NULL;
+	     i++, storage = get_next_storage(storage)) {
+	    char       *policy_name = storage_get_policy(storage);
+	    policy_s   *policy = lookup_policy(policy_name);
+
+	    compute_storage_retention(output_find, volumes[i],
+				      storage_name(storage),
+				      storage_get_tapepool(storage),
+				      policy_get_retention_tapes(policy),
+				      policy_get_retention_days(policy),
+				      policy_get_retention_recover(policy),
+				      policy_get_retention_full(policy));
+	}
+
+	retention_computed = TRUE;
     }
 
-    retention_computed = TRUE;
+    for (i = 0; i < nstorages; i++) {
+	g_hash_table_destroy(volumes[i]);
+    }
+    g_free(volumes);
 }
 
 
 static void
 compute_storage_retention_nb(
-    const char *storage,
-    const char *tapepool,
-    const char *l_template,
+    GHashTable *volumes,
     int   retention_tapes)
 {
     tape_t *tp;
@@ -814,12 +1019,7 @@ compute_storage_retention_nb(
 	    if (tp->reuse == 1 &&
 		!tp->retention &&
 		!g_str_equal(tp->datestamp, "0") &&
-		(!tp->config || g_str_equal(tp->config, get_config_name())) &&
-		(!tp->storage || g_str_equal(tp->storage, storage)) &&
-		((tp->pool && g_str_equal(tp->pool, tapepool)) ||
-		 (!tp->pool && match_labelstr_template(l_template, tp->label,
-						       tp->barcode, tp->meta,
-						       tp->storage)))) {
+		g_hash_table_lookup(volumes, tp)) {
 		count++;
 		if (count <= retention_tapes) {
 		    /* Do not mark them, as it change when a tape is
@@ -836,7 +1036,7 @@ compute_storage_retention_nb(
 typedef struct cmdfile_add_retention_s {
     const char *storage;
     const char *pool;
-    const char *l_template;
+    GHashTable *volumes;
 } cmdfile_add_retention_t;
 
 static void
@@ -858,12 +1058,7 @@ cmdfile_add_retention(
 	    char *label = (char *)sl->data;
 	    tp = lookup_tapelabel(label);
 	    if (tp && !tp->retention && !tp->retention_nb &&
-		(!tp->config || g_str_equal(tp->config, get_config_name())) &&
-	        (!tp->storage || g_str_equal(tp->storage, data->storage)) &&
-	        ((tp->pool && g_str_equal(tp->pool, data->pool)) ||
-	         (!tp->pool && match_labelstr_template(data->l_template, tp->label,
-	                                                   tp->barcode, tp->meta,
-							    tp->storage)))) {
+		g_hash_table_lookup(data->volumes, tp)) {
 		tp->retention = TRUE;
 		tp->retention_type = RETENTION_CMD_COPY;
 	    }
@@ -877,12 +1072,7 @@ cmdfile_add_retention(
 	char *label = cmddata->src_label;
 	tp = lookup_tapelabel(label);
 	if (tp && !tp->retention && !tp->retention_nb &&
-	    (!tp->config || g_str_equal(tp->config, get_config_name())) &&
-	    (!tp->storage || g_str_equal(tp->storage, data->storage)) &&
-	    ((tp->pool && g_str_equal(tp->pool, data->pool)) ||
-	     (!tp->pool && match_labelstr_template(data->l_template, tp->label,
-	                                           tp->barcode, tp->meta,
-							    tp->storage)))) {
+	    g_hash_table_lookup(data->volumes, tp)) {
 	    tp->retention = TRUE;
 	    tp->retention_type = RETENTION_CMD_RESTORE;
 	}
@@ -892,9 +1082,9 @@ cmdfile_add_retention(
 static void
 compute_storage_retention(
     find_result_t *output_find,
+    GHashTable *volumes,
     const char *storage,
     const char *tapepool,
-    const char *l_template,
     int   retention_tapes,
     int   retention_days,
     int   retention_recover,
@@ -916,12 +1106,7 @@ compute_storage_retention(
 	    if (tp->reuse == 1 &&
 		!tp->retention && !tp->retention_nb &&
 		g_ascii_strcasecmp(tp->datestamp, datestr) > 0 &&
-		(!tp->config || g_str_equal(tp->config, get_config_name())) &&
-		(!tp->storage || g_str_equal(tp->storage, storage)) &&
-		((tp->pool && g_str_equal(tp->pool, tapepool)) ||
-		 (!tp->pool && match_labelstr_template(l_template, tp->label,
-						       tp->barcode, tp->meta,
-							    tp->storage)))) {
+		g_hash_table_lookup(volumes, tp)) {
 		tp->retention = TRUE;
 		tp->retention_type = RETENTION_DAYS;
 	    }
@@ -953,12 +1138,7 @@ compute_storage_retention(
 		if (ofr->label && ofr->label[0] != '/') {
 		    tp = lookup_tapelabel(ofr->label);
 		    if (!tp->retention && !tp->retention_nb &&
-			(!tp->config || g_str_equal(tp->config, get_config_name())) &&
-			(!tp->storage || g_str_equal(tp->storage, storage)) &&
-			((tp->pool && g_str_equal(tp->pool, tapepool)) ||
-			 (!tp->pool && match_labelstr_template(l_template, tp->label,
-							       tp->barcode, tp->meta,
-							    tp->storage)))) {
+			g_hash_table_lookup(volumes, tp)) {
 			/* keep that label */
 			tp->retention = TRUE;
 			tp->retention_type = RETENTION_RECOVER;
@@ -976,8 +1156,7 @@ compute_storage_retention(
 	char *diskname = "ADJAOLDUIN";
 	int   count    = 0;
 
-	sort_find_result("hkDLpbfw", &output_find);
-
+	/* output_find is sorted "hkDLpbfw" by update_output_find */
 	for (ofr = output_find;
 	     ofr;
 	     ofr = ofr->next) {
@@ -994,12 +1173,7 @@ compute_storage_retention(
 		if (ofr->label && ofr->label[0] != '/') {
 		    tp = lookup_tapelabel(ofr->label);
 		    if (!tp->retention && !tp->retention_nb &&
-			(!tp->config || g_str_equal(tp->config, get_config_name())) &&
-			(!tp->storage || g_str_equal(tp->storage, storage)) &&
-			((tp->pool && g_str_equal(tp->pool, tapepool)) ||
-			 (!tp->pool && match_labelstr_template(l_template, tp->label,
-							       tp->barcode, tp->meta,
-							    tp->storage)))) {
+			g_hash_table_lookup(volumes, tp)) {
 			/* keep that label */
 			tp->retention = TRUE;
 			tp->retention_type = RETENTION_FULL;
@@ -1016,7 +1190,7 @@ compute_storage_retention(
     unlock_cmdfile(cmddatas);
     data.storage  = storage;
     data.pool = tapepool;
-    data.l_template = l_template;
+    data.volumes = volumes;
 
     // keep label if it have a command in cmdfile not yet executed.
     g_hash_table_foreach(cmddatas->cmdfile, &cmdfile_add_retention, &data);
@@ -43,7 +43,8 @@ GetOptions(
     'version' => \&Amanda::Util::version_opt,
     'o=s' => sub { add_config_override_opt($config_overrides, $_[1]); },
     'storage-name=s' => \$opt_storage_name,
-    'log-filename=s' => sub { Amanda::Logfile::set_logname($_[1]); },
+    'log-filename=s' => sub { Amanda::Logfile::set_logname($_[1]);
+			      Amanda::Logfile::log_set_keep_open(1); },
 ) or usage();
 
 if (@ARGV != 1) {
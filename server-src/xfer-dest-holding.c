@@ -37,6 +37,9 @@
 #define HEADER_BLOCK_BYTES  DISK_BLOCK_BYTES
 #define HOLDING_BLOCK_BYTES DISK_BLOCK_BYTES
 
+/* the writeback of a chunk file is started every HOLDING_WRITE_BEHIND bytes */
+#define HOLDING_WRITE_BEHIND (8*1024*1024)
+
 /*
  * Xfer Dest Holding
  */
@@ -53,9 +56,6 @@ typedef struct XferDestHolding {
      */
 
     char       *first_filename;
-    /* The thread doing the actual writes to tape; this also handles buffering
-     * for streaming */
-    GThread *holding_thread;
 
     /* Ring Buffer
      *
@@ -92,6 +92,8 @@ typedef struct XferDestHolding {
     guint64     header_bytes_written;
     guint64     chunk_offset;         /* bytes written to the current */
 				      /* chunk, including header      */
+    guint64     flushed_offset;       /* bytes of the current chunk   */
+				      /* whose writeback was started  */
 
     enum { CHUNK_OK	 = 0,		/* */
 	   CHUNK_EOF	 = 1,		/* we read the complete input */
@@ -122,6 +124,7 @@ typedef struct {
 static int close_chunk(XferDestHolding *xdh, char *cont_filename, char **mesg);
 static ssize_t write_header(XferDestHolding *xdh, int fd);
 static size_t full_write_with_fake_enospc(int fd, const void *buf, size_t count);
+static void holding_write_behind(XferDestHolding *xdh);
 
 /* we use a function pointer for full_write, so that we can "shim" in
  * full_write_with_fake_enospc for testing
@@ -161,6 +164,7 @@ holding_thread_wait_for_block(
     XferElement *elt = XFER_ELEMENT(self);
     gsize bytes_needed = HOLDING_BLOCK_BYTES;
     gsize usable;
+    gint64 start;
 
     while (1) {
 	/* are we ready? */
@@ -174,7 +178,9 @@ holding_thread_wait_for_block(
 	    break;
 
 	/* nope - so wait */
+	start = xfer_stats_clock();
 	g_cond_wait(self->mem_ring->add_cond, self->mem_ring->mutex);
+	xfer_element_add_stats(elt, 0, 0, xfer_stats_clock() - start, 0);
     }
 
     usable = MIN(self->mem_ring->written - self->mem_ring->readx, bytes_needed);
@@ -189,6 +195,7 @@ holding_thread_consume_block(
     XferDestHolding *self,
     gsize written)
 {
+    xfer_element_add_stats(XFER_ELEMENT(self), written, 0, 0, 0);
     self->mem_ring->readx += written;
     self->mem_ring->read_offset += written;
     if (self->mem_ring->read_offset >= self->mem_ring->ring_size)
@@ -279,6 +286,7 @@ failure_port_write_data:
 	crc32_add((uint8_t *)(self->mem_ring->buffer + self->mem_ring->read_offset),
 			 to_write, &elt->crc);
 	self->chunk_offset += count;
+	holding_write_behind(self);
 
 	self->data_bytes_written += count;
 	self->use_bytes -= count;
@@ -369,7 +377,7 @@ holding_thread(
 		port_open_header--;
 	    }
 #endif
-	    fd = open(tmp_filename, O_RDWR|O_CREAT|O_TRUNC, 0600);
+	    fd = holding_chunk_open(tmp_filename);
 #ifdef FAILURE_CODE
 failure_port_open_header:
 #endif
@@ -434,6 +442,7 @@ failure_port_write_header:
 	    self->fd = fd;
 	    self->header_bytes_written = HEADER_BLOCK_BYTES;
 	    self->chunk_offset = HEADER_BLOCK_BYTES;
+	    self->flushed_offset = 0;
 	}
 
 	DBG(2, "beginning to write chunk");
@@ -499,14 +508,17 @@ shm_holding_thread_wait_for_block(
 {
     XferElement *elt = XFER_ELEMENT(self);
     gsize usable;
+    gint64 start;
 
     while (!elt->cancelled &&
 	   !elt->shm_ring->mc->cancelled &&
 	   !elt->shm_ring->mc->eof_flag &&
 	   !(elt->shm_ring->mc->written - elt->shm_ring->mc->readx > HOLDING_BLOCK_BYTES)) {
 
+	start = xfer_stats_clock();
 	if (shm_ring_sem_wait(elt->shm_ring, elt->shm_ring->sem_read) != 0)
 	    break;
+	xfer_element_add_stats(elt, 0, 0, xfer_stats_clock() - start, 0);
     }
 
     usable = MIN(elt->shm_ring->mc->written - elt->shm_ring->mc->readx, HOLDING_BLOCK_BYTES+1);
@@ -523,6 +535,7 @@ shm_holding_thread_consume_block(
 {
     XferElement *elt = XFER_ELEMENT(self);
 
+    xfer_element_add_stats(elt, written, 0, 0, 0);
     elt->shm_ring->mc->readx += written;
     elt->shm_ring->mc->read_offset += written;
     if (elt->shm_ring->mc->read_offset >= elt->shm_ring->mc->ring_size)
@@ -601,6 +614,7 @@ failure_shm_write_data:
 	crc32_add((uint8_t *)(elt->shm_ring->data + elt->shm_ring->mc->read_offset),
 			 to_write, &elt->crc);
 	self->chunk_offset += count;
+	holding_write_behind(self);
 
 	self->data_bytes_written += count;
 	self->use_bytes -= count;
@@ -694,7 +708,7 @@ shm_holding_thread(
 		shm_open_header--;
 	    }
 #endif
-	    fd = open(tmp_filename, O_RDWR|O_CREAT|O_TRUNC, 0600);
+	    fd = holding_chunk_open(tmp_filename);
 #ifdef FAILURE_CODE
 failure_shm_open_header:
 #endif
@@ -759,6 +773,7 @@ failure_shm_write_header:
 	    self->fd = fd;
 	    self->header_bytes_written = HEADER_BLOCK_BYTES;
 	    self->chunk_offset = HEADER_BLOCK_BYTES;
+	    self->flushed_offset = 0;
 	}
 
 	DBG(2, "beginning to write chunk");
@@ -826,16 +841,12 @@ start_impl(
     XferElement *elt)
 {
     XferDestHolding *self = (XferDestHolding *)elt;
-    GError *error = NULL;
 
+    /* the thread doing the actual writes to the holding disk */
     if (elt->input_mech == XFER_MECH_SHM_RING) {
-        self->holding_thread = g_thread_create(shm_holding_thread, (gpointer)self, FALSE, &error);
+        xfer_thread_run(shm_holding_thread, (gpointer)self);
     } else {
-        self->holding_thread = g_thread_create(holding_thread, (gpointer)self, FALSE, &error);
-    }
-    if (!self->holding_thread) {
-        g_critical(_("Error creating new thread: %s (%s)"),
-            error->message, errno? strerror(errno) : _("no error code"));
+        xfer_thread_run(holding_thread, (gpointer)self);
     }
 
     return TRUE;
@@ -1141,6 +1152,32 @@ xfer_dest_holding(
     return elt;
 }
 
+/*
+ * Start the writeback of the data written to the current chunk file, without
+ * waiting for it.  The disk then writes steadily instead of in bursts when the
+ * kernel's dirty limits are hit, and when the dump moves on to a chunk on
+ * another holding disk, the end of this chunk is written in parallel with the
+ * start of the next one.
+ */
+static void
+holding_write_behind(
+    XferDestHolding *self)
+{
+#ifdef HAVE_SYNC_FILE_RANGE
+    if (self->chunk_offset - self->flushed_offset < HOLDING_WRITE_BEHIND)
+	return;
+
+    if (sync_file_range(self->fd, self->flushed_offset,
+			self->chunk_offset - self->flushed_offset,
+			SYNC_FILE_RANGE_WRITE) == -1) {
+	g_debug("sync_file_range failed: %s", strerror(errno));
+    }
+    self->flushed_offset = self->chunk_offset;
+#else
+    (void)self;
+#endif
+}
+
 /*
  * Send an Amanda dump header to the output file and set file->blocksize
  */
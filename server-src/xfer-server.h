@@ -47,6 +47,18 @@ guint64
 xfer_source_holding_get_bytes_read(
     XferElement *elt);
 
+/* Set how many bytes are read ahead of the data sent, and how long before the
+ * end of a chunk the next chunk is opened and read.  The default is 32M; 0
+ * leaves the readahead to the kernel.  Call before the transfer starts.
+ *
+ * @param elt: the XferSourceHolding
+ * @param readahead: bytes
+ */
+void
+xfer_source_holding_set_readahead(
+    XferElement *elt,
+    guint64 readahead);
+
 /* A transfer destination that writes to holding file.
  *
  * Implemented in xfer-dest-holding.c
@@ -63,7 +63,18 @@ typedef struct XferSourceHolding {
     off_t fsize;
     gboolean paused;
 
-    GThread *holding_thread;
+    /* bytes kept in flight ahead of the reads, 0 to leave it to the kernel */
+    gsize readahead;
+
+    /* offset in the current chunk up to which the reads were announced */
+    off_t advised_offset;
+
+    /* the chunk after the current one, opened and prefetched once the current
+     * one is read to within readahead bytes of its end; next_fd_filename is
+     * NULL until then */
+    int next_fd;
+    char *next_fd_filename;
+
     GMutex     *state_mutex;
     GCond      *state_cond;
 
@@ -84,6 +95,7 @@ typedef struct {
 } XferSourceHoldingClass;
 
 static gboolean start_new_chunk(XferSourceHolding *self);
+static void holding_readahead(XferSourceHolding *self);
 
 /*
  * Implementation
@@ -91,6 +103,11 @@ static gboolean start_new_chunk(XferSourceHolding *self);
 
 #define HOLDING_BLOCK_BYTES DISK_BLOCK_BYTES
 
+/* default for readahead; the start of the next chunk is read this far before
+ * the end of the current one, so that when it is on another holding disk,
+ * that disk works in parallel with the current one */
+#define HOLDING_PREFETCH (32*1024*1024)
+
 /*
  * Debug logging
  */
@@ -149,11 +166,15 @@ holding_thread(
 
 	// wait for mem_ring space;
 	while (mem_ring_size - (written - readx) < producer_block_size) {
+	    gint64 start;
+
 	    if (elt->cancelled) {
 		g_mutex_unlock(self->mem_ring->mutex);
 		goto return_eof;
 	    }
+	    start = xfer_stats_clock();
 	    g_cond_wait(self->mem_ring->free_cond, self->mem_ring->mutex);
+	    xfer_element_add_stats(elt, 0, 0, 0, xfer_stats_clock() - start);
 	    write_offset = self->mem_ring->write_offset;
 	    written = self->mem_ring->written;
             readx = self->mem_ring->readx;
@@ -183,6 +204,7 @@ holding_thread(
 	    self->current_offset += bytes_read;
 	    self->bytes_read += bytes_read;
 	    crc32_add((uint8_t *)self->mem_ring->buffer + self->mem_ring->write_offset, bytes_read, &elt->crc);
+	    holding_readahead(self);
 	    write_offset += bytes_read;
 	    write_offset %= mem_ring_size;
 	    g_mutex_lock(self->mem_ring->mutex);
@@ -281,8 +303,17 @@ start_new_chunk(
 		return FALSE;
 	    }
 
-	    /* otherwise, open up the next file */
-	    self->fd = open(self->next_filename, O_RDONLY);
+	    /* otherwise, open up the next file, unless it is already open */
+	    if (self->next_fd != -1 &&
+		g_str_equal(self->next_fd_filename, self->next_filename)) {
+		self->fd = self->next_fd;
+	    } else {
+		if (self->next_fd != -1)
+		    close(self->next_fd);
+		self->fd = open(self->next_filename, O_RDONLY);
+	    }
+	    self->next_fd = -1;
+	    amfree(self->next_fd_filename);
 	    if (self->fd < 0) {
 		xfer_cancel_with_error(XFER_ELEMENT(self),
 			"while opening holding file '%s': %s",
@@ -369,6 +400,10 @@ start_new_chunk(
 
 	self->current_offset = self->offset_file += self->fsize;	/* fsize of previous chunk */
 	self->fsize = finfo.st_size - DISK_BLOCK_BYTES;
+	self->advised_offset = 0;
+#ifdef HAVE_POSIX_FADVISE
+	posix_fadvise(self->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
 
 	g_free(self->next_filename);
 	if (hdr.cont_filename[0]) {
@@ -391,6 +426,51 @@ start_new_chunk(
     return TRUE;
 }
 
+/* Keep readahead bytes of the current chunk announced to the kernel ahead of
+ * the reads, so that the holding disk always has a deep queue of requests;
+ * posix_fadvise(WILLNEED) starts the reads without waiting for them, so no
+ * thread is needed for this.  Once the current chunk is read to within
+ * readahead bytes of its end, open the next chunk and announce its start as
+ * well, so that the flush does not wait for that holding disk when it gets
+ * there. */
+static void
+holding_readahead(
+    XferSourceHolding *self)
+{
+#ifdef HAVE_POSIX_FADVISE
+    off_t pos;
+
+    if (self->readahead == 0 || self->fd == -1)
+	return;
+
+    pos = self->current_offset - self->offset_file + DISK_BLOCK_BYTES;
+    if (self->advised_offset < pos + (off_t)self->readahead / 2) {
+	off_t start = MAX(self->advised_offset, pos);
+	off_t end = MIN(pos + (off_t)self->readahead,
+			self->fsize + DISK_BLOCK_BYTES);
+
+	if (end > start)
+	    posix_fadvise(self->fd, start, end - start, POSIX_FADV_WILLNEED);
+	self->advised_offset = MAX(end, self->advised_offset);
+    }
+
+    if (self->next_fd_filename || !self->next_filename ||
+	self->current_offset + (off_t)self->readahead <
+				self->offset_file + self->fsize)
+	return;
+
+    self->next_fd_filename = g_strdup(self->next_filename);
+    self->next_fd = open(self->next_filename, O_RDONLY);
+    if (self->next_fd < 0)
+	return; /* start_new_chunk reports the error */
+    DBG(2, "prefetching holding file '%s'", self->next_filename);
+    posix_fadvise(self->next_fd, 0, DISK_BLOCK_BYTES + self->readahead,
+		  POSIX_FADV_WILLNEED);
+#else
+    (void)self;
+#endif
+}
+
 /* pick an arbitrary block size for reading */
 #define HOLDING_BLOCK_SIZE (1024*128)
 
@@ -409,6 +489,19 @@ get_mem_ring_impl(
     return self->mem_ring;
 }
 
+static gboolean
+setup_impl(
+    XferElement *elt)
+{
+    if (elt->output_mech == XFER_MECH_PULL_BUFFER)
+	xfer_reserve_buffers(elt->xfer, HOLDING_BLOCK_SIZE, 2, FALSE);
+
+    /* every output mech computes the crc of what it produces */
+    elt->output_crc_known = TRUE;
+
+    return TRUE;
+}
+
 static gpointer
 pull_buffer_impl(
     XferElement *elt,
@@ -443,7 +536,7 @@ pull_buffer_impl(
 	    goto return_eof;
     }
 
-    buf = g_malloc(HOLDING_BLOCK_SIZE);
+    buf = xfer_element_alloc_buffer(elt, HOLDING_BLOCK_SIZE);
 
     if (elt->offset == 0 && elt->orig_size == 0) {
     }
@@ -466,6 +559,7 @@ pull_buffer_impl(
 	    *size = bytes_read;
 	    self->bytes_read += bytes_read;
 	    crc32_add((uint8_t *)buf, bytes_read, &elt->crc);
+	    holding_readahead(self);
 	    g_mutex_unlock(self->start_recovery_mutex);
 	    return buf;
 	}
@@ -492,7 +586,7 @@ return_eof:
     xfer_queue_message(elt->xfer, msg);
 
     g_mutex_unlock(self->start_recovery_mutex);
-    g_free(buf);
+    xfer_element_free_buffer(elt, buf);
     *size = 0;
     return NULL;
 }
@@ -555,6 +649,7 @@ pull_buffer_static_impl(
 	    *size = bytes_read;
 	    self->bytes_read += bytes_read;
 	    crc32_add((uint8_t *)buf, bytes_read, &elt->crc);
+	    holding_readahead(self);
 	    g_mutex_unlock(self->start_recovery_mutex);
 	    return buf;
 	}
@@ -590,14 +685,9 @@ start_impl(
     XferElement *elt)
 {
     XferSourceHolding *self = (XferSourceHolding *)elt;
-    GError *error = NULL;
 
     if (elt->output_mech == XFER_MECH_MEM_RING) {
-	self->holding_thread = g_thread_create(holding_thread, (gpointer)self, FALSE, &error);
-	if (!self->holding_thread) {
-            g_critical(_("Error creating new thread: %s (%s)"),
-	            error->message, errno? strerror(errno) : _("no error code"));
-	}
+	xfer_thread_run(holding_thread, (gpointer)self);
 	return TRUE;
     }
 
@@ -665,6 +755,8 @@ instance_init(
 
     elt->can_generate_eof = TRUE;
     self->fd = -1;
+    self->next_fd = -1;
+    self->readahead = HOLDING_PREFETCH;
     self->paused = TRUE;
     self->current_offset = 0;
     self->offset_file = -1;
@@ -694,6 +786,9 @@ finalize_impl(
     g_mutex_free(self->start_recovery_mutex);
     if (self->fd != -1)
 	close(self->fd); /* ignore error; we were probably already cancelled */
+    if (self->next_fd != -1)
+	close(self->next_fd);
+    g_free(self->next_fd_filename);
 
     G_OBJECT_CLASS(parent_class)->finalize(obj_self);
 }
@@ -712,6 +807,7 @@ class_init(
     };
 
     klass->get_mem_ring = get_mem_ring_impl;
+    klass->setup = setup_impl;
     klass->pull_buffer = pull_buffer_impl;
     klass->pull_buffer_static = pull_buffer_static_impl;
     klass->start = start_impl;
@@ -787,3 +883,13 @@ xfer_source_holding_get_bytes_read(
     return self->bytes_read;
 }
 
+void
+xfer_source_holding_set_readahead(
+    XferElement *elt,
+    guint64 readahead)
+{
+    XferSourceHolding *self = XFER_SOURCE_HOLDING(elt);
+
+    self->readahead = (gsize)readahead;
+}
+
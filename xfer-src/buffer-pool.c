@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2008-2012 Zmanda, Inc.  All Rights Reserved.
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+
+/* A per-transfer pool of data buffers, so that steady-state PUSH_BUFFER and
+ * PULL_BUFFER transfers recycle the same few buffers rather than going
+ * through malloc and free for every block.  The buffers left when a transfer
+ * is freed are kept for the next transfers of the process.  See xfer.h for
+ * the interface. */
+
+#include "amanda.h"
+#include "amxfer.h"
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#define HUGEPAGE_SIZE (2*1024*1024)
+
+/* available buffers of one size, linked through their first word */
+typedef struct pool_size_s {
+    gsize size;
+    gboolean hugepages;
+    gpointer free_list;
+    guint nfree;
+} pool_size_t;
+
+/* the buffers of the freed pools, up to SPARE_MAX bytes, newest first */
+#define SPARE_MAX (64*1024*1024)
+
+typedef struct spare_s {
+    gpointer buf;
+    gsize size;
+    gboolean hugepages;
+} spare_t;
+
+static GStaticMutex spare_mutex = G_STATIC_MUTEX_INIT;
+static GSList *spares = NULL;
+static gsize spare_bytes = 0;
+
+struct XferBufferPool {
+    GMutex *mutex;
+
+    /* buffer -> pool_size_t, for every buffer the pool allocated */
+    GHashTable *owned;
+
+    /* size -> pool_size_t, for every reserved size */
+    GHashTable *sizes;
+
+    gsize page_size;
+    guint64 nallocs;
+    guint64 nreuses;
+};
+
+static void pool_free(gpointer buf);
+
+/* Take a spare buffer like those of PS, or return NULL */
+static gpointer
+spare_get(
+    pool_size_t *ps)
+{
+    GSList *iter;
+    gpointer buf = NULL;
+
+    g_static_mutex_lock(&spare_mutex);
+    for (iter = spares; iter; iter = iter->next) {
+	spare_t *spare = iter->data;
+
+	if (spare->size == ps->size && spare->hugepages == ps->hugepages) {
+	    buf = spare->buf;
+	    spare_bytes -= spare->size;
+	    spares = g_slist_delete_link(spares, iter);
+	    g_free(spare);
+	    break;
+	}
+    }
+    g_static_mutex_unlock(&spare_mutex);
+
+    return buf;
+}
+
+/* Keep BUF, a buffer like those of PS, for a later pool; the oldest spares
+ * are freed if it does not fit */
+static void
+spare_put(
+    gpointer buf,
+    pool_size_t *ps)
+{
+    spare_t *spare;
+
+    if (ps->size > SPARE_MAX) {
+	pool_free(buf);
+	return;
+    }
+
+    spare = g_new(spare_t, 1);
+    spare->buf = buf;
+    spare->size = ps->size;
+    spare->hugepages = ps->hugepages;
+
+    g_static_mutex_lock(&spare_mutex);
+    spares = g_slist_prepend(spares, spare);
+    spare_bytes += spare->size;
+    while (spare_bytes > SPARE_MAX) {
+	GSList *last = g_slist_last(spares);
+
+	spare = last->data;
+	spare_bytes -= spare->size;
+	spares = g_slist_delete_link(spares, last);
+	pool_free(spare->buf);
+	g_free(spare);
+    }
+    g_static_mutex_unlock(&spare_mutex);
+}
+
+static gpointer
+pool_alloc(
+    XferBufferPool *pool,
+    pool_size_t *ps)
+{
+    gpointer buf;
+
+    buf = spare_get(ps);
+    if (buf)
+	return buf;
+
+#ifdef HAVE_POSIX_MEMALIGN
+    gsize align = ps->hugepages ? HUGEPAGE_SIZE : pool->page_size;
+    int rv = posix_memalign(&buf, align, ps->size);
+    if (rv != 0) {
+	error(_("could not allocate %zu-byte transfer buffer: %s"),
+	      ps->size, strerror(rv));
+	/*NOTREACHED*/
+    }
+#if defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+    if (ps->hugepages)
+	madvise(buf, ps->size, MADV_HUGEPAGE);
+#endif
+#else
+    (void)pool;
+    buf = g_malloc(ps->size);
+#endif
+
+    return buf;
+}
+
+static void
+pool_free(
+    gpointer buf)
+{
+#ifdef HAVE_POSIX_MEMALIGN
+    free(buf);
+#else
+    g_free(buf);
+#endif
+}
+
+/* g_hash_table_foreach callback for xfer_buffer_pool_free */
+static void
+spare_free_list(
+    gpointer key G_GNUC_UNUSED,
+    gpointer value,
+    gpointer user_data G_GNUC_UNUSED)
+{
+    pool_size_t *ps = value;
+
+    while (ps->free_list) {
+	gpointer buf = ps->free_list;
+	ps->free_list = *(gpointer *)buf;
+	spare_put(buf, ps);
+    }
+}
+
+XferBufferPool *
+xfer_buffer_pool_new(void)
+{
+    XferBufferPool *pool = g_new0(XferBufferPool, 1);
+
+    pool->mutex = g_mutex_new();
+    pool->owned = g_hash_table_new(g_direct_hash, g_direct_equal);
+    pool->sizes = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					NULL, g_free);
+#ifdef _SC_PAGESIZE
+    pool->page_size = sysconf(_SC_PAGESIZE);
+#endif
+    if (pool->page_size == 0 || pool->page_size == (gsize)-1)
+	pool->page_size = 4096;
+
+    return pool;
+}
+
+void
+xfer_buffer_pool_free(
+    XferBufferPool *pool)
+{
+    if (!pool)
+	return;
+
+    if (pool->nallocs)
+	g_debug("buffer pool: %ju buffers allocated, %ju reused",
+		(uintmax_t)pool->nallocs, (uintmax_t)pool->nreuses);
+
+    /* keep the available buffers for the next pools; any still held by an
+     * element belong to it now, and will be freed with g_free */
+    g_hash_table_foreach(pool->sizes, spare_free_list, NULL);
+
+    g_hash_table_destroy(pool->owned);
+    g_hash_table_destroy(pool->sizes);
+    g_mutex_free(pool->mutex);
+    g_free(pool);
+}
+
+void
+xfer_reserve_buffers(
+    Xfer *xfer,
+    gsize size,
+    guint count,
+    gboolean hugepages)
+{
+    XferBufferPool *pool = xfer->buffer_pool;
+    pool_size_t *ps;
+
+    g_assert(size >= sizeof(gpointer));
+
+    g_mutex_lock(pool->mutex);
+    ps = g_hash_table_lookup(pool->sizes, GSIZE_TO_POINTER(size));
+    if (!ps) {
+	ps = g_new0(pool_size_t, 1);
+	ps->size = size;
+	ps->hugepages = hugepages && size >= HUGEPAGE_SIZE;
+	g_hash_table_insert(pool->sizes, GSIZE_TO_POINTER(size), ps);
+    }
+
+    while (ps->nfree < count) {
+	gpointer buf = pool_alloc(pool, ps);
+
+	g_hash_table_insert(pool->owned, buf, ps);
+	*(gpointer *)buf = ps->free_list;
+	ps->free_list = buf;
+	ps->nfree++;
+	pool->nallocs++;
+    }
+    g_mutex_unlock(pool->mutex);
+}
+
+gpointer
+xfer_get_buffer(
+    Xfer *xfer,
+    gsize size)
+{
+    XferBufferPool *pool = xfer->buffer_pool;
+    pool_size_t *ps;
+    gpointer buf;
+
+    g_mutex_lock(pool->mutex);
+    ps = g_hash_table_lookup(pool->sizes, GSIZE_TO_POINTER(size));
+    if (!ps) {
+	/* not a reserved size */
+	g_mutex_unlock(pool->mutex);
+	return g_malloc(size);
+    }
+
+    if (ps->free_list) {
+	buf = ps->free_list;
+	ps->free_list = *(gpointer *)buf;
+	ps->nfree--;
+	pool->nreuses++;
+    } else {
+	buf = pool_alloc(pool, ps);
+	g_hash_table_insert(pool->owned, buf, ps);
+	pool->nallocs++;
+    }
+    g_mutex_unlock(pool->mutex);
+
+    return buf;
+}
+
+void
+xfer_release_buffer(
+    Xfer *xfer,
+    gpointer buf)
+{
+    XferBufferPool *pool = xfer->buffer_pool;
+    pool_size_t *ps;
+
+    if (!buf)
+	return;
+
+    g_mutex_lock(pool->mutex);
+    ps = g_hash_table_lookup(pool->owned, buf);
+    if (ps) {
+	*(gpointer *)buf = ps->free_list;
+	ps->free_list = buf;
+	ps->nfree++;
+    }
+    g_mutex_unlock(pool->mutex);
+
+    /* not one of ours */
+    if (!ps)
+	g_free(buf);
+}
@@ -98,7 +98,7 @@ push_buffer_impl(
 	xfer_cancel_with_error(elt,
 	    _("illegal attempt to transfer more than %zd bytes"), self->max_size);
 	wait_until_xfer_cancelled(elt->xfer);
-	amfree(buf);
+	xfer_element_free_buffer(elt, buf);
 	return;
     }
 
@@ -117,7 +117,7 @@ push_buffer_impl(
     g_memmove(((guint8 *)self->buf)+self->len, buf, len);
     self->len += len;
 
-    amfree(buf);
+    xfer_element_free_buffer(elt, buf);
 }
 
 static void
@@ -240,6 +240,7 @@ xfer_dest_buffer(
     XferElement *elt = XFER_ELEMENT(self);
 
     self->max_size = max_size;
+    elt->releases_buffers = TRUE;
 
     return elt;
 }
@@ -91,7 +91,7 @@ push_buffer_impl(
 	    xfer_cancel_with_error(elt,
 		"verification of incoming bytestream failed; see stderr for details"),
 	    wait_until_xfer_cancelled(elt->xfer);
-	    amfree(buf);
+	    xfer_element_free_buffer(elt, buf);
 	    return;
 	}
     }
@@ -102,11 +102,12 @@ push_buffer_impl(
 	 * after all) */
 	XMsg *msg = xmsg_new((XferElement *)self, XMSG_INFO, 0);
 	msg->message = g_strdup("Is this thing on?");
+	msg->flags |= XMSG_FLAG_DROPPABLE;
 	xfer_queue_message(XFER_ELEMENT(self)->xfer, msg);
 	self->sent_info = TRUE;
     }
 
-    amfree(buf);
+    xfer_element_free_buffer(elt, buf);
 }
 
 static void
@@ -142,6 +143,7 @@ push_buffer_static_impl(
 	 * after all) */
 	XMsg *msg = xmsg_new((XferElement *)self, XMSG_INFO, 0);
 	msg->message = g_strdup("Is this thing on?");
+	msg->flags |= XMSG_FLAG_DROPPABLE;
 	xfer_queue_message(XFER_ELEMENT(self)->xfer, msg);
 	self->sent_info = TRUE;
     }
@@ -207,6 +209,7 @@ xfer_dest_null(
 	self->do_verify = FALSE;
     }
     crc32_init(&elt->crc);
+    elt->releases_buffers = TRUE;
 
     return elt;
 }
@@ -0,0 +1,529 @@
+/*
+ * Copyright (c) 2008-2012 Zmanda, Inc.  All Rights Reserved.
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+/* Multi-connection DirectTCP; see directtcp-mux.h */
+
+#include "amanda.h"
+#include "amxfer.h"
+#include "amutil.h"
+#include "directtcp-mux.h"
+
+#define MUX_MAGIC "AMDTMUX1"
+#define MUX_FRAME_HEADER 12
+#define MUX_BLOCK_SIZE (256*1024)
+/* blocks queued for sending, or waiting to be reordered, per connection */
+#define MUX_BLOCKS_PER_STREAM 4
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+typedef struct mux_block {
+    guint64 seq;
+    guint32 len;
+    /* MUX_FRAME_HEADER bytes of frame header, then the data */
+    char *frame;
+} mux_block_t;
+
+struct DirectTCPMux {
+    XferElement *elt;
+    gboolean sending;
+
+    int nsocks;
+    int *socks;
+
+    /* our end of the socketpair joined to the glue */
+    int peer;
+
+    GThread *pump;
+    GThread **workers;
+
+    GMutex *mutex;
+    GCond *cond;
+    gboolean failed;
+
+    /* sending: blocks read from the glue, waiting for a connection */
+    GQueue *queue;
+    gboolean eof;
+
+    /* receiving: blocks received out of order, by sequence */
+    GTree *pending;
+    int nsocks_done;
+
+    /* sequence of the next block to queue (sending) or deliver (receiving) */
+    guint64 next_seq;
+};
+
+typedef struct mux_worker {
+    DirectTCPMux *mux;
+    int sock;
+} mux_worker_t;
+
+static mux_block_t *
+block_new(
+    gsize size)
+{
+    mux_block_t *blk = g_new0(mux_block_t, 1);
+
+    blk->frame = g_malloc(MUX_FRAME_HEADER + size);
+    return blk;
+}
+
+static void
+block_free(
+    gpointer data)
+{
+    mux_block_t *blk = data;
+
+    g_free(blk->frame);
+    g_free(blk);
+}
+
+static gint
+seq_cmp(
+    gconstpointer a,
+    gconstpointer b)
+{
+    guint64 sa = *(const guint64 *)a;
+    guint64 sb = *(const guint64 *)b;
+
+    return (sa < sb)? -1 : (sa > sb)? 1 : 0;
+}
+
+static void
+put_frame_header(
+    char *p,
+    guint32 len,
+    guint64 seq)
+{
+    guint32 v;
+
+    v = htonl(len);
+    memcpy(p, &v, 4);
+    v = htonl((guint32)(seq >> 32));
+    memcpy(p+4, &v, 4);
+    v = htonl((guint32)seq);
+    memcpy(p+8, &v, 4);
+}
+
+static void
+get_frame_header(
+    const char *p,
+    guint32 *len,
+    guint64 *seq)
+{
+    guint32 hi, lo;
+
+    memcpy(len, p, 4);
+    *len = ntohl(*len);
+    memcpy(&hi, p+4, 4);
+    memcpy(&lo, p+8, 4);
+    *seq = ((guint64)ntohl(hi) << 32) | ntohl(lo);
+}
+
+void
+directtcp_mux_hello(
+    char *hello,
+    int index,
+    int nstreams)
+{
+    guint32 v;
+
+    memcpy(hello, MUX_MAGIC, 8);
+    v = htonl((guint32)index);
+    memcpy(hello+8, &v, 4);
+    v = htonl((guint32)nstreams);
+    memcpy(hello+12, &v, 4);
+}
+
+int
+directtcp_mux_parse_hello(
+    const char *hello)
+{
+    guint32 index, nstreams;
+
+    if (memcmp(hello, MUX_MAGIC, 8) != 0)
+	return -1;
+    memcpy(&index, hello+8, 4);
+    memcpy(&nstreams, hello+12, 4);
+    index = ntohl(index);
+    nstreams = ntohl(nstreams);
+    if (nstreams < 1 || nstreams > DIRECTTCP_MUX_MAX_STREAMS || index >= nstreams)
+	return -1;
+
+    return (int)nstreams;
+}
+
+/* Record a failure and wake everybody up; the first one is reported */
+static void
+mux_fail(
+    DirectTCPMux *mux,
+    const char *what,
+    int err)
+{
+    gboolean first;
+
+    g_mutex_lock(mux->mutex);
+    first = !mux->failed;
+    mux->failed = TRUE;
+    g_cond_broadcast(mux->cond);
+    g_mutex_unlock(mux->mutex);
+
+    if (first) {
+	g_debug("directtcp mux: %s: %s", what, err? strerror(err) : "unexpected EOF");
+	if (!mux->elt->cancelled)
+	    xfer_cancel_with_error(mux->elt, "DirectTCP %s: %s", what,
+				   err? strerror(err) : "unexpected EOF");
+    }
+}
+
+/*
+ * Sending
+ */
+
+/* read the glue's data into sequenced blocks */
+static gpointer
+send_pump_thread(
+    gpointer data)
+{
+    DirectTCPMux *mux = data;
+    int max_queued = mux->nsocks * MUX_BLOCKS_PER_STREAM;
+
+    for (;;) {
+	mux_block_t *blk = block_new(MUX_BLOCK_SIZE);
+	int err = 0;
+	gsize len;
+
+	len = read_fully(mux->peer, blk->frame + MUX_FRAME_HEADER,
+			 MUX_BLOCK_SIZE, &err);
+	if (err) {
+	    block_free(blk);
+	    mux_fail(mux, "reading the data to send", err);
+	    break;
+	}
+	if (len == 0) {
+	    block_free(blk);
+	    break;
+	}
+
+	g_mutex_lock(mux->mutex);
+	while ((int)mux->queue->length >= max_queued && !mux->failed)
+	    g_cond_wait(mux->cond, mux->mutex);
+	if (mux->failed) {
+	    g_mutex_unlock(mux->mutex);
+	    block_free(blk);
+	    break;
+	}
+	blk->seq = mux->next_seq++;
+	blk->len = len;
+	put_frame_header(blk->frame, blk->len, blk->seq);
+	g_queue_push_tail(mux->queue, blk);
+	g_cond_broadcast(mux->cond);
+	g_mutex_unlock(mux->mutex);
+
+	if (len < MUX_BLOCK_SIZE)
+	    break;
+    }
+
+    g_mutex_lock(mux->mutex);
+    mux->eof = TRUE;
+    g_cond_broadcast(mux->cond);
+    g_mutex_unlock(mux->mutex);
+
+    /* make sure the glue doesn't block writing to us after a failure */
+    if (mux->failed)
+	shutdown(mux->peer, SHUT_RDWR);
+
+    return NULL;
+}
+
+/* send queued blocks on one connection, as fast as it takes them */
+static gpointer
+send_worker_thread(
+    gpointer data)
+{
+    mux_worker_t *w = data;
+    DirectTCPMux *mux = w->mux;
+    char eof_frame[MUX_FRAME_HEADER];
+
+    for (;;) {
+	mux_block_t *blk;
+
+	g_mutex_lock(mux->mutex);
+	while (mux->queue->length == 0 && !mux->eof && !mux->failed)
+	    g_cond_wait(mux->cond, mux->mutex);
+	blk = mux->failed? NULL : g_queue_pop_head(mux->queue);
+	g_cond_broadcast(mux->cond);
+	g_mutex_unlock(mux->mutex);
+
+	if (!blk)
+	    break;
+
+	if (full_write(w->sock, blk->frame, MUX_FRAME_HEADER + blk->len)
+		< MUX_FRAME_HEADER + blk->len) {
+	    int err = errno;
+	    block_free(blk);
+	    mux_fail(mux, "sending data", err);
+	    break;
+	}
+	block_free(blk);
+    }
+
+    if (!mux->failed) {
+	put_frame_header(eof_frame, 0, 0);
+	if (full_write(w->sock, eof_frame, MUX_FRAME_HEADER) < MUX_FRAME_HEADER)
+	    mux_fail(mux, "sending data", errno);
+    }
+
+    g_free(w);
+    return NULL;
+}
+
+/*
+ * Receiving
+ */
+
+/* receive blocks on one connection and queue them for reordering */
+static gpointer
+recv_worker_thread(
+    gpointer data)
+{
+    mux_worker_t *w = data;
+    DirectTCPMux *mux = w->mux;
+    int max_pending = mux->nsocks * MUX_BLOCKS_PER_STREAM;
+    char header[MUX_FRAME_HEADER];
+
+    for (;;) {
+	mux_block_t *blk;
+	guint32 len;
+	guint64 seq;
+	int err = 0;
+
+	if (read_fully(w->sock, header, MUX_FRAME_HEADER, &err) < MUX_FRAME_HEADER) {
+	    mux_fail(mux, "receiving data", err);
+	    break;
+	}
+	get_frame_header(header, &len, &seq);
+
+	if (len == 0) {
+	    g_mutex_lock(mux->mutex);
+	    mux->nsocks_done++;
+	    g_cond_broadcast(mux->cond);
+	    g_mutex_unlock(mux->mutex);
+	    break;
+	}
+	if (len > MUX_BLOCK_SIZE) {
+	    mux_fail(mux, "receiving data", EPROTO);
+	    break;
+	}
+
+	blk = block_new(len);
+	blk->seq = seq;
+	blk->len = len;
+	if (read_fully(w->sock, blk->frame + MUX_FRAME_HEADER, len, &err) < len) {
+	    block_free(blk);
+	    mux_fail(mux, "receiving data", err);
+	    break;
+	}
+
+	/* the block the pump is waiting for is always let in, so a full
+	 * reorder queue cannot deadlock */
+	g_mutex_lock(mux->mutex);
+	while (g_tree_nnodes(mux->pending) >= max_pending &&
+	       seq != mux->next_seq && !mux->failed)
+	    g_cond_wait(mux->cond, mux->mutex);
+	if (mux->failed || seq < mux->next_seq ||
+	    g_tree_lookup(mux->pending, &blk->seq)) {
+	    gboolean dup = !mux->failed;
+	    g_mutex_unlock(mux->mutex);
+	    block_free(blk);
+	    if (dup)
+		mux_fail(mux, "receiving data", EPROTO);
+	    break;
+	}
+	g_tree_insert(mux->pending, &blk->seq, blk);
+	g_cond_broadcast(mux->cond);
+	g_mutex_unlock(mux->mutex);
+    }
+
+    g_free(w);
+    return NULL;
+}
+
+/* write to the glue, without taking a SIGPIPE if it has gone away */
+static gboolean
+peer_write(
+    int fd,
+    const char *buf,
+    gsize len)
+{
+    while (len > 0) {
+	ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return FALSE;
+	}
+	buf += n;
+	len -= n;
+    }
+    return TRUE;
+}
+
+/* hand the blocks to the glue in sequence */
+static gpointer
+recv_pump_thread(
+    gpointer data)
+{
+    DirectTCPMux *mux = data;
+
+    for (;;) {
+	mux_block_t *blk;
+	gboolean incomplete;
+
+	g_mutex_lock(mux->mutex);
+	while (!(blk = g_tree_lookup(mux->pending, &mux->next_seq)) &&
+	       mux->nsocks_done < mux->nsocks && !mux->failed)
+	    g_cond_wait(mux->cond, mux->mutex);
+	if (blk && !mux->failed) {
+	    g_tree_steal(mux->pending, &blk->seq);
+	    mux->next_seq++;
+	    g_cond_broadcast(mux->cond);
+	} else {
+	    blk = NULL;
+	}
+	/* if every connection has ended, the stream must be complete */
+	incomplete = !blk && !mux->failed && g_tree_nnodes(mux->pending) != 0;
+	g_mutex_unlock(mux->mutex);
+
+	if (!blk) {
+	    if (incomplete)
+		mux_fail(mux, "receiving data", EPROTO);
+	    break;
+	}
+
+	if (!peer_write(mux->peer, blk->frame + MUX_FRAME_HEADER, blk->len)) {
+	    int err = errno;
+	    block_free(blk);
+	    mux_fail(mux, "delivering data", err);
+	    break;
+	}
+	block_free(blk);
+    }
+
+    /* EOF for the glue */
+    shutdown(mux->peer, SHUT_WR);
+
+    return NULL;
+}
+
+DirectTCPMux *
+directtcp_mux_new(
+    XferElement *elt,
+    int *socks,
+    int nsocks,
+    gboolean sending,
+    int *local_fd)
+{
+    DirectTCPMux *mux;
+    int sv[2];
+    int i;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+	xfer_cancel_with_error(elt, "socketpair(): %s", strerror(errno));
+	for (i = 0; i < nsocks; i++)
+	    close(socks[i]);
+	return NULL;
+    }
+
+    mux = g_new0(DirectTCPMux, 1);
+    mux->elt = elt;
+    mux->sending = sending;
+    mux->nsocks = nsocks;
+    mux->socks = g_memdup(socks, nsocks * sizeof(int));
+    mux->peer = sv[1];
+    mux->mutex = g_mutex_new();
+    mux->cond = g_cond_new();
+    if (sending)
+	mux->queue = g_queue_new();
+    else
+	mux->pending = g_tree_new_full((GCompareDataFunc)seq_cmp, NULL,
+				       NULL, block_free);
+
+    mux->workers = g_new0(GThread *, nsocks);
+    for (i = 0; i < nsocks; i++) {
+	mux_worker_t *w = g_new0(mux_worker_t, 1);
+	w->mux = mux;
+	w->sock = mux->socks[i];
+	mux->workers[i] = g_thread_create(
+		sending? send_worker_thread : recv_worker_thread,
+		w, TRUE, NULL);
+    }
+    mux->pump = g_thread_create(sending? send_pump_thread : recv_pump_thread,
+				mux, TRUE, NULL);
+
+    g_debug("directtcp mux: %s over %d connections",
+	    sending? "sending" : "receiving", nsocks);
+
+    *local_fd = sv[0];
+    return mux;
+}
+
+gboolean
+directtcp_mux_finish(
+    DirectTCPMux *mux)
+{
+    gboolean ok;
+    int i;
+
+    g_thread_join(mux->pump);
+
+    /* a receiver that stopped early must unblock its connections */
+    if (!mux->sending && (mux->failed || mux->nsocks_done < mux->nsocks)) {
+	for (i = 0; i < mux->nsocks; i++)
+	    shutdown(mux->socks[i], SHUT_RDWR);
+    }
+
+    for (i = 0; i < mux->nsocks; i++) {
+	g_thread_join(mux->workers[i]);
+	close(mux->socks[i]);
+    }
+
+    ok = !mux->failed;
+
+    if (mux->queue) {
+	mux_block_t *blk;
+	while ((blk = g_queue_pop_head(mux->queue)))
+	    block_free(blk);
+	g_queue_free(mux->queue);
+    }
+    if (mux->pending)
+	g_tree_destroy(mux->pending);
+    close(mux->peer);
+    g_cond_free(mux->cond);
+    g_mutex_free(mux->mutex);
+    g_free(mux->workers);
+    g_free(mux->socks);
+    g_free(mux);
+
+    return ok;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2008-2012 Zmanda, Inc.  All Rights Reserved.
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+/* Multi-connection DirectTCP.  When both ends of a DirectTCP stream are
+ * Amanda transfer glue, the data can be spread over several TCP
+ * connections to get past the congestion window of a single one on long,
+ * fat pipes.  The sender cuts the stream into sequence-numbered blocks and
+ * hands each to whichever connection is free; the receiver puts them back
+ * in order.  The glue element reads or writes the stream through one end
+ * of a local socketpair, exactly as it would a plain data socket.
+ *
+ * Every connection begins with a hello from the connecting side:
+ *
+ *   "AMDTMUX1"  u32 connection index  u32 number of connections
+ *
+ * and then carries frames of
+ *
+ *   u32 length  u64 sequence  <length bytes>
+ *
+ * in network byte order.  A zero-length frame ends the connection's part
+ * of the stream.  Both ends have to be told the number of connections
+ * with xfer_element_set_directtcp_streams; a standard DirectTCP peer (an
+ * NDMP mover, for instance) always uses a single plain connection. */
+
+#ifndef DIRECTTCP_MUX_H
+#define DIRECTTCP_MUX_H
+
+#include "amxfer.h"
+
+#define DIRECTTCP_MUX_HELLO_SIZE 16
+#define DIRECTTCP_MUX_MAX_STREAMS 64
+
+typedef struct DirectTCPMux DirectTCPMux;
+
+/* Fill HELLO with the hello for connection INDEX of NSTREAMS */
+void directtcp_mux_hello(char *hello, int index, int nstreams);
+
+/* Check a hello received on an accepted connection; returns its number of
+ * connections, or -1 if HELLO is not a valid hello */
+int directtcp_mux_parse_hello(const char *hello);
+
+/* Start moving a stream over the NSOCKS connected sockets in SOCKS, which
+ * the mux takes over.  If SENDING, the data written to the returned local fd
+ * is sent; otherwise the data received can be read from it.  Errors are
+ * reported by cancelling ELT's transfer.
+ *
+ * @param elt: element on whose behalf the data is moved
+ * @param socks: connected data sockets
+ * @param nsocks: number of sockets
+ * @param sending: direction of the stream
+ * @param local_fd: (output) the fd to write or read the stream
+ * @returns: the new mux
+ */
+DirectTCPMux *directtcp_mux_new(XferElement *elt, int *socks, int nsocks,
+				gboolean sending, int *local_fd);
+
+/* Wait for the mux to finish and free it.  The caller must already have
+ * closed the local fd.  For a sending mux, this returns once everything
+ * written has been handed to the network.
+ *
+ * @returns: FALSE if the stream failed
+ */
+gboolean directtcp_mux_finish(DirectTCPMux *mux);
+
+#endif
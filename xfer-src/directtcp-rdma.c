@@ -0,0 +1,845 @@
+/*
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+/* DirectTCP over RDMA; see directtcp-rdma.h */
+
+#include "amanda.h"
+#include "amxfer.h"
+#include "amutil.h"
+#include "sockaddr-util.h"
+#include "directtcp-rdma.h"
+
+#ifdef HAVE_RDMA
+
+#include <poll.h>
+#include <infiniband/verbs.h>
+
+#define RDMA_MAGIC "AMDTRDM1"
+#define RDMA_HELLO_SIZE 48
+#define RDMA_SLOT_ENTRY_SIZE 16
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* the work request ids */
+#define WR_CREDIT 0
+#define WR_DATA 1
+
+typedef struct rdma_hello {
+    guint32 slots;
+    guint32 slot_size;
+    guint32 qpn;
+    guint32 psn;
+    guint16 lid;
+    guint8 mtu;
+    guint8 gid[16];
+} rdma_hello_t;
+
+struct DirectTCPRdma {
+    XferElement *elt;
+    gboolean sending;
+
+    /* the DirectTCP connection, kept open until the stream is done */
+    int sock;
+
+    /* our end of the socketpair joined to the glue */
+    int peer;
+
+    GThread *thread;
+    gboolean failed;
+
+    /* the adapter port that has the address of the connection */
+    struct ibv_context *ctx;
+    guint8 port;
+    int gid_index;
+    struct ibv_port_attr port_attr;
+
+    struct ibv_pd *pd;
+    struct ibv_comp_channel *channel;
+    struct ibv_cq *cq;
+    struct ibv_qp *qp;
+
+    /* our slots, registered buffers from the transfer's pool */
+    gpointer slots[DIRECTTCP_RDMA_SLOTS];
+    struct ibv_mr *mrs[DIRECTTCP_RDMA_SLOTS];
+
+    /* sending: the receiver's slots */
+    guint64 remote_addr[DIRECTTCP_RDMA_SLOTS];
+    guint32 remote_rkey[DIRECTTCP_RDMA_SLOTS];
+
+    /* sending: blocks written, writes completed, and slots we may write to;
+     * receiving: credits sent and completed, blocks received, their
+     * lengths, and blocks delivered */
+    guint64 posted, completed;
+    guint credits;
+    guint64 received, delivered;
+    guint32 lengths[DIRECTTCP_RDMA_SLOTS];
+};
+
+/* Record a failure; the first one is reported */
+static void
+rdma_fail(
+    DirectTCPRdma *rdma,
+    const char *what,
+    const char *msg)
+{
+    if (rdma->failed)
+	return;
+    rdma->failed = TRUE;
+
+    g_debug("directtcp rdma: %s: %s", what, msg);
+    if (!rdma->elt->cancelled)
+	xfer_cancel_with_error(rdma->elt, "DirectTCP over RDMA: %s: %s",
+			       what, msg);
+
+    /* make sure the glue doesn't block on us after a failure */
+    if (rdma->peer >= 0)
+	shutdown(rdma->peer, SHUT_RDWR);
+}
+
+static void
+put32(
+    char *p,
+    guint32 v)
+{
+    v = htonl(v);
+    memcpy(p, &v, 4);
+}
+
+static guint32
+get32(
+    const char *p)
+{
+    guint32 v;
+
+    memcpy(&v, p, 4);
+    return ntohl(v);
+}
+
+/*
+ * Setup
+ */
+
+/* Find the active adapter port with the local address of the connection
+ * among its GIDs, as RoCE ports have; failing that, use the first active
+ * port, which is what an InfiniBand fabric with IPoIB gives */
+static char *
+rdma_find_port(
+    DirectTCPRdma *rdma)
+{
+    sockaddr_union local;
+    socklen_t len = sizeof(local);
+    guint8 want[16];
+    gboolean have_want = FALSE;
+    struct ibv_device **list;
+    int ndev, i;
+
+    memset(want, 0, sizeof(want));
+    if (getsockname(rdma->sock, (struct sockaddr *)&local, &len) == 0) {
+	if (SU_GET_FAMILY(&local) == AF_INET) {
+	    /* an IPv4-mapped IPv6 address */
+	    want[10] = want[11] = 0xff;
+	    memcpy(want + 12, &local.sin.sin_addr, 4);
+	    have_want = TRUE;
+#ifdef WORKING_IPV6
+	} else if (SU_GET_FAMILY(&local) == AF_INET6) {
+	    memcpy(want, &local.sin6.sin6_addr, 16);
+	    have_want = TRUE;
+#endif
+	}
+    }
+
+    list = ibv_get_device_list(&ndev);
+    if (!list || ndev == 0) {
+	if (list)
+	    ibv_free_device_list(list);
+	return g_strdup("no RDMA adapter");
+    }
+
+    for (i = 0; i < ndev; i++) {
+	struct ibv_context *ctx = ibv_open_device(list[i]);
+	struct ibv_device_attr dev_attr;
+	gboolean keep = FALSE;
+	int port;
+
+	if (!ctx)
+	    continue;
+	if (ibv_query_device(ctx, &dev_attr) != 0) {
+	    ibv_close_device(ctx);
+	    continue;
+	}
+
+	for (port = 1; port <= dev_attr.phys_port_cnt; port++) {
+	    struct ibv_port_attr port_attr;
+	    int g;
+
+	    if (ibv_query_port(ctx, port, &port_attr) != 0 ||
+		port_attr.state != IBV_PORT_ACTIVE)
+		continue;
+
+	    for (g = 0; have_want && g < port_attr.gid_tbl_len; g++) {
+		union ibv_gid gid;
+
+		if (ibv_query_gid(ctx, port, g, &gid) == 0 &&
+		    memcmp(gid.raw, want, 16) == 0)
+		    break;
+	    }
+
+	    if (have_want && g < port_attr.gid_tbl_len) {
+		/* the port of the connection; drop any fallback */
+		if (rdma->ctx && rdma->ctx != ctx)
+		    ibv_close_device(rdma->ctx);
+		rdma->ctx = ctx;
+		rdma->port = port;
+		rdma->gid_index = g;
+		rdma->port_attr = port_attr;
+		ibv_free_device_list(list);
+		return NULL;
+	    }
+
+	    if (!rdma->ctx) {
+		rdma->ctx = ctx;
+		rdma->port = port;
+		rdma->gid_index = 0;
+		rdma->port_attr = port_attr;
+		keep = TRUE;
+	    }
+	}
+
+	if (!keep)
+	    ibv_close_device(ctx);
+    }
+    ibv_free_device_list(list);
+
+    if (!rdma->ctx)
+	return g_strdup("no active RDMA adapter port");
+    g_debug("directtcp rdma: no port has the address of the connection; "
+	    "using port %d of %s", rdma->port,
+	    ibv_get_device_name(rdma->ctx->device));
+    return NULL;
+}
+
+static gboolean
+post_recv(
+    DirectTCPRdma *rdma,
+    guint64 id)
+{
+    struct ibv_recv_wr wr, *bad;
+
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = id;
+    wr.num_sge = 0;
+    return ibv_post_recv(rdma->qp, &wr, &bad) == 0;
+}
+
+/* Open the adapter, create the queue pair and register our slots */
+static char *
+rdma_open(
+    DirectTCPRdma *rdma)
+{
+    struct ibv_qp_init_attr init_attr;
+    struct ibv_qp_attr attr;
+    int access = IBV_ACCESS_LOCAL_WRITE;
+    char *errmsg;
+    int i;
+
+    if ((errmsg = rdma_find_port(rdma)))
+	return errmsg;
+
+    if (!(rdma->pd = ibv_alloc_pd(rdma->ctx)))
+	return g_strdup_printf("ibv_alloc_pd: %s", strerror(errno));
+    if (!(rdma->channel = ibv_create_comp_channel(rdma->ctx)))
+	return g_strdup_printf("ibv_create_comp_channel: %s", strerror(errno));
+    fcntl(rdma->channel->fd, F_SETFL,
+	  fcntl(rdma->channel->fd, F_GETFL) | O_NONBLOCK);
+    if (!(rdma->cq = ibv_create_cq(rdma->ctx, 4 * DIRECTTCP_RDMA_SLOTS + 4,
+				   NULL, rdma->channel, 0)))
+	return g_strdup_printf("ibv_create_cq: %s", strerror(errno));
+
+    memset(&init_attr, 0, sizeof(init_attr));
+    init_attr.send_cq = rdma->cq;
+    init_attr.recv_cq = rdma->cq;
+    init_attr.qp_type = IBV_QPT_RC;
+    init_attr.cap.max_send_wr = DIRECTTCP_RDMA_SLOTS + 1;
+    init_attr.cap.max_recv_wr = DIRECTTCP_RDMA_SLOTS + 1;
+    init_attr.cap.max_send_sge = 1;
+    init_attr.cap.max_recv_sge = 1;
+    if (!(rdma->qp = ibv_create_qp(rdma->pd, &init_attr)))
+	return g_strdup_printf("ibv_create_qp: %s", strerror(errno));
+
+    memset(&attr, 0, sizeof(attr));
+    attr.qp_state = IBV_QPS_INIT;
+    attr.pkey_index = 0;
+    attr.port_num = rdma->port;
+    attr.qp_access_flags = rdma->sending? 0 : IBV_ACCESS_REMOTE_WRITE;
+    if (ibv_modify_qp(rdma->qp, &attr, IBV_QP_STATE | IBV_QP_PKEY_INDEX |
+		      IBV_QP_PORT | IBV_QP_ACCESS_FLAGS) != 0)
+	return g_strdup_printf("ibv_modify_qp(INIT): %s", strerror(errno));
+
+    if (!rdma->sending)
+	access |= IBV_ACCESS_REMOTE_WRITE;
+    for (i = 0; i < DIRECTTCP_RDMA_SLOTS; i++) {
+	rdma->slots[i] = xfer_get_buffer(rdma->elt->xfer,
+					 DIRECTTCP_RDMA_SLOT_SIZE);
+	rdma->mrs[i] = ibv_reg_mr(rdma->pd, rdma->slots[i],
+				  DIRECTTCP_RDMA_SLOT_SIZE, access);
+	if (!rdma->mrs[i])
+	    return g_strdup_printf("ibv_reg_mr: %s", strerror(errno));
+    }
+
+    /* the receives for the blocks or the credits, posted before the peer
+     * can send any */
+    for (i = 0; i < DIRECTTCP_RDMA_SLOTS; i++) {
+	if (!post_recv(rdma, rdma->sending? WR_CREDIT : WR_DATA))
+	    return g_strdup_printf("ibv_post_recv: %s", strerror(errno));
+    }
+
+    return NULL;
+}
+
+/* Send our hello, and our slots if we receive; a NULL HELLO says that we
+ * can't use RDMA */
+static gboolean
+send_hello(
+    DirectTCPRdma *rdma,
+    rdma_hello_t *hello)
+{
+    char buf[RDMA_HELLO_SIZE + DIRECTTCP_RDMA_SLOTS * RDMA_SLOT_ENTRY_SIZE];
+    gsize len = RDMA_HELLO_SIZE;
+    int i;
+
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, RDMA_MAGIC, 8);
+    if (hello) {
+	guint16 lid = htons(hello->lid);
+
+	put32(buf + 8, hello->slots);
+	put32(buf + 12, hello->slot_size);
+	put32(buf + 16, hello->qpn);
+	put32(buf + 20, hello->psn);
+	memcpy(buf + 24, &lid, 2);
+	buf[26] = hello->mtu;
+	memcpy(buf + 28, hello->gid, 16);
+
+	if (!rdma->sending) {
+	    for (i = 0; i < DIRECTTCP_RDMA_SLOTS; i++) {
+		char *p = buf + RDMA_HELLO_SIZE + i * RDMA_SLOT_ENTRY_SIZE;
+		guint64 addr = (guint64)(uintptr_t)rdma->slots[i];
+
+		put32(p, (guint32)(addr >> 32));
+		put32(p + 4, (guint32)addr);
+		put32(p + 8, rdma->mrs[i]->rkey);
+	    }
+	    len += DIRECTTCP_RDMA_SLOTS * RDMA_SLOT_ENTRY_SIZE;
+	}
+    }
+
+    return full_write(rdma->sock, buf, len) == len;
+}
+
+static char *
+recv_hello(
+    DirectTCPRdma *rdma,
+    rdma_hello_t *hello)
+{
+    char buf[RDMA_HELLO_SIZE];
+    int err = 0;
+    int i;
+
+    if (read_fully(rdma->sock, buf, RDMA_HELLO_SIZE, &err) < RDMA_HELLO_SIZE)
+	return g_strdup_printf("reading the peer's hello: %s",
+			       err? strerror(err) : "unexpected EOF");
+    if (memcmp(buf, RDMA_MAGIC, 8) != 0)
+	return g_strdup("bad hello from the peer");
+
+    hello->slots = get32(buf + 8);
+    hello->slot_size = get32(buf + 12);
+    hello->qpn = get32(buf + 16);
+    hello->psn = get32(buf + 20);
+    memcpy(&hello->lid, buf + 24, 2);
+    hello->lid = ntohs(hello->lid);
+    hello->mtu = buf[26];
+    memcpy(hello->gid, buf + 28, 16);
+
+    if (hello->slots == 0)
+	return g_strdup("the peer cannot use RDMA");
+    if (hello->slots != DIRECTTCP_RDMA_SLOTS ||
+	hello->slot_size != DIRECTTCP_RDMA_SLOT_SIZE)
+	return g_strdup_printf("the peer has %u slots of %u bytes",
+			       hello->slots, hello->slot_size);
+
+    if (rdma->sending) {
+	for (i = 0; i < DIRECTTCP_RDMA_SLOTS; i++) {
+	    char entry[RDMA_SLOT_ENTRY_SIZE];
+
+	    if (read_fully(rdma->sock, entry, sizeof(entry), &err) < sizeof(entry))
+		return g_strdup_printf("reading the peer's slots: %s",
+				       err? strerror(err) : "unexpected EOF");
+	    rdma->remote_addr[i] = ((guint64)get32(entry) << 32) | get32(entry + 4);
+	    rdma->remote_rkey[i] = get32(entry + 8);
+	}
+    }
+
+    return NULL;
+}
+
+/* Connect the queue pair to the peer's */
+static char *
+rdma_connect(
+    DirectTCPRdma *rdma,
+    rdma_hello_t *mine,
+    rdma_hello_t *theirs)
+{
+    struct ibv_qp_attr attr;
+    static const guint8 zero_gid[16];
+    char c = 0;
+    int err = 0;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.qp_state = IBV_QPS_RTR;
+    attr.path_mtu = MIN(mine->mtu, theirs->mtu);
+    attr.dest_qp_num = theirs->qpn;
+    attr.rq_psn = theirs->psn;
+    attr.max_dest_rd_atomic = 1;
+    attr.min_rnr_timer = 12;
+    attr.ah_attr.dlid = theirs->lid;
+    attr.ah_attr.sl = 0;
+    attr.ah_attr.port_num = rdma->port;
+    /* RoCE always routes by GID; InfiniBand only across subnets */
+    if (theirs->lid == 0 || memcmp(theirs->gid, zero_gid, 16) != 0) {
+	attr.ah_attr.is_global = 1;
+	memcpy(attr.ah_attr.grh.dgid.raw, theirs->gid, 16);
+	attr.ah_attr.grh.sgid_index = rdma->gid_index;
+	attr.ah_attr.grh.hop_limit = 64;
+    }
+    if (ibv_modify_qp(rdma->qp, &attr, IBV_QP_STATE | IBV_QP_AV |
+		      IBV_QP_PATH_MTU | IBV_QP_DEST_QPN | IBV_QP_RQ_PSN |
+		      IBV_QP_MAX_DEST_RD_ATOMIC | IBV_QP_MIN_RNR_TIMER) != 0)
+	return g_strdup_printf("ibv_modify_qp(RTR): %s", strerror(errno));
+
+    memset(&attr, 0, sizeof(attr));
+    attr.qp_state = IBV_QPS_RTS;
+    attr.timeout = 14;
+    attr.retry_cnt = 7;
+    attr.rnr_retry = 7;
+    attr.sq_psn = mine->psn;
+    attr.max_rd_atomic = 1;
+    if (ibv_modify_qp(rdma->qp, &attr, IBV_QP_STATE | IBV_QP_TIMEOUT |
+		      IBV_QP_RETRY_CNT | IBV_QP_RNR_RETRY | IBV_QP_SQ_PSN |
+		      IBV_QP_MAX_QP_RD_ATOMIC) != 0)
+	return g_strdup_printf("ibv_modify_qp(RTS): %s", strerror(errno));
+
+    /* nothing may be written before the peer's queue pair is ready for it */
+    if (full_write(rdma->sock, &c, 1) < 1 ||
+	read_fully(rdma->sock, &c, 1, &err) < 1)
+	return g_strdup_printf("waiting for the peer: %s",
+			       err? strerror(err) : "unexpected EOF");
+
+    return NULL;
+}
+
+/*
+ * The stream
+ */
+
+/* Wait for completions and account for them; FALSE if the stream failed */
+static gboolean
+rdma_wait(
+    DirectTCPRdma *rdma)
+{
+    struct ibv_wc wc[16];
+    gboolean armed = FALSE;
+    int n, i;
+
+    for (;;) {
+	struct pollfd fds[3];
+	int nfds = 2;
+
+	n = ibv_poll_cq(rdma->cq, 16, wc);
+	if (n < 0) {
+	    rdma_fail(rdma, "polling the completion queue", strerror(errno));
+	    return FALSE;
+	}
+	if (n > 0)
+	    break;
+
+	/* arm the queue, then look again for what came in meanwhile */
+	if (!armed) {
+	    if (ibv_req_notify_cq(rdma->cq, 0) != 0) {
+		rdma_fail(rdma, "ibv_req_notify_cq", strerror(errno));
+		return FALSE;
+	    }
+	    armed = TRUE;
+	    continue;
+	}
+
+	/* a peer that went away closes the connection, and a receiving glue
+	 * that stopped closes its fd */
+	fds[0].fd = rdma->channel->fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = rdma->sock;
+	fds[1].events = POLLIN;
+	if (!rdma->sending) {
+	    fds[2].fd = rdma->peer;
+	    fds[2].events = 0;
+	    nfds = 3;
+	}
+	if (poll(fds, nfds, -1) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    rdma_fail(rdma, "poll", strerror(errno));
+	    return FALSE;
+	}
+	if (fds[0].revents & POLLIN) {
+	    struct ibv_cq *cq;
+	    void *cq_ctx;
+
+	    if (ibv_get_cq_event(rdma->channel, &cq, &cq_ctx) == 0) {
+		ibv_ack_cq_events(cq, 1);
+		armed = FALSE;
+	    }
+	    continue;
+	}
+	if (fds[1].revents) {
+	    /* the last completions may still be on their way */
+	    if ((n = ibv_poll_cq(rdma->cq, 16, wc)) > 0)
+		break;
+	    rdma_fail(rdma, "the peer", "connection closed");
+	    return FALSE;
+	}
+	if (nfds == 3 && fds[2].revents) {
+	    rdma_fail(rdma, "delivering data", strerror(EPIPE));
+	    return FALSE;
+	}
+    }
+
+    for (i = 0; i < n; i++) {
+	if (wc[i].status != IBV_WC_SUCCESS) {
+	    rdma_fail(rdma, "completion", ibv_wc_status_str(wc[i].status));
+	    return FALSE;
+	}
+
+	switch (wc[i].opcode) {
+	case IBV_WC_RDMA_WRITE:
+	    rdma->completed++;
+	    break;
+
+	case IBV_WC_RECV:
+	    /* a credit */
+	    rdma->credits += ntohl(wc[i].imm_data);
+	    if (!post_recv(rdma, WR_CREDIT)) {
+		rdma_fail(rdma, "ibv_post_recv", strerror(errno));
+		return FALSE;
+	    }
+	    break;
+
+	case IBV_WC_RECV_RDMA_WITH_IMM:
+	    rdma->lengths[rdma->received % DIRECTTCP_RDMA_SLOTS] =
+		ntohl(wc[i].imm_data);
+	    rdma->received++;
+	    break;
+
+	case IBV_WC_SEND:
+	    /* a credit we sent */
+	    rdma->completed++;
+	    break;
+
+	default:
+	    break;
+	}
+    }
+
+    return TRUE;
+}
+
+/* read the glue's data into our slots and write it into the receiver's */
+static gpointer
+send_thread(
+    gpointer data)
+{
+    DirectTCPRdma *rdma = data;
+    gsize len;
+
+    do {
+	guint slot = rdma->posted % DIRECTTCP_RDMA_SLOTS;
+	struct ibv_send_wr wr, *bad;
+	struct ibv_sge sge;
+	int err = 0;
+
+	/* a slot of ours that is not being written, and one of theirs */
+	while (!rdma->failed &&
+	       (rdma->posted - rdma->completed >= DIRECTTCP_RDMA_SLOTS ||
+	        rdma->credits == 0))
+	    rdma_wait(rdma);
+	if (rdma->failed)
+	    break;
+
+	len = read_fully(rdma->peer, rdma->slots[slot],
+			 DIRECTTCP_RDMA_SLOT_SIZE, &err);
+	if (err) {
+	    rdma_fail(rdma, "reading the data to send", strerror(err));
+	    break;
+	}
+
+	/* a block of length zero is the end of the stream */
+	memset(&wr, 0, sizeof(wr));
+	sge.addr = (uintptr_t)rdma->slots[slot];
+	sge.length = len;
+	sge.lkey = rdma->mrs[slot]->lkey;
+	wr.wr_id = WR_DATA;
+	wr.sg_list = len? &sge : NULL;
+	wr.num_sge = len? 1 : 0;
+	wr.opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
+	wr.send_flags = IBV_SEND_SIGNALED;
+	wr.imm_data = htonl((guint32)len);
+	wr.wr.rdma.remote_addr = rdma->remote_addr[slot];
+	wr.wr.rdma.rkey = rdma->remote_rkey[slot];
+	if (ibv_post_send(rdma->qp, &wr, &bad) != 0) {
+	    rdma_fail(rdma, "ibv_post_send", strerror(errno));
+	    break;
+	}
+	rdma->posted++;
+	rdma->credits--;
+    } while (len > 0);
+
+    /* the data is with the receiver once every write has completed */
+    while (!rdma->failed && rdma->completed < rdma->posted)
+	rdma_wait(rdma);
+
+    return NULL;
+}
+
+/* write to the glue, without taking a SIGPIPE if it has gone away */
+static gboolean
+peer_write(
+    int fd,
+    const char *buf,
+    gsize len)
+{
+    while (len > 0) {
+	ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return FALSE;
+	}
+	buf += n;
+	len -= n;
+    }
+    return TRUE;
+}
+
+/* hand the blocks written into our slots to the glue, and give the slots
+ * back */
+static gpointer
+recv_thread(
+    gpointer data)
+{
+    DirectTCPRdma *rdma = data;
+
+    for (;;) {
+	guint slot = rdma->delivered % DIRECTTCP_RDMA_SLOTS;
+	struct ibv_send_wr wr, *bad;
+	guint32 len;
+
+	/* a block, and room in the send queue for its credit */
+	while (!rdma->failed && (rdma->delivered == rdma->received ||
+		rdma->posted - rdma->completed >= DIRECTTCP_RDMA_SLOTS))
+	    rdma_wait(rdma);
+	if (rdma->failed)
+	    break;
+
+	len = rdma->lengths[slot];
+	if (len == 0)
+	    break;
+	if (len > DIRECTTCP_RDMA_SLOT_SIZE) {
+	    rdma_fail(rdma, "receiving data", strerror(EPROTO));
+	    break;
+	}
+
+	if (!peer_write(rdma->peer, rdma->slots[slot], len)) {
+	    rdma_fail(rdma, "delivering data", strerror(errno));
+	    break;
+	}
+	rdma->delivered++;
+
+	memset(&wr, 0, sizeof(wr));
+	wr.wr_id = WR_CREDIT;
+	wr.num_sge = 0;
+	wr.opcode = IBV_WR_SEND_WITH_IMM;
+	wr.send_flags = IBV_SEND_SIGNALED;
+	wr.imm_data = htonl(1);
+	if (!post_recv(rdma, WR_DATA) ||
+	    ibv_post_send(rdma->qp, &wr, &bad) != 0) {
+	    rdma_fail(rdma, "returning a slot", strerror(errno));
+	    break;
+	}
+	rdma->posted++;
+    }
+
+    /* EOF for the glue */
+    if (!rdma->failed)
+	shutdown(rdma->peer, SHUT_WR);
+
+    return NULL;
+}
+
+static void
+rdma_free(
+    DirectTCPRdma *rdma)
+{
+    int i;
+
+    if (rdma->qp)
+	ibv_destroy_qp(rdma->qp);
+    for (i = 0; i < DIRECTTCP_RDMA_SLOTS; i++) {
+	if (rdma->mrs[i])
+	    ibv_dereg_mr(rdma->mrs[i]);
+	if (rdma->slots[i])
+	    xfer_release_buffer(rdma->elt->xfer, rdma->slots[i]);
+    }
+    if (rdma->cq)
+	ibv_destroy_cq(rdma->cq);
+    if (rdma->channel)
+	ibv_destroy_comp_channel(rdma->channel);
+    if (rdma->pd)
+	ibv_dealloc_pd(rdma->pd);
+    if (rdma->ctx)
+	ibv_close_device(rdma->ctx);
+    if (rdma->sock >= 0)
+	close(rdma->sock);
+    if (rdma->peer >= 0)
+	close(rdma->peer);
+    g_free(rdma);
+}
+
+DirectTCPRdma *
+directtcp_rdma_new(
+    XferElement *elt,
+    int sock,
+    gboolean sending,
+    int *local_fd)
+{
+    DirectTCPRdma *rdma = g_new0(DirectTCPRdma, 1);
+    rdma_hello_t mine, theirs;
+    char *errmsg;
+    int sv[2];
+
+    rdma->elt = elt;
+    rdma->sending = sending;
+    rdma->sock = sock;
+    rdma->peer = -1;
+    rdma->credits = DIRECTTCP_RDMA_SLOTS;
+
+    /* both ends send their hello before reading the other's; it fits in the
+     * socket buffers */
+    if ((errmsg = rdma_open(rdma))) {
+	send_hello(rdma, NULL);
+	goto failed;
+    }
+
+    memset(&mine, 0, sizeof(mine));
+    mine.slots = DIRECTTCP_RDMA_SLOTS;
+    mine.slot_size = DIRECTTCP_RDMA_SLOT_SIZE;
+    mine.qpn = rdma->qp->qp_num;
+    mine.psn = g_random_int() & 0xffffff;
+    mine.lid = rdma->port_attr.lid;
+    mine.mtu = rdma->port_attr.active_mtu;
+    if (rdma->port_attr.link_layer == IBV_LINK_LAYER_ETHERNET ||
+	rdma->port_attr.lid == 0) {
+	union ibv_gid gid;
+
+	if (ibv_query_gid(rdma->ctx, rdma->port, rdma->gid_index, &gid) == 0)
+	    memcpy(mine.gid, gid.raw, 16);
+    }
+    if (!send_hello(rdma, &mine)) {
+	errmsg = g_strdup_printf("sending the hello: %s", strerror(errno));
+	goto failed;
+    }
+    if ((errmsg = recv_hello(rdma, &theirs)) ||
+	(errmsg = rdma_connect(rdma, &mine, &theirs)))
+	goto failed;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+	errmsg = g_strdup_printf("socketpair(): %s", strerror(errno));
+	goto failed;
+    }
+    rdma->peer = sv[1];
+
+    rdma->thread = g_thread_create(sending? send_thread : recv_thread,
+				   rdma, TRUE, NULL);
+
+    g_debug("directtcp rdma: %s through %s port %d",
+	    sending? "sending" : "receiving",
+	    ibv_get_device_name(rdma->ctx->device), rdma->port);
+
+    *local_fd = sv[0];
+    return rdma;
+
+failed:
+    g_debug("directtcp rdma: %s", errmsg);
+    xfer_cancel_with_error(elt, "DirectTCP over RDMA: %s", errmsg);
+    g_free(errmsg);
+    rdma_free(rdma);
+    return NULL;
+}
+
+gboolean
+directtcp_rdma_finish(
+    DirectTCPRdma *rdma)
+{
+    gboolean ok;
+
+    g_thread_join(rdma->thread);
+    ok = !rdma->failed;
+    rdma_free(rdma);
+
+    return ok;
+}
+
+#else /* HAVE_RDMA */
+
+struct DirectTCPRdma {
+    int unused;
+};
+
+DirectTCPRdma *
+directtcp_rdma_new(
+    XferElement *elt,
+    int sock,
+    gboolean sending G_GNUC_UNUSED,
+    int *local_fd G_GNUC_UNUSED)
+{
+    close(sock);
+    xfer_cancel_with_error(elt,
+	"DirectTCP over RDMA: Amanda was built without RDMA support");
+    return NULL;
+}
+
+gboolean
+directtcp_rdma_finish(
+    DirectTCPRdma *rdma G_GNUC_UNUSED)
+{
+    return FALSE;
+}
+
+#endif /* HAVE_RDMA */
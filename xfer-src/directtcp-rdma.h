@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+/* DirectTCP over RDMA.  When both ends of a DirectTCP stream are Amanda
+ * transfer glue on hosts with InfiniBand or RoCE adapters, the data can be
+ * moved with RDMA writes instead of through TCP.  The DirectTCP connection
+ * is made as usual, and then carries the exchange that sets up a reliable
+ * connected queue pair between the two adapters:
+ *
+ *   "AMDTRDM1"  u32 slots  u32 slot size  u32 qp number  u32 psn
+ *   u16 lid  u8 mtu  u8 pad  gid[16]  u32 pad
+ *
+ * followed, from the receiver, by the address and key of each of its slots:
+ *
+ *   u64 address  u32 rkey  u32 pad
+ *
+ * all in network byte order.  A sender or receiver that cannot use RDMA
+ * sends a hello with no slots, and both ends fail.
+ *
+ * The receiver's slots are a ring of buffers from the transfer's buffer
+ * pool, registered with the adapter.  The sender writes each block of the
+ * stream into the next slot with an RDMA write with immediate data, the
+ * immediate being the length of the block; a block of length zero ends the
+ * stream.  The receiver sees a completion for each block, hands the data to
+ * the glue, and gives the slot back with a send carrying a credit.  The
+ * sender only writes into a slot it holds a credit for, and reuses its own
+ * registered buffer once the completion of the write comes back.
+ *
+ * As for the multi-connection streams, the glue element reads or writes the
+ * stream through one end of a local socketpair.  Both ends have to be told
+ * to use RDMA with xfer_element_set_directtcp_rdma; the TCP connection stays
+ * open until the stream is finished. */
+
+#ifndef DIRECTTCP_RDMA_H
+#define DIRECTTCP_RDMA_H
+
+#include "amxfer.h"
+
+#define DIRECTTCP_RDMA_SLOTS 8
+#define DIRECTTCP_RDMA_SLOT_SIZE (2*1024*1024)
+
+typedef struct DirectTCPRdma DirectTCPRdma;
+
+/* Set up an RDMA stream with the peer at the other end of the connected
+ * DirectTCP socket SOCK, which the transport takes over.  If SENDING, the
+ * data written to the returned local fd is sent; otherwise the data received
+ * can be read from it.  Errors are reported by cancelling ELT's transfer.
+ * The slots come from the buffer pool of ELT's transfer, where they should
+ * have been reserved in setup() with
+ *
+ *   xfer_reserve_buffers(xfer, DIRECTTCP_RDMA_SLOT_SIZE,
+ *			  DIRECTTCP_RDMA_SLOTS, TRUE);
+ *
+ * @param elt: element on whose behalf the data is moved
+ * @param sock: connected data socket
+ * @param sending: direction of the stream
+ * @param local_fd: (output) the fd to write or read the stream
+ * @returns: the new transport, or NULL on error
+ */
+DirectTCPRdma *directtcp_rdma_new(XferElement *elt, int sock,
+				  gboolean sending, int *local_fd);
+
+/* Wait for the transport to finish and free it.  The caller must already
+ * have closed the local fd.  For a sending transport, this returns once the
+ * receiver has acknowledged everything written.
+ *
+ * @returns: FALSE if the stream failed
+ */
+gboolean directtcp_rdma_finish(DirectTCPRdma *rdma);
+
+#endif
@@ -25,6 +25,8 @@
 #include "amxfer.h"
 #include "element-glue.h"
 #include "directtcp.h"
+#include "directtcp-mux.h"
+#include "directtcp-rdma.h"
 #include "amutil.h"
 #include "sockaddr-util.h"
 #include "stream.h"
@@ -74,12 +76,19 @@ typedef struct XferElementGlue_ {
     int input_data_socket, output_data_socket;
     int read_fd, write_fd;
 
+    /* multi-connection DirectTCP streams, whose local ends are the data
+     * sockets above */
+    DirectTCPMux *input_mux, *output_mux;
+
+    /* DirectTCP streams over RDMA, whose local ends are the data sockets */
+    DirectTCPRdma *input_rdma, *output_rdma;
+
     /* a ring buffer of ptr/size pairs with semaphores */
     struct { gpointer buf; size_t size; } *ring;
     amsemaphore_t *ring_used_sem, *ring_free_sem;
     gint ring_head, ring_tail;
 
-    GThread *thread;
+    XferThread *thread;
     GThreadFunc threadfunc;
 } XferElementGlue;
 
@@ -113,12 +122,118 @@ send_xfer_done(
 	    xmsg_new((XferElement *)self, XMSG_DONE, 0));
 }
 
+/* xfer_read_fully, full_write and shm_ring_sem_wait, counting the data moved
+ * and the time spent blocked in the element's statistics.  A read returns as
+ * soon as the transfer is cancelled. */
+static gsize
+glue_read(
+    XferElement *elt,
+    int fd,
+    gpointer buf,
+    gsize count,
+    int *err)
+{
+    gint64 start;
+    gsize len;
+
+    if (!xfer_element_stats_enabled(elt))
+	return xfer_read_fully(elt->xfer, fd, buf, count, err);
+
+    start = xfer_stats_clock();
+    len = xfer_read_fully(elt->xfer, fd, buf, count, err);
+    xfer_element_add_stats(elt, len, 0, xfer_stats_clock() - start, 0);
+    return len;
+}
+
+static gsize
+glue_write(
+    XferElement *elt,
+    int fd,
+    gconstpointer buf,
+    gsize count)
+{
+    gint64 start;
+    gsize len;
+
+    if (!xfer_element_stats_enabled(elt))
+	return full_write(fd, buf, count);
+
+    start = xfer_stats_clock();
+    len = full_write(fd, buf, count);
+    xfer_element_add_stats(elt, 0, len, 0, xfer_stats_clock() - start);
+    return len;
+}
+
+/* Add LEN bytes at BUF to our crc, unless we report upstream's crc instead */
+static inline void
+glue_crc_add(
+    XferElement *elt,
+    gpointer buf,
+    size_t len)
+{
+    if (!elt->reuse_upstream_crc)
+	crc32_add((uint8_t *)buf, len, &elt->crc);
+}
+
+static int
+glue_sem_wait(
+    XferElement *elt,
+    gboolean upstream,
+    sem_t *sem)
+{
+    gint64 start, elapsed;
+    int rv;
+
+    if (!xfer_element_stats_enabled(elt))
+	return shm_ring_sem_wait(elt->shm_ring, sem);
+
+    start = xfer_stats_clock();
+    rv = shm_ring_sem_wait(elt->shm_ring, sem);
+    elapsed = xfer_stats_clock() - start;
+    if (upstream)
+	xfer_element_add_stats(elt, 0, 0, elapsed, 0);
+    else
+	xfer_element_add_stats(elt, 0, 0, 0, elapsed);
+    return rv;
+}
+
+/* Whether the DirectTCP stream on our input or output goes over RDMA, as set
+ * on the neighboring element */
+static gboolean
+glue_directtcp_rdma(
+    XferElementGlue *self,
+    gboolean input)
+{
+    XferElement *elt = XFER_ELEMENT(self);
+    XferElement *peer = input? elt->upstream : elt->downstream;
+
+    return peer && peer->directtcp_rdma;
+}
+
+/* The number of connections to use for the DirectTCP stream on our input
+ * or output, as set on the neighboring element; an RDMA stream needs only
+ * one */
+static int
+glue_directtcp_streams(
+    XferElementGlue *self,
+    gboolean input)
+{
+    XferElement *elt = XFER_ELEMENT(self);
+    XferElement *peer = input? elt->upstream : elt->downstream;
+
+    if (!peer || peer->directtcp_streams < 1 ||
+	glue_directtcp_rdma(self, input))
+	return 1;
+    return peer->directtcp_streams;
+}
+
 static gboolean
 do_directtcp_listen(
     XferElement *elt,
     int *sockp,
     DirectTCPAddr **addrsp)
 {
+    XferElementGlue *self = XFER_ELEMENT_GLUE(elt);
     int sock;
     sockaddr_union data_addr;
     DirectTCPAddr *addrs;
@@ -158,7 +273,8 @@ do_directtcp_listen(
 	return FALSE;
     }
 
-    if (listen(sock, 1) < 0) {
+    if (listen(sock, glue_directtcp_streams(self,
+				sockp == &self->input_listen_socket)) < 0) {
 	xfer_cancel_with_error(elt, "listen(): %s", strerror(errno));
 	freeaddrinfo(res);
 	close(sock);
@@ -186,11 +302,65 @@ prolong_accept(
     return !XFER_ELEMENT(data)->cancelled;
 }
 
+/* Start a multi-connection stream over SOCKS; returns the local fd */
+static int
+start_directtcp_mux(
+    XferElementGlue *self,
+    int *socks,
+    int nsocks,
+    gboolean input)
+{
+    DirectTCPMux *mux;
+    int fd;
+
+    mux = directtcp_mux_new(XFER_ELEMENT(self), socks, nsocks, !input, &fd);
+    if (!mux) {
+	wait_until_xfer_cancelled(XFER_ELEMENT(self)->xfer);
+	return -1;
+    }
+
+    if (input)
+	self->input_mux = mux;
+    else
+	self->output_mux = mux;
+
+    return fd;
+}
+
+/* Start an RDMA stream with the peer on SOCK; returns the local fd */
+static int
+start_directtcp_rdma(
+    XferElementGlue *self,
+    int sock,
+    gboolean input)
+{
+    DirectTCPRdma *rdma;
+    int fd;
+
+    rdma = directtcp_rdma_new(XFER_ELEMENT(self), sock, !input, &fd);
+    if (!rdma) {
+	wait_until_xfer_cancelled(XFER_ELEMENT(self)->xfer);
+	return -1;
+    }
+
+    if (input)
+	self->input_rdma = rdma;
+    else
+	self->output_rdma = rdma;
+
+    return fd;
+}
+
 static int
 do_directtcp_accept(
     XferElementGlue *self,
     int *socketp)
 {
+    XferElement *elt = XFER_ELEMENT(self);
+    gboolean input = (socketp == &self->input_listen_socket);
+    int streams = glue_directtcp_streams(self, input);
+    int socks[DIRECTTCP_MUX_MAX_STREAMS];
+    int nsocks = 0;
     int sock;
     time_t timeout_time;
     time_t dtimeout = (time_t)getconf_int(CNF_DTIMEOUT);
@@ -198,27 +368,58 @@ do_directtcp_accept(
     timeout_time = time(NULL) + dtimeout;
     g_assert(*socketp != -1);
 
-    if ((sock = interruptible_accept(*socketp, NULL, NULL,
-				     prolong_accept, self, timeout_time)) == -1) {
-	close(*socketp);
-	*socketp = -1;
-	/* if the accept was interrupted due to a cancellation, then do not
-	 * add a further error message */
-	if (errno == 0 && XFER_ELEMENT(self)->cancelled)
+    while (nsocks < streams) {
+	char hello[DIRECTTCP_MUX_HELLO_SIZE];
+
+	if ((sock = interruptible_accept(*socketp, NULL, NULL,
+				 prolong_accept, self, timeout_time)) == -1) {
+	    close(*socketp);
+	    *socketp = -1;
+	    while (nsocks > 0)
+		close(socks[--nsocks]);
+	    /* if the accept was interrupted due to a cancellation, then do not
+	     * add a further error message */
+	    if (errno == 0 && elt->cancelled)
+		return -1;
+
+	    xfer_cancel_with_error(elt,
+		_("Error accepting incoming connection: %s"), strerror(errno));
+	    wait_until_xfer_cancelled(elt->xfer);
 	    return -1;
+	}
+	socks[nsocks++] = sock;
 
-	xfer_cancel_with_error(XFER_ELEMENT(self),
-	    _("Error accepting incoming connection: %s"), strerror(errno));
-	wait_until_xfer_cancelled(XFER_ELEMENT(self)->xfer);
-	return -1;
+	if (streams == 1)
+	    break;
+
+	/* every connection of a multi-connection stream says hello first */
+	if (full_read(sock, hello, sizeof(hello)) < sizeof(hello) ||
+	    directtcp_mux_parse_hello(hello) != streams) {
+	    close(*socketp);
+	    *socketp = -1;
+	    while (nsocks > 0)
+		close(socks[--nsocks]);
+	    xfer_cancel_with_error(elt,
+		_("Bad hello on multi-connection DirectTCP stream"));
+	    wait_until_xfer_cancelled(elt->xfer);
+	    return -1;
+	}
     }
 
     /* close the listening socket now, for good measure */
     close(*socketp);
     *socketp = -1;
 
+    if (streams > 1) {
+	g_debug("do_directtcp_accept: %d connections", streams);
+	return start_directtcp_mux(self, socks, nsocks, input);
+    }
+
     g_debug("do_directtcp_accept: %d", sock);
 
+    if (glue_directtcp_rdma(self, input))
+	return start_directtcp_rdma(self, sock, input);
+
     return sock;
 }
 
@@ -228,6 +429,12 @@ do_directtcp_connect(
     DirectTCPAddr *addrs)
 {
     XferElement *elt = XFER_ELEMENT(self);
+    /* we are reading if these are our upstream's addresses */
+    gboolean input = (elt->upstream &&
+		      addrs == elt->upstream->output_listen_addrs);
+    int streams = glue_directtcp_streams(self, input);
+    int socks[DIRECTTCP_MUX_MAX_STREAMS];
+    int nsocks;
     sockaddr_union addr;
     int sock;
 #ifdef WORKING_IPV6
@@ -298,33 +505,60 @@ do_directtcp_connect(
 	str_sockaddr_r(&addr, strsockaddr, sizeof(strsockaddr));
     }
 
-    sock = socket(SU_GET_FAMILY(&addr), SOCK_STREAM, 0);
+    for (nsocks = 0; nsocks < streams; nsocks++) {
+	sock = socket(SU_GET_FAMILY(&addr), SOCK_STREAM, 0);
 
-    g_debug("do_directtcp_connect making data connection to %s", strsockaddr);
+	g_debug("do_directtcp_connect making data connection to %s", strsockaddr);
 
-    if (sock < 0) {
-	xfer_cancel_with_error(elt,
-	    "socket(): %s", strerror(errno));
-	goto cancel_wait;
+	if (sock < 0) {
+	    xfer_cancel_with_error(elt,
+		"socket(): %s", strerror(errno));
+	    goto cancel_wait;
+	}
+	if (connect(sock, (struct sockaddr *)&addr, SS_LEN(&addr)) < 0) {
+	    xfer_cancel_with_error(elt,
+		"connect(): %s", strerror(errno));
+	    close(sock);
+	    goto cancel_wait;
+	}
+	socks[nsocks] = sock;
+
+	if (streams > 1) {
+	    char hello[DIRECTTCP_MUX_HELLO_SIZE];
+
+	    directtcp_mux_hello(hello, nsocks, streams);
+	    if (full_write(sock, hello, sizeof(hello)) < sizeof(hello)) {
+		xfer_cancel_with_error(elt,
+		    "sending DirectTCP hello: %s", strerror(errno));
+		nsocks++;
+		goto cancel_wait;
+	    }
+	}
     }
-    if (connect(sock, (struct sockaddr *)&addr, SS_LEN(&addr)) < 0) {
-	xfer_cancel_with_error(elt,
-	    "connect(): %s", strerror(errno));
-	close(sock);
-	goto cancel_wait;
+
+    if (streams > 1) {
+	g_debug("do_directtcp_connect: %d connections to %s", streams,
+		strsockaddr);
+	return start_directtcp_mux(self, socks, nsocks, input);
     }
 
     g_debug("do_directtcp_connect: connected to %s, fd %d", strsockaddr, sock);
 
+    if (glue_directtcp_rdma(self, input))
+	return start_directtcp_rdma(self, sock, input);
+
     return sock;
 
 cancel_wait:
+    while (nsocks > 0)
+	close(socks[--nsocks]);
     wait_until_xfer_cancelled(elt->xfer);
     return -1;
 }
 
 #define GLUE_BUFFER_SIZE 32768
 #define GLUE_RING_BUFFER_SIZE 32
+#define GLUE_POOL_BUFFERS 4
 
 #define mech_pair(IN,OUT) ((IN)*XFER_MECH_MAX+(OUT))
 
@@ -373,20 +607,44 @@ _get_write_fd(XferElementGlue *self)
     return self->write_fd;
 }
 
+/* closing the local end of a multi-connection or RDMA stream also waits for
+ * it */
 static int
 close_read_fd(XferElementGlue *self)
 {
     int fd = get_read_fd(self);
+    int rv;
+
     self->read_fd = -1;
-    return close(fd);
+    rv = close(fd);
+    if (self->input_mux) {
+	directtcp_mux_finish(self->input_mux);
+	self->input_mux = NULL;
+    }
+    if (self->input_rdma) {
+	directtcp_rdma_finish(self->input_rdma);
+	self->input_rdma = NULL;
+    }
+    return rv;
 }
 
 static int
 close_write_fd(XferElementGlue *self)
 {
     int fd = get_write_fd(self);
+    int rv;
+
     self->write_fd = -1;
-    return close(fd);
+    rv = close(fd);
+    if (self->output_mux) {
+	directtcp_mux_finish(self->output_mux);
+	self->output_mux = NULL;
+    }
+    if (self->output_rdma) {
+	directtcp_rdma_finish(self->output_rdma);
+	self->output_rdma = NULL;
+    }
+    return rv;
 }
 
 /*
@@ -415,7 +673,7 @@ pull_and_write(XferElementGlue *self)
 
 	/* write it */
 	if (!elt->downstream->drain_mode) {
-	    written = full_write(fd, buf, len);
+	    written = glue_write(elt, fd, buf, len);
 	    if (written < len) {
 		if (elt->downstream->must_drain) {
 		    g_debug("Error writing to fd %d: %s", fd, strerror(errno));
@@ -426,20 +684,21 @@ pull_and_write(XferElementGlue *self)
 			    _("Error writing to fd %d: %s"), fd, strerror(errno));
 			wait_until_xfer_cancelled(elt->xfer);
 		    }
-		    amfree(buf);
+		    xfer_element_free_buffer(elt, buf);
 		    break;
 		}
 		elt->downstream->drain_mode = TRUE;
 	    }
         }
-	crc32_add((uint8_t *)buf, len, &elt->crc);
+	glue_crc_add(elt, buf, len);
 
-	amfree(buf);
+	xfer_element_free_buffer(elt, buf);
     }
 
     if (elt->cancelled && elt->expect_eof)
 	xfer_element_drain_buffers(elt->upstream);
 
+    xfer_element_take_upstream_crc(elt);
     g_debug("sending XMSG_CRC message %p", elt->downstream);
     g_debug("pull_and_write CRC: %08x      size %lld",
 	    crc32_finish(&elt->crc), (long long)elt->crc.size);
@@ -483,7 +742,7 @@ pull_static_and_write(XferElementGlue *self)
 
 	/* write it */
 	if (!elt->downstream->drain_mode) {
-	    written = full_write(fd, buf, len);
+	    written = glue_write(elt, fd, buf, len);
 	    if (written < len) {
 		if (elt->downstream->must_drain) {
 		    g_debug("Error writing to fd %d: %s", fd, strerror(errno));
@@ -500,12 +759,13 @@ pull_static_and_write(XferElementGlue *self)
 		elt->downstream->drain_mode = TRUE;
 	    }
         }
-	crc32_add((uint8_t *)buf, len, &elt->crc);
+	glue_crc_add(elt, buf, len);
     }
 
     if (elt->cancelled && elt->expect_eof)
 	xfer_element_drain_buffers(elt->upstream);
 
+    xfer_element_take_upstream_crc(elt);
     g_debug("sending XMSG_CRC message %p", elt->downstream);
     g_debug("pull_static_and_write CRC: %08x      size %lld",
 	    crc32_finish(&elt->crc), (long long)elt->crc.size);
@@ -520,6 +780,182 @@ pull_static_and_write(XferElementGlue *self)
     close_write_fd(self);
 }
 
+#if defined(HAVE_SPLICE) && defined(HAVE_TEE)
+/* splice() can only be used if at least one end of each call is a pipe; we
+ * interpose our own pipe, so both neighbours only need to be pipes or
+ * sockets. */
+static gboolean
+can_splice_fd(int fd)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) < 0)
+	return FALSE;
+    return S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode);
+}
+
+/* Move data from rfd to wfd without copying it through userspace.  The data
+ * is spliced into an intermediate pipe, tee()'d into a second pipe from which
+ * it is read for the crc, and spliced out to wfd.  Blocks that can not be
+ * tee()'d completely, or that must be drained, are read and written normally.
+ *
+ * Returns FALSE if splice is not usable for these fds and nothing was
+ * transferred; the caller must then use the copy loop. Otherwise returns
+ * TRUE, with errors already reported to the xfer. */
+static gboolean
+splice_and_write(
+    XferElementGlue *self,
+    int rfd,
+    int wfd,
+    char *buf)
+{
+    XferElement *elt = XFER_ELEMENT(self);
+    int data_pipe[2];
+    int crc_pipe[2];
+    gboolean first = TRUE;
+
+    if (!can_splice_fd(rfd) || !can_splice_fd(wfd))
+	return FALSE;
+
+    if (pipe(data_pipe) < 0)
+	return FALSE;
+    if (pipe(crc_pipe) < 0) {
+	close(data_pipe[0]);
+	close(data_pipe[1]);
+	return FALSE;
+    }
+
+    g_debug("read_and_write: using splice from %d to %d", rfd, wfd);
+    while (!elt->cancelled) {
+	ssize_t len;
+	ssize_t teed;
+	ssize_t done;
+	gint64 start;
+
+	/* move up to a block from upstream into our pipe */
+	start = xfer_stats_clock();
+	len = splice(rfd, NULL, data_pipe[1], NULL, GLUE_BUFFER_SIZE,
+		     SPLICE_F_MOVE | SPLICE_F_MORE);
+	xfer_element_add_stats(elt, len > 0? len : 0, 0,
+			       xfer_stats_clock() - start, 0);
+	if (len < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if (first && (errno == EINVAL || errno == ENOSYS)) {
+		close(data_pipe[0]);
+		close(data_pipe[1]);
+		close(crc_pipe[0]);
+		close(crc_pipe[1]);
+		g_debug("read_and_write: splice not supported: %s",
+			strerror(errno));
+		return FALSE;
+	    }
+	    if (!elt->cancelled) {
+		xfer_cancel_with_error(elt,
+		    _("Error reading from fd %d: %s"), rfd, strerror(errno));
+		wait_until_xfer_cancelled(elt->xfer);
+	    }
+	    break;
+	} else if (len == 0) {
+	    break;
+	}
+	first = FALSE;
+
+	/* duplicate the pages for the crc; this does not consume data_pipe */
+	teed = -1;
+	if (!elt->downstream->drain_mode) {
+	    if (elt->reuse_upstream_crc)
+		teed = len;	/* no copy needed */
+	    else
+		teed = tee(data_pipe[0], crc_pipe[1], len, 0);
+	}
+
+	if (teed != len) {
+	    /* could not get a complete view of the block; consume any partial
+	     * tee and handle this block through userspace */
+	    if (teed > 0)
+		read_fully(crc_pipe[0], buf, teed, NULL);
+	    if (read_fully(data_pipe[0], buf, len, NULL) < (gsize)len) {
+		if (!elt->cancelled) {
+		    xfer_cancel_with_error(elt,
+			_("Error reading from pipe: %s"), strerror(errno));
+		    wait_until_xfer_cancelled(elt->xfer);
+		}
+		break;
+	    }
+	    if (!elt->downstream->drain_mode &&
+		glue_write(elt, wfd, buf, len) < (gsize)len) {
+		if (elt->downstream->must_drain) {
+		    g_debug("Could not write to fd %d: %s", wfd, strerror(errno));
+		} else if (elt->downstream->ignore_broken_pipe && errno == EPIPE) {
+		} else {
+		    if (!elt->cancelled) {
+			xfer_cancel_with_error(elt,
+			    _("Could not write to fd %d: %s"),
+			    wfd, strerror(errno));
+			wait_until_xfer_cancelled(elt->xfer);
+		    }
+		    break;
+		}
+	    }
+	    glue_crc_add(elt, buf, len);
+	    continue;
+	}
+
+	/* move the block downstream */
+	done = 0;
+	start = xfer_stats_clock();
+	while (done < len) {
+	    ssize_t n = splice(data_pipe[0], NULL, wfd, NULL, len - done,
+			       SPLICE_F_MOVE | SPLICE_F_MORE);
+	    if (n < 0 && errno == EINTR)
+		continue;
+	    if (n <= 0)
+		break;
+	    done += n;
+	}
+	xfer_element_add_stats(elt, 0, done, 0, xfer_stats_clock() - start);
+	if (done < len) {
+	    if (elt->downstream->must_drain) {
+		g_debug("Could not write to fd %d: %s", wfd, strerror(errno));
+	    } else if (elt->downstream->ignore_broken_pipe && errno == EPIPE) {
+	    } else {
+		if (!elt->cancelled) {
+		    xfer_cancel_with_error(elt,
+			_("Could not write to fd %d: %s"),
+			wfd, strerror(errno));
+		    wait_until_xfer_cancelled(elt->xfer);
+		}
+		break;
+	    }
+	    /* discard the rest of the block */
+	    read_fully(data_pipe[0], buf, len - done, NULL);
+	    elt->downstream->drain_mode = TRUE;
+	}
+
+	/* and read the tee'd copy for the crc */
+	if (elt->reuse_upstream_crc)
+	    continue;
+	if (read_fully(crc_pipe[0], buf, len, NULL) < (gsize)len) {
+	    if (!elt->cancelled) {
+		xfer_cancel_with_error(elt,
+		    _("Error reading from pipe: %s"), strerror(errno));
+		wait_until_xfer_cancelled(elt->xfer);
+	    }
+	    break;
+	}
+	glue_crc_add(elt, buf, len);
+    }
+
+    close(data_pipe[0]);
+    close(data_pipe[1]);
+    close(crc_pipe[0]);
+    close(crc_pipe[1]);
+
+    return TRUE;
+}
+#endif
+
 static void
 read_and_write(XferElementGlue *self)
 {
@@ -533,11 +969,15 @@ read_and_write(XferElementGlue *self)
     crc32_init(&elt->crc);
 
     g_debug("read_and_write: read from %d, write to %d", rfd, wfd);
+#if defined(HAVE_SPLICE) && defined(HAVE_TEE)
+    if (splice_and_write(self, rfd, wfd, buf))
+	goto done;
+#endif
     while (!elt->cancelled) {
 	size_t len;
 
 	/* read from upstream */
-	len = read_fully(rfd, buf, GLUE_BUFFER_SIZE, NULL);
+	len = glue_read(elt, rfd, buf, GLUE_BUFFER_SIZE, NULL);
 	if (len < GLUE_BUFFER_SIZE) {
 	    if (errno) {
 		if (!elt->cancelled) {
@@ -552,7 +992,7 @@ read_and_write(XferElementGlue *self)
 	}
 
 	/* write the buffer fully */
-	if (!elt->downstream->drain_mode && full_write(wfd, buf, len) < len) {
+	if (!elt->downstream->drain_mode && glue_write(elt, wfd, buf, len) < len) {
 	    if (elt->downstream->must_drain) {
 		g_debug("Could not write to fd %d: %s",  wfd, strerror(errno));
 	    } else if (elt->downstream->ignore_broken_pipe && errno == EPIPE) {
@@ -566,9 +1006,12 @@ read_and_write(XferElementGlue *self)
 		break;
 	    }
 	}
-	crc32_add((uint8_t *)buf, len, &elt->crc);
+	glue_crc_add(elt, buf, len);
     }
 
+#if defined(HAVE_SPLICE) && defined(HAVE_TEE)
+done:
+#endif
     if (elt->cancelled && elt->expect_eof)
 	xfer_element_drain_fd(rfd);
 
@@ -579,14 +1022,18 @@ read_and_write(XferElementGlue *self)
     /* close the fd we've been writing, as an EOF signal to downstream */
     close_write_fd(self);
 
-    g_debug("read_and_write upstream CRC: %08x      size %lld",
-	    crc32_finish(&elt->crc), (long long)elt->crc.size);
-    g_debug("sending XMSG_CRC message");
-    msg = xmsg_new(elt->upstream, XMSG_CRC, 0);
-    msg->crc = crc32_finish(&elt->crc);
-    msg->size = elt->crc.size;
-    xfer_queue_message(elt->xfer, msg);
+    /* upstream reports its own crc if we reuse it */
+    if (!elt->reuse_upstream_crc) {
+	g_debug("read_and_write upstream CRC: %08x      size %lld",
+		crc32_finish(&elt->crc), (long long)elt->crc.size);
+	g_debug("sending XMSG_CRC message");
+	msg = xmsg_new(elt->upstream, XMSG_CRC, 0);
+	msg->crc = crc32_finish(&elt->crc);
+	msg->size = elt->crc.size;
+	xfer_queue_message(elt->xfer, msg);
+    }
 
+    xfer_element_take_upstream_crc(elt);
     g_debug("read_and_write downstream CRC: %08x      size %lld",
 	    crc32_finish(&elt->crc), (long long)elt->crc.size);
     g_debug("sending XMSG_CRC message");
@@ -609,12 +1056,12 @@ read_and_push(
     crc32_init(&elt->crc);
 
     while (!elt->cancelled) {
-	char *buf = g_malloc(GLUE_BUFFER_SIZE);
+	char *buf = xfer_element_alloc_buffer(elt, GLUE_BUFFER_SIZE);
 	gsize len;
 	int read_error;
 
 	/* read a buffer from upstream */
-	len = read_fully(fd, buf, GLUE_BUFFER_SIZE, &read_error);
+	len = glue_read(elt, fd, buf, GLUE_BUFFER_SIZE, &read_error);
 	if (len < GLUE_BUFFER_SIZE) {
 	    if (read_error) {
 		if (!elt->cancelled) {
@@ -624,14 +1071,14 @@ read_and_push(
                          fd, strerror(read_error));
 		    wait_until_xfer_cancelled(elt->xfer);
 		}
-                amfree(buf);
+                xfer_element_free_buffer(elt, buf);
 		break;
 	    } else if (len == 0) { /* we only count a zero-length read as EOF */
-		amfree(buf);
+		xfer_element_free_buffer(elt, buf);
 		break;
 	    }
 	}
-	crc32_add((uint8_t *)buf, len, &elt->crc);
+	glue_crc_add(elt, buf, len);
 
 	xfer_element_push_buffer(elt->downstream, buf, len);
     }
@@ -645,13 +1092,16 @@ read_and_push(
     /* close the read fd, since it's at EOF */
     close_read_fd(self);
 
-    g_debug("sending XMSG_CRC message");
-    g_debug("read_and_push CRC: %08x      size %lld",
-	    crc32_finish(&elt->crc), (long long)elt->crc.size);
-    msg = xmsg_new(elt->upstream, XMSG_CRC, 0);
-    msg->crc = crc32_finish(&elt->crc);
-    msg->size = elt->crc.size;
-    xfer_queue_message(elt->xfer, msg);
+    /* upstream reports its own crc if we reuse it */
+    if (!elt->reuse_upstream_crc) {
+	g_debug("sending XMSG_CRC message");
+	g_debug("read_and_push CRC: %08x      size %lld",
+		crc32_finish(&elt->crc), (long long)elt->crc.size);
+	msg = xmsg_new(elt->upstream, XMSG_CRC, 0);
+	msg->crc = crc32_finish(&elt->crc);
+	msg->size = elt->crc.size;
+	xfer_queue_message(elt->xfer, msg);
+    }
 }
 
 static void
@@ -671,7 +1121,7 @@ read_and_push_static(
 	int read_error;
 
 	/* read a buffer from upstream */
-	len = read_fully(fd, buf, GLUE_BUFFER_SIZE, &read_error);
+	len = glue_read(elt, fd, buf, GLUE_BUFFER_SIZE, &read_error);
 	if (len < GLUE_BUFFER_SIZE) {
 	    if (read_error) {
 		if (!elt->cancelled) {
@@ -686,7 +1136,7 @@ read_and_push_static(
 		break;
 	    }
 	}
-	crc32_add((uint8_t *)buf, len, &elt->crc);
+	glue_crc_add(elt, buf, len);
 
 	xfer_element_push_buffer_static(elt->downstream, buf, len);
     }
@@ -701,13 +1151,16 @@ read_and_push_static(
     /* close the read fd, since it's at EOF */
     close_read_fd(self);
 
-    g_debug("sending XMSG_CRC message");
-    g_debug("read_and_push_static CRC: %08x      size %lld",
-	    crc32_finish(&elt->crc), (long long)elt->crc.size);
-    msg = xmsg_new(elt->upstream, XMSG_CRC, 0);
-    msg->crc = crc32_finish(&elt->crc);
-    msg->size = elt->crc.size;
-    xfer_queue_message(elt->xfer, msg);
+    /* upstream reports its own crc if we reuse it */
+    if (!elt->reuse_upstream_crc) {
+	g_debug("sending XMSG_CRC message");
+	g_debug("read_and_push_static CRC: %08x      size %lld",
+		crc32_finish(&elt->crc), (long long)elt->crc.size);
+	msg = xmsg_new(elt->upstream, XMSG_CRC, 0);
+	msg->crc = crc32_finish(&elt->crc);
+	msg->size = elt->crc.size;
+	xfer_queue_message(elt->xfer, msg);
+    }
 }
 
 static void
@@ -717,58 +1170,42 @@ read_to_mem_ring(
     XferElement *elt = XFER_ELEMENT(self);
     int fd = get_read_fd(self);
     XMsg *msg;
-    uint64_t read_offset;
     uint64_t write_offset;
     uint64_t producer_block_size;
-    uint64_t consumer_block_size;
     uint64_t mem_ring_size;
 
     g_debug("read_to_mem_ring");
+    /* the downstream element is the only reader */
+    mem_ring_producer_set_spsc(self->mem_ring);
     mem_ring_producer_set_size(self->mem_ring, GLUE_BUFFER_SIZE*4, GLUE_BUFFER_SIZE);
     mem_ring_size = self->mem_ring->ring_size;
     producer_block_size = self->mem_ring->producer_block_size;
-    consumer_block_size = self->mem_ring->consumer_block_size;
     crc32_init(&elt->crc);
 
     while (!elt->cancelled) {
 	gsize len;
 	gsize len2;
 	int read_error;
-
-	g_mutex_lock(self->mem_ring->mutex);
+	gint64 start;
+	uint64_t space;
+
+	/* wait for room for a whole block; this is time spent waiting for
+	 * the consumer */
+	start = xfer_stats_clock();
+	space = mem_ring_wait_for_space(self->mem_ring, producer_block_size);
+	xfer_element_add_stats(elt, 0, 0, 0, xfer_stats_clock() - start);
+	if (elt->cancelled || space < producer_block_size) /* consumer gave up */
+	    goto return_eof;
+
+	/* only the producer changes write_offset */
 	write_offset = self->mem_ring->write_offset;
-        read_offset = self->mem_ring->read_offset;
-	while (!(write_offset == read_offset) &&
-	       !((write_offset < read_offset) &&
-		 (read_offset - write_offset > producer_block_size)) &&
-	       !((write_offset > read_offset) &&
-		 (mem_ring_size - write_offset + read_offset > producer_block_size))) {
-	    if (elt->cancelled) {
-		g_mutex_unlock(self->mem_ring->mutex);
-		goto return_eof;
-	    }
-	    g_cond_wait(self->mem_ring->free_cond, self->mem_ring->mutex);
-	    write_offset = self->mem_ring->write_offset;
-	    read_offset = self->mem_ring->read_offset;
-	}
-	g_mutex_unlock(self->mem_ring->mutex);
 
 	/* read a buffer from upstream */
-	if (write_offset + self->mem_ring->producer_block_size <= mem_ring_size) {
-	    len = read_fully(fd, self->mem_ring->buffer+write_offset, producer_block_size, &read_error);
+	if (write_offset + producer_block_size <= mem_ring_size) {
+	    len = glue_read(elt, fd, self->mem_ring->buffer+write_offset, producer_block_size, &read_error);
 	    if (len > 0) {
-		crc32_add((uint8_t *)self->mem_ring->buffer+write_offset, len, &elt->crc);
-		write_offset += len;
-		write_offset %= mem_ring_size;
-		g_mutex_lock(self->mem_ring->mutex);
-		self->mem_ring->data_avail += len;
-		self->mem_ring->written += len;
-		self->mem_ring->write_offset = write_offset;
-		if (self->mem_ring->data_avail >= consumer_block_size) {
-		    g_cond_broadcast(self->mem_ring->add_cond);
-		    self->mem_ring->data_avail -= consumer_block_size;
-		}
-		g_mutex_unlock(self->mem_ring->mutex);
+		glue_crc_add(elt, self->mem_ring->buffer+write_offset, len);
+		mem_ring_produced(self->mem_ring, len);
 	    }
 	    if (len < producer_block_size) {
 		if (read_error) {
@@ -785,29 +1222,20 @@ read_to_mem_ring(
 		}
 	    }
 	} else {
-	    len = read_fully(fd, self->mem_ring->buffer+write_offset, mem_ring_size - write_offset, &read_error);
+	    len = glue_read(elt, fd, self->mem_ring->buffer+write_offset, mem_ring_size - write_offset, &read_error);
 	    if (len > 0) {
-		crc32_add((uint8_t *)self->mem_ring->buffer+write_offset, len, &elt->crc);
+		glue_crc_add(elt, self->mem_ring->buffer+write_offset, len);
 	    }
 	    len2 = 0;
 	    if (len == mem_ring_size - write_offset) {
-		len2 = read_fully(fd, self->mem_ring->buffer, producer_block_size - (mem_ring_size - write_offset), &read_error);
+		len2 = glue_read(elt, fd, self->mem_ring->buffer, producer_block_size - (mem_ring_size - write_offset), &read_error);
 		if (len2 > 0) {
-		    crc32_add((uint8_t *)self->mem_ring->buffer, len2, &elt->crc);
+		    glue_crc_add(elt, self->mem_ring->buffer, len2);
 		    len += len2;
 		}
 	    }
 	    if (len > 0) {
-		write_offset += len;
-		write_offset %= mem_ring_size;
-		g_mutex_lock(self->mem_ring->mutex);
-		self->mem_ring->write_offset = write_offset;
-		self->mem_ring->data_avail += len;
-		if (self->mem_ring->data_avail >= consumer_block_size) {
-		    g_cond_broadcast(self->mem_ring->add_cond);
-		    self->mem_ring->data_avail -= consumer_block_size;
-		}
-		g_mutex_unlock(self->mem_ring->mutex);
+		mem_ring_produced(self->mem_ring, len);
 	    }
 	    if (len < producer_block_size) {
 		if (read_error) {
@@ -832,20 +1260,22 @@ return_eof:
 
     /* send an EOF indication downstream */
     g_mutex_lock(self->mem_ring->mutex);
-    self->mem_ring->eof_flag = TRUE;
-    g_cond_broadcast(self->mem_ring->add_cond);
+    mem_ring_set_eof(self->mem_ring);
     g_mutex_unlock(self->mem_ring->mutex);
 
     /* close the read fd, since it's at EOF */
     close_read_fd(self);
 
-    g_debug("sending XMSG_CRC message");
-    g_debug("read_to_mem_ring CRC: %08x      size %lld",
-	    crc32_finish(&elt->crc), (long long)elt->crc.size);
-    msg = xmsg_new(elt->upstream, XMSG_CRC, 0);
-    msg->crc = crc32_finish(&elt->crc);
-    msg->size = elt->crc.size;
-    xfer_queue_message(elt->xfer, msg);
+    /* upstream reports its own crc if we reuse it */
+    if (!elt->reuse_upstream_crc) {
+	g_debug("sending XMSG_CRC message");
+	g_debug("read_to_mem_ring CRC: %08x      size %lld",
+		crc32_finish(&elt->crc), (long long)elt->crc.size);
+	msg = xmsg_new(elt->upstream, XMSG_CRC, 0);
+	msg->crc = crc32_finish(&elt->crc);
+	msg->size = elt->crc.size;
+	xfer_queue_message(elt->xfer, msg);
+    }
 }
 
 static void
@@ -879,7 +1309,7 @@ read_to_shm_ring(
 	    readx = elt->shm_ring->mc->readx;
 	    if (shm_ring_size - (written - readx) > elt->shm_ring->block_size)
 		break;
-	    if (shm_ring_sem_wait(elt->shm_ring, elt->shm_ring->sem_write) != 0)
+	    if (glue_sem_wait(elt, FALSE, elt->shm_ring->sem_write) != 0)
 		break;
 	}
 
@@ -910,10 +1340,10 @@ read_to_shm_ring(
 		elt->shm_ring->data_avail -= consumer_block_size;
 	    }
 	    if (n <= (ssize_t)iov[0].iov_len) {
-		crc32_add((uint8_t *)iov[0].iov_base, n, &elt->crc);
+		glue_crc_add(elt, iov[0].iov_base, n);
 	    } else {
-		crc32_add((uint8_t *)iov[0].iov_base, iov[0].iov_len, &elt->crc);
-		crc32_add((uint8_t *)iov[1].iov_base, n - iov[0].iov_len, &elt->crc);
+		glue_crc_add(elt, iov[0].iov_base, iov[0].iov_len);
+		glue_crc_add(elt, iov[1].iov_base, n - iov[0].iov_len);
 	    }
 	} else {
 	    elt->shm_ring->mc->eof_flag = TRUE;
@@ -936,20 +1366,23 @@ read_to_shm_ring(
 	   !elt->shm_ring->mc->cancelled &&
 	   (elt->shm_ring->mc->written != elt->shm_ring->mc->readx ||
 	    !elt->shm_ring->mc->eof_flag)) {
-	if (shm_ring_sem_wait(elt->shm_ring, elt->shm_ring->sem_write) != 0)
+	if (glue_sem_wait(elt, FALSE, elt->shm_ring->sem_write) != 0)
 	    break;
     }
 
     /* close the read fd, since it's at EOF */
     close_read_fd(self);
 
-    g_debug("sending XMSG_CRC message");
-    g_debug("read_to_shm_ring CRC: %08x      size %lld",
-	    crc32_finish(&elt->crc), (long long)elt->crc.size);
-    msg = xmsg_new(elt->upstream, XMSG_CRC, 0);
-    msg->crc = crc32_finish(&elt->crc);
-    msg->size = elt->crc.size;
-    xfer_queue_message(elt->xfer, msg);
+    /* upstream reports its own crc if we reuse it */
+    if (!elt->reuse_upstream_crc) {
+	g_debug("sending XMSG_CRC message");
+	g_debug("read_to_shm_ring CRC: %08x      size %lld",
+		crc32_finish(&elt->crc), (long long)elt->crc.size);
+	msg = xmsg_new(elt->upstream, XMSG_CRC, 0);
+	msg->crc = crc32_finish(&elt->crc);
+	msg->size = elt->crc.size;
+	xfer_queue_message(elt->xfer, msg);
+    }
 
     close_producer_shm_ring(elt->shm_ring);
     elt->shm_ring = NULL;
@@ -987,7 +1420,7 @@ pull_static_to_shm_ring(
 	    readx = elt->shm_ring->mc->readx;
 	    if (shm_ring_size - (written - readx) > elt->shm_ring->block_size)
 		break;
-	    if (shm_ring_sem_wait(elt->shm_ring, elt->shm_ring->sem_write) != 0)
+	    if (glue_sem_wait(elt, FALSE, elt->shm_ring->sem_write) != 0)
 		break;
 	}
 
@@ -1012,7 +1445,7 @@ pull_static_to_shm_ring(
 		sem_post(elt->shm_ring->sem_read);
 		elt->shm_ring->data_avail -= consumer_block_size;
 	    }
-	    crc32_add((uint8_t *)base, len, &elt->crc);
+	    glue_crc_add(elt, base, len);
 	} else {
 	    elt->shm_ring->mc->eof_flag = TRUE;
 	    break;
@@ -1033,17 +1466,20 @@ pull_static_to_shm_ring(
 	   !elt->shm_ring->mc->cancelled &&
 	   (elt->shm_ring->mc->written != elt->shm_ring->mc->readx ||
 	    !elt->shm_ring->mc->eof_flag)) {
-	if (shm_ring_sem_wait(elt->shm_ring, elt->shm_ring->sem_write) != 0)
+	if (glue_sem_wait(elt, FALSE, elt->shm_ring->sem_write) != 0)
 	    break;
     }
 
-    g_debug("sending XMSG_CRC message");
-    g_debug("pull_static_to_shm_ring CRC: %08x      size %lld",
-	    crc32_finish(&elt->crc), (long long)elt->crc.size);
-    msg = xmsg_new(elt->upstream, XMSG_CRC, 0);
-    msg->crc = crc32_finish(&elt->crc);
-    msg->size = elt->crc.size;
-    xfer_queue_message(elt->xfer, msg);
+    /* upstream reports its own crc if we reuse it */
+    if (!elt->reuse_upstream_crc) {
+	g_debug("sending XMSG_CRC message");
+	g_debug("pull_static_to_shm_ring CRC: %08x      size %lld",
+		crc32_finish(&elt->crc), (long long)elt->crc.size);
+	msg = xmsg_new(elt->upstream, XMSG_CRC, 0);
+	msg->crc = crc32_finish(&elt->crc);
+	msg->size = elt->crc.size;
+	xfer_queue_message(elt->xfer, msg);
+    }
 
     return;
 }
@@ -1066,7 +1502,7 @@ shm_ring_and_push_buffer_static(XferElementGlue *self)
 	do {
 	    usable = elt->shm_ring->mc->written - elt->shm_ring->mc->readx;
 	    eof_flag = elt->shm_ring->mc->eof_flag;
-            if (shm_ring_sem_wait(elt->shm_ring, elt->shm_ring->sem_read) != 0)
+            if (glue_sem_wait(elt, TRUE, elt->shm_ring->sem_read) != 0)
                 break;
         } while (!elt->shm_ring->mc->cancelled &&
                  usable < elt->shm_ring->block_size && !eof_flag);
@@ -1767,6 +2203,29 @@ setup_impl(
 	    return FALSE;
     }
 
+    /* we allocate the buffers we push or return when reading them from an
+     * fd or socket */
+    if ((elt->output_mech == XFER_MECH_PUSH_BUFFER ||
+	 elt->output_mech == XFER_MECH_PULL_BUFFER) &&
+	(elt->input_mech == XFER_MECH_READFD ||
+	 elt->input_mech == XFER_MECH_WRITEFD ||
+	 elt->input_mech == XFER_MECH_DIRECTTCP_LISTEN ||
+	 elt->input_mech == XFER_MECH_DIRECTTCP_CONNECT)) {
+	xfer_reserve_buffers(elt->xfer, GLUE_BUFFER_SIZE, GLUE_POOL_BUFFERS,
+			     FALSE);
+    }
+
+    /* the registered slots of an RDMA stream */
+    if (((elt->input_mech == XFER_MECH_DIRECTTCP_LISTEN ||
+	  elt->input_mech == XFER_MECH_DIRECTTCP_CONNECT) &&
+	 glue_directtcp_rdma(self, TRUE)) ||
+	((elt->output_mech == XFER_MECH_DIRECTTCP_LISTEN ||
+	  elt->output_mech == XFER_MECH_DIRECTTCP_CONNECT) &&
+	 glue_directtcp_rdma(self, FALSE))) {
+	xfer_reserve_buffers(elt->xfer, DIRECTTCP_RDMA_SLOT_SIZE,
+			     DIRECTTCP_RDMA_SLOTS, TRUE);
+    }
+
     return TRUE;
 }
 
@@ -1786,7 +2245,7 @@ start_impl(
     XferElementGlue *self = (XferElementGlue *)elt;
 
     if (self->need_thread)
-	self->thread = g_thread_create(worker_thread, (gpointer)self, TRUE, NULL);
+	self->thread = xfer_thread_create(worker_thread, (gpointer)self);
 
     /* we're active if we have a thread that will eventually die */
     return self->need_thread;
@@ -1799,7 +2258,7 @@ pull_buffer_impl(
 {
     XferElementGlue *self = XFER_ELEMENT_GLUE(elt);
 
-    g_debug("pUll_buffer_impl");
+    xfer_debug(9, "pull_buffer_impl");
     /* accept first, if required */
     if (self->on_pull & PULL_ACCEPT_FIRST) {
 	/* don't accept the next time around */
@@ -1885,10 +2344,10 @@ pull_buffer_impl(
 		return NULL;
 	    }
 
-	    buf = g_malloc(GLUE_BUFFER_SIZE);
+	    buf = xfer_element_alloc_buffer(elt, GLUE_BUFFER_SIZE);
 
 	    /* read from upstream */
-	    len = read_fully(fd, buf, GLUE_BUFFER_SIZE, NULL);
+	    len = glue_read(elt, fd, buf, GLUE_BUFFER_SIZE, NULL);
 	    if (len < GLUE_BUFFER_SIZE) {
 		if (errno) {
 		    if (!elt->cancelled) {
@@ -1898,7 +2357,7 @@ pull_buffer_impl(
 		    }
 
 		    /* return an EOF */
-		    amfree(buf);
+		    xfer_element_free_buffer(elt, buf);
 		    len = 0;
 
 		    /* and finish off the upstream */
@@ -1908,7 +2367,7 @@ pull_buffer_impl(
 		    close_read_fd(self);
 		} else if (len == 0) {
 		    /* EOF */
-		    g_free(buf);
+		    xfer_element_free_buffer(elt, buf);
 		    buf = NULL;
 		    *size = 0;
 
@@ -1938,7 +2397,7 @@ pull_buffer_static_impl(
 {
     XferElementGlue *self = XFER_ELEMENT_GLUE(elt);
 
-    g_debug("pUll_buffer_impl");
+    xfer_debug(9, "pull_buffer_impl");
     /* accept first, if required */
     if (self->on_pull & PULL_ACCEPT_FIRST) {
 	/* don't accept the next time around */
@@ -2025,7 +2484,7 @@ g_critical("PULL_FROM_RING_BUFFER unimplemented");
 	    }
 
 	    /* read from upstream */
-	    len = read_fully(fd, buf, block_size, NULL);
+	    len = glue_read(elt, fd, buf, block_size, NULL);
 	    if (len < (ssize_t)block_size) {
 		if (errno) {
 		    if (!elt->cancelled) {
@@ -2074,7 +2533,7 @@ push_buffer_impl(
     XferElementGlue *self = (XferElementGlue *)elt;
     XMsg *msg;
 
-    g_debug("push_buffer_impl");
+    xfer_debug(9, "push_buffer_impl");
     /* accept first, if required */
     if (self->on_push & PUSH_ACCEPT_FIRST) {
 	/* don't accept the next time around */
@@ -2119,7 +2578,7 @@ push_buffer_impl(
 	case PUSH_TO_RING_BUFFER:
 	    /* just drop packets if the transfer has been cancelled */
 	    if (elt->cancelled) {
-		amfree(buf);
+		xfer_element_free_buffer(elt, buf);
 		return;
 	    }
 
@@ -2154,7 +2613,7 @@ push_buffer_impl(
 		    elt->expect_eof = TRUE;
 		}
 
-		amfree(buf);
+		xfer_element_free_buffer(elt, buf);
 
 		return;
 	    }
@@ -2162,7 +2621,7 @@ push_buffer_impl(
 	    /* write the full buffer to the fd, or close on EOF */
 	    if (buf) {
 		if (!elt->downstream->drain_mode &&
-		    full_write(fd, buf, len) < len) {
+		    glue_write(elt, fd, buf, len) < len) {
 		    if (elt->downstream->must_drain) {
 			g_debug("Error writing to fd %d: %s",
 				fd, strerror(errno));
@@ -2179,9 +2638,10 @@ push_buffer_impl(
 		    }
 		    elt->downstream->drain_mode = TRUE;
 		}
-		crc32_add((uint8_t *)buf, len, &elt->crc);
-		amfree(buf);
+		glue_crc_add(elt, buf, len);
+		xfer_element_free_buffer(elt, buf);
 	    } else {
+		xfer_element_take_upstream_crc(elt);
 		g_debug("sending XMSG_CRC message");
 		g_debug("push_to_fd CRC: %08x", crc32_finish(&elt->crc));
 		msg = xmsg_new(elt->downstream, XMSG_CRC, 0);
@@ -2296,7 +2756,7 @@ g_critical("PUSH_TO_RING_BUFFER not implemented");
 	    /* write the full buffer to the fd, or close on EOF */
 	    if (buf) {
 		if (!elt->downstream->drain_mode &&
-		    full_write(fd, buf, len) < len) {
+		    glue_write(elt, fd, buf, len) < len) {
 		    if (elt->downstream->must_drain) {
 			g_debug("Error writing to fd %d: %s",
 				fd, strerror(errno));
@@ -2313,8 +2773,9 @@ g_critical("PUSH_TO_RING_BUFFER not implemented");
 		    }
 		    elt->downstream->drain_mode = TRUE;
 		}
-		crc32_add((uint8_t *)buf, len, &elt->crc);
+		glue_crc_add(elt, buf, len);
 	    } else {
+		xfer_element_take_upstream_crc(elt);
 		g_debug("sending XMSG_CRC message");
 		g_debug("push_to_fd CRC: %08x", crc32_finish(&elt->crc));
 		msg = xmsg_new(elt->downstream, XMSG_CRC, 0);
@@ -2341,6 +2802,9 @@ instance_init(
 {
     XferElement *elt = (XferElement *)self;
     elt->can_generate_eof = TRUE;
+    elt->releases_buffers = TRUE;
+    elt->forwards_buffers = TRUE;
+    elt->passes_data_unchanged = TRUE;
     self->pipe[0] = self->pipe[1] = -1;
     self->input_listen_socket = -1;
     self->output_listen_socket = -1;
@@ -2359,7 +2823,7 @@ finalize_impl(
 
     /* first make sure the worker thread has finished up */
     if (self->thread)
-	g_thread_join(self->thread);
+	xfer_thread_join(self->thread);
 
     /* close our pipes and fd's if they're still open */
     if (self->pipe[0] != -1) close(self->pipe[0]);
@@ -2370,6 +2834,10 @@ finalize_impl(
     if (self->output_listen_socket != -1) close(self->output_listen_socket);
     if (self->read_fd != -1) close(self->read_fd);
     if (self->write_fd != -1) close(self->write_fd);
+    if (self->input_mux) directtcp_mux_finish(self->input_mux);
+    if (self->output_mux) directtcp_mux_finish(self->output_mux);
+    if (self->input_rdma) directtcp_rdma_finish(self->input_rdma);
+    if (self->output_rdma) directtcp_rdma_finish(self->output_rdma);
 
     if (self->ring) {
 	/* empty the ring buffer, ignoring syncronization issues */
@@ -0,0 +1,297 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2008-2012 Zmanda, Inc.  All Rights Reserved.
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+#include "amanda.h"
+#include "amxfer.h"
+#include "amcompress.h"
+
+/*
+ * Class declaration
+ *
+ * This declaration is entirely private; nothing but xfer_filter_compress()
+ * references it directly.
+ */
+
+GType xfer_filter_compress_get_type(void);
+#define XFER_FILTER_COMPRESS_TYPE (xfer_filter_compress_get_type())
+#define XFER_FILTER_COMPRESS(obj) G_TYPE_CHECK_INSTANCE_CAST((obj), xfer_filter_compress_get_type(), XferFilterCompress)
+#define XFER_FILTER_COMPRESS_CONST(obj) G_TYPE_CHECK_INSTANCE_CAST((obj), xfer_filter_compress_get_type(), XferFilterCompress const)
+#define XFER_FILTER_COMPRESS_CLASS(klass) G_TYPE_CHECK_CLASS_CAST((klass), xfer_filter_compress_get_type(), XferFilterCompressClass)
+#define IS_XFER_FILTER_COMPRESS(obj) G_TYPE_CHECK_INSTANCE_TYPE((obj), xfer_filter_compress_get_type ())
+#define XFER_FILTER_COMPRESS_GET_CLASS(obj) G_TYPE_INSTANCE_GET_CLASS((obj), xfer_filter_compress_get_type(), XferFilterCompressClass)
+
+static GObjectClass *parent_class = NULL;
+
+/*
+ * Main object structure
+ */
+
+typedef struct XferFilterCompress {
+    XferElement __parent__;
+
+    amcompress_algo_t algo;
+    int level;
+    int nthreads;
+
+    amcompress_t *comp;
+    gboolean eof;
+} XferFilterCompress;
+
+/*
+ * Class definition
+ */
+
+typedef struct {
+    XferElementClass __parent__;
+} XferFilterCompressClass;
+
+/*
+ * Utilities
+ */
+
+/* compress BUF (or finish the stream if BUF is NULL) and return a newly
+ * allocated buffer holding the output, or NULL if there is no output yet.
+ * Cancels the xfer on error. */
+static char *
+compress_buffer(
+    XferFilterCompress *self,
+    char *buf,
+    size_t len,
+    size_t *out_len)
+{
+    XferElement *elt = XFER_ELEMENT(self);
+    char *out;
+    gsize size;
+
+    if (buf)
+	out = amcompress_update(self->comp, buf, len, &size);
+    else
+	out = amcompress_finish(self->comp, &size);
+
+    if (!out) {
+	xfer_cancel_with_error(elt, _("%s compression failed: %s"),
+			       amcompress_algo_name(self->algo),
+			       amcompress_error(self->comp));
+	*out_len = 0;
+	return NULL;
+    }
+
+    *out_len = size;
+    if (size == 0)
+	return NULL;
+
+    return g_memdup(out, size);
+}
+
+/*
+ * Implementation
+ */
+
+static gboolean
+setup_impl(
+    XferElement *elt)
+{
+    XferFilterCompress *self = (XferFilterCompress *)elt;
+    char *errmsg = NULL;
+
+    self->comp = amcompress_new(self->algo, self->level, self->nthreads,
+				&errmsg);
+    if (!self->comp) {
+	xfer_cancel_with_error(elt, "%s", errmsg);
+	g_free(errmsg);
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gpointer
+pull_buffer_impl(
+    XferElement *elt,
+    size_t *size)
+{
+    XferFilterCompress *self = (XferFilterCompress *)elt;
+
+    while (!elt->cancelled && !self->eof) {
+	char *buf;
+	char *out;
+	size_t len = 0;
+
+	buf = xfer_element_pull_buffer(elt->upstream, &len);
+	if (!buf)
+	    self->eof = TRUE;
+
+	out = compress_buffer(self, buf, len, size);
+	xfer_element_free_buffer(elt, buf);
+	if (out)
+	    return out;
+    }
+
+    if (elt->cancelled) {
+	/* drain our upstream only if we're expecting an EOF */
+	if (elt->expect_eof && !self->eof) {
+	    xfer_element_drain_buffers(elt->upstream);
+	}
+    }
+
+    /* return an EOF */
+    *size = 0;
+    return NULL;
+}
+
+static void
+push_buffer_impl(
+    XferElement *elt,
+    gpointer buf,
+    size_t len)
+{
+    XferFilterCompress *self = (XferFilterCompress *)elt;
+    gboolean eof = (buf == NULL);
+    char *out;
+    size_t out_len;
+
+    /* drop the buffer if we've been cancelled */
+    if (elt->cancelled) {
+	xfer_element_free_buffer(elt, buf);
+	return;
+    }
+
+    /* compress the given buffer, or flush the stream at EOF, and pass any
+     * output downstream */
+    out = compress_buffer(self, buf, len, &out_len);
+    xfer_element_free_buffer(elt, buf);
+    if (out)
+	xfer_element_push_buffer(elt->downstream, out, out_len);
+
+    if (eof)
+	xfer_element_push_buffer(elt->downstream, NULL, 0);
+}
+
+static void
+instance_init(
+    XferElement *elt)
+{
+    XferFilterCompress *self = (XferFilterCompress *)elt;
+
+    elt->can_generate_eof = TRUE;
+    elt->releases_buffers = TRUE;
+    self->comp = NULL;
+    self->eof = FALSE;
+}
+
+static void
+finalize_impl(
+    GObject * obj_self)
+{
+    XferFilterCompress *self = XFER_FILTER_COMPRESS(obj_self);
+
+    if (self->comp) {
+	g_debug("%s compressed %llu bytes to %llu bytes",
+		amcompress_algo_name(self->algo),
+		(unsigned long long)amcompress_bytes_in(self->comp),
+		(unsigned long long)amcompress_bytes_out(self->comp));
+	amcompress_free(self->comp);
+    }
+
+    /* chain up */
+    G_OBJECT_CLASS(parent_class)->finalize(obj_self);
+}
+
+static void
+class_init(
+    XferFilterCompressClass * selfc)
+{
+    XferElementClass *klass = XFER_ELEMENT_CLASS(selfc);
+    GObjectClass *goc = G_OBJECT_CLASS(selfc);
+    static xfer_element_mech_pair_t mech_pairs[] = {
+	{ XFER_MECH_PULL_BUFFER, XFER_MECH_PULL_BUFFER, XFER_NROPS(2), XFER_NTHREADS(0), XFER_NALLOC(1) },
+	{ XFER_MECH_PUSH_BUFFER, XFER_MECH_PUSH_BUFFER, XFER_NROPS(2), XFER_NTHREADS(0), XFER_NALLOC(1) },
+	{ XFER_MECH_NONE, XFER_MECH_NONE, XFER_NROPS(0), XFER_NTHREADS(0), XFER_NALLOC(0) },
+    };
+
+    klass->setup = setup_impl;
+    klass->push_buffer = push_buffer_impl;
+    klass->pull_buffer = pull_buffer_impl;
+
+    klass->perl_class = "Amanda::Xfer::Filter::Compress";
+    klass->mech_pairs = mech_pairs;
+
+    goc->finalize = finalize_impl;
+
+    parent_class = g_type_class_peek_parent(selfc);
+}
+
+GType
+xfer_filter_compress_get_type (void)
+{
+    static GType type = 0;
+
+    if (G_UNLIKELY(type == 0)) {
+        static const GTypeInfo info = {
+            sizeof (XferFilterCompressClass),
+            (GBaseInitFunc) NULL,
+            (GBaseFinalizeFunc) NULL,
+            (GClassInitFunc) class_init,
+            (GClassFinalizeFunc) NULL,
+            NULL /* class_data */,
+            sizeof (XferFilterCompress),
+            0 /* n_preallocs */,
+            (GInstanceInitFunc) instance_init,
+            NULL
+        };
+
+        type = g_type_register_static (XFER_ELEMENT_TYPE, "XferFilterCompress", &info, 0);
+    }
+
+    return type;
+}
+
+/* create an element of this class; prototype is in xfer-element.h */
+XferElement *
+xfer_filter_compress(
+    const char *algo_name,
+    int level,
+    int nthreads)
+{
+    XferFilterCompress *xfc = (XferFilterCompress *)g_object_new(XFER_FILTER_COMPRESS_TYPE, NULL);
+    XferElement *elt = XFER_ELEMENT(xfc);
+
+    if (!amcompress_algo_from_name(algo_name, &xfc->algo)) {
+	g_critical("unknown compression algorithm '%s'", algo_name);
+    }
+    xfc->level = level;
+    xfc->nthreads = nthreads;
+
+    return elt;
+}
+
+gboolean
+xfer_filter_compress_supported(
+    const char *algo_name)
+{
+    amcompress_algo_t algo;
+
+    if (!amcompress_algo_from_name(algo_name, &algo))
+	return FALSE;
+    return amcompress_supported(algo);
+}
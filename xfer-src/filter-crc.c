@@ -123,7 +123,7 @@ pull_buffer_static_impl(
 
     /* get a buffer from upstream, crc it, and hand it back */
     xfer_element_pull_buffer_static(XFER_ELEMENT(self)->upstream, buf, block_size, size);
-    if (size) {
+    if (*size) {
 	crc32_add((uint8_t *)buf, *size, &elt->crc);
     } else {
 	g_debug("sending XMSG_CRC message");
@@ -204,6 +204,9 @@ instance_init(
     XferElement *elt)
 {
     elt->can_generate_eof = TRUE;
+    elt->output_crc_known = TRUE;
+    elt->releases_buffers = TRUE;
+    elt->forwards_buffers = TRUE;
     crc32_init(&elt->crc);
 }
 
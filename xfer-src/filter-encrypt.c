@@ -0,0 +1,524 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2008-2012 Zmanda, Inc.  All Rights Reserved.
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+#include "amanda.h"
+#include "amxfer.h"
+#include "amgcm.h"
+#include "amexec.h"
+
+
+/*
+ * Class declaration
+ *
+ * This declaration is entirely private; nothing but xfer_filter_encrypt()
+ * references it directly.
+ */
+
+GType xfer_filter_encrypt_get_type(void);
+#define XFER_FILTER_ENCRYPT_TYPE (xfer_filter_encrypt_get_type())
+#define XFER_FILTER_ENCRYPT(obj) G_TYPE_CHECK_INSTANCE_CAST((obj), xfer_filter_encrypt_get_type(), XferFilterEncrypt)
+#define XFER_FILTER_ENCRYPT_CONST(obj) G_TYPE_CHECK_INSTANCE_CAST((obj), xfer_filter_encrypt_get_type(), XferFilterEncrypt const)
+#define XFER_FILTER_ENCRYPT_CLASS(klass) G_TYPE_CHECK_CLASS_CAST((klass), xfer_filter_encrypt_get_type(), XferFilterEncryptClass)
+#define IS_XFER_FILTER_ENCRYPT(obj) G_TYPE_CHECK_INSTANCE_TYPE((obj), xfer_filter_encrypt_get_type ())
+#define XFER_FILTER_ENCRYPT_GET_CLASS(obj) G_TYPE_INSTANCE_GET_CLASS((obj), xfer_filter_encrypt_get_type(), XferFilterEncryptClass)
+
+static GObjectClass *parent_class = NULL;
+
+/*
+ * Main object structure
+ */
+
+typedef struct XferFilterEncrypt {
+    XferElement __parent__;
+
+    char *key_file;
+    gboolean decrypt;
+    int nthreads;
+
+    guint8 key[AMGCM_KEY_SIZE];
+    guint8 stream_key[AMGCM_KEY_SIZE];	/* derived once the header is known */
+    guint8 hdr[AMGCM_HEADER_SIZE];
+    gboolean hdr_done;		/* header written (encrypt) or parsed (decrypt) */
+    guint32 record_size;
+    guint64 index;		/* next record number */
+
+    GByteArray *inbuf;		/* input not yet processed */
+    gboolean eof;		/* upstream EOF seen */
+    gboolean done;		/* final record written or read */
+
+    amexec_queue_t *pool;
+    amsemaphore_t *pool_sem;
+} XferFilterEncrypt;
+
+/*
+ * Class definition
+ */
+
+typedef struct {
+    XferElementClass __parent__;
+} XferFilterEncryptClass;
+
+/* One record to seal or open */
+typedef struct record_op_s {
+    XferFilterEncrypt *self;
+    guint64 index;
+    gboolean final;
+    const guint8 *in;		/* plaintext (encrypt) or record (decrypt) */
+    gsize len;			/* plaintext length */
+    guint8 *out;
+    char *errmsg;
+} record_op_t;
+
+/*
+ * Utilities
+ */
+
+static void
+do_record_op(
+    record_op_t *op)
+{
+    XferFilterEncrypt *self = op->self;
+
+    if (self->decrypt)
+	amgcm_open_record(self->stream_key, self->hdr, op->index, op->in,
+			  op->len, op->out, &op->errmsg);
+    else
+	amgcm_seal_record(self->stream_key, self->hdr, op->index, op->final,
+			  op->in, op->len, op->out, &op->errmsg);
+}
+
+static void
+record_op_thread(
+    gpointer data,
+    gpointer user_data)
+{
+    XferFilterEncrypt *self = (XferFilterEncrypt *)user_data;
+
+    do_record_op((record_op_t *)data);
+    amsemaphore_decrement(self->pool_sem, 1);
+}
+
+/* run the given ops, in parallel if we have a thread pool, and return the
+ * first error message, if any */
+static char *
+run_record_ops(
+    XferFilterEncrypt *self,
+    record_op_t *ops,
+    guint nops)
+{
+    char *errmsg = NULL;
+    guint i;
+
+    if (self->pool && nops > 1) {
+	amsemaphore_force_set(self->pool_sem, nops);
+	for (i = 0; i < nops; i++)
+	    amexec_queue_push(self->pool, &ops[i]);
+	amsemaphore_wait_empty(self->pool_sem);
+    } else {
+	for (i = 0; i < nops; i++)
+	    do_record_op(&ops[i]);
+    }
+
+    for (i = 0; i < nops; i++) {
+	if (ops[i].errmsg && !errmsg)
+	    errmsg = ops[i].errmsg;
+	else
+	    g_free(ops[i].errmsg);
+    }
+
+    return errmsg;
+}
+
+/* seal as many records of self->inbuf as are ready; all of them at EOF */
+static char *
+encrypt_records(
+    XferFilterEncrypt *self,
+    gsize *out_len,
+    char **errmsg)
+{
+    gsize rsize = self->record_size;
+    guint batch = MAX(self->nthreads, 1);
+    guint nops, i;
+    gsize avail = self->inbuf->len;
+    gsize hdr_len = self->hdr_done ? 0 : AMGCM_HEADER_SIZE;
+    record_op_t *ops;
+    char *out, *p;
+
+    if (self->eof) {
+	nops = (avail + rsize - 1) / rsize;
+	if (nops == 0)
+	    nops = 1;	/* an empty final record */
+    } else {
+	nops = avail / rsize;
+	if (nops < batch)
+	    return NULL;
+    }
+
+    ops = g_new0(record_op_t, nops);
+    out = p = g_malloc(hdr_len + avail + (gsize)nops * AMGCM_RECORD_OVERHEAD);
+    if (hdr_len) {
+	memcpy(p, self->hdr, AMGCM_HEADER_SIZE);
+	p += AMGCM_HEADER_SIZE;
+    }
+    for (i = 0; i < nops; i++) {
+	ops[i].self = self;
+	ops[i].index = self->index++;
+	ops[i].final = self->eof && i == nops - 1;
+	ops[i].in = self->inbuf->data + (gsize)i * rsize;
+	ops[i].len = MIN(rsize, avail - (gsize)i * rsize);
+	ops[i].out = (guint8 *)p;
+	p += ops[i].len + AMGCM_RECORD_OVERHEAD;
+    }
+
+    *errmsg = run_record_ops(self, ops, nops);
+    g_byte_array_remove_range(self->inbuf, 0,
+			      MIN(avail, (gsize)nops * rsize));
+    self->hdr_done = TRUE;
+    if (self->eof)
+	self->done = TRUE;
+    g_free(ops);
+
+    *out_len = p - out;
+    return out;
+}
+
+/* open all complete records in self->inbuf */
+static char *
+decrypt_records(
+    XferFilterEncrypt *self,
+    gsize *out_len,
+    char **errmsg)
+{
+    GArray *ops;
+    gsize pos = 0, total = 0;
+    char *out = NULL, *p;
+    guint i;
+
+    if (!self->hdr_done) {
+	if (self->inbuf->len < AMGCM_HEADER_SIZE)
+	    goto check_eof;
+	memcpy(self->hdr, self->inbuf->data, AMGCM_HEADER_SIZE);
+	if (!amgcm_parse_header(self->hdr, &self->record_size, errmsg) ||
+	    !amgcm_stream_key(self->key, self->hdr, self->stream_key, errmsg))
+	    return NULL;
+	self->hdr_done = TRUE;
+	pos = AMGCM_HEADER_SIZE;
+    }
+
+    ops = g_array_new(FALSE, TRUE, sizeof(record_op_t));
+    while (!self->done && pos + 4 <= self->inbuf->len) {
+	record_op_t op = { self, 0, FALSE, NULL, 0, NULL, NULL };
+
+	if (!amgcm_record_length(self->inbuf->data + pos, self->record_size,
+				 &op.len, &op.final, errmsg)) {
+	    g_array_free(ops, TRUE);
+	    return NULL;
+	}
+	if (pos + op.len + AMGCM_RECORD_OVERHEAD > self->inbuf->len)
+	    break;
+
+	op.index = self->index++;
+	op.in = self->inbuf->data + pos;
+	g_array_append_val(ops, op);
+	pos += op.len + AMGCM_RECORD_OVERHEAD;
+	total += op.len;
+	if (op.final)
+	    self->done = TRUE;
+    }
+
+    if (ops->len > 0) {
+	record_op_t *opv = (record_op_t *)ops->data;
+
+	out = p = g_malloc(MAX(total, 1));
+	for (i = 0; i < ops->len; i++) {
+	    opv[i].out = (guint8 *)p;
+	    p += opv[i].len;
+	}
+	*errmsg = run_record_ops(self, opv, ops->len);
+	*out_len = total;
+    }
+    g_array_free(ops, TRUE);
+    g_byte_array_remove_range(self->inbuf, 0, pos);
+
+    if (*errmsg) {
+	g_free(out);
+	return NULL;
+    }
+
+    if (self->done && self->inbuf->len > 0) {
+	*errmsg = g_strdup(_("unexpected data after the last AES-GCM record"));
+	g_free(out);
+	return NULL;
+    }
+
+check_eof:
+    if (self->eof && !self->done && !*errmsg) {
+	*errmsg = g_strdup(_("AES-GCM encrypted stream is truncated"));
+	g_free(out);
+	return NULL;
+    }
+
+    return out;
+}
+
+/* add BUF (or EOF, if BUF is NULL) to the input and return a newly allocated
+ * buffer holding whatever output is ready, or NULL if there is none.
+ * Cancels the xfer on error. */
+static char *
+process_buffer(
+    XferFilterEncrypt *self,
+    char *buf,
+    size_t len,
+    size_t *out_len)
+{
+    XferElement *elt = XFER_ELEMENT(self);
+    char *errmsg = NULL;
+    gsize size = 0;
+    char *out;
+
+    *out_len = 0;
+    if (self->done) {
+	if (buf && len > 0 && self->decrypt) {
+	    xfer_cancel_with_error(elt, "%s",
+		_("unexpected data after the last AES-GCM record"));
+	}
+	return NULL;
+    }
+
+    if (buf)
+	g_byte_array_append(self->inbuf, (guint8 *)buf, len);
+    else
+	self->eof = TRUE;
+
+    if (self->decrypt)
+	out = decrypt_records(self, &size, &errmsg);
+    else
+	out = encrypt_records(self, &size, &errmsg);
+
+    if (errmsg) {
+	xfer_cancel_with_error(elt, "%s", errmsg);
+	g_free(errmsg);
+	g_free(out);
+	return NULL;
+    }
+
+    if (out && size == 0) {
+	g_free(out);
+	return NULL;
+    }
+
+    *out_len = size;
+    return out;
+}
+
+/*
+ * Implementation
+ */
+
+static gboolean
+setup_impl(
+    XferElement *elt)
+{
+    XferFilterEncrypt *self = (XferFilterEncrypt *)elt;
+    char *errmsg = NULL;
+
+    if (!amgcm_load_key(self->key_file, self->key, &errmsg) ||
+	(!self->decrypt &&
+	 (!amgcm_make_header(self->hdr, self->record_size, &errmsg) ||
+	  !amgcm_stream_key(self->key, self->hdr, self->stream_key,
+			    &errmsg)))) {
+	xfer_cancel_with_error(elt, "%s", errmsg);
+	g_free(errmsg);
+	return FALSE;
+    }
+
+    if (self->nthreads > 1) {
+	self->pool_sem = amsemaphore_new_with_value(0);
+	self->pool = amexec_queue_new("encrypt", record_op_thread, self,
+				      self->nthreads, AMEXEC_PRIORITY_NORMAL, 0);
+    }
+
+    return TRUE;
+}
+
+static gpointer
+pull_buffer_impl(
+    XferElement *elt,
+    size_t *size)
+{
+    XferFilterEncrypt *self = (XferFilterEncrypt *)elt;
+
+    while (!elt->cancelled && !self->eof) {
+	char *buf;
+	char *out;
+	size_t len = 0;
+
+	buf = xfer_element_pull_buffer(elt->upstream, &len);
+	out = process_buffer(self, buf, len, size);
+	xfer_element_free_buffer(elt, buf);
+	if (out)
+	    return out;
+    }
+
+    if (elt->cancelled) {
+	/* drain our upstream only if we're expecting an EOF */
+	if (elt->expect_eof && !self->eof) {
+	    xfer_element_drain_buffers(elt->upstream);
+	}
+    }
+
+    /* return an EOF */
+    *size = 0;
+    return NULL;
+}
+
+static void
+push_buffer_impl(
+    XferElement *elt,
+    gpointer buf,
+    size_t len)
+{
+    XferFilterEncrypt *self = (XferFilterEncrypt *)elt;
+    gboolean eof = (buf == NULL);
+    char *out;
+    size_t out_len;
+
+    /* drop the buffer if we've been cancelled */
+    if (elt->cancelled) {
+	xfer_element_free_buffer(elt, buf);
+	return;
+    }
+
+    out = process_buffer(self, buf, len, &out_len);
+    xfer_element_free_buffer(elt, buf);
+    if (out)
+	xfer_element_push_buffer(elt->downstream, out, out_len);
+
+    if (eof)
+	xfer_element_push_buffer(elt->downstream, NULL, 0);
+}
+
+static void
+instance_init(
+    XferElement *elt)
+{
+    XferFilterEncrypt *self = (XferFilterEncrypt *)elt;
+
+    elt->can_generate_eof = TRUE;
+    elt->releases_buffers = TRUE;
+    self->record_size = AMGCM_DEFAULT_RECORD_SIZE;
+    self->inbuf = g_byte_array_new();
+    self->pool = NULL;
+    self->pool_sem = NULL;
+}
+
+static void
+finalize_impl(
+    GObject * obj_self)
+{
+    XferFilterEncrypt *self = XFER_FILTER_ENCRYPT(obj_self);
+
+    if (self->pool)
+	amexec_queue_free(self->pool, TRUE);
+    if (self->pool_sem)
+	amsemaphore_free(self->pool_sem);
+    g_byte_array_free(self->inbuf, TRUE);
+    memset(self->key, 0, sizeof(self->key));
+    memset(self->stream_key, 0, sizeof(self->stream_key));
+    g_free(self->key_file);
+
+    /* chain up */
+    G_OBJECT_CLASS(parent_class)->finalize(obj_self);
+}
+
+static void
+class_init(
+    XferFilterEncryptClass * selfc)
+{
+    XferElementClass *klass = XFER_ELEMENT_CLASS(selfc);
+    GObjectClass *goc = G_OBJECT_CLASS(selfc);
+    static xfer_element_mech_pair_t mech_pairs[] = {
+	{ XFER_MECH_PULL_BUFFER, XFER_MECH_PULL_BUFFER, XFER_NROPS(1), XFER_NTHREADS(0), XFER_NALLOC(1) },
+	{ XFER_MECH_PUSH_BUFFER, XFER_MECH_PUSH_BUFFER, XFER_NROPS(1), XFER_NTHREADS(0), XFER_NALLOC(1) },
+	{ XFER_MECH_NONE, XFER_MECH_NONE, XFER_NROPS(0), XFER_NTHREADS(0), XFER_NALLOC(0) },
+    };
+
+    klass->setup = setup_impl;
+    klass->push_buffer = push_buffer_impl;
+    klass->pull_buffer = pull_buffer_impl;
+
+    klass->perl_class = "Amanda::Xfer::Filter::Encrypt";
+    klass->mech_pairs = mech_pairs;
+
+    goc->finalize = finalize_impl;
+
+    parent_class = g_type_class_peek_parent(selfc);
+}
+
+GType
+xfer_filter_encrypt_get_type (void)
+{
+    static GType type = 0;
+
+    if (G_UNLIKELY(type == 0)) {
+        static const GTypeInfo info = {
+            sizeof (XferFilterEncryptClass),
+            (GBaseInitFunc) NULL,
+            (GBaseFinalizeFunc) NULL,
+            (GClassInitFunc) class_init,
+            (GClassFinalizeFunc) NULL,
+            NULL /* class_data */,
+            sizeof (XferFilterEncrypt),
+            0 /* n_preallocs */,
+            (GInstanceInitFunc) instance_init,
+            NULL
+        };
+
+        type = g_type_register_static (XFER_ELEMENT_TYPE, "XferFilterEncrypt", &info, 0);
+    }
+
+    return type;
+}
+
+/* create an element of this class; prototype is in xfer-element.h */
+XferElement *
+xfer_filter_encrypt(
+    const char *key_file,
+    gboolean decrypt,
+    int nthreads)
+{
+    XferFilterEncrypt *xfe = (XferFilterEncrypt *)g_object_new(XFER_FILTER_ENCRYPT_TYPE, NULL);
+    XferElement *elt = XFER_ELEMENT(xfe);
+
+    xfe->key_file = g_strdup(key_file);
+    xfe->decrypt = decrypt;
+    xfe->nthreads = nthreads;
+
+    return elt;
+}
+
+gboolean
+xfer_filter_encrypt_supported(void)
+{
+    return amgcm_supported();
+}
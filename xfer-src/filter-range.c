@@ -0,0 +1,300 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+#include "amanda.h"
+#include "amxfer.h"
+
+/*
+ * Class declaration
+ *
+ * This declaration is entirely private; nothing but xfer_filter_range()
+ * references it directly.
+ */
+
+GType xfer_filter_range_get_type(void);
+#define XFER_FILTER_RANGE_TYPE (xfer_filter_range_get_type())
+#define XFER_FILTER_RANGE(obj) G_TYPE_CHECK_INSTANCE_CAST((obj), xfer_filter_range_get_type(), XferFilterRange)
+#define XFER_FILTER_RANGE_CONST(obj) G_TYPE_CHECK_INSTANCE_CAST((obj), xfer_filter_range_get_type(), XferFilterRange const)
+#define XFER_FILTER_RANGE_CLASS(klass) G_TYPE_CHECK_CLASS_CAST((klass), xfer_filter_range_get_type(), XferFilterRangeClass)
+#define IS_XFER_FILTER_RANGE(obj) G_TYPE_CHECK_INSTANCE_TYPE((obj), xfer_filter_range_get_type ())
+#define XFER_FILTER_RANGE_GET_CLASS(obj) G_TYPE_INSTANCE_GET_CLASS((obj), xfer_filter_range_get_type(), XferFilterRangeClass)
+
+static GObjectClass *parent_class = NULL;
+
+/*
+ * Main object structure
+ */
+
+typedef struct {
+    guint64 start;
+    gint64 length;	/* -1 for up to the end of the data */
+} range_t;
+
+typedef struct XferFilterRange {
+    XferElement __parent__;
+
+    /* the ranges to keep, in increasing order; they are added by
+     * xfer_filter_range_add while the data flows */
+    GMutex *mutex;
+    GQueue *ranges;
+
+    /* position in the data of the next byte from upstream */
+    guint64 pos;
+    gboolean eof;
+} XferFilterRange;
+
+/*
+ * Class definition
+ */
+
+typedef struct {
+    XferElementClass __parent__;
+} XferFilterRangeClass;
+
+/*
+ * Utilities
+ */
+
+/* Return the bytes of BUF that are in a range, or NULL if there are none.
+ * BUF itself is returned when all of it is kept; otherwise it is freed and
+ * the kept bytes are in a new buffer. */
+static char *
+select_bytes(
+    XferFilterRange *self,
+    char *buf,
+    size_t len,
+    size_t *out_len)
+{
+    guint64 pos = self->pos;
+    guint64 buf_end = self->pos + len;
+    range_t *range;
+    char *out = NULL;
+    size_t n = 0;
+
+    g_mutex_lock(self->mutex);
+    while ((range = g_queue_peek_head(self->ranges)) != NULL) {
+	guint64 end = range->length < 0 ? G_MAXUINT64
+					: range->start + range->length;
+	guint64 from, to;
+
+	if (end <= pos) {
+	    g_free(g_queue_pop_head(self->ranges));
+	    continue;
+	}
+	if (range->start >= buf_end)
+	    break;
+
+	from = MAX(range->start, pos);
+	to = MIN(end, buf_end);
+	if (from == self->pos && to == buf_end) {
+	    g_mutex_unlock(self->mutex);
+	    self->pos = buf_end;
+	    *out_len = len;
+	    return buf;
+	}
+
+	if (!out)
+	    out = g_malloc(len);
+	memcpy(out + n, buf + (from - self->pos), to - from);
+	n += to - from;
+	pos = to;
+	if (to == buf_end)
+	    break;
+    }
+    g_mutex_unlock(self->mutex);
+
+    self->pos = buf_end;
+    xfer_element_free_buffer(XFER_ELEMENT(self), buf);
+    *out_len = n;
+    return out;
+}
+
+/*
+ * Implementation
+ */
+
+static gpointer
+pull_buffer_impl(
+    XferElement *elt,
+    size_t *size)
+{
+    XferFilterRange *self = (XferFilterRange *)elt;
+
+    while (!elt->cancelled && !self->eof) {
+	char *buf;
+	char *out;
+	size_t len = 0;
+
+	buf = xfer_element_pull_buffer(elt->upstream, &len);
+	if (!buf) {
+	    self->eof = TRUE;
+	    break;
+	}
+
+	out = select_bytes(self, buf, len, size);
+	if (out)
+	    return out;
+    }
+
+    if (elt->cancelled) {
+	/* drain our upstream only if we're expecting an EOF */
+	if (elt->expect_eof && !self->eof) {
+	    xfer_element_drain_buffers(elt->upstream);
+	}
+    }
+
+    /* return an EOF */
+    *size = 0;
+    return NULL;
+}
+
+static void
+push_buffer_impl(
+    XferElement *elt,
+    gpointer buf,
+    size_t len)
+{
+    XferFilterRange *self = (XferFilterRange *)elt;
+    char *out;
+    size_t out_len;
+
+    /* drop the buffer if we've been cancelled */
+    if (elt->cancelled) {
+	xfer_element_free_buffer(elt, buf);
+	return;
+    }
+
+    if (!buf) {
+	xfer_element_push_buffer(elt->downstream, NULL, 0);
+	return;
+    }
+
+    /* pass the bytes in a range downstream */
+    out = select_bytes(self, buf, len, &out_len);
+    if (out)
+	xfer_element_push_buffer(elt->downstream, out, out_len);
+}
+
+static void
+instance_init(
+    XferElement *elt)
+{
+    XferFilterRange *self = (XferFilterRange *)elt;
+
+    elt->can_generate_eof = TRUE;
+    elt->releases_buffers = TRUE;
+    self->mutex = g_mutex_new();
+    self->ranges = g_queue_new();
+    self->pos = 0;
+    self->eof = FALSE;
+}
+
+static void
+finalize_impl(
+    GObject * obj_self)
+{
+    XferFilterRange *self = XFER_FILTER_RANGE(obj_self);
+    range_t *range;
+
+    g_debug("range filter: %llu bytes read",
+	    (unsigned long long)self->pos);
+    while ((range = g_queue_pop_head(self->ranges)) != NULL)
+	g_free(range);
+    g_queue_free(self->ranges);
+    g_mutex_free(self->mutex);
+
+    /* chain up */
+    G_OBJECT_CLASS(parent_class)->finalize(obj_self);
+}
+
+static void
+class_init(
+    XferFilterRangeClass * selfc)
+{
+    XferElementClass *klass = XFER_ELEMENT_CLASS(selfc);
+    GObjectClass *goc = G_OBJECT_CLASS(selfc);
+    static xfer_element_mech_pair_t mech_pairs[] = {
+	{ XFER_MECH_PULL_BUFFER, XFER_MECH_PULL_BUFFER, XFER_NROPS(1), XFER_NTHREADS(0), XFER_NALLOC(0) },
+	{ XFER_MECH_PUSH_BUFFER, XFER_MECH_PUSH_BUFFER, XFER_NROPS(1), XFER_NTHREADS(0), XFER_NALLOC(0) },
+	{ XFER_MECH_NONE, XFER_MECH_NONE, XFER_NROPS(0), XFER_NTHREADS(0), XFER_NALLOC(0) },
+    };
+
+    klass->push_buffer = push_buffer_impl;
+    klass->pull_buffer = pull_buffer_impl;
+
+    klass->perl_class = "Amanda::Xfer::Filter::Range";
+    klass->mech_pairs = mech_pairs;
+
+    goc->finalize = finalize_impl;
+
+    parent_class = g_type_class_peek_parent(selfc);
+}
+
+GType
+xfer_filter_range_get_type (void)
+{
+    static GType type = 0;
+
+    if (G_UNLIKELY(type == 0)) {
+        static const GTypeInfo info = {
+            sizeof (XferFilterRangeClass),
+            (GBaseInitFunc) NULL,
+            (GBaseFinalizeFunc) NULL,
+            (GClassInitFunc) class_init,
+            (GClassFinalizeFunc) NULL,
+            NULL /* class_data */,
+            sizeof (XferFilterRange),
+            0 /* n_preallocs */,
+            (GInstanceInitFunc) instance_init,
+            NULL
+        };
+
+        type = g_type_register_static (XFER_ELEMENT_TYPE, "XferFilterRange", &info, 0);
+    }
+
+    return type;
+}
+
+/* create an element of this class; prototype is in xfer-element.h */
+XferElement *
+xfer_filter_range(void)
+{
+    XferFilterRange *xfr = (XferFilterRange *)g_object_new(XFER_FILTER_RANGE_TYPE, NULL);
+
+    return XFER_ELEMENT(xfr);
+}
+
+void
+xfer_filter_range_add(
+    XferElement *elt,
+    guint64 start,
+    gint64 length)
+{
+    XferFilterRange *self = XFER_FILTER_RANGE(elt);
+    range_t *range = g_new(range_t, 1);
+
+    range->start = start;
+    range->length = length;
+    g_mutex_lock(self->mutex);
+    g_queue_push_tail(self->ranges, range);
+    g_mutex_unlock(self->mutex);
+}
@@ -145,7 +145,7 @@ push_buffer_impl(
 
     /* drop the buffer if we've been cancelled */
     if (elt->cancelled) {
-	amfree(buf);
+	xfer_element_free_buffer(elt, buf);
 	return;
     }
 
@@ -182,6 +182,8 @@ instance_init(
     XferElement *elt)
 {
     elt->can_generate_eof = TRUE;
+    elt->releases_buffers = TRUE;
+    elt->forwards_buffers = TRUE;
 }
 
 static void
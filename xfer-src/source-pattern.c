@@ -103,6 +103,16 @@ static void fill_buffer_with_pattern(XferSourcePattern *self, char *buf,
     self->current_offset = offset;
 }
 
+static gboolean
+setup_impl(
+    XferElement *elt)
+{
+    if (elt->output_mech == XFER_MECH_PULL_BUFFER)
+	xfer_reserve_buffers(elt->xfer, 10240, 2, FALSE);
+
+    return TRUE;
+}
+
 static gpointer
 pull_buffer_impl(
     XferElement *elt,
@@ -129,7 +139,8 @@ pull_buffer_impl(
 	*size = 10240;
     }
 
-    rval = malloc(*size);
+    /* always use a full-sized buffer, so that it can come from the pool */
+    rval = xfer_element_alloc_buffer(elt, 10240);
 
     fill_buffer_with_pattern(self, rval, *size);
 
@@ -187,6 +198,7 @@ class_init(
 	{ XFER_MECH_NONE, XFER_MECH_NONE, XFER_NROPS(0), XFER_NTHREADS(0), XFER_NALLOC(0) },
     };
 
+    klass->setup = setup_impl;
     klass->pull_buffer = pull_buffer_impl;
     klass->pull_buffer_static = pull_buffer_static_impl;
 
@@ -75,6 +75,16 @@ get_seed_impl(
     return simpleprng_get_seed(&self->prng);
 }
 
+static gboolean
+setup_impl(
+    XferElement *elt)
+{
+    if (elt->output_mech == XFER_MECH_PULL_BUFFER)
+	xfer_reserve_buffers(elt->xfer, 10240, 2, FALSE);
+
+    return TRUE;
+}
+
 static gpointer
 pull_buffer_impl(
     XferElement *elt,
@@ -95,7 +105,8 @@ pull_buffer_impl(
 	*size = 10240;
     }
 
-    buf = g_malloc(*size);
+    /* always use a full-sized buffer, so that it can come from the pool */
+    buf = xfer_element_alloc_buffer(elt, 10240);
     simpleprng_fill_buffer(&self->prng, buf, *size);
 
     return buf;
@@ -147,6 +158,7 @@ class_init(
     };
 
     selfc->get_seed = get_seed_impl;
+    klass->setup = setup_impl;
     klass->pull_buffer = pull_buffer_impl;
     klass->pull_buffer_static = pull_buffer_static_impl;
 
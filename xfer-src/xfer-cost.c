@@ -0,0 +1,573 @@
+/*
+ * Copyright (c) 2008-2012 Zmanda, Inc.  All Rights Reserved.
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+
+/* Linkage costs for link_elements.  By default, the cost of a mech pair is
+ * computed from the static weights in its declaration.  If a calibration file
+ * written by xfer_calibrate_costs is present, the costs measured on this host
+ * for each mechanism are used instead.  See xfer.h for the interface. */
+
+#include "amanda.h"
+#include "amxfer.h"
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#include <semaphore.h>
+
+/* calculate an integer representing the cost of a mech pair as a
+ * single integer.  OPS_PER_BYTE is the most important metric,
+ * followed by NTHREADS.
+ *
+ * PAIR will be evaluated multiple times.
+ */
+#define PAIR_COST(pair) (((pair).ops_per_byte << 16) + ((pair).nalloc << 8) + (pair).nthreads)
+
+/* the largest cost considered for any one pair, so that a transfer's total
+ * cost stays well under link_elements' maximum */
+#define MAX_PAIR_COST 0xffff
+
+/* benchmark parameters */
+#define BENCH_BLOCK_SIZE (64*1024)
+#define BENCH_NBLOCKS 1024
+#define BENCH_RING_BLOCKS 32
+#define BENCH_RUNS 3
+
+/* measured costs, in picoseconds per byte */
+typedef struct xfer_costs_s {
+    gint32 copy;		/* for each ops_per_byte */
+    gint32 alloc;		/* for each nalloc */
+    gint32 thread;		/* for each nthreads */
+    gint32 mech[XFER_MECH_MAX];	/* for each input and output mechanism */
+} xfer_costs_t;
+
+static xfer_costs_t costs;
+static gboolean costs_loaded = FALSE;
+static gboolean have_costs = FALSE;
+
+/*
+ * Calibration file
+ */
+
+static char *
+read_costs(
+    const char *filename,
+    xfer_costs_t *result)
+{
+    FILE *f;
+    char line[256];
+    char key[64];
+    int value;
+    int mech;
+
+    if (!(f = fopen(filename, "r")))
+	return g_strdup_printf(_("Could not open '%s': %s"), filename,
+			       strerror(errno));
+
+    memset(result, 0, sizeof(*result));
+    for (mech = 0; mech < XFER_MECH_MAX; mech++)
+	result->mech[mech] = -1;
+    result->mech[XFER_MECH_NONE] = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+	if (line[0] == '#' || sscanf(line, "%63s %d", key, &value) != 2)
+	    continue;
+	if (value < 0)
+	    value = 0;
+
+	if (g_str_equal(key, "copy")) {
+	    result->copy = value;
+	} else if (g_str_equal(key, "alloc")) {
+	    result->alloc = value;
+	} else if (g_str_equal(key, "thread")) {
+	    result->thread = value;
+	} else {
+	    for (mech = XFER_MECH_NONE + 1; mech < XFER_MECH_MAX; mech++) {
+		if (g_str_equal(key, xfer_mech_name(mech)))
+		    result->mech[mech] = value;
+	    }
+	}
+    }
+    fclose(f);
+
+    /* mechanisms that were not measured cost as much as a pipe */
+    if (result->mech[XFER_MECH_READFD] < 0)
+	return g_strdup_printf(_("'%s' has no READFD cost"), filename);
+    for (mech = XFER_MECH_NONE + 1; mech < XFER_MECH_MAX; mech++) {
+	if (result->mech[mech] < 0)
+	    result->mech[mech] = result->mech[XFER_MECH_READFD];
+    }
+
+    return NULL;
+}
+
+static char *
+write_costs(
+    const char *filename,
+    xfer_costs_t *c)
+{
+    char *tmpname = g_strconcat(filename, ".tmp", NULL);
+    char *errmsg = NULL;
+    FILE *f;
+    int mech;
+
+    if (!(f = fopen(tmpname, "w"))) {
+	errmsg = g_strdup_printf(_("Could not create '%s': %s"), tmpname,
+				 strerror(errno));
+	g_free(tmpname);
+	return errmsg;
+    }
+
+    g_fprintf(f, "# xfer linkage costs in picoseconds per byte, written by xfer_calibrate_costs\n");
+    g_fprintf(f, "copy %d\n", c->copy);
+    g_fprintf(f, "alloc %d\n", c->alloc);
+    g_fprintf(f, "thread %d\n", c->thread);
+    for (mech = XFER_MECH_NONE + 1; mech < XFER_MECH_MAX; mech++)
+	g_fprintf(f, "%s %d\n", xfer_mech_name(mech), c->mech[mech]);
+
+    if (fclose(f) != 0) {
+	errmsg = g_strdup_printf(_("Could not write '%s': %s"), tmpname,
+				 strerror(errno));
+    } else if (rename(tmpname, filename) != 0) {
+	errmsg = g_strdup_printf(_("Could not rename '%s' to '%s': %s"),
+				 tmpname, filename, strerror(errno));
+    }
+    if (errmsg)
+	unlink(tmpname);
+
+    g_free(tmpname);
+    return errmsg;
+}
+
+/*
+ * Benchmarks
+ *
+ * Each benchmark moves BENCH_NBLOCKS blocks of BENCH_BLOCK_SIZE bytes, with a
+ * producer thread where the mechanism involves two threads, and returns the
+ * elapsed time in seconds.
+ */
+
+typedef struct bench_s {
+    char *block;
+    int pipe[2];
+    GAsyncQueue *queue;
+
+    /* rings */
+    char *ring;
+    guint64 written;
+    guint64 readx;
+    GMutex *mutex;
+    GCond *add_cond;
+    GCond *free_cond;
+    sem_t *sems;	/* [0] = blocks free, [1] = blocks added */
+} bench_t;
+
+static double
+bench_copy(
+    bench_t *b G_GNUC_UNUSED)
+{
+    char *src = g_malloc0(BENCH_BLOCK_SIZE);
+    char *dst = g_malloc0(BENCH_BLOCK_SIZE);
+    GTimer *timer = g_timer_new();
+    double elapsed;
+    int i;
+
+    for (i = 0; i < BENCH_NBLOCKS; i++) {
+	memcpy(dst, src, BENCH_BLOCK_SIZE);
+	src[i % BENCH_BLOCK_SIZE] = dst[(i * 7) % BENCH_BLOCK_SIZE] + 1;
+    }
+    elapsed = g_timer_elapsed(timer, NULL);
+
+    g_timer_destroy(timer);
+    g_free(src);
+    g_free(dst);
+    return elapsed;
+}
+
+static double
+bench_alloc(
+    bench_t *b G_GNUC_UNUSED)
+{
+    GTimer *timer = g_timer_new();
+    double elapsed;
+    char *buf;
+    int i;
+
+    for (i = 0; i < BENCH_NBLOCKS; i++) {
+	buf = g_malloc(BENCH_BLOCK_SIZE);
+	buf[0] = buf[BENCH_BLOCK_SIZE-1] = (char)i;
+	g_free(buf);
+    }
+    elapsed = g_timer_elapsed(timer, NULL);
+
+    g_timer_destroy(timer);
+    return elapsed;
+}
+
+static gpointer
+thread_producer(
+    gpointer data)
+{
+    bench_t *b = (bench_t *)data;
+    int i;
+
+    for (i = 0; i < BENCH_NBLOCKS; i++)
+	g_async_queue_push(b->queue, b->block);
+
+    return NULL;
+}
+
+static double
+bench_thread(
+    bench_t *b)
+{
+    GTimer *timer = g_timer_new();
+    GThread *thread;
+    double elapsed;
+    int i;
+
+    b->queue = g_async_queue_new();
+    thread = g_thread_create(thread_producer, (gpointer)b, TRUE, NULL);
+    for (i = 0; i < BENCH_NBLOCKS; i++)
+	g_async_queue_pop(b->queue);
+    elapsed = g_timer_elapsed(timer, NULL);
+
+    g_thread_join(thread);
+    g_async_queue_unref(b->queue);
+    g_timer_destroy(timer);
+    return elapsed;
+}
+
+static gpointer
+pipe_producer(
+    gpointer data)
+{
+    bench_t *b = (bench_t *)data;
+    int i;
+
+    for (i = 0; i < BENCH_NBLOCKS; i++) {
+	if (full_write(b->pipe[1], b->block, BENCH_BLOCK_SIZE) < BENCH_BLOCK_SIZE)
+	    break;
+    }
+    close(b->pipe[1]);
+
+    return NULL;
+}
+
+static double
+bench_pipe(
+    bench_t *b)
+{
+    char *buf = g_malloc(BENCH_BLOCK_SIZE);
+    GTimer *timer;
+    GThread *thread;
+    double elapsed;
+
+    if (pipe(b->pipe) < 0) {
+	g_free(buf);
+	return -1;
+    }
+
+    timer = g_timer_new();
+    thread = g_thread_create(pipe_producer, (gpointer)b, TRUE, NULL);
+    while (read_fully(b->pipe[0], buf, BENCH_BLOCK_SIZE, NULL) == BENCH_BLOCK_SIZE)
+	;
+    elapsed = g_timer_elapsed(timer, NULL);
+
+    g_thread_join(thread);
+    close(b->pipe[0]);
+    g_timer_destroy(timer);
+    g_free(buf);
+    return elapsed;
+}
+
+static gpointer
+mem_ring_producer(
+    gpointer data)
+{
+    bench_t *b = (bench_t *)data;
+    int i;
+
+    for (i = 0; i < BENCH_NBLOCKS; i++) {
+	g_mutex_lock(b->mutex);
+	while (b->written - b->readx == BENCH_RING_BLOCKS)
+	    g_cond_wait(b->free_cond, b->mutex);
+	g_mutex_unlock(b->mutex);
+
+	memcpy(b->ring + (i % BENCH_RING_BLOCKS) * BENCH_BLOCK_SIZE, b->block,
+	       BENCH_BLOCK_SIZE);
+
+	g_mutex_lock(b->mutex);
+	b->written++;
+	g_cond_broadcast(b->add_cond);
+	g_mutex_unlock(b->mutex);
+    }
+
+    return NULL;
+}
+
+static double
+bench_mem_ring(
+    bench_t *b)
+{
+    GTimer *timer;
+    GThread *thread;
+    double elapsed;
+    int i;
+
+    b->ring = g_malloc0(BENCH_RING_BLOCKS * BENCH_BLOCK_SIZE);
+    b->written = b->readx = 0;
+    b->mutex = g_mutex_new();
+    b->add_cond = g_cond_new();
+    b->free_cond = g_cond_new();
+
+    timer = g_timer_new();
+    thread = g_thread_create(mem_ring_producer, (gpointer)b, TRUE, NULL);
+    for (i = 0; i < BENCH_NBLOCKS; i++) {
+	g_mutex_lock(b->mutex);
+	while (b->written == b->readx)
+	    g_cond_wait(b->add_cond, b->mutex);
+	b->readx++;
+	g_cond_broadcast(b->free_cond);
+	g_mutex_unlock(b->mutex);
+    }
+    elapsed = g_timer_elapsed(timer, NULL);
+
+    g_thread_join(thread);
+    g_timer_destroy(timer);
+    g_cond_free(b->free_cond);
+    g_cond_free(b->add_cond);
+    g_mutex_free(b->mutex);
+    g_free(b->ring);
+    return elapsed;
+}
+
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_ANONYMOUS)
+static gpointer
+shm_ring_producer(
+    gpointer data)
+{
+    bench_t *b = (bench_t *)data;
+    int i;
+
+    for (i = 0; i < BENCH_NBLOCKS; i++) {
+	while (sem_wait(&b->sems[0]) != 0 && errno == EINTR)
+	    ;
+	memcpy(b->ring + (i % BENCH_RING_BLOCKS) * BENCH_BLOCK_SIZE, b->block,
+	       BENCH_BLOCK_SIZE);
+	sem_post(&b->sems[1]);
+    }
+
+    return NULL;
+}
+
+/* the shm_ring protocol is a shared mapping synchronized by semaphores; this
+ * measures the same thing between two threads */
+static double
+bench_shm_ring(
+    bench_t *b)
+{
+    gsize size = BENCH_RING_BLOCKS * BENCH_BLOCK_SIZE + 2 * sizeof(sem_t);
+    GTimer *timer;
+    GThread *thread;
+    double elapsed;
+    char *map;
+    int i;
+
+    map = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS,
+	       -1, 0);
+    if (map == MAP_FAILED)
+	return -1;
+    b->ring = map;
+    b->sems = (sem_t *)(map + BENCH_RING_BLOCKS * BENCH_BLOCK_SIZE);
+    if (sem_init(&b->sems[0], 1, BENCH_RING_BLOCKS) != 0 ||
+	sem_init(&b->sems[1], 1, 0) != 0) {
+	munmap(map, size);
+	return -1;
+    }
+
+    timer = g_timer_new();
+    thread = g_thread_create(shm_ring_producer, (gpointer)b, TRUE, NULL);
+    for (i = 0; i < BENCH_NBLOCKS; i++) {
+	while (sem_wait(&b->sems[1]) != 0 && errno == EINTR)
+	    ;
+	sem_post(&b->sems[0]);
+    }
+    elapsed = g_timer_elapsed(timer, NULL);
+
+    g_thread_join(thread);
+    g_timer_destroy(timer);
+    sem_destroy(&b->sems[0]);
+    sem_destroy(&b->sems[1]);
+    munmap(map, size);
+    return elapsed;
+}
+#endif
+
+/* run BENCH the usual number of times, and return the best result in
+ * picoseconds per byte, or -1 if it could not be run */
+static gint32
+measure(
+    double (*bench)(bench_t *b),
+    bench_t *b,
+    const char *name)
+{
+    double best = -1;
+    double ps;
+    int i;
+
+    for (i = 0; i < BENCH_RUNS; i++) {
+	double elapsed = bench(b);
+	if (elapsed >= 0 && (best < 0 || elapsed < best))
+	    best = elapsed;
+    }
+    if (best < 0) {
+	g_debug("xfer cost calibration: could not measure %s", name);
+	return -1;
+    }
+
+    ps = best * 1e12 / ((double)BENCH_NBLOCKS * BENCH_BLOCK_SIZE);
+    if (ps > MAX_PAIR_COST)
+	ps = MAX_PAIR_COST;
+    g_debug("xfer cost calibration: %s costs %.0f ps/byte", name, ps);
+    return (gint32)ps;
+}
+
+/*
+ * Interface
+ */
+
+char *
+xfer_calibrate_costs(
+    const char *filename)
+{
+    xfer_costs_t c;
+    bench_t b;
+    char *errmsg;
+    int mech;
+
+#ifdef DEFAULT_XFER_COSTS_FILE
+    if (!filename)
+	filename = DEFAULT_XFER_COSTS_FILE;
+#endif
+    if (!filename)
+	return g_strdup(_("no xfer costs file is configured"));
+
+    memset(&b, 0, sizeof(b));
+    b.block = g_malloc0(BENCH_BLOCK_SIZE);
+
+    c.copy = measure(bench_copy, &b, "copy");
+    c.alloc = measure(bench_alloc, &b, "alloc");
+    c.thread = measure(bench_thread, &b, "thread");
+    for (mech = 0; mech < XFER_MECH_MAX; mech++)
+	c.mech[mech] = -1;
+    c.mech[XFER_MECH_NONE] = 0;
+
+    /* handing a buffer to a neighbor is a function call; the allocation and
+     * any thread switch are accounted with nalloc and nthreads */
+    c.mech[XFER_MECH_PULL_BUFFER] = 0;
+    c.mech[XFER_MECH_PULL_BUFFER_STATIC] = 0;
+    c.mech[XFER_MECH_PUSH_BUFFER] = 0;
+    c.mech[XFER_MECH_PUSH_BUFFER_STATIC] = 0;
+
+    c.mech[XFER_MECH_READFD] = measure(bench_pipe, &b, "READFD");
+    c.mech[XFER_MECH_WRITEFD] = c.mech[XFER_MECH_READFD];
+    c.mech[XFER_MECH_MEM_RING] = measure(bench_mem_ring, &b, "MEM_RING");
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_ANONYMOUS)
+    c.mech[XFER_MECH_SHM_RING] = measure(bench_shm_ring, &b, "SHM_RING");
+#endif
+    g_free(b.block);
+
+    if (c.copy < 0 || c.alloc < 0 || c.thread < 0 ||
+	c.mech[XFER_MECH_READFD] < 0)
+	return g_strdup(_("xfer cost calibration failed; see the debug log"));
+
+    /* DirectTCP connections are sockets, which cost about as much as pipes */
+    for (mech = XFER_MECH_NONE + 1; mech < XFER_MECH_MAX; mech++) {
+	if (c.mech[mech] < 0)
+	    c.mech[mech] = c.mech[XFER_MECH_READFD];
+    }
+
+    if ((errmsg = write_costs(filename, &c)))
+	return errmsg;
+
+    costs = c;
+    costs_loaded = have_costs = TRUE;
+    return NULL;
+}
+
+char *
+xfer_load_costs(
+    const char *filename)
+{
+    xfer_costs_t c;
+    char *errmsg;
+
+    costs_loaded = TRUE;
+    have_costs = FALSE;
+    if (!filename)
+	return NULL;
+
+    if ((errmsg = read_costs(filename, &c)))
+	return errmsg;
+
+    costs = c;
+    have_costs = TRUE;
+    return NULL;
+}
+
+gint32
+xfer_pair_cost(
+    xfer_element_mech_pair_t *pair)
+{
+    gint32 cost;
+
+    if (!costs_loaded) {
+#ifdef DEFAULT_XFER_COSTS_FILE
+	char *errmsg = xfer_load_costs(DEFAULT_XFER_COSTS_FILE);
+
+	if (errmsg) {
+	    g_debug("using static xfer linkage costs: %s", errmsg);
+	    g_free(errmsg);
+	} else {
+	    g_debug("using xfer linkage costs from '%s'",
+		    DEFAULT_XFER_COSTS_FILE);
+	}
+#else
+	costs_loaded = TRUE;
+#endif
+    }
+
+    if (!have_costs)
+	return PAIR_COST(*pair);
+
+    cost = pair->ops_per_byte * costs.copy
+	 + pair->nalloc * costs.alloc
+	 + pair->nthreads * costs.thread
+	 + costs.mech[pair->input_mech]
+	 + costs.mech[pair->output_mech];
+
+    /* prefer the simpler pair when the measurements can't tell them apart */
+    cost += pair->ops_per_byte + pair->nalloc + pair->nthreads;
+
+    return MIN(cost, MAX_PAIR_COST);
+}
@@ -23,6 +23,9 @@
 
 #include "amanda.h"
 #include "amxfer.h"
+#include "directtcp-mux.h"
+#include "amprobe.h"
+#include <poll.h>
 
 /* parent class for XferElement */
 static GObjectClass *parent_class = NULL;
@@ -46,6 +49,12 @@ xfer_element_init(
     xe->must_drain = FALSE;
     xe->cancel_on_success = FALSE;
     xe->ignore_broken_pipe = FALSE;
+    xe->releases_buffers = FALSE;
+    xe->forwards_buffers = FALSE;
+    xe->accepts_pool_buffers = FALSE;
+    xe->directtcp_streams = 1;
+    xe->stats_mutex = g_mutex_new();
+    memset(&xe->stats, 0, sizeof(xe->stats));
 }
 
 static gboolean
@@ -188,6 +197,8 @@ xfer_element_finalize(
     /* free the repr cache */
     if (elt->repr) g_free(elt->repr);
 
+    g_mutex_free(elt->stats_mutex);
+
     /* close up the input/output file descriptors, being careful to do so
      * atomically, and making any errors doing so into mere warnings */
     fd = xfer_element_swap_input_fd(elt, -1);
@@ -326,10 +337,27 @@ xfer_element_get_block_size(
     return XFER_ELEMENT_GET_CLASS(elt)->get_block_size(elt);
 }
 
+void
+xfer_element_set_directtcp_streams(
+    XferElement *elt,
+    int streams)
+{
+    elt->directtcp_streams = CLAMP(streams, 1, DIRECTTCP_MUX_MAX_STREAMS);
+}
+
+void
+xfer_element_set_directtcp_rdma(
+    XferElement *elt,
+    gboolean rdma)
+{
+    elt->directtcp_rdma = rdma;
+}
+
 gboolean
 xfer_element_start(
     XferElement *elt)
 {
+    AMPROBE2(xfer__element__start, elt, XFER_ELEMENT_GET_CLASS(elt)->perl_class);
     return XFER_ELEMENT_GET_CLASS(elt)->start(elt);
 }
 
@@ -338,15 +366,52 @@ xfer_element_cancel(
     XferElement *elt,
     gboolean expect_eof)
 {
+    AMPROBE2(xfer__element__cancel, elt, expect_eof);
     return XFER_ELEMENT_GET_CLASS(elt)->cancel(elt, expect_eof);
 }
 
+/* Account for a push (or pull) from CALLER into CALLEE which moved LEN bytes
+ * and took ELAPSED microseconds, during which CALLER was blocked. */
+static void
+account_call(
+    XferElement *caller,
+    XferElement *callee,
+    gboolean push,
+    gsize len,
+    gint64 elapsed)
+{
+    if (elapsed < 0)
+	elapsed = 0;
+
+    g_mutex_lock(callee->stats_mutex);
+    if (push)
+	callee->stats.bytes_in += len;
+    else
+	callee->stats.bytes_out += len;
+    callee->stats.called += elapsed;
+    g_mutex_unlock(callee->stats_mutex);
+
+    if (caller) {
+	g_mutex_lock(caller->stats_mutex);
+	if (push) {
+	    caller->stats.bytes_out += len;
+	    caller->stats.wait_downstream += elapsed;
+	} else {
+	    caller->stats.bytes_in += len;
+	    caller->stats.wait_upstream += elapsed;
+	}
+	g_mutex_unlock(caller->stats_mutex);
+    }
+}
+
 gpointer
 xfer_element_pull_buffer(
     XferElement *elt,
     size_t *size)
 {
     xfer_status status;
+    gint64 start, elapsed;
+    gpointer buf;
     /* Make sure that the xfer is running before calling upstream's
      * pull_buffer method; this avoids a race condition where upstream
      * hasn't finished its xfer_element_start yet, and isn't ready for
@@ -357,7 +422,19 @@ xfer_element_pull_buffer(
     if (status == XFER_START)
 	wait_until_xfer_running(elt->xfer);
 
-    return XFER_ELEMENT_GET_CLASS(elt)->pull_buffer(elt, size);
+    if (!xfer_element_stats_enabled(elt)) {
+	buf = XFER_ELEMENT_GET_CLASS(elt)->pull_buffer(elt, size);
+	AMPROBE3(xfer__pull__buffer, elt, buf? *size : 0, 0);
+	return buf;
+    }
+
+    start = xfer_stats_clock();
+    buf = XFER_ELEMENT_GET_CLASS(elt)->pull_buffer(elt, size);
+    elapsed = xfer_stats_clock() - start;
+    AMPROBE3(xfer__pull__buffer, elt, buf? *size : 0, elapsed);
+    account_call(elt->downstream, elt, FALSE, buf? *size : 0, elapsed);
+
+    return buf;
 }
 
 gpointer
@@ -368,6 +445,8 @@ xfer_element_pull_buffer_static(
     size_t *size)
 {
     xfer_status status;
+    gint64 start, elapsed;
+    gpointer result;
     /* Make sure that the xfer is running before calling upstream's
      * pull_bufferi_static method; this avoids a race condition where upstream
      * hasn't finished its xfer_element_start yet, and isn't ready for
@@ -378,7 +457,19 @@ xfer_element_pull_buffer_static(
     if (status == XFER_START)
 	wait_until_xfer_running(elt->xfer);
 
-    return XFER_ELEMENT_GET_CLASS(elt)->pull_buffer_static(elt, buf, block_size, size);
+    if (!xfer_element_stats_enabled(elt)) {
+	result = XFER_ELEMENT_GET_CLASS(elt)->pull_buffer_static(elt, buf, block_size, size);
+	AMPROBE3(xfer__pull__buffer, elt, result? *size : 0, 0);
+	return result;
+    }
+
+    start = xfer_stats_clock();
+    result = XFER_ELEMENT_GET_CLASS(elt)->pull_buffer_static(elt, buf, block_size, size);
+    elapsed = xfer_stats_clock() - start;
+    AMPROBE3(xfer__pull__buffer, elt, result? *size : 0, elapsed);
+    account_call(elt->downstream, elt, FALSE, result? *size : 0, elapsed);
+
+    return result;
 }
 
 void
@@ -387,9 +478,21 @@ xfer_element_push_buffer(
     gpointer buf,
     size_t size)
 {
+    gint64 start, elapsed;
+
     /* There is no race condition with push_buffer, because downstream
      * elements are started first. */
+    if (!xfer_element_stats_enabled(elt)) {
+	XFER_ELEMENT_GET_CLASS(elt)->push_buffer(elt, buf, size);
+	AMPROBE3(xfer__push__buffer, elt, buf? size : 0, 0);
+	return;
+    }
+
+    start = xfer_stats_clock();
     XFER_ELEMENT_GET_CLASS(elt)->push_buffer(elt, buf, size);
+    elapsed = xfer_stats_clock() - start;
+    AMPROBE3(xfer__push__buffer, elt, buf? size : 0, elapsed);
+    account_call(elt->upstream, elt, TRUE, buf? size : 0, elapsed);
 }
 
 void
@@ -398,9 +501,21 @@ xfer_element_push_buffer_static(
     gpointer buf,
     size_t size)
 {
+    gint64 start, elapsed;
+
     /* There is no race condition with push_buffer, because downstream
      * elements are started first. */
+    if (!xfer_element_stats_enabled(elt)) {
+	XFER_ELEMENT_GET_CLASS(elt)->push_buffer_static(elt, buf, size);
+	AMPROBE3(xfer__push__buffer, elt, buf? size : 0, 0);
+	return;
+    }
+
+    start = xfer_stats_clock();
     XFER_ELEMENT_GET_CLASS(elt)->push_buffer_static(elt, buf, size);
+    elapsed = xfer_stats_clock() - start;
+    AMPROBE3(xfer__push__buffer, elt, buf? size : 0, elapsed);
+    account_call(elt->upstream, elt, TRUE, buf? size : 0, elapsed);
 }
 
 xfer_element_mech_pair_t *
@@ -422,21 +537,113 @@ xfer_element_drain_buffers(
     size_t size;
 
     while ((buf =xfer_element_pull_buffer(upstream, &size))) {
-	amfree(buf);
+	xfer_element_free_buffer(upstream->downstream, buf);
     }
 }
 
+gpointer
+xfer_element_alloc_buffer(
+    XferElement *elt,
+    gsize size)
+{
+    if (elt->xfer && elt->downstream && elt->downstream->accepts_pool_buffers)
+	return xfer_get_buffer(elt->xfer, size);
+    return g_malloc(size);
+}
+
+void
+xfer_element_free_buffer(
+    XferElement *elt,
+    gpointer buf)
+{
+    if (elt && elt->xfer)
+	xfer_release_buffer(elt->xfer, buf);
+    else
+	g_free(buf);
+}
+
+void
+xfer_element_take_upstream_crc(
+    XferElement *elt)
+{
+    if (elt->reuse_upstream_crc)
+	elt->crc = elt->upstream->crc;
+}
+
+gboolean
+xfer_element_stats_enabled(
+    XferElement *elt)
+{
+    return elt && elt->xfer && elt->xfer->stats_interval != 0;
+}
+
+void
+xfer_element_add_stats(
+    XferElement *elt,
+    guint64 bytes_in,
+    guint64 bytes_out,
+    gint64 wait_upstream,
+    gint64 wait_downstream)
+{
+    if (!xfer_element_stats_enabled(elt))
+	return;
+
+    g_mutex_lock(elt->stats_mutex);
+    elt->stats.bytes_in += bytes_in;
+    elt->stats.bytes_out += bytes_out;
+    if (wait_upstream > 0)
+	elt->stats.wait_upstream += wait_upstream;
+    if (wait_downstream > 0)
+	elt->stats.wait_downstream += wait_downstream;
+    g_mutex_unlock(elt->stats_mutex);
+}
+
+void
+xfer_element_get_stats(
+    XferElement *elt,
+    xfer_element_stats_t *stats)
+{
+    g_mutex_lock(elt->stats_mutex);
+    *stats = elt->stats;
+    g_mutex_unlock(elt->stats_mutex);
+}
+
 void
 xfer_element_drain_fd(
     int fd)
 {
-    size_t len;
-    char buf[1024];
+    struct pollfd pfd;
+    time_t deadline = time(NULL) + XFER_DRAIN_MAX_TIME;
+    ssize_t len;
+    int rv;
+    char buf[32768];
 
     while (1) {
-	len = read_fully(fd, buf, sizeof(buf), NULL);
-	if (len < sizeof(buf))
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	rv = poll(&pfd, 1, XFER_DRAIN_IDLE_TIMEOUT * 1000);
+	if (rv == -1 && errno == EINTR)
+	    continue;
+	if (rv == 0) {
+	    g_debug("xfer_element_drain_fd: no data on fd %d for %d seconds; giving up",
+		    fd, XFER_DRAIN_IDLE_TIMEOUT);
+	    return;
+	}
+	if (rv == -1)
+	    return;
+
+	len = read(fd, buf, sizeof(buf));
+	if (len == 0)
+	    return;
+	if (len < 0 && errno != EINTR && errno != EAGAIN)
+	    return;
+
+	if (time(NULL) > deadline) {
+	    g_debug("xfer_element_drain_fd: fd %d still has data after %d seconds; giving up",
+		    fd, XFER_DRAIN_MAX_TIME);
 	    return;
+	}
     }
 }
 
@@ -33,6 +33,16 @@
 #include "amutil.h"
 #include "xfer.h"
 #include "directtcp.h"
+#include "conffile.h"
+
+/* Write a debugging message if the config variable debug_xfer
+ * is greater than or equal to i; the arguments are not evaluated
+ * otherwise, so this is cheap enough for the per-buffer paths. */
+#define xfer_debug(i, ...) do {		\
+	if ((i) <= debug_xfer) {	\
+	    g_debug(__VA_ARGS__);	\
+	}				\
+} while (0)
 
 typedef enum {
     /* sources have no input mechanisms and destinations have no output
@@ -107,6 +117,36 @@ typedef struct {
     guint8 nalloc;		/* number of alloc for each block */
 } xfer_element_mech_pair_t;
 
+/* Get the cost of a mech pair, for use in linking elements; this uses the
+ * costs measured by xfer_calibrate_costs, if available, and the static
+ * weights otherwise.  Implemented in xfer-cost.c.
+ *
+ * @param pair: the mech pair
+ * @returns: cost
+ */
+gint32 xfer_pair_cost(xfer_element_mech_pair_t *pair);
+
+/* Get the name of a mechanism, e.g., "READFD"; for debugging messages and the
+ * calibration file.
+ *
+ * @param mech: the mechanism
+ * @returns: statically allocated string
+ */
+char *xfer_mech_name(xfer_mech mech);
+
+/*
+ * Running per-element statistics, reported to the caller in XMSG_STATS.
+ * Times are in microseconds.
+ */
+
+typedef struct {
+    guint64 bytes_in;		/* bytes received from upstream */
+    guint64 bytes_out;		/* bytes handed downstream */
+    guint64 wait_upstream;	/* time blocked waiting for upstream */
+    guint64 wait_downstream;	/* time blocked waiting for downstream */
+    guint64 called;		/* time spent in calls from neighbors */
+} xfer_element_stats_t;
+
 /***********************
  * XferElement
  *
@@ -165,6 +205,14 @@ typedef struct XferElement {
     DirectTCPAddr *input_listen_addrs;
     DirectTCPAddr *output_listen_addrs;
 
+    /* number of TCP connections that the glue next to this element uses for
+     * a DirectTCP stream; see xfer_element_set_directtcp_streams */
+    int directtcp_streams;
+
+    /* whether that glue moves the stream over RDMA; see
+     * xfer_element_set_directtcp_rdma */
+    gboolean directtcp_rdma;
+
     /* cache for repr() */
     char *repr;
 
@@ -182,11 +230,39 @@ typedef struct XferElement {
     /* for crc computation */
     crc_t crc;
 
+    /* CRC pass-through.  Output_crc_known should be set during setup by
+     * elements that compute elt->crc over exactly the bytes they produce, and
+     * whose crc is final before their downstream neighbor sees EOF.
+     * Passes_data_unchanged is set by elements that neither modify nor drop
+     * the bytes they move.  Reuse_upstream_crc is computed by xfer_start from
+     * those, unless the xfer was asked to verify every crc; an element with it
+     * set may skip its own crc computation and report its upstream neighbor's
+     * crc instead (see xfer_element_take_upstream_crc). */
+    gboolean output_crc_known;
+    gboolean passes_data_unchanged;
+    gboolean reuse_upstream_crc;
+
     /* if input must be drained in case of write error */
     gboolean must_drain;
     gboolean drain_mode;
     gboolean cancel_on_success;
     gboolean ignore_broken_pipe;
+
+    /* Buffer recycling.  Releases_buffers should be set during initialization
+     * by elements that free every buffer they receive with
+     * xfer_element_free_buffer, and forwards_buffers by those that may pass
+     * a received buffer on to their downstream neighbor.  Accepts_pool_buffers
+     * is computed by xfer_start from those, and tells upstream whether
+     * xfer_element_alloc_buffer may return a pool buffer. */
+    gboolean releases_buffers;
+    gboolean forwards_buffers;
+    gboolean accepts_pool_buffers;
+
+    /* Statistics for XMSG_STATS, protected by stats_mutex.  The push and pull
+     * wrappers below account for buffer mechanisms; elements that block on
+     * file descriptors or rings should call xfer_element_add_stats. */
+    GMutex *stats_mutex;
+    xfer_element_stats_t stats;
 } XferElement;
 
 /*
@@ -386,6 +462,8 @@ off_t xfer_element_get_offset(XferElement *elt);
 off_t xfer_element_get_orig_size(XferElement *elt);
 off_t xfer_element_get_size(XferElement *elt);
 size_t xfer_element_get_block_size(XferElement *elt);
+void xfer_element_set_directtcp_streams(XferElement *elt, int streams);
+void xfer_element_set_directtcp_rdma(XferElement *elt, gboolean rdma);
 gboolean xfer_element_start(XferElement *elt);
 void xfer_element_push_buffer(XferElement *elt, gpointer buf, size_t size);
 void xfer_element_push_buffer_static(XferElement *elt, gpointer buf, size_t size);
@@ -408,8 +486,73 @@ shm_ring_t *xfer_element_get_shm_ring(XferElement *elt);
  */
 void xfer_element_drain_buffers(XferElement *upstream);
 
+/* Allocate a buffer to push or return to ELT's downstream neighbor.  This
+ * comes from the transfer's buffer pool when SIZE has been reserved with
+ * xfer_reserve_buffers and the neighbor accepts pool buffers.
+ *
+ * @param elt: the element producing the buffer
+ * @param size: buffer size
+ * @returns: the buffer
+ */
+gpointer xfer_element_alloc_buffer(XferElement *elt, gsize size);
+
+/* Free a buffer received from upstream, returning it to the buffer pool if it
+ * came from there.
+ *
+ * @param elt: the element that received the buffer
+ * @param buf: the buffer, or NULL
+ */
+void xfer_element_free_buffer(XferElement *elt, gpointer buf);
+
+/* If ELT reuses its upstream neighbor's crc, copy that crc into elt->crc.
+ * Call this after upstream has reached EOF and before reporting elt->crc.
+ *
+ * @param elt: the element
+ */
+void xfer_element_take_upstream_crc(XferElement *elt);
+
+/* Is the element's transfer gathering statistics, i.e., has
+ * xfer_set_stats_interval been given a non-zero interval?  When it is not,
+ * the push and pull wrappers neither time the calls nor take stats_mutex, and
+ * elements can skip timing their waits.
+ *
+ * @param elt: the element
+ * @returns: TRUE if statistics are gathered
+ */
+gboolean xfer_element_stats_enabled(XferElement *elt);
+
+/* Add to an element's statistics.  This can be called from any thread, and
+ * ELT may be NULL.  Bytes moved by xfer_element_push_buffer and
+ * xfer_element_pull_buffer, and the time spent blocked in those calls, are
+ * already counted, so elements only need to report data moved through file
+ * descriptors, rings, and the like.
+ *
+ * @param elt: the element
+ * @param bytes_in: bytes received from upstream
+ * @param bytes_out: bytes sent downstream
+ * @param wait_upstream: microseconds spent waiting for upstream
+ * @param wait_downstream: microseconds spent waiting for downstream
+ */
+void xfer_element_add_stats(XferElement *elt, guint64 bytes_in,
+			    guint64 bytes_out, gint64 wait_upstream,
+			    gint64 wait_downstream);
+
+/* Get a snapshot of an element's statistics; this can be called from any
+ * thread.
+ *
+ * @param elt: the element
+ * @param stats (output): the statistics
+ */
+void xfer_element_get_stats(XferElement *elt, xfer_element_stats_t *stats);
+
+#define XFER_DRAIN_IDLE_TIMEOUT 10
+#define XFER_DRAIN_MAX_TIME 60
+
 /* Drain UPSTREAM by reading until EOF.  This does not close
- * the file descriptor.
+ * the file descriptor.  It gives up once the fd has been idle for
+ * XFER_DRAIN_IDLE_TIMEOUT seconds or the drain has lasted XFER_DRAIN_MAX_TIME
+ * seconds, so that a cancellation completes in bounded time; the caller then
+ * closes the fd, and upstream gets EPIPE.
  *
  * @param fd: the file descriptor to drain
  */
@@ -562,6 +705,77 @@ XferElement *xfer_filter_xor(
  */
 XferElement *xfer_filter_crc(void);
 
+/* A transfer filter that compresses the data that passes through it, in
+ * process, with gzip, zstd or lz4.  The output is compatible with the
+ * corresponding command-line tool's decompressor.
+ *
+ * Implemented in filter-compress.c
+ *
+ * @param algo: "gzip", "zstd" or "lz4"
+ * @param level: compression level, or one of the AMCOMPRESS_LEVEL_* values
+ * @param nthreads: number of compression worker threads; 0 or 1 to compress
+ *	in the calling thread, AMCOMPRESS_THREADS_AUTO (-1) for one per CPU.
+ *	Several threads compress independent blocks, see amcompress_new.
+ * @return: new element
+ */
+XferElement *xfer_filter_compress(
+    const char *algo,
+    int level,
+    int nthreads);
+
+/* Is the given compression algorithm available to xfer_filter_compress?
+ *
+ * @param algo: "gzip", "zstd" or "lz4"
+ * @return: TRUE if supported
+ */
+gboolean xfer_filter_compress_supported(const char *algo);
+
+/* A transfer filter that encrypts or decrypts the data that passes through
+ * it with AES-256-GCM, in independently authenticated records.  The stream
+ * format is described in amgcm.h.
+ *
+ * Implemented in filter-encrypt.c
+ *
+ * @param key_file: file holding the key
+ * @param decrypt: TRUE to decrypt rather than encrypt
+ * @param nthreads: number of worker threads; 0 or 1 to process records in
+ *	the calling thread
+ * @return: new element
+ */
+XferElement *xfer_filter_encrypt(
+    const char *key_file,
+    gboolean decrypt,
+    int nthreads);
+
+/* Is AES-GCM encryption available to xfer_filter_encrypt?
+ *
+ * @return: TRUE if supported
+ */
+gboolean xfer_filter_encrypt_supported(void);
+
+/* A transfer filter that passes on only the bytes at the given positions in
+ * the data, and drops the others.  The ranges are added with
+ * xfer_filter_range_add, possibly while the data flows, but each before the
+ * data it covers reaches the filter.
+ *
+ * Implemented in filter-range.c
+ *
+ * @return: new element
+ */
+XferElement *xfer_filter_range(void);
+
+/* Add a range of bytes to pass on.  The ranges must be added in increasing
+ * order of START.
+ *
+ * @param elt: the xfer_filter_range element
+ * @param start: position of the first byte in the data
+ * @param length: number of bytes, or -1 for all the bytes from START
+ */
+void xfer_filter_range_add(
+    XferElement *elt,
+    guint64 start,
+    gint64 length);
+
 /* A transfer destination that consumes all bytes it is given, optionally
  * validating that they match those produced by source_random
  *
@@ -24,11 +24,17 @@
 
 #include "amanda.h"
 #include "amxfer.h"
+#include "amcompress.h"
+#include "amgcm.h"
+#include "amexec.h"
 #include "glib-util.h"
 #include "testutils.h"
 #include "event.h"
 #include "simpleprng.h"
 #include "sockaddr-util.h"
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
 
 /* Having tests repeat exactly is an advantage, so we use a hard-coded
  * random seed. */
@@ -1159,6 +1165,141 @@ xfer_dest_pull_get_type (void)
     return type;
 }
 
+/* MEM_RING */
+
+static GType xfer_dest_ring_get_type(void);
+#define XFER_DEST_RING_TYPE (xfer_dest_ring_get_type())
+#define XFER_DEST_RING(obj) G_TYPE_CHECK_INSTANCE_CAST((obj), xfer_dest_ring_get_type(), XferDestRing)
+#define XFER_DEST_RING_CONST(obj) G_TYPE_CHECK_INSTANCE_CAST((obj), xfer_dest_ring_get_type(), XferDestRing const)
+#define XFER_DEST_RING_CLASS(klass) G_TYPE_CHECK_CLASS_CAST((klass), xfer_dest_ring_get_type(), XferDestRingClass)
+#define IS_XFER_DEST_RING(obj) G_TYPE_CHECK_INSTANCE_TYPE((obj), xfer_dest_ring_get_type ())
+#define XFER_DEST_RING_GET_CLASS(obj) G_TYPE_INSTANCE_GET_CLASS((obj), xfer_dest_ring_get_type(), XferDestRingClass)
+
+typedef struct XferDestRing {
+    XferElement __parent__;
+
+    guint64 length;
+    guint64 bytes;
+    gboolean spsc;	/* use the SPSC functions instead of the fields */
+    GThread *thread;
+    simpleprng_state_t prng;
+} XferDestRing;
+
+typedef struct {
+    XferElementClass __parent__;
+} XferDestRingClass;
+
+static gpointer
+dest_ring_thread(
+    gpointer data)
+{
+    XferDestRing *self = XFER_DEST_RING(data);
+    XferElement *elt = XFER_ELEMENT(self);
+    mem_ring_t *mem_ring = xfer_element_get_mem_ring(elt->upstream);
+
+    if (self->spsc)
+	mem_ring_consumer_set_spsc(mem_ring);
+    mem_ring_consumer_set_size(mem_ring, TEST_BLOCK_SIZE*4, TEST_BLOCK_SIZE);
+
+    while (self->spsc) {
+	gboolean eof;
+	uint64_t n = mem_ring_wait_for_data(mem_ring, 1, &eof);
+
+	if (n == 0)
+	    break;
+	n = MIN(n, mem_ring->ring_size - mem_ring->read_offset);
+	if (!simpleprng_verify_buffer(&self->prng,
+				mem_ring->buffer + mem_ring->read_offset, n))
+	    g_critical("data entering XferDestRing does not match");
+	self->bytes += n;
+	mem_ring_consumed(mem_ring, n);
+    }
+
+    g_mutex_lock(mem_ring->mutex);
+    while (!self->spsc) {
+	uint64_t n;
+
+	while (mem_ring->written == mem_ring->readx && !mem_ring->eof_flag)
+	    g_cond_wait(mem_ring->add_cond, mem_ring->mutex);
+	if (mem_ring->written == mem_ring->readx)
+	    break;
+
+	n = MIN(mem_ring->written - mem_ring->readx,
+		mem_ring->ring_size - mem_ring->read_offset);
+	g_mutex_unlock(mem_ring->mutex);
+
+	if (!simpleprng_verify_buffer(&self->prng,
+				mem_ring->buffer + mem_ring->read_offset, n))
+	    g_critical("data entering XferDestRing does not match");
+	self->bytes += n;
+
+	g_mutex_lock(mem_ring->mutex);
+	mem_ring->readx += n;
+	mem_ring->read_offset += n;
+	if (mem_ring->read_offset == mem_ring->ring_size)
+	    mem_ring->read_offset = 0;
+	g_cond_broadcast(mem_ring->free_cond);
+    }
+    g_mutex_unlock(mem_ring->mutex);
+
+    g_assert(self->bytes == self->length);
+
+    xfer_queue_message(elt->xfer, xmsg_new(elt, XMSG_DONE, 0));
+
+    return NULL;
+}
+
+static gboolean
+dest_ring_start_impl(
+    XferElement *elt)
+{
+    XferDestRing *self = XFER_DEST_RING(elt);
+
+    simpleprng_seed(&self->prng, RANDOM_SEED);
+    self->thread = g_thread_create(dest_ring_thread, (gpointer)self, FALSE, NULL);
+
+    return TRUE;
+}
+
+static void
+dest_ring_class_init(
+    XferDestRingClass * klass)
+{
+    XferElementClass *xec = XFER_ELEMENT_CLASS(klass);
+    static xfer_element_mech_pair_t mech_pairs[] = {
+	{ XFER_MECH_MEM_RING, XFER_MECH_NONE, XFER_NROPS(1), XFER_NTHREADS(1), XFER_NALLOC(0) },
+	{ XFER_MECH_NONE, XFER_MECH_NONE, XFER_NROPS(0), XFER_NTHREADS(0), XFER_NALLOC(0) },
+    };
+
+    xec->start = dest_ring_start_impl;
+    xec->mech_pairs = mech_pairs;
+}
+
+GType
+xfer_dest_ring_get_type (void)
+{
+    static GType type = 0;
+
+    if (G_UNLIKELY(type == 0)) {
+        static const GTypeInfo info = {
+            sizeof (XferDestRingClass),
+            (GBaseInitFunc) NULL,
+            (GBaseFinalizeFunc) NULL,
+            (GClassInitFunc) dest_ring_class_init,
+            (GClassFinalizeFunc) NULL,
+            NULL /* class_data */,
+            sizeof (XferDestRing),
+            0 /* n_preallocs */,
+            (GInstanceInitFunc) NULL,
+            NULL
+        };
+
+        type = g_type_register_static (XFER_ELEMENT_TYPE, "XferDestRing", &info, 0);
+    }
+
+    return type;
+}
+
 /* LISTEN */
 
 static GType xfer_dest_listen_get_type(void);
@@ -1492,110 +1633,246 @@ test_xfer_simple(void)
 }
 
 /****
- * Run a transfer between two files, with or without filters
+ * Read a pipe into a MEM_RING through glue, with a consumer that uses the
+ * single-producer/single-consumer functions
  */
 
 static int
-test_xfer_files(gboolean add_filters)
+test_xfer_mem_ring_spsc(void)
 {
     unsigned int i;
-    unsigned int elts;
     GSource *src;
-    char *in_filename = __FILE__;
-    char *out_filename = "xfer-test.tmp"; /* current directory is writeable */
-    int rfd, wfd;
+    XferElement *elements[2];
     Xfer *xfer;
-    XferElement *elements[4];
-
-    rfd = open(in_filename, O_RDONLY, 0);
-    if (rfd < 0) {
-	g_critical("Could not open '%s': %s", in_filename, strerror(errno));
-	exit(1);
-    }
-
-    wfd = open(out_filename, O_WRONLY|O_CREAT, 0777);
-    if (wfd < 0) {
-	g_critical("Could not open '%s': %s", out_filename, strerror(errno));
-	exit(1);
-    }
 
-    elts = 0;
-    elements[elts++] = xfer_source_fd(rfd);
-    if (add_filters) {
-	elements[elts++] = xfer_filter_xor(0xab);
-	elements[elts++] = xfer_filter_xor(0xab);
-    }
-    elements[elts++] = xfer_dest_fd(wfd);
+    elements[0] = (XferElement *)g_object_new(XFER_SOURCE_READFD_TYPE, NULL);
+    elements[1] = (XferElement *)g_object_new(XFER_DEST_RING_TYPE, NULL);
+    XFER_DEST_RING(elements[1])->length = TEST_XFER_SIZE;
+    XFER_DEST_RING(elements[1])->spsc = TRUE;
 
-    xfer = xfer_new(elements, elts);
+    xfer = xfer_new(elements, G_N_ELEMENTS(elements));
     src = xfer_get_source(xfer);
     g_source_set_callback(src, (GSourceFunc)test_xfer_generic_callback, NULL, NULL);
     g_source_attach(src, NULL);
     tu_dbg("Transfer: %s\n", xfer_repr(xfer));
 
-    /* unreference the elements */
-    for (i = 0; i < elts; i++) {
+    for (i = 0; i < G_N_ELEMENTS(elements); i++)
 	g_object_unref(elements[i]);
-	g_assert(G_OBJECT(elements[i])->ref_count == 1);
-	elements[i] = NULL;
-    }
 
     xfer_start(xfer, 0, 0);
 
     g_main_loop_run(default_main_loop());
     g_assert(xfer->status == XFER_DONE);
 
-    if (fcntl(rfd, F_GETFD) == -1) {
-	fprintf(stderr,"rfd is already closed\n");
-	exit(1);
-    }
-    if (fcntl(wfd, F_GETFD) == -1) {
-	fprintf(stderr,"wfd is already closed\n");
-	exit(1);
-    }
-    close(rfd);
-    close(wfd);
     xfer_unref(xfer);
 
-    unlink(out_filename); /* ignore any errors */
-
     return 1;
 }
 
+/****
+ * Check that the buffer pool recycles reserved buffers, and is not confused
+ * by buffers it did not allocate
+ */
+
 static int
-test_xfer_files_simple(void)
+test_xfer_buffer_pool(void)
 {
-    return test_xfer_files(FALSE);
+    XferElement *elements[2] = {
+	xfer_source_random(0, RANDOM_SEED),
+	xfer_dest_null(0),
+    };
+    Xfer *xfer = xfer_new(elements, G_N_ELEMENTS(elements));
+    gpointer buf1, buf2;
+    int rv = 1;
+
+    g_object_unref(elements[0]);
+    g_object_unref(elements[1]);
+
+    xfer_reserve_buffers(xfer, 65536, 1, FALSE);
+
+    buf1 = xfer_get_buffer(xfer, 65536);
+#ifdef HAVE_POSIX_MEMALIGN
+    if (((uintptr_t)buf1) % 4096 != 0) {
+	tu_dbg("pool buffer %p is not page-aligned\n", buf1);
+	rv = 0;
+    }
+#endif
+    xfer_release_buffer(xfer, buf1);
+    buf2 = xfer_get_buffer(xfer, 65536);
+    if (buf2 != buf1) {
+	tu_dbg("pool buffer was not reused\n");
+	rv = 0;
+    }
+    xfer_release_buffer(xfer, buf2);
+
+    /* an unreserved size comes from g_malloc, and is g_free'd */
+    buf1 = xfer_get_buffer(xfer, 1000);
+    xfer_release_buffer(xfer, buf1);
+    xfer_release_buffer(xfer, g_malloc(65536));
+
+    xfer_unref(xfer);
+
+    return rv;
+}
+
+/****
+ * Check that XMSG_STATS accounts for the data passing through each element
+ */
+
+static XferElement *stats_elts[3];
+static guint64 stats_in[3], stats_out[3];
+
+static void
+test_xfer_stats_callback(
+    gpointer data G_GNUC_UNUSED,
+    XMsg *msg,
+    Xfer *xfer)
+{
+    int i;
+
+    if (msg->type == XMSG_STATS) {
+	tu_dbg("%s: in %ju out %ju wait-up %f wait-down %f busy %f\n",
+	       xfer_element_repr(msg->elt), (uintmax_t)msg->bytes_in,
+	       (uintmax_t)msg->bytes_out, msg->wait_upstream,
+	       msg->wait_downstream, msg->busy);
+	for (i = 0; i < 3; i++) {
+	    if (msg->elt == stats_elts[i]) {
+		stats_in[i] = msg->bytes_in;
+		stats_out[i] = msg->bytes_out;
+	    }
+	}
+    }
+
+    test_xfer_generic_callback(data, msg, xfer);
 }
 
 static int
-test_xfer_files_filter(void)
+test_xfer_stats(void)
 {
-    return test_xfer_files(TRUE);
+    unsigned int i;
+    GSource *src;
+    guint64 length = 1024*1024;
+    XferElement *elements[] = {
+	xfer_source_random(length, RANDOM_SEED),
+	xfer_filter_xor('d'),
+	xfer_dest_null(0),
+    };
+    Xfer *xfer = xfer_new(elements, G_N_ELEMENTS(elements));
+    int rv = 1;
+
+    src = xfer_get_source(xfer);
+    g_source_set_callback(src, (GSourceFunc)test_xfer_stats_callback, NULL, NULL);
+    g_source_attach(src, NULL);
+    xfer_set_stats_interval(xfer, 1);
+
+    for (i = 0; i < G_N_ELEMENTS(elements); i++) {
+	stats_elts[i] = elements[i];
+	stats_in[i] = stats_out[i] = G_MAXUINT64;
+	g_object_unref(elements[i]);
+	elements[i] = NULL;
+    }
+
+    xfer_start(xfer, 0, 0);
+
+    g_main_loop_run(default_main_loop());
+    g_assert(xfer->status == XFER_DONE);
+
+    if (stats_in[0] != 0 || stats_out[0] != length) {
+	tu_dbg("source stats are wrong\n");
+	rv = 0;
+    }
+    if (stats_in[1] != length || stats_out[1] != length) {
+	tu_dbg("filter stats are wrong\n");
+	rv = 0;
+    }
+    if (stats_in[2] != length || stats_out[2] != 0) {
+	tu_dbg("destination stats are wrong\n");
+	rv = 0;
+    }
+
+    xfer_unref(xfer);
+
+    return rv;
 }
 
-/*****
- * test each possible combination of source and destination mechansim
+/****
+ * Check that batched delivery coalesces and drops messages as flagged
  */
 
+static int batch_updates, batch_chatter, batch_kept, batch_oversize;
+static char *batch_last_update;
+
+static void
+test_xfer_batching_callback(
+    gpointer data,
+    XMsg **msgs,
+    guint nmsgs,
+    Xfer *xfer)
+{
+    guint i;
+
+    if (nmsgs == 0 || nmsgs > XMSG_BATCH_SIZE)
+	batch_oversize++;
+
+    for (i = 0; i < nmsgs; i++) {
+	XMsg *msg = msgs[i];
+
+	if (msg->type == XMSG_INFO && msg->message) {
+	    if (g_str_has_prefix(msg->message, "update ")) {
+		batch_updates++;
+		g_free(batch_last_update);
+		batch_last_update = g_strdup(msg->message);
+	    } else if (strcmp(msg->message, "chatter") == 0) {
+		batch_chatter++;
+	    } else if (strcmp(msg->message, "keep") == 0) {
+		batch_kept++;
+	    }
+	}
+
+	test_xfer_generic_callback(data, msg, xfer);
+    }
+}
+
 static int
-test_glue_combo(
-    XferElement *source,
-    XferElement *dest)
+test_xfer_batching(void)
 {
     unsigned int i;
     GSource *src;
-    XferElement *elements[] = { source, dest };
-
+    XMsg *msg;
+    XferElement *elements[] = {
+	xfer_source_random(100*1024, RANDOM_SEED),
+	xfer_dest_null(0),
+    };
     Xfer *xfer = xfer_new(elements, G_N_ELEMENTS(elements));
+    int rv = 1;
+
     src = xfer_get_source(xfer);
-    g_source_set_callback(src, (GSourceFunc)test_xfer_generic_callback, NULL, NULL);
+    xfer_set_message_batching(xfer, TRUE);
+    g_source_set_callback(src, (GSourceFunc)test_xfer_batching_callback, NULL, NULL);
     g_source_attach(src, NULL);
 
-    /* unreference the elements */
+    batch_updates = batch_chatter = batch_kept = batch_oversize = 0;
+    batch_last_update = NULL;
+
+    /* queue everything before the main loop gets a chance to dispatch */
+    for (i = 0; i < 10; i++) {
+	msg = xmsg_new(elements[0], XMSG_INFO, 0);
+	msg->message = g_strdup_printf("update %u", i);
+	msg->flags |= XMSG_FLAG_COALESCE;
+	xfer_queue_message(xfer, msg);
+    }
+    for (i = 0; i < XMSG_DROP_BACKLOG + 10; i++) {
+	msg = xmsg_new(elements[1], XMSG_INFO, 0);
+	msg->message = g_strdup("chatter");
+	msg->flags |= XMSG_FLAG_DROPPABLE;
+	xfer_queue_message(xfer, msg);
+    }
+    msg = xmsg_new(elements[1], XMSG_INFO, 0);
+    msg->message = g_strdup("keep");
+    xfer_queue_message(xfer, msg);
+
     for (i = 0; i < G_N_ELEMENTS(elements); i++) {
 	g_object_unref(elements[i]);
-	g_assert(G_OBJECT(elements[i])->ref_count == 1);
 	elements[i] = NULL;
     }
 
@@ -1604,44 +1881,887 @@ test_glue_combo(
     g_main_loop_run(default_main_loop());
     g_assert(xfer->status == XFER_DONE);
 
+    if (batch_updates != 1 || !batch_last_update
+		|| strcmp(batch_last_update, "update 9") != 0) {
+	tu_dbg("got %d updates, last '%s'; expected only 'update 9'\n",
+	       batch_updates, batch_last_update? batch_last_update : "(none)");
+	rv = 0;
+    }
+    if (batch_chatter != 0) {
+	tu_dbg("got %d droppable messages; expected none\n", batch_chatter);
+	rv = 0;
+    }
+    if (batch_kept != 1) {
+	tu_dbg("got %d unflagged messages; expected one\n", batch_kept);
+	rv = 0;
+    }
+    if (batch_oversize) {
+	tu_dbg("got %d batches of the wrong size\n", batch_oversize);
+	rv = 0;
+    }
+
+    g_free(batch_last_update);
+    batch_last_update = NULL;
     xfer_unref(xfer);
 
-    return 1;
+    return rv;
 }
 
-#define make_test_glue(n, s, d) static int n(void) \
-{\
-    return test_glue_combo((XferElement *)g_object_new(s, NULL), \
-			   (XferElement *)g_object_new(d, NULL)); \
+/****
+ * Check that the glue between a crc filter and an fd destination reports the
+ * filter's crc without computing it, unless asked to verify it
+ */
+
+static XferElement *crc_elts[2];
+static crc_t crc_seen[2];
+
+static void
+test_xfer_crc_passthrough_callback(
+    gpointer data G_GNUC_UNUSED,
+    XMsg *msg,
+    Xfer *xfer)
+{
+    int i;
+
+    if (msg->type == XMSG_CRC) {
+	for (i = 0; i < 2; i++) {
+	    if (msg->elt == crc_elts[i]) {
+		crc_seen[i].crc = msg->crc;
+		crc_seen[i].size = msg->size;
+	    }
+	}
+    }
+
+    test_xfer_generic_callback(data, msg, xfer);
 }
-make_test_glue(test_glue_READFD_READFD, XFER_SOURCE_READFD_TYPE, XFER_DEST_READFD_TYPE)
-make_test_glue(test_glue_READFD_WRITEFD, XFER_SOURCE_READFD_TYPE, XFER_DEST_WRITEFD_TYPE)
-make_test_glue(test_glue_READFD_PUSH, XFER_SOURCE_READFD_TYPE, XFER_DEST_PUSH_TYPE)
-make_test_glue(test_glue_READFD_PULL, XFER_SOURCE_READFD_TYPE, XFER_DEST_PULL_TYPE)
-make_test_glue(test_glue_READFD_LISTEN, XFER_SOURCE_READFD_TYPE, XFER_DEST_LISTEN_TYPE)
-make_test_glue(test_glue_READFD_CONNECT, XFER_SOURCE_READFD_TYPE, XFER_DEST_CONNECT_TYPE)
-make_test_glue(test_glue_WRITEFD_READFD, XFER_SOURCE_WRITEFD_TYPE, XFER_DEST_READFD_TYPE)
-make_test_glue(test_glue_WRITEFD_WRITEFD, XFER_SOURCE_WRITEFD_TYPE, XFER_DEST_WRITEFD_TYPE)
-make_test_glue(test_glue_WRITEFD_PUSH, XFER_SOURCE_WRITEFD_TYPE, XFER_DEST_PUSH_TYPE)
-make_test_glue(test_glue_WRITEFD_PULL, XFER_SOURCE_WRITEFD_TYPE, XFER_DEST_PULL_TYPE)
-make_test_glue(test_glue_WRITEFD_LISTEN, XFER_SOURCE_WRITEFD_TYPE, XFER_DEST_LISTEN_TYPE)
-make_test_glue(test_glue_WRITEFD_CONNECT, XFER_SOURCE_WRITEFD_TYPE, XFER_DEST_CONNECT_TYPE)
-make_test_glue(test_glue_PUSH_READFD, XFER_SOURCE_PUSH_TYPE, XFER_DEST_READFD_TYPE)
-make_test_glue(test_glue_PUSH_WRITEFD, XFER_SOURCE_PUSH_TYPE, XFER_DEST_WRITEFD_TYPE)
-make_test_glue(test_glue_PUSH_PUSH, XFER_SOURCE_PUSH_TYPE, XFER_DEST_PUSH_TYPE)
-make_test_glue(test_glue_PUSH_PULL, XFER_SOURCE_PUSH_TYPE, XFER_DEST_PULL_TYPE)
-make_test_glue(test_glue_PUSH_LISTEN, XFER_SOURCE_PUSH_TYPE, XFER_DEST_LISTEN_TYPE)
-make_test_glue(test_glue_PUSH_CONNECT, XFER_SOURCE_PUSH_TYPE, XFER_DEST_CONNECT_TYPE)
-make_test_glue(test_glue_PULL_READFD, XFER_SOURCE_PULL_TYPE, XFER_DEST_READFD_TYPE)
-make_test_glue(test_glue_PULL_WRITEFD, XFER_SOURCE_PULL_TYPE, XFER_DEST_WRITEFD_TYPE)
-make_test_glue(test_glue_PULL_PUSH, XFER_SOURCE_PULL_TYPE, XFER_DEST_PUSH_TYPE)
-make_test_glue(test_glue_PULL_PULL, XFER_SOURCE_PULL_TYPE, XFER_DEST_PULL_TYPE)
-make_test_glue(test_glue_PULL_LISTEN, XFER_SOURCE_PULL_TYPE, XFER_DEST_LISTEN_TYPE)
-make_test_glue(test_glue_PULL_CONNECT, XFER_SOURCE_PULL_TYPE, XFER_DEST_CONNECT_TYPE)
-make_test_glue(test_glue_LISTEN_READFD, XFER_SOURCE_LISTEN_TYPE, XFER_DEST_READFD_TYPE)
-make_test_glue(test_glue_LISTEN_WRITEFD, XFER_SOURCE_LISTEN_TYPE, XFER_DEST_WRITEFD_TYPE)
-make_test_glue(test_glue_LISTEN_PUSH, XFER_SOURCE_LISTEN_TYPE, XFER_DEST_PUSH_TYPE)
-make_test_glue(test_glue_LISTEN_PULL, XFER_SOURCE_LISTEN_TYPE, XFER_DEST_PULL_TYPE)
+
+static int
+test_xfer_crc_passthrough(void)
+{
+    unsigned int i;
+    int verify;
+    guint64 length = 1024*1024 + 13;
+    int rv = 1;
+
+    for (verify = 0; verify <= 1; verify++) {
+	GSource *src;
+	int fd = open("/dev/null", O_WRONLY);
+	XferElement *elements[] = {
+	    xfer_source_random(length, RANDOM_SEED),
+	    xfer_filter_crc(),
+	    xfer_dest_fd(fd),
+	};
+	Xfer *xfer = xfer_new(elements, G_N_ELEMENTS(elements));
+	XferElement *glue;
+
+	close(fd);
+	src = xfer_get_source(xfer);
+	g_source_set_callback(src, (GSourceFunc)test_xfer_crc_passthrough_callback, NULL, NULL);
+	g_source_attach(src, NULL);
+	xfer_set_verify_crc(xfer, verify);
+
+	crc_elts[0] = elements[1];
+	crc_elts[1] = elements[2];
+	for (i = 0; i < 2; i++) {
+	    crc_seen[i].crc = 0;
+	    crc_seen[i].size = 0;
+	}
+	for (i = 0; i < G_N_ELEMENTS(elements); i++) {
+	    g_object_unref(elements[i]);
+	    elements[i] = NULL;
+	}
+
+	xfer_start(xfer, 0, 0);
+
+	/* the filter cannot write to an fd, so glue follows it */
+	glue = crc_elts[0]->downstream;
+	if (glue->reuse_upstream_crc == verify) {
+	    tu_dbg("glue %s the upstream crc\n", verify? "reused" : "did not reuse");
+	    rv = 0;
+	}
+
+	g_main_loop_run(default_main_loop());
+	g_assert(xfer->status == XFER_DONE);
+
+	if (crc_seen[0].size != length || crc_seen[1].size != length ||
+	    crc_seen[0].crc != crc_seen[1].crc) {
+	    tu_dbg("crcs differ: %08x:%ju %08x:%ju\n",
+		   crc_seen[0].crc, (uintmax_t)crc_seen[0].size,
+		   crc_seen[1].crc, (uintmax_t)crc_seen[1].size);
+	    rv = 0;
+	}
+
+	xfer_unref(xfer);
+    }
+
+    return rv;
+}
+
+/****
+ * Check that a calibration file changes the linkage costs, and that a
+ * transfer still links with measured costs
+ */
+
+static int
+test_xfer_costs(void)
+{
+    char *filename = "xfer-test-costs.tmp"; /* current directory is writeable */
+    xfer_element_mech_pair_t pipe_pair = {
+	XFER_MECH_READFD, XFER_MECH_PULL_BUFFER,
+	XFER_NROPS(1), XFER_NTHREADS(1), XFER_NALLOC(1) };
+    xfer_element_mech_pair_t buffer_pair = {
+	XFER_MECH_PUSH_BUFFER, XFER_MECH_PUSH_BUFFER,
+	XFER_NROPS(1), XFER_NTHREADS(0), XFER_NALLOC(0) };
+    XferElement *elements[3];
+    Xfer *xfer;
+    GSource *src;
+    FILE *f;
+    char *errmsg;
+    unsigned int i;
+    int rv = 1;
+
+    f = fopen(filename, "w");
+    g_assert(f != NULL);
+    fprintf(f, "# test costs\ncopy 10\nalloc 5\nthread 20\nREADFD 100\n"
+	       "PUSH_BUFFER 0\nPULL_BUFFER 0\n");
+    fclose(f);
+
+    if ((errmsg = xfer_load_costs(filename))) {
+	tu_dbg("xfer_load_costs: %s\n", errmsg);
+	g_free(errmsg);
+	unlink(filename);
+	return 0;
+    }
+    unlink(filename);
+
+    /* 10 + 5 + 20 + 100 + 0, plus the 3-point tie-break */
+    if (xfer_pair_cost(&pipe_pair) != 138) {
+	tu_dbg("pipe pair cost is %d\n", xfer_pair_cost(&pipe_pair));
+	rv = 0;
+    }
+    if (xfer_pair_cost(&buffer_pair) != 11) {
+	tu_dbg("buffer pair cost is %d\n", xfer_pair_cost(&buffer_pair));
+	rv = 0;
+    }
+
+    elements[0] = xfer_source_random(1024*1024, RANDOM_SEED);
+    elements[1] = xfer_filter_xor('c');
+    elements[2] = xfer_dest_null(0);
+    xfer = xfer_new(elements, G_N_ELEMENTS(elements));
+    for (i = 0; i < G_N_ELEMENTS(elements); i++)
+	g_object_unref(elements[i]);
+
+    src = xfer_get_source(xfer);
+    g_source_set_callback(src, (GSourceFunc)test_xfer_generic_callback, NULL, NULL);
+    g_source_attach(src, NULL);
+
+    xfer_start(xfer, 0, 0);
+
+    g_main_loop_run(default_main_loop());
+    g_assert(xfer->status == XFER_DONE);
+
+    xfer_unref(xfer);
+
+    /* go back to the static weights for the remaining tests */
+    g_assert(xfer_load_costs(NULL) == NULL);
+    if (xfer_pair_cost(&buffer_pair) == 11) {
+	tu_dbg("static costs were not restored\n");
+	rv = 0;
+    }
+
+    return rv;
+}
+
+/****
+ * Run a transfer between two files, with or without filters
+ */
+
+static int
+test_xfer_files(gboolean add_filters)
+{
+    unsigned int i;
+    unsigned int elts;
+    GSource *src;
+    char *in_filename = __FILE__;
+    char *out_filename = "xfer-test.tmp"; /* current directory is writeable */
+    int rfd, wfd;
+    Xfer *xfer;
+    XferElement *elements[4];
+
+    rfd = open(in_filename, O_RDONLY, 0);
+    if (rfd < 0) {
+	g_critical("Could not open '%s': %s", in_filename, strerror(errno));
+	exit(1);
+    }
+
+    wfd = open(out_filename, O_WRONLY|O_CREAT, 0777);
+    if (wfd < 0) {
+	g_critical("Could not open '%s': %s", out_filename, strerror(errno));
+	exit(1);
+    }
+
+    elts = 0;
+    elements[elts++] = xfer_source_fd(rfd);
+    if (add_filters) {
+	elements[elts++] = xfer_filter_xor(0xab);
+	elements[elts++] = xfer_filter_xor(0xab);
+    }
+    elements[elts++] = xfer_dest_fd(wfd);
+
+    xfer = xfer_new(elements, elts);
+    src = xfer_get_source(xfer);
+    g_source_set_callback(src, (GSourceFunc)test_xfer_generic_callback, NULL, NULL);
+    g_source_attach(src, NULL);
+    tu_dbg("Transfer: %s\n", xfer_repr(xfer));
+
+    /* unreference the elements */
+    for (i = 0; i < elts; i++) {
+	g_object_unref(elements[i]);
+	g_assert(G_OBJECT(elements[i])->ref_count == 1);
+	elements[i] = NULL;
+    }
+
+    xfer_start(xfer, 0, 0);
+
+    g_main_loop_run(default_main_loop());
+    g_assert(xfer->status == XFER_DONE);
+
+    if (fcntl(rfd, F_GETFD) == -1) {
+	fprintf(stderr,"rfd is already closed\n");
+	exit(1);
+    }
+    if (fcntl(wfd, F_GETFD) == -1) {
+	fprintf(stderr,"wfd is already closed\n");
+	exit(1);
+    }
+    close(rfd);
+    close(wfd);
+    xfer_unref(xfer);
+
+    unlink(out_filename); /* ignore any errors */
+
+    return 1;
+}
+
+static int
+test_xfer_files_simple(void)
+{
+    return test_xfer_files(FALSE);
+}
+
+static int
+test_xfer_files_filter(void)
+{
+    return test_xfer_files(TRUE);
+}
+
+/****
+ * Compress a file in-process and check that the output is a gzip stream
+ */
+
+static int
+test_xfer_compress(void)
+{
+    unsigned int i;
+    GSource *src;
+    char *in_filename = __FILE__;
+    char *out_filename = "xfer-test.tmp"; /* current directory is writeable */
+    unsigned char magic[2];
+    int rfd, wfd;
+    Xfer *xfer;
+    XferElement *elements[3];
+
+    if (!xfer_filter_compress_supported("gzip")) {
+	tu_dbg("gzip compression not supported; skipping\n");
+	return 1;
+    }
+
+    rfd = open(in_filename, O_RDONLY, 0);
+    if (rfd < 0) {
+	g_critical("Could not open '%s': %s", in_filename, strerror(errno));
+	exit(1);
+    }
+
+    wfd = open(out_filename, O_WRONLY|O_CREAT|O_TRUNC, 0777);
+    if (wfd < 0) {
+	g_critical("Could not open '%s': %s", out_filename, strerror(errno));
+	exit(1);
+    }
+
+    elements[0] = xfer_source_fd(rfd);
+    elements[1] = xfer_filter_compress("gzip", AMCOMPRESS_LEVEL_BEST, 0);
+    elements[2] = xfer_dest_fd(wfd);
+
+    xfer = xfer_new(elements, G_N_ELEMENTS(elements));
+    src = xfer_get_source(xfer);
+    g_source_set_callback(src, (GSourceFunc)test_xfer_generic_callback, NULL, NULL);
+    g_source_attach(src, NULL);
+    tu_dbg("Transfer: %s\n", xfer_repr(xfer));
+
+    /* unreference the elements */
+    for (i = 0; i < G_N_ELEMENTS(elements); i++) {
+	g_object_unref(elements[i]);
+	g_assert(G_OBJECT(elements[i])->ref_count == 1);
+	elements[i] = NULL;
+    }
+
+    xfer_start(xfer, 0, 0);
+
+    g_main_loop_run(default_main_loop());
+    g_assert(xfer->status == XFER_DONE);
+
+    close(rfd);
+    close(wfd);
+    xfer_unref(xfer);
+
+    rfd = open(out_filename, O_RDONLY, 0);
+    if (rfd < 0 || read(rfd, magic, 2) != 2) {
+	g_critical("Could not read '%s'", out_filename);
+	exit(1);
+    }
+    close(rfd);
+    unlink(out_filename); /* ignore any errors */
+
+    if (magic[0] != 0x1f || magic[1] != 0x8b) {
+	tu_dbg("output is not a gzip stream\n");
+	return 0;
+    }
+
+    return 1;
+}
+
+/****
+ * Compress several blocks' worth of a pattern with worker threads, and check
+ * that the concatenated gzip members decompress to the input, in order
+ */
+
+#ifdef HAVE_LIBZ
+static int
+test_xfer_compress_threads(void)
+{
+    unsigned int i;
+    GSource *src;
+    Xfer *xfer;
+    XferElement *elements[3];
+    char pattern[] = "0123456789abcdefghijklmnopqrstuvwxyz!";
+    guint64 length = 5*1024*1024 + 12345;
+    gpointer buf;
+    gsize size;
+    z_stream strm;
+    unsigned char out[65536];
+    guint64 pos = 0;
+    int r = Z_OK;
+
+    elements[0] = xfer_source_pattern(length, pattern, sizeof(pattern)-1);
+    elements[1] = xfer_filter_compress("gzip", AMCOMPRESS_LEVEL_FAST, 4);
+    elements[2] = xfer_dest_buffer(0);
+
+    xfer = xfer_new(elements, G_N_ELEMENTS(elements));
+    src = xfer_get_source(xfer);
+    g_source_set_callback(src, (GSourceFunc)test_xfer_generic_callback, NULL, NULL);
+    g_source_attach(src, NULL);
+    tu_dbg("Transfer: %s\n", xfer_repr(xfer));
+
+    xfer_start(xfer, 0, 0);
+
+    g_main_loop_run(default_main_loop());
+    g_assert(xfer->status == XFER_DONE);
+
+    xfer_dest_buffer_get(elements[2], &buf, &size);
+
+    memset(&strm, 0, sizeof(strm));
+    /* 16+MAX_WBITS: expect a gzip header */
+    g_assert(inflateInit2(&strm, 16 + MAX_WBITS) == Z_OK);
+    strm.next_in = buf;
+    strm.avail_in = size;
+    while (strm.avail_in > 0) {
+	strm.next_out = out;
+	strm.avail_out = sizeof(out);
+	r = inflate(&strm, Z_NO_FLUSH);
+	if (r != Z_OK && r != Z_STREAM_END) {
+	    tu_dbg("inflate failed at output byte %llu: %d\n", (unsigned long long)pos, r);
+	    break;
+	}
+	for (i = 0; i < sizeof(out) - strm.avail_out; i++, pos++) {
+	    if (out[i] != (unsigned char)pattern[pos % (sizeof(pattern)-1)]) {
+		tu_dbg("output differs at byte %llu\n", (unsigned long long)pos);
+		r = Z_DATA_ERROR;
+		break;
+	    }
+	}
+	if (r == Z_DATA_ERROR)
+	    break;
+	/* the next block is a new gzip member */
+	if (r == Z_STREAM_END)
+	    inflateReset(&strm);
+    }
+    inflateEnd(&strm);
+
+    for (i = 0; i < G_N_ELEMENTS(elements); i++)
+	g_object_unref(elements[i]);
+    xfer_unref(xfer);
+
+    if (r != Z_STREAM_END)
+	return 0;
+    if (pos != length) {
+	tu_dbg("got %llu bytes; expected %llu\n", (unsigned long long)pos, (unsigned long long)length);
+	return 0;
+    }
+
+    return 1;
+}
+#endif
+
+/****
+ * Encrypt and decrypt random data, checking that it survives the round trip
+ */
+
+static gboolean encrypt_xfer_failed;
+
+static void
+test_xfer_encrypt_callback(
+    gpointer data,
+    XMsg *msg,
+    Xfer *xfer)
+{
+    if (msg->type == XMSG_ERROR) {
+	tu_dbg("Error: %s\n", msg->message);
+	encrypt_xfer_failed = TRUE;
+    }
+    test_xfer_generic_callback(data, msg, xfer);
+}
+
+static int
+test_xfer_encrypt(void)
+{
+    unsigned int i;
+    GSource *src;
+    char *key_filename = "xfer-test.key"; /* current directory is writeable */
+    char *key = "000102030405060708090a0b0c0d0e0f"
+		"101112131415161718191a1b1c1d1e1f\n";
+    Xfer *xfer;
+    XferElement *elements[4];
+
+    if (!xfer_filter_encrypt_supported()) {
+	tu_dbg("AES-GCM encryption not supported; skipping\n");
+	return 1;
+    }
+
+    if (!g_file_set_contents(key_filename, key, -1, NULL)) {
+	g_critical("Could not write '%s'", key_filename);
+	exit(1);
+    }
+
+    /* several records, processed by different numbers of threads */
+    elements[0] = xfer_source_random(3*1024*1024 + 17, RANDOM_SEED);
+    elements[1] = xfer_filter_encrypt(key_filename, FALSE, 4);
+    elements[2] = xfer_filter_encrypt(key_filename, TRUE, 2);
+    elements[3] = xfer_dest_null(RANDOM_SEED);
+
+    encrypt_xfer_failed = FALSE;
+    xfer = xfer_new(elements, G_N_ELEMENTS(elements));
+    src = xfer_get_source(xfer);
+    g_source_set_callback(src, (GSourceFunc)test_xfer_encrypt_callback, NULL, NULL);
+    g_source_attach(src, NULL);
+    tu_dbg("Transfer: %s\n", xfer_repr(xfer));
+
+    /* unreference the elements */
+    for (i = 0; i < G_N_ELEMENTS(elements); i++) {
+	g_object_unref(elements[i]);
+	g_assert(G_OBJECT(elements[i])->ref_count == 1);
+	elements[i] = NULL;
+    }
+
+    xfer_start(xfer, 0, 0);
+
+    g_main_loop_run(default_main_loop());
+    g_assert(xfer->status == XFER_DONE);
+
+    xfer_unref(xfer);
+    unlink(key_filename); /* ignore any errors */
+
+    return !encrypt_xfer_failed;
+}
+
+/****
+ * Decrypt a stream encrypted by amgcm_stream_*, as the dumper does
+ */
+
+static int
+test_xfer_encrypt_stream(void)
+{
+    unsigned int i;
+    GSource *src;
+    char *key_filename = "xfer-test.key";
+    char *enc_filename = "xfer-test.enc";
+    char *key_hex = "000102030405060708090a0b0c0d0e0f"
+		    "101112131415161718191a1b1c1d1e1f\n";
+    char pattern[] = "0123456789abcdefghijklmnopqrstuvwxyz!";
+    gsize length = 3*AMGCM_DEFAULT_RECORD_SIZE/2 + 11;
+    guint8 key[AMGCM_KEY_SIZE];
+    amgcm_stream_t *stream;
+    GString *plain = g_string_new(NULL);
+    GString *enc = g_string_new(NULL);
+    char *errmsg = NULL;
+    char *out;
+    gsize out_len, pos;
+    gpointer buf;
+    gsize size;
+    Xfer *xfer;
+    XferElement *elements[3];
+    int fd;
+    gboolean ok;
+
+    if (!xfer_filter_encrypt_supported()) {
+	tu_dbg("AES-GCM encryption not supported; skipping\n");
+	return 1;
+    }
+
+    if (!g_file_set_contents(key_filename, key_hex, -1, NULL) ||
+	!amgcm_load_key(key_filename, key, &errmsg)) {
+	g_critical("Could not write '%s'", key_filename);
+	exit(1);
+    }
+
+    for (pos = 0; pos < length; pos++)
+	g_string_append_c(plain, pattern[pos % (sizeof(pattern)-1)]);
+
+    /* feed it in odd-sized pieces */
+    stream = amgcm_stream_new(key, AMGCM_DEFAULT_RECORD_SIZE, &errmsg);
+    g_assert(stream != NULL);
+    for (pos = 0; pos < length; pos += 65537) {
+	out = amgcm_stream_update(stream, plain->str + pos,
+				  MIN(65537, length - pos), &out_len);
+	g_assert(out != NULL);
+	g_string_append_len(enc, out, out_len);
+    }
+    out = amgcm_stream_finish(stream, &out_len);
+    g_assert(out != NULL);
+    g_string_append_len(enc, out, out_len);
+    amgcm_stream_free(stream);
+
+    if (!g_file_set_contents(enc_filename, enc->str, enc->len, NULL)) {
+	g_critical("Could not write '%s'", enc_filename);
+	exit(1);
+    }
+    fd = open(enc_filename, O_RDONLY);
+    g_assert(fd >= 0);
+
+    elements[0] = xfer_source_fd(fd);
+    elements[1] = xfer_filter_encrypt(key_filename, TRUE, 2);
+    elements[2] = xfer_dest_buffer(0);
+
+    encrypt_xfer_failed = FALSE;
+    xfer = xfer_new(elements, G_N_ELEMENTS(elements));
+    src = xfer_get_source(xfer);
+    g_source_set_callback(src, (GSourceFunc)test_xfer_encrypt_callback, NULL, NULL);
+    g_source_attach(src, NULL);
+    tu_dbg("Transfer: %s\n", xfer_repr(xfer));
+
+    xfer_start(xfer, 0, 0);
+
+    g_main_loop_run(default_main_loop());
+    g_assert(xfer->status == XFER_DONE);
+
+    xfer_dest_buffer_get(elements[2], &buf, &size);
+    ok = !encrypt_xfer_failed && size == length &&
+	 memcmp(buf, plain->str, length) == 0;
+    if (!ok)
+	tu_dbg("decrypted %zu bytes, expected %zu\n", size, length);
+
+    for (i = 0; i < G_N_ELEMENTS(elements); i++)
+	g_object_unref(elements[i]);
+    xfer_unref(xfer);
+    close(fd);
+    unlink(key_filename); /* ignore any errors */
+    unlink(enc_filename);
+    g_string_free(plain, TRUE);
+    g_string_free(enc, TRUE);
+
+    return ok;
+}
+
+/****
+ * Keep some ranges of a pattern, two of them adjacent and the last one
+ * open-ended, and check the bytes that come out
+ */
+
+static int
+test_xfer_range(void)
+{
+    static const struct { guint64 start; gint64 length; } ranges[] = {
+	{ 10, 100 }, { 110, 50 }, { 70000, 1 }, { 200000, -1 },
+    };
+    unsigned int i;
+    GSource *src;
+    Xfer *xfer;
+    XferElement *elements[3];
+    char pattern[] = "0123456789abcdefghijklmnopqrstuvwxyz!";
+    guint64 length = 300000;
+    gpointer buf;
+    gsize size, expected_size = 0;
+    char *p;
+    int ret = 1;
+
+    elements[0] = xfer_source_pattern(length, pattern, sizeof(pattern)-1);
+    elements[1] = xfer_filter_range();
+    elements[2] = xfer_dest_buffer(0);
+    for (i = 0; i < G_N_ELEMENTS(ranges); i++)
+	xfer_filter_range_add(elements[1], ranges[i].start, ranges[i].length);
+
+    xfer = xfer_new(elements, G_N_ELEMENTS(elements));
+    src = xfer_get_source(xfer);
+    g_source_set_callback(src, (GSourceFunc)test_xfer_generic_callback, NULL, NULL);
+    g_source_attach(src, NULL);
+    tu_dbg("Transfer: %s\n", xfer_repr(xfer));
+
+    xfer_start(xfer, 0, 0);
+
+    g_main_loop_run(default_main_loop());
+    g_assert(xfer->status == XFER_DONE);
+
+    xfer_dest_buffer_get(elements[2], &buf, &size);
+    p = buf;
+    for (i = 0; i < G_N_ELEMENTS(ranges); i++) {
+	guint64 n = ranges[i].length < 0 ? length - ranges[i].start
+					 : (guint64)ranges[i].length;
+	guint64 j;
+
+	for (j = 0; j < n && expected_size + j < size; j++) {
+	    if (p[expected_size + j] !=
+		pattern[(ranges[i].start + j) % (sizeof(pattern)-1)]) {
+		tu_dbg("range %u differs at byte %llu\n", i, (unsigned long long)j);
+		ret = 0;
+		break;
+	    }
+	}
+	expected_size += n;
+    }
+    if (size != expected_size) {
+	tu_dbg("got %zu bytes; expected %zu\n", size, expected_size);
+	ret = 0;
+    }
+
+    for (i = 0; i < G_N_ELEMENTS(elements); i++)
+	g_object_unref(elements[i]);
+    xfer_unref(xfer);
+
+    return ret;
+}
+
+/****
+ * Send data between two transfers over a multi-connection DirectTCP stream,
+ * with glue at both ends
+ */
+
+static int directtcp_mux_xfers_running;
+static gboolean directtcp_mux_error;
+
+static void
+test_xfer_directtcp_mux_callback(
+    gpointer data G_GNUC_UNUSED,
+    XMsg *msg,
+    Xfer *xfer)
+{
+    tu_dbg("Received message %s\n", xmsg_repr(msg));
+
+    switch (msg->type) {
+	case XMSG_ERROR:
+	    directtcp_mux_error = TRUE;
+	    break;
+
+	case XMSG_DONE:
+	    if (xfer->status == XFER_DONE &&
+		--directtcp_mux_xfers_running == 0)
+		g_main_loop_quit(default_main_loop());
+	    break;
+
+	default:
+	    break;
+    }
+}
+
+static int
+test_xfer_directtcp_mux(void)
+{
+    unsigned int i;
+    GSource *src;
+    Xfer *sender, *receiver;
+    XferElement *send_elements[2], *recv_elements[2];
+    guint64 length = 5*1024*1024 + 1234;
+
+    send_elements[0] = xfer_source_random(length, RANDOM_SEED);
+    send_elements[1] = xfer_dest_directtcp_listen();
+    xfer_element_set_directtcp_streams(send_elements[1], 4);
+
+    sender = xfer_new(send_elements, G_N_ELEMENTS(send_elements));
+    src = xfer_get_source(sender);
+    g_source_set_callback(src, (GSourceFunc)test_xfer_directtcp_mux_callback, NULL, NULL);
+    g_source_attach(src, NULL);
+    tu_dbg("Transfer: %s\n", xfer_repr(sender));
+
+    directtcp_mux_xfers_running = 2;
+    directtcp_mux_error = FALSE;
+
+    /* once started, the sender's glue is listening */
+    xfer_start(sender, 0, 0);
+
+    recv_elements[0] = xfer_source_directtcp_connect(
+				send_elements[1]->output_listen_addrs);
+    xfer_element_set_directtcp_streams(recv_elements[0], 4);
+    recv_elements[1] = xfer_dest_null(RANDOM_SEED);
+
+    receiver = xfer_new(recv_elements, G_N_ELEMENTS(recv_elements));
+    src = xfer_get_source(receiver);
+    g_source_set_callback(src, (GSourceFunc)test_xfer_directtcp_mux_callback, NULL, NULL);
+    g_source_attach(src, NULL);
+    tu_dbg("Transfer: %s\n", xfer_repr(receiver));
+
+    for (i = 0; i < 2; i++) {
+	g_object_unref(send_elements[i]);
+	g_object_unref(recv_elements[i]);
+    }
+
+    xfer_start(receiver, 0, 0);
+
+    g_main_loop_run(default_main_loop());
+    g_assert(sender->status == XFER_DONE);
+    g_assert(receiver->status == XFER_DONE);
+
+    xfer_unref(receiver);
+    xfer_unref(sender);
+
+    return !directtcp_mux_error;
+}
+
+/****
+ * Cancel a transfer whose glue is blocked reading an fd that never has data;
+ * the cancellation token must wake it, long before the fd is closed
+ */
+
+static gboolean
+test_xfer_cancel_timeout(
+    gpointer data)
+{
+    xfer_cancel((Xfer *)data);
+    return FALSE;
+}
+
+static int
+test_xfer_cancel(void)
+{
+    unsigned int i;
+    GSource *src;
+    int p[2];
+    time_t start;
+    int rv = 1;
+    XferElement *elements[2];
+    Xfer *xfer;
+
+    if (pipe(p) == -1) {
+	tu_dbg("pipe: %s\n", strerror(errno));
+	return 0;
+    }
+    elements[0] = xfer_source_fd(p[0]);
+    elements[1] = xfer_dest_null(0);
+
+    xfer = xfer_new(elements, G_N_ELEMENTS(elements));
+    src = xfer_get_source(xfer);
+    g_source_set_callback(src, (GSourceFunc)test_xfer_generic_callback, NULL, NULL);
+    g_source_attach(src, NULL);
+
+    for (i = 0; i < G_N_ELEMENTS(elements); i++) {
+	g_object_unref(elements[i]);
+	elements[i] = NULL;
+    }
+
+    start = time(NULL);
+    xfer_start(xfer, 0, 0);
+    g_timeout_add(500, test_xfer_cancel_timeout, xfer);
+
+    /* the write end stays open, so only the cancellation ends the read */
+    g_main_loop_run(default_main_loop());
+    g_assert(xfer->status == XFER_DONE);
+    if (time(NULL) - start > 5) {
+	tu_dbg("the cancellation took %d seconds\n", (int)(time(NULL) - start));
+	rv = 0;
+    }
+
+    xfer_unref(xfer);
+    close(p[0]);
+    close(p[1]);
+
+    return rv;
+}
+
+/*****
+ * test each possible combination of source and destination mechansim
+ */
+
+static int
+test_glue_combo(
+    XferElement *source,
+    XferElement *dest)
+{
+    unsigned int i;
+    GSource *src;
+    XferElement *elements[] = { source, dest };
+
+    Xfer *xfer = xfer_new(elements, G_N_ELEMENTS(elements));
+    src = xfer_get_source(xfer);
+    g_source_set_callback(src, (GSourceFunc)test_xfer_generic_callback, NULL, NULL);
+    g_source_attach(src, NULL);
+
+    /* unreference the elements */
+    for (i = 0; i < G_N_ELEMENTS(elements); i++) {
+	g_object_unref(elements[i]);
+	g_assert(G_OBJECT(elements[i])->ref_count == 1);
+	elements[i] = NULL;
+    }
+
+    xfer_start(xfer, 0, 0);
+
+    g_main_loop_run(default_main_loop());
+    g_assert(xfer->status == XFER_DONE);
+
+    xfer_unref(xfer);
+
+    return 1;
+}
+
+#define make_test_glue(n, s, d) static int n(void) \
+{\
+    return test_glue_combo((XferElement *)g_object_new(s, NULL), \
+			   (XferElement *)g_object_new(d, NULL)); \
+}
+make_test_glue(test_glue_READFD_READFD, XFER_SOURCE_READFD_TYPE, XFER_DEST_READFD_TYPE)
+make_test_glue(test_glue_READFD_WRITEFD, XFER_SOURCE_READFD_TYPE, XFER_DEST_WRITEFD_TYPE)
+make_test_glue(test_glue_READFD_PUSH, XFER_SOURCE_READFD_TYPE, XFER_DEST_PUSH_TYPE)
+make_test_glue(test_glue_READFD_PULL, XFER_SOURCE_READFD_TYPE, XFER_DEST_PULL_TYPE)
+make_test_glue(test_glue_READFD_LISTEN, XFER_SOURCE_READFD_TYPE, XFER_DEST_LISTEN_TYPE)
+make_test_glue(test_glue_READFD_CONNECT, XFER_SOURCE_READFD_TYPE, XFER_DEST_CONNECT_TYPE)
+make_test_glue(test_glue_WRITEFD_READFD, XFER_SOURCE_WRITEFD_TYPE, XFER_DEST_READFD_TYPE)
+make_test_glue(test_glue_WRITEFD_WRITEFD, XFER_SOURCE_WRITEFD_TYPE, XFER_DEST_WRITEFD_TYPE)
+make_test_glue(test_glue_WRITEFD_PUSH, XFER_SOURCE_WRITEFD_TYPE, XFER_DEST_PUSH_TYPE)
+make_test_glue(test_glue_WRITEFD_PULL, XFER_SOURCE_WRITEFD_TYPE, XFER_DEST_PULL_TYPE)
+make_test_glue(test_glue_WRITEFD_LISTEN, XFER_SOURCE_WRITEFD_TYPE, XFER_DEST_LISTEN_TYPE)
+make_test_glue(test_glue_WRITEFD_CONNECT, XFER_SOURCE_WRITEFD_TYPE, XFER_DEST_CONNECT_TYPE)
+make_test_glue(test_glue_PUSH_READFD, XFER_SOURCE_PUSH_TYPE, XFER_DEST_READFD_TYPE)
+make_test_glue(test_glue_PUSH_WRITEFD, XFER_SOURCE_PUSH_TYPE, XFER_DEST_WRITEFD_TYPE)
+make_test_glue(test_glue_PUSH_PUSH, XFER_SOURCE_PUSH_TYPE, XFER_DEST_PUSH_TYPE)
+make_test_glue(test_glue_PUSH_PULL, XFER_SOURCE_PUSH_TYPE, XFER_DEST_PULL_TYPE)
+make_test_glue(test_glue_PUSH_LISTEN, XFER_SOURCE_PUSH_TYPE, XFER_DEST_LISTEN_TYPE)
+make_test_glue(test_glue_PUSH_CONNECT, XFER_SOURCE_PUSH_TYPE, XFER_DEST_CONNECT_TYPE)
+make_test_glue(test_glue_PULL_READFD, XFER_SOURCE_PULL_TYPE, XFER_DEST_READFD_TYPE)
+make_test_glue(test_glue_PULL_WRITEFD, XFER_SOURCE_PULL_TYPE, XFER_DEST_WRITEFD_TYPE)
+make_test_glue(test_glue_PULL_PUSH, XFER_SOURCE_PULL_TYPE, XFER_DEST_PUSH_TYPE)
+make_test_glue(test_glue_PULL_PULL, XFER_SOURCE_PULL_TYPE, XFER_DEST_PULL_TYPE)
+make_test_glue(test_glue_PULL_LISTEN, XFER_SOURCE_PULL_TYPE, XFER_DEST_LISTEN_TYPE)
+make_test_glue(test_glue_PULL_CONNECT, XFER_SOURCE_PULL_TYPE, XFER_DEST_CONNECT_TYPE)
+make_test_glue(test_glue_LISTEN_READFD, XFER_SOURCE_LISTEN_TYPE, XFER_DEST_READFD_TYPE)
+make_test_glue(test_glue_LISTEN_WRITEFD, XFER_SOURCE_LISTEN_TYPE, XFER_DEST_WRITEFD_TYPE)
+make_test_glue(test_glue_LISTEN_PUSH, XFER_SOURCE_LISTEN_TYPE, XFER_DEST_PUSH_TYPE)
+make_test_glue(test_glue_LISTEN_PULL, XFER_SOURCE_LISTEN_TYPE, XFER_DEST_PULL_TYPE)
 make_test_glue(test_glue_LISTEN_LISTEN, XFER_SOURCE_LISTEN_TYPE, XFER_DEST_LISTEN_TYPE)
 make_test_glue(test_glue_LISTEN_CONNECT, XFER_SOURCE_LISTEN_TYPE, XFER_DEST_CONNECT_TYPE)
 make_test_glue(test_glue_CONNECT_READFD, XFER_SOURCE_CONNECT_TYPE, XFER_DEST_READFD_TYPE)
@@ -1651,6 +2771,63 @@ make_test_glue(test_glue_CONNECT_PULL, XFER_SOURCE_CONNECT_TYPE, XFER_DEST_PULL_
 make_test_glue(test_glue_CONNECT_LISTEN, XFER_SOURCE_CONNECT_TYPE, XFER_DEST_LISTEN_TYPE)
 make_test_glue(test_glue_CONNECT_CONNECT, XFER_SOURCE_CONNECT_TYPE, XFER_DEST_CONNECT_TYPE)
 
+/****
+ * Check that consecutive transfers reuse the element threads and the pooled
+ * buffers of the previous ones
+ */
+
+static int
+test_xfer_reuse(void)
+{
+    XferElement *elements[2];
+    Xfer *xfer;
+    gpointer buf1, buf2;
+    guint nthreads = 0;
+    int i, rv = 1;
+
+    /* the glue between READFD and WRITEFD needs a thread */
+    for (i = 0; i < 3; i++) {
+	test_glue_combo((XferElement *)g_object_new(XFER_SOURCE_READFD_TYPE, NULL),
+			(XferElement *)g_object_new(XFER_DEST_WRITEFD_TYPE, NULL));
+	/* let the joined thread go back to the executor */
+	g_usleep(100000);
+	if (i == 0) {
+	    nthreads = amexec_get_nthreads();
+	} else if (amexec_get_nthreads() > nthreads) {
+	    tu_dbg("transfer %d started %u more threads\n", i,
+		   amexec_get_nthreads() - nthreads);
+	    rv = 0;
+	}
+    }
+
+    /* a buffer of a freed transfer is reserved by the next one */
+    elements[0] = xfer_source_random(0, RANDOM_SEED);
+    elements[1] = xfer_dest_null(0);
+    xfer = xfer_new(elements, G_N_ELEMENTS(elements));
+    g_object_unref(elements[0]);
+    g_object_unref(elements[1]);
+    xfer_reserve_buffers(xfer, 3*65536, 1, FALSE);
+    buf1 = xfer_get_buffer(xfer, 3*65536);
+    xfer_release_buffer(xfer, buf1);
+    xfer_unref(xfer);
+
+    elements[0] = xfer_source_random(0, RANDOM_SEED);
+    elements[1] = xfer_dest_null(0);
+    xfer = xfer_new(elements, G_N_ELEMENTS(elements));
+    g_object_unref(elements[0]);
+    g_object_unref(elements[1]);
+    xfer_reserve_buffers(xfer, 3*65536, 1, FALSE);
+    buf2 = xfer_get_buffer(xfer, 3*65536);
+    if (buf2 != buf1) {
+	tu_dbg("the buffer of the previous transfer was not reused\n");
+	rv = 0;
+    }
+    xfer_release_buffer(xfer, buf2);
+    xfer_unref(xfer);
+
+    return rv;
+}
+
 /*
  * Main driver
  */
@@ -1660,8 +2837,24 @@ main(int argc, char **argv)
 {
     static TestUtilsTest tests[] = {
 	TU_TEST(test_xfer_simple, 90),
+	TU_TEST(test_xfer_mem_ring_spsc, 90),
+	TU_TEST(test_xfer_buffer_pool, 90),
+	TU_TEST(test_xfer_stats, 90),
+	TU_TEST(test_xfer_batching, 90),
+	TU_TEST(test_xfer_crc_passthrough, 90),
+	TU_TEST(test_xfer_costs, 90),
 	TU_TEST(test_xfer_files_simple, 90),
 	TU_TEST(test_xfer_files_filter, 90),
+	TU_TEST(test_xfer_compress, 90),
+#ifdef HAVE_LIBZ
+	TU_TEST(test_xfer_compress_threads, 90),
+#endif
+	TU_TEST(test_xfer_encrypt, 90),
+	TU_TEST(test_xfer_encrypt_stream, 90),
+	TU_TEST(test_xfer_range, 90),
+	TU_TEST(test_xfer_directtcp_mux, 90),
+	TU_TEST(test_xfer_cancel, 90),
+	TU_TEST(test_xfer_reuse, 90),
         TU_TEST(test_glue_READFD_READFD, 90),
         TU_TEST(test_glue_READFD_WRITEFD, 90),
         TU_TEST(test_glue_READFD_PUSH, 90),
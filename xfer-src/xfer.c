@@ -23,6 +23,13 @@
 #include "amanda.h"
 #include "amxfer.h"
 #include "element-glue.h"
+#include "amprobe.h"
+#include "amexec.h"
+#include <poll.h>
+
+#ifndef ECANCELED
+#define ECANCELED EINTR
+#endif
 
 /* XMsgSource objects are GSource "subclasses" which manage
  * a queue of messages, delivering those messages via callback
@@ -42,6 +49,7 @@ typedef struct XMsgSource {
 static void xfer_set_status(Xfer *xfer, xfer_status status);
 static XMsgSource *xmsgsource_new(Xfer *xfer);
 static void link_elements(Xfer *xfer);
+static XMsg *stats_msg_new(Xfer *xfer, XferElement *elt, gint64 now);
 
 Xfer *
 xfer_new(
@@ -58,6 +66,20 @@ xfer_new(
     xfer->status_mutex = g_mutex_new();
     xfer->status_cond = g_cond_new();
     xfer->fd_mutex = g_mutex_new();
+    xfer->buffer_pool = xfer_buffer_pool_new();
+
+    /* both ends are non-blocking: xfer_cancel must never block, and nothing
+     * ever reads the byte it writes */
+    if (pipe(xfer->cancel_pipe) == -1) {
+	g_warning("cannot create the cancel pipe of a transfer: %s",
+		  strerror(errno));
+	xfer->cancel_pipe[0] = xfer->cancel_pipe[1] = -1;
+    } else {
+	fcntl(xfer->cancel_pipe[0], F_SETFL,
+	      fcntl(xfer->cancel_pipe[0], F_GETFL) | O_NONBLOCK);
+	fcntl(xfer->cancel_pipe[1], F_SETFL,
+	      fcntl(xfer->cancel_pipe[1], F_GETFL) | O_NONBLOCK);
+    }
 
     xfer->refcount = 1;
     xfer->repr = NULL;
@@ -132,6 +154,13 @@ xfer_unref(
     }
     g_ptr_array_free(xfer->elements, TRUE);
 
+    xfer_buffer_pool_free(xfer->buffer_pool);
+
+    if (xfer->cancel_pipe[0] != -1) {
+	close(xfer->cancel_pipe[0]);
+	close(xfer->cancel_pipe[1]);
+    }
+
     if (xfer->repr)
 	g_free(xfer->repr);
 
@@ -157,7 +186,9 @@ xfer_queue_message(
     g_async_queue_push(xfer->queue, (gpointer)msg);
 
     /* TODO: don't do this if we're in the main thread */
-    g_main_context_wakeup(NULL);
+    /* wake the context the messages are read in, which is not always
+     * the default one */
+    g_main_context_wakeup(g_source_get_context((GSource *)xfer->msg_source));
 }
 
 char *
@@ -238,6 +269,29 @@ xfer_start(
 		elt->downstream = g_ptr_array_index(xfer->elements, i+1);
 	}
 
+	/* Pool buffers may only be handed to elements that give them back,
+	 * either directly or by passing them on to an element that does */
+	for (i = len; i >= 1; i--) {
+	    XferElement *elt = g_ptr_array_index(xfer->elements, i-1);
+
+	    elt->accepts_pool_buffers = elt->releases_buffers &&
+		(!elt->forwards_buffers ||
+		 (elt->downstream && elt->downstream->accepts_pool_buffers));
+	}
+
+	/* An element that passes data through unchanged may report the crc
+	 * its upstream neighbor already knows rather than computing it */
+	for (i = 0; i < len; i++) {
+	    XferElement *elt = g_ptr_array_index(xfer->elements, i);
+
+	    elt->reuse_upstream_crc = !xfer->verify_crc &&
+		elt->passes_data_unchanged &&
+		elt->upstream && elt->upstream->output_crc_known;
+	    if (elt->reuse_upstream_crc)
+		g_debug("%s reuses the crc of %s", xfer_element_repr(elt),
+			xfer_element_repr(elt->upstream));
+	}
+
 	/* Set offset and size for first element */
 	{
 	    XferElement *xe = (XferElement *)g_ptr_array_index(xfer->elements, 0);
@@ -257,6 +311,8 @@ xfer_start(
      * certain that the status is still XFER_START and we have not yet been
      * cancelled.  We may have an XMSG_CANCEL already queued up for us, though) */
     xfer_set_status(xfer, XFER_RUNNING);
+    xfer->start_time = xfer_stats_clock();
+    xfer->stats_next = xfer->start_time + (gint64)xfer->stats_interval * G_USEC_PER_SEC;
 
     /* If this transfer involves no active processing, then we consider it to
      * be done already.  We send a "fake" XMSG_DONE from the destination element,
@@ -283,6 +339,32 @@ xfer_set_offset_and_size(
     xfer_element_set_size(xe, size);
 }
 
+void
+xfer_set_stats_interval(
+    Xfer *xfer,
+    guint interval)
+{
+    xfer->stats_interval = interval;
+    xfer->stats_next = xfer_stats_clock() + (gint64)interval * G_USEC_PER_SEC;
+}
+
+void
+xfer_set_verify_crc(
+    Xfer *xfer,
+    gboolean verify)
+{
+    g_assert(xfer->status == XFER_INIT || xfer->status == XFER_DONE);
+    xfer->verify_crc = verify;
+}
+
+void
+xfer_set_message_batching(
+    Xfer *xfer,
+    gboolean batching)
+{
+    xfer->batch_messages = batching;
+}
+
 void
 xfer_cancel(
     Xfer *xfer)
@@ -292,10 +374,73 @@ xfer_cancel(
     XferElement *src;
     if (xfer->cancelled > 0) return;
     xfer->cancelled++;
+
+    /* but wake the threads polling the cancellation token right away */
+    if (xfer->cancel_pipe[1] != -1 && write(xfer->cancel_pipe[1], "C", 1) != 1)
+	g_debug("cannot write to the cancel pipe: %s", strerror(errno));
+
     src = g_ptr_array_index(xfer->elements, 0);
     xfer_queue_message(xfer, xmsg_new(src, XMSG_CANCEL, 0));
 }
 
+int
+xfer_get_cancel_fd(
+    Xfer *xfer)
+{
+    return xfer->cancel_pipe[0];
+}
+
+gsize
+xfer_read_fully(
+    Xfer *xfer,
+    int fd,
+    gpointer buf,
+    gsize count,
+    int *err)
+{
+    struct pollfd fds[2];
+    gsize done = 0;
+    ssize_t len;
+
+    if (!xfer || xfer->cancel_pipe[0] == -1)
+	return read_fully(fd, buf, count, err);
+
+    errno = 0;
+    while (done < count) {
+	fds[0].fd = fd;
+	fds[0].events = POLLIN;
+	fds[0].revents = 0;
+	fds[1].fd = xfer->cancel_pipe[0];
+	fds[1].events = POLLIN;
+	fds[1].revents = 0;
+	if (poll(fds, 2, -1) == -1) {
+	    if (errno == EINTR)
+		continue;
+	    break;
+	}
+	if (fds[1].revents) {
+	    wait_until_xfer_cancelled(xfer);
+	    errno = ECANCELED;
+	    break;
+	}
+
+	len = read(fd, (char *)buf + done, count - done);
+	if (len == 0) {
+	    errno = 0;
+	    break;
+	} else if (len < 0) {
+	    if (errno == EINTR || errno == EAGAIN)
+		continue;
+	    break;
+	}
+	done += len;
+    }
+
+    if (err)
+	*err = (done == count) ? 0 : errno;
+    return done;
+}
+
 static void
 xfer_set_status(
     Xfer *xfer,
@@ -328,6 +473,7 @@ xfer_set_status(
     }
 
     xfer->status = status;
+    AMPROBE2(xfer__status, xfer, status);
     g_cond_broadcast(xfer->status_cond);
     g_mutex_unlock(xfer->status_mutex);
 }
@@ -354,8 +500,7 @@ typedef struct linking_state {
     gint32 best_cost; /* cost for best */
 } linking_state;
 
-/* used for debugging messages */
-static char *
+char *
 xfer_mech_name(
     xfer_mech mech)
 {
@@ -375,14 +520,6 @@ xfer_mech_name(
     }
 }
 
-/* calculate an integer representing the cost of a mech pair as a
- * single integer.  OPS_PER_BYTE is the most important metric,
- * followed by NTHREADS.
- *
- * PAIR will be evaluated multiple times.
- */
-#define PAIR_COST(pair) (((pair).ops_per_byte << 16) + ((pair).nalloc << 8) + (pair).nthreads)
-
 /* maximum cost */
 #define MAX_COST 0xffffff
 
@@ -433,7 +570,7 @@ link_recurse(
 	 my->glue_idx = -1;
 	 link_recurse(st, idx+1,
 		      elt_pairs[my->elt_idx].output_mech,
-		      cost + PAIR_COST(elt_pairs[my->elt_idx]));
+		      cost + xfer_pair_cost(&elt_pairs[my->elt_idx]));
 
 	/* and recurse with glue */
 	for (my->glue_idx = 0;
@@ -447,8 +584,8 @@ link_recurse(
 	     /* and recurse with the glue */
 	     link_recurse(st, idx+1,
 			  glue_pairs[my->glue_idx].output_mech,
-			  cost + PAIR_COST(elt_pairs[my->elt_idx])
-			       + PAIR_COST(glue_pairs[my->glue_idx]));
+			  cost + xfer_pair_cost(&elt_pairs[my->elt_idx])
+			       + xfer_pair_cost(&glue_pairs[my->glue_idx]));
 	}
     }
 }
@@ -544,6 +681,97 @@ link_elements(
     amfree(st.best);
 }
 
+/*
+ * Statistics
+ */
+
+static XMsg *
+stats_msg_new(
+    Xfer *xfer,
+    XferElement *elt,
+    gint64 now)
+{
+    XMsg *msg = xmsg_new(elt, XMSG_STATS, 0);
+    xfer_element_stats_t stats;
+    guint64 elapsed, wait, busy;
+
+    /* only the latest statistics are of any interest */
+    msg->flags |= XMSG_FLAG_COALESCE;
+
+    xfer_element_get_stats(elt, &stats);
+    elapsed = now > xfer->start_time? now - xfer->start_time : 0;
+    wait = stats.wait_upstream + stats.wait_downstream;
+
+    /* elements that are only ever called by their neighbors are busy while
+     * they are called; elements with their own threads are busy from the
+     * start of the transfer.  Either way, time spent waiting on neighbors
+     * doesn't count. */
+    busy = stats.called? stats.called : elapsed;
+    busy = busy > wait? busy - wait : 0;
+
+    msg->bytes_in = stats.bytes_in;
+    msg->bytes_out = stats.bytes_out;
+    msg->wait_upstream = (double)stats.wait_upstream / G_USEC_PER_SEC;
+    msg->wait_downstream = (double)stats.wait_downstream / G_USEC_PER_SEC;
+    msg->busy = (double)busy / G_USEC_PER_SEC;
+    msg->duration = (double)elapsed / G_USEC_PER_SEC;
+
+    return msg;
+}
+
+/* Is an XMSG_STATS due?  If not, and one will be, reduce *TIMEOUT_ to the
+ * number of milliseconds until then. */
+static gboolean
+stats_due(
+    Xfer *xfer,
+    gint *timeout_)
+{
+    gint64 now;
+    gint wait;
+
+    if (!xfer->stats_interval || xfer->status != XFER_RUNNING)
+	return FALSE;
+
+    now = xfer_stats_clock();
+    if (now >= xfer->stats_next)
+	return TRUE;
+
+    if (timeout_) {
+	wait = (xfer->stats_next - now + 999) / 1000;
+	if (*timeout_ < 0 || wait < *timeout_)
+	    *timeout_ = wait;
+    }
+    return FALSE;
+}
+
+static void
+queue_stats(
+    Xfer *xfer)
+{
+    gint64 now = xfer_stats_clock();
+    guint i;
+
+    for (i = 0; i < xfer->elements->len; i++) {
+	XferElement *elt = (XferElement *)g_ptr_array_index(xfer->elements, i);
+	xfer_queue_message(xfer, stats_msg_new(xfer, elt, now));
+    }
+
+    xfer->stats_next = now + (gint64)xfer->stats_interval * G_USEC_PER_SEC;
+}
+
+gint64
+xfer_stats_clock(void)
+{
+#if GLIB_CHECK_VERSION(2,28,0)
+    return g_get_monotonic_time();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (gint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+#endif
+}
+
 /*
  * XMsgSource
  */
@@ -556,7 +784,10 @@ xmsgsource_prepare(
     XMsgSource *xms = (XMsgSource *)source;
 
     *timeout_ = -1;
-    return xms->xfer && g_async_queue_length(xms->xfer->queue) > 0;
+    if (!xms->xfer)
+	return FALSE;
+    return stats_due(xms->xfer, timeout_) ||
+	   g_async_queue_length(xms->xfer->queue) > 0;
 }
 
 static gboolean
@@ -565,7 +796,114 @@ xmsgsource_check(
 {
     XMsgSource *xms = (XMsgSource *)source;
 
-    return xms->xfer && g_async_queue_length(xms->xfer->queue) > 0;
+    if (!xms->xfer)
+	return FALSE;
+    return stats_due(xms->xfer, NULL) ||
+	   g_async_queue_length(xms->xfer->queue) > 0;
+}
+
+/* Messages on their way from the queue to the caller's callback */
+typedef struct xmsg_delivery_s {
+    Xfer *xfer;
+    GSourceFunc callback;
+    gpointer user_data;
+    XMsg *batch[XMSG_BATCH_SIZE];
+    guint nbatch;
+} xmsg_delivery_t;
+
+static void
+deliver_flush(
+    xmsg_delivery_t *dl)
+{
+    XMsgBatchCallback batch_cb = (XMsgBatchCallback)dl->callback;
+    guint i;
+
+    if (!dl->nbatch)
+	return;
+
+    batch_cb(dl->user_data, dl->batch, dl->nbatch, dl->xfer);
+    for (i = 0; i < dl->nbatch; i++)
+	xmsg_free(dl->batch[i]);
+    dl->nbatch = 0;
+}
+
+/* Hand MSG to the caller, taking ownership of it */
+static void
+deliver(
+    xmsg_delivery_t *dl,
+    XMsg *msg)
+{
+    if (!dl->callback) {
+	g_warning("Dropping %s because no callback is set", xmsg_repr(msg));
+	xmsg_free(msg);
+    } else if (!dl->xfer->batch_messages) {
+	((XMsgCallback)dl->callback)(dl->user_data, msg, dl->xfer);
+	xmsg_free(msg);
+    } else {
+	dl->batch[dl->nbatch++] = msg;
+	if (dl->nbatch == XMSG_BATCH_SIZE)
+	    deliver_flush(dl);
+    }
+}
+
+/* Take everything currently on the queue, replacing coalescable messages
+ * with their successors and shedding droppable messages if the caller is
+ * falling behind.  Returns a GPtrArray of messages, in queue order. */
+static GPtrArray *
+drain_queue(
+    Xfer *xfer)
+{
+    GPtrArray *msgs = g_ptr_array_new();
+    GHashTable *seen;
+    XMsg *msg;
+    gboolean shed;
+    guint i, j;
+
+    while ((msg = (XMsg *)g_async_queue_try_pop(xfer->queue)))
+	g_ptr_array_add(msgs, msg);
+
+    if (msgs->len < 2)
+	return msgs;
+
+    shed = msgs->len > XMSG_DROP_BACKLOG;
+    if (shed)
+	g_debug("%s: %u messages waiting; dropping unimportant messages",
+		xfer_repr(xfer), msgs->len);
+
+    /* walk backward, so the latest message of each kind is the one kept;
+     * SEEN maps each element to a bitmask of the types already kept */
+    seen = g_hash_table_new(g_direct_hash, g_direct_equal);
+    for (i = msgs->len; i-- > 0; ) {
+	guint bits, bit;
+
+	msg = (XMsg *)g_ptr_array_index(msgs, i);
+	if (shed && (msg->flags & XMSG_FLAG_DROPPABLE)) {
+	    xmsg_free(msg);
+	    g_ptr_array_index(msgs, i) = NULL;
+	    continue;
+	}
+	if (!(msg->flags & XMSG_FLAG_COALESCE))
+	    continue;
+
+	bit = 1 << msg->type;
+	bits = GPOINTER_TO_UINT(g_hash_table_lookup(seen, msg->elt));
+	if (bits & bit) {
+	    xmsg_free(msg);
+	    g_ptr_array_index(msgs, i) = NULL;
+	} else {
+	    g_hash_table_insert(seen, msg->elt, GUINT_TO_POINTER(bits | bit));
+	}
+    }
+    g_hash_table_destroy(seen);
+
+    /* close up the holes */
+    for (i = j = 0; i < msgs->len; i++) {
+	if (g_ptr_array_index(msgs, i))
+	    g_ptr_array_index(msgs, j++) = g_ptr_array_index(msgs, i);
+    }
+    g_ptr_array_set_size(msgs, j);
+
+    return msgs;
 }
 
 static gboolean
@@ -576,17 +914,38 @@ xmsgsource_dispatch(
 {
     XMsgSource *xms = (XMsgSource *)source;
     Xfer *xfer = xms->xfer;
-    XMsgCallback my_cb = (XMsgCallback)callback;
+    xmsg_delivery_t dl;
+    GPtrArray *msgs;
     XMsg *msg;
     gboolean deliver_to_caller;
-    guint i;
+    guint i, m;
     gboolean xfer_done = FALSE;
 
+    if (!xfer)
+	return TRUE;
+
+    if (stats_due(xfer, NULL))
+	queue_stats(xfer);
+
+    dl.xfer = xfer;
+    dl.callback = callback;
+    dl.user_data = user_data;
+    dl.nbatch = 0;
+
+    /* hold a reference, since the callbacks may drop theirs */
+    xfer_ref(xfer);
+    msgs = drain_queue(xfer);
+
     /* we're potentially calling Perl code within this loop, so we have to
      * check that everything is ok on each iteration of the loop. */
-    while (xfer
-        && xfer->status != XFER_DONE
-        && (msg = (XMsg *)g_async_queue_try_pop(xfer->queue))) {
+    for (m = 0; m < msgs->len && xfer->status != XFER_DONE; m++) {
+	msg = (XMsg *)g_ptr_array_index(msgs, m);
+	g_ptr_array_index(msgs, m) = NULL;
+
+	/* DONE and CANCEL change the transfer's state, so anything queued
+	 * before them must be delivered first */
+	if (msg->type == XMSG_DONE || msg->type == XMSG_CANCEL)
+	    deliver_flush(&dl);
 
 	/* We get first crack at interpreting messages, before calling the
 	 * designated callback. */
@@ -596,6 +955,19 @@ xmsgsource_dispatch(
 	     * the entire transfer is finished. */
 	    case XMSG_DONE:
 		if (--xfer->num_active_elements <= 0) {
+		    /* deliver the final statistics directly, since anything
+		     * queued now would be dropped */
+		    if (xfer->stats_interval && callback) {
+			gint64 now = xfer_stats_clock();
+
+			for (i = 0; i < xfer->elements->len; i++) {
+			    XferElement *elt = (XferElement *)
+				    g_ptr_array_index(xfer->elements, i);
+
+			    deliver(&dl, stats_msg_new(xfer, elt, now));
+			}
+		    }
+
 		    /* mark the transfer as done, and take a note to break out
 		     * of this loop after delivering the message to the user */
 		    xfer_set_status(xfer, XFER_DONE);
@@ -624,6 +996,15 @@ xmsgsource_dispatch(
 			expect_eof = xfer_element_cancel(elt, expect_eof) || expect_eof;
 		    }
 
+		    /* wake whatever blocks on a shared-memory ring; a cancelled
+		     * ring carries no more data */
+		    for (i = 0; i < xfer->elements->len; i++) {
+			XferElement *elt = (XferElement *)
+				g_ptr_array_index(xfer->elements, i);
+			if (elt->shm_ring && !elt->shm_ring->mc->cancelled)
+			    shm_ring_cancel(elt->shm_ring);
+		    }
+
 		    /* if nothing in the transfer can generate an EOF, then we
 		     * can't cancel this transfer, and we'll just have to wait
 		     * until it's finished.  This may happen, for example, if
@@ -641,23 +1022,31 @@ xmsgsource_dispatch(
 		break;  /* nothing interesting to do */
 	}
 
-	if (deliver_to_caller) {
-	    if (my_cb) {
-		my_cb(user_data, msg, xfer);
-	    } else {
-		g_warning("Dropping %s because no callback is set", xmsg_repr(msg));
-	    }
-	}
-
-	xmsg_free(msg);
+	if (deliver_to_caller)
+	    deliver(&dl, msg);
+	else
+	    xmsg_free(msg);
 
-	/* This transfer is done, so kill it and exit the loop */
-	if (xfer_done) {
-	    xfer_unref(xfer);
-	    xfer = NULL;
+	/* This transfer is done, so exit the loop */
+	if (xfer_done)
 	    break;
+    }
+    deliver_flush(&dl);
+
+    /* anything left arrived after the transfer finished */
+    for (; m < msgs->len; m++) {
+	msg = (XMsg *)g_ptr_array_index(msgs, m);
+	if (msg) {
+	    g_debug("Dropping %s because the transfer is done", xmsg_repr(msg));
+	    xmsg_free(msg);
 	}
     }
+    g_ptr_array_free(msgs, TRUE);
+
+    /* This transfer is done, so drop the reference it held on itself */
+    if (xfer_done)
+	xfer_unref(xfer);
+    xfer_unref(xfer);
 
     /* Never automatically un-queue the event source */
     return TRUE;
@@ -760,3 +1149,109 @@ xfer_atomic_swap_fd(Xfer *xfer, gint *fdp, gint newfd)
 
     return rv;
 }
+
+/*
+ * Element threads
+ */
+
+struct XferThread {
+    GThreadFunc func;
+    gpointer data;
+    gboolean joinable;
+
+    /* the rest is only used if joinable */
+    GMutex *mutex;
+    GCond *cond;
+    gboolean done;
+    gpointer result;
+};
+
+static GStaticMutex thread_queue_mutex = G_STATIC_MUTEX_INIT;
+static amexec_queue_t *thread_queue = NULL;
+
+static void
+xfer_thread_job(
+    gpointer data,
+    gpointer user_data G_GNUC_UNUSED)
+{
+    XferThread *thread = data;
+    gpointer result = thread->func(thread->data);
+
+    if (!thread->joinable) {
+	g_free(thread);
+	return;
+    }
+
+    g_mutex_lock(thread->mutex);
+    thread->result = result;
+    thread->done = TRUE;
+    g_cond_broadcast(thread->cond);
+    g_mutex_unlock(thread->mutex);
+}
+
+static XferThread *
+xfer_thread_start(
+    GThreadFunc func,
+    gpointer data,
+    gboolean joinable)
+{
+    XferThread *thread = g_new0(XferThread, 1);
+
+    thread->func = func;
+    thread->data = data;
+    thread->joinable = joinable;
+    if (joinable) {
+	thread->mutex = g_mutex_new();
+	thread->cond = g_cond_new();
+    }
+
+    /* every element thread runs at once: they wait on each other */
+    g_static_mutex_lock(&thread_queue_mutex);
+    if (!thread_queue)
+	thread_queue = amexec_queue_new("xfer", xfer_thread_job, NULL,
+					G_MAXUINT, AMEXEC_PRIORITY_HIGH,
+					AMEXEC_BLOCKING);
+    g_static_mutex_unlock(&thread_queue_mutex);
+
+    amexec_queue_push(thread_queue, thread);
+
+    /* a thread that is not joinable may be freed by now */
+    return joinable? thread : NULL;
+}
+
+XferThread *
+xfer_thread_create(
+    GThreadFunc func,
+    gpointer data)
+{
+    return xfer_thread_start(func, data, TRUE);
+}
+
+gpointer
+xfer_thread_join(
+    XferThread *thread)
+{
+    gpointer result;
+
+    g_assert(thread->joinable);
+
+    g_mutex_lock(thread->mutex);
+    while (!thread->done)
+	g_cond_wait(thread->cond, thread->mutex);
+    result = thread->result;
+    g_mutex_unlock(thread->mutex);
+
+    g_mutex_free(thread->mutex);
+    g_cond_free(thread->cond);
+    g_free(thread);
+
+    return result;
+}
+
+void
+xfer_thread_run(
+    GThreadFunc func,
+    gpointer data)
+{
+    xfer_thread_start(func, data, FALSE);
+}
@@ -51,6 +51,7 @@ typedef enum {
 struct XferElement;
 struct XMsgSource;
 struct XMsg;
+typedef struct XferBufferPool XferBufferPool;
 
 /*
  * "Class" declaration
@@ -93,7 +94,29 @@ typedef struct Xfer {
      * xfer */
     GMutex *fd_mutex;
 
+    /* recycled PUSH_BUFFER/PULL_BUFFER data buffers; see xfer_get_buffer */
+    XferBufferPool *buffer_pool;
+
+    /* XMSG_STATS interval in seconds (0 to disable), time the transfer
+     * started running, and time the next XMSG_STATS is due; times are as
+     * returned by xfer_stats_clock */
+    guint stats_interval;
+    gint64 start_time;
+    gint64 stats_next;
+
+    /* if TRUE, every element computes its own crc; see xfer_set_verify_crc */
+    gboolean verify_crc;
+
+    /* if TRUE, the GSource callback is an XMsgBatchCallback; see
+     * xfer_set_message_batching */
+    gboolean batch_messages;
+
     int cancelled;
+
+    /* the cancellation token: xfer_cancel writes a byte to cancel_pipe[1],
+     * so cancel_pipe[0] is readable from then on; -1 if the pipe could not
+     * be created.  See xfer_get_cancel_fd */
+    int cancel_pipe[2];
 } Xfer;
 
 /* Note that all functions must be called from the main thread unless
@@ -139,6 +162,29 @@ GSource *xfer_get_source(Xfer *xfer);
  */
 typedef void (*XMsgCallback)(gpointer data, struct XMsg *msg, Xfer *xfer);
 
+/* Alternative callback, used when message batching is enabled: up to
+ * XMSG_BATCH_SIZE messages are delivered in one call, in the order they were
+ * queued.  The messages are freed when the callback returns.
+ */
+#define XMSG_BATCH_SIZE 64
+typedef void (*XMsgBatchCallback)(gpointer data, struct XMsg **msgs,
+				  guint nmsgs, Xfer *xfer);
+
+/* Deliver messages in batches, to an XMsgBatchCallback set on the GSource,
+ * rather than one at a time to an XMsgCallback.  This is useful when each
+ * callback is expensive, as it is for perl callbacks.
+ *
+ * Whether or not batching is enabled, messages marked XMSG_FLAG_COALESCE are
+ * replaced by later messages of the same type from the same element that
+ * are already queued, and messages marked XMSG_FLAG_DROPPABLE are discarded
+ * when more than XMSG_DROP_BACKLOG messages are waiting.
+ *
+ * @param xfer: the Xfer object
+ * @param batching: TRUE to deliver messages in batches
+ */
+#define XMSG_DROP_BACKLOG 256
+void xfer_set_message_batching(Xfer *xfer, gboolean batching);
+
 /* Queue a message for delivery via this transfer's GSource.  This can
  * be called in any thread.
  *
@@ -167,6 +213,94 @@ void xfer_start(Xfer *xfer, gint64 offset, gint64 size);
 
 void xfer_set_offset_and_size(Xfer *xfer, gint64 offset, gint64 size);
 
+/* Send an XMSG_STATS for each element every INTERVAL seconds while the
+ * transfer is running, and once more before the final XMSG_DONE.  The default
+ * is not to send XMSG_STATS at all.
+ *
+ * @param xfer: the Xfer object
+ * @param interval: seconds between messages, or 0 to disable them
+ */
+void xfer_set_stats_interval(Xfer *xfer, guint interval);
+
+/* Elements that pass data through unchanged normally report the crc already
+ * computed by their upstream neighbor instead of computing it again.  Setting
+ * VERIFY makes every element compute its own crc, so that the crcs reported
+ * along the transfer check each other.  This must be called before
+ * xfer_start.
+ *
+ * @param xfer: the Xfer object
+ * @param verify: TRUE to compute the crc at every element
+ */
+void xfer_set_verify_crc(Xfer *xfer, gboolean verify);
+
+/* Linkage costs
+ *
+ * When linking elements, the cheapest linkage is chosen based on the costs in
+ * each element's mech pairs.  By default those are static weights; after
+ * xfer_calibrate_costs has been run on a host, they are computed from the
+ * measured cost of copying, allocating, switching threads and moving data
+ * through each mechanism on that host.
+ */
+
+/* Measure the cost of each mechanism on this host, write the results to
+ * FILENAME, and use them for subsequent transfers.  This takes a few seconds.
+ *
+ * @param filename: the calibration file, or NULL for the default
+ * @returns: NULL on success, or an error message to be freed by the caller
+ */
+char *xfer_calibrate_costs(const char *filename);
+
+/* Use the costs from a calibration file for subsequent transfers, instead of
+ * those from the default calibration file.
+ *
+ * @param filename: the calibration file, or NULL to use the static weights
+ * @returns: NULL on success, or an error message to be freed by the caller
+ */
+char *xfer_load_costs(const char *filename);
+
+/* Buffer pool
+ *
+ * Each transfer keeps a pool of page-aligned buffers of the sizes its
+ * elements reserve, so that buffers handed between elements with
+ * XFER_MECH_PUSH_BUFFER and XFER_MECH_PULL_BUFFER can be recycled instead of
+ * allocated and freed for each block.  Elements should normally use
+ * xfer_element_alloc_buffer and xfer_element_free_buffer rather than calling
+ * these directly.  These functions can be called from any thread.
+ */
+
+/* Reserve COUNT buffers of SIZE bytes.  Only reserved sizes are pooled;
+ * call this from an element's setup() method, or once the size is known.
+ *
+ * @param xfer: the Xfer object
+ * @param size: buffer size
+ * @param count: number of buffers to allocate now
+ * @param hugepages: back buffers of 2MiB or more with huge pages, where the
+ *	system supports it
+ */
+void xfer_reserve_buffers(Xfer *xfer, gsize size, guint count,
+			  gboolean hugepages);
+
+/* Get a buffer of SIZE bytes, from the pool if SIZE has been reserved and with
+ * g_malloc otherwise.
+ *
+ * @param xfer: the Xfer object
+ * @param size: buffer size
+ * @returns: the buffer
+ */
+gpointer xfer_get_buffer(Xfer *xfer, gsize size);
+
+/* Return a buffer to the pool; buffers that did not come from the pool are
+ * freed with g_free.
+ *
+ * @param xfer: the Xfer object
+ * @param buf: the buffer, or NULL
+ */
+void xfer_release_buffer(Xfer *xfer, gpointer buf);
+
+/* Create and destroy a pool (for use by xfer.c) */
+XferBufferPool *xfer_buffer_pool_new(void);
+void xfer_buffer_pool_free(XferBufferPool *pool);
+
 /* Abort a running transfer.  This essentially tells the source to stop
  * producing data and allows the remainder of the transfer to "drain".  Thus
  * the transfer will signal its completion "normally" some time after
@@ -188,6 +322,30 @@ void xfer_set_offset_and_size(Xfer *xfer, gint64 offset, gint64 size);
  */
 void xfer_cancel(Xfer *xfer);
 
+/* Return a file descriptor that becomes readable, and stays readable, as soon
+ * as xfer_cancel is called; a blocking wait in an element can poll it with the
+ * fd it waits on, rather than wait until elt->cancelled is noticed.  Do not
+ * read or close it.  This can be called from any thread.
+ *
+ * @param xfer: the Xfer object
+ * @returns: the fd, or -1 if there is none
+ */
+int xfer_get_cancel_fd(Xfer *xfer);
+
+/* read_fully, giving up as soon as the transfer is cancelled.  In that case
+ * the bytes read so far are returned, errno (and *err) is ECANCELED, and the
+ * call returns only once the transfer's status is XFER_CANCELLED, so that
+ * elt->cancelled is set.  Must not be called from the main thread.
+ *
+ * @param xfer: the Xfer object, or NULL to just call read_fully
+ * @param fd: the file descriptor to read from
+ * @param buf: the buffer to read into
+ * @param count: the number of bytes to read
+ * @param err (output): 0 if count bytes were read, otherwise errno
+ * @returns: the number of bytes read
+ */
+gsize xfer_read_fully(Xfer *xfer, int fd, gpointer buf, gsize count, int *err);
+
 /*
  * Utilities
  */
@@ -237,4 +395,45 @@ void xfer_cancel_with_error(struct XferElement *elt, const char *fmt, ...)
  */
 gint xfer_atomic_swap_fd(Xfer *xfer, gint *fdp, gint newfd);
 
+/* Element threads
+ *
+ * The threads of the elements are jobs of the process-wide executor (see
+ * amexec.h), so a process that runs one transfer after another, like the
+ * taper, reuses the same threads instead of creating and joining them for
+ * each transfer.  These functions can be called from any thread.
+ */
+typedef struct XferThread XferThread;
+
+/* Run FUNC(DATA) on an element thread that can be joined, like
+ * g_thread_create(FUNC, DATA, TRUE, NULL).
+ *
+ * @param func: the thread function
+ * @param data: its argument
+ * @returns: the thread, to give to xfer_thread_join
+ */
+XferThread *xfer_thread_create(GThreadFunc func, gpointer data);
+
+/* Wait for the thread to return, and free it.
+ *
+ * @param thread: the thread
+ * @returns: the return value of its function
+ */
+gpointer xfer_thread_join(XferThread *thread);
+
+/* Run FUNC(DATA) on an element thread that is not joined, like
+ * g_thread_create(FUNC, DATA, FALSE, NULL).
+ *
+ * @param func: the thread function
+ * @param data: its argument
+ */
+void xfer_thread_run(GThreadFunc func, gpointer data);
+
+/* Get the time, in microseconds from the monotonic clock, for element
+ * statistics; it does not jump when the wall clock is set.  This can be
+ * called from any thread.
+ *
+ * @returns: the time
+ */
+gint64 xfer_stats_clock(void);
+
 #endif /* XFER_H */
@@ -57,6 +57,7 @@ xmsg_free(
     /* and free any allocated attributes */
     if (msg->repr) g_free(msg->repr);
     if (msg->message) g_free(msg->message);
+    if (msg->digest) g_free(msg->digest);
 
     /* then free the XMsg itself */
     g_free(msg);
@@ -82,6 +83,7 @@ xmsg_repr(
 	    case XMSG_CRC: typ = "CRC"; break;
 	    case XMSG_NO_SPACE: typ = "NO_SPACE"; break;
 	    case XMSG_SEGMENT_DONE: typ = "SEGMENT_DONE"; break;
+	    case XMSG_STATS: typ = "STATS"; break;
 	    default: typ = "**UNKNOWN**"; break;
 	}
 
@@ -96,6 +96,7 @@ typedef enum {
      *		dumpfile; always 0 for XferSourceTaper)
      *  - fileno (the on-media file number used for this part, or 0 if no file
      *		  was used)
+     *  - digest (fixity digest of the part, if the element computes one)
      */
     XMSG_PART_DONE = 5,
 
@@ -117,6 +118,8 @@ typedef enum {
     /* XMSG_CRC:
      *  - crc
      *  - size
+     *  - digest (fixity digest of the whole image, if the element computes
+     *		one)
      */
     XMSG_CRC = 8,
 
@@ -130,8 +133,31 @@ typedef enum {
      */
     XMSG_SEGMENT_DONE = 10,
 
+    /* XMSG_STATS: periodic per-element statistics, sent by the Xfer itself
+     * on behalf of each element when xfer_set_stats_interval is in effect,
+     * and once more just before the final XMSG_DONE.  Attributes:
+     *  - bytes_in (bytes received from upstream)
+     *  - bytes_out (bytes handed downstream)
+     *  - wait_upstream (seconds blocked waiting for upstream)
+     *  - wait_downstream (seconds blocked waiting for downstream)
+     *  - busy (seconds spent in the element's own work)
+     *  - duration (seconds since the transfer started)
+     */
+    XMSG_STATS = 11,
+
 } xmsg_type;
 
+/* Delivery flags.  Progress-type messages, where only the latest one matters,
+ * should be marked COALESCE; messages that can be lost without harm when the
+ * receiver is falling behind should be marked DROPPABLE. */
+
+/* an undelivered message is replaced by a later message of the same type
+ * from the same element */
+#define XMSG_FLAG_COALESCE	(1 << 0)
+
+/* the message may be discarded if too many messages are waiting */
+#define XMSG_FLAG_DROPPABLE	(1 << 1)
+
 /*
  * Class Declaration
  */
@@ -151,6 +177,10 @@ typedef struct XMsg {
     /* internal use only; use xmsg_repr() to get the representation */
     char *repr;
 
+    /* XMSG_FLAG_* bits telling the XMsgSource how the message may be
+     * delivered; set by the sender before the message is queued */
+    int flags;
+
     /* Attributes. Many of these will be zero or null.  See the xmsg_type
      * enumeration for a description of the attributes that are set for each
      * message type.
@@ -208,6 +238,18 @@ typedef struct XMsg {
 
     /* value */
     uint32_t crc;
+
+    /* fixity digest, "sha256:<hex>"; see amdigest.h */
+    char *digest;
+
+    /* bytes received from upstream and handed downstream */
+    guint64 bytes_in;
+    guint64 bytes_out;
+
+    /* time blocked on neighboring elements, and working, in seconds */
+    double wait_upstream;
+    double wait_downstream;
+    double busy;
 } XMsg;
 
 /*